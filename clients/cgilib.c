@@ -22,6 +22,10 @@
 #include <ctype.h>
 #include <stdio.h>
 
+#ifndef WIN32
+#include <sys/socket.h>
+#endif	/* !WIN32 */
+
 #include "cgilib.h"
 #include "parseconf.h"
 
@@ -160,15 +164,35 @@ static void cgilib_err(const char *errmsg)
 	upslogx(LOG_ERR, "Fatal error in parseconf(ups.conf): %s", errmsg);
 }
 
-int checkhost(const char *host, char **desc)
+/* MONITOR entries of hosts.conf, kept while the file does not change */
+typedef struct cgi_host_s {
+	char	*sys;
+	char	*desc;
+	struct cgi_host_s	*next;
+} cgi_host_t;
+
+static cgi_host_t	*hosts = NULL;
+static struct stat	hosts_st;
+
+static void free_hosts(void)
 {
-	char	fn[NUT_PATH_MAX + 1];
-	PCONF_CTX_t	ctx;
+	cgi_host_t	*tmp;
 
-	if (!host)
-		return 0;		/* deny null hostnames */
+	while (hosts) {
+		tmp = hosts->next;
+		free(hosts->sys);
+		free(hosts->desc);
+		free(hosts);
+		hosts = tmp;
+	}
+}
 
-	snprintf(fn, sizeof(fn), "%s/hosts.conf", confpath());
+static void load_hosts(const char *fn)
+{
+	PCONF_CTX_t	ctx;
+	cgi_host_t	*tmp, **last = &hosts;
+
+	free_hosts();
 
 	pconf_init(&ctx, cgilib_err);
 
@@ -176,7 +200,9 @@ int checkhost(const char *host, char **desc)
 		pconf_finish(&ctx);
 		fprintf(stderr, "%s\n", ctx.errmsg);
 
-		return 0;	/* failed: deny access */
+		/* try again with the next request */
+		memset(&hosts_st, 0, sizeof(hosts_st));
+		return;
 	}
 
 	while (pconf_file_next(&ctx)) {
@@ -193,16 +219,878 @@ int checkhost(const char *host, char **desc)
 		if (strcmp(ctx.arglist[0], "MONITOR") != 0)
 			continue;
 
-		if (!strcmp(ctx.arglist[1], host)) {
+		tmp = xcalloc(1, sizeof(*tmp));
+		tmp->sys = xstrdup(ctx.arglist[1]);
+		tmp->desc = xstrdup(ctx.arglist[2]);
+
+		*last = tmp;
+		last = &tmp->next;
+	}
+
+	pconf_finish(&ctx);
+}
+
+int checkhost(const char *host, char **desc)
+{
+	char	fn[NUT_PATH_MAX + 1];
+	cgi_host_t	*tmp;
+
+	if (!host)
+		return 0;		/* deny null hostnames */
+
+	snprintf(fn, sizeof(fn), "%s/hosts.conf", confpath());
+
+	if (cgi_file_changed(fn, &hosts_st))
+		load_hosts(fn);
+
+	for (tmp = hosts; tmp; tmp = tmp->next) {
+		if (!strcmp(tmp->sys, host)) {
 			if (desc)
-				*desc = xstrdup(ctx.arglist[2]);
+				*desc = xstrdup(tmp->desc);
 
-			pconf_finish(&ctx);
 			return 1;	/* found: allow access */
 		}
 	}
 
-	pconf_finish(&ctx);
-
 	return 0;	/* not found: access denied */
 }
+
+int cgi_file_changed(const char *fn, struct stat *last)
+{
+	struct stat	st;
+
+	if (stat(fn, &st) != 0) {
+		memset(last, 0, sizeof(*last));
+		return 1;
+	}
+
+	if ((st.st_mtime == last->st_mtime) && (st.st_size == last->st_size)
+		&& (st.st_ino == last->st_ino) && (st.st_dev == last->st_dev))
+		return 0;
+
+	*last = st;
+	return 1;
+}
+
+/* number of the request being handled, from 1 */
+static unsigned long	reqnum = 0;
+
+#ifndef WIN32
+
+/* FastCGI: the web server (or spawn-fcgi and the like) starts us with a
+ * listening socket as stdin, and sends the requests as records holding
+ * their environment (PARAMS), then their body (STDIN). The output of
+ * each request goes to a temporary file set as stdout, and is sent back
+ * in STDOUT records once the request is done. Requests are taken one at
+ * a time, which we tell the web server when it asks (GET_VALUES), from
+ * whichever of the connections kept open by the web server sends one.
+ */
+#define FCGI_VERSION_1		1
+
+#define FCGI_BEGIN_REQUEST	1
+#define FCGI_ABORT_REQUEST	2
+#define FCGI_END_REQUEST	3
+#define FCGI_PARAMS		4
+#define FCGI_STDIN		5
+#define FCGI_STDOUT		6
+#define FCGI_GET_VALUES		9
+#define FCGI_GET_VALUES_RESULT	10
+#define FCGI_UNKNOWN_TYPE	11
+
+#define FCGI_KEEP_CONN		1
+#define FCGI_RESPONDER		1
+
+#define FCGI_REQUEST_COMPLETE	0
+#define FCGI_CANT_MPX_CONN	1
+#define FCGI_UNKNOWN_ROLE	3
+
+/* 0: not checked yet, 1: FastCGI, -1: plain CGI */
+static int	fcgi_mode = 0;
+
+/* the connection of the current request, and those kept open */
+static int	fcgi_conn = -1, fcgi_keep = 0;
+static int	*fcgi_conns = NULL;
+static size_t	fcgi_numconns = 0, fcgi_next = 0;
+static unsigned int	fcgi_reqid = 0;
+
+/* the PARAMS of the current request, and the names set from them */
+static char	*fcgi_params = NULL;
+static size_t	fcgi_paramlen = 0, fcgi_paramsize = 0;
+static char	**fcgi_envnames = NULL;
+static size_t	fcgi_numenv = 0;
+
+static int fcgi_read(void *buf, size_t len)
+{
+	char	*p = buf;
+	ssize_t	ret;
+
+	while (len > 0) {
+		ret = read(fcgi_conn, p, len);
+
+		if (ret < 0 && errno == EINTR)
+			continue;
+
+		if (ret <= 0)
+			return -1;
+
+		p += ret;
+		len -= (size_t)ret;
+	}
+
+	return 0;
+}
+
+static int fcgi_write(const void *buf, size_t len)
+{
+	const char	*p = buf;
+	ssize_t	ret;
+
+	while (len > 0) {
+		ret = write(fcgi_conn, p, len);
+
+		if (ret < 0 && errno == EINTR)
+			continue;
+
+		if (ret <= 0)
+			return -1;
+
+		p += ret;
+		len -= (size_t)ret;
+	}
+
+	return 0;
+}
+
+static int fcgi_send(int type, unsigned int reqid, const void *data,
+	size_t len)
+{
+	unsigned char	hdr[8];
+
+	hdr[0] = FCGI_VERSION_1;
+	hdr[1] = (unsigned char)type;
+	hdr[2] = (unsigned char)(reqid >> 8);
+	hdr[3] = (unsigned char)reqid;
+	hdr[4] = (unsigned char)(len >> 8);
+	hdr[5] = (unsigned char)len;
+	hdr[6] = 0;
+	hdr[7] = 0;
+
+	if (fcgi_write(hdr, sizeof(hdr)) < 0)
+		return -1;
+
+	if (len > 0 && fcgi_write(data, len) < 0)
+		return -1;
+
+	return 0;
+}
+
+static int fcgi_end(unsigned int reqid, int status, int protostatus)
+{
+	unsigned char	body[8];
+
+	memset(body, 0, sizeof(body));
+	body[0] = (unsigned char)((unsigned int)status >> 24);
+	body[1] = (unsigned char)((unsigned int)status >> 16);
+	body[2] = (unsigned char)((unsigned int)status >> 8);
+	body[3] = (unsigned char)status;
+	body[4] = (unsigned char)protostatus;
+
+	return fcgi_send(FCGI_END_REQUEST, reqid, body, sizeof(body));
+}
+
+static void fcgi_close(void)
+{
+	size_t	i;
+
+	for (i = 0; i < fcgi_numconns; i++) {
+		if (fcgi_conns[i] == fcgi_conn) {
+			fcgi_conns[i] = fcgi_conns[--fcgi_numconns];
+			break;
+		}
+	}
+
+	if (fcgi_conn >= 0)
+		close(fcgi_conn);
+
+	fcgi_conn = -1;
+	fcgi_reqid = 0;
+}
+
+/* length of a name or value in a name-value pair */
+static int fcgi_nvlen(const unsigned char **p, const unsigned char *end,
+	size_t *len)
+{
+	if (*p >= end)
+		return -1;
+
+	if (!(**p & 0x80)) {
+		*len = *(*p)++;
+		return 0;
+	}
+
+	if (end - *p < 4)
+		return -1;
+
+	*len = ((size_t)((*p)[0] & 0x7f) << 24) | ((size_t)(*p)[1] << 16)
+		| ((size_t)(*p)[2] << 8) | (size_t)(*p)[3];
+	*p += 4;
+
+	return 0;
+}
+
+/* walk the name-value pairs in buf, calling fn for each */
+static void fcgi_pairs(const unsigned char *buf, size_t buflen,
+	void (*fn)(const char *name, size_t namelen,
+		const char *val, size_t vallen, void *arg), void *arg)
+{
+	const unsigned char	*p = buf, *end = buf + buflen;
+	size_t	namelen, vallen;
+
+	while (p < end) {
+		if (fcgi_nvlen(&p, end, &namelen) < 0
+			|| fcgi_nvlen(&p, end, &vallen) < 0)
+			return;
+
+		if (namelen > (size_t)(end - p)
+			|| vallen > (size_t)(end - p) - namelen)
+			return;
+
+		fn((const char *)p, namelen, (const char *)p + namelen,
+			vallen, arg);
+
+		p += namelen + vallen;
+	}
+}
+
+static void fcgi_setenv(const char *name, size_t namelen,
+	const char *val, size_t vallen, void *arg)
+{
+	char	*n, *v;
+	NUT_UNUSED_VARIABLE(arg);
+
+	if (namelen == 0 || memchr(name, '=', namelen))
+		return;
+
+	n = xmalloc(namelen + 1);
+	memcpy(n, name, namelen);
+	n[namelen] = '\0';
+
+	v = xmalloc(vallen + 1);
+	memcpy(v, val, vallen);
+	v[vallen] = '\0';
+
+	setenv(n, v, 1);
+	free(v);
+
+	fcgi_envnames = xrealloc(fcgi_envnames,
+		(fcgi_numenv + 1) * sizeof(*fcgi_envnames));
+	fcgi_envnames[fcgi_numenv++] = n;
+}
+
+static void fcgi_value(const char *name, size_t namelen,
+	const char *val, size_t vallen, void *arg)
+{
+	char	*out = arg, buf[SMALLBUF];
+	const char	*res;
+	NUT_UNUSED_VARIABLE(val);
+	NUT_UNUSED_VARIABLE(vallen);
+
+	if (namelen == 14 && !memcmp(name, "FCGI_MAX_CONNS", 14))
+		res = "1";
+	else if (namelen == 13 && !memcmp(name, "FCGI_MAX_REQS", 13))
+		res = "1";
+	else if (namelen == 15 && !memcmp(name, "FCGI_MPXS_CONNS", 15))
+		res = "0";
+	else
+		return;
+
+	/* all of the above are short: one byte lengths */
+	if (strlen(out) + namelen + 4 >= SMALLBUF)
+		return;
+
+	snprintf(buf, sizeof(buf), "%c%c%.*s%s", (char)namelen, 1,
+		(int)namelen, name, res);
+	snprintfcat(out, SMALLBUF, "%s", buf);
+}
+
+/* answer a GET_VALUES management record */
+static int fcgi_get_values(const unsigned char *buf, size_t len)
+{
+	char	out[SMALLBUF];
+
+	out[0] = '\0';
+	fcgi_pairs(buf, len, fcgi_value, out);
+
+	return fcgi_send(FCGI_GET_VALUES_RESULT, 0, out, strlen(out));
+}
+
+/* read records until a request is fully received: returns 0 then, and -1
+ * when the connection is gone */
+static int fcgi_read_request(void)
+{
+	unsigned char	hdr[8], unk[8], *body = NULL;
+	size_t	bodysize = 0, len;
+	unsigned int	reqid;
+	int	type, got_params = 0;
+
+	fcgi_reqid = 0;
+	fcgi_paramlen = 0;
+
+	for (;;) {
+		if (fcgi_read(hdr, sizeof(hdr)) < 0)
+			break;
+
+		type = hdr[1];
+		reqid = ((unsigned int)hdr[2] << 8) | hdr[3];
+		len = ((size_t)hdr[4] << 8) | hdr[5];
+
+		if (len + hdr[6] > bodysize) {
+			bodysize = len + hdr[6];
+			body = xrealloc(body, bodysize);
+		}
+
+		if (len + hdr[6] > 0 && fcgi_read(body, len + hdr[6]) < 0)
+			break;
+
+		if (hdr[0] != FCGI_VERSION_1)
+			break;
+
+		if (reqid == 0) {
+			if (type == FCGI_GET_VALUES) {
+				if (fcgi_get_values(body, len) < 0)
+					break;
+				continue;
+			}
+
+			memset(unk, 0, sizeof(unk));
+			unk[0] = (unsigned char)type;
+
+			if (fcgi_send(FCGI_UNKNOWN_TYPE, 0, unk, sizeof(unk)) < 0)
+				break;
+
+			continue;
+		}
+
+		if (type == FCGI_BEGIN_REQUEST) {
+			if (len < 8)
+				break;
+
+			/* one at a time */
+			if (fcgi_reqid != 0) {
+				if (fcgi_end(reqid, 0, FCGI_CANT_MPX_CONN) < 0)
+					break;
+				continue;
+			}
+
+			if ((((unsigned int)body[0] << 8) | body[1]) != FCGI_RESPONDER) {
+				if (fcgi_end(reqid, 0, FCGI_UNKNOWN_ROLE) < 0)
+					break;
+				continue;
+			}
+
+			fcgi_reqid = reqid;
+			fcgi_keep = (body[2] & FCGI_KEEP_CONN) ? 1 : 0;
+			fcgi_paramlen = 0;
+			got_params = 0;
+			continue;
+		}
+
+		/* not ours, or arriving after we stopped listening */
+		if (reqid != fcgi_reqid)
+			continue;
+
+		if (type == FCGI_ABORT_REQUEST) {
+			fcgi_reqid = 0;
+			if (fcgi_end(reqid, 0, FCGI_REQUEST_COMPLETE) < 0)
+				break;
+			continue;
+		}
+
+		if (type == FCGI_PARAMS) {
+			if (len == 0) {
+				got_params = 1;
+				continue;
+			}
+
+			if (fcgi_paramlen + len > fcgi_paramsize) {
+				fcgi_paramsize = fcgi_paramlen + len;
+				fcgi_params = xrealloc(fcgi_params, fcgi_paramsize);
+			}
+
+			memcpy(fcgi_params + fcgi_paramlen, body, len);
+			fcgi_paramlen += len;
+			continue;
+		}
+
+		/* the body of the request is not used: the end of it means
+		 * that the request is complete */
+		if (type == FCGI_STDIN && len == 0 && got_params) {
+			free(body);
+			return 0;
+		}
+	}
+
+	free(body);
+	fcgi_close();
+	return -1;
+}
+
+/* set the environment for the request, and an empty stdout */
+static void fcgi_setup(void)
+{
+	size_t	i;
+
+	for (i = 0; i < fcgi_numenv; i++) {
+		unsetenv(fcgi_envnames[i]);
+		free(fcgi_envnames[i]);
+	}
+	fcgi_numenv = 0;
+
+	fcgi_pairs((unsigned char *)fcgi_params, fcgi_paramlen,
+		fcgi_setenv, NULL);
+
+	fflush(stdout);
+	if (ftruncate(STDOUT_FILENO, 0) != 0
+		|| fseek(stdout, 0, SEEK_SET) != 0)
+		fatal_with_errno(EXIT_FAILURE, "Can't reset the output");
+}
+
+static int fcgi_accept(void)
+{
+	FILE	*tf;
+
+	if (fcgi_mode == 0) {
+		struct sockaddr_storage	sa;
+		socklen_t	salen = sizeof(sa);
+
+		/* like CGI, FastCGI has stdin connected: to a listening
+		 * socket, with no peer */
+		if (getpeername(STDIN_FILENO, (struct sockaddr *)&sa, &salen) == 0
+			|| errno != ENOTCONN) {
+			fcgi_mode = -1;
+			return -1;
+		}
+
+		fcgi_mode = 1;
+
+		/* the output is gathered there, to be sent once complete */
+		tf = tmpfile();
+		if (!tf || dup2(fileno(tf), STDOUT_FILENO) < 0)
+			fatal_with_errno(EXIT_FAILURE, "Can't create the output file");
+		fclose(tf);
+
+		/* write errors to the web server are handled */
+		signal(SIGPIPE, SIG_IGN);
+	}
+
+	if (fcgi_mode < 0)
+		return -1;
+
+	for (;;) {
+		fd_set	rfds;
+		int	maxfd = STDIN_FILENO, fd;
+		size_t	i, n;
+
+		FD_ZERO(&rfds);
+		FD_SET(STDIN_FILENO, &rfds);
+
+		for (i = 0; i < fcgi_numconns; i++) {
+			FD_SET(fcgi_conns[i], &rfds);
+			if (fcgi_conns[i] > maxfd)
+				maxfd = fcgi_conns[i];
+		}
+
+		if (select(maxfd + 1, &rfds, NULL, NULL, NULL) < 0) {
+			if (errno == EINTR)
+				continue;
+			return 0;
+		}
+
+		/* take turns between the connections */
+		for (n = 0; n < fcgi_numconns; n++) {
+			i = (fcgi_next + n) % fcgi_numconns;
+
+			if (!FD_ISSET(fcgi_conns[i], &rfds))
+				continue;
+
+			fcgi_next = i + 1;
+			fcgi_conn = fcgi_conns[i];
+
+			/* the web server sends a request in one go */
+			if (fcgi_read_request() == 0) {
+				fcgi_setup();
+				return 1;
+			}
+
+			/* closed, and off the list: look again */
+			break;
+		}
+
+		if (n < fcgi_numconns || !FD_ISSET(STDIN_FILENO, &rfds))
+			continue;
+
+		fd = accept(STDIN_FILENO, NULL, NULL);
+
+		if (fd < 0) {
+			if (errno == EINTR || errno == ECONNABORTED
+				|| errno == EAGAIN)
+				continue;
+			return 0;
+		}
+
+		if (fd >= FD_SETSIZE) {
+			close(fd);
+			continue;
+		}
+
+		fcgi_conns = xrealloc(fcgi_conns,
+			(fcgi_numconns + 1) * sizeof(*fcgi_conns));
+		fcgi_conns[fcgi_numconns++] = fd;
+	}
+}
+
+static void fcgi_finish(int status)
+{
+	char	buf[LARGEBUF * 2];
+	off_t	pos = 0, end;
+	ssize_t	ret;
+
+	fflush(stdout);
+	end = lseek(STDOUT_FILENO, 0, SEEK_CUR);
+
+	while (pos < end) {
+		ret = pread(STDOUT_FILENO, buf, sizeof(buf), pos);
+		if (ret <= 0)
+			break;
+
+		if (fcgi_send(FCGI_STDOUT, fcgi_reqid, buf, (size_t)ret) < 0) {
+			fcgi_close();
+			return;
+		}
+
+		pos += ret;
+	}
+
+	if (fcgi_send(FCGI_STDOUT, fcgi_reqid, NULL, 0) < 0
+		|| fcgi_end(fcgi_reqid, status, FCGI_REQUEST_COMPLETE) < 0
+		|| !fcgi_keep) {
+		fcgi_close();
+		return;
+	}
+
+	/* left for the next request on it */
+	fcgi_conn = -1;
+	fcgi_reqid = 0;
+}
+
+#endif	/* !WIN32 */
+
+int cgi_accept(void)
+{
+#ifndef WIN32
+	int	ret = fcgi_accept();
+
+	if (ret >= 0) {
+		if (ret > 0)
+			reqnum++;
+		return ret;
+	}
+#endif	/* !WIN32 */
+
+	/* plain CGI: this one request */
+	if (reqnum > 0)
+		return 0;
+
+	reqnum++;
+	return 1;
+}
+
+void cgi_finish(int status)
+{
+#ifndef WIN32
+	if (fcgi_mode > 0) {
+		fcgi_finish(status);
+		return;
+	}
+#endif	/* !WIN32 */
+
+	NUT_UNUSED_VARIABLE(status);
+	fflush(stdout);
+}
+
+int cgi_persistent(void)
+{
+#ifndef WIN32
+	return (fcgi_mode > 0);
+#else
+	return 0;
+#endif
+}
+
+/* how long, in seconds, the values of a UPS are reused in persistent mode */
+#define CGI_DATA_CACHE	2
+
+/* the variables of one UPS, sorted by name */
+typedef struct cgi_snap_s {
+	char	*upsname;
+	time_t	when;
+	unsigned long	req;		/* request which fetched them */
+	unsigned long	failed;		/* request in which LIST VAR failed */
+	size_t	numvars;
+	char	**names;
+	char	**vals;
+	struct cgi_snap_s	*next;
+} cgi_snap_t;
+
+typedef struct cgi_conn_s {
+	char	*hostname;
+	uint16_t	port;
+	UPSCONN_t	ups;
+	unsigned long	tried;		/* request of the last connection attempt */
+	cgi_snap_t	*snaps;
+	struct cgi_conn_s	*next;
+} cgi_conn_t;
+
+static cgi_conn_t	*conns = NULL;
+
+static void snap_clear(cgi_snap_t *snap)
+{
+	size_t	i;
+
+	for (i = 0; i < snap->numvars; i++) {
+		free(snap->names[i]);
+		free(snap->vals[i]);
+	}
+
+	free(snap->names);
+	free(snap->vals);
+
+	snap->names = snap->vals = NULL;
+	snap->numvars = 0;
+	snap->req = 0;
+}
+
+static void conn_clear(cgi_conn_t *conn)
+{
+	cgi_snap_t	*tmp;
+
+	upscli_disconnect(&conn->ups);
+
+	while (conn->snaps) {
+		tmp = conn->snaps->next;
+		snap_clear(conn->snaps);
+		free(conn->snaps->upsname);
+		free(conn->snaps);
+		conn->snaps = tmp;
+	}
+}
+
+#ifndef WIN32
+/* upsd sends nothing unless asked: data to read on an idle connection
+ * means that it was closed by the server */
+static int conn_closed(UPSCONN_t *ups)
+{
+	fd_set	rfds;
+	struct timeval	tv;
+	int	fd = upscli_fd(ups);
+
+	FD_ZERO(&rfds);
+	FD_SET(fd, &rfds);
+	tv.tv_sec = 0;
+	tv.tv_usec = 0;
+
+	return (select(fd + 1, &rfds, NULL, NULL, &tv) != 0);
+}
+#endif	/* !WIN32 */
+
+UPSCONN_t *cgi_connect(const char *hostname, uint16_t port)
+{
+	cgi_conn_t	*conn;
+
+	for (conn = conns; conn; conn = conn->next)
+		if (conn->port == port && !strcmp(conn->hostname, hostname))
+			break;
+
+	if (!conn) {
+		conn = xcalloc(1, sizeof(*conn));
+		conn->hostname = xstrdup(hostname);
+		conn->port = port;
+		conn->ups.fd = -1;
+		conn->next = conns;
+		conns = conn;
+	}
+
+#ifndef WIN32
+	if (upscli_fd(&conn->ups) != -1 && conn_closed(&conn->ups))
+		conn_clear(conn);
+#endif	/* !WIN32 */
+
+	/* don't keep trying a dead server within one request */
+	if (upscli_fd(&conn->ups) == -1 && conn->tried != reqnum) {
+		conn_clear(conn);
+		conn->tried = reqnum;
+
+		upscli_connect(&conn->ups, hostname, port, UPSCLI_CONN_TRYSSL);
+	}
+
+	return &conn->ups;
+}
+
+static int snap_cmp(const void *a, const void *b)
+{
+	return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+/* fetch all the variables of the UPS: returns 0 if LIST VAR failed */
+static int snap_fetch(UPSCONN_t *ups, cgi_snap_t *snap)
+{
+	size_t	numq, numa, i, j, size = 0;
+	const	char	*query[2];
+	char	**answer, **pairs = NULL;
+	int	ret;
+
+	snap_clear(snap);
+
+	query[0] = "VAR";
+	query[1] = snap->upsname;
+	numq = 2;
+
+	if (upscli_list_start(ups, numq, query) < 0)
+		return 0;
+
+	while ((ret = upscli_list_next(ups, numq, query, &numa, &answer)) == 1) {
+		/* VAR <upsname> <varname> <val> */
+		if (numa < 4)
+			continue;
+
+		if (snap->numvars >= size) {
+			size = size ? size * 2 : 64;
+			pairs = xrealloc(pairs, size * 2 * sizeof(*pairs));
+		}
+
+		pairs[snap->numvars * 2] = xstrdup(answer[2]);
+		pairs[snap->numvars * 2 + 1] = xstrdup(answer[3]);
+		snap->numvars++;
+	}
+
+	/* keep names and values together while sorting */
+	if (snap->numvars > 0)
+		qsort(pairs, snap->numvars, 2 * sizeof(*pairs), snap_cmp);
+
+	snap->names = xcalloc(snap->numvars + 1, sizeof(*snap->names));
+	snap->vals = xcalloc(snap->numvars + 1, sizeof(*snap->vals));
+
+	for (i = 0, j = 0; i < snap->numvars; i++, j += 2) {
+		snap->names[i] = pairs[j];
+		snap->vals[i] = pairs[j + 1];
+	}
+
+	free(pairs);
+
+	if (ret < 0) {
+		snap_clear(snap);
+		return 0;
+	}
+
+	snap->when = time(NULL);
+	snap->req = reqnum;
+	return 1;
+}
+
+int cgi_get_var(UPSCONN_t *ups, const char *upsname, const char *var,
+	char *buf, size_t buflen)
+{
+	cgi_conn_t	*conn;
+	cgi_snap_t	*snap;
+	size_t	lo, hi, mid, numq, numa;
+	const	char	*query[3];
+	char	**answer;
+	int	ret;
+
+	for (conn = conns; conn; conn = conn->next)
+		if (&conn->ups == ups)
+			break;
+
+	snap = NULL;
+
+	if (conn) {
+		for (snap = conn->snaps; snap; snap = snap->next)
+			if (!strcmp(snap->upsname, upsname))
+				break;
+
+		if (!snap) {
+			snap = xcalloc(1, sizeof(*snap));
+			snap->upsname = xstrdup(upsname);
+			snap->next = conn->snaps;
+			conn->snaps = snap;
+		}
+
+		/* fresh enough: fetched during this request, or recently */
+		if (snap->req != reqnum && (!cgi_persistent() || snap->req == 0
+			|| time(NULL) - snap->when >= CGI_DATA_CACHE)) {
+
+			if (snap->failed == reqnum || !snap_fetch(ups, snap)) {
+				snap->failed = reqnum;
+				snap = NULL;
+			}
+		}
+	}
+
+	/* no snapshot: ask for this one (and get the error as it is) */
+	if (!snap) {
+		query[0] = "VAR";
+		query[1] = upsname;
+		query[2] = var;
+		numq = 3;
+
+		ret = upscli_get(ups, numq, query, &numa, &answer);
+
+		if (ret < 0)
+			return ret;
+
+		if (numa < 4) {
+			ups->upserror = UPSCLI_ERR_PROTOCOL;
+			return -1;
+		}
+
+		snprintf(buf, buflen, "%s", answer[3]);
+		return 0;
+	}
+
+	lo = 0;
+	hi = snap->numvars;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		ret = strcmp(snap->names[mid], var);
+
+		if (ret == 0) {
+			snprintf(buf, buflen, "%s", snap->vals[mid]);
+			return 0;
+		}
+
+		if (ret < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	/* what upsd would have said */
+	ups->upserror = UPSCLI_ERR_VARNOTSUPP;
+	return -1;
+}
+
+void cgi_disconnect_all(void)
+{
+	cgi_conn_t	*tmp;
+
+	while (conns) {
+		tmp = conns->next;
+		conn_clear(conns);
+		free(conns->hostname);
+		free(conns);
+		conns = tmp;
+	}
+
+	free_hosts();
+}
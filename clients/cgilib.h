@@ -20,6 +20,9 @@
 #ifndef NUT_CGILIB_H_SEEN
 #define NUT_CGILIB_H_SEEN 1
 
+#include "nut_stdint.h"
+#include "upsclient.h"
+
 #ifdef __cplusplus
 /* *INDENT-OFF* */
 extern "C" {
@@ -38,6 +41,32 @@ void extractpostargs(void);
 /* see if a host is allowed per the hosts.conf */
 int checkhost(const char *host, char **desc);
 
+/* wait for the next request: returns 1 when there is one to handle,
+ * and 0 when done (a CGI run handles one request, a FastCGI one keeps
+ * taking them from the web server until it goes away) */
+int cgi_accept(void);
+
+/* send the output of the request to the web server (FastCGI only) */
+void cgi_finish(int status);
+
+/* see if this process handles more than one request */
+int cgi_persistent(void);
+
+/* see if a file changed since the last call with the same *last */
+int cgi_file_changed(const char *fn, struct stat *last);
+
+/* connect to upsd, reusing a connection kept from an earlier request;
+ * never NULL, check upscli_fd() for the outcome */
+UPSCONN_t *cgi_connect(const char *hostname, uint16_t port);
+
+/* like upscli_get() for VAR <upsname> <var>, served from one LIST VAR
+ * of the UPS, reused for a few seconds in persistent mode */
+int cgi_get_var(UPSCONN_t *ups, const char *upsname, const char *var,
+	char *buf, size_t buflen);
+
+/* drop the connections, at the end of the program */
+void cgi_disconnect_all(void);
+
 #ifdef __cplusplus
 /* *INDENT-OFF* */
 }
@@ -0,0 +1,856 @@
+/* nut-loadgen - synthetic client load on upsd, for benchmarks
+
+   Copyright (C)
+	2026	Network UPS Tools developers
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+/* Each connection plays one kind of client for the whole run: "poll" asks
+ * for ups.status like upsmon does (logged into the UPS with -L), "list"
+ * takes LIST VAR like an exporter, and "set" and "instcmd" make changes as
+ * an authenticated user, following each with GET TRACKING until it is
+ * done. All of them go over the asynchronous connections of libupsclient
+ * in one event loop, each starting its next request one interval after
+ * the last one started (or as soon as it was answered, if that took
+ * longer). Connections which fail or get lost are made again after a
+ * delay, as clients do.
+ */
+
+#include "common.h"
+#include "nut_platform.h"
+
+#ifndef WIN32
+#include <poll.h>
+#include <sys/resource.h>
+#endif	/* !WIN32 */
+
+#include "nut_stdint.h"
+#include "state.h"	/* state_get_timestamp_usec() */
+#include "upsclient.h"
+
+#define LG_DEFAULT_CONNS	100
+#define LG_DEFAULT_DURATION	10	/* seconds */
+#define LG_DEFAULT_INTERVAL	1000	/* milliseconds */
+#define LG_DEFAULT_TIMEOUT	10	/* seconds */
+#define LG_DEFAULT_RECONNECT	1000	/* milliseconds */
+
+/* between the GET TRACKING of a change which is still PENDING */
+#define LG_TRACKING_POLL	10000	/* microseconds */
+
+/* latencies kept of each kind, a uniform sample of them beyond that */
+#define LG_SAMPLES	100000
+
+typedef enum {
+	LG_POLL = 0,	/* GET VAR <ups> ups.status */
+	LG_LIST,	/* LIST VAR <ups> */
+	LG_SET,		/* SET VAR with tracking */
+	LG_INSTCMD,	/* INSTCMD with tracking */
+	LG_KINDS
+} lg_kind_t;
+
+static const char	*lg_kind_names[LG_KINDS] = { "poll", "list", "set", "instcmd" };
+
+typedef struct {
+	uint64_t	done, errors;
+	uint64_t	items;		/* of the LIST answers */
+	uint64_t	seen;		/* latencies, of which usec[] keeps count */
+	uint64_t	max;
+	uint64_t	*usec;
+	size_t	count;
+} lg_stats_t;
+
+#ifndef WIN32
+
+typedef struct {
+	lg_kind_t	kind;
+	int	tls;
+	UPSCLI_ASYNC_t	*as;
+	int	ready;		/* connected and set up */
+	int	busy;		/* setting up, or a request is in flight */
+	int	drop;		/* to be closed, and made again */
+	int	retry;		/* made again after a failure or loss */
+	uint64_t	start;	/* of the connection, or of the request in flight */
+	uint64_t	sent;	/* of the last line of it, for the timeout */
+	uint64_t	due;	/* of the next request, or connection */
+	uint64_t	track_due;	/* of the next GET TRACKING, if any */
+	char	tracking[UUID4_LEN];
+} lg_conn_t;
+
+static char	*upsname = NULL, *hostname = NULL;
+static uint16_t	port;
+static const char	*username = NULL, *password = NULL;
+static const char	*setvar = NULL, *setval = NULL, *instcmd = NULL;
+static int	do_login = 0;
+static uint64_t	interval = LG_DEFAULT_INTERVAL * 1000ULL;
+static uint64_t	timeout = LG_DEFAULT_TIMEOUT * 1000000ULL;
+static uint64_t	reconnect = LG_DEFAULT_RECONNECT * 1000ULL;
+
+static lg_stats_t	stats[LG_KINDS], connects;
+static uint64_t	failed = 0, lost = 0, reconnected = 0, timeouts = 0;
+
+static uint64_t lg_now(void)
+{
+	return state_get_timestamp_usec();
+}
+
+/* up to <range> - 1 */
+static uint64_t lg_random(uint64_t range)
+{
+	return range ? (((uint64_t)random() << 31) ^ (uint64_t)random()) % range : 0;
+}
+
+static void lg_sample(lg_stats_t *st, uint64_t usec)
+{
+	uint64_t	i;
+
+	if (!st->usec) {
+		st->usec = xcalloc(LG_SAMPLES, sizeof(*st->usec));
+	}
+
+	if (usec > st->max) {
+		st->max = usec;
+	}
+
+	st->seen++;
+	if (st->count < LG_SAMPLES) {
+		st->usec[st->count++] = usec;
+		return;
+	}
+
+	/* reservoir sampling: each of them is kept with the same odds */
+	if ((i = lg_random(st->seen)) < LG_SAMPLES) {
+		st->usec[i] = usec;
+	}
+}
+
+/* the request in flight of <c> is done */
+static void lg_done(lg_conn_t *c, int ok)
+{
+	lg_stats_t	*st = &stats[c->kind];
+	uint64_t	now = lg_now();
+
+	if (ok) {
+		st->done++;
+		lg_sample(st, now - c->start);
+	} else {
+		st->errors++;
+	}
+
+	c->busy = 0;
+	c->tracking[0] = '\0';
+	c->track_due = 0;
+	c->due = (c->start + interval > now) ? c->start + interval : now;
+}
+
+static void lg_setup_cb(UPSCLI_ASYNC_t *as, int ret, size_t numa, char **answer, void *arg)
+{
+	lg_conn_t	*c = (lg_conn_t *)arg;
+
+	NUT_UNUSED_VARIABLE(as);
+	NUT_UNUSED_VARIABLE(numa);
+	NUT_UNUSED_VARIABLE(answer);
+
+	if (ret < 0) {
+		c->drop = 1;
+	}
+}
+
+static void lg_get_cb(UPSCLI_ASYNC_t *as, int ret, size_t numa, char **answer, void *arg)
+{
+	NUT_UNUSED_VARIABLE(as);
+	NUT_UNUSED_VARIABLE(numa);
+	NUT_UNUSED_VARIABLE(answer);
+
+	lg_done((lg_conn_t *)arg, ret == 0);
+}
+
+static void lg_list_cb(UPSCLI_ASYNC_t *as, int ret, size_t numa, char **answer, void *arg)
+{
+	lg_conn_t	*c = (lg_conn_t *)arg;
+
+	NUT_UNUSED_VARIABLE(as);
+	NUT_UNUSED_VARIABLE(numa);
+	NUT_UNUSED_VARIABLE(answer);
+
+	if (ret == 1) {
+		stats[c->kind].items++;
+		return;
+	}
+
+	lg_done(c, ret == 0);
+}
+
+/* PENDING, SUCCESS, or an error (ret=-1) for a tracked change */
+static void lg_track_cb(UPSCLI_ASYNC_t *as, int ret, size_t numa, char **answer, void *arg)
+{
+	lg_conn_t	*c = (lg_conn_t *)arg;
+
+	NUT_UNUSED_VARIABLE(as);
+
+	if (ret == 0 && numa > 0 && !strcmp(answer[0], "PENDING")) {
+		c->track_due = lg_now() + LG_TRACKING_POLL;
+		return;
+	}
+
+	lg_done(c, ret == 0 && numa > 0 && !strcmp(answer[0], "SUCCESS"));
+}
+
+static void lg_track(lg_conn_t *c)
+{
+	char	cmd[SMALLBUF];
+
+	snprintf(cmd, sizeof(cmd), "GET TRACKING %s", c->tracking);
+	c->track_due = 0;
+	c->sent = lg_now();
+
+	if (upscli_async_cmd(c->as, cmd, lg_track_cb, c) < 0) {
+		c->drop = 1;
+	}
+}
+
+/* "OK TRACKING <id>" for a SET VAR or INSTCMD, or "OK" without tracking */
+static void lg_change_cb(UPSCLI_ASYNC_t *as, int ret, size_t numa, char **answer, void *arg)
+{
+	lg_conn_t	*c = (lg_conn_t *)arg;
+
+	NUT_UNUSED_VARIABLE(as);
+
+	if (ret == 0 && numa >= 3 && !strcmp(answer[1], "TRACKING")) {
+		snprintf(c->tracking, sizeof(c->tracking), "%s", answer[2]);
+		lg_track(c);
+		return;
+	}
+
+	lg_done(c, ret == 0);
+}
+
+static void lg_setup(lg_conn_t *c, const char *fmt, const char *arg)
+{
+	char	cmd[SMALLBUF];
+
+	snprintf(cmd, sizeof(cmd), fmt, arg);
+	if (upscli_async_cmd(c->as, cmd, lg_setup_cb, c) < 0) {
+		c->drop = 1;
+	}
+}
+
+static void lg_connect(lg_conn_t *c, uint64_t now)
+{
+	c->as = upscli_async_connect(hostname, port, c->tls ? UPSCLI_CONN_REQSSL : 0);
+	if (!c->as) {
+		fatalx(EXIT_FAILURE, "Error: out of memory");
+	}
+
+	c->ready = c->drop = 0;
+	c->busy = 1;
+	c->start = c->sent = now;
+	c->tracking[0] = '\0';
+	c->track_due = 0;
+
+	if (c->kind == LG_SET || c->kind == LG_INSTCMD
+	 || (c->kind == LG_POLL && do_login)
+	) {
+		lg_setup(c, "USERNAME %s", username);
+		lg_setup(c, "PASSWORD %s", password);
+	}
+
+	if (c->kind == LG_POLL && do_login) {
+		lg_setup(c, "LOGIN %s", upsname);
+	}
+
+	if (c->kind == LG_SET || c->kind == LG_INSTCMD) {
+		lg_setup(c, "SET TRACKING %s", "ON");
+	}
+}
+
+static void lg_start(lg_conn_t *c, uint64_t now)
+{
+	const char	*query[3];
+	char	cmd[LARGEBUF];
+	int	ret = -1;
+
+	c->busy = 1;
+	c->start = c->sent = now;
+
+	query[0] = "VAR";
+	query[1] = upsname;
+
+	switch (c->kind)
+	{
+	case LG_POLL:
+		query[2] = "ups.status";
+		ret = upscli_async_get(c->as, 3, query, lg_get_cb, c);
+		break;
+
+	case LG_LIST:
+		ret = upscli_async_list(c->as, 2, query, lg_list_cb, c);
+		break;
+
+	case LG_SET:
+		snprintf(cmd, sizeof(cmd), "SET VAR %s %s \"%s\"", upsname, setvar, setval);
+		ret = upscli_async_cmd(c->as, cmd, lg_change_cb, c);
+		break;
+
+	case LG_INSTCMD:
+		snprintf(cmd, sizeof(cmd), "INSTCMD %s %s", upsname, instcmd);
+		ret = upscli_async_cmd(c->as, cmd, lg_change_cb, c);
+		break;
+
+	case LG_KINDS:
+	default:
+		break;
+	}
+
+	if (ret < 0) {
+		c->drop = 1;
+	}
+}
+
+/* close a failed or lost connection (its requests were called back with
+ * errors already), to be made again after the reconnect delay */
+static void lg_close(lg_conn_t *c, uint64_t now)
+{
+	if (c->ready) {
+		lost++;
+	} else {
+		failed++;
+	}
+
+	upscli_async_free(c->as);
+	c->as = NULL;
+	c->ready = c->busy = 0;
+	c->retry = 1;
+	c->due = now + reconnect;
+}
+
+/* after the connection of <c> was served: set it up, or close it */
+static void lg_check(lg_conn_t *c, uint64_t now)
+{
+	int	state = upscli_async_state(c->as);
+
+	/* a request in flight for too long counts as failed, and the
+	 * connection as lost (the request is not called back then) */
+	if (!c->drop && c->busy && !c->track_due && now - c->sent >= timeout) {
+		upsdebugx(2, "%s request timed out", lg_kind_names[c->kind]);
+		timeouts++;
+		if (c->ready) {
+			stats[c->kind].errors++;
+		}
+		c->drop = 1;
+	}
+
+	if (c->drop || state == UPSCLI_ASYNC_FAILED) {
+		upsdebugx(2, "%s connection %s: %s", lg_kind_names[c->kind],
+			c->ready ? "lost" : "failed",
+			upscli_strerror(upscli_async_conn(c->as)));
+		lg_close(c, now);
+		return;
+	}
+
+	if (!c->ready && state == UPSCLI_ASYNC_READY && !upscli_async_pending(c->as)) {
+		connects.done++;
+		lg_sample(&connects, now - c->start);
+		if (c->retry) {
+			reconnected++;
+		}
+
+		c->ready = 1;
+		c->busy = 0;
+		/* spread the first requests over the interval */
+		c->due = now + lg_random(interval);
+	}
+}
+
+static double lg_msec(uint64_t usec)
+{
+	return (double)usec / 1000;
+}
+
+static int lg_usec_cmp(const void *a, const void *b)
+{
+	uint64_t	x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+static void lg_latencies(lg_stats_t *st, char *buf, size_t bufsize)
+{
+	if (!st->count) {
+		snprintf(buf, bufsize, "no latencies");
+		return;
+	}
+
+	qsort(st->usec, st->count, sizeof(*st->usec), lg_usec_cmp);
+
+	snprintf(buf, bufsize, "p50 %.3f ms, p90 %.3f ms, p99 %.3f ms, max %.3f ms",
+		lg_msec(st->usec[(st->count - 1) * 50 / 100]),
+		lg_msec(st->usec[(st->count - 1) * 90 / 100]),
+		lg_msec(st->usec[(st->count - 1) * 99 / 100]),
+		lg_msec(st->max));
+}
+
+static void lg_report(double elapsed, size_t numconns, size_t numtls)
+{
+	char	lat[SMALLBUF];
+	int	kind;
+
+	printf("Run: %.1f seconds, %" PRIuSIZE " connections (%" PRIuSIZE " over TLS) to %s@%s:%" PRIu16 "\n",
+		elapsed, numconns, numtls, upsname, hostname, port);
+
+	lg_latencies(&connects, lat, sizeof(lat));
+	printf("Connections: %" PRIu64 " made, %" PRIu64 " failed, %" PRIu64 " lost, "
+		"%" PRIu64 " made again, %" PRIu64 " requests timed out; setup %s\n",
+		connects.done, failed, lost, reconnected, timeouts, lat);
+
+	for (kind = 0; kind < LG_KINDS; kind++) {
+		lg_stats_t	*st = &stats[kind];
+		uint64_t	total = st->done + st->errors;
+
+		if (!total) {
+			continue;
+		}
+
+		lg_latencies(st, lat, sizeof(lat));
+		printf("%s: %" PRIu64 " requests, %.1f/s, %" PRIu64 " errors (%.2f%%)",
+			lg_kind_names[kind], total, (double)total / elapsed,
+			st->errors, 100.0 * (double)st->errors / (double)total);
+		if (kind == LG_LIST && st->done) {
+			printf(", %.1f items each", (double)st->items / (double)st->done);
+		}
+		printf("; %s\n", lat);
+	}
+
+	fflush(stdout);
+}
+
+/* one progress line per <every> seconds, for the requests of that time */
+static void lg_progress(double elapsed, size_t numready)
+{
+	static uint64_t	last_total = 0, last_errors = 0;
+	static double	last_elapsed = 0;
+	uint64_t	total = 0, errors = 0;
+	int	kind;
+
+	for (kind = 0; kind < LG_KINDS; kind++) {
+		total += stats[kind].done + stats[kind].errors;
+		errors += stats[kind].errors;
+	}
+
+	printf("%.0fs: %" PRIuSIZE " connections up, %.1f requests/s, %" PRIu64 " errors\n",
+		elapsed, numready,
+		(double)(total - last_total) / (elapsed - last_elapsed),
+		errors - last_errors);
+	fflush(stdout);
+
+	last_total = total;
+	last_errors = errors;
+	last_elapsed = elapsed;
+}
+
+/* the connections open at once need as many descriptors */
+static void lg_raise_nofile(size_t numconns)
+{
+	struct rlimit	rl;
+	rlim_t	want = (rlim_t)numconns + 16;
+
+	if (getrlimit(RLIMIT_NOFILE, &rl) < 0 || rl.rlim_cur >= want) {
+		return;
+	}
+
+	rl.rlim_cur = (rl.rlim_max != RLIM_INFINITY && rl.rlim_max < want) ? rl.rlim_max : want;
+	if (setrlimit(RLIMIT_NOFILE, &rl) < 0 || rl.rlim_cur < want) {
+		upslogx(LOG_WARNING, "Warning: only %lu descriptors are allowed, "
+			"some connections will fail", (unsigned long)rl.rlim_cur);
+	}
+}
+
+/* "poll=80,list=15,set=5" (a kind alone weighs 1) */
+static void lg_parse_mix(const char *mix, unsigned int *weight)
+{
+	char	*copy = xstrdup(mix), *item, *save = NULL;
+	int	kind;
+
+	memset(weight, 0, LG_KINDS * sizeof(*weight));
+
+	for (item = strtok_r(copy, ",", &save); item; item = strtok_r(NULL, ",", &save)) {
+		char	*eq = strchr(item, '=');
+		unsigned int	w = 1;
+
+		if (eq) {
+			*eq = '\0';
+			if (!str_to_uint(eq + 1, &w, 10)) {
+				fatalx(EXIT_FAILURE, "Error: invalid weight of %s: %s", item, eq + 1);
+			}
+		}
+
+		for (kind = 0; kind < LG_KINDS; kind++) {
+			if (!strcmp(item, lg_kind_names[kind])) {
+				break;
+			}
+		}
+
+		if (kind == LG_KINDS) {
+			fatalx(EXIT_FAILURE, "Error: unknown kind of load: %s", item);
+		}
+
+		weight[kind] = w;
+	}
+
+	free(copy);
+}
+
+static int lg_run(size_t numconns, double duration, const unsigned int *weight,
+	unsigned int tls_percent, double rate, double report_every)
+{
+	lg_conn_t	*conns = xcalloc(numconns, sizeof(*conns));
+	struct pollfd	*pfd = xcalloc(numconns, sizeof(*pfd));
+	size_t	*idx = xcalloc(numconns, sizeof(*idx));
+	uint64_t	begin = lg_now(), end, now, next, next_report, errors = 0;
+	unsigned int	total = 0;
+	size_t	i, n, numtls = 0, numready;
+	int	kind;
+
+	for (kind = 0; kind < LG_KINDS; kind++) {
+		total += weight[kind];
+	}
+
+	end = begin + (uint64_t)(duration * 1000000);
+	next_report = report_every > 0 ? begin + (uint64_t)(report_every * 1000000) : end;
+
+	/* the kinds and TLS in the proportions asked, spread over the list */
+	for (i = 0; i < numconns; i++) {
+		lg_conn_t	*c = &conns[i];
+		unsigned int	pos = (unsigned int)(((uint64_t)i * total * 2 + total) / (numconns * 2));
+		unsigned int	cum = 0;
+
+		for (kind = 0; kind < LG_KINDS - 1; kind++) {
+			cum += weight[kind];
+			if (pos < cum) {
+				break;
+			}
+		}
+
+		c->kind = (lg_kind_t)kind;
+		c->tls = ((i + 1) * tls_percent / 100) > (i * tls_percent / 100);
+		numtls += c->tls ? 1 : 0;
+		c->due = begin + (rate > 0 ? (uint64_t)((double)i * 1000000 / rate) : 0);
+	}
+
+	for (now = begin; now < end; ) {
+		next = end;
+
+		for (i = 0, n = 0; i < numconns; i++) {
+			lg_conn_t	*c = &conns[i];
+			int	ev;
+
+			if (!c->as) {
+				if (now < c->due) {
+					next = (c->due < next) ? c->due : next;
+					continue;
+				}
+				lg_connect(c, now);
+			}
+
+			if (c->ready && !c->busy) {
+				if (now >= c->due) {
+					lg_start(c, now);
+				} else if (c->due < next) {
+					next = c->due;
+				}
+			}
+
+			if (c->ready && c->track_due) {
+				if (now >= c->track_due) {
+					lg_track(c);
+				} else if (c->track_due < next) {
+					next = c->track_due;
+				}
+			}
+
+			if (c->busy && c->sent + timeout < next) {
+				next = c->sent + timeout;
+			}
+
+			ev = upscli_async_events(c->as);
+			pfd[n].fd = upscli_async_fd(c->as);
+			pfd[n].events = (short)(((ev & UPSCLI_ASYNC_READ) ? POLLIN : 0)
+				| ((ev & UPSCLI_ASYNC_WRITE) ? POLLOUT : 0));
+			pfd[n].revents = 0;
+			idx[n++] = i;
+		}
+
+		if (next_report < next) {
+			next = next_report;
+		}
+
+		if (poll(pfd, (nfds_t)n, (next > now) ? (int)((next - now + 999) / 1000) : 0) < 0
+		 && errno != EINTR
+		) {
+			fatal_with_errno(EXIT_FAILURE, "poll");
+		}
+
+		for (i = 0; i < n; i++) {
+			lg_conn_t	*c = &conns[idx[i]];
+			int	ev = 0;
+
+			if (pfd[i].revents & (POLLIN | POLLERR | POLLHUP))
+				ev |= UPSCLI_ASYNC_READ;
+			if (pfd[i].revents & (POLLOUT | POLLERR | POLLHUP))
+				ev |= UPSCLI_ASYNC_WRITE;
+
+			if (ev) {
+				upscli_async_process(c->as, ev);
+			}
+		}
+
+		now = lg_now();
+
+		for (i = 0, numready = 0; i < numconns; i++) {
+			if (conns[i].as) {
+				lg_check(&conns[i], now);
+				numready += conns[i].ready ? 1 : 0;
+			}
+		}
+
+		if (now >= next_report && now < end) {
+			lg_progress((double)(now - begin) / 1000000, numready);
+			next_report += (uint64_t)(report_every * 1000000);
+		}
+	}
+
+	for (i = 0; i < numconns; i++) {
+		if (conns[i].as) {
+			upscli_async_free(conns[i].as);
+		}
+	}
+
+	lg_report((double)(now - begin) / 1000000, numconns, numtls);
+
+	for (kind = 0; kind < LG_KINDS; kind++) {
+		errors += stats[kind].errors;
+		free(stats[kind].usec);
+	}
+	free(connects.usec);
+	free(conns);
+	free(pfd);
+	free(idx);
+
+	return (errors || failed || lost) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+#endif	/* !WIN32 */
+
+static void usage(const char *prog)
+{
+	print_banner_once(prog, 2);
+	printf("NUT client load generator, to benchmark upsd.\n");
+
+	printf("\nusage: %s [OPTIONS] <ups>[@<hostname>[:<port>]]\n", prog);
+
+	printf("\n  -c <num>     - connections to keep open (default: %d)\n", LG_DEFAULT_CONNS);
+	printf("  -d <secs>    - length of the run (default: %d)\n", LG_DEFAULT_DURATION);
+	printf("  -m <mix>     - kinds of client and their weights, from poll (GET of\n");
+	printf("                 ups.status), list (LIST VAR), set (SET VAR) and instcmd\n");
+	printf("                 (INSTCMD), e.g. poll=80,list=15,set=5 (default: poll)\n");
+	printf("  -i <msec>    - from one request of a connection to the next, 0 for\n");
+	printf("                 as soon as answered (default: %d)\n", LG_DEFAULT_INTERVAL);
+	printf("  -T <percent> - connections which use TLS (STARTTLS) (default: 0)\n");
+	printf("  -a <rate>    - new connections per second at the start (default: all at once)\n");
+	printf("  -r <msec>    - wait before making a failed or lost connection again\n");
+	printf("                 (default: %d)\n", LG_DEFAULT_RECONNECT);
+	printf("  -w <secs>    - give up on a request (and its connection) after this\n");
+	printf("                 long (default: %d)\n", LG_DEFAULT_TIMEOUT);
+	printf("  -u <user>    - user for set and instcmd, and for poll with -L\n");
+	printf("  -p <pass>    - password of that user\n");
+	printf("  -L           - poll connections LOGIN to the UPS, like upsmon\n");
+	printf("  -s <var=val> - the variable (and value) set connections set\n");
+	printf("  -x <cmd>     - the command instcmd connections run\n");
+	printf("  -R <secs>    - report progress this often (default: only at the end)\n");
+	printf("  -V           - display the version of this software\n");
+	printf("  -h           - display this help text\n");
+
+	nut_report_config_flags();
+
+	printf("\n%s", suggest_doc_links(prog, NULL));
+}
+
+int main(int argc, char **argv)
+{
+	const char	*prog = xbasename(argv[0]);
+	const char	*mix = "poll";
+	unsigned int	numconns = LG_DEFAULT_CONNS, tls_percent = 0, ui;
+	unsigned int	weight[LG_KINDS];
+	double	duration = LG_DEFAULT_DURATION, rate = 0, report_every = 0, d;
+	char	*s;
+	int	i = 0;
+
+	s = getenv("NUT_DEBUG_LEVEL");
+	if (s && str_to_int(s, &i, 10) && i > 0) {
+		nut_debug_level = i;
+	}
+
+	while ((i = getopt(argc, argv, "+hc:d:m:i:T:a:r:w:u:p:Ls:x:R:V")) != -1) {
+		switch (i)
+		{
+		case 'c':
+			if (!str_to_uint(optarg, &numconns, 10) || numconns < 1)
+				fatalx(EXIT_FAILURE, "Error: invalid number of connections: %s", optarg);
+			break;
+
+		case 'd':
+			if (!str_to_double(optarg, &duration, 10) || duration <= 0)
+				fatalx(EXIT_FAILURE, "Error: invalid length of the run: %s", optarg);
+			break;
+
+		case 'm':
+			mix = optarg;
+			break;
+
+#ifndef WIN32
+		case 'i':
+			if (!str_to_uint(optarg, &ui, 10))
+				fatalx(EXIT_FAILURE, "Error: invalid interval: %s", optarg);
+			interval = (uint64_t)ui * 1000;
+			break;
+
+		case 'r':
+			if (!str_to_uint(optarg, &ui, 10))
+				fatalx(EXIT_FAILURE, "Error: invalid reconnect delay: %s", optarg);
+			reconnect = (uint64_t)ui * 1000;
+			break;
+
+		case 'w':
+			if (!str_to_double(optarg, &d, 10) || d <= 0)
+				fatalx(EXIT_FAILURE, "Error: invalid timeout: %s", optarg);
+			timeout = (uint64_t)(d * 1000000);
+			break;
+
+		case 'u':
+			username = optarg;
+			break;
+
+		case 'p':
+			password = optarg;
+			break;
+
+		case 'L':
+			do_login = 1;
+			break;
+
+		case 's':
+			setvar = optarg;
+			break;
+
+		case 'x':
+			instcmd = optarg;
+			break;
+#endif	/* !WIN32 */
+
+		case 'T':
+			if (!str_to_uint(optarg, &tls_percent, 10) || tls_percent > 100)
+				fatalx(EXIT_FAILURE, "Error: invalid share of TLS connections: %s", optarg);
+			break;
+
+		case 'a':
+			if (!str_to_double(optarg, &rate, 10) || rate < 0)
+				fatalx(EXIT_FAILURE, "Error: invalid connection rate: %s", optarg);
+			break;
+
+		case 'R':
+			if (!str_to_double(optarg, &report_every, 10) || report_every < 0)
+				fatalx(EXIT_FAILURE, "Error: invalid report interval: %s", optarg);
+			break;
+
+		case 'V':
+			print_banner_once(prog, 1);
+			nut_report_config_flags();
+			exit(EXIT_SUCCESS);
+
+		case 'h':
+		default:
+			usage(prog);
+			exit(EXIT_SUCCESS);
+		}
+	}
+
+	argc -= optind;
+	argv += optind;
+
+	if (argc < 1) {
+		usage(prog);
+		exit(EXIT_FAILURE);
+	}
+
+	lg_parse_mix(mix, weight);
+
+#ifndef WIN32
+	if (upscli_splitname(argv[0], &upsname, &hostname, &port) != 0) {
+		fatalx(EXIT_FAILURE, "Error: invalid UPS definition.\nRequired format: upsname[@hostname[:port]]");
+	}
+
+	if ((weight[LG_SET] || weight[LG_INSTCMD] || (weight[LG_POLL] && do_login))
+	 && (!username || !password)
+	) {
+		fatalx(EXIT_FAILURE, "Error: a user and password (-u, -p) are needed for this mix");
+	}
+
+	if (weight[LG_SET]) {
+		char	*eq;
+
+		if (!setvar || !(eq = strchr(setvar, '='))) {
+			fatalx(EXIT_FAILURE, "Error: set connections need a variable and value (-s var=val)");
+		}
+
+		setvar = s = xstrdup(setvar);
+		eq = strchr(s, '=');
+		*eq = '\0';
+		setval = eq + 1;
+	}
+
+	if (weight[LG_INSTCMD] && !instcmd) {
+		fatalx(EXIT_FAILURE, "Error: instcmd connections need a command (-x cmd)");
+	}
+
+	for (ui = 0, i = 0; i < LG_KINDS; i++) {
+		ui += weight[i];
+	}
+	if (!ui) {
+		fatalx(EXIT_FAILURE, "Error: the mix has no weight");
+	}
+
+	signal(SIGPIPE, SIG_IGN);
+	srandom((unsigned int)lg_now());
+	lg_raise_nofile(numconns);
+
+	i = lg_run(numconns, duration, weight, tls_percent, rate, report_every);
+
+	free(upsname);
+	free(hostname);
+	if (weight[LG_SET]) {
+		free((char *)setvar);
+	}
+
+	exit(i);
+#else	/* WIN32 */
+	NUT_UNUSED_VARIABLE(numconns);
+	NUT_UNUSED_VARIABLE(duration);
+	NUT_UNUSED_VARIABLE(tls_percent);
+	NUT_UNUSED_VARIABLE(rate);
+	NUT_UNUSED_VARIABLE(report_every);
+	NUT_UNUSED_VARIABLE(ui);
+	NUT_UNUSED_VARIABLE(d);
+	fatalx(EXIT_FAILURE, "Error: %s is not supported on this platform", prog);
+#endif	/* WIN32 */
+}
@@ -27,6 +27,8 @@
 #include "nutclient.h"
 
 #include <sstream>
+#include <algorithm>
+#include <thread>
 
 /* TODO: Make it a run-time option like upsdebugx(),
  * probably with a verbosity level variable in each
@@ -34,6 +36,7 @@
 #include <iostream>	/* std::cerr debugging */
 #include <cstdint>
 #include <cstdlib>
+#include <climits>
 #include <stdlib.h>
 
 #ifndef WIN32
@@ -47,6 +50,20 @@
 #include <string.h>
 #include <stdio.h>
 
+#ifdef WITH_OPENSSL
+# include <openssl/err.h>
+# include <openssl/ssl.h>
+#elif defined(WITH_NSS) /* WITH_OPENSSL */
+# include <nss.h>
+# include <prerror.h>
+# include <prinit.h>
+# include <pk11func.h>
+# include <plstr.h>
+# include <prtypes.h>
+# include <ssl.h>
+# include <private/pprio.h>
+#endif /* WITH_OPENSSL | WITH_NSS */
+
 /* Windows/Linux Socket compatibility layer: */
 /* Thanks to Benjamin Roux (http://broux.developpez.com/articles/c/sockets/) */
 #ifdef WIN32
@@ -87,6 +104,8 @@ static inline int sktclose(int fh)
 #  include <sys/socket.h>
 #  include <netinet/in.h>
 #  include <arpa/inet.h>
+#  include <sys/un.h>
+#  include <sys/uio.h> /* writev */
 #  include <unistd.h> /* close */
 #  include <netdb.h> /* gethostbyname */
 #  include <fcntl.h>
@@ -140,6 +159,8 @@ static inline int sktclose(int fh)
 # ifndef HAVE_LOCALTIME_R
 #  define HAVE_LOCALTIME_R 111
 # endif
+/* For connect_ai_race() */
+#define NUT_WANT_INET_NTOP_XX	1
 #include "common.h"
 #else /* not HAVE_NUTCOMMON */
 #include <stdlib.h>
@@ -235,20 +256,57 @@ public:
 	size_t write(const void* buf, size_t sz);
 
 	std::string read();
+	void read(std::string& line);
 	void write(const std::string& str);
 
+	/* Wait up to <timeout> milliseconds (negative to block) for data */
+	bool waitReadable(int timeout);
+
+	/* Run the TLS handshake on the connection (once the server agreed
+	 * to STARTTLS), offering the last session with this host and port */
+	void startTLS(const std::string& host, uint16_t port, bool verifyCert);
+	bool isTLS()const;
+
+	/* Set up TLS for all sockets, done with defaults on first startTLS() */
+	static void initTLS(const std::string& certPath,
+		const std::string& certName, const std::string& certPasswd);
+	/* Whether the library was built with TLS support */
+	static bool hasTLS();
 
 private:
+	/* Least room made in the buffer for each read */
+	static const size_t READ_SIZE = 16384;
+
+	void waitFor(bool writing);
+	/* Whether TLS holds decrypted data not read yet */
+	bool tlsPending()const;
+
 	SOCKET _sock;
 	bool _debugConnect;
+#ifdef WITH_OPENSSL
+	SSL* _ssl;
+#elif defined(WITH_NSS) /* WITH_OPENSSL */
+	PRFileDesc* _ssl;
+#endif /* WITH_OPENSSL | WITH_NSS */
+	/* Key of the TLS session cache: host, port and verification */
+	std::string _tlsPeer;
 	struct timeval	_tv;
-	std::string _buffer; /* Received buffer, string because data should be text only. */
+	/* Received data, not taken as lines yet: from _bufBegin to _bufEnd */
+	std::vector<char> _buffer;
+	size_t _bufBegin, _bufEnd;
 };
 
 Socket::Socket():
 _sock(INVALID_SOCKET),
 _debugConnect(false),
-_tv()
+#if (defined WITH_OPENSSL) || (defined WITH_NSS)
+_ssl(nullptr),
+#endif /* WITH_OPENSSL | WITH_NSS */
+_tlsPeer(),
+_tv(),
+_buffer(),
+_bufBegin(0),
+_bufEnd(0)
 {
 	_tv.tv_sec = -1;
 	_tv.tv_usec = 0;
@@ -269,21 +327,56 @@ void Socket::setDebugConnect(bool d)
 	_debugConnect = d;
 }
 
+#ifdef HAVE_NUTCOMMON
+/* The address each server (host and port) answered on the last time,
+ * tried first by the next connection to it.
+ * Pedantic builds complain about the static variable below, see
+ * Client::TRACKING: the map is allocated and never freed for that.
+ */
+#if (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_PUSH_POP) && (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_EXIT_TIME_DESTRUCTORS || defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_GLOBAL_CONSTRUCTORS)
+#pragma GCC diagnostic push
+# ifdef HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_GLOBAL_CONSTRUCTORS
+#  pragma GCC diagnostic ignored "-Wglobal-constructors"
+# endif
+# ifdef HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_EXIT_TIME_DESTRUCTORS
+#  pragma GCC diagnostic ignored "-Wexit-time-destructors"
+# endif
+#endif
+static std::mutex addrMutex;
+#if (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_PUSH_POP) && (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_EXIT_TIME_DESTRUCTORS || defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_GLOBAL_CONSTRUCTORS)
+#pragma GCC diagnostic pop
+#endif
+static std::map<std::string, struct sockaddr_storage>* addrCache = nullptr;
+#endif /* HAVE_NUTCOMMON */
+
 void Socket::connect(const std::string& host, uint16_t port)
 {
 	int	sock_fd;
-	struct addrinfo	hints, *res, *ai;
+	struct addrinfo	hints, *res;
 	char			sport[NI_MAXSERV];
 	int			v;
+#ifdef HAVE_NUTCOMMON
+	struct sockaddr_storage	last;
+	bool			network = true;
+#else /* not HAVE_NUTCOMMON */
+	struct addrinfo	*ai;
 	fd_set 			wfds;
 	int			error;
 	socklen_t		error_size;
+#endif /* not HAVE_NUTCOMMON */
 
 #ifndef WIN32
+# ifndef HAVE_NUTCOMMON
 	long			fd_flags;
+# endif
+	const char		*unixpath = nullptr;
+	struct sockaddr_un	unixaddr;
+	struct addrinfo		unixai;
 #else	/* WIN32 */
+# ifndef HAVE_NUTCOMMON
 	HANDLE event = NULL;
 	unsigned long argp;
+# endif
 
 	WSADATA WSAdata;
 	WSAStartup(2,&WSAdata);
@@ -300,58 +393,126 @@ void Socket::connect(const std::string& host, uint16_t port)
 
 	snprintf(sport, sizeof(sport), "%" PRIuMAX, static_cast<uintmax_t>(port));
 
-	memset(&hints, 0, sizeof(hints));
-	/* TODO? Port IPv4 vs. IPv6 detail from upsclient.c */
-	hints.ai_family = AF_UNSPEC;
-	hints.ai_socktype = SOCK_STREAM;
-	hints.ai_protocol = IPPROTO_TCP;
-
-	if (_debugConnect) std::cerr <<
-		"[D2] Socket::connect(): getaddrinfo(" <<
-		host << ", " <<
-		sport << ", " <<
-		"...)" << std::endl << std::flush;
+#ifndef WIN32
+	/* "unix:/path" (or just "/path") of a local upsd socket,
+	 * see LISTEN in upsd.conf; the port is not used then */
+	if (host.compare(0, 5, "unix:") == 0) {
+		unixpath = host.c_str() + 5;
+	} else if (host[0] == '/') {
+		unixpath = host.c_str();
+	}
 
-	while ((v = getaddrinfo(host.c_str(), sport, &hints, &res)) != 0) {
-		switch (v)
-		{
-		case EAI_AGAIN:
-			continue;
-		case EAI_NONAME:
+	if (unixpath) {
+		if (strlen(unixpath) >= sizeof(unixaddr.sun_path)) {
 			if (_debugConnect) std::cerr <<
 				"[D2] Socket::connect(): " <<
-				"connect not successful: " <<
-				"UnknownHostException" <<
+				"socket path too long: " << unixpath <<
 				std::endl << std::flush;
 			throw nut::UnknownHostException();
-		case EAI_MEMORY:
-			if (_debugConnect) std::cerr <<
-				"[D2] Socket::connect(): " <<
-				"connect not successful: " <<
-				"Out of memory" <<
-				std::endl << std::flush;
-			throw nut::NutException("Out of memory");
+		}
+
+		memset(&unixaddr, 0, sizeof(unixaddr));
+		unixaddr.sun_family = AF_UNIX;
+		snprintf(unixaddr.sun_path, sizeof(unixaddr.sun_path), "%s", unixpath);
+
+		memset(&unixai, 0, sizeof(unixai));
+		unixai.ai_family = AF_UNIX;
+		unixai.ai_socktype = SOCK_STREAM;
+		unixai.ai_addr = reinterpret_cast<struct sockaddr *>(&unixaddr);
+		unixai.ai_addrlen = sizeof(unixaddr);
+		res = &unixai;
+# ifdef HAVE_NUTCOMMON
+		network = false;
+# endif
+	} else
+#endif	/* !WIN32 */
+	{
+		memset(&hints, 0, sizeof(hints));
+		/* TODO? Port IPv4 vs. IPv6 detail from upsclient.c */
+		hints.ai_family = AF_UNSPEC;
+		hints.ai_socktype = SOCK_STREAM;
+		hints.ai_protocol = IPPROTO_TCP;
+
+		if (_debugConnect) std::cerr <<
+			"[D2] Socket::connect(): getaddrinfo(" <<
+			host << ", " <<
+			sport << ", " <<
+			"...)" << std::endl << std::flush;
+
+		while ((v = getaddrinfo(host.c_str(), sport, &hints, &res)) != 0) {
+			switch (v)
+			{
+			case EAI_AGAIN:
+				continue;
+			case EAI_NONAME:
+				if (_debugConnect) std::cerr <<
+					"[D2] Socket::connect(): " <<
+					"connect not successful: " <<
+					"UnknownHostException" <<
+					std::endl << std::flush;
+				throw nut::UnknownHostException();
+			case EAI_MEMORY:
+				if (_debugConnect) std::cerr <<
+					"[D2] Socket::connect(): " <<
+					"connect not successful: " <<
+					"Out of memory" <<
+					std::endl << std::flush;
+				throw nut::NutException("Out of memory");
 #ifndef WIN32
-		case EAI_SYSTEM:
+			case EAI_SYSTEM:
 #else	/* WIN32 */
-		case WSANO_RECOVERY:
+			case WSANO_RECOVERY:
 #endif	/* WIN32 */
-			if (_debugConnect) std::cerr <<
-				"[D2] Socket::connect(): " <<
-				"connect not successful: " <<
-				"SystemException" <<
-				std::endl << std::flush;
-			throw nut::SystemException();
-		default:
-			if (_debugConnect) std::cerr <<
-				"[D2] Socket::connect(): " <<
-				"connect not successful: " <<
-				"Unknown error" <<
-				std::endl << std::flush;
-			throw nut::NutException("Unknown error");
+				if (_debugConnect) std::cerr <<
+					"[D2] Socket::connect(): " <<
+					"connect not successful: " <<
+					"SystemException" <<
+					std::endl << std::flush;
+				throw nut::SystemException();
+			default:
+				if (_debugConnect) std::cerr <<
+					"[D2] Socket::connect(): " <<
+					"connect not successful: " <<
+					"Unknown error" <<
+					std::endl << std::flush;
+				throw nut::NutException("Unknown error");
+			}
+		}
+	}
+
+#ifdef HAVE_NUTCOMMON
+	/* Race the addresses, rather than waiting out the timeout on each
+	 * dead one in turn (like a broken IPv6 route) */
+	memset(&last, 0, sizeof(last));
+	std::string key = host + ":" + sport;
+	if (network) {
+		std::lock_guard<std::mutex> lock(addrMutex);
+		if (addrCache) {
+			std::map<std::string, struct sockaddr_storage>::const_iterator it = addrCache->find(key);
+			if (it != addrCache->end()) {
+				last = it->second;
+			}
 		}
 	}
 
+	sock_fd = connect_ai_race(res, hasTimeout() ? &_tv : nullptr, &last);
+	if (_debugConnect) std::cerr <<
+		"[D2] Socket::connect(): connect_ai_race(): " <<
+		"sock_fd = " << sock_fd <<
+		"; errno = " << (sock_fd < 0 ? errno : 0) <<
+		std::endl << std::flush;
+
+	if (sock_fd >= 0) {
+		if (network) {
+			std::lock_guard<std::mutex> lock(addrMutex);
+			if (!addrCache) {
+				addrCache = new std::map<std::string, struct sockaddr_storage>;
+			}
+			(*addrCache)[key] = last;
+		}
+		_sock = static_cast<SOCKET>(sock_fd);
+	}
+#else /* not HAVE_NUTCOMMON */
 	for (ai = res; ai != nullptr; ai = ai->ai_next) {
 
 		if (_debugConnect) std::cerr <<
@@ -513,7 +674,11 @@ void Socket::connect(const std::string& host, uint16_t port)
 //		ups->syserrno = 0;
 		break;
 	}
+#endif /* not HAVE_NUTCOMMON */
 
+#ifndef WIN32
+	if (res != &unixai)
+#endif	/* !WIN32 */
 	freeaddrinfo(res);
 
 #ifndef WIN32
@@ -533,8 +698,6 @@ void Socket::connect(const std::string& host, uint16_t port)
 		throw nut::IOException("Cannot connect to host");
 	}
 
-	/* TODO? See upsclient.c for NSS/SSL connection handling */
-
 #ifdef OLD
 	struct hostent *hostinfo = nullptr;
 	SOCKADDR_IN sin = { 0 };
@@ -565,12 +728,30 @@ void Socket::connect(const std::string& host, uint16_t port)
 
 void Socket::disconnect()
 {
+#ifdef WITH_OPENSSL
+	if(_ssl)
+	{
+		/* Without close_notify, the session would not be resumable */
+		SSL_shutdown(_ssl);
+		SSL_free(_ssl);
+		_ssl = nullptr;
+	}
+#elif defined(WITH_NSS) /* WITH_OPENSSL */
+	if(_ssl)
+	{
+		/* Closes the imported socket too */
+		PR_Shutdown(_ssl, PR_SHUTDOWN_BOTH);
+		PR_Close(_ssl);
+		_ssl = nullptr;
+		_sock = INVALID_SOCKET;
+	}
+#endif /* WITH_OPENSSL | WITH_NSS */
 	if(_sock != INVALID_SOCKET)
 	{
 		::closesocket(_sock);
 		_sock = INVALID_SOCKET;
 	}
-	_buffer.clear();
+	_bufBegin = _bufEnd = 0;
 }
 
 bool Socket::isConnected()const
@@ -578,111 +759,10 @@ bool Socket::isConnected()const
 	return _sock!=INVALID_SOCKET;
 }
 
-size_t Socket::read(void* buf, size_t sz)
-{
-	if(!isConnected())
-	{
-		throw nut::NotConnectedException();
-	}
-
-	if(_tv.tv_sec>=0)
-	{
-		fd_set fds;
-		FD_ZERO(&fds);
-		FD_SET(_sock, &fds);
-		int ret = select(_sock+1, &fds, nullptr, nullptr, &_tv);
-		if (ret < 1) {
-			throw nut::TimeoutException();
-		}
-	}
-
-	ssize_t res = sktread(_sock, buf, sz);
-	if(res==-1)
-	{
-		disconnect();
-		throw nut::IOException("Error while reading on socket");
-	}
-	return static_cast<size_t>(res);
-}
-
-size_t Socket::write(const void* buf, size_t sz)
-{
-	if(!isConnected())
-	{
-		throw nut::NotConnectedException();
-	}
-
-	if(_tv.tv_sec>=0)
-	{
-		fd_set fds;
-		FD_ZERO(&fds);
-		FD_SET(_sock, &fds);
-		int ret = select(_sock+1, nullptr, &fds, nullptr, &_tv);
-		if (ret < 1) {
-			throw nut::TimeoutException();
-		}
-	}
-
-	ssize_t res = sktwrite(_sock, buf, sz);
-	if(res==-1)
-	{
-		disconnect();
-		throw nut::IOException("Error while writing on socket");
-	}
-	return static_cast<size_t>(res);
-}
-
-std::string Socket::read()
-{
-	std::string res;
-	char buff[256];
-
-	while(true)
-	{
-		// Look at already read data in _buffer
-		if(!_buffer.empty())
-		{
-			size_t idx = _buffer.find('\n');
-			if(idx!=std::string::npos)
-			{
-				res += _buffer.substr(0, idx);
-				_buffer.erase(0, idx+1);
-				return res;
-			}
-			res += _buffer;
-		}
-
-		// Read new buffer
-		size_t sz = read(&buff, 256);
-		if(sz==0)
-		{
-			disconnect();
-			throw nut::IOException("Server closed connection unexpectedly");
-		}
-		_buffer.assign(buff, sz);
-	}
-}
-
-void Socket::write(const std::string& str)
-{
-//	write(str.c_str(), str.size());
-//	write("\n", 1);
-	std::string buff = str + "\n";
-	write(buff.c_str(), buff.size());
-}
-
-}/* namespace internal */
-
-
-/*
- *
- * Client implementation
- *
- */
-
-/* Pedantic builds complain about the static variable below...
- * It is assumed safe to ignore since it is a std::string with
- * no complex teardown at program exit.
+/* TLS state shared by all sockets (like upsclient.c does), with the
+ * last session established with each server for resumption.
+ * Pedantic builds complain about the static variables below, see
+ * Client::TRACKING: the map is allocated and never freed for that.
  */
 #if (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_PUSH_POP) && (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_EXIT_TIME_DESTRUCTORS || defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_GLOBAL_CONSTRUCTORS)
 #pragma GCC diagnostic push
@@ -693,759 +773,2492 @@ void Socket::write(const std::string& str)
 #  pragma GCC diagnostic ignored "-Wexit-time-destructors"
 # endif
 #endif
-const Feature Client::TRACKING = "TRACKING";
+static std::mutex tlsMutex;
 #if (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_PUSH_POP) && (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_EXIT_TIME_DESTRUCTORS || defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_GLOBAL_CONSTRUCTORS)
 #pragma GCC diagnostic pop
 #endif
+static bool tlsInitialized = false;
+#ifdef WITH_OPENSSL
+static SSL_CTX* tlsContext = nullptr;
+static std::map<std::string, SSL_SESSION*>* tlsSessions = nullptr;
 
-Client::Client()
+/* Text of the last OpenSSL error, for exceptions */
+static std::string tlsError()
 {
+	char buf[256];
+	unsigned long err = ERR_get_error();
+	if(err == 0)
+	{
+		return "unknown error";
+	}
+	ERR_error_string_n(err, buf, sizeof(buf));
+	ERR_clear_error();
+	return buf;
 }
+#elif defined(WITH_NSS) /* WITH_OPENSSL */
+static char* tlsPasswd = nullptr;
+static char* tlsCertName = nullptr;
 
-Client::~Client()
+static std::string tlsError()
 {
+	char buf[256];
+	PRInt32 length = PR_GetErrorTextLength();
+	if(length > 0 && static_cast<size_t>(length) < sizeof(buf))
+	{
+		PR_GetErrorText(buf);
+		return buf;
+	}
+	std::stringstream str;
+	str << "error " << PR_GetError();
+	return str.str();
 }
 
-bool Client::hasDevice(const std::string& dev)
+static char* tlsPasswordCallback(PK11SlotInfo* slot, PRBool retry, void* arg)
 {
-	std::set<std::string> devs = getDeviceNames();
-	return devs.find(dev) != devs.end();
+	NUT_UNUSED_VARIABLE(slot);
+	NUT_UNUSED_VARIABLE(arg);
+
+	/* Do not loop on a wrong password */
+	if(retry || !tlsPasswd)
+	{
+		return nullptr;
+	}
+	return PL_strdup(tlsPasswd);
 }
 
-Device Client::getDevice(const std::string& name)
+static SECStatus tlsAuthCertificateDontVerify(void* arg, PRFileDesc* fd,
+	PRBool checksig, PRBool isServer)
 {
-	if(hasDevice(name))
-		return Device(this, name);
-	else
-		return Device(nullptr, "");
+	NUT_UNUSED_VARIABLE(arg);
+	NUT_UNUSED_VARIABLE(fd);
+	NUT_UNUSED_VARIABLE(checksig);
+	NUT_UNUSED_VARIABLE(isServer);
+	return SECSuccess;
 }
+#endif /* WITH_OPENSSL | WITH_NSS */
 
-std::set<Device> Client::getDevices()
+#ifdef WITH_OPENSSL
+/* OpenSSL callback for a newly established (or ticketed) session,
+ * with the cache key of its socket as application data */
+static int tlsNewSession(SSL* ssl, SSL_SESSION* session)
 {
-	std::set<Device> res;
-
-	std::set<std::string> devs = getDeviceNames();
-	for(std::set<std::string>::iterator it=devs.begin(); it!=devs.end(); ++it)
+	const std::string* peer = static_cast<const std::string*>(SSL_get_app_data(ssl));
+	if(!peer)
 	{
-		res.insert(Device(this, *it));
+		return 0;
 	}
 
-	return res;
+	std::lock_guard<std::mutex> lock(tlsMutex);
+	SSL_SESSION*& cached = (*tlsSessions)[*peer];
+	if(cached)
+	{
+		SSL_SESSION_free(cached);
+	}
+	/* We keep the reference we were given */
+	cached = session;
+	return 1;
 }
+#endif /* WITH_OPENSSL */
 
-bool Client::hasDeviceVariable(const std::string& dev, const std::string& name)
+static void tlsInit(const std::string& certPath,
+	const std::string& certName, const std::string& certPasswd);
+
+bool Socket::hasTLS()
 {
-	std::set<std::string> names = getDeviceVariableNames(dev);
-	return names.find(name) != names.end();
+#if (defined WITH_OPENSSL) || (defined WITH_NSS)
+	return true;
+#else
+	return false;
+#endif
 }
 
-std::map<std::string,std::vector<std::string> > Client::getDeviceVariableValues(const std::string& dev)
+void Socket::initTLS(const std::string& certPath,
+	const std::string& certName, const std::string& certPasswd)
 {
-	std::map<std::string,std::vector<std::string> > res;
-
-	std::set<std::string> names = getDeviceVariableNames(dev);
-	for(std::set<std::string>::iterator it=names.begin(); it!=names.end(); ++it)
+	std::lock_guard<std::mutex> lock(tlsMutex);
+	if(tlsInitialized)
 	{
-		const std::string& name = *it;
-		res[name] = getDeviceVariableValue(dev, name);
+		throw nut::IOException("TLS already initialized");
 	}
-
-	return res;
+	tlsInit(certPath, certName, certPasswd);
 }
 
-std::map<std::string,std::map<std::string,std::vector<std::string> > > Client::getDevicesVariableValues(const std::set<std::string>& devs)
+/* Set up TLS with tlsMutex held */
+static void tlsInit(const std::string& certPath,
+	const std::string& certName, const std::string& certPasswd)
 {
-	std::map<std::string,std::map<std::string,std::vector<std::string> > > res;
+#ifdef WITH_OPENSSL
+	NUT_UNUSED_VARIABLE(certName);
+	NUT_UNUSED_VARIABLE(certPasswd);
 
-	for(std::set<std::string>::const_iterator it=devs.cbegin(); it!=devs.cend(); ++it)
+# if OPENSSL_VERSION_NUMBER < 0x10100000L
+	SSL_load_error_strings();
+	SSL_library_init();
+	SSL_CTX* ctx = SSL_CTX_new(SSLv23_client_method());
+# else
+	SSL_CTX* ctx = SSL_CTX_new(TLS_client_method());
+# endif
+	if(!ctx)
 	{
-		res[*it] = getDeviceVariableValues(*it);
+		throw nut::IOException("Cannot initialize TLS context: " + tlsError());
 	}
 
-	return res;
-}
+# if OPENSSL_VERSION_NUMBER < 0x10100000L
+	SSL_CTX_set_options(ctx, SSL_OP_NO_SSLv2 | SSL_OP_NO_SSLv3);
+# else
+	SSL_CTX_set_min_proto_version(ctx, TLS1_VERSION);
+# endif
 
-bool Client::hasDeviceCommand(const std::string& dev, const std::string& name)
-{
-	std::set<std::string> names = getDeviceCommandNames(dev);
-	return names.find(name) != names.end();
-}
+	int ret = certPath.empty()
+		? SSL_CTX_set_default_verify_paths(ctx)
+		: SSL_CTX_load_verify_locations(ctx, nullptr, certPath.c_str());
+	if(ret != 1)
+	{
+		std::string err = tlsError();
+		SSL_CTX_free(ctx);
+		throw nut::IOException("Cannot load certificates from " +
+			(certPath.empty() ? std::string("default paths") : certPath) + ": " + err);
+	}
 
-bool Client::hasFeature(const Feature& feature)
-{
-	try
+	/* Keep sessions ourselves, per server, as upscli_sslinit() does */
+	SSL_CTX_set_session_cache_mode(ctx,
+		SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+	SSL_CTX_sess_set_new_cb(ctx, tlsNewSession);
+
+	tlsContext = ctx;
+	tlsSessions = new std::map<std::string, SSL_SESSION*>;
+#elif defined(WITH_NSS) /* WITH_OPENSSL */
+	SECStatus status;
+
+	if(!NSS_IsInitialized())
 	{
-		// If feature is known, querying it won't throw an exception.
-		isFeatureEnabled(feature);
-		return true;
+		PR_Init(PR_USER_THREAD, PR_PRIORITY_NORMAL, 0);
+		status = certPath.empty()
+			? NSS_NoDB_Init(nullptr)
+			: NSS_Init(certPath.c_str());
+		if(status != SECSuccess)
+		{
+			throw nut::IOException("Cannot initialize TLS context: " + tlsError());
+		}
+		if(NSS_SetDomesticPolicy() != SECSuccess)
+		{
+			throw nut::IOException("Cannot initialize TLS policy: " + tlsError());
+		}
 	}
-	catch(...)
+
+	status = SSL_OptionSetDefault(SSL_ENABLE_TLS, PR_TRUE);
+	if(status != SECSuccess)
 	{
-		return false;
+		throw nut::IOException("Cannot enable TLS: " + tlsError());
+	}
+
+	if(!certPasswd.empty())
+	{
+		tlsPasswd = PL_strdup(certPasswd.c_str());
+	}
+	if(!certName.empty())
+	{
+		tlsCertName = PL_strdup(certName.c_str());
 	}
+	PK11_SetPasswordFunc(tlsPasswordCallback);
+#else /* neither WITH_OPENSSL nor WITH_NSS */
+	NUT_UNUSED_VARIABLE(certPath);
+	NUT_UNUSED_VARIABLE(certName);
+	NUT_UNUSED_VARIABLE(certPasswd);
+	throw nut::IOException("TLS is not available");
+#endif /* WITH_OPENSSL | WITH_NSS */
+
+	tlsInitialized = true;
 }
 
+void Socket::startTLS(const std::string& host, uint16_t port, bool verifyCert)
+{
+	if(!isConnected())
+	{
+		throw nut::NotConnectedException();
+	}
+	if(isTLS())
+	{
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(tlsMutex);
+		if(!tlsInitialized)
+		{
+			tlsInit("", "", "");
+		}
+	}
+
+	std::stringstream peer;
+	peer << host << ":" << port << ":" << (verifyCert ? 1 : 0);
+	_tlsPeer = peer.str();
+
+	/* Anything read past the STARTTLS answer would not be encrypted */
+	_bufBegin = _bufEnd = 0;
+
+#ifdef WITH_OPENSSL
+	SSL* ssl = SSL_new(tlsContext);
+	if(!ssl)
+	{
+		throw nut::IOException("Cannot create TLS socket: " + tlsError());
+	}
+	if(SSL_set_fd(ssl, static_cast<int>(_sock)) != 1)
+	{
+		SSL_free(ssl);
+		throw nut::IOException("Cannot bind socket to TLS: " + tlsError());
+	}
+
+	if(verifyCert)
+	{
+		SSL_set_verify(ssl, SSL_VERIFY_PEER, nullptr);
+# if OPENSSL_VERSION_NUMBER >= 0x10100000L
+		SSL_set1_host(ssl, host.c_str());
+# endif
+	}
+	else
+	{
+		SSL_set_verify(ssl, SSL_VERIFY_NONE, nullptr);
+	}
+	SSL_set_tlsext_host_name(ssl, host.c_str());
+
+	/* Offer the last session with this server for resumption */
+	SSL_set_app_data(ssl, &_tlsPeer);
+	{
+		std::lock_guard<std::mutex> lock(tlsMutex);
+		std::map<std::string, SSL_SESSION*>::iterator it = tlsSessions->find(_tlsPeer);
+		if(it != tlsSessions->end() && SSL_set_session(ssl, it->second) != 1)
+		{
+			if (_debugConnect) std::cerr <<
+				"[D2] Socket::startTLS(): cannot reuse cached TLS session" <<
+				std::endl << std::flush;
+		}
+	}
+
+	_ssl = ssl;
+	int res = SSL_connect(ssl);
+	if(res != 1)
+	{
+		std::string err = tlsError();
+		disconnect();
+		throw nut::IOException("TLS handshake failed: " + err);
+	}
+
+	if (_debugConnect) std::cerr <<
+		"[D2] Socket::startTLS(): connected (" << SSL_get_version(ssl) <<
+		(SSL_session_reused(ssl) ? ", session resumed" : "") << ")" <<
+		std::endl << std::flush;
+#elif defined(WITH_NSS) /* WITH_OPENSSL */
+	PRFileDesc* socket = PR_ImportTCPSocket(_sock);
+	if(!socket)
+	{
+		throw nut::IOException("Cannot import socket: " + tlsError());
+	}
+	PRFileDesc* ssl = SSL_ImportFD(nullptr, socket);
+	if(!ssl)
+	{
+		std::string err = tlsError();
+		PR_Close(socket);
+		_sock = INVALID_SOCKET;
+		disconnect();
+		throw nut::IOException("Cannot create TLS socket: " + err);
+	}
+	_ssl = ssl;
+
+	SECStatus status = SECSuccess;
+	if(!verifyCert)
+	{
+		status = SSL_AuthCertificateHook(ssl, tlsAuthCertificateDontVerify, nullptr);
+	}
+	if(status == SECSuccess && tlsCertName)
+	{
+		status = SSL_GetClientAuthDataHook(ssl, NSS_GetClientAuthData, tlsCertName);
+	}
+	if(status == SECSuccess)
+	{
+		status = SSL_SetURL(ssl, host.c_str());
+	}
+	/* NSS keeps the client sessions for resumption itself,
+	 * make sure they are told apart per server and port */
+	if(status == SECSuccess)
+	{
+		status = SSL_SetSockPeerID(ssl, _tlsPeer.c_str());
+	}
+	if(status == SECSuccess)
+	{
+		status = SSL_ResetHandshake(ssl, PR_FALSE);
+	}
+	if(status == SECSuccess)
+	{
+		status = SSL_ForceHandshake(ssl);
+	}
+	if(status != SECSuccess)
+	{
+		std::string err = tlsError();
+		disconnect();
+		throw nut::IOException("TLS handshake failed: " + err);
+	}
+
+	if (_debugConnect) std::cerr <<
+		"[D2] Socket::startTLS(): connected" <<
+		std::endl << std::flush;
+#else /* neither WITH_OPENSSL nor WITH_NSS */
+	throw nut::IOException("TLS is not available");
+#endif /* WITH_OPENSSL | WITH_NSS */
+}
+
+bool Socket::isTLS()const
+{
+#if (defined WITH_OPENSSL) || (defined WITH_NSS)
+	return _ssl != nullptr;
+#else
+	return false;
+#endif
+}
+
+bool Socket::tlsPending()const
+{
+#ifdef WITH_OPENSSL
+	return _ssl && SSL_pending(_ssl) > 0;
+#elif defined(WITH_NSS) /* WITH_OPENSSL */
+	return _ssl && SSL_DataPending(_ssl) > 0;
+#else
+	return false;
+#endif
+}
+
+void Socket::waitFor(bool writing)
+{
+	if(_tv.tv_sec>=0)
+	{
+		/* select() may update the timeout it was given */
+		struct timeval tv = _tv;
+		fd_set fds;
+		FD_ZERO(&fds);
+		FD_SET(_sock, &fds);
+		int ret = select(_sock+1, writing ? nullptr : &fds, writing ? &fds : nullptr, nullptr, &tv);
+		if (ret < 1) {
+			throw nut::TimeoutException();
+		}
+	}
+}
+
+bool Socket::waitReadable(int timeout)
+{
+	if(!isConnected())
+	{
+		throw nut::NotConnectedException();
+	}
+	if(_bufEnd > _bufBegin || tlsPending())
+	{
+		return true;
+	}
+
+	struct timeval tv, *ptv = nullptr;
+	if(timeout >= 0)
+	{
+		tv.tv_sec = timeout / 1000;
+		tv.tv_usec = (timeout % 1000) * 1000;
+		ptv = &tv;
+	}
+	fd_set fds;
+	FD_ZERO(&fds);
+	FD_SET(_sock, &fds);
+	int ret = select(_sock+1, &fds, nullptr, nullptr, ptv);
+	if(ret < 0)
+	{
+		if(errno == EINTR)
+		{
+			return false;
+		}
+		disconnect();
+		throw nut::IOException("Error while reading on socket");
+	}
+	return ret > 0;
+}
+
+size_t Socket::read(void* buf, size_t sz)
+{
+	if(!isConnected())
+	{
+		throw nut::NotConnectedException();
+	}
+
+	/* Data already decrypted would not wake select() up */
+	if(!tlsPending())
+	{
+		waitFor(false);
+	}
+
+#ifdef WITH_OPENSSL
+	if(_ssl)
+	{
+		/* SSL_* routines deal with int type for return and buflen */
+		int res = SSL_read(_ssl, buf, sz > INT_MAX ? INT_MAX : static_cast<int>(sz));
+		if(res <= 0)
+		{
+			int err = SSL_get_error(_ssl, res);
+			if(err == SSL_ERROR_ZERO_RETURN || (err == SSL_ERROR_SYSCALL && res == 0))
+			{
+				return 0;
+			}
+			std::string msg = tlsError();
+			disconnect();
+			throw nut::IOException("Error while reading on TLS socket: " + msg);
+		}
+		return static_cast<size_t>(res);
+	}
+#elif defined(WITH_NSS) /* WITH_OPENSSL */
+	if(_ssl)
+	{
+		PRInt32 res = PR_Read(_ssl, buf, sz > INT_MAX ? INT_MAX : static_cast<PRInt32>(sz));
+		if(res < 0)
+		{
+			std::string msg = tlsError();
+			disconnect();
+			throw nut::IOException("Error while reading on TLS socket: " + msg);
+		}
+		return static_cast<size_t>(res);
+	}
+#endif /* WITH_OPENSSL | WITH_NSS */
+
+	ssize_t res = sktread(_sock, buf, sz);
+	if(res==-1)
+	{
+		disconnect();
+		throw nut::IOException("Error while reading on socket");
+	}
+	return static_cast<size_t>(res);
+}
+
+size_t Socket::write(const void* buf, size_t sz)
+{
+	if(!isConnected())
+	{
+		throw nut::NotConnectedException();
+	}
+
+	waitFor(true);
+
+#ifdef WITH_OPENSSL
+	if(_ssl)
+	{
+		int res = SSL_write(_ssl, buf, sz > INT_MAX ? INT_MAX : static_cast<int>(sz));
+		if(res <= 0)
+		{
+			std::string msg = tlsError();
+			disconnect();
+			throw nut::IOException("Error while writing on TLS socket: " + msg);
+		}
+		return static_cast<size_t>(res);
+	}
+#elif defined(WITH_NSS) /* WITH_OPENSSL */
+	if(_ssl)
+	{
+		PRInt32 res = PR_Write(_ssl, buf, sz > INT_MAX ? INT_MAX : static_cast<PRInt32>(sz));
+		if(res < 0)
+		{
+			std::string msg = tlsError();
+			disconnect();
+			throw nut::IOException("Error while writing on TLS socket: " + msg);
+		}
+		return static_cast<size_t>(res);
+	}
+#endif /* WITH_OPENSSL | WITH_NSS */
+
+	ssize_t res = sktwrite(_sock, buf, sz);
+	if(res==-1)
+	{
+		disconnect();
+		throw nut::IOException("Error while writing on socket");
+	}
+	return static_cast<size_t>(res);
+}
+
+std::string Socket::read()
+{
+	std::string res;
+	read(res);
+	return res;
+}
+
+void Socket::read(std::string& line)
+{
+	/* Bytes of the buffered data known to hold no newline */
+	size_t scanned = 0;
+
+	while(true)
+	{
+		// Look for the end of a line in what was not scanned yet
+		const char* begin = _buffer.data() + _bufBegin;
+		const char* nl = nullptr;
+		if(_bufEnd - _bufBegin > scanned)
+		{
+			nl = static_cast<const char*>(
+				memchr(begin + scanned, '\n', _bufEnd - _bufBegin - scanned));
+		}
+		if(nl)
+		{
+			/* assign() reuses the storage of the caller's string */
+			line.assign(begin, static_cast<size_t>(nl - begin));
+			_bufBegin += static_cast<size_t>(nl - begin) + 1;
+			if(_bufBegin == _bufEnd)
+			{
+				_bufBegin = _bufEnd = 0;
+			}
+			return;
+		}
+		scanned = _bufEnd - _bufBegin;
+
+		// Make room at the end, moving the partial line to the front first
+		if(_buffer.size() - _bufEnd < READ_SIZE)
+		{
+			if(_bufBegin > 0)
+			{
+				memmove(_buffer.data(), _buffer.data() + _bufBegin, _bufEnd - _bufBegin);
+				_bufEnd -= _bufBegin;
+				_bufBegin = 0;
+			}
+			if(_buffer.size() - _bufEnd < READ_SIZE)
+			{
+				_buffer.resize(_bufEnd + READ_SIZE);
+			}
+		}
+
+		// Read new data
+		size_t sz = read(_buffer.data() + _bufEnd, _buffer.size() - _bufEnd);
+		if(sz==0)
+		{
+			disconnect();
+			throw nut::IOException("Server closed connection unexpectedly");
+		}
+		_bufEnd += sz;
+	}
+}
+
+void Socket::write(const std::string& str)
+{
+	if(!isConnected())
+	{
+		throw nut::NotConnectedException();
+	}
+
+#ifndef WIN32
+	if(!isTLS())
+	{
+		// Send the request and its newline together, without a copy
+		static const char nl = '\n';
+		struct iovec iov[2], *v = iov;
+		int cnt = 2;
+
+		iov[0].iov_base = const_cast<char*>(str.data());
+		iov[0].iov_len = str.size();
+		iov[1].iov_base = const_cast<char*>(&nl);
+		iov[1].iov_len = 1;
+
+		while(cnt > 0)
+		{
+			waitFor(true);
+
+			ssize_t res = ::writev(_sock, v, cnt);
+			if(res==-1)
+			{
+				if(errno==EINTR)
+				{
+					continue;
+				}
+				disconnect();
+				throw nut::IOException("Error while writing on socket");
+			}
+
+			// Skip what was written, resuming within a partly written part
+			size_t done = static_cast<size_t>(res);
+			while(cnt > 0 && done >= v->iov_len)
+			{
+				done -= v->iov_len;
+				v++;
+				cnt--;
+			}
+			if(cnt > 0)
+			{
+				v->iov_base = static_cast<char*>(v->iov_base) + done;
+				v->iov_len -= done;
+			}
+		}
+		return;
+	}
+#endif	/* !WIN32 */
+
+	// Under TLS the request and its newline go in one record
+	std::string buff = str + "\n";
+	for(size_t done = 0; done < buff.size(); )
+	{
+		done += write(buff.data() + done, buff.size() - done);
+	}
+}
+
+/* An asynchronous request of a TcpClient, and its answer once read */
+struct AsyncRequest
+{
+	AsyncRequest(const std::string& l):list(l),done(false){}
+
+	/* Prefix of the items of a LIST answer, empty for one line answers */
+	std::string list;
+	bool done;
+	/* The answer line, or the items of the list */
+	std::vector<std::string> lines;
+	std::exception_ptr error;
+};
+
+}/* namespace internal */
+
+
 /*
  *
- * TCP Client implementation
+ * Client implementation
  *
  */
 
-TcpClient::TcpClient():
-Client(),
-_host("localhost"),
-_port(3493),
-_timeout(0),
-_socket(new internal::Socket)
+/* Pedantic builds complain about the static variable below...
+ * It is assumed safe to ignore since it is a std::string with
+ * no complex teardown at program exit.
+ */
+#if (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_PUSH_POP) && (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_EXIT_TIME_DESTRUCTORS || defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_GLOBAL_CONSTRUCTORS)
+#pragma GCC diagnostic push
+# ifdef HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_GLOBAL_CONSTRUCTORS
+#  pragma GCC diagnostic ignored "-Wglobal-constructors"
+# endif
+# ifdef HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_EXIT_TIME_DESTRUCTORS
+#  pragma GCC diagnostic ignored "-Wexit-time-destructors"
+# endif
+#endif
+const Feature Client::TRACKING = "TRACKING";
+#if (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_PUSH_POP) && (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_EXIT_TIME_DESTRUCTORS || defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_GLOBAL_CONSTRUCTORS)
+#pragma GCC diagnostic pop
+#endif
+
+Client::Client()
+{
+}
+
+Client::~Client()
+{
+}
+
+bool Client::hasDevice(const std::string& dev)
+{
+	std::set<std::string> devs = getDeviceNames();
+	return devs.find(dev) != devs.end();
+}
+
+Device Client::getDevice(const std::string& name)
+{
+	if(hasDevice(name))
+		return Device(this, name);
+	else
+		return Device(nullptr, "");
+}
+
+std::set<Device> Client::getDevices()
+{
+	std::set<Device> res;
+
+	std::set<std::string> devs = getDeviceNames();
+	for(std::set<std::string>::iterator it=devs.begin(); it!=devs.end(); ++it)
+	{
+		res.insert(Device(this, *it));
+	}
+
+	return res;
+}
+
+bool Client::hasDeviceVariable(const std::string& dev, const std::string& name)
+{
+	std::set<std::string> names = getDeviceVariableNames(dev);
+	return names.find(name) != names.end();
+}
+
+std::map<std::string,std::vector<std::string> > Client::getDeviceVariableValues(const std::string& dev)
+{
+	std::map<std::string,std::vector<std::string> > res;
+
+	std::set<std::string> names = getDeviceVariableNames(dev);
+	for(std::set<std::string>::iterator it=names.begin(); it!=names.end(); ++it)
+	{
+		const std::string& name = *it;
+		res[name] = getDeviceVariableValue(dev, name);
+	}
+
+	return res;
+}
+
+std::map<std::string,std::map<std::string,std::vector<std::string> > > Client::getDevicesVariableValues(const std::set<std::string>& devs)
+{
+	std::map<std::string,std::map<std::string,std::vector<std::string> > > res;
+
+	for(std::set<std::string>::const_iterator it=devs.cbegin(); it!=devs.cend(); ++it)
+	{
+		res[*it] = getDeviceVariableValues(*it);
+	}
+
+	return res;
+}
+
+void Client::visitDevicesVariableValues(const std::set<std::string>& devs, const VariableVisitor& visitor)
+{
+	std::map<std::string,std::map<std::string,std::vector<std::string> > > res = getDevicesVariableValues(devs);
+
+	for(std::map<std::string,std::map<std::string,std::vector<std::string> > >::const_iterator it=res.cbegin(); it!=res.cend(); ++it)
+	{
+		for(std::map<std::string,std::vector<std::string> >::const_iterator it2=it->second.cbegin(); it2!=it->second.cend(); ++it2)
+		{
+			visitor(it->first, it2->first, it2->second);
+		}
+	}
+}
+
+bool Client::hasDeviceCommand(const std::string& dev, const std::string& name)
+{
+	std::set<std::string> names = getDeviceCommandNames(dev);
+	return names.find(name) != names.end();
+}
+
+bool Client::hasFeature(const Feature& feature)
+{
+	try
+	{
+		// If feature is known, querying it won't throw an exception.
+		isFeatureEnabled(feature);
+		return true;
+	}
+	catch(...)
+	{
+		return false;
+	}
+}
+
+/*
+ *
+ * TCP Client implementation
+ *
+ */
+
+TcpClient::TcpClient():
+Client(),
+_host("localhost"),
+_port(3493),
+_timeout(0),
+_socket(new internal::Socket),
+_maxPending(256),
+_pushed(false),
+_pollInterval(1000),
+_tls(false),
+_tlsVerify(false)
+{
+	// Do not connect now
+}
+
+TcpClient::TcpClient(const std::string& host, uint16_t port):
+Client(),
+_timeout(0),
+_socket(new internal::Socket),
+_maxPending(256),
+_pushed(false),
+_pollInterval(1000),
+_tls(false),
+_tlsVerify(false)
+{
+	connect(host, port);
+}
+
+TcpClient::~TcpClient()
+{
+	failPendingRequests(std::make_exception_ptr(NotConnectedException()));
+	delete _socket;
+}
+
+void TcpClient::connect(const std::string& host, uint16_t port)
+{
+	_host = host;
+	_port = port;
+	connect();
+}
+
+void TcpClient::connect()
+{
+	_socket->connect(_host, _port);
+	if(_tls)
+	{
+		/* Resumes the session of the previous connection, if cached */
+		try
+		{
+			sendTLSRequest();
+		}
+		catch(...)
+		{
+			_socket->disconnect();
+			throw;
+		}
+	}
+}
+
+void TcpClient::initTLS(const std::string& certPath,
+	const std::string& certName, const std::string& certPasswd)
+{
+	internal::Socket::initTLS(certPath, certName, certPasswd);
+}
+
+void TcpClient::startTLS(bool verifyCert)
+{
+	if(_socket->isTLS())
+	{
+		return;
+	}
+	if(!internal::Socket::hasTLS())
+	{
+		throw IOException("TLS is not available");
+	}
+	_tlsVerify = verifyCert;
+	sendTLSRequest();
+	_tls = true;
+}
+
+void TcpClient::sendTLSRequest()
+{
+	std::string res = sendQuery("STARTTLS");
+	if(res != "OK STARTTLS")
+	{
+		detectError(res);
+		throw NutException("Unexpected STARTTLS answer: " + res);
+	}
+	_socket->startTLS(_host, _port, _tlsVerify);
+}
+
+bool TcpClient::isTLS()const
+{
+	return _socket->isTLS();
+}
+
+void TcpClient::setDebugConnect(bool d)
+{
+	_socket->setDebugConnect(d);
+}
+
+std::string TcpClient::getHost()const
+{
+	return _host;
+}
+
+uint16_t TcpClient::getPort()const
+{
+	return _port;
+}
+
+bool TcpClient::isConnected()const
+{
+	return _socket->isConnected();
+}
+
+void TcpClient::disconnect()
+{
+	_socket->disconnect();
+	failPendingRequests(std::make_exception_ptr(NotConnectedException()));
+	_watched.clear();
+}
+
+void TcpClient::setTimeout(time_t timeout)
+{
+	_timeout = timeout;
+	_socket->setTimeout(timeout);
+}
+
+time_t TcpClient::getTimeout()const
+{
+	return _timeout;
+}
+
+void TcpClient::authenticate(const std::string& user, const std::string& passwd)
+{
+	detectError(sendQuery("USERNAME " + user));
+	detectError(sendQuery("PASSWORD " + passwd));
+}
+
+void TcpClient::logout()
+{
+	detectError(sendQuery("LOGOUT"));
+	_socket->disconnect();
+}
+
+Device TcpClient::getDevice(const std::string& name)
+{
+	try
+	{
+		get("UPSDESC", name);
+	}
+	catch(NutException& ex)
+	{
+		if(ex.str()=="UNKNOWN-UPS")
+			return Device(nullptr, "");
+		else
+			throw;
+	}
+	return Device(this, name);
+}
+
+std::set<std::string> TcpClient::getDeviceNames()
+{
+	std::set<std::string> res;
+
+	std::vector<std::vector<std::string> > devs = list("UPS");
+	for(std::vector<std::vector<std::string> >::iterator it=devs.begin();
+		it!=devs.end(); ++it)
+	{
+		std::string id = (*it)[0];
+		if(!id.empty())
+			res.insert(id);
+	}
+
+	return res;
+}
+
+std::string TcpClient::getDeviceDescription(const std::string& name)
+{
+	return get("UPSDESC", name)[0];
+}
+
+std::set<std::string> TcpClient::getDeviceVariableNames(const std::string& dev)
+{
+	std::set<std::string> set;
+
+	std::vector<std::vector<std::string> > res = list("VAR", dev);
+	for(size_t n=0; n<res.size(); ++n)
+	{
+		set.insert(res[n][0]);
+	}
+
+	return set;
+}
+
+std::set<std::string> TcpClient::getDeviceRWVariableNames(const std::string& dev)
+{
+	std::set<std::string> set;
+
+	std::vector<std::vector<std::string> > res = list("RW", dev);
+	for(size_t n=0; n<res.size(); ++n)
+	{
+		set.insert(res[n][0]);
+	}
+
+	return set;
+}
+
+std::string TcpClient::getDeviceVariableDescription(const std::string& dev, const std::string& name)
+{
+	return get("DESC", dev + " " + name)[0];
+}
+
+std::vector<std::string> TcpClient::getDeviceVariableValue(const std::string& dev, const std::string& name)
+{
+	return get("VAR", dev + " " + name);
+}
+
+std::map<std::string,std::vector<std::string> > TcpClient::getDeviceVariableValues(const std::string& dev)
+{
+
+	std::map<std::string,std::vector<std::string> >  map;
+
+	std::vector<std::string> query;
+	query.push_back("LIST VAR " + dev);
+	sendAsyncQueries(query);
+
+	std::vector<std::string> tokens;
+	parseList("VAR " + dev, [&](const std::string& line, size_t begin)
+	{
+		explode(line, begin, tokens);
+		if (tokens.empty())
+		{
+			throw NutException("Invalid response");
+		}
+		map[tokens[0]].assign(tokens.begin() + 1, tokens.end());
+	});
+
+	return map;
+}
+
+std::map<std::string,std::vector<std::string> > TcpClient::getDeviceVariableValues(const std::string& dev, const std::set<std::string>& names)
+{
+	std::map<std::string,std::vector<std::string> >  map;
+
+	if (names.empty())
+	{
+		return map;
+	}
+
+	std::string req = "GET VARS " + dev;
+	for (std::set<std::string>::const_iterator it=names.cbegin(); it!=names.cend(); ++it)
+	{
+		req += " " + *it;
+	}
+
+	std::string res = sendQuery(req);
+	detectError(res);
+	if (res != "BEGIN GET VARS " + dev)
+	{
+		throw NutException("Invalid response");
+	}
+
+	std::string var = "VAR " + dev + " ", missing = "MISSING " + dev + " ";
+	const std::string end = "END GET VARS " + dev;
+	while (true)
+	{
+		readLine(res);
+		detectError(res);
+		if (res == end)
+		{
+			return map;
+		}
+		if (res.compare(0, var.size(), var) == 0)
+		{
+			std::vector<std::string> vals = explode(res, var.size());
+			if (vals.empty())
+			{
+				throw NutException("Invalid response");
+			}
+			std::string name = vals[0];
+			vals.erase(vals.begin());
+			map[name] = vals;
+		}
+		else if (res.compare(0, missing.size(), missing) != 0)
+		{
+			throw NutException("Invalid response");
+		}
+	}
+}
+
+std::map<std::string,std::map<std::string,std::vector<std::string> > > TcpClient::getDevicesVariableValues(const std::set<std::string>& devs)
+{
+	std::map<std::string,std::map<std::string,std::vector<std::string> > > map;
+
+	if (devs.empty())
+	{
+		// This request might come from processing the empty valid
+		// response of an upsd server which was allowed to start
+		// with no device sections in its ups.conf
+		return map;
+	}
+
+	std::vector<std::string> queries;
+	for (std::set<std::string>::const_iterator it=devs.cbegin(); it!=devs.cend(); ++it)
+	{
+		queries.push_back("LIST VAR " + *it);
+	}
+	sendAsyncQueries(queries);
+
+	std::vector<std::string> tokens;
+	for (std::set<std::string>::const_iterator it=devs.cbegin(); it!=devs.cend(); ++it)
+	{
+		try
+		{
+			std::map<std::string,std::vector<std::string> > map2;
+			parseList("VAR " + *it, [&](const std::string& line, size_t begin)
+			{
+				explode(line, begin, tokens);
+				if (tokens.empty())
+				{
+					throw NutException("Invalid response");
+				}
+				map2[tokens[0]].assign(tokens.begin() + 1, tokens.end());
+			});
+			map[*it].swap(map2);
+		}
+		catch (NutException&)
+		{
+			// We sent a bunch of queries, we need to process them all to clear up the backlog.
+		}
+	}
+
+	if (map.empty())
+	{
+		// We may fail on some devices, but not on ALL devices.
+		throw NutException("Invalid device");
+	}
+
+	return map;
+}
+
+void TcpClient::visitDevicesVariableValues(const std::set<std::string>& devs, const VariableVisitor& visitor)
+{
+	if (devs.empty())
+	{
+		return;
+	}
+
+	std::vector<std::string> queries;
+	for (std::set<std::string>::const_iterator it=devs.cbegin(); it!=devs.cend(); ++it)
+	{
+		queries.push_back("LIST VAR " + *it);
+	}
+	sendAsyncQueries(queries);
+
+	// The same token strings serve for all lines of all devices
+	std::vector<std::string> tokens, values;
+	bool listed = false;
+	for (std::set<std::string>::const_iterator it=devs.cbegin(); it!=devs.cend(); ++it)
+	{
+		try
+		{
+			parseList("VAR " + *it, [&](const std::string& line, size_t begin)
+			{
+				explode(line, begin, tokens);
+				if (tokens.empty())
+				{
+					throw NutException("Invalid response");
+				}
+				values.assign(tokens.begin() + 1, tokens.end());
+				visitor(*it, tokens[0], values);
+			});
+			listed = true;
+		}
+		catch (NutException&)
+		{
+			// As above, the answers to the other queries are still to be read.
+		}
+	}
+
+	if (!listed)
+	{
+		throw NutException("Invalid device");
+	}
+}
+
+std::map<std::string,std::map<std::string,std::vector<std::string> > > TcpClient::getFleetVariableValues(const std::set<std::string>& names, const std::string& pattern)
+{
+	std::map<std::string,std::map<std::string,std::vector<std::string> > > map;
+
+	if (names.empty())
+	{
+		return map;
+	}
+
+	std::string req = "LIST FLEET " + escape(pattern);
+	for (std::set<std::string>::const_iterator it=names.cbegin(); it!=names.cend(); ++it)
+	{
+		req += " " + *it;
+	}
+
+	std::string res = sendQuery(req);
+	detectError(res);
+	if (res != "BEGIN LIST FLEET " + pattern)
+	{
+		throw NutException("Invalid response");
+	}
+
+	static const std::string var = "VAR ", missing = "MISSING ", unavailable = "UNAVAILABLE ";
+	const std::string end = "END LIST FLEET " + pattern;
+	std::vector<std::string> tokens;
+	while (true)
+	{
+		readLine(res);
+		detectError(res);
+		if (res == end)
+		{
+			return map;
+		}
+		if (res.compare(0, var.size(), var) == 0)
+		{
+			explode(res, var.size(), tokens);
+			if (tokens.size() < 2)
+			{
+				throw NutException("Invalid response");
+			}
+			map[tokens[0]][tokens[1]].assign(tokens.begin() + 2, tokens.end());
+		}
+		else if (res.compare(0, missing.size(), missing) != 0
+		&& res.compare(0, unavailable.size(), unavailable) != 0)
+		{
+			throw NutException("Invalid response");
+		}
+	}
+}
+
+void TcpClient::getDeviceVariableChanges(const std::string& dev, std::string& cursor, std::map<std::string,std::vector<std::string> >& values)
+{
+	const std::string req = "VAR " + dev + " SINCE " + cursor;
+	std::vector<std::string> query;
+	query.push_back("LIST " + req);
+	sendAsyncQueries(query);
+
+	std::string res = readLine();
+	detectError(res);
+	if(res != ("BEGIN LIST " + req))
+	{
+		throw NutException("Invalid response");
+	}
+
+	// Lines are "<what> <dev> ...", unlike other lists
+	const std::string end = "END LIST " + req;
+	std::string newcursor;
+	std::vector<std::string> tokens;
+	while(true)
+	{
+		readLine(res);
+		detectError(res);
+		if(res == end)
+		{
+			break;
+		}
+		explode(res, 0, tokens);
+		if(tokens.size() < 2 || tokens[1] != dev)
+		{
+			throw NutException("Invalid response");
+		}
+		if(tokens[0] == "VAR" && tokens.size() >= 3)
+		{
+			values[tokens[2]].assign(tokens.begin() + 3, tokens.end());
+		}
+		else if(tokens[0] == "DELETED" && tokens.size() == 3)
+		{
+			values.erase(tokens[2]);
+		}
+		else if(tokens[0] == "RESYNC")
+		{
+			values.clear();
+		}
+		else if(tokens[0] == "CURSOR" && tokens.size() == 3)
+		{
+			newcursor = tokens[2];
+		}
+		else
+		{
+			throw NutException("Invalid response");
+		}
+	}
+
+	if(newcursor.empty())
+	{
+		throw NutException("Invalid response");
+	}
+	cursor = newcursor;
+}
+
+TrackingID TcpClient::setDeviceVariable(const std::string& dev, const std::string& name, const std::string& value)
+{
+	std::string query = "SET VAR " + dev + " " + name + " " + escape(value);
+	return sendTrackingQuery(query);
+}
+
+TrackingID TcpClient::setDeviceVariable(const std::string& dev, const std::string& name, const std::vector<std::string>& values)
+{
+	std::string query = "SET VAR " + dev + " " + name;
+	for(size_t n=0; n<values.size(); ++n)
+	{
+		query += " " + escape(values[n]);
+	}
+	return sendTrackingQuery(query);
+}
+
+std::set<std::string> TcpClient::getDeviceCommandNames(const std::string& dev)
+{
+	std::set<std::string> cmds;
+
+	std::vector<std::vector<std::string> > res = list("CMD", dev);
+	for(size_t n=0; n<res.size(); ++n)
+	{
+		cmds.insert(res[n][0]);
+	}
+
+	return cmds;
+}
+
+std::string TcpClient::getDeviceCommandDescription(const std::string& dev, const std::string& name)
+{
+	return get("CMDDESC", dev + " " + name)[0];
+}
+
+TrackingID TcpClient::executeDeviceCommand(const std::string& dev, const std::string& name, const std::string& param)
+{
+	return sendTrackingQuery("INSTCMD " + dev + " " + name + " " + param);
+}
+
+std::map<std::string, std::set<std::string>> TcpClient::listDeviceClients(void)
+{
+	/* Lists all clients of all devices (which have at least one client) */
+	std::map<std::string, std::set<std::string>> deviceClientsMap;
+
+	std::set<std::string> devs = getDeviceNames();
+	for(std::set<std::string>::iterator it=devs.begin(); it!=devs.end(); ++it)
+	{
+		std::string dev = *it;
+		std::set<std::string> deviceClients = deviceGetClients(dev);
+		if (!deviceClients.empty()) {
+			deviceClientsMap[dev] = deviceClients;
+		}
+	}
+
+	return deviceClientsMap;
+}
+
+std::set<std::string> TcpClient::deviceGetClients(const std::string& dev)
+{
+	/* Who did a deviceLogin() to this dev? */
+	std::set<std::string> clients;
+
+	std::vector<std::vector<std::string> > res = list("CLIENT", dev);
+	for(size_t n=0; n<res.size(); ++n)
+	{
+		clients.insert(res[n][0]);
+	}
+
+	return clients;
+}
+
+void TcpClient::deviceLogin(const std::string& dev)
+{
+	/* Requires that current session is already logged in with
+	 * an account which has one of "upsmon" roles in `upsd.users` */
+	detectError(sendQuery("LOGIN " + dev));
+}
+
+/* NOTE: "master" is deprecated since NUT v2.8.0 in favor of "primary".
+ * For the sake of old/new server/client interoperability,
+ * practical implementations should try to use one and fall
+ * back to the other, and only fail if both return "ERR".
+ */
+void TcpClient::deviceMaster(const std::string& dev)
+{
+	try {
+		detectError(sendQuery("MASTER " + dev));
+	} catch (NutException &exOrig) {
+		try {
+			detectError(sendQuery("PRIMARY " + dev));
+		} catch (NutException &exRetry) {
+			NUT_UNUSED_VARIABLE(exRetry);
+			throw exOrig;
+		}
+	}
+}
+
+void TcpClient::devicePrimary(const std::string& dev)
+{
+	try {
+		detectError(sendQuery("PRIMARY " + dev));
+	} catch (NutException &exOrig) {
+		try {
+			detectError(sendQuery("MASTER " + dev));
+		} catch (NutException &exRetry) {
+			NUT_UNUSED_VARIABLE(exRetry);
+			throw exOrig;
+		}
+	}
+}
+
+void TcpClient::deviceForcedShutdown(const std::string& dev)
+{
+	detectError(sendQuery("FSD " + dev));
+}
+
+int TcpClient::deviceGetNumLogins(const std::string& dev)
+{
+	std::string num = get("NUMLOGINS", dev)[0];
+	return atoi(num.c_str());
+}
+
+TrackingResult TcpClient::getTrackingResult(const TrackingID& id)
+{
+	if (id.empty())
+	{
+		return TrackingResult::SUCCESS;
+	}
+
+	std::string result = sendQuery("GET TRACKING " + id);
+
+	if (result == "PENDING")
+	{
+		return TrackingResult::PENDING;
+	}
+	else if (result == "SUCCESS")
+	{
+		return TrackingResult::SUCCESS;
+	}
+	else if (result == "ERR UNKNOWN")
+	{
+		return TrackingResult::UNKNOWN;
+	}
+	else if (result == "ERR INVALID-ARGUMENT")
+	{
+		return TrackingResult::INVALID_ARGUMENT;
+	}
+	else
+	{
+		return TrackingResult::FAILURE;
+	}
+}
+
+bool TcpClient::isFeatureEnabled(const Feature& feature)
+{
+	std::string result = sendQuery("GET " + feature);
+	detectError(result);
+
+	if (result == "ON")
+	{
+		return true;
+	}
+	else if (result == "OFF")
+	{
+		return false;
+	}
+	else
+	{
+		throw NutException("Unknown feature result " + result);
+	}
+}
+void TcpClient::setFeature(const Feature& feature, bool status)
+{
+	std::string result = sendQuery("SET " + feature + " " + (status ? "ON" : "OFF"));
+	detectError(result);
+}
+
+std::vector<std::string> TcpClient::get
+	(const std::string& subcmd, const std::string& params)
+{
+	std::string req = subcmd;
+	if(!params.empty())
+	{
+		req += " " + params;
+	}
+	std::string res = sendQuery("GET " + req);
+	detectError(res);
+	if(res.substr(0, req.size()) != req)
+	{
+		throw NutException("Invalid response");
+	}
+
+	return explode(res, req.size());
+}
+
+std::vector<std::vector<std::string> > TcpClient::list
+	(const std::string& subcmd, const std::string& params)
+{
+	std::string req = subcmd;
+	if(!params.empty())
+	{
+		req += " " + params;
+	}
+	std::vector<std::string> query;
+	query.push_back("LIST " + req);
+	sendAsyncQueries(query);
+	return parseList(req);
+}
+
+std::vector<std::vector<std::string> > TcpClient::parseList
+	(const std::string& req)
+{
+	std::vector<std::vector<std::string> > arr;
+	parseList(req, [&arr](const std::string& line, size_t begin)
+	{
+		arr.push_back(explode(line, begin));
+	});
+	return arr;
+}
+
+void TcpClient::parseList
+	(const std::string& req, const std::function<void(const std::string& line, size_t begin)>& item)
+{
+	std::string res = readLine();
+	detectError(res);
+	if(res != ("BEGIN LIST " + req))
+	{
+		throw NutException("Invalid response");
+	}
+
+	// One line buffer for the whole list, its items start with <req>
+	const std::string end = "END LIST " + req;
+	while(true)
+	{
+		readLine(res);
+		detectError(res);
+		if(res == end)
+		{
+			return;
+		}
+		if(res.compare(0, req.size(), req) == 0)
+		{
+			item(res, req.size());
+		}
+		else
+		{
+			throw NutException("Invalid response");
+		}
+	}
+}
+
+void TcpClient::readLine(std::string& line)
 {
-	// Do not connect now
+	while(true)
+	{
+		_socket->read(line);
+		if(!_pushed || !queuePushedChange(line))
+		{
+			return;
+		}
+	}
 }
 
-TcpClient::TcpClient(const std::string& host, uint16_t port):
-Client(),
-_timeout(0),
-_socket(new internal::Socket)
+std::string TcpClient::readLine()
 {
-	connect(host, port);
+	std::string line;
+	readLine(line);
+	return line;
 }
 
-TcpClient::~TcpClient()
+std::string TcpClient::sendQuery(const std::string& req)
 {
-	delete _socket;
+	readPendingAnswers();
+	_socket->write(req);
+	return readLine();
 }
 
-void TcpClient::connect(const std::string& host, uint16_t port)
+void TcpClient::sendAsyncQueries(const std::vector<std::string>& req)
 {
-	_host = host;
-	_port = port;
-	connect();
+	readPendingAnswers();
+	for (std::vector<std::string>::const_iterator it = req.cbegin(); it != req.cend(); ++it)
+	{
+		_socket->write(*it);
+	}
 }
 
-void TcpClient::connect()
+void TcpClient::detectError(const std::string& req)
 {
-	_socket->connect(_host, _port);
+	if(req.compare(0, 3, "ERR")==0)
+	{
+		throw NutException(req.substr(4));
+	}
 }
 
-void TcpClient::setDebugConnect(bool d)
+std::vector<std::string> TcpClient::explode(const std::string& str, size_t begin)
 {
-	_socket->setDebugConnect(d);
+	std::vector<std::string> res;
+	explode(str, begin, res);
+	return res;
 }
 
-std::string TcpClient::getHost()const
+void TcpClient::explode(const std::string& str, size_t begin, std::vector<std::string>& tokens)
 {
-	return _host;
+	/* The token strings of an earlier call are reused, keeping their storage */
+	size_t count = 0;
+	std::string* temp = &nextToken(tokens, count);
+
+	enum STATE {
+		INIT,
+		SIMPLE_STRING,
+		QUOTED_STRING,
+		SIMPLE_ESCAPE,
+		QUOTED_ESCAPE
+	} state = INIT;
+
+	for(size_t idx=begin; idx<str.size(); ++idx)
+	{
+		char c = str[idx];
+		switch(state)
+		{
+		case INIT:
+			if(c==' ' /* || c=='\t' */)
+			{ /* Do nothing */ }
+			else if(c=='"')
+			{
+				state = QUOTED_STRING;
+			}
+			else if(c=='\\')
+			{
+				state = SIMPLE_ESCAPE;
+			}
+			/* What about bad characters ? */
+			else
+			{
+				*temp += c;
+				state = SIMPLE_STRING;
+			}
+			break;
+		case SIMPLE_STRING:
+			if(c==' ' /* || c=='\t' */)
+			{
+				/* if(!temp.empty()) : Must not occur */
+					temp = &nextToken(tokens, ++count);
+				state = INIT;
+			}
+			else if(c=='\\')
+			{
+				state = SIMPLE_ESCAPE;
+			}
+			else if(c=='"')
+			{
+				/* if(!temp.empty()) : Must not occur */
+					temp = &nextToken(tokens, ++count);
+				state = QUOTED_STRING;
+			}
+			/* What about bad characters ? */
+			else
+			{
+				*temp += c;
+			}
+			break;
+		case QUOTED_STRING:
+			if(c=='\\')
+			{
+				state = QUOTED_ESCAPE;
+			}
+			else if(c=='"')
+			{
+				temp = &nextToken(tokens, ++count);
+				state = INIT;
+			}
+			/* What about bad characters ? */
+			else
+			{
+				*temp += c;
+			}
+			break;
+		case SIMPLE_ESCAPE:
+			if(c=='\\' || c=='"' || c==' ' /* || c=='\t'*/)
+			{
+				*temp += c;
+			}
+			else
+			{
+				*temp += '\\' + c; // Really do this ?
+			}
+			state = SIMPLE_STRING;
+			break;
+		case QUOTED_ESCAPE:
+			if(c=='\\' || c=='"')
+			{
+				*temp += c;
+			}
+			else
+			{
+				*temp += '\\' + c; // Really do this ?
+			}
+			state = QUOTED_STRING;
+			break;
+
+#if (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_PUSH_POP) && ( (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_COVERED_SWITCH_DEFAULT) || (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_UNREACHABLE_CODE) )
+# pragma GCC diagnostic push
+#endif
+#ifdef HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_COVERED_SWITCH_DEFAULT
+# pragma GCC diagnostic ignored "-Wcovered-switch-default"
+#endif
+#ifdef HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_UNREACHABLE_CODE
+# pragma GCC diagnostic ignored "-Wunreachable-code"
+#endif
+/* Older CLANG (e.g. clang-3.4) seems to not support the GCC pragmas above */
+#ifdef __clang__
+# pragma clang diagnostic push
+# pragma clang diagnostic ignored "-Wunreachable-code"
+# pragma clang diagnostic ignored "-Wcovered-switch-default"
+#endif
+		default:
+			/* Must not occur. */
+			break;
+#ifdef __clang__
+# pragma clang diagnostic pop
+#endif
+#if (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_PUSH_POP) && ( (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_COVERED_SWITCH_DEFAULT) || (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_UNREACHABLE_CODE) )
+# pragma GCC diagnostic pop
+#endif
+		}
+	}
+
+	if(!temp->empty())
+	{
+		++count;
+	}
+
+	tokens.resize(count);
 }
 
-uint16_t TcpClient::getPort()const
+std::string& TcpClient::nextToken(std::vector<std::string>& tokens, size_t count)
 {
-	return _port;
+	if(count == tokens.size())
+	{
+		tokens.emplace_back();
+	}
+	tokens[count].clear();
+	return tokens[count];
 }
 
-bool TcpClient::isConnected()const
+std::string TcpClient::escape(const std::string& str)
 {
-	return _socket->isConnected();
+	std::string res = "\"";
+
+	for(size_t n=0; n<str.size(); n++)
+	{
+		char c = str[n];
+		if(c=='"')
+			res += "\\\"";
+		else if(c=='\\')
+			res += "\\\\";
+		else
+			res += c;
+	}
+
+	res += '"';
+	return res;
 }
 
-void TcpClient::disconnect()
+TrackingID TcpClient::sendTrackingQuery(const std::string& req)
 {
-	_socket->disconnect();
+	return parseTrackingReply(sendQuery(req));
 }
 
-void TcpClient::setTimeout(time_t timeout)
+TrackingID TcpClient::parseTrackingReply(const std::string& reply)
 {
-	_timeout = timeout;
+	detectError(reply);
+	std::vector<std::string> res = explode(reply);
+
+	if (res.size() == 1 && res[0] == "OK")
+	{
+		return TrackingID("");
+	}
+	else if (res.size() == 3 && res[0] == "OK" && res[1] == "TRACKING")
+	{
+		return TrackingID(res[2]);
+	}
+	else
+	{
+		throw NutException("Unknown query result");
+	}
 }
 
-time_t TcpClient::getTimeout()const
+std::future<std::vector<std::string> > TcpClient::getDeviceVariableValueAsync(const std::string& dev, const std::string& name)
 {
-	return _timeout;
+	return getAsync("VAR", dev + " " + name);
 }
 
-void TcpClient::authenticate(const std::string& user, const std::string& passwd)
+std::future<std::map<std::string,std::vector<std::string> > > TcpClient::getDeviceVariableValuesAsync(const std::string& dev)
 {
-	detectError(sendQuery("USERNAME " + user));
-	detectError(sendQuery("PASSWORD " + passwd));
+	const std::string req = "VAR " + dev;
+	std::shared_ptr<internal::AsyncRequest> ar = sendAsyncRequest("LIST " + req, req);
+	return std::async(std::launch::deferred, [this, ar, req]()
+	{
+		waitAsyncRequest(*ar);
+		std::map<std::string,std::vector<std::string> > res;
+		std::vector<std::string> tokens;
+		for (const std::string& line : ar->lines)
+		{
+			explode(line, req.size(), tokens);
+			if (tokens.empty())
+			{
+				continue;
+			}
+			std::vector<std::string>& values = res[tokens[0]];
+			values.assign(tokens.begin() + 1, tokens.end());
+		}
+		return res;
+	});
+}
+
+std::future<TrackingID> TcpClient::setDeviceVariableAsync(const std::string& dev, const std::string& name, const std::vector<std::string>& values)
+{
+	std::string query = "SET VAR " + dev + " " + name;
+	for(size_t n=0; n<values.size(); ++n)
+	{
+		query += " " + escape(values[n]);
+	}
+	std::shared_ptr<internal::AsyncRequest> ar = sendAsyncRequest(query);
+	return std::async(std::launch::deferred, [this, ar]()
+	{
+		waitAsyncRequest(*ar);
+		return parseTrackingReply(ar->lines[0]);
+	});
+}
+
+std::future<TrackingID> TcpClient::executeDeviceCommandAsync(const std::string& dev, const std::string& name, const std::string& param)
+{
+	std::shared_ptr<internal::AsyncRequest> ar = sendAsyncRequest("INSTCMD " + dev + " " + name + " " + param);
+	return std::async(std::launch::deferred, [this, ar]()
+	{
+		waitAsyncRequest(*ar);
+		return parseTrackingReply(ar->lines[0]);
+	});
+}
+
+std::future<std::vector<std::string> > TcpClient::getAsync
+	(const std::string& subcmd, const std::string& params)
+{
+	std::string req = subcmd;
+	if(!params.empty())
+	{
+		req += " " + params;
+	}
+	std::shared_ptr<internal::AsyncRequest> ar = sendAsyncRequest("GET " + req);
+	return std::async(std::launch::deferred, [this, ar, req]()
+	{
+		waitAsyncRequest(*ar);
+		const std::string& res = ar->lines[0];
+		detectError(res);
+		if(res.compare(0, req.size(), req) != 0)
+		{
+			throw NutException("Invalid response");
+		}
+		return explode(res, req.size());
+	});
+}
+
+std::future<std::vector<std::vector<std::string> > > TcpClient::listAsync
+	(const std::string& subcmd, const std::string& params)
+{
+	std::string req = subcmd;
+	if(!params.empty())
+	{
+		req += " " + params;
+	}
+	std::shared_ptr<internal::AsyncRequest> ar = sendAsyncRequest("LIST " + req, req);
+	return std::async(std::launch::deferred, [this, ar, req]()
+	{
+		waitAsyncRequest(*ar);
+		std::vector<std::vector<std::string> > arr;
+		for (const std::string& line : ar->lines)
+		{
+			arr.push_back(explode(line, req.size()));
+		}
+		return arr;
+	});
 }
 
-void TcpClient::logout()
+void TcpClient::watchDevice(const std::string& dev, const std::set<std::string>& names)
 {
-	detectError(sendQuery("LOGOUT"));
-	_socket->disconnect();
-}
+	WatchedDevice watched;
+	watched.names = names;
+	watched.pushed = false;
 
-Device TcpClient::getDevice(const std::string& name)
-{
-	try
+	std::string req = "WATCH " + dev;
+	for(const std::string& name : names)
 	{
-		get("UPSDESC", name);
+		req += " " + name;
 	}
-	catch(NutException& ex)
+	std::string res = sendQuery(req);
+	if(res != "ERR UNKNOWN-COMMAND")
 	{
-		if(ex.str()=="UNKNOWN-UPS")
-			return Device(nullptr, "");
-		else
+		detectError(res);
+		if(res != "OK WATCH " + dev)
+		{
+			throw NutException("Invalid response");
+		}
+		watched.pushed = true;
+		_pushed = true;
+	}
+	else
+	{
+		// Older servers: poll, for deltas if they know LIST VAR ... SINCE
+		watched.cursor = "0";
+		try
+		{
+			getDeviceVariableChanges(dev, watched.cursor, watched.values);
+		}
+		catch(IOException&)
+		{
 			throw;
+		}
+		catch(NutException& ex)
+		{
+			if(std::string(ex.what()) != "INVALID-ARGUMENT")
+			{
+				throw;
+			}
+			watched.cursor.clear();
+			watched.values = getDeviceVariableValues(dev);
+		}
+		_nextPoll = std::chrono::steady_clock::now() + _pollInterval;
 	}
-	return Device(this, name);
+	_watched[dev] = watched;
 }
 
-std::set<std::string> TcpClient::getDeviceNames()
+void TcpClient::unwatchDevice(const std::string& dev)
 {
-	std::set<std::string> res;
-
-	std::vector<std::vector<std::string> > devs = list("UPS");
-	for(std::vector<std::vector<std::string> >::iterator it=devs.begin();
-		it!=devs.end(); ++it)
+	bool pushed = false;
+	for(const std::pair<const std::string, WatchedDevice>& watched : _watched)
 	{
-		std::string id = (*it)[0];
-		if(!id.empty())
-			res.insert(id);
+		if(watched.second.pushed && (dev.empty() || watched.first == dev))
+		{
+			pushed = true;
+		}
 	}
-
-	return res;
-}
-
-std::string TcpClient::getDeviceDescription(const std::string& name)
-{
-	return get("UPSDESC", name)[0];
-}
-
-std::set<std::string> TcpClient::getDeviceVariableNames(const std::string& dev)
-{
-	std::set<std::string> set;
-
-	std::vector<std::vector<std::string> > res = list("VAR", dev);
-	for(size_t n=0; n<res.size(); ++n)
+	if(pushed)
 	{
-		set.insert(res[n][0]);
+		detectError(sendQuery(dev.empty() ? std::string("UNWATCH") : "UNWATCH " + dev));
 	}
 
-	return set;
+	if(dev.empty())
+	{
+		_watched.clear();
+		_changes.clear();
+		return;
+	}
+	_watched.erase(dev);
+	for(std::deque<VariableChange>::iterator it = _changes.begin(); it != _changes.end(); )
+	{
+		it = it->device == dev ? _changes.erase(it) : it + 1;
+	}
 }
 
-std::set<std::string> TcpClient::getDeviceRWVariableNames(const std::string& dev)
+bool TcpClient::queuePushedChange(const std::string& line)
 {
-	std::set<std::string> set;
-
-	std::vector<std::vector<std::string> > res = list("RW", dev);
-	for(size_t n=0; n<res.size(); ++n)
+	const bool changed = line.compare(0, 8, "CHANGED ") == 0;
+	if(!changed && line.compare(0, 8, "DELETED ") != 0)
 	{
-		set.insert(res[n][0]);
+		return false;
 	}
 
-	return set;
-}
+	std::vector<std::string> tokens = explode(line, 8);
+	if(tokens.size() < 2)
+	{
+		return true;
+	}
+	// Late ones may come for what is not watched any more
+	std::map<std::string, WatchedDevice>::const_iterator it = _watched.find(tokens[0]);
+	if(it == _watched.end()
+	|| (!it->second.names.empty() && it->second.names.count(tokens[1]) == 0))
+	{
+		return true;
+	}
 
-std::string TcpClient::getDeviceVariableDescription(const std::string& dev, const std::string& name)
-{
-	return get("DESC", dev + " " + name)[0];
+	VariableChange change;
+	change.device = tokens[0];
+	change.name = tokens[1];
+	change.values.assign(tokens.begin() + 2, tokens.end());
+	change.deleted = !changed;
+	_changes.push_back(change);
+	return true;
 }
 
-std::vector<std::string> TcpClient::getDeviceVariableValue(const std::string& dev, const std::string& name)
+/* Queue the changes from <before> to <after> of the variables in <names>
+ * (all if empty) */
+static void diffValues(const std::string& dev, const std::set<std::string>& names,
+	const std::map<std::string,std::vector<std::string> >& before,
+	const std::map<std::string,std::vector<std::string> >& after,
+	std::deque<VariableChange>& changes)
 {
-	return get("VAR", dev + " " + name);
+	std::map<std::string,std::vector<std::string> >::const_iterator b = before.cbegin(), a = after.cbegin();
+	while(b != before.cend() || a != after.cend())
+	{
+		VariableChange change;
+		change.device = dev;
+		change.deleted = false;
+		if(a == after.cend() || (b != before.cend() && b->first < a->first))
+		{
+			change.name = b->first;
+			change.deleted = true;
+			++b;
+		}
+		else if(b == before.cend() || a->first < b->first)
+		{
+			change.name = a->first;
+			change.values = a->second;
+			++a;
+		}
+		else
+		{
+			bool same = a->second == b->second;
+			change.name = a->first;
+			change.values = a->second;
+			++a;
+			++b;
+			if(same)
+			{
+				continue;
+			}
+		}
+		if(names.empty() || names.count(change.name))
+		{
+			changes.push_back(change);
+		}
+	}
 }
 
-std::map<std::string,std::vector<std::string> > TcpClient::getDeviceVariableValues(const std::string& dev)
+void TcpClient::pollWatchedDevices()
 {
-
-	std::map<std::string,std::vector<std::string> >  map;
-
-	std::vector<std::vector<std::string> > res = list("VAR", dev);
-	for(size_t n=0; n<res.size(); ++n)
+	// Devices without deltas are listed together
+	std::set<std::string> listed;
+	for(std::pair<const std::string, WatchedDevice>& watched : _watched)
 	{
-		std::vector<std::string>& vals = res[n];
-		std::string var = vals[0];
-		vals.erase(vals.begin());
-		map[var] = vals;
+		WatchedDevice& w = watched.second;
+		if(w.pushed)
+		{
+			continue;
+		}
+		if(w.cursor.empty())
+		{
+			listed.insert(watched.first);
+			continue;
+		}
+		std::map<std::string,std::vector<std::string> > values = w.values;
+		getDeviceVariableChanges(watched.first, w.cursor, values);
+		diffValues(watched.first, w.names, w.values, values, _changes);
+		w.values.swap(values);
 	}
 
-	return map;
+	if(!listed.empty())
+	{
+		std::map<std::string,std::map<std::string,std::vector<std::string> > > all = getDevicesVariableValues(listed);
+		for(const std::string& dev : listed)
+		{
+			WatchedDevice& w = _watched[dev];
+			diffValues(dev, w.names, w.values, all[dev], _changes);
+			w.values.swap(all[dev]);
+		}
+	}
 }
 
-std::map<std::string,std::map<std::string,std::vector<std::string> > > TcpClient::getDevicesVariableValues(const std::set<std::string>& devs)
+size_t TcpClient::waitChanges(std::vector<VariableChange>& changes, int timeout)
 {
-	std::map<std::string,std::map<std::string,std::vector<std::string> > > map;
+	changes.clear();
+	// Pushed changes are the only lines expected from now on
+	readPendingAnswers();
 
-	if (devs.empty())
+	bool polled = false;
+	for(const std::pair<const std::string, WatchedDevice>& watched : _watched)
 	{
-		// This request might come from processing the empty valid
-		// response of an upsd server which was allowed to start
-		// with no device sections in its ups.conf
-		return map;
+		polled = polled || !watched.second.pushed;
 	}
 
-	std::vector<std::string> queries;
-	for (std::set<std::string>::const_iterator it=devs.cbegin(); it!=devs.cend(); ++it)
+	const std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout);
+	std::string line;
+	while(true)
 	{
-		queries.push_back("LIST VAR " + *it);
-	}
-	sendAsyncQueries(queries);
+		std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+		if(polled && now >= _nextPoll)
+		{
+			pollWatchedDevices();
+			_nextPoll = now + _pollInterval;
+		}
+		if(!_changes.empty() || (!_pushed && !polled))
+		{
+			break;
+		}
 
-	for (std::set<std::string>::const_iterator it=devs.cbegin(); it!=devs.cend(); ++it)
-	{
-		try
+		// Until the deadline or the next poll, whichever comes first
+		std::chrono::milliseconds wait(-1);
+		if(timeout >= 0)
 		{
-			std::map<std::string,std::vector<std::string> > map2;
-			std::vector<std::vector<std::string> > res = parseList("VAR " + *it);
-			for (std::vector<std::vector<std::string> >::iterator it2=res.begin(); it2!=res.end(); ++it2)
+			wait = std::max(std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now), std::chrono::milliseconds(0));
+		}
+		if(polled)
+		{
+			std::chrono::milliseconds poll = std::max(std::chrono::duration_cast<std::chrono::milliseconds>(_nextPoll - now), std::chrono::milliseconds(0));
+			wait = wait.count() < 0 ? poll : std::min(wait, poll);
+		}
+
+		if(_pushed)
+		{
+			if(_socket->waitReadable(static_cast<int>(wait.count())))
 			{
-				std::vector<std::string>& vals = *it2;
-				std::string var = vals[0];
-				vals.erase(vals.begin());
-				map2[var] = vals;
+				// Other lines are not expected: dropped
+				_socket->read(line);
+				queuePushedChange(line);
+				continue;
 			}
-			map[*it] = map2;
 		}
-		catch (NutException&)
+		else
 		{
-			// We sent a bunch of queries, we need to process them all to clear up the backlog.
+			std::this_thread::sleep_for(wait);
+		}
+
+		if(timeout >= 0 && std::chrono::steady_clock::now() >= deadline)
+		{
+			break;
 		}
 	}
 
-	if (map.empty())
+	// Those already received along with the first one
+	while(_pushed && _socket->isConnected() && _socket->waitReadable(0))
 	{
-		// We may fail on some devices, but not on ALL devices.
-		throw NutException("Invalid device");
+		_socket->read(line);
+		queuePushedChange(line);
 	}
 
-	return map;
+	size_t count = _changes.size();
+	if(_changeCallback)
+	{
+		// The callback may watch or unwatch devices
+		std::deque<VariableChange> taken;
+		taken.swap(_changes);
+		for(const VariableChange& change : taken)
+		{
+			_changeCallback(change);
+		}
+	}
+	else
+	{
+		changes.assign(_changes.begin(), _changes.end());
+		_changes.clear();
+	}
+	return count;
 }
 
-TrackingID TcpClient::setDeviceVariable(const std::string& dev, const std::string& name, const std::string& value)
+void TcpClient::setChangeCallback(const ChangeCallback& callback)
 {
-	std::string query = "SET VAR " + dev + " " + name + " " + escape(value);
-	return sendTrackingQuery(query);
+	_changeCallback = callback;
 }
 
-TrackingID TcpClient::setDeviceVariable(const std::string& dev, const std::string& name, const std::vector<std::string>& values)
+void TcpClient::setChangePollInterval(int interval)
 {
-	std::string query = "SET VAR " + dev + " " + name;
-	for(size_t n=0; n<values.size(); ++n)
-	{
-		query += " " + escape(values[n]);
-	}
-	return sendTrackingQuery(query);
+	_pollInterval = std::chrono::milliseconds(interval > 0 ? interval : 1);
 }
 
-std::set<std::string> TcpClient::getDeviceCommandNames(const std::string& dev)
+void TcpClient::setMaxPendingRequests(size_t max)
 {
-	std::set<std::string> cmds;
-
-	std::vector<std::vector<std::string> > res = list("CMD", dev);
-	for(size_t n=0; n<res.size(); ++n)
-	{
-		cmds.insert(res[n][0]);
-	}
-
-	return cmds;
+	_maxPending = max > 0 ? max : 1;
 }
 
-std::string TcpClient::getDeviceCommandDescription(const std::string& dev, const std::string& name)
+size_t TcpClient::getPendingRequests()const
 {
-	return get("CMDDESC", dev + " " + name)[0];
+	return _pending.size();
 }
 
-TrackingID TcpClient::executeDeviceCommand(const std::string& dev, const std::string& name, const std::string& param)
+std::shared_ptr<internal::AsyncRequest> TcpClient::sendAsyncRequest
+	(const std::string& req, const std::string& list)
 {
-	return sendTrackingQuery("INSTCMD " + dev + " " + name + " " + param);
+	// Keep what upsd has to queue for us bounded
+	while (_pending.size() >= _maxPending)
+	{
+		readPendingAnswers(_pending.front().get());
+	}
+
+	_socket->write(req);
+	std::shared_ptr<internal::AsyncRequest> ar = std::make_shared<internal::AsyncRequest>(list);
+	_pending.push_back(ar);
+	return ar;
 }
 
-std::map<std::string, std::set<std::string>> TcpClient::listDeviceClients(void)
+void TcpClient::readPendingAnswers(const internal::AsyncRequest* req)
 {
-	/* Lists all clients of all devices (which have at least one client) */
-	std::map<std::string, std::set<std::string>> deviceClientsMap;
-
-	std::set<std::string> devs = getDeviceNames();
-	for(std::set<std::string>::iterator it=devs.begin(); it!=devs.end(); ++it)
+	while (!_pending.empty())
 	{
-		std::string dev = *it;
-		std::set<std::string> deviceClients = deviceGetClients(dev);
-		if (!deviceClients.empty()) {
-			deviceClientsMap[dev] = deviceClients;
+		std::shared_ptr<internal::AsyncRequest> ar = _pending.front();
+		try
+		{
+			std::string line = readLine();
+			if (ar->list.empty())
+			{
+				ar->lines.push_back(line);
+			}
+			else if (line.compare(0, 3, "ERR") == 0)
+			{
+				ar->error = std::make_exception_ptr(NutException(line.substr(4)));
+			}
+			else if (line != "BEGIN LIST " + ar->list)
+			{
+				throw NutException("Invalid response");
+			}
+			else
+			{
+				const std::string end = "END LIST " + ar->list;
+				while (true)
+				{
+					readLine(line);
+					if (line == end)
+					{
+						break;
+					}
+					if (line.compare(0, ar->list.size(), ar->list) != 0)
+					{
+						throw NutException("Invalid response");
+					}
+					ar->lines.push_back(line);
+				}
+			}
+		}
+		catch (...)
+		{
+			// The answers which follow can not be told apart any more
+			_socket->disconnect();
+			failPendingRequests(std::current_exception());
+			return;
+		}
+		ar->done = true;
+		_pending.pop_front();
+		if (ar.get() == req)
+		{
+			return;
 		}
 	}
-
-	return deviceClientsMap;
 }
 
-std::set<std::string> TcpClient::deviceGetClients(const std::string& dev)
+void TcpClient::waitAsyncRequest(internal::AsyncRequest& req)
 {
-	/* Who did a deviceLogin() to this dev? */
-	std::set<std::string> clients;
-
-	std::vector<std::vector<std::string> > res = list("CLIENT", dev);
-	for(size_t n=0; n<res.size(); ++n)
+	// Not done yet means still pending, which reading the answers ends
+	if (!req.done)
 	{
-		clients.insert(res[n][0]);
+		readPendingAnswers(&req);
+	}
+	if (req.error)
+	{
+		std::rethrow_exception(req.error);
 	}
-
-	return clients;
 }
 
-void TcpClient::deviceLogin(const std::string& dev)
+void TcpClient::failPendingRequests(std::exception_ptr error)
 {
-	/* Requires that current session is already logged in with
-	 * an account which has one of "upsmon" roles in `upsd.users` */
-	detectError(sendQuery("LOGIN " + dev));
+	for (std::shared_ptr<internal::AsyncRequest>& ar : _pending)
+	{
+		ar->error = error;
+		ar->done = true;
+	}
+	_pending.clear();
 }
 
-/* NOTE: "master" is deprecated since NUT v2.8.0 in favor of "primary".
- * For the sake of old/new server/client interoperability,
- * practical implementations should try to use one and fall
- * back to the other, and only fail if both return "ERR".
+/*
+ *
+ * Caching client implementation
+ *
  */
-void TcpClient::deviceMaster(const std::string& dev)
-{
-	try {
-		detectError(sendQuery("MASTER " + dev));
-	} catch (NutException &exOrig) {
-		try {
-			detectError(sendQuery("PRIMARY " + dev));
-		} catch (NutException &exRetry) {
-			NUT_UNUSED_VARIABLE(exRetry);
-			throw exOrig;
-		}
-	}
+
+CachingClient::CachingClient(Client& client, time_t ttl):
+Client(),
+_client(client),
+_tcpClient(dynamic_cast<TcpClient*>(&client)),
+_ttl(ttl)
+{
 }
 
-void TcpClient::devicePrimary(const std::string& dev)
+CachingClient::~CachingClient()
 {
-	try {
-		detectError(sendQuery("PRIMARY " + dev));
-	} catch (NutException &exOrig) {
-		try {
-			detectError(sendQuery("MASTER " + dev));
-		} catch (NutException &exRetry) {
-			NUT_UNUSED_VARIABLE(exRetry);
-			throw exOrig;
-		}
-	}
 }
 
-void TcpClient::deviceForcedShutdown(const std::string& dev)
+void CachingClient::setTTL(time_t ttl)
 {
-	detectError(sendQuery("FSD " + dev));
+	_ttl = std::chrono::seconds(ttl);
 }
 
-int TcpClient::deviceGetNumLogins(const std::string& dev)
+void CachingClient::setVariableTTL(const std::string& name, time_t ttl)
 {
-	std::string num = get("NUMLOGINS", dev)[0];
-	return atoi(num.c_str());
+	_ttls[name] = std::chrono::seconds(ttl);
 }
 
-TrackingResult TcpClient::getTrackingResult(const TrackingID& id)
+std::chrono::seconds CachingClient::getTTL(const std::string& name)const
 {
-	if (id.empty())
+	std::map<std::string, std::chrono::seconds>::const_iterator it = _ttls.find(name);
+	return it != _ttls.end() ? it->second : _ttl;
+}
+
+void CachingClient::invalidate(const std::string& dev)
+{
+	if (dev.empty())
 	{
-		return TrackingResult::SUCCESS;
+		_devices.clear();
 	}
-
-	std::string result = sendQuery("GET TRACKING " + id);
-
-	if (result == "PENDING")
+	else
 	{
-		return TrackingResult::PENDING;
+		_devices.erase(dev);
 	}
-	else if (result == "SUCCESS")
+}
+
+CachingClient::DeviceCache& CachingClient::fetch(const std::string& dev, std::chrono::seconds ttl)
+{
+	const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+	std::map<std::string, DeviceCache>::iterator it = _devices.find(dev);
+	if (it != _devices.end() && now - it->second.fetched < ttl)
 	{
-		return TrackingResult::SUCCESS;
+		return it->second;
 	}
-	else if (result == "ERR UNKNOWN")
+
+	const bool added = it == _devices.end();
+	if (added)
 	{
-		return TrackingResult::UNKNOWN;
+		it = _devices.insert(std::make_pair(dev, DeviceCache())).first;
 	}
-	else if (result == "ERR INVALID-ARGUMENT")
+	DeviceCache& cache = it->second;
+	try
 	{
-		return TrackingResult::INVALID_ARGUMENT;
+		fetch(dev, cache);
 	}
-	else
+	catch (...)
 	{
-		return TrackingResult::FAILURE;
+		if (added)
+		{
+			_devices.erase(it);
+		}
+		throw;
 	}
+	cache.fetched = now;
+	return cache;
 }
 
-bool TcpClient::isFeatureEnabled(const Feature& feature)
+void CachingClient::fetch(const std::string& dev, DeviceCache& cache)
 {
-	std::string result = sendQuery("GET " + feature);
-	detectError(result);
-
-	if (result == "ON")
-	{
-		return true;
-	}
-	else if (result == "OFF")
+	if (_tcpClient)
 	{
-		return false;
+		std::string cursor = cache.cursor.empty() ? "0" : cache.cursor;
+		try
+		{
+			_tcpClient->getDeviceVariableChanges(dev, cursor, cache.values);
+			cache.cursor = cursor;
+		}
+		catch (IOException&)
+		{
+			throw;
+		}
+		catch (NutException& ex)
+		{
+			// Servers before protocol 1.4 do not know SINCE
+			if (std::string(ex.what()) != "INVALID-ARGUMENT")
+			{
+				throw;
+			}
+			_tcpClient = nullptr;
+		}
 	}
-	else
+	if (!_tcpClient)
 	{
-		throw NutException("Unknown feature result " + result);
+		cache.values = _client.getDeviceVariableValues(dev);
+		cache.cursor.clear();
 	}
 }
-void TcpClient::setFeature(const Feature& feature, bool status)
+
+void CachingClient::authenticate(const std::string& user, const std::string& passwd)
 {
-	std::string result = sendQuery("SET " + feature + " " + (status ? "ON" : "OFF"));
-	detectError(result);
+	_client.authenticate(user, passwd);
 }
 
-std::vector<std::string> TcpClient::get
-	(const std::string& subcmd, const std::string& params)
+void CachingClient::logout()
 {
-	std::string req = subcmd;
-	if(!params.empty())
-	{
-		req += " " + params;
-	}
-	std::string res = sendQuery("GET " + req);
-	detectError(res);
-	if(res.substr(0, req.size()) != req)
-	{
-		throw NutException("Invalid response");
-	}
+	_client.logout();
+	invalidate();
+}
 
-	return explode(res, req.size());
+std::set<std::string> CachingClient::getDeviceNames()
+{
+	return _client.getDeviceNames();
 }
 
-std::vector<std::vector<std::string> > TcpClient::list
-	(const std::string& subcmd, const std::string& params)
+std::string CachingClient::getDeviceDescription(const std::string& name)
 {
-	std::string req = subcmd;
-	if(!params.empty())
-	{
-		req += " " + params;
-	}
-	std::vector<std::string> query;
-	query.push_back("LIST " + req);
-	sendAsyncQueries(query);
-	return parseList(req);
+	return _client.getDeviceDescription(name);
 }
 
-std::vector<std::vector<std::string> > TcpClient::parseList
-	(const std::string& req)
+std::set<std::string> CachingClient::getDeviceVariableNames(const std::string& dev)
 {
-	std::string res = _socket->read();
-	detectError(res);
-	if(res != ("BEGIN LIST " + req))
+	std::set<std::string> names;
+	const DeviceCache& cache = fetch(dev, _ttl);
+	for (std::map<std::string,std::vector<std::string> >::const_iterator it = cache.values.cbegin(); it != cache.values.cend(); ++it)
 	{
-		throw NutException("Invalid response");
+		names.insert(it->first);
 	}
+	return names;
+}
 
-	std::vector<std::vector<std::string> > arr;
-	while(true)
-	{
-		res = _socket->read();
-		detectError(res);
-		if(res == ("END LIST " + req))
-		{
-			return arr;
-		}
-		if(res.substr(0, req.size()) == req)
-		{
-			arr.push_back(explode(res, req.size()));
-		}
-		else
-		{
-			throw NutException("Invalid response");
-		}
-	}
+std::set<std::string> CachingClient::getDeviceRWVariableNames(const std::string& dev)
+{
+	return _client.getDeviceRWVariableNames(dev);
 }
 
-std::string TcpClient::sendQuery(const std::string& req)
+bool CachingClient::hasDeviceVariable(const std::string& dev, const std::string& name)
 {
-	_socket->write(req);
-	return _socket->read();
+	const DeviceCache& cache = fetch(dev, getTTL(name));
+	return cache.values.find(name) != cache.values.end();
 }
 
-void TcpClient::sendAsyncQueries(const std::vector<std::string>& req)
+std::string CachingClient::getDeviceVariableDescription(const std::string& dev, const std::string& name)
 {
-	for (std::vector<std::string>::const_iterator it = req.cbegin(); it != req.cend(); ++it)
-	{
-		_socket->write(*it);
-	}
+	return _client.getDeviceVariableDescription(dev, name);
 }
 
-void TcpClient::detectError(const std::string& req)
+std::vector<std::string> CachingClient::getDeviceVariableValue(const std::string& dev, const std::string& name)
 {
-	if(req.substr(0,3)=="ERR")
+	const DeviceCache& cache = fetch(dev, getTTL(name));
+	std::map<std::string,std::vector<std::string> >::const_iterator it = cache.values.find(name);
+	if (it == cache.values.end())
 	{
-		throw NutException(req.substr(4));
+		throw NutException("VAR-NOT-SUPPORTED");
 	}
+	return it->second;
 }
 
-std::vector<std::string> TcpClient::explode(const std::string& str, size_t begin)
+std::map<std::string,std::vector<std::string> > CachingClient::getDeviceVariableValues(const std::string& dev)
 {
-	std::vector<std::string> res;
-	std::string temp;
+	return fetch(dev, _ttl).values;
+}
 
-	enum STATE {
-		INIT,
-		SIMPLE_STRING,
-		QUOTED_STRING,
-		SIMPLE_ESCAPE,
-		QUOTED_ESCAPE
-	} state = INIT;
+TrackingID CachingClient::setDeviceVariable(const std::string& dev, const std::string& name, const std::string& value)
+{
+	TrackingID id = _client.setDeviceVariable(dev, name, value);
+	invalidate(dev);
+	return id;
+}
 
-	for(size_t idx=begin; idx<str.size(); ++idx)
-	{
-		char c = str[idx];
-		switch(state)
-		{
-		case INIT:
-			if(c==' ' /* || c=='\t' */)
-			{ /* Do nothing */ }
-			else if(c=='"')
-			{
-				state = QUOTED_STRING;
-			}
-			else if(c=='\\')
-			{
-				state = SIMPLE_ESCAPE;
-			}
-			/* What about bad characters ? */
-			else
-			{
-				temp += c;
-				state = SIMPLE_STRING;
-			}
-			break;
-		case SIMPLE_STRING:
-			if(c==' ' /* || c=='\t' */)
-			{
-				/* if(!temp.empty()) : Must not occur */
-					res.push_back(temp);
-				temp.clear();
-				state = INIT;
-			}
-			else if(c=='\\')
-			{
-				state = SIMPLE_ESCAPE;
-			}
-			else if(c=='"')
-			{
-				/* if(!temp.empty()) : Must not occur */
-					res.push_back(temp);
-				temp.clear();
-				state = QUOTED_STRING;
-			}
-			/* What about bad characters ? */
-			else
-			{
-				temp += c;
-			}
-			break;
-		case QUOTED_STRING:
-			if(c=='\\')
-			{
-				state = QUOTED_ESCAPE;
-			}
-			else if(c=='"')
-			{
-				res.push_back(temp);
-				temp.clear();
-				state = INIT;
-			}
-			/* What about bad characters ? */
-			else
-			{
-				temp += c;
-			}
-			break;
-		case SIMPLE_ESCAPE:
-			if(c=='\\' || c=='"' || c==' ' /* || c=='\t'*/)
-			{
-				temp += c;
-			}
-			else
-			{
-				temp += '\\' + c; // Really do this ?
-			}
-			state = SIMPLE_STRING;
-			break;
-		case QUOTED_ESCAPE:
-			if(c=='\\' || c=='"')
-			{
-				temp += c;
-			}
-			else
-			{
-				temp += '\\' + c; // Really do this ?
-			}
-			state = QUOTED_STRING;
-			break;
+TrackingID CachingClient::setDeviceVariable(const std::string& dev, const std::string& name, const std::vector<std::string>& values)
+{
+	TrackingID id = _client.setDeviceVariable(dev, name, values);
+	invalidate(dev);
+	return id;
+}
 
-#if (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_PUSH_POP) && ( (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_COVERED_SWITCH_DEFAULT) || (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_UNREACHABLE_CODE) )
-# pragma GCC diagnostic push
-#endif
-#ifdef HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_COVERED_SWITCH_DEFAULT
-# pragma GCC diagnostic ignored "-Wcovered-switch-default"
-#endif
-#ifdef HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_UNREACHABLE_CODE
-# pragma GCC diagnostic ignored "-Wunreachable-code"
-#endif
-/* Older CLANG (e.g. clang-3.4) seems to not support the GCC pragmas above */
-#ifdef __clang__
-# pragma clang diagnostic push
-# pragma clang diagnostic ignored "-Wunreachable-code"
-# pragma clang diagnostic ignored "-Wcovered-switch-default"
-#endif
-		default:
-			/* Must not occur. */
-			break;
-#ifdef __clang__
-# pragma clang diagnostic pop
-#endif
-#if (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_PUSH_POP) && ( (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_COVERED_SWITCH_DEFAULT) || (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_UNREACHABLE_CODE) )
-# pragma GCC diagnostic pop
-#endif
-		}
-	}
+std::set<std::string> CachingClient::getDeviceCommandNames(const std::string& dev)
+{
+	return _client.getDeviceCommandNames(dev);
+}
+
+std::string CachingClient::getDeviceCommandDescription(const std::string& dev, const std::string& name)
+{
+	return _client.getDeviceCommandDescription(dev, name);
+}
+
+TrackingID CachingClient::executeDeviceCommand(const std::string& dev, const std::string& name, const std::string& param)
+{
+	TrackingID id = _client.executeDeviceCommand(dev, name, param);
+	invalidate(dev);
+	return id;
+}
+
+void CachingClient::deviceLogin(const std::string& dev)
+{
+	_client.deviceLogin(dev);
+}
+
+void CachingClient::deviceMaster(const std::string& dev)
+{
+	_client.deviceMaster(dev);
+}
 
-	if(!temp.empty())
-	{
-		res.push_back(temp);
-	}
+void CachingClient::devicePrimary(const std::string& dev)
+{
+	_client.devicePrimary(dev);
+}
 
-	return res;
+void CachingClient::deviceForcedShutdown(const std::string& dev)
+{
+	_client.deviceForcedShutdown(dev);
+	invalidate(dev);
 }
 
-std::string TcpClient::escape(const std::string& str)
+int CachingClient::deviceGetNumLogins(const std::string& dev)
 {
-	std::string res = "\"";
+	return _client.deviceGetNumLogins(dev);
+}
 
-	for(size_t n=0; n<str.size(); n++)
-	{
-		char c = str[n];
-		if(c=='"')
-			res += "\\\"";
-		else if(c=='\\')
-			res += "\\\\";
-		else
-			res += c;
-	}
+std::set<std::string> CachingClient::deviceGetClients(const std::string& dev)
+{
+	return _client.deviceGetClients(dev);
+}
 
-	res += '"';
-	return res;
+std::map<std::string, std::set<std::string>> CachingClient::listDeviceClients(void)
+{
+	return _client.listDeviceClients();
 }
 
-TrackingID TcpClient::sendTrackingQuery(const std::string& req)
+TrackingResult CachingClient::getTrackingResult(const TrackingID& id)
 {
-	std::string reply = sendQuery(req);
-	detectError(reply);
-	std::vector<std::string> res = explode(reply);
+	return _client.getTrackingResult(id);
+}
 
-	if (res.size() == 1 && res[0] == "OK")
-	{
-		return TrackingID("");
-	}
-	else if (res.size() == 3 && res[0] == "OK" && res[1] == "TRACKING")
-	{
-		return TrackingID(res[2]);
-	}
-	else
-	{
-		throw NutException("Unknown query result");
-	}
+bool CachingClient::isFeatureEnabled(const Feature& feature)
+{
+	return _client.isFeatureEnabled(feature);
+}
+
+void CachingClient::setFeature(const Feature& feature, bool status)
+{
+	_client.setFeature(feature, status);
 }
 
 /*
@@ -1758,98 +3571,679 @@ std::string Variable::getDescription()
 	return getDevice()->getClient()->getDeviceVariableDescription(getDevice()->getName(), getName());
 }
 
-void Variable::setValue(const std::string& value)
-{
-	getDevice()->setVariable(getName(), value);
+void Variable::setValue(const std::string& value)
+{
+	getDevice()->setVariable(getName(), value);
+}
+
+void Variable::setValues(const std::vector<std::string>& values)
+{
+	getDevice()->setVariable(getName(), values);
+}
+
+
+/*
+ *
+ * Command implementation
+ *
+ */
+
+Command::Command(Device* dev, const std::string& name):
+_device(dev),
+_name(name)
+{
+}
+
+Command::Command(const Command& cmd):
+_device(cmd._device),
+_name(cmd._name)
+{
+}
+
+Command& Command::operator=(const Command& cmd)
+{
+	// Self assignment?
+	if (this==&cmd)
+		return *this;
+
+	_device = cmd._device;
+	_name = cmd._name;
+	return *this;
+}
+
+Command::~Command()
+{
+}
+
+std::string Command::getName()const
+{
+	return _name;
+}
+
+const Device* Command::getDevice()const
+{
+	return _device;
+}
+
+Device* Command::getDevice()
+{
+	return _device;
+}
+
+bool Command::isOk()const
+{
+	return _device!=nullptr && !_name.empty();
+}
+
+Command::operator bool()const
+{
+	return isOk();
+}
+
+bool Command::operator!()const
+{
+	return !isOk();
+}
+
+bool Command::operator==(const Command& cmd)const
+{
+	return cmd._device==_device && cmd._name==_name;
+}
+
+bool Command::operator<(const Command& cmd)const
+{
+	return getName()<cmd.getName();
+}
+
+std::string Command::getDescription()
+{
+	return getDevice()->getClient()->getDeviceCommandDescription(getDevice()->getName(), getName());
+}
+
+void Command::execute(const std::string& param)
+{
+	getDevice()->executeCommand(getName(), param);
+}
+
+/*
+ *
+ * Client pool implementation
+ *
+ */
+
+ClientPool::Lease::Lease(ClientPool* pool, size_t slot):
+_pool(pool),
+_slot(slot),
+_invalid(false)
+{
+}
+
+ClientPool::Lease::Lease(Lease&& lease) noexcept:
+_pool(lease._pool),
+_slot(lease._slot),
+_invalid(lease._invalid)
+{
+	lease._pool = nullptr;
+}
+
+ClientPool::Lease& ClientPool::Lease::operator=(Lease&& lease) noexcept
+{
+	if (this != &lease)
+	{
+		release();
+		_pool = lease._pool;
+		_slot = lease._slot;
+		_invalid = lease._invalid;
+		lease._pool = nullptr;
+	}
+	return *this;
+}
+
+ClientPool::Lease::~Lease()
+{
+	release();
+}
+
+TcpClient* ClientPool::Lease::operator->()const
+{
+	return get();
+}
+
+TcpClient& ClientPool::Lease::operator*()const
+{
+	return *get();
+}
+
+TcpClient* ClientPool::Lease::get()const
+{
+	return _pool ? _pool->_slots[_slot].client.get() : nullptr;
+}
+
+void ClientPool::Lease::invalidate()
+{
+	_invalid = true;
+}
+
+void ClientPool::Lease::release()
+{
+	if (_pool)
+	{
+		_pool->release(_slot, _invalid);
+		_pool = nullptr;
+	}
+}
+
+ClientPool::ClientPool(const std::string& host, uint16_t port, size_t size):
+_host(host),
+_port(port),
+_slots(size > 0 ? size : 1),
+_generation(0),
+_minDelay(1),
+_maxDelay(60),
+_delay(0),
+_healthCheck(30)
+{
+	for (Slot& slot : _slots)
+	{
+		slot.client.reset(new TcpClient);
+		slot.leased = false;
+		slot.generation = 0;
+	}
+}
+
+ClientPool::~ClientPool()
+{
+}
+
+void ClientPool::setAuthentication(const std::string& user, const std::string& passwd)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	_user = user;
+	_passwd = passwd;
+	++_generation;
+}
+
+void ClientPool::setFeature(const Feature& feature, bool status)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	_features[feature] = status;
+	++_generation;
+}
+
+void ClientPool::setReconnectDelay(time_t min, time_t max)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	_minDelay = std::chrono::seconds(min);
+	_maxDelay = std::chrono::seconds(max > min ? max : min);
+}
+
+void ClientPool::setHealthCheckInterval(time_t interval)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	_healthCheck = std::chrono::seconds(interval);
+}
+
+size_t ClientPool::getSize()const
+{
+	return _slots.size();
+}
+
+std::string ClientPool::getHost()const
+{
+	return _host;
+}
+
+uint16_t ClientPool::getPort()const
+{
+	return _port;
+}
+
+ClientPool::Lease ClientPool::acquire()
+{
+	size_t n;
+	unsigned long generation;
+	std::chrono::seconds healthCheck;
+	{
+		std::unique_lock<std::mutex> lock(_mutex);
+		while (true)
+		{
+			// Prefer a connected client to one which must connect
+			size_t unconnected = _slots.size();
+			for (n = 0; n < _slots.size(); ++n)
+			{
+				if (_slots[n].leased)
+				{
+					continue;
+				}
+				if (_slots[n].client->isConnected())
+				{
+					break;
+				}
+				if (unconnected == _slots.size())
+				{
+					unconnected = n;
+				}
+			}
+			if (n == _slots.size())
+			{
+				n = unconnected;
+			}
+			if (n < _slots.size())
+			{
+				break;
+			}
+			_released.wait(lock);
+		}
+		_slots[n].leased = true;
+		generation = _generation;
+		healthCheck = _healthCheck;
+	}
+
+	// From now on the slot is ours, and goes back to the pool on errors
+	Lease lease(this, n);
+	Slot& slot = _slots[n];
+	TcpClient& client = *slot.client;
+	if (client.isConnected())
+	{
+		if (slot.generation != generation)
+		{
+			client.disconnect();
+		}
+		else if (std::chrono::steady_clock::now() - slot.lastUsed >= healthCheck)
+		{
+			try
+			{
+				client.sendQuery("VER");
+			}
+			catch (NutException&)
+			{
+				client.disconnect();
+			}
+		}
+	}
+	if (!client.isConnected())
+	{
+		connect(slot);
+	}
+	return lease;
+}
+
+void ClientPool::connect(Slot& slot)
+{
+	std::string user, passwd;
+	std::map<Feature, bool> features;
+	unsigned long generation;
+	const std::chrono::steady_clock::time_point attempt = std::chrono::steady_clock::now();
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		if (attempt < _retryAt)
+		{
+			throw IOException("Cannot connect to host");
+		}
+		user = _user;
+		passwd = _passwd;
+		features = _features;
+		generation = _generation;
+	}
+
+	TcpClient& client = *slot.client;
+	try
+	{
+		client.connect(_host, _port);
+		if (!user.empty())
+		{
+			client.authenticate(user, passwd);
+		}
+		for (const std::pair<const Feature, bool>& feature : features)
+		{
+			client.setFeature(feature.first, feature.second);
+		}
+	}
+	catch (NutException&)
+	{
+		client.disconnect();
+		std::lock_guard<std::mutex> lock(_mutex);
+		// Once for the attempts which failed together
+		if (_retryAt <= attempt)
+		{
+			_delay = _delay.count() > 0 ? std::min(_delay * 2, _maxDelay) : _minDelay;
+			_retryAt = std::chrono::steady_clock::now() + _delay;
+		}
+		throw;
+	}
+
+	std::lock_guard<std::mutex> lock(_mutex);
+	_delay = std::chrono::seconds(0);
+	slot.generation = generation;
 }
 
-void Variable::setValues(const std::vector<std::string>& values)
+void ClientPool::release(size_t n, bool drop)
 {
-	getDevice()->setVariable(getName(), values);
+	Slot& slot = _slots[n];
+	// The answers of pending requests would go to the next lease
+	if (drop || slot.client->getPendingRequests() > 0)
+	{
+		slot.client->disconnect();
+	}
+	slot.lastUsed = std::chrono::steady_clock::now();
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		slot.leased = false;
+	}
+	_released.notify_one();
 }
 
-
 /*
  *
- * Command implementation
+ * Multiple servers client implementation
  *
  */
 
-Command::Command(Device* dev, const std::string& name):
-_device(dev),
-_name(name)
+struct MultiClient::Batch
+{
+	Query query;
+	std::chrono::seconds timeout;
+	std::mutex mutex;
+	std::condition_variable done;
+	/* Servers asked which did not answer yet */
+	std::set<std::string> pending;
+	/* Set once the call returned: late answers are dropped */
+	bool closed;
+	DeviceValues values;
+	ServerErrors errors;
+};
+
+MultiClient::MultiClient(size_t threads):
+_threads(threads > 0 ? threads : 1),
+_stop(false),
+_generation(0),
+_deadline(5),
+_minDelay(1),
+_maxDelay(60)
 {
 }
 
-Command::Command(const Command& cmd):
-_device(cmd._device),
-_name(cmd._name)
+MultiClient::~MultiClient()
 {
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_stop = true;
+	}
+	_queued.notify_all();
+	for (std::thread& worker : _workers)
+	{
+		worker.join();
+	}
 }
 
-Command& Command::operator=(const Command& cmd)
+std::string MultiClient::serverName(const std::string& host, uint16_t port)
 {
-	// Self assignment?
-	if (this==&cmd)
-		return *this;
+	if (port == 3493 || host.compare(0, 5, "unix:") == 0)
+	{
+		return host;
+	}
+	return host + ":" + std::to_string(port);
+}
 
-	_device = cmd._device;
-	_name = cmd._name;
-	return *this;
+void MultiClient::addServer(const std::string& host, uint16_t port)
+{
+	const std::string name = serverName(host, port);
+	std::lock_guard<std::mutex> lock(_mutex);
+	if (_servers.find(name) != _servers.end())
+	{
+		return;
+	}
+
+	std::shared_ptr<Server> server = std::make_shared<Server>();
+	server->host = host;
+	server->port = port;
+	server->name = name;
+	server->client.reset(new TcpClient);
+	server->busy = false;
+	server->generation = 0;
+	server->delay = std::chrono::seconds(0);
+	_servers[name] = server;
 }
 
-Command::~Command()
+void MultiClient::removeServer(const std::string& host, uint16_t port)
 {
+	// A worker still busy with it keeps it until done
+	std::lock_guard<std::mutex> lock(_mutex);
+	_servers.erase(serverName(host, port));
 }
 
-std::string Command::getName()const
+std::set<std::string> MultiClient::getServers()const
 {
-	return _name;
+	std::set<std::string> names;
+	std::lock_guard<std::mutex> lock(_mutex);
+	for (const std::pair<const std::string, std::shared_ptr<Server> >& server : _servers)
+	{
+		names.insert(server.first);
+	}
+	return names;
 }
 
-const Device* Command::getDevice()const
+void MultiClient::setAuthentication(const std::string& user, const std::string& passwd)
 {
-	return _device;
+	std::lock_guard<std::mutex> lock(_mutex);
+	_user = user;
+	_passwd = passwd;
+	++_generation;
 }
 
-Device* Command::getDevice()
+void MultiClient::setDeadline(time_t deadline)
 {
-	return _device;
+	std::lock_guard<std::mutex> lock(_mutex);
+	_deadline = std::chrono::seconds(deadline > 0 ? deadline : 1);
 }
 
-bool Command::isOk()const
+void MultiClient::setReconnectDelay(time_t min, time_t max)
 {
-	return _device!=nullptr && !_name.empty();
+	std::lock_guard<std::mutex> lock(_mutex);
+	_minDelay = std::chrono::seconds(min);
+	_maxDelay = std::chrono::seconds(max > min ? max : min);
 }
 
-Command::operator bool()const
+MultiClient::DeviceValues MultiClient::query(const Query& query, ServerErrors* errors)
 {
-	return isOk();
+	std::shared_ptr<Batch> batch = std::make_shared<Batch>();
+	batch->query = query;
+	batch->closed = false;
+
+	std::chrono::steady_clock::time_point deadline;
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+		deadline = now + _deadline;
+		batch->timeout = _deadline;
+
+		for (const std::pair<const std::string, std::shared_ptr<Server> >& it : _servers)
+		{
+			Server& server = *it.second;
+			if (server.busy)
+			{
+				batch->errors[server.name] = "Busy with an earlier request";
+				continue;
+			}
+			// Only the worker asking it touches the client meanwhile
+			if (!server.client->isConnected() && now < server.retryAt)
+			{
+				batch->errors[server.name] = server.lastError;
+				continue;
+			}
+			server.busy = true;
+			batch->pending.insert(server.name);
+			_tasks.push_back(Task{it.second, batch});
+		}
+
+		while (_workers.size() < _threads && _workers.size() < _servers.size())
+		{
+			_workers.emplace_back(&MultiClient::work, this);
+		}
+	}
+	_queued.notify_all();
+
+	std::unique_lock<std::mutex> lock(batch->mutex);
+	batch->done.wait_until(lock, deadline, [&batch]{ return batch->pending.empty(); });
+	batch->closed = true;
+	for (const std::string& name : batch->pending)
+	{
+		batch->errors[name] = "Timed out";
+	}
+
+	if (errors)
+	{
+		errors->swap(batch->errors);
+	}
+	DeviceValues values;
+	values.swap(batch->values);
+	return values;
 }
 
-bool Command::operator!()const
+std::set<std::string> MultiClient::getDeviceNames(ServerErrors* errors)
 {
-	return !isOk();
+	DeviceValues devices = query([](TcpClient& client)
+	{
+		DeviceValues values;
+		for (const std::string& dev : client.getDeviceNames())
+		{
+			values[dev];
+		}
+		return values;
+	}, errors);
+
+	std::set<std::string> names;
+	for (const DeviceValues::value_type& dev : devices)
+	{
+		names.insert(dev.first);
+	}
+	return names;
 }
 
-bool Command::operator==(const Command& cmd)const
+MultiClient::DeviceValues MultiClient::getDevicesVariableValues(ServerErrors* errors)
 {
-	return cmd._device==_device && cmd._name==_name;
+	return query([](TcpClient& client)
+	{
+		return client.getDevicesVariableValues(client.getDeviceNames());
+	}, errors);
 }
 
-bool Command::operator<(const Command& cmd)const
+MultiClient::DeviceValues MultiClient::getDevicesVariableValues(const std::set<std::string>& names, ServerErrors* errors)
 {
-	return getName()<cmd.getName();
+	return query([names](TcpClient& client)
+	{
+		return client.getFleetVariableValues(names);
+	}, errors);
 }
 
-std::string Command::getDescription()
+void MultiClient::work()
 {
-	return getDevice()->getClient()->getDeviceCommandDescription(getDevice()->getName(), getName());
+	std::unique_lock<std::mutex> lock(_mutex);
+	while (true)
+	{
+		_queued.wait(lock, [this]{ return _stop || !_tasks.empty(); });
+		if (_stop)
+		{
+			return;
+		}
+
+		Task task = _tasks.front();
+		_tasks.pop_front();
+		lock.unlock();
+		run(task);
+		lock.lock();
+	}
 }
 
-void Command::execute(const std::string& param)
+void MultiClient::run(const Task& task)
 {
-	getDevice()->executeCommand(getName(), param);
+	Server& server = *task.server;
+	Batch& batch = *task.batch;
+	TcpClient& client = *server.client;
+
+	bool late;
+	{
+		std::lock_guard<std::mutex> lock(batch.mutex);
+		late = batch.closed;
+	}
+
+	std::string user, passwd;
+	unsigned long generation;
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		user = _user;
+		passwd = _passwd;
+		generation = _generation;
+	}
+
+	DeviceValues values;
+	std::string error;
+	bool connected = false, unreachable = false;
+	if (!late)
+	{
+		try
+		{
+			client.setTimeout(static_cast<time_t>(batch.timeout.count()));
+			if (client.isConnected() && server.generation != generation)
+			{
+				client.disconnect();
+			}
+			if (!client.isConnected())
+			{
+				try
+				{
+					client.connect(server.host, server.port);
+					if (!user.empty())
+					{
+						client.authenticate(user, passwd);
+					}
+				}
+				catch (...)
+				{
+					unreachable = true;
+					throw;
+				}
+				server.generation = generation;
+				connected = true;
+			}
+			values = batch.query(client);
+		}
+		catch (std::exception& ex)
+		{
+			error = ex.what();
+			client.disconnect();
+		}
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		if (unreachable)
+		{
+			server.delay = server.delay.count() > 0 ? std::min(server.delay * 2, _maxDelay) : _minDelay;
+			server.retryAt = std::chrono::steady_clock::now() + server.delay;
+			server.lastError = error;
+		}
+		else if (connected)
+		{
+			server.delay = std::chrono::seconds(0);
+		}
+		server.busy = false;
+	}
+
+	std::lock_guard<std::mutex> lock(batch.mutex);
+	batch.pending.erase(server.name);
+	if (!batch.closed)
+	{
+		for (DeviceValues::value_type& dev : values)
+		{
+			batch.values[dev.first + "@" + server.name].swap(dev.second);
+		}
+		if (!error.empty())
+		{
+			batch.errors[server.name] = error;
+		}
+	}
+	batch.done.notify_one();
 }
 
 } /* namespace nut */
@@ -1977,6 +4371,24 @@ int nutclient_tcp_reconnect(NUTCLIENT_TCP_t client)
 	return -1;
 }
 
+int nutclient_tcp_start_tls(NUTCLIENT_TCP_t client, int verifycert)
+{
+	if(client)
+	{
+		nut::TcpClient* cl = dynamic_cast<nut::TcpClient*>(static_cast<nut::Client*>(client));
+		if(cl)
+		{
+			try
+			{
+				cl->startTLS(verifycert != 0);
+				return 0;
+			}
+			catch(...){}
+		}
+	}
+	return -1;
+}
+
 void nutclient_tcp_set_timeout(NUTCLIENT_TCP_t client, time_t timeout)
 {
 	if(client)
@@ -2002,6 +4414,75 @@ time_t nutclient_tcp_get_timeout(NUTCLIENT_TCP_t client)
 	return -1;
 }
 
+int nutclient_tcp_watch_device(NUTCLIENT_TCP_t client, const char* dev, const strarr names)
+{
+	if(client)
+	{
+		nut::TcpClient* cl = dynamic_cast<nut::TcpClient*>(static_cast<nut::Client*>(client));
+		if(cl)
+		{
+			try
+			{
+				std::set<std::string> vars;
+				for(strarr pstr = names; pstr && *pstr; ++pstr)
+				{
+					vars.insert(std::string(*pstr));
+				}
+				cl->watchDevice(dev, vars);
+				return 0;
+			}
+			catch(...){}
+		}
+	}
+	return -1;
+}
+
+int nutclient_tcp_unwatch_device(NUTCLIENT_TCP_t client, const char* dev)
+{
+	if(client)
+	{
+		nut::TcpClient* cl = dynamic_cast<nut::TcpClient*>(static_cast<nut::Client*>(client));
+		if(cl)
+		{
+			try
+			{
+				cl->unwatchDevice(dev ? dev : "");
+				return 0;
+			}
+			catch(...){}
+		}
+	}
+	return -1;
+}
+
+int nutclient_tcp_wait_changes(NUTCLIENT_TCP_t client, int timeout, NUTCLIENT_CHANGE_CB_t cb, void* arg)
+{
+	if(client)
+	{
+		nut::TcpClient* cl = dynamic_cast<nut::TcpClient*>(static_cast<nut::Client*>(client));
+		if(cl)
+		{
+			try
+			{
+				std::vector<nut::VariableChange> changes;
+				cl->waitChanges(changes, timeout);
+				for(const nut::VariableChange& change : changes)
+				{
+					strarr values = change.deleted ? nullptr : stringvector_to_strarr(change.values);
+					cb(change.device.c_str(), change.name.c_str(), values, arg);
+					if(values)
+					{
+						strarr_free(values);
+					}
+				}
+				return static_cast<int>(changes.size());
+			}
+			catch(...){}
+		}
+	}
+	return -1;
+}
+
 void nutclient_authenticate(NUTCLIENT_t client, const char* login, const char* passwd)
 {
 	if(client)
@@ -2253,6 +4734,121 @@ strarr nutclient_get_device_variable_values(NUTCLIENT_t client, const char* dev,
 	return nullptr;
 }
 
+/* Pack the variables of <devs> in one block: the header, the variables,
+ * the value pointers and then all the strings */
+static NUTCLIENT_VARIABLES_t* variables_alloc(nut::Client* cl, const std::set<std::string>& devs)
+{
+	struct var_offsets
+	{
+		size_t dev, name, firstvalue, numvalues;
+	};
+	std::vector<var_offsets> vars;
+	std::vector<size_t> values;
+	std::string strings;
+	std::string lastdev;
+	size_t lastdevoff = 0;
+
+	cl->visitDevicesVariableValues(devs, [&](const std::string& dev, const std::string& name, const std::vector<std::string>& vals)
+	{
+		if(vars.empty() || dev != lastdev)
+		{
+			lastdev = dev;
+			lastdevoff = strings.size();
+			strings.append(dev.c_str(), dev.size() + 1);
+		}
+		var_offsets var;
+		var.dev = lastdevoff;
+		var.name = strings.size();
+		strings.append(name.c_str(), name.size() + 1);
+		var.firstvalue = values.size();
+		var.numvalues = vals.size();
+		for(const std::string& val : vals)
+		{
+			values.push_back(strings.size());
+			strings.append(val.c_str(), val.size() + 1);
+		}
+		// Room for the NULL ending the values of this variable
+		values.push_back(SIZE_MAX);
+		vars.push_back(var);
+	});
+
+	const size_t varsoff = sizeof(NUTCLIENT_VARIABLES_t);
+	const size_t valuesoff = varsoff + vars.size() * sizeof(NUTCLIENT_VARIABLE_t);
+	const size_t stringsoff = valuesoff + values.size() * sizeof(const char*);
+	char* block = static_cast<char*>(xcalloc(1, stringsoff + strings.size()));
+	if (block == nullptr) {
+		throw nut::NutException("Out of memory");
+	}
+
+	// All the offsets are multiples of the pointer size
+	NUTCLIENT_VARIABLES_t* res = static_cast<NUTCLIENT_VARIABLES_t*>(static_cast<void*>(block));
+	NUTCLIENT_VARIABLE_t* resvars = static_cast<NUTCLIENT_VARIABLE_t*>(static_cast<void*>(block + varsoff));
+	const char** resvalues = static_cast<const char**>(static_cast<void*>(block + valuesoff));
+	char* resstrings = block + stringsoff;
+
+	memcpy(resstrings, strings.data(), strings.size());
+	for(size_t n = 0; n < values.size(); ++n)
+	{
+		resvalues[n] = values[n] == SIZE_MAX ? nullptr : resstrings + values[n];
+	}
+	for(size_t n = 0; n < vars.size(); ++n)
+	{
+		resvars[n].dev = resstrings + vars[n].dev;
+		resvars[n].name = resstrings + vars[n].name;
+		resvars[n].values = resvalues + vars[n].firstvalue;
+		resvars[n].numvalues = vars[n].numvalues;
+	}
+	res->count = vars.size();
+	res->vars = resvars;
+	return res;
+}
+
+NUTCLIENT_VARIABLES_t* nutclient_get_devices_variables_values(NUTCLIENT_t client, const strarr devs)
+{
+	if(client)
+	{
+		nut::Client* cl = static_cast<nut::Client*>(client);
+		if(cl)
+		{
+			try
+			{
+				std::set<std::string> names;
+				for(strarr pstr = devs; pstr && *pstr; ++pstr)
+				{
+					names.insert(std::string(*pstr));
+				}
+				return variables_alloc(cl, names);
+			}
+			catch(...){}
+		}
+	}
+	return nullptr;
+}
+
+NUTCLIENT_VARIABLES_t* nutclient_get_device_variables_values(NUTCLIENT_t client, const char* dev)
+{
+	if(client)
+	{
+		nut::Client* cl = static_cast<nut::Client*>(client);
+		if(cl)
+		{
+			try
+			{
+				std::set<std::string> names;
+				names.insert(std::string(dev));
+				return variables_alloc(cl, names);
+			}
+			catch(...){}
+		}
+	}
+	return nullptr;
+}
+
+void nutclient_variables_free(NUTCLIENT_VARIABLES_t* vars)
+{
+	free(vars);
+}
+
 void nutclient_set_device_variable_value(NUTCLIENT_t client, const char* dev, const char* var, const char* value)
 {
 	if(client)
@@ -28,6 +28,14 @@
 #include <map>
 #include <set>
 #include <exception>
+#include <functional>
+#include <future>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
 #include <cstdint>
 #include <ctime>
 
@@ -42,11 +50,14 @@ namespace nut
 namespace internal
 {
 class Socket;
+struct AsyncRequest;
 } /* namespace internal */
 
 
 class Client;
 class TcpClient;
+class ClientPool;
+class MultiClient;
 class Device;
 class Variable;
 class Command;
@@ -149,6 +160,20 @@ typedef enum
 
 typedef std::string Feature;
 
+/**
+ * Change of a variable watched with TcpClient::watchDevice().
+ */
+struct VariableChange
+{
+	std::string device;
+	std::string name;
+	/* New values, empty when the variable was removed */
+	std::vector<std::string> values;
+	bool deleted;
+};
+
+typedef std::function<void(const VariableChange& change)> ChangeCallback;
+
 /**
  * A nut client is the starting point to dialog to NUTD.
  * It can connect to an NUTD then retrieve its device list.
@@ -264,6 +289,19 @@ public:
 	 * \return Variable values indexed by variable names, indexed by device names.
 	 */
 	virtual std::map<std::string,std::map<std::string,std::vector<std::string> > > getDevicesVariableValues(const std::set<std::string>& devs);
+	/**
+	 * Called for each variable walked by visitDevicesVariableValues(),
+	 * with the device name, variable name and values. These are only
+	 * valid during the call.
+	 */
+	typedef std::function<void(const std::string& dev, const std::string& name, const std::vector<std::string>& values)> VariableVisitor;
+	/**
+	 * Walk the values of all variables of a set of devices, without
+	 * building maps of them (so that the caller can fill its own).
+	 * \param devs Device names
+	 * \param visitor Called for each variable.
+	 */
+	virtual void visitDevicesVariableValues(const std::set<std::string>& devs, const VariableVisitor& visitor);
 	/**
 	 * Intend to set the value of a variable.
 	 * \param dev Device name
@@ -376,6 +414,7 @@ class TcpClient : public Client
 	 * generally, but still want covered with integration tests
 	 */
 	friend class NutActiveClientTest;
+	friend class ClientPool;
 
 public:
 	/**
@@ -386,16 +425,16 @@ public:
 
 	/**
 	 * Construct a nut TcpClient object then connect it to the specified server.
-	 * \param host Server host name.
-	 * \param port Server port.
+	 * \param host Server host name, or "unix:/path" of a local upsd socket.
+	 * \param port Server port (not used for local sockets).
 	 */
 	TcpClient(const std::string& host, uint16_t port = 3493);
 	~TcpClient() override;
 
 	/**
 	 * Connect it to the specified server.
-	 * \param host Server host name.
-	 * \param port Server port.
+	 * \param host Server host name, or "unix:/path" of a local upsd socket.
+	 * \param port Server port (not used for local sockets).
 	 */
 	void connect(const std::string& host, uint16_t port = 3493);
 
@@ -411,6 +450,36 @@ public:
 	 */
 	void setDebugConnect(bool d);
 
+	/**
+	 * Set up TLS for all TcpClient connections, before the first
+	 * startTLS(). Without it, TLS is set up on first use with the
+	 * default certificates of the TLS library.
+	 * \param certPath With OpenSSL, directory of the (hashed) CA
+	 * certificates; with NSS, directory of the certificate database.
+	 * \param certName With NSS, nickname of the client certificate
+	 * to present to the server, if any.
+	 * \param certPasswd With NSS, password of the certificate database.
+	 * Throws IOException if TLS was already set up, or cannot be.
+	 */
+	static void initTLS(const std::string& certPath = "",
+		const std::string& certName = "", const std::string& certPasswd = "");
+
+	/**
+	 * Secure the connection with STARTTLS.
+	 * The TLS session is then kept per host and port, and connect()
+	 * issues STARTTLS again by itself, resuming the session instead
+	 * of a full handshake when the server allows it.
+	 * \param verifyCert Verify the certificate (and name) of the server.
+	 * Throws IOException if the client was built without TLS support
+	 * or the handshake fails, and NutException if the server refuses.
+	 */
+	void startTLS(bool verifyCert = false);
+
+	/**
+	 * Test if the connection is secured by TLS.
+	 */
+	bool isTLS()const;
+
 	/**
 	 * Test if the connection is active.
 	 * \return tru if the connection is active.
@@ -456,7 +525,39 @@ public:
 	virtual std::string getDeviceVariableDescription(const std::string& dev, const std::string& name) override;
 	virtual std::vector<std::string> getDeviceVariableValue(const std::string& dev, const std::string& name) override;
 	virtual std::map<std::string,std::vector<std::string> > getDeviceVariableValues(const std::string& dev) override;
+	/**
+	 * Retrieve values of some variables of a device in one round trip
+	 * (GET VARS, needs protocol version 1.4).
+	 * \param dev Device name
+	 * \param names Variable names
+	 * \return Variable values indexed by variable names; variables
+	 * not supported by the device are left out.
+	 */
+	std::map<std::string,std::vector<std::string> > getDeviceVariableValues(const std::string& dev, const std::set<std::string>& names);
 	virtual std::map<std::string,std::map<std::string,std::vector<std::string> > > getDevicesVariableValues(const std::set<std::string>& devs) override;
+	virtual void visitDevicesVariableValues(const std::set<std::string>& devs, const VariableVisitor& visitor) override;
+	/**
+	 * Update the variables of a device with what changed since an earlier
+	 * call (LIST VAR ... SINCE, needs protocol version 1.4).
+	 * \param dev Device name
+	 * \param cursor "0" for the first call, then the one it was set to,
+	 * which is updated for the next one.
+	 * \param values Variable values indexed by variable names, as left
+	 * by the earlier call; updated.
+	 */
+	void getDeviceVariableChanges(const std::string& dev, std::string& cursor, std::map<std::string,std::vector<std::string> >& values);
+	/**
+	 * Retrieve some variables of all devices, or of those whose names
+	 * match a pattern, in one round trip (LIST FLEET, needs protocol
+	 * version 1.4).
+	 * \param names Variable names
+	 * \param pattern Device name pattern, where '*' stands for any text
+	 * and '?' for any character.
+	 * \return Variable values indexed by device names, then by variable
+	 * names; variables not supported by a device are left out, and so
+	 * are devices whose driver is not connected or whose data is stale.
+	 */
+	std::map<std::string,std::map<std::string,std::vector<std::string> > > getFleetVariableValues(const std::set<std::string>& names, const std::string& pattern = "*");
 	virtual TrackingID setDeviceVariable(const std::string& dev, const std::string& name, const std::string& value) override;
 	virtual TrackingID setDeviceVariable(const std::string& dev, const std::string& name, const std::vector<std::string>& values) override;
 
@@ -481,26 +582,280 @@ public:
 	virtual bool isFeatureEnabled(const Feature& feature) override;
 	virtual void setFeature(const Feature& feature, bool status) override;
 
+	/*
+	 * Asynchronous requests.
+	 * Each of them is sent at once, and the returned (deferred) future
+	 * gets its answer from the connection when waited for, reading the
+	 * answers of the requests sent before it along the way: many requests
+	 * can be in flight over one connection, and their answers come back
+	 * in the order they were sent. A synchronous call first reads the
+	 * answers of all the pending requests.
+	 * Like the rest of TcpClient, this is not thread-safe: the futures
+	 * must be waited for from the thread using the client, before the
+	 * client is destroyed. Requests still pending when the connection
+	 * is closed fail with a NotConnectedException, and an IO error while
+	 * reading an answer fails all of them and closes the connection.
+	 */
+
+	/**
+	 * Retrieve the values of a variable of a device asynchronously.
+	 * \param dev Device name
+	 * \param name Variable name
+	 * 
+eturn Future of the variable values
+	 */
+	std::future<std::vector<std::string> > getDeviceVariableValueAsync(const std::string& dev, const std::string& name);
+	/**
+	 * Retrieve all the variables of a device asynchronously.
+	 * \param dev Device name
+	 * 
+eturn Future of the variable values indexed by variable names
+	 */
+	std::future<std::map<std::string,std::vector<std::string> > > getDeviceVariableValuesAsync(const std::string& dev);
+	/**
+	 * Set the values of a variable of a device asynchronously.
+	 * \param dev Device name
+	 * \param name Variable name
+	 * \param values Variable values
+	 * 
+eturn Future of the tracking ID of the request
+	 */
+	std::future<TrackingID> setDeviceVariableAsync(const std::string& dev, const std::string& name, const std::vector<std::string>& values);
+	/**
+	 * Execute an instant command of a device asynchronously.
+	 * \param dev Device name
+	 * \param name Command name
+	 * \param param Additional command parameter
+	 * 
+eturn Future of the tracking ID of the request
+	 */
+	std::future<TrackingID> executeDeviceCommandAsync(const std::string& dev, const std::string& name, const std::string& param="");
+	/**
+	 * Send a GET request asynchronously.
+	 * \param subcmd GET subcommand, such as "VAR"
+	 * \param params Its parameters, such as "ups battery.charge"
+	 * 
+eturn Future of the tokens of the answer following the request
+	 */
+	std::future<std::vector<std::string> > getAsync(const std::string& subcmd, const std::string& params = "");
+	/**
+	 * Send a LIST request asynchronously.
+	 * \param subcmd LIST subcommand, such as "VAR"
+	 * \param params Its parameters, such as "ups"
+	 * 
+eturn Future of the tokens of each item following the request
+	 */
+	std::future<std::vector<std::vector<std::string> > > listAsync(const std::string& subcmd, const std::string& params = "");
+
+	/*
+	 * Subscriptions to variable changes.
+	 * With upsd protocol version 1.4, the changes are pushed by the server
+	 * (WATCH); otherwise they are polled for, with LIST VAR ... SINCE when
+	 * available. Only changes are reported, not the values at the time of
+	 * the subscription. Subscriptions end with the connection.
+	 */
+
+	/**
+	 * Watch the changes of (some) variables of a device; watching it again
+	 * replaces the variables watched.
+	 * \param dev Device name
+	 * \param names Variable names, none to watch all of them
+	 */
+	void watchDevice(const std::string& dev, const std::set<std::string>& names = std::set<std::string>());
+	/**
+	 * Stop watching a device, or all of them.
+	 * \param dev Device name, empty for all of them
+	 */
+	void unwatchDevice(const std::string& dev = "");
+	/**
+	 * Get the changes of the watched variables, waiting for some.
+	 * \param changes Set to the changes, in the order they were reported;
+	 * left empty when a change callback is set, which gets them instead.
+	 * \param timeout Milliseconds to wait for a change at most, 0 to only
+	 * take those already received, negative to wait until there are some.
+	 * \return Number of changes
+	 */
+	size_t waitChanges(std::vector<VariableChange>& changes, int timeout);
+	/**
+	 * Set a callback for waitChanges() to call for each change (from the
+	 * thread calling waitChanges()), or none to return them.
+	 */
+	void setChangeCallback(const ChangeCallback& callback);
+	/**
+	 * Set how often the changes are polled for when the server can not
+	 * push them.
+	 * \param interval Milliseconds between polls (default 1000)
+	 */
+	void setChangePollInterval(int interval);
+
+	/**
+	 * Set how many asynchronous requests may wait for their answers; once
+	 * reached, sending a request first reads the answer of the oldest one.
+	 * \param max Number of requests (default 256), at least 1
+	 */
+	void setMaxPendingRequests(size_t max);
+	/**
+	 * Retrieve the number of asynchronous requests waiting for their answers.
+	 */
+	size_t getPendingRequests()const;
+
 protected:
 	std::string sendQuery(const std::string& req);
 	void sendAsyncQueries(const std::vector<std::string>& req);
 	static void detectError(const std::string& req);
 	TrackingID sendTrackingQuery(const std::string& req);
+	/* Issue STARTTLS then run the handshake */
+	void sendTLSRequest();
 
 	std::vector<std::string> get(const std::string& subcmd, const std::string& params = "");
 
 	std::vector<std::vector<std::string> > list(const std::string& subcmd, const std::string& params = "");
 
 	std::vector<std::vector<std::string> > parseList(const std::string& req);
+	/* Call <item> for each line of the list, the tokens starting at <begin> */
+	void parseList(const std::string& req, const std::function<void(const std::string& line, size_t begin)>& item);
 
 	static std::vector<std::string> explode(const std::string& str, size_t begin=0);
+	/* Same, into <tokens> whose strings are reused */
+	static void explode(const std::string& str, size_t begin, std::vector<std::string>& tokens);
+	static std::string& nextToken(std::vector<std::string>& tokens, size_t count);
 	static std::string escape(const std::string& str);
+	static TrackingID parseTrackingReply(const std::string& reply);
+
+	/* Send <req>, whose answer is a list of <list> items if not empty */
+	std::shared_ptr<internal::AsyncRequest> sendAsyncRequest(const std::string& req, const std::string& list = "");
+	/* Read the answers of the pending requests, up to <req> or all */
+	void readPendingAnswers(const internal::AsyncRequest* req = nullptr);
+	/* Wait for the answer of <req>, throwing its error if any */
+	void waitAsyncRequest(internal::AsyncRequest& req);
+	void failPendingRequests(std::exception_ptr error);
+
+	/* Read a line, queueing the changes pushed meanwhile */
+	void readLine(std::string& line);
+	std::string readLine();
+	bool queuePushedChange(const std::string& line);
+	void pollWatchedDevices();
+
+	struct WatchedDevice
+	{
+		std::set<std::string> names;
+		/* Pushed by the server, or polled for */
+		bool pushed;
+		/* When polled: LIST VAR ... SINCE cursor (empty if not supported)
+		 * and the values last seen */
+		std::string cursor;
+		std::map<std::string,std::vector<std::string> > values;
+	};
 
 private:
 	std::string _host;
 	uint16_t _port;
 	time_t _timeout;
 	internal::Socket* _socket;
+	std::deque<std::shared_ptr<internal::AsyncRequest> > _pending;
+	size_t _maxPending;
+	std::map<std::string, WatchedDevice> _watched;
+	/* Set once the server pushed changes: lines are checked for them */
+	bool _pushed;
+	std::deque<VariableChange> _changes;
+	ChangeCallback _changeCallback;
+	std::chrono::milliseconds _pollInterval;
+	std::chrono::steady_clock::time_point _nextPoll;
+	/* STARTTLS was asked for, to be issued again on reconnection */
+	bool _tls;
+	bool _tlsVerify;
+};
+
+/**
+ * Client caching the variables of the devices of another client.
+ * The variables of a device are fetched all at once, and reads are then
+ * answered from memory until they are older than their time to live.
+ * With a TcpClient (protocol version 1.4), only what changed is fetched
+ * again. Changes made through this client drop the cache of the device.
+ * Other calls are passed to the client, which must outlive this one.
+ */
+class CachingClient : public Client
+{
+public:
+	/**
+	 * Construct a cache over a client.
+	 * \param client Client to fetch the variables with.
+	 * \param ttl Default time to live of the variables, in seconds.
+	 */
+	CachingClient(Client& client, time_t ttl = 5);
+	~CachingClient() override;
+
+	/**
+	 * Set the default time to live of the variables.
+	 * \param ttl Time to live in seconds, 0 to always fetch them.
+	 */
+	void setTTL(time_t ttl);
+	/**
+	 * Set the time to live of one variable, such as a short one for
+	 * "ups.status".
+	 * \param name Variable name
+	 * \param ttl Time to live in seconds, 0 to always fetch it.
+	 */
+	void setVariableTTL(const std::string& name, time_t ttl);
+	/**
+	 * Drop the cache of a device, or of all of them.
+	 * \param dev Device name, empty for all of them.
+	 */
+	void invalidate(const std::string& dev = "");
+
+	virtual void authenticate(const std::string& user, const std::string& passwd) override;
+	virtual void logout() override;
+
+	virtual std::set<std::string> getDeviceNames() override;
+	virtual std::string getDeviceDescription(const std::string& name) override;
+
+	virtual std::set<std::string> getDeviceVariableNames(const std::string& dev) override;
+	virtual std::set<std::string> getDeviceRWVariableNames(const std::string& dev) override;
+	virtual bool hasDeviceVariable(const std::string& dev, const std::string& name) override;
+	virtual std::string getDeviceVariableDescription(const std::string& dev, const std::string& name) override;
+	virtual std::vector<std::string> getDeviceVariableValue(const std::string& dev, const std::string& name) override;
+	virtual std::map<std::string,std::vector<std::string> > getDeviceVariableValues(const std::string& dev) override;
+	virtual TrackingID setDeviceVariable(const std::string& dev, const std::string& name, const std::string& value) override;
+	virtual TrackingID setDeviceVariable(const std::string& dev, const std::string& name, const std::vector<std::string>& values) override;
+
+	virtual std::set<std::string> getDeviceCommandNames(const std::string& dev) override;
+	virtual std::string getDeviceCommandDescription(const std::string& dev, const std::string& name) override;
+	virtual TrackingID executeDeviceCommand(const std::string& dev, const std::string& name, const std::string& param="") override;
+
+	virtual void deviceLogin(const std::string& dev) override;
+	virtual void deviceMaster(const std::string& dev) override;
+	virtual void devicePrimary(const std::string& dev) override;
+	virtual void deviceForcedShutdown(const std::string& dev) override;
+	virtual int deviceGetNumLogins(const std::string& dev) override;
+	virtual std::set<std::string> deviceGetClients(const std::string& dev) override;
+
+	virtual std::map<std::string, std::set<std::string>> listDeviceClients(void) override;
+
+	virtual TrackingResult getTrackingResult(const TrackingID& id) override;
+
+	virtual bool isFeatureEnabled(const Feature& feature) override;
+	virtual void setFeature(const Feature& feature, bool status) override;
+
+private:
+	struct DeviceCache
+	{
+		std::map<std::string,std::vector<std::string> > values;
+		/* LIST VAR ... SINCE cursor, empty when fetched in full */
+		std::string cursor;
+		std::chrono::steady_clock::time_point fetched;
+	};
+
+	/* The cache of <dev>, fetched again if older than <ttl> */
+	DeviceCache& fetch(const std::string& dev, std::chrono::seconds ttl);
+	void fetch(const std::string& dev, DeviceCache& cache);
+	std::chrono::seconds getTTL(const std::string& name)const;
+
+	Client& _client;
+	/* Set when <_client> can fetch changes only */
+	TcpClient* _tcpClient;
+	std::chrono::seconds _ttl;
+	std::map<std::string, std::chrono::seconds> _ttls;
+	std::map<std::string, DeviceCache> _devices;
 };
 
 /**
@@ -823,6 +1178,254 @@ private:
 	std::string _name;
 };
 
+/**
+ * Pool of TCP connections to one NUTD server, for use by several threads.
+ * A thread leases one of its TcpClient objects, which goes back to the pool
+ * when the lease is released. Lost connections are made again at the next
+ * lease (after an increasing delay while the server can not be reached),
+ * redoing the authentication and the features set on the pool.
+ * A leased client, and the Device, Variable and Command objects got from
+ * it, must only be used by the thread holding the lease and until it is
+ * released. All the leases must be released before the pool is destroyed.
+ */
+class ClientPool
+{
+public:
+	/**
+	 * Lease of a client of the pool, released when destroyed.
+	 */
+	class Lease
+	{
+	public:
+		Lease(Lease&& lease) noexcept;
+		Lease& operator=(Lease&& lease) noexcept;
+		Lease(const Lease&) = delete;
+		Lease& operator=(const Lease&) = delete;
+		~Lease();
+
+		TcpClient* operator->()const;
+		TcpClient& operator*()const;
+		TcpClient* get()const;
+
+		/**
+		 * Close the connection when the lease is released, such as after
+		 * an error which may have left it in an unknown state.
+		 */
+		void invalidate();
+		/**
+		 * Give the client back to the pool before the lease is destroyed.
+		 */
+		void release();
+
+	private:
+		friend class ClientPool;
+		Lease(ClientPool* pool, size_t slot);
+
+		ClientPool* _pool;
+		size_t _slot;
+		bool _invalid;
+	};
+
+	/**
+	 * Construct a pool of connections, made when first leased.
+	 * \param host Server host name, or "unix:/path" of a local upsd socket.
+	 * \param port Server port (not used for local sockets).
+	 * \param size Number of connections, at least 1.
+	 */
+	ClientPool(const std::string& host, uint16_t port = 3493, size_t size = 4);
+	~ClientPool();
+	ClientPool(const ClientPool&) = delete;
+	ClientPool& operator=(const ClientPool&) = delete;
+
+	/**
+	 * Log in all the connections with these credentials.
+	 * Connections already made are made again when next leased.
+	 */
+	void setAuthentication(const std::string& user, const std::string& passwd);
+	/**
+	 * Set a feature (such as Client::TRACKING) on all the connections.
+	 * Connections already made are made again when next leased.
+	 */
+	void setFeature(const Feature& feature, bool status);
+	/**
+	 * Set the delay before connecting again after a failed attempt, which
+	 * doubles with each failure from <min> up to <max> (1 and 60 seconds
+	 * by default). Leases asked for in the meantime fail at once.
+	 */
+	void setReconnectDelay(time_t min, time_t max);
+	/**
+	 * Check with a round trip that a connection left unused for this long
+	 * (30 seconds by default) still works before leasing it.
+	 */
+	void setHealthCheckInterval(time_t interval);
+
+	/**
+	 * Lease a client, waiting for one if they are all leased.
+	 * \return The lease of a connected (and logged in) client.
+	 * \throws IOException if the server can not be reached.
+	 */
+	Lease acquire();
+
+	size_t getSize()const;
+	std::string getHost()const;
+	uint16_t getPort()const;
+
+private:
+	struct Slot
+	{
+		std::unique_ptr<TcpClient> client;
+		bool leased;
+		/* Settings generation the connection was made with */
+		unsigned long generation;
+		std::chrono::steady_clock::time_point lastUsed;
+	};
+
+	void connect(Slot& slot);
+	void release(size_t slot, bool drop);
+
+	std::string _host;
+	uint16_t _port;
+	std::vector<Slot> _slots;
+
+	mutable std::mutex _mutex;
+	std::condition_variable _released;
+	std::string _user, _passwd;
+	std::map<Feature, bool> _features;
+	unsigned long _generation;
+	std::chrono::seconds _minDelay, _maxDelay, _delay;
+	std::chrono::steady_clock::time_point _retryAt;
+	std::chrono::seconds _healthCheck;
+};
+
+/**
+ * Client of many NUTD servers at once, for collectors.
+ * Each call asks all the servers in parallel, from a pool of threads with
+ * one TcpClient connection per server, and returns once they all answered
+ * or the deadline passed. The devices of the servers which answered are
+ * merged, named "ups@host" (or "ups@host:port" on another port than 3493),
+ * and the other servers are reported with their error, by "host" (or
+ * "host:port"). A server still busy with a call which ran out of time is
+ * reported as such until it is done with it. A server which could not be
+ * reached is not tried again, and reported at once, until a delay has
+ * passed which doubles with each failure (like in ClientPool).
+ * A MultiClient is used by one thread at a time.
+ */
+class MultiClient
+{
+public:
+	/* Variable values indexed by device names, then by variable names */
+	typedef std::map<std::string,std::map<std::string,std::vector<std::string> > > DeviceValues;
+	/* Errors indexed by server names (host or host:port) */
+	typedef std::map<std::string,std::string> ServerErrors;
+	/* What to ask each server, devices named as the server knows them */
+	typedef std::function<DeviceValues(TcpClient& client)> Query;
+
+	/**
+	 * Construct a client of no server yet.
+	 * \param threads Most servers asked at once, at least 1.
+	 */
+	MultiClient(size_t threads = 16);
+	/**
+	 * Waits for the servers still busy with a call which ran out of time.
+	 */
+	~MultiClient();
+	MultiClient(const MultiClient&) = delete;
+	MultiClient& operator=(const MultiClient&) = delete;
+
+	/**
+	 * Add a server to ask (once).
+	 * \param host Server host name, or "unix:/path" of a local upsd socket.
+	 * \param port Server port (not used for local sockets).
+	 */
+	void addServer(const std::string& host, uint16_t port = 3493);
+	void removeServer(const std::string& host, uint16_t port = 3493);
+	/**
+	 * Retrieve the names of the servers, as used for their errors.
+	 */
+	std::set<std::string> getServers()const;
+
+	/**
+	 * Log in to all the servers with these credentials.
+	 * Connections already made are made again when next used.
+	 */
+	void setAuthentication(const std::string& user, const std::string& passwd);
+	/**
+	 * Set how long a call waits for the servers (5 seconds by default).
+	 * Each network operation with a server is also limited to that long.
+	 */
+	void setDeadline(time_t deadline);
+	/**
+	 * Set the delay before connecting again to a server after a failed
+	 * attempt, which doubles with each failure from <min> up to <max>
+	 * (1 and 60 seconds by default).
+	 */
+	void setReconnectDelay(time_t min, time_t max);
+
+	/**
+	 * Ask all the servers.
+	 * \param query Called with the client of each server, from the thread
+	 * asking it; it is kept until the late servers are done with it, so
+	 * it must not refer to anything of the caller.
+	 * \param errors Set to the servers which did not answer in time, or
+	 * failed, and their errors (the text of the exception thrown).
+	 * \return What the servers answered, devices named "ups@host".
+	 */
+	DeviceValues query(const Query& query, ServerErrors* errors = nullptr);
+	/**
+	 * Retrieve the devices of all the servers.
+	 * \return Device names, as "ups@host".
+	 */
+	std::set<std::string> getDeviceNames(ServerErrors* errors = nullptr);
+	/**
+	 * Retrieve all the variables of the devices of all the servers.
+	 */
+	DeviceValues getDevicesVariableValues(ServerErrors* errors = nullptr);
+	/**
+	 * Retrieve some variables of the devices of all the servers, in one
+	 * round trip with each (LIST FLEET, needs protocol version 1.4).
+	 * \param names Variable names
+	 */
+	DeviceValues getDevicesVariableValues(const std::set<std::string>& names, ServerErrors* errors = nullptr);
+
+private:
+	struct Server
+	{
+		std::string host;
+		uint16_t port;
+		std::string name;
+		std::unique_ptr<TcpClient> client;
+		/* Asked by a call, maybe one which ran out of time */
+		bool busy;
+		/* Settings generation the connection was made with */
+		unsigned long generation;
+		std::chrono::seconds delay;
+		std::chrono::steady_clock::time_point retryAt;
+		std::string lastError;
+	};
+	struct Batch;
+	struct Task
+	{
+		std::shared_ptr<Server> server;
+		std::shared_ptr<Batch> batch;
+	};
+
+	static std::string serverName(const std::string& host, uint16_t port);
+	void work();
+	void run(const Task& task);
+
+	size_t _threads;
+	std::map<std::string, std::shared_ptr<Server> > _servers;
+	std::vector<std::thread> _workers;
+	std::deque<Task> _tasks;
+	bool _stop;
+
+	mutable std::mutex _mutex;
+	std::condition_variable _queued;
+	std::string _user, _passwd;
+	unsigned long _generation;
+	std::chrono::seconds _deadline, _minDelay, _maxDelay;
+};
+
 } /* namespace nut */
 
 #endif /* __cplusplus */
@@ -985,6 +1588,46 @@ char* nutclient_get_device_variable_description(NUTCLIENT_t client, const char*
  */
 strarr nutclient_get_device_variable_values(NUTCLIENT_t client, const char* dev, const char* var);
 
+/** Variable of a device, in a NUTCLIENT_VARIABLES_t block. */
+typedef struct
+{
+	const char* dev;
+	const char* name;
+	/** Values (generally only one), NULL-terminated. */
+	const char* const* values;
+	size_t numvalues;
+} NUTCLIENT_VARIABLE_t;
+
+/**
+ * Variables of devices, with all their strings, in one allocated block.
+ */
+typedef struct
+{
+	size_t count;
+	const NUTCLIENT_VARIABLE_t* vars;
+} NUTCLIENT_VARIABLES_t;
+
+/**
+ * Retrieve all the variables (names and values) of several devices at once.
+ * \param client Nut client handle.
+ * \param devs Device names, NULL-terminated. The caller is responsible to free it after call.
+ * \return Variables, device after device. Must be freed with nutclient_variables_free().
+ */
+NUTCLIENT_VARIABLES_t* nutclient_get_devices_variables_values(NUTCLIENT_t client, const strarr devs);
+
+/**
+ * Retrieve all the variables (names and values) of a device at once.
+ * \param client Nut client handle.
+ * \param dev Device name.
+ * \return Variables. Must be freed with nutclient_variables_free().
+ */
+NUTCLIENT_VARIABLES_t* nutclient_get_device_variables_values(NUTCLIENT_t client, const char* dev);
+
+/**
+ * Free the variables of devices.
+ */
+void nutclient_variables_free(NUTCLIENT_VARIABLES_t* vars);
+
 /**
  * Intend to set device variable value.
  * \param client Nut client handle.
@@ -1085,6 +1728,45 @@ void nutclient_tcp_set_timeout(NUTCLIENT_TCP_t client, time_t timeout);
  * \return Timeout value in seconds.
  */
 time_t nutclient_tcp_get_timeout(NUTCLIENT_TCP_t client);
+/**
+ * Secure the connection with STARTTLS (see nut::TcpClient::startTLS()),
+ * also when it is reconnected.
+ * \param client Nut TCP client handle.
+ * \param verifycert Non-zero to verify the certificate of the server.
+ * \return 0 if the connection is secured.
+ */
+int nutclient_tcp_start_tls(NUTCLIENT_TCP_t client, int verifycert);
+
+/**
+ * Watch the changes of (some) variables of a device, pushed by the server
+ * or polled for (see nut::TcpClient::watchDevice()).
+ * \param client Nut TCP client handle.
+ * \param dev Device name.
+ * \param names Variable names, NULL to watch all of them. The caller is responsible to free it after call.
+ * \return 0 if watched, -1 otherwise.
+ */
+int nutclient_tcp_watch_device(NUTCLIENT_TCP_t client, const char* dev, const strarr names);
+/**
+ * Stop watching a device.
+ * \param client Nut TCP client handle.
+ * \param dev Device name, NULL for all of them.
+ * \return 0 if done, -1 otherwise.
+ */
+int nutclient_tcp_unwatch_device(NUTCLIENT_TCP_t client, const char* dev);
+/**
+ * Called for a change of a watched variable, with its new values (freed
+ * after the call), or NULL when it was removed.
+ */
+typedef void (*NUTCLIENT_CHANGE_CB_t)(const char* dev, const char* var, const strarr values, void* arg);
+/**
+ * Wait for changes of the watched variables, and call <cb> for each.
+ * \param client Nut TCP client handle.
+ * \param timeout Milliseconds to wait at most, 0 not to wait, negative to wait until there are some.
+ * \param cb Change callback.
+ * \param arg Argument passed to the callback.
+ * \return Number of changes, -1 on error.
+ */
+int nutclient_tcp_wait_changes(NUTCLIENT_TCP_t client, int timeout, NUTCLIENT_CHANGE_CB_t cb, void* arg);
 
 /** \} */
 
@@ -26,6 +26,7 @@
 #include <netdb.h>
 #include <netinet/in.h>
 #include <sys/socket.h>
+#include <poll.h>
 #endif	/* !WIN32 */
 
 #include "nut_stdint.h"
@@ -34,6 +35,9 @@
 /* network timeout for initial connection, in seconds */
 #define UPSCLI_DEFAULT_CONNECT_TIMEOUT	"10"
 
+/* servers queried at once in batch mode */
+#define DEFAULT_BATCH_PARALLEL	16
+
 static char		*upsname = NULL, *hostname = NULL;
 static UPSCONN_t	*ups = NULL;
 
@@ -45,6 +49,7 @@ static void usage(const char *prog)
 	printf("\nusage: %s -l | -L [<hostname>[:port]]\n", prog);
 	printf("       %s <ups> [<variable>]\n", prog);
 	printf("       %s -c <ups>\n", prog);
+	printf("       %s -B [-P <num>] [<ups> ...]\n", prog);
 
 	printf("\nFirst form (lists UPSes):\n");
 	printf("  -l         - lists each UPS on <hostname>, one per line.\n");
@@ -60,6 +65,12 @@ static void usage(const char *prog)
 	printf("  -c         - lists each client connected on <ups>, one per line.\n");
 	printf("  <ups>      - upsd server, <upsname>[@<hostname>[:<port>]] form\n");
 
+	printf("\nFourth form (lists variables of many devices, as JSON lines):\n");
+	printf("  -B         - batch mode, for each <ups> given, or read from stdin\n");
+	printf("               (one per line) if there is none.\n");
+	printf("  -P <num>   - query at most <num> servers at once (default: %d)\n",
+		DEFAULT_BATCH_PARALLEL);
+
 	printf("\nCommon arguments:\n");
 	printf("  -V         - display the version of this software\n");
 	printf("  -W <secs>  - network timeout for initial connections (default: %s)\n",
@@ -211,6 +222,288 @@ static void list_clients(const char *devname)
 	}
 }
 
+#ifndef WIN32
+/* --- batch mode: the UPSes are grouped by server, and each server gets
+ * one asynchronous connection with a LIST VAR for each of its UPSes in
+ * flight at once; the answers are printed as JSON lines as they come --- */
+
+typedef struct batch_ups_s {
+	char	*target, *upsname;
+	char	*vars;		/* the "vars" JSON object, so far */
+	size_t	varslen, varssize;
+	int	done;
+	struct	batch_host_s	*host;
+	struct	batch_ups_s	*next;
+} batch_ups_t;
+
+typedef struct batch_host_s {
+	char	*hostname;
+	uint16_t	port;
+	batch_ups_t	*ups, *lastups;
+	size_t	pending;
+	UPSCLI_ASYNC_t	*as;
+	time_t	lastactive;
+	struct	batch_host_s	*next;
+} batch_host_t;
+
+static size_t	batch_failed = 0;
+
+static void batch_cat(batch_ups_t *u, const char *str, int quote)
+{
+	const	char	*p;
+	char	esc[8];
+
+	for (p = str; *p; p++) {
+		const	char	*add = NULL;
+		size_t	len;
+
+		if (quote && (*p == '"' || *p == '\\')) {
+			snprintf(esc, sizeof(esc), "\\%c", *p);
+			add = esc;
+		} else if (quote && (unsigned char)*p < 0x20) {
+			snprintf(esc, sizeof(esc), "\\u%04x", (unsigned char)*p);
+			add = esc;
+		}
+
+		len = add ? strlen(add) : 1;
+		if (u->varslen + len + 1 > u->varssize) {
+			u->varssize = (u->varssize + len + 1) * 2;
+			u->vars = xrealloc(u->vars, u->varssize);
+		}
+
+		if (add)
+			memcpy(u->vars + u->varslen, add, len);
+		else
+			u->vars[u->varslen] = *p;
+
+		u->varslen += len;
+		u->vars[u->varslen] = '\0';
+	}
+}
+
+/* print the result line of a target, with its vars or an error */
+static void batch_print(batch_ups_t *u, const char *error)
+{
+	batch_ups_t	line;
+
+	memset(&line, 0, sizeof(line));
+	batch_cat(&line, "{\"ups\":\"", 0);
+	batch_cat(&line, u->target, 1);
+
+	if (error) {
+		batch_cat(&line, "\",\"error\":\"", 0);
+		batch_cat(&line, error, 1);
+		batch_cat(&line, "\"}", 0);
+		batch_failed++;
+	} else {
+		batch_cat(&line, "\",\"vars\":{", 0);
+		if (u->vars)
+			batch_cat(&line, u->vars, 0);
+		batch_cat(&line, "}}", 0);
+	}
+
+	printf("%s\n", line.vars);
+	free(line.vars);
+}
+
+static void batch_list_cb(UPSCLI_ASYNC_t *as, int ret, size_t numa,
+		char **answer, void *arg)
+{
+	batch_ups_t	*u = (batch_ups_t *)arg;
+
+	u->host->lastactive = time(NULL);
+
+	/* VAR <ups> <var> <value> */
+	if (ret == 1) {
+		if (numa >= 4) {
+			batch_cat(u, u->varslen ? ",\"" : "\"", 0);
+			batch_cat(u, answer[2], 1);
+			batch_cat(u, "\":\"", 0);
+			batch_cat(u, answer[3], 1);
+			batch_cat(u, "\"", 0);
+		}
+		return;
+	}
+
+	u->host->pending--;
+	u->done = 1;
+	batch_print(u, (ret == 0) ? NULL : upscli_strerror(upscli_async_conn(as)));
+}
+
+/* connect to a server, with the LIST VAR of all its UPSes queued */
+static void batch_start(batch_host_t *h)
+{
+	batch_ups_t	*u;
+	const	char	*query[2];
+
+	h->as = upscli_async_connect(h->hostname, h->port, UPSCLI_CONN_TRYSSL);
+	if (!h->as)
+		fatalx(EXIT_FAILURE, "Error: out of memory");
+
+	h->lastactive = time(NULL);
+
+	for (u = h->ups; u != NULL; u = u->next) {
+		query[0] = "VAR";
+		query[1] = u->upsname;
+
+		if (upscli_async_list(h->as, 2, query, batch_list_cb, u) == 0) {
+			h->pending++;
+		} else {
+			u->done = 1;
+			batch_print(u, upscli_strerror(upscli_async_conn(h->as)));
+		}
+	}
+}
+
+static void batch_add(batch_host_t **hosts, const char *target)
+{
+	batch_host_t	*h;
+	batch_ups_t	*u;
+	char	*un = NULL, *hn = NULL;
+	uint16_t	port;
+
+	u = xcalloc(1, sizeof(*u));
+	u->target = xstrdup(target);
+
+	if (upscli_splitname(target, &un, &hn, &port) != 0) {
+		batch_print(u, "Invalid UPS definition");
+		free(u->target);
+		free(u);
+		free(un);
+		free(hn);
+		return;
+	}
+
+	u->upsname = un;
+
+	for (h = *hosts; h != NULL; h = h->next) {
+		if (h->port == port && !strcmp(h->hostname, hn))
+			break;
+	}
+
+	if (h) {
+		free(hn);
+	} else {
+		h = xcalloc(1, sizeof(*h));
+		h->hostname = hn;
+		h->port = port;
+		h->next = *hosts;
+		*hosts = h;
+	}
+
+	u->host = h;
+	if (h->lastups)
+		h->lastups->next = u;
+	else
+		h->ups = u;
+	h->lastups = u;
+}
+
+static void batch_free(batch_host_t *h)
+{
+	batch_ups_t	*u;
+
+	while (h->ups) {
+		u = h->ups;
+		h->ups = u->next;
+
+		free(u->target);
+		free(u->upsname);
+		free(u->vars);
+		free(u);
+	}
+
+	free(h->hostname);
+	free(h);
+}
+
+static int batch_run(int argc, char **argv, size_t parallel, double timeout)
+{
+	batch_host_t	*hosts = NULL, *h, **hp, *active = NULL;
+	struct	pollfd	*pfd;
+	batch_ups_t	*u;
+	char	buf[LARGEBUF], *p;
+	size_t	numactive = 0, i;
+	int	ret, ev;
+
+	if (argc > 0) {
+		for (i = 0; i < (size_t)argc; i++)
+			batch_add(&hosts, argv[i]);
+	} else {
+		while (fgets(buf, sizeof(buf), stdin)) {
+			p = buf + strspn(buf, " \t");
+			p[strcspn(p, " \t\r\n")] = '\0';
+
+			if (*p && *p != '#')
+				batch_add(&hosts, p);
+		}
+	}
+
+	pfd = xcalloc(parallel, sizeof(*pfd));
+
+	while (hosts || active) {
+		/* keep up to <parallel> servers going */
+		while (hosts && numactive < parallel) {
+			h = hosts;
+			hosts = h->next;
+
+			h->next = active;
+			active = h;
+			numactive++;
+
+			batch_start(h);
+		}
+
+		for (h = active, i = 0; h != NULL; h = h->next, i++) {
+			ev = upscli_async_events(h->as);
+			pfd[i].fd = upscli_async_fd(h->as);
+			pfd[i].events = (short)(((ev & UPSCLI_ASYNC_READ) ? POLLIN : 0)
+				| ((ev & UPSCLI_ASYNC_WRITE) ? POLLOUT : 0));
+			pfd[i].revents = 0;
+		}
+
+		ret = poll(pfd, numactive, 1000);
+		if (ret < 0 && errno != EINTR)
+			fatal_with_errno(EXIT_FAILURE, "poll");
+
+		for (hp = &active, i = 0; (h = *hp) != NULL; i++) {
+			ev = 0;
+			if (pfd[i].revents & (POLLIN | POLLERR | POLLHUP))
+				ev |= UPSCLI_ASYNC_READ;
+			if (pfd[i].revents & (POLLOUT | POLLERR | POLLHUP))
+				ev |= UPSCLI_ASYNC_WRITE;
+
+			if (ev && h->pending)
+				upscli_async_process(h->as, ev);
+
+			/* a server which went silent fails with its UPSes */
+			if (h->pending && difftime(time(NULL), h->lastactive) >= timeout) {
+				for (u = h->ups; u != NULL; u = u->next) {
+					if (!u->done)
+						batch_print(u, "Connection timed out");
+				}
+				h->pending = 0;
+			}
+
+			if (!h->pending) {
+				*hp = h->next;
+				numactive--;
+				upscli_async_free(h->as);
+				batch_free(h);
+				continue;
+			}
+
+			hp = &h->next;
+		}
+	}
+
+	free(pfd);
+	fflush(stdout);
+
+	return batch_failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+#endif	/* !WIN32 */
+
 static void clean_exit(void)
 {
 	if (ups) {
@@ -226,7 +519,8 @@ int main(int argc, char **argv)
 {
 	int	i = 0;
 	uint16_t	port;
-	int	varlist = 0, clientlist = 0, verbose = 0;
+	int	varlist = 0, clientlist = 0, verbose = 0, batch = 0;
+	size_t	parallel = DEFAULT_BATCH_PARALLEL;
 	const char	*prog = xbasename(argv[0]);
 	const char	*net_connect_timeout = NULL;
 	char	*s = NULL;
@@ -242,7 +536,7 @@ int main(int argc, char **argv)
 	}
 	upsdebugx(1, "Starting NUT client: %s", prog);
 
-	while ((i = getopt(argc, argv, "+hlLcVW:")) != -1) {
+	while ((i = getopt(argc, argv, "+hlLcBP:VW:")) != -1) {
 
 		switch (i)
 		{
@@ -258,6 +552,19 @@ int main(int argc, char **argv)
 			clientlist = 1;
 			break;
 
+		case 'B':
+			batch = 1;
+			break;
+
+		case 'P':
+			{	/* scoping */
+				unsigned int	ui = 0;
+				if (!str_to_uint(optarg, &ui, 10) || ui < 1)
+					fatalx(EXIT_FAILURE, "Error: invalid number of servers: %s", optarg);
+				parallel = ui;
+			}
+			break;
+
 		case 'V':
 			/* just show the version and optional
 			 * CONFIG_FLAGS banner if available */
@@ -284,6 +591,15 @@ int main(int argc, char **argv)
 	argc -= optind;
 	argv += optind;
 
+	if (batch) {
+#ifndef WIN32
+		exit(batch_run(argc, argv, parallel,
+			atof(net_connect_timeout ? net_connect_timeout : UPSCLI_DEFAULT_CONNECT_TIMEOUT)));
+#else	/* WIN32 */
+		fatalx(EXIT_FAILURE, "Error: batch mode is not supported on this platform");
+#endif	/* WIN32 */
+	}
+
 	/* be a good little client that cleans up after itself */
 	atexit(clean_exit);
 
@@ -43,6 +43,7 @@
 # include <sys/socket.h>
 # include <netinet/in.h>
 # include <arpa/inet.h>
+# include <sys/un.h>
 # include <fcntl.h>
 # define SOCK_OPT_CAST
 #else /* => WIN32 */
@@ -164,8 +165,33 @@ static int upscli_initialized = 0;
 static struct timeval upscli_default_connect_timeout = {0, 0};
 static int upscli_default_connect_timeout_initialized = 0;
 
+/* The address each server (host and port) answered on the last time,
+ * tried first by the next upscli_tryconnect() to it */
+typedef struct ADDR_CACHE_s {
+	char	*host;
+	uint16_t	port;
+	struct sockaddr_storage	addr;
+
+	struct ADDR_CACHE_s	*next;
+}	ADDR_CACHE_t;
+static ADDR_CACHE_t	*addr_cache = NULL;
+static void addr_cache_free(void);
+
 #ifdef WITH_OPENSSL
 static SSL_CTX	*ssl_ctx;
+
+/* TLS sessions kept for resumption, one per server (and verification
+ * mode, so that a session set up without checking the certificate is
+ * never reused where it is to be checked) */
+typedef struct SSL_SESSCACHE_s {
+	char	*host;
+	uint16_t	port;
+	int	verifycert;
+	SSL_SESSION	*session;
+
+	struct SSL_SESSCACHE_s	*next;
+}	SSL_SESSCACHE_t;
+static SSL_SESSCACHE_t	*ssl_sesscache = NULL;
 #elif defined(WITH_NSS) /* WITH_OPENSLL */
 static int verify_certificate = 1;
 static HOST_CERT_t *first_host_cert = NULL;
@@ -223,6 +249,68 @@ static int ssl_error(SSL *ssl, ssize_t ret)
 	return -1;
 }
 
+static SSL_SESSCACHE_t *ssl_sesscache_find(const char *host, uint16_t port, int verifycert)
+{
+	SSL_SESSCACHE_t	*entry;
+
+	for (entry = ssl_sesscache; entry; entry = entry->next) {
+		if (entry->port == port && entry->verifycert == verifycert
+		&& !strcmp(entry->host, host)) {
+			return entry;
+		}
+	}
+
+	return NULL;
+}
+
+/* OpenSSL callback for a newly established (or ticketed) session;
+ * returns 1 as we keep the reference to it */
+static int ssl_sesscache_new(SSL *ssl, SSL_SESSION *session)
+{
+	UPSCONN_t	*ups = (UPSCONN_t *)SSL_get_app_data(ssl);
+	SSL_SESSCACHE_t	*entry;
+	int	verifycert;
+
+	if (!ups || !ups->host) {
+		return 0;
+	}
+
+	verifycert = (SSL_get_verify_mode(ssl) != SSL_VERIFY_NONE);
+	entry = ssl_sesscache_find(ups->host, ups->port, verifycert);
+	if (!entry) {
+		entry = (SSL_SESSCACHE_t *)xcalloc(1, sizeof(*entry));
+		entry->host = xstrdup(ups->host);
+		entry->port = ups->port;
+		entry->verifycert = verifycert;
+		entry->next = ssl_sesscache;
+		ssl_sesscache = entry;
+	}
+
+	if (entry->session) {
+		SSL_SESSION_free(entry->session);
+	}
+	entry->session = session;
+
+	upsdebugx(3, "SSL session cached for %s:%" PRIu16, ups->host, ups->port);
+	return 1;
+}
+
+static void ssl_sesscache_free(void)
+{
+	SSL_SESSCACHE_t	*entry, *next;
+
+	for (entry = ssl_sesscache; entry; entry = next) {
+		next = entry->next;
+		if (entry->session) {
+			SSL_SESSION_free(entry->session);
+		}
+		free(entry->host);
+		free(entry);
+	}
+
+	ssl_sesscache = NULL;
+}
+
 #elif defined(WITH_NSS) /* WITH_OPENSSL */
 
 static char *nss_password_callback(PK11SlotInfo *slot, PRBool retry,
@@ -427,6 +515,18 @@ int upscli_init(int certverify, const char *certpath,
 
 		SSL_CTX_set_verify(ssl_ctx, ssl_mode, NULL);
 	}
+
+	/* keep sessions ourselves, per server, for upscli_sslinit() to
+	 * resume them on later connections from this process */
+	SSL_CTX_set_session_cache_mode(ssl_ctx,
+		SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+	SSL_CTX_sess_set_new_cb(ssl_ctx, ssl_sesscache_new);
+
+#ifdef SSL_OP_ENABLE_KTLS
+	/* let the kernel encrypt (and decrypt) the records once connected,
+	 * where it can; OpenSSL falls back to doing it by itself if not */
+	SSL_CTX_set_options(ssl_ctx, SSL_OP_ENABLE_KTLS);
+#endif
 #elif defined(WITH_NSS) /* WITH_OPENSSL */
 	PR_Init(PR_USER_THREAD, PR_PRIORITY_NORMAL, 0);
 
@@ -536,7 +636,11 @@ static HOST_CERT_t* upscli_find_host_cert(const char* hostname)
 
 int upscli_cleanup(void)
 {
+	addr_cache_free();
+
 #ifdef WITH_OPENSSL
+	ssl_sesscache_free();
+
 	if (ssl_ctx) {
 		SSL_CTX_free(ssl_ctx);
 		ssl_ctx = NULL;
@@ -650,6 +754,16 @@ static ssize_t upscli_select_read(const int fd, void *buf, const size_t buflen,
 	fd_set		fds;
 	struct timeval	tv;
 
+#ifdef MSG_DONTWAIT
+	/* within a longer answer the data is usually there already,
+	 * so only wait for it if it is not */
+	ret = recv(fd, buf, buflen, MSG_DONTWAIT);
+
+	if (ret >= 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+		return ret;
+	}
+#endif	/* MSG_DONTWAIT */
+
 	FD_ZERO(&fds);
 	FD_SET(fd, &fds);
 
@@ -814,47 +928,23 @@ static ssize_t net_write(UPSCONN_t *ups, const char *buf, size_t buflen, const t
 
 #ifdef WITH_SSL
 
-/*
+/* set up TLS on the connection, once upsd accepted STARTTLS; with
+ * <nonblock>, the socket is left non-blocking for upscli_async_*()
  * 1 : OK
  * -1 : ERROR
  * 0 : SSL NOT SUPPORTED
  */
-static int upscli_sslinit(UPSCONN_t *ups, int verifycert)
+static int upscli_sslstart(UPSCONN_t *ups, int verifycert, int nonblock)
 {
 #ifdef WITH_OPENSSL
-	int res;
+	SSL_SESSCACHE_t	*sesscache;
 #elif defined(WITH_NSS) /* WITH_OPENSSL */
 	SECStatus	status;
 	PRFileDesc	*socket;
+	PRSocketOptionData	sockopt;
 	HOST_CERT_t *cert;
-#endif /* WITH_OPENSSL | WITH_NSS */
 	char	buf[UPSCLI_NETBUF_LEN];
-
-	/* Intend to initialize upscli with no ssl db if not already done.
-	 * Compatibility stuff for old clients which do not initialize them.
-	 */
-	if (upscli_initialized==0) {
-		upsdebugx(3, "upscli not initialized, "
-			"force initialisation without SSL configuration");
-		upscli_init(0, NULL, NULL, NULL);
-	}
-
-	/* see if upsd even talks SSL/TLS */
-	snprintf(buf, sizeof(buf), "STARTTLS\n");
-
-	if (upscli_sendline(ups, buf, strlen(buf)) != 0) {
-		return -1;
-	}
-
-	if (upscli_readline(ups, buf, sizeof(buf)) != 0) {
-		return -1;
-	}
-
-	if (strncmp(buf, "OK STARTTLS", 11) != 0) {
-		return 0;		/* not supported */
-	}
-
-	/* upsd is happy, so let's crank up the client */
+#endif /* WITH_OPENSSL | WITH_NSS */
 
 #ifdef WITH_OPENSSL
 
@@ -880,20 +970,19 @@ static int upscli_sslinit(UPSCONN_t *ups, int verifycert)
 		SSL_set_verify(ups->ssl, SSL_VERIFY_NONE, NULL);
 	}
 
-	res = SSL_connect(ups->ssl);
-	switch(res)
-	{
-	case 1:
-		upsdebugx(3, "SSL connected (%s)", SSL_get_version(ups->ssl));
-		break;
-	case 0:
-		upsdebug_with_errno(1, "SSL_connect do not accept handshake.");
-		ssl_error(ups->ssl, res);
-		return -1;
-	default:
-		upsdebug_with_errno(1, "Unknown return value from SSL_connect %d", res);
-		ssl_error(ups->ssl, res);
-		return -1;
+	/* offer the last session with this server for resumption */
+	SSL_set_app_data(ups->ssl, ups);
+	sesscache = ssl_sesscache_find(ups->host, ups->port, verifycert != 0);
+	if (sesscache && sesscache->session) {
+		if (SSL_set_session(ups->ssl, sesscache->session) != 1) {
+			upsdebugx(3, "Can not reuse cached SSL session");
+		}
+	}
+
+	if (nonblock) {
+		/* SSL_write() may then take part of a growing buffer */
+		SSL_set_mode(ups->ssl, SSL_MODE_ENABLE_PARTIAL_WRITE
+			| SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
 	}
 
 	return 1;
@@ -906,6 +995,16 @@ static int upscli_sslinit(UPSCONN_t *ups, int verifycert)
 		return -1;
 	}
 
+	if (nonblock) {
+		/* NSPR would otherwise wait for the I/O itself */
+		sockopt.option = PR_SockOpt_Nonblocking;
+		sockopt.value.non_blocking = PR_TRUE;
+		if (PR_SetSocketOption(socket, &sockopt) != PR_SUCCESS) {
+			nss_error("upscli_sslinit / PR_SetSocketOption");
+			return -1;
+		}
+	}
+
 	ups->ssl = SSL_ImportFD(NULL, socket);
 	if (ups->ssl == NULL){
 		nss_error("upscli_sslinit / SSL_ImportFD");
@@ -968,6 +1067,16 @@ static int upscli_sslinit(UPSCONN_t *ups, int verifycert)
 		return -1;
 	}
 
+	/* NSS keeps the client sessions for resumption itself,
+	 * make sure they are told apart per server and port */
+	snprintf(buf, sizeof(buf), "%s:%" PRIu16 ":%d",
+		ups->host, ups->port, verifycert ? 1 : 0);
+	status = SSL_SetSockPeerID(ups->ssl, buf);
+	if (status != SECSuccess) {
+		nss_error("upscli_sslinit / SSL_SetSockPeerID");
+		return -1;
+	}
+
 	status = SSL_ResetHandshake(ups->ssl, PR_FALSE);
 	if (status != SECSuccess) {
 		nss_error("upscli_sslinit / SSL_ResetHandshake");
@@ -976,7 +1085,78 @@ static int upscli_sslinit(UPSCONN_t *ups, int verifycert)
 		return -1;
 	}
 
+	return 1;
+
+#endif /* WITH_OPENSSL | WITH_NSS */
+}
+
+#ifdef WITH_OPENSSL
+/* whether the records of <ssl> are encrypted by the kernel */
+static int ssl_ktls_send(SSL *ssl)
+{
+#ifdef BIO_get_ktls_send
+	return BIO_get_ktls_send(SSL_get_wbio(ssl));
+#else
+	NUT_UNUSED_VARIABLE(ssl);
+	return 0;
+#endif
+}
+#endif /* WITH_OPENSSL */
+
+/* run the TLS handshake set up by upscli_sslstart(); with <want> (on a
+ * non-blocking socket), it may stop until the events it tells of
+ * 1 : OK
+ * -1 : ERROR
+ * 0 : WAITING FOR *want
+ */
+static int upscli_sslhandshake(UPSCONN_t *ups, int *want)
+{
+#ifdef WITH_OPENSSL
+	int res;
+
+	res = SSL_connect(ups->ssl);
+
+	if (res != 1 && want) {
+		switch (SSL_get_error(ups->ssl, res))
+		{
+		case SSL_ERROR_WANT_READ:
+			*want = UPSCLI_ASYNC_READ;
+			return 0;
+		case SSL_ERROR_WANT_WRITE:
+			*want = UPSCLI_ASYNC_WRITE;
+			return 0;
+		default:
+			break;
+		}
+	}
+
+	switch(res)
+	{
+	case 1:
+		upsdebugx(3, "SSL connected (%s%s%s)", SSL_get_version(ups->ssl),
+			SSL_session_reused(ups->ssl) ? ", session resumed" : "",
+			ssl_ktls_send(ups->ssl) ? ", kernel TLS" : "");
+		break;
+	case 0:
+		upsdebug_with_errno(1, "SSL_connect do not accept handshake.");
+		ssl_error(ups->ssl, res);
+		return -1;
+	default:
+		upsdebug_with_errno(1, "Unknown return value from SSL_connect %d", res);
+		ssl_error(ups->ssl, res);
+		return -1;
+	}
+
+	return 1;
+
+#elif defined(WITH_NSS) /* WITH_OPENSSL */
+	SECStatus	status;
+
 	status = SSL_ForceHandshake(ups->ssl);
+	if (status != SECSuccess && want && PR_GetError() == PR_WOULD_BLOCK_ERROR) {
+		*want = UPSCLI_ASYNC_READ;
+		return 0;
+	}
 	if (status != SECSuccess) {
 		nss_error("upscli_sslinit / SSL_ForceHandshake");
 		ups->ssl = NULL;
@@ -990,6 +1170,49 @@ static int upscli_sslinit(UPSCONN_t *ups, int verifycert)
 #endif /* WITH_OPENSSL | WITH_NSS */
 }
 
+/*
+ * 1 : OK
+ * -1 : ERROR
+ * 0 : SSL NOT SUPPORTED
+ */
+static int upscli_sslinit(UPSCONN_t *ups, int verifycert)
+{
+	char	buf[UPSCLI_NETBUF_LEN];
+	int	ret;
+
+	/* Intend to initialize upscli with no ssl db if not already done.
+	 * Compatibility stuff for old clients which do not initialize them.
+	 */
+	if (upscli_initialized==0) {
+		upsdebugx(3, "upscli not initialized, "
+			"force initialisation without SSL configuration");
+		upscli_init(0, NULL, NULL, NULL);
+	}
+
+	/* see if upsd even talks SSL/TLS */
+	snprintf(buf, sizeof(buf), "STARTTLS\n");
+
+	if (upscli_sendline(ups, buf, strlen(buf)) != 0) {
+		return -1;
+	}
+
+	if (upscli_readline(ups, buf, sizeof(buf)) != 0) {
+		return -1;
+	}
+
+	if (strncmp(buf, "OK STARTTLS", 11) != 0) {
+		return 0;		/* not supported */
+	}
+
+	/* upsd is happy, so let's crank up the client */
+	ret = upscli_sslstart(ups, verifycert, 0);
+	if (ret != 1) {
+		return ret;
+	}
+
+	return upscli_sslhandshake(ups, NULL);
+}
+
 #else /* WITH_SSL */
 
 static int upscli_sslinit(UPSCONN_t *ups, int verifycert)
@@ -1002,41 +1225,93 @@ static int upscli_sslinit(UPSCONN_t *ups, int verifycert)
 
 #endif /* WITH_SSL */
 
-int upscli_tryconnect(UPSCONN_t *ups, const char *host, uint16_t port, int flags, struct timeval * timeout)
+/* Socket path if "host" names a local upsd socket ("unix:/path" or
+ * plain "/path", see LISTEN in upsd.conf), or NULL for network hosts */
+static const char *upscli_unix_path(const char *host)
 {
-	int				sock_fd;
-	struct addrinfo	hints, *res, *ai;
-	char			sport[NI_MAXSERV];
-	int				v, certverify, tryssl, forcessl, ret;
-	HOST_CERT_t*	hostcert;
-	fd_set 			wfds;
-	int			error;
-	socklen_t		error_size;
+	if (!host) {
+		return NULL;
+	}
 
-#ifndef WIN32
-	long			fd_flags;
-#else	/* WIN32 */
-	HANDLE event = NULL;
-	unsigned long argp;
+	if (!strncmp(host, "unix:", 5)) {
+		return host + 5;
+	}
 
-	WSADATA WSAdata;
-	WSAStartup(2,&WSAdata);
-#endif	/* WIN32 */
-	if (!ups) {
-		return -1;
+	if (*host == '/') {
+		return host;
 	}
 
-	/* clear out any lingering junk */
-	memset(ups, 0, sizeof(*ups));
-	ups->upsclient_magic = UPSCLIENT_MAGIC;
-	ups->fd = -1;
+	return NULL;
+}
 
-	if (!host) {
-		upslogx(LOG_WARNING, "%s: Host not specified", __func__);
+#ifndef WIN32
+/* fake a single resolved address for the local socket <path>,
+ * the port is not used */
+static int upscli_unix_ai(UPSCONN_t *ups, const char *path,
+	struct sockaddr_un *addr, struct addrinfo *ai)
+{
+	if (strlen(path) >= sizeof(addr->sun_path)) {
+		upslogx(LOG_WARNING, "%s: Socket path too long: '%s'",
+			__func__, path);
 		ups->upserror = UPSCLI_ERR_NOSUCHHOST;
 		return -1;
 	}
 
+	memset(addr, 0, sizeof(*addr));
+	addr->sun_family = AF_UNIX;
+	snprintf(addr->sun_path, sizeof(addr->sun_path), "%s", path);
+
+	memset(ai, 0, sizeof(*ai));
+	ai->ai_family = AF_UNIX;
+	ai->ai_socktype = SOCK_STREAM;
+	ai->ai_addr = (struct sockaddr *) addr;
+	ai->ai_addrlen = sizeof(*addr);
+
+	return 0;
+}
+#endif	/* !WIN32 */
+
+/* the cached address of <host> and <port>, added (empty) if new */
+static ADDR_CACHE_t *addr_cache_get(const char *host, uint16_t port)
+{
+	ADDR_CACHE_t	*entry;
+
+	for (entry = addr_cache; entry; entry = entry->next) {
+		if (entry->port == port && !strcmp(entry->host, host)) {
+			return entry;
+		}
+	}
+
+	entry = (ADDR_CACHE_t *)xcalloc(1, sizeof(*entry));
+	entry->host = xstrdup(host);
+	entry->port = port;
+	entry->next = addr_cache;
+	addr_cache = entry;
+
+	return entry;
+}
+
+static void addr_cache_free(void)
+{
+	ADDR_CACHE_t	*entry, *next;
+
+	for (entry = addr_cache; entry; entry = next) {
+		next = entry->next;
+		free(entry->host);
+		free(entry);
+	}
+
+	addr_cache = NULL;
+}
+
+/* resolve the network <host> for a connection to <port> */
+static int upscli_resolve(UPSCONN_t *ups, const char *host, uint16_t port,
+	int flags, struct addrinfo **res)
+{
+	struct addrinfo	hints;
+	char	sport[NI_MAXSERV];
+	int	v;
+
 	snprintf(sport, sizeof(sport), "%" PRIuMAX, (uintmax_t)port);
 
 	memset(&hints, 0, sizeof(hints));
@@ -1052,7 +1327,7 @@ int upscli_tryconnect(UPSCONN_t *ups, const char *host, uint16_t port, int flags
 	hints.ai_socktype = SOCK_STREAM;
 	hints.ai_protocol = IPPROTO_TCP;
 
-	while ((v = getaddrinfo(host, sport, &hints, &res)) != 0) {
+	while ((v = getaddrinfo(host, sport, &hints, res)) != 0) {
 		switch (v)
 		{
 		case EAI_AGAIN:
@@ -1077,119 +1352,92 @@ int upscli_tryconnect(UPSCONN_t *ups, const char *host, uint16_t port, int flags
 		return -1;
 	}
 
-	for (ai = res; ai != NULL; ai = ai->ai_next) {
+	return 0;
+}
 
-		sock_fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+/* the TLS settings for <host>: its own rule if one was added with
+ * upscli_add_host_cert(), or those of <flags> */
+static void upscli_ssl_policy(const char *host, int flags,
+	int *certverify, int *forcessl, int *tryssl)
+{
+	HOST_CERT_t	*hostcert = upscli_find_host_cert(host);
 
-		if (sock_fd < 0) {
-			switch (errno)
-			{
-			case EAFNOSUPPORT:
-			case EINVAL:
-				break;
-			default:
-				ups->upserror = UPSCLI_ERR_SOCKFAILURE;
-				ups->syserrno = errno;
-			}
-			continue;
-		}
+	if (hostcert != NULL) {
+		/* An host security rule is specified. */
+		*certverify	= hostcert->certverify;
+		*forcessl	= hostcert->forcessl;
+	} else {
+		*certverify	= (flags & UPSCLI_CONN_CERTVERIF) != 0 ? 1 : 0;
+		*forcessl	= (flags & UPSCLI_CONN_REQSSL) != 0 ? 1 : 0;
+	}
+	*tryssl = (flags & UPSCLI_CONN_TRYSSL) != 0 ? 1 : 0;
+}
 
-		/* non blocking connect */
-		if(timeout != NULL) {
-#ifndef WIN32
-			fd_flags = fcntl(sock_fd, F_GETFL);
-			fd_flags |= O_NONBLOCK;
-			fcntl(sock_fd, F_SETFL, fd_flags);
-#else	/* WIN32 */
-			event = CreateEvent(NULL, /* Security */
-					FALSE, /* auto-reset */
-					FALSE, /* initial state */
-					NULL); /* no name */
-
-			/* Associate socket event to the socket via its Event object */
-			WSAEventSelect( sock_fd, event, FD_CONNECT );
-			CloseHandle(event);
-#endif	/* WIN32 */
-		}
+int upscli_tryconnect(UPSCONN_t *ups, const char *host, uint16_t port, int flags, struct timeval * timeout)
+{
+	int				sock_fd;
+	struct addrinfo	*res;
+	int				certverify, tryssl, forcessl, ret;
+	ADDR_CACHE_t	*cached = NULL;
 
-		while ((v = connect(sock_fd, ai->ai_addr, ai->ai_addrlen)) < 0) {
 #ifndef WIN32
-			if(errno == EINPROGRESS || SOLARIS_i386_NBCONNECT_ENOENT(errno) || AIX_NBCONNECT_0(errno)) {
+	const char		*unixpath;
+	struct sockaddr_un	unixaddr;
+	struct addrinfo		unixai;
 #else	/* WIN32 */
-			if(errno == WSAEWOULDBLOCK) {
+	WSADATA WSAdata;
+	WSAStartup(2,&WSAdata);
 #endif	/* WIN32 */
-				FD_ZERO(&wfds);
-				FD_SET(sock_fd, &wfds);
-				select(sock_fd+1,NULL,&wfds,NULL,
-						timeout);
-				if (FD_ISSET(sock_fd, &wfds)) {
-					error_size = sizeof(error);
-					getsockopt(sock_fd, SOL_SOCKET, SO_ERROR,
-							SOCK_OPT_CAST &error, &error_size);
-					if( error == 0) {
-						/* connect successful */
-						v = 0;
-						break;
-					}
-					errno = error;
-				}
-				else {
-					/* Timeout */
-					v = -1;
-					ups->upserror = UPSCLI_ERR_CONNFAILURE;
-					ups->syserrno = ETIMEDOUT;
-					break;
-				}
-			}
+	if (!ups) {
+		return -1;
+	}
 
-			switch (errno)
-			{
-			case EAFNOSUPPORT:
-				break;
-			case EINTR:
-			case EAGAIN:
-				continue;
-			default:
-				ups->upserror = UPSCLI_ERR_CONNFAILURE;
-				ups->syserrno = errno;
-			}
-			break;
-		}
+	/* clear out any lingering junk */
+	memset(ups, 0, sizeof(*ups));
+	ups->upsclient_magic = UPSCLIENT_MAGIC;
+	ups->fd = -1;
 
-		if (v < 0) {
-			close(sock_fd);
-			/* if timeout, break out so client can continue */
-			/* match Linux behavior that updates timeout struct */
-			if (timeout != NULL &&
-			    ups->upserror == UPSCLI_ERR_CONNFAILURE &&
-			    ups->syserrno == ETIMEDOUT
-			) {
-				const char	*addrstr = inet_ntopAI(ai);
-				upslogx(LOG_WARNING, "%s: Connection to host timed out: '%s'",
-					__func__, (addrstr && *addrstr) ? addrstr : NUT_STRARG(host));
-				break;
-			}
-			continue;
-		}
+	if (!host) {
+		upslogx(LOG_WARNING, "%s: Host not specified", __func__);
+		ups->upserror = UPSCLI_ERR_NOSUCHHOST;
+		return -1;
+	}
 
-		/* switch back to blocking operation */
-		if (timeout != NULL) {
 #ifndef WIN32
-			fd_flags = fcntl(sock_fd, F_GETFL);
-			fd_flags &= ~O_NONBLOCK;
-			fcntl(sock_fd, F_SETFL, fd_flags);
-#else	/* WIN32 */
-			argp = 0;
-			ioctlsocket(sock_fd, FIONBIO, &argp);
-#endif	/* WIN32 */
+	if ((unixpath = upscli_unix_path(host)) != NULL) {
+		/* "unix:/path" (or just "/path") of a local upsd socket */
+		if (upscli_unix_ai(ups, unixpath, &unixaddr, &unixai) < 0) {
+			return -1;
+		}
+		res = &unixai;
+	} else
+#endif	/* !WIN32 */
+	{
+		if (upscli_resolve(ups, host, port, flags, &res) < 0) {
+			return -1;
 		}
+		cached = addr_cache_get(host, port);
+	}
 
+	/* race the addresses, rather than waiting out the timeout
+	 * on each dead one in turn (like a broken IPv6 route) */
+	sock_fd = connect_ai_race(res, timeout, cached ? &cached->addr : NULL);
+	if (sock_fd < 0) {
+		ups->upserror = UPSCLI_ERR_CONNFAILURE;
+		ups->syserrno = errno;
+		if (timeout != NULL && ups->syserrno == ETIMEDOUT) {
+			upslogx(LOG_WARNING, "%s: Connection to host timed out: '%s'",
+				__func__, NUT_STRARG(host));
+		}
+	} else {
 		ups->fd = sock_fd;
 		ups->upserror = 0;
 		ups->syserrno = 0;
-		break;
 	}
 
+#ifndef WIN32
+	if (res != &unixai)
+#endif	/* !WIN32 */
 	freeaddrinfo(res);
 
 	if (ups->fd < 0) {
@@ -1208,17 +1456,7 @@ int upscli_tryconnect(UPSCONN_t *ups, const char *host, uint16_t port, int flags
 
 	ups->port = port;
 
-	hostcert = upscli_find_host_cert(host);
-
-	if (hostcert != NULL) {
-		/* An host security rule is specified. */
-		certverify	= hostcert->certverify;
-		forcessl	= hostcert->forcessl;
-	} else {
-		certverify	= (flags & UPSCLI_CONN_CERTVERIF) != 0 ? 1 : 0;
-		forcessl	= (flags & UPSCLI_CONN_REQSSL) != 0 ? 1 : 0;
-	}
-	tryssl = (flags & UPSCLI_CONN_TRYSSL) != 0 ? 1 : 0;
+	upscli_ssl_policy(host, flags, &certverify, &forcessl, &tryssl);
 
 	if (tryssl || forcessl) {
 		ret = upscli_sslinit(ups, certverify);
@@ -1384,10 +1622,9 @@ static int verify_resp(size_t num, const char **q, char **a)
 	return 1;	/* OK */
 }
 
-int upscli_get(UPSCONN_t *ups, size_t numq, const char **query,
-		size_t *numa, char ***answer)
+int upscli_get_send(UPSCONN_t *ups, size_t numq, const char **query)
 {
-	char	cmd[UPSCLI_NETBUF_LEN], tmp[UPSCLI_NETBUF_LEN];
+	char	cmd[UPSCLI_NETBUF_LEN];
 
 	if (!ups) {
 		return -1;
@@ -1405,15 +1642,21 @@ int upscli_get(UPSCONN_t *ups, size_t numq, const char **query,
 		return -1;
 	}
 
-	if (upscli_readline(ups, tmp, sizeof(tmp)) != 0) {
+	return 0;
+}
+
+int upscli_get_answer(UPSCONN_t *ups, char *line, size_t numq, const char **query,
+		size_t *numa, char ***answer)
+{
+	if (!ups) {
 		return -1;
 	}
 
-	if (upscli_errcheck(ups, tmp) != 0) {
+	if (upscli_errcheck(ups, line) != 0) {
 		return -1;
 	}
 
-	if (!pconf_line(&ups->pc_ctx, tmp)) {
+	if (!pconf_line(&ups->pc_ctx, line)) {
 		ups->upserror = UPSCLI_ERR_PARSE;
 		return -1;
 	}
@@ -1437,6 +1680,154 @@ int upscli_get(UPSCONN_t *ups, size_t numq, const char **query,
 	return 0;
 }
 
+int upscli_get(UPSCONN_t *ups, size_t numq, const char **query,
+		size_t *numa, char ***answer)
+{
+	char	tmp[UPSCLI_NETBUF_LEN];
+
+	if (upscli_get_send(ups, numq, query) != 0) {
+		return -1;
+	}
+
+	if (upscli_readline(ups, tmp, sizeof(tmp)) != 0) {
+		return -1;
+	}
+
+	return upscli_get_answer(ups, tmp, numq, query, numa, answer);
+}
+
+/* read the lines of a GET VARS answer after its BEGIN line */
+static int get_vars_read(UPSCONN_t *ups, const char *upsname,
+		size_t numvars, const char **vars, char **values)
+{
+	char	tmp[UPSCLI_NETBUF_LEN];
+	size_t	i;
+
+	/* a: VAR <ups> <var> <val> | MISSING <ups> <var> (one per var),
+	 *    then END GET VARS <ups> */
+	for (i = 0; ; i++) {
+		if (upscli_readline(ups, tmp, sizeof(tmp)) != 0) {
+			return -1;
+		}
+
+		if (upscli_errcheck(ups, tmp) != 0) {
+			return -1;
+		}
+
+		if (!pconf_line(&ups->pc_ctx, tmp)) {
+			ups->upserror = UPSCLI_ERR_PARSE;
+			return -1;
+		}
+
+		if ((ups->pc_ctx.numargs >= 2)
+		&&  (!strcasecmp(ups->pc_ctx.arglist[0], "END"))
+		&&  (!strcasecmp(ups->pc_ctx.arglist[1], "GET"))
+		) {
+			break;
+		}
+
+		if ((i >= numvars)
+		||  (ups->pc_ctx.numargs < 3)
+		||  (strcasecmp(ups->pc_ctx.arglist[1], upsname) != 0)
+		||  (strcasecmp(ups->pc_ctx.arglist[2], vars[i]) != 0)
+		) {
+			ups->upserror = UPSCLI_ERR_PROTOCOL;
+			return -1;
+		}
+
+		if ((ups->pc_ctx.numargs >= 4)
+		&&  (!strcasecmp(ups->pc_ctx.arglist[0], "VAR"))
+		) {
+			values[i] = xstrdup(ups->pc_ctx.arglist[3]);
+		} else if (strcasecmp(ups->pc_ctx.arglist[0], "MISSING") != 0) {
+			ups->upserror = UPSCLI_ERR_PROTOCOL;
+			return -1;
+		}
+	}
+
+	if (i != numvars) {
+		ups->upserror = UPSCLI_ERR_PROTOCOL;
+		return -1;
+	}
+
+	return 0;
+}
+
+int upscli_get_vars(UPSCONN_t *ups, const char *upsname,
+		size_t numvars, const char **vars, char **values)
+{
+	char	*cmd, tmp[UPSCLI_NETBUF_LEN];
+	const char	**query;
+	size_t	i, cmdlen;
+	ssize_t	ret;
+
+	if (!ups) {
+		return -1;
+	}
+
+	if ((!upsname) || (numvars < 1) || (!vars) || (!values)) {
+		ups->upserror = UPSCLI_ERR_INVALIDARG;
+		return -1;
+	}
+
+	/* q: [GET] VARS <ups> <var>... (every element may grow when encoded) */
+	query = xcalloc(numvars + 2, sizeof(*query));
+	query[0] = "VARS";
+	query[1] = upsname;
+	cmdlen = sizeof("GET VARS \n") + 2 * strlen(upsname) + 3;
+
+	for (i = 0; i < numvars; i++) {
+		values[i] = NULL;
+		query[i + 2] = vars[i];
+		cmdlen += 2 * strlen(vars[i]) + 3;
+	}
+
+	cmd = xcalloc(cmdlen, sizeof(char));
+	build_cmd(cmd, cmdlen, "GET", numvars + 2, query);
+	free(query);
+
+	ret = upscli_sendline(ups, cmd, strlen(cmd));
+	free(cmd);
+
+	if (ret != 0) {
+		return -1;
+	}
+
+	if (upscli_readline(ups, tmp, sizeof(tmp)) != 0) {
+		return -1;
+	}
+
+	if (upscli_errcheck(ups, tmp) != 0) {
+		return -1;
+	}
+
+	/* a: BEGIN GET VARS <ups> */
+	if (!pconf_line(&ups->pc_ctx, tmp)) {
+		ups->upserror = UPSCLI_ERR_PARSE;
+		return -1;
+	}
+
+	if ((ups->pc_ctx.numargs < 4)
+	||  (strcasecmp(ups->pc_ctx.arglist[0], "BEGIN") != 0)
+	||  (strcasecmp(ups->pc_ctx.arglist[1], "GET") != 0)
+	||  (strcasecmp(ups->pc_ctx.arglist[2], "VARS") != 0)
+	||  (strcasecmp(ups->pc_ctx.arglist[3], upsname) != 0)
+	) {
+		ups->upserror = UPSCLI_ERR_PROTOCOL;
+		return -1;
+	}
+
+	if (get_vars_read(ups, upsname, numvars, vars, values) != 0) {
+		for (i = 0; i < numvars; i++) {
+			free(values[i]);
+			values[i] = NULL;
+		}
+		return -1;
+	}
+
+	return 0;
+}
+
 int upscli_list_start(UPSCONN_t *ups, size_t numq, const char **query)
 {
 	char	cmd[UPSCLI_NETBUF_LEN], tmp[UPSCLI_NETBUF_LEN];
@@ -1495,6 +1886,72 @@ int upscli_list_start(UPSCONN_t *ups, size_t numq, const char **query)
 	return 0;
 }
 
+int upscli_list_fleet_start(UPSCONN_t *ups, const char *pattern,
+		size_t numvars, const char **vars)
+{
+	char	*cmd, tmp[UPSCLI_NETBUF_LEN];
+	const char	**query;
+	size_t	i, cmdlen;
+	ssize_t	ret;
+
+	if (!ups) {
+		return -1;
+	}
+
+	if ((!pattern) || (numvars < 1) || (!vars)) {
+		ups->upserror = UPSCLI_ERR_INVALIDARG;
+		return -1;
+	}
+
+	/* q: [LIST] FLEET <pattern> <var>... (may be too long for one buffer) */
+	query = xcalloc(numvars + 2, sizeof(*query));
+	query[0] = "FLEET";
+	query[1] = pattern;
+	cmdlen = sizeof("LIST FLEET \n") + 2 * strlen(pattern) + 3;
+
+	for (i = 0; i < numvars; i++) {
+		query[i + 2] = vars[i];
+		cmdlen += 2 * strlen(vars[i]) + 3;
+	}
+
+	cmd = xcalloc(cmdlen, sizeof(char));
+	build_cmd(cmd, cmdlen, "LIST", numvars + 2, query);
+	free(query);
+
+	ret = upscli_sendline(ups, cmd, strlen(cmd));
+	free(cmd);
+
+	if (ret != 0) {
+		return -1;
+	}
+
+	if (upscli_readline(ups, tmp, sizeof(tmp)) != 0) {
+		return -1;
+	}
+
+	if (upscli_errcheck(ups, tmp) != 0) {
+		return -1;
+	}
+
+	/* a: BEGIN LIST FLEET <pattern> */
+	if (!pconf_line(&ups->pc_ctx, tmp)) {
+		ups->upserror = UPSCLI_ERR_PARSE;
+		return -1;
+	}
+
+	if ((ups->pc_ctx.numargs < 4)
+	||  (strcasecmp(ups->pc_ctx.arglist[0], "BEGIN") != 0)
+	||  (strcasecmp(ups->pc_ctx.arglist[1], "LIST") != 0)
+	||  (strcasecmp(ups->pc_ctx.arglist[2], "FLEET") != 0)
+	||  (strcmp(ups->pc_ctx.arglist[3], pattern) != 0)
+	) {
+		ups->upserror = UPSCLI_ERR_PROTOCOL;
+		return -1;
+	}
+
+	return 0;
+}
+
 int upscli_list_next(UPSCONN_t *ups, size_t numq, const char **query,
 		size_t *numa, char ***answer)
 {
@@ -1606,7 +2063,9 @@ ssize_t upscli_readline_timeout(UPSCONN_t *ups, char *buf, size_t buflen, const
 		return -1;
 	}
 
-	for (recv = 0; recv < (buflen-1); recv++) {
+	for (recv = 0; recv < (buflen-1); ) {
+		const char	*start, *nl;
+		size_t	len;
 
 		if (ups->readidx == ups->readlen) {
 
@@ -1624,9 +2083,24 @@ ssize_t upscli_readline_timeout(UPSCONN_t *ups, char *buf, size_t buflen, const
 			ups->readidx = 0;
 		}
 
-		buf[recv] = ups->readbuf[ups->readidx++];
+		/* take what is buffered, up to the newline or the room left */
+		start = ups->readbuf + ups->readidx;
+		len = ups->readlen - ups->readidx;
+		if (len > buflen - 1 - recv) {
+			len = buflen - 1 - recv;
+		}
+
+		nl = memchr(start, '\n', len);
+		if (nl) {
+			len = (size_t)(nl - start);
+		}
+
+		memcpy(buf + recv, start, len);
+		recv += len;
+		ups->readidx += len;
 
-		if (buf[recv] == '\n') {
+		if (nl) {
+			ups->readidx++;	/* drop the newline */
 			break;
 		}
 	}
@@ -1640,71 +2114,1112 @@ ssize_t upscli_readline(UPSCONN_t *ups, char *buf, size_t buflen)
 	return upscli_readline_timeout(ups, buf, buflen, DEFAULT_NETWORK_TIMEOUT);
 }
 
-/* split upsname[@hostname[:port]] into separate components */
-int upscli_splitname(const char *buf, char **upsname, char **hostname, uint16_t *port)
+/* is there more to read right now, without waiting on the socket? */
+static int net_readable(UPSCONN_t *ups)
 {
-	char	*sat, *ssc, tmp[SMALLBUF], *last = NULL;
+	fd_set	fds;
+	struct timeval	tv;
+	int	ret;
 
-	/* paranoia */
-	if ((!buf) || (!upsname) || (!hostname) || (!port)) {
-		return -1;
+#ifdef WITH_SSL
+	/* data may be decrypted already, with nothing left on the socket */
+	if (ups->ssl) {
+# ifdef WITH_OPENSSL
+		if (SSL_pending(ups->ssl) > 0) {
+			return 1;
+		}
+# elif defined(WITH_NSS) /* WITH_OPENSSL */
+		if (SSL_DataPending(ups->ssl) > 0) {
+			return 1;
+		}
+# endif	/* WITH_OPENSSL | WITH_NSS*/
 	}
+#endif	/* WITH_SSL */
 
-	if (snprintf(tmp, sizeof(tmp), "%s", buf) < 1) {
-		fprintf(stderr, "upscli_splitname: can't parse empty string\n");
-		return -1;
+	FD_ZERO(&fds);
+	FD_SET(ups->fd, &fds);
+
+	tv.tv_sec = 0;
+	tv.tv_usec = 0;
+
+	ret = select(ups->fd + 1, &fds, NULL, NULL, &tv);
+
+	if (ret < 0) {
+		if (errno == EINTR) {
+			return 0;
+		}
+
+		ups->upserror = UPSCLI_ERR_READ;
+		ups->syserrno = errno;
 	}
 
-	sat = strchr(tmp, '@');
-	ssc = strchr(tmp, ':');
+	return ret;
+}
 
-	/* someone passed a "@hostname" string? */
-	if (sat == tmp) {
-		fprintf(stderr, "upscli_splitname: got empty upsname string\n");
+int upscli_readline_nowait(UPSCONN_t *ups, char *buf, size_t buflen, size_t *len)
+{
+
+	if (!ups) {
 		return -1;
 	}
 
-	if ((*upsname = xstrdup(strtok_r(tmp, "@", &last))) == NULL) {
-		fprintf(stderr, "upscli_splitname: xstrdup failed\n");
+	if (ups->fd < 0) {
+		ups->upserror = UPSCLI_ERR_DRVNOTCONN;
 		return -1;
 	}
 
-	/* someone passed a "@hostname" string (take two)? */
-	if (!**upsname) {
-		fprintf(stderr, "upscli_splitname: got empty upsname string\n");
+	if ((!buf) || (buflen < 1) || (!len) || (*len >= buflen)) {
+		ups->upserror = UPSCLI_ERR_INVALIDARG;
 		return -1;
 	}
 
-/*
-	fprintf(stderr, "upscli_splitname3: got buf='%s', tmp='%s', upsname='%s', possible hostname:port='%s'\n",
-		NUT_STRARG(buf), NUT_STRARG(tmp), NUT_STRARG(*upsname), NUT_STRARG((sat ? sat+1 : sat)));
- */
+	if (ups->upsclient_magic != UPSCLIENT_MAGIC) {
+		ups->upserror = UPSCLI_ERR_INVALIDARG;
+		return -1;
+	}
 
-	/* only a upsname is specified, fill in defaults */
-	if (sat == NULL) {
-		if (ssc) {
-			/* TOTHINK: Consult isdigit(ssc+1) to shortcut
-			 *  `upsname:port` into `upsname@localhost:port`? */
-			fprintf(stderr, "upscli_splitname: port specified, but not a hostname\n");
-			return -1;
-		}
+	for (;;) {
+		const char	*start, *nl;
+		size_t	avail, take;
 
-		if ((*hostname = xstrdup("localhost")) == NULL) {
-			fprintf(stderr, "upscli_splitname: xstrdup failed\n");
-			return -1;
-		}
+		if (ups->readidx == ups->readlen) {
+			ssize_t	ret = net_readable(ups);
 
-		*port = PORT;
-		return 0;
-	}
+			if (ret == 0) {
+				return 0;	/* wait for more */
+			}
 
-	/* someone passed a "upsname@" string? */
-	if (!(*(sat+1))) {
-		fprintf(stderr, "upscli_splitname: got the @ separator and then an empty hostname[:port] string\n");
-		return -1;
-	}
+			if (ret > 0) {
+				ret = net_read(ups, ups->readbuf, sizeof(ups->readbuf), 0);
+			}
 
-	return upscli_splitaddr(sat+1, hostname, port);
+			if (ret < 1) {
+				upscli_disconnect(ups);
+				return -1;
+			}
+
+			ups->readlen = (size_t)ret;
+			ups->readidx = 0;
+		}
+
+		start = ups->readbuf + ups->readidx;
+		avail = ups->readlen - ups->readidx;
+
+		nl = memchr(start, '\n', avail);
+		if (nl) {
+			avail = (size_t)(nl - start);
+		}
+
+		/* the end of an overlong line is dropped */
+		take = buflen - 1 - *len;
+		if (take > avail) {
+			take = avail;
+		}
+
+		memcpy(buf + *len, start, take);
+		*len += take;
+		ups->readidx += avail;
+
+		if (nl) {
+			ups->readidx++;	/* drop the newline */
+			buf[*len] = '\0';
+			return 1;
+		}
+	}
+}
+
+/* --- asynchronous connections, see upscli_async[3] --- */
+
+#define ASYNC_REQ_GET		1
+#define ASYNC_REQ_LIST		2
+#define ASYNC_REQ_CMD		3
+#define ASYNC_REQ_STARTTLS	4	/* internal, before the others */
+
+typedef struct upscli_async_req_s {
+	int	type;		/* ASYNC_REQ_* */
+	char	*cmd;		/* the request line */
+	int	sent;		/* out to upsd already */
+	int	begun;		/* LIST: BEGIN LIST was read */
+	size_t	numq;
+	char	**query;
+	upscli_async_cb_t	cb;
+	void	*arg;
+	struct upscli_async_req_s	*next;
+}	upscli_async_req_t;
+
+struct upscli_async_s {
+	UPSCONN_t	conn;		/* fd, TLS, errors and parser */
+	int	state;		/* UPSCLI_ASYNC_* */
+	int	want;		/* events the TLS layer wants too */
+	int	tls;		/* STARTTLS once connected */
+	int	handshake;	/* TLS handshake in progress */
+	int	certverify;
+	int	forcessl;
+
+	/* addresses left to try while connecting */
+	struct addrinfo	*res, *ai;
+#ifndef WIN32
+	struct sockaddr_un	unixaddr;
+	struct addrinfo	unixai;
+#endif	/* !WIN32 */
+
+	/* requests sent or to be sent, in the order of their answers */
+	upscli_async_req_t	*head, *tail;
+	size_t	numreq;
+
+	char	*wbuf;		/* request lines not written yet */
+	size_t	wlen, wsize;
+
+	char	rbuf[UPSCLI_NETBUF_LEN];
+	char	line[UPSCLI_NETBUF_LEN];	/* answer read so far */
+	size_t	linelen;
+
+	upscli_async_cb_t	push_cb;
+	void	*push_arg;
+};
+
+static void async_res_free(UPSCLI_ASYNC_t *as)
+{
+#ifndef WIN32
+	if (as->res == &as->unixai) {
+		as->res = NULL;
+	}
+#endif	/* !WIN32 */
+
+	if (as->res) {
+		freeaddrinfo(as->res);
+		as->res = NULL;
+	}
+
+	as->ai = NULL;
+}
+
+static void async_req_free(upscli_async_req_t *req)
+{
+	size_t	i;
+
+	for (i = 0; i < req->numq; i++) {
+		free(req->query[i]);
+	}
+
+	free(req->query);
+	free(req->cmd);
+	free(req);
+}
+
+/* take the first request off the queue, its answer came */
+static upscli_async_req_t *async_req_pop(UPSCLI_ASYNC_t *as)
+{
+	upscli_async_req_t	*req = as->head;
+
+	if (req) {
+		as->head = req->next;
+		if (!as->head) {
+			as->tail = NULL;
+		}
+		as->numreq--;
+	}
+
+	return req;
+}
+
+static void async_wbuf_add(UPSCLI_ASYNC_t *as, const char *data, size_t len)
+{
+	if (as->wlen + len > as->wsize) {
+		as->wsize = as->wlen + len + UPSCLI_NETBUF_LEN;
+		as->wbuf = (char *)xrealloc(as->wbuf, as->wsize);
+	}
+
+	memcpy(as->wbuf + as->wlen, data, len);
+	as->wlen += len;
+}
+
+/* once ready, write out the requests queued meanwhile */
+static void async_send_queued(UPSCLI_ASYNC_t *as)
+{
+	upscli_async_req_t	*req;
+
+	for (req = as->head; req; req = req->next) {
+		if (!req->sent) {
+			async_wbuf_add(as, req->cmd, strlen(req->cmd));
+			req->sent = 1;
+		}
+	}
+}
+
+/* give up on the connection, failing the requests still queued */
+static void async_fail(UPSCLI_ASYNC_t *as, int upserror, int syserrno)
+{
+	upscli_async_req_t	*req;
+
+	if (as->state == UPSCLI_ASYNC_FAILED) {
+		return;
+	}
+
+	as->state = UPSCLI_ASYNC_FAILED;
+	as->want = 0;
+	as->wlen = 0;
+
+	async_res_free(as);
+
+	if (as->conn.fd >= 0) {
+		upscli_disconnect(&as->conn);
+	}
+
+	/* keep the cause, not that of the disconnection */
+	as->conn.upserror = upserror;
+	as->conn.syserrno = syserrno;
+
+	while ((req = async_req_pop(as)) != NULL) {
+		if (req->cb && req->type != ASYNC_REQ_STARTTLS) {
+			req->cb(as, -1, 0, NULL, req->arg);
+		}
+		async_req_free(req);
+	}
+}
+
+static void async_ready(UPSCLI_ASYNC_t *as)
+{
+	as->state = UPSCLI_ASYNC_READY;
+	as->handshake = 0;
+	async_send_queued(as);
+}
+
+/* STARTTLS was refused, or TLS is not available here */
+static void async_no_tls(UPSCLI_ASYNC_t *as)
+{
+	if (as->forcessl) {
+		upslogx(LOG_ERR, "Can not connect to NUT server %s in SSL, disconnect",
+			as->conn.host);
+		async_fail(as, UPSCLI_ERR_SSLFAIL, 0);
+		return;
+	}
+
+	if (as->certverify) {
+		upslogx(LOG_NOTICE, "Can not connect to NUT server %s in SSL and "
+			"certificate is needed, disconnect", as->conn.host);
+		async_fail(as, UPSCLI_ERR_SSLFAIL, 0);
+		return;
+	}
+
+	upsdebugx(3, "Can not connect to NUT server %s in SSL, continue unencrypted",
+		as->conn.host);
+	async_ready(as);
+}
+
+static void async_handshake(UPSCLI_ASYNC_t *as)
+{
+#ifdef WITH_SSL
+	int	ret;
+
+	as->want = 0;
+	ret = upscli_sslhandshake(&as->conn, &as->want);
+
+	if (ret < 0) {
+		async_fail(as, UPSCLI_ERR_SSLERR, 0);
+		return;
+	}
+
+	if (ret == 0) {
+		return;	/* wait for as->want */
+	}
+
+	as->want = 0;
+	upslogx(LOG_INFO, "Connected to NUT server %s in SSL", as->conn.host);
+	if (as->certverify == 0) {
+		/* you REALLY should set CERTVERIFY to 1 if using SSL... */
+		upslogx(LOG_WARNING, "Certificate verification is disabled");
+	}
+
+	async_ready(as);
+#else	/* !WITH_SSL */
+	async_no_tls(as);
+#endif	/* !WITH_SSL */
+}
+
+/* the answer to STARTTLS came */
+static void async_starttls(UPSCLI_ASYNC_t *as, const char *line)
+{
+#ifdef WITH_SSL
+	int	ret;
+
+	if (strncmp(line, "OK STARTTLS", 11) != 0) {
+		async_no_tls(as);
+		return;
+	}
+
+	ret = upscli_sslstart(&as->conn, as->certverify, 1);
+
+	if (ret < 0) {
+		async_fail(as, UPSCLI_ERR_SSLERR, 0);
+		return;
+	}
+
+	if (ret == 0) {
+		async_no_tls(as);
+		return;
+	}
+
+	as->handshake = 1;
+	async_handshake(as);
+#else	/* !WITH_SSL */
+	NUT_UNUSED_VARIABLE(line);
+	async_no_tls(as);
+#endif	/* !WITH_SSL */
+}
+
+/* the TCP connection is up */
+static void async_connected(UPSCLI_ASYNC_t *as, int fd)
+{
+	upscli_async_req_t	*req;
+
+	as->conn.fd = fd;
+	as->conn.upserror = 0;
+	as->conn.syserrno = 0;
+
+	async_res_free(as);
+
+	if (!as->tls) {
+		async_ready(as);
+		return;
+	}
+
+	as->state = UPSCLI_ASYNC_STARTTLS;
+
+#ifdef WITH_SSL
+	if (upscli_initialized == 0) {
+		upsdebugx(3, "upscli not initialized, "
+			"force initialisation without SSL configuration");
+		upscli_init(0, NULL, NULL, NULL);
+	}
+#endif	/* WITH_SSL */
+
+	/* ahead of the requests queued so far */
+	req = (upscli_async_req_t *)xcalloc(1, sizeof(*req));
+	req->type = ASYNC_REQ_STARTTLS;
+	req->cmd = xstrdup("STARTTLS\n");
+	req->sent = 1;
+	req->next = as->head;
+	as->head = req;
+	if (!as->tail) {
+		as->tail = req;
+	}
+	as->numreq++;
+
+	async_wbuf_add(as, req->cmd, strlen(req->cmd));
+}
+
+/* start connecting to the next address, skipping those which fail at once */
+static void async_connect_next(UPSCLI_ASYNC_t *as)
+{
+#ifndef WIN32
+	for (; as->ai != NULL; as->ai = as->ai->ai_next) {
+		int	fd;
+
+		fd = socket(as->ai->ai_family, as->ai->ai_socktype, as->ai->ai_protocol);
+
+		if (fd < 0) {
+			as->conn.upserror = UPSCLI_ERR_SOCKFAILURE;
+			as->conn.syserrno = errno;
+			continue;
+		}
+
+		fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+		if (connect(fd, as->ai->ai_addr, as->ai->ai_addrlen) == 0) {
+			async_connected(as, fd);
+			return;
+		}
+
+		if (errno == EINPROGRESS || SOLARIS_i386_NBCONNECT_ENOENT(errno) || AIX_NBCONNECT_0(errno)) {
+			/* see upscli_async_process() */
+			as->conn.fd = fd;
+			return;
+		}
+
+		as->conn.upserror = UPSCLI_ERR_CONNFAILURE;
+		as->conn.syserrno = errno;
+		close(fd);
+	}
+
+	async_fail(as, as->conn.upserror, as->conn.syserrno);
+#else	/* WIN32 */
+	NUT_WIN32_INCOMPLETE();
+	async_fail(as, UPSCLI_ERR_CONNFAILURE, ENOSYS);
+#endif	/* WIN32 */
+}
+
+UPSCLI_ASYNC_t *upscli_async_connect(const char *host, uint16_t port, int flags)
+{
+	UPSCLI_ASYNC_t	*as;
+	int	tryssl;
+#ifndef WIN32
+	const char	*unixpath;
+#endif	/* !WIN32 */
+
+	as = (UPSCLI_ASYNC_t *)calloc(1, sizeof(*as));
+	if (!as) {
+		return NULL;
+	}
+
+	as->conn.upsclient_magic = UPSCLIENT_MAGIC;
+	as->conn.fd = -1;
+	as->state = UPSCLI_ASYNC_CONNECTING;
+	pconf_init(&as->conn.pc_ctx, NULL);
+
+	if (!host) {
+		upslogx(LOG_WARNING, "%s: Host not specified", __func__);
+		async_fail(as, UPSCLI_ERR_NOSUCHHOST, 0);
+		return as;
+	}
+
+	as->conn.host = xstrdup(host);
+	as->conn.port = port;
+
+	upscli_ssl_policy(host, flags, &as->certverify, &as->forcessl, &tryssl);
+	as->tls = (tryssl || as->forcessl);
+
+#ifndef WIN32
+	if ((unixpath = upscli_unix_path(host)) != NULL) {
+		if (upscli_unix_ai(&as->conn, unixpath, &as->unixaddr, &as->unixai) < 0) {
+			async_fail(as, as->conn.upserror, 0);
+			return as;
+		}
+		as->res = &as->unixai;
+	} else
+#endif	/* !WIN32 */
+	{
+		/* NOTE: name resolution itself still blocks */
+		if (upscli_resolve(&as->conn, host, port, flags, &as->res) < 0) {
+			as->res = NULL;
+			async_fail(as, as->conn.upserror, as->conn.syserrno);
+			return as;
+		}
+	}
+
+	as->ai = as->res;
+	as->conn.upserror = UPSCLI_ERR_CONNFAILURE;
+	async_connect_next(as);
+
+	return as;
+}
+
+void upscli_async_free(UPSCLI_ASYNC_t *as)
+{
+	upscli_async_req_t	*req;
+
+	if (!as) {
+		return;
+	}
+
+	async_res_free(as);
+
+	/* says LOGOUT if still connected */
+	upscli_disconnect(&as->conn);
+
+	/* not called back: the caller is done with them */
+	while ((req = async_req_pop(as)) != NULL) {
+		async_req_free(req);
+	}
+
+	free(as->wbuf);
+	free(as);
+}
+
+int upscli_async_fd(UPSCLI_ASYNC_t *as)
+{
+	if (!as) {
+		return -1;
+	}
+
+	return as->conn.fd;
+}
+
+int upscli_async_events(UPSCLI_ASYNC_t *as)
+{
+	if (!as) {
+		return 0;
+	}
+
+	switch (as->state)
+	{
+	case UPSCLI_ASYNC_CONNECTING:
+		return UPSCLI_ASYNC_WRITE;
+
+	case UPSCLI_ASYNC_STARTTLS:
+	case UPSCLI_ASYNC_READY:
+		if (as->handshake) {
+			return as->want;
+		}
+
+		/* always read, to notice a disconnection or pushed lines */
+		return UPSCLI_ASYNC_READ | as->want
+			| (as->wlen > 0 ? UPSCLI_ASYNC_WRITE : 0);
+
+	case UPSCLI_ASYNC_FAILED:
+	default:
+		return 0;
+	}
+}
+
+int upscli_async_state(UPSCLI_ASYNC_t *as)
+{
+	if (!as) {
+		return UPSCLI_ASYNC_FAILED;
+	}
+
+	return as->state;
+}
+
+UPSCONN_t *upscli_async_conn(UPSCLI_ASYNC_t *as)
+{
+	if (!as) {
+		return NULL;
+	}
+
+	return &as->conn;
+}
+
+size_t upscli_async_pending(UPSCLI_ASYNC_t *as)
+{
+	upscli_async_req_t	*req;
+	size_t	num = 0;
+
+	if (!as) {
+		return 0;
+	}
+
+	for (req = as->head; req; req = req->next) {
+		if (req->type != ASYNC_REQ_STARTTLS) {
+			num++;
+		}
+	}
+
+	return num;
+}
+
+void upscli_async_set_push(UPSCLI_ASYNC_t *as, upscli_async_cb_t cb, void *arg)
+{
+	if (!as) {
+		return;
+	}
+
+	as->push_cb = cb;
+	as->push_arg = arg;
+}
+
+static int async_queue(UPSCLI_ASYNC_t *as, int type, const char *cmd,
+	size_t numq, const char **query, upscli_async_cb_t cb, void *arg)
+{
+	upscli_async_req_t	*req;
+	size_t	i;
+
+	if (!as) {
+		return -1;
+	}
+
+	if (as->state == UPSCLI_ASYNC_FAILED) {
+		return -1;	/* with the error it failed with */
+	}
+
+	req = (upscli_async_req_t *)xcalloc(1, sizeof(*req));
+	req->type = type;
+	req->cmd = xstrdup(cmd);
+	req->cb = cb;
+	req->arg = arg;
+
+	if (numq > 0) {
+		req->numq = numq;
+		req->query = (char **)xcalloc(numq, sizeof(*req->query));
+		for (i = 0; i < numq; i++) {
+			req->query[i] = xstrdup(query[i]);
+		}
+	}
+
+	if (as->tail) {
+		as->tail->next = req;
+	} else {
+		as->head = req;
+	}
+	as->tail = req;
+	as->numreq++;
+
+	if (as->state == UPSCLI_ASYNC_READY) {
+		async_wbuf_add(as, req->cmd, strlen(req->cmd));
+		req->sent = 1;
+	}
+
+	return 0;
+}
+
+int upscli_async_get(UPSCLI_ASYNC_t *as, size_t numq, const char **query,
+		upscli_async_cb_t cb, void *arg)
+{
+	char	cmd[UPSCLI_NETBUF_LEN];
+
+	if (!as) {
+		return -1;
+	}
+
+	if (numq < 1) {
+		as->conn.upserror = UPSCLI_ERR_INVALIDARG;
+		return -1;
+	}
+
+	build_cmd(cmd, sizeof(cmd), "GET", numq, query);
+
+	return async_queue(as, ASYNC_REQ_GET, cmd, numq, query, cb, arg);
+}
+
+int upscli_async_list(UPSCLI_ASYNC_t *as, size_t numq, const char **query,
+		upscli_async_cb_t cb, void *arg)
+{
+	char	cmd[UPSCLI_NETBUF_LEN];
+
+	if (!as) {
+		return -1;
+	}
+
+	if (numq < 1) {
+		as->conn.upserror = UPSCLI_ERR_INVALIDARG;
+		return -1;
+	}
+
+	build_cmd(cmd, sizeof(cmd), "LIST", numq, query);
+
+	return async_queue(as, ASYNC_REQ_LIST, cmd, numq, query, cb, arg);
+}
+
+int upscli_async_cmd(UPSCLI_ASYNC_t *as, const char *cmd,
+		upscli_async_cb_t cb, void *arg)
+{
+	char	line[UPSCLI_NETBUF_LEN];
+
+	if (!as) {
+		return -1;
+	}
+
+	if (!cmd || !*cmd || strchr(cmd, '\n')) {
+		as->conn.upserror = UPSCLI_ERR_INVALIDARG;
+		return -1;
+	}
+
+	snprintf(line, sizeof(line), "%s\n", cmd);
+
+	return async_queue(as, ASYNC_REQ_CMD, line, 0, NULL, cb, arg);
+}
+
+/* call back the request at the head of the queue with <ret> and the
+ * answer parsed in as->conn.pc_ctx, and drop it */
+static void async_req_done(UPSCLI_ASYNC_t *as, int ret)
+{
+	upscli_async_req_t	*req = async_req_pop(as);
+
+	if (req->cb) {
+		if (ret < 0) {
+			req->cb(as, -1, 0, NULL, req->arg);
+		} else {
+			req->cb(as, ret, as->conn.pc_ctx.numargs,
+				as->conn.pc_ctx.arglist, req->arg);
+		}
+	}
+
+	async_req_free(req);
+}
+
+/* a complete line came in */
+static void async_line(UPSCLI_ASYNC_t *as, char *line)
+{
+	upscli_async_req_t	*req;
+	char	**arg;
+
+	/* changes pushed for a WATCH come at any time */
+	if (!strncmp(line, "CHANGED ", 8) || !strncmp(line, "DELETED ", 8)) {
+		if (as->push_cb && pconf_line(&as->conn.pc_ctx, line)) {
+			as->push_cb(as, 0, as->conn.pc_ctx.numargs,
+				as->conn.pc_ctx.arglist, as->push_arg);
+		}
+		return;
+	}
+
+	req = as->head;
+
+	if (!req || !req->sent) {
+		upsdebugx(2, "%s: unexpected [%s]", __func__, line);
+		return;
+	}
+
+	if (req->type == ASYNC_REQ_STARTTLS) {
+		async_req_free(async_req_pop(as));
+		async_starttls(as, line);
+		return;
+	}
+
+	if (upscli_errcheck(&as->conn, line) != 0) {
+		async_req_done(as, -1);
+		return;
+	}
+
+	if (!pconf_line(&as->conn.pc_ctx, line)) {
+		as->conn.upserror = UPSCLI_ERR_PARSE;
+		async_req_done(as, -1);
+		return;
+	}
+
+	arg = as->conn.pc_ctx.arglist;
+
+	switch (req->type)
+	{
+	case ASYNC_REQ_GET:
+		/* q: [GET] VAR <ups> <var>, a: VAR <ups> <var> <val> */
+		if (as->conn.pc_ctx.numargs < req->numq
+		||  !verify_resp(req->numq, (const char **)req->query, arg)
+		) {
+			as->conn.upserror = UPSCLI_ERR_PROTOCOL;
+			async_req_done(as, -1);
+			return;
+		}
+		async_req_done(as, 0);
+		return;
+
+	case ASYNC_REQ_LIST:
+		if (!req->begun) {
+			/* a: BEGIN LIST <query> */
+			if (as->conn.pc_ctx.numargs < req->numq + 2
+			||  strcasecmp(arg[0], "BEGIN") || strcasecmp(arg[1], "LIST")
+			||  !verify_resp(req->numq, (const char **)req->query, &arg[2])
+			) {
+				as->conn.upserror = UPSCLI_ERR_PROTOCOL;
+				async_req_done(as, -1);
+				return;
+			}
+			req->begun = 1;
+			return;
+		}
+
+		/* a: END LIST <query> */
+		if (as->conn.pc_ctx.numargs >= 2
+		&&  !strcmp(arg[0], "END") && !strcmp(arg[1], "LIST")
+		) {
+			async_req_done(as, 0);
+			return;
+		}
+
+		/* a: <query> <values...> */
+		if (as->conn.pc_ctx.numargs < req->numq
+		||  !verify_resp(req->numq, (const char **)req->query, arg)
+		) {
+			as->conn.upserror = UPSCLI_ERR_PROTOCOL;
+			async_req_done(as, -1);
+			return;
+		}
+		if (req->cb) {
+			req->cb(as, 1, as->conn.pc_ctx.numargs, arg, req->arg);
+		}
+		return;
+
+	case ASYNC_REQ_CMD:
+	default:
+		async_req_done(as, 0);
+		return;
+	}
+}
+
+/* read what is there, handling the complete lines; -1 once failed */
+static int async_read(UPSCLI_ASYNC_t *as)
+{
+	for (;;) {
+		ssize_t	ret;
+		size_t	len, i;
+
+#ifdef WITH_SSL
+		if (as->conn.ssl) {
+# ifdef WITH_OPENSSL
+			int	iret = SSL_read(as->conn.ssl, as->rbuf, (int)sizeof(as->rbuf));
+
+			if (iret <= 0) {
+				switch (SSL_get_error(as->conn.ssl, iret))
+				{
+				case SSL_ERROR_WANT_READ:
+					return 0;
+				case SSL_ERROR_WANT_WRITE:
+					as->want |= UPSCLI_ASYNC_WRITE;
+					return 0;
+				case SSL_ERROR_ZERO_RETURN:
+					async_fail(as, UPSCLI_ERR_SRVDISC, 0);
+					return -1;
+				default:
+					ssl_error(as->conn.ssl, iret);
+					async_fail(as, UPSCLI_ERR_SSLERR, errno);
+					return -1;
+				}
+			}
+			ret = (ssize_t)iret;
+# elif defined(WITH_NSS)	/* WITH_OPENSSL */
+			ret = PR_Read(as->conn.ssl, as->rbuf, (PRInt32)sizeof(as->rbuf));
+
+			if (ret < 0 && PR_GetError() == PR_WOULD_BLOCK_ERROR) {
+				return 0;
+			}
+			if (ret == 0) {
+				async_fail(as, UPSCLI_ERR_SRVDISC, 0);
+				return -1;
+			}
+			if (ret < 0) {
+				async_fail(as, UPSCLI_ERR_SSLERR, 0);
+				return -1;
+			}
+# endif	/* WITH_OPENSSL | WITH_NSS */
+		} else
+#endif	/* WITH_SSL */
+		{
+			ret = read(as->conn.fd, as->rbuf, sizeof(as->rbuf));
+
+			if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+				return 0;
+			}
+			if (ret == 0) {
+				async_fail(as, UPSCLI_ERR_SRVDISC, 0);
+				return -1;
+			}
+			if (ret < 0) {
+				async_fail(as, UPSCLI_ERR_READ, errno);
+				return -1;
+			}
+		}
+
+		/* split it in lines, the end of overlong ones is dropped */
+		len = (size_t)ret;
+		for (i = 0; i < len; ) {
+			const char	*start = as->rbuf + i, *nl;
+			size_t	avail = len - i, take;
+
+			nl = memchr(start, '\n', avail);
+			if (nl) {
+				avail = (size_t)(nl - start);
+			}
+
+			take = sizeof(as->line) - 1 - as->linelen;
+			if (take > avail) {
+				take = avail;
+			}
+
+			memcpy(as->line + as->linelen, start, take);
+			as->linelen += take;
+			i += avail;
+
+			if (!nl) {
+				break;
+			}
+
+			i++;	/* the newline */
+			as->line[as->linelen] = '\0';
+			as->linelen = 0;
+
+			async_line(as, as->line);
+
+			if (as->state == UPSCLI_ASYNC_FAILED) {
+				return -1;
+			}
+
+			if (as->handshake) {
+				/* TLS from here on, nothing else was sent */
+				return 0;
+			}
+		}
+	}
+}
+
+/* write out what is pending; -1 once failed */
+static int async_write(UPSCLI_ASYNC_t *as)
+{
+	while (as->wlen > 0) {
+		ssize_t	ret;
+
+#ifdef WITH_SSL
+		if (as->conn.ssl) {
+# ifdef WITH_OPENSSL
+			int	iret;
+
+			assert(as->wlen <= INT_MAX);
+			iret = SSL_write(as->conn.ssl, as->wbuf, (int)as->wlen);
+
+			if (iret <= 0) {
+				switch (SSL_get_error(as->conn.ssl, iret))
+				{
+				case SSL_ERROR_WANT_WRITE:
+					return 0;
+				case SSL_ERROR_WANT_READ:
+					as->want |= UPSCLI_ASYNC_READ;
+					return 0;
+				default:
+					ssl_error(as->conn.ssl, iret);
+					async_fail(as, UPSCLI_ERR_SSLERR, errno);
+					return -1;
+				}
+			}
+			ret = (ssize_t)iret;
+# elif defined(WITH_NSS)	/* WITH_OPENSSL */
+			assert(as->wlen <= PR_INT32_MAX);
+			ret = PR_Write(as->conn.ssl, as->wbuf, (PRInt32)as->wlen);
+
+			if (ret < 0 && PR_GetError() == PR_WOULD_BLOCK_ERROR) {
+				return 0;
+			}
+			if (ret < 0) {
+				async_fail(as, UPSCLI_ERR_SSLERR, 0);
+				return -1;
+			}
+# endif	/* WITH_OPENSSL | WITH_NSS */
+		} else
+#endif	/* WITH_SSL */
+		{
+			ret = write(as->conn.fd, as->wbuf, as->wlen);
+
+			if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+				return 0;
+			}
+			if (ret < 0) {
+				async_fail(as, UPSCLI_ERR_WRITE, errno);
+				return -1;
+			}
+		}
+
+		as->wlen -= (size_t)ret;
+		memmove(as->wbuf, as->wbuf + ret, as->wlen);
+	}
+
+	return 0;
+}
+
+int upscli_async_process(UPSCLI_ASYNC_t *as, int revents)
+{
+	if (!as) {
+		return -1;
+	}
+
+	if (as->state == UPSCLI_ASYNC_CONNECTING) {
+		int	error = 0;
+		socklen_t	error_size = sizeof(error);
+
+		if (!(revents & UPSCLI_ASYNC_WRITE)) {
+			return as->state;
+		}
+
+		getsockopt(as->conn.fd, SOL_SOCKET, SO_ERROR,
+			SOCK_OPT_CAST &error, &error_size);
+
+		if (error != 0) {
+			/* on to the next address, if any */
+			close(as->conn.fd);
+			as->conn.fd = -1;
+			as->conn.upserror = UPSCLI_ERR_CONNFAILURE;
+			as->conn.syserrno = error;
+			as->ai = as->ai->ai_next;
+			async_connect_next(as);
+			return (as->state == UPSCLI_ASYNC_FAILED) ? -1 : as->state;
+		}
+
+		async_connected(as, as->conn.fd);
+		revents = UPSCLI_ASYNC_WRITE;	/* likely writable still */
+	}
+
+	if (as->handshake) {
+		async_handshake(as);
+		if (as->handshake || as->state == UPSCLI_ASYNC_FAILED) {
+			return (as->state == UPSCLI_ASYNC_FAILED) ? -1 : as->state;
+		}
+		/* the queued requests may go out now */
+		revents |= UPSCLI_ASYNC_WRITE;
+	}
+
+	/* the TLS layer may need the other direction to make progress */
+	if (as->want) {
+		revents |= UPSCLI_ASYNC_READ | UPSCLI_ASYNC_WRITE;
+		as->want = 0;
+	}
+
+	if ((revents & UPSCLI_ASYNC_WRITE) && async_write(as) < 0) {
+		return -1;
+	}
+
+	if ((revents & UPSCLI_ASYNC_READ) && async_read(as) < 0) {
+		return -1;
+	}
+
+	/* answers may have queued more requests */
+	if (as->state == UPSCLI_ASYNC_READY && as->wlen > 0 && async_write(as) < 0) {
+		return -1;
+	}
+
+	return (as->state == UPSCLI_ASYNC_FAILED) ? -1 : as->state;
+}
+
+/* split upsname[@hostname[:port]] into separate components */
+int upscli_splitname(const char *buf, char **upsname, char **hostname, uint16_t *port)
+{
+	char	*sat, *ssc, tmp[SMALLBUF], *last = NULL;
+
+	/* paranoia */
+	if ((!buf) || (!upsname) || (!hostname) || (!port)) {
+		return -1;
+	}
+
+	if (snprintf(tmp, sizeof(tmp), "%s", buf) < 1) {
+		fprintf(stderr, "upscli_splitname: can't parse empty string\n");
+		return -1;
+	}
+
+	sat = strchr(tmp, '@');
+	ssc = strchr(tmp, ':');
+
+	/* someone passed a "@hostname" string? */
+	if (sat == tmp) {
+		fprintf(stderr, "upscli_splitname: got empty upsname string\n");
+		return -1;
+	}
+
+	if ((*upsname = xstrdup(strtok_r(tmp, "@", &last))) == NULL) {
+		fprintf(stderr, "upscli_splitname: xstrdup failed\n");
+		return -1;
+	}
+
+	/* someone passed a "@hostname" string (take two)? */
+	if (!**upsname) {
+		fprintf(stderr, "upscli_splitname: got empty upsname string\n");
+		return -1;
+	}
+
+/*
+	fprintf(stderr, "upscli_splitname3: got buf='%s', tmp='%s', upsname='%s', possible hostname:port='%s'\n",
+		NUT_STRARG(buf), NUT_STRARG(tmp), NUT_STRARG(*upsname), NUT_STRARG((sat ? sat+1 : sat)));
+ */
+
+	/* only a upsname is specified, fill in defaults */
+	if (sat == NULL) {
+		if (ssc) {
+			/* TOTHINK: Consult isdigit(ssc+1) to shortcut
+			 *  `upsname:port` into `upsname@localhost:port`? */
+			fprintf(stderr, "upscli_splitname: port specified, but not a hostname\n");
+			return -1;
+		}
+
+		if ((*hostname = xstrdup("localhost")) == NULL) {
+			fprintf(stderr, "upscli_splitname: xstrdup failed\n");
+			return -1;
+		}
+
+		*port = PORT;
+		return 0;
+	}
+
+	/* someone passed a "upsname@" string? */
+	if (!(*(sat+1))) {
+		fprintf(stderr, "upscli_splitname: got the @ separator and then an empty hostname[:port] string\n");
+		return -1;
+	}
+
+	return upscli_splitaddr(sat+1, hostname, port);
 }
 
 /* split hostname[:port] into separate components */
@@ -1733,6 +3248,18 @@ int upscli_splitaddr(const char *buf, char **hostname, uint16_t *port)
 		/* let it pass, but probably fail later */
 	}
 
+	if (upscli_unix_path(tmp)) {
+		/* local socket path, may contain anything but is not
+		 * followed by a port number */
+		if ((*hostname = xstrdup(tmp)) == NULL) {
+			fprintf(stderr, "upscli_splitaddr: xstrdup failed\n");
+			return -1;
+		}
+
+		*port = PORT;
+		return 0;
+	}
+
 	if (*tmp == '[') {
 		/* NOTE: Brackets are required for colon-separated IPv6
 		 * addresses, to differentiate from a port number. For
@@ -114,8 +114,27 @@ void upscli_add_host_cert(const char* hostname, const char* certname, int certve
 int upscli_get(UPSCONN_t *ups, size_t numq, const char **query,
 		size_t *numa, char ***answer);
 
+/* upscli_get() in two steps, for callers with several requests in flight
+ * (the answers come in the order of the requests): send the request, and
+ * check and split a line read as its answer */
+int upscli_get_send(UPSCONN_t *ups, size_t numq, const char **query);
+int upscli_get_answer(UPSCONN_t *ups, char *line, size_t numq, const char **query,
+		size_t *numa, char ***answer);
+
+/* GET VARS (protocol 1.4+): fills values[0..numvars-1] with copies of
+ * the values (to be free()d by caller), or NULL for missing variables */
+int upscli_get_vars(UPSCONN_t *ups, const char *upsname,
+		size_t numvars, const char **vars, char **values);
+
 int upscli_list_start(UPSCONN_t *ups, size_t numq, const char **query);
 
+/* LIST FLEET (protocol 1.4+): ask for some variables of every UPS whose name
+ * matches pattern ('*' and '?' wildcards); the VAR <ups> <var> <val>,
+ * MISSING <ups> <var> and UNAVAILABLE <ups> <error> lines are then read
+ * with upscli_list_next(ups, 0, NULL, ...) */
+int upscli_list_fleet_start(UPSCONN_t *ups, const char *pattern,
+		size_t numvars, const char **vars);
+
 int upscli_list_next(UPSCONN_t *ups, size_t numq, const char **query,
 		size_t *numa, char ***answer);
 
@@ -124,6 +143,11 @@ ssize_t upscli_sendline(UPSCONN_t *ups, const char *buf, size_t buflen);
 
 ssize_t upscli_readline_timeout(UPSCONN_t *ups, char *buf, size_t buflen, const time_t timeout);
 ssize_t upscli_readline(UPSCONN_t *ups, char *buf, size_t buflen);
+/* read what is there of a line without waiting for the rest, appending to
+ * the *len bytes already in buf: returns 1 once the line is complete (its
+ * newline replaced with a NUL, *len its length), 0 if the rest is to be
+ * waited for on upscli_fd() before calling again, or -1 on error */
+int upscli_readline_nowait(UPSCONN_t *ups, char *buf, size_t buflen, size_t *len);
 
 int upscli_splitname(const char *buf, char **upsname, char **hostname,
 			uint16_t *port);
@@ -140,6 +164,60 @@ int upscli_upserror(UPSCONN_t *ups);
 /* returns 1 if SSL mode is active for this connection */
 int upscli_ssl(UPSCONN_t *ups);
 
+/* --- asynchronous use, for event loops serving many connections: the
+ * caller waits for upscli_async_events() on upscli_async_fd(), and hands
+ * what came to upscli_async_process(), which calls back the requests as
+ * they complete (see upscli_async[3]) --- */
+
+typedef struct upscli_async_s	UPSCLI_ASYNC_t;
+
+/* called with ret=0 and the split answer line when a request completes,
+ * ret=1 for each item of a LIST (then ret=0 for its END LIST line), or
+ * ret=-1 on errors (see upscli_upserror() of upscli_async_conn()) */
+typedef void (*upscli_async_cb_t)(UPSCLI_ASYNC_t *as, int ret,
+		size_t numa, char **answer, void *arg);
+
+/* upscli_async_state() */
+#define UPSCLI_ASYNC_CONNECTING	1	/* TCP connection in progress	*/
+#define UPSCLI_ASYNC_STARTTLS	2	/* STARTTLS and TLS handshake	*/
+#define UPSCLI_ASYNC_READY	3	/* requests are sent		*/
+#define UPSCLI_ASYNC_FAILED	4	/* could not connect, or lost it*/
+
+/* upscli_async_events() and upscli_async_process() */
+#define UPSCLI_ASYNC_READ	0x01
+#define UPSCLI_ASYNC_WRITE	0x02
+
+/* start connecting, with the same flags as upscli_connect(); only returns
+ * NULL if out of memory, see upscli_async_state() for failures */
+UPSCLI_ASYNC_t *upscli_async_connect(const char *host, uint16_t port, int flags);
+void upscli_async_free(UPSCLI_ASYNC_t *as);
+
+int upscli_async_fd(UPSCLI_ASYNC_t *as);
+int upscli_async_events(UPSCLI_ASYNC_t *as);
+int upscli_async_state(UPSCLI_ASYNC_t *as);
+/* returns the state after doing what <revents> allow, or -1 if failed */
+int upscli_async_process(UPSCLI_ASYNC_t *as, int revents);
+
+/* for upscli_strerror() and upscli_upserror() */
+UPSCONN_t *upscli_async_conn(UPSCLI_ASYNC_t *as);
+
+/* queue requests, which may be done before the connection is ready, and
+ * from the callbacks; they are sent at once (pipelined) and answered in
+ * order. cmd is a raw command line like "USERNAME <name>", without the
+ * newline, answered by one line (usually "OK") */
+int upscli_async_get(UPSCLI_ASYNC_t *as, size_t numq, const char **query,
+		upscli_async_cb_t cb, void *arg);
+int upscli_async_list(UPSCLI_ASYNC_t *as, size_t numq, const char **query,
+		upscli_async_cb_t cb, void *arg);
+int upscli_async_cmd(UPSCLI_ASYNC_t *as, const char *cmd,
+		upscli_async_cb_t cb, void *arg);
+/* number of the requests which are not answered yet */
+size_t upscli_async_pending(UPSCLI_ASYNC_t *as);
+
+/* called with ret=0 and the split CHANGED or DELETED line pushed by upsd
+ * for a WATCH subscription */
+void upscli_async_set_push(UPSCLI_ASYNC_t *as, upscli_async_cb_t cb, void *arg);
+
 /* Assign default upscli_connect() from string; return 0 if OK, or
  * return -1 if parsing failed and current value was kept  */
 int upscli_set_default_connect_timeout(const char *secs);
@@ -55,7 +55,8 @@ static void usage(const char *prog)
 
 	printf("\nusage: %s [-h]\n", prog);
 	printf("       %s [-l <ups>]\n", prog);
-	printf("       %s [-u <username>] [-p <password>] [-w] [-t <timeout>] <ups> <command> [<value>]\n\n", prog);
+	printf("       %s [-u <username>] [-p <password>] [-w] [-t <timeout>] <ups> <command> [<value>]\n", prog);
+	printf("       %s [-u <username>] [-p <password>] [-w] [-t <timeout>] -f <file> <ups>\n\n", prog);
 	printf("\n");
 	printf("  -l <ups>	show available commands on UPS <ups>\n");
 	printf("  -u <username>	set username for command authentication\n");
@@ -63,6 +64,8 @@ static void usage(const char *prog)
 	printf("  -w            wait for the completion of command by the driver\n");
 	printf("                and return its actual result from the device\n");
 	printf("  -t <timeout>	set a timeout when using -w (in seconds, default: %d)\n", DEFAULT_TRACKING_TIMEOUT);
+	printf("  -f <file>	run the commands listed in <file> (- for stdin), one\n");
+	printf("		\"<command> [<value>]\" per line, over a single session\n");
 	printf("\n");
 	printf("  <ups>		UPS identifier - <upsname>[@<hostname>[:<port>]]\n");
 	printf("  <command>	Valid instant command - test.panel.start, etc.\n");
@@ -276,6 +279,222 @@ static void do_cmd(char **argv, const int argc)
 # pragma GCC diagnostic pop
 #endif
 
+/* script mode: the operations are sent pipelined over the one session,
+ * a window at a time so that their answers never fill up the sockets */
+#define BATCH_WINDOW	32
+
+struct batch_op_t {
+	char	*desc;		/* the script line, reported with the result */
+	char	*request;	/* what is sent to upsd */
+	char	*result;	/* the final answer */
+	char	tracking_id[UUID4_LEN];
+};
+
+static struct batch_op_t	*batch_ops = NULL;
+static size_t	batch_numops = 0, batch_allocops = 0;
+
+static void batch_add(const char *desc, const char *request)
+{
+	struct batch_op_t	*op;
+
+	if (batch_numops == batch_allocops) {
+		batch_allocops = batch_allocops ? batch_allocops * 2 : 16;
+		batch_ops = xrealloc(batch_ops, batch_allocops * sizeof(*batch_ops));
+	}
+
+	op = &batch_ops[batch_numops++];
+	memset(op, 0, sizeof(*op));
+	op->desc = xstrdup(desc);
+	op->request = xstrdup(request);
+}
+
+/* send all <req> lines, reading back their answers in the same order */
+static void batch_exchange(char **req, char **ans, size_t count)
+{
+	char	buf[SMALLBUF], *out;
+	size_t	i, j, n, len;
+
+	for (i = 0; i < count; i += n) {
+		n = count - i;
+		if (n > BATCH_WINDOW) {
+			n = BATCH_WINDOW;
+		}
+
+		for (j = 0, len = 0; j < n; j++) {
+			len += strlen(req[i + j]);
+		}
+
+		out = xmalloc(len + 1);
+		for (j = 0, len = 0; j < n; j++) {
+			memcpy(out + len, req[i + j], strlen(req[i + j]));
+			len += strlen(req[i + j]);
+		}
+
+		if (upscli_sendline(ups, out, len) < 0) {
+			fatalx(EXIT_FAILURE, "Can't send the requests: %s", upscli_strerror(ups));
+		}
+		free(out);
+
+		for (j = 0; j < n; j++) {
+			if (upscli_readline(ups, buf, sizeof(buf)) < 0) {
+				fatalx(EXIT_FAILURE, "Can't receive the answers: %s", upscli_strerror(ups));
+			}
+			ans[i + j] = xstrdup(buf);
+		}
+	}
+}
+
+/* run the script, polling the tracking IDs of all operations together;
+ * returns the number of failed ones */
+static size_t do_batch(void)
+{
+	char	**req, **ans;
+	size_t	i, n, pending = 0, failed = 0;
+	time_t	start, now;
+	struct batch_op_t	*op;
+
+	req = xcalloc(batch_numops, sizeof(*req));
+	ans = xcalloc(batch_numops, sizeof(*ans));
+
+	for (i = 0; i < batch_numops; i++) {
+		req[i] = batch_ops[i].request;
+	}
+
+	batch_exchange(req, ans, batch_numops);
+
+	for (i = 0; i < batch_numops; i++) {
+		op = &batch_ops[i];
+
+		/* "OK TRACKING " + UUID4_LEN, as in single command mode */
+		if (tracking_enabled && !strncmp(ans[i], "OK TRACKING ", 12)
+		 && strlen(ans[i]) == UUID4_LEN - 1 + 12) {
+			memcpy(op->tracking_id, ans[i] + 12, UUID4_LEN);
+			free(ans[i]);
+			pending++;
+		} else {
+			op->result = ans[i];
+		}
+	}
+
+	time(&start);
+
+	while (pending > 0) {
+		time(&now);
+		if (difftime(now, start) >= timeout) {
+			break;
+		}
+
+		for (i = 0, n = 0; i < batch_numops; i++) {
+			if (batch_ops[i].result) {
+				continue;
+			}
+			req[n] = xmalloc(UUID4_LEN + 15);
+			snprintf(req[n++], UUID4_LEN + 15, "GET TRACKING %s\n", batch_ops[i].tracking_id);
+		}
+
+		batch_exchange(req, ans, n);
+
+		for (i = 0, n = 0; i < batch_numops; i++) {
+			op = &batch_ops[i];
+			if (op->result) {
+				continue;
+			}
+
+			free(req[n]);
+			if (strncmp(ans[n], "PENDING", 7)) {
+				op->result = ans[n];
+				pending--;
+			} else {
+				free(ans[n]);
+			}
+			n++;
+		}
+
+		if (pending > 0) {
+			/* wait a second before retrying */
+			sleep(1);
+		}
+	}
+
+	for (i = 0; i < batch_numops; i++) {
+		op = &batch_ops[i];
+
+		/* still PENDING when the timeout expired */
+		printf("%s: %s\n", op->desc, op->result ? op->result : "PENDING");
+
+		if (!op->result || (strncmp(op->result, "OK", 2) && strcmp(op->result, "SUCCESS"))) {
+			failed++;
+		}
+
+		free(op->desc);
+		free(op->request);
+		free(op->result);
+	}
+
+	free(batch_ops);
+	free(req);
+	free(ans);
+
+	return failed;
+}
+
+/* read the script: one "<command> [<value>]" per line */
+static void batch_read(const char *fn)
+{
+	FILE	*f = stdin;
+	char	line[SMALLBUF], desc[SMALLBUF], req[SMALLBUF * 2], enc[SMALLBUF];
+	char	*cmd, *val, *end;
+	size_t	lineno = 0;
+
+	if (strcmp(fn, "-") && (f = fopen(fn, "r")) == NULL) {
+		fatal_with_errno(EXIT_FAILURE, "Can't open %s", fn);
+	}
+
+	while (fgets(line, sizeof(line), f)) {
+		lineno++;
+
+		cmd = line + strspn(line, " \t");
+		for (end = cmd + strlen(cmd); end > cmd && strchr(" \t\r\n", end[-1]); end--)
+			;
+		*end = '\0';
+
+		if (!*cmd || *cmd == '#') {
+			continue;
+		}
+
+		val = cmd + strcspn(cmd, " \t");
+		if (*val) {
+			*val++ = '\0';
+			val += strspn(val, " \t");
+		}
+
+		/* also fallback for old command names */
+		if (!strchr(cmd, '.')) {
+			fatalx(EXIT_FAILURE, "Error: %s line %" PRIuSIZE ": old command names are not supported",
+				fn, lineno);
+		}
+
+		if (*val) {
+			snprintf(desc, sizeof(desc), "%s %s", cmd, val);
+			snprintf(req, sizeof(req), "INSTCMD %s %s \"%s\"\n",
+				upsname, cmd, pconf_encode(val, enc, sizeof(enc)));
+		} else {
+			snprintf(desc, sizeof(desc), "%s", cmd);
+			snprintf(req, sizeof(req), "INSTCMD %s %s\n", upsname, cmd);
+		}
+
+		batch_add(desc, req);
+	}
+
+	if (f != stdin) {
+		fclose(f);
+	}
+
+	if (!batch_numops) {
+		fatalx(EXIT_FAILURE, "Error: no commands found in %s", fn);
+	}
+}
+
 static void clean_exit(void)
 {
 	if (ups) {
@@ -295,6 +514,7 @@ int main(int argc, char **argv)
 	int	have_un = 0, have_pw = 0, cmdlist = 0;
 	char	buf[SMALLBUF * 2], username[SMALLBUF], password[SMALLBUF], *s = NULL;
 	const char	*prog = xbasename(argv[0]);
+	const char	*script = NULL;
 	const char	*net_connect_timeout = NULL;
 
 	/* NOTE: Caller must `export NUT_DEBUG_LEVEL` to see debugs for upsc
@@ -308,7 +528,7 @@ int main(int argc, char **argv)
 	}
 	upsdebugx(1, "Starting NUT client: %s", prog);
 
-	while ((i = getopt(argc, argv, "+lhu:p:t:wVW:")) != -1) {
+	while ((i = getopt(argc, argv, "+lhu:p:t:wf:VW:")) != -1) {
 
 		switch (i)
 		{
@@ -335,6 +555,10 @@ int main(int argc, char **argv)
 			tracking_enabled = 1;
 			break;
 
+		case 'f':
+			script = optarg;
+			break;
+
 		case 'V':
 			/* just show the version and optional
 			 * CONFIG_FLAGS banner if available */
@@ -384,14 +608,23 @@ int main(int argc, char **argv)
 		exit(EXIT_SUCCESS);
 	}
 
-	if (argc < 2) {
-		usage(prog);
-		exit(EXIT_SUCCESS);
-	}
+	if (script) {
+		batch_read(script);
+
+		/* the username prompt would read the script */
+		if (!have_un && !strcmp(script, "-")) {
+			fatalx(EXIT_FAILURE, "Error: -u is required when the commands are read from stdin");
+		}
+	} else {
+		if (argc < 2) {
+			usage(prog);
+			exit(EXIT_SUCCESS);
+		}
 
-	/* also fallback for old command names */
-	if (!strchr(argv[1], '.')) {
-		fatalx(EXIT_FAILURE, "Error: old command names are not supported");
+		/* also fallback for old command names */
+		if (!strchr(argv[1], '.')) {
+			fatalx(EXIT_FAILURE, "Error: old command names are not supported");
+		}
 	}
 
 	if (!have_un) {
@@ -482,6 +715,10 @@ int main(int argc, char **argv)
 		}
 	}
 
+	if (script) {
+		exit(do_batch() ? EXIT_FAILURE : EXIT_SUCCESS);
+	}
+
 	do_cmd(&argv[1], argc - 1);
 
 	exit(EXIT_SUCCESS);
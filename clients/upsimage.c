@@ -52,10 +52,14 @@
 #define UPSCLI_DEFAULT_CONNECT_TIMEOUT	"10"
 
 static	char	*monhost = NULL, *cmd = NULL;
+static	int	use_svg = 0;
 
 static	uint16_t	port;
 static	char	*upsname, *hostname;
-static	UPSCONN_t	ups;
+static	UPSCONN_t	*ups;
+
+/* defaults of the imgarg[] values, which requests may change */
+static	int	*imgarg_default = NULL;
 
 #define RED(x)		((x >> 16) & 0xff)
 #define GREEN(x)	((x >> 8)  & 0xff)
@@ -82,6 +86,11 @@ void parsearg(char *var, char *value)
 		return;
 	}
 
+	if (!strcmp(var, "format")) {
+		use_svg = !strcmp(value, "svg");
+		return;
+	}
+
 	/* see if this is one of the shared (upsimagearg.h) variables */
 	for (i = 0; imgarg[i].name != NULL; i++) {
 		if (!strcmp(imgarg[i].name, var)) {
@@ -117,32 +126,414 @@ static int get_imgarg(const char *name)
 	return -1;
 }
 
-/* write the HTML header then have gd dump the image */
-static void drawimage(gdImagePtr im)
-	__attribute__((noreturn));
+/* what the drawing functions below draw on: a gd image for PNG output,
+ * or a list of shapes for SVG output */
+#define IMG_MAXCOLORS	32
+
+typedef enum {
+	IMG_RECT = 0,
+	IMG_LINE,
+	IMG_TEXT,
+	IMG_TEXTUP
+} img_shape_kind_t;
+
+typedef struct {
+	img_shape_kind_t	kind;
+	int	x1, y1, x2, y2;
+	int	color;
+	char	*text;
+} img_shape_t;
+
+typedef struct {
+	gdImagePtr	gd;
+	int	width, height;
+	int	numcolors, colors[IMG_MAXCOLORS];
+	int	transparent;
+	size_t	numshapes, size;
+	img_shape_t	*shapes;
+} img_t;
+
+/* images already drawn, for the requests asking for the same again */
+#define IMG_CACHE_SIZE	32
+
+typedef struct {
+	char	*key;
+	char	*data;
+	size_t	len;
+	int	svg;
+	time_t	when;
+	unsigned long	used;
+} img_cache_t;
+
+static	img_cache_t	img_cache[IMG_CACHE_SIZE];
+static	unsigned long	img_cache_uses = 0;
+
+/* what is drawn for the request: its ETag comes from it */
+static	char	img_key[LARGEBUF];
+
+static img_t *img_create(int width, int height)
+{
+	img_t	*im = xcalloc(1, sizeof(*im));
+
+	im->width = width;
+	im->height = height;
+	im->transparent = -1;
+
+	if (!use_svg)
+		im->gd = gdImageCreate(width, height);
 
-static void drawimage(gdImagePtr im)
+	return im;
+}
+
+static void img_destroy(img_t *im)
 {
-	printf("Pragma: no-cache\n");
-	printf("Content-type: image/png\n\n");
+	size_t	i;
 
-	gdImagePng(im, stdout);
-	gdImageDestroy(im);
+	if (im->gd)
+		gdImageDestroy(im->gd);
 
-	upscli_disconnect(&ups);
+	for (i = 0; i < im->numshapes; i++)
+		free(im->shapes[i].text);
 
-	exit(EXIT_SUCCESS);
+	free(im->shapes);
+	free(im);
+}
+
+static void img_add(img_t *im, img_shape_kind_t kind, int x1, int y1,
+	int x2, int y2, int color, const char *text)
+{
+	img_shape_t	*sh;
+
+	if (im->numshapes >= im->size) {
+		im->size = im->size ? im->size * 2 : 64;
+		im->shapes = xrealloc(im->shapes, im->size * sizeof(*im->shapes));
+	}
+
+	sh = &im->shapes[im->numshapes++];
+	sh->kind = kind;
+	sh->x1 = x1;
+	sh->y1 = y1;
+	sh->x2 = x2;
+	sh->y2 = y2;
+	sh->color = color;
+	sh->text = text ? xstrdup(text) : NULL;
 }
 
 /* helper function to allocate color in the image */
-static int color_alloc(gdImagePtr im, int rgb)
+static int color_alloc(img_t *im, int rgb)
+{
+	if (im->gd)
+		return gdImageColorAllocate(im->gd, RED(rgb), GREEN(rgb), BLUE(rgb));
+
+	if (im->numcolors >= IMG_MAXCOLORS)
+		return im->numcolors - 1;
+
+	im->colors[im->numcolors] = rgb;
+	return im->numcolors++;
+}
+
+static void img_transparent(img_t *im, int color)
+{
+	if (im->gd)
+		gdImageColorTransparent(im->gd, color);
+
+	im->transparent = color;
+}
+
+static void img_rect(img_t *im, int x1, int y1, int x2, int y2, int color)
+{
+	if (im->gd)
+		gdImageFilledRectangle(im->gd, x1, y1, x2, y2, color);
+	else
+		img_add(im, IMG_RECT, x1, y1, x2, y2, color, NULL);
+}
+
+static void img_line(img_t *im, int x1, int y1, int x2, int y2, int color)
+{
+	if (im->gd)
+		gdImageLine(im->gd, x1, y1, x2, y2, color);
+	else
+		img_add(im, IMG_LINE, x1, y1, x2, y2, color, NULL);
+}
+
+static void img_string(img_t *im, int x, int y, const char *s, int color)
+{
+	if (im->gd)
+		gdImageString(im->gd, gdFontMediumBold, x, y,
+			(unsigned char *)s, color);
+	else
+		img_add(im, IMG_TEXT, x, y, 0, 0, color, s);
+}
+
+static void img_string_up(img_t *im, int x, int y, const char *s, int color)
+{
+	if (im->gd)
+		gdImageStringUp(im->gd, gdFontMediumBold, x, y,
+			(unsigned char *)s, color);
+	else
+		img_add(im, IMG_TEXTUP, x, y, 0, 0, color, s);
+}
+
+static void svg_text(char **buf, size_t *len, size_t *size, const char *s)
+{
+	char	esc[SMALLBUF * 6];
+	size_t	i;
+
+	esc[0] = '\0';
+
+	for (i = 0; s[i] && strlen(esc) < sizeof(esc) - 8; i++) {
+		switch (s[i]) {
+		case '&':	snprintfcat(esc, sizeof(esc), "&amp;"); break;
+		case '<':	snprintfcat(esc, sizeof(esc), "&lt;"); break;
+		case '>':	snprintfcat(esc, sizeof(esc), "&gt;"); break;
+		default:
+			/* no control characters in XML */
+			snprintfcat(esc, sizeof(esc), "%c",
+				((unsigned char)s[i] < 0x20) ? ' ' : s[i]);
+			break;
+		}
+	}
+
+	if (*len + strlen(esc) + 1 > *size) {
+		*size = (*len + strlen(esc) + 1) * 2;
+		*buf = xrealloc(*buf, *size);
+	}
+
+	memcpy(*buf + *len, esc, strlen(esc) + 1);
+	*len += strlen(esc);
+}
+
+static void svg_add(char **buf, size_t *len, size_t *size, const char *fmt, ...)
+	__attribute__ ((__format__ (__printf__, 4, 5)));
+
+static void svg_add(char **buf, size_t *len, size_t *size, const char *fmt, ...)
+{
+	char	line[SMALLBUF];
+	va_list	ap;
+
+	va_start(ap, fmt);
+	vsnprintf(line, sizeof(line), fmt, ap);
+	va_end(ap);
+
+	if (*len + strlen(line) + 1 > *size) {
+		*size = (*len + strlen(line) + 1) * 2;
+		*buf = xrealloc(*buf, *size);
+	}
+
+	memcpy(*buf + *len, line, strlen(line) + 1);
+	*len += strlen(line);
+}
+
+/* the shapes as an SVG document, drawn like gd would: pixel centers on
+ * the integer coordinates, and text in its 7x13 MediumBold font */
+static char *img_svg(img_t *im, size_t *len)
+{
+	char	*buf = NULL;
+	size_t	size = 0, i;
+	img_shape_t	*sh;
+	int	rgb;
+
+	*len = 0;
+
+	svg_add(&buf, len, &size,
+		"<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+		"<svg xmlns=\"http://www.w3.org/2000/svg\" width=\"%d\" height=\"%d\""
+		" viewBox=\"0 0 %d %d\" shape-rendering=\"crispEdges\""
+		" font-family=\"monospace\" font-weight=\"bold\" font-size=\"13\">\n",
+		im->width, im->height, im->width, im->height);
+
+	for (i = 0; i < im->numshapes; i++) {
+		sh = &im->shapes[i];
+
+		/* likewise, gd shows nothing of that color */
+		if (sh->color == im->transparent)
+			continue;
+
+		rgb = im->colors[sh->color];
+
+		switch (sh->kind) {
+		case IMG_RECT:
+			svg_add(&buf, len, &size,
+				"<rect x=\"%d\" y=\"%d\" width=\"%d\" height=\"%d\" fill=\"#%06x\"/>\n",
+				sh->x1, sh->y1, sh->x2 - sh->x1 + 1,
+				sh->y2 - sh->y1 + 1, (unsigned int)rgb);
+			break;
+
+		case IMG_LINE:
+			svg_add(&buf, len, &size,
+				"<line x1=\"%d.5\" y1=\"%d.5\" x2=\"%d.5\" y2=\"%d.5\" stroke=\"#%06x\"/>\n",
+				sh->x1, sh->y1, sh->x2, sh->y2, (unsigned int)rgb);
+			break;
+
+		case IMG_TEXT:
+			svg_add(&buf, len, &size,
+				"<text x=\"%d\" y=\"%d\" fill=\"#%06x\">",
+				sh->x1, sh->y1 + gdFontMediumBold->h - 3,
+				(unsigned int)rgb);
+			svg_text(&buf, len, &size, sh->text);
+			svg_add(&buf, len, &size, "</text>\n");
+			break;
+
+		case IMG_TEXTUP:
+			svg_add(&buf, len, &size,
+				"<text transform=\"translate(%d %d) rotate(-90)\" y=\"%d\" fill=\"#%06x\">",
+				sh->x1, sh->y1, gdFontMediumBold->h - 3,
+				(unsigned int)rgb);
+			svg_text(&buf, len, &size, sh->text);
+			svg_add(&buf, len, &size, "</text>\n");
+			break;
+
+		default:
+			break;
+		}
+	}
+
+	svg_add(&buf, len, &size, "</svg>\n");
+
+	return buf;
+}
+
+/* the arguments of the request, which all drawings depend on */
+static void img_key_args(void)
+{
+	int	i;
+
+	snprintfcat(img_key, sizeof(img_key), " %s", use_svg ? "svg" : "png");
+
+	for (i = 0; imgarg[i].name != NULL; i++)
+		snprintfcat(img_key, sizeof(img_key), " %d", imgarg[i].val);
+}
+
+/* FNV-1a, as a quoted string */
+static void img_etag(const char *key, char *buf, size_t buflen)
+{
+	uint64_t	h = 0xcbf29ce484222325ULL;
+	const unsigned char	*p;
+
+	for (p = (const unsigned char *)key; *p; p++) {
+		h ^= *p;
+		h *= 0x100000001b3ULL;
+	}
+
+	snprintf(buf, buflen, "\"%08lx%08lx\"",
+		(unsigned long)(h >> 32), (unsigned long)(h & 0xffffffffUL));
+}
+
+static void img_headers(const char *etag, time_t when, int svg)
+{
+	char	date[SMALLBUF];
+	struct tm	tmbuf;
+
+	/* may be kept, but must be checked with us each time */
+	printf("Pragma: no-cache\n");
+	printf("Cache-Control: no-cache\n");
+	printf("ETag: %s\n", etag);
+
+	if (strftime(date, sizeof(date), "%a, %d %b %Y %H:%M:%S GMT",
+		gmtime_r(&when, &tmbuf)))
+		printf("Last-Modified: %s\n", date);
+
+	if (svg)
+		printf("Content-type: image/svg+xml\n\n");
+	else
+		printf("Content-type: image/png\n\n");
+}
+
+/* see if what is described by img_key was already drawn: if so, tell the
+ * browser that the copy it has is fine, or send the one we have */
+static int img_cached(void)
+{
+	char	etag[SMALLBUF];
+	const char	*inm = getenv("HTTP_IF_NONE_MATCH");
+	img_cache_t	*c;
+	size_t	i;
+
+	img_key_args();
+	img_etag(img_key, etag, sizeof(etag));
+
+	if (inm && (strstr(inm, etag) || !strcmp(inm, "*"))) {
+		printf("Status: 304 Not Modified\n");
+		printf("Cache-Control: no-cache\n");
+		printf("ETag: %s\n\n", etag);
+		return 1;
+	}
+
+	for (i = 0; i < IMG_CACHE_SIZE; i++) {
+		c = &img_cache[i];
+
+		if (!c->key || strcmp(c->key, img_key))
+			continue;
+
+		c->used = ++img_cache_uses;
+
+		img_headers(etag, c->when, c->svg);
+		fwrite(c->data, 1, c->len, stdout);
+		return 1;
+	}
+
+	return 0;
+}
+
+/* keep the image for later requests, in place of the least used one */
+static void img_cache_add(const char *data, size_t len, time_t when)
+{
+	img_cache_t	*c = &img_cache[0];
+	size_t	i;
+
+	/* nobody to ask for it again */
+	if (!cgi_persistent())
+		return;
+
+	for (i = 1; i < IMG_CACHE_SIZE && c->key; i++)
+		if (!img_cache[i].key || img_cache[i].used < c->used)
+			c = &img_cache[i];
+
+	free(c->key);
+	free(c->data);
+
+	c->key = xstrdup(img_key);
+	c->data = xmalloc(len);
+	memcpy(c->data, data, len);
+	c->len = len;
+	c->svg = use_svg;
+	c->when = when;
+	c->used = ++img_cache_uses;
+}
+
+/* write the HTML header then dump the image */
+static void drawimage(img_t *im)
 {
-	return gdImageColorAllocate(im, RED(rgb), GREEN(rgb), BLUE(rgb));
+	char	etag[SMALLBUF], *data;
+	int	size = 0;
+	size_t	len;
+	time_t	now = time(NULL);
+
+	img_etag(img_key, etag, sizeof(etag));
+
+	if (im->gd) {
+		data = gdImagePngPtr(im->gd, &size);
+		len = (data && size > 0) ? (size_t)size : 0;
+	} else
+		data = img_svg(im, &len);
+
+	img_headers(etag, now, use_svg);
+
+	if (data) {
+		fwrite(data, 1, len, stdout);
+		img_cache_add(data, len, now);
+
+		if (im->gd)
+			gdFree(data);
+		else
+			free(data);
+	}
+
+	img_destroy(im);
 }
 
 /* draws the scale behind the bar indicator */
 static void drawscale(
-	gdImagePtr im,				/* image where we would like to draw scale */
+	img_t *im,				/* image where we would like to draw scale */
 	int lvllo, int lvlhi,			/* min and max numbers on the scale */
 	int step, int step5, int step10,	/* steps for minor, submajor and major dashes */
 	int redlo1, int redhi1,			/* first red zone start and end */
@@ -171,8 +562,8 @@ static void drawscale(
 	scale_height = get_imgarg("scale_height");
 
 	/* start out with a background color and make it transparent */
-	gdImageFilledRectangle(im, 0, 0, width, height, back_color);
-	gdImageColorTransparent(im, back_color);
+	img_rect(im, 0, 0, width, height, back_color);
+	img_transparent(im, back_color);
 
 	range = lvlhi - lvllo;
 
@@ -196,12 +587,12 @@ static void drawscale(
 
 		/* draw major, semimajor or minor dash accordingly */
 		if (level % step10 == 0) {
-			gdImageLine(im, 0, y, width, y, col1);
+			img_line(im, 0, y, width, y, col1);
 		} else {
 			if (level % step5 == 0)
-				gdImageLine(im, 5, y, width - 5, y, col2);
+				img_line(im, 5, y, width - 5, y, col2);
 			else
-				gdImageLine(im, 10, y, width - 10, y, col2);
+				img_line(im, 10, y, width - 10, y, col2);
 		}
 	}
 
@@ -210,25 +601,14 @@ static void drawscale(
 		if (level % step10 == 0) {
 			y = scale_height * (lvlhi - level) / range;
 			snprintf(lbltxt, sizeof(lbltxt), "%d", level);
-			gdImageString(im, gdFontMediumBold,
+			img_string(im,
 				width - (int)(strlen(lbltxt)) * gdFontMediumBold->w,
-				y, (unsigned char *) lbltxt, scale_num_color);
+				y, lbltxt, scale_num_color);
 		}
 	}
 }
 
 /* draws the bar style indicator */
-static void drawbar(
-	int lvllo, int lvlhi,			/* min and max numbers on the scale */
-	int step, int step5, int step10,	/* steps for minor, submajor and major dashes */
-	int redlo1, int redhi1,			/* first red zone start and end */
-	int redlo2, int redhi2,			/* second red zone start and end */
-	int grnlo, int grnhi,			/* green zone start and end */
-	double value, 				/* UPS variable value to draw */
-	const char *format			/* printf style format to be used when rendering summary text */
-)
-	__attribute__((noreturn));
-
 static void drawbar(
 	int lvllo, int lvlhi,			/* min and max numbers on the scale */
 	int step, int step5, int step10,	/* steps for minor, submajor and major dashes */
@@ -239,19 +619,28 @@ static void drawbar(
 	const char *format			/* printf style format to be used when rendering summary text */
 )
 {
-	gdImagePtr	im;
+	img_t		*im;
 	int		bar_color, summary_color;
 	char		text[SMALLBUF];
 	int		bar_y;
 	int		width, height, scale_height;
 
+	/* same bar as before? */
+	snprintf(img_key, sizeof(img_key),
+		"bar %d %d %d %d %d %d %d %d %d %d %d %.17g %s",
+		lvllo, lvlhi, step, step5, step10, redlo1, redhi1,
+		redlo2, redhi2, grnlo, grnhi, value, format);
+
+	if (img_cached())
+		return;
+
 	/* get the dimension parameters */
 	width = get_imgarg("width");
 	height = get_imgarg("height");
 	scale_height = get_imgarg("scale_height");
 
 	/* create the image */
-	im = gdImageCreate(width, height);
+	im = img_create(width, height);
 
 	/* draw the scale */
 	drawscale(im, lvllo, lvlhi, step, step5, step10, redlo1, redhi1,
@@ -275,30 +664,24 @@ static void drawbar(
 		bar_y = scale_height;
 
 	/* draw it */
-	gdImageFilledRectangle(im, 25, bar_y, width - 25, scale_height,
-		bar_color);
+	img_rect(im, 25, bar_y, width - 25, scale_height, bar_color);
 
 	/* stick the text version of the value at the bottom center
 	 * expected format is one of imgvar[] entries for "double value"
 	 */
 	snprintf_dynamic(text, sizeof(text), format, "%f", value);
-	gdImageString(im, gdFontMediumBold,
+	img_string(im,
 		(width - (int)(strlen(text))*gdFontMediumBold->w)/2,
 		height - gdFontMediumBold->h,
-		(unsigned char *) text, summary_color);
+		text, summary_color);
 
 	drawimage(im);
-
-	/* NOTREACHED */
 }
 
 /* draws the error image */
-static void noimage(const char *fmt, ...)
-	__attribute__((noreturn));
-
 static void noimage(const char *fmt, ...)
 {
-	gdImagePtr	im;
+	img_t	*im;
 	int		back_color, summary_color;
 	int		width, height;
 	char		msg[SMALLBUF];
@@ -326,46 +709,45 @@ static void noimage(const char *fmt, ...)
 #endif
 	va_end(ap);
 
+	snprintf(img_key, sizeof(img_key), "noimage %s", msg);
+
+	if (img_cached())
+		return;
+
 	width = get_imgarg("width");
 	height = get_imgarg("height");
 
-	im = gdImageCreate(width, height);
+	im = img_create(width, height);
 	back_color = color_alloc(im, get_imgarg("back_col"));
 	summary_color = color_alloc(im, get_imgarg("summary_col"));
 
-	gdImageFilledRectangle(im, 0, 0, width, height, back_color);
-	gdImageColorTransparent(im, back_color);
+	img_rect(im, 0, 0, width, height, back_color);
+	img_transparent(im, back_color);
 
 	if (width > height)
-		gdImageString(im, gdFontMediumBold,
+		img_string(im,
 			(width - (int)(strlen(msg))*gdFontMediumBold->w)/2,
 			(height - gdFontMediumBold->h)/2,
-			(unsigned char *) msg, 	summary_color);
+			msg, summary_color);
 	else
-		gdImageStringUp(im, gdFontMediumBold,
+		img_string_up(im,
 			(width - gdFontMediumBold->h)/2,
 			(height + (int)(strlen(msg))*gdFontMediumBold->w)/2,
-			(unsigned char *) msg, summary_color);
+			msg, summary_color);
 
 	drawimage(im);
 
 	/* NOTE: Earlier code called noimage() and then exit(EXIT_FAILURE);
-	 * to signal an error via process exit code. Now that drawimage()
-	 * always ends with exit(EXIT_SUCCESS) - which might make webserver
-	 * feel good - the command-line use if any suffers no error returns.
+	 * to signal an error via process exit code. Now the request which
+	 * drew it ends with EXIT_SUCCESS - which might make webserver feel
+	 * good - the command-line use if any suffers no error returns.
 	 */
-
-	/* NOTREACHED */
 }
 
 /* draws bar indicator when minimum, nominal or maximum values for the given
    UPS variable can be determined.
    deviation < 0 means that values below nom should be grey instead of
    green */
-static void drawgeneralbar(double var, int min, int nom, int max,
-		int deviation, 	const char *format)
-	__attribute__((noreturn));
-
 static void drawgeneralbar(double var, int min, int nom, int max,
 		int deviation, 	const char *format)
 {
@@ -420,15 +802,9 @@ static void drawgeneralbar(double var, int min, int nom, int max,
 		drawbar(lo, hi, step1, step5, step10, 0, min, max, hi,
 				nom, max, var, format);
 	}
-
-	/* NOTREACHED */
 }
 
 /* draws input and output voltage bar style indicators */
-static void draw_utility(double var, int min, int nom, int max,
-		int deviation, const char *format)
-	__attribute__((noreturn));
-
 static void draw_utility(double var, int min, int nom, int max,
 		int deviation, const char *format)
 {
@@ -467,15 +843,9 @@ static void draw_utility(double var, int min, int nom, int max,
 	deviation = (int)(nom * 0.1);
 
 	drawgeneralbar(var, min, nom, max, deviation, format);
-
-	/* NOTREACHED */
 }
 
 /* draws battery.percent bar style indicator */
-static void draw_battpct(double var, int min, int nom,
-		int max, int deviation, const char *format)
-	__attribute__((noreturn));
-
 static void draw_battpct(double var, int min, int nom,
 		int max, int deviation, const char *format)
 {
@@ -491,10 +861,6 @@ static void draw_battpct(double var, int min, int nom,
 }
 
 /* draws battery.voltage bar style indicator */
-static void draw_battvolt(double var, int min, int nom, int max,
-		int deviation, const char *format)
-	__attribute__((noreturn));
-
 static void draw_battvolt(double var, int min, int nom, int max,
 		int deviation, const char *format)
 {
@@ -540,11 +906,6 @@ static void draw_battvolt(double var, int min, int nom, int max,
 }
 
 /* draws ups.load bar style indicator */
-static void draw_upsload(double var, int min,
-		int nom, int max,
-		int deviation, const char *format)
-	__attribute__((noreturn));
-
 static void draw_upsload(double var, int min,
 		int nom, int max,
 		int deviation, const char *format)
@@ -558,10 +919,6 @@ static void draw_upsload(double var, int min,
 }
 
 /* draws temperature bar style indicator */
-static void draw_temperature(double var, int min, int nom, int max,
-		int deviation, const char *format)
-	__attribute__((noreturn));
-
 static void draw_temperature(double var, int min, int nom, int max,
 		int deviation, const char *format)
 {
@@ -574,10 +931,6 @@ static void draw_temperature(double var, int min, int nom, int max,
 }
 
 /* draws humidity bar style indicator */
-static void draw_humidity(double var, int min, int nom, int max,
-		int deviation, const char *format)
-	__attribute__((noreturn));
-
 static void draw_humidity(double var, int min, int nom, int max,
 		int deviation, const char *format)
 {
@@ -589,63 +942,73 @@ static void draw_humidity(double var, int min, int nom, int max,
 
 static int get_var(const char *var, char *buf, size_t buflen)
 {
-	int	ret;
-	size_t	numq, numa;
-	const	char	*query[4];
-	char	**answer;
+	/* one LIST VAR per UPS serves all of these */
+	if (cgi_get_var(ups, upsname, var, buf, buflen) < 0)
+		return 0;
 
-	query[0] = "VAR";
-	query[1] = upsname;
-	query[2] = var;
+	return 1;
+}
 
-	numq = 3;
+/* forget what the previous request set */
+static void reset_request(void)
+{
+	int	i;
 
-	ret = upscli_get(&ups, numq, query, &numa, &answer);
+	free(monhost);
+	free(cmd);
+	free(upsname);
+	free(hostname);
+	monhost = cmd = upsname = hostname = NULL;
+	use_svg = 0;
 
-	if (ret < 0)
-		return 0;
+	if (!imgarg_default) {
+		for (i = 0; imgarg[i].name != NULL; i++)
+			;
 
-	if (numa < numq)
-		return 0;
+		imgarg_default = xcalloc((size_t)i + 1, sizeof(*imgarg_default));
 
-	snprintf(buf, buflen, "%s", answer[3]);
-	return 1;
+		for (i = 0; imgarg[i].name != NULL; i++)
+			imgarg_default[i] = imgarg[i].val;
+	}
+
+	for (i = 0; imgarg[i].name != NULL; i++)
+		imgarg[i].val = imgarg_default[i];
 }
 
-int main(int argc, char **argv)
+static void handle_request(void)
 {
 	char	str[SMALLBUF];
 	int	i, min, nom, max;
 	double	var = 0;
-	NUT_UNUSED_VARIABLE(argc);
-	NUT_UNUSED_VARIABLE(argv);
 
-	extractcgiargs();
+	reset_request();
 
-	upscli_init_default_connect_timeout(NULL, NULL, UPSCLI_DEFAULT_CONNECT_TIMEOUT);
+	extractcgiargs();
 
 	/* no 'host=' or 'display=' given */
-	if ((!monhost) || (!cmd))
+	if ((!monhost) || (!cmd)) {
 		noimage("No host or display");
+		return;
+	}
 
-	if (!checkhost(monhost, NULL))
+	if (!checkhost(monhost, NULL)) {
 		noimage("Access denied");
-
-	upsname = hostname = NULL;
+		return;
+	}
 
 	if (upscli_splitname(monhost, &upsname, &hostname, &port) != 0) {
 		noimage("Invalid UPS definition (upsname[@hostname[:port]])\n");
-#ifndef HAVE___ATTRIBUTE__NORETURN
-		exit(EXIT_FAILURE);	/* Should not get here in practice, but compiler is afraid we can fall through */
-#endif
+		return;
 	}
 
-	if (upscli_connect(&ups, hostname, port, UPSCLI_CONN_TRYSSL) < 0) {
+	/* the connections to each upsd are kept between requests in
+	 * persistent mode */
+	ups = cgi_connect(hostname, port);
+
+	if (upscli_fd(ups) == -1) {
 		noimage("Can't connect to server:\n%s\n",
-			upscli_strerror(&ups));
-#ifndef HAVE___ATTRIBUTE__NORETURN
-		exit(EXIT_FAILURE);	/* Should not get here in practice, but compiler is afraid we can fall through */
-#endif
+			upscli_strerror(ups));
+		return;
 	}
 
 	for (i = 0; imgvar[i].name; i++)
@@ -655,9 +1018,7 @@ int main(int argc, char **argv)
 			   registered with this variable */
 			if (!imgvar[i].drawfunc) {
 				noimage("Draw function N/A");
-#ifndef HAVE___ATTRIBUTE__NORETURN
-				exit(EXIT_FAILURE);	/* Should not get here in practice, but compiler is afraid we can fall through */
-#endif
+				return;
 			}
 
 			/* get the variable value */
@@ -668,9 +1029,7 @@ int main(int argc, char **argv)
 				snprintf(str, sizeof(str), "%s N/A",
 					imgvar[i].name);
 				noimage(str);
-#ifndef HAVE___ATTRIBUTE__NORETURN
-				exit(EXIT_FAILURE);	/* Should not get here in practice, but compiler is afraid we can fall through */
-#endif
+				return;
 			}
 
 			/* when getting minimum, nominal and maximum values,
@@ -719,13 +1078,28 @@ int main(int argc, char **argv)
 
 			imgvar[i].drawfunc(var, min, nom, max,
 				imgvar[i].deviation, imgvar[i].format);
-			exit(EXIT_SUCCESS);
+			return;
 		}
 
 	noimage("Unknown display");
-#ifndef HAVE___ATTRIBUTE__NORETURN
-	exit(EXIT_FAILURE);
-#endif
+}
+
+int main(int argc, char **argv)
+{
+	NUT_UNUSED_VARIABLE(argc);
+	NUT_UNUSED_VARIABLE(argv);
+
+	upscli_init_default_connect_timeout(NULL, NULL, UPSCLI_DEFAULT_CONNECT_TIMEOUT);
+
+	/* one request as a CGI program, many as a FastCGI one */
+	while (cgi_accept()) {
+		handle_request();
+		cgi_finish(EXIT_SUCCESS);
+	}
+
+	cgi_disconnect_all();
+
+	return EXIT_SUCCESS;
 }
 
 imgvar_t imgvar[] = {
@@ -46,11 +46,15 @@
 /* network timeout for initial connection, in seconds */
 #define UPSCLI_DEFAULT_CONNECT_TIMEOUT	"10"
 
+/* records kept in memory, and seconds between batched writes */
+#define DEFAULT_RING_SIZE	4096
+#define DEFAULT_BATCH_INTERVAL	5
+
 #ifdef WIN32
 #include "wincompat.h"
 #endif	/* WIN32 */
 
-	static	int	reopen_flag = 0, exit_flag = 0;
+	static	int	reopen_flag = 0, exit_flag = 0, dump_flag = 0;
 	static	size_t	max_loops = 0;
 #ifndef WIN32
 	static	sigset_t	nut_upslog_sigmask;
@@ -61,6 +65,16 @@
 
 	static	flist_t	*fhead = NULL;
 
+	/* variables named in the format, fetched at once for each system */
+	static	const	char	**logvars = NULL;
+	static	size_t	numlogvars = 0;
+
+	/* the last records taken, the unwritten ones at the end */
+	static	output_mode_t	output_mode = OUTPUT_TEXT;
+	static	ring_record_t	*ring = NULL;
+	static	size_t	ring_size = DEFAULT_RING_SIZE, ring_next = 0;
+	static	size_t	ring_count = 0, ring_unwritten = 0;
+
 	/* FIXME: To be valgrind-clean, free these at exit */
 	static	struct	logtarget_t *logfile_anchor = NULL;
 	static	struct	monhost_ups_t *monhost_ups_anchor = NULL;
@@ -110,6 +124,8 @@ static struct logtarget_t *add_logfile(const char *logfn_arg)
 	return p;
 }
 
+static void start_logfile(FILE *f);
+
 static void reopen_log(void)
 {
 	struct	logtarget_t	*p;
@@ -134,6 +150,8 @@ static void reopen_log(void)
 			fatal_with_errno(EXIT_FAILURE,
 				"could not reopen logfile %s", p->logfn);
 		}
+
+		start_logfile(p->logfile);
 	}
 }
 
@@ -148,6 +166,11 @@ static void set_exit_flag(int sig)
 	exit_flag = sig;
 }
 
+static void set_dump_flag(int sig)
+{
+	dump_flag = sig;
+}
+
 static void set_print_now_flag(int sig)
 {
 	NUT_UNUSED_VARIABLE(sig);
@@ -156,7 +179,8 @@ static void set_print_now_flag(int sig)
 }
 #endif	/* !WIN32 */
 
-/* handlers: reload on HUP, exit on INT/QUIT/TERM */
+/* handlers: reload on HUP, exit on INT/QUIT/TERM, log now on USR1,
+ * dump the ring on USR2 */
 static void setup_signals(void)
 {
 #ifndef WIN32
@@ -181,6 +205,10 @@ static void setup_signals(void)
 	sa.sa_handler = set_print_now_flag;
 	if (sigaction(SIGUSR1, &sa, NULL) < 0)
 		fatal_with_errno(EXIT_FAILURE, "Can't install SIGUSR1 handler");
+
+	sa.sa_handler = set_dump_flag;
+	if (sigaction(SIGUSR2, &sa, NULL) < 0)
+		fatal_with_errno(EXIT_FAILURE, "Can't install SIGUSR2 handler");
 #else	/* WIN32 */
 	NUT_WIN32_INCOMPLETE_MAYBE_NOT_APPLICABLE();
 #endif	/* WIN32 */
@@ -201,7 +229,13 @@ static void help(const char *prog)
 	printf("		- Use -f \"<format>\" so your shell doesn't break it up.\n");
 	printf("  -N            - Prefix \"%%UPSHOST%%%%t\" before the format (default/custom)");
 	printf("		- Useful when logging many systems into same target.\n");
-	printf("  -i <interval>	- Time between updates, in seconds\n");
+	printf("  -i <interval>	- Time between updates, in seconds (may be fractional)\n");
+	printf("  -o <mode>	- Write records as text (default), csv or json\n");
+	printf("		- csv and json hold the %%VAR%% values of the format\n");
+	printf("  -b <secs>	- Write and sync csv/json records in batches this often\n");
+	printf("		  (default: %d)\n", DEFAULT_BATCH_INTERVAL);
+	printf("  -R <count>	- Records kept in memory for dumps on SIGUSR2 (default: %d)\n",
+		DEFAULT_RING_SIZE);
 	printf("  -d <count>	- Exit after specified amount of updates\n");
 	printf("  -l <logfile>	- Log file name, or - for stdout (foreground by default)\n");
 	printf("  -D		- raise debugging level (and stay foreground by default)\n");
@@ -298,24 +332,90 @@ static void do_time(const char *arg, const struct monhost_ups_t *monhost_ups_pri
 
 static void getvar(const char *var, const struct monhost_ups_t *monhost_ups_print)
 {
-	int	ret;
-	size_t	numq, numa;
-	const	char	*query[4];
-	char	**answer;
+	size_t	i;
+
+	for (i = 0; i < numlogvars; i++) {
+		if (!strcmp(logvars[i], var))
+			break;
+	}
+
+	if ((i >= numlogvars) || (!monhost_ups_print->values)
+	||  (!monhost_ups_print->values[i])
+	) {
+		snprintfcat(logbuffer, sizeof(logbuffer), "NA");
+		return;
+	}
+
+	snprintfcat(logbuffer, sizeof(logbuffer), "%s", monhost_ups_print->values[i]);
+}
+
+/* GET VAR of each variable for servers before GET VARS, with all the
+ * requests sent before their answers are read */
+static void fetch_vars_each(struct monhost_ups_t *mu)
+{
+	size_t	i, numa;
+	const	char	*query[3];
+	char	**answer, buf[UPSCLI_NETBUF_LEN];
 
 	query[0] = "VAR";
-	query[1] = monhost_ups_print->upsname;
-	query[2] = var;
-	numq = 3;
+	query[1] = mu->upsname;
 
-	ret = upscli_get(monhost_ups_print->ups, numq, query, &numa, &answer);
+	for (i = 0; i < numlogvars; i++) {
+		query[2] = logvars[i];
 
-	if ((ret < 0) || (numa < numq)) {
-		snprintfcat(logbuffer, sizeof(logbuffer), "NA");
+		if (upscli_get_send(mu->ups, 3, query) != 0)
+			return;
+	}
+
+	for (i = 0; i < numlogvars; i++) {
+		query[2] = logvars[i];
+
+		if (upscli_readline(mu->ups, buf, sizeof(buf)) != 0)
+			return;
+
+		if ((upscli_get_answer(mu->ups, buf, 3, query, &numa, &answer) == 0)
+		&&  (numa > 3)
+		) {
+			mu->values[i] = xstrdup(answer[3]);
+		}
+	}
+}
+
+/* fetch the logged variables of a system, once for all its tokens */
+static void fetch_vars(struct monhost_ups_t *mu)
+{
+	size_t	i;
+	int	err;
+
+	if (!numlogvars || !mu->upsname)
 		return;
+
+	if (!mu->values)
+		mu->values = xcalloc(numlogvars, sizeof(char *));
+
+	for (i = 0; i < numlogvars; i++) {
+		free(mu->values[i]);
+		mu->values[i] = NULL;
 	}
 
-	snprintfcat(logbuffer, sizeof(logbuffer), "%s", answer[3]);
+	if (!mu->nogetvars) {
+		if (upscli_get_vars(mu->ups, mu->upsname, numlogvars, logvars, mu->values) == 0)
+			return;
+
+		/* only older servers refuse the command itself */
+		err = upscli_upserror(mu->ups);
+		if ((upscli_fd(mu->ups) < 0)
+		||  ((err != UPSCLI_ERR_UNKCOMMAND) && (err != UPSCLI_ERR_INVALIDARG))
+		) {
+			return;
+		}
+
+		upsdebugx(1, "%s: no GET VARS support, using GET VAR for each variable",
+			mu->monhost);
+		mu->nogetvars = 1;
+	}
+
+	fetch_vars_each(mu);
 }
 
 static void do_var(const char *arg, const struct monhost_ups_t *monhost_ups_print)
@@ -384,6 +484,19 @@ static void add_call(void (*fptr)(const char *arg, const struct monhost_ups_t *m
 		last->next = tmp;
 	else
 		fhead = tmp;
+
+	/* the same check as in do_var(), which logs the others as INVALID */
+	if (fptr == do_var && arg && strchr(arg, '.')) {
+		size_t	i;
+
+		for (i = 0; i < numlogvars; i++) {
+			if (!strcmp(logvars[i], arg))
+				return;
+		}
+
+		logvars = xrealloc(logvars, (numlogvars + 1) * sizeof(*logvars));
+		logvars[numlogvars++] = tmp->arg;
+	}
 }
 
 /* turn the format string into a list of function calls with args */
@@ -487,9 +600,257 @@ static void run_flist(const struct monhost_ups_t *monhost_ups_print)
 
 		tmp = tmp->next;
 	}
+}
+
+/* append a CSV field, quoted if it has to be */
+static void csv_cat(const char *str)
+{
+	const	char	*p;
+
+	if (!strpbrk(str, ",\"\r\n")) {
+		snprintfcat(logbuffer, sizeof(logbuffer), "%s", str);
+		return;
+	}
+
+	snprintfcat(logbuffer, sizeof(logbuffer), "\"");
 
-	fprintf(monhost_ups_print->logtarget->logfile, "%s\n", logbuffer);
-	fflush(monhost_ups_print->logtarget->logfile);
+	for (p = str; *p; p++) {
+		if (*p == '"')
+			snprintfcat(logbuffer, sizeof(logbuffer), "\"\"");
+		else
+			snprintfcat(logbuffer, sizeof(logbuffer), "%c", *p);
+	}
+
+	snprintfcat(logbuffer, sizeof(logbuffer), "\"");
+}
+
+/* append a JSON string */
+static void json_cat(const char *str)
+{
+	const	char	*p;
+
+	snprintfcat(logbuffer, sizeof(logbuffer), "\"");
+
+	for (p = str; *p; p++) {
+		if (*p == '"' || *p == '\\')
+			snprintfcat(logbuffer, sizeof(logbuffer), "\\%c", *p);
+		else if ((unsigned char)*p < 0x20)
+			snprintfcat(logbuffer, sizeof(logbuffer), "\\u%04x", (unsigned char)*p);
+		else
+			snprintfcat(logbuffer, sizeof(logbuffer), "%c", *p);
+	}
+
+	snprintfcat(logbuffer, sizeof(logbuffer), "\"");
+}
+
+/* time,ups,<var>... for the head of a CSV file */
+static void write_csv_header(FILE *f)
+{
+	size_t	i;
+
+	memset(logbuffer, 0, sizeof(logbuffer));
+	snprintfcat(logbuffer, sizeof(logbuffer), "time,ups");
+
+	for (i = 0; i < numlogvars; i++) {
+		snprintfcat(logbuffer, sizeof(logbuffer), ",");
+		csv_cat(logvars[i]);
+	}
+
+	fprintf(f, "%s\n", logbuffer);
+}
+
+/* new (or emptied by a rotation) CSV files start with the column names */
+static void start_logfile(FILE *f)
+{
+	struct	stat	st;
+
+	if (output_mode != OUTPUT_CSV)
+		return;
+
+	if (f != stdout && (fstat(fileno(f), &st) != 0 || st.st_size > 0))
+		return;
+
+	write_csv_header(f);
+}
+
+/* the columns of a CSV or JSON record, taken at tv */
+static void make_columns(const struct monhost_ups_t *mu, const struct timeval *tv)
+{
+	size_t	i;
+	char	timebuf[SMALLBUF];
+
+	memset(logbuffer, 0, sizeof(logbuffer));
+	snprintf(timebuf, sizeof(timebuf), "%ld.%03ld",
+		(long)tv->tv_sec, (long)(tv->tv_usec / 1000));
+
+	if (output_mode == OUTPUT_CSV) {
+		snprintfcat(logbuffer, sizeof(logbuffer), "%s,", timebuf);
+		csv_cat(mu->monhost);
+
+		for (i = 0; i < numlogvars; i++) {
+			snprintfcat(logbuffer, sizeof(logbuffer), ",");
+			if (mu->values && mu->values[i])
+				csv_cat(mu->values[i]);
+		}
+
+		return;
+	}
+
+	snprintfcat(logbuffer, sizeof(logbuffer), "{\"time\":%s,\"ups\":", timebuf);
+	json_cat(mu->monhost);
+
+	for (i = 0; i < numlogvars; i++) {
+		snprintfcat(logbuffer, sizeof(logbuffer), ",");
+		json_cat(logvars[i]);
+		snprintfcat(logbuffer, sizeof(logbuffer), ":");
+		if (mu->values && mu->values[i])
+			json_cat(mu->values[i]);
+		else
+			snprintfcat(logbuffer, sizeof(logbuffer), "null");
+	}
+
+	snprintfcat(logbuffer, sizeof(logbuffer), "}");
+}
+
+/* the i-th record of the ring, from the oldest one */
+static ring_record_t *ring_record(size_t i)
+{
+	return &ring[(ring_next + ring_size - ring_count + i) % ring_size];
+}
+
+/* write the records not written yet, and sync them to the disk */
+static void write_batch(void)
+{
+	struct	logtarget_t	*p;
+	ring_record_t	*rec;
+	size_t	i;
+
+	for (i = ring_count - ring_unwritten; i < ring_count; i++) {
+		rec = ring_record(i);
+		fprintf(rec->monhost_ups->logtarget->logfile, "%s\n", rec->line);
+	}
+
+	ring_unwritten = 0;
+
+	for (p = logfile_anchor; p != NULL; p = p->next) {
+		if (!p->logfile)
+			continue;
+
+		fflush(p->logfile);
+#ifndef WIN32
+		if (p->logfile != stdout)
+			fsync(fileno(p->logfile));
+#endif	/* !WIN32 */
+	}
+}
+
+/* keep the record in logbuffer: text is written at once, as it always
+ * was, other modes wait for the next batch */
+static void add_record(struct monhost_ups_t *mu)
+{
+	ring_record_t	*rec;
+
+	if (ring_unwritten == ring_size)
+		write_batch();
+
+	rec = &ring[ring_next];
+	free(rec->line);
+	rec->monhost_ups = mu;
+	rec->line = xstrdup(logbuffer);
+
+	ring_next = (ring_next + 1) % ring_size;
+	if (ring_count < ring_size)
+		ring_count++;
+
+	if (output_mode != OUTPUT_TEXT) {
+		ring_unwritten++;
+		return;
+	}
+
+	fprintf(mu->logtarget->logfile, "%s\n", logbuffer);
+	fflush(mu->logtarget->logfile);
+}
+
+/* write all the records still in memory next to their log files, as
+ * <logfile>.ring (or on stdout for "-") */
+static void dump_ring(void)
+{
+	struct	logtarget_t	*p;
+	ring_record_t	*rec;
+	size_t	i, n;
+	char	fn[NUT_PATH_MAX + 1];
+	FILE	*f;
+
+	for (p = logfile_anchor; p != NULL; p = p->next) {
+		if (!p->logfile)
+			continue;
+
+		if (p->logfile == stdout) {
+			f = stdout;
+			snprintf(fn, sizeof(fn), "stdout");
+		} else {
+			snprintf(fn, sizeof(fn), "%s.ring", p->logfn);
+			if ((f = fopen(fn, "w")) == NULL) {
+				upslog_with_errno(LOG_ERR, "could not write %s", fn);
+				continue;
+			}
+		}
+
+		if (output_mode == OUTPUT_CSV)
+			write_csv_header(f);
+
+		for (i = 0, n = 0; i < ring_count; i++) {
+			rec = ring_record(i);
+			if (rec->monhost_ups->logtarget != p)
+				continue;
+
+			fprintf(f, "%s\n", rec->line);
+			n++;
+		}
+
+		if (f == stdout)
+			fflush(f);
+		else
+			fclose(f);
+
+		upslogx(LOG_INFO, "Dumped %" PRIuSIZE " records to %s", n, fn);
+	}
+}
+
+/* seconds on a clock which settime() does not move */
+static double now_mono(void)
+{
+#if defined(HAVE_CLOCK_GETTIME) && defined(HAVE_CLOCK_MONOTONIC) && HAVE_CLOCK_GETTIME && HAVE_CLOCK_MONOTONIC
+	struct	timespec	now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+#else
+	struct	timeval	now;
+
+	gettimeofday(&now, NULL);
+	return (double)now.tv_sec + (double)now.tv_usec / 1e6;
+#endif
+}
+
+/* sleep until that now_mono() time, or until a signal comes */
+static void sleep_until(double when)
+{
+	double	left = when - now_mono();
+#ifndef WIN32
+	struct	timeval	tv;
+#endif	/* !WIN32 */
+
+	if (left <= 0)
+		return;
+
+#ifndef WIN32
+	tv.tv_sec = (time_t)left;
+	tv.tv_usec = (suseconds_t)((left - (double)tv.tv_sec) * 1e6);
+	select(0, NULL, NULL, NULL, &tv);
+#else	/* WIN32 */
+	Sleep((DWORD)(left * 1000));
+#endif	/* WIN32 */
 }
 
 	/* -s <monhost>
@@ -502,11 +863,14 @@ static void run_flist(const struct monhost_ups_t *monhost_ups_print)
 
 int main(int argc, char **argv)
 {
-	int	interval = 30, i, foreground = -1, prefix_UPSHOST = 0, logformat_allocated = 0;
+	int	i, foreground = -1, prefix_UPSHOST = 0, logformat_allocated = 0;
 	size_t	monhost_len = 0, loop_count = 0;
 	const char	*prog = xbasename(argv[0]);
 	const char	*net_connect_timeout = NULL;
-	time_t	now, nextpoll = 0;
+	double	interval = 30, batch_interval = DEFAULT_BATCH_INTERVAL;
+	double	now, nextpoll = 0, lastbatch = 0;
+	struct	timeval	tv;
+	struct	logtarget_t	*logtarget;
 	const char	*user = NULL;
 	struct passwd	*new_uid = NULL;
 	const char	*pidfilebase = prog;
@@ -518,7 +882,7 @@ int main(int argc, char **argv)
 
 	print_banner_once(prog, 0);
 
-	while ((i = getopt(argc, argv, "+hDs:l:i:d:Nf:u:Vp:FBm:W:")) != -1) {
+	while ((i = getopt(argc, argv, "+hDs:l:i:d:Nf:u:Vp:FBm:W:o:b:R:")) != -1) {
 		switch(i) {
 			case 'h':
 				help(prog);
@@ -558,6 +922,9 @@ int main(int argc, char **argv)
 					monhost_ups_current->logtarget = add_logfile(filter_path(strsep(&m_arg, ",")));
 #endif	/* WIN32 */
 					monhost_ups_current->ups = NULL;
+					monhost_ups_current->sharedconn = 0;
+					monhost_ups_current->nogetvars = 0;
+					monhost_ups_current->values = NULL;
 					if (m_arg) /* Had a third comma - also unexpected! */
 						fatalx(EXIT_FAILURE, "Argument '-m upsspec,logfile' requires exactly 2 components in the tuple");
 					free(s);
@@ -576,7 +943,31 @@ int main(int argc, char **argv)
 				break;
 
 			case 'i':
-				interval = atoi(optarg);
+				interval = atof(optarg);
+				break;
+
+			case 'o':
+				if (!strcasecmp(optarg, "text"))
+					output_mode = OUTPUT_TEXT;
+				else if (!strcasecmp(optarg, "csv"))
+					output_mode = OUTPUT_CSV;
+				else if (!strcasecmp(optarg, "json"))
+					output_mode = OUTPUT_JSON;
+				else
+					fatalx(EXIT_FAILURE, "Error: unknown output mode %s", optarg);
+				break;
+
+			case 'b':
+				batch_interval = atof(optarg);
+				break;
+
+			case 'R':
+				{	/* scoping */
+					unsigned long ul = 0;
+					if (!str_to_ulong(optarg, &ul, 10) || ul < 1 || ul > SIZE_MAX / sizeof(ring_record_t))
+						fatalx(EXIT_FAILURE, "Error: invalid ring size %s", optarg);
+					ring_size = (size_t)ul;
+				}
 				break;
 
 			case 'd':
@@ -670,7 +1061,7 @@ int main(int argc, char **argv)
 #else	/* WIN32 */
 		logfn = filter_path(argv[1]);
 #endif	/* WIN32 */
-		interval = atoi(argv[2]);
+		interval = atof(argv[2]);
 	}
 
 	if (argc >= 4) {
@@ -712,6 +1103,9 @@ int main(int argc, char **argv)
 		monhost_ups_current->monhost = xstrdup(monhost);
 		monhost_ups_current->logtarget = add_logfile(logfn);
 		monhost_ups_current->ups = NULL;
+		monhost_ups_current->sharedconn = 0;
+		monhost_ups_current->nogetvars = 0;
+		monhost_ups_current->values = NULL;
 	}
 
 	/* shouldn't happen */
@@ -811,6 +1205,9 @@ int main(int argc, char **argv)
 				mu->hostname = xstrdup(monhost_ups_current->hostname);
 				mu->port = monhost_ups_current->port;
 				mu->ups = NULL;
+				mu->sharedconn = 0;
+				mu->nogetvars = 0;
+				mu->values = NULL;
 				mu->logtarget = monhost_ups_current->logtarget;
 				mu->next = monhost_ups_current->next;
 				monhost_ups_current->next = mu;
@@ -876,7 +1273,7 @@ int main(int argc, char **argv)
 	     monhost_ups_current != NULL;
 	     monhost_ups_current = monhost_ups_current->next
 	) {
-		printf("logging status of %s to %s (%is intervals)\n",
+		printf("logging status of %s to %s (%gs intervals)\n",
 			monhost_ups_current->monhost,
 			!strcmp(monhost_ups_current->logtarget->logfn, "-")
 			? "stdout"
@@ -886,11 +1283,28 @@ int main(int argc, char **argv)
 			fatalx(EXIT_FAILURE, "Error: invalid UPS definition.  Required format: upsname[@hostname[:port]]\n");
 		}
 
-		monhost_ups_current->ups = xmalloc(sizeof(UPSCONN_t));
+		/* systems of the same server are logged over one connection */
+		for (monhost_ups_prev = monhost_ups_anchor;
+		     monhost_ups_prev != monhost_ups_current;
+		     monhost_ups_prev = monhost_ups_prev->next
+		) {
+			if (monhost_ups_prev->port == monhost_ups_current->port
+			&&  !strcmp(monhost_ups_prev->hostname, monhost_ups_current->hostname)
+			) {
+				break;
+			}
+		}
+
+		if (monhost_ups_prev != monhost_ups_current) {
+			monhost_ups_current->ups = monhost_ups_prev->ups;
+			monhost_ups_current->sharedconn = 1;
+		} else {
+			monhost_ups_current->ups = xmalloc(sizeof(UPSCONN_t));
 
-		if (upscli_connect(monhost_ups_current->ups, monhost_ups_current->hostname, monhost_ups_current->port, UPSCLI_CONN_TRYSSL) < 0)
-			fprintf(stderr, "Warning: initial connect failed: %s\n",
-				upscli_strerror(monhost_ups_current->ups));
+			if (upscli_connect(monhost_ups_current->ups, monhost_ups_current->hostname, monhost_ups_current->port, UPSCLI_CONN_TRYSSL) < 0)
+				fprintf(stderr, "Warning: initial connect failed: %s\n",
+					upscli_strerror(monhost_ups_current->ups));
+		}
 
 		/* we might have several systems logged into same file */
 		if (monhost_ups_current->logtarget->logfile) {
@@ -936,16 +1350,34 @@ int main(int argc, char **argv)
 
 	compile_format();
 
+	ring = xcalloc(ring_size, sizeof(ring_record_t));
+
+	/* the column names are only known now */
+	for (logtarget = logfile_anchor; logtarget != NULL; logtarget = logtarget->next) {
+		if (logtarget->logfile)
+			start_logfile(logtarget->logfile);
+	}
+
 	upsnotify(NOTIFY_STATE_READY_WITH_PID, NULL);
 
 	while (exit_flag == 0) {
 		upsnotify(NOTIFY_STATE_WATCHDOG, NULL);
 
-		time(&now);
+		now = now_mono();
 
 		if (nextpoll > now) {
 			/* there is still time left, so sleep it off */
-			sleep((unsigned int)(difftime(nextpoll, now)));
+			sleep_until(nextpoll);
+
+			/* a dump does not take a record of its own */
+			if (dump_flag) {
+				dump_ring();
+				dump_flag = 0;
+
+				if (exit_flag == 0 && now_mono() < nextpoll)
+					continue;
+			}
+
 			nextpoll += interval;
 		} else {
 			/* we spent more time in polling than the interval allows */
@@ -956,6 +1388,8 @@ int main(int argc, char **argv)
 			upsnotify(NOTIFY_STATE_RELOADING, NULL);
 			upslogx(LOG_INFO, "Signal %d: reopening log file",
 				reopen_flag);
+			/* the records taken so far go to the rotated files */
+			write_batch();
 			reopen_log();
 			reopen_flag = 0;
 			upsnotify(NOTIFY_STATE_READY, NULL);
@@ -975,11 +1409,30 @@ int main(int argc, char **argv)
 					UPSCLI_CONN_TRYSSL);
 			}
 
-			run_flist(monhost_ups_current);
+			gettimeofday(&tv, NULL);
+			fetch_vars(monhost_ups_current);
+
+			if (output_mode == OUTPUT_TEXT)
+				run_flist(monhost_ups_current);
+			else
+				make_columns(monhost_ups_current, &tv);
+
+			add_record(monhost_ups_current);
+		}
+
+		if (output_mode != OUTPUT_TEXT && now_mono() - lastbatch >= batch_interval) {
+			write_batch();
+			lastbatch = now_mono();
+		}
 
-			/* don't keep connection open if we don't intend to use it shortly */
-			if (interval > 30) {
-				upscli_disconnect(monhost_ups_current->ups);
+		/* don't keep connections open if we don't intend to use them shortly */
+		if (interval > 30) {
+			for (monhost_ups_current = monhost_ups_anchor;
+			     monhost_ups_current != NULL;
+			     monhost_ups_current = monhost_ups_current->next
+			) {
+				if (!monhost_ups_current->sharedconn)
+					upscli_disconnect(monhost_ups_current->ups);
 			}
 		}
 
@@ -995,6 +1448,8 @@ int main(int argc, char **argv)
 	upslogx(LOG_INFO, "Signal %d: exiting", exit_flag);
 	upsnotify(NOTIFY_STATE_STOPPING, "Signal %d: exiting", exit_flag);
 
+	write_batch();
+
 	for (monhost_ups_current = monhost_ups_anchor;
 	     monhost_ups_current != NULL;
 	     monhost_ups_current = monhost_ups_current->next
@@ -1008,7 +1463,17 @@ int main(int argc, char **argv)
 			monhost_ups_current->logtarget->logfile = NULL;
 		}
 
-		upscli_disconnect(monhost_ups_current->ups);
+		if (!monhost_ups_current->sharedconn)
+			upscli_disconnect(monhost_ups_current->ups);
+
+		if (monhost_ups_current->values) {
+			size_t	i;
+
+			for (i = 0; i < numlogvars; i++)
+				free(monhost_ups_current->values[i]);
+			free(monhost_ups_current->values);
+			monhost_ups_current->values = NULL;
+		}
 	}
 
 	if (logformat_allocated) {
@@ -24,10 +24,27 @@ struct 	monhost_ups_t {
 	char	*hostname;
 	uint16_t	port;
 	UPSCONN_t	*ups;
+	int	sharedconn;	/* ups belongs to an earlier entry of the same server */
+	int	nogetvars;	/* the server does not know GET VARS */
+	char	**values;	/* logvars[] of this interval, NULL for missing ones */
 	struct 	logtarget_t	*logtarget;
 	struct	monhost_ups_t	*next;
 };
 
+/* how the records are written: as the format string makes them, or as
+ * columns of its %VAR% values (in batches, from the ring) */
+typedef enum {
+	OUTPUT_TEXT = 0,
+	OUTPUT_CSV,
+	OUTPUT_JSON
+} output_mode_t;
+
+/* a record kept in the ring buffer, for batched writes and dumps */
+typedef struct {
+	struct	monhost_ups_t	*monhost_ups;
+	char	*line;
+} ring_record_t;
+
 /* function list */
 typedef struct flist_s {
 	void	(*fptr)(const char *arg, const struct monhost_ups_t *monhost_ups_print);
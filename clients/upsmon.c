@@ -27,8 +27,14 @@
 #ifndef WIN32
 # include <sys/wait.h>
 # include <sys/socket.h>
+# include <sys/un.h>
 # include <unistd.h>
 # include <fcntl.h>
+# if (defined HAVE_SPAWN_H) && (defined HAVE_POSIX_SPAWN)
+#  include <spawn.h>
+#  define UPSMON_SPAWN 1
+extern char **environ;
+# endif
 #else	/* WIN32 */
 # include "wincompat.h"
 #endif	/* WIN32 */
@@ -43,7 +49,10 @@
 # include <stdarg.h>
 #endif
 
-static	char	*shutdowncmd = NULL, *notifycmd = NULL;
+static	char	*shutdowncmd = NULL, *notifycmd = NULL, *upsschedpipe = NULL;
+
+	/* at most so many notifications are run at once, 0 forks for each */
+static	unsigned int	notifyworkers = 4;
 static	char	*powerdownflag = NULL, *configfile = NULL;
 
 static	unsigned int	minsupplies = 1, sleepval = 5;
@@ -298,11 +307,493 @@ static unsigned __stdcall async_notify(LPVOID param)
 }
 #endif	/* WIN32 */
 
+#ifndef WIN32
+/* hand the event to a running upssched daemon over its socket, rather
+ * than forking to run NOTIFYCMD (which is upssched then): returns 0 once
+ * the daemon has it, or -1 if NOTIFYCMD is to be run as usual */
+static int notify_upssched(const char *ntype, const char *upsname)
+{
+	struct	sockaddr_un	saddr;
+	struct	timeval	tv;
+	fd_set	rfds;
+	char	buf[SMALLBUF], enc[SMALLBUF];
+	int	fd, ret;
+	size_t	len;
+
+	memset(&saddr, '\0', sizeof(saddr));
+	saddr.sun_family = AF_UNIX;
+	snprintf(saddr.sun_path, sizeof(saddr.sun_path), "%s", upsschedpipe);
+
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0)
+		return -1;
+
+	/* a daemon too busy to take connections is not waited for */
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+	if (connect(fd, (const struct sockaddr *) &saddr, sizeof(saddr)) < 0) {
+		upsdebug_with_errno(3, "%s: no upssched daemon on %s",
+			__func__, upsschedpipe);
+		close(fd);
+		return -1;
+	}
+
+	snprintf(buf, sizeof(buf), "NOTIFY \"%s\"",
+		pconf_encode(upsname ? upsname : "", enc, sizeof(enc)));
+	snprintfcat(buf, sizeof(buf), " \"%s\"\n",
+		pconf_encode(ntype, enc, sizeof(enc)));
+	len = strlen(buf);
+
+	if (write(fd, buf, len) != (ssize_t)len) {
+		close(fd);
+		return -1;
+	}
+
+	/* the daemon answers before it acts on the event */
+	tv.tv_sec = 1;
+	tv.tv_usec = 0;
+	FD_ZERO(&rfds);
+	FD_SET(fd, &rfds);
+
+	ret = select(fd + 1, &rfds, NULL, NULL, &tv);
+	if (ret == 0) {
+		/* it will read the request when it gets to it */
+		upsdebugx(2, "%s: no answer in time from upssched, assuming it got %s",
+			__func__, ntype);
+		close(fd);
+		return 0;
+	}
+
+	ret = (ret > 0) ? (int)read(fd, buf, sizeof(buf) - 1) : -1;
+	close(fd);
+
+	/* ERR UNKNOWN from older daemons, or one which just went away */
+	if (ret < 2 || strncmp(buf, "OK", 2) != 0) {
+		upsdebugx(2, "%s: upssched did not take %s, running NOTIFYCMD",
+			__func__, ntype);
+		return -1;
+	}
+
+	upsdebugx(6, "%s: upssched took %s", __func__, ntype);
+	return 0;
+}
+
+/* what the child forked for a notification does, see notify() */
+static void notify_run(const char *notice, unsigned int flags, const char *ntype,
+			const char *upsname, const char *cmd)
+{
+	char	exec[LARGEBUF];
+
+	if (flag_isset(flags, NOTIFY_WALL)) {
+		upsdebugx(6, "%s: NOTIFY_WALL", __func__);
+		wall(notice);
+	}
+
+	if (flag_isset(flags, NOTIFY_EXEC)) {
+		if (cmd != NULL && *cmd) {
+			upsdebugx(6, "%s: NOTIFY_EXEC: calling NOTIFYCMD as '%s \"%s\"'",
+				__func__, cmd, notice);
+
+			snprintf(exec, sizeof(exec), "%s \"%s\"", cmd, notice);
+
+			if (upsname)
+				setenv("UPSNAME", upsname, 1);
+			else
+				setenv("UPSNAME", "", 1);
+
+			setenv("NOTIFYTYPE", ntype, 1);
+			if (system(exec) == -1) {
+				upslog_with_errno(LOG_ERR, "%s", __func__);
+			}
+		} else {
+			upsdebugx(6, "%s: NOTIFY_EXEC: no NOTIFYCMD was configured", __func__);
+		}
+	}
+}
+
+#ifndef WIN32
+/* start the NOTIFYCMD of a notification that needs nothing else (no wall)
+ * as notify_run() would, but with posix_spawn() instead of copying upsmon
+ * for a child which would only fork again in system(); returns the PID,
+ * 0 if the notification needs a fork, or -1 when it failed */
+static pid_t notify_spawn(const char *notice, unsigned int flags, const char *ntype,
+			const char *upsname, const char *cmd)
+{
+#ifdef UPSMON_SPAWN
+	char	exec[LARGEBUF], upsenv[SMALLBUF], typeenv[SMALLBUF];
+	char	sh[] = "sh", dash_c[] = "-c", *argv[4], **envp;
+	size_t	i, n;
+	pid_t	pid;
+	int	ret;
+
+	if (flag_isset(flags, NOTIFY_WALL) || !flag_isset(flags, NOTIFY_EXEC)
+	||  cmd == NULL || !*cmd
+	) {
+		return 0;
+	}
+
+	upsdebugx(6, "%s: NOTIFY_EXEC: spawning NOTIFYCMD as '%s \"%s\"'",
+		__func__, cmd, notice);
+
+	snprintf(exec, sizeof(exec), "%s \"%s\"", cmd, notice);
+
+	argv[0] = sh;
+	argv[1] = dash_c;
+	argv[2] = exec;
+	argv[3] = NULL;
+
+	/* our environment, with the two variables of this notification */
+	for (n = 0; environ[n] != NULL; n++)
+		;
+
+	envp = xcalloc(n + 3, sizeof(*envp));
+
+	for (i = 0, n = 0; environ[i] != NULL; i++) {
+		if (strncmp(environ[i], "UPSNAME=", 8)
+		&&  strncmp(environ[i], "NOTIFYTYPE=", 11)
+		) {
+			envp[n++] = environ[i];
+		}
+	}
+
+	snprintf(upsenv, sizeof(upsenv), "UPSNAME=%s", upsname ? upsname : "");
+	snprintf(typeenv, sizeof(typeenv), "NOTIFYTYPE=%s", ntype);
+	envp[n++] = upsenv;
+	envp[n++] = typeenv;
+	envp[n] = NULL;
+
+	/* the shell system() would run */
+	ret = posix_spawn(&pid, "/bin/sh", NULL, NULL, argv, envp);
+
+	free(envp);
+
+	if (ret != 0) {
+		errno = ret;
+		upslog_with_errno(LOG_ERR, "Can't spawn NOTIFYCMD");
+		return -1;
+	}
+
+	return pid;
+#else	/* !UPSMON_SPAWN */
+	NUT_UNUSED_VARIABLE(notice);
+	NUT_UNUSED_VARIABLE(flags);
+	NUT_UNUSED_VARIABLE(ntype);
+	NUT_UNUSED_VARIABLE(upsname);
+	NUT_UNUSED_VARIABLE(cmd);
+
+	return 0;
+#endif	/* !UPSMON_SPAWN */
+}
+#endif	/* !WIN32 */
+
+/* The notification dispatcher: a long-lived child of upsmon which reads
+ * the notifications from a pipe, so that a burst of them (a site-wide
+ * power loss) does not fork upsmon itself over and over while it is busy
+ * with the shutdown. It runs at most NOTIFYWORKERS of them at a time and
+ * those of one UPS in turn, a notification being folded into the last
+ * one still waiting for that UPS if it is of the same type. */
+typedef struct notify_job_s {
+	unsigned int	flags;
+	char	*ntype, *upsname, *notice, *cmd;
+	pid_t	pid;		/* of the worker running it, 0 while queued */
+	struct notify_job_s	*next;
+} notify_job_t;
+
+/* on the pipe, followed by <len> bytes: ntype, upsname, notice and the
+ * NOTIFYCMD (as it may change on reload), each ending with a '\0' */
+typedef struct {
+	unsigned int	flags;
+	unsigned int	len;
+} notify_hdr_t;
+
+#define NOTIFY_RECORD_MAX	(LARGEBUF * 4)
+
+static	pid_t	notify_pid = -1;	/* the dispatcher */
+static	int	notify_fd = -1;		/* the writing end of its pipe */
+
+static void notify_job_free(notify_job_t *job)
+{
+	free(job->ntype);
+	free(job->upsname);
+	free(job->notice);
+	free(job->cmd);
+	free(job);
+}
+
+static void notify_job_add(notify_job_t **queue, const notify_hdr_t *hdr, const char *data)
+{
+	notify_job_t	*job, *last = NULL, **jp;
+	const char	*field[4];
+	size_t	i, off;
+
+	for (i = 0, off = 0; i < 4; i++) {
+		field[i] = data + off;
+		off += strlen(field[i]) + 1;
+	}
+
+	/* the last job of this UPS, if it is waiting still */
+	for (jp = queue; *jp != NULL; jp = &(*jp)->next) {
+		if (!strcmp((*jp)->upsname, field[1])) {
+			last = *jp;
+		}
+	}
+
+	if (last && !last->pid && !strcmp(last->ntype, field[0])) {
+		upsdebugx(2, "%s: folding %s for [%s] into the one still queued",
+			__func__, field[0], field[1]);
+
+		free(last->notice);
+		free(last->cmd);
+		last->flags = hdr->flags;
+		last->notice = xstrdup(field[2]);
+		last->cmd = xstrdup(field[3]);
+		return;
+	}
+
+	job = xcalloc(1, sizeof(*job));
+	job->flags = hdr->flags;
+	job->ntype = xstrdup(field[0]);
+	job->upsname = xstrdup(field[1]);
+	job->notice = xstrdup(field[2]);
+	job->cmd = xstrdup(field[3]);
+
+	*jp = job;
+}
+
+static void notify_dispatcher(int fd)
+{
+	notify_job_t	*queue = NULL, *job, *prev, **jp;
+	notify_hdr_t	hdr;
+	char	buf[NOTIFY_RECORD_MAX];
+	size_t	buflen = 0, running = 0;
+	struct	timeval	tv;
+	fd_set	rfds;
+	ssize_t	ret;
+	pid_t	pid;
+	int	eof = 0;
+
+	for (;;) {
+		/* reap the workers which are done */
+		while ((pid = waitpid(-1, NULL, WNOHANG)) > 0) {
+			for (jp = &queue; (job = *jp) != NULL; jp = &job->next) {
+				if (job->pid == pid) {
+					*jp = job->next;
+					notify_job_free(job);
+					running--;
+					break;
+				}
+			}
+		}
+
+		/* start the first waiting job of each UPS, while there is room */
+		for (job = queue; job != NULL && running < notifyworkers; job = job->next) {
+			if (job->pid) {
+				continue;
+			}
+
+			for (prev = queue; prev != job; prev = prev->next) {
+				if (!strcmp(prev->upsname, job->upsname)) {
+					break;
+				}
+			}
+
+			if (prev != job) {
+				continue;
+			}
+
+			pid = notify_spawn(job->notice, job->flags, job->ntype,
+				*job->upsname ? job->upsname : NULL, job->cmd);
+
+			if (pid == 0) {
+				pid = fork();
+
+				if (pid < 0) {
+					upslog_with_errno(LOG_ERR, "Can't fork to notify");
+				}
+			}
+
+			if (pid < 0) {
+				break;
+			}
+
+			if (pid == 0) {
+				notify_run(job->notice, job->flags, job->ntype,
+					*job->upsname ? job->upsname : NULL, job->cmd);
+				exit(EXIT_SUCCESS);
+			}
+
+			job->pid = pid;
+			running++;
+		}
+
+		if (eof && !queue) {
+			upsdebugx(2, "%s: upsmon is gone and all notifications were run, exiting", __func__);
+			exit(EXIT_SUCCESS);
+		}
+
+		/* the workers are checked on every 0.1 sec while there are any */
+		FD_ZERO(&rfds);
+		if (!eof) {
+			FD_SET(fd, &rfds);
+		}
+		tv.tv_sec = 0;
+		tv.tv_usec = 100000;
+
+		if (select(eof ? 0 : fd + 1, &rfds, NULL, NULL, queue ? &tv : NULL) <= 0
+		||  !FD_ISSET(fd, &rfds)
+		) {
+			continue;
+		}
+
+		ret = read(fd, buf + buflen, sizeof(buf) - buflen);
+
+		if (ret < 0 && errno == EINTR) {
+			continue;
+		}
+
+		if (ret <= 0) {
+			/* upsmon exited or restarts the dispatcher */
+			eof = 1;
+			continue;
+		}
+
+		for (buflen += (size_t)ret; buflen >= sizeof(hdr); ) {
+			memcpy(&hdr, buf, sizeof(hdr));
+
+			if (buflen < sizeof(hdr) + hdr.len) {
+				break;
+			}
+
+			notify_job_add(&queue, &hdr, buf + sizeof(hdr));
+
+			buflen -= sizeof(hdr) + hdr.len;
+			memmove(buf, buf + sizeof(hdr) + hdr.len, buflen);
+		}
+	}
+}
+
+static void notify_stop(void)
+{
+	if (notify_fd < 0) {
+		return;
+	}
+
+	/* it runs what is queued still, then exits */
+	close(notify_fd);
+	notify_fd = -1;
+	notify_pid = -1;
+}
+
+static int notify_start(void)
+{
+	utype_t	*ups;
+	int	fds[2];
+
+	if (pipe(fds) < 0) {
+		upslog_with_errno(LOG_ERR, "Can't create the notification pipe");
+		return -1;
+	}
+
+	notify_pid = fork();
+
+	if (notify_pid < 0) {
+		upslog_with_errno(LOG_ERR, "Can't fork the notification dispatcher");
+		close(fds[0]);
+		close(fds[1]);
+		return -1;
+	}
+
+	if (notify_pid == 0) {
+		/* let go of what would keep the peers of upsmon waiting */
+		close(fds[1]);
+		for (ups = firstups; ups != NULL; ups = ups->next) {
+			if (upscli_fd(&ups->conn) >= 0) {
+				close(upscli_fd(&ups->conn));
+			}
+		}
+		if (use_pipe) {
+			close(pipefd[1]);
+		}
+
+		signal(SIGINT, SIG_DFL);
+		signal(SIGQUIT, SIG_DFL);
+		signal(SIGTERM, SIG_DFL);
+		signal(SIGCMD_FSD, SIG_IGN);
+		signal(SIGCMD_RELOAD, SIG_IGN);
+
+		/* not for the workers and NOTIFYCMD */
+		set_close_on_exec(fds[0]);
+
+		notify_dispatcher(fds[0]);
+	}
+
+	close(fds[0]);
+
+	/* upsmon does not wait if the dispatcher falls behind */
+	fcntl(fds[1], F_SETFL, fcntl(fds[1], F_GETFL) | O_NONBLOCK);
+	set_close_on_exec(fds[1]);
+	notify_fd = fds[1];
+
+	upsdebugx(2, "%s: started the notification dispatcher [%" PRIiMAX "]",
+		__func__, (intmax_t)notify_pid);
+	return 0;
+}
+
+/* hand a notification to the dispatcher, starting it if need be;
+ * returns 0 once it has it, or -1 if upsmon is to fork for it instead */
+static int notify_queue(const char *notice, unsigned int flags, const char *ntype,
+			const char *upsname)
+{
+	char	buf[NOTIFY_RECORD_MAX];
+	notify_hdr_t	hdr;
+	size_t	len = sizeof(hdr);
+	ssize_t	ret;
+	int	retry;
+
+	if (NOTIFY_RECORD_MAX - len < strlen(ntype) + strlen(NUT_STRARG(upsname))
+		+ strlen(notice) + strlen(NUT_STRARG(notifycmd)) + 4
+	) {
+		return -1;
+	}
+
+	len += (size_t)snprintf(buf + len, sizeof(buf) - len, "%s", ntype) + 1;
+	len += (size_t)snprintf(buf + len, sizeof(buf) - len, "%s", upsname ? upsname : "") + 1;
+	len += (size_t)snprintf(buf + len, sizeof(buf) - len, "%s", notice) + 1;
+	len += (size_t)snprintf(buf + len, sizeof(buf) - len, "%s", notifycmd ? notifycmd : "") + 1;
+
+	hdr.flags = flags;
+	hdr.len = (unsigned int)(len - sizeof(hdr));
+	memcpy(buf, &hdr, sizeof(hdr));
+
+	for (retry = 0; retry < 2; retry++) {
+		if (notify_fd < 0 && notify_start() < 0) {
+			return -1;
+		}
+
+		ret = write(notify_fd, buf, len);
+
+		if (ret == (ssize_t)len) {
+			return 0;
+		}
+
+		if (ret < 0 && errno == EAGAIN) {
+			upslogx(LOG_WARNING, "Notification dispatcher is busy, forking for %s", ntype);
+			return -1;
+		}
+
+		/* it died: start another one */
+		upslog_with_errno(LOG_WARNING, "Notification dispatcher is gone");
+		notify_stop();
+	}
+
+	return -1;
+}
+#endif	/* !WIN32 */
+
 static void notify(const char *notice, unsigned int flags, const char *ntype,
 			const char *upsname)
 {
 #ifndef WIN32
-	char	exec[LARGEBUF];
 	int	ret;
 #endif	/* !WIN32 */
 
@@ -320,6 +811,37 @@ static void notify(const char *notice, unsigned int flags, const char *ntype,
 	}
 
 #ifndef WIN32
+	/* no fork at all when upssched takes the event and there is no wall */
+	if (flag_isset(flags, NOTIFY_EXEC) && notifycmd != NULL && upsschedpipe != NULL
+	&&  notify_upssched(ntype, upsname) == 0
+	) {
+		flags &= ~NOTIFY_EXEC;
+	}
+
+	if (!flag_isset(flags, NOTIFY_WALL)
+	&&  !(flag_isset(flags, NOTIFY_EXEC) && notifycmd != NULL)
+	) {
+		upsdebugx(6, "%s: nothing to run", __func__);
+		return;
+	}
+
+	if (notifyworkers > 0 && notify_queue(notice, flags, ntype, upsname) == 0) {
+		upsdebugx(6, "%s: queued to the notification dispatcher", __func__);
+		return;
+	}
+
+	/* a lone NOTIFYCMD is started without a copy of upsmon in between */
+	ret = notify_spawn(notice, flags, ntype, upsname, notifycmd);
+
+	if (ret > 0) {
+		upsdebugx(6, "%s: spawned NOTIFYCMD as PID %d", __func__, ret);
+		return;
+	}
+
+	if (ret < 0) {
+		return;
+	}
+
 	/* fork here so upsmon doesn't get wedged if the notifier is slow */
 	ret = fork();
 
@@ -336,31 +858,7 @@ static void notify(const char *notice, unsigned int flags, const char *ntype,
 	/* child continues and does all the work */
 	upsdebugx(6, "%s (child): forked to notify via subprocesses", __func__);
 
-	if (flag_isset(flags, NOTIFY_WALL)) {
-		upsdebugx(6, "%s (child): NOTIFY_WALL", __func__);
-		wall(notice);
-	}
-
-	if (flag_isset(flags, NOTIFY_EXEC)) {
-		if (notifycmd != NULL) {
-			upsdebugx(6, "%s (child): NOTIFY_EXEC: calling NOTIFYCMD as '%s \"%s\"'",
-				__func__, notifycmd, notice);
-
-			snprintf(exec, sizeof(exec), "%s \"%s\"", notifycmd, notice);
-
-			if (upsname)
-				setenv("UPSNAME", upsname, 1);
-			else
-				setenv("UPSNAME", "", 1);
-
-			setenv("NOTIFYTYPE", ntype, 1);
-			if (system(exec) == -1) {
-				upslog_with_errno(LOG_ERR, "%s", __func__);
-			}
-		} else {
-			upsdebugx(6, "%s (child): NOTIFY_EXEC: no NOTIFYCMD was configured", __func__);
-		}
-	}
+	notify_run(notice, flags, ntype, upsname, notifycmd);
 
 	upsdebugx(6, "%s (child): exiting after notifications", __func__);
 
@@ -1019,6 +1517,138 @@ static void doshutdown(void)
 }
 
 /* set forced shutdown flag so other upsmons know what's going on here */
+/* the variables read by each poll, in the order of utype_t poll_answer[],
+ * which are also those that upsd is asked to push the changes of */
+static const char	*poll_vars[POLL_VARS] = {
+	"ups.status",
+	"ups.mode.buzzwords",
+	"experimental.ups.mode.buzzwords"
+};
+
+/* for the CHANGED and DELETED lines pushed by upsd */
+static PCONF_CTX_t	push_ctx;
+static int	push_ctx_ready = 0;
+
+/* how long to wait for an answer of upsd */
+static void net_timeout(struct timeval *tv)
+{
+	upscli_get_default_connect_timeout(tv);
+	if (tv->tv_sec == 0 && tv->tv_usec == 0) {
+		tv->tv_sec = DEFAULT_NETWORK_TIMEOUT;
+	}
+}
+
+/* keep the value if <line> is a change pushed by upsd, for push_handle()
+ * to deal with later; returns 1 if it was such a line */
+static int push_take(utype_t *ups, char *line)
+{
+	size_t	i;
+	int	deleted;
+
+	if (!strncmp(line, "CHANGED ", 8)) {
+		deleted = 0;
+	} else if (!strncmp(line, "DELETED ", 8)) {
+		deleted = 1;
+	} else {
+		return 0;
+	}
+
+	if (!push_ctx_ready) {
+		pconf_init(&push_ctx, NULL);
+		push_ctx_ready = 1;
+	}
+
+	if (!pconf_line(&push_ctx, line)
+	||  push_ctx.numargs < (deleted ? 3 : 4)
+	||  strcasecmp(push_ctx.arglist[1], ups->upsname)
+	) {
+		upsdebugx(2, "%s: UPS [%s]: ignoring [%s]",
+			__func__, ups->sys, line);
+		return 1;
+	}
+
+	/* the count of logins, for sync_secondaries() */
+	if (!deleted && !strcmp(push_ctx.arglist[2], "NUMLOGINS")) {
+		upsdebugx(3, "%s: UPS [%s]: [%s]", __func__, ups->sys, line);
+		ups->push_numlogins = strtol(push_ctx.arglist[3], NULL, 10);
+		return 1;
+	}
+
+	for (i = 0; i < POLL_VARS; i++) {
+		if (strcasecmp(push_ctx.arglist[2], poll_vars[i])) {
+			continue;
+		}
+
+		upsdebugx(3, "%s: UPS [%s]: [%s]", __func__, ups->sys, line);
+
+		if (deleted) {
+			ups->poll_answer[i][0] = '\0';
+			ups->poll_got[i] = -1;
+		} else {
+			snprintf(ups->poll_answer[i], sizeof(ups->poll_answer[i]),
+				"%s", push_ctx.arglist[3]);
+			ups->poll_got[i] = 0;
+
+			/* for comparison with LIST TRACE on the same system */
+			if (i == 0 && nut_debug_level > 0) {
+				ups->push_status_usec = state_get_timestamp_usec();
+			}
+		}
+
+		ups->push_changed = 1;
+		break;
+	}
+
+	return 1;
+}
+
+/* read the answer to a request sent to upsd, keeping the changes which
+ * it pushed meanwhile if the UPS is watched */
+static int read_reply(utype_t *ups, char *buf, size_t buflen)
+{
+	if (!ups->watching) {
+		return upscli_readline(&ups->conn, buf, buflen);
+	}
+
+	for (;;) {
+		struct timeval	tv;
+		fd_set	rfds;
+		int	ret;
+
+		/* this shares the line buffer with the polls and pushes */
+		ret = upscli_readline_nowait(&ups->conn, ups->poll_line,
+			sizeof(ups->poll_line), &ups->poll_linelen);
+
+		if (ret < 0) {
+			return -1;
+		}
+
+		if (ret == 0) {
+			net_timeout(&tv);
+			FD_ZERO(&rfds);
+			FD_SET(upscli_fd(&ups->conn), &rfds);
+
+			if (select(upscli_fd(&ups->conn) + 1, &rfds, NULL, NULL, &tv) == 0) {
+				ups->conn.upserror = UPSCLI_ERR_READ;
+				ups->conn.syserrno = ETIMEDOUT;
+				upscli_disconnect(&ups->conn);
+				return -1;
+			}
+
+			continue;
+		}
+
+		ups->poll_linelen = 0;
+
+		if (push_take(ups, ups->poll_line)) {
+			continue;
+		}
+
+		snprintf(buf, buflen, "%s", ups->poll_line);
+		return 0;
+	}
+}
+
 static void setfsd(utype_t *ups)
 {
 	char	buf[SMALLBUF];
@@ -1043,7 +1673,7 @@ static void setfsd(utype_t *ups)
 		return;
 	}
 
-	ret = upscli_readline(&ups->conn, buf, sizeof(buf));
+	ret = read_reply(ups, buf, sizeof(buf));
 
 	if (ret < 0) {
 		upslogx(LOG_ERR, "FSD set on UPS %s failed: %s", ups->sys,
@@ -1106,7 +1736,7 @@ static int get_var(utype_t *ups, const char *var, char *buf, size_t bufsize)
 	int	ret;
 	size_t	numq, numa;
 	const	char	*query[4];
-	char	**answer;
+	char	**answer, line[UPSCLI_NETBUF_LEN];
 
 	/* this shouldn't happen */
 	if (!ups->upsname) {
@@ -1159,7 +1789,15 @@ static int get_var(utype_t *ups, const char *var, char *buf, size_t bufsize)
 
 	upsdebugx(3, "%s: %s / %s", __func__, ups->sys, var);
 
-	ret = upscli_get(&ups->conn, numq, query, &numa, &answer);
+	ret = upscli_get_send(&ups->conn, numq, query);
+
+	if (ret == 0) {
+		ret = read_reply(ups, line, sizeof(line));
+	}
+
+	if (ret == 0) {
+		ret = upscli_get_answer(&ups->conn, line, numq, query, &numa, &answer);
+	}
 
 	if (ret < 0) {
 
@@ -1186,6 +1824,10 @@ static int get_var(utype_t *ups, const char *var, char *buf, size_t bufsize)
 	return 0;
 }
 
+#ifndef WIN32
+static void push_read(utype_t *ups);
+#endif	/* !WIN32 */
+
 /* Called by upsmon which is the primary on some UPS(es) to wait
  * until all secondaries log out from it on the shared upsd server
  * or the HOSTSYNC timeout expires
@@ -1200,6 +1842,15 @@ static void sync_secondaries(void)
 	time(&start);
 
 	for (;;) {
+		int	polled = 0;
+#ifndef WIN32
+		struct timeval	tv;
+		fd_set	rfds;
+		int	maxfd = -1;
+
+		FD_ZERO(&rfds);
+#endif	/* !WIN32 */
+
 		maxlogins = 0;
 
 		for (ups = firstups; ups != NULL; ups = ups->next) {
@@ -1208,6 +1859,23 @@ static void sync_secondaries(void)
 			if (!flag_isset(ups->status, ST_PRIMARY))
 				continue;
 
+#ifndef WIN32
+			/* an upsd which pushes the count did so right after WATCH,
+			 * and does again as soon as it changes */
+			push_read(ups);
+
+			if (ups->watching && ups->push_numlogins >= 0) {
+				if (ups->push_numlogins > maxlogins)
+					maxlogins = ups->push_numlogins;
+
+				FD_SET(upscli_fd(&ups->conn), &rfds);
+				if (upscli_fd(&ups->conn) > maxfd)
+					maxfd = upscli_fd(&ups->conn);
+				continue;
+			}
+#endif	/* !WIN32 */
+
+			polled = 1;
 			set_alarm();
 
 			if (get_var(ups, "numlogins", temp, sizeof(temp)) >= 0) {
@@ -1236,6 +1904,21 @@ static void sync_secondaries(void)
 			return;
 		}
 
+#ifndef WIN32
+		/* wait for a count pushed by upsd, polling the others (if any)
+		 * every quarter of a second, and checking HOSTSYNC every second */
+		if (maxfd >= 0) {
+			tv.tv_sec = polled ? 0 : 1;
+			tv.tv_usec = polled ? 250000 : 0;
+
+			if (select(maxfd + 1, &rfds, NULL, NULL, &tv) < 0 && errno != EINTR) {
+				upslog_with_errno(LOG_ERR, "%s: select", __func__);
+				usleep(250000);
+			}
+			continue;
+		}
+#endif	/* !WIN32 */
+
 		usleep(250000);
 	}
 }
@@ -1271,6 +1954,9 @@ static void forceshutdown(void)
 	doshutdown();
 }
 
+/* the power value of the UPSes which are not critical, see ups_recalc() */
+static unsigned int	power_ol = 0;
+
 static int is_ups_critical(utype_t *ups)
 {
 	time_t	now;
@@ -1538,43 +2224,77 @@ static int is_ups_critical(utype_t *ups)
 	return 0;
 }
 
+/* see if <ups> is critical, unless nothing it depends on changed since
+ * it was last found to be fine (online and communicating), and count it
+ * in the online power value if it is not; so only one UPS whose state
+ * changed is looked at again, and those in trouble (whose criticality
+ * may come with time, or from a lack of news) */
+static void ups_recalc(utype_t *ups, time_t now)
+{
+	int	crit;
+
+	if (ups->crit_known
+	 && ups->crit_status == ups->status
+	 && ups->crit_commstate == ups->commstate
+	 && ups->crit_offstate == ups->offstate
+	 && ups->crit_pv == ups->pv
+	) {
+		return;
+	}
+
+	/* promote dead UPSes that were last known OB to OB+LB */
+	if ((now - ups->lastpoll) > deadtime)
+		if (flag_isset(ups->status, ST_ONBATT)) {
+			upsdebugx(1, "Promoting dead UPS: %s", ups->sys);
+			setflag(&ups->status, ST_LOWBATT);
+		}
+
+	/* note: we assume that a UPS that isn't critical must be OK *
+	 *                                                           *
+	 * this means a UPS we've never heard from is assumed OL     *
+	 * whether this is really the best thing to do is undecided  */
+
+	/* crit = (FSD) || (OB & LB) > HOSTSYNC seconds || (CAL || BYPASS || ALARM || OFF) && nocomms */
+	/* Note: ECO mode not considered easily fatal here */
+	crit = is_ups_critical(ups);
+	if (crit)
+		upsdebugx(1, "Critical UPS: %s", ups->sys);
+
+	power_ol -= ups->power;
+	ups->power = crit ? 0 : ups->pv;
+	power_ol += ups->power;
+
+	/* it stays fine until its state changes, unless on battery */
+	ups->crit_known = (!crit && ups->commstate != 0 && !ups->oblbsince
+		&& !flag_isset(ups->status, ST_ONBATT));
+	ups->crit_status = ups->status;
+	ups->crit_commstate = ups->commstate;
+	ups->crit_offstate = ups->offstate;
+	ups->crit_pv = ups->pv;
+}
+
+/* see if things are still OK with the online power value */
+static void recalc_decide(void)
+{
+	upsdebugx(3, "Current power value: %u", power_ol);
+	upsdebugx(3, "Minimum power value: %u", minsupplies);
+
+	if (power_ol < minsupplies)
+		forceshutdown();
+}
+
 /* recalculate the online power value and see if things are still OK */
 static void recalc(void)
 {
 	utype_t	*ups;
-	unsigned int	val_ol = 0;
 	time_t	now;
 
 	time(&now);
-	ups = firstups;
-	while (ups != NULL) {
-		/* promote dead UPSes that were last known OB to OB+LB */
-		if ((now - ups->lastpoll) > deadtime)
-			if (flag_isset(ups->status, ST_ONBATT)) {
-				upsdebugx(1, "Promoting dead UPS: %s", ups->sys);
-				setflag(&ups->status, ST_LOWBATT);
-			}
-
-		/* note: we assume that a UPS that isn't critical must be OK *
-		 *                                                           *
-		 * this means a UPS we've never heard from is assumed OL     *
-		 * whether this is really the best thing to do is undecided  */
-
-		/* crit = (FSD) || (OB & LB) > HOSTSYNC seconds || (CAL || BYPASS || ALARM || OFF) && nocomms */
-		/* Note: ECO mode not considered easily fatal here */
-		if (is_ups_critical(ups))
-			upsdebugx(1, "Critical UPS: %s", ups->sys);
-		else
-			val_ol += ups->pv;
-
-		ups = ups->next;
+	for (ups = firstups; ups != NULL; ups = ups->next) {
+		ups_recalc(ups, now);
 	}
 
-	upsdebugx(3, "Current power value: %u", val_ol);
-	upsdebugx(3, "Minimum power value: %u", minsupplies);
-
-	if (val_ol < minsupplies)
-		forceshutdown();
+	recalc_decide();
 }
 
 static void ups_low_batt(utype_t *ups)
@@ -1783,6 +2503,11 @@ static void drop_connection(utype_t *ups)
 	clearflag(&ups->status, ST_LOGIN);
 	clearflag(&ups->status, ST_CLICONNECTED);
 
+	ups->watching = 0;
+	ups->push_changed = 0;
+	ups->push_numlogins = -1;
+	ups->poll_linelen = 0;
+
 	upscli_disconnect(&ups->conn);
 }
 
@@ -2005,6 +2730,8 @@ static void addups(int reloading, const char *sys, const char *pvs,
 	tmp->oblbsince = 0;
 	tmp->oversince = 0;
 
+	tmp->push_numlogins = -1;
+
 	if (   (!strcasecmp(managerialOption, "primary"))
 	    || (!strcasecmp(managerialOption, "master"))  ) {
 		setflag(&tmp->status, ST_PRIMARY);
@@ -2199,6 +2926,24 @@ static int parse_conf_arg(size_t numargs, char **arg)
 		return 1;
 	}
 
+	/* NOTIFYWORKERS <num> */
+	if (!strcmp(arg[0], "NOTIFYWORKERS")) {
+		int inotifyworkers = atoi(arg[1]);
+		if (inotifyworkers < 0) {
+			upsdebugx(0, "Ignoring invalid NOTIFYWORKERS value: %d", inotifyworkers);
+		} else {
+			notifyworkers = (unsigned int)inotifyworkers;
+		}
+		return 1;
+	}
+
+	/* UPSSCHEDPIPE <filename> */
+	if (!strcmp(arg[0], "UPSSCHEDPIPE")) {
+		free(upsschedpipe);
+		upsschedpipe = xstrdup(arg[1]);
+		return 1;
+	}
+
 	/* POLLFREQ <num> */
 	if (!strcmp(arg[0], "POLLFREQ")) {
 		int ipollfreq = atoi(arg[1]);
@@ -2582,7 +3327,12 @@ static void upsmon_cleanup(void)
 
 	free(run_as_user);
 	free(shutdowncmd);
+#ifndef WIN32
+	notify_stop();
+#endif	/* !WIN32 */
+
 	free(notifycmd);
+	free(upsschedpipe);
 	free(powerdownflag);
 	free(configfile);
 
@@ -2590,6 +3340,10 @@ static void upsmon_cleanup(void)
 		free(notifylist[i].msg);
 	}
 
+	if (push_ctx_ready) {
+		pconf_finish(&push_ctx);
+	}
+
 	upscli_cleanup();
 
 #ifdef WIN32
@@ -2658,6 +3412,65 @@ static void update_crittimer(utype_t *ups)
 }
 
 /* handle connecting to upsd, plus get SSL going too if possible */
+/* if upsd supports it, subscribe to the changes of the poll_vars so they
+ * are handled as soon as they happen, with the polls as a heartbeat */
+static void watch_start(utype_t *ups)
+{
+#ifndef WIN32
+	char	buf[SMALLBUF];
+	unsigned int	major = 0, minor = 0;
+
+	ups->watching = 0;
+	ups->push_changed = 0;
+	ups->push_numlogins = -1;
+
+	snprintf(buf, sizeof(buf), "NETVER\n");
+
+	if (upscli_sendline(&ups->conn, buf, strlen(buf)) < 0
+	||  upscli_readline(&ups->conn, buf, sizeof(buf)) < 0
+	) {
+		upsdebugx(1, "UPS [%s]: can't get the protocol version: %s",
+			ups->sys, upscli_strerror(&ups->conn));
+		return;
+	}
+
+	/* WATCH since protocol 1.4 */
+	if (sscanf(buf, "%u.%u", &major, &minor) != 2
+	||  major < 1 || (major == 1 && minor < 4)
+	) {
+		upsdebugx(1, "UPS [%s]: protocol version [%s], polling only",
+			ups->sys, buf);
+		return;
+	}
+
+	/* a primary also waits for the secondaries to log out on shutdown,
+	 * see sync_secondaries(); an upsd which does not push their count
+	 * just takes NUMLOGINS for a variable that never changes */
+	snprintf(buf, sizeof(buf), "WATCH %s %s %s %s%s\n", ups->upsname,
+		poll_vars[0], poll_vars[1], poll_vars[2],
+		flag_isset(ups->status, ST_PRIMARY) ? " NUMLOGINS" : "");
+
+	if (upscli_sendline(&ups->conn, buf, strlen(buf)) < 0
+	||  upscli_readline(&ups->conn, buf, sizeof(buf)) < 0
+	) {
+		upslogx(LOG_WARNING, "UPS [%s]: WATCH failed, polling only: %s",
+			ups->sys, upscli_strerror(&ups->conn));
+		return;
+	}
+
+	if (strncmp(buf, "OK WATCH", 8) != 0) {
+		upslogx(LOG_WARNING, "UPS [%s]: WATCH failed, polling only - got [%s]",
+			ups->sys, buf);
+		return;
+	}
+
+	upsdebugx(1, "UPS [%s]: upsd pushes the status changes", ups->sys);
+	ups->watching = 1;
+#else
+	NUT_UNUSED_VARIABLE(ups);
+#endif	/* !WIN32 */
+}
+
 static int try_connect(utype_t *ups)
 {
 	int	flags = 0, ret;
@@ -2715,8 +3528,10 @@ static int try_connect(utype_t *ups)
 
 	ret = do_upsd_auth(ups);
 
-	if (ret == 1)
+	if (ret == 1) {
+		watch_start(ups);
 		return 1;		/* everything is happy */
+	}
 
 	/* something failed in the auth so we may not be completely logged in */
 
@@ -2982,63 +3797,36 @@ static void parse_status(utype_t *ups, char *status, char *buzzword, char *buzzw
 	upsdebugx(3, "Handled %d status tokens", handled_stat_words);
 }
 
-/* see what the status of the UPS is and handle any changes */
-static void pollups(utype_t *ups)
+/* handle the variables of the UPS, as last polled or pushed */
+static void status_handle(utype_t *ups)
 {
-	char	status[SMALLBUF], buzzmode[SMALLBUF], buzzmodeX[SMALLBUF];
-	int	pollfail_log = 0;	/* if we throttle, only upsdebugx() but not upslogx() the failures */
-	int	upserror, got_status, got_buzzmode, got_buzzmodeX;
-
-	/* try a reconnect here */
-	if (!flag_isset(ups->status, ST_CLICONNECTED)) {
-		if (try_connect(ups) != 1) {
-			return;
-		}
-	}
-
-	if (upscli_ssl(&ups->conn) == 1)
-		upsdebugx(2, "%s: %s [SSL]", __func__, ups->sys);
-	else
-		upsdebugx(2, "%s: %s", __func__, ups->sys);
+	char	status[SMALLBUF], buzzword[SMALLBUF], buzzwordX[SMALLBUF];
 
-	set_alarm();
+	ups->push_changed = 0;
 
-	if ((got_status = get_var(ups, "status", status, sizeof(status))))
-		status[0] = '\0';
-	if ((got_buzzmode = get_var(ups, "buzzword", buzzmode, sizeof(buzzmode))))
-		buzzmode[0] = '\0';
-	if ((got_buzzmodeX = get_var(ups, "X-buzzword", buzzmodeX, sizeof(buzzmodeX))))
-		buzzmodeX[0] = '\0';
+	/* parse_status() cuts them up; the originals are kept in case
+	 * only some of them are pushed later */
+	snprintf(status, sizeof(status), "%s", ups->poll_answer[0]);
+	snprintf(buzzword, sizeof(buzzword), "%s", ups->poll_answer[1]);
+	snprintf(buzzwordX, sizeof(buzzwordX), "%s", ups->poll_answer[2]);
 
-	if (got_status == 0 || got_buzzmode == 0 || got_buzzmodeX == 0) {
-		clear_alarm();
+	if (ups->push_status_usec) {
+		upsdebugx(1, "%s: UPS [%s]: ups.status [%s] pushed at %" PRIu64
+			" us, parsed at %" PRIu64 " us", __func__, ups->sys, status,
+			ups->push_status_usec, state_get_timestamp_usec());
+		ups->push_status_usec = 0;
+	}
 
-		/* reset pollfail log throttling */
-#if 0
-		/* Note: last error is never cleared, so we reset it below */
-		upserror = upscli_upserror(&ups->conn);
-		upsdebugx(3, "%s: Poll UPS [%s] after getvar(status) okay: upserror=%d: %s",
-			__func__, ups->sys, upserror, upscli_strerror(&ups->conn));
-#endif
-		upserror = UPSCLI_ERR_NONE;
-		if (pollfail_log_throttle_max >= 0
-		&&  ups->pollfail_log_throttle_state != upserror
-		) {
-			/* Notify throttled log that we are okay now */
-			upslogx(LOG_ERR, "Poll UPS [%s] recovered from "
-				"failure state code %d - now %d",
-				ups->sys, ups->pollfail_log_throttle_state,
-				upserror);
-		}
-		ups->pollfail_log_throttle_state = upserror;
-		ups->pollfail_log_throttle_count = -1;
+	parse_status(ups, status, buzzword, buzzwordX);
+}
 
-		parse_status(ups, status, buzzmode, buzzmodeX);
-		return;
-	}
+/* report a failed poll of the UPS */
+static void pollups_failed(utype_t *ups)
+{
+	int	pollfail_log = 0;	/* if we throttle, only upsdebugx() but not upslogx() the failures */
+	int	upserror;
 
-	/* fallthrough: no communications */
-	clear_alarm();
+	ups->poll_pending = 0;
 
 	/* try to make some of these a little friendlier */
 	upserror = upscli_upserror(&ups->conn);
@@ -3126,6 +3914,350 @@ static void pollups(utype_t *ups)
 	}
 }
 
+/* handle the answers of a completed poll of the UPS */
+static void pollups_done(utype_t *ups)
+{
+	int	upserror;
+
+	ups->poll_pending = 0;
+
+	if (ups->poll_got[0] != 0 && ups->poll_got[1] != 0 && ups->poll_got[2] != 0) {
+		pollups_failed(ups);
+		return;
+	}
+
+	/* reset pollfail log throttling */
+#if 0
+	/* Note: last error is never cleared, so we reset it below */
+	upserror = upscli_upserror(&ups->conn);
+	upsdebugx(3, "%s: Poll UPS [%s] after getvar(status) okay: upserror=%d: %s",
+		__func__, ups->sys, upserror, upscli_strerror(&ups->conn));
+#endif
+	upserror = UPSCLI_ERR_NONE;
+	if (pollfail_log_throttle_max >= 0
+	&&  ups->pollfail_log_throttle_state != upserror
+	) {
+		/* Notify throttled log that we are okay now */
+		upslogx(LOG_ERR, "Poll UPS [%s] recovered from "
+			"failure state code %d - now %d",
+			ups->sys, ups->pollfail_log_throttle_state,
+			upserror);
+	}
+	ups->pollfail_log_throttle_state = upserror;
+	ups->pollfail_log_throttle_count = -1;
+
+	status_handle(ups);
+}
+
+/* take the answers of the UPS which came in so far, without waiting */
+static void pollups_read(utype_t *ups)
+{
+	while (ups->poll_pending > 0) {
+		size_t	i = POLL_VARS - (size_t)ups->poll_pending, numa;
+		const char	*query[3];
+		char	**answer;
+		int	ret;
+
+		ret = upscli_readline_nowait(&ups->conn, ups->poll_line,
+			sizeof(ups->poll_line), &ups->poll_linelen);
+
+		if (ret == 0) {
+			return;	/* the rest is yet to come */
+		}
+
+		if (ret < 0) {
+			pollups_failed(ups);
+			return;
+		}
+
+		ups->poll_linelen = 0;
+
+		if (push_take(ups, ups->poll_line)) {
+			continue;	/* not an answer */
+		}
+
+		ups->poll_pending--;
+		ups->poll_got[i] = -1;
+		ups->poll_answer[i][0] = '\0';
+
+		query[0] = "VAR";
+		query[1] = ups->upsname;
+		query[2] = poll_vars[i];
+
+		upsdebugx(3, "%s: %s / %s", __func__, ups->sys, poll_vars[i]);
+
+		if (upscli_get_answer(&ups->conn, ups->poll_line, 3, query, &numa, &answer) < 0) {
+			/* detect old upsd */
+			if (upscli_upserror(&ups->conn) == UPSCLI_ERR_UNKCOMMAND) {
+				upslogx(LOG_ERR, "UPS [%s]: Too old to monitor",
+					ups->sys);
+			}
+			continue;
+		}
+
+		if (numa <= 3) {
+			upslogx(LOG_ERR, "%s: Error: insufficient data "
+				"(got %" PRIuSIZE " args, need at least 4)",
+				poll_vars[i], numa);
+			continue;
+		}
+
+		snprintf(ups->poll_answer[i], sizeof(ups->poll_answer[i]), "%s", answer[3]);
+		ups->poll_got[i] = 0;
+	}
+
+	pollups_done(ups);
+}
+
+/* send the queries of a poll of the UPS, whose answers are then waited
+ * for along with those of the other UPSes by pollups_wait() */
+static void pollups_send(utype_t *ups)
+{
+	struct timeval	tv;
+	size_t	i;
+
+	/* try a reconnect here */
+	if (!flag_isset(ups->status, ST_CLICONNECTED)) {
+		if (try_connect(ups) != 1) {
+			return;
+		}
+	}
+
+	if (upscli_ssl(&ups->conn) == 1)
+		upsdebugx(2, "%s: %s [SSL]", __func__, ups->sys);
+	else
+		upsdebugx(2, "%s: %s", __func__, ups->sys);
+
+	/* all of them go out at once, the answers come back in order */
+	for (i = 0; i < POLL_VARS; i++) {
+		const char	*query[3];
+
+		query[0] = "VAR";
+		query[1] = ups->upsname;
+		query[2] = poll_vars[i];
+
+		if (upscli_get_send(&ups->conn, 3, query) < 0) {
+			pollups_failed(ups);
+			return;
+		}
+	}
+
+	net_timeout(&tv);
+
+	gettimeofday(&ups->poll_deadline, NULL);
+	ups->poll_deadline.tv_sec += tv.tv_sec;
+	ups->poll_deadline.tv_usec += tv.tv_usec;
+	if (ups->poll_deadline.tv_usec >= 1000000) {
+		ups->poll_deadline.tv_sec++;
+		ups->poll_deadline.tv_usec -= 1000000;
+	}
+
+	ups->poll_pending = POLL_VARS;
+	ups->poll_linelen = 0;
+
+	/* in case the answers were quick (or buffered already) */
+	pollups_read(ups);
+}
+
+/* wait for the answers of the polls sent by pollups_send(), each UPS until
+ * its own deadline, handling them as they come in */
+static void pollups_wait(void)
+{
+	utype_t	*ups;
+
+	/* the last resort against a read blocking in the TLS layer */
+	set_alarm();
+
+	for (;;) {
+		struct timeval	now, tv, first;
+		fd_set	rfds;
+		int	maxfd = -1, ret;
+
+		FD_ZERO(&rfds);
+		gettimeofday(&now, NULL);
+
+		for (ups = firstups; ups != NULL; ups = ups->next) {
+			int	fd;
+
+			if (ups->poll_pending < 1) {
+				continue;
+			}
+
+			if (exit_flag) {
+				/* the connections are dropped on the way out */
+				ups->poll_pending = 0;
+				upscli_disconnect(&ups->conn);
+				continue;
+			}
+
+			if (!timercmp(&now, &ups->poll_deadline, <)) {
+				upsdebugx(2, "%s: %s did not answer in time",
+					__func__, ups->sys);
+				ups->conn.upserror = UPSCLI_ERR_READ;
+				ups->conn.syserrno = ETIMEDOUT;
+				upscli_disconnect(&ups->conn);
+				pollups_failed(ups);
+				continue;
+			}
+
+			if (maxfd < 0 || timercmp(&ups->poll_deadline, &first, <)) {
+				first = ups->poll_deadline;
+			}
+
+			fd = upscli_fd(&ups->conn);
+			FD_SET(fd, &rfds);
+			if (fd > maxfd) {
+				maxfd = fd;
+			}
+		}
+
+		if (maxfd < 0) {
+			break;	/* all answered or gave up */
+		}
+
+		/* until the first deadline, which is still ahead */
+		tv.tv_sec = first.tv_sec - now.tv_sec;
+		tv.tv_usec = first.tv_usec - now.tv_usec;
+		if (tv.tv_usec < 0) {
+			tv.tv_sec--;
+			tv.tv_usec += 1000000;
+		}
+
+		ret = select(maxfd + 1, &rfds, NULL, NULL, &tv);
+
+		if (ret < 0) {
+			if (errno != EINTR) {
+				upslog_with_errno(LOG_ERR, "%s: select", __func__);
+			}
+			continue;	/* the deadlines still apply */
+		}
+
+		for (ups = firstups; ups != NULL; ups = ups->next) {
+			if (ups->poll_pending > 0 && FD_ISSET(upscli_fd(&ups->conn), &rfds)) {
+				pollups_read(ups);
+			}
+		}
+	}
+
+	clear_alarm();
+}
+
+#ifndef WIN32
+/* take the changes pushed by upsd for the UPS, without waiting */
+static void push_read(utype_t *ups)
+{
+	while (ups->watching && ups->poll_pending < 1) {
+		int	ret;
+
+		ret = upscli_readline_nowait(&ups->conn, ups->poll_line,
+			sizeof(ups->poll_line), &ups->poll_linelen);
+
+		if (ret == 0) {
+			return;	/* the rest is yet to come */
+		}
+
+		if (ret < 0) {
+			pollups_failed(ups);
+			return;
+		}
+
+		ups->poll_linelen = 0;
+
+		if (!push_take(ups, ups->poll_line)) {
+			upsdebugx(2, "%s: UPS [%s]: unexpected [%s]",
+				__func__, ups->sys, ups->poll_line);
+		}
+	}
+}
+
+/* deal with the changes pushed for the UPS since it was last handled,
+ * returns 1 if its status was parsed again */
+static int push_handle(utype_t *ups)
+{
+	/* a poll in progress takes them into account */
+	if (!ups->push_changed || ups->poll_pending > 0) {
+		return 0;
+	}
+
+	/* no status at all: the next poll tells why */
+	if (ups->poll_got[0] != 0) {
+		ups->push_changed = 0;
+		return 0;
+	}
+
+	status_handle(ups);
+	return 1;
+}
+
+/* sleep for up to <sec> seconds (less if a signal comes), meanwhile
+ * handling the changes pushed by upsd for the watched UPSes */
+static void watch_sleep(unsigned int sec)
+{
+	struct timeval	start, now, tv;
+
+	gettimeofday(&start, NULL);
+
+	for (;;) {
+		utype_t	*ups;
+		fd_set	rfds;
+		double	left;
+		int	maxfd = -1, handled = 0, ret;
+
+		FD_ZERO(&rfds);
+
+		for (ups = firstups; ups != NULL; ups = ups->next) {
+			int	fd;
+
+			/* also those read along with the poll answers; only a
+			 * UPS which changed needs to be looked at again */
+			push_read(ups);
+			if (push_handle(ups)) {
+				ups_recalc(ups, time(NULL));
+				handled = 1;
+			}
+
+			if (!ups->watching) {
+				continue;
+			}
+
+			fd = upscli_fd(&ups->conn);
+			FD_SET(fd, &rfds);
+			if (fd > maxfd) {
+				maxfd = fd;
+			}
+		}
+
+		if (handled) {
+			recalc_decide();
+		}
+
+		gettimeofday(&now, NULL);
+		left = (double)sec - difftimeval(now, start);
+
+		/* done, or the clock jumped */
+		if (left <= 0 || left > (double)sec) {
+			return;
+		}
+
+		tv.tv_sec = (time_t)left;
+		tv.tv_usec = (suseconds_t)((left - (double)tv.tv_sec) * 1000000);
+
+		ret = select(maxfd + 1, &rfds, NULL, NULL, &tv);
+
+		if (ret < 0) {
+			if (errno != EINTR) {
+				upslog_with_errno(LOG_ERR, "%s: select", __func__);
+			}
+			return;	/* like sleep() on a signal */
+		}
+
+		if (ret == 0) {
+			return;
+		}
+	}
+}
+#endif	/* !WIN32 */
+
 /* see if the powerdownflag file is there and proper */
 static int pdflag_status(void)
 {
@@ -3381,6 +4513,7 @@ static void delete_ups(utype_t *target)
 
 			/* release memory */
 
+			power_ol -= ptr->power;
 			ups_free(ptr);
 
 			return;
@@ -3413,6 +4546,7 @@ static int check_file(const char *fn)
 static void reload_conf(void)
 {
 	utype_t	*tmp, *next;
+	unsigned int	oldnotifyworkers = notifyworkers;
 
 	upslogx(LOG_INFO, "Reloading configuration");
 
@@ -3422,11 +4556,13 @@ static void reload_conf(void)
 		return;
 	}
 
-	/* flip through ups list, clear retain value */
+	/* flip through ups list, clear retain value (and what recalc()
+	 * found, which may depend on the settings) */
 	tmp = firstups;
 
 	while (tmp) {
 		tmp->retain = 0;
+		tmp->crit_known = 0;
 		tmp = tmp->next;
 	}
 
@@ -3436,6 +4572,14 @@ static void reload_conf(void)
 	/* reread upsmon.conf */
 	loadconfig();
 
+#ifndef WIN32
+	/* a new dispatcher is started for the next notification */
+	if (notifyworkers != oldnotifyworkers)
+		notify_stop();
+#else	/* WIN32 */
+	NUT_UNUSED_VARIABLE(oldnotifyworkers);
+#endif	/* WIN32 */
+
 	/* go through the utype_t struct again */
 	tmp = firstups;
 
@@ -4004,11 +5148,15 @@ int main(int argc, char *argv[])
 		for (ups = firstups; ups != NULL; ups = ups->next) {
 			if (isPreparingForSleepSupported() && (sleep_inhibitor_status = isPreparingForSleep()) >= 0) {
 				upsdebugx(2, "Aborting UPS polling sub-loop because OS is preparing for sleep or just woke up");
+				/* do not leave answers to come for later requests */
+				pollups_wait();
 				goto end_loop_cycle;
 			}
-			pollups(ups);
+			pollups_send(ups);
 		}
 
+		pollups_wait();
+
 		recalc();
 
 		/* make sure the parent hasn't died */
@@ -4034,7 +5182,7 @@ int main(int argc, char *argv[])
 				/* WARNING: This call can take several seconds itself
 				 * on some systems, seen e.g. with Ubuntu in WSL after
 				 * the PC spent some life-time sleeping */
-				sleep(1);
+				watch_sleep(1);
 				upsdebugx(7, "delay between main loop cycles: after sleep 1...");
 				sleep_inhibitor_status = isPreparingForSleep();
 				upsdebugx(7, "delay between main loop cycles: after isPreparingForSleep()...");
@@ -4071,7 +5219,7 @@ int main(int argc, char *argv[])
 			 * and so not handling here specially */
 		} else {
 			/* sleep tight */
-			sleep(sleepval);
+			watch_sleep(sleepval);
 		}
 		gettimeofday(&end, NULL);
 		upsdebugx(4, "%u-sec delay between main loop cycles finished, took %.06f",
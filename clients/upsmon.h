@@ -55,6 +55,9 @@ extern "C" {
 /* *INDENT-ON* */
 #endif
 
+/* variables read by each poll of an UPS */
+#define POLL_VARS	3
+
 /* UPS tracking structure */
 
 typedef struct {
@@ -91,11 +94,31 @@ typedef struct {
 	int	pollfail_log_throttle_state;	/* Last (error) state which we throttle */
 	int	pollfail_log_throttle_count;	/* How many pollfreq loops this UPS was in this state since last logged report? */
 
+	/* poll in progress, see pollups_send() and pollups_wait() */
+	int	poll_pending;		/* answers still to come	*/
+	struct timeval	poll_deadline;	/* when to give up on them	*/
+	char	poll_line[UPSCLI_NETBUF_LEN];	/* answer read so far	*/
+	size_t	poll_linelen;
+	char	poll_answer[POLL_VARS][SMALLBUF];	/* variable values	*/
+	int	poll_got[POLL_VARS];	/* 0 if the value came through	*/
+
+	/* WATCH subscription to the poll_vars, see watch_start() */
+	int	watching;		/* upsd pushes their changes	*/
+	int	push_changed;		/* some came in, not handled yet*/
+	uint64_t	push_status_usec;	/* when ups.status came in	*/
+	long	push_numlogins;		/* pushed for a primary, or -1	*/
+
 	time_t	lastpoll;		/* time of last successful poll	*/
 	time_t  lastnoncrit;		/* time of last non-crit poll	*/
 	time_t	lastrbwarn;		/* time of last REPLBATT warning*/
 	time_t	lastncwarn;		/* time of last NOCOMM warning	*/
 
+	/* what recalc() found last, see ups_recalc() */
+	int	crit_known;		/* good while the below stay	*/
+	int	crit_status, crit_commstate, crit_offstate;
+	unsigned int	crit_pv;
+	unsigned int	power;			/* counted in power_ol		*/
+
 	time_t	offsince;		/* time of recent entry into OFF state	*/
 	time_t	oblbsince;		/* time of recent entry into OB LB state (normally this causes immediate shutdown alert, unless we are configured to delay it)	*/
 	time_t	oversince;		/* time of recent entry into OVER state	*/
@@ -54,10 +54,13 @@ static void usage(const char *prog)
 	printf("NUT administration client program to set variables within UPS hardware.\n");
 
 	printf("\nusage: %s [-h]\n", prog);
-	printf("       %s [-s <variable>] [-u <username>] [-p <password>] [-w] [-t <timeout>] <ups>\n\n", prog);
+	printf("       %s [-s <variable>] [-u <username>] [-p <password>] [-w] [-t <timeout>] <ups>\n", prog);
+	printf("       %s -f <file> [-u <username>] [-p <password>] [-w] [-t <timeout>] <ups>\n\n", prog);
 	printf("\n");
 	printf("  -s <variable>	specify variable to be changed\n");
 	printf("		use -s VAR=VALUE to avoid prompting for value\n");
+	printf("  -f <file>     set the variables listed in <file> (- for stdin), one\n");
+	printf("                VAR=VALUE per line, over a single session\n");
 	printf("  -l            show all possible read/write variables.\n");
 	printf("  -u <username> set username for command authentication\n");
 	printf("  -p <password> set password for command authentication\n");
@@ -202,15 +205,15 @@ static void do_set(const char *varname, const char *newval)
 # pragma GCC diagnostic pop
 #endif
 
-static void do_setvar(const char *varname, char *uin, const char *pass)
+/* prompt for the missing credentials, filling <user>; returns the password */
+static const char *ask_login(char *user, size_t userlen, const char *uin, const char *pass)
 {
-	char	newval[SMALLBUF], temp[SMALLBUF * 2], user[SMALLBUF], *ptr;
 	struct passwd	*pw;
 
 	if (uin) {
-		snprintf(user, sizeof(user), "%s", uin);
+		snprintf(user, userlen, "%s", uin);
 	} else {
-		memset(user, '\0', sizeof(user));
+		memset(user, '\0', userlen);
 
 		pw = getpwuid(getuid());
 
@@ -220,7 +223,7 @@ static void do_setvar(const char *varname, char *uin, const char *pass)
 			printf("Username: ");
 		}
 
-		if (fgets(user, sizeof(user), stdin) == NULL) {
+		if (fgets(user, (int)userlen, stdin) == NULL) {
 			upsdebug_with_errno(LOG_INFO, "%s", __func__);
 		}
 
@@ -232,7 +235,7 @@ static void do_setvar(const char *varname, char *uin, const char *pass)
 				fatalx(EXIT_FAILURE, "No username available - even tried getpwuid");
 			}
 
-			snprintf(user, sizeof(user), "%s", pw->pw_name);
+			snprintf(user, userlen, "%s", pw->pw_name);
 		}
 	}
 
@@ -245,18 +248,13 @@ static void do_setvar(const char *varname, char *uin, const char *pass)
 		}
 	}
 
-	/* Check if varname is in VAR=VALUE form */
-	if ((ptr = strchr(varname, '=')) != NULL) {
-		*ptr++ = 0;
-		snprintf(newval, sizeof(newval), "%s", ptr);
-	} else {
-		printf("Enter new value for %s: ", varname);
-		fflush(stdout);
-		if (fgets(newval, sizeof(newval), stdin) == NULL) {
-			upsdebug_with_errno(LOG_INFO, "%s", __func__);
-		}
-		newval[strlen(newval) - 1] = '\0';
-	}
+	return pass;
+}
+
+/* log in, and enable status tracking if asked to */
+static void do_login(const char *user, const char *pass)
+{
+	char	temp[SMALLBUF * 2];
 
 	snprintf(temp, sizeof(temp), "USERNAME %s\n", user);
 
@@ -288,11 +286,6 @@ static void do_setvar(const char *varname, char *uin, const char *pass)
 		fatalx(EXIT_FAILURE, "Error: a UPS name must be specified (upsname[@hostname[:port]])");
 	}
 
-	/* old variable names are no longer supported */
-	if (!strchr(varname, '.')) {
-		fatalx(EXIT_FAILURE, "Error: old variable names are not supported");
-	}
-
 	/* enable status tracking ID */
 	if (tracking_enabled) {
 
@@ -311,10 +304,270 @@ static void do_setvar(const char *varname, char *uin, const char *pass)
 			fatalx(EXIT_FAILURE, "Enabling set variable status tracking failed. upsd answered: %s", temp);
 		}
 	}
+}
+
+static void do_setvar(const char *varname, char *uin, const char *pass)
+{
+	char	newval[SMALLBUF], user[SMALLBUF], *ptr;
+
+	pass = ask_login(user, sizeof(user), uin, pass);
+
+	/* Check if varname is in VAR=VALUE form */
+	if ((ptr = strchr(varname, '=')) != NULL) {
+		*ptr++ = 0;
+		snprintf(newval, sizeof(newval), "%s", ptr);
+	} else {
+		printf("Enter new value for %s: ", varname);
+		fflush(stdout);
+		if (fgets(newval, sizeof(newval), stdin) == NULL) {
+			upsdebug_with_errno(LOG_INFO, "%s", __func__);
+		}
+		newval[strlen(newval) - 1] = '\0';
+	}
+
+	do_login(user, pass);
+
+	/* old variable names are no longer supported */
+	if (!strchr(varname, '.')) {
+		fatalx(EXIT_FAILURE, "Error: old variable names are not supported");
+	}
 
 	do_set(varname, newval);
 }
 
+/* script mode: the operations are sent pipelined over the one session,
+ * a window at a time so that their answers never fill up the sockets */
+#define BATCH_WINDOW	32
+
+struct batch_op_t {
+	char	*desc;		/* the script line, reported with the result */
+	char	*request;	/* what is sent to upsd */
+	char	*result;	/* the final answer */
+	char	tracking_id[UUID4_LEN];
+};
+
+static struct batch_op_t	*batch_ops = NULL;
+static size_t	batch_numops = 0, batch_allocops = 0;
+
+static void batch_add(const char *desc, const char *request)
+{
+	struct batch_op_t	*op;
+
+	if (batch_numops == batch_allocops) {
+		batch_allocops = batch_allocops ? batch_allocops * 2 : 16;
+		batch_ops = xrealloc(batch_ops, batch_allocops * sizeof(*batch_ops));
+	}
+
+	op = &batch_ops[batch_numops++];
+	memset(op, 0, sizeof(*op));
+	op->desc = xstrdup(desc);
+	op->request = xstrdup(request);
+}
+
+/* send all <req> lines, reading back their answers in the same order */
+static void batch_exchange(char **req, char **ans, size_t count)
+{
+	char	buf[SMALLBUF], *out;
+	size_t	i, j, n, len;
+
+	for (i = 0; i < count; i += n) {
+		n = count - i;
+		if (n > BATCH_WINDOW) {
+			n = BATCH_WINDOW;
+		}
+
+		for (j = 0, len = 0; j < n; j++) {
+			len += strlen(req[i + j]);
+		}
+
+		out = xmalloc(len + 1);
+		for (j = 0, len = 0; j < n; j++) {
+			memcpy(out + len, req[i + j], strlen(req[i + j]));
+			len += strlen(req[i + j]);
+		}
+
+		if (upscli_sendline(ups, out, len) < 0) {
+			fatalx(EXIT_FAILURE, "Can't send the requests: %s", upscli_strerror(ups));
+		}
+		free(out);
+
+		for (j = 0; j < n; j++) {
+			if (upscli_readline(ups, buf, sizeof(buf)) < 0) {
+				fatalx(EXIT_FAILURE, "Can't receive the answers: %s", upscli_strerror(ups));
+			}
+			ans[i + j] = xstrdup(buf);
+		}
+	}
+}
+
+/* run the script, polling the tracking IDs of all operations together;
+ * returns the number of failed ones */
+static size_t do_batch(void)
+{
+	char	**req, **ans;
+	size_t	i, n, pending = 0, failed = 0;
+	time_t	start, now;
+	struct batch_op_t	*op;
+
+	req = xcalloc(batch_numops, sizeof(*req));
+	ans = xcalloc(batch_numops, sizeof(*ans));
+
+	for (i = 0; i < batch_numops; i++) {
+		req[i] = batch_ops[i].request;
+	}
+
+	batch_exchange(req, ans, batch_numops);
+
+	for (i = 0; i < batch_numops; i++) {
+		op = &batch_ops[i];
+
+		/* "OK TRACKING " + UUID4_LEN, as in single command mode */
+		if (tracking_enabled && !strncmp(ans[i], "OK TRACKING ", 12)
+		 && strlen(ans[i]) == UUID4_LEN - 1 + 12) {
+			memcpy(op->tracking_id, ans[i] + 12, UUID4_LEN);
+			free(ans[i]);
+			pending++;
+		} else {
+			op->result = ans[i];
+		}
+	}
+
+	time(&start);
+
+	while (pending > 0) {
+		time(&now);
+		if (difftime(now, start) >= timeout) {
+			break;
+		}
+
+		for (i = 0, n = 0; i < batch_numops; i++) {
+			if (batch_ops[i].result) {
+				continue;
+			}
+			req[n] = xmalloc(UUID4_LEN + 15);
+			snprintf(req[n++], UUID4_LEN + 15, "GET TRACKING %s\n", batch_ops[i].tracking_id);
+		}
+
+		batch_exchange(req, ans, n);
+
+		for (i = 0, n = 0; i < batch_numops; i++) {
+			op = &batch_ops[i];
+			if (op->result) {
+				continue;
+			}
+
+			free(req[n]);
+			if (strncmp(ans[n], "PENDING", 7)) {
+				op->result = ans[n];
+				pending--;
+			} else {
+				free(ans[n]);
+			}
+			n++;
+		}
+
+		if (pending > 0) {
+			/* wait a second before retrying */
+			sleep(1);
+		}
+	}
+
+	for (i = 0; i < batch_numops; i++) {
+		op = &batch_ops[i];
+
+		/* still PENDING when the timeout expired */
+		printf("%s: %s\n", op->desc, op->result ? op->result : "PENDING");
+
+		if (!op->result || (strncmp(op->result, "OK", 2) && strcmp(op->result, "SUCCESS"))) {
+			failed++;
+		}
+
+		free(op->desc);
+		free(op->request);
+		free(op->result);
+	}
+
+	free(batch_ops);
+	free(req);
+	free(ans);
+
+	return failed;
+}
+
+/* read the script: one "<variable>=<value>" per line */
+static void batch_read(const char *fn)
+{
+	FILE	*f = stdin;
+	char	line[SMALLBUF], desc[SMALLBUF], req[SMALLBUF * 2], enc[SMALLBUF];
+	char	*var, *val, *end;
+	size_t	lineno = 0;
+
+	if (strcmp(fn, "-") && (f = fopen(fn, "r")) == NULL) {
+		fatal_with_errno(EXIT_FAILURE, "Can't open %s", fn);
+	}
+
+	while (fgets(line, sizeof(line), f)) {
+		lineno++;
+
+		var = line + strspn(line, " \t");
+		for (end = var + strlen(var); end > var && strchr(" \t\r\n", end[-1]); end--)
+			;
+		*end = '\0';
+
+		if (!*var || *var == '#') {
+			continue;
+		}
+
+		if ((val = strchr(var, '=')) == NULL) {
+			fatalx(EXIT_FAILURE, "Error: %s line %" PRIuSIZE ": expected <variable>=<value>",
+				fn, lineno);
+		}
+		for (end = val++; end > var && strchr(" \t", end[-1]); end--)
+			;
+		*end = '\0';
+		val += strspn(val, " \t");
+
+		/* old variable names are no longer supported */
+		if (!strchr(var, '.')) {
+			fatalx(EXIT_FAILURE, "Error: %s line %" PRIuSIZE ": old variable names are not supported",
+				fn, lineno);
+		}
+
+		snprintf(req, sizeof(req), "SET VAR %s %s \"%s\"\n",
+			upsname, var, pconf_encode(val, enc, sizeof(enc)));
+		snprintf(desc, sizeof(desc), "%s=%s", var, val);
+
+		batch_add(desc, req);
+	}
+
+	if (f != stdin) {
+		fclose(f);
+	}
+
+	if (!batch_numops) {
+		fatalx(EXIT_FAILURE, "Error: no variables found in %s", fn);
+	}
+}
+
+static void do_setbatch(const char *script, char *uin, const char *pass)
+{
+	char	user[SMALLBUF];
+
+	batch_read(script);
+
+	/* the username prompt would read the script */
+	if (!uin && !strcmp(script, "-")) {
+		fatalx(EXIT_FAILURE, "Error: -u is required when the variables are read from stdin");
+	}
+
+	pass = ask_login(user, sizeof(user), uin, pass);
+	do_login(user, pass);
+
+	if (do_batch()) {
+		exit(EXIT_FAILURE);
+	}
+}
+
 static const char *get_data(const char *type, const char *varname)
 {
 	int	ret;
@@ -654,6 +907,7 @@ int main(int argc, char **argv)
 	const char	*prog = xbasename(argv[0]);
 	const char	*net_connect_timeout = NULL;
 	char	*password = NULL, *username = NULL, *setvar = NULL, *s = NULL;
+	const char	*script = NULL;
 
 	/* NOTE: Caller must `export NUT_DEBUG_LEVEL` to see debugs for upsc
 	 * and NUT methods called from it. This line aims to just initialize
@@ -666,12 +920,15 @@ int main(int argc, char **argv)
 	}
 	upsdebugx(1, "Starting NUT client: %s", prog);
 
-	while ((i = getopt(argc, argv, "+hls:p:t:u:wVW:")) != -1) {
+	while ((i = getopt(argc, argv, "+hls:f:p:t:u:wVW:")) != -1) {
 		switch (i)
 		{
 		case 's':
 			setvar = optarg;
 			break;
+		case 'f':
+			script = optarg;
+			break;
 		case 'l':
 			if (setvar) {
 				upslogx(LOG_WARNING, "Listing mode requested, overriding setvar specified earlier!");
@@ -733,7 +990,10 @@ int main(int argc, char **argv)
 		fatalx(EXIT_FAILURE, "Error: %s", upscli_strerror(ups));
 	}
 
-	if (setvar) {
+	if (script) {
+		/* setting the variables of a script */
+		do_setbatch(script, username, password);
+	} else if (setvar) {
 		/* setting a variable */
 		do_setvar(setvar, username, password);
 	} else {
@@ -36,6 +36,12 @@
  * timers can be cancelled at any time before they trigger
  *
  * the daemon will shut down automatically when no more timers are active
+ * (after LINGER seconds, or never with LINGER 0)
+ *
+ * upsmon may also hand its events to a running daemon as NOTIFY commands
+ * on the socket (see UPSSCHEDPIPE in upsmon.conf), so that it is the
+ * daemon which matches them against the AT conditions, without a
+ * upssched process started for each event
  *
  */
 
@@ -60,16 +66,39 @@
 #include "timehead.h"
 #include "nut_stdint.h"
 
+#define PARENT_STARTED		-2
+#define PARENT_UNNECESSARY	-3
+#define MAX_TRIES 		30
+#define EMPTY_WAIT		15	/* default seconds with no timers to exit */
+#define US_LISTEN_BACKLOG	16
+#define US_SOCK_BUF_LEN		256
+#define US_MAX_READ		128
+
 typedef struct ttype_s {
 	char	*name;
 	time_t	etime;
-	struct ttype_s	*next;
+	size_t	seq;	/* order of the starts, for ties and CANCEL */
 } ttype_t;
 
-static ttype_t	*thead = NULL;
+/* AT <notifytype> <upsname> <command> <cmdarg1> [<cmdarg2>] */
+typedef struct at_s {
+	char	*ntype, *upsname, *cmd, *ca1, *ca2;
+	struct at_s	*next;
+} at_t;
+
+/* the timers, as a binary min-heap on their deadlines */
+static ttype_t	**theap = NULL;
+static size_t	tcount = 0, talloc = 0, tseq = 0;
+
+static at_t	*athead = NULL;
 static conn_t	*connhead = NULL;
 static char	*cmdscript = NULL, *pipefn = NULL, *lockfn = NULL;
 
+/* seconds the daemon stays with no timers (0: forever), and since when */
+static long	linger = EMPTY_WAIT;
+static time_t	lastactive = 0;
+static int	reload_flag = 0, conf_reloading = 0;
+
 /* ups name and notify type (string) as received from upsmon */
 static const	char	*upsname, *notify_type, *prog = NULL;
 
@@ -78,13 +107,10 @@ static OVERLAPPED connect_overlapped;
 # define BUF_LEN 512
 #endif	/* WIN32 */
 
-#define PARENT_STARTED		-2
-#define PARENT_UNNECESSARY	-3
-#define MAX_TRIES 		30
-#define EMPTY_WAIT		15	/* min passes with no timers to exit */
-#define US_LISTEN_BACKLOG	16
-#define US_SOCK_BUF_LEN		256
-#define US_MAX_READ		128
+/* the AT conditions, shared by the client and the daemon */
+static void run_ats(int indaemon);
+static void free_ats(void);
+static void checkconf(void);
 
 /* --- server functions --- */
 
@@ -120,47 +146,73 @@ static void exec_cmd(const char *cmd)
 	return;
 }
 
-static void removetimer(ttype_t *tfind)
+static int timer_before(const ttype_t *a, const ttype_t *b)
 {
-	ttype_t	*tmp, *last;
+	if (a->etime != b->etime)
+		return (a->etime < b->etime);
 
-	last = NULL;
-	tmp = thead;
+	return (a->seq < b->seq);
+}
 
-	while (tmp) {
-		if (tmp == tfind) {	/* found it */
-			if (last == NULL)	/* deleting first */
-				thead = tmp->next;
-			else
-				last->next = tmp->next;
+static void heap_swap(size_t i, size_t j)
+{
+	ttype_t	*tmp = theap[i];
 
-			free(tmp->name);
-			free(tmp);
-			return;
-		}
+	theap[i] = theap[j];
+	theap[j] = tmp;
+}
 
-		last = tmp;
-		tmp = tmp->next;
+/* move the timer at i to its place, up or down the heap */
+static void heap_fix(size_t i)
+{
+	size_t	child;
+
+	while (i > 0 && timer_before(theap[i], theap[(i - 1) / 2])) {
+		heap_swap(i, (i - 1) / 2);
+		i = (i - 1) / 2;
+	}
+
+	while ((child = 2 * i + 1) < tcount) {
+		if (child + 1 < tcount && timer_before(theap[child + 1], theap[child]))
+			child++;
+
+		if (!timer_before(theap[child], theap[i]))
+			break;
+
+		heap_swap(i, child);
+		i = child;
 	}
+}
 
-	/* this one should never happen */
+static void removetimer(size_t i)
+{
+	if (i >= tcount) {
+		/* this one should never happen */
+		upslogx(LOG_ERR, "removetimer: failed to locate target at %" PRIuSIZE, i);
+		return;
+	}
+
+	free(theap[i]->name);
+	free(theap[i]);
 
-	upslogx(LOG_ERR, "removetimer: failed to locate target at %p", (void *)tfind);
+	tcount--;
+	if (i < tcount) {
+		theap[i] = theap[tcount];
+		heap_fix(i);
+	}
 }
 
 static void checktimers(void)
 {
-	ttype_t	*tmp, *tmpnext;
 	time_t	now;
-	static	int	emptyctr = 0;
 
-	/* if the queue is empty we might be ready to exit */
-	if (!thead) {
+	time(&now);
 
-		emptyctr++;
+	/* if the queue is empty we might be ready to exit */
+	if (!tcount) {
 
 		/* wait a little while in case someone wants us again */
-		if (emptyctr < EMPTY_WAIT)
+		if (linger == 0 || now - lastactive < linger)
 			return;
 
 		if (nut_debug_level)
@@ -176,34 +228,48 @@ static void checktimers(void)
 		exit(EXIT_SUCCESS);
 	}
 
-	emptyctr = 0;
+	/* the due timers, earliest first */
+	while (tcount && now >= theap[0]->etime) {
+		if (nut_debug_level)
+			upslogx(LOG_INFO, "Event: %s ", theap[0]->name);
 
-	/* flip through LL, look for activity */
-	tmp = thead;
+		exec_cmd(theap[0]->name);
 
-	time(&now);
-	while (tmp) {
-		tmpnext = tmp->next;
+		/* delete from queue */
+		removetimer(0);
 
-		if (now >= tmp->etime) {
-			if (nut_debug_level)
-				upslogx(LOG_INFO, "Event: %s ", tmp->name);
+		time(&now);
+	}
 
-			exec_cmd(tmp->name);
+	lastactive = now;
+}
 
-			/* delete from queue */
-			removetimer(tmp);
-		}
+/* how long the daemon may wait for its sockets: until the earliest timer,
+ * or the end of its lingering; returns 0 to wait with no limit */
+static int timer_wait(struct timeval *tv)
+{
+	time_t	now, until;
 
-		tmp = tmpnext;
-	}
+	if (tcount)
+		until = theap[0]->etime;
+	else if (linger > 0)
+		until = lastactive + linger;
+	else
+		return 0;
+
+	time(&now);
+
+	tv->tv_sec = (until > now) ? (until - now) : 0;
+	tv->tv_usec = 0;
+
+	return 1;
 }
 
 static void start_timer(const char *name, const char *ofsstr)
 {
 	time_t	now;
 	long	ofs;
-	ttype_t	*tmp, *last;
+	ttype_t	*tmp;
 
 	/* get the time */
 	time(&now);
@@ -220,37 +286,40 @@ static void start_timer(const char *name, const char *ofsstr)
 		upslogx(LOG_INFO, "New timer: %s (%ld seconds)", name, ofs);
 
 	/* now add to the queue */
-	tmp = last = thead;
-
-	while (tmp) {
-		last = tmp;
-		tmp = tmp->next;
+	if (tcount == talloc) {
+		talloc = talloc ? 2 * talloc : 16;
+		theap = xrealloc(theap, talloc * sizeof(*theap));
 	}
 
 	tmp = xmalloc(sizeof(ttype_t));
 	tmp->name = xstrdup(name);
 	tmp->etime = now + ofs;
-	tmp->next = NULL;
+	tmp->seq = tseq++;
 
-	if (last)
-		last->next = tmp;
-	else
-		thead = tmp;
+	theap[tcount] = tmp;
+	heap_fix(tcount++);
 }
 
 static void cancel_timer(const char *name, const char *cname)
 {
-	ttype_t	*tmp;
-
-	for (tmp = thead; tmp != NULL; tmp = tmp->next) {
-		if (!strcmp(tmp->name, name)) {		/* match */
-			if (nut_debug_level)
-				upslogx(LOG_INFO, "Cancelling timer: %s", name);
-			removetimer(tmp);
-			return;
+	size_t	i, found = tcount;
+
+	/* the first one started by that name, as the list used to find */
+	for (i = 0; i < tcount; i++) {
+		if (!strcmp(theap[i]->name, name)
+		&&  (found == tcount || theap[i]->seq < theap[found]->seq)
+		) {
+			found = i;
 		}
 	}
 
+	if (found < tcount) {		/* match */
+		if (nut_debug_level)
+			upslogx(LOG_INFO, "Cancelling timer: %s", name);
+		removetimer(found);
+		return;
+	}
+
 	/* this is not necessarily an error */
 	if (cname && cname[0]) {
 		if (nut_debug_level)
@@ -657,6 +726,26 @@ static int sock_arg(conn_t *conn)
 	if (conn->ctx.numargs < 3)
 		return 0;
 
+	/* NOTIFY <upsname> <notifytype>, from upsmon: answered before the
+	 * AT conditions run, so that a slow EXECUTE does not hold it */
+	if (!strcmp(conn->ctx.arglist[0], "NOTIFY")) {
+		char	*un = xstrdup(conn->ctx.arglist[1]);
+		char	*nt = xstrdup(conn->ctx.arglist[2]);
+
+		send_to_one(conn, "OK\n");
+
+		upsdebugx(1, "Event %s for [%s] from the socket", nt, un);
+		upsname = un;
+		notify_type = nt;
+		run_ats(1);
+		lastactive = time(NULL);
+
+		upsname = notify_type = NULL;
+		free(un);
+		free(nt);
+		return 1;
+	}
+
 	/* START <name> <length> */
 	if (!strcmp(conn->ctx.arglist[0], "START")) {
 		start_timer(conn->ctx.arglist[1], conn->ctx.arglist[2]);
@@ -791,6 +880,24 @@ static int sock_read(conn_t *conn)
 	return 0;	/* fell out without parsing anything */
 }
 
+static void reload_conf(void)
+{
+	upslogx(LOG_INFO, "Reloading upssched.conf");
+
+	free_ats();
+
+	conf_reloading = 1;
+	checkconf();
+	conf_reloading = 0;
+}
+
+#ifndef WIN32
+static void set_reload_flag(int sig)
+{
+	reload_flag = sig;
+}
+#endif	/* !WIN32 */
+
 static void start_daemon(TYPE_FD lockfd)
 {
 	int	maxfd = 0;	/* Unidiomatic use vs. "pipefd" below, which is "int" on non-WIN32 */
@@ -802,6 +909,7 @@ static void start_daemon(TYPE_FD lockfd)
 	int	pid, ret;
 	fd_set	rfds;
 	conn_t	*tmpnext;
+	struct	sigaction	sa;
 
 	us_serialize(SERIALIZE_INIT);
 
@@ -897,6 +1005,17 @@ static void start_daemon(TYPE_FD lockfd)
 	unsetenv("NOTIFYTYPE");
 	unsetenv("UPSNAME");
 
+	/* reload the AT conditions on HUP, and outlive clients which went
+	 * away before their answer */
+	sigemptyset(&sa.sa_mask);
+	sa.sa_flags = 0;
+	sa.sa_handler = set_reload_flag;
+	sigaction(SIGHUP, &sa, NULL);
+	sa.sa_handler = SIG_IGN;
+	sigaction(SIGPIPE, &sa, NULL);
+
+	lastactive = time(NULL);
+
 	/* now watch for activity */
 	upsdebugx(2, "Timer daemon waiting for connections on pipefd %d",
 		pipefd);
@@ -907,10 +1026,6 @@ static void start_daemon(TYPE_FD lockfd)
 
 		gettimeofday(&start, NULL);
 
-		/* wait at most 1s so we can check our timers regularly */
-		tv.tv_sec = 1;
-		tv.tv_usec = 0;
-
 		FD_ZERO(&rfds);
 		FD_SET(pipefd, &rfds);
 
@@ -923,7 +1038,13 @@ static void start_daemon(TYPE_FD lockfd)
 				maxfd = tmp->fd;
 		}
 
-		ret = select(maxfd + 1, &rfds, NULL, NULL, &tv);
+		/* wait until the earliest timer is due */
+		ret = select(maxfd + 1, &rfds, NULL, NULL, timer_wait(&tv) ? &tv : NULL);
+
+		if (reload_flag) {
+			reload_flag = 0;
+			reload_conf();
+		}
 
 		if (ret > 0) {
 			if (FD_ISSET(pipefd, &rfds))
@@ -1010,12 +1131,14 @@ static void start_daemon(TYPE_FD lockfd)
 
 	/* now watch for activity */
 
-	for (;;) {
-		/* wait at most 1s so we can check our timers regularly */
-		tv.tv_sec = 1;
-		tv.tv_usec = 0;
+	lastactive = time(NULL);
 
-		timeout_ms = (tv.tv_sec * 1000) + (tv.tv_usec / 1000);
+	for (;;) {
+		/* wait until the earliest timer is due */
+		if (timer_wait(&tv))
+			timeout_ms = (tv.tv_sec * 1000) + (tv.tv_usec / 1000);
+		else
+			timeout_ms = INFINITE;
 
 		maxfd = 0;
 
@@ -1324,6 +1447,8 @@ static void sendcmd(const char *cmd, const char *arg1, const char *arg2)
 static void parse_at(const char *ntype, const char *un, const char *cmd,
 		const char *ca1, const char *ca2)
 {
+	at_t	*tmp, *last;
+
 	/* complain both ways in case we don't have a tty */
 
 	if (!cmdscript) {
@@ -1341,15 +1466,54 @@ static void parse_at(const char *ntype, const char *un, const char *cmd,
 		fatalx(EXIT_FAILURE, "LOCKFN must be set before any ATs in the config file!");
 	}
 
+	/* keep it for the events, in the order of the file */
+	tmp = xcalloc(1, sizeof(at_t));
+	tmp->ntype = xstrdup(ntype);
+	tmp->upsname = xstrdup(un);
+	tmp->cmd = xstrdup(cmd);
+	tmp->ca1 = xstrdup(ca1);
+	tmp->ca2 = ca2 ? xstrdup(ca2) : NULL;
+
+	for (last = athead; last && last->next; last = last->next)
+		;
+
+	if (last)
+		last->next = tmp;
+	else
+		athead = tmp;
+}
+
+static void free_ats(void)
+{
+	at_t	*tmp;
+
+	while (athead) {
+		tmp = athead;
+		athead = tmp->next;
+
+		free(tmp->ntype);
+		free(tmp->upsname);
+		free(tmp->cmd);
+		free(tmp->ca1);
+		free(tmp->ca2);
+		free(tmp);
+	}
+}
+
+/* act on one AT condition for the event of upsname/notify_type: as a
+ * client, with the timers handed to the daemon (which may start it), or
+ * in the daemon itself for NOTIFY commands */
+static void run_at(const at_t *at, int indaemon)
+{
 	/* check upsname: does this apply to us? */
 	upsdebugx(2, "%s: is '%s' in AT command the '%s' we were launched to process?",
-		__func__, un, upsname);
-	if (strcmp(upsname, un) != 0) {
-		if (strcmp(un, "*") != 0) {
+		__func__, at->upsname, upsname);
+	if (strcmp(upsname, at->upsname) != 0) {
+		if (strcmp(at->upsname, "*") != 0) {
 			upsdebugx(1, "%s: SKIP: '%s' in AT command "
 				"did not match the '%s' UPSNAME "
 				"we were launched to process",
-				__func__, un, upsname);
+				__func__, at->upsname, upsname);
 			return;		/* not for us, and not the wildcard */
 		} else {
 			upsdebugx(1, "%s: this AT command is for a wildcard: matched", __func__);
@@ -1357,48 +1521,76 @@ static void parse_at(const char *ntype, const char *un, const char *cmd,
 	} else {
 		upsdebugx(1, "%s: '%s' in AT command matched the '%s' "
 			"UPSNAME we were launched to process",
-			__func__, un, upsname);
+			__func__, at->upsname, upsname);
 	}
 
 	/* see if the current notify type matches the one from the .conf */
-	if (strcasecmp(notify_type, ntype) != 0) {
+	if (strcasecmp(notify_type, at->ntype) != 0) {
 		upsdebugx(1, "%s: SKIP: '%s' in AT command "
 			"did not match the '%s' NOTIFYTYPE "
 			"we were launched to process",
-			__func__, ntype, notify_type);
+			__func__, at->ntype, notify_type);
 		return;
 	}
 
 	/* if command is valid, send it to the daemon (which may start it) */
 
-	if (!strcmp(cmd, "START-TIMER")) {
-		upsdebugx(1, "%s: processing %s", __func__, cmd);
-		sendcmd("START", ca1, ca2);
+	if (!strcmp(at->cmd, "START-TIMER")) {
+		upsdebugx(1, "%s: processing %s", __func__, at->cmd);
+		if (indaemon && !at->ca2)
+			upslogx(LOG_ERR, "No time given to START-TIMER %s", at->ca1);
+		else if (indaemon)
+			start_timer(at->ca1, at->ca2);
+		else
+			sendcmd("START", at->ca1, at->ca2);
 		return;
 	}
 
-	if (!strcmp(cmd, "CANCEL-TIMER")) {
-		upsdebugx(1, "%s: processing %s", __func__, cmd);
-		sendcmd("CANCEL", ca1, ca2);
+	if (!strcmp(at->cmd, "CANCEL-TIMER")) {
+		upsdebugx(1, "%s: processing %s", __func__, at->cmd);
+		if (indaemon)
+			cancel_timer(at->ca1, at->ca2);
+		else
+			sendcmd("CANCEL", at->ca1, at->ca2);
 		return;
 	}
 
-	if (!strcmp(cmd, "EXECUTE")) {
-		upsdebugx(1, "%s: processing %s", __func__, cmd);
+	if (!strcmp(at->cmd, "EXECUTE")) {
+		upsdebugx(1, "%s: processing %s", __func__, at->cmd);
 
-		if (ca1[0] == '\0') {
+		if (at->ca1[0] == '\0') {
 			upslogx(LOG_ERR, "Empty EXECUTE command argument");
 			return;
 		}
 
 		if (nut_debug_level)
-			upslogx(LOG_INFO, "Executing command: %s", ca1);
+			upslogx(LOG_INFO, "Executing command: %s", at->ca1);
 
-		exec_cmd(ca1);
+		/* the daemon is not run with the variables of this event */
+		if (indaemon) {
+			setenv("UPSNAME", upsname, 1);
+			setenv("NOTIFYTYPE", notify_type, 1);
+		}
+
+		exec_cmd(at->ca1);
+
+		if (indaemon) {
+			unsetenv("NOTIFYTYPE");
+			unsetenv("UPSNAME");
+		}
 		return;
 	}
 
-	upslogx(LOG_ERR, "Invalid command: %s", cmd);
+	upslogx(LOG_ERR, "Invalid command: %s", at->cmd);
+}
+
+/* go through the AT conditions for the event of upsname/notify_type */
+static void run_ats(int indaemon)
+{
+	const	at_t	*at;
+
+	for (at = athead; at != NULL; at = at->next)
+		run_at(at, indaemon);
 }
 
 static int conf_arg(size_t numargs, char **arg)
@@ -1408,10 +1600,31 @@ static int conf_arg(size_t numargs, char **arg)
 
 	/* CMDSCRIPT <scriptname> */
 	if (!strcmp(arg[0], "CMDSCRIPT")) {
+		free(cmdscript);
 		cmdscript = xstrdup(arg[1]);
 		return 1;
 	}
 
+	/* LINGER <seconds> */
+	if (!strcmp(arg[0], "LINGER")) {
+		long	l;
+
+		if (!str_to_long(arg[1], &l, 10) || l < 0) {
+			upslogx(LOG_ERR, "Invalid LINGER value: %s", arg[1]);
+			return 1;
+		}
+
+		linger = l;
+		return 1;
+	}
+
+	/* the daemon keeps its socket and lock when reloading */
+	if (conf_reloading
+	&&  (!strcmp(arg[0], "PIPEFN") || !strcmp(arg[0], "LOCKFN"))
+	) {
+		return 1;
+	}
+
 	/* PIPEFN <pipename> */
 	if (!strcmp(arg[0], "PIPEFN")) {
 #ifndef WIN32
@@ -1594,6 +1807,7 @@ int main(int argc, char **argv)
 	 *  -> start_daemon -> conn_add(pipefd) or sock_read(conn)
 	 */
 	checkconf();
+	run_ats(0);
 
 	upsdebugx(1, "Exiting upssched (CLI process)");
 	exit(EXIT_SUCCESS);
@@ -646,159 +646,276 @@ static const char *get_data(const char *type, const char *varname)
 	return answer[3];
 }
 
-static void do_string(const char *varname, int maxlen)
+/* a RW variable, with what is needed to show it */
+struct setting_t {
+	char	*name, *val, *desc;
+	char	**type;		/* as GET TYPE tells, e.g. RW ENUM */
+	size_t	numtype;
+	char	**enums;
+	size_t	numenums;
+	struct	setting_t	*next;
+};
+
+static void strlist_add(char ***list, size_t *count, const char *str)
 {
-	const	char	*val;
+	*list = xrealloc(*list, (*count + 1) * sizeof(**list));
+	(*list)[(*count)++] = xstrdup(str);
+}
 
-	val = get_data("VAR", varname);
+static void strlist_free(char **list, size_t count)
+{
+	size_t	i;
 
-	if (!val) {
-		printf("Unavailable\n");
-		fprintf(stderr, "do_string: can't get current value of %s\n",
-			varname);
-		return;
-	}
+	for (i = 0; i < count; i++)
+		free(list[i]);
 
-	printf("<INPUT TYPE=\"TEXT\" NAME=\"UPSVAR_%s\" VALUE=\"%s\" "
-		"SIZE=\"%d\">\n", varname, val, maxlen);
+	free(list);
+}
+
+static struct setting_t *setting_add(struct setting_t ***tail,
+	const char *name, const char *val)
+{
+	struct	setting_t	*stmp = xcalloc(1, sizeof(*stmp));
+
+	stmp->name = xstrdup(name);
+	stmp->val = xstrdup(val);
+
+	**tail = stmp;
+	*tail = &stmp->next;
+
+	return stmp;
+}
+
+static void settings_free(struct setting_t *stmp)
+{
+	struct	setting_t	*snext;
+
+	for (; stmp; stmp = snext) {
+		snext = stmp->next;
+
+		free(stmp->name);
+		free(stmp->val);
+		free(stmp->desc);
+		strlist_free(stmp->type, stmp->numtype);
+		strlist_free(stmp->enums, stmp->numenums);
+		free(stmp);
+	}
 }
 
-static void do_enum(const char *varname)
+/* LIST SETTINGS (protocol 1.4+): the RW variables with their types,
+ * descriptions and enumerated values in one request; returns -1 if the
+ * server does not support it */
+static int get_settings(struct setting_t **head)
 {
 	int	ret;
-	size_t	numq, numa;
-	char	**answer, *val;
-	const	char	*query[4], *tmp;
+	size_t	i, numa;
+	char	**answer;
+	const	char	*query[2];
+	struct	setting_t	**tail = head, *last = NULL;
 
-	/* get current value */
-	tmp = get_data("VAR", varname);
+	query[0] = "SETTINGS";
+	query[1] = upsname;
 
-	if (!tmp) {
-		printf("Unavailable\n");
-		fprintf(stderr, "do_enum: can't get current value of %s\n",
-			varname);
-		return;
+	if (upscli_list_start(&ups, 2, query) < 0)
+		return -1;
+
+	/* RW | TYPE | DESC | ENUM | RANGE <upsname> <varname> ... */
+	while ((ret = upscli_list_next(&ups, 0, NULL, &numa, &answer)) == 1) {
+		if (numa < 3)
+			continue;
+
+		if (!strcasecmp(answer[0], "RW")) {
+			last = setting_add(&tail, answer[2], (numa > 3) ? answer[3] : "");
+			continue;
+		}
+
+		/* the rest is about the last RW one; RANGE is not used here */
+		if (!last || strcmp(last->name, answer[2]) != 0)
+			continue;
+
+		if (!strcasecmp(answer[0], "TYPE")) {
+			for (i = 3; i < numa; i++)
+				strlist_add(&last->type, &last->numtype, answer[i]);
+		} else if (!strcasecmp(answer[0], "DESC") && (numa > 3)) {
+			free(last->desc);
+			last->desc = xstrdup(answer[3]);
+		} else if (!strcasecmp(answer[0], "ENUM") && (numa > 3)) {
+			strlist_add(&last->enums, &last->numenums, answer[3]);
+		}
 	}
 
-	/* tmp is a pointer into answer - have to save it somewhere else */
-	val = xstrdup(tmp);
+	if (ret < 0)
+		fprintf(stderr, "LIST SETTINGS %s failed: %s\n",
+			upsname, upscli_strerror(&ups));
+
+	return 0;
+}
+
+/* the same from older servers: LIST RW, then GET DESC, GET TYPE and maybe
+ * LIST ENUM for each variable */
+static void get_settings_each(struct setting_t **head)
+{
+	int	ret;
+	size_t	i, numq, numa;
+	const	char	*query[3], *tmp;
+	char	**answer;
+	struct	setting_t	**tail = head, *stmp;
 
-	query[0] = "ENUM";
+	query[0] = "RW";
 	query[1] = upsname;
-	query[2] = varname;
-	numq = 3;
+	numq = 2;
 
 	ret = upscli_list_start(&ups, numq, query);
 
 	if (ret < 0) {
-		printf("Unavailable\n");
-		fprintf(stderr, "Error doing ENUM %s %s: %s\n",
-			upsname, varname, upscli_strerror(&ups));
-		free(val);
-		return;
+		fprintf(stderr, "LIST RW %s failed: %s\n",
+			upsname, upscli_strerror(&ups));
+
+		error_page("showsettings", "Server protocol error",
+			"LIST RW command failed");
+
+		/* NOTREACHED */
 	}
 
 	ret = upscli_list_next(&ups, numq, query, &numa, &answer);
 
-	printf("<SELECT NAME=\"UPSVAR_%s\">\n", varname);
-
 	while (ret == 1) {
 
-		/* ENUM <upsname> <varname> <value> */
+		/* RW <upsname> <varname> <value> */
+		if (numa >= 3)
+			setting_add(&tail, answer[2], (numa > 3) ? answer[3] : "");
 
-		if (numa < 4) {
-			fprintf(stderr, "Error: insufficient data "
-				"(got %" PRIuSIZE " args, need at least 4)\n", numa);
+		ret = upscli_list_next(&ups, numq, query, &numa, &answer);
+	}
 
-			free(val);
-			return;
+	for (stmp = *head; stmp; stmp = stmp->next) {
+		tmp = get_data("DESC", stmp->name);
+		if (tmp)
+			stmp->desc = xstrdup(tmp);
+
+		query[0] = "TYPE";
+		query[1] = upsname;
+		query[2] = stmp->name;
+		numq = 3;
+
+		ret = upscli_get(&ups, numq, query, &numa, &answer);
+
+		if ((ret < 0) || (numa < numq))
+			continue;
+
+		/* TYPE <upsname> <varname> <type>... */
+		for (i = 3; i < numa; i++)
+			strlist_add(&stmp->type, &stmp->numtype, answer[i]);
+
+		for (i = 0; i < stmp->numtype; i++) {
+			if (!strcasecmp(stmp->type[i], "ENUM"))
+				break;
 		}
 
-		printf("<OPTION VALUE=\"%s\" ", answer[3]);
+		if (i == stmp->numtype)
+			continue;
 
-		if (!strcmp(answer[3], val))
-			printf(" SELECTED");
+		query[0] = "ENUM";
 
-		printf(">%s</OPTION>\n", answer[3]);
+		if (upscli_list_start(&ups, numq, query) < 0) {
+			fprintf(stderr, "Error doing ENUM %s %s: %s\n",
+				upsname, stmp->name, upscli_strerror(&ups));
+			continue;
+		}
 
-		ret = upscli_list_next(&ups, numq, query, &numa, &answer);
+		/* ENUM <upsname> <varname> <value> */
+		while (upscli_list_next(&ups, numq, query, &numa, &answer) == 1) {
+			if (numa >= 4)
+				strlist_add(&stmp->enums, &stmp->numenums, answer[3]);
+		}
 	}
+}
 
-	free(val);
-	printf("</SELECT>\n");
+static void do_string(const struct setting_t *stmp, int maxlen)
+{
+	printf("<INPUT TYPE=\"TEXT\" NAME=\"UPSVAR_%s\" VALUE=\"%s\" "
+		"SIZE=\"%d\">\n", stmp->name, stmp->val, maxlen);
 }
 
-static void do_type(const char *varname)
+static void do_enum(const struct setting_t *stmp)
 {
-	int	ret;
-	size_t	i, numq, numa;
-	char	**answer;
-	const	char	*query[4];
+	size_t	i;
 
-	query[0] = "TYPE";
-	query[1] = upsname;
-	query[2] = varname;
-	numq = 3;
+	if (!stmp->numenums) {
+		printf("Unavailable\n");
+		fprintf(stderr, "do_enum: no values listed for %s\n",
+			stmp->name);
+		return;
+	}
 
-	ret = upscli_get(&ups, numq, query, &numa, &answer);
+	printf("<SELECT NAME=\"UPSVAR_%s\">\n", stmp->name);
+
+	for (i = 0; i < stmp->numenums; i++) {
+		printf("<OPTION VALUE=\"%s\" ", stmp->enums[i]);
 
-	if ((ret < 0) || (numa < numq)) {
+		if (!strcmp(stmp->enums[i], stmp->val))
+			printf(" SELECTED");
+
+		printf(">%s</OPTION>\n", stmp->enums[i]);
+	}
+
+	printf("</SELECT>\n");
+}
+
+static void do_type(const struct setting_t *stmp)
+{
+	size_t	i;
+
+	if (!stmp->numtype) {
 		printf("Unknown type\n");
 		return;
 	}
 
-	/* TYPE <upsname> <varname> <type>... */
-	for (i = 3; i < numa; i++) {
+	for (i = 0; i < stmp->numtype; i++) {
 
-		if (!strcasecmp(answer[i], "ENUM")) {
-			do_enum(varname);
+		if (!strcasecmp(stmp->type[i], "ENUM")) {
+			do_enum(stmp);
 			return;
 		}
 
-		if (!strncasecmp(answer[i], "STRING:", 7)) {
-			char	*ptr, len;
+		if (!strncasecmp(stmp->type[i], "STRING:", 7)) {
+			char	len;
 			long	l;
 
 			/* split out the :<len> data */
-			ptr = strchr(answer[i], ':');
-			*ptr++ = '\0';
-			l = strtol(ptr, (char **) NULL, 10);
+			l = strtol(stmp->type[i] + 7, (char **) NULL, 10);
 			assert(l <= 127);	/* FIXME: Loophole about longer numbers? Why are we limited to char at all here? */
 			len = (char)l;
 
-			do_string(varname, len);
+			do_string(stmp, len);
 			return;
 		}
 
 		/* ignore this one */
-		if (!strcasecmp(answer[i], "RW"))
+		if (!strcasecmp(stmp->type[i], "RW"))
 			continue;
 
 		printf("Unrecognized\n");
 	}
 }
 
-static void print_rw(const char *arg_upsname, const char *varname)
+static void print_rw(const char *arg_upsname, const struct setting_t *stmp)
 {
-	const	char	*tmp;
-
 	printf("<!-- <TR><TD>Device</TD><TD>%s</TD></TR> -->\n", arg_upsname);
 
 	printf("<TR BGCOLOR=\"#60B0B0\" ALIGN=\"CENTER\">\n");
 
 	printf("<TD>");
 
-	tmp = get_data("DESC", varname);
-
-	if ((tmp) && (strcmp(tmp, "Unavailable") != 0))
-		printf("%s", tmp);
+	if ((stmp->desc) && (strcmp(stmp->desc, "Unavailable") != 0))
+		printf("%s", stmp->desc);
 	else
-		printf("%s", varname);
+		printf("%s", stmp->name);
 
 	printf("</TD>\n");
 
 	printf("<TD>\n");
-	do_type(varname);
+	do_type(stmp);
 	printf("</TD>\n");
 
 	printf("</TR>\n");
@@ -809,11 +926,8 @@ static void showsettings(void)
 
 static void showsettings(void)
 {
-	int	ret;
-	size_t	numq, numa;
-	const	char	*query[2];
-	char	**answer, *desc = NULL;
-	struct	list_t	*lhead, *llast, *ltmp, *lnext;
+	char	*desc = NULL;
+	struct	setting_t	*shead = NULL, *stmp;
 
 	if (!checkhost(monups, &desc))
 		error_page("showsettings", "Access denied",
@@ -821,43 +935,8 @@ static void showsettings(void)
 
 	upsd_connect();
 
-	query[0] = "RW";
-	query[1] = upsname;
-	numq = 2;
-
-	ret = upscli_list_start(&ups, numq, query);
-
-	if (ret < 0) {
-		fprintf(stderr, "LIST RW %s failed: %s\n",
-			upsname, upscli_strerror(&ups));
-
-		error_page("showsettings", "Server protocol error",
-			"LIST RW command failed");
-
-		/* NOTREACHED */
-	}
-
-	llast = lhead = NULL;
-
-	ret = upscli_list_next(&ups, numq, query, &numa, &answer);
-
-	while (ret == 1) {
-
-		/* sock this entry away for later */
-
-		ltmp = xmalloc(sizeof(struct list_t));
-		ltmp->name = xstrdup(answer[2]);
-		ltmp->next = NULL;
-
-		if (llast)
-			llast->next = ltmp;
-		else
-			lhead = ltmp;
-
-		llast = ltmp;
-
-		ret = upscli_list_next(&ups, numq, query, &numa, &answer);
-	}
+	if (get_settings(&shead) < 0)
+		get_settings_each(&shead);
 
 	do_header("Current settings");
 	printf("<FORM ACTION=\"upsset.cgi\" METHOD=\"POST\">\n");
@@ -872,19 +951,10 @@ static void showsettings(void)
 	printf("<TH>Setting</TH>\n");
 	printf("<TH>Value</TH></TR>\n");
 
-	/* use the list to get descriptions and types */
+	for (stmp = shead; stmp; stmp = stmp->next)
+		print_rw(upsname, stmp);
 
-	ltmp = lhead;
-
-	while (ltmp) {
-		lnext = ltmp->next;
-
-		print_rw(upsname, ltmp->name);
-
-		free(ltmp->name);
-		free(ltmp);
-		ltmp = lnext;
-	}
+	settings_free(shead);
 
 	printf("<TR BGCOLOR=\"#60B0B0\">\n");
 	printf("<TD COLSPAN=\"2\" ALIGN=\"CENTER\">\n");
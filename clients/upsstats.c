@@ -42,13 +42,30 @@ static char	*monhostdesc = NULL;
 
 static uint16_t	port;
 static char	*upsname, *hostname;
-static char	*upsimgpath="upsimage.cgi", *upsstatpath="upsstats.cgi";
-static UPSCONN_t	ups;
-
-static FILE	*tf;
-static long	forofs = 0;
-
-static ulist_t	*ulhead = NULL, *currups = NULL;
+static char	default_imgpath[] = "upsimage.cgi", default_statpath[] = "upsstats.cgi";
+static char	*upsimgpath = default_imgpath, *upsstatpath = default_statpath;
+static UPSCONN_t	*ups = NULL;
+
+/* a template, kept as read while the file does not change */
+typedef struct {
+	const char	*name;
+	struct stat	st;
+	char	**lines;
+	size_t	numlines;
+}	template_t;
+
+static template_t	templates[] = {
+	{ "upsstats.html", { 0 }, NULL, 0 },
+	{ "upsstats-single.html", { 0 }, NULL, 0 },
+	{ NULL, { 0 }, NULL, 0 }
+};
+
+/* the line of the template to display next, and the one after FOREACHUPS */
+static size_t	curline = 0, forofs = 0;
+
+/* hosts.conf as read, and the UPSes that FOREACHUPS walks */
+static ulist_t	*ulhead = NULL, *forlist = NULL, *currups = NULL;
+static struct stat	hosts_st;
 
 static int	skip_clause = 0, skip_block = 0;
 
@@ -75,16 +92,18 @@ void parsearg(char *var, char *value)
 
 static void report_error(void)
 {
-	if (upscli_upserror(&ups) == UPSCLI_ERR_VARNOTSUPP)
+	if (!ups)
+		printf("[error: no usable UPS definition]\n");
+	else if (upscli_upserror(ups) == UPSCLI_ERR_VARNOTSUPP)
 		printf("Not supported\n");
 	else
-		printf("[error: %s]\n", upscli_strerror(&ups));
+		printf("[error: %s]\n", upscli_strerror(ups));
 }
 
 /* make sure we're actually connected to upsd */
 static int check_ups_fd(int do_report)
 {
-	if (upscli_fd(&ups) == -1) {
+	if (!ups || upscli_fd(ups) == -1) {
 		if (do_report)
 			report_error();
 
@@ -106,11 +125,6 @@ static int check_ups_fd(int do_report)
 
 static int get_var(const char *var, char *buf, size_t buflen, int verbose)
 {
-	int	ret;
-	size_t	numq, numa;
-	const	char	*query[4];
-	char	**answer;
-
 	if (!check_ups_fd(1))
 		return 0;
 
@@ -121,28 +135,13 @@ static int get_var(const char *var, char *buf, size_t buflen, int verbose)
 		return 0;
 	}
 
-	query[0] = "VAR";
-	query[1] = upsname;
-	query[2] = var;
-
-	numq = 3;
-
-	ret = upscli_get(&ups, numq, query, &numa, &answer);
-
-	if (ret < 0) {
+	/* one LIST VAR per UPS serves all of these */
+	if (cgi_get_var(ups, upsname, var, buf, buflen) < 0) {
 		if (verbose)
 			report_error();
 		return 0;
 	}
 
-	if (numa < numq) {
-		if (verbose)
-			printf("[Invalid response]\n");
-
-		return 0;
-	}
-
-	snprintf(buf, buflen, "%s", answer[3]);
 	return 1;
 }
 
@@ -231,7 +230,7 @@ static int get_img_val(const char *var, const char *desc, const char *imgargs)
 /* see if <arg> is valid - table from upsimagearg.h */
 static void check_imgarg(char *arg, char *out, size_t outlen)
 {
-	int	i;
+	int	i, ok;
 	char	*ep;
 
 	ep = strchr(arg, '=');
@@ -241,17 +240,21 @@ static void check_imgarg(char *arg, char *out, size_t outlen)
 
 	*ep++= '\0';
 
+	/* the image format is not in the table */
+	ok = (!strcmp(arg, "format") && (!strcmp(ep, "png") || !strcmp(ep, "svg")));
+
+	for (i = 0; !ok && imgarg[i].name != NULL; i++)
+		if (!strcmp(imgarg[i].name, arg))
+			ok = 1;
+
 	/* if it's allowed, append it so it can become part of the URL */
-	for (i = 0; imgarg[i].name != NULL; i++) {
-		if (!strcmp(imgarg[i].name, arg)) {
+	if (!ok)
+		return;
 
-			if (strlen(out) == 0)
-				snprintf(out, outlen, "%s=%s", arg, ep);
-			else
-				snprintfcat(out, outlen, "&amp;%s=%s", arg, ep);
-			return;
-		}
-	}
+	if (strlen(out) == 0)
+		snprintf(out, outlen, "%s=%s", arg, ep);
+	else
+		snprintfcat(out, outlen, "&amp;%s=%s", arg, ep);
 }
 
 /* split out the var=val commands from the IMG line */
@@ -352,59 +355,23 @@ static int do_img(char *buf)
 
 static void ups_connect(void)
 {
-	static ulist_t	*lastups = NULL;
-	char	*newups, *newhost;
-	uint16_t	newport;
-
-	/* try to minimize reconnects */
-	if (lastups) {
-
-		/* don't reconnect if these are both the same UPS */
-		if (!strcmp(lastups->sys, currups->sys)) {
-			lastups = currups;
-			return;
-		}
-
-		/* see if it's just on the same host */
-		newups = newhost = NULL;
-
-		if (upscli_splitname(currups->sys, &newups, &newhost,
-			&newport) != 0) {
-			printf("Unusable UPS definition [%s]\n", currups->sys);
-			fprintf(stderr, "Unusable UPS definition [%s]\n",
-				currups->sys);
-			exit(EXIT_FAILURE);
-		}
-
-		if ((!strcmp(newhost, hostname)) && (port == newport)) {
-			free(upsname);
-			upsname = newups;
-
-			free(newhost);
-			lastups = currups;
-			return;
-		}
-
-		/* not the same upsd, so disconnect */
-		free(newups);
-		free(newhost);
-	}
-
-	upscli_disconnect(&ups);
-
 	free(upsname);
 	free(hostname);
+	upsname = hostname = NULL;
+	ups = NULL;
 
 	if (upscli_splitname(currups->sys, &upsname, &hostname, &port) != 0) {
 		printf("Unusable UPS definition [%s]\n", currups->sys);
 		fprintf(stderr, "Unusable UPS definition [%s]\n", currups->sys);
-		exit(EXIT_FAILURE);
+		return;
 	}
 
-	if (upscli_connect(&ups, hostname, port, UPSCLI_CONN_TRYSSL) < 0)
-		fprintf(stderr, "UPS [%s]: can't connect to server: %s\n", currups->sys, upscli_strerror(&ups));
+	/* the connections to each upsd are shared, and kept between
+	 * requests in persistent mode */
+	ups = cgi_connect(hostname, port);
 
-	lastups = currups;
+	if (upscli_fd(ups) == -1)
+		fprintf(stderr, "UPS [%s]: can't connect to server: %s\n", currups->sys, upscli_strerror(ups));
 }
 
 static void do_hostlink(void)
@@ -555,14 +522,18 @@ static void do_ifbetween(const char *s)
 static void do_upsstatpath(const char *s) {
 
 	if(strlen(s)) {
-		upsstatpath = strdup(s);
+		if (upsstatpath != default_statpath)
+			free(upsstatpath);
+		upsstatpath = xstrdup(s);
 	}
 }
 
 static void do_upsimgpath(const char *s) {
 
 	if(strlen(s)) {
-		upsimgpath = strdup(s);
+		if (upsimgpath != default_imgpath)
+			free(upsimgpath);
+		upsimgpath = xstrdup(s);
 	}
 }
 
@@ -727,9 +698,9 @@ static int do_command(char *cmd)
 	}
 
 	if (!strcmp(cmd, "FOREACHUPS")) {
-		forofs = ftell(tf);
+		forofs = curline;
 
-		currups = ulhead;
+		currups = forlist;
 		ups_connect();
 		return 1;
 	}
@@ -744,7 +715,7 @@ static int do_command(char *cmd)
 		currups = currups->next;
 
 		if (currups) {
-			fseek(tf, forofs, SEEK_SET);
+			curline = forofs;
 			ups_connect();
 		}
 
@@ -847,27 +818,70 @@ static void parse_line(const char *buf)
 	}
 }
 
-static void display_template(const char *tfn)
+/* (re)read the template if it changed: returns 0 if it can't be read */
+static int load_template(template_t *t, const char *fn)
 {
-	char	fn[NUT_PATH_MAX + 1], buf[LARGEBUF];
+	char	buf[LARGEBUF];
+	size_t	i, size = 0;
+	FILE	*tf;
 
-	snprintf(fn, sizeof(fn), "%s/%s", confpath(), tfn);
+	if (!cgi_file_changed(fn, &t->st) && t->lines)
+		return 1;
+
+	for (i = 0; i < t->numlines; i++)
+		free(t->lines[i]);
+	free(t->lines);
+	t->lines = NULL;
+	t->numlines = 0;
 
 	tf = fopen(fn, "r");
 
 	if (!tf) {
 		fprintf(stderr, "upsstats: Can't open %s: %s\n", fn, strerror(errno));
+		return 0;
+	}
 
+	/* kept in the pieces that fgets() returns, for FOREACHUPS */
+	while (fgets(buf, sizeof(buf), tf)) {
+		if (t->numlines >= size) {
+			size = size ? size * 2 : 64;
+			t->lines = xrealloc(t->lines, size * sizeof(*t->lines));
+		}
+
+		t->lines[t->numlines++] = xstrdup(buf);
+	}
+
+	fclose(tf);
+
+	/* an empty file still counts as loaded */
+	if (!t->lines)
+		t->lines = xcalloc(1, sizeof(*t->lines));
+
+	return 1;
+}
+
+static int display_template(const char *tfn)
+{
+	char	fn[NUT_PATH_MAX + 1];
+	template_t	*t;
+
+	snprintf(fn, sizeof(fn), "%s/%s", confpath(), tfn);
+
+	for (t = templates; t->name; t++)
+		if (!strcmp(t->name, tfn))
+			break;
+
+	if (!t->name || !load_template(t, fn)) {
 		printf("Error: can't open template file (%s)\n", tfn);
 
-		exit(EXIT_FAILURE);
+		return EXIT_FAILURE;
 	}
 
-	while (fgets(buf, sizeof(buf), tf)) {
-		parse_line(buf);
+	for (curline = 0; curline < t->numlines; ) {
+		parse_line(t->lines[curline++]);
 	}
 
-	fclose(tf);
+	return EXIT_SUCCESS;
 }
 
 static void display_tree(int verbose)
@@ -876,6 +890,9 @@ static void display_tree(int verbose)
 	const	char	*query[4];
 	char	**answer;
 
+	if (!check_ups_fd(verbose))
+		return;
+
 	if (!upsname) {
 		if (verbose)
 			printf("[No UPS name specified]\n");
@@ -886,7 +903,7 @@ static void display_tree(int verbose)
 	query[1] = upsname;
 	numq = 2;
 
-	if (upscli_list_start(&ups, numq, query) < 0) {
+	if (upscli_list_start(ups, numq, query) < 0) {
 		if (verbose)
 			report_error();
 		return;
@@ -911,7 +928,7 @@ static void display_tree(int verbose)
 
 	printf("<TR><TH COLSPAN=3 BGCOLOR=\"#60B0B0\"></TH></TR>\n");
 
-	while (upscli_list_next(&ups, numq, query, &numa, &answer) == 1) {
+	while (upscli_list_next(ups, numq, query, &numa, &answer) == 1) {
 
 		/* VAR <upsname> <varname> <val> */
 		if (numa < 4) {
@@ -960,18 +977,37 @@ static void add_ups(char *sys, char *desc)
 		ulhead = tmp;
 }
 
+static void free_ups(void)
+{
+	ulist_t	*tmp;
+
+	while (ulhead) {
+		tmp = ulhead->next;
+		free(ulhead->sys);
+		free(ulhead->desc);
+		free(ulhead);
+		ulhead = tmp;
+	}
+}
+
 /* called for fatal errors in parseconf like malloc failures */
 static void upsstats_hosts_err(const char *errmsg)
 {
 	upslogx(LOG_ERR, "Fatal error in parseconf(hosts.conf): %s", errmsg);
 }
 
-static void load_hosts_conf(void)
+/* (re)read hosts.conf if it changed: returns 0 when nothing can be shown */
+static int load_hosts_conf(void)
 {
 	char	fn[NUT_PATH_MAX + 1];
 	PCONF_CTX_t	ctx;
 
-	snprintf(fn, sizeof(fn), "%s/hosts.conf", CONFPATH);
+	snprintf(fn, sizeof(fn), "%s/hosts.conf", confpath());
+
+	if (!cgi_file_changed(fn, &hosts_st) && ulhead)
+		return 1;
+
+	free_ups();
 
 	pconf_init(&ctx, upsstats_hosts_err);
 
@@ -988,7 +1024,7 @@ static void load_hosts_conf(void)
 
 		/* leave something for the admin */
 		fprintf(stderr, "upsstats: %s\n", ctx.errmsg);
-		exit(EXIT_FAILURE);
+		return 0;
 	}
 
 	while (pconf_file_next(&ctx)) {
@@ -1020,21 +1056,27 @@ static void load_hosts_conf(void)
 
 		/* leave something for the admin */
 		fprintf(stderr, "upsstats: no hosts to monitor\n");
-		exit(EXIT_FAILURE);
+		return 0;
 	}
+
+	return 1;
 }
 
-static void display_single(void)
+static int display_single(void)
 {
+	ulist_t	single;
+
 	if (!checkhost(monhost, &monhostdesc)) {
 		printf("Access to that host [%s] is not authorized.\n",
 			monhost);
-		exit(EXIT_FAILURE);
+		return EXIT_FAILURE;
 	}
 
-	add_ups(monhost, monhostdesc);
+	single.sys = monhost;
+	single.desc = monhostdesc;
+	single.next = NULL;
 
-	currups = ulhead;
+	forlist = currups = &single;
 	ups_connect();
 
 	/* switch between data tree view and standard single view */
@@ -1043,37 +1085,72 @@ static void display_single(void)
 	else
 		display_template("upsstats-single.html");
 
-	upscli_disconnect(&ups);
+	currups = forlist = NULL;
+
+	return EXIT_SUCCESS;
 }
 
-int main(int argc, char **argv)
+/* forget what the previous request set */
+static void reset_request(void)
 {
-	NUT_UNUSED_VARIABLE(argc);
-	NUT_UNUSED_VARIABLE(argv);
+	free(monhost);
+	free(monhostdesc);
+	monhost = monhostdesc = NULL;
+
+	use_celsius = 1;
+	refreshdelay = -1;
+	treemode = 0;
+	skip_clause = skip_block = 0;
+	curline = forofs = 0;
+	currups = forlist = NULL;
+
+	if (upsimgpath != default_imgpath)
+		free(upsimgpath);
+	if (upsstatpath != default_statpath)
+		free(upsstatpath);
+	upsimgpath = default_imgpath;
+	upsstatpath = default_statpath;
+}
 
-	extractcgiargs();
+static int handle_request(void)
+{
+	reset_request();
 
-	upscli_init_default_connect_timeout(NULL, NULL, UPSCLI_DEFAULT_CONNECT_TIMEOUT);
+	extractcgiargs();
 
 	printf("Content-type: text/html\n");
 	printf("Pragma: no-cache\n");
 	printf("\n");
 
 	/* if a host is specified, use upsstats-single.html instead */
-	if (monhost) {
-		display_single();
-		exit(EXIT_SUCCESS);
-	}
+	if (monhost)
+		return display_single();
 
 	/* default: multimon replacement mode */
 
-	load_hosts_conf();
+	if (!load_hosts_conf())
+		return EXIT_FAILURE;
+
+	forlist = currups = ulhead;
+
+	return display_template("upsstats.html");
+}
+
+int main(int argc, char **argv)
+{
+	int	ret = EXIT_SUCCESS;
+	NUT_UNUSED_VARIABLE(argc);
+	NUT_UNUSED_VARIABLE(argv);
 
-	currups = ulhead;
+	upscli_init_default_connect_timeout(NULL, NULL, UPSCLI_DEFAULT_CONNECT_TIMEOUT);
 
-	display_template("upsstats.html");
+	/* one request as a CGI program, many as a FastCGI one */
+	while (cgi_accept()) {
+		ret = handle_request();
+		cgi_finish(ret);
+	}
 
-	upscli_disconnect(&ups);
+	cgi_disconnect_all();
 
-	return 0;
+	return ret;
 }
@@ -228,6 +228,9 @@ void nut_report_config_flags(void)
 		now.tv_sec -= 1;
 	}
 
+	/* keep it after the asynchronously logged messages, if any */
+	upslog_flush();
+
 	if (xbit_test(upslog_flags, UPSLOG_STDERR)) {
 		fprintf(stderr, "%4.0f.%06ld\t[D1] Network UPS Tools version %s%s%s%s%s%s%s%s%s%s %s%s\n",
 			difftime(now.tv_sec, upslog_start.tv_sec),
@@ -41,9 +41,15 @@
 #endif
 
 #include <dirent.h>
+#ifdef HAVE_PTHREAD
+# include <pthread.h>
+#endif
 #if !HAVE_DECL_REALPATH
 # include <sys/stat.h>
 #endif
+#if (defined HAVE_MALLOC_H) && (defined HAVE_MALLINFO2)
+# include <malloc.h>	/* mallinfo2() */
+#endif
 
 #if (defined WITH_LIBSYSTEMD_INHIBITOR) && (defined WITH_LIBSYSTEMD && WITH_LIBSYSTEMD) && (defined WITH_LIBSYSTEMD_INHIBITOR && WITH_LIBSYSTEMD_INHIBITOR) && !(defined(WITHOUT_LIBSYSTEMD) && (WITHOUT_LIBSYSTEMD))
 #  ifdef HAVE_SYSTEMD_SD_BUS_H
@@ -3176,14 +3182,443 @@ char * mkstr_dynamic(const char *fmt_dynamic, const char *fmt_reference, ...)
 	return buf;
 }
 
+/* Formatting buffer of vupslog(), kept per thread (or once per process
+ * without threads) and reused between calls, so that logging does not
+ * allocate. A message which needed a much larger buffer does not pin it
+ * for the rest of the run. */
+typedef struct upslog_buf_s {
+	char	*buf;
+	size_t	bufsize;
+	int	busy;	/* in use, e.g. if a signal handler logs meanwhile */
+} upslog_buf_t;
+
+#ifdef HAVE_PTHREAD
+static pthread_key_t	upslog_buf_key;
+static pthread_once_t	upslog_buf_once = PTHREAD_ONCE_INIT;
+static int	upslog_buf_key_ok = 0;
+
+static void upslog_buf_free(void *arg)
+{
+	upslog_buf_t	*lb = (upslog_buf_t *)arg;
+
+	free(lb->buf);
+	free(lb);
+}
+
+static void upslog_buf_key_init(void)
+{
+	upslog_buf_key_ok = (pthread_key_create(&upslog_buf_key, upslog_buf_free) == 0);
+}
+#endif	/* HAVE_PTHREAD */
+
+static upslog_buf_t *upslog_buf_get(void)
+{
+#ifdef HAVE_PTHREAD
+	upslog_buf_t	*lb;
+
+	pthread_once(&upslog_buf_once, upslog_buf_key_init);
+	if (!upslog_buf_key_ok)
+		return NULL;
+
+	lb = (upslog_buf_t *)pthread_getspecific(upslog_buf_key);
+	if (lb == NULL) {
+		/* Not xcalloc() here, we can log without it */
+		lb = (upslog_buf_t *)calloc(1, sizeof(*lb));
+		if (lb == NULL || pthread_setspecific(upslog_buf_key, lb) != 0) {
+			free(lb);
+			return NULL;
+		}
+	}
+
+	return lb;
+#else	/* !HAVE_PTHREAD */
+	static upslog_buf_t	lb = { NULL, 0, 0 };
+
+	return &lb;
+#endif	/* !HAVE_PTHREAD */
+}
+
+/* Seconds and microseconds from upslog_start to <tv>, for the
+ * timestamps of the messages printed to stderr when debugging */
+static void upslog_elapsed(const struct timeval *tv, double *sec, long *usec)
+{
+	struct timeval	now = *tv;
+
+	if (upslog_start.tv_usec > now.tv_usec) {
+		now.tv_usec += 1000000;
+		now.tv_sec -= 1;
+	}
+
+	*sec = difftime(now.tv_sec, upslog_start.tv_sec);
+	*usec = (long)(now.tv_usec - upslog_start.tv_usec);
+}
+
+/* Write one formatted message of vupslog() as <flags> (upslog_flags at
+ * the time it was logged) tell */
+static void upslog_write(int priority, int flags, int debug,
+	const struct timeval *tv, const char *buf)
+{
+	if (xbit_test(flags, UPSLOG_STDERR)) {
+		if (debug) {
+			double	sec;
+			long	usec;
+
+			upslog_elapsed(tv, &sec, &usec);
+
+			/* Print all in one shot, to better avoid
+			 * mixed lines in parallel threads */
+			fprintf(stderr, "%4.0f.%06ld\t%s\n", sec, usec, buf);
+		} else {
+			fprintf(stderr, "%s\n", buf);
+		}
+#ifdef WIN32
+		fflush(stderr);
+#endif	/* WIN32 */
+	}
+	if (xbit_test(flags, UPSLOG_SYSLOG))
+		syslog(priority, "%s", buf);
+}
+
+#if (defined HAVE_PTHREAD) && (defined HAVE___SYNC_SYNCHRONIZE) && !(defined WIN32)
+/* Asynchronous logging, with NUT_DEBUG_ASYNC=<records> in the environment:
+ * vupslog() copies the formatted messages into a bounded lock-free ring
+ * (several threads may log at once, one writer thread takes them out),
+ * and a writer thread hands them to stderr in batches and to syslog, so
+ * that a busy daemon debugging at a high level does not wait for them.
+ *
+ * When the ring is full, debug messages are dropped (and counted in a
+ * later message) while others are written by the caller as before; so
+ * are messages which do not fit a record. The ring is flushed before a
+ * fork(), on fatal errors and at exit.
+ */
+# define UPSLOG_ASYNC	1
+# define UPSLOG_ASYNC_MIN	16
+# define UPSLOG_ASYNC_MAX	65536
+/* How long upslog_flush() waits for the writer, in msec */
+# define UPSLOG_ASYNC_FLUSH_WAIT	2000
+
+typedef struct upslog_rec_s {
+	volatile size_t	seq;	/* ring position this record is free or ready for */
+	int	priority;
+	int	flags;	/* upslog_flags when logged */
+	int	debug;	/* nut_debug_level > 0 when logged */
+	struct timeval	tv;
+	char	msg[LARGEBUF];
+} upslog_rec_t;
+
+static upslog_rec_t	*upslog_ring = NULL;
+static size_t	upslog_ring_size = 0;
+static volatile size_t	upslog_ring_head = 0;	/* next position to fill */
+static volatile size_t	upslog_ring_tail = 0;	/* next position to write */
+static volatile size_t	upslog_ring_done = 0;	/* positions written out */
+static volatile size_t	upslog_ring_dropped = 0;
+
+static pthread_once_t	upslog_async_once = PTHREAD_ONCE_INIT;
+static pthread_t	upslog_writer;
+static pthread_mutex_t	upslog_writer_mutex;
+static pthread_cond_t	upslog_writer_cond;
+static volatile int	upslog_writer_idle = 0;
+static volatile int	upslog_async_running = 0;
+static volatile int	upslog_async_stopping = 0;
+static volatile int	upslog_async_restart = 0;
+
+static void upslog_writer_wake(void)
+{
+	pthread_mutex_lock(&upslog_writer_mutex);
+	pthread_cond_signal(&upslog_writer_cond);
+	pthread_mutex_unlock(&upslog_writer_mutex);
+}
+
+/* Append a message for stderr to the <batch> of the writer thread;
+ * returns 0 if it does not fit there */
+static int upslog_batch_add(char *batch, size_t batchsize, size_t *batchlen,
+	const upslog_rec_t *rec)
+{
+	int	ret;
+
+	if (rec->debug) {
+		double	sec;
+		long	usec;
+
+		upslog_elapsed(&rec->tv, &sec, &usec);
+		ret = snprintf(batch + *batchlen, batchsize - *batchlen,
+			"%4.0f.%06ld\t%s\n", sec, usec, rec->msg);
+	} else {
+		ret = snprintf(batch + *batchlen, batchsize - *batchlen,
+			"%s\n", rec->msg);
+	}
+
+	if (ret < 0)
+		return 1;	/* skip it */
+	if ((size_t)ret >= batchsize - *batchlen)
+		return 0;
+
+	*batchlen += (size_t)ret;
+	return 1;
+}
+
+/* Write the <batch> out; the records taken from the ring so far are done */
+static void upslog_batch_write(const char *batch, size_t *batchlen)
+{
+	if (*batchlen > 0) {
+		fwrite(batch, 1, *batchlen, stderr);
+		fflush(stderr);
+		*batchlen = 0;
+	}
+
+	__sync_synchronize();
+	upslog_ring_done = upslog_ring_tail;
+}
+
+static void *upslog_writer_thread(void *arg)
+{
+	char	batch[LARGEBUF * 8];
+	size_t	batchlen = 0, dropped = 0;
+
+	NUT_UNUSED_VARIABLE(arg);
+
+	for (;;) {
+		upslog_rec_t	*rec = &upslog_ring[upslog_ring_tail & (upslog_ring_size - 1)];
+		size_t	now_dropped;
+
+		if (rec->seq == upslog_ring_tail + 1) {
+			__sync_synchronize();
+
+			if (xbit_test(rec->flags, UPSLOG_STDERR)
+			 && !upslog_batch_add(batch, sizeof(batch), &batchlen, rec)
+			) {
+				/* a record always fits an empty batch */
+				upslog_batch_write(batch, &batchlen);
+				upslog_batch_add(batch, sizeof(batch), &batchlen, rec);
+			}
+			if (xbit_test(rec->flags, UPSLOG_SYSLOG))
+				syslog(rec->priority, "%s", rec->msg);
+
+			__sync_synchronize();
+			rec->seq = upslog_ring_tail + upslog_ring_size;
+			upslog_ring_tail++;
+			continue;
+		}
+
+		/* nothing more for now: write out the batch */
+		upslog_batch_write(batch, &batchlen);
+
+		now_dropped = upslog_ring_dropped;
+		if (now_dropped != dropped) {
+			struct timeval	tv;
+
+			snprintf(batch, sizeof(batch), "upslog: %" PRIuSIZE
+				" debug messages were dropped as the NUT_DEBUG_ASYNC"
+				" queue was full", now_dropped - dropped);
+			gettimeofday(&tv, NULL);
+			upslog_write(LOG_WARNING, upslog_flags, nut_debug_level > 0, &tv, batch);
+			dropped = now_dropped;
+		}
+
+		if (upslog_async_stopping)
+			break;
+
+		pthread_mutex_lock(&upslog_writer_mutex);
+		upslog_writer_idle = 1;
+		__sync_synchronize();
+		if (upslog_ring[upslog_ring_tail & (upslog_ring_size - 1)].seq != upslog_ring_tail + 1
+		 && !upslog_async_stopping
+		) {
+			struct timespec	ts;
+			struct timeval	tv;
+
+			/* producers wake us up; the timeout is a safety net */
+			gettimeofday(&tv, NULL);
+			ts.tv_sec = tv.tv_sec + 1;
+			ts.tv_nsec = tv.tv_usec * 1000;
+			pthread_cond_timedwait(&upslog_writer_cond, &upslog_writer_mutex, &ts);
+		}
+		upslog_writer_idle = 0;
+		pthread_mutex_unlock(&upslog_writer_mutex);
+	}
+
+	return NULL;
+}
+
+static void upslog_async_start(void)
+{
+	sigset_t	all, old;
+	size_t	i;
+
+	for (i = 0; i < upslog_ring_size; i++)
+		upslog_ring[i].seq = i;
+	upslog_ring_head = upslog_ring_tail = upslog_ring_done = 0;
+	upslog_ring_dropped = 0;
+	upslog_writer_idle = 0;
+	upslog_async_stopping = 0;
+	upslog_async_restart = 0;
+
+	pthread_mutex_init(&upslog_writer_mutex, NULL);
+	pthread_cond_init(&upslog_writer_cond, NULL);
+
+	/* signals are for the threads of the program, not the writer */
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+	upslog_async_running = (pthread_create(&upslog_writer, NULL, upslog_writer_thread, NULL) == 0);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+}
+
+/* atexit() handler: write out what was logged and stop the writer */
+static void upslog_async_stop(void)
+{
+	if (!upslog_async_running || upslog_async_restart)
+		return;
+
+	upslog_async_stopping = 1;
+	__sync_synchronize();
+	upslog_writer_wake();
+	pthread_join(upslog_writer, NULL);
+	upslog_async_running = 0;
+}
+
+/* pthread_atfork() child handler: the writer thread stayed with the
+ * parent (which wrote out the ring before forking), start another one
+ * when the child first logs */
+static void upslog_async_forked(void)
+{
+	if (upslog_async_running)
+		upslog_async_restart = 1;
+}
+
+static void upslog_async_init(void)
+{
+	const char	*s = getenv("NUT_DEBUG_ASYNC");
+	long	l;
+	size_t	size;
+
+	if (s == NULL || !str_to_long(s, &l, 10) || l <= 0)
+		return;
+
+	for (size = UPSLOG_ASYNC_MIN; size < (size_t)l && size < UPSLOG_ASYNC_MAX; size *= 2)
+		;
+
+	/* Not xcalloc() here, we can log without it */
+	upslog_ring = (upslog_rec_t *)calloc(size, sizeof(*upslog_ring));
+	if (upslog_ring == NULL)
+		return;
+	upslog_ring_size = size;
+
+	upslog_async_start();
+	if (!upslog_async_running)
+		return;
+
+	atexit(upslog_async_stop);
+	pthread_atfork(upslog_flush, NULL, upslog_async_forked);
+}
+
+/* Queue the message in <buf> for the writer thread; returns 0 if the
+ * caller should rather write it now */
+static int upslog_async_push(int priority, const struct timeval *tv, const char *buf)
+{
+	upslog_rec_t	*rec;
+	size_t	pos, len;
+
+	pthread_once(&upslog_async_once, upslog_async_init);
+	if (upslog_async_restart)
+		upslog_async_start();
+	if (!upslog_async_running || upslog_async_stopping)
+		return 0;
+
+	len = strlen(buf);
+	if (len >= sizeof(rec->msg)) {
+		/* keep it after whatever this thread logged before */
+		upslog_flush();
+		return 0;
+	}
+
+	pos = upslog_ring_head;
+	for (;;) {
+		size_t	seq;
+
+		rec = &upslog_ring[pos & (upslog_ring_size - 1)];
+		seq = rec->seq;
+		__sync_synchronize();
+
+		if (seq == pos) {
+			if (__sync_bool_compare_and_swap(&upslog_ring_head, pos, pos + 1))
+				break;
+			pos = upslog_ring_head;
+		} else if ((intptr_t)(seq - pos) < 0) {
+			/* full: the writer is behind by a whole ring */
+			if (priority != LOG_DEBUG)
+				return 0;
+			__sync_fetch_and_add(&upslog_ring_dropped, 1);
+			return 1;
+		} else {
+			/* another thread took it meanwhile */
+			pos = upslog_ring_head;
+		}
+	}
+
+	rec->priority = priority;
+	rec->flags = upslog_flags;
+	rec->debug = (nut_debug_level > 0);
+	rec->tv = *tv;
+	memcpy(rec->msg, buf, len + 1);
+
+	__sync_synchronize();
+	rec->seq = pos + 1;
+	__sync_synchronize();
+
+	if (upslog_writer_idle)
+		upslog_writer_wake();
+
+	return 1;
+}
+#endif	/* HAVE_PTHREAD && HAVE___SYNC_SYNCHRONIZE && !WIN32 */
+
+void upslog_flush(void)
+{
+#ifdef UPSLOG_ASYNC
+	size_t	target;
+	int	waited;
+
+	if (!upslog_async_running || upslog_async_restart
+	 || pthread_equal(pthread_self(), upslog_writer)
+	)
+		return;
+
+	target = upslog_ring_head;
+	upslog_writer_wake();
+
+	for (waited = 0;
+	     (intptr_t)(upslog_ring_done - target) < 0 && waited < UPSLOG_ASYNC_FLUSH_WAIT;
+	     waited++
+	) {
+		usleep(1000);
+	}
+#endif	/* UPSLOG_ASYNC */
+}
+
 static void vupslog(int priority, const char *fmt, va_list va, int use_strerror)
 {
 	int	ret, errno_orig = errno;
 	size_t	bufsize = LARGEBUF;
-	char	*buf = xcalloc(bufsize, sizeof(char));
+	char	*buf;
+	struct timeval	now;
+	upslog_buf_t	*lb = upslog_buf_get();
+
+	if (lb != NULL && !lb->busy) {
+		lb->busy = 1;
+		if (lb->buf == NULL) {
+			lb->buf = xcalloc(bufsize, sizeof(char));
+			lb->bufsize = bufsize * sizeof(char);
+		}
+		buf = lb->buf;
+		bufsize = lb->bufsize;
+	} else {
+		/* e.g. logging from a signal handler while this thread did */
+		lb = NULL;
+		buf = xcalloc(bufsize, sizeof(char));
 
-	/* Be pedantic about our limitations */
-	bufsize *= sizeof(char);
+		/* Be pedantic about our limitations */
+		bufsize *= sizeof(char);
+	}
 
 #ifdef HAVE_PRAGMAS_FOR_GCC_DIAGNOSTIC_IGNORED_FORMAT_NONLITERAL
 #pragma GCC diagnostic push
@@ -3260,6 +3695,10 @@ static void vupslog(int priority, const char *fmt, va_list va, int use_strerror)
 				}
 				bufsize = newbufsize;
 				buf = xrealloc(buf, bufsize);
+				if (lb != NULL) {
+					lb->buf = buf;
+					lb->bufsize = bufsize;
+				}
 				continue;
 			}
 		} else {
@@ -3326,40 +3765,26 @@ vupslog_too_long:
 
 	/* Note: nowadays debug level can be changed during run-time,
 	 * so mark the starting point whenever we first try to log */
+	gettimeofday(&now, NULL);
 	if (upslog_start.tv_sec == 0) {
-		struct timeval		now;
-
-		gettimeofday(&now, NULL);
 		upslog_start = now;
 	}
 
-	if (xbit_test(upslog_flags, UPSLOG_STDERR)) {
-		if (nut_debug_level > 0) {
-			struct timeval		now;
-
-			gettimeofday(&now, NULL);
-
-			if (upslog_start.tv_usec > now.tv_usec) {
-				now.tv_usec += 1000000;
-				now.tv_sec -= 1;
-			}
+#ifdef UPSLOG_ASYNC
+	if (!upslog_async_push(priority, &now, buf))
+#endif
+		upslog_write(priority, upslog_flags, nut_debug_level > 0, &now, buf);
 
-			/* Print all in one shot, to better avoid
-			 * mixed lines in parallel threads */
-			fprintf(stderr, "%4.0f.%06ld\t%s\n",
-				difftime(now.tv_sec, upslog_start.tv_sec),
-				(long)(now.tv_usec - upslog_start.tv_usec),
-				buf);
-		} else {
-			fprintf(stderr, "%s\n", buf);
+	if (lb != NULL) {
+		if (lb->bufsize > LARGEBUF * 4) {
+			free(lb->buf);
+			lb->buf = NULL;
+			lb->bufsize = 0;
 		}
-#ifdef WIN32
-		fflush(stderr);
-#endif	/* WIN32 */
+		lb->busy = 0;
+	} else {
+		free(buf);
 	}
-	if (xbit_test(upslog_flags, UPSLOG_SYSLOG))
-		syslog(priority, "%s", buf);
-	free(buf);
 }
 
 
@@ -3513,6 +3938,96 @@ void check_unix_socket_filename(const char *fn) {
 		fn, len, max);
 }
 
+/* see nut_listen_fds(): -1 until the environment was looked at */
+static int	listen_fds_count = -1;
+
+int nut_listen_fds(void)
+{
+#ifndef WIN32
+	const char	*s;
+	char	*end;
+	long	pid, n;
+	int	i;
+
+	if (listen_fds_count >= 0)
+		return listen_fds_count;
+
+	listen_fds_count = 0;
+
+	if (!(s = getenv("LISTEN_PID")))
+		return 0;
+	pid = strtol(s, &end, 10);
+	if (*end || pid != (long)getpid()) {
+		upsdebugx(1, "%s: LISTEN_PID=%s is not for us", __func__, s);
+		return 0;
+	}
+
+	if (!(s = getenv("LISTEN_FDS")))
+		return 0;
+	n = strtol(s, &end, 10);
+	if (*end || n < 0 || n > 1024) {
+		upslogx(LOG_WARNING, "Ignoring invalid LISTEN_FDS=%s", s);
+		return 0;
+	}
+
+	unsetenv("LISTEN_PID");
+	unsetenv("LISTEN_FDS");
+	unsetenv("LISTEN_FDNAMES");
+
+	/* ours only, not for whatever we may start */
+	for (i = 0; i < (int)n; i++) {
+		int	flags = fcntl(NUT_LISTEN_FDS_START + i, F_GETFD);
+
+		if (flags != -1)
+			fcntl(NUT_LISTEN_FDS_START + i, F_SETFD, flags | FD_CLOEXEC);
+	}
+
+	listen_fds_count = (int)n;
+	upsdebugx(1, "%s: got %d socket(s) from the service manager", __func__, listen_fds_count);
+#else	/* WIN32 */
+	listen_fds_count = 0;
+#endif	/* WIN32 */
+
+	return listen_fds_count;
+}
+
+TYPE_FD nut_listen_fd_unix(const char *path)
+{
+#ifndef WIN32
+	int	i, n = nut_listen_fds();
+
+	for (i = 0; i < n; i++) {
+		int	fd = NUT_LISTEN_FDS_START + i;
+		struct sockaddr_un	ssaddr;
+		socklen_t	len = sizeof(ssaddr);
+#ifdef SO_ACCEPTCONN
+		int	listening = 0;
+		socklen_t	optlen = sizeof(listening);
+
+		if (getsockopt(fd, SOL_SOCKET, SO_ACCEPTCONN, &listening, &optlen) != 0
+		 || !listening
+		) {
+			continue;
+		}
+#endif	/* SO_ACCEPTCONN */
+
+		memset(&ssaddr, 0, sizeof(ssaddr));
+		if (getsockname(fd, (struct sockaddr *)&ssaddr, &len) != 0
+		 || ssaddr.sun_family != AF_UNIX
+		) {
+			continue;
+		}
+
+		if (!strncmp(ssaddr.sun_path, path, sizeof(ssaddr.sun_path)))
+			return fd;
+	}
+#else	/* WIN32 */
+	NUT_UNUSED_VARIABLE(path);
+#endif	/* WIN32 */
+
+	return ERROR_FD;
+}
+
 /* logs the formatted string to any configured logging devices + the output of strerror(errno) */
 void upslog_with_errno(int priority, const char *fmt, ...)
 {
@@ -3831,6 +4346,9 @@ static void vfatal(const char *fmt, va_list va, int use_strerror)
 #ifdef HAVE_PRAGMAS_FOR_GCC_DIAGNOSTIC_IGNORED_FORMAT_NONLITERAL
 #pragma GCC diagnostic pop
 #endif
+
+	/* the caller exits next, make sure this is out */
+	upslog_flush();
 }
 
 void fatal_with_errno(int status, const char *fmt, ...)
@@ -3889,6 +4407,76 @@ void fatalx(int status, const char *fmt, ...)
 
 static const char *oom_msg = "Out of memory";
 
+/* the tags accounted for so far, in the order they were first used */
+static nut_mem_tag_t	*mem_tags = NULL, **mem_tags_tail = &mem_tags;
+
+/* whether the x*alloc() wrappers count under xalloc_tag */
+static int	mem_enabled = 0;
+static nut_mem_tag_t	xalloc_tag = { "xalloc", 1, 0, 0, 0, 0, 0, NULL };
+
+void nut_mem_enable(void)
+{
+	mem_enabled = 1;
+}
+
+void nut_mem_add(nut_mem_tag_t *tag, size_t size)
+{
+	if (!tag->listed) {
+		tag->listed = 1;
+		*mem_tags_tail = tag;
+		mem_tags_tail = &tag->next;
+	}
+
+	tag->allocs++;
+	tag->bytes += size;
+
+	if (tag->nofree) {
+		return;
+	}
+
+	tag->live += size;
+	if (tag->live > tag->peak) {
+		tag->peak = tag->live;
+	}
+}
+
+void nut_mem_sub(nut_mem_tag_t *tag, size_t size)
+{
+	if (tag->nofree) {
+		return;
+	}
+
+	tag->live = (tag->live > size) ? tag->live - size : 0;
+}
+
+const nut_mem_tag_t *nut_mem_tags(void)
+{
+	return mem_tags;
+}
+
+size_t nut_mem_heap(size_t *peak)
+{
+	static size_t	heap_peak = 0;
+	size_t	heap = 0;
+
+#if (defined HAVE_MALLOC_H) && (defined HAVE_MALLINFO2)
+	struct mallinfo2	mi = mallinfo2();
+
+	/* in use from the arenas, and in chunks mapped on their own */
+	heap = mi.uordblks + mi.hblkhd;
+#endif
+
+	if (heap > heap_peak) {
+		heap_peak = heap;
+	}
+
+	if (peak) {
+		*peak = heap_peak;
+	}
+
+	return heap;
+}
+
 void *xmalloc(size_t size)
 {
 	void *p = malloc(size);
@@ -3896,6 +4484,9 @@ void *xmalloc(size_t size)
 	if (p == NULL)
 		fatal_with_errno(EXIT_FAILURE, "%s", oom_msg);
 
+	if (mem_enabled)
+		nut_mem_add(&xalloc_tag, size);
+
 #ifdef WIN32
 	/* FIXME: This is what (x)calloc() is for! */
 	memset(p, 0, size);
@@ -3911,6 +4502,9 @@ void *xcalloc(size_t number, size_t size)
 	if (p == NULL)
 		fatal_with_errno(EXIT_FAILURE, "%s", oom_msg);
 
+	if (mem_enabled)
+		nut_mem_add(&xalloc_tag, number * size);
+
 #ifdef WIN32
 	/* FIXME: calloc() above should have initialized this already! */
 	memset(p, 0, size * number);
@@ -3925,6 +4519,10 @@ void *xrealloc(void *ptr, size_t size)
 
 	if (p == NULL)
 		fatal_with_errno(EXIT_FAILURE, "%s", oom_msg);
+
+	if (mem_enabled)
+		nut_mem_add(&xalloc_tag, size);
+
 	return p;
 }
 
@@ -3941,6 +4539,10 @@ char *xstrdup(const char *string)
 
 	if (p == NULL)
 		fatal_with_errno(EXIT_FAILURE, "%s", oom_msg);
+
+	if (mem_enabled)
+		nut_mem_add(&xalloc_tag, strlen(p) + 1);
+
 	return p;
 }
 
@@ -4796,3 +5398,265 @@ const char *inet_ntopAI(struct addrinfo *ai)
 			return NULL;
 	}
 }
+
+/* WA for Solaris/i386 bug: non-blocking connect sets errno to ENOENT */
+#if (defined NUT_PLATFORM_SOLARIS)
+#	define SOLARIS_i386_NBCONNECT_ENOENT(status) ( (!strcmp("i386", CPU_TYPE)) ? (ENOENT == (status)) : 0 )
+#else
+#	define SOLARIS_i386_NBCONNECT_ENOENT(status) (0)
+#endif  /* end of Solaris/i386 WA for non-blocking connect */
+
+/* WA for AIX bug: non-blocking connect sets errno to 0 */
+#if (defined NUT_PLATFORM_AIX)
+#	define AIX_NBCONNECT_0(status) (0 == (status))
+#else
+#	define AIX_NBCONNECT_0(status) (0)
+#endif  /* end of AIX WA for non-blocking connect */
+
+/* milliseconds elapsed since <start> */
+static long connect_ai_elapsed(const struct timeval *start)
+{
+	struct timeval	now;
+
+	gettimeofday(&now, NULL);
+	return (long)(now.tv_sec - start->tv_sec) * 1000
+		+ (long)(now.tv_usec - start->tv_usec) / 1000;
+}
+
+static int connect_ai_nonblock(int fd, int on)
+{
+#ifndef WIN32
+	long	fd_flags = fcntl(fd, F_GETFL);
+
+	if (fd_flags < 0) {
+		return -1;
+	}
+	if (on) {
+		fd_flags |= O_NONBLOCK;
+	} else {
+		fd_flags &= ~O_NONBLOCK;
+	}
+	return fcntl(fd, F_SETFL, fd_flags);
+#else	/* WIN32 */
+	unsigned long	argp = on ? 1 : 0;
+
+	return ioctlsocket((SOCKET)fd, FIONBIO, &argp);
+#endif	/* WIN32 */
+}
+
+static void connect_ai_close(int fd)
+{
+#ifndef WIN32
+	close(fd);
+#else	/* WIN32 */
+	closesocket((SOCKET)fd);
+#endif	/* WIN32 */
+}
+
+/* whether <ai> holds the address saved in <addr> */
+static int connect_ai_match(const struct addrinfo *ai, const struct sockaddr_storage *addr)
+{
+	return ai->ai_addr
+		&& (size_t)ai->ai_addrlen <= sizeof(*addr)
+		&& ai->ai_family == addr->ss_family
+		&& !memcmp(ai->ai_addr, addr, (size_t)ai->ai_addrlen);
+}
+
+int connect_ai_race(struct addrinfo *res, const struct timeval *timeout,
+	struct sockaddr_storage *last)
+{
+	struct addrinfo	*ai, **cand;
+	int	*fds;
+	size_t	i, j, ncand = 0, next = 0, inflight = 0;
+	int	fd = -1, err = ECONNREFUSED, winner = -1;
+	long	total = -1, started = 0, elapsed, wait;
+	struct timeval	start, tv;
+	fd_set	wfds;
+
+	for (ai = res; ai != NULL; ai = ai->ai_next) {
+		ncand++;
+	}
+	if (ncand == 0) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	cand = (struct addrinfo **)xcalloc(ncand, sizeof(*cand));
+	fds = (int *)xcalloc(ncand, sizeof(*fds));
+
+	/* the address which answered last time goes first, then the
+	 * families take turns, in the order of getaddrinfo() otherwise */
+	for (ai = res; ai != NULL; ai = ai->ai_next) {
+		if (last && last->ss_family != 0 && connect_ai_match(ai, last)) {
+			cand[next++] = ai;
+			break;
+		}
+	}
+	for (i = next; i < ncand; i++) {
+		struct addrinfo	*pick = NULL, *same = NULL;
+
+		for (ai = res; ai != NULL; ai = ai->ai_next) {
+			for (j = 0; j < i; j++) {
+				if (cand[j] == ai) {
+					break;
+				}
+			}
+			if (j < i) {
+				continue;
+			}
+			if (i == 0 || ai->ai_family != cand[i - 1]->ai_family) {
+				pick = ai;
+				break;
+			}
+			if (!same) {
+				same = ai;
+			}
+		}
+		cand[i] = pick ? pick : same;
+	}
+	next = 0;
+
+	if (timeout) {
+		total = (long)timeout->tv_sec * 1000 + (long)timeout->tv_usec / 1000;
+	}
+	gettimeofday(&start, NULL);
+
+	while (winner < 0) {
+		elapsed = connect_ai_elapsed(&start);
+
+		if (total >= 0 && elapsed >= total) {
+			err = ETIMEDOUT;
+			break;
+		}
+
+		/* start the next attempt when the others failed, or did not
+		 * make it within the delay */
+		if (next < ncand && (inflight == 0
+		 || elapsed - started >= CONNECT_AI_ATTEMPT_DELAY)
+		) {
+			ai = cand[next];
+			fd = (int)socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+			if (fd < 0) {
+				err = errno;
+				cand[next++] = NULL;
+				continue;
+			}
+			connect_ai_nonblock(fd, 1);
+
+			if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) {
+				fds[next] = fd;
+				winner = (int)next++;
+				break;
+			}
+#ifndef WIN32
+			if (errno == EINPROGRESS || errno == EINTR
+			 || SOLARIS_i386_NBCONNECT_ENOENT(errno) || AIX_NBCONNECT_0(errno)
+			) {
+#else	/* WIN32 */
+			if (WSAGetLastError() == WSAEWOULDBLOCK) {
+#endif	/* WIN32 */
+				fds[next++] = fd;
+				inflight++;
+				started = elapsed;
+				continue;
+			}
+
+			err = errno;
+			connect_ai_close(fd);
+			cand[next++] = NULL;
+			continue;
+		}
+
+		if (inflight == 0) {
+			/* nothing left to try */
+			break;
+		}
+
+		/* wait for an attempt to finish, the next one to start,
+		 * or the time to run out */
+		wait = -1;
+		if (next < ncand) {
+			wait = CONNECT_AI_ATTEMPT_DELAY - (elapsed - started);
+		}
+		if (total >= 0 && (wait < 0 || total - elapsed < wait)) {
+			wait = total - elapsed;
+		}
+		if (wait < 0 && (next < ncand || total >= 0)) {
+			wait = 0;
+		}
+
+		FD_ZERO(&wfds);
+		fd = -1;
+		for (i = 0; i < next; i++) {
+			if (cand[i]) {
+				FD_SET(fds[i], &wfds);
+				if (fds[i] > fd) {
+					fd = fds[i];
+				}
+			}
+		}
+
+		tv.tv_sec = wait / 1000;
+		tv.tv_usec = (wait % 1000) * 1000;
+		if (select(fd + 1, NULL, &wfds, NULL, wait >= 0 ? &tv : NULL) < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			err = errno;
+			break;
+		}
+
+		for (i = 0; i < next; i++) {
+			int	error = 0;
+			socklen_t	error_size = sizeof(error);
+
+			if (!cand[i] || !FD_ISSET(fds[i], &wfds)) {
+				continue;
+			}
+
+			getsockopt(fds[i], SOL_SOCKET, SO_ERROR,
+#ifdef WIN32
+				(char *)
+#endif	/* WIN32 */
+				&error, &error_size);
+			if (error == 0) {
+				winner = (int)i;
+				break;
+			}
+
+			err = error;
+			connect_ai_close(fds[i]);
+			cand[i] = NULL;
+			inflight--;
+
+			/* no need to wait for the delay then */
+			started = connect_ai_elapsed(&start) - CONNECT_AI_ATTEMPT_DELAY;
+		}
+	}
+
+	/* the losers of the race are dropped */
+	for (i = 0; i < next; i++) {
+		if (cand[i] && (int)i != winner) {
+			connect_ai_close(fds[i]);
+		}
+	}
+
+	fd = -1;
+	if (winner >= 0) {
+		fd = fds[winner];
+		connect_ai_nonblock(fd, 0);
+
+		if (last && (size_t)cand[winner]->ai_addrlen <= sizeof(*last)) {
+			memset(last, 0, sizeof(*last));
+			memcpy(last, cand[winner]->ai_addr, (size_t)cand[winner]->ai_addrlen);
+		}
+	}
+
+	free(fds);
+	free(cand);
+
+	if (fd < 0) {
+		errno = err;
+	}
+	return fd;
+}
@@ -241,6 +241,19 @@ std::string NutParser::parseSTRCHARS()
 	return str;
 }
 
+/* Characters which go on an unquoted STRING as they are, and those which
+ * go on a QUOTED_STRING: parseToken() takes runs of them in one go */
+static inline bool isPlainStringChar(char c, bool colon)
+{
+	return isgraph(c) && c != '"' && c != '#' && c != '[' && c != ']'
+		&& c != '=' && c != '\\' && !(c == ':' && colon);
+}
+
+static inline bool isPlainQuotedChar(char c)
+{
+	return (c == ' ' || c == '\t' || isgraph(c)) && c != '"' && c != '\\';
+}
+
 /** Parse a string source for getting the next token, ignoring spaces.
  * \return Token type.
  */
@@ -329,6 +342,13 @@ NutParser::Token NutParser::parseToken()
 					}
 				} else if (c == ' ' || c == '\t' || isgraph(c)) {
 					token.str += c;
+					if (!escaped) {
+						size_t end = _pos;
+						while (end < _buffer.size() && isPlainQuotedChar(_buffer[end]))
+							end++;
+						token.str.append(_buffer, _pos, end - _pos);
+						_pos = end;
+					}
 				} else if (c == '\r' || c == '\n') /* EOL */{
 					/* WTF ? consider it as correct ? */
 					back();
@@ -373,6 +393,14 @@ NutParser::Token NutParser::parseToken()
 					return token;
 				}else if (isgraph(c)) {
 					token.str += c;
+					if (!escaped) {
+						bool colon = !hasOptions(OPTION_IGNORE_COLON);
+						size_t end = _pos;
+						while (end < _buffer.size() && isPlainStringChar(_buffer[end], colon))
+							end++;
+						token.str.append(_buffer, _pos, end - _pos);
+						_pos = end;
+					}
 				} else /* Bad character ?? */ {
 					/* WTF ? Keep, Ignore ? */
 				}
@@ -540,7 +568,7 @@ void NutConfigParser::parseConfig()
 						break;
 					case Token::TOKEN_STRING:
 					case Token::TOKEN_QUOTED_STRING:
-						name = tok.str;
+						name = std::move(tok.str);
 						state = CPS_DIRECTIVE_HAVE_NAME;
 						break;
 
@@ -560,7 +588,7 @@ void NutConfigParser::parseConfig()
 					case Token::TOKEN_STRING:
 					case Token::TOKEN_QUOTED_STRING:
 						/* Should occur ! */
-						name = tok.str;
+						name = std::move(tok.str);
 						state = CPS_SECTION_HAVE_NAME;
 						break;
 					case Token::TOKEN_BRACKET_CLOSE:
@@ -680,7 +708,7 @@ void NutConfigParser::parseConfig()
 					case Token::TOKEN_STRING:
 					case Token::TOKEN_QUOTED_STRING:
 						/* Could occur ! */
-						values.push_back(tok.str);
+						values.push_back(std::move(tok.str));
 						state = CPS_DIRECTIVE_VALUES;
 						break;
 
@@ -716,7 +744,7 @@ void NutConfigParser::parseConfig()
 					case Token::TOKEN_STRING:
 					case Token::TOKEN_QUOTED_STRING:
 						/* Could occur ! */
-						values.push_back(tok.str);
+						values.push_back(std::move(tok.str));
 						state = CPS_DIRECTIVE_VALUES;
 						break;
 
@@ -826,10 +854,9 @@ void DefaultConfigParser::onParseDirective(
 	// Separator has no specific semantic in this context
 
 	// Save values
-	_section.entries[directiveName].name = directiveName;
-	_section.entries[directiveName].values = values;
-
-	// TODO Can probably be optimized.
+	GenericConfigSectionEntry& entry = _section.entries[directiveName];
+	entry.name = directiveName;
+	entry.values = values;
 }
 
 void DefaultConfigParser::onParseEnd()
@@ -898,6 +925,7 @@ void GenericConfigParser::onParseSection(const GenericConfigSection& section)
 
 void GenericConfiguration::setGenericConfigSection(const GenericConfigSection& section)
 {
+	touch(section.name);
 	sections[section.name] = section;
 }
 
@@ -989,6 +1017,8 @@ void GenericConfiguration::set(const std::string & section, const std::string &
 
 	// Set parameters values
 	entry_iter->second.values = params;
+
+	touch(section);
 }
 
 
@@ -1028,6 +1058,8 @@ void GenericConfiguration::remove(const std::string & section, const std::string
 		return;
 
 	entries.erase(entry_iter);
+
+	touch(section);
 }
 
 
@@ -1039,6 +1071,8 @@ void GenericConfiguration::removeSection(const std::string & section)
 		return;
 
 	sections.erase(section_iter);
+
+	touch(section);
 }
 
 
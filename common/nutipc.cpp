@@ -44,8 +44,13 @@
 #include "nutstream.hpp"
 
 #include <iostream>
+#include <vector>
 #include <sys/stat.h>
 
+#ifdef NUT_IPC_POSIX_SPAWN
+extern char **environ;
+#endif
+
 
 namespace nut {
 
@@ -175,11 +180,182 @@ Process::Executor::Executor(const std::string & command) {
 }
 
 
+void Process::Executor::redirect(int fd, int from) {
+	FileAction action;
+
+	action.fd    = fd;
+	action.from  = from;
+	action.flags = 0;
+	action.mode  = 0;
+
+	m_actions.push_back(action);
+}
+
+
+void Process::Executor::redirect(int fd, const std::string & path, int flags, mode_t mode) {
+	FileAction action;
+
+	action.fd    = fd;
+	action.from  = -1;
+	action.path  = path;
+	action.flags = flags;
+	action.mode  = mode;
+
+	m_actions.push_back(action);
+}
+
+
+void Process::Executor::close(int fd) {
+	FileAction action;
+
+	action.fd    = fd;
+	action.from  = -2;
+	action.flags = 0;
+	action.mode  = 0;
+
+	m_actions.push_back(action);
+}
+
+
+pid_t Process::Executor::spawn() const
+#if (defined __cplusplus) && (__cplusplus < 201100)
+	throw(std::runtime_error)
+#endif
+{
+#ifdef WIN32
+	std::stringstream e;
+
+	e << "Can't spawn " << m_bin << ": not implemented on this platform yet";
+
+	/* NUT_WIN32_INCOMPLETE(); */
+	throw std::runtime_error(e.str());
+#elif (defined NUT_IPC_POSIX_SPAWN)
+	std::vector<const char *> argv;
+
+	argv.reserve(m_args.size() + 2);
+	argv.push_back(m_bin.c_str());
+
+	Arguments::const_iterator arg = m_args.begin();
+
+	for (; arg != m_args.end(); ++arg)
+		argv.push_back((*arg).c_str());
+
+	argv.push_back(nullptr);
+
+	posix_spawn_file_actions_t actions;
+	posix_spawn_file_actions_t * actions_p = nullptr;
+
+	int status = 0;
+
+	if (!m_actions.empty()) {
+		status = ::posix_spawn_file_actions_init(&actions);
+
+		if (0 == status)
+			actions_p = &actions;
+
+		FileActions::const_iterator action = m_actions.begin();
+
+		for (; 0 == status && action != m_actions.end(); ++action) {
+			if (-1 == action->from)
+				status = ::posix_spawn_file_actions_addopen(&actions,
+					action->fd, action->path.c_str(),
+					action->flags, action->mode);
+
+			else if (-2 == action->from)
+				status = ::posix_spawn_file_actions_addclose(&actions,
+					action->fd);
+
+			else
+				status = ::posix_spawn_file_actions_adddup2(&actions,
+					action->from, action->fd);
+		}
+	}
+
+	pid_t pid = -1;
+
+	if (0 == status)
+		status = ::posix_spawnp(&pid, argv[0], actions_p, nullptr,
+			const_cast<char * const *>(&argv[0]), environ);
+
+	if (nullptr != actions_p)
+		::posix_spawn_file_actions_destroy(actions_p);
+
+	if (0 != status) {
+		std::stringstream e;
+
+		e << "Failed to spawn binary " << m_bin << ": "
+			<< status << ": " << strerror(status);
+
+		throw std::runtime_error(e.str());
+	}
+
+	return pid;
+#else	/* !WIN32 && !NUT_IPC_POSIX_SPAWN */
+	pid_t pid = ::fork();
+
+	if (-1 == pid) {
+		int erno = errno;
+
+		std::stringstream e;
+
+		e << "Failed to fork for binary " << m_bin << ": "
+			<< erno << ": " << strerror(erno);
+
+		throw std::runtime_error(e.str());
+	}
+
+	if (!pid)
+		::exit(const_cast<Executor &>(*this)());
+
+	return pid;
+#endif	/* !WIN32 && !NUT_IPC_POSIX_SPAWN */
+}
+
+
 int Process::Executor::operator () ()
 #if (defined __cplusplus) && (__cplusplus < 201100)
 	throw(std::runtime_error)
 #endif
 {
+#ifndef WIN32
+	FileActions::const_iterator action = m_actions.begin();
+
+	for (; action != m_actions.end(); ++action) {
+		int status;
+
+		if (-2 == action->from) {
+			status = ::close(action->fd);
+		}
+		else {
+			int from = action->from;
+
+			if (-1 == from)
+				from = ::open(action->path.c_str(), action->flags, action->mode);
+
+			status = from;
+
+			if (-1 != from && from != action->fd) {
+				status = ::dup2(from, action->fd);
+
+				if (-1 == action->from)
+					::close(from);
+			}
+		}
+
+		if (-1 == status) {
+			int erno = errno;
+
+			std::stringstream e;
+
+			e << "Failed to set up descriptor " << action->fd
+				<< " for binary " << m_bin << ": "
+				<< erno << ": " << strerror(erno);
+
+			throw std::runtime_error(e.str());
+		}
+	}
+#endif	/* !WIN32 */
+
 	const char ** args_c_str = new const char *[m_args.size() + 2];
 
 	const char * bin_c_str = m_bin.c_str();
@@ -602,6 +602,44 @@ bool NutFile::remove(int & err_code, std::string & err_msg)
 }
 
 
+bool NutFile::rename(const std::string & new_name, int & err_code, std::string & err_msg)
+#if (defined __cplusplus) && (__cplusplus < 201100)
+		throw()
+#endif
+{
+	/* Can not rename an unknown file name */
+	if (m_name.empty()) {
+		err_code = ENOENT;
+		err_msg  = std::string("No file name was specified");
+		return false;
+	}
+
+#ifdef WIN32
+	/* Unlike POSIX rename(), the Windows one does not replace
+	 * an existing file */
+	if (!MoveFileExA(m_name.c_str(), new_name.c_str(),
+		MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH)
+	) {
+		err_code = static_cast<int>(GetLastError());
+		err_msg  = std::string("MoveFileEx() failed");
+		return false;
+	}
+#else	/* !WIN32 */
+	if (0 != ::rename(m_name.c_str(), new_name.c_str())) {
+		err_code = errno;
+
+		err_msg = std::string(::strerror(err_code));
+
+		return false;
+	}
+#endif	/* !WIN32 */
+
+	err_code = 0;
+
+	return true;
+}
+
+
 NutFile::NutFile(const std::string & name, access_t mode):
 	m_name(name),
 	m_impl(nullptr),
@@ -710,20 +748,33 @@ NutStream::status_t NutFile::getString(std::string & str)
 	if (nullptr == m_impl)
 		return NUTS_ERROR;
 
-	// Note that ::fgetc is used instead of ::fgets
-	// That's because of \0 char. support
+	// Make room for (the rest of) a regular file at once
+	struct stat st;
+	long pos = ::ftell(m_impl);
+
+	if (0 == ::fstat(fileno(m_impl), &st) && S_ISREG(st.st_mode)
+	&&  pos >= 0 && st.st_size > pos
+	) {
+		str.reserve(str.size() + static_cast<size_t>(st.st_size - pos) + 65536);
+	}
+
+	// Read in large blocks: ::fread (unlike ::fgets) keeps \0 characters
 	for (;;) {
-		char ch;
+		static const size_t block = 65536;	// as reserved above
+		size_t len = str.size();
 
-		status_t status = fgetcWrapper(m_impl, ch);
+		str.resize(len + block);
 
-		if (NUTS_ERROR == status)
-			return status;
+		size_t got = ::fread(&str[len], 1, block, m_impl);
 
-		if (NUTS_EOF == status)
-			return NUTS_OK;
+		str.resize(len + got);
+
+		if (got < block) {
+			if (::ferror(m_impl))
+				return NUTS_ERROR;
 
-		str += ch;
+			return NUTS_OK;
+		}
 	}
 }
 
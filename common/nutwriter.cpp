@@ -965,25 +965,66 @@ NutWriter::status_t GenericConfigWriter::writeSection(const GenericConfigSection
 
 
 NutWriter::status_t GenericConfigWriter::writeConfig(const GenericConfiguration & config) {
+	status_t status = NUTW_OK;
+
+	// Sections serialised by another kind of writer differ
+	if (config.m_serialised_by && *config.m_serialised_by != typeid(*this))
+		config.m_serialised.clear();
+
+	std::string buffer;
+	GenericConfiguration::SerialisedSectionMap serialised;
+
+	m_buffer = &buffer;
+
 	// Write sections
 	// Note that lexicographic ordering places the global
 	// (i.e. empty-name) section as the first one
 	GenericConfiguration::SectionMap::const_iterator section_iter = config.sections.begin();
 
 	for (; section_iter != config.sections.end(); ++section_iter) {
-		status_t status = writeSection(section_iter->second);
+		std::string & text = serialised.insert(serialised.end(),
+			std::pair<const std::string, std::string>(section_iter->first, std::string()))->second;
+
+		// Reuse sections not changed since they were last written
+		GenericConfiguration::SerialisedSectionMap::iterator cached =
+			config.m_serialised.find(section_iter->first);
+
+		if (config.m_serialised.end() != cached) {
+			text.swap(cached->second);
+			buffer += text;
+
+			continue;
+		}
+
+		size_t start = buffer.size();
+
+		status = writeSection(section_iter->second);
 
 		if (NUTW_OK != status)
-			return status;
+			break;
 
 		// TBD: Write one empty line as section separator
 		status = write(eol);
 
 		if (NUTW_OK != status)
-			return status;
+			break;
+
+		text.assign(buffer, start, std::string::npos);
 	}
 
-	return NUTW_OK;
+	m_buffer = nullptr;
+
+	if (NUTW_OK != status) {
+		config.m_serialised.clear();
+
+		return status;
+	}
+
+	// Remember the sections as written now (only)
+	config.m_serialised.swap(serialised);
+	config.m_serialised_by = &typeid(*this);
+
+	return write(buffer);
 }
 
 
@@ -27,7 +27,8 @@
  * All subsequent calls must have it as the first argument.  There are
  * two entry points for parsing lines.  You can have it read a file
  * (pconf_file_begin and pconf_file_next), take lines directly from
- * the caller (pconf_line), or go along a character at a time (pconf_char).
+ * the caller (pconf_line), or go along a character at a time (pconf_char)
+ * or a buffer at a time (pconf_buf).
  * The parsing is identical no matter how you feed it.
  *
  * Since there are no more callbacks, you take the successful return
@@ -74,6 +75,11 @@
  * Finally, there is argsize, which remembers how long each of the
  * arglist elements are.  This is how we know when to expand them.
  *
+ * For network sockets, pconf_buf looks for whole lines in the data
+ * received and splits the simple ones (plain words and "quoted words"
+ * without escapes or comments) in one go; anything else goes through
+ * the state machine above, so the result does not depend on the path.
+ *
  */
 
 #include "config.h" /* should be first */
@@ -117,10 +123,9 @@ static void pconf_fatal(PCONF_CTX_t *ctx, const char *errtxt)
 	exit(EXIT_FAILURE);
 }
 
-static void add_arg_word(PCONF_CTX_t *ctx)
+static void add_arg_mem(PCONF_CTX_t *ctx, const char *word, size_t wbuflen)
 {
 	size_t	argpos;
-	size_t	wbuflen;
 
 	/* this is where the new value goes */
 	argpos = ctx->numargs;
@@ -149,8 +154,6 @@ static void add_arg_word(PCONF_CTX_t *ctx)
 		ctx->argsize[argpos] = 0;
 	}
 
-	wbuflen = strlen(ctx->wordbuf);
-
 	/* now see if the string itself grew compared to last time */
 	if (wbuflen >= ctx->argsize[argpos]) {
 		size_t	newlen;
@@ -168,11 +171,14 @@ static void add_arg_word(PCONF_CTX_t *ctx)
 		ctx->argsize[argpos] = newlen;
 	}
 
-	/* strncpy doesn't give us a trailing NULL, so prep the space */
-	memset(ctx->arglist[argpos], '\0', ctx->argsize[argpos]);
-
 	/* finally copy the new value into the provided space */
-	strncpy(ctx->arglist[argpos], ctx->wordbuf, wbuflen);
+	memcpy(ctx->arglist[argpos], word, wbuflen);
+	ctx->arglist[argpos][wbuflen] = '\0';
+}
+
+static void add_arg_word(PCONF_CTX_t *ctx)
+{
+	add_arg_mem(ctx, ctx->wordbuf, strlen(ctx->wordbuf));
 }
 
 static void addchar(PCONF_CTX_t *ctx)
@@ -595,41 +601,222 @@ int pconf_line(PCONF_CTX_t *ctx, const char *line)
 
 #define PCONF_ESCAPE "#\\\""
 
+/* nonzero if pconf_encode() would change src: most values (numbers,
+ * status tokens) have nothing to escape, and strcspn() is the vectorized
+ * scan of the C library */
+int pconf_encode_needed(const char *src)
+{
+	return src[strcspn(src, PCONF_ESCAPE)] != '\0';
+}
+
 char *pconf_encode(const char *src, char *dest, size_t destsize)
 {
-	size_t	i, srclen, destlen, maxlen;
+	size_t	run, destlen, maxlen;
 
 	if (destsize < 1)
 		return dest;
 
-	memset(dest, '\0', destsize);
-
 	/* always leave room for a final NULL */
 	maxlen = destsize - 1;
-	srclen = strlen(src);
 	destlen = 0;
 
-	for (i = 0; i < srclen; i++) {
-		if (strchr(PCONF_ESCAPE, src[i])) {
+	/* copy the runs between the characters to escape in blocks */
+	while (*src) {
+		run = strcspn(src, PCONF_ESCAPE);
 
-			/* if they both won't fit, we're done */
-			if (destlen >= maxlen - 1)
-				return dest;
+		if (run > maxlen - destlen)
+			run = maxlen - destlen;
 
-			dest[destlen++] = '\\';
-		}
+		memcpy(dest + destlen, src, run);
+		destlen += run;
+		src += run;
 
-		/* bail out when dest is full */
-		if (destlen >= maxlen)
-			return dest;
+		/* done, or bail out when dest is full */
+		if (!*src || destlen >= maxlen)
+			break;
+
+		/* if they both won't fit, we're done */
+		if (destlen >= maxlen - 1)
+			break;
 
-		dest[destlen++] = src[i];
+		dest[destlen++] = '\\';
+		dest[destlen++] = *src++;
 	}
 
+	dest[destlen] = '\0';
+
 	return dest;
 }
 
+/* split a complete line (without its newline) if it only has plain words
+ * and "quoted words" free of escapes, comments and control characters;
+ * returns 0 without consuming anything for the state machine to do it */
+static int split_simple_line(PCONF_CTX_t *ctx, const char *line, size_t len)
+{
+	size_t	i = 0, start, wlen;
+	const unsigned char	*p = (const unsigned char *)line;
+
+	/* everything has to be checked first, as words are committed */
+	for (i = 0; i < len; i++) {
+		if (p[i] == '\\' || p[i] == '#' || p[i] == '=') {
+			return 0;
+		}
+		if ((p[i] < 0x20 && p[i] != '\t' && p[i] != '\r') || p[i] > 0x7f) {
+			return 0;
+		}
+	}
+
+	i = 0;
+	while (i < len) {
+		int	quoted = 0;
+
+		if (p[i] == ' ' || p[i] == '\t' || p[i] == '\r') {
+			i++;
+			continue;
+		}
+
+		if (p[i] == '"') {
+			const char	*q;
+
+			quoted = 1;
+			start = ++i;
+			q = memchr(line + start, '"', len - start);
+			if (!q) {
+				/* goes on past the end of line, let the machine say */
+				ctx->numargs = 0;
+				return 0;
+			}
+			i = (size_t)(q - line);
+
+			/* addchar() would drop these from a quoted word */
+			if (memchr(line + start, '\t', i - start)
+			||  memchr(line + start, '\r', i - start)) {
+				ctx->numargs = 0;
+				return 0;
+			}
+		} else {
+			/* a quote inside a bare word is just a character */
+			start = i;
+			while (i < len && p[i] != ' ' && p[i] != '\t' && p[i] != '\r') {
+				i++;
+			}
+		}
+
+		wlen = i - start;
+		if (quoted) {
+			i++;	/* skip the closing quote */
+		}
+
+		/* same limits as addchar() and endofword() */
+		if (ctx->wordlen_limit != 0 && wlen > ctx->wordlen_limit) {
+			wlen = ctx->wordlen_limit;
+		}
+		if (ctx->arg_limit == 0 || ctx->numargs < ctx->arg_limit) {
+			add_arg_mem(ctx, line + start, wlen);
+		}
+	}
+
+	return 1;
+}
+
+/* parse input a buffer at a time: consume data until a line is complete,
+ * and tell in "used" how much of it was taken; call again with the rest
+ * returns 1 with a line ready, 0 if more data is needed, -1 on error */
+int pconf_buf(PCONF_CTX_t *ctx, const char *buf, size_t buflen, size_t *used)
+{
+	const char	*nl;
+	size_t	i;
+
+	*used = 0;
+
+	if (!check_magic(ctx))
+		return -1;
+
+	/* if the last call finished a line, clean stuff up for another */
+	if ((ctx->state == STATE_ENDOFLINE) || (ctx->state == STATE_PARSEERR)) {
+		ctx->numargs = 0;
+		ctx->state = STATE_FINDWORDSTART;
+	}
+
+	/* fast path: a whole line is there and we are not in the middle
+	 * of one from the previous call */
+	if (ctx->state == STATE_FINDWORDSTART && ctx->numargs == 0
+	&& ctx->wordptr == ctx->wordbuf
+	&& (nl = memchr(buf, '\n', buflen)) != NULL
+	&& split_simple_line(ctx, buf, (size_t)(nl - buf))) {
+		ctx->state = STATE_ENDOFLINE;
+		*used = (size_t)(nl - buf) + 1;
+		return 1;
+	}
+
+	for (i = 0; i < buflen; i++) {
+		ctx->ch = buf[i];
+		parse_char(ctx);
+
+		if (ctx->state == STATE_ENDOFLINE) {
+			*used = i + 1;
+			return 1;
+		}
+
+		if (ctx->state == STATE_PARSEERR) {
+			*used = i + 1;
+			return -1;
+		}
+	}
+
+	*used = buflen;
+	return 0;
+}
+
 /* parse input a character at a time */
+/* release the memory which the words of the last line took, if that is
+ * more than <keep> bytes, for contexts kept around between lines (such as
+ * those of upsd clients, which would otherwise hold on to what the longest
+ * of their lines needed); not in the middle of a line, where the words are
+ * still needed; returns 1 if the memory was released */
+int pconf_compact(PCONF_CTX_t *ctx, size_t keep)
+{
+	size_t	i, held;
+	char	*wordbuf;
+
+	if (!check_magic(ctx))
+		return 0;
+
+	if ((ctx->state != STATE_ENDOFLINE) && (ctx->state != STATE_PARSEERR)
+	&& ((ctx->state != STATE_FINDWORDSTART) || (ctx->numargs != 0)
+	 || (ctx->wordptr != ctx->wordbuf))) {
+		return 0;
+	}
+
+	held = ctx->wordbufsize + ctx->maxargs * (sizeof(char *) + sizeof(size_t));
+	for (i = 0; i < ctx->maxargs; i++)
+		held += ctx->argsize[i];
+
+	if (held <= keep)
+		return 0;
+
+	for (i = 0; i < ctx->maxargs; i++)
+		free(ctx->arglist[i]);
+
+	free(ctx->arglist);
+	free(ctx->argsize);
+	ctx->arglist = NULL;
+	ctx->argsize = NULL;
+	ctx->numargs = 0;
+	ctx->maxargs = 0;
+	ctx->state = STATE_FINDWORDSTART;
+
+	/* back to the size pconf_init() starts with */
+	if (ctx->wordbufsize > 16 && (wordbuf = realloc(ctx->wordbuf, 16)) != NULL) {
+		ctx->wordbuf = wordbuf;
+		ctx->wordbufsize = 16;
+	}
+	ctx->wordbuf[0] = '\0';
+	ctx->wordptr = ctx->wordbuf;
+
+	return 1;
+}
+
 int pconf_char(PCONF_CTX_t *ctx, char ch)
 {
 	if (!check_magic(ctx))
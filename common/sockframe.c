@@ -0,0 +1,282 @@
+/* sockframe.c - framed records on the socket between a driver and upsd
+
+   Copyright (C)
+	2026	Network UPS Tools developers
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+/* A reader which asked for it (with FRAMED on a driver socket) gets each
+ * line of the protocol as a record of its arguments instead: the command
+ * and variable names are sent once and referred to by an id from then on,
+ * and values go as they are, so that neither side formats, quotes, escapes
+ * or tokenizes any text. The length in front of each record lets them go
+ * over the same stream socket (or pipe) as the text protocol does.
+ */
+
+#include "config.h"	/* must be first */
+
+#include "common.h"
+#include "sockframe.h"
+
+void sockframe_names_init(sockframe_names_t *names)
+{
+	memset(names, 0, sizeof(*names));
+}
+
+void sockframe_names_free(sockframe_names_t *names)
+{
+	size_t	i;
+
+	for (i = 0; i < names->count; i++) {
+		free(names->name[i]);
+	}
+
+	free(names->name);
+	free(names->bucket);
+	free(names->chain);
+	sockframe_names_init(names);
+}
+
+/* keep chains short as the number of names grows */
+static void names_grow(sockframe_names_t *names)
+{
+	size_t	i;
+
+	names->buckets = names->buckets ? 2 * names->buckets : 64;
+	free(names->bucket);
+	names->bucket = xcalloc(names->buckets, sizeof(*names->bucket));
+
+	for (i = 0; i < names->count; i++) {
+		size_t	*slot = &names->bucket[str_hash_nocase(names->name[i]) & (names->buckets - 1)];
+
+		names->chain[i] = *slot;
+		*slot = i + 1;
+	}
+}
+
+/* the id of <name>, or -1 if there are too many names to give it one */
+static long name_id(sockframe_names_t *names, const char *name)
+{
+	size_t	hash = str_hash_nocase(name), id;
+
+	if (names->buckets) {
+		for (id = names->bucket[hash & (names->buckets - 1)]; id; id = names->chain[id - 1]) {
+			if (!strcmp(names->name[id - 1], name)) {
+				return (long)(id - 1);
+			}
+		}
+	}
+
+	if (names->count >= SOCKFRAME_MAXNAMES) {
+		return -1;
+	}
+
+	if (names->count >= names->alloc) {
+		names->alloc = names->alloc ? 2 * names->alloc : 64;
+		names->name = xrealloc(names->name, names->alloc * sizeof(*names->name));
+		names->chain = xrealloc(names->chain, names->alloc * sizeof(*names->chain));
+	}
+
+	id = names->count++;
+	names->name[id] = xstrdup(name);
+
+	if (names->count > names->buckets) {
+		names_grow(names);	/* puts the new one in too */
+	} else {
+		size_t	*slot = &names->bucket[hash & (names->buckets - 1)];
+
+		names->chain[id] = *slot;
+		*slot = id + 1;
+	}
+
+	return (long)id;
+}
+
+static void put16(char *buf, size_t val)
+{
+	buf[0] = (char)((val >> 8) & 0xff);
+	buf[1] = (char)(val & 0xff);
+}
+
+static size_t get16(const char *buf)
+{
+	return ((size_t)(unsigned char)buf[0] << 8) | (unsigned char)buf[1];
+}
+
+size_t sockframe_args(char *buf, size_t bufsize, sockframe_names_t *names,
+	size_t numnames, size_t numargs, const char **arg)
+{
+	size_t	i, len = SOCKFRAME_HEADER_LEN + 1;
+
+	if (bufsize > SOCKFRAME_MAXLEN) {
+		bufsize = SOCKFRAME_MAXLEN;
+	}
+
+	if (numargs > 255 || len > bufsize) {
+		return 0;
+	}
+
+	buf[2] = SOCKFRAME_ARGS;
+	buf[3] = (char)numargs;
+
+	for (i = 0; i < numargs; i++) {
+		long	id = (i < numnames) ? name_id(names, arg[i]) : -1;
+		size_t	arglen;
+
+		if (len + 2 > bufsize) {
+			return 0;
+		}
+
+		if (id >= 0) {
+			put16(buf + len, SOCKFRAME_REF | (size_t)id);
+			len += 2;
+			continue;
+		}
+
+		arglen = strlen(arg[i]);
+		if (arglen >= SOCKFRAME_REF || len + 2 + arglen + 1 > bufsize) {
+			return 0;
+		}
+
+		put16(buf + len, arglen);
+		memcpy(buf + len + 2, arg[i], arglen + 1);
+		len += 2 + arglen + 1;
+	}
+
+	put16(buf, len);
+	return len;
+}
+
+size_t sockframe_name(char *buf, size_t bufsize, const sockframe_names_t *names,
+	size_t id)
+{
+	size_t	namelen, len;
+
+	if (id >= names->count) {
+		return 0;
+	}
+
+	namelen = strlen(names->name[id]);
+	len = SOCKFRAME_HEADER_LEN + 2 + namelen + 1;
+	if (len > bufsize || len > SOCKFRAME_MAXLEN) {
+		return 0;
+	}
+
+	put16(buf, len);
+	buf[2] = SOCKFRAME_NAME;
+	put16(buf + 3, id);
+	memcpy(buf + 5, names->name[id], namelen + 1);
+
+	return len;
+}
+
+int sockframe_next(const char *buf, size_t len, size_t *reclen)
+{
+	if (len < 2) {
+		return 0;
+	}
+
+	*reclen = get16(buf);
+	if (*reclen < SOCKFRAME_HEADER_LEN) {
+		return -1;
+	}
+
+	return (len >= *reclen) ? 1 : 0;
+}
+
+/* reader: take the definition of name <id>, which comes in order */
+static int name_set(sockframe_names_t *names, size_t id, const char *name)
+{
+	if (id < names->count) {
+		free(names->name[id]);
+		names->name[id] = xstrdup(name);
+		return 1;
+	}
+
+	if (id != names->count || id >= SOCKFRAME_MAXNAMES) {
+		return 0;
+	}
+
+	if (names->count >= names->alloc) {
+		names->alloc = names->alloc ? 2 * names->alloc : 64;
+		names->name = xrealloc(names->name, names->alloc * sizeof(*names->name));
+	}
+
+	names->name[names->count++] = xstrdup(name);
+	return 1;
+}
+
+int sockframe_decode(char *rec, size_t reclen, sockframe_names_t *names,
+	char **arg, size_t *numargs)
+{
+	size_t	i, count, pos;
+
+	if (reclen < SOCKFRAME_HEADER_LEN + 1) {
+		return -1;
+	}
+
+	switch (rec[2])
+	{
+	case SOCKFRAME_NAME:
+		if (reclen < SOCKFRAME_HEADER_LEN + 3 || rec[reclen - 1] != '\0'
+		 || !name_set(names, get16(rec + 3), rec + 5)
+		) {
+			return -1;
+		}
+		return 0;
+
+	case SOCKFRAME_ARGS:
+		break;
+
+	default:
+		return -1;
+	}
+
+	count = (unsigned char)rec[3];
+	if (count < 1 || count > SOCKFRAME_MAXARGS) {
+		return -1;
+	}
+
+	for (i = 0, pos = SOCKFRAME_HEADER_LEN + 1; i < count; i++) {
+		size_t	val;
+
+		if (pos + 2 > reclen) {
+			return -1;
+		}
+
+		val = get16(rec + pos);
+		pos += 2;
+
+		if (val & SOCKFRAME_REF) {
+			val &= ~(size_t)SOCKFRAME_REF;
+			if (val >= names->count) {
+				return -1;
+			}
+			arg[i] = names->name[val];
+			continue;
+		}
+
+		if (pos + val + 1 > reclen || rec[pos + val] != '\0') {
+			return -1;
+		}
+
+		arg[i] = rec + pos;
+		pos += val + 1;
+	}
+
+	*numargs = count;
+	return 1;
+}
@@ -25,6 +25,8 @@
 
 #include <stdio.h>
 #include <stdarg.h>
+#include <stddef.h>
+#include <ctype.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #ifndef WIN32
@@ -38,29 +40,273 @@
 
 /* internal helpers */
 
+/* Tree nodes, their enum and range items and the items of command lists
+ * are carved out of slabs of ST_POOL_SLAB objects, instead of one malloc()
+ * each: the nodes of a tree mostly end up next to each other in memory,
+ * which is what walks over the whole tree (dumps to clients) like best.
+ * Released objects are kept on a free list for reuse; the slabs stay
+ * allocated until exit. Each pool accounts for the objects in use with a
+ * tag of nut_mem_tags(), as do the names and values stored elsewhere. */
+#define ST_POOL_SLAB	64
+
+/* room for short enum values within the pooled item */
+#define ST_ENUM_INLINE	24
+
+/* start of a slab, sized to keep the objects after it aligned */
+typedef union st_slab_u {
+	union st_slab_u	*next;
+	long double	align_ld;
+	void	*align_ptr;
+	long	align_l;
+} st_slab_t;
+
+typedef struct {
+	size_t	size;		/* of one object, at least a pointer */
+	void	*freelist;	/* linked through the first pointer of each */
+	st_slab_t	*slabs;	/* all slabs, to keep them reachable */
+	nut_mem_tag_t	*tag;	/* accounts for the objects handed out */
+} st_pool_t;
+
+/* an enum list item with the value stored along, if short */
+typedef struct {
+	enum_t	item;
+	char	buf[ST_ENUM_INLINE];
+} st_enum_slot_t;
+
+/* what the trees hold, see nut_mem_tags() */
+static nut_mem_tag_t	mem_nodes = NUT_MEM_TAG_INIT("state.nodes");
+static nut_mem_tag_t	mem_enums = NUT_MEM_TAG_INIT("state.enums");
+static nut_mem_tag_t	mem_ranges = NUT_MEM_TAG_INIT("state.ranges");
+static nut_mem_tag_t	mem_cmds = NUT_MEM_TAG_INIT("state.cmds");
+static nut_mem_tag_t	mem_names = NUT_MEM_TAG_INIT("state.names");
+static nut_mem_tag_t	mem_values = NUT_MEM_TAG_INIT("state.values");
+
+static st_pool_t	node_pool = { sizeof(st_tree_t), NULL, NULL, &mem_nodes };
+static st_pool_t	enum_pool = { sizeof(st_enum_slot_t), NULL, NULL, &mem_enums };
+static st_pool_t	range_pool = { sizeof(range_t), NULL, NULL, &mem_ranges };
+static st_pool_t	cmd_pool = { sizeof(cmdlist_t), NULL, NULL, &mem_cmds };
+
+/* Variable and command names are interned in a table of the process, as
+ * the same few hundred of them show up in the tree of every device and in
+ * every copy upsd keeps: there is one copy of each name, shared by all the
+ * nodes and lists, and names differing only in case share the one spelt as
+ * seen first (they are the same variable to the trees anyway). So names
+ * taken from a node or list can be told equal by their pointer alone. */
+typedef struct st_name_s {
+	struct st_name_s	*next;	/* in the hash chain */
+	size_t	refs;
+	uint32_t	hash;
+	char	name[1];	/* allocated to fit */
+} st_name_t;
+
+#define ST_NAME_ENTRY(name)	((st_name_t *)(void *)((name) - offsetof(st_name_t, name)))
+
+static st_name_t	**st_names = NULL;
+static size_t	st_names_size = 0, st_names_count = 0;
+
+static st_name_t *st_name_lookup(const char *name, uint32_t hash)
+{
+	st_name_t	*entry;
+
+	if (!st_names_size) {
+		return NULL;
+	}
+
+	for (entry = st_names[hash & (st_names_size - 1)]; entry; entry = entry->next) {
+		if (entry->hash == hash && !strcasecmp(entry->name, name)) {
+			return entry;
+		}
+	}
+
+	return NULL;
+}
+
+const char *state_name_find(const char *name)
+{
+	st_name_t	*entry = st_name_lookup(name, (uint32_t)str_hash_nocase(name));
+
+	return entry ? entry->name : NULL;
+}
+
+const char *state_name_intern(const char *name)
+{
+	uint32_t	hash = (uint32_t)str_hash_nocase(name);
+	st_name_t	*entry = st_name_lookup(name, hash);
+	size_t	len, i;
+
+	if (entry) {
+		entry->refs++;
+		return entry->name;
+	}
+
+	/* keep the chains short, by twice as many buckets when full */
+	if (st_names_count >= st_names_size) {
+		size_t	size = st_names_size ? st_names_size * 2 : 256;
+		st_name_t	**names = xcalloc(size, sizeof(*names));
+
+		for (i = 0; i < st_names_size; i++) {
+			while ((entry = st_names[i]) != NULL) {
+				st_names[i] = entry->next;
+				entry->next = names[entry->hash & (size - 1)];
+				names[entry->hash & (size - 1)] = entry;
+			}
+		}
+
+		free(st_names);
+		nut_mem_sub(&mem_names, st_names_size * sizeof(*names));
+		nut_mem_add(&mem_names, size * sizeof(*names));
+		st_names = names;
+		st_names_size = size;
+	}
+
+	len = strlen(name);
+	entry = xmalloc(offsetof(st_name_t, name) + len + 1);
+	nut_mem_add(&mem_names, offsetof(st_name_t, name) + len + 1);
+	memcpy(entry->name, name, len + 1);
+	entry->refs = 1;
+	entry->hash = hash;
+	entry->next = st_names[hash & (st_names_size - 1)];
+	st_names[hash & (st_names_size - 1)] = entry;
+	st_names_count++;
+
+	return entry->name;
+}
+
+void state_name_release(const char *name)
+{
+	st_name_t	*entry, **eptr;
+
+	if (!name) {
+		return;
+	}
+
+	entry = ST_NAME_ENTRY(name);
+
+	if (--entry->refs > 0) {
+		return;
+	}
+
+	for (eptr = &st_names[entry->hash & (st_names_size - 1)]; *eptr; eptr = &(*eptr)->next) {
+		if (*eptr == entry) {
+			*eptr = entry->next;
+			break;
+		}
+	}
+
+	st_names_count--;
+	nut_mem_sub(&mem_names, offsetof(st_name_t, name) + strlen(entry->name) + 1);
+	free(entry);
+}
+
+/* order of an interned name against another name, equal by pointer first */
+static int st_name_cmp(const char *interned, const char *name)
+{
+	return (interned == name) ? 0 : strcasecmp(interned, name);
+}
+
+/* hand out a zeroed object */
+static void *st_pool_get(st_pool_t *pool)
+{
+	void	*obj;
+
+	if (!pool->freelist) {
+		st_slab_t	*slab = xcalloc(1, sizeof(*slab) + ST_POOL_SLAB * pool->size);
+		char	*objs = (char *)(slab + 1);
+		size_t	i;
+
+		slab->next = pool->slabs;
+		pool->slabs = slab;
+
+		/* lowest addresses first, so a new tree fills the slab in order */
+		for (i = ST_POOL_SLAB; i > 0; i--) {
+			obj = objs + (i - 1) * pool->size;
+			*(void **)obj = pool->freelist;
+			pool->freelist = obj;
+		}
+	}
+
+	obj = pool->freelist;
+	pool->freelist = *(void **)obj;
+	memset(obj, 0, pool->size);
+	nut_mem_add(pool->tag, pool->size);
+
+	return obj;
+}
+
+static void st_pool_put(st_pool_t *pool, void *obj)
+{
+	*(void **)obj = pool->freelist;
+	pool->freelist = obj;
+	nut_mem_sub(pool->tag, pool->size);
+}
+
+/* point *str at a copy of src, kept in the inline buffer if it fits;
+ * returns the size of the storage used */
+static size_t st_str_init(char **str, char *buf, size_t bufsize, const char *src)
+{
+	size_t	len = strlen(src) + 1;
+
+	if (len <= bufsize) {
+		memcpy(buf, src, len);
+		*str = buf;
+		return bufsize;
+	}
+
+	*str = xstrdup(src);
+	nut_mem_add(&mem_values, len);
+	return len;
+}
+
+/* give back the storage of *str, of <size> if it is not <buf> */
+static void st_str_free(char *str, const char *buf, size_t size)
+{
+	if (str != buf) {
+		nut_mem_sub(&mem_values, size);
+		free(str);
+	}
+}
+
 static void val_escape(st_tree_t *node)
 {
 	char	etmp[ST_MAX_VALUE_LEN];
+	size_t	len;
 
-	/* escape any tricky stuff like \ and " */
-	pconf_encode(node->raw, etmp, sizeof(etmp));
-
-	/* if nothing was escaped, we don't need to do anything else */
-	if (!strcmp(node->raw, etmp)) {
+	/* if there is nothing to escape, we don't need to do anything else */
+	if (!pconf_encode_needed(node->raw)) {
 		node->val = node->raw;
 		return;
 	}
 
+	/* escape any tricky stuff like \ and " */
+	pconf_encode(node->raw, etmp, sizeof(etmp));
+	len = strlen(etmp) + 1;
+
 	/* if the escaped value grew, deal with it */
-	if (node->safesize < (strlen(etmp) + 1)) {
-		node->safesize = strlen(etmp) + 1;
+	if (node->safesize < len) {
+		nut_mem_sub(&mem_values, node->safesize);
+		nut_mem_add(&mem_values, len);
+		node->safesize = len;
 		node->safe = xrealloc(node->safe, node->safesize);
 	}
 
-	snprintf(node->safe, node->safesize, "%s", etmp);
+	memcpy(node->safe, etmp, len);
 	node->val = node->safe;
 }
 
+static enum_t *st_tree_enum_new(const char *val)
+{
+	st_enum_slot_t	*slot = st_pool_get(&enum_pool);
+
+	st_str_init(&slot->item.val, slot->buf, sizeof(slot->buf), val);
+	return &slot->item;
+}
+
+static void st_tree_enum_item_free(enum_t *item)
+{
+	st_str_free(item->val, ((st_enum_slot_t *)item)->buf, strlen(item->val) + 1);
+	st_pool_put(&enum_pool, item);
+}
+
 static void st_tree_enum_free(enum_t *list)
 {
 	if (!list) {
@@ -69,8 +315,7 @@ static void st_tree_enum_free(enum_t *list)
 
 	st_tree_enum_free(list->next);
 
-	free(list->val);
-	free(list);
+	st_tree_enum_item_free(list);
 }
 
 static void st_tree_range_free(range_t *list)
@@ -81,14 +326,20 @@ static void st_tree_range_free(range_t *list)
 
 	st_tree_range_free(list->next);
 
-	free(list);
+	st_pool_put(&range_pool, list);
 }
 
+/* nodes given back so far, which any node pointer kept aside (see
+ * st_family_t) is only good until */
+static unsigned long	st_tree_frees = 0;
+
 /* free all memory associated with a node */
 static void st_tree_node_free(st_tree_t *node)
 {
-	free(node->var);
-	free(node->raw);
+	st_tree_frees++;
+	state_name_release(node->var);
+	st_str_free(node->raw, node->rawbuf, node->rawsize);
+	nut_mem_sub(&mem_values, node->safesize);
 	free(node->safe);
 
 	/* never free node->val, since it's just a pointer to raw or safe */
@@ -99,44 +350,220 @@ static void st_tree_node_free(st_tree_t *node)
 	/* and the list of ranges */
 	st_tree_range_free(node->range_list);
 
-	/* now finally kill the node itself */
-	free(node);
+	/* now finally give the node itself back */
+	st_pool_put(&node_pool, node);
 }
 
-/* add a subtree to another subtree */
-static void st_tree_node_add(st_tree_t **nptr, st_tree_t *sptr)
+/* the generation nodes written from now on are tagged with */
+static unsigned long	st_tree_generation = 0;
+
+static int st_tree_node_refresh_timestamp(const st_tree_t *node)
 {
-	if (!sptr) {
-		return;
+	if (!node)
+		return -1;
+
+	((st_tree_t *)node)->gen = st_tree_generation;
+
+	return state_get_timestamp((st_tree_timespec_t *)&node->lastset);
+}
+
+/* AVL balancing helpers: drivers tend to publish their variables in
+ * sorted order, which would degrade a plain binary search tree into a
+ * list; keeping it balanced keeps lookups at O(log n) compares */
+static int st_tree_height(const st_tree_t *node)
+{
+	return node ? node->height : 0;
+}
+
+static void st_tree_update_height(st_tree_t *node)
+{
+	int	hl = st_tree_height(node->left), hr = st_tree_height(node->right);
+
+	node->height = (hl > hr ? hl : hr) + 1;
+}
+
+static st_tree_t *st_tree_rotate_right(st_tree_t *node)
+{
+	st_tree_t	*top = node->left;
+
+	node->left = top->right;
+	top->right = node;
+	st_tree_update_height(node);
+	st_tree_update_height(top);
+
+	return top;
+}
+
+static st_tree_t *st_tree_rotate_left(st_tree_t *node)
+{
+	st_tree_t	*top = node->right;
+
+	node->right = top->left;
+	top->left = node;
+	st_tree_update_height(node);
+	st_tree_update_height(top);
+
+	return top;
+}
+
+/* restore the AVL property at *nptr after its subtrees changed */
+static void st_tree_rebalance(st_tree_t **nptr)
+{
+	st_tree_t	*node = *nptr;
+	int	balance;
+
+	st_tree_update_height(node);
+	balance = st_tree_height(node->left) - st_tree_height(node->right);
+
+	if (balance > 1) {
+		if (st_tree_height(node->left->left) < st_tree_height(node->left->right))
+			node->left = st_tree_rotate_left(node->left);
+		*nptr = st_tree_rotate_right(node);
+	} else if (balance < -1) {
+		if (st_tree_height(node->right->right) < st_tree_height(node->right->left))
+			node->right = st_tree_rotate_right(node->right);
+		*nptr = st_tree_rotate_left(node);
 	}
+}
 
-	while (*nptr) {
+/* detach the leftmost node of a (non-empty) subtree and return it */
+static st_tree_t *st_tree_node_unlink_min(st_tree_t **nptr)
+{
+	st_tree_t	*node = *nptr, *min;
 
-		st_tree_t	*node = *nptr;
+	if (!node->left) {
+		*nptr = node->right;
+		return node;
+	}
 
-		if (strcasecmp(node->var, sptr->var) > 0) {
-			nptr = &node->left;
-			continue;
+	min = st_tree_node_unlink_min(&node->left);
+	st_tree_rebalance(nptr);
+
+	return min;
+}
+
+/* remove a variable from a tree, unless it is immutable or (if cutoff
+ * is given) was updated after the cutoff; rebalances on the way back */
+static int st_tree_node_delete(st_tree_t **nptr, const char *var, const st_tree_timespec_t *cutoff)
+{
+	st_tree_t	*node = *nptr, *repl;
+	int	cmp, ret;
+
+	if (!node) {
+		return 0;	/* not found */
+	}
+
+	cmp = st_name_cmp(node->var, var);
+
+	if (cmp != 0) {
+		ret = st_tree_node_delete(cmp > 0 ? &node->left : &node->right, var, cutoff);
+		if (ret) {
+			st_tree_rebalance(nptr);
 		}
+		return ret;
+	}
 
-		if (strcasecmp(node->var, sptr->var) < 0) {
-			nptr = &node->right;
-			continue;
+	if (node->flags & ST_FLAG_IMMUTABLE) {
+		upsdebugx(6, "%s: not deleting immutable variable [%s]", __func__, var);
+		return 0;
+	}
+
+	if (cutoff) {
+		if (st_tree_node_compare_timestamp(node, cutoff) >= 0) {
+			upsdebugx(6, "%s: not deleting recently updated variable [%s]", __func__, var);
+			return 0;
 		}
+		upsdebugx(6, "%s: deleting variable [%s] last updated too long ago", __func__, var);
+	}
 
-		upsdebugx(1, "%s: duplicate value (shouldn't happen)", __func__);
-		return;
+	if (!node->left || !node->right) {
+		*nptr = node->left ? node->left : node->right;
+	} else {
+		/* put the in-order successor in place of the node */
+		repl = st_tree_node_unlink_min(&node->right);
+		repl->left = node->left;
+		repl->right = node->right;
+		*nptr = repl;
+		st_tree_rebalance(nptr);
 	}
 
-	*nptr = sptr;
+	st_tree_node_free(node);
+
+	return 1;
 }
 
-static int st_tree_node_refresh_timestamp(const st_tree_t *node)
+/* update the value of an existing node, returns 1 if it changed */
+static int st_tree_node_update(st_tree_t *node, const char *var, const char *val)
 {
-	if (!node)
-		return -1;
+	/* refresh even if "skip-writing" same info value */
+	st_tree_node_refresh_timestamp(node);
 
-	return state_get_timestamp((st_tree_timespec_t *)&node->lastset);
+	/* updating an existing entry */
+	if (!strcasecmp(node->raw, val)) {
+		return 0;	/* no change */
+	}
+
+	/* changes should be ignored */
+	if (node->flags & ST_FLAG_IMMUTABLE) {
+		upsdebugx(6, "%s: not changing immutable variable [%s]", __func__, var);
+		return 0;	/* no change */
+	}
+
+	/* expand the buffer if the value grows (out of the inline one) */
+	if (node->rawsize < (strlen(val) + 1)) {
+		if (node->raw != node->rawbuf) {
+			nut_mem_sub(&mem_values, node->rawsize);
+		}
+		node->rawsize = strlen(val) + 1;
+		nut_mem_add(&mem_values, node->rawsize);
+		if (node->raw == node->rawbuf) {
+			node->raw = xmalloc(node->rawsize);
+		} else {
+			node->raw = xrealloc(node->raw, node->rawsize);
+		}
+	}
+
+	/* store the literal value for later comparisons */
+	snprintf(node->raw, node->rawsize, "%s", val);
+	node->numset = 0;
+
+	val_escape(node);
+
+	return 1;	/* changed */
+}
+
+/* add or update a variable; an added node is rebalanced in on the way back
+ * returns as state_setinfo(), with 2 for "added" as a hint to rebalance */
+static int st_tree_node_set(st_tree_t **nptr, const char *var, const char *val)
+{
+	st_tree_t	*node = *nptr;
+	int	cmp, ret;
+
+	if (!node) {
+		node = st_pool_get(&node_pool);
+
+		node->var = state_name_intern(var);
+		node->rawsize = st_str_init(&node->raw, node->rawbuf, sizeof(node->rawbuf), val);
+		node->height = 1;
+		st_tree_node_refresh_timestamp(node);
+
+		val_escape(node);
+
+		*nptr = node;
+		return 2;	/* added */
+	}
+
+	cmp = st_name_cmp(node->var, var);
+
+	if (cmp != 0) {
+		ret = st_tree_node_set(cmp > 0 ? &node->left : &node->right, var, val);
+		if (ret == 2) {
+			st_tree_rebalance(nptr);
+		}
+		return ret;
+	}
+
+	return st_tree_node_update(node, var, val);
 }
 
 /* interface */
@@ -156,6 +583,20 @@ int state_get_timestamp(st_tree_timespec_t *now)
 #endif
 }
 
+uint64_t state_get_timestamp_usec(void)
+{
+	st_tree_timespec_t	now;
+
+	if (state_get_timestamp(&now) < 0)
+		return 0;
+
+#if defined(HAVE_CLOCK_GETTIME) && defined(HAVE_CLOCK_MONOTONIC) && HAVE_CLOCK_GETTIME && HAVE_CLOCK_MONOTONIC
+	return (uint64_t)now.tv_sec * 1000000 + (uint64_t)now.tv_nsec / 1000;
+#else
+	return (uint64_t)now.tv_sec * 1000000 + (uint64_t)now.tv_usec;
+#endif
+}
+
 /* Returns -1 if the node->lastset is "older" than cutoff,
  * 0 if it is equal, or +1 if it is newer.
  * Returns -2 or -3 if node or cutoff are null.
@@ -196,134 +637,133 @@ int st_tree_node_compare_timestamp(
  */
 int state_delinfo(st_tree_t **nptr, const char *var)
 {
-	while (*nptr) {
+	return st_tree_node_delete(nptr, var, NULL);
+}
 
-		st_tree_t	*node = *nptr;
+int state_delinfo_olderthan(st_tree_t **nptr, const char *var, const st_tree_timespec_t *cutoff)
+{
+	/* NB: a NULL cutoff deletes unconditionally, as it always did */
+	return st_tree_node_delete(nptr, var, cutoff);
+}
 
-		if (strcasecmp(node->var, var) > 0) {
-			nptr = &node->left;
-			continue;
-		}
+unsigned long state_generation_next(void)
+{
+	return ++st_tree_generation;
+}
 
-		if (strcasecmp(node->var, var) < 0) {
-			nptr = &node->right;
-			continue;
-		}
+/* as if <node> was written again, for callers which know it would not change */
+void state_touchinfo(st_tree_t *node)
+{
+	st_tree_node_refresh_timestamp(node);
+}
 
-		if (node->flags & ST_FLAG_IMMUTABLE) {
-			upsdebugx(6, "%s: not deleting immutable variable [%s]", __func__, var);
-			return 0;
-		}
+/* collect (by a reference on their names) the nodes which state_prune()
+ * deletes: that rebalances the tree, so it is done afterwards */
+static void st_tree_find_stale(const st_tree_t *node, const char *prefix,
+	size_t prefixlen, unsigned long gen, const char ***stale,
+	size_t *numstale, size_t *allocstale)
+{
+	if (!node) {
+		return;
+	}
 
-		/* whatever is on the left, hang it off current right */
-		st_tree_node_add(&node->right, node->left);
+	st_tree_find_stale(node->left, prefix, prefixlen, gen, stale, numstale, allocstale);
+	st_tree_find_stale(node->right, prefix, prefixlen, gen, stale, numstale, allocstale);
 
-		/* now point the parent at the old right child */
-		*nptr = node->right;
+	if (node->gen == gen || (node->flags & ST_FLAG_IMMUTABLE)) {
+		return;
+	}
 
-		st_tree_node_free(node);
+	if (prefix && strncasecmp(node->var, prefix, prefixlen)) {
+		return;
+	}
 
-		return 1;
+	if (*numstale >= *allocstale) {
+		*allocstale = *allocstale ? 2 * *allocstale : 16;
+		*stale = xrealloc(*stale, *allocstale * sizeof(**stale));
 	}
 
-	return 0;	/* not found */
+	(*stale)[(*numstale)++] = state_name_intern(node->var);
 }
 
-int state_delinfo_olderthan(st_tree_t **nptr, const char *var, const st_tree_timespec_t *cutoff)
+size_t state_prune(st_tree_t **nptr, const char *prefix, unsigned long gen,
+	void (*deleted)(const char *var, void *arg), void *arg)
 {
-	while (*nptr) {
-
-		st_tree_t	*node = *nptr;
-
-		if (strcasecmp(node->var, var) > 0) {
-			nptr = &node->left;
-			continue;
-		}
-
-		if (strcasecmp(node->var, var) < 0) {
-			nptr = &node->right;
-			continue;
-		}
-
-		if (node->flags & ST_FLAG_IMMUTABLE) {
-			upsdebugx(6, "%s: not deleting immutable variable [%s]", __func__, var);
-			return 0;
-		}
-
-		if (st_tree_node_compare_timestamp(node, cutoff) >= 0) {
-			upsdebugx(6, "%s: not deleting recently updated variable [%s]", __func__, var);
-			return 0;
+	const char	**stale = NULL;
+	size_t	numstale = 0, allocstale = 0, numdeleted = 0, i;
+
+	st_tree_find_stale(*nptr, prefix, prefix ? strlen(prefix) : 0, gen,
+		&stale, &numstale, &allocstale);
+
+	for (i = 0; i < numstale; i++) {
+		if (st_tree_node_delete(nptr, stale[i], NULL) == 1) {
+			upsdebugx(6, "%s: deleting variable [%s] not refreshed in generation %lu",
+				__func__, stale[i], gen);
+			numdeleted++;
+			if (deleted) {
+				deleted(stale[i], arg);
+			}
 		}
-		upsdebugx(6, "%s: deleting variable [%s] last updated too long ago", __func__, var);
-
-		/* whatever is on the left, hang it off current right */
-		st_tree_node_add(&node->right, node->left);
-
-		/* now point the parent at the old right child */
-		*nptr = node->right;
-
-		st_tree_node_free(node);
-
-		return 1;
+		state_name_release(stale[i]);
 	}
 
-	return 0;	/* not found */
+	free(stale);
+
+	return numdeleted;
 }
 
 int state_setinfo(st_tree_t **nptr, const char *var, const char *val)
 {
-	while (*nptr) {
-
-		st_tree_t	*node = *nptr;
-
-		if (strcasecmp(node->var, var) > 0) {
-			nptr = &node->left;
-			continue;
-		}
-
-		if (strcasecmp(node->var, var) < 0) {
-			nptr = &node->right;
-			continue;
-		}
+	return st_tree_node_set(nptr, var, val) ? 1 : 0;
+}
 
-		/* refresh even if "skip-writing" same info value */
-		st_tree_node_refresh_timestamp(node);
+/* Numeric counterpart of state_setinfo(), for values published over and
+ * over while they mostly stay the same: <value> is only formatted (with
+ * <precision> decimals) and compared to the stored text if it moved by
+ * more than <deadband> since the last call for this variable, otherwise
+ * this is as cheap as a lookup. Returns like state_setinfo(), with the
+ * text of the new value in <buf> when it changed. */
+/* state_setinfo_double() for <var>, whose node (if any) is already known */
+static int st_tree_setinfo_double(st_tree_t **nptr, st_tree_t *node, const char *var,
+	double value, int precision, double deadband, char *buf, size_t bufsize)
+{
+	double	delta;
+	int	ret;
 
-		/* updating an existing entry */
-		if (!strcasecmp(node->raw, val)) {
-			return 0;	/* no change */
+	if (node && node->numset && node->numprec == precision) {
+		delta = value - node->numval;
+		if (delta < 0) {
+			delta = -delta;
 		}
 
-		/* changes should be ignored */
-		if (node->flags & ST_FLAG_IMMUTABLE) {
-			upsdebugx(6, "%s: not changing immutable variable [%s]", __func__, var);
+		if (delta <= deadband) {
+			/* as for the unchanged text in st_tree_node_set() */
+			st_tree_node_refresh_timestamp(node);
 			return 0;	/* no change */
 		}
+	}
 
-		/* expand the buffer if the value grows */
-		if (node->rawsize < (strlen(val) + 1)) {
-			node->rawsize = strlen(val) + 1;
-			node->raw = xrealloc(node->raw, node->rawsize);
-		}
-
-		/* store the literal value for later comparisons */
-		snprintf(node->raw, node->rawsize, "%s", val);
+	snprintf(buf, bufsize, "%.*f", precision, value);
+	ret = state_setinfo(nptr, var, buf);
 
-		val_escape(node);
-
-		return 1;	/* changed */
+	if (!node) {
+		node = state_tree_find(*nptr, var);
 	}
 
-	*nptr = xcalloc(1, sizeof(**nptr));
-
-	(*nptr)->var = xstrdup(var);
-	(*nptr)->raw = xstrdup(val);
-	(*nptr)->rawsize = strlen(val) + 1;
-	st_tree_node_refresh_timestamp(*nptr);
+	if (node) {
+		node->numval = value;
+		node->numprec = precision;
+		node->numset = 1;
+	}
 
-	val_escape(*nptr);
+	return ret;
+}
 
-	return 1;	/* added */
+int state_setinfo_double(st_tree_t **nptr, const char *var, double value,
+	int precision, double deadband, char *buf, size_t bufsize)
+{
+	return st_tree_setinfo_double(nptr, state_tree_find(*nptr, var), var,
+		value, precision, deadband, buf, bufsize);
 }
 
 static int st_tree_enum_add(enum_t **list, const char *enc)
@@ -340,8 +780,7 @@ static int st_tree_enum_add(enum_t **list, const char *enc)
 		return 0;	/* duplicate */
 	}
 
-	item = xcalloc(1, sizeof(*item));
-	item->val = xstrdup(enc);
+	item = st_tree_enum_new(enc);
 	item->next = *list;
 
 	/* now we're done creating it, add it to the list */
@@ -385,7 +824,7 @@ static int st_tree_range_add(range_t **list, const int min, const int max)
 		return 0;	/* duplicate */
 	}
 
-	item = xcalloc(1, sizeof(*item));
+	item = st_pool_get(&range_pool);
 	item->min = min;
 	item->max = max;
 	item->next = *list;
@@ -561,12 +1000,14 @@ int state_addcmd(cmdlist_t **list, const char *cmd)
 
 	while (*list) {
 
-		if (strcasecmp((*list)->name, cmd) > 0) {
+		int	cmp = st_name_cmp((*list)->name, cmd);
+
+		if (cmp > 0) {
 			/* insertion point reached */
 			break;
 		}
 
-		if (strcasecmp((*list)->name, cmd) < 0) {
+		if (cmp < 0) {
 			list = &(*list)->next;
 			continue;
 		}
@@ -574,8 +1015,8 @@ int state_addcmd(cmdlist_t **list, const char *cmd)
 		return 0;	/* duplicate */
 	}
 
-	item = xcalloc(1, sizeof(*item));
-	item->name = xstrdup(cmd);
+	item = st_pool_get(&cmd_pool);
+	item->name = state_name_intern(cmd);
 	item->next = *list;
 
 	/* now we're done creating it, insert it in the list */
@@ -604,8 +1045,8 @@ void state_cmdfree(cmdlist_t *list)
 
 	state_cmdfree(list->next);
 
-	free(list->name);
-	free(list);
+	state_name_release(list->name);
+	st_pool_put(&cmd_pool, list);
 }
 
 int state_delcmd(cmdlist_t **list, const char *cmd)
@@ -613,13 +1054,14 @@ int state_delcmd(cmdlist_t **list, const char *cmd)
 	while (*list) {
 
 		cmdlist_t	*item = *list;
+		int	cmp = st_name_cmp(item->name, cmd);
 
-		if (strcasecmp(item->name, cmd) > 0) {
+		if (cmp > 0) {
 			/* not found */
 			break;
 		}
 
-		if (strcasecmp(item->name, cmd) < 0) {
+		if (cmp < 0) {
 			list = &item->next;
 			continue;
 		}
@@ -628,8 +1070,8 @@ int state_delcmd(cmdlist_t **list, const char *cmd)
 
 		*list = item->next;
 
-		free(item->name);
-		free(item);
+		state_name_release(item->name);
+		st_pool_put(&cmd_pool, item);
 
 		return 1;	/* deleted */
 	}
@@ -652,8 +1094,7 @@ static int st_tree_del_enum(enum_t **list, const char *val)
 		/* we found it! */
 		*list = item->next;
 
-		free(item->val);
-		free(item);
+		st_tree_enum_item_free(item);
 
 		return 1;	/* deleted */
 	}
@@ -691,7 +1132,7 @@ static int st_tree_del_range(range_t **list, const int min, const int max)
 		/* we found it! */
 		*list = item->next;
 
-		free(item);
+		st_pool_put(&range_pool, item);
 
 		return 1;	/* deleted */
 	}
@@ -717,13 +1158,14 @@ int state_delrange(st_tree_t *root, const char *var, const int min, const int ma
 st_tree_t *state_tree_find(st_tree_t *node, const char *var)
 {
 	while (node) {
+		int	cmp = st_name_cmp(node->var, var);
 
-		if (strcasecmp(node->var, var) > 0) {
+		if (cmp > 0) {
 			node = node->left;
 			continue;
 		}
 
-		if (strcasecmp(node->var, var) < 0) {
+		if (cmp < 0) {
 			node = node->right;
 			continue;
 		}
@@ -733,3 +1175,119 @@ st_tree_t *state_tree_find(st_tree_t *node, const char *var)
 
 	return node;
 }
+
+/* indexed families of variables, see st_family_t */
+
+st_family_t *state_family_new(const char *tmpl)
+{
+	st_family_t	*fam;
+
+	if (!tmpl || validate_formatting_string(tmpl, "%i", NUT_DYNAMICFORMATTING_DEBUG_LEVEL) < 0) {
+		return NULL;
+	}
+
+	fam = xcalloc(1, sizeof(*fam));
+	fam->tmpl = xstrdup(tmpl);
+
+	return fam;
+}
+
+void state_family_free(st_family_t *fam)
+{
+	size_t	i;
+
+	if (!fam) {
+		return;
+	}
+
+	for (i = 0; i < fam->count; i++) {
+		state_name_release(fam->name[i]);
+	}
+
+	free(fam->name);
+	free(fam->node);
+	free(fam->tmpl);
+	free(fam);
+}
+
+const char *state_family_name(st_family_t *fam, int index)
+{
+	char	buf[SMALLBUF];
+
+	if (index < 0 || index >= ST_FAMILY_MAXINDEX) {
+		return NULL;
+	}
+
+	if ((size_t)index >= fam->count) {
+		size_t	count = fam->count ? fam->count : 16;
+
+		while (count <= (size_t)index) {
+			count *= 2;
+		}
+
+		fam->name = xrealloc(fam->name, count * sizeof(*fam->name));
+		fam->node = xrealloc(fam->node, count * sizeof(*fam->node));
+		memset(fam->name + fam->count, 0, (count - fam->count) * sizeof(*fam->name));
+		memset(fam->node + fam->count, 0, (count - fam->count) * sizeof(*fam->node));
+		fam->count = count;
+	}
+
+	/* made once, when first asked for */
+	if (!fam->name[index]) {
+		if (snprintf_dynamic(buf, sizeof(buf), fam->tmpl, "%i", index) < 0) {
+			return NULL;
+		}
+		fam->name[index] = state_name_intern(buf);
+	}
+
+	return fam->name[index];
+}
+
+st_tree_t *state_family_find(st_family_t *fam, st_tree_t *root, int index)
+{
+	const char	*name = state_family_name(fam, index);
+
+	if (!name) {
+		return NULL;
+	}
+
+	/* a node given back may have been reused for another variable */
+	if (fam->frees != st_tree_frees) {
+		memset(fam->node, 0, fam->count * sizeof(*fam->node));
+		fam->frees = st_tree_frees;
+	}
+
+	if (!fam->node[index]) {
+		fam->node[index] = state_tree_find(root, name);
+	}
+
+	return fam->node[index];
+}
+
+int state_family_setinfo(st_family_t *fam, st_tree_t **nptr, int index, const char *val)
+{
+	st_tree_t	*node = state_family_find(fam, *nptr, index);
+
+	if (node) {
+		return st_tree_node_update(node, node->var, val);
+	}
+
+	if (!state_family_name(fam, index)) {
+		return -1;
+	}
+
+	return state_setinfo(nptr, fam->name[index], val);
+}
+
+int state_family_setinfo_double(st_family_t *fam, st_tree_t **nptr, int index,
+	double value, int precision, double deadband, char *buf, size_t bufsize)
+{
+	st_tree_t	*node = state_family_find(fam, *nptr, index);
+
+	if (!node && !state_family_name(fam, index)) {
+		return -1;
+	}
+
+	return st_tree_setinfo_double(nptr, node, fam->name[index],
+		value, precision, deadband, buf, bufsize);
+}
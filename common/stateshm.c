@@ -0,0 +1,550 @@
+/* stateshm.c - device states shared by a driver with upsd through memory
+
+   Copyright (C)
+	2026	Network UPS Tools developers
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+/* A driver asked for it (with SHMSTATE on its socket) publishes its whole
+ * state tree into a file mapped in memory once per main loop iteration
+ * where something changed, and only rings the socket with the sequence
+ * number; the reader copies the records out and applies them as argument
+ * lists, without formatting, escaping or tokenizing any text.
+ * The same records, saved to a file by stateshm_save(), are the snapshot
+ * a driver started with "statesnapshot" serves its last data from.
+ */
+
+#include "config.h"	/* must be first */
+
+#include "common.h"
+#include "stateshm.h"
+
+#include <stddef.h>
+
+#ifdef WITH_STATESHM
+# include <sys/types.h>
+# include <sys/stat.h>
+# include <sys/mman.h>
+# include <fcntl.h>
+#endif	/* WITH_STATESHM */
+
+/* initial size of a region, it grows by doubling when needed */
+#define STATESHM_INITIAL_SIZE	65536
+
+/* how often a reader retries a copy which was being written over */
+#define STATESHM_READ_TRIES	8
+
+#define STATESHM_HEADER_SIZE	(offsetof(stateshm_t, data))
+
+/* largest snapshot file accepted, much more than any device has */
+#define STATESHM_SNAPSHOT_MAXLEN	(16 * 1024 * 1024)
+
+/* start of a snapshot file, the records follow */
+typedef struct {
+	uint32_t	magic;
+	uint32_t	version;
+	int64_t	saved;	/* time(), when written */
+	uint64_t	len;	/* of the records */
+} stateshm_snapshot_t;
+
+void stateshm_init(stateshm_ctx_t *ctx)
+{
+	memset(ctx, 0, sizeof(*ctx));
+	ctx->fd = -1;
+}
+
+static void record(stateshm_ctx_t *ctx, size_t numargs, const char **arg)
+{
+	size_t	i, need = 1;
+
+	for (i = 0; i < numargs; i++) {
+		need += strlen(arg[i]) + 1;
+	}
+
+	if (ctx->len + need > ctx->bufsize) {
+		while (ctx->len + need > ctx->bufsize) {
+			ctx->bufsize = ctx->bufsize ? 2 * ctx->bufsize : LARGEBUF;
+		}
+		ctx->buf = xrealloc(ctx->buf, ctx->bufsize);
+	}
+
+	ctx->buf[ctx->len++] = (char)numargs;
+
+	for (i = 0; i < numargs; i++) {
+		size_t	len = strlen(arg[i]) + 1;
+
+		memcpy(ctx->buf + ctx->len, arg[i], len);
+		ctx->len += len;
+	}
+}
+
+/* enum values are kept escaped for the wire, records carry them as is */
+static void unescape(const char *src, char *dest, size_t destsize)
+{
+	size_t	len = 0;
+
+	for (; *src && len + 1 < destsize; src++) {
+		if (*src == '\\' && src[1]) {
+			src++;
+		}
+		dest[len++] = *src;
+	}
+
+	dest[len] = '\0';
+}
+
+static void record_tree(stateshm_ctx_t *ctx, const st_tree_t *node)
+{
+	const enum_t	*etmp;
+	const range_t	*rtmp;
+	const char	*arg[STATESHM_MAXARGS];
+	char	buf1[ST_MAX_VALUE_LEN], buf2[SMALLBUF];
+	size_t	n;
+
+	if (!node) {
+		return;
+	}
+
+	record_tree(ctx, node->left);
+
+	arg[0] = "SETINFO";
+	arg[1] = node->var;
+	arg[2] = node->raw;
+	record(ctx, 3, arg);
+
+	for (etmp = node->enum_list; etmp; etmp = etmp->next) {
+		unescape(etmp->val, buf1, sizeof(buf1));
+		arg[0] = "ADDENUM";
+		arg[2] = buf1;
+		record(ctx, 3, arg);
+	}
+
+	for (rtmp = node->range_list; rtmp; rtmp = rtmp->next) {
+		snprintf(buf1, sizeof(buf1), "%d", rtmp->min);
+		snprintf(buf2, sizeof(buf2), "%d", rtmp->max);
+		arg[0] = "ADDRANGE";
+		arg[2] = buf1;
+		arg[3] = buf2;
+		record(ctx, 4, arg);
+	}
+
+	if (node->aux) {
+		snprintf(buf1, sizeof(buf1), "%ld", node->aux);
+		arg[0] = "SETAUX";
+		arg[2] = buf1;
+		record(ctx, 3, arg);
+	}
+
+	if (node->flags & (ST_FLAG_RW | ST_FLAG_STRING | ST_FLAG_NUMBER)) {
+		n = 2;
+		arg[0] = "SETFLAGS";
+		if (node->flags & ST_FLAG_RW) {
+			arg[n++] = "RW";
+		}
+		if (node->flags & ST_FLAG_STRING) {
+			arg[n++] = "STRING";
+		}
+		if (node->flags & ST_FLAG_NUMBER) {
+			arg[n++] = "NUMBER";
+		}
+		record(ctx, n, arg);
+	}
+
+	record_tree(ctx, node->right);
+}
+
+static void record_all(stateshm_ctx_t *ctx, const st_tree_t *root,
+	const cmdlist_t *cmdlist)
+{
+	const char	*arg[2];
+
+	ctx->len = 0;
+	record_tree(ctx, root);
+
+	arg[0] = "ADDCMD";
+	for (; cmdlist; cmdlist = cmdlist->next) {
+		arg[1] = cmdlist->name;
+		record(ctx, 2, arg);
+	}
+}
+
+#ifdef WITH_STATESHM
+
+static int stateshm_map(stateshm_ctx_t *ctx, size_t size, int prot)
+{
+	void	*map;
+
+	map = mmap(NULL, size, prot, MAP_SHARED, ctx->fd, 0);
+	if (map == MAP_FAILED) {
+		return 0;
+	}
+
+	if (ctx->map) {
+		munmap((void *)ctx->map, ctx->mapsize);
+	}
+
+	ctx->map = map;
+	ctx->mapsize = size;
+	return 1;
+}
+
+int stateshm_create(stateshm_ctx_t *ctx, const char *fn)
+{
+	stateshm_close(ctx);
+
+	/* readers still mapping an older file keep it until they re-open */
+	unlink(fn);
+
+	ctx->fd = open(fn, O_RDWR | O_CREAT | O_EXCL, 0660);
+	if (ctx->fd < 0) {
+		return 0;
+	}
+
+	set_close_on_exec(ctx->fd);
+
+	if (ftruncate(ctx->fd, STATESHM_INITIAL_SIZE) != 0
+	 || !stateshm_map(ctx, STATESHM_INITIAL_SIZE, PROT_READ | PROT_WRITE)
+	) {
+		int	err = errno;
+
+		close(ctx->fd);
+		unlink(fn);
+		ctx->fd = -1;
+		errno = err;
+		return 0;
+	}
+
+	ctx->fn = xstrdup(fn);
+	ctx->map->magic = STATESHM_MAGIC;
+	ctx->map->version = STATESHM_VERSION;
+	ctx->map->seq = 0;
+	ctx->map->len = 0;
+	ctx->map->size = STATESHM_INITIAL_SIZE;
+
+	return 1;
+}
+
+unsigned long stateshm_publish(stateshm_ctx_t *ctx, const st_tree_t *root,
+	const cmdlist_t *cmdlist)
+{
+	size_t	need;
+
+	if (!ctx->map || !ctx->fn) {
+		return 0;
+	}
+
+	record_all(ctx, root, cmdlist);
+
+	need = STATESHM_HEADER_SIZE + ctx->len;
+
+	if (need > ctx->mapsize) {
+		size_t	size = ctx->mapsize;
+
+		while (size < need) {
+			size *= 2;
+		}
+
+		/* readers see the new size and map the file again */
+		if (ftruncate(ctx->fd, (off_t)size) != 0
+		 || !stateshm_map(ctx, size, PROT_READ | PROT_WRITE)
+		) {
+			upslog_with_errno(LOG_ERR, "%s: can't grow %s to %" PRIuSIZE " bytes",
+				__func__, ctx->fn, size);
+			return 0;
+		}
+
+		ctx->map->size = size;
+	}
+
+	ctx->map->seq++;
+	__sync_synchronize();
+
+	memcpy(ctx->map->data, ctx->buf, ctx->len);
+	ctx->map->len = ctx->len;
+
+	__sync_synchronize();
+	ctx->map->seq++;
+
+	return ctx->map->seq;
+}
+
+int stateshm_open(stateshm_ctx_t *ctx, const char *fn)
+{
+	struct stat	st;
+
+	stateshm_close(ctx);
+
+	ctx->fd = open(fn, O_RDONLY);
+	if (ctx->fd < 0) {
+		return 0;
+	}
+
+	set_close_on_exec(ctx->fd);
+
+	if (fstat(ctx->fd, &st) != 0
+	 || (size_t)st.st_size < STATESHM_HEADER_SIZE
+	 || !stateshm_map(ctx, (size_t)st.st_size, PROT_READ)
+	) {
+		stateshm_close(ctx);
+		errno = EINVAL;
+		return 0;
+	}
+
+	if (ctx->map->magic != STATESHM_MAGIC || ctx->map->version != STATESHM_VERSION) {
+		stateshm_close(ctx);
+		errno = EPROTO;
+		return 0;
+	}
+
+	return 1;
+}
+
+int stateshm_read(stateshm_ctx_t *ctx)
+{
+	int	tries;
+
+	if (!ctx->map) {
+		return -1;
+	}
+
+	for (tries = 0; tries < STATESHM_READ_TRIES; tries++) {
+		unsigned long	seq = ctx->map->seq;
+		size_t	size, len;
+
+		if (seq & 1) {
+			continue;	/* being written */
+		}
+
+		if (seq == ctx->seq) {
+			return 0;
+		}
+
+		__sync_synchronize();
+
+		size = ctx->map->size;
+		len = ctx->map->len;
+
+		if (size > ctx->mapsize) {
+			if (!stateshm_map(ctx, size, PROT_READ)) {
+				return -1;
+			}
+			continue;
+		}
+
+		if (STATESHM_HEADER_SIZE + len > ctx->mapsize) {
+			continue;
+		}
+
+		if (len > ctx->bufsize) {
+			ctx->bufsize = len;
+			ctx->buf = xrealloc(ctx->buf, ctx->bufsize);
+		}
+
+		memcpy(ctx->buf, ctx->map->data, len);
+
+		__sync_synchronize();
+
+		if (ctx->map->seq != seq) {
+			continue;
+		}
+
+		ctx->seq = seq;
+		ctx->len = len;
+		return 1;
+	}
+
+	return -1;
+}
+
+#else	/* !WITH_STATESHM */
+
+int stateshm_create(stateshm_ctx_t *ctx, const char *fn)
+{
+	NUT_UNUSED_VARIABLE(ctx);
+	NUT_UNUSED_VARIABLE(fn);
+	errno = ENOSYS;
+	return 0;
+}
+
+unsigned long stateshm_publish(stateshm_ctx_t *ctx, const st_tree_t *root,
+	const cmdlist_t *cmdlist)
+{
+	NUT_UNUSED_VARIABLE(ctx);
+	NUT_UNUSED_VARIABLE(root);
+	NUT_UNUSED_VARIABLE(cmdlist);
+	return 0;
+}
+
+int stateshm_open(stateshm_ctx_t *ctx, const char *fn)
+{
+	NUT_UNUSED_VARIABLE(ctx);
+	NUT_UNUSED_VARIABLE(fn);
+	errno = ENOSYS;
+	return 0;
+}
+
+int stateshm_read(stateshm_ctx_t *ctx)
+{
+	NUT_UNUSED_VARIABLE(ctx);
+	return -1;
+}
+
+#endif	/* WITH_STATESHM */
+
+int stateshm_save(stateshm_ctx_t *ctx, const char *fn,
+	const st_tree_t *root, const cmdlist_t *cmdlist)
+{
+	stateshm_snapshot_t	hdr;
+	char	tmpfn[NUT_PATH_MAX + 1];
+	FILE	*f;
+	int	err;
+
+	record_all(ctx, root, cmdlist);
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.magic = STATESHM_SNAPSHOT_MAGIC;
+	hdr.version = STATESHM_VERSION;
+	hdr.saved = (int64_t)time(NULL);
+	hdr.len = (uint64_t)ctx->len;
+
+	snprintf(tmpfn, sizeof(tmpfn), "%s.tmp", fn);
+	if ((f = fopen(tmpfn, "wb")) == NULL) {
+		return 0;
+	}
+
+	if (fwrite(&hdr, sizeof(hdr), 1, f) != 1
+	 || (ctx->len && fwrite(ctx->buf, ctx->len, 1, f) != 1)
+	 || fflush(f) != 0
+#ifndef WIN32
+	 || fsync(fileno(f)) != 0
+#endif	/* !WIN32 */
+	) {
+		err = errno;
+		fclose(f);
+		unlink(tmpfn);
+		errno = err;
+		return 0;
+	}
+
+	if (fclose(f) != 0) {
+		err = errno;
+		unlink(tmpfn);
+		errno = err;
+		return 0;
+	}
+
+#ifdef WIN32
+	/* rename() does not replace a file there */
+	unlink(fn);
+#endif	/* WIN32 */
+
+	if (rename(tmpfn, fn) != 0) {
+		err = errno;
+		unlink(tmpfn);
+		errno = err;
+		return 0;
+	}
+
+	return 1;
+}
+
+time_t stateshm_load(stateshm_ctx_t *ctx, const char *fn)
+{
+	stateshm_snapshot_t	hdr;
+	FILE	*f;
+
+	if ((f = fopen(fn, "rb")) == NULL) {
+		return 0;
+	}
+
+	if (fread(&hdr, sizeof(hdr), 1, f) != 1
+	 || hdr.magic != STATESHM_SNAPSHOT_MAGIC
+	 || hdr.version != STATESHM_VERSION
+	 || hdr.saved <= 0
+	 || hdr.len > STATESHM_SNAPSHOT_MAXLEN
+	) {
+		fclose(f);
+		errno = EINVAL;
+		return 0;
+	}
+
+	if (hdr.len > ctx->bufsize) {
+		ctx->bufsize = (size_t)hdr.len;
+		ctx->buf = xrealloc(ctx->buf, ctx->bufsize);
+	}
+
+	ctx->len = (size_t)hdr.len;
+	if (ctx->len && fread(ctx->buf, ctx->len, 1, f) != 1) {
+		fclose(f);
+		ctx->len = 0;
+		errno = EINVAL;
+		return 0;
+	}
+
+	fclose(f);
+	return (time_t)hdr.saved;
+}
+
+size_t stateshm_next(const stateshm_ctx_t *ctx, size_t *off, char **arg)
+{
+	size_t	numargs, i, pos = *off;
+
+	if (pos >= ctx->len) {
+		return 0;
+	}
+
+	numargs = (unsigned char)ctx->buf[pos++];
+	if (numargs < 1 || numargs > STATESHM_MAXARGS) {
+		return 0;
+	}
+
+	for (i = 0; i < numargs; i++) {
+		const char	*end;
+
+		if (pos >= ctx->len
+		 || (end = memchr(ctx->buf + pos, '\0', ctx->len - pos)) == NULL
+		) {
+			return 0;	/* cut short, should not happen */
+		}
+
+		arg[i] = ctx->buf + pos;
+		pos = (size_t)(end - ctx->buf) + 1;
+	}
+
+	*off = pos;
+	return numargs;
+}
+
+void stateshm_close(stateshm_ctx_t *ctx)
+{
+#ifdef WITH_STATESHM
+	if (ctx->map) {
+		munmap((void *)ctx->map, ctx->mapsize);
+	}
+
+	if (ctx->fd >= 0) {
+		close(ctx->fd);
+	}
+
+	if (ctx->fn) {
+		unlink(ctx->fn);
+	}
+#endif	/* WITH_STATESHM */
+
+	free(ctx->fn);
+	free(ctx->buf);
+	stateshm_init(ctx);
+}
@@ -36,6 +36,7 @@
 
 #include "nut_stdint.h"
 #include "str.h"
+#include "common.h"	/* for str_hash_nocase() and fnv1a_hash() */
 
 char	*str_trim(char *string, const char character)
 {
@@ -628,6 +629,29 @@ int str_ends_with(const char *s, const char *suff) {
 	return (slen >= sufflen) && (!memcmp(s + slen - sufflen, suff, sufflen));
 }
 
+size_t	str_hash_nocase(const char *string)
+{
+	size_t	hash = FNV1A_INIT;
+	const unsigned char	*p;
+
+	for (p = (const unsigned char *)string; *p; p++) {
+		hash = (hash ^ (size_t)tolower(*p)) * 16777619U;
+	}
+
+	return hash;
+}
+
+size_t	fnv1a_hash(size_t hash, const void *buf, size_t len)
+{
+	const unsigned char	*p = buf;
+
+	for (; len > 0; len--, p++) {
+		hash = (hash ^ *p) * 16777619U;
+	}
+
+	return hash;
+}
+
 #ifndef HAVE_STRTOF
 # include <errno.h>
 # include <stdio.h>
@@ -27,8 +27,98 @@
 #include "upsconf.h"
 #include "common.h"
 #include "parseconf.h"
+#include "nut_stdint.h"
+
+/* The index of ups.conf tells where its sections begin, as found by the
+ * last full parse (by upsdrvctl, upsd or a driver), so that each driver
+ * of a large setup only parses the global part and its own section. It
+ * is kept in the state path, and only used while the size and hash of
+ * the ups.conf contents match: a header, the sections, then their names.
+ */
+#define UPSCONF_INDEX_NAME	"ups.conf.index"
+#define UPSCONF_INDEX_MAGIC	"NUTUCIX1"
+
+typedef struct {
+	char	magic[8];
+	uint64_t	hash;	/* FNV-1a of the ups.conf contents */
+	uint64_t	size;	/* of the ups.conf contents */
+	uint32_t	count;	/* sections after this header */
+	uint32_t	nameslen;	/* bytes of their names after the sections */
+} upsconf_index_hdr_t;
+
+typedef struct {
+	uint64_t	offset;	/* where the [section] line begins */
+	uint64_t	length;	/* up to the next section, or the end */
+	uint32_t	linenum;	/* of the [section] line */
+	uint32_t	name;	/* offset of the NUL-terminated name in names */
+} upsconf_index_sect_t;
+
+/* The settings of the last full parse, which read_upsconf() calls back
+ * again as long as ups.conf did not change (e.g. on reload of upsd) */
+typedef struct upsconf_arg_s {
+	char	*section;
+	char	*var;
+	char	*val;
+	struct upsconf_arg_s	*next;
+} upsconf_arg_t;
+
+/* What a full parse finds out, for the index and the cache above */
+typedef struct {
+	upsconf_index_sect_t	*sect;
+	size_t	count, alloc;
+	char	*names;
+	size_t	nameslen;
+	upsconf_arg_t	*args, **argtail;
+	int	errors;
+} upsconf_scan_t;
 
 	static	char	*ups_section;
+	static	upsconf_scan_t	*upsconf_scan;
+
+static	upsconf_arg_t	*upsconf_cache = NULL;
+static	uint64_t	upsconf_cache_hash = 0, upsconf_cache_size = 0;
+
+static uint64_t upsconf_hash(const char *buf, size_t len)
+{
+	uint64_t	hash = 0xcbf29ce484222325ULL;
+	size_t	i;
+
+	for (i = 0; i < len; i++) {
+		hash ^= (unsigned char)buf[i];
+		hash *= 0x100000001b3ULL;
+	}
+
+	return hash;
+}
+
+static void upsconf_cache_free(upsconf_arg_t *arg)
+{
+	while (arg) {
+		upsconf_arg_t	*next = arg->next;
+
+		free(arg->section);
+		free(arg->var);
+		free(arg->val);
+		free(arg);
+		arg = next;
+	}
+}
+
+/* pass one setting on, keeping it for the cache during a full parse */
+static void upsconf_emit(char *section, char *var, char *val)
+{
+	if (upsconf_scan && upsconf_scan->argtail) {
+		upsconf_arg_t	*arg = xcalloc(1, sizeof(*arg));
+
+		arg->section = section ? xstrdup(section) : NULL;
+		arg->var = xstrdup(var);
+		arg->val = val ? xstrdup(val) : NULL;
+		*upsconf_scan->argtail = arg;
+		upsconf_scan->argtail = &arg->next;
+	}
+
+	do_upsconf_args(section, var, val);
+}
 
 /* handle arguments separated by parseconf */
 static void conf_args(size_t numargs, char **arg)
@@ -48,7 +138,7 @@ static void conf_args(size_t numargs, char **arg)
 
 	/* handle 'foo' (flag) */
 	if (numargs == 1) {
-		do_upsconf_args(ups_section, arg[0], NULL);
+		upsconf_emit(ups_section, arg[0], NULL);
 		return;
 	}
 
@@ -57,7 +147,7 @@ static void conf_args(size_t numargs, char **arg)
 
 	/* handle 'foo = bar', 'foo=bar', 'foo =bar' or 'foo= bar' forms */
 	if (!strcmp(arg[1], "=")) {
-		do_upsconf_args(ups_section, arg[0], arg[2]);
+		upsconf_emit(ups_section, arg[0], arg[2]);
 		return;
 	}
 }
@@ -68,6 +158,286 @@ static void upsconf_err(const char *errmsg)
 	upslogx(LOG_ERR, "Fatal error in parseconf(ups.conf): %s", errmsg);
 }
 
+/* count the lines in buf, to report parse errors where they are */
+static int upsconf_lines(const char *buf, size_t len)
+{
+	const char	*p = buf, *end = buf + len;
+	int	lines = 0;
+
+	while (p < end && (p = memchr(p, '\n', (size_t)(end - p))) != NULL) {
+		lines++;
+		p++;
+	}
+
+	return lines;
+}
+
+/* note down a section header (its name is namelen bytes long) which
+ * begins at offset on line linenum */
+static void upsconf_scan_sect(upsconf_scan_t *scan, size_t offset,
+	int linenum, const char *name, size_t namelen)
+{
+	if (scan->count == scan->alloc) {
+		scan->alloc = scan->alloc ? scan->alloc * 2 : 16;
+		scan->sect = xrealloc(scan->sect, scan->alloc * sizeof(*scan->sect));
+	}
+
+	scan->sect[scan->count].offset = (uint64_t)offset;
+	scan->sect[scan->count].length = 0;
+	scan->sect[scan->count].linenum = (uint32_t)linenum;
+	scan->sect[scan->count].name = (uint32_t)scan->nameslen;
+	scan->count++;
+
+	scan->names = xrealloc(scan->names, scan->nameslen + namelen + 1);
+	memcpy(scan->names + scan->nameslen, name, namelen);
+	scan->names[scan->nameslen + namelen] = '\0';
+	scan->nameslen += namelen + 1;
+}
+
+/* parse len bytes of the ups.conf contents (fn) from buf, which begin on
+ * line linenum, and call back do_upsconf_args() for the settings there;
+ * a full parse also notes down in scan where the sections begin */
+static void upsconf_parse(const char *fn, const char *buf, size_t len,
+	int linenum, upsconf_scan_t *scan)
+{
+	PCONF_CTX_t	ctx;
+	size_t	pos = 0, linestart = 0, used;
+	int	ret;
+
+	pconf_init(&ctx, upsconf_err);
+
+	while (pos < len) {
+		ret = pconf_buf(&ctx, buf + pos, len - pos, &used);
+		pos += used;
+
+		if (ret == 0) {
+			/* ends without a newline, tie the last line off */
+			ret = pconf_buf(&ctx, "\n", 1, &used);
+			if (ret == 0)
+				break;	/* e.g. in an unbalanced quote */
+		}
+
+		if (ret < 0) {
+			upslogx(LOG_ERR, "Parse error: %s:%d: %s",
+				fn, linenum, ctx.errmsg);
+			ctx.error = 0;
+			if (scan)
+				scan->errors++;
+		} else {
+			if (scan && ctx.numargs > 0
+			 && (ctx.arglist[0][0] == '[')
+			 && (ctx.arglist[0][strlen(ctx.arglist[0])-1] == ']')
+			) {
+				upsconf_scan_sect(scan, linestart, linenum,
+					&ctx.arglist[0][1], strlen(ctx.arglist[0]) - 2);
+			}
+
+			conf_args(ctx.numargs, ctx.arglist);
+		}
+
+		linenum += upsconf_lines(buf + linestart, pos - linestart);
+		linestart = pos;
+	}
+
+	pconf_finish(&ctx);
+}
+
+/* read the whole ups.conf (fn) into memory; returns NULL (or aborts the
+ * program when fatal_errors is set) if it can not */
+static char *upsconf_load(const char *fn, size_t *len, int fatal_errors)
+{
+	FILE	*f;
+	char	*buf = NULL;
+	size_t	alloc = 0, ret;
+
+	*len = 0;
+
+	if ((f = fopen(fn, "rb")) == NULL) {
+		if (fatal_errors) {
+			fatal_with_errno(EXIT_FAILURE, "Can't open %s", fn);
+		}
+		upslog_with_errno(LOG_WARNING, "Can't open %s", fn);
+		return NULL;
+	}
+
+	do {
+		if (*len == alloc) {
+			alloc = alloc ? alloc * 2 : LARGEBUF * 16;
+			buf = xrealloc(buf, alloc);
+		}
+		ret = fread(buf + *len, 1, alloc - *len, f);
+		*len += ret;
+	} while (ret > 0);
+
+	fclose(f);
+
+	return buf;
+}
+
+/* the path name of the index */
+static void upsconf_index_fn(char *fn, size_t fnlen)
+{
+	snprintf(fn, fnlen, "%s/%s", dflt_statepath(), UPSCONF_INDEX_NAME);
+}
+
+/* read the index, if any is there for ups.conf contents of this size and
+ * hash; returns the sections (to free) and their count, or NULL */
+static upsconf_index_sect_t *upsconf_index_load(uint64_t hash, size_t size,
+	size_t *count, char **names)
+{
+	char	fn[NUT_PATH_MAX + 1];
+	FILE	*f;
+	upsconf_index_hdr_t	hdr;
+	upsconf_index_sect_t	*sect = NULL;
+	size_t	i;
+	uint64_t	end = 0;
+
+	*count = 0;
+	*names = NULL;
+
+	upsconf_index_fn(fn, sizeof(fn));
+	if ((f = fopen(fn, "rb")) == NULL)
+		return NULL;
+
+	if (fread(&hdr, sizeof(hdr), 1, f) != 1
+	 || memcmp(hdr.magic, UPSCONF_INDEX_MAGIC, sizeof(hdr.magic)) != 0
+	 || hdr.hash != hash || hdr.size != (uint64_t)size
+	 || hdr.count > size || hdr.nameslen > size || hdr.nameslen < 1
+	) {
+		fclose(f);
+		return NULL;
+	}
+
+	if (hdr.count > 0) {
+		sect = xcalloc(hdr.count, sizeof(*sect));
+	}
+	*names = xcalloc(hdr.nameslen, 1);
+	if ((hdr.count > 0 && fread(sect, sizeof(*sect), hdr.count, f) != hdr.count)
+	 || fread(*names, 1, hdr.nameslen, f) != hdr.nameslen
+	 || (*names)[hdr.nameslen - 1] != '\0'
+	) {
+		goto invalid;
+	}
+
+	/* sections follow each other up to the end of the contents */
+	for (i = 0; i < hdr.count; i++) {
+		if (sect[i].offset < end || sect[i].offset > (uint64_t)size
+		 || sect[i].length > (uint64_t)size - sect[i].offset
+		 || sect[i].name >= hdr.nameslen
+		) {
+			goto invalid;
+		}
+		end = sect[i].offset + sect[i].length;
+	}
+
+	fclose(f);
+	*count = hdr.count;
+	return sect;
+
+invalid:
+	upsdebugx(1, "%s: ignoring the invalid %s", __func__, fn);
+	fclose(f);
+	free(sect);
+	free(*names);
+	*names = NULL;
+	return NULL;
+}
+
+/* save the index of a full parse, unless it is already there */
+static void upsconf_index_save(const upsconf_scan_t *scan, uint64_t hash, size_t size)
+{
+	char	fn[NUT_PATH_MAX + 1], tmpfn[NUT_PATH_MAX + 32];
+	upsconf_index_sect_t	*sect;
+	upsconf_index_hdr_t	hdr;
+	char	*names;
+	size_t	count, i;
+	FILE	*f;
+
+	if ((sect = upsconf_index_load(hash, size, &count, &names)) != NULL || names != NULL) {
+		free(sect);
+		free(names);
+		return;
+	}
+
+	/* each section goes on up to the next one */
+	for (i = 0; i < scan->count; i++) {
+		scan->sect[i].length = ((i + 1 < scan->count) ? scan->sect[i + 1].offset : (uint64_t)size)
+			- scan->sect[i].offset;
+	}
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, UPSCONF_INDEX_MAGIC, sizeof(hdr.magic));
+	hdr.hash = hash;
+	hdr.size = (uint64_t)size;
+	hdr.count = (uint32_t)scan->count;
+	hdr.nameslen = (uint32_t)scan->nameslen + 1;
+
+	upsconf_index_fn(fn, sizeof(fn));
+	snprintf(tmpfn, sizeof(tmpfn), "%s.%" PRIdMAX ".tmp", fn, (intmax_t)getpid());
+	if ((f = fopen(tmpfn, "wb")) == NULL) {
+		upsdebug_with_errno(1, "%s: can not write %s", __func__, tmpfn);
+		return;
+	}
+
+	if (fwrite(&hdr, sizeof(hdr), 1, f) != 1
+	 || (scan->count && fwrite(scan->sect, sizeof(*scan->sect), scan->count, f) != scan->count)
+	 || (scan->nameslen && fwrite(scan->names, 1, scan->nameslen, f) != scan->nameslen)
+	 || fwrite("", 1, 1, f) != 1
+	 || fclose(f) != 0
+	) {
+		upsdebug_with_errno(1, "%s: can not write %s", __func__, tmpfn);
+		unlink(tmpfn);
+		return;
+	}
+
+#ifdef WIN32
+	/* rename() does not replace a file there */
+	unlink(fn);
+#endif	/* WIN32 */
+
+	if (rename(tmpfn, fn) != 0) {
+		upsdebug_with_errno(1, "%s: can not rename %s", __func__, tmpfn);
+		unlink(tmpfn);
+		return;
+	}
+
+	upsdebugx(2, "%s: saved %s with %" PRIuSIZE " sections",
+		__func__, fn, scan->count);
+}
+
+/* parse the whole ups.conf contents from buf and save its index; with
+ * cache set, keep the settings for the next read_upsconf() too */
+static void upsconf_parse_full(const char *fn, const char *buf, size_t len,
+	uint64_t hash, int cache)
+{
+	upsconf_scan_t	scan;
+
+	memset(&scan, 0, sizeof(scan));
+	if (cache) {
+		scan.argtail = &scan.args;
+		upsconf_cache_free(upsconf_cache);
+		upsconf_cache = NULL;
+	}
+
+	upsconf_scan = &scan;
+	upsconf_parse(fn, buf, len, 1, &scan);
+	upsconf_scan = NULL;
+
+	/* errors are to be reported again on the next read */
+	if (cache && scan.errors == 0) {
+		upsconf_cache = scan.args;
+		upsconf_cache_hash = hash;
+		upsconf_cache_size = (uint64_t)len;
+	} else {
+		upsconf_cache_free(scan.args);
+	}
+
+	upsconf_index_save(&scan, hash, len);
+
+	free(scan.sect);
+	free(scan.names);
+}
+
 /* open the ups.conf, parse it, and call back do_upsconf_args()
  * returns -1 (or aborts the program) in case of errors;
  * returns 1 if processing finished successfully
@@ -76,35 +446,85 @@ static void upsconf_err(const char *errmsg)
 int read_upsconf(int fatal_errors)
 {
 	char	fn[NUT_PATH_MAX + 1];
-	PCONF_CTX_t	ctx;
+	char	*buf;
+	size_t	len;
+	uint64_t	hash;
 
 	ups_section = NULL;
 	snprintf(fn, sizeof(fn), "%s/ups.conf", confpath());
 
-	pconf_init(&ctx, upsconf_err);
+	if ((buf = upsconf_load(fn, &len, fatal_errors)) == NULL)
+		return -1;
 
-	if (!pconf_file_begin(&ctx, fn)) {
-		if (fatal_errors) {
-			fatalx(EXIT_FAILURE, "Can't open %s: %s", fn, ctx.errmsg);
-		} else {
-			upslogx(LOG_WARNING, "Can't open %s: %s", fn, ctx.errmsg);
-			return -1;
+	hash = upsconf_hash(buf, len);
+
+	if (upsconf_cache && upsconf_cache_hash == hash
+	 && upsconf_cache_size == (uint64_t)len
+	) {
+		upsconf_arg_t	*arg;
+
+		upsdebugx(2, "%s: %s did not change, using its settings as parsed before",
+			__func__, fn);
+		for (arg = upsconf_cache; arg; arg = arg->next) {
+			do_upsconf_args(arg->section, arg->var, arg->val);
 		}
+	} else {
+		upsconf_parse_full(fn, buf, len, hash, 1);
 	}
 
-	while (pconf_file_next(&ctx)) {
-		if (pconf_parse_error(&ctx)) {
-			upslogx(LOG_ERR, "Parse error: %s:%d: %s",
-				fn, ctx.linenum, ctx.errmsg);
-			continue;
+	free(buf);
+	free(ups_section);
+	ups_section = NULL;
+
+	return 1; /* Handled OK */
+}
+
+/* like read_upsconf(), but parse only the global settings and those of
+ * the section(s) called section, if the index of ups.conf is current */
+int read_upsconf_section(const char *section, int fatal_errors)
+{
+	char	fn[NUT_PATH_MAX + 1];
+	char	*buf, *names;
+	size_t	len, count, i, first;
+	uint64_t	hash;
+	upsconf_index_sect_t	*sect;
+
+	if (section == NULL)
+		return read_upsconf(fatal_errors);
+
+	ups_section = NULL;
+	snprintf(fn, sizeof(fn), "%s/ups.conf", confpath());
+
+	if ((buf = upsconf_load(fn, &len, fatal_errors)) == NULL)
+		return -1;
+
+	hash = upsconf_hash(buf, len);
+
+	if ((sect = upsconf_index_load(hash, len, &count, &names)) == NULL && names == NULL) {
+		upsdebugx(2, "%s: no current index of %s, parsing it all",
+			__func__, fn);
+		upsconf_parse_full(fn, buf, len, hash, 0);
+	} else {
+		first = count ? (size_t)sect[0].offset : len;
+		upsconf_parse(fn, buf, first, 1, NULL);
+
+		for (i = 0; i < count; i++) {
+			if (strcmp(names + sect[i].name, section) != 0)
+				continue;
+
+			free(ups_section);
+			ups_section = NULL;
+			upsconf_parse(fn, buf + sect[i].offset, (size_t)sect[i].length,
+				(int)sect[i].linenum, NULL);
 		}
 
-		conf_args(ctx.numargs, ctx.arglist);
+		free(sect);
+		free(names);
 	}
 
-	pconf_finish(&ctx);
-
+	free(buf);
 	free(ups_section);
+	ups_section = NULL;
 
 	return 1; /* Handled OK */
 }
@@ -494,6 +494,7 @@ static HANDLE		pipe_connection_handle;
 OVERLAPPED		pipe_connection_overlapped;
 pipe_conn_t		*pipe_connhead = NULL;
 static const char	*named_pipe_name=NULL;
+void			(*pipe_create_hook)(HANDLE handle) = NULL;
 
 void pipe_create(const char * pipe_name)
 {
@@ -546,6 +547,12 @@ void pipe_create(const char * pipe_name)
 		fatal_with_errno(EXIT_FAILURE, "Can't create event");
 	}
 
+	/* e.g. upsd associates it with its I/O completion port, which
+	 * must happen before any overlapped request is started on it */
+	if (pipe_create_hook) {
+		pipe_create_hook(pipe_connection_handle);
+	}
+
 	/* Wait for a connection */
 	ret = ConnectNamedPipe(pipe_connection_handle,&pipe_connection_overlapped);
 	if(ret == 0 && GetLastError() != ERROR_IO_PENDING ) {
@@ -633,6 +640,121 @@ int pipe_ready(pipe_conn_t *conn)
 	return 1;
 }
 
+static int pipe_read_post(pipe_reads_t *reads, size_t i)
+{
+	HANDLE	event = reads->ov[i].hEvent;
+
+	memset(&reads->ov[i], 0, sizeof(reads->ov[i]));
+	reads->ov[i].hEvent = event;
+
+	/* -1 to be sure to have a trailing 0 */
+	if (!ReadFile(reads->handle, reads->buf[i], reads->bufsize - 1, NULL, &reads->ov[i])
+	 && GetLastError() != ERROR_IO_PENDING && GetLastError() != ERROR_MORE_DATA
+	) {
+		/* no completion would ever be reported for it */
+		return 0;
+	}
+
+	reads->pending[i] = 1;
+	return 1;
+}
+
+int pipe_reads_start(pipe_reads_t *reads, HANDLE handle, HANDLE event, size_t bufsize)
+{
+	size_t	i;
+
+	if (reads->bufsize != (DWORD)bufsize) {
+		pipe_reads_free(reads);
+	}
+
+	reads->handle = handle;
+	reads->bufsize = (DWORD)bufsize;
+	reads->next = 0;
+
+	for (i = 0; i < PIPE_READS_COUNT; i++) {
+		if (!reads->buf[i]) {
+			reads->buf[i] = xmalloc(bufsize);
+		}
+		reads->pending[i] = 0;
+		reads->ov[i].hEvent = event;
+	}
+
+	for (i = 0; i < PIPE_READS_COUNT; i++) {
+		if (!pipe_read_post(reads, i)) {
+			pipe_reads_stop(reads);
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+int pipe_reads_next(pipe_reads_t *reads, char **buf, DWORD *len)
+{
+	size_t	i = reads->next;
+
+	if (!reads->pending[i]) {
+		return -1;	/* pipe_reads_again() failed, or stopped */
+	}
+
+	/* e.g. a completion of a later read, this one is not done yet */
+	if (!HasOverlappedIoCompleted(&reads->ov[i])) {
+		return 0;
+	}
+
+	*len = 0;
+	if (!GetOverlappedResult(reads->handle, &reads->ov[i], len, FALSE)
+	 && GetLastError() != ERROR_MORE_DATA	/* the rest comes with the next one */
+	) {
+		reads->pending[i] = 0;
+		return -1;
+	}
+
+	reads->pending[i] = 0;
+	reads->buf[i][*len] = '\0';
+	*buf = reads->buf[i];
+
+	return 1;
+}
+
+int pipe_reads_again(pipe_reads_t *reads)
+{
+	size_t	i = reads->next;
+
+	/* now the newest one */
+	reads->next = (i + 1) % PIPE_READS_COUNT;
+
+	return pipe_read_post(reads, i);
+}
+
+void pipe_reads_stop(pipe_reads_t *reads)
+{
+	DWORD	len;
+	size_t	i;
+
+	/* all the reads were started by this (the main) thread */
+	CancelIo(reads->handle);
+
+	for (i = 0; i < PIPE_READS_COUNT; i++) {
+		if (reads->pending[i]) {
+			GetOverlappedResult(reads->handle, &reads->ov[i], &len, TRUE);
+			reads->pending[i] = 0;
+		}
+	}
+}
+
+void pipe_reads_free(pipe_reads_t *reads)
+{
+	size_t	i;
+
+	for (i = 0; i < PIPE_READS_COUNT; i++) {
+		free(reads->buf[i]);
+		reads->buf[i] = NULL;
+	}
+
+	reads->bufsize = 0;
+}
+
 /* return 1 on error, 0 if OK */
 int send_to_named_pipe(const char * pipe_name, const char * data)
 {
@@ -44,7 +44,7 @@
 #endif
 
 #define DRIVER_NAME	"NUT APC Modbus driver " DRIVER_NAME_NUT_MODBUS_HAS_USB_WITH_STR " USB support (libmodbus link type: " NUT_MODBUS_LINKTYPE_STR ")"
-#define DRIVER_VERSION	"0.15"
+#define DRIVER_VERSION	"0.16"
 
 #if defined NUT_MODBUS_HAS_USB
 
@@ -897,6 +897,67 @@ static apc_modbus_register_t* apc_modbus_register_maps[] = {
 	apc_modbus_register_map_static
 };
 
+/* The registers are polled in as few requests as the maps allow: the
+ * ranges of each map (and the registers decoded by hand from it) are
+ * merged into blocks when no more than APC_MODBUS_READ_MAX_GAP unmapped
+ * registers separate them, as reading a few more bytes costs less than
+ * another request (and its interframe delay). */
+#define APC_MODBUS_READ_MAX_GAP		16
+#define APC_MODBUS_READ_MAX_BLOCK	125	/* Modbus limit for a read */
+
+typedef struct {
+	int addr;
+	int len;
+} apc_modbus_range_t;
+
+typedef struct {
+	apc_modbus_register_t *map;
+	const apc_modbus_range_t *extra; /* Ends with a zero length */
+	int base, span; /* Addresses covered by the blocks (and regs) */
+	apc_modbus_range_t *blocks;
+	size_t blocks_count;
+	uint16_t *regs; /* Register values, from base */
+} apc_modbus_poll_t;
+
+static const apc_modbus_range_t apc_modbus_extra_inventory[] = {
+	{ APC_MODBUS_SOGRELAYCONFIGSETTING_BF_REG,		1 },
+	{ 0, 0 }
+};
+
+static const apc_modbus_range_t apc_modbus_extra_status[] = {
+	{ APC_MODBUS_UPSSTATUS_BF_REG,					2 },
+	{ APC_MODBUS_SIMPLESIGNALINGSTATUS_BF_REG,		1 },
+	{ APC_MODBUS_RUNTIMECALIBRATIONSTATUS_BF_REG,	1 },
+	{ 0, 0 }
+};
+
+static const apc_modbus_range_t apc_modbus_extra_dynamic[] = {
+	{ APC_MODBUS_INPUTSTATUS_BF_REG,				1 },
+	{ 0, 0 }
+};
+
+static const apc_modbus_range_t apc_modbus_extra_none[] = {
+	{ 0, 0 }
+};
+
+static apc_modbus_poll_t apc_modbus_poll_inventory = { apc_modbus_register_map_inventory, apc_modbus_extra_inventory, 0, 0, NULL, 0, NULL };
+static apc_modbus_poll_t apc_modbus_poll_status = { apc_modbus_register_map_status, apc_modbus_extra_status, 0, 0, NULL, 0, NULL };
+static apc_modbus_poll_t apc_modbus_poll_dynamic = { apc_modbus_register_map_dynamic, apc_modbus_extra_dynamic, 0, 0, NULL, 0, NULL };
+static apc_modbus_poll_t apc_modbus_poll_static = { apc_modbus_register_map_static, apc_modbus_extra_none, 0, 0, NULL, 0, NULL };
+
+static apc_modbus_poll_t* apc_modbus_polls[] = {
+	&apc_modbus_poll_inventory,
+	&apc_modbus_poll_status,
+	&apc_modbus_poll_dynamic,
+	&apc_modbus_poll_static
+};
+
+/* Register value at addr, once _apc_modbus_poll_read() succeeded */
+#define APC_MODBUS_POLL_REG(poll, addr) (&(poll)->regs[(addr) - (poll)->base])
+
+/* After a write, the UPS is polled for the new value that long at most */
+#define APC_MODBUS_WRITE_POLL_TIMEOUT	1000000	/* usec */
+
 static void _apc_modbus_close(int free_modbus)
 {
 	if (modbus_ctx != NULL) {
@@ -1046,6 +1107,101 @@ static int _apc_modbus_read_registers(modbus_t *ctx, int addr, int nb, uint16_t
 	}
 }
 
+static int _apc_modbus_range_compare(const void *a, const void *b)
+{
+	const apc_modbus_range_t *ra = a, *rb = b;
+
+	if (ra->addr != rb->addr) {
+		return (ra->addr < rb->addr) ? -1 : 1;
+	}
+
+	return (ra->len < rb->len) ? -1 : (ra->len > rb->len);
+}
+
+static void _apc_modbus_poll_plan(apc_modbus_poll_t *poll)
+{
+	apc_modbus_range_t *ranges, *b;
+	size_t i, n = 0, count = 0;
+	int end;
+
+	for (i = 0; poll->map[i].nut_variable_name; i++) {
+		count++;
+	}
+	for (i = 0; poll->extra[i].len; i++) {
+		count++;
+	}
+	assert(count > 0);
+
+	ranges = xcalloc(count, sizeof(*ranges));
+	for (i = 0; poll->map[i].nut_variable_name; i++, n++) {
+		ranges[n].addr = (int)poll->map[i].modbus_addr;
+		ranges[n].len = (int)poll->map[i].modbus_len;
+	}
+	for (i = 0; poll->extra[i].len; i++, n++) {
+		ranges[n] = poll->extra[i];
+	}
+	qsort(ranges, count, sizeof(*ranges), _apc_modbus_range_compare);
+
+	/* Merged in place: ranges[0..blocks_count) become the blocks */
+	b = &ranges[0];
+	for (i = 1; i < count; i++) {
+		end = ranges[i].addr + ranges[i].len;
+		if (ranges[i].addr <= b->addr + b->len + APC_MODBUS_READ_MAX_GAP
+		 && end - b->addr <= APC_MODBUS_READ_MAX_BLOCK
+		) {
+			if (end > b->addr + b->len) {
+				b->len = end - b->addr;
+			}
+		} else {
+			*(++b) = ranges[i];
+		}
+	}
+
+	poll->blocks = ranges;
+	poll->blocks_count = (size_t)(b - ranges) + 1;
+	poll->base = ranges[0].addr;
+	poll->span = b->addr + b->len - poll->base;
+	poll->regs = xcalloc((size_t)poll->span, sizeof(*poll->regs));
+
+	for (i = 0; i < poll->blocks_count; i++) {
+		upsdebugx(3, "%s: block %" PRIuSIZE ": %d:%d", __func__,
+			i, poll->blocks[i].addr, poll->blocks[i].addr + poll->blocks[i].len);
+	}
+}
+
+static void _apc_modbus_poll_free(void)
+{
+	size_t i;
+
+	for (i = 0; i < SIZEOF_ARRAY(apc_modbus_polls); i++) {
+		free(apc_modbus_polls[i]->blocks);
+		free(apc_modbus_polls[i]->regs);
+		apc_modbus_polls[i]->blocks = NULL;
+		apc_modbus_polls[i]->regs = NULL;
+		apc_modbus_polls[i]->blocks_count = 0;
+	}
+}
+
+/* Read all the blocks of a poll into its regs */
+static int _apc_modbus_poll_read(apc_modbus_poll_t *poll)
+{
+	size_t i;
+	const apc_modbus_range_t *b;
+
+	if (!poll->regs) {
+		_apc_modbus_poll_plan(poll);
+	}
+
+	for (i = 0; i < poll->blocks_count; i++) {
+		b = &poll->blocks[i];
+		if (!_apc_modbus_read_registers(modbus_ctx, b->addr, b->len, APC_MODBUS_POLL_REG(poll, b->addr))) {
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
 static int _apc_modbus_update_value(apc_modbus_register_t *regs_info, const uint16_t *regs, const size_t regs_len)
 {
 	apc_modbus_value_t value;
@@ -1184,15 +1340,13 @@ static int _apc_modbus_process_registers(apc_modbus_register_t* values, const ui
 
 static int _apc_modbus_read_inventory(void)
 {
-	uint16_t regbuf[120];
-	int start_addr;
+	apc_modbus_poll_t *poll = &apc_modbus_poll_inventory;
 	uint16_t sog_relay_config;
 	int outlet_group_count;
 
 	/* Inventory Information */
-	start_addr = apc_modbus_register_map_inventory[0].modbus_addr;
-	if (_apc_modbus_read_registers(modbus_ctx, start_addr, SIZEOF_ARRAY(regbuf), regbuf)) {
-		sog_relay_config = regbuf[APC_MODBUS_SOGRELAYCONFIGSETTING_BF_REG - start_addr];
+	if (_apc_modbus_poll_read(poll)) {
+		sog_relay_config = *APC_MODBUS_POLL_REG(poll, APC_MODBUS_SOGRELAYCONFIGSETTING_BF_REG);
 
 		outlet_group_count = 0;
 		if ((sog_relay_config & APC_MODBUS_SOGRELAYCONFIGSETTING_BF_MOG_PRESENT)) {
@@ -1215,7 +1369,7 @@ static int _apc_modbus_read_inventory(void)
 
 		dstate_setinfo("outlet.group.count", "%d", outlet_group_count);
 
-		_apc_modbus_process_registers(apc_modbus_register_map_inventory, regbuf, SIZEOF_ARRAY(regbuf), start_addr);
+		_apc_modbus_process_registers(poll->map, poll->regs, (size_t)poll->span, (size_t)poll->base);
 	} else {
 		return 0;
 	}
@@ -1226,9 +1380,10 @@ static int _apc_modbus_read_inventory(void)
 static int _apc_modbus_setvar(const char *nut_varname, const char *str_value)
 {
 	size_t mi, i;
-	int addr, nb, r;
+	int addr, nb, r, read_ok = 0;
+	int64_t deadline;
 	apc_modbus_register_t *apc_map = NULL, *apc_value = NULL;
-	uint16_t reg_value[16];
+	uint16_t reg_value[16], read_value[16];
 
 	upsdebug_SET_STARTING(nut_varname, str_value);
 
@@ -1313,15 +1468,29 @@ static int _apc_modbus_setvar(const char *nut_varname, const char *str_value)
 		return STAT_SET_FAILED;
 	}
 
-	/* There seem to be some communication problems if we don't wait after writing.
-	 * Maybe there is some register we need to poll for write completion?
-	 */
-	usleep(100000);
-
 	upslogx(LOG_INFO, "SET %s='%s'", nut_varname, str_value);
 
-	if (_apc_modbus_read_registers(modbus_ctx, addr, nb, reg_value)) {
-		_apc_modbus_process_registers(apc_map, reg_value, nb, addr);
+	/* The UPS may not answer right after a write; rather than to wait
+	 * for a fixed time, read the registers back until it does with the
+	 * new value (or until the timeout, if it adjusted the value). */
+	deadline = _apc_modbus_get_time_us() + APC_MODBUS_WRITE_POLL_TIMEOUT;
+	do {
+		_apc_modbus_interframe_delay();
+		r = modbus_read_registers(modbus_ctx, addr, nb, read_value);
+		if (r > 0) {
+			_apc_modbus_interframe_delay_reset();
+			read_ok = 1;
+			if (!memcmp(read_value, reg_value, (size_t)nb * sizeof(*reg_value))) {
+				break;
+			}
+		}
+	} while (_apc_modbus_get_time_us() < deadline);
+
+	if (read_ok) {
+		_apc_modbus_process_registers(apc_map, read_value, (size_t)nb, (size_t)addr);
+	} else {
+		upslogx(LOG_ERR, "%s: Read of %d:%d failed: %s (%s)", __func__, addr, addr + nb, modbus_strerror(errno), device_path);
+		_apc_modbus_handle_error(modbus_ctx);
 	}
 
 	return STAT_SET_HANDLED;
@@ -1459,7 +1628,7 @@ void upsdrv_initinfo(void)
 
 void upsdrv_updateinfo(void)
 {
-	uint16_t regbuf[32];
+	apc_modbus_poll_t *poll;
 	uint64_t value;
 
 	if (!is_open) {
@@ -1475,9 +1644,10 @@ void upsdrv_updateinfo(void)
 	buzzmode_init();
 
 	/* Status Data */
-	if (_apc_modbus_read_registers(modbus_ctx, 0, 27, regbuf)) {
+	poll = &apc_modbus_poll_status;
+	if (_apc_modbus_poll_read(poll)) {
 		/* UPSStatus_BF, 2 registers */
-		_apc_modbus_to_uint64(&regbuf[0], 2, &value);
+		_apc_modbus_to_uint64(APC_MODBUS_POLL_REG(poll, APC_MODBUS_UPSSTATUS_BF_REG), 2, &value);
 		if (value & (1 << 1)) {
 			status_set("OL");
 		}
@@ -1507,33 +1677,34 @@ void upsdrv_updateinfo(void)
 		}
 
 		/* SimpleSignalingStatus_BF, 1 register */
-		_apc_modbus_to_uint64(&regbuf[18], 1, &value);
+		_apc_modbus_to_uint64(APC_MODBUS_POLL_REG(poll, APC_MODBUS_SIMPLESIGNALINGSTATUS_BF_REG), 1, &value);
 		if (value & (1 << 1)) { /* ShutdownImminent */
 			status_set("LB");
 		}
 
 		/* BatterySystemError_BF, 1 register */
-		_apc_modbus_to_uint64(&regbuf[18], 1, &value);
+		_apc_modbus_to_uint64(APC_MODBUS_POLL_REG(poll, APC_MODBUS_SIMPLESIGNALINGSTATUS_BF_REG), 1, &value);
 		if (value & (1 << 1)) { /* NeedsReplacement */
 			status_set("RB");
 		}
 
 		/* RunTimeCalibrationStatus_BF, 1 register */
-		_apc_modbus_to_uint64(&regbuf[24], 1, &value);
+		_apc_modbus_to_uint64(APC_MODBUS_POLL_REG(poll, APC_MODBUS_RUNTIMECALIBRATIONSTATUS_BF_REG), 1, &value);
 		if (value & (1 << 1)) { /* InProgress */
 			status_set("CAL");
 		}
 
-		_apc_modbus_process_registers(apc_modbus_register_map_status, regbuf, 27, 0);
+		_apc_modbus_process_registers(poll->map, poll->regs, (size_t)poll->span, (size_t)poll->base);
 	} else {
 		dstate_datastale();
 		return;
 	}
 
 	/* Dynamic Data */
-	if (_apc_modbus_read_registers(modbus_ctx, 128, 32, regbuf)) {
+	poll = &apc_modbus_poll_dynamic;
+	if (_apc_modbus_poll_read(poll)) {
 		/* InputStatus_BF, 1 register */
-		_apc_modbus_to_uint64(&regbuf[22], 1, &value);
+		_apc_modbus_to_uint64(APC_MODBUS_POLL_REG(poll, APC_MODBUS_INPUTSTATUS_BF_REG), 1, &value);
 		if (value & (1 << 5)) {
 			status_set("BOOST");
 		}
@@ -1541,15 +1712,16 @@ void upsdrv_updateinfo(void)
 			status_set("TRIM");
 		}
 
-		_apc_modbus_process_registers(apc_modbus_register_map_dynamic, regbuf, 32, 128);
+		_apc_modbus_process_registers(poll->map, poll->regs, (size_t)poll->span, (size_t)poll->base);
 	} else {
 		dstate_datastale();
 		return;
 	}
 
 	/* Static Data */
-	if (_apc_modbus_read_registers(modbus_ctx, 1026, 22, regbuf)) {
-		_apc_modbus_process_registers(apc_modbus_register_map_static, regbuf, 22, 1026);
+	poll = &apc_modbus_poll_static;
+	if (_apc_modbus_poll_read(poll)) {
+		_apc_modbus_process_registers(poll->map, poll->regs, (size_t)poll->span, (size_t)poll->base);
 	} else {
 		dstate_datastale();
 		return;
@@ -1979,6 +2151,7 @@ void upsdrv_initups(void)
 void upsdrv_cleanup(void)
 {
 	_apc_modbus_close(1);
+	_apc_modbus_poll_free();
 
 #if defined NUT_MODBUS_HAS_USB
 	USBFreeExactMatcher(reopen_matcher);
@@ -19,6 +19,11 @@
 #ifndef APC_MODBUS_H
 #define APC_MODBUS_H
 
+#define APC_MODBUS_UPSSTATUS_BF_REG 0
+#define APC_MODBUS_SIMPLESIGNALINGSTATUS_BF_REG 18
+#define APC_MODBUS_RUNTIMECALIBRATIONSTATUS_BF_REG 24
+#define APC_MODBUS_INPUTSTATUS_BF_REG 150
+
 #define APC_MODBUS_REPLACEBATTERYTESTSTATUS_BF_PENDING (1 << 0)
 #define APC_MODBUS_REPLACEBATTERYTESTSTATUS_BF_INPROGRESS (1 << 1)
 #define APC_MODBUS_REPLACEBATTERYTESTSTATUS_BF_PASSED (1 << 2)
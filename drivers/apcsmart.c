@@ -37,7 +37,7 @@
 #include "apcsmart_tabs.h"
 
 #define DRIVER_NAME	"APC Smart protocol driver"
-#define DRIVER_VERSION	"3.36"
+#define DRIVER_VERSION	"3.37"
 
 #ifdef WIN32
 # ifndef ECANCELED
@@ -58,6 +58,9 @@ upsdrv_info_t upsdrv_info = {
 
 static long ups_status = 0;
 
+/* polling interval of the APC_SLOW variables */
+static long slowpollfreq = APC_SLOWPOLLFREQ;
+
 /* some forwards */
 
 static int sdcmd_S(const void *);
@@ -65,6 +68,7 @@ static int sdcmd_AT(const void *);
 static int sdcmd_K(const void *);
 static int sdcmd_Z(const void *);
 static int sdcmd_CS(const void *);
+static int update_info(int all, int slow);
 
 /*
  * following table *must* match order defined in the man page, namely:
@@ -1361,6 +1365,239 @@ static int getbaseinfo(void)
 	return 1;
 }
 
+/*
+ * Capabilities cache: with the "capcache" flag, what getbaseinfo() found
+ * (the variables and commands present, the enumerated values of settable
+ * variables, a model name forced for old units) is saved in the state path
+ * along with the serial number and firmware version of the UPS. A later
+ * start on the same UPS uses it instead of probing the whole command set,
+ * which takes long on units that time out on what they do not support;
+ * one on another UPS probes it and replaces the file.
+ */
+static char *capcache_fn = NULL;
+static char capcache_serial[APC_LBUF], capcache_fw[APC_LBUF];
+
+/* read an identification string, quietly (it may well be missing) */
+static int capcache_read_id(char cmd, char *buf, size_t buflen)
+{
+	char	temp[APC_LBUF];
+	ssize_t	ret;
+
+	apc_flush(0);
+	if (apc_write((const unsigned char)cmd) != 1)
+		return 0;
+	ret = apc_read(temp, sizeof(temp), SER_TO);
+	if (ret < 1 || !strcmp(temp, "NA"))
+		return 0;
+
+	snprintf(buf, buflen, "%s", temp);
+	return 1;
+}
+
+/* the identity of the UPS, and the file of its cache; 0 if not caching */
+static int capcache_ident(void)
+{
+	char	fn[NUT_PATH_MAX + 1];
+
+	if (!testvar("capcache"))
+		return 0;
+
+	if (!capcache_fn) {
+		snprintf(fn, sizeof(fn), "%s/%s-%s.%s", dflt_statepath(),
+			progname, upsname ? upsname : "apcsmart", APC_CAPCACHE_SUFFIX);
+		capcache_fn = xstrdup(fn);
+	}
+
+	/* same order of firmware commands as firmware_table_lookup() */
+	capcache_serial[0] = capcache_fw[0] = '\0';
+	capcache_read_id('n', capcache_serial, sizeof(capcache_serial));
+	if (!capcache_read_id(APC_FW_OLD, capcache_fw, sizeof(capcache_fw)))
+		capcache_read_id(APC_FW_NEW, capcache_fw, sizeof(capcache_fw));
+
+	if (!capcache_serial[0] && !capcache_fw[0]) {
+		upsdebugx(1, "%s: no serial number nor firmware version, not caching", __func__);
+		return 0;
+	}
+
+	upsdebugx(2, "%s: serial [%s], firmware [%s]", __func__,
+		capcache_serial, capcache_fw);
+	return 1;
+}
+
+/* find the vartab (or cmdtab with cmd) entry of a cache line "<hex cmd> <name>" */
+static void *capcache_entry(const char *line, int cmd, const char **rest)
+{
+	unsigned int	c;
+	int	off = 0, i;
+	size_t	len;
+
+	if (sscanf(line, "%2x %n", &c, &off) != 1 || off == 0)
+		return NULL;
+	line += off;
+	len = strcspn(line, " ");
+	*rest = line[len] ? line + len + 1 : line + len;
+
+	if (cmd) {
+		for (i = 0; apc_cmdtab[i].name != NULL; i++)
+			if ((unsigned int)apc_cmdtab[i].cmd == c
+			 && strlen(apc_cmdtab[i].name) == len
+			 && !strncmp(apc_cmdtab[i].name, line, len))
+				return &apc_cmdtab[i];
+	} else {
+		for (i = 0; apc_vartab[i].name != NULL; i++)
+			if ((unsigned int)(unsigned char)apc_vartab[i].cmd == c
+			 && strlen(apc_vartab[i].name) == len
+			 && !strncmp(apc_vartab[i].name, line, len))
+				return &apc_vartab[i];
+	}
+
+	return NULL;
+}
+
+/*
+ * Go through the cache lines: check them (apply == 0), then set the state
+ * up from them (apply == 1: flags and commands, then apply == 2: the RW
+ * flags and enumerations, once the variables have their values)
+ */
+static int capcache_scan(FILE *f, int apply)
+{
+	char	buf[APC_LBUF], *nl, *val;
+	const char	*rest;
+	int	serial = 0, fw = 0;
+	apc_vartab_t	*vt;
+	apc_cmdtab_t	*ct;
+
+	rewind(f);
+	while (fgets(buf, sizeof(buf), f)) {
+		if ((nl = strchr(buf, '\n')) != NULL)
+			*nl = '\0';
+		if (buf[0] == '#' || (val = strchr(buf, ' ')) == NULL)
+			continue;
+		*val++ = '\0';
+
+		if (!strcmp(buf, "table")) {
+			if (strcmp(val, APC_TABLE_VERSION))
+				return 0;
+		} else if (!strcmp(buf, "serial")) {
+			serial = !strcmp(val, capcache_serial);
+		} else if (!strcmp(buf, "firmware")) {
+			fw = !strcmp(val, capcache_fw);
+		} else if (!strcmp(buf, "model")) {
+			if (apply == 1)
+				dstate_setinfo("ups.model", "%s", val);
+		} else if (!strcmp(buf, "var") || !strcmp(buf, "enum")) {
+			if ((vt = capcache_entry(val, 0, &rest)) == NULL)
+				return 0;
+			if (apply == 1 && buf[0] == 'v')
+				vt->flags |= APC_PRESENT;
+			if (apply == 2 && buf[0] == 'v' && !strcmp(rest, "enum")) {
+				dstate_setflags(vt->name, ST_FLAG_RW);
+				vt->flags |= APC_RW | APC_ENUM;
+			}
+			if (apply == 2 && buf[0] == 'v')
+				var_string_setup(vt);
+			if (apply == 2 && buf[0] == 'e')
+				dstate_addenum(vt->name, "%s", rest);
+		} else if (!strcmp(buf, "cmd")) {
+			if ((ct = capcache_entry(val, 1, &rest)) == NULL)
+				return 0;
+			if (apply == 1) {
+				ct->flags |= APC_PRESENT;
+				dstate_addcmd(ct->name);
+			}
+		}
+	}
+
+	return serial && fw;
+}
+
+/* set up from the cache of the same UPS if any, instead of getbaseinfo() */
+static int capcache_load(void)
+{
+	FILE	*f;
+
+	if (!capcache_ident())
+		return 0;
+
+	if ((f = fopen(capcache_fn, "r")) == NULL) {
+		upsdebugx(2, "%s: no capabilities cache %s yet", __func__, capcache_fn);
+		return 0;
+	}
+
+	if (!capcache_scan(f, 0)) {
+		upsdebugx(1, "%s: %s is of another UPS (or driver), ignored",
+			__func__, capcache_fn);
+		fclose(f);
+		return 0;
+	}
+
+	capcache_scan(f, 1);
+	/* the values of all variables, as the probe would have read them */
+	update_info(1, 1);
+	capcache_scan(f, 2);
+	fclose(f);
+
+	upsdebugx(1, "%s: set up from the capabilities cache %s", __func__, capcache_fn);
+	return 1;
+}
+
+static void capcache_save(void)
+{
+	char	tmpfn[NUT_PATH_MAX + 1];
+	const char	*model;
+	const st_tree_t	*node;
+	const struct enum_s	*en;
+	int	i;
+	FILE	*f;
+
+	if (!capcache_fn || (!capcache_serial[0] && !capcache_fw[0]))
+		return;
+
+	snprintf(tmpfn, sizeof(tmpfn), "%s.%ld.tmp", capcache_fn, (long)getpid());
+	if ((f = fopen(tmpfn, "w")) == NULL) {
+		upslog_with_errno(LOG_WARNING, "Can't write the capabilities cache %s", tmpfn);
+		return;
+	}
+
+	fprintf(f, "# %s capabilities cache, remove to probe the UPS in full\n", progname);
+	fprintf(f, "table %s\n", APC_TABLE_VERSION);
+	fprintf(f, "serial %s\n", capcache_serial);
+	fprintf(f, "firmware %s\n", capcache_fw);
+
+	/* forced by the probe of old units, rather than read */
+	if (!vt_lookup_name("ups.model") && (model = dstate_getinfo("ups.model")))
+		fprintf(f, "model %s\n", model);
+
+	for (i = 0; apc_vartab[i].name != NULL; i++) {
+		apc_vartab_t	*vt = &apc_vartab[i];
+
+		if (!(vt->flags & APC_PRESENT))
+			continue;
+		fprintf(f, "var %02x %s%s\n", (unsigned int)(unsigned char)vt->cmd,
+			vt->name, (vt->flags & APC_ENUM) ? " enum" : "");
+		if (!(vt->flags & APC_ENUM))
+			continue;
+		node = state_tree_find((st_tree_t *)dstate_getroot(), vt->name);
+		for (en = node ? node->enum_list : NULL; en; en = en->next)
+			fprintf(f, "enum %02x %s %s\n", (unsigned int)(unsigned char)vt->cmd,
+				vt->name, en->val);
+	}
+
+	for (i = 0; apc_cmdtab[i].name != NULL; i++) {
+		if (apc_cmdtab[i].flags & APC_PRESENT)
+			fprintf(f, "cmd %02x %s\n", (unsigned int)apc_cmdtab[i].cmd,
+				apc_cmdtab[i].name);
+	}
+
+	if (fclose(f) != 0 || rename(tmpfn, capcache_fn) != 0) {
+		upslog_with_errno(LOG_WARNING, "Can't write the capabilities cache %s", capcache_fn);
+		unlink(tmpfn);
+		return;
+	}
+
+	upsdebugx(1, "%s: wrote the capabilities cache %s", __func__, capcache_fn);
+}
+
 /* check for calibration status and either start or stop */
 static int do_cal(int start)
 {
@@ -1783,15 +2020,18 @@ void upsdrv_shutdown(void)
 		upsdrv_shutdown_simple();
 }
 
-static int update_info(int all)
+static int update_info(int all, int slow)
 {
 	int i;
 
-	upsdebugx(1, "%s: starting scan%s", __func__, all ? " (all vars)" : "");
+	upsdebugx(1, "%s: starting scan%s", __func__,
+		all ? " (all vars)" : slow ? " (with slow vars)" : "");
 
 	for (i = 0; apc_vartab[i].name != NULL; i++) {
 		if (!all && (apc_vartab[i].flags & APC_POLL) == 0)
 			continue;
+		if (!all && !slow && (apc_vartab[i].flags & APC_SLOW))
+			continue;
 
 		if (!poll_data(&apc_vartab[i])) {
 			upsdebugx(1, "%s: %s", __func__, "aborting scan");
@@ -2152,6 +2392,8 @@ void upsdrv_makevartable(void)
 	addvar(VAR_VALUE, "sdtype", "simple shutdown method");
 	addvar(VAR_VALUE, "advorder", "advanced shutdown control");
 	addvar(VAR_VALUE, "cshdelay", "CS hack delay");
+	addvar(VAR_VALUE, "slowpollfreq", "polling interval of slowly changing variables, in seconds");
+	addvar(VAR_FLAG, "capcache", "cache the probed capabilities across restarts");
 }
 
 void upsdrv_help(void)
@@ -2188,6 +2430,13 @@ void upsdrv_initups(void)
 			fatalx(EXIT_FAILURE, "invalid value (%s) for option 'cshdelay'", val);
 	}
 
+	/* sanitize slowpollfreq */
+	if ((val = getval("slowpollfreq"))) {
+		if (!rexhlp("^[0-9]{1,6}$", val))
+			fatalx(EXIT_FAILURE, "invalid value (%s) for option 'slowpollfreq'", val);
+		slowpollfreq = strtol(val, NULL, 10);
+	}
+
 	upsfd = extrafd = ser_open(device_path);
 	apc_ser_set();
 
@@ -2200,6 +2449,9 @@ void upsdrv_cleanup(void)
 {
 	char temp[APC_LBUF];
 
+	free(capcache_fn);
+	capcache_fn = NULL;
+
 	if (INVALID_FD(upsfd))
 		return;
 
@@ -2221,10 +2473,13 @@ void upsdrv_initinfo(void)
 			);
 	}
 
-	if (!getbaseinfo()) {
-		fatalx(EXIT_FAILURE,
-			"Problems with communicating APC UPS on port %s\n", device_path
-			);
+	if (!capcache_load()) {
+		if (!getbaseinfo()) {
+			fatalx(EXIT_FAILURE,
+				"Problems with communicating APC UPS on port %s\n", device_path
+				);
+		}
+		capcache_save();
 	}
 
 	/* manufacturer ID - hard-coded in this particular module */
@@ -2249,8 +2504,8 @@ void upsdrv_initinfo(void)
 void upsdrv_updateinfo(void)
 {
 	static int last_worked = 0;
-	static time_t last_full = 0;
-	int all;
+	static time_t last_full = 0, last_slow = 0;
+	int all, slow;
 	time_t now;
 
 	/* try to wake up a dead UPS once in awhile */
@@ -2263,6 +2518,7 @@ void upsdrv_updateinfo(void)
 
 		/* reset this so a full update runs when the UPS returns */
 		last_full = 0;
+		last_slow = 0;
 
 		/* Flush the buffer in case it helps,
 		 * or sleep 1 sec if buffer is empty */
@@ -2335,7 +2591,14 @@ void upsdrv_updateinfo(void)
 	} else
 		all = 0;
 
-	if (update_info(all)) {
+	/* the slowly changing ones less often than status and line values */
+	if (all || difftime(now, last_slow) >= (double)slowpollfreq) {
+		last_slow = now;
+		slow = 1;
+	} else
+		slow = 0;
+
+	if (update_info(all, slow)) {
 		dstate_dataok();
 	} else {
 		dstate_datastale();
@@ -103,6 +103,12 @@
 /* it only does two strings, and they're both the same length */
 #define APC_STRLEN	8
 
+/* default polling interval of the APC_SLOW variables, in seconds */
+#define APC_SLOWPOLLFREQ	60
+
+/* capabilities cache: <statepath>/<progname>-<upsname>.caps */
+#define APC_CAPCACHE_SUFFIX	"caps"
+
 #define SER_D0	0x001	/* 0 sec., for flushes */
 #define SER_DX	0x002	/* 200 ms for long/repeated cmds, in case of unexpected NAs */
 #define SER_D1	0x004	/* 1.5 sec. */
@@ -24,7 +24,7 @@
 /* APC_MULTI variables *must* be listed in order of preference */
 apc_vartab_t apc_vartab[] = {
 /* name cmd flags   regex   nlen0   cnt */
-	{ "ups.temperature",		'C',	APC_POLL|APC_F_CELSIUS, NULL, 0, 0 },
+	{ "ups.temperature",		'C',	APC_POLL|APC_SLOW|APC_F_CELSIUS, NULL, 0, 0 },
 	{ "ups.load",			'P',	APC_POLL|APC_F_PERCENT, NULL, 0, 0 },
 	{ "ups.test.interval",		'E',	APC_F_HOURS, NULL, 0, 0 },
 	{ "ups.test.result",		'X',	APC_POLL, NULL, 0, 0 },
@@ -36,7 +36,7 @@ apc_vartab_t apc_vartab[] = {
 	{ "input.voltage",		'L',	APC_POLL|APC_F_VOLT, NULL, 0, 0 },
 	{ "input.frequency",		'F',	APC_POLL|APC_F_DEC, NULL, 0, 0 },
 	{ "input.sensitivity",		's',	0, NULL, 0, 0 },
-	{ "input.quality",		'9',	APC_POLL|APC_F_HEX, NULL, 0, 0 },
+	{ "input.quality",		'9',	APC_POLL|APC_SLOW|APC_F_HEX, NULL, 0, 0 },
 	{ "input.transfer.low",		'l',	APC_F_VOLT, NULL, 0, 0 },
 	{ "input.transfer.high",	'u',	APC_F_VOLT, NULL, 0, 0 },
 	{ "input.transfer.reason",	'G',	APC_POLL|APC_F_REASON, NULL, 0, 0 },
@@ -45,14 +45,14 @@ apc_vartab_t apc_vartab[] = {
 	{ "output.current",		'/',	APC_POLL|APC_F_AMP, NULL, 0, 0 },
 	{ "output.voltage",		'O',	APC_POLL|APC_F_VOLT, NULL, 0, 0 },
 	{ "output.voltage.nominal",	'o',	APC_F_VOLT, NULL, 0, 0 },
-	{ "ambient.humidity",		'h',	APC_POLL|APC_F_PERCENT, NULL, 0, 0 },
-	{ "ambient.0.humidity",		'H',	APC_POLL|APC_PACK|APC_F_PERCENT, NULL, 0, 0 },
-	{ "ambient.0.humidity.high",	'{',	APC_POLL|APC_PACK|APC_F_PERCENT, NULL, 0, 0 },
-	{ "ambient.0.humidity.low",	'}',	APC_POLL|APC_PACK|APC_F_PERCENT, NULL, 0, 0 },
-	{ "ambient.temperature",	't',	APC_POLL|APC_F_CELSIUS, NULL, 0, 0 },
-	{ "ambient.0.temperature",	'T',	APC_MULTI|APC_POLL|APC_PACK|APC_F_CELSIUS, "^[0-9]{2}\\.[0-9]{2}$", 0, 0 },
-	{ "ambient.0.temperature.high",	'[',	APC_POLL|APC_PACK|APC_F_CELSIUS, NULL, 0, 0 },
-	{ "ambient.0.temperature.low",	']',	APC_POLL|APC_PACK|APC_F_CELSIUS, NULL, 0, 0 },
+	{ "ambient.humidity",		'h',	APC_POLL|APC_SLOW|APC_F_PERCENT, NULL, 0, 0 },
+	{ "ambient.0.humidity",		'H',	APC_POLL|APC_SLOW|APC_PACK|APC_F_PERCENT, NULL, 0, 0 },
+	{ "ambient.0.humidity.high",	'{',	APC_POLL|APC_SLOW|APC_PACK|APC_F_PERCENT, NULL, 0, 0 },
+	{ "ambient.0.humidity.low",	'}',	APC_POLL|APC_SLOW|APC_PACK|APC_F_PERCENT, NULL, 0, 0 },
+	{ "ambient.temperature",	't',	APC_POLL|APC_SLOW|APC_F_CELSIUS, NULL, 0, 0 },
+	{ "ambient.0.temperature",	'T',	APC_MULTI|APC_POLL|APC_SLOW|APC_PACK|APC_F_CELSIUS, "^[0-9]{2}\\.[0-9]{2}$", 0, 0 },
+	{ "ambient.0.temperature.high",	'[',	APC_POLL|APC_SLOW|APC_PACK|APC_F_CELSIUS, NULL, 0, 0 },
+	{ "ambient.0.temperature.low",	']',	APC_POLL|APC_SLOW|APC_PACK|APC_F_CELSIUS, NULL, 0, 0 },
 	{ "battery.date",		'x',	APC_STRING, NULL, 0, 0 },
 	{ "battery.charge",		'f',	APC_POLL|APC_F_PERCENT, NULL, 0, 0 },
 	{ "battery.charge.restart",	'e',	APC_F_PERCENT, NULL, 0, 0 },
@@ -63,7 +63,7 @@ apc_vartab_t apc_vartab[] = {
 	{ "battery.packs",		'>',	APC_F_DEC, NULL, 0, 0 },
 	{ "battery.packs.bad",		'<',	APC_F_DEC, NULL, 0, 0 },
 	{ "battery.alarm.threshold",	'k', 0, NULL, 0, 0 },
-	{ "device.uptime",		'T',	APC_MULTI|APC_POLL|APC_F_HOURS, "^[0-9]{3}\\.[0-9]{1}$", 0, 0 },
+	{ "device.uptime",		'T',	APC_MULTI|APC_POLL|APC_SLOW|APC_F_HOURS, "^[0-9]{3}\\.[0-9]{1}$", 0, 0 },
 	{ "ups.serial",			'n', 0, NULL, 0, 0 },
 	{ "ups.mfr.date",		'm', 0, NULL, 0, 0 },
 	{ "ups.model",			'\001', 0, NULL, 0, 0 },
@@ -25,7 +25,7 @@
 
 #include "main.h"
 
-#define APC_TABLE_VERSION	"version 3.1"
+#define APC_TABLE_VERSION	"version 3.2"
 
 /* common flags */
 
@@ -44,6 +44,7 @@
 #define APC_STRING	0x00000800	/* string variable			*/
 #define APC_MULTI	0x00001000	/* there're other vars like that	*/
 #define APC_PACK	0x00002000	/* packed variable			*/
+#define APC_SLOW	0x00004000	/* polled only every slowpollfreq	*/
 
 #define APC_PACK_MAX	4		/* max count of subfields in packed var	*/
 
@@ -57,7 +57,7 @@ typedef struct pollfd {
 #include "nut_stdint.h"
 
 #define DRIVER_NAME	"apcupsd network client UPS driver"
-#define DRIVER_VERSION	"0.73"
+#define DRIVER_VERSION	"0.74"
 
 #define POLL_INTERVAL_MIN 10
 
@@ -73,17 +73,12 @@ upsdrv_info_t upsdrv_info = {
 static uint16_t port=3551;
 static struct sockaddr_in host;
 
-static void process(char *item,char *data)
+static void setitem(size_t i,char *data)
 {
-	int i;
 	char *p1;
 	char *p2;
 
-	for(i=0;nut_data[i].info_type;i++)if(!(nut_data[i].apcupsd_item))
-		dstate_setinfo(nut_data[i].info_type,"%s",
-			nut_data[i].default_value);
-	else if(!strcmp(nut_data[i].apcupsd_item,item))
-			switch(nut_data[i].drv_flags&~DU_FLAG_INIT)
+	switch(nut_data[i].drv_flags&~DU_FLAG_INIT)
 	{
 	case DU_FLAG_STATUS:
 		status_init();
@@ -172,168 +167,282 @@ static void process(char *item,char *data)
 	}
 }
 
-static int getdata(void)
+/* the last text of each item from apcupsd, and whether it came this time */
+static char *item_text[sizeof(nut_data)/sizeof(nut_data[0])];
+static int item_seen[sizeof(nut_data)/sizeof(nut_data[0])];
+
+static void process(char *item,char *data)
 {
-	ssize_t x;
-	uint16_t n;
-	char *item;
-	char *data;
-	struct pollfd p;
-	char bfr[1024];
-	st_tree_timespec_t start;
-	int ret = -1;
-#ifndef WIN32
-	int fd_flags;
-#else	/* WIN32 */
-	/* Note: while the code below uses "pollfd" for simplicity as it is
-	 * available in mingw headers (although poll() method usually is not),
-	 * WIN32 builds use WaitForMultipleObjects(); see also similar code
-	 * in upsd.c for networking.
-	 */
-	HANDLE event = NULL;
+	size_t i;
+	char bfr[LARGEBUF];
+
+	for(i=0;nut_data[i].info_type;i++)
+	{
+		if(!nut_data[i].apcupsd_item||strcmp(nut_data[i].apcupsd_item,item))
+			continue;
+
+		item_seen[i]=1;
+
+		/* most of the status is the same from one poll to the next */
+		if(item_text[i]&&!strcmp(item_text[i],data))
+			continue;
+
+		free(item_text[i]);
+		item_text[i]=xstrdup(data);
+
+		/* setitem() cuts it up */
+		snprintf(bfr,sizeof(bfr),"%s",data);
+		setitem(i,bfr);
+	}
+}
+
+/* The connection to the NIS port of apcupsd is kept from one poll to the
+ * next (apcupsd serves any number of requests on it), and its records are
+ * read into a buffer which is kept too: a driver gatewaying an apcupsd host
+ * does not cost a TCP handshake at each poll. */
+static TYPE_FD_SOCK nis_fd = ERROR_FD_SOCK;
+#ifdef WIN32
+/* Note: WIN32 builds use WaitForMultipleObjects() on this, rather than
+ * poll(); see also similar code in upsd.c for networking.
+ */
+static HANDLE nis_event = NULL;
 #endif	/* WIN32 */
 
-	state_get_timestamp((st_tree_timespec_t *)&start);
+static char nis_buf[LARGEBUF];
+static size_t nis_off = 0, nis_len = 0;
 
-	if (INVALID_FD_SOCK( (p.fd = socket(AF_INET, SOCK_STREAM, 0)) ))
+static void nis_close(void)
+{
+	if (VALID_FD_SOCK(nis_fd))
+		close(nis_fd);
+	nis_fd = ERROR_FD_SOCK;
+#ifdef WIN32
+	if (nis_event != NULL)
+		CloseHandle(nis_event);
+	nis_event = NULL;
+#endif	/* WIN32 */
+	nis_off = nis_len = 0;
+}
+
+static int nis_connect(void)
+{
+#ifndef WIN32
+	int fd_flags;
+#endif	/* !WIN32 */
+
+	if (INVALID_FD_SOCK( (nis_fd = socket(AF_INET, SOCK_STREAM, 0)) ))
 	{
 		upsdebugx(1,"socket error");
-		/* return -1; */
-		ret = -1;
-		goto getdata_return;
+		return -1;
 	}
 
-	if(connect(p.fd,(struct sockaddr *)&host,sizeof(host)))
+	if(connect(nis_fd,(struct sockaddr *)&host,sizeof(host)))
 	{
 		upsdebugx(1,"can't connect to apcupsd");
-		/* close(p.fd);
-		return -1; */
-		ret = -1;
-		goto getdata_return;
+		nis_close();
+		return -1;
 	}
 
 #ifndef WIN32
 	/* WSAEventSelect automatically sets the socket to nonblocking mode */
-	fd_flags = fcntl(p.fd, F_GETFL);
+	fd_flags = fcntl(nis_fd, F_GETFL);
 	if (fd_flags == -1) {
 		upsdebugx(1,"unexpected fcntl(fd, F_GETFL) failure");
-		/* close(p.fd);
-		return -1; */
-		ret = -1;
-		goto getdata_return;
+		nis_close();
+		return -1;
 	}
 	fd_flags |= O_NONBLOCK;
-	if(fcntl(p.fd, F_SETFL, fd_flags) == -1)
+	if(fcntl(nis_fd, F_SETFL, fd_flags) == -1)
 	{
 		upsdebugx(1,"unexpected fcntl(fd, F_SETFL, fd_flags|O_NONBLOCK) failure");
-		/* close(p.fd);
-		return -1; */
-		ret = -1;
-		goto getdata_return;
+		nis_close();
+		return -1;
 	}
 #else	/* WIN32 */
-	event = CreateEvent(
+	nis_event = CreateEvent(
 		NULL,  /* Security */
 		FALSE, /* auto-reset */
 		FALSE, /* initial state */
 		NULL); /* no name */
 
 	/* Associate socket event to the socket via its Event object */
-	WSAEventSelect( p.fd, event, FD_CONNECT );
+	WSAEventSelect( nis_fd, nis_event, FD_READ | FD_CLOSE );
 #endif	/* WIN32 */
 
-	p.events=POLLIN;
+	upsdebugx(2,"connected to apcupsd");
+	return 0;
+}
 
-	n=htons(6);
-	x=write(p.fd,&n,2);
-	x=write(p.fd,"status",6);
+/* whether there is something to read within <timeout> ms */
+static int nis_wait(int timeout)
+{
+#ifndef WIN32
+	struct pollfd p;
+
+	p.fd=nis_fd;
+	p.events=POLLIN;
+	p.revents=0;
 
 	/* TODO: double-check for poll() in configure script */
-#ifndef WIN32
-	while(poll(&p,1,15000)==1)
+	return poll(&p,1,timeout)==1;
 #else	/* WIN32 */
-	while (WaitForMultipleObjects(1, &event, FALSE, 15000) == WAIT_TIMEOUT)
+	return WaitForMultipleObjects(1, &nis_event, FALSE, (DWORD)timeout) == WAIT_OBJECT_0;
 #endif	/* WIN32 */
+}
+
+/* make the next <len> bytes of the reply available at nis_buf + nis_off */
+static int nis_need(size_t len)
+{
+	ssize_t x;
+
+	while(nis_len-nis_off<len)
 	{
-		if(read(p.fd,&n,2)!=2)
+		if(nis_off)
 		{
-			upsdebugx(1,"apcupsd communication error");
-			ret = -1;
-			goto getdata_return;
+			memmove(nis_buf,nis_buf+nis_off,nis_len-nis_off);
+			nis_len-=nis_off;
+			nis_off=0;
 		}
 
-		if(!(x=ntohs(n)))
-		{
-			ret = 0;
-			goto getdata_return;
-		}
-		else if(x<0||x>=(int)sizeof(bfr))
-		/* Note: LGTM.com suggests "Comparison is always false because x >= 0"
-		 * for the line above, probably because ntohs() returns an uint type.
-		 * I am reluctant to fix this one, because googling for headers from
-		 * random OSes showed various types used as the return value (uint16_t,
-		 * unsigned_short, u_short, in_port_t...)
-		 */
+		/* keep a byte for the NUL put after a record */
+		if(len>=sizeof(nis_buf)||!nis_wait(15000))
+			return -1;
+
+		x=read(nis_fd,nis_buf+nis_len,sizeof(nis_buf)-1-nis_len);
+		if(x<=0)
+			return -1;
+
+		nis_len+=(size_t)x;
+	}
+
+	return 0;
+}
+
+/* ask for the status on the connection, and take its records: returns 0
+ * when all came, or -1 with the number taken in <records> */
+static int nis_status(size_t *records)
+{
+	ssize_t x;
+	uint16_t n;
+	char req[8];
+	char *bfr;
+	char *item;
+	char *data;
+	char next;
+
+	/* the name of the request with its length in front, sent at once */
+	n=htons(6);
+	memcpy(req,&n,2);
+	memcpy(req+2,"status",6);
+	nis_off=nis_len=0;
+
+	if(write(nis_fd,req,sizeof(req))!=(ssize_t)sizeof(req))
+	{
+		upsdebugx(1,"apcupsd communication error");
+		return -1;
+	}
+
+	for(;;)
+	{
+		if(nis_need(2))
 		{
-			upsdebugx(1,"apcupsd communication error");
-			ret = -1;
-			goto getdata_return;
+			upsdebugx(1,"unexpected connection close by apcupsd");
+			return -1;
 		}
 
-#ifndef WIN32
-		if(poll(&p,1,15000)!=1)break;
-#else	/* WIN32 */
-		if (WaitForMultipleObjects(1, &event, FALSE, 15000) != WAIT_OBJECT_0) break;
-#endif	/* WIN32 */
+		memcpy(&n,nis_buf+nis_off,2);
 
-		if(read(p.fd,bfr,(size_t)x)!=x)
+		if(!(x=ntohs(n)))
 		{
-			upsdebugx(1,"apcupsd communication error");
-			ret = -1;
-			goto getdata_return;
+			nis_off+=2;
+			return 0;
 		}
 
-		bfr[x]=0;
-
-		if(!(item=strtok(bfr," \t:\r\n")))
+		if(nis_need(2+(size_t)x))
 		{
 			upsdebugx(1,"apcupsd communication error");
-			ret = -1;
-			goto getdata_return;
+			return -1;
 		}
 
-		if(!(data=strtok(NULL,"\r\n")))
+		bfr=nis_buf+nis_off+2;
+		nis_off+=2+(size_t)x;
+
+		/* the first byte of the next record, if it came already */
+		next=bfr[x];
+		bfr[x]=0;
+
+		if(!(item=strtok(bfr," \t:\r\n"))
+		 ||!(data=strtok(NULL,"\r\n")))
 		{
 			upsdebugx(1,"apcupsd communication error");
-			ret = -1;
-			goto getdata_return;
+			return -1;
 		}
 		while(*data==' '||*data=='\t'||*data==':')data++;
 
 		process(item,data);
+		bfr[x]=next;
+		(*records)++;
 	}
+}
 
-	upsdebugx(1,"unexpected connection close by apcupsd");
-	ret = -1;
+static int getdata(void)
+{
+	size_t i;
+	size_t records = 0;
+	int reused;
+	int ret = -1;
 
-getdata_return:
-	if (VALID_FD_SOCK(p.fd))
-		close(p.fd);
-#ifdef WIN32
-	if (event != NULL)
-		CloseHandle(event);
-#endif	/* WIN32 */
+	memset(item_seen,0,sizeof(item_seen));
+
+	for(i=0;i<2;i++)
+	{
+		reused=VALID_FD_SOCK(nis_fd);
+
+		/* nothing is due on a connection between the polls, but that
+		 * it was closed by apcupsd */
+		if(reused&&nis_wait(0))
+		{
+			upsdebugx(2,"connection closed by apcupsd, reconnecting");
+			nis_close();
+			reused=0;
+		}
+
+		if(!reused&&nis_connect())
+			break;
+
+		if(!(ret=nis_status(&records)))
+			break;
+
+		nis_close();
+
+		/* a connection kept from before may have gone stale without
+		 * a sign: try a new one right away, if nothing came on it */
+		if(!reused||records)
+			break;
+	}
 
 	/* Remove any unprotected entries not refreshed in this run */
-	for(x=0;nut_data[x].info_type;x++)
-		if(!(nut_data[x].drv_flags & DU_FLAG_INIT) && !(nut_data[x].drv_flags & DU_FLAG_PRESERVE))
-			dstate_delinfo_olderthan(nut_data[x].info_type, &start);
+	for(i=0;nut_data[i].info_type;i++)
+		if(!(nut_data[i].drv_flags & DU_FLAG_INIT) && !(nut_data[i].drv_flags & DU_FLAG_PRESERVE)
+		 && item_text[i] && !item_seen[i])
+		{
+			dstate_delinfo(nut_data[i].info_type);
+			free(item_text[i]);
+			item_text[i]=NULL;
+		}
 
 	return ret;
 }
 
 void upsdrv_initinfo(void)
 {
+	size_t i;
+
+	/* the values which do not come from apcupsd */
+	for(i=0;nut_data[i].info_type;i++)if(!(nut_data[i].apcupsd_item))
+		dstate_setinfo(nut_data[i].info_type,"%s",
+			nut_data[i].default_value);
+
 	if(!port)fatalx(EXIT_FAILURE,"invalid host or port specified!");
 	if(getdata())fatalx(EXIT_FAILURE,"can't communicate with apcupsd!");
 	else dstate_dataok();
@@ -403,4 +512,13 @@ void upsdrv_initups(void)
 
 void upsdrv_cleanup(void)
 {
+	size_t i;
+
+	nis_close();
+
+	for(i=0;nut_data[i].info_type;i++)
+	{
+		free(item_text[i]);
+		item_text[i]=NULL;
+	}
 }
@@ -116,11 +116,14 @@ TODO List:
 #include "bcmxcp.h"
 
 #define DRIVER_NAME	"BCMXCP UPS driver"
-#define DRIVER_VERSION	"0.37"
+#define DRIVER_VERSION	"0.39"
 
 #define MAX_NUT_NAME_LENGTH 128
 #define NUT_OUTLET_POSITION   7
 
+/* capabilities cache: <statepath>/<progname>-<upsname>.caps */
+#define CAPCACHE_SUFFIX	"caps"
+
 /* driver description structure */
 upsdrv_info_t upsdrv_info = {
 	DRIVER_NAME,
@@ -155,6 +158,12 @@ static bool_t set_alarm_support_in_alarm_map(const unsigned char *map, const uns
 static void decode_meter_map_entry(const unsigned char *entry, const unsigned char format, char* value);
 static unsigned char init_outlet(unsigned char len);
 static void init_system_test_capabilities(void);
+static void init_decode_plan(void);
+static void set_command_list(const unsigned char *cmds, unsigned char len);
+static void set_system_test_capabilities(const unsigned char *caps, unsigned char len);
+static void set_ext_vars(const unsigned char *conf, unsigned char len);
+static bool_t capcache_load(const unsigned char *id_block, ssize_t len);
+static void capcache_save(void);
 static int instcmd(const char *cmdname, const char *extra);
 static int setvar(const char *varname, const char *val);
 static int decode_instcmd_exec(const ssize_t res, const unsigned char exec_status, const char *cmdname, const char *success_msg);
@@ -186,6 +195,29 @@ static const char *OutletStatus[9] = {
 static unsigned char AUTHOR[4] = {0xCF, 0x69, 0xE8, 0xD5};
 static int nphases = 0;
 static uint16_t outlet_block_len = 0;
+
+/* The meters and alarms the UPS reports which we map, in map order,
+ * so that the updates do not walk the whole maps */
+static unsigned char meter_plan[BCMXCP_METER_MAP_MAX];
+static unsigned int meter_plan_len = 0;
+static bool_t meter_plan_has_load = FALSE;
+static uint16_t alarm_plan[BCMXCP_ALARM_MAP_MAX];
+static unsigned int alarm_plan_len = 0;
+
+/* A list of capabilities, as read from the UPS or the capabilities cache */
+typedef struct {
+	bool_t known;	/* read, or loaded from the cache */
+	unsigned char len;
+	unsigned char val[PW_ANSWER_MAX_SIZE];
+} BCMXCP_CAPLIST_t;
+
+/* The command list, system test capabilities and configurable variables
+ * of the UPS, which the capabilities cache keeps per ID block */
+static BCMXCP_CAPLIST_t cap_commands, cap_system_tests, cap_ext_vars;
+static unsigned char capcache_id[PW_ANSWER_MAX_SIZE];
+static size_t capcache_id_len = 0;
+static bool_t capcache_loaded = FALSE;
+
 static const char *cpu_name[5] = {
 	"Cont:",
 	"Inve:",
@@ -774,12 +806,17 @@ bool_t init_command(int size)
 {
 	unsigned char answer[PW_ANSWER_MAX_SIZE];
 	unsigned char commandByte;
-	const char* nutvalue;
 	ssize_t res;
-	int iIndex = 0, ncounter, NumComms = 0, i;
+	int iIndex = 0, ncounter, NumComms = 0;
 
 	upsdebugx(1, "entering init_command(%i)", size);
 
+	if (cap_commands.known) {
+		upsdebugx(2, "Command list from the capabilities cache.");
+		set_command_list(cap_commands.val, cap_commands.len);
+		return TRUE;
+	}
+
 	res = command_read_sequence(PW_COMMAND_LIST_REQ, answer);
 	if (res <= 0)
 	{
@@ -809,7 +846,6 @@ bool_t init_command(int size)
 				commandByte = answer[iIndex];
 				if (commandByte < BCMXCP_COMMAND_MAP_MAX) {
 					upsdebugx(2, "%03d\t%02x\t%s", ncounter, commandByte, bcmxcp_command_map[commandByte].command_desc);
-					bcmxcp_command_map[commandByte].command_byte = commandByte;
 				}
 				else {
 					upsdebugx(2, "%03d\t%02x\t%s", ncounter, commandByte, "Unknown command, the commandByte is not mapped");
@@ -818,17 +854,10 @@ bool_t init_command(int size)
 				iIndex++;
 			}
 
-			/* Map supported commands to instcmd */
-			for (i = 0; i < BCMXCP_COMMAND_MAP_MAX; i++) {
-				if (bcmxcp_command_map[i].command_desc != NULL) {
-					if (bcmxcp_command_map[i].command_byte > 0) {
-						if ((nutvalue = nut_find_infoval(command_map_info, bcmxcp_command_map[i].command_byte, FALSE)) != NULL) {
-							dstate_addcmd(nutvalue);
-							upsdebugx(2, "Added support for instcmd %s", nutvalue);
-						}
-					}
-				}
-			}
+			cap_commands.len = (unsigned char)NumComms;
+			memcpy(cap_commands.val, answer + 2, cap_commands.len);
+			cap_commands.known = TRUE;
+			set_command_list(cap_commands.val, cap_commands.len);
 
 			return TRUE;
 		}
@@ -839,6 +868,30 @@ bool_t init_command(int size)
 	}
 }
 
+/* Set the supported commands up from a command list block */
+void set_command_list(const unsigned char *cmds, unsigned char len)
+{
+	const char* nutvalue;
+	int i;
+
+	for (i = 0; i < len; i++) {
+		if (cmds[i] < BCMXCP_COMMAND_MAP_MAX)
+			bcmxcp_command_map[cmds[i]].command_byte = cmds[i];
+	}
+
+	/* Map supported commands to instcmd */
+	for (i = 0; i < BCMXCP_COMMAND_MAP_MAX; i++) {
+		if (bcmxcp_command_map[i].command_desc != NULL) {
+			if (bcmxcp_command_map[i].command_byte > 0) {
+				if ((nutvalue = nut_find_infoval(command_map_info, bcmxcp_command_map[i].command_byte, FALSE)) != NULL) {
+					dstate_addcmd(nutvalue);
+					upsdebugx(2, "Added support for instcmd %s", nutvalue);
+				}
+			}
+		}
+	}
+}
+
 void init_ups_meter_map(const unsigned char *map, unsigned char len)
 {
 	unsigned int iIndex, iOffset = 0;
@@ -979,6 +1032,30 @@ void init_ups_alarm_map(const unsigned char *map, unsigned char len)
 	upsdebugx(2, "\n");
 }
 
+/* Gather the meters and alarms which the updates have to look at */
+void init_decode_plan(void)
+{
+	unsigned int iIndex;
+
+	meter_plan_len = 0;
+	meter_plan_has_load = FALSE;
+	for (iIndex = 0; iIndex < BCMXCP_METER_MAP_MAX; iIndex++) {
+		if (bcmxcp_meter_map[iIndex].format == 0 || bcmxcp_meter_map[iIndex].nut_entity == NULL)
+			continue;
+		meter_plan[meter_plan_len++] = (unsigned char)iIndex;
+		if (!strcasecmp(bcmxcp_meter_map[iIndex].nut_entity, "ups.load"))
+			meter_plan_has_load = TRUE;
+	}
+
+	alarm_plan_len = 0;
+	for (iIndex = 0; iIndex < BCMXCP_ALARM_MAP_MAX; iIndex++) {
+		if (bcmxcp_alarm_map[iIndex].alarm_block_index >= 0 && bcmxcp_alarm_map[iIndex].alarm_desc != NULL)
+			alarm_plan[alarm_plan_len++] = (uint16_t)iIndex;
+	}
+
+	upsdebugx(2, "%u meters and %u alarms to decode", meter_plan_len, alarm_plan_len);
+}
+
 bool_t set_alarm_support_in_alarm_map(
 	const unsigned char *map,
 	const unsigned int mapIndex,
@@ -1023,7 +1100,11 @@ unsigned char init_outlet(unsigned char len)
 	unsigned char num_outlet, size_outlet, num;
 	unsigned char outlet_num, outlet_state;
 	uint16_t auto_dly_off, auto_dly_on;
-	char outlet_name[64];
+	/* this runs on every poll: index the outlet variables */
+	st_family_t *outlet_id = dstate_family("outlet.%i.id"),
+		*outlet_status = dstate_family("outlet.%i.status"),
+		*outlet_dly_off = dstate_family("outlet.%i.delay.shutdown"),
+		*outlet_dly_on = dstate_family("outlet.%i.delay.start");
 
 	res = command_read_sequence(PW_OUT_MON_BLOCK_REQ, answer);
 	if (res <= 0)
@@ -1040,30 +1121,28 @@ unsigned char init_outlet(unsigned char len)
 	for (num = 1 ; num <= num_outlet ; num++) {
 		outlet_num = answer[iIndex++];
 		upsdebugx(2, "Outlet number: %u", outlet_num);
-		snprintf(outlet_name, sizeof(outlet_name)-1, "outlet.%u.id", num);
-		dstate_setinfo(outlet_name, "%u", outlet_num);
+		dstate_family_setinfo(outlet_id, num, "%u", outlet_num);
 
 		outlet_state = answer[iIndex++];
 		upsdebugx(2, "Outlet state: %u", outlet_state);
-		snprintf(outlet_name, sizeof(outlet_name)-1, "outlet.%u.status", num);
 		if (outlet_state>0 && outlet_state <9)
-			dstate_setinfo(outlet_name, "%s", OutletStatus[outlet_state]);
+			dstate_family_setinfo(outlet_status, num, "%s", OutletStatus[outlet_state]);
 
 		auto_dly_off = get_word(answer+iIndex);
 		iIndex += 2;
 		upsdebugx(2, "Auto delay off: %u", auto_dly_off);
-		snprintf(outlet_name, sizeof(outlet_name)-1, "outlet.%u.delay.shutdown", num);
-		dstate_setinfo(outlet_name, "%u", auto_dly_off);
-		dstate_setflags(outlet_name, ST_FLAG_RW | ST_FLAG_STRING);
-		dstate_setaux(outlet_name, 5);
+		if (dstate_family_setinfo(outlet_dly_off, num, "%u", auto_dly_off) >= 0) {
+			dstate_setflags(dstate_family_name(outlet_dly_off, num), ST_FLAG_RW | ST_FLAG_STRING);
+			dstate_setaux(dstate_family_name(outlet_dly_off, num), 5);
+		}
 
 		auto_dly_on = get_word(answer+iIndex);
 		iIndex += 2;
 		upsdebugx(2, "Auto delay on: %u", auto_dly_on);
-		snprintf(outlet_name, sizeof(outlet_name)-1, "outlet.%u.delay.start", num);
-		dstate_setinfo(outlet_name, "%u", auto_dly_on);
-		dstate_setflags(outlet_name, ST_FLAG_RW | ST_FLAG_STRING);
-		dstate_setaux(outlet_name, 5);
+		if (dstate_family_setinfo(outlet_dly_on, num, "%u", auto_dly_on) >= 0) {
+			dstate_setflags(dstate_family_name(outlet_dly_on, num), ST_FLAG_RW | ST_FLAG_STRING);
+			dstate_setaux(dstate_family_name(outlet_dly_on, num), 5);
+		}
 	}
 
 	return num_outlet;
@@ -1073,7 +1152,12 @@ void init_ext_vars(void)
 {
 	unsigned char answer[PW_ANSWER_MAX_SIZE], cbuf[5];
 	ssize_t length = 0;
-	int index = 0;
+
+	if (cap_ext_vars.known) {
+		upsdebugx(2, "Configurable variables from the capabilities cache.");
+		set_ext_vars(cap_ext_vars.val, cap_ext_vars.len);
+		return;
+	}
 
 	send_write_command(AUTHOR, 4);
 
@@ -1087,10 +1171,21 @@ void init_ext_vars(void)
 	length = command_write_sequence(cbuf, 4, answer);
 	if (length <= 0)
 		fatal_with_errno(EXIT_FAILURE, "Could not communicate with the ups");
-	if (length < 4)  /* UPS doesn't have configurable vars */
-		return;
-	for (index=3; index < length; index++) {
-		switch(answer[index]) {
+
+	/* less than 4 bytes: UPS doesn't have configurable vars */
+	cap_ext_vars.len = (length < 4) ? 0 : (unsigned char)(length - 3);
+	memcpy(cap_ext_vars.val, answer + 3, cap_ext_vars.len);
+	cap_ext_vars.known = TRUE;
+	set_ext_vars(cap_ext_vars.val, cap_ext_vars.len);
+}
+
+/* Set the configurable variables up from a configuration list */
+void set_ext_vars(const unsigned char *conf, unsigned char len)
+{
+	int index = 0;
+
+	for (index=0; index < len; index++) {
+		switch(conf[index]) {
 			case PW_CONF_LOW_DEV_LIMIT:  dstate_setinfo("input.transfer.boost.high", "%d", 0);
 						     dstate_setflags("input.transfer.boost.high", ST_FLAG_RW | ST_FLAG_STRING);
 						     dstate_setaux("input.transfer.boost.high", 3);
@@ -1344,9 +1439,13 @@ void init_topology(void)
 void init_system_test_capabilities(void)
 {
 	unsigned char answer[PW_ANSWER_MAX_SIZE], cbuf[5];
-	const char* nutvalue;
 	ssize_t res;
-	int value, i;
+
+	if (cap_system_tests.known) {
+		upsdebugx(2, "System test capabilities from the capabilities cache.");
+		set_system_test_capabilities(cap_system_tests.val, cap_system_tests.len);
+		return;
+	}
 
 	/* Query what system test capabilities are supported */
 	send_write_command(AUTHOR, 4);
@@ -1361,21 +1460,175 @@ void init_system_test_capabilities(void)
 		return;
 	}
 
+	cap_system_tests.known = TRUE;
 	if ((unsigned char)answer[0] != BCMXCP_RETURN_ACCEPTED) {
 		upsdebugx(2, "System test capabilities list not supported");
+		cap_system_tests.len = 0;
 		return;
 	}
 
-	/* Add instcmd for system test capabilities */
-	for (i = 3; i < res; i++) {
-		value = answer[i];
-		if ((nutvalue = nut_find_infoval(system_test_info, value, TRUE)) != NULL) {
+	cap_system_tests.len = (res < 3) ? 0 : (unsigned char)(res - 3);
+	memcpy(cap_system_tests.val, answer + 3, cap_system_tests.len);
+	set_system_test_capabilities(cap_system_tests.val, cap_system_tests.len);
+}
+
+/* Add instcmd for system test capabilities */
+void set_system_test_capabilities(const unsigned char *caps, unsigned char len)
+{
+	const char* nutvalue;
+	int i;
+
+	for (i = 0; i < len; i++) {
+		if ((nutvalue = nut_find_infoval(system_test_info, caps[i], TRUE)) != NULL) {
 			upsdebugx(2, "Added support for instcmd %s", nutvalue);
 			dstate_addcmd(nutvalue);
 		}
 	}
 }
 
+/*
+ * Capabilities cache: with the "capcache" flag, the command list, system
+ * test capabilities and configurable variables of the UPS are saved in the
+ * state path along with its ID block, so that a restart on the same UPS
+ * (same firmware, rating, model and maps) does not query them again, each
+ * query of the latter two taking an authorization and a PW_SLEEP wait.
+ * What the cache lacks, or all on another UPS, is queried as before.
+ */
+static char *capcache_filename(void)
+{
+	static char	fn[NUT_PATH_MAX + 1];
+
+	snprintf(fn, sizeof(fn), "%s/%s-%s.%s", dflt_statepath(),
+		progname, upsname ? upsname : "bcmxcp", CAPCACHE_SUFFIX);
+	return fn;
+}
+
+/* "<name> <hex bytes>" line of a capability list */
+static void capcache_put(FILE *f, const char *name, const unsigned char *val, size_t len)
+{
+	size_t	i;
+
+	fprintf(f, "%s ", name);
+	for (i = 0; i < len; i++)
+		fprintf(f, "%02x", val[i]);
+	fprintf(f, "\n");
+}
+
+static ssize_t capcache_get(const char *hex, unsigned char *val, size_t maxlen)
+{
+	size_t	len, i;
+	unsigned int	c;
+
+	len = strspn(hex, "0123456789abcdef");
+	if ((hex[len] && strcmp(hex + len, "\n")) || len % 2 || len / 2 > maxlen)
+		return -1;
+
+	for (i = 0; i < len / 2; i++) {
+		if (sscanf(hex + 2 * i, "%2x", &c) != 1)
+			return -1;
+		val[i] = (unsigned char)c;
+	}
+
+	return (ssize_t)(len / 2);
+}
+
+/* load the lists of the UPS with this ID block, if the cache has it */
+bool_t capcache_load(const unsigned char *id_block, ssize_t len)
+{
+	char	line[2 * PW_ANSWER_MAX_SIZE + 32], *val;
+	unsigned char	id[PW_ANSWER_MAX_SIZE];
+	BCMXCP_CAPLIST_t	*list;
+	ssize_t	n;
+	FILE	*f;
+
+	if (!testvar("capcache") || len <= 0)
+		return FALSE;
+
+	capcache_id_len = (size_t)len;
+	memcpy(capcache_id, id_block, capcache_id_len);
+
+	if ((f = fopen(capcache_filename(), "r")) == NULL) {
+		upsdebugx(2, "No capabilities cache %s yet", capcache_filename());
+		return FALSE;
+	}
+
+	/* the ID block comes first, nothing is taken from another UPS */
+	while (fgets(line, sizeof(line), f)) {
+		if (line[0] == '#' || (val = strchr(line, ' ')) == NULL)
+			continue;
+		*val++ = '\0';
+
+		if (!strcmp(line, "id")) {
+			n = capcache_get(val, id, sizeof(id));
+			if (n != len || memcmp(id, id_block, capcache_id_len)) {
+				upsdebugx(1, "Capabilities cache %s is of another UPS, ignored", capcache_filename());
+				break;
+			}
+			capcache_loaded = TRUE;
+			continue;
+		}
+		if (!capcache_loaded)
+			break;
+
+		if (!strcmp(line, "commands"))
+			list = &cap_commands;
+		else if (!strcmp(line, "systemtests"))
+			list = &cap_system_tests;
+		else if (!strcmp(line, "extvars"))
+			list = &cap_ext_vars;
+		else
+			continue;
+
+		if ((n = capcache_get(val, list->val, sizeof(list->val))) < 0
+		 || n > UCHAR_MAX) {
+			upsdebugx(1, "Invalid %s list in the capabilities cache, ignored", line);
+			continue;
+		}
+		list->len = (unsigned char)n;
+		list->known = TRUE;
+	}
+
+	fclose(f);
+
+	if (capcache_loaded)
+		upsdebugx(1, "Using the capabilities cache %s", capcache_filename());
+	return capcache_loaded;
+}
+
+void capcache_save(void)
+{
+	char	tmpfn[NUT_PATH_MAX + 32];
+	FILE	*f;
+
+	/* not caching, or nothing new */
+	if (!capcache_id_len
+	 || (capcache_loaded && cap_commands.known && cap_system_tests.known && cap_ext_vars.known))
+		return;
+
+	snprintf(tmpfn, sizeof(tmpfn), "%s.%ld.tmp", capcache_filename(), (long)getpid());
+	if ((f = fopen(tmpfn, "w")) == NULL) {
+		upslog_with_errno(LOG_WARNING, "Can't write the capabilities cache %s", tmpfn);
+		return;
+	}
+
+	fprintf(f, "# %s capabilities cache, remove to query the UPS in full\n", progname);
+	capcache_put(f, "id", capcache_id, capcache_id_len);
+	if (cap_commands.known)
+		capcache_put(f, "commands", cap_commands.val, cap_commands.len);
+	if (cap_system_tests.known)
+		capcache_put(f, "systemtests", cap_system_tests.val, cap_system_tests.len);
+	if (cap_ext_vars.known)
+		capcache_put(f, "extvars", cap_ext_vars.val, cap_ext_vars.len);
+
+	if (fclose(f) != 0 || rename(tmpfn, capcache_filename()) != 0) {
+		upslog_with_errno(LOG_WARNING, "Can't write the capabilities cache %s", capcache_filename());
+		unlink(tmpfn);
+		return;
+	}
+
+	upsdebugx(1, "Wrote the capabilities cache %s", capcache_filename());
+}
+
 void upsdrv_initinfo(void)
 {
 	unsigned char answer[PW_ANSWER_MAX_SIZE];
@@ -1414,6 +1667,9 @@ void upsdrv_initinfo(void)
 	if (res <= 0)
 		fatal_with_errno(EXIT_FAILURE, "Could not communicate with the ups");
 
+	/* What else the UPS told us before, if the same UPS */
+	capcache_load(answer, res);
+
 	/* Get number of CPU's in ID block */
 	len = answer[iIndex++];
 
@@ -1498,6 +1754,8 @@ void upsdrv_initinfo(void)
 	init_ups_alarm_map(answer+iIndex, (unsigned char)len);
 	iIndex += len;
 
+	init_decode_plan();
+
 	/* Then the Config_block_length */
 	conf_block_len = get_word(answer+iIndex);
 	upsdebugx(2, "Length of Config_block: %u\n", conf_block_len);
@@ -1586,6 +1844,8 @@ void upsdrv_initinfo(void)
    	/* Get information about configurable external variables*/
 	init_ext_vars();
 
+	capcache_save();
+
 	upsh.instcmd = instcmd;
 	upsh.setvar = setvar;
 }
@@ -1596,9 +1856,9 @@ void upsdrv_updateinfo(void)
 	unsigned char status, topology;
 	char sValue[128];
 	int iIndex;
+	unsigned int i;
 	ssize_t res;
 	uint16_t value;
-	bool_t has_ups_load = FALSE;
 	int batt_status = 0;
 	const char *nutvalue;
 	float calculated_load;
@@ -1612,24 +1872,18 @@ void upsdrv_updateinfo(void)
 		return;
 	}
 
-	/* Loop thru meter map, get all data UPS is willing to offer */
-	for (iIndex = 0; iIndex < BCMXCP_METER_MAP_MAX; iIndex++) {
-		if (bcmxcp_meter_map[iIndex].format != 0 && bcmxcp_meter_map[iIndex].nut_entity != NULL) {
-			decode_meter_map_entry(answer + bcmxcp_meter_map[iIndex].meter_block_index,
-						 bcmxcp_meter_map[iIndex].format, sValue);
-
-			/* Set result */
-			dstate_setinfo(bcmxcp_meter_map[iIndex].nut_entity, "%s", sValue);
+	/* Loop thru the mapped meters, get all data UPS is willing to offer */
+	for (i = 0; i < meter_plan_len; i++) {
+		iIndex = meter_plan[i];
+		decode_meter_map_entry(answer + bcmxcp_meter_map[iIndex].meter_block_index,
+					 bcmxcp_meter_map[iIndex].format, sValue);
 
-			/* Check if we read ups.load */
-			if (has_ups_load == FALSE && !strcasecmp(bcmxcp_meter_map[iIndex].nut_entity, "ups.load")) {
-				has_ups_load = TRUE;
-			}
-		}
+		/* Set result */
+		dstate_setinfo(bcmxcp_meter_map[iIndex].nut_entity, "%s", sValue);
 	}
 
 	/* Calculate ups.load if UPS does not report it directly */
-	if (has_ups_load == FALSE) {
+	if (meter_plan_has_load == FALSE) {
 		calculated_load = calculate_ups_load(answer);
 		if (calculated_load >= 0.0f) {
 			dstate_setinfo("ups.load", "%5.1f", calculated_load);
@@ -1660,24 +1914,23 @@ void upsdrv_updateinfo(void)
 		/* Set alarms */
 		alarm_init();
 
-		/* Loop thru alarm map, get all alarms UPS is willing to offer */
-		for (iIndex = 0; iIndex < BCMXCP_ALARM_MAP_MAX; iIndex++) {
-			if (bcmxcp_alarm_map[iIndex].alarm_block_index >= 0 && bcmxcp_alarm_map[iIndex].alarm_desc != NULL) {
-				if (answer[bcmxcp_alarm_map[iIndex].alarm_block_index] > 0) {
-					alarm_set(bcmxcp_alarm_map[iIndex].alarm_desc);
-
-					if (iIndex == BCMXCP_ALARM_UPS_ON_BATTERY) {
-						bcmxcp_status.alarm_on_battery = 1;
-					}
-					else if (iIndex == BCMXCP_ALARM_BATTERY_LOW) {
-						bcmxcp_status.alarm_low_battery = 1;
-					}
-					else if (iIndex == BCMXCP_ALARM_BATTERY_TEST_FAILED) {
-						bcmxcp_status.alarm_replace_battery = 1;
-					}
-					else if (iIndex == BCMXCP_ALARM_BATTERY_NEEDS_SERVICE) {
-						bcmxcp_status.alarm_replace_battery = 1;
-					}
+		/* Loop thru the supported alarms, get all alarms UPS is willing to offer */
+		for (i = 0; i < alarm_plan_len; i++) {
+			iIndex = alarm_plan[i];
+			if (answer[bcmxcp_alarm_map[iIndex].alarm_block_index] > 0) {
+				alarm_set(bcmxcp_alarm_map[iIndex].alarm_desc);
+
+				if (iIndex == BCMXCP_ALARM_UPS_ON_BATTERY) {
+					bcmxcp_status.alarm_on_battery = 1;
+				}
+				else if (iIndex == BCMXCP_ALARM_BATTERY_LOW) {
+					bcmxcp_status.alarm_low_battery = 1;
+				}
+				else if (iIndex == BCMXCP_ALARM_BATTERY_TEST_FAILED) {
+					bcmxcp_status.alarm_replace_battery = 1;
+				}
+				else if (iIndex == BCMXCP_ALARM_BATTERY_NEEDS_SERVICE) {
+					bcmxcp_status.alarm_replace_battery = 1;
 				}
 			}
 		}
@@ -2229,6 +2482,7 @@ void upsdrv_makevartable(void)
 	 */
 	addvar(VAR_VALUE, "shutdown_delay", "Specify shutdown delay (seconds)");
 	addvar(VAR_VALUE, "baud_rate", "Specify communication speed (ex: 9600)");
+	addvar(VAR_FLAG, "capcache", "Cache the capabilities of the UPS across restarts");
 }
 
 int setvar (const char *varname, const char *val)
@@ -34,7 +34,10 @@
 #endif	/* !WIN32 */
 
 #define DRIVER_NAME	"Clone UPS driver"
-#define DRIVER_VERSION	"0.08"
+#define DRIVER_VERSION	"0.09"
+
+/* most reads of the driver socket per update, the rest waits for the next one */
+#define SSTATE_READ_MAX	16
 
 /* driver description structure */
 upsdrv_info_t upsdrv_info = {
@@ -359,6 +362,8 @@ static void sstate_disconnect(void)
 #endif	/* WIN32 */
 
 	upsfd = ERROR_FD;
+	/* do not leave a closed fd for the main loop to wait on */
+	extrafd = ERROR_FD;
 }
 
 
@@ -395,31 +400,76 @@ static int sstate_sendline(const char *buf)
 }
 
 
+static int sstate_parse(const char *buf, ssize_t len)
+{
+	ssize_t	i;
+
+	for (i = 0; i < len; i++) {
+
+		switch (pconf_char(&sock_ctx, buf[i]))
+		{
+			case 1:
+				if (parse_args(sock_ctx.numargs, sock_ctx.arglist)) {
+					time(&last_heard);
+				}
+				continue;
+
+			case 0:
+				continue;	/* haven't gotten a line yet */
+
+			default:
+				/* parse error */
+				upslogx(LOG_NOTICE, "Parse error on sock: %s", sock_ctx.errmsg);
+				return -1;
+		}
+	}
+
+	return 0;
+}
+
+
 static int sstate_readline(void)
 {
-	int	i;
 	ssize_t	ret;
 #ifndef WIN32
 	char	buf[SMALLBUF];
+	int	reads;
 
 	if (INVALID_FD(upsfd)) {
 		return -1;	/* failed */
 	}
 
-	ret = read(upsfd, buf, sizeof(buf));
+	/* The socket is our extrafd, so the main loop wakes us up as soon as
+	 * the driver has sent something: take all of it (within reason), so
+	 * as not to be woken up again right away for what is left over */
+	for (reads = 0; reads < SSTATE_READ_MAX; reads++) {
+		ret = read(upsfd, buf, sizeof(buf));
 
-	if (ret < 0) {
-		switch(errno)
-		{
-			case EINTR:
-			case EAGAIN:
-				return 0;
+		if (ret < 0) {
+			switch(errno)
+			{
+				case EINTR:
+				case EAGAIN:
+					return 0;
 
-			default:
-				upslog_with_errno(LOG_WARNING, "Read from UPS [%s] failed", device_path);
-				return -1;
+				default:
+					upslog_with_errno(LOG_WARNING, "Read from UPS [%s] failed", device_path);
+					return -1;
+			}
+		}
+
+		if (ret == 0) {
+			/* would wake us up all the time if kept */
+			upslogx(LOG_WARNING, "Driver for UPS [%s] has closed the connection", device_path);
+			return -1;
+		}
+
+		if (sstate_parse(buf, ret)) {
+			return -1;
 		}
 	}
+
+	return 0;
 #else	/* WIN32 */
 	if (INVALID_FD(upsfd)) {
 		return -1;	/* failed */
@@ -430,29 +480,9 @@ static int sstate_readline(void)
 	DWORD bytesRead;
 	GetOverlappedResult(upsfd, &read_overlapped, &bytesRead, FALSE);
 	ret = bytesRead;
-#endif	/* WIN32 */
-
-	for (i = 0; i < ret; i++) {
-
-		switch (pconf_char(&sock_ctx, buf[i]))
-		{
-			case 1:
-				if (parse_args(sock_ctx.numargs, sock_ctx.arglist)) {
-					time(&last_heard);
-				}
-				continue;
-
-			case 0:
-				continue;	/* haven't gotten a line yet */
 
-			default:
-				/* parse error */
-				upslogx(LOG_NOTICE, "Parse error on sock: %s", sock_ctx.errmsg);
-				return -1;
-		}
-	}
-
-	return 0;
+	return sstate_parse(buf, ret);
+#endif	/* WIN32 */
 }
 
 
@@ -597,16 +627,20 @@ void upsdrv_initinfo(void)
 void upsdrv_updateinfo(void)
 {
 	time_t	now = time(NULL);
+#ifdef WIN32
 	double	d;
 
-	/* Throttle tight loops to avoid CPU burn, e.g. when the socket to driver
-	 * is not in fact connected, so a select() somewhere is not waiting much */
+	/* Throttle tight loops to avoid CPU burn, e.g. when the pipe to driver
+	 * is not in fact connected, so a wait somewhere is not waiting much.
+	 * Elsewhere, the socket is drained and dropped when closed, so that
+	 * we are only woken up early by upstream data, and handle it at once */
 	if (last_poll > 0 && (d = difftime(now, last_poll)) < 1.0) {
 		upsdebugx(5, "%s: too little time (%g sec) has passed since last cycle, throttling",
 			__func__, d);
 		usleep(500000);
 		now = time(NULL);
 	}
+#endif	/* WIN32 */
 
 	if (sstate_dead(15)) {
 		sstate_disconnect();
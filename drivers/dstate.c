@@ -25,6 +25,7 @@
 #include "config.h" /* must be the first header */
 
 #include <stdio.h>
+#include <ctype.h>
 #ifndef WIN32
 # include <stdarg.h>
 # include <sys/stat.h>
@@ -39,26 +40,105 @@
 
 #include "common.h"
 #include "dstate.h"
+#include "main.h"
 #include "state.h"
+#include "stateshm.h"
+#include "sockframe.h"
 #include "parseconf.h"
 #include "attribute.h"
 #include "nut_stdint.h"
+#include "nut_probes.h"
 
 	static TYPE_FD	sockfd = ERROR_FD;
 #ifndef WIN32
 	static char	*sockfn = NULL;
+	/* the process which made the socket file and removes it; 0 if it was
+	 * passed to us (see nut_listen_fds()), so stays for the next one */
+	static pid_t	sockfn_owner = 0;
 #else	/* WIN32 */
 	static OVERLAPPED	connect_overlapped;
 	static char	*pipename = NULL;
 #endif	/* WIN32 */
 	static int	stale = 1, alarm_active = 0, alarm_status = 0, ignorelb = 0,
 				alarm_legacy_status = 0;
-	static char	status_buf[ST_MAX_VALUE_LEN], alarm_buf[ST_MAX_VALUE_LEN],
-			buzzmode_buf[ST_MAX_VALUE_LEN];
+	static char	alarm_buf[ST_MAX_VALUE_LEN], buzzmode_buf[ST_MAX_VALUE_LEN];
 	static conn_t	*connhead = NULL;
 	static st_tree_t	*dtree_root = NULL;
 	static cmdlist_t	*cmdhead = NULL;
 
+	/* indexed families of variables, see dstate_family() */
+	static st_family_t	*families = NULL;
+
+	/* states published in memory for connections which asked with
+	 * SHMSTATE, and whether they changed since, see shm_flush() */
+	static stateshm_ctx_t	shmstate;
+	static int	shm_dirty = 0;
+
+	/* the states saved for the next run of the driver ("statesnapshot"),
+	 * and whether they changed since, see snapshot_flush() */
+	static stateshm_ctx_t	snapstate;
+	static char	*snap_fn = NULL;
+	static int	snap_dirty = 0;
+	static time_t	snap_last = 0;
+
+#ifndef WIN32
+	/* more fds to wake up on, see dstate_watch_fd() and dstate_add_fd() */
+	typedef struct {
+		int	fd;
+		int	events;	/* DSTATE_WATCH_* */
+		dstate_fd_func_t	func;	/* NULL: just wake up */
+		void	*arg;
+	} watch_fd_t;
+
+	static watch_fd_t	*watch_fds = NULL;
+	static size_t	watch_count = 0, watch_alloc = 0;
+
+	/* those found ready by dstate_poll_fds(), which their callbacks
+	 * may (un)watch fds meanwhile */
+	static watch_fd_t	*watch_ready = NULL;
+	static size_t	watch_ready_alloc = 0;
+#endif	/* !WIN32 */
+
+	/* broadcasts held back by dstate_batch_begin(): all of them, just
+	 * the events for connections reading the states from memory, and
+	 * all of them with the TRACE times for connections which asked */
+	typedef struct {
+		char	*buf;
+		size_t	len, size;
+	} batch_buf_t;
+	static int	batch_depth = 0;
+	static batch_buf_t	batch_all, batch_events, batch_trace;
+
+	/* connections which asked for TRACE */
+	static int	trace_conns = 0;
+
+	/* all the connections, those which asked for FRAMED, the names
+	 * their records refer to, and the records of a batch for them */
+	static int	all_conns = 0, framed_conns = 0;
+	static sockframe_names_t	frame_names;
+	static batch_buf_t	batch_frames;
+
+	/* what DUMPALL sends (but for DATAOK and DUMPDONE), made once for
+	 * all the connections asking until the states change */
+	static batch_buf_t	dump_cache;
+	static int	dump_valid = 0;
+
+	/* the same as records for FRAMED connections */
+	static batch_buf_t	frame_dump_cache;
+	static int	frame_dump_valid = 0;
+
+	/* once a connection asked for SEQ: the last DSTATE_JOURNAL_MAX changes
+	 * of the state tree (their arguments one after another, a ring where
+	 * number <seq> is at (<seq> - 1) % DSTATE_JOURNAL_MAX), the number of
+	 * the last one and of the last sent with SEQ, and who is numbering */
+	typedef struct {
+		char	*args;
+		size_t	len, quoted, numargs;
+	} journal_entry_t;
+	static journal_entry_t	journal[DSTATE_JOURNAL_MAX];
+	static uint64_t	journal_seq = 0, journal_sent = 0;
+	static char	journal_epoch[SMALLBUF] = "";
+
 	struct ups_handler	upsh;
 
 #ifndef WIN32
@@ -148,15 +228,23 @@ static TYPE_FD sock_open(const char *fn)
 
 	check_unix_socket_filename(fn);
 
+	/* keep this around for the unlink() when exiting */
+	sockfn = xstrdup(fn);
+
+	if (VALID_FD((fd = nut_listen_fd_unix(fn)))) {
+		sockfn_owner = 0;
+		if (!getenv("NUT_QUIET_INIT_LISTENER"))
+			upslogx(LOG_INFO, "Listening on socket %s (passed by the service manager)", sockfn);
+		return fd;
+	}
+
 	fd = socket(AF_UNIX, SOCK_STREAM, 0);
 
 	if (INVALID_FD(fd)) {
 		fatal_with_errno(EXIT_FAILURE, "Can't create a unix domain socket");
 	}
 
-	/* keep this around for the unlink() when exiting */
-	sockfn = xstrdup(fn);
-
+	sockfn_owner = getpid();
 	ssaddr.sun_family = AF_UNIX;
 	snprintf(ssaddr.sun_path, sizeof(ssaddr.sun_path), "%s", sockfn);
 
@@ -234,9 +322,11 @@ static void sock_disconnect(conn_t *conn)
 	close(conn->fd);
 #else	/* WIN32 */
 	/* FIXME NUT_WIN32_INCOMPLETE not sure if this is the right way to close a connection */
-	if (conn->read_overlapped.hEvent != INVALID_HANDLE_VALUE) {
-		CloseHandle(conn->read_overlapped.hEvent);
-		conn->read_overlapped.hEvent = INVALID_HANDLE_VALUE;
+	pipe_reads_stop(&conn->reads);
+	pipe_reads_free(&conn->reads);
+	if (conn->read_event != INVALID_HANDLE_VALUE) {
+		CloseHandle(conn->read_event);
+		conn->read_event = INVALID_HANDLE_VALUE;
 	}
 	upsdebugx(3, "%s: disconnecting named pipe handle %p", __func__, conn->fd);
 	DisconnectNamedPipe(conn->fd);
@@ -245,6 +335,15 @@ static void sock_disconnect(conn_t *conn)
 	upsdebugx(5, "%s: finishing parsing context", __func__);
 	pconf_finish(&conn->ctx);
 
+	if (conn->trace) {
+		trace_conns--;
+	}
+
+	if (conn->framed) {
+		framed_conns--;
+	}
+	all_conns--;
+
 	upsdebugx(5, "%s: relinking the chain of connections", __func__);
 	if (conn->prev) {
 		conn->prev->next = conn->next;
@@ -259,18 +358,345 @@ static void sock_disconnect(conn_t *conn)
 	}
 
 	upsdebugx(5, "%s: freeing the conn object", __func__);
+#ifndef WIN32
+	free(conn->outbuf);
+#endif	/* !WIN32 */
+	while (conn->numcmds--) {
+		free(conn->cmds[conn->numcmds].name);
+		free(conn->cmds[conn->numcmds].value);
+		free(conn->cmds[conn->numcmds].id);
+	}
+	free(conn->cmds);
 	free(conn);
 }
 
-static void send_to_all(const char *fmt, ...)
+static int send_to_one(conn_t *conn, const char *fmt, ...)
+	__attribute__ ((__format__ (__printf__, 2, 3)));
+static void shm_flush(void);
+static void batch_flush(void);
+
+static void batch_add(batch_buf_t *batch, const char *buf, size_t len)
+{
+	if (batch->len + len > batch->size) {
+		while (batch->len + len > batch->size) {
+			batch->size = batch->size ? 2 * batch->size : ST_SOCK_BUF_LEN * 8;
+		}
+		batch->buf = xrealloc(batch->buf, batch->size);
+	}
+
+	memcpy(batch->buf + batch->len, buf, len);
+	batch->len += len;
+}
+
+/* a write to a connection failed: drop it */
+static void send_failed(conn_t *conn, size_t buflen, ssize_t ret, const char *func)
+{
+#ifndef WIN32
+	upsdebug_with_errno(0, "WARNING: %s: write %" PRIuSIZE " bytes to "
+		"socket %d failed (ret=%" PRIiSIZE "), disconnecting.",
+		func, buflen, (int)conn->fd, ret);
+#else	/* WIN32 */
+	upsdebug_with_errno(0, "WARNING: %s: write %" PRIuSIZE " bytes to "
+		"handle %p failed (ret=%" PRIiSIZE "), disconnecting.",
+		func, buflen, conn->fd, ret);
+#endif	/* WIN32 */
+
+	sock_disconnect(conn);
+}
+
+#ifndef WIN32
+/* write out as much of the queue of a connection as it takes now,
+ * returns 0 if the connection failed and was dropped */
+static int conn_flush(conn_t *conn)
+{
+	ssize_t	ret;
+
+	while (conn->outoff < conn->outlen) {
+		ret = write(conn->fd, conn->outbuf + conn->outoff,
+			conn->outlen - conn->outoff);
+
+		if (ret < 0 && errno == EINTR) {
+			continue;
+		}
+
+		if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			break;	/* the rest when the reader is ready */
+		}
+
+		if (ret < 1) {
+			send_failed(conn, conn->outlen - conn->outoff, ret, __func__);
+			return 0;
+		}
+
+		conn->outoff += (size_t)ret;
+	}
+
+	upsdebugx(6, "%s: %" PRIuSIZE " bytes left queued for socket %d",
+		__func__, conn->outlen - conn->outoff, (int)conn->fd);
+
+	if (conn->outoff == conn->outlen) {
+		conn->outoff = conn->outlen = 0;
+	}
+
+	return 1;
+}
+#endif	/* !WIN32 */
+
+/* send <len> bytes to a connection: whatever it can not take right now is
+ * queued behind anything queued before, and written by dstate_poll_fds()
+ * once the reader is ready for more, so a slow reader does not hold up the
+ * driver; returns 0 if the connection failed and was dropped */
+static int conn_send(conn_t *conn, const char *buf, size_t len, const char *func)
+{
+	ssize_t	ret = 0;
+	size_t	off = 0;
+
+#ifndef WIN32
+	/* nothing may overtake what is queued already */
+	while (conn->outoff == conn->outlen && off < len) {
+		ret = write(conn->fd, buf + off, len - off);
+
+		if (ret < 0 && errno == EINTR) {
+			continue;
+		}
+
+		if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			break;
+		}
+
+		if (ret < 1) {
+			send_failed(conn, len - off, ret, func);
+			return 0;
+		}
+
+		off += (size_t)ret;
+	}
+
+	if (off == len) {
+		upsdebugx(6, "%s: wrote %" PRIuSIZE " bytes to socket %d",
+			func, len, (int)conn->fd);
+		return 1;
+	}
+
+	len -= off;
+	if (conn->outlen - conn->outoff + len > DSTATE_CONN_OUTBUF_MAX) {
+		upslogx(LOG_WARNING, "%s: dropping the connection on socket %d: "
+			"more than %d bytes sent to it are not consumed yet",
+			func, (int)conn->fd, DSTATE_CONN_OUTBUF_MAX);
+		sock_disconnect(conn);
+		return 0;
+	}
+
+	if (conn->outsize - conn->outlen < len) {
+		/* reclaim the space of data already sent */
+		if (conn->outoff > 0) {
+			memmove(conn->outbuf, conn->outbuf + conn->outoff,
+				conn->outlen - conn->outoff);
+			conn->outlen -= conn->outoff;
+			conn->outoff = 0;
+		}
+
+		if (conn->outsize - conn->outlen < len) {
+			while (conn->outsize - conn->outlen < len) {
+				conn->outsize = conn->outsize ? 2 * conn->outsize : ST_SOCK_BUF_LEN * 4;
+			}
+			conn->outbuf = xrealloc(conn->outbuf, conn->outsize);
+		}
+	}
+
+	memcpy(conn->outbuf + conn->outlen, buf + off, len);
+	conn->outlen += len;
+
+	upsdebugx(6, "%s: queued %" PRIuSIZE " bytes for socket %d, "
+		"%" PRIuSIZE " in total", func, len, (int)conn->fd,
+		conn->outlen - conn->outoff);
+#else	/* WIN32 */
+	while (off < len) {
+		DWORD	bytesWritten = 0;
+
+		ret = WriteFile(conn->fd, buf + off, len - off,
+			&bytesWritten, NULL) ? (ssize_t)bytesWritten : -1;
+		if (ret < 1) {
+			send_failed(conn, len - off, ret, func);
+			return 0;
+		}
+		off += (size_t)ret;
+	}
+#endif	/* WIN32 */
+
+	return 1;
+}
+
+/* send records to a FRAMED connection, after the definitions of the names
+ * it did not get yet; returns 0 if the connection failed and was dropped */
+static int frame_send(conn_t *conn, const char *frame, size_t len, const char *func)
+{
+	if (conn->frame_names < frame_names.count) {
+		batch_buf_t	defs;
+		char	buf[ST_SOCK_BUF_LEN];
+		size_t	id;
+		int	ret;
+
+		memset(&defs, 0, sizeof(defs));
+		for (id = conn->frame_names; id < frame_names.count; id++) {
+			size_t	deflen = sockframe_name(buf, sizeof(buf), &frame_names, id);
+
+			if (deflen) {
+				batch_add(&defs, buf, deflen);
+			}
+		}
+
+		ret = conn_send(conn, defs.buf, defs.len, func);
+		free(defs.buf);
+
+		if (!ret) {
+			return 0;
+		}
+		conn->frame_names = frame_names.count;
+	}
+
+	if (!len) {
+		return 1;
+	}
+
+	return conn_send(conn, frame, len, func);
+}
+
+/* make records of lines with no quoted arguments (like those made by
+ * send_to_one() and send_event_to_all()), returns their length */
+static size_t frame_text(const char *text, char *frame, size_t framesize)
+{
+	char	line[ST_SOCK_BUF_LEN], *p;
+	const char	*arg[SOCKFRAME_MAXARGS];
+	size_t	numargs = 0, len = 0;
+
+	snprintf(line, sizeof(line), "%s", text);
+
+	for (p = line; *p; p++) {
+		if (*p == ' ' || *p == '\n') {
+			int	eol = (*p == '\n');
+
+			*p = '\0';
+			if (eol && numargs) {
+				len += sockframe_args(frame + len, framesize - len,
+					&frame_names, 1, numargs, arg);
+				numargs = 0;
+			}
+			continue;
+		}
+
+		if ((p == line || p[-1] == '\0') && numargs < SOCKFRAME_MAXARGS) {
+			arg[numargs++] = p;
+		}
+	}
+
+	return len;
+}
+
+/* state_update: a change of the state tree (not sent as such to connections
+ * reading it from memory), or else an event like DATAOK */
+static void state_sent(int state_update)
+{
+	if (state_update) {
+		shm_dirty = 1;
+		snap_dirty = 1;
+		dump_valid = 0;
+		frame_dump_valid = 0;
+	} else if (!batch_depth) {
+		/* let memory readers see the changes made before the event */
+		shm_flush();
+	}
+}
+
+/* send a line to the connections which take text */
+static void send_text_to_all(int state_update, const char *buf, size_t buflen)
+{
+	char	tracebuf[ST_SOCK_BUF_LEN + 32];
+	size_t	tracelen = 0;
+	conn_t	*conn, *cnext;
+	int	ret;
+
+	upsdebugx(5, "%s: %.*s", __func__, (int)buflen - 1, buf);
+
+	/* SETINFO <varname> <value> TRACE <usec>: when the value was set
+	 * here, so that the reader can tell how long the change took */
+	if (trace_conns > 0 && state_update && !strncmp(buf, "SETINFO ", 8)
+	 && buf[buflen - 1] == '\n'
+	) {
+		ret = snprintf(tracebuf, sizeof(tracebuf), "%.*s TRACE %" PRIu64 "\n",
+			(int)(buflen - 1), buf, state_get_timestamp_usec());
+		if (ret > 0 && (size_t)ret < sizeof(tracebuf)) {
+			tracelen = (size_t)ret;
+		}
+	}
+
+	if (batch_depth) {
+		batch_add(&batch_all, buf, buflen);
+		if (!state_update) {
+			batch_add(&batch_events, buf, buflen);
+		}
+		if (trace_conns > 0) {
+			if (tracelen) {
+				batch_add(&batch_trace, tracebuf, tracelen);
+			} else {
+				batch_add(&batch_trace, buf, buflen);
+			}
+		}
+
+		/* do not let a huge batch pile up beyond what sockets take */
+		if (batch_all.len >= DSTATE_BATCH_MAX) {
+			batch_flush();
+		}
+		return;
+	}
+
+	for (conn = connhead; conn; conn = cnext) {
+		cnext = conn->next;
+		if (conn->nobroadcast || conn->framed || (state_update && conn->shmstate))
+			continue;
+
+		if (conn->trace && tracelen) {
+			conn_send(conn, tracebuf, tracelen, __func__);
+		} else {
+			conn_send(conn, buf, buflen, __func__);
+		}
+	}
+}
+
+/* send records to the FRAMED connections */
+static void send_frame_to_all(const char *frame, size_t len)
+{
+	conn_t	*conn, *cnext;
+
+	if (!len) {
+		upsdebugx(2, "%s: nothing to write", __func__);
+		return;
+	}
+
+	if (batch_depth) {
+		batch_add(&batch_frames, frame, len);
+		if (batch_frames.len >= DSTATE_BATCH_MAX) {
+			batch_flush();
+		}
+		return;
+	}
+
+	for (conn = connhead; conn; conn = cnext) {
+		cnext = conn->next;
+		if (conn->framed && !conn->nobroadcast) {
+			frame_send(conn, frame, len, __func__);
+		}
+	}
+}
+
+static void vsend_to_all(int state_update, const char *fmt, va_list ap)
 {
 	ssize_t	ret;
 	char	buf[ST_SOCK_BUF_LEN];
 	size_t	buflen;
-	va_list	ap;
-	conn_t	*conn, *cnext;
 
-	va_start(ap, fmt);
+	state_sent(state_update);
+
 #ifdef HAVE_PRAGMAS_FOR_GCC_DIAGNOSTIC_IGNORED_FORMAT_NONLITERAL
 #pragma GCC diagnostic push
 #endif
@@ -288,16 +714,12 @@ static void send_to_all(const char *fmt, ...)
 #ifdef HAVE_PRAGMAS_FOR_GCC_DIAGNOSTIC_IGNORED_FORMAT_NONLITERAL
 #pragma GCC diagnostic pop
 #endif
-	va_end(ap);
 
 	if (ret < 1) {
 		upsdebugx(2, "%s: nothing to write", __func__);
 		return;
 	}
 
-	if (ret <= INT_MAX)
-		upsdebugx(5, "%s: %.*s", __func__, (int)(ret-1), buf);
-
 	buflen = strlen(buf);
 	if (buflen >= SSIZE_MAX) {
 		/* Can't compare buflen to ret... though should not happen with ST_SOCK_BUF_LEN */
@@ -305,58 +727,188 @@ static void send_to_all(const char *fmt, ...)
 		return;
 	}
 
-	for (conn = connhead; conn; conn = cnext) {
-		cnext = conn->next;
-		if (conn->nobroadcast)
-			continue;
+	send_text_to_all(state_update, buf, buflen);
 
-#ifndef WIN32
-		ret = write(conn->fd, buf, buflen);
-#else	/* WIN32 */
-		DWORD bytesWritten = 0;
-		BOOL  result = FALSE;
+	if (framed_conns > 0) {
+		char	frame[ST_SOCK_BUF_LEN];
 
-		result = WriteFile (conn->fd, buf, buflen, &bytesWritten, NULL);
-		if( result == 0 ) {
-			upsdebugx(2, "%s: write failed on handle %p, disconnecting", __func__, conn->fd);
-			sock_disconnect(conn);
-			continue;
-		}
-		else  {
-			ret = (ssize_t)bytesWritten;
+		send_frame_to_all(frame, frame_text(buf, frame, sizeof(frame)));
+	}
+}
+
+static void send_event_to_all(const char *fmt, ...)
+	__attribute__ ((__format__ (__printf__, 1, 2)));
+static void send_event_to_all(const char *fmt, ...)
+{
+	va_list	ap;
+
+	va_start(ap, fmt);
+	vsend_to_all(0, fmt, ap);
+	va_end(ap);
+}
+
+/* the line of the arguments of a change, the one at <quoted> (0 for none)
+ * being a value: returns its length, or 0 if it does not fit */
+static size_t args_text(char *buf, size_t bufsize, size_t quoted, size_t numargs, const char **arg)
+{
+	size_t	i, buflen = 0;
+
+	for (i = 0; i < numargs; i++) {
+		int	ret = snprintf(buf + buflen, bufsize - buflen,
+			(i == quoted) ? "%s\"%s\"" : "%s%s", i ? " " : "", arg[i]);
+
+		if (ret < 0 || (size_t)ret >= bufsize - buflen - 1) {
+			upslogx(LOG_NOTICE, "%s failed: buffered message too large", __func__);
+			return 0;
 		}
-#endif	/* WIN32 */
+		buflen += (size_t)ret;
+	}
 
-		if ((ret < 1) || (ret != (ssize_t)buflen)) {
-#ifndef WIN32
-			upsdebug_with_errno(0, "WARNING: %s: write %" PRIuSIZE " bytes to "
-				"socket %d failed (ret=%" PRIiSIZE "), disconnecting.",
-				__func__, buflen, (int)conn->fd, ret);
-#else	/* WIN32 */
-			upsdebug_with_errno(0, "WARNING: %s: write %" PRIuSIZE " bytes to "
-				"handle %p failed (ret=%" PRIiSIZE "), disconnecting.",
-				__func__, buflen, conn->fd, ret);
-#endif	/* WIN32 */
-			upsdebugx(6, "%s: failed write: %s", __func__, buf);
+	buf[buflen++] = '\n';
+	return buflen;
+}
 
-			sock_disconnect(conn);
+/* keep a change in the journal, see SEQ */
+static void journal_add(size_t quoted, size_t numargs, const char **arg)
+{
+	journal_entry_t	*entry = &journal[journal_seq % DSTATE_JOURNAL_MAX];
+	size_t	i, len = 0;
 
-			/* TOTHINK: Maybe fallback elsewhere in other cases? */
-			if (ret < 0 && errno == EAGAIN && do_synchronous == -1) {
-				upsdebugx(0, "%s: synchronous mode was 'auto', "
-					"will try 'on' for next connections",
-					__func__);
-				do_synchronous = 1;
-			}
+	for (i = 0; i < numargs; i++) {
+		len += strlen(arg[i]) + 1;
+	}
 
-			dstate_setinfo("driver.parameter.synchronous", "%s",
-				(do_synchronous==1)?"yes":((do_synchronous==0)?"no":"auto"));
+	if (len > entry->len) {
+		entry->args = xrealloc(entry->args, len);
+	}
+
+	for (i = 0, len = 0; i < numargs; i++) {
+		size_t	arglen = strlen(arg[i]) + 1;
+
+		memcpy(entry->args + len, arg[i], arglen);
+		len += arglen;
+	}
+
+	entry->len = len;
+	entry->quoted = quoted;
+	entry->numargs = numargs;
+	journal_seq++;
+}
+
+/* send <conn> the changes after number <since> from the journal,
+ * returns 0 if it was dropped */
+static int journal_send(conn_t *conn, uint64_t since)
+{
+	for (; since < journal_seq; since++) {
+		const journal_entry_t	*entry = &journal[since % DSTATE_JOURNAL_MAX];
+		const char	*arg[SOCKFRAME_MAXARGS], *p = entry->args;
+		char	buf[ST_SOCK_BUF_LEN + 64];
+		size_t	i, len;
+
+		for (i = 0; i < entry->numargs && i < SOCKFRAME_MAXARGS; i++) {
+			arg[i] = p;
+			p += strlen(p) + 1;
+		}
+
+		if (conn->framed) {
+			len = sockframe_args(buf, sizeof(buf), &frame_names, 2, i, arg);
+			if (len && !frame_send(conn, buf, len, __func__)) {
+				return 0;
+			}
 		} else {
-			upsdebugx(6, "%s: write %" PRIuSIZE " bytes to socket %d succeeded "
-				"(ret=%" PRIiSIZE "): %s",
-				__func__, buflen, conn->fd, ret, buf);
+			len = args_text(buf, sizeof(buf), entry->quoted, i, arg);
+			if (len && !conn_send(conn, buf, len, __func__)) {
+				return 0;
+			}
+		}
+	}
+
+	return 1;
+}
+
+/* tell the connections which asked for SEQ up to which change they
+ * got, once the changes of a round are sent */
+static void journal_flush(void)
+{
+	conn_t	*conn, *cnext;
+
+	if (!*journal_epoch || journal_sent == journal_seq || batch_depth) {
+		return;
+	}
+
+	for (conn = connhead; conn; conn = cnext) {
+		cnext = conn->next;
+		if (conn->seq && !conn->nobroadcast) {
+			send_to_one(conn, "SEQ %s %" PRIu64 "\n", journal_epoch, journal_seq);
 		}
 	}
+
+	journal_sent = journal_seq;
+}
+
+/* send a change of the state tree given as the arguments of its line,
+ * the one at <quoted> (0 for none) being a value: the text is only made if
+ * a connection takes it, and FRAMED connections get the values as is */
+static void send_to_all(size_t quoted, size_t numargs, const char **arg)
+{
+	state_sent(1);
+
+	if (*journal_epoch) {
+		journal_add(quoted, numargs, arg);
+	}
+
+	if (all_conns > framed_conns) {
+		char	buf[ST_SOCK_BUF_LEN];
+		size_t	buflen = args_text(buf, sizeof(buf), quoted, numargs, arg);
+
+		if (!buflen) {
+			return;
+		}
+		send_text_to_all(1, buf, buflen);
+	}
+
+	if (framed_conns > 0) {
+		char	frame[ST_SOCK_BUF_LEN + 64], usec[32];
+		const char	*targ[SOCKFRAME_MAXARGS];
+
+		/* the times of TRACE go to all FRAMED connections alike */
+		if (trace_conns > 0 && numargs == 3 && !strcmp(arg[0], "SETINFO")) {
+			memcpy(targ, arg, numargs * sizeof(*arg));
+			snprintf(usec, sizeof(usec), "%" PRIu64, state_get_timestamp_usec());
+			targ[numargs++] = "TRACE";
+			targ[numargs++] = usec;
+			arg = targ;
+		}
+
+		send_frame_to_all(frame, sockframe_args(frame, sizeof(frame),
+			&frame_names, 2, numargs, arg));
+	}
+}
+
+/* <cmd> <name> ["<value>"] */
+static void send_var_to_all(const char *cmd, const char *name, const char *value)
+{
+	const char	*arg[3];
+
+	arg[0] = cmd;
+	arg[1] = name;
+	arg[2] = value;
+	send_to_all(value ? 2 : 0, value ? 3 : 2, arg);
+}
+
+/* ADDRANGE or DELRANGE <var> <min> <max> */
+static void send_range_to_all(const char *cmd, const char *var, int min, int max)
+{
+	const char	*arg[4];
+	char	minbuf[24], maxbuf[24];
+
+	snprintf(minbuf, sizeof(minbuf), "%i", min);
+	snprintf(maxbuf, sizeof(maxbuf), "%i", max);
+	arg[0] = cmd;
+	arg[1] = var;
+	arg[2] = minbuf;
+	arg[3] = maxbuf;
+	send_to_all(0, 4, arg);
 }
 
 static int send_to_one(conn_t *conn, const char *fmt, ...)
@@ -365,10 +917,6 @@ static int send_to_one(conn_t *conn, const char *fmt, ...)
 	va_list	ap;
 	char	buf[ST_SOCK_BUF_LEN];
 	size_t	buflen;
-#ifdef WIN32
-	DWORD bytesWritten = 0;
-	BOOL  result = FALSE;
-#endif	/* WIN32 */
 
 	va_start(ap, fmt);
 #ifdef HAVE_PRAGMAS_FOR_GCC_DIAGNOSTIC_IGNORED_FORMAT_NONLITERAL
@@ -406,91 +954,13 @@ static int send_to_one(conn_t *conn, const char *fmt, ...)
 	if (ret <= INT_MAX)
 		upsdebugx(5, "%s: %.*s", __func__, (int)(ret-1), buf);
 
-/*
-	upsdebugx(0, "%s: writing %" PRIiSIZE " bytes to socket %d: %s",
-		__func__, buflen, conn->fd, buf);
-*/
-
-#ifndef WIN32
-	ret = write(conn->fd, buf, buflen);
-#else	/* WIN32 */
-	result = WriteFile (conn->fd, buf, buflen, &bytesWritten, NULL);
-	if( result == 0 ) {
-		ret = 0;
-	}
-	else  {
-		ret = (ssize_t)bytesWritten;
-	}
-#endif	/* WIN32 */
-
-	if (ret < 0) {
-		/* Hacky bugfix: throttle down for upsd to read that */
-#ifndef WIN32
-		upsdebug_with_errno(1, "%s: had to throttle down to retry "
-			"writing %" PRIuSIZE " bytes to socket %d (ret=%" PRIiSIZE ") : %s",
-			__func__, buflen, (int)conn->fd, ret, buf);
-#else	/* WIN32 */
-		upsdebug_with_errno(1, "%s: had to throttle down to retry "
-			"writing %" PRIuSIZE " bytes to handle %p (ret=%" PRIiSIZE ") : %s",
-			__func__, buflen, conn->fd, ret, buf);
-#endif	/* WIN32 */
+	if (conn->framed) {
+		char	frame[ST_SOCK_BUF_LEN];
 
-		usleep(200);
-
-#ifndef WIN32
-		ret = write(conn->fd, buf, buflen);
-#else	/* WIN32 */
-		result = WriteFile (conn->fd, buf, buflen, &bytesWritten, NULL);
-		if( result == 0 ) {
-			ret = 0;
-		}
-		else  {
-			ret = (ssize_t)bytesWritten;
-		}
-#endif	/* WIN32 */
-		if (ret == (ssize_t)buflen) {
-			upsdebugx(1, "%s: throttling down helped", __func__);
-		}
+		return frame_send(conn, frame, frame_text(buf, frame, sizeof(frame)), __func__);
 	}
 
-	if ((ret < 1) || (ret != (ssize_t)buflen)) {
-#ifndef WIN32
-		upsdebug_with_errno(0, "WARNING: %s: write %" PRIuSIZE " bytes to "
-			"socket %d failed (ret=%" PRIiSIZE "), disconnecting.",
-			__func__, buflen, (int)conn->fd, ret);
-#else	/* WIN32 */
-		upsdebug_with_errno(0, "WARNING: %s: write %" PRIuSIZE " bytes to "
-			"handle %p failed (ret=%" PRIiSIZE "), disconnecting.",
-			__func__, buflen, conn->fd, ret);
-#endif	/* WIN32 */
-		upsdebugx(6, "%s: failed write: %s", __func__, buf);
-		sock_disconnect(conn);
-
-		/* TOTHINK: Maybe fallback elsewhere in other cases? */
-		if (ret < 0 && errno == EAGAIN && do_synchronous == -1) {
-			upsdebugx(0, "%s: synchronous mode was 'auto', "
-				"will try 'on' for next connections",
-				__func__);
-			do_synchronous = 1;
-		}
-
-		dstate_setinfo("driver.parameter.synchronous", "%s",
-			(do_synchronous==1)?"yes":((do_synchronous==0)?"no":"auto"));
-
-		return 0;	/* failed */
-	} else {
-#ifndef WIN32
-		upsdebugx(6, "%s: write %" PRIuSIZE " bytes to socket %d succeeded "
-			"(ret=%" PRIiSIZE "): %s",
-			__func__, buflen, conn->fd, ret, buf);
-#else	/* WIN32 */
-		upsdebugx(6, "%s: write %" PRIuSIZE " bytes to handle %p succeeded "
-			"(ret=%" PRIiSIZE "): %s",
-			__func__, buflen, conn->fd, ret, buf);
-#endif	/* WIN32 */
-	}
-
-	return 1;	/* OK */
+	return conn_send(conn, buf, buflen, __func__);
 }
 
 static void sock_connect(TYPE_FD sock)
@@ -589,23 +1059,26 @@ static void sock_connect(TYPE_FD sock)
 	ConnectNamedPipe(sockfd,&connect_overlapped);
 
 	/* A new pipe waiting for new client connection has been created. We could manage the current connection now */
-	/* Start a read operation on the newly connected pipe so we could wait on the event associated to this IO */
-	memset(&conn->read_overlapped,0,sizeof(conn->read_overlapped));
-	memset(conn->buf,0,sizeof(conn->buf));
-	conn->read_overlapped.hEvent = CreateEvent(NULL, /*Security*/
+	/* Start read operations on the newly connected pipe so we could wait on the event associated to these IOs */
+	conn->read_event = CreateEvent(NULL, /*Security*/
 			FALSE, /* auto-reset*/
 			FALSE, /* inital state = non signaled*/
 			NULL /* no name*/);
-	if(conn->read_overlapped.hEvent == NULL ) {
+	if(conn->read_event == NULL ) {
 		fatal_with_errno(EXIT_FAILURE, "Can't create event");
 	}
 
-	ReadFile (conn->fd, conn->buf,
-		sizeof(conn->buf) - 1, /* -1 to be sure to have a trailling 0 */
-		NULL, &(conn->read_overlapped));
+	/* a burst of commands (e.g. from a clone driver) is taken at once */
+	if (!pipe_reads_start(&conn->reads, conn->fd, conn->read_event, LARGEBUF)) {
+		upslogx(LOG_ERR, "Can't read from the new connection: %d", (int)GetLastError());
+		SetEvent(conn->read_event);	/* for sock_read() to drop it */
+	}
 #endif	/* WIN32 */
 
 	conn->nobroadcast = 0;
+	conn->shmstate = 0;
+	conn->framed = 0;
+	conn->frame_names = 0;
 	conn->readzero = 0;
 	conn->closing = 0;
 	pconf_init(&conn->ctx, NULL);
@@ -616,6 +1089,7 @@ static void sock_connect(TYPE_FD sock)
 	}
 
 	connhead = conn;
+	all_conns++;
 
 #ifndef WIN32
 	upsdebugx(3, "%s: new connection on fd %d", __func__, fd);
@@ -625,104 +1099,487 @@ static void sock_connect(TYPE_FD sock)
 
 }
 
-static int st_tree_dump_conn_one_node(st_tree_t *node, conn_t *conn)
+static void dump_add(batch_buf_t *dump, const char *fmt, ...)
+	__attribute__ ((__format__ (__printf__, 2, 3)));
+static void dump_add(batch_buf_t *dump, const char *fmt, ...)
+{
+	char	buf[ST_SOCK_BUF_LEN];
+	va_list	ap;
+	int	ret;
+
+	va_start(ap, fmt);
+#ifdef HAVE_PRAGMAS_FOR_GCC_DIAGNOSTIC_IGNORED_FORMAT_NONLITERAL
+#pragma GCC diagnostic push
+#endif
+#ifdef HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_FORMAT_NONLITERAL
+#pragma GCC diagnostic ignored "-Wformat-nonliteral"
+#endif
+	ret = vsnprintf(buf, sizeof(buf), fmt, ap);
+#ifdef HAVE_PRAGMAS_FOR_GCC_DIAGNOSTIC_IGNORED_FORMAT_NONLITERAL
+#pragma GCC diagnostic pop
+#endif
+	va_end(ap);
+
+	if (ret > 0) {
+		batch_add(dump, buf, strlen(buf));
+	}
+}
+
+static void st_tree_dump_one_node(const st_tree_t *node, batch_buf_t *dump)
 {
 	enum_t	*etmp;
 	range_t	*rtmp;
 
-	if (!send_to_one(conn, "SETINFO %s \"%s\"\n", node->var, node->val)) {
-		return 0;	/* write failed, bail out */
-	}
+	dump_add(dump, "SETINFO %s \"%s\"\n", node->var, node->val);
 
 	/* send any enums */
 	for (etmp = node->enum_list; etmp; etmp = etmp->next) {
-		if (!send_to_one(conn, "ADDENUM %s \"%s\"\n", node->var, etmp->val)) {
-			return 0;
-		}
+		dump_add(dump, "ADDENUM %s \"%s\"\n", node->var, etmp->val);
 	}
 
 	/* send any ranges */
 	for (rtmp = node->range_list; rtmp; rtmp = rtmp->next) {
-		if (!send_to_one(conn, "ADDRANGE %s %i %i\n", node->var, rtmp->min, rtmp->max)) {
+		dump_add(dump, "ADDRANGE %s %i %i\n", node->var, rtmp->min, rtmp->max);
+	}
+
+	/* provide any auxiliary data */
+	if (node->aux) {
+		dump_add(dump, "SETAUX %s %ld\n", node->var, node->aux);
+	}
+
+	/* finally report any flags */
+	if (node->flags) {
+		char	flist[SMALLBUF];
+
+		/* build the list */
+		snprintf(flist, sizeof(flist), "%s", node->var);
+
+		if (node->flags & ST_FLAG_RW) {
+			snprintfcat(flist, sizeof(flist), " RW");
+		}
+		if (node->flags & ST_FLAG_STRING) {
+			snprintfcat(flist, sizeof(flist), " STRING");
+		}
+		if (node->flags & ST_FLAG_NUMBER) {
+			snprintfcat(flist, sizeof(flist), " NUMBER");
+		}
+
+		dump_add(dump, "SETFLAGS %s\n", flist);
+	}
+}
+
+/* one line of a dump for FRAMED connections */
+static void frame_add(batch_buf_t *dump, size_t numargs, const char **arg)
+{
+	char	frame[ST_SOCK_BUF_LEN + 64];
+	size_t	len = sockframe_args(frame, sizeof(frame), &frame_names, 2, numargs, arg);
+
+	if (len) {
+		batch_add(dump, frame, len);
+	}
+}
+
+/* the same as st_tree_dump_one_node() as records, with the values as is */
+static void frame_dump_one_node(const st_tree_t *node, batch_buf_t *dump)
+{
+	enum_t	*etmp;
+	range_t	*rtmp;
+	const char	*arg[6];
+	char	buf[ST_MAX_VALUE_LEN], min[24], max[24];
+	size_t	numargs;
+
+	arg[1] = node->var;
+
+	arg[0] = "SETINFO";
+	arg[2] = node->raw;
+	frame_add(dump, 3, arg);
+
+	/* enum values are kept escaped for the text */
+	for (etmp = node->enum_list; etmp; etmp = etmp->next) {
+		const char	*src = etmp->val;
+		size_t	len = 0;
+
+		for (; *src && len + 1 < sizeof(buf); src++) {
+			if (*src == '\\' && src[1]) {
+				src++;
+			}
+			buf[len++] = *src;
+		}
+		buf[len] = '\0';
+
+		arg[0] = "ADDENUM";
+		arg[2] = buf;
+		frame_add(dump, 3, arg);
+	}
+
+	for (rtmp = node->range_list; rtmp; rtmp = rtmp->next) {
+		snprintf(min, sizeof(min), "%i", rtmp->min);
+		snprintf(max, sizeof(max), "%i", rtmp->max);
+		arg[0] = "ADDRANGE";
+		arg[2] = min;
+		arg[3] = max;
+		frame_add(dump, 4, arg);
+	}
+
+	if (node->aux) {
+		snprintf(buf, sizeof(buf), "%ld", node->aux);
+		arg[0] = "SETAUX";
+		arg[2] = buf;
+		frame_add(dump, 3, arg);
+	}
+
+	if (node->flags) {
+		numargs = 2;
+		if (node->flags & ST_FLAG_RW) {
+			arg[numargs++] = "RW";
+		}
+		if (node->flags & ST_FLAG_STRING) {
+			arg[numargs++] = "STRING";
+		}
+		if (node->flags & ST_FLAG_NUMBER) {
+			arg[numargs++] = "NUMBER";
+		}
+
+		if (numargs > 2) {
+			arg[0] = "SETFLAGS";
+			frame_add(dump, numargs, arg);
+		}
+	}
+}
+
+static void st_tree_dump(const st_tree_t *node, batch_buf_t *dump, int framed)
+{
+	for (; node; node = node->right) {
+		st_tree_dump(node->left, dump, framed);
+		if (framed) {
+			frame_dump_one_node(node, dump);
+		} else {
+			st_tree_dump_one_node(node, dump);
+		}
+	}
+}
+
+/* the whole DUMPALL as it stands (as records if <framed>), remade only
+ * after changes */
+static const batch_buf_t *dump_get(int framed)
+{
+	batch_buf_t	*dump = framed ? &frame_dump_cache : &dump_cache;
+	int	*valid = framed ? &frame_dump_valid : &dump_valid;
+	cmdlist_t	*cmd;
+
+	if (*valid) {
+		return dump;
+	}
+
+	dump->len = 0;
+	st_tree_dump(dtree_root, dump, framed);
+
+	for (cmd = cmdhead; cmd; cmd = cmd->next) {
+		if (framed) {
+			const char	*arg[2];
+
+			arg[0] = "ADDCMD";
+			arg[1] = cmd->name;
+			frame_add(dump, 2, arg);
+		} else {
+			dump_add(dump, "ADDCMD %s\n", cmd->name);
+		}
+	}
+
+	upsdebugx(5, "%s: made a dump of %" PRIuSIZE " bytes%s",
+		__func__, dump->len, framed ? " of records" : "");
+	*valid = 1;
+
+	return dump;
+}
+
+/* send what piled up in a batch, one write per connection */
+static void batch_flush(void)
+{
+	conn_t	*conn, *cnext;
+	batch_buf_t	all = batch_all, events = batch_events, trace = batch_trace,
+		frames = batch_frames;
+
+	/* memory readers get the changes ahead of the events */
+	shm_flush();
+
+	/* whatever comes up meanwhile (e.g. from a failed write) starts
+	 * another batch */
+	memset(&batch_all, 0, sizeof(batch_all));
+	memset(&batch_events, 0, sizeof(batch_events));
+	memset(&batch_trace, 0, sizeof(batch_trace));
+	memset(&batch_frames, 0, sizeof(batch_frames));
+
+	for (conn = connhead; conn; conn = cnext) {
+		const batch_buf_t	*batch = conn->framed ? &frames
+			: (conn->shmstate ? &events : (conn->trace ? &trace : &all));
+
+		cnext = conn->next;
+		if (conn->nobroadcast || !batch->len) {
+			continue;
+		}
+
+		if (conn->framed) {
+			frame_send(conn, batch->buf, batch->len, __func__);
+		} else {
+			conn_send(conn, batch->buf, batch->len, __func__);
+		}
+	}
+
+	/* keep the buffers around for the next batch */
+	if (!batch_all.buf) {
+		batch_all = all;
+		batch_all.len = 0;
+	} else {
+		free(all.buf);
+	}
+
+	if (!batch_events.buf) {
+		batch_events = events;
+		batch_events.len = 0;
+	} else {
+		free(events.buf);
+	}
+
+	if (!batch_trace.buf) {
+		batch_trace = trace;
+		batch_trace.len = 0;
+	} else {
+		free(trace.buf);
+	}
+
+	if (!batch_frames.buf) {
+		batch_frames = frames;
+		batch_frames.len = 0;
+	} else {
+		free(frames.buf);
+	}
+}
+
+void dstate_batch_begin(void)
+{
+	batch_depth++;
+}
+
+void dstate_batch_commit(void)
+{
+	if (batch_depth < 1) {
+		upsdebugx(1, "%s: no batch was begun", __func__);
+		return;
+	}
+
+	if (--batch_depth == 0) {
+		batch_flush();
+	}
+}
+
+/* publish the states in memory if they changed, and ring the connections
+ * reading them there */
+static void shm_flush(void)
+{
+	conn_t	*conn, *cnext;
+	unsigned long	seq;
+
+	if (!shm_dirty || !shmstate.map) {
+		return;
+	}
+
+	shm_dirty = 0;
+	if ((seq = stateshm_publish(&shmstate, dtree_root, cmdhead)) == 0) {
+		return;
+	}
+
+	for (conn = connhead; conn; conn = cnext) {
+		cnext = conn->next;
+		if (conn->shmstate && !conn->nobroadcast) {
+			send_to_one(conn, "SHMSTATE %lu\n", seq);
+		}
+	}
+}
+
+/* save the states for the next run of the driver if they changed (and are
+ * not stale), at most every DSTATE_SNAPSHOT_INTERVAL seconds unless <force> */
+static void snapshot_flush(int force)
+{
+	time_t	now;
+
+	if (!snap_fn || !snap_dirty || stale || INVALID_FD(sockfd)) {
+		return;
+	}
+
+	time(&now);
+	if (!force && difftime(now, snap_last) < DSTATE_SNAPSHOT_INTERVAL) {
+		return;
+	}
+
+	snap_dirty = 0;
+	snap_last = now;
+
+	if (!stateshm_save(&snapstate, snap_fn, dtree_root, cmdhead)) {
+		upslog_with_errno(LOG_WARNING, "Can't save the state snapshot %s", snap_fn);
+		return;
+	}
+
+	upsdebugx(3, "%s: saved the states in %s (%" PRIuSIZE " bytes of records)",
+		__func__, snap_fn, snapstate.len);
+}
+
+#ifdef WITH_STATESHM
+/* SHMSTATE: this connection wants the states from memory from now on */
+static int shm_start(conn_t *conn)
+{
+	if (conn->framed) {
+		return 0;	/* gets the states as records */
+	}
+
+	if (!shmstate.map) {
+		char	fn[NUT_PATH_MAX + 1];
+
+		snprintf(fn, sizeof(fn), "%s%s", sockfn, STATESHM_SUFFIX);
+		if (!stateshm_create(&shmstate, fn)) {
+			upslog_with_errno(LOG_WARNING, "Can't share the states in %s, "
+				"sending them over the socket", fn);
 			return 0;
 		}
+		upsdebugx(1, "%s: sharing the states in %s", __func__, fn);
 	}
 
-	/* provide any auxiliary data */
-	if (node->aux) {
-		if (!send_to_one(conn, "SETAUX %s %ld\n", node->var, node->aux)) {
-			return 0;
+	conn->shmstate = 1;
+	return 1;
+}
+#endif	/* WITH_STATESHM */
+
+static void send_tracking(conn_t *conn, const char *id, int value)
+{
+	send_to_one(conn, "TRACKING %s %i\n", id, value);
+}
+
+/* the handlers shared by all drivers may take these (see main_instcmd()
+ * and main_setvar()), so they go one at a time in a batch */
+static int cmd_shared(const conn_cmd_t *cmd)
+{
+	return !strncmp(cmd->name, "driver.", 7) || !strncmp(cmd->name, "shutdown.", 9);
+}
+
+/* hand the driver <count> settings (or commands) in a row of a batch,
+ * all at once if it can take them so; returns 0 if <conn> was dropped */
+static int cmd_run(conn_t *conn, const conn_cmd_t *cmd, size_t count)
+{
+	const char	**name = xcalloc(count, sizeof(*name));
+	const char	**value = xcalloc(count, sizeof(*value));
+	int	*ret = xcalloc(count, sizeof(*ret));
+	uint64_t	start = drv_stats_now_usec(), usec;
+	size_t	i;
+	int	alive = 1;
+
+	for (i = 0; i < count; i++) {
+		name[i] = cmd[i].name;
+		value[i] = cmd[i].value;
+	}
+
+	if (cmd->setvar && upsh.setvar_batch) {
+		upsh.setvar_batch(count, name, value, ret);
+	} else if (!cmd->setvar && upsh.instcmd_batch) {
+		upsh.instcmd_batch(count, name, value, ret);
+	} else {
+		for (i = 0; i < count; i++) {
+			if (cmd->setvar) {
+				ret[i] = upsh.setvar ? upsh.setvar(name[i], value[i]) : STAT_SET_UNKNOWN;
+			} else {
+				ret[i] = upsh.instcmd ? upsh.instcmd(name[i], value[i]) : STAT_INSTCMD_UNKNOWN;
+			}
 		}
 	}
 
-	/* finally report any flags */
-	if (node->flags) {
-		char	flist[SMALLBUF];
-
-		/* build the list */
-		snprintf(flist, sizeof(flist), "%s", node->var);
+	usec = (drv_stats_now_usec() - start) / count;
 
-		if (node->flags & ST_FLAG_RW) {
-			snprintfcat(flist, sizeof(flist), " RW");
-		}
-		if (node->flags & ST_FLAG_STRING) {
-			snprintfcat(flist, sizeof(flist), " STRING");
-		}
-		if (node->flags & ST_FLAG_NUMBER) {
-			snprintfcat(flist, sizeof(flist), " NUMBER");
-		}
+	for (i = 0; i < count; i++) {
+		drv_stats_add(cmd->setvar ? DRV_STATS_SETVAR : DRV_STATS_INSTCMD, usec);
 
-		if (!send_to_one(conn, "SETFLAGS %s\n", flist)) {
-			return 0;
+		if (alive && cmd[i].id) {
+			alive = send_to_one(conn, "TRACKING %s %i\n", cmd[i].id, ret[i]);
 		}
 	}
 
-	return 1;	/* everything's OK here ... */
+	free(name);
+	free(value);
+	free(ret);
+
+	return alive;
 }
 
-static int st_tree_dump_conn(st_tree_t *node, conn_t *conn)
+/* BATCH END (or a full batch): do what was held back, in order; returns
+ * 0 if <conn> was dropped */
+static int cmd_batch_run(conn_t *conn)
 {
-	int	ret;
+	conn_cmd_t	*cmds = conn->cmds;
+	size_t	numcmds = conn->numcmds, i, j;
+	int	alive = 1;
+
+	/* <conn> may be dropped while they run */
+	conn->cmds = NULL;
+	conn->numcmds = conn->cmdsalloc = 0;
+
+	upsdebugx(2, "%s: %" PRIuSIZE " commands and settings", __func__, numcmds);
+
+	for (i = 0; alive && i < numcmds; i = j) {
+		if (cmd_shared(&cmds[i])) {
+			int	ret = cmds[i].setvar
+				? main_setvar(cmds[i].name, cmds[i].value, conn)
+				: main_instcmd(cmds[i].name, cmds[i].value, conn);
+
+			/* not handled there, as in sock_arg() */
+			if (ret != (cmds[i].setvar ? STAT_SET_UNKNOWN : STAT_INSTCMD_UNKNOWN)) {
+				if (cmds[i].id) {
+					alive = send_to_one(conn, "TRACKING %s %i\n", cmds[i].id, ret);
+				}
+				j = i + 1;
+				continue;
+			}
 
-	if (!node) {
-		return 1;	/* not an error */
-	}
+			alive = cmd_run(conn, &cmds[i], 1);
+			j = i + 1;
+			continue;
+		}
 
-	if (node->left) {
-		ret = st_tree_dump_conn(node->left, conn);
+		for (j = i + 1; j < numcmds
+			&& cmds[j].setvar == cmds[i].setvar && !cmd_shared(&cmds[j]); j++);
 
-		if (!ret) {
-			return 0;	/* write failed in the child */
-		}
+		alive = cmd_run(conn, &cmds[i], j - i);
 	}
 
-	if (!st_tree_dump_conn_one_node(node, conn))
-		return 0;	/* one of writes failed, bail out */
-
-	if (node->right) {
-		return st_tree_dump_conn(node->right, conn);
+	for (i = 0; i < numcmds; i++) {
+		free(cmds[i].name);
+		free(cmds[i].value);
+		free(cmds[i].id);
 	}
+	free(cmds);
 
-	return 1;	/* everything's OK here ... */
+	return alive;
 }
 
-static int cmd_dump_conn(conn_t *conn)
+/* hold back a SET or INSTCMD until BATCH END; returns 0 if <conn> was
+ * dropped running those held before, once too many */
+static int cmd_queue(conn_t *conn, int setvar, const char *name, const char *value, const char *id)
 {
-	cmdlist_t	*cmd;
+	conn_cmd_t	*cmd;
 
-	for (cmd = cmdhead; cmd; cmd = cmd->next) {
-		if (!send_to_one(conn, "ADDCMD %s\n", cmd->name)) {
-			return 0;
-		}
+	if (conn->numcmds >= DSTATE_CMDBATCH_MAX && !cmd_batch_run(conn)) {
+		return 0;
 	}
 
-	return 1;
-}
+	if (conn->numcmds >= conn->cmdsalloc) {
+		conn->cmdsalloc = conn->cmdsalloc ? 2 * conn->cmdsalloc : 16;
+		conn->cmds = xrealloc(conn->cmds, conn->cmdsalloc * sizeof(*conn->cmds));
+	}
 
+	cmd = &conn->cmds[conn->numcmds++];
+	cmd->setvar = setvar;
+	cmd->name = xstrdup(name);
+	cmd->value = value ? xstrdup(value) : NULL;
+	cmd->id = id ? xstrdup(id) : NULL;
 
-static void send_tracking(conn_t *conn, const char *id, int value)
-{
-	send_to_one(conn, "TRACKING %s %i\n", id, value);
+	return 1;
 }
 
 static int sock_arg(conn_t *conn, size_t numarg, char **arg)
@@ -759,19 +1616,37 @@ static int sock_arg(conn_t *conn, size_t numarg, char **arg)
 		return 1;
 	}
 
+	/* the DUMPALL sent (in case the driver did not know DUMPSINCE) after
+	 * a DUMPSINCE which was answered with the changes */
+	if (!strcasecmp(arg[0], "DUMPALL") && conn->resumed) {
+		conn->resumed = 0;
+		return 1;
+	}
+
 	if (!strcasecmp(arg[0], "DUMPALL") || !strcasecmp(arg[0], "DUMPSTATUS") || (!strcasecmp(arg[0], "DUMPVALUE") && numarg > 1)) {
 		/* first thing: the staleness flag (see also below) */
 		if ((stale == 1) && !send_to_one(conn, "DATASTALE\n")) {
 			return 1;
 		}
 
-		if (!strcasecmp(arg[0], "DUMPALL")) {
-			if (!st_tree_dump_conn(dtree_root, conn)) {
-				return 1;
-			}
+		if (!strcasecmp(arg[0], "DUMPALL") && conn->shmstate) {
+			/* publish anew, everyone reading it gets the same copy */
+			shm_dirty = 1;
+			shm_flush();
 
-			if (!cmd_dump_conn(conn)) {
-				return 1;
+			if (conn->nobroadcast && shmstate.map
+			 && !send_to_one(conn, "SHMSTATE %lu\n", shmstate.map->seq)
+			) {
+				return 2;	/* dropped, conn is free()'d */
+			}
+		} else if (!strcasecmp(arg[0], "DUMPALL")) {
+			const batch_buf_t	*dump = dump_get(conn->framed);
+
+			if (dump->len && !(conn->framed
+				? frame_send(conn, dump->buf, dump->len, __func__)
+				: conn_send(conn, dump->buf, dump->len, __func__))
+			) {
+				return 2;	/* dropped, conn is free()'d */
 			}
 		} else {
 			/* A cheaper version of the dump */
@@ -782,16 +1657,86 @@ static int sock_arg(conn_t *conn, size_t numarg, char **arg)
 				upsdebugx(1, "%s: %s was requested but currently no %s is known",
 					__func__, arg[0], NUT_STRARG(varname));
 			} else {
-				if (!st_tree_dump_conn_one_node(sttmp, conn))
-					return 1;
+				batch_buf_t	dump;
+				int	ret;
+
+				memset(&dump, 0, sizeof(dump));
+				if (conn->framed) {
+					frame_dump_one_node(sttmp, &dump);
+					ret = frame_send(conn, dump.buf, dump.len, __func__);
+				} else {
+					st_tree_dump_one_node(sttmp, &dump);
+					ret = conn_send(conn, dump.buf, dump.len, __func__);
+				}
+				free(dump.buf);
+
+				if (!ret)
+					return 2;	/* dropped, conn is free()'d */
 			}
 		}
 
-		if ((stale == 0) && !send_to_one(conn, "DATAOK\n")) {
-			return 1;
+		/* which change the dump is up to */
+		if (conn->seq && !strcasecmp(arg[0], "DUMPALL")
+		 && !send_to_one(conn, "SEQ %s %" PRIu64 "\n", journal_epoch, journal_seq)
+		) {
+			return 2;	/* dropped, conn is free()'d */
+		}
+
+		if (!send_to_one(conn, "%sDUMPDONE\n", (stale == 0) ? "DATAOK\n" : "")) {
+			return 2;	/* dropped, conn is free()'d */
+		}
+
+		return 1;
+	}
+
+	/* SEQ: number the changes from now on, and keep the last ones in a
+	 * journal; the connection is told with "SEQ <epoch> <number>" up to
+	 * which it got, after a DUMPALL and once the changes of a round are
+	 * sent, where <epoch> tells this run of the driver from others */
+	if (!strcasecmp(arg[0], "SEQ")) {
+		if (!*journal_epoch) {
+			snprintf(journal_epoch, sizeof(journal_epoch), "%" PRIiMAX ".%" PRIiMAX,
+				(intmax_t)time(NULL), (intmax_t)getpid());
+		}
+		conn->seq = 1;
+		upsdebugx(1, "%s: connection requested SEQ numbers of the changes", __func__);
+		return 1;
+	}
+
+	/* DUMPSINCE <epoch> <number>: a reader which comes back asks for the
+	 * changes after those it got: they are sent after RESUME if they are
+	 * all in the journal (and the DUMPALL which follows is ignored), or
+	 * else RESYNC is sent and that DUMPALL goes as usual */
+	if (!strcasecmp(arg[0], "DUMPSINCE")) {
+		uint64_t	since = 0;
+		char	*end = NULL;
+
+		if (numarg > 2) {
+			since = (uint64_t)strtoull(arg[2], &end, 10);
+		}
+
+		if (!*journal_epoch || conn->shmstate || numarg < 3
+		 || strcmp(arg[1], journal_epoch) || !end || *end
+		 || since > journal_seq || journal_seq - since > DSTATE_JOURNAL_MAX
+		) {
+			upsdebugx(1, "%s: can not resume from change %s of %s, a dump follows",
+				__func__, numarg > 2 ? arg[2] : "", numarg > 1 ? arg[1] : "");
+			return send_to_one(conn, "RESYNC\n") ? 1 : 2;
 		}
 
-		send_to_one(conn, "DUMPDONE\n");
+		upsdebugx(1, "%s: resuming from change %" PRIu64 " (%" PRIu64 " missed)",
+			__func__, since, journal_seq - since);
+
+		if (!send_to_one(conn, "RESUME\n")
+		 || ((stale == 1) && !send_to_one(conn, "DATASTALE\n"))
+		 || !journal_send(conn, since)
+		 || (conn->seq && !send_to_one(conn, "SEQ %s %" PRIu64 "\n", journal_epoch, journal_seq))
+		 || !send_to_one(conn, "%sDUMPDONE\n", (stale == 0) ? "DATAOK\n" : "")
+		) {
+			return 2;	/* dropped, conn is free()'d */
+		}
+
+		conn->resumed = 1;
 		return 1;
 	}
 
@@ -800,6 +1745,56 @@ static int sock_arg(conn_t *conn, size_t numarg, char **arg)
 		return 1;
 	}
 
+#ifdef WITH_STATESHM
+	/* SHMSTATE: read the states from memory, see stateshm.h; a DUMPALL
+	 * is then answered with where they are up to (as are changes) */
+	if (!strcasecmp(arg[0], "SHMSTATE")) {
+		shm_start(conn);
+		return 1;
+	}
+#endif	/* WITH_STATESHM */
+
+	/* FRAMED <version>: confirmed the same way, then records follow
+	 * instead of text, see sockframe.h; not for a connection reading
+	 * the states from memory, which would gain little */
+	if (!strcasecmp(arg[0], "FRAMED")) {
+		if (conn->framed || conn->shmstate || numarg < 2
+		 || atoi(arg[1]) != SOCKFRAME_VERSION
+		) {
+			upsdebugx(1, "%s: not taking FRAMED %s", __func__,
+				numarg > 1 ? arg[1] : "");
+			return 1;
+		}
+
+		/* a batch begun before has no records for it */
+		if (batch_depth) {
+			batch_flush();
+		}
+
+		if (!send_to_one(conn, "FRAMED %d\n", SOCKFRAME_VERSION)) {
+			return 2;	/* dropped, conn is free()'d */
+		}
+
+		conn->framed = 1;
+		framed_conns++;
+		upsdebugx(1, "%s: connection requested FRAMED records", __func__);
+		return 1;
+	}
+
+	/* TRACE: send the SETINFO changes with the time they were set */
+	if (!strcasecmp(arg[0], "TRACE")) {
+		if (!conn->trace) {
+			/* a batch begun without it has no lines to trace */
+			if (batch_depth) {
+				batch_flush();
+			}
+			conn->trace = 1;
+			trace_conns++;
+		}
+		upsdebugx(1, "%s: connection requested TRACE of the changes", __func__);
+		return 1;
+	}
+
 	if (!strcasecmp(arg[0], "NOBROADCAST")) {
 		char buf[SMALLBUF];
 		conn->nobroadcast = 1;
@@ -838,6 +1833,23 @@ static int sock_arg(conn_t *conn, size_t numarg, char **arg)
 		return 0;
 	}
 
+	/* BATCH BEGIN: hold back the SET and INSTCMD which follow until
+	 * BATCH END, and then hand them to the driver together, see
+	 * upsh.setvar_batch and upsh.instcmd_batch */
+	if (!strcasecmp(arg[0], "BATCH")) {
+		if (!strcasecmp(arg[1], "BEGIN")) {
+			conn->cmdbatch = 1;
+			return 1;
+		}
+
+		if (!strcasecmp(arg[1], "END")) {
+			conn->cmdbatch = 0;
+			return cmd_batch_run(conn) ? 1 : 2;
+		}
+
+		return 0;
+	}
+
 	/* INSTCMD <cmdname> [<cmdparam>] [TRACKING <id>] */
 	if (!strcasecmp(arg[0], "INSTCMD")) {
 		int ret;
@@ -861,6 +1873,10 @@ static int sock_arg(conn_t *conn, size_t numarg, char **arg)
 		if (cmdid)
 			upsdebugx(3, "%s: TRACKING = %s", __func__, cmdid);
 
+		if (conn->cmdbatch) {
+			return cmd_queue(conn, 0, cmdname, cmdparam, cmdid) ? 1 : 2;
+		}
+
 		/* try the handler shared by all drivers first */
 		ret = main_instcmd(cmdname, cmdparam, conn);
 		if (ret != STAT_INSTCMD_UNKNOWN) {
@@ -879,7 +1895,10 @@ static int sock_arg(conn_t *conn, size_t numarg, char **arg)
 
 		/* try the driver-provided handler if present */
 		if (upsh.instcmd) {
+			uint64_t	start = drv_stats_now_usec();
+
 			ret = upsh.instcmd(cmdname, cmdparam);
+			drv_stats_add(DRV_STATS_INSTCMD, drv_stats_now_usec() - start);
 
 			/* send back execution result if requested */
 			if (cmdid)
@@ -935,6 +1954,10 @@ static int sock_arg(conn_t *conn, size_t numarg, char **arg)
 			upsdebugx(3, "%s: TRACKING = %s", __func__, setid);
 		}
 
+		if (conn->cmdbatch) {
+			return cmd_queue(conn, 1, arg[1], arg[2], setid) ? 1 : 2;
+		}
+
 		/* try the handler shared by all drivers first */
 		ret = main_setvar(arg[1], arg[2], conn);
 		if (ret != STAT_SET_UNKNOWN) {
@@ -953,7 +1976,10 @@ static int sock_arg(conn_t *conn, size_t numarg, char **arg)
 
 		/* try the driver-provided handler if present */
 		if (upsh.setvar) {
+			uint64_t	start = drv_stats_now_usec();
+
 			ret = upsh.setvar(arg[1], arg[2]);
+			drv_stats_add(DRV_STATS_SETVAR, drv_stats_now_usec() - start);
 
 			/* send back execution result if requested */
 			if (setid)
@@ -971,12 +1997,52 @@ static int sock_arg(conn_t *conn, size_t numarg, char **arg)
 	return 0;
 }
 
-static void sock_read(conn_t *conn)
+/* feed what was read from a connection to its parser;
+ * returns 0 if the connection was closed (and conn free()'d) meanwhile */
+static int sock_parse(conn_t *conn, const char *buf, size_t len)
 {
-	ssize_t	ret, i;
+	size_t	i;
 	int	ret_arg = -1;
 
+	for (i = 0; i < len; i++) {
+
+		switch(pconf_char(&conn->ctx, buf[i]))
+		{
+		case 0: /* nothing to parse yet */
+			continue;
+
+		case 1: /* try to use it, and complain about unknown commands */
+			ret_arg = sock_arg(conn, conn->ctx.numargs, conn->ctx.arglist);
+			if (!ret_arg) {
+				size_t	arg;
+
+				upslogx(LOG_INFO, "Unknown command on socket: ");
+
+				for (arg = 0; arg < conn->ctx.numargs && arg < INT_MAX; arg++) {
+					upslogx(LOG_INFO, "arg %d: %s", (int)arg, conn->ctx.arglist[arg]);
+				}
+			} else if (ret_arg == 2) {
+				/* closed by LOGOUT processing or a failed write, conn is free()'d */
+				if (i < len)
+					upsdebugx(1, "%s: returning early, socket may be not valid anymore", __func__);
+				return 0;
+			}
+
+			continue;
+
+		default: /* nothing parsed */
+			upslogx(LOG_NOTICE, "Parse error on sock: %s", conn->ctx.errmsg);
+			return 1;
+		}
+	}
+
+	return 1;
+}
+
+static void sock_read(conn_t *conn)
+{
 #ifndef WIN32
+	ssize_t	ret;
 	char	buf[SMALLBUF];
 
 	ret = read(conn->fd, buf, sizeof(buf));
@@ -1027,61 +2093,36 @@ static void sock_read(conn_t *conn)
 	} else {
 		conn->readzero = 0;
 	}
-#else	/* WIN32 */
-	char *buf = conn->buf;
-	DWORD bytesRead;
-	BOOL res;
-	res = GetOverlappedResult(conn->fd, &conn->read_overlapped, &bytesRead, FALSE);
-	if( res == 0 ) {
-		upslogx(LOG_INFO, "Read error : %d",(int)GetLastError());
-		sock_disconnect(conn);
-		return;
-	}
-	ret = bytesRead;
-
-	/* Special case for signals */
-	if (!strncmp(conn->buf, COMMAND_STOP, sizeof(COMMAND_STOP))) {
-		set_exit_flag(1);
-		return;
-	}
-#endif	/* WIN32 */
-
-	for (i = 0; i < ret; i++) {
 
-		switch(pconf_char(&conn->ctx, buf[i]))
-		{
-		case 0: /* nothing to parse yet */
-			continue;
-
-		case 1: /* try to use it, and complain about unknown commands */
-			ret_arg = sock_arg(conn, conn->ctx.numargs, conn->ctx.arglist);
-			if (!ret_arg) {
-				size_t	arg;
-
-				upslogx(LOG_INFO, "Unknown command on socket: ");
-
-				for (arg = 0; arg < conn->ctx.numargs && arg < INT_MAX; arg++) {
-					upslogx(LOG_INFO, "arg %d: %s", (int)arg, conn->ctx.arglist[arg]);
-				}
-			} else if (ret_arg == 2) {
-				/* closed by LOGOUT processing, conn is free()'d */
-				if (i < ret)
-					upsdebugx(1, "%s: returning early, socket may be not valid anymore", __func__);
-				return;
-			}
+	sock_parse(conn, buf, (size_t)ret);
+#else	/* WIN32 */
+	char	*buf;
+	DWORD	bytesRead;
+	int	ret;
 
-			continue;
+	/* the event tells that one or more of the reads are done: take all
+	 * of those, in order, and start each again once parsed */
+	while ((ret = pipe_reads_next(&conn->reads, &buf, &bytesRead)) > 0) {
+		/* Special case for signals */
+		if (!strncmp(buf, COMMAND_STOP, sizeof(COMMAND_STOP))) {
+			set_exit_flag(1);
+			return;
+		}
 
-		default: /* nothing parsed */
-			upslogx(LOG_NOTICE, "Parse error on sock: %s", conn->ctx.errmsg);
+		if (!sock_parse(conn, buf, (size_t)bytesRead)) {
 			return;
 		}
+
+		if (!pipe_reads_again(&conn->reads)) {
+			ret = -1;
+			break;
+		}
 	}
 
-#ifdef WIN32
-	/* Restart async read */
-	memset(conn->buf,0,sizeof(conn->buf));
-	ReadFile(conn->fd,conn->buf,sizeof(conn->buf)-1,NULL,&(conn->read_overlapped)); /* -1 to be sure to have a trailling 0 */
+	if (ret < 0) {
+		upslogx(LOG_INFO, "Read error : %d",(int)GetLastError());
+		sock_disconnect(conn);
+	}
 #endif	/* WIN32 */
 }
 
@@ -1094,7 +2135,10 @@ static void sock_close(void)
 		close(sockfd);
 
 		if (sockfn) {
-			unlink(sockfn);
+			/* not by a child serving it for a while (see the
+			 * "lazyinit" and "statesnapshot" options) */
+			if (sockfn_owner == getpid())
+				unlink(sockfn);
 			free(sockfn);
 			sockfn = NULL;
 		}
@@ -1113,6 +2157,8 @@ static void sock_close(void)
 
 	connhead = NULL;
 	/* conntail = NULL; */
+
+	stateshm_close(&shmstate);
 }
 
 /* interface */
@@ -1132,30 +2178,151 @@ char * dstate_init(const char *prog, const char *devname)
 # pragma GCC diagnostic pop
 #endif
 
-	if (devname) {
-		snprintf(sockname, sizeof(sockname), "%s/%s-%s", dflt_statepath(), prog, devname);
-	} else {
-		snprintf(sockname, sizeof(sockname), "%s/%s", dflt_statepath(), prog);
+	if (devname) {
+		snprintf(sockname, sizeof(sockname), "%s/%s-%s", dflt_statepath(), prog, devname);
+	} else {
+		snprintf(sockname, sizeof(sockname), "%s/%s", dflt_statepath(), prog);
+	}
+#else	/* WIN32 */
+	/* upsname (and so devname) is now mandatory so no need to test it */
+	snprintf(sockname, sizeof(sockname), "\\\\.\\pipe\\%s-%s", prog, devname);
+	pipename = xstrdup(sockname);
+#endif	/* WIN32 */
+
+	/* opened early already (as for "lazyinit"), maybe by our parent */
+	if (VALID_FD(sockfd)) {
+		return xstrdup(sockname);
+	}
+
+	stateshm_init(&shmstate);
+	sockfd = sock_open(sockname);
+
+#ifndef WIN32
+	upsdebugx(2, "%s: sock %s open on fd %d", __func__, sockname, sockfd);
+#else	/* WIN32 */
+	upsdebugx(2, "%s: sock %s open on handle %p", __func__, sockname, sockfd);
+#endif	/* WIN32 */
+
+	/* NOTE: Caller must free this string */
+	return xstrdup(sockname);
+}
+
+#ifndef WIN32
+void dstate_add_fd(int fd, int events, dstate_fd_func_t func, void *arg)
+{
+	size_t	i;
+
+	for (i = 0; i < watch_count; i++) {
+		if (watch_fds[i].fd == fd) {
+			watch_fds[i].events = events;
+			watch_fds[i].func = func;
+			watch_fds[i].arg = arg;
+			return;
+		}
+	}
+
+	if (watch_count == watch_alloc) {
+		watch_alloc = watch_alloc ? watch_alloc * 2 : 8;
+		watch_fds = xrealloc(watch_fds, watch_alloc * sizeof(*watch_fds));
+	}
+
+	upsdebugx(3, "%s: fd %d (events 0x%x%s)", __func__, fd, (unsigned int)events,
+		func ? ", with callback" : "");
+	watch_fds[watch_count].fd = fd;
+	watch_fds[watch_count].events = events;
+	watch_fds[watch_count].func = func;
+	watch_fds[watch_count].arg = arg;
+	watch_count++;
+}
+
+void dstate_watch_fd(int fd, int events)
+{
+	dstate_add_fd(fd, events, NULL, NULL);
+}
+
+/* run the callbacks of the watched fds which select() found ready in
+ * <rfds> and <wfds>, returns 2 if one of them (or a watched fd without
+ * a callback) asked for the caller to wake up, 0 otherwise */
+static int watch_fds_serve(fd_set *rfds, fd_set *wfds)
+{
+	size_t	i, j, ready = 0;
+	int	wake = 0;
+
+	if (watch_ready_alloc < watch_count) {
+		watch_ready_alloc = watch_alloc;
+		watch_ready = xrealloc(watch_ready, watch_ready_alloc * sizeof(*watch_ready));
+	}
+
+	for (i = 0; i < watch_count; i++) {
+		int	events = 0;
+
+		if ((watch_fds[i].events & DSTATE_WATCH_READ) && FD_ISSET(watch_fds[i].fd, rfds)) {
+			events |= DSTATE_WATCH_READ;
+		}
+		if ((watch_fds[i].events & DSTATE_WATCH_WRITE) && FD_ISSET(watch_fds[i].fd, wfds)) {
+			events |= DSTATE_WATCH_WRITE;
+		}
+
+		if (!events) {
+			continue;
+		}
+
+		if (!watch_fds[i].func) {
+			wake = 2;
+			continue;
+		}
+
+		watch_ready[ready] = watch_fds[i];
+		watch_ready[ready].events = events;
+		ready++;
+	}
+
+	for (i = 0; i < ready; i++) {
+		int	ret;
+
+		/* skip it if an earlier callback unwatched (or replaced) it */
+		for (j = 0; j < watch_count; j++) {
+			if (watch_fds[j].fd == watch_ready[i].fd) {
+				break;
+			}
+		}
+
+		if (j == watch_count || watch_fds[j].func != watch_ready[i].func
+		 || watch_fds[j].arg != watch_ready[i].arg
+		) {
+			continue;
+		}
+
+		dstate_batch_begin();
+		ret = watch_ready[i].func(watch_ready[i].fd, watch_ready[i].events, watch_ready[i].arg);
+		dstate_batch_commit();
+
+		if (ret < 0) {
+			dstate_unwatch_fd(watch_ready[i].fd);
+		} else if (ret > 0) {
+			wake = 2;
+		}
 	}
-#else	/* WIN32 */
-	/* upsname (and so devname) is now mandatory so no need to test it */
-	snprintf(sockname, sizeof(sockname), "\\\\.\\pipe\\%s-%s", prog, devname);
-	pipename = xstrdup(sockname);
-#endif	/* WIN32 */
 
-	sockfd = sock_open(sockname);
+	return wake;
+}
 
-#ifndef WIN32
-	upsdebugx(2, "%s: sock %s open on fd %d", __func__, sockname, sockfd);
-#else	/* WIN32 */
-	upsdebugx(2, "%s: sock %s open on handle %p", __func__, sockname, sockfd);
-#endif	/* WIN32 */
+void dstate_unwatch_fd(int fd)
+{
+	size_t	i;
 
-	/* NOTE: Caller must free this string */
-	return xstrdup(sockname);
+	for (i = 0; i < watch_count; i++) {
+		if (watch_fds[i].fd == fd) {
+			upsdebugx(3, "%s: fd %d", __func__, fd);
+			watch_fds[i] = watch_fds[--watch_count];
+			return;
+		}
+	}
 }
+#endif	/* !WIN32 */
 
-/* returns 1 if timeout expired or data is available on UPS fd, 0 otherwise */
+/* returns 1 if timeout expired or data is available on UPS fd, 2 if one
+ * of the watched fds (or its callback) asks for it, 0 otherwise */
 int dstate_poll_fds(struct timeval timeout, TYPE_FD arg_extrafd)
 {
 	int	maxfd = 0; /* Unidiomatic use vs. "sockfd" below, which is "int" on non-WIN32 */
@@ -1165,12 +2332,22 @@ int dstate_poll_fds(struct timeval timeout, TYPE_FD arg_extrafd)
 
 #ifndef WIN32
 	int	ret;
-	fd_set	rfds;
+	size_t	i;
+	fd_set	rfds, wfds;
+
+	snapshot_flush(0);
+
+	/* changes of this round of updates go to memory readers at once */
+	shm_flush();
+	journal_flush();
 
 	FD_ZERO(&rfds);
-	FD_SET(sockfd, &rfds);
+	FD_ZERO(&wfds);
 
-	maxfd = sockfd;
+	if (VALID_FD(sockfd)) {
+		FD_SET(sockfd, &rfds);
+		maxfd = sockfd;
+	}
 
 	if (VALID_FD(arg_extrafd)) {
 		FD_SET(arg_extrafd, &rfds);
@@ -1180,15 +2357,32 @@ int dstate_poll_fds(struct timeval timeout, TYPE_FD arg_extrafd)
 		}
 	}
 
+	for (i = 0; i < watch_count; i++) {
+		if (watch_fds[i].events & DSTATE_WATCH_READ) {
+			FD_SET(watch_fds[i].fd, &rfds);
+		}
+		if (watch_fds[i].events & DSTATE_WATCH_WRITE) {
+			FD_SET(watch_fds[i].fd, &wfds);
+		}
+		if (watch_fds[i].fd > maxfd) {
+			maxfd = watch_fds[i].fd;
+		}
+	}
+
 	for (conn = connhead; conn; conn = conn->next) {
 		FD_SET(conn->fd, &rfds);
 
+		/* wait for room to send what is queued */
+		if (conn->outoff < conn->outlen) {
+			FD_SET(conn->fd, &wfds);
+		}
+
 		if (conn->fd > maxfd) {
 			maxfd = conn->fd;
 		}
 	}
 
-	gettimeofday(&now, NULL);
+	drv_gettime(&now);
 
 	/* number of microseconds should always be positive */
 	if (timeout.tv_usec < now.tv_usec) {
@@ -1205,7 +2399,7 @@ int dstate_poll_fds(struct timeval timeout, TYPE_FD arg_extrafd)
 		timeout.tv_usec -= now.tv_usec;
 	}
 
-	ret = select(maxfd + 1, &rfds, NULL, NULL, &timeout);
+	ret = select(maxfd + 1, &rfds, &wfds, NULL, &timeout);
 
 	if (ret == 0) {
 		return 1;	/* timer expired */
@@ -1226,13 +2420,17 @@ int dstate_poll_fds(struct timeval timeout, TYPE_FD arg_extrafd)
 		return overrun;
 	}
 
-	if (FD_ISSET(sockfd, &rfds)) {
+	if (VALID_FD(sockfd) && FD_ISSET(sockfd, &rfds)) {
 		sock_connect(sockfd);
 	}
 
 	for (conn = connhead; conn; conn = cnext) {
 		cnext = conn->next;
 
+		if (FD_ISSET(conn->fd, &wfds) && !conn_flush(conn)) {
+			continue;	/* dropped */
+		}
+
 		if (FD_ISSET(conn->fd, &rfds)) {
 			sock_read(conn);
 		}
@@ -1242,7 +2440,10 @@ int dstate_poll_fds(struct timeval timeout, TYPE_FD arg_extrafd)
 		cnext = conn->next;
 
 		if (conn->closing) {
-			sock_disconnect(conn);
+			/* the last answers, if the reader takes them now */
+			if (conn_flush(conn)) {
+				sock_disconnect(conn);
+			}
 		}
 	}
 
@@ -1251,12 +2452,19 @@ int dstate_poll_fds(struct timeval timeout, TYPE_FD arg_extrafd)
 		return 1;
 	}
 
+	if (watch_count && watch_fds_serve(&rfds, &wfds)) {
+		return 2;
+	}
+
 #else /* WIN32 */
 
 	DWORD	ret;
 	HANDLE	rfds[32];
 	DWORD	timeout_ms;
 
+	snapshot_flush(0);
+	journal_flush();
+
 	/* FIXME: Should such table (and limit) be used in reality? */
 	NUT_UNUSED_VARIABLE(arg_extrafd);
 /*
@@ -1266,7 +2474,7 @@ int dstate_poll_fds(struct timeval timeout, TYPE_FD arg_extrafd)
 	}
 */
 
-	gettimeofday(&now, NULL);
+	drv_gettime(&now);
 
 	/* number of microseconds should always be positive */
 	if (timeout.tv_usec < now.tv_usec) {
@@ -1287,7 +2495,7 @@ int dstate_poll_fds(struct timeval timeout, TYPE_FD arg_extrafd)
 
 	/* Wait on the read IO of each connections */
 	for (conn = connhead; conn; conn = conn->next) {
-		rfds[maxfd] = conn->read_overlapped.hEvent;
+		rfds[maxfd] = conn->read_event;
 		maxfd++;
 	}
 	/* Add the connect event */
@@ -1311,7 +2519,7 @@ int dstate_poll_fds(struct timeval timeout, TYPE_FD arg_extrafd)
 
 	/* Retrieve the signaled connection */
 	for (conn = connhead; conn != NULL; conn = conn->next) {
-		if( conn->read_overlapped.hEvent == rfds[ret-WAIT_OBJECT_0]) {
+		if( conn->read_event == rfds[ret-WAIT_OBJECT_0]) {
 			break;
 		}
 	}
@@ -1377,7 +2585,8 @@ int vdstate_setinfo(const char *var, const char *fmt, va_list ap)
 	ret = state_setinfo(&dtree_root, var, value);
 
 	if (ret == 1) {
-		send_to_all("SETINFO %s \"%s\"\n", var, value);
+		NUT_PROBE2(driver_setinfo, var, value);
+		send_var_to_all("SETINFO", var, value);
 	}
 
 	return ret;
@@ -1441,6 +2650,164 @@ int dstate_setinfo_dynamic(const char *var, const char *fmt_dynamic, const char
 	}
 }
 
+int dstate_setinfo_double(const char *var, double value, int precision, double deadband)
+{
+	int	ret;
+	char	buf[ST_MAX_VALUE_LEN];
+
+	if (precision < 0) {
+		precision = 0;
+	}
+
+	ret = state_setinfo_double(&dtree_root, var, value, precision, deadband,
+		buf, sizeof(buf));
+
+	if (ret == 1) {
+		NUT_PROBE2(driver_setinfo, var, buf);
+		send_var_to_all("SETINFO", var, buf);
+	}
+
+	return ret;
+}
+
+int dstate_setinfo_int(const char *var, long value, long deadband)
+{
+	/* integers are exact as doubles as far as devices count */
+	return dstate_setinfo_double(var, (double)value, 0, (double)deadband);
+}
+
+st_family_t *dstate_family(const char *tmpl)
+{
+	st_family_t	*fam;
+
+	for (fam = families; fam; fam = fam->next) {
+		if (!strcmp(fam->tmpl, tmpl)) {
+			return fam;
+		}
+	}
+
+	if (!(fam = state_family_new(tmpl))) {
+		upslogx(LOG_ERR, "%s: not a template of indexed variables: %s", __func__, tmpl);
+		return NULL;
+	}
+
+	fam->next = families;
+	families = fam;
+
+	return fam;
+}
+
+const char *dstate_family_name(st_family_t *fam, int index)
+{
+	return fam ? state_family_name(fam, index) : NULL;
+}
+
+int dstate_family_setinfo(st_family_t *fam, int index, const char *fmt, ...)
+{
+	int	ret;
+	char	value[ST_MAX_VALUE_LEN];
+	va_list	ap;
+
+	if (!fam) {
+		return -1;
+	}
+
+	va_start(ap, fmt);
+#ifdef HAVE_PRAGMAS_FOR_GCC_DIAGNOSTIC_IGNORED_FORMAT_NONLITERAL
+#pragma GCC diagnostic push
+#endif
+#ifdef HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_FORMAT_NONLITERAL
+#pragma GCC diagnostic ignored "-Wformat-nonliteral"
+#endif
+#ifdef HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_FORMAT_SECURITY
+#pragma GCC diagnostic ignored "-Wformat-security"
+#endif
+	/* as in vdstate_setinfo() */
+	vsnprintf(value, sizeof(value), fmt, ap);
+#ifdef HAVE_PRAGMAS_FOR_GCC_DIAGNOSTIC_IGNORED_FORMAT_NONLITERAL
+#pragma GCC diagnostic pop
+#endif
+	va_end(ap);
+
+	ret = state_family_setinfo(fam, &dtree_root, index, value);
+
+	if (ret == 1) {
+		NUT_PROBE2(driver_setinfo, fam->name[index], value);
+		send_var_to_all("SETINFO", fam->name[index], value);
+	}
+
+	return ret;
+}
+
+int dstate_family_setinfo_double(st_family_t *fam, int index, double value, int precision, double deadband)
+{
+	int	ret;
+	char	buf[ST_MAX_VALUE_LEN];
+
+	if (!fam) {
+		return -1;
+	}
+
+	if (precision < 0) {
+		precision = 0;
+	}
+
+	ret = state_family_setinfo_double(fam, &dtree_root, index, value,
+		precision, deadband, buf, sizeof(buf));
+
+	if (ret == 1) {
+		NUT_PROBE2(driver_setinfo, fam->name[index], buf);
+		send_var_to_all("SETINFO", fam->name[index], buf);
+	}
+
+	return ret;
+}
+
+const char *dstate_family_getinfo(st_family_t *fam, int index)
+{
+	st_tree_t	*node = fam ? state_family_find(fam, dtree_root, index) : NULL;
+
+	return node ? node->val : NULL;
+}
+
+int dstate_family_delinfo(st_family_t *fam, int index)
+{
+	const char	*name = dstate_family_name(fam, index);
+
+	return name ? dstate_delinfo(name) : 0;
+}
+
+int dstate_float_precision(const char *fmt)
+{
+	int	precision = 6;	/* of "%f" */
+
+	if (!fmt || *fmt++ != '%') {
+		return -1;
+	}
+
+	if (*fmt == '0' && fmt[1] == '.') {
+		fmt++;
+	}
+
+	if (*fmt == '.') {
+		fmt++;
+		if (!isdigit((unsigned char)*fmt)) {
+			return -1;
+		}
+
+		precision = 0;
+		while (isdigit((unsigned char)*fmt) && precision < 100) {
+			precision = precision * 10 + (*fmt++ - '0');
+		}
+	}
+
+	if (*fmt != 'f' || fmt[1] != '\0' || precision >= 100) {
+		return -1;
+	}
+
+	return precision;
+}
+
 int vdstate_addenum(const char *var, const char *fmt, va_list ap)
 {
 	int	ret;
@@ -1468,7 +2835,7 @@ int vdstate_addenum(const char *var, const char *fmt, va_list ap)
 	ret = state_addenum(dtree_root, var, value);
 
 	if (ret == 1) {
-		send_to_all("ADDENUM %s \"%s\"\n", var, value);
+		send_var_to_all("ADDENUM", var, value);
 	}
 
 	return ret;
@@ -1539,7 +2906,7 @@ int dstate_addrange(const char *var, const int min, const int max)
 	ret = state_addrange(dtree_root, var, min, max);
 
 	if (ret == 1) {
-		send_to_all("ADDRANGE %s %i %i\n", var, min, max);
+		send_range_to_all("ADDRANGE", var, min, max);
 		/* Also add the "NUMBER" flag for ranges */
 		dstate_addflags(var, ST_FLAG_NUMBER);
 	}
@@ -1550,7 +2917,8 @@ int dstate_addrange(const char *var, const int min, const int max)
 void dstate_setflags(const char *var, int flags)
 {
 	st_tree_t	*sttmp;
-	char	flist[SMALLBUF];
+	const char	*arg[5];
+	size_t	numargs = 2;
 
 	/* find the dtree node for var */
 	sttmp = state_tree_find(dtree_root, var);
@@ -1572,22 +2940,23 @@ void dstate_setflags(const char *var, int flags)
 	sttmp->flags = flags;
 
 	/* build the list */
-	snprintf(flist, sizeof(flist), "%s", var);
+	arg[0] = "SETFLAGS";
+	arg[1] = var;
 
 	if (flags & ST_FLAG_RW) {
-		snprintfcat(flist, sizeof(flist), " RW");
+		arg[numargs++] = "RW";
 	}
 
 	if (flags & ST_FLAG_STRING) {
-		snprintfcat(flist, sizeof(flist), " STRING");
+		arg[numargs++] = "STRING";
 	}
 
 	if (flags & ST_FLAG_NUMBER) {
-		snprintfcat(flist, sizeof(flist), " NUMBER");
+		arg[numargs++] = "NUMBER";
 	}
 
 	/* update listeners */
-	send_to_all("SETFLAGS %s\n", flist);
+	send_to_all(0, numargs, arg);
 }
 
 void dstate_addflags(const char *var, const int addflags)
@@ -1629,6 +2998,8 @@ void dstate_delflags(const char *var, const int delflags)
 void dstate_setaux(const char *var, long aux)
 {
 	st_tree_t	*sttmp;
+	const char	*arg[3];
+	char	auxbuf[24];
 
 	/* find the dtree node for var */
 	sttmp = state_tree_find(dtree_root, var);
@@ -1645,7 +3016,11 @@ void dstate_setaux(const char *var, long aux)
 	sttmp->aux = aux;
 
 	/* update listeners */
-	send_to_all("SETAUX %s %ld\n", var, aux);
+	snprintf(auxbuf, sizeof(auxbuf), "%ld", aux);
+	arg[0] = "SETAUX";
+	arg[1] = var;
+	arg[2] = auxbuf;
+	send_to_all(0, 3, arg);
 }
 
 const char *dstate_getinfo(const char *var)
@@ -1661,7 +3036,7 @@ void dstate_addcmd(const char *cmdname)
 
 	/* update listeners */
 	if (ret == 1) {
-		send_to_all("ADDCMD %s\n", cmdname);
+		send_var_to_all("ADDCMD", cmdname, NULL);
 	}
 }
 
@@ -1673,7 +3048,7 @@ int dstate_delinfo(const char *var)
 
 	/* update listeners */
 	if (ret == 1) {
-		send_to_all("DELINFO %s\n", var);
+		send_var_to_all("DELINFO", var, NULL);
 	}
 
 	return ret;
@@ -1687,8 +3062,60 @@ int dstate_delinfo_olderthan(const char *var, const st_tree_timespec_t *cutoff)
 
 	/* update listeners */
 	if (ret == 1) {
-		send_to_all("DELINFO %s\n", var);
+		send_var_to_all("DELINFO", var, NULL);
+	}
+
+	return ret;
+}
+
+/* the generation dstate_prune() keeps the variables of */
+static unsigned long	prune_gen = 0;
+
+void dstate_prune_begin(void)
+{
+	prune_gen = state_generation_next();
+}
+
+static void prune_deleted(const char *var, void *arg)
+{
+	NUT_UNUSED_VARIABLE(arg);
+
+	send_var_to_all("DELINFO", var, NULL);
+}
+
+/* the driver state is not set every cycle, keep it out of the sweep */
+static void prune_keep_driver(st_tree_t *node)
+{
+	int	cmp;
+
+	if (!node) {
+		return;
+	}
+
+	cmp = strncasecmp(node->var, "driver.", 7);
+
+	if (cmp >= 0) {
+		prune_keep_driver(node->left);
+	}
+	if (cmp <= 0) {
+		prune_keep_driver(node->right);
 	}
+	if (!cmp) {
+		state_touchinfo(node);
+	}
+}
+
+size_t dstate_prune(const char *prefix)
+{
+	size_t	ret, len = prefix ? strlen(prefix) : 0;
+
+	if (!strncasecmp(prefix ? prefix : "", "driver.", len < 7 ? len : 7)) {
+		prune_keep_driver(dtree_root);
+	}
+
+	dstate_batch_begin();
+	ret = state_prune(&dtree_root, prefix, prune_gen, prune_deleted, NULL);
+	dstate_batch_commit();
 
 	return ret;
 }
@@ -1701,7 +3128,7 @@ int dstate_delenum(const char *var, const char *val)
 
 	/* update listeners */
 	if (ret == 1) {
-		send_to_all("DELENUM %s \"%s\"\n", var, val);
+		send_var_to_all("DELENUM", var, val);
 	}
 
 	return ret;
@@ -1715,7 +3142,7 @@ int dstate_delrange(const char *var, const int min, const int max)
 
 	/* update listeners */
 	if (ret == 1) {
-		send_to_all("DELRANGE %s %i %i\n", var, min, max);
+		send_range_to_all("DELRANGE", var, min, max);
 	}
 
 	return ret;
@@ -1729,7 +3156,7 @@ int dstate_delcmd(const char *cmd)
 
 	/* update listeners */
 	if (ret == 1) {
-		send_to_all("DELCMD %s\n", cmd);
+		send_var_to_all("DELCMD", cmd, NULL);
 	}
 
 	return ret;
@@ -1737,13 +3164,119 @@ int dstate_delcmd(const char *cmd)
 
 void dstate_free(void)
 {
+	size_t	i;
+
+	/* the last states of a driver which exits in good order */
+	snapshot_flush(1);
+	stateshm_close(&snapstate);
+	free(snap_fn);
+	snap_fn = NULL;
+
 	state_infofree(dtree_root);
 	dtree_root = NULL;
 
 	state_cmdfree(cmdhead);
 	cmdhead = NULL;
 
+	while (families) {
+		st_family_t	*fam = families;
+
+		families = fam->next;
+		state_family_free(fam);
+	}
+
 	sock_close();
+
+#ifndef WIN32
+	free(watch_fds);
+	watch_fds = NULL;
+	watch_count = watch_alloc = 0;
+	free(watch_ready);
+	watch_ready = NULL;
+	watch_ready_alloc = 0;
+#endif	/* !WIN32 */
+
+	free(batch_all.buf);
+	free(batch_events.buf);
+	free(batch_trace.buf);
+	free(batch_frames.buf);
+	free(dump_cache.buf);
+	free(frame_dump_cache.buf);
+	memset(&batch_all, 0, sizeof(batch_all));
+	memset(&batch_events, 0, sizeof(batch_events));
+	memset(&batch_trace, 0, sizeof(batch_trace));
+	memset(&batch_frames, 0, sizeof(batch_frames));
+	memset(&dump_cache, 0, sizeof(dump_cache));
+	memset(&frame_dump_cache, 0, sizeof(frame_dump_cache));
+	for (i = 0; i < DSTATE_JOURNAL_MAX; i++) {
+		free(journal[i].args);
+	}
+	memset(journal, 0, sizeof(journal));
+	journal_seq = journal_sent = 0;
+	*journal_epoch = '\0';
+	batch_depth = 0;
+	dump_valid = 0;
+	frame_dump_valid = 0;
+	sockframe_names_free(&frame_names);
+}
+
+void dstate_snapshot_enable(const char *fn)
+{
+	free(snap_fn);
+	snap_fn = xstrdup(fn);
+	snap_dirty = 1;
+	snap_last = 0;
+	stateshm_init(&snapstate);
+}
+
+time_t dstate_snapshot_load(const char *fn)
+{
+	stateshm_ctx_t	ctx;
+	char	*arg[STATESHM_MAXARGS];
+	size_t	numargs, off = 0;
+	time_t	saved;
+
+	stateshm_init(&ctx);
+	if ((saved = stateshm_load(&ctx, fn)) == 0) {
+		upsdebug_with_errno(1, "%s: can't load %s", __func__, fn);
+		stateshm_close(&ctx);
+		return 0;
+	}
+
+	/* as a driver would have set them, in the order of DUMPALL */
+	while ((numargs = stateshm_next(&ctx, &off, arg)) > 0) {
+		if (!strcmp(arg[0], "ADDCMD") && numargs >= 2) {
+			dstate_addcmd(arg[1]);
+		} else if (numargs < 3) {
+			continue;
+		} else if (!strcmp(arg[0], "SETINFO")) {
+			dstate_setinfo(arg[1], "%s", arg[2]);
+		} else if (!strcmp(arg[0], "ADDENUM")) {
+			dstate_addenum(arg[1], "%s", arg[2]);
+		} else if (!strcmp(arg[0], "ADDRANGE") && numargs >= 4) {
+			dstate_addrange(arg[1], atoi(arg[2]), atoi(arg[3]));
+		} else if (!strcmp(arg[0], "SETAUX")) {
+			dstate_setaux(arg[1], strtol(arg[2], NULL, 10));
+		} else if (!strcmp(arg[0], "SETFLAGS")) {
+			int	flags = 0;
+			size_t	i;
+
+			for (i = 2; i < numargs; i++) {
+				if (!strcasecmp(arg[i], "RW")) {
+					flags |= ST_FLAG_RW;
+				} else if (!strcasecmp(arg[i], "STRING")) {
+					flags |= ST_FLAG_STRING;
+				} else if (!strcasecmp(arg[i], "NUMBER")) {
+					flags |= ST_FLAG_NUMBER;
+				}
+			}
+			dstate_setflags(arg[1], flags);
+		}
+	}
+
+	upsdebugx(1, "%s: loaded the states saved in %s", __func__, fn);
+	stateshm_close(&ctx);
+	return saved;
 }
 
 const st_tree_t *dstate_getroot(void)
@@ -1760,7 +3293,7 @@ void dstate_dataok(void)
 {
 	if (stale == 1) {
 		stale = 0;
-		send_to_all("DATAOK\n");
+		send_event_to_all("DATAOK\n");
 	}
 }
 
@@ -1768,7 +3301,7 @@ void dstate_datastale(void)
 {
 	if (stale == 0) {
 		stale = 1;
-		send_to_all("DATASTALE\n");
+		send_event_to_all("DATASTALE\n");
 	}
 }
 
@@ -1779,32 +3312,76 @@ int dstate_is_stale(void)
 
 /* ups.status management functions - reducing duplication in the drivers */
 
+/* The status words known by name (those of docs/new-drivers.txt) are kept
+ * during a pass as bits, others as a list of words; both are noted in the
+ * order they were set, which ups.status lists them in. The string is only
+ * made anew by status_commit() when what was set differs from last time. */
+static const char	*status_words[] = {
+	"OL", "OB", "LB", "HB", "RB", "CHRG", "DISCHRG", "BYPASS",
+	"CAL", "OFF", "OVER", "TRIM", "BOOST", "FSD"
+};
+
+#define STATUS_WORDS	(sizeof(status_words) / sizeof(*status_words))
+#define STATUS_OTHER	0xff	/* order[] entry: the next of other[] */
+#define STATUS_LB	2	/* index of "LB" */
+
+typedef struct {
+	uint32_t	mask;		/* bits of the known words set */
+	unsigned char	order[ST_MAX_VALUE_LEN / 2];
+	size_t	count;		/* of order[] */
+	char	other[ST_MAX_VALUE_LEN];	/* words not known, space-separated */
+	size_t	len;		/* of ups.status made of it all */
+	int	alarm;		/* "ALARM" goes first */
+} status_acc_t;
+
+static status_acc_t	status_cur, status_last;
+static char	status_str[ST_MAX_VALUE_LEN];	/* made of status_last */
+
+static int status_word(const char *word)
+{
+	size_t	i;
+
+	for (i = 0; i < STATUS_WORDS; i++) {
+		if (!strcmp(word, status_words[i])) {
+			return (int)i;
+		}
+	}
+
+	return -1;
+}
+
 /* clean out the temp space for a new pass */
 void status_init(void)
 {
 	/* This does not normally change in driver run-time, but can in tests */
 	ignorelb = (dstate_getinfo("driver.flag.ignorelb") ? 1 : 0);
 
-	memset(status_buf, 0, sizeof(status_buf));
+	status_cur.mask = 0;
+	status_cur.count = 0;
+	status_cur.other[0] = '\0';
+	status_cur.len = 0;
 	alarm_status = 0;
 	alarm_legacy_status = 0;
 }
 
 /* check if a status element has been set, return 0 if not, 1 if yes
- * (considering a whole-word token in temporary status_buf) */
+ * (considering a whole-word token set since status_init()) */
 int status_get(const char *buf)
 {
-	return str_contains_token(status_buf, buf);
-}
+	int	idx;
 
-/* add a status element */
-static int status_set_callback(char *tgt, size_t tgtsize, const char *token)
-{
-	if (tgt != status_buf || tgtsize != sizeof(status_buf)) {
-		upsdebugx(2, "%s: called for wrong use-case", __func__);
+	if (!buf || !*buf)
 		return 0;
-	}
 
+	if ((idx = status_word(buf)) >= 0)
+		return (status_cur.mask & (1U << idx)) ? 1 : 0;
+
+	return str_contains_token(status_cur.other, buf);
+}
+
+/* see if a status word is to be set at all */
+static int status_set_check(const char *token)
+{
 	if (ignorelb && !strcasecmp(token, "LB")) {
 		upsdebugx(2, "%s: ignoring LB flag from device", __func__);
 		return 0;
@@ -1834,17 +3411,110 @@ static int status_set_callback(char *tgt, size_t tgtsize, const char *token)
 	return 1;
 }
 
+/* add one status word, unless it was already set */
+static void status_add(const char *word, size_t wordlen)
+{
+	char	tmp[ST_MAX_VALUE_LEN];
+	int	idx;
+	size_t	needed;
+
+	if (wordlen >= sizeof(tmp)) {
+		upsdebugx(1, "%s: skip token '%.*s': too long for target string",
+			__func__, (int)wordlen, word);
+		return;
+	}
+
+	memcpy(tmp, word, wordlen);
+	tmp[wordlen] = '\0';
+
+	if (!status_set_check(tmp))
+		return;
+
+	idx = status_word(tmp);
+	if (idx >= 0 ? (status_cur.mask & (1U << idx)) != 0
+		: str_contains_token(status_cur.other, tmp)
+	) {
+		upsdebugx(2, "%s: skip token '%s': was already set", __func__, tmp);
+		return;
+	}
+
+	needed = status_cur.len + (status_cur.len > 0 ? 1 : 0) + wordlen;
+	if (needed >= ST_MAX_VALUE_LEN || status_cur.count >= sizeof(status_cur.order)) {
+		upsdebugx(1, "%s: skip token '%s': too long for target string", __func__, tmp);
+		return;
+	}
+
+	if (idx >= 0) {
+		status_cur.mask |= 1U << idx;
+		status_cur.order[status_cur.count++] = (unsigned char)idx;
+	} else {
+		snprintfcat(status_cur.other, sizeof(status_cur.other), "%s%s",
+			status_cur.other[0] ? " " : "", tmp);
+		status_cur.order[status_cur.count++] = STATUS_OTHER;
+	}
+	status_cur.len = needed;
+}
+
+/* add a status element (or several, separated by spaces) */
 void status_set(const char *buf)
 {
+	const char	*p, *end;
+
 #ifdef DEBUG
 	upsdebugx(3, "%s: '%s'\n", __func__, buf);
 #endif
-	str_add_unique_token(status_buf, sizeof(status_buf), buf, status_set_callback, NULL);
+	if (!buf)
+		return;
+
+	for (p = buf; *p; p = end) {
+		while (*p == ' ')
+			p++;
+		for (end = p; *end && *end != ' '; end++);
+		if (end > p)
+			status_add(p, (size_t)(end - p));
+	}
+}
+
+static int status_same(const status_acc_t *a, const status_acc_t *b)
+{
+	return a->mask == b->mask && a->count == b->count && a->alarm == b->alarm
+		&& !memcmp(a->order, b->order, a->count)
+		&& !strcmp(a->other, b->other);
+}
+
+/* ups.status made of the words of status_cur in the order they were set */
+static void status_render(char *buf, size_t bufsize)
+{
+	const char	*other = status_cur.other;
+	size_t	i, len = 0, wlen;
+
+	buf[0] = '\0';
+	if (status_cur.alarm) {
+		len = (size_t)snprintf(buf, bufsize, "ALARM");
+	}
+
+	for (i = 0; i < status_cur.count && len < bufsize; i++) {
+		if (status_cur.order[i] != STATUS_OTHER) {
+			len += (size_t)snprintf(buf + len, bufsize - len, "%s%s",
+				len ? " " : "", status_words[status_cur.order[i]]);
+			continue;
+		}
+
+		for (wlen = 0; other[wlen] && other[wlen] != ' '; wlen++);
+		len += (size_t)snprintf(buf + len, bufsize - len, "%s%.*s",
+			len ? " " : "", (int)wlen, other);
+		other += wlen;
+		while (*other == ' ')
+			other++;
+	}
 }
 
-/* write the status_buf into the externally visible dstate storage */
+/* write the status words set into the externally visible dstate storage */
 void status_commit(void)
 {
+	st_tree_t	*node;
+	const char	*cur;
+
 	while (ignorelb) {
 		const char	*val, *low;
 
@@ -1852,7 +3522,9 @@ void status_commit(void)
 		low = dstate_getinfo("battery.charge.low");
 
 		if (val && low && (strtol(val, NULL, 10) < strtol(low, NULL, 10))) {
-			snprintfcat(status_buf, sizeof(status_buf), " LB");
+			status_cur.mask |= 1U << STATUS_LB;
+			if (status_cur.count < sizeof(status_cur.order))
+				status_cur.order[status_cur.count++] = STATUS_LB;
 			upsdebugx(2, "%s: appending LB flag [charge '%s' below '%s']", __func__, val, low);
 			break;
 		}
@@ -1861,7 +3533,9 @@ void status_commit(void)
 		low = dstate_getinfo("battery.runtime.low");
 
 		if (val && low && (strtol(val, NULL, 10) < strtol(low, NULL, 10))) {
-			snprintfcat(status_buf, sizeof(status_buf), " LB");
+			status_cur.mask |= 1U << STATUS_LB;
+			if (status_cur.count < sizeof(status_cur.order))
+				status_cur.order[status_cur.count++] = STATUS_LB;
 			upsdebugx(2, "%s: appending LB flag [runtime '%s' below '%s']", __func__, val, low);
 			break;
 		}
@@ -1870,16 +3544,22 @@ void status_commit(void)
 		break;
 	}
 
-	if (alarm_active || alarm_legacy_status) {
-		if (*status_buf != '\0') {
-			dstate_setinfo("ups.status", "ALARM %s", status_buf);
-		} else {
-			dstate_setinfo("ups.status", "ALARM");
-		}
-	} else {
-		dstate_setinfo("ups.status", "%s", status_buf);
+	status_cur.alarm = (alarm_active || alarm_legacy_status);
+	if (!status_cur.alarm) {
 		alarm_legacy_status = 0; /* just to be sure */
 	}
+
+	/* nothing changed since last time (and nothing else set ups.status) */
+	node = state_tree_find(dtree_root, "ups.status");
+	cur = node ? node->raw : NULL;
+	if (cur && status_same(&status_cur, &status_last) && !strcmp(cur, status_str)) {
+		state_touchinfo(node);	/* set all the same, for dstate_prune() */
+		return;
+	}
+
+	status_render(status_str, sizeof(status_str));
+	status_last = status_cur;
+	dstate_setinfo("ups.status", "%s", status_str);
 }
 
 /* similar functions for experimental.ups.mode.buzzwords, where tracked
@@ -43,18 +43,39 @@
 #endif
 
 /* track client connections */
+/* a SET or INSTCMD held back between BATCH BEGIN and BATCH END */
+typedef struct {
+	int	setvar;	/* SET, or else INSTCMD */
+	char	*name;
+	char	*value;	/* NULL for an INSTCMD without a parameter */
+	char	*id;	/* TRACKING id, or NULL */
+} conn_cmd_t;
+
 typedef struct conn_s {
 	TYPE_FD	fd;
 #ifdef WIN32
-	char    buf[LARGEBUF];
-	OVERLAPPED read_overlapped;
+	pipe_reads_t	reads;	/* kept posted on the pipe, see sock_read() */
+	HANDLE	read_event;	/* signalled by the completion of any of them */
 #endif	/* WIN32 */
 	PCONF_CTX_t	ctx;
 	struct conn_s	*prev;
 	struct conn_s	*next;
 	int	nobroadcast;	/* connections can request to ignore send_to_all() updates */
+	int	shmstate;	/* reads the states from memory, see SHMSTATE */
+	int	trace;	/* gets SETINFO lines with the time they were set, see TRACE */
+	int	framed;	/* gets records rather than text, see FRAMED */
+	size_t	frame_names;	/* how many names it got the definitions of */
+	int	seq;	/* gets the number of the last change as they are made, see SEQ */
+	int	resumed;	/* took the changes it missed with DUMPSINCE, see there */
+	int	cmdbatch;	/* between BATCH BEGIN and BATCH END, see there */
+	conn_cmd_t	*cmds;	/* held back until then */
+	size_t	numcmds, cmdsalloc;
 	int	readzero;	/* how many times in a row we had zero bytes read; see DSTATE_CONN_READZERO_THROTTLE_USEC and DSTATE_CONN_READZERO_THROTTLE_MAX */
 	int	closing;	/* raised during LOGOUT processing, to close the socket when time is right */
+#ifndef WIN32
+	char	*outbuf;	/* sent data the reader did not take yet, see conn_send() */
+	size_t	outlen, outoff, outsize;
+#endif	/* !WIN32 */
 } conn_t;
 
 /* sleep after read()ing zero bytes */
@@ -63,6 +84,28 @@ typedef struct conn_s {
 /* close socket after read()ing zero bytes this many times in a row */
 #define DSTATE_CONN_READZERO_THROTTLE_MAX	5
 
+/* drop a connection which leaves more than this many bytes sent to it
+ * unread (it gets everything again with DUMPALL once it reconnects) */
+#define DSTATE_CONN_OUTBUF_MAX	1048576
+
+/* send a batch of changes early once it grew this large (bytes) */
+#define DSTATE_BATCH_MAX	65536
+
+/* changes kept for readers which come back with DUMPSINCE, see SEQ */
+#define DSTATE_JOURNAL_MAX	1024
+
+/* most commands held back in one BATCH (those before are done then) */
+#define DSTATE_CMDBATCH_MAX	256
+
+/* save the state snapshot ("statesnapshot") at most this often (seconds) */
+#define DSTATE_SNAPSHOT_INTERVAL	30
+
+/* file name suffix of the snapshot, next to the driver socket */
+#define DSTATE_SNAPSHOT_SUFFIX	".snapshot"
+
+/* serve a state snapshot at start-up only if it is not older (seconds) */
+#define DSTATE_SNAPSHOT_MAXAGE	600
+
 #include "main.h"	/* for set_exit_flag(); uses conn_t itself */
 
 	extern	struct	ups_handler	upsh;
@@ -73,11 +116,56 @@ typedef struct conn_s {
 
 char * dstate_init(const char *prog, const char *devname);
 int dstate_poll_fds(struct timeval timeout, TYPE_FD extrafd);
+
+#ifndef WIN32
+/* more file descriptors for dstate_poll_fds() to wake up on, like
+ * extrafd, for reading and/or writing (e.g. those of libusb) */
+#define DSTATE_WATCH_READ	1
+#define DSTATE_WATCH_WRITE	2
+void dstate_watch_fd(int fd, int events);
+void dstate_unwatch_fd(int fd);
+
+/* Like dstate_watch_fd(), but rather than waking up, dstate_poll_fds()
+ * calls <func> with the DSTATE_WATCH_* events which are ready on <fd>
+ * and <arg>, then goes on waiting: it returns 1 to wake up nonetheless
+ * (e.g. to have the data updated at once), 0 to go on, or -1 to have
+ * the fd unwatched. Its changes of the data are sent out together.
+ */
+typedef int (*dstate_fd_func_t)(int fd, int events, void *arg);
+void dstate_add_fd(int fd, int events, dstate_fd_func_t func, void *arg);
+#endif	/* !WIN32 */
 int vdstate_setinfo(const char *var, const char *fmt, va_list ap);
 int dstate_setinfo(const char *var, const char *fmt, ...)
 	__attribute__ ((__format__ (__printf__, 2, 3)));
 int dstate_setinfo_dynamic(const char *var, const char *fmt_dynamic, const char *fmt_reference, ...)
 	__attribute__ ((__format__ (__printf__, 3, 4)));
+
+/* Set readings which drivers publish on every poll: the value is stored as
+ * with "%.<precision>f" (or "%ld"), but only formatted and compared when it
+ * moved by more than <deadband> since it was last set this way, so that a
+ * steady reading costs just a lookup. Return like dstate_setinfo(). */
+int dstate_setinfo_double(const char *var, double value, int precision, double deadband);
+int dstate_setinfo_int(const char *var, long value, long deadband);
+
+/* Indexed families of variables (e.g. "outlet.%i.current"), for drivers
+ * which publish the same few for each of many outlets or phases: the
+ * family of a template is made when first asked for and kept until
+ * dstate_free(), and setting its variables by index costs neither
+ * formatting their names nor looking them up in the tree (see
+ * st_family_t). dstate_family() returns NULL if <tmpl> does not take
+ * exactly one integer, which the other methods take as a no-op (with
+ * -1, 0 or NULL). */
+st_family_t *dstate_family(const char *tmpl);
+const char *dstate_family_name(st_family_t *fam, int index);
+int dstate_family_setinfo(st_family_t *fam, int index, const char *fmt, ...)
+	__attribute__ ((__format__ (__printf__, 3, 4)));
+int dstate_family_setinfo_double(st_family_t *fam, int index, double value, int precision, double deadband);
+const char *dstate_family_getinfo(st_family_t *fam, int index);
+int dstate_family_delinfo(st_family_t *fam, int index);
+
+/* the precision of a plain "%f", "%.<N>f" or "%0.<N>f" format as found in
+ * driver mapping tables, or -1 if it is anything else */
+int dstate_float_precision(const char *fmt);
 int vdstate_addenum(const char *var, const char *fmt, va_list ap);
 int dstate_addenum(const char *var, const char *fmt, ...)
 	__attribute__ ((__format__ (__printf__, 2, 3)));
@@ -91,6 +179,13 @@ void dstate_setaux(const char *var, long aux);
 const char *dstate_getinfo(const char *var);
 void dstate_addcmd(const char *cmdname);
 int dstate_delinfo_olderthan(const char *var, const st_tree_timespec_t *cutoff);
+/* Delete what a poll cycle did not refresh: call dstate_prune_begin()
+ * before the cycle sets the variables it still finds, then dstate_prune()
+ * removes (but for driver.* ones) those under <prefix>, or all of them if
+ * it is NULL, which were not set since, and tells the connections about
+ * them at once. Returns the number of variables deleted. */
+void dstate_prune_begin(void);
+size_t dstate_prune(const char *prefix);
 int dstate_delinfo(const char *var);
 int dstate_delenum(const char *var, const char *val);
 int dstate_delrange(const char *var, const int min, const int max);
@@ -102,6 +197,22 @@ const cmdlist_t *dstate_getcmdlist(void);
 void dstate_dataok(void);
 void dstate_datastale(void);
 
+/* Save the states to <fn> from now on (see snapshot_flush() in dstate.c)
+ * for the next run of this driver to serve meanwhile it initializes */
+void dstate_snapshot_enable(const char *fn);
+
+/* set the states saved in snapshot <fn>, returns the time they were saved
+ * or 0 if it could not be read */
+time_t dstate_snapshot_load(const char *fn);
+
+/* Hold back the changes (and DATAOK/DATASTALE) made until the matching
+ * dstate_batch_commit(), then send them all to each connection with one
+ * write, so that clients see the outcome of a whole update at once.
+ * Batches may be nested, only the outermost commit sends anything; the
+ * driver core makes one around each upsdrv_updateinfo() call. */
+void dstate_batch_begin(void);
+void dstate_batch_commit(void);
+
 int dstate_is_stale(void);
 
 /* clean out the temp space for a new pass */
@@ -48,7 +48,7 @@
 #include "dummy-ups.h"
 
 #define DRIVER_NAME	"Device simulation and repeater driver"
-#define DRIVER_VERSION	"0.22"
+#define DRIVER_VERSION	"0.24"
 
 /* driver description structure */
 upsdrv_info_t upsdrv_info =
@@ -84,7 +84,11 @@ enum drivermode {
 	MODE_REPEATER,
 
 	/* consolidate data from several UPSs (TBS) */
-	MODE_META
+	MODE_META,
+
+	/* make up the readings of a device, changing them at random
+	 * (within realistic bounds) at a given rate, for load tests */
+	MODE_SIMULATE
 };
 typedef enum drivermode drivermode_t;
 
@@ -105,6 +109,7 @@ static int is_valid_data(const char* varname);
 static int is_valid_value(const char* varname, const char *value);
 /* libupsclient update */
 static int upsclient_update_vars(void);
+static void upsclient_check_delta(void);
 
 /* connection information */
 static char		*client_upsname = NULL, *hostname = NULL;
@@ -114,6 +119,46 @@ static uint16_t	port;
 /* repeater mode parameters */
 static int repeater_disable_strict_start = 0;
 
+/* repeater mode: the cursor for the next delta listing (LIST VAR ...
+ * SINCE) of the remote upsd, "0" to start over, or empty if it does not
+ * support them so that all variables are listed every time */
+static char	repeater_cursor[SMALLBUF] = "";
+
+/* simulation mode: the readings which wander, each changed by up to
+ * "step" at a time, within "low" and "high" */
+typedef struct {
+	const char	*name;
+	double	low, high, step;
+	int	decimals;
+	double	value;
+} sim_var_t;
+
+static sim_var_t	sim_vars[] = {
+	{ "input.voltage",		215,	245,	1.5,	1,	230 },
+	{ "input.frequency",		49.8,	50.2,	0.05,	2,	50 },
+	{ "output.voltage",		227,	233,	0.5,	1,	230 },
+	{ "output.frequency",		49.9,	50.1,	0.02,	2,	50 },
+	{ "ups.load",			5,	85,	2,	0,	35 },
+	{ "ups.temperature",		20,	35,	0.2,	1,	27 },
+	{ "battery.voltage",		26.4,	27.6,	0.05,	2,	27.2 },
+	{ "battery.temperature",	20,	35,	0.2,	1,	25 },
+	{ NULL, 0, 0, 0, 0, 0 }
+};
+
+/* the same device (nominal values) every time */
+#define SIM_REALPOWER_NOMINAL	1500
+#define SIM_RUNTIME_FULL	3600	/* seconds at 0% load with a full battery */
+#define SIM_OUTAGE_CHANCE	0.002	/* of a change being a power failure */
+
+static double	sim_rate = 1;	/* changes per second */
+static double	sim_budget = 0, sim_charge = 100;
+static int	sim_onbatt = 0;
+static uint64_t	sim_rng = 0;
+static struct timeval	sim_last;
+
+static void sim_init(void);
+static void sim_update(void);
+
 /* Driver functions */
 
 void upsdrv_initinfo(void)
@@ -122,6 +167,12 @@ void upsdrv_initinfo(void)
 
 	switch (mode)
 	{
+		case MODE_SIMULATE:
+			sim_init();
+			upsh.setvar = setvar;
+			dstate_dataok();
+			break;
+
 		case MODE_DUMMY_ONCE:
 		case MODE_DUMMY_LOOP:
 			/* Initialise basic essential variables */
@@ -174,6 +225,7 @@ void upsdrv_initinfo(void)
 			else
 			{
 				upsdebugx(1, "Connected to %s@%s", client_upsname, hostname);
+				upsclient_check_delta();
 			}
 			if (upsclient_update_vars() < 0)
 			{
@@ -266,6 +318,13 @@ void upsdrv_updateinfo(void)
 {
 	upsdebugx(1, "upsdrv_updateinfo...");
 
+	/* the simulation keeps to the poll interval, at the rate it was given */
+	if (mode == MODE_SIMULATE) {
+		sim_update();
+		dstate_dataok();
+		return;
+	}
+
 	sleep(1);
 
 	switch (mode)
@@ -345,10 +404,12 @@ void upsdrv_updateinfo(void)
 				else
 				{
 					upsdebugx(1, "Reconnected");
+					upsclient_check_delta();
 				}
 			}
 			break;
 
+		case MODE_SIMULATE:	/* handled above */
 		case MODE_NONE:
 #if (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_PUSH_POP) && ( (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_COVERED_SWITCH_DEFAULT) || (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_UNREACHABLE_CODE) )
 # pragma GCC diagnostic push
@@ -419,8 +480,10 @@ void upsdrv_help(void)
 
 void upsdrv_makevartable(void)
 {
-	addvar(VAR_VALUE,	"mode",	"Specify mode instead of guessing it from port value (dummy = dummy-loop, dummy-once, repeater)"); /* meta */
+	addvar(VAR_VALUE,	"mode",	"Specify mode instead of guessing it from port value (dummy = dummy-loop, dummy-once, repeater, simulate)"); /* meta */
 	addvar(VAR_FLAG,    "repeater_disable_strict_start", "Do not terminate the driver encountering errors when starting the repeater mode");
+	addvar(VAR_VALUE,	"sim_rate",	"Simulation mode: changes of the readings per second (default 1)");
+	addvar(VAR_VALUE,	"sim_seed",	"Simulation mode: seed of the changes, mixed with the device name (default 1)");
 }
 
 void upsdrv_initups(void)
@@ -433,6 +496,7 @@ void upsdrv_initups(void)
 		&&  !strcmp(val, "dummy-once")
 		&&  !strcmp(val, "dummy")
 		&&  !strcmp(val, "repeater")
+		&&  !strcmp(val, "simulate")
 		/* &&  !strcmp(val, "meta") */
 		) {
 			fatalx(EXIT_FAILURE, "Unsupported mode was specified: %s", val);
@@ -440,6 +504,14 @@ void upsdrv_initups(void)
 	}
 
 	/* check the running mode... */
+	if ( (!val && !strcmp(device_path, "simulate"))
+	||   (val && !strcmp(val, "simulate"))
+	) {
+		upsdebugx(1, "Simulation mode");
+		mode = MODE_SIMULATE;
+		dstate_setinfo("driver.parameter.mode", "simulate");
+	}
+	else
 	if ( (!val && strchr(device_path, '@'))
 	||   (val && !strcmp(val, "repeater"))
 	/*||   (val && !strcmp(val, "meta")) */
@@ -495,6 +567,7 @@ void upsdrv_initups(void)
 			case MODE_NONE:
 			case MODE_REPEATER:
 			case MODE_META:
+			case MODE_SIMULATE:
 #if (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_PUSH_POP) && ( (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_COVERED_SWITCH_DEFAULT) || (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_UNREACHABLE_CODE) )
 # pragma GCC diagnostic push
 #endif
@@ -593,6 +666,18 @@ static int setvar(const char *varname, const char *val)
 
 	upsdebug_SET_STARTING(varname, val);
 
+	/* the simulation goes on from a value set for one of its readings */
+	if (mode == MODE_SIMULATE) {
+		sim_var_t	*v;
+
+		for (v = sim_vars; v->name; v++) {
+			if (!strcmp(v->name, varname)) {
+				v->value = strtod(val, NULL);
+				break;
+			}
+		}
+	}
+
 	/* FIXME: the below is only valid if (mode == MODE_DUMMY)
 	 * if (mode == MODE_REPEATER) => forward
 	 * if (mode == MODE_META) => ?
@@ -657,6 +742,132 @@ static int setvar(const char *varname, const char *val)
 /*               Support functions               */
 /*************************************************/
 
+/* on (re)connection: delta listings are there since protocol 1.4 */
+static void upsclient_check_delta(void)
+{
+	char	buf[SMALLBUF];
+	unsigned int	major, minor;
+
+	repeater_cursor[0] = '\0';
+
+	snprintf(buf, sizeof(buf), "NETVER\n");
+
+	if (upscli_sendline(ups, buf, strlen(buf)) < 0
+	||  upscli_readline(ups, buf, sizeof(buf)) < 0
+	) {
+		upsdebugx(1, "Can't get the protocol version: %s", upscli_strerror(ups));
+		return;
+	}
+
+	if (sscanf(buf, "%u.%u", &major, &minor) != 2
+	||  major < 1 || (major == 1 && minor < 4)
+	) {
+		upsdebugx(1, "Protocol version [%s]: listing all variables every time", buf);
+		return;
+	}
+
+	upsdebugx(1, "Protocol version [%s]: listing the changes only", buf);
+	snprintf(repeater_cursor, sizeof(repeater_cursor), "0");
+}
+
+/* take what changed on the remote upsd since the last delta listing,
+ * instead of all the variables: returns 1 if that worked */
+static int upsclient_update_delta(void)
+{
+	char	buf[LARGEBUF], cursor[SMALLBUF] = "";
+	int	ret = -1, resync = 0;
+	PCONF_CTX_t	pc;
+
+	snprintf(buf, sizeof(buf), "LIST VAR %s SINCE %s\n",
+		client_upsname, repeater_cursor);
+
+	if (upscli_sendline(ups, buf, strlen(buf)) < 0) {
+		upsdebugx(1, "Error: %s (%i)", upscli_strerror(ups), upscli_upserror(ups));
+		return -1;
+	}
+
+	pconf_init(&pc, NULL);
+
+	for (;;) {
+		char	**arg;
+
+		if (upscli_readline(ups, buf, sizeof(buf)) < 0) {
+			upsdebugx(1, "Error: %s (%i)", upscli_strerror(ups), upscli_upserror(ups));
+			goto end;
+		}
+
+		if (!pconf_line(&pc, buf) || pc.numargs < 1) {
+			upsdebugx(1, "Error: can't parse [%s]", buf);
+			goto end;
+		}
+
+		arg = pc.arglist;
+
+		if (!strcmp(arg[0], "ERR")) {
+			upsdebugx(1, "Error: %s", pc.numargs > 1 ? arg[1] : "unknown");
+			goto end;
+		}
+
+		if (!strcmp(arg[0], "END")) {
+			break;
+		}
+
+		/* all of them are listed, the others are gone */
+		if (!strcmp(arg[0], "RESYNC")) {
+			resync = 1;
+			dstate_prune_begin();
+			continue;
+		}
+
+		if (!strcmp(arg[0], "CURSOR") && pc.numargs >= 3) {
+			snprintf(cursor, sizeof(cursor), "%s", arg[2]);
+			continue;
+		}
+
+		/* DELETED <upsname> <varname> */
+		if (!strcmp(arg[0], "DELETED") && pc.numargs >= 3) {
+			if (strncmp(arg[2], "driver.", 7)) {
+				upsdebugx(5, "Deleted: %s", arg[2]);
+				dstate_delinfo(arg[2]);
+			}
+			continue;
+		}
+
+		/* VAR <upsname> <varname> <val> */
+		if (!strcmp(arg[0], "VAR") && pc.numargs >= 4) {
+			upsdebugx(5, "Received: %s %s %s %s",
+				arg[0], arg[1], arg[2], arg[3]);
+
+			/* do not override the driver collection */
+			if (strncmp(arg[2], "driver.", 7)) {
+				setvar(arg[2], arg[3]);
+			}
+			continue;
+		}
+
+		/* BEGIN LIST VAR ... */
+		if (strcmp(arg[0], "BEGIN")) {
+			upsdebugx(2, "Ignoring [%s]", buf);
+		}
+	}
+
+	/* those which were not listed (so not set again) are gone */
+	if (resync) {
+		upsdebugx(2, "Deleted %" PRIuSIZE " variables no longer listed",
+			dstate_prune(NULL));
+	}
+
+	/* without one, the next listing starts over */
+	snprintf(repeater_cursor, sizeof(repeater_cursor), "%s",
+		cursor[0] ? cursor : "0");
+	ret = 1;
+
+end:
+	pconf_finish(&pc);
+
+	return ret;
+}
+
 static int upsclient_update_vars(void)
 {
 	int		ret;
@@ -664,6 +875,10 @@ static int upsclient_update_vars(void)
 	const char	*query[4];
 	char		**answer;
 
+	if (repeater_cursor[0]) {
+		return upsclient_update_delta();
+	}
+
 	query[0] = "VAR";
 	query[1] = client_upsname;
 	numq = 2;
@@ -913,3 +1128,167 @@ static int parse_data_file(TYPE_FD arg_upsfd)
 	}
 	return 1;
 }
+
+/*************************************************/
+/*               Simulation mode                 */
+/*************************************************/
+
+/* xorshift64*: cheap, and the same sequence for the same seed everywhere */
+static double sim_random(void)
+{
+	sim_rng ^= sim_rng >> 12;
+	sim_rng ^= sim_rng << 25;
+	sim_rng ^= sim_rng >> 27;
+
+	return (double)((sim_rng * (uint64_t)2685821657736338717ULL) >> 11) / 9007199254740992.0;
+}
+
+static double sim_get(const char *name)
+{
+	sim_var_t	*v;
+
+	for (v = sim_vars; v->name; v++) {
+		if (!strcmp(v->name, name))
+			return v->value;
+	}
+
+	return 0;
+}
+
+/* the readings which follow from the others */
+static void sim_publish(void)
+{
+	sim_var_t	*v;
+	double	load = sim_get("ups.load");
+
+	for (v = sim_vars; v->name; v++) {
+		if (sim_onbatt && !strncmp(v->name, "input.", 6)) {
+			dstate_setinfo(v->name, "%.*f", v->decimals, 0.0);
+			continue;
+		}
+		dstate_setinfo(v->name, "%.*f", v->decimals, v->value);
+	}
+
+	dstate_setinfo("ups.realpower", "%.0f", SIM_REALPOWER_NOMINAL * load / 100);
+	dstate_setinfo("output.current", "%.1f",
+		SIM_REALPOWER_NOMINAL * load / 100 / sim_get("output.voltage"));
+	dstate_setinfo("battery.charge", "%.0f", sim_charge);
+	dstate_setinfo("battery.runtime", "%.0f",
+		SIM_RUNTIME_FULL * sim_charge / 100 * (1 - load / 100 * 0.9));
+
+	status_init();
+	if (sim_onbatt) {
+		status_set("OB");
+		status_set("DISCHRG");
+		if (sim_charge < 20)
+			status_set("LB");
+	} else {
+		status_set("OL");
+		if (sim_charge < 100)
+			status_set("CHRG");
+	}
+	status_commit();
+}
+
+/* one change: a reading wanders, or the power fails or comes back */
+static void sim_step(void)
+{
+	sim_var_t	*v;
+	size_t	n;
+
+	if (sim_onbatt) {
+		sim_charge -= 1 + sim_get("ups.load") / 25;
+		if (sim_charge < 10 || sim_random() < 0.05) {
+			upsdebugx(2, "%s: power back", __func__);
+			sim_onbatt = 0;
+			if (sim_charge < 0)
+				sim_charge = 0;
+		}
+	} else if (sim_random() < SIM_OUTAGE_CHANCE) {
+		upsdebugx(2, "%s: power failure", __func__);
+		sim_onbatt = 1;
+	} else if (sim_charge < 100) {
+		sim_charge += 0.5;
+		if (sim_charge > 100)
+			sim_charge = 100;
+	}
+
+	for (n = 0; sim_vars[n].name; n++)
+		;
+	v = &sim_vars[(size_t)(sim_random() * (double)n) % n];
+
+	v->value += (sim_random() * 2 - 1) * v->step;
+	if (v->value < v->low)
+		v->value = v->low;
+	if (v->value > v->high)
+		v->value = v->high;
+}
+
+static void sim_init(void)
+{
+	const char	*val;
+	uint32_t	hash = (uint32_t)FNV1A_INIT;
+	unsigned long	seed = 1;
+	size_t	i;
+
+	if ((val = getval("sim_rate")) != NULL) {
+		sim_rate = strtod(val, NULL);
+		if (sim_rate <= 0) {
+			fatalx(EXIT_FAILURE, "Invalid sim_rate value: %s", val);
+		}
+	}
+
+	if ((val = getval("sim_seed")) != NULL) {
+		seed = strtoul(val, NULL, 10);
+	}
+
+	/* several sections of the same seed still make different devices */
+	if (upsname) {
+		hash = (uint32_t)fnv1a_hash(FNV1A_INIT, upsname, strlen(upsname));
+	}
+	sim_rng = ((uint64_t)seed << 32 | hash) ^ (uint64_t)0x9e3779b97f4a7c15ULL;
+	if (!sim_rng)
+		sim_rng = 1;
+
+	upsdebugx(1, "Simulating changes at %g per second, seed %lu", sim_rate, seed);
+
+	dstate_setinfo("device.mfr", "Network UPS Tools");
+	dstate_setinfo("device.model", "Simulated UPS");
+	dstate_setinfo("device.serial", "SIM-%08lx", (unsigned long)hash);
+	dstate_setinfo("device.type", "ups");
+	dstate_setinfo("ups.realpower.nominal", "%d", SIM_REALPOWER_NOMINAL);
+	dstate_setinfo("input.voltage.nominal", "230");
+	dstate_setinfo("battery.charge.low", "20");
+
+	/* do not start all devices alike */
+	for (i = 0; i < 50; i++) {
+		sim_step();
+	}
+	sim_onbatt = 0;
+	sim_charge = 100;
+
+	sim_publish();
+	gettimeofday(&sim_last, NULL);
+}
+
+static void sim_update(void)
+{
+	struct timeval	now;
+	double	elapsed;
+
+	gettimeofday(&now, NULL);
+	elapsed = difftimeval(now, sim_last);
+	sim_last = now;
+
+	/* a long stall (e.g. a suspended machine) does not make a burst */
+	sim_budget += ((elapsed > 10) ? 10 : elapsed) * sim_rate;
+	if (sim_budget < 1)
+		return;
+
+	while (sim_budget >= 1) {
+		sim_step();
+		sim_budget -= 1;
+	}
+
+	sim_publish();
+}
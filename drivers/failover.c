@@ -27,7 +27,7 @@
 #include "upsdrvquery.h"
 
 #define DRIVER_NAME      "UPS Failover Driver"
-#define DRIVER_VERSION   "0.01"
+#define DRIVER_VERSION   "0.03"
 
 upsdrv_info_t upsdrv_info = {
 	DRIVER_NAME,
@@ -91,9 +91,18 @@ static ups_device_t *get_primary_candidate(void);
 static int ups_passes_status_filters(const ups_device_t *ups);
 static int has_better_runtime(int rt, int rt_low, int best_rt, int best_rt_low, int mode);
 static void ups_promote_primary(ups_device_t *ups);
-static void ups_demote_primary(ups_device_t *ups);
+static void ups_demote_primary(ups_device_t *ups, ups_device_t *next);
 static void ups_export_dstate(ups_device_t *ups);
 static void ups_clean_dstate(const ups_device_t *ups);
+static void ups_switch_dstate(const ups_device_t *from, ups_device_t *to);
+static int ups_var_same(const ups_var_t *var, const ups_var_t *other, int compare_value);
+
+static const char *ups_var_name(const ups_device_t *ups, size_t pos);
+static const char *ups_cmd_name(const ups_device_t *ups, size_t pos);
+static int name_index_find(const name_index_t *idx, const ups_device_t *ups, const char *name, const char *(*name_at)(const ups_device_t *, size_t));
+static void name_index_add(name_index_t *idx, const ups_device_t *ups, size_t pos, size_t count, const char *(*name_at)(const ups_device_t *, size_t));
+static void name_index_rebuild(name_index_t *idx, const ups_device_t *ups, size_t count, const char *(*name_at)(const ups_device_t *, size_t));
+static void name_index_free(name_index_t *idx);
 
 static int ups_get_cmd_pos(const ups_device_t *ups, const char *cmd);
 static int ups_add_cmd(ups_device_t *ups, const char *val);
@@ -694,7 +703,7 @@ static void handle_no_primaries(void)
 	}
 
 	if (primary_ups && arg_fsdmode > 0) {
-		ups_demote_primary(primary_ups);
+		ups_demote_primary(primary_ups, NULL);
 	}
 
 	time(&now);
@@ -835,6 +844,10 @@ static int ups_connect(ups_device_t *ups)
 	if (conn) {
 		pconf_init(&ups->parse_ctx, NULL);
 		ups->conn = conn;
+#ifndef WIN32
+		/* wake up the main loop when the driver has news for us */
+		dstate_watch_fd(ups->conn->sockfd, DSTATE_WATCH_READ);
+#endif	/* !WIN32 */
 
 		upslogx(LOG_NOTICE, "%s: [%s]: connection is now established",
 			__func__, ups->socketname);
@@ -892,46 +905,81 @@ static int ups_read_data(ups_device_t *ups)
 	ssize_t	ret;
 	struct timeval tv;
 
+#ifndef WIN32
+	int	reads;
+	ssize_t	total = 0;
+
+	/* The socket is watched by the main loop, which wakes us up as soon
+	 * as the driver has sent something: only take what is pending, but
+	 * all of it (within reason), so as not to be woken up again for it */
+	tv.tv_sec = 0;
+	tv.tv_usec = 0;
+
+	for (reads = 0; reads < CONN_READ_DRAIN_MAX; reads++) {
+		ret = upsdrvquery_read_timeout(ups->conn, tv);
+
+		if (ret == -2) {
+			/* nothing (more) pending */
+			return total;
+		}
+
+		if (ret == 0) {
+			upsdebugx(2, "%s: [%s]: UPS driver has closed the connection",
+				__func__, ups->socketname);
+
+			return -1;
+		}
+#else	/* WIN32 */
 	tv.tv_sec = CONN_READ_TIMEOUT;
 	tv.tv_usec = 0;
 
-	ret = upsdrvquery_read_timeout(ups->conn, tv);
+	{
+		ret = upsdrvquery_read_timeout(ups->conn, tv);
+#endif	/* WIN32 */
 
-	if (ret == -1) {
-		upsdebug_with_errno(2, "%s: [%s]: read from UPS driver has failed",
-			__func__, ups->socketname);
+		if (ret == -1) {
+			upsdebug_with_errno(2, "%s: [%s]: read from UPS driver has failed",
+				__func__, ups->socketname);
 
-		return ret;
-	}
+			return ret;
+		}
 
-	if (ret == -2) {
-		upsdebug_with_errno(2, "%s: [%s]: read from UPS driver has timed out",
-			__func__, ups->socketname);
+		if (ret == -2) {
+			upsdebug_with_errno(2, "%s: [%s]: read from UPS driver has timed out",
+				__func__, ups->socketname);
 
-		return ret;
-	}
+			return ret;
+		}
 
-	for (i = 0; i < ret; ++i) {
-		switch (pconf_char(&ups->parse_ctx, ups->conn->buf[i]))
-		{
-			case 1:
-				if (ups_parse_protocol(ups, ups->parse_ctx.numargs, ups->parse_ctx.arglist)) {
-					time(&ups->last_heard_time);
-				}
-				continue;
+		for (i = 0; i < ret; ++i) {
+			switch (pconf_char(&ups->parse_ctx, ups->conn->buf[i]))
+			{
+				case 1:
+					if (ups_parse_protocol(ups, ups->parse_ctx.numargs, ups->parse_ctx.arglist)) {
+						time(&ups->last_heard_time);
+					}
+					continue;
 
-			case 0:
-				continue; /* no complete line yet */
+				case 0:
+					continue; /* no complete line yet */
 
-			default:
-				upsdebug_with_errno(2, "%s: [%s]: parse error on read data: %s",
-					__func__, ups->socketname, ups->parse_ctx.errmsg);
+				default:
+					upsdebug_with_errno(2, "%s: [%s]: parse error on read data: %s",
+						__func__, ups->socketname, ups->parse_ctx.errmsg);
 
-				return -1;
+					return -1;
+			}
 		}
+#ifndef WIN32
+		total += ret;
+	}
+
+	return total;
+#else	/* WIN32 */
 	}
 
 	return ret;
+#endif	/* WIN32 */
 }
 
 static void ups_disconnect(ups_device_t *ups)
@@ -942,6 +990,11 @@ static void ups_disconnect(ups_device_t *ups)
 	ups->flags = UPS_FLAG_NONE;
 
 	if (ups->conn) {
+#ifndef WIN32
+		if (VALID_FD(ups->conn->sockfd)) {
+			dstate_unwatch_fd(ups->conn->sockfd);
+		}
+#endif	/* !WIN32 */
 		upsdrvquery_close(ups->conn);
 		free(ups->conn);
 		ups->conn = NULL;
@@ -1542,11 +1595,13 @@ static void ups_promote_primary(ups_device_t *ups)
 	}
 
 	if (primary_ups) {
-		ups_demote_primary(primary_ups);
+		/* hands over the dstate, changing only what differs */
+		ups_demote_primary(primary_ups, ups);
+	} else {
+		ups->force_dstate_export = 1;
 	}
 
 	primary_ups = ups;
-	primary_ups->force_dstate_export = 1;
 
 	ups_set_flag(ups, UPS_FLAG_PRIMARY);
 
@@ -1558,7 +1613,7 @@ static void ups_promote_primary(ups_device_t *ups)
 	ups_export_dstate(primary_ups);
 }
 
-static void ups_demote_primary(ups_device_t *ups)
+static void ups_demote_primary(ups_device_t *ups, ups_device_t *next)
 {
 	last_primary_ups = ups;
 	primary_ups = NULL;
@@ -1570,7 +1625,11 @@ static void ups_demote_primary(ups_device_t *ups)
 		__func__, last_primary_ups->socketname,
 		NUT_STRARG(last_primary_ups->status), last_primary_ups->priority);
 
-	ups_clean_dstate(last_primary_ups);
+	if (next) {
+		ups_switch_dstate(last_primary_ups, next);
+	} else {
+		ups_clean_dstate(last_primary_ups);
+	}
 }
 
 static void ups_export_dstate(ups_device_t *ups)
@@ -1681,19 +1740,179 @@ static void ups_clean_dstate(const ups_device_t *ups)
 	status_commit();
 }
 
-static int ups_get_cmd_pos(const ups_device_t *ups, const char *cmd)
+/* Hand the dstate of the (previous) primary over to the next one: remove
+ * what only the former has and mark for export what the latter has or has
+ * differently, rather than removing and exporting everything again */
+static void ups_switch_dstate(const ups_device_t *from, ups_device_t *to)
 {
 	size_t i = 0;
+	int pos = -1;
 
-	for (i = 0; i < ups->cmd_count; ++i) {
-		if (!strcmp(ups->cmd_list[i]->value, cmd)) {
-			return i;
+	status_init();
+	alarm_init();
+
+	for (i = 0; i < from->cmd_count; ++i) {
+		if (ups_get_cmd_pos(to, from->cmd_list[i]->value) < 0) {
+			dstate_delcmd(from->cmd_list[i]->value);
+			upsdebugx(5, "%s: [%s]: removed command from dstate: [%s]",
+				__func__, from->socketname, from->cmd_list[i]->value);
+		}
+	}
+
+	for (i = 0; i < to->cmd_count; ++i) {
+		to->cmd_list[i]->needs_export = (ups_get_cmd_pos(from, to->cmd_list[i]->value) < 0);
+	}
+
+	for (i = 0; i < from->var_count; ++i) {
+		const ups_var_t *var = from->var_list[i];
+
+		/* flags, aux, enums and ranges are only ever added by the export */
+		pos = ups_get_var_pos(to, var->key);
+		if (pos < 0 || !ups_var_same(var, to->var_list[pos], 0)) {
+			dstate_delinfo(var->key);
+			upsdebugx(5, "%s: [%s]: removed variable from dstate: [%s]",
+				__func__, from->socketname, var->key);
+		}
+	}
+
+	for (i = 0; i < to->var_count; ++i) {
+		ups_var_t *var = to->var_list[i];
+
+		pos = ups_get_var_pos(from, var->key);
+
+		/* status and alarm were cleared above, so are always published */
+		var->needs_export = (pos < 0 || !ups_var_same(var, from->var_list[pos], 1)
+			|| !strcmp(var->key, "ups.status") || !strcmp(var->key, "ups.alarm"));
+	}
+
+	alarm_commit();
+	status_commit();
+
+	to->force_dstate_export = 0;
+
+	upsdebugx(4, "%s: [%s]: dstate handed over from [%s]",
+		__func__, to->socketname, from->socketname);
+}
+
+/* whether two variables carry the same flags, aux, enums, ranges (and value) */
+static int ups_var_same(const ups_var_t *var, const ups_var_t *other, int compare_value)
+{
+	size_t i = 0;
+
+	if (var->flags != other->flags || var->aux != other->aux
+	 || var->enum_count != other->enum_count || var->range_count != other->range_count) {
+		return 0;
+	}
+
+	if (compare_value && strcmp(var->value, other->value)) {
+		return 0;
+	}
+
+	for (i = 0; i < var->enum_count; ++i) {
+		if (strcmp(var->enum_list[i], other->enum_list[i])) {
+			return 0;
+		}
+	}
+
+	for (i = 0; i < var->range_count; ++i) {
+		if (var->range_list[i]->min != other->range_list[i]->min
+		 || var->range_list[i]->max != other->range_list[i]->max) {
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+static const char *ups_var_name(const ups_device_t *ups, size_t pos)
+{
+	return ups->var_list[pos]->key;
+}
+
+static const char *ups_cmd_name(const ups_device_t *ups, size_t pos)
+{
+	return ups->cmd_list[pos]->value;
+}
+
+/* position of the entry with this name in the indexed list, or -1 */
+static int name_index_find(const name_index_t *idx, const ups_device_t *ups, const char *name,
+	const char *(*name_at)(const ups_device_t *, size_t))
+{
+	size_t i = 0;
+
+	if (!idx->size) {
+		return -1;
+	}
+
+	for (i = str_hash_nocase(name) & (idx->size - 1); idx->slots[i]; i = (i + 1) & (idx->size - 1)) {
+		if (!strcmp(name_at(ups, idx->slots[i] - 1), name)) {
+			return (int)(idx->slots[i] - 1);
 		}
 	}
 
 	return -1;
 }
 
+static void name_index_insert(name_index_t *idx, const char *name, size_t pos)
+{
+	size_t i = str_hash_nocase(name) & (idx->size - 1);
+
+	while (idx->slots[i]) {
+		i = (i + 1) & (idx->size - 1);
+	}
+
+	idx->slots[i] = pos + 1;
+}
+
+/* index the entry just appended at pos, count being the new list length */
+static void name_index_add(name_index_t *idx, const ups_device_t *ups, size_t pos, size_t count,
+	const char *(*name_at)(const ups_device_t *, size_t))
+{
+	if (count * 2 > idx->size) {
+		name_index_rebuild(idx, ups, count, name_at);
+		return;
+	}
+
+	name_index_insert(idx, name_at(ups, pos), pos);
+}
+
+/* index the list afresh, e.g. after entries moved */
+static void name_index_rebuild(name_index_t *idx, const ups_device_t *ups, size_t count,
+	const char *(*name_at)(const ups_device_t *, size_t))
+{
+	size_t i = 0;
+
+	if (count * 2 > idx->size) {
+		size_t size = idx->size ? idx->size : 64;
+
+		while (count * 2 > size) {
+			size *= 2;
+		}
+
+		free(idx->slots);
+		idx->slots = xcalloc(size, sizeof(*idx->slots));
+		idx->size = size;
+	} else if (idx->size) {
+		memset(idx->slots, 0, idx->size * sizeof(*idx->slots));
+	}
+
+	for (i = 0; i < count; ++i) {
+		name_index_insert(idx, name_at(ups, i), i);
+	}
+}
+
+static void name_index_free(name_index_t *idx)
+{
+	free(idx->slots);
+	idx->slots = NULL;
+	idx->size = 0;
+}
+
+static int ups_get_cmd_pos(const ups_device_t *ups, const char *cmd)
+{
+	return name_index_find(&ups->cmd_index, ups, cmd, ups_cmd_name);
+}
+
 static int ups_add_cmd(ups_device_t *ups, const char *val)
 {
 	ups_cmd_t *new_cmd = NULL;
@@ -1714,6 +1933,7 @@ static int ups_add_cmd(ups_device_t *ups, const char *val)
 
 	ups->cmd_list[ups->cmd_count] = new_cmd;
 	ups->cmd_count++;
+	name_index_add(&ups->cmd_index, ups, ups->cmd_count - 1, ups->cmd_count, ups_cmd_name);
 
 	upsdebugx(5, "%s: [%s]: added to ups->cmd_list: [%s]",
 		__func__, ups->socketname, val);
@@ -1745,6 +1965,7 @@ static int ups_del_cmd(ups_device_t *ups, const char *val)
 
 		ups->cmd_list[ups->cmd_count - 1] = NULL;
 		ups->cmd_count--;
+		name_index_rebuild(&ups->cmd_index, ups, ups->cmd_count, ups_cmd_name);
 
 		if (ups->cmd_count == 0) {
 			free(ups->cmd_list);
@@ -1770,15 +1991,7 @@ static int ups_del_cmd(ups_device_t *ups, const char *val)
 
 static int ups_get_var_pos(const ups_device_t *ups, const char *key)
 {
-	size_t i = 0;
-
-	for (i = 0; i < ups->var_count; ++i) {
-		if (!strcmp(ups->var_list[i]->key, key)) {
-			return i;
-		}
-	}
-
-	return -1;
+	return name_index_find(&ups->var_index, ups, key, ups_var_name);
 }
 
 static int ups_set_var(ups_device_t *ups, const char *key, const char *value)
@@ -1819,6 +2032,7 @@ static int ups_set_var(ups_device_t *ups, const char *key, const char *value)
 
 	ups->var_list[ups->var_count] = new_var;
 	ups->var_count++;
+	name_index_add(&ups->var_index, ups, ups->var_count - 1, ups->var_count, ups_var_name);
 
 	upsdebugx(5, "%s: [%s]: stored in ups->var_list: [%s] : [%s]",
 		__func__, ups->socketname, key, value);
@@ -1866,6 +2080,7 @@ static int ups_del_var(ups_device_t *ups, const char *key)
 
 		ups->var_list[ups->var_count - 1] = NULL;
 		ups->var_count--;
+		name_index_rebuild(&ups->var_index, ups, ups->var_count, ups_var_name);
 
 		if (ups->var_count == 0) {
 			free(ups->var_list);
@@ -2197,6 +2412,8 @@ static void ups_free_ups_state(ups_device_t *ups)
 		ups->var_allocs = 0;
 	}
 
+	name_index_free(&ups->var_index);
+
 	if (ups->cmd_list) {
 		for (i = 0; i < ups->cmd_count; ++i) {
 			if (ups->cmd_list[i]) {
@@ -2215,6 +2432,8 @@ static void ups_free_ups_state(ups_device_t *ups)
 		ups->cmd_allocs = 0;
 	}
 
+	name_index_free(&ups->cmd_index);
+
 	if (ups->status) {
 		free(ups->status);
 		ups->status = NULL;
@@ -31,6 +31,7 @@
 #define SUBVAR_ALLOC_BATCH   10
 #define CMD_ALLOC_BATCH      20
 #define CONN_READ_TIMEOUT     3
+#define CONN_READ_DRAIN_MAX  16
 #define CONN_CMD_TIMEOUT      3
 #define ALARM_PROPAG_TIME    15
 
@@ -90,6 +91,11 @@ typedef struct {
 	int needs_export;
 } ups_cmd_t;
 
+typedef struct {
+	size_t *slots;	/* list position + 1 of an entry, 0 if free */
+	size_t size;	/* power of 2, at least twice the list length */
+} name_index_t;
+
 typedef struct {
 	char **have_any;
 	size_t have_any_count;
@@ -118,6 +124,9 @@ typedef struct {
 	size_t cmd_count;
 	size_t cmd_allocs;
 
+	name_index_t var_index;
+	name_index_t cmd_index;
+
 	char *status;
 
 	time_t last_heard_time;
@@ -31,7 +31,7 @@
 #endif
 
 #define DRIVER_NAME	"GPIO UPS driver (API " WITH_LIBGPIO_VERSION_STR ")"
-#define DRIVER_VERSION	"1.04"
+#define DRIVER_VERSION	"1.05"
 
 /* driver description structure */
 upsdrv_info_t upsdrv_info = {
@@ -43,6 +43,8 @@ upsdrv_info_t upsdrv_info = {
 };
 
 static void reserve_lines_libgpiod(struct gpioups_t *gpioupsfd, int inner);
+static void events_open_libgpiod(struct gpioups_t *gpioupsfdlocal);
+static void events_read_libgpiod(struct gpioups_t *gpioupsfdlocal);
 
 /*	CyberPower 12V open collector state definitions
 	0 ON BATTERY			Low when operating from utility line
@@ -116,6 +118,109 @@ static void reserve_lines_libgpiod(struct gpioups_t *gpioupsfdlocal, int inner)
 	}
 }
 
+/*
+ * with the lines held for the driver lifetime, have their edge events
+ * wake the main loop (through extrafd) so that line changes are seen
+ * at once rather than at the next poll; if that is not possible, the
+ * lines are just polled
+ */
+static void events_open_libgpiod(struct gpioups_t *gpioupsfdlocal) {
+	struct libgpiod_data_t *libgpiod_data = (struct libgpiod_data_t *)(gpioupsfdlocal->lib_data);
+#if WITH_LIBGPIO_VERSION < 0x00020000
+	unsigned int j;
+
+	/* one fd per line: gather them in an epoll fd, readable if any is */
+	libgpiod_data->eventFd = epoll_create1(EPOLL_CLOEXEC);
+	if(libgpiod_data->eventFd < 0) {
+		upsdebug_with_errno(1, "events_open_libgpiod: epoll_create1 failed, lines will be polled");
+		gpioupsfdlocal->runOptions &= ~ROPT_EVMODE;
+		return;
+	}
+	for(j=0; j < gpiod_line_bulk_num_lines(&libgpiod_data->gpioLines); j++) {
+		struct epoll_event ev;
+		int lineFd = gpiod_line_event_get_fd(gpiod_line_bulk_get_line(&libgpiod_data->gpioLines, j));
+
+		memset(&ev, 0, sizeof(ev));
+		ev.events = EPOLLIN;
+		ev.data.fd = lineFd;
+		if(lineFd < 0 || epoll_ctl(libgpiod_data->eventFd, EPOLL_CTL_ADD, lineFd, &ev) < 0) {
+			upsdebug_with_errno(1, "events_open_libgpiod: no event fd for line %u, lines will be polled", j);
+			close(libgpiod_data->eventFd);
+			libgpiod_data->eventFd = -1;
+			gpioupsfdlocal->runOptions &= ~ROPT_EVMODE;
+			return;
+		}
+	}
+#else	/* #if WITH_LIBGPIO_VERSION >= 0x00020000 */
+	libgpiod_data->eventFd = gpiod_line_request_get_fd(libgpiod_data->request);
+	libgpiod_data->eventBuffer = gpiod_edge_event_buffer_new(NUT_GPIO_EVENTBUF);
+	if(libgpiod_data->eventFd < 0 || !libgpiod_data->eventBuffer) {
+		upsdebugx(1, "events_open_libgpiod: no edge event fd, lines will be polled");
+		libgpiod_data->eventFd = -1;
+		gpioupsfdlocal->runOptions &= ~ROPT_EVMODE;
+		return;
+	}
+#endif	/* WITH_LIBGPIO_VERSION */
+
+	extrafd = libgpiod_data->eventFd;
+	upsdebugx(5, "events_open_libgpiod: line events on fd %d", libgpiod_data->eventFd);
+}
+
+/*
+ * consume the pending edge events (without waiting), so that the event
+ * fd does not keep waking the main loop; the states are then read anew
+ */
+static void events_read_libgpiod(struct gpioups_t *gpioupsfdlocal) {
+	struct libgpiod_data_t *libgpiod_data = (struct libgpiod_data_t *)(gpioupsfdlocal->lib_data);
+#if WITH_LIBGPIO_VERSION < 0x00020000
+	unsigned int j;
+
+	for(j=0; j < gpiod_line_bulk_num_lines(&libgpiod_data->gpioLines); j++) {
+		struct gpiod_line *eLine = gpiod_line_bulk_get_line(&libgpiod_data->gpioLines, j);
+		struct pollfd pfd;
+
+		pfd.fd = gpiod_line_event_get_fd(eLine);
+		pfd.events = POLLIN;
+		pfd.revents = 0;
+		while(pfd.fd >= 0 && poll(&pfd, 1, 0) > 0 && (pfd.revents & POLLIN)) {
+			struct gpiod_line_event event;
+
+			if(gpiod_line_event_read_fd(pfd.fd, &event) < 0)
+				break;
+			upsdebugx(5,
+				"Event type %d for line %u",
+				event.event_type,
+				gpiod_line_offset(eLine)
+			);
+			pfd.revents = 0;
+		}
+	}
+#else	/* #if WITH_LIBGPIO_VERSION >= 0x00020000 */
+	while(gpiod_line_request_wait_edge_events(libgpiod_data->request, 0) > 0) {
+		int eventsRead = gpiod_line_request_read_edge_events(
+			libgpiod_data->request,
+			libgpiod_data->eventBuffer,
+			NUT_GPIO_EVENTBUF
+		);
+		int j;
+
+		if(eventsRead <= 0)
+			break;
+		for(j=0; j < eventsRead; j++) {
+			struct gpiod_edge_event *event = gpiod_edge_event_buffer_get_event(
+				libgpiod_data->eventBuffer,
+				(unsigned long)j
+			);
+			upsdebugx(5,
+				"Event type %d for line %u",
+				(int)gpiod_edge_event_get_event_type(event),
+				gpiod_edge_event_get_line_offset(event)
+			);
+		}
+	}
+#endif	/* WITH_LIBGPIO_VERSION */
+}
+
 /*
  * allocate memeory for libary, open gpiochip
  * and check lines numbers validity - consistency with h/w chip
@@ -123,6 +228,7 @@ static void reserve_lines_libgpiod(struct gpioups_t *gpioupsfdlocal, int inner)
 void gpio_open(struct gpioups_t *gpioupsfdlocal) {
 	struct libgpiod_data_t *libgpiod_data = xcalloc(1, sizeof(struct libgpiod_data_t));
 	gpioupsfdlocal->lib_data = libgpiod_data;
+	libgpiod_data->eventFd = -1;
 
 #if WITH_LIBGPIO_VERSION < 0x00020000
 	libgpiod_data->gpioChipHandle = gpiod_chip_open_by_name(gpioupsfdlocal->chipName);
@@ -211,7 +317,14 @@ void gpio_open(struct gpioups_t *gpioupsfdlocal) {
 				gpioRc
 			);
 		upsdebugx(5, "GPIO gpiod_chip_get_lines return code %d", gpioRc);
+		/* lines held for the driver lifetime are watched for edge events */
+		if(!(gpioupsfdlocal->runOptions&ROPT_REQRES)) {
+			gpioupsfdlocal->runOptions |= ROPT_EVMODE;
+		}
 		reserve_lines_libgpiod(gpioupsfdlocal, 0);
+		if(gpioupsfdlocal->runOptions&ROPT_EVMODE) {
+			events_open_libgpiod(gpioupsfdlocal);
+		}
 
 #if WITH_LIBGPIO_VERSION >= 0x00020000
 	gpioRc=gpiod_line_request_get_values(libgpiod_data->request, gpioupsfdlocal->upsLinesStates);
@@ -232,7 +345,17 @@ void gpio_close(struct gpioups_t *gpioupsfdlocal) {
 	if(gpioupsfdlocal) {
 		struct libgpiod_data_t *libgpiod_data = (struct libgpiod_data_t *)(gpioupsfdlocal->lib_data);
 		if(libgpiod_data) {
-#if WITH_LIBGPIO_VERSION >= 0x00020000
+			if(libgpiod_data->eventFd >= 0 && extrafd == libgpiod_data->eventFd) {
+				extrafd = ERROR_FD;
+			}
+#if WITH_LIBGPIO_VERSION < 0x00020000
+			if(libgpiod_data->eventFd >= 0) {
+				close(libgpiod_data->eventFd);
+			}
+#else	/* #if WITH_LIBGPIO_VERSION >= 0x00020000 */
+			if(libgpiod_data->eventBuffer) {
+				gpiod_edge_event_buffer_free(libgpiod_data->eventBuffer);
+			}
 			if(libgpiod_data->values) {
 				free(libgpiod_data->values);
 			}
@@ -259,64 +382,7 @@ void gpio_get_lines_states(struct gpioups_t *gpioupsfdlocal) {
 	reserve_lines_libgpiod(gpioupsfdlocal, 1);
 
 	if(gpioupsfdlocal->runOptions&ROPT_EVMODE) {
-#if WITH_LIBGPIO_VERSION < 0x00020000
-		struct timespec timeoutLong = {1,0};
-		struct gpiod_line_event event;
-		int monRes;
-		upsdebugx(5,
-			"gpio_get_lines_states_libgpiod initial %d, timeout %ld",
-			gpioupsfdlocal->initial,
-			timeoutLong.tv_sec
-		);
-		if(gpioupsfdlocal->initial) {
-			timeoutLong.tv_sec = 35;
-		} else {
-			gpioupsfdlocal->initial = 1;
-		}
-		upsdebugx(5,
-			"gpio_get_lines_states_libgpiod initial %d, timeout %ld",
-			gpioupsfdlocal->initial,
-			timeoutLong.tv_sec
-		);
-		gpiod_line_bulk_init(&libgpiod_data->gpioEventLines);
-		monRes=gpiod_line_event_wait_bulk(
-			&libgpiod_data->gpioLines,
-			&timeoutLong,
-			&libgpiod_data->gpioEventLines
-		);
-		upsdebugx(5,
-			"gpiod_line_event_wait_bulk completed with %d return code and timeout %ld s",
-			monRes,
-			timeoutLong.tv_sec
-		);
-		if(monRes==1) {
-			int num_lines_local = (int)gpiod_line_bulk_num_lines(&libgpiod_data->gpioEventLines);
-			int j;
-			for(j=0; j<num_lines_local; j++) {
-				struct gpiod_line *eLine = gpiod_line_bulk_get_line(
-					&libgpiod_data->gpioEventLines,
-					j
-				);
-				int eventRc = gpiod_line_event_read(eLine, &event);
-				unsigned int lineOffset = gpiod_line_offset(eLine);
-				event.event_type=0;
-				upsdebugx(5,
-					"Event read return code %d and event type %d for line %u",
-					eventRc,
-					event.event_type,
-					lineOffset
-				);
-			}
-		}
-#else	/* #if WITH_LIBGPIO_VERSION >= 0x00020000 */
-		int64_t poll_timeout = 1000000000;	//	in nanoseconds
-		if(gpioupsfdlocal->initial) {
-			poll_timeout = 35000000000;
-		} else {
-			gpioupsfdlocal->initial = 1;
-		}
-		gpioRc = gpiod_line_request_wait_edge_events(libgpiod_data->request, poll_timeout);
-#endif	/* WITH_LIBGPIO_VERSION */
+		events_read_libgpiod(gpioupsfdlocal);
 	}
 	for(i=0; i < gpioupsfdlocal->upsLinesCount; i++) {
 		gpioupsfdlocal->upsLinesStates[i] = -1;
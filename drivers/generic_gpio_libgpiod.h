@@ -25,9 +25,16 @@
 
 #include <gpiod.h>
 #include <poll.h>
+#if WITH_LIBGPIO_VERSION < 0x00020000
+# include <sys/epoll.h>
+#endif
+
+/*  edge events read at once (libgpiod v2) */
+#define NUT_GPIO_EVENTBUF	16
 
 typedef struct libgpiod_data_t {
 	struct gpiod_chip	*gpioChipHandle;	/* libgpiod chip handle when opened */
+	int	eventFd;	/* fd readable on line edge events (set as extrafd), or -1 */
 #if WITH_LIBGPIO_VERSION < 0x00020000
 	struct gpiod_line_bulk	gpioLines;	/* libgpiod lines to monitor */
 	struct gpiod_line_bulk	gpioEventLines;	/* libgpiod lines for event monitoring */
@@ -36,6 +43,7 @@ typedef struct libgpiod_data_t {
 	struct gpiod_request_config *config;
 	struct gpiod_line_request *request;
 	enum gpiod_line_value *values;
+	struct gpiod_edge_event_buffer *eventBuffer;
 #endif	/* WITH_LIBGPIO_VERSION */
 } libgpiod_data;
 
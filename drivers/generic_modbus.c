@@ -31,7 +31,7 @@
 #endif
 
 #define DRIVER_NAME	"NUT Generic Modbus driver (libmodbus link type: " NUT_MODBUS_LINKTYPE_STR ")"
-#define DRIVER_VERSION	"0.07"
+#define DRIVER_VERSION	"0.08"
 
 /* variables */
 static modbus_t *mbctx = NULL;                             /* modbus memory context */
@@ -46,11 +46,26 @@ static int ser_data_bit = DATA_BIT;                        /* serial port data b
 static int ser_stop_bit = STOP_BIT;                        /* serial port stop bit */
 static int rio_slave_id = MODBUS_SLAVE_ID;                 /* set device ID to default value */
 static int FSD_pulse_duration = SHTDOWN_PULSE_DURATION;    /* set the FSD pulse duration */
+static int read_max_gap = READ_MAX_GAP;                    /* max unused addresses in a read block */
+static int read_max_block = READ_MAX_BLOCK;                /* max addresses in a read block */
 static uint32_t mod_resp_to_s = MODRESP_TIMEOUT_s;         /* set the modbus response time out (s) */
 static uint32_t mod_resp_to_us = MODRESP_TIMEOUT_us;       /* set the modbus response time out (us) */
 static uint32_t mod_byte_to_s = MODBYTE_TIMEOUT_s;         /* set the modbus byte time out (us) */
 static uint32_t mod_byte_to_us = MODBYTE_TIMEOUT_us;       /* set the modbus byte time out (us) */
 
+/* reads of the state signals in blocks, see plan_reads() */
+struct rblock {
+	regtype_t type;     /* register type */
+	int addr;           /* first address */
+	int count;          /* number of registers or bits */
+};
+typedef struct rblock rblock_t;
+
+static rblock_t rblocks[NUMOF_SIG_STATES];                 /* blocks to read at each update */
+static int nrblocks = 0;
+static int sigval[NUMOF_SIG_STATES];                       /* signal states got by read_signals(), -1 on error */
+static int sigval_fresh = 0;                               /* sigval is from this update */
+
 /* get config vars set by -x or defined in ups.conf driver section */
 void get_config_vars(void);
 
@@ -69,6 +84,12 @@ int upscmd(const char *cmd, const char *arg);
 /* read signal status */
 int get_signal_state(devstate_t state);
 
+/* plan the reads of the mapped signals in blocks */
+static void plan_reads(void);
+
+/* read all the mapped signals for this update */
+static void read_signals(void);
+
 /* count the time elapsed since start */
 long time_elapsed(struct timeval *start);
 
@@ -116,6 +137,7 @@ void upsdrv_initups(void)
 	upsdebugx(2, "upsdrv_initups");
 
 	get_config_vars();
+	plan_reads();
 
 	/* open communication port */
 	mbctx = modbus_new(device_path);
@@ -193,6 +215,9 @@ void upsdrv_updateinfo(void)
 	status_init();      /* initialize ups.status update */
 	alarm_init();       /* initialize ups.alarm update */
 
+	/* get the state of all the signals at once */
+	read_signals();
+
 	/*
 	 * update UPS status regarding MAINS state either via OL | OB.
 	 * if both statuses are mapped to contacts then only OL is evaluated.
@@ -310,6 +335,8 @@ void upsdrv_updateinfo(void)
 		}
 	}
 
+	sigval_fresh = 0;
+
 	/* check for communication errors */
 	if (errcnt == 0) {
 		alarm_commit();
@@ -389,6 +416,8 @@ void upsdrv_makevartable(void)
 	addvar(VAR_VALUE, "DISCHRG_noro", "NO/NC configuration for DISCHRG state");
 	addvar(VAR_VALUE, "FSD_noro", "NO/NC configuration for FSD state");
 	addvar(VAR_VALUE, "FSD_pulse_duration", "FSD pulse duration");
+	addvar(VAR_VALUE, "read_max_gap", "max unused addresses between signals read at once");
+	addvar(VAR_VALUE, "read_max_block", "max addresses read at once (1: each signal on its own)");
 }
 
 /* close modbus connection and free modbus context allocated memory */
@@ -682,10 +711,16 @@ int upscmd(const char *cmd, const char *arg)
 int get_signal_state(devstate_t state)
 {
 	int rval = -1;
-	int reg_val;
+	int reg_val = 0;
 	regtype_t rtype = 0;    /* register type */
 	int addr = -1;          /* register address */
 
+	/* already read with the others for this update */
+	if (sigval_fresh && state != FSD_T && sigar[state].addr != NOTUSED) {
+		upsdebugx(3, "get_signal_state: state: %d", sigval[state]);
+		return sigval[state];
+	}
+
 	/* assign register address and type  */
 	switch (state) {
 		case OL_T:
@@ -747,6 +782,163 @@ int get_signal_state(devstate_t state)
 	return rval;
 }
 
+/* the mapped signals to read at each update (all but FSD, which is written) */
+static int signal_polled(int i)
+{
+	return (i != FSD_T && sigar[i].addr != NOTUSED);
+}
+
+/*
+ * merge the reads of the signals of a register type in blocks covering
+ * their addresses, with at most read_max_gap unused addresses between two
+ * of them, and read_max_block addresses per block
+ */
+static void plan_reads(void)
+{
+	int order[NUMOF_SIG_STATES];
+	int n = 0, i, j;
+
+	for (i = 0; i < NUMOF_SIG_STATES; i++) {
+		if (!signal_polled(i)) {
+			continue;
+		}
+
+		/* sort by register type and address */
+		for (j = n; j > 0; j--) {
+			sigattr_t *prev = &sigar[order[j - 1]];
+			if (prev->type < sigar[i].type
+			 || (prev->type == sigar[i].type && prev->addr <= sigar[i].addr)
+			) {
+				break;
+			}
+			order[j] = order[j - 1];
+		}
+		order[j] = i;
+		n++;
+	}
+
+	nrblocks = 0;
+	for (i = 0; i < n; i++) {
+		sigattr_t *sig = &sigar[order[i]];
+		rblock_t *blk = nrblocks ? &rblocks[nrblocks - 1] : NULL;
+
+		if (blk != NULL
+		 && blk->type == sig->type
+		 && sig->addr <= blk->addr + blk->count + read_max_gap
+		 && sig->addr - blk->addr < read_max_block
+		) {
+			if (sig->addr >= blk->addr + blk->count) {
+				blk->count = sig->addr - blk->addr + 1;
+			}
+			continue;
+		}
+
+		blk = &rblocks[nrblocks++];
+		blk->type = sig->type;
+		blk->addr = sig->addr;
+		blk->count = 1;
+	}
+
+	for (i = 0; i < nrblocks; i++) {
+		upsdebugx(2, "read block %d: addr:0x%x, count:%d, type:%u",
+			i, (unsigned int)rblocks[i].addr, rblocks[i].count, rblocks[i].type);
+	}
+}
+
+/* read the signals of block <blk> one by one */
+static void read_block_signals(const rblock_t *blk)
+{
+	int i, reg_val;
+
+	for (i = 0; i < NUMOF_SIG_STATES; i++) {
+		if (!signal_polled(i)
+		 || sigar[i].type != blk->type
+		 || sigar[i].addr < blk->addr
+		 || sigar[i].addr >= blk->addr + blk->count
+		) {
+			continue;
+		}
+
+		reg_val = 0;
+		sigval[i] = (register_read(mbctx, sigar[i].addr, sigar[i].type, &reg_val) == -1) ? -1 : reg_val;
+	}
+}
+
+/* read block <blk> and decode the signals in it */
+static void read_block(const rblock_t *blk)
+{
+	uint16_t regs[READ_MAX_BLOCK_LIMIT];
+	uint8_t bits[READ_MAX_BLOCK_LIMIT];
+	int rval = -1, i, off;
+
+	if (blk->count == 1) {
+		read_block_signals(blk);
+		return;
+	}
+
+	if (blk->type == COIL) {
+		rval = modbus_read_bits(mbctx, blk->addr, blk->count, bits);
+	} else if (blk->type == INPUT_B) {
+		rval = modbus_read_input_bits(mbctx, blk->addr, blk->count, bits);
+	} else if (blk->type == INPUT_R) {
+		rval = modbus_read_input_registers(mbctx, blk->addr, blk->count, regs);
+	} else {
+		rval = modbus_read_registers(mbctx, blk->addr, blk->count, regs);
+	}
+
+	if (rval != blk->count) {
+		upsdebugx(2, "read_block: addr:0x%x, count:%d: error(%s), reading its signals one by one",
+			(unsigned int)blk->addr, blk->count, modbus_strerror(errno));
+
+		/* the device does not take reads of several registers */
+		if (rval == -1 && (errno == EMBXILADD || errno == EMBXILVAL)) {
+			upslogx(LOG_NOTICE, "Device rejects reads of %d addresses at once, "
+				"reading each state signal on its own from now on", blk->count);
+			read_max_block = 1;
+			plan_reads();
+		}
+
+		read_block_signals(blk);
+		return;
+	}
+
+	for (i = 0; i < NUMOF_SIG_STATES; i++) {
+		if (!signal_polled(i)
+		 || sigar[i].type != blk->type
+		 || sigar[i].addr < blk->addr
+		 || sigar[i].addr >= blk->addr + blk->count
+		) {
+			continue;
+		}
+
+		/* same masks as register_read() */
+		off = sigar[i].addr - blk->addr;
+		sigval[i] = (blk->type == COIL || blk->type == INPUT_B)
+			? (bits[off] & 0x0F) : (regs[off] & 0x00FF);
+		upsdebugx(3, "register addr: 0x%x, register type: %u read: %d",
+			(unsigned int)sigar[i].addr, sigar[i].type, sigval[i]);
+	}
+}
+
+static void read_signals(void)
+{
+	rblock_t blocks[NUMOF_SIG_STATES];
+	int i, n = nrblocks;
+
+	/* a block rejected by the device makes a new plan: go on with this one */
+	memcpy(blocks, rblocks, sizeof(blocks));
+
+	for (i = 0; i < NUMOF_SIG_STATES; i++) {
+		sigval[i] = -1;
+	}
+
+	for (i = 0; i < n; i++) {
+		read_block(&blocks[i]);
+	}
+
+	sigval_fresh = 1;
+}
+
 /* get driver configuration parameters */
 void get_config_vars(void)
 {
@@ -1011,6 +1203,25 @@ void get_config_vars(void)
 	}
 	upsdebugx(2, "FSD_pulse_duration %d", FSD_pulse_duration);
 
+	/* check if read block limits are set and get the values */
+	if (testvar("read_max_gap")) {
+		read_max_gap = (int)strtol(getval("read_max_gap"), NULL, 10);
+		if (read_max_gap < 0) {
+			read_max_gap = 0;
+		}
+	}
+	upsdebugx(2, "read_max_gap %d", read_max_gap);
+
+	if (testvar("read_max_block")) {
+		read_max_block = (int)strtol(getval("read_max_block"), NULL, 10);
+	}
+	if (read_max_block < 1) {
+		read_max_block = 1;
+	} else if (read_max_block > READ_MAX_BLOCK_LIMIT) {
+		read_max_block = READ_MAX_BLOCK_LIMIT;
+	}
+	upsdebugx(2, "read_max_block %d", read_max_block);
+
 	/* debug loop over signal array */
 	for (i = 0; i < NUMOF_SIG_STATES; i++) {
 		if (sigar[i].addr != NOTUSED) {
@@ -46,6 +46,15 @@
 /* modbus access parameters */
 #define MODBUS_SLAVE_ID 5
 
+/*
+ * reads of the state signals merged in blocks of registers or bits
+ * of a type: unused addresses between two signals of a block, and
+ * addresses per block (1: a read per signal)
+ */
+#define READ_MAX_GAP 0
+#define READ_MAX_BLOCK 32
+#define READ_MAX_BLOCK_LIMIT 125	/* MODBUS_MAX_READ_REGISTERS */
+
 /* shutdown repeat on error */
 #define FSD_REPEAT_CNT 3
 
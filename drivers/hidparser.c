@@ -478,6 +478,122 @@ int FindObject(HIDDesc_t *pDesc_arg, HIDData_t *pData)
 	return 1;
 }
 
+/*
+ * Index_Hash
+ * Hash (FNV-1a) of a Type and the first Size Nodes of a Path
+ * -------------------------------------------------------------------------- */
+static uint32_t Index_Hash(const HIDNode_t *Node, uint8_t Size, uint8_t Type)
+{
+	size_t	hash = fnv1a_hash(FNV1A_INIT, &Type, 1);
+
+	hash = fnv1a_hash(hash, &Size, 1);
+
+	return (uint32_t)fnv1a_hash(hash, Node, Size * sizeof(*Node));
+}
+
+/*
+ * Index_Slot
+ * Find the slot of the index for a Type and the first Size Nodes of a
+ * Path: the one in use for them, or the free one where they would go.
+ * -------------------------------------------------------------------------- */
+static HIDIndex_t *Index_Slot(HIDDesc_t *pDesc_arg, const HIDNode_t *Node, uint8_t Size, uint8_t Type, uint32_t hash)
+{
+	size_t	mask = pDesc_arg->indexsize - 1, i;
+
+	for (i = hash & mask; ; i = (i + 1) & mask) {
+		HIDIndex_t	*pSlot = &pDesc_arg->index[i];
+
+		if (!pSlot->item) {
+			return pSlot;
+		}
+
+		if (pSlot->hash == hash && pSlot->Size == Size && pSlot->Type == Type
+		 && !memcmp(pDesc_arg->item[pSlot->item - 1].Path.Node, Node, Size * sizeof(HIDNode_t))
+		) {
+			return pSlot;
+		}
+	}
+}
+
+/*
+ * Index_Grow
+ * Double the slots of the index. Return 0 if out of memory.
+ * -------------------------------------------------------------------------- */
+static int Index_Grow(HIDDesc_t *pDesc_arg)
+{
+	HIDIndex_t	*old = pDesc_arg->index;
+	size_t	oldsize = pDesc_arg->indexsize, i;
+
+	pDesc_arg->indexsize = oldsize ? oldsize * 2 : 256;
+	pDesc_arg->index = calloc(pDesc_arg->indexsize, sizeof(*pDesc_arg->index));
+	if (!pDesc_arg->index) {
+		pDesc_arg->index = old;
+		pDesc_arg->indexsize = oldsize;
+		return 0;
+	}
+
+	for (i = 0; i < oldsize; i++) {
+		HIDIndex_t	*pSlot;
+
+		if (!old[i].item) {
+			continue;
+		}
+
+		pSlot = Index_Slot(pDesc_arg, pDesc_arg->item[old[i].item - 1].Path.Node,
+			old[i].Size, old[i].Type, old[i].hash);
+		*pSlot = old[i];
+	}
+
+	free(old);
+	return 1;
+}
+
+/*
+ * Index_Build
+ * Make the hash index of the items of a parsed report descriptor, for
+ * FindObject_with_Path(). That function returns the first item of the
+ * Type whose Path begins with the Nodes it is given, so each item is
+ * entered for every leading part of its Path (where no item before it
+ * was). Without the index (out of memory), lookups search the items.
+ * -------------------------------------------------------------------------- */
+static void Index_Build(HIDDesc_t *pDesc_arg)
+{
+	size_t	i;
+
+	for (i = 0; i < pDesc_arg->nitems; i++) {
+		HIDData_t	*pData = &pDesc_arg->item[i];
+		uint8_t	size;
+
+		for (size = 0; size <= PATH_SIZE; size++) {
+			uint32_t	hash = Index_Hash(pData->Path.Node, size, pData->Type);
+			HIDIndex_t	*pSlot;
+
+			if ((pDesc_arg->indexused + 1) * 2 > pDesc_arg->indexsize) {
+				if (!Index_Grow(pDesc_arg)) {
+					free(pDesc_arg->index);
+					pDesc_arg->index = NULL;
+					pDesc_arg->indexsize = pDesc_arg->indexused = 0;
+					return;
+				}
+			}
+
+			pSlot = Index_Slot(pDesc_arg, pData->Path.Node, size, pData->Type, hash);
+			if (pSlot->item) {
+				continue;
+			}
+
+			pSlot->hash = hash;
+			pSlot->Size = size;
+			pSlot->Type = pData->Type;
+			pSlot->item = i + 1;
+			pDesc_arg->indexused++;
+		}
+	}
+
+	upsdebugx(5, "%s: %" PRIuSIZE " HID objects indexed in %" PRIuSIZE " slots",
+		__func__, pDesc_arg->nitems, pDesc_arg->indexsize);
+}
+
 /*
  * FindObject_with_Path
  * Get pData item with given Path and Type. Return NULL if not found.
@@ -486,6 +602,13 @@ HIDData_t *FindObject_with_Path(HIDDesc_t *pDesc_arg, HIDPath_t *Path, uint8_t T
 {
 	size_t	i;
 
+	if (pDesc_arg->index && Path->Size <= PATH_SIZE) {
+		HIDIndex_t	*pSlot = Index_Slot(pDesc_arg, Path->Node, Path->Size, Type,
+			Index_Hash(Path->Node, Path->Size, Type));
+
+		return pSlot->item ? &pDesc_arg->item[pSlot->item - 1] : NULL;
+	}
+
 	for (i = 0; i < pDesc_arg->nitems; i++) {
 		HIDData_t *pData = &pDesc_arg->item[i];
 
@@ -764,6 +887,38 @@ HIDDesc_t *Parse_ReportDesc(const usb_ctrl_charbuf ReportDesc, const usb_ctrl_ch
 
 	pDesc_var->item = realloc(pDesc_var->item, pDesc_var->nitems * sizeof(*pDesc_var->item));
 
+	Index_Build(pDesc_var);
+
+	return pDesc_var;
+}
+
+/* make a report descriptor of <nitems> items parsed before (copied from
+ * <item>), with the report lengths <replen> of each report ID */
+HIDDesc_t *New_ReportDesc(const HIDData_t *item, size_t nitems, const size_t *replen)
+{
+	HIDDesc_t	*pDesc_var;
+
+	if (!item || nitems == 0 || nitems > MAX_REPORT) {
+		return NULL;
+	}
+
+	pDesc_var = calloc(1, sizeof(*pDesc_var));
+	if (!pDesc_var) {
+		return NULL;
+	}
+
+	pDesc_var->item = calloc(nitems, sizeof(*pDesc_var->item));
+	if (!pDesc_var->item) {
+		Free_ReportDesc(pDesc_var);
+		return NULL;
+	}
+
+	memcpy(pDesc_var->item, item, nitems * sizeof(*pDesc_var->item));
+	memcpy(pDesc_var->replen, replen, sizeof(pDesc_var->replen));
+	pDesc_var->nitems = nitems;
+
+	Index_Build(pDesc_var);
+
 	return pDesc_var;
 }
 
@@ -775,5 +930,6 @@ void Free_ReportDesc(HIDDesc_t *pDesc_arg)
 	}
 
 	free(pDesc_arg->item);
+	free(pDesc_arg->index);
 	free(pDesc_arg);
 }
@@ -56,6 +56,11 @@ extern "C" {
  * -------------------------------------------------------------------------- */
 HIDDesc_t *Parse_ReportDesc(const usb_ctrl_charbuf ReportDesc, const usb_ctrl_charbufsize n);
 
+/*
+ * New_ReportDesc
+ * -------------------------------------------------------------------------- */
+HIDDesc_t *New_ReportDesc(const HIDData_t *item, size_t nitems, const size_t *replen);
+
 /*
  * Free_ReportDesc
  * -------------------------------------------------------------------------- */
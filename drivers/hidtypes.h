@@ -315,8 +315,32 @@ typedef struct {
 	long		PhyMax;				/* Physical Max			*/
 	int8_t		have_PhyMin;			/* Physical Min defined?		*/
 	int8_t		have_PhyMax;			/* Physical Max defined?		*/
+
+	/* Conversion of the logical values to physical ones in the units of
+	 * NUT, computed by libhid on first use (clear have_Conv when any of
+	 * the above changes afterwards) */
+	int8_t		have_Conv;			/* Conv* below computed?		*/
+	int8_t		ConvRange;			/* physical range, clamped to?	*/
+	double		ConvUnit;			/* 10^exponent of the unit		*/
+	double		ConvScale;			/* physical = logical * ConvScale	*/
+	double		ConvOffset;			/*	+ ConvOffset			*/
+	double		ConvMin;			/* physical range, in units		*/
+	double		ConvMax;
+	double		ConvInv;			/* logical per physical step		*/
 } HIDData_t;
 
+/*
+ * HIDIndex struct
+ *
+ * Slot of the hash index of the items by Type and (leading part of) Path
+ * -------------------------------------------------------------------------- */
+typedef struct {
+	uint32_t	hash;				/* of Type, Size and the Nodes	*/
+	uint8_t		Size;				/* Nodes of the Path matched	*/
+	uint8_t		Type;				/* FEATURE / INPUT / OUTPUT		*/
+	size_t		item;				/* 1 + index in item[], 0 if free	*/
+} HIDIndex_t;
+
 /*
  * HIDDesc struct
  *
@@ -326,6 +350,9 @@ typedef struct {
 	size_t		nitems;				/* number of items in descriptor */
 	HIDData_t	*item;				/* list of items			*/
 	size_t		replen[256];		/* list of report lengths, in byte */
+	HIDIndex_t	*index;				/* hash index of the items (or NULL) */
+	size_t		indexsize;			/* slots in index, a power of 2	*/
+	size_t		indexused;			/* slots in use			*/
 } HIDDesc_t;
 
 #ifdef __cplusplus
@@ -37,7 +37,7 @@
 #define BATTERY_CHARGE_LOW                  15
 
 #define DRIVER_NAME                         "hwmon-INA219 UPS driver"
-#define DRIVER_VERSION                      "0.03"
+#define DRIVER_VERSION                      "0.04"
 
 upsdrv_info_t upsdrv_info = {
 	DRIVER_NAME,
@@ -79,6 +79,30 @@ static int voltage = 0;
  */
 static int current = 0;
 
+/**
+ * @brief Attribute of the hwmon device read at each poll.
+ */
+struct ina219_attr {
+	const char *name;
+	int *value;
+	int fd;
+};
+
+/**
+ * @brief Attributes kept open (and read with pread) from discovery until
+ * an error, which is when the device is discovered again.
+ */
+static struct ina219_attr ina219_attrs[] = {
+	{ "in1_input", &voltage, -1 },
+	{ "curr1_input", &current, -1 },
+	{ NULL, NULL, -1 }
+};
+
+/**
+ * @brief Directory scanned for the device when port=auto.
+ */
+static const char *ina219_hwmon_dir = SYSFS_HWMON_DIR;
+
 static int file_contains(const char *path, const char *text)
 {
 	FILE *f;
@@ -103,27 +127,21 @@ static int file_contains(const char *path, const char *text)
 	return 1;
 }
 
-static int file_read_number(const char *path, int *value)
+static int fd_read_number(int fd, int *value)
 {
 	char buf[128];
 	ssize_t ret;
-	int fd;
 
-	if ((fd = open(path, O_RDONLY)) < 0)
+	/* sysfs gives the whole (new) value again when read from the start */
+	if ((ret = pread(fd, buf, sizeof(buf) - 1, 0)) < 0)
 		return -errno;
 
-	if ((ret = pread(fd, buf, sizeof(buf), 0)) < 0) {
-		const int _e = -errno;
-		close(fd);
-		return _e;
-	}
-	else {
-		close(fd);
+	if (ret == 0)
+		return -ENODATA;
 
-		buf[ret] = '\0';
-		*value = atoi(buf);
-		return 0;
-	}
+	buf[ret] = '\0';
+	*value = atoi(buf);
+	return 0;
 }
 
 static int detect_ina219(const char *ina219_dir)
@@ -199,37 +217,77 @@ static int scan_hwmon_ina219(const char *sysfs_hwmon_dir)
 	return -ENODEV;
 }
 
-static int update_intvar(
-	const char *base_path,
-	const char *name,
-	int *value)
+static void ina219_close(void)
 {
-	char path[NUT_PATH_MAX + 1];
-	int ret;
+	struct ina219_attr *attr;
 
-	if (snprintf(path, sizeof(path), "%s/%s", base_path, name) >= NUT_PATH_MAX) {
-		errno = ENAMETOOLONG;
-		upslog_with_errno(LOG_ERR, "snprintf(%s/%s) has failed", base_path, name);
-		return -ENAMETOOLONG;
+	for (attr = ina219_attrs; attr->name; attr++) {
+		if (attr->fd >= 0)
+			close(attr->fd);
+		attr->fd = -1;
 	}
+}
 
-	if ((ret = file_read_number(path, value)) < 0) {
-		errno = -ret;
-		upslog_with_errno(LOG_ERR, "file_read_number(%s) has failed", path);
-		return ret;
+static int ina219_open(void)
+{
+	struct ina219_attr *attr;
+	char path[NUT_PATH_MAX + 1];
+
+	for (attr = ina219_attrs; attr->name; attr++) {
+		if (snprintf(path, sizeof(path), "%s/%s", ina219_base_path, attr->name) >= NUT_PATH_MAX) {
+			errno = ENAMETOOLONG;
+			upslog_with_errno(LOG_ERR, "snprintf(%s/%s) has failed",
+					ina219_base_path, attr->name);
+			ina219_close();
+			return -ENAMETOOLONG;
+		}
+
+		if ((attr->fd = open(path, O_RDONLY)) < 0) {
+			const int _e = -errno;
+			upslog_with_errno(LOG_ERR, "unable to open %s", path);
+			ina219_close();
+			return _e;
+		}
 	}
 
 	return 0;
 }
 
-static int update_voltage(void)
+/**
+ * @brief Read all the attributes for one poll.
+ */
+static int ina219_read(void)
 {
-	return update_intvar(ina219_base_path, "in1_input", &voltage);
+	struct ina219_attr *attr;
+	int ret;
+
+	for (attr = ina219_attrs; attr->name; attr++) {
+		if ((ret = fd_read_number(attr->fd, attr->value)) < 0) {
+			errno = -ret;
+			upslog_with_errno(LOG_ERR, "reading %s/%s has failed",
+					ina219_base_path, attr->name);
+			return ret;
+		}
+	}
+
+	return 0;
 }
 
-static int update_current(void)
+/**
+ * @brief Open the attributes again after an error, from a new scan
+ * for the device if port=auto (its hwmonX may have changed).
+ */
+static int ina219_reopen(void)
 {
-	return update_intvar(ina219_base_path, "curr1_input", &current);
+	int ret;
+
+	ina219_close();
+
+	if (!strcmp(device_path, "auto")
+	 && (ret = scan_hwmon_ina219(ina219_hwmon_dir)) < 0)
+		return ret;
+
+	return ina219_open();
 }
 
 void upsdrv_makevartable(void)
@@ -367,16 +425,21 @@ static void battery_charge_params_init(void)
 
 void upsdrv_initups(void)
 {
-	const char *hwmon_dir = SYSFS_HWMON_DIR;
 	int ret;
 
 	if (getval("sysfs_dir"))
-		hwmon_dir = getval("sysfs_dir");
+		ina219_hwmon_dir = getval("sysfs_dir");
 
-	if ((ret = scan_hwmon_ina219(hwmon_dir)) < 0) {
+	if ((ret = scan_hwmon_ina219(ina219_hwmon_dir)) < 0) {
 		errno = -ret;
 		fatal_with_errno(EXIT_FAILURE, "scan_hwmon_ina219(%s) has failed",
-				hwmon_dir);
+				ina219_hwmon_dir);
+	}
+
+	if ((ret = ina219_open()) < 0) {
+		errno = -ret;
+		fatal_with_errno(EXIT_FAILURE, "ina219_open(%s) has failed",
+				ina219_base_path);
 	}
 
 	battery_voltage_params_init();
@@ -419,23 +482,16 @@ static unsigned int battery_charge_compute(void)
 void upsdrv_updateinfo(void)
 {
 	unsigned int charge = 0;
-	int stale = 0;
-
-	if (update_voltage() < 0)
-		stale = 1;
-
-	upsdebugx(3, "Battery voltage: %.3fV", voltage / 1000.0);
-
-	if (update_current() < 0)
-		stale = 1;
-
-	upsdebugx(3, "Battery current: %.3fA", current / 1000.0);
 
-	if (stale) {
+	if (ina219_read() < 0
+	 && (ina219_reopen() < 0 || ina219_read() < 0)) {
 		dstate_datastale();
 		return;
 	}
 
+	upsdebugx(3, "Battery voltage: %.3fV", voltage / 1000.0);
+	upsdebugx(3, "Battery current: %.3fA", current / 1000.0);
+
 	status_init();
 
 	charge = battery_charge_compute();
@@ -479,4 +535,5 @@ void upsdrv_help(void)
 
 void upsdrv_cleanup(void)
 {
+	ina219_close();
 }
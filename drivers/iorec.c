@@ -0,0 +1,390 @@
+/* iorec.c - recording and replaying of the device I/O of drivers
+
+   Copyright (C)
+	2026	Network UPS Tools developers
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+/* The transactions which the serial, USB and SNMP layers make with the
+ * device are logged to a text file, one per line:
+ *
+ *	<usec since the start> <chan> <op> <key> <ret> <data in hex>
+ *
+ * with "-" for an empty key or data. A driver started with such a file to
+ * replay gets its answers from it instead of the device, at the recorded
+ * pace or faster, so that changes to its parsing and state handling can
+ * be timed (and profiled) on the same input over and over.
+ */
+
+#include "config.h" /* must be the first header */
+
+#include "common.h"
+#include "timehead.h"
+#include "main.h"
+#include "iorec.h"
+#include "nut_stdint.h"
+
+#ifndef WIN32
+#include <sys/resource.h>
+#endif	/* !WIN32 */
+
+typedef struct {
+	uint64_t	t;
+	char	*chan, *op, *key;
+	long	ret;
+	unsigned char	*data;
+	size_t	len;
+} iorec_t;
+
+iorec_mode_t	iorec_mode = IOREC_OFF;
+
+static FILE	*rec_file = NULL;
+static uint64_t	rec_start = 0;
+
+static iorec_t	*recs = NULL;
+static size_t	nrecs = 0, cursor = 0, replayed = 0;
+static double	speed = 1.0;
+static int	replay_done = 0;
+static const iorec_t	*replay_last = NULL;
+
+/* the key as written in the file: no blanks, "-" if empty */
+static const char *key_format(const char *key, char *buf, size_t bufsize)
+{
+	size_t	i;
+
+	if (!key || !*key) {
+		return "-";
+	}
+
+	for (i = 0; key[i] && i < bufsize - 1; i++) {
+		buf[i] = ((unsigned char)key[i] <= ' ') ? '_' : key[i];
+	}
+	buf[i] = '\0';
+
+	return buf;
+}
+
+static int hexval(int c)
+{
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F')
+		return c - 'A' + 10;
+	return -1;
+}
+
+/* a whole line of any length, in a buffer grown as needed */
+static char *read_line(FILE *f, char **buf, size_t *bufsize)
+{
+	size_t	len = 0;
+
+	if (!*buf) {
+		*bufsize = 1024;
+		*buf = xcalloc(1, *bufsize);
+	}
+
+	while (fgets(*buf + len, (int)(*bufsize - len), f)) {
+		len += strlen(*buf + len);
+		if (len > 0 && (*buf)[len - 1] == '\n') {
+			(*buf)[len - 1] = '\0';
+			return *buf;
+		}
+		*bufsize *= 2;
+		*buf = xrealloc(*buf, *bufsize);
+	}
+
+	return len ? *buf : NULL;
+}
+
+static int parse_line(char *line, iorec_t *rec)
+{
+	char	*field[6], *p = line;
+	size_t	i, n;
+	unsigned long long	t;
+
+	for (n = 0; n < 6; n++) {
+		while (*p == ' ' || *p == '\t')
+			p++;
+		if (!*p)
+			break;
+		field[n] = p;
+		while (*p && *p != ' ' && *p != '\t')
+			p++;
+		if (*p)
+			*p++ = '\0';
+	}
+
+	if (n < 6 || sscanf(field[0], "%llu", &t) != 1) {
+		return 0;
+	}
+
+	memset(rec, 0, sizeof(*rec));
+	rec->t = (uint64_t)t;
+	rec->chan = xstrdup(field[1]);
+	rec->op = xstrdup(field[2]);
+	rec->key = xstrdup(field[3]);
+	rec->ret = strtol(field[4], NULL, 10);
+
+	if (strcmp(field[5], "-")) {
+		n = strlen(field[5]) / 2;
+		rec->data = xcalloc(n ? n : 1, 1);
+		for (i = 0; i < n; i++) {
+			int	hi = hexval(field[5][2 * i]), lo = hexval(field[5][2 * i + 1]);
+
+			if (hi < 0 || lo < 0)
+				break;
+			rec->data[i] = (unsigned char)(hi << 4 | lo);
+		}
+		rec->len = i;
+	}
+
+	return 1;
+}
+
+static void replay_load(const char *fn)
+{
+	FILE	*f = fopen(fn, "r");
+	char	*line, *buf = NULL;
+	size_t	bufsize = 0, alloc = 0, lineno = 0;
+
+	if (!f) {
+		fatal_with_errno(EXIT_FAILURE, "Can't open I/O recording %s", fn);
+	}
+
+	while ((line = read_line(f, &buf, &bufsize)) != NULL) {
+		lineno++;
+		if (line[0] == '#' || line[0] == '\0') {
+			continue;
+		}
+
+		if (nrecs == alloc) {
+			alloc = alloc ? alloc * 2 : 256;
+			recs = xrealloc(recs, alloc * sizeof(*recs));
+		}
+
+		if (!parse_line(line, &recs[nrecs])) {
+			upslogx(LOG_WARNING, "I/O recording %s: line %" PRIuSIZE
+				" not understood, ignored", fn, lineno);
+			continue;
+		}
+		nrecs++;
+	}
+
+	free(buf);
+	fclose(f);
+
+	upslogx(LOG_NOTICE, "Replaying %" PRIuSIZE " recorded device transactions from %s"
+		" at speed %g%s", nrecs, fn, speed, speed > 0 ? "" : " (no waits)");
+}
+
+void iorec_init(void)
+{
+	const char	*fn;
+
+	rec_start = drv_stats_now_usec();
+
+	if ((fn = getenv(IOREC_ENV_REPLAY)) != NULL && *fn) {
+		const char	*s = getenv(IOREC_ENV_SPEED);
+
+		if (s && *s) {
+			speed = strtod(s, NULL);
+			if (speed < 0) {
+				speed = 0;
+			}
+		}
+
+		iorec_mode = IOREC_REPLAY;
+		replay_load(fn);
+		return;
+	}
+
+	if ((fn = getenv(IOREC_ENV_RECORD)) != NULL && *fn) {
+		rec_file = fopen(fn, "w");
+		if (!rec_file) {
+			fatal_with_errno(EXIT_FAILURE, "Can't create I/O recording %s", fn);
+		}
+
+		/* a recording is only useful complete, up to a crash */
+		setvbuf(rec_file, NULL, _IOLBF, 0);
+		fprintf(rec_file, "# NUT driver I/O recording 1: %s %s (%s)\n",
+			progname, upsname, device_path ? device_path : "-");
+
+		iorec_mode = IOREC_RECORD;
+		upslogx(LOG_NOTICE, "Recording the device transactions to %s", fn);
+	}
+}
+
+void iorec_free(void)
+{
+	size_t	i;
+
+	if (rec_file) {
+		fclose(rec_file);
+		rec_file = NULL;
+	}
+
+	for (i = 0; i < nrecs; i++) {
+		free(recs[i].chan);
+		free(recs[i].op);
+		free(recs[i].key);
+		free(recs[i].data);
+	}
+	free(recs);
+	recs = NULL;
+	replay_last = NULL;
+	nrecs = cursor = 0;
+
+	iorec_mode = IOREC_OFF;
+}
+
+void iorec_record(const char *chan, const char *op, const char *key,
+	long ret, const void *data, size_t len)
+{
+	const unsigned char	*p = data;
+	char	keybuf[SMALLBUF];
+	size_t	i;
+
+	if (iorec_mode != IOREC_RECORD || !rec_file) {
+		return;
+	}
+
+	if (len > IOREC_DATA_MAX) {
+		len = IOREC_DATA_MAX;
+	}
+
+	fprintf(rec_file, "%" PRIu64 " %s %s %s %ld ",
+		drv_stats_now_usec() - rec_start, chan, op,
+		key_format(key, keybuf, sizeof(keybuf)), ret);
+
+	if (!p || !len) {
+		fputc('-', rec_file);
+	}
+	for (i = 0; p && i < len; i++) {
+		fprintf(rec_file, "%02x", p[i]);
+	}
+	fputc('\n', rec_file);
+}
+
+static void replay_end(void)
+{
+	double	elapsed = (double)(drv_stats_now_usec() - rec_start) / 1000000;
+#ifndef WIN32
+	struct rusage	ru;
+
+	getrusage(RUSAGE_SELF, &ru);
+	upslogx(LOG_NOTICE, "End of the I/O recording: %" PRIuSIZE " transactions"
+		" replayed in %.3f s, CPU time %.3f s user, %.3f s system",
+		replayed, elapsed,
+		(double)ru.ru_utime.tv_sec + (double)ru.ru_utime.tv_usec / 1000000,
+		(double)ru.ru_stime.tv_sec + (double)ru.ru_stime.tv_usec / 1000000);
+#else	/* WIN32 */
+	upslogx(LOG_NOTICE, "End of the I/O recording: %" PRIuSIZE " transactions"
+		" replayed in %.3f s", replayed, elapsed);
+#endif	/* WIN32 */
+
+	replay_done = 1;
+	set_exit_flag(EF_EXIT_SUCCESS);
+}
+
+int iorec_replay_key(char *buf, size_t bufsize)
+{
+	if (!replay_last || !strcmp(replay_last->key, "-")) {
+		return 0;
+	}
+
+	snprintf(buf, bufsize, "%s", replay_last->key);
+	return 1;
+}
+
+void iorec_scale_wait(const struct timeval *from, struct timeval *to)
+{
+	double	usec;
+
+	if (iorec_mode != IOREC_REPLAY || speed == 1.0) {
+		return;
+	}
+
+	usec = (speed > 0) ? difftimeval(*to, *from) * 1000000 / speed : 0;
+	*to = *from;
+	to->tv_sec += (time_t)(usec / 1000000);
+	to->tv_usec += (suseconds_t)((long)usec % 1000000);
+	if (to->tv_usec >= 1000000) {
+		to->tv_sec++;
+		to->tv_usec -= 1000000;
+	}
+}
+
+int iorec_replay(const char *chan, const char *op, const char *key,
+	long *ret, void *data, size_t *len)
+{
+	char	keybuf[SMALLBUF];
+	const char	*k = key ? key_format(key, keybuf, sizeof(keybuf)) : NULL;
+	const iorec_t	*rec = NULL;
+	size_t	i;
+
+	if (iorec_mode != IOREC_REPLAY || replay_done) {
+		return 0;
+	}
+
+	/* transactions the driver does not make this time are skipped */
+	for (i = cursor; i < nrecs; i++) {
+		if (!strcmp(recs[i].chan, chan) && !strcmp(recs[i].op, op)
+		 && (!k || !strcmp(recs[i].key, k))
+		) {
+			rec = &recs[i];
+			break;
+		}
+	}
+
+	if (!rec) {
+		upsdebugx(1, "%s: no more %s %s %s in the recording",
+			__func__, chan, op, k ? k : "*");
+		replay_end();
+		return 0;
+	}
+
+	cursor = i + 1;
+	replayed++;
+	replay_last = rec;
+
+	if (speed > 0) {
+		uint64_t	due = rec_start + (uint64_t)((double)rec->t / speed),
+				now = drv_stats_now_usec();
+
+		/* in steps, usleep() may not take a second or more */
+		while (due > now) {
+			usleep((useconds_t)((due - now > 500000) ? 500000 : due - now));
+			now = drv_stats_now_usec();
+		}
+	}
+
+	if (ret) {
+		*ret = rec->ret;
+	}
+
+	if (len) {
+		size_t	n = (rec->len < *len) ? rec->len : *len;
+
+		if (data && n) {
+			memcpy(data, rec->data, n);
+		}
+		*len = n;
+	}
+
+	return 1;
+}
@@ -0,0 +1,81 @@
+/* iorec.h - recording and replaying of the device I/O of drivers
+
+   Copyright (C)
+	2026	Network UPS Tools developers
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#ifndef NUT_IOREC_H_SEEN
+#define NUT_IOREC_H_SEEN 1
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+/* *INDENT-OFF* */
+extern "C" {
+/* *INDENT-ON* */
+#endif
+
+/* environment variables which select the mode, see docs/developers.txt */
+#define IOREC_ENV_RECORD	"NUT_DRIVER_IORECORD"
+#define IOREC_ENV_REPLAY	"NUT_DRIVER_IOREPLAY"
+#define IOREC_ENV_SPEED		"NUT_DRIVER_IOREPLAY_SPEED"
+
+/* longest data of one transaction kept in a recording */
+#define IOREC_DATA_MAX	65536
+
+typedef enum {
+	IOREC_OFF = 0,
+	IOREC_RECORD,	/* the transactions with the device are logged */
+	IOREC_REPLAY	/* ... or served from a log instead of the device */
+} iorec_mode_t;
+
+extern iorec_mode_t	iorec_mode;
+
+/* set the mode from the environment, and open the recording */
+void iorec_init(void);
+void iorec_free(void);
+
+/* log a transaction on channel <chan> ("ser", "usb", "snmp"): operation
+ * <op>, what it was about <key> (may be NULL), its result <ret> and the
+ * <len> bytes of <data> it sent or received (may be NULL) */
+void iorec_record(const char *chan, const char *op, const char *key,
+	long ret, const void *data, size_t len);
+
+/* find the next recorded transaction matching <chan>, <op> and <key>
+ * (NULL for any), waiting for its time to come at the replay speed:
+ * fills <ret>, and up to <*len> bytes of <data> with <*len> set to their
+ * count (<data> and <len> may be NULL). Returns 1 if one was found, 0 at
+ * the end of the recording (the driver then exits). */
+int iorec_replay(const char *chan, const char *op, const char *key,
+	long *ret, void *data, size_t *len);
+
+/* copy the key of the transaction replayed last into <buf>, returns 0 if
+ * there is none */
+int iorec_replay_key(char *buf, size_t bufsize);
+
+/* a replay goes at its own speed: bring the end <to> of a wait of the
+ * main loop which starts at <from> closer accordingly */
+struct timeval;
+void iorec_scale_wait(const struct timeval *from, struct timeval *to);
+
+#ifdef __cplusplus
+/* *INDENT-OFF* */
+}
+/* *INDENT-ON* */
+#endif
+
+#endif	/* NUT_IOREC_H_SEEN */
@@ -39,11 +39,13 @@
 #ifdef HAVE_STRINGS_H
 # include <strings.h>
 #endif
+#include <ctype.h>
 /* #include "nut_float.h" */
 #include "libhid.h"
 #include "hidparser.h"
 #include "common.h" /* for xmalloc, upsdebugx prototypes */
 #include "nut_stdint.h"
+#include "main.h" /* for drv_stats_now_usec() */
 
 /* Communication layers and drivers (USB and MGE SHUT) */
 #if (defined SHUT_MODE) && SHUT_MODE
@@ -59,6 +61,7 @@ static double logical_to_physical(HIDData_t *Data, long logical);
 static long physical_to_logical(HIDData_t *Data, double physical);
 static const char *hid_lookup_path(const HIDNode_t usage, usage_tables_t *utab);
 static long hid_lookup_usage(const char *name, usage_tables_t *utab);
+static void usage_index_free(void);
 static int string_to_path(const char *string, HIDPath_t *path, usage_tables_t *utab);
 static int path_to_string(char *string, size_t size, const HIDPath_t *path, usage_tables_t *utab);
 static int8_t get_unit_expo(const HIDData_t *hiddata);
@@ -93,6 +96,7 @@ void free_report_buffer(reportbuf_t *rbuf)
 
 	for (i=0; i<256; i++) {
 		free(rbuf->data[i]);
+		free(rbuf->prev[i]);
 	}
 
 	free(rbuf);
@@ -136,7 +140,8 @@ reportbuf_t *new_report_buffer(HIDDesc_t *arg_pDesc)
 		}
 
 		rbuf->data[id] = calloc(rbuf->len[id], sizeof(*(rbuf->data[id])));
-		if (rbuf->data[id])
+		rbuf->prev[id] = calloc(rbuf->len[id], sizeof(*(rbuf->prev[id])));
+		if (rbuf->data[id] && rbuf->prev[id])
 			continue;
 
 		/* on failure, give up what we got so far */
@@ -147,25 +152,71 @@ reportbuf_t *new_report_buffer(HIDDesc_t *arg_pDesc)
 	return rbuf;
 }
 
+void HIDBeginCycle(reportbuf_t *rbuf)
+{
+	if (!rbuf)
+		return;
+
+	/* cycle_got[] is 0 for the reports never requested */
+	if (++rbuf->cycle == 0)
+		rbuf->cycle = 1;
+	rbuf->incycle = 1;
+}
+
+void HIDEndCycle(reportbuf_t *rbuf)
+{
+	if (!rbuf)
+		return;
+
+	rbuf->incycle = 0;
+}
+
+/* count a change of the report with the given id, which has just been
+   received, if it is not the same as last time */
+static void note_report_change(reportbuf_t *rbuf, int id)
+{
+	if (rbuf->gen[id] && !memcmp(rbuf->data[id], rbuf->prev[id], rbuf->len[id])) {
+		return;
+	}
+
+	memcpy(rbuf->prev[id], rbuf->data[id], rbuf->len[id]);
+	if (++rbuf->gen[id] == 0)
+		rbuf->gen[id] = 1;
+}
+
 /* ---------------------------------------------------------------------- */
 /* the functions in this next group operate on buffered reports, but
    operate on individual items, not whole reports. */
 
 /* refresh the report with the given id in the report buffer rbuf.  If
    the report is not yet in the buffer, or if it is older than "age"
-   seconds, then the report is freshly read from the USB
-   device. Otherwise, it is unchanged.
+   milliseconds, then the report is freshly read from the USB device, unless
+   it was already requested in the current cycle (if any). Otherwise,
+   it is unchanged.
    Return 0 on success, -1 on error with errno set. */
 /* because buggy firmwares from APC return wrong report size, we either
    ask the report with the found report size or with the whole buffer size
    depending on the max_report_size flag */
-static int refresh_report_buffer(reportbuf_t *rbuf, hid_dev_handle_t udev, HIDData_t *pData, time_t age)
+static int refresh_report_buffer(reportbuf_t *rbuf, hid_dev_handle_t udev, HIDData_t *pData, long age)
 {
 	usb_ctrl_repindex	id = pData->ReportID;
 	int	ret;
 	size_t	r;
+	uint64_t	now = drv_stats_now_usec();
+
+	if (rbuf->incycle && rbuf->cycle_got[id] == rbuf->cycle) {
+		if (rbuf->cycle_ret[id] <= 0) {
+			/* as it failed a moment ago */
+			errno = -rbuf->cycle_ret[id];
+			return -1;
+		}
+		upsdebug_hex(3, "Report[buf]", rbuf->data[id], rbuf->len[id]);
+		return 0;
+	}
 
-	if (interrupt_only || rbuf->ts[id] + age > time(NULL)) {
+	if (interrupt_only
+	 || (rbuf->ts[id] && age > 0 && now - rbuf->ts[id] < (uint64_t)age * 1000)
+	) {
 		/* buffered report is still good; nothing to do */
 		upsdebug_hex(3, "Report[buf]", rbuf->data[id], rbuf->len[id]);
 		return 0;
@@ -232,6 +283,11 @@ static int refresh_report_buffer(reportbuf_t *rbuf, hid_dev_handle_t udev, HIDDa
 		(usb_ctrl_charbuf)rbuf->data[id],
 		(usb_ctrl_charbufsize)r);
 
+	if (rbuf->incycle) {
+		rbuf->cycle_got[id] = rbuf->cycle;
+		rbuf->cycle_ret[id] = (ret <= 0) ? ret : 1;
+	}
+
 	if (ret <= 0) {
 		errno = -ret;
 		return -1;
@@ -251,7 +307,8 @@ static int refresh_report_buffer(reportbuf_t *rbuf, hid_dev_handle_t udev, HIDDa
 	}
 
 	/* have (valid) report */
-	time(&rbuf->ts[id]);
+	rbuf->ts[id] = drv_stats_now_usec();
+	note_report_change(rbuf, id);
 
 	return 0;
 }
@@ -260,7 +317,7 @@ static int refresh_report_buffer(reportbuf_t *rbuf, hid_dev_handle_t udev, HIDDa
    conversion is performed. If age>0, the read operation is buffered
    if the item's age is less than "age". On success, return 0 and
    store the answer in *value. On failure, return -1 and set errno. */
-static int get_item_buffered(reportbuf_t *rbuf, hid_dev_handle_t udev, HIDData_t *pData, long *Value, time_t age)
+static int get_item_buffered(reportbuf_t *rbuf, hid_dev_handle_t udev, HIDData_t *pData, long *Value, long age)
 {
 	int id = pData->ReportID;
 	int r;
@@ -345,8 +402,12 @@ static int set_item_buffered(reportbuf_t *rbuf, hid_dev_handle_t udev, HIDData_t
 
 	upsdebug_hex(3, "Report[set]", rbuf->data[id], r);
 
-	/* expire report */
+	/* expire report, also for the current cycle; whatever the device
+	 * answers next, the items in it are to be decoded again */
 	rbuf->ts[id] = 0;
+	rbuf->cycle_got[id] = 0;
+	if (++rbuf->gen[id] == 0)
+		rbuf->gen[id] = 1;
 
 	return 0;
 }
@@ -372,7 +433,8 @@ static int file_report_buffer(reportbuf_t *rbuf, unsigned char *buf, size_t bufl
 	}
 
 	/* have (valid) report */
-	time(&rbuf->ts[id]);
+	rbuf->ts[id] = drv_stats_now_usec();
+	note_report_change(rbuf, id);
 
 	return 0;
 }
@@ -481,6 +543,397 @@ const char *HIDDataType(const HIDData_t *hiddata)
 	}
 }
 
+/* ---------------------------------------------------------------------- */
+/* report descriptor cache */
+
+/* The item which HIDGetItemData() found (or not) for each path is kept in
+ * a hash table, so that the walk after a reconnection, or any later
+ * lookup of the same path, does not decipher it and search the descriptor
+ * again. With a cache file, these bindings are saved along with the items
+ * of the parsed descriptor, so that the next start of the driver skips
+ * both the parsing and the lookups while the device (by VID, PID and
+ * release number) and its descriptor (by length and hash) are the same:
+ *
+ *	# NUT HID descriptor cache <version>
+ *	key <VID> <PID> <release> <length> <hash> <subdriver> <PATH_SIZE>
+ *	item <ReportID> <Offset> <Size> <Type> <Attribute> <Unit> <UnitExp>
+ *		<LogMin> <LogMax> <assumed_LogMax> <PhyMin> <PhyMax>
+ *		<have_PhyMin> <have_PhyMax> <Path.Size> <Path.Node in hex>...
+ *	replen <ReportID> <length>
+ *	bind <Type> <index of the item or -1> <path>
+ */
+#define HIDCACHE_VERSION	1
+#define HIDCACHE_ITEM_FIELDS	14	/* before Path.Size */
+
+typedef struct {
+	char	*path;		/* NULL if the slot is free */
+	uint8_t	Type;
+	long	item;		/* index in pDesc->item, -1 if not found */
+} hidbind_t;
+
+static struct {
+	usage_tables_t	*utab;	/* which the bindings are made with */
+	hidbind_t	*bind;
+	size_t	bindsize, bindused;	/* slots (a power of 2), in use */
+	char	*fn;		/* cache file, or NULL */
+	char	key[SMALLBUF];	/* identity of the device and descriptor */
+	HIDData_t	*item;	/* with a file: the items as parsed (unfixed) */
+	size_t	nitems;
+	size_t	replen[256];
+	int	dirty;		/* the file is to be written */
+} hidcache;
+
+static size_t hidcache_hash(const char *path, uint8_t Type)
+{
+	return fnv1a_hash(str_hash_nocase(path), &Type, 1);
+}
+
+static hidbind_t *hidcache_find(const char *path, uint8_t Type)
+{
+	size_t	i;
+
+	if (!hidcache.bindsize) {
+		return NULL;
+	}
+
+	for (i = hidcache_hash(path, Type) & (hidcache.bindsize - 1);
+		hidcache.bind[i].path;
+		i = (i + 1) & (hidcache.bindsize - 1)
+	) {
+		if (hidcache.bind[i].Type == Type && !strcmp(hidcache.bind[i].path, path)) {
+			return &hidcache.bind[i];
+		}
+	}
+
+	return NULL;
+}
+
+static void hidcache_add(const char *path, uint8_t Type, long item)
+{
+	size_t	i;
+
+	if (hidcache.bindused * 2 >= hidcache.bindsize) {
+		hidbind_t	*old = hidcache.bind;
+		size_t	oldsize = hidcache.bindsize;
+
+		hidcache.bindsize = oldsize ? oldsize * 2 : 256;
+		hidcache.bind = xcalloc(hidcache.bindsize, sizeof(*hidcache.bind));
+		hidcache.bindused = 0;
+
+		for (i = 0; i < oldsize; i++) {
+			if (old[i].path) {
+				size_t	j = hidcache_hash(old[i].path, old[i].Type) & (hidcache.bindsize - 1);
+
+				while (hidcache.bind[j].path) {
+					j = (j + 1) & (hidcache.bindsize - 1);
+				}
+				hidcache.bind[j] = old[i];
+				hidcache.bindused++;
+			}
+		}
+		free(old);
+	}
+
+	for (i = hidcache_hash(path, Type) & (hidcache.bindsize - 1);
+		hidcache.bind[i].path;
+		i = (i + 1) & (hidcache.bindsize - 1)
+	);
+
+	hidcache.bind[i].path = xstrdup(path);
+	hidcache.bind[i].Type = Type;
+	hidcache.bind[i].item = item;
+	hidcache.bindused++;
+
+	if (hidcache.fn) {
+		hidcache.dirty = 1;
+	}
+}
+
+void HIDCacheFree(void)
+{
+	size_t	i;
+
+	for (i = 0; i < hidcache.bindsize; i++) {
+		free(hidcache.bind[i].path);
+	}
+	free(hidcache.bind);
+	free(hidcache.fn);
+	free(hidcache.item);
+	memset(&hidcache, 0, sizeof(hidcache));
+
+	usage_index_free();
+}
+
+/* read the items of the cache file into hidcache.item, and its bindings */
+static HIDDesc_t *hidcache_load(void)
+{
+	FILE	*f;
+	char	line[LARGEBUF], *p, *end, *path;
+	HIDData_t	*item = NULL;
+	size_t	nitems = 0, n;
+	long	v[HIDCACHE_ITEM_FIELDS + 1], Type, index;
+	unsigned long	node[PATH_SIZE];
+	int	version, ok = 0;
+	HIDDesc_t	*desc;
+
+	if ((f = fopen(hidcache.fn, "r")) == NULL) {
+		upsdebug_with_errno(2, "%s: no report descriptor cache %s", __func__, hidcache.fn);
+		return NULL;
+	}
+
+	memset(hidcache.replen, 0, sizeof(hidcache.replen));
+
+	if (!fgets(line, sizeof(line), f)
+	 || sscanf(line, "# NUT HID descriptor cache %d", &version) != 1
+	 || version != HIDCACHE_VERSION
+	 || !fgets(line, sizeof(line), f)
+	 || strncmp(line, hidcache.key, strlen(hidcache.key))
+	 || strcmp(line + strlen(hidcache.key), "\n")
+	) {
+		upsdebugx(2, "%s: %s is not for this device or descriptor",
+			__func__, hidcache.fn);
+		fclose(f);
+		return NULL;
+	}
+
+	while (fgets(line, sizeof(line), f)) {
+		if ((p = strchr(line, '\n')) == NULL) {
+			goto bad;
+		}
+		*p = '\0';
+
+		if (!strncmp(line, "item ", 5)) {
+			HIDData_t	*d;
+
+			for (n = 0, p = line + 5; n < HIDCACHE_ITEM_FIELDS + 1; n++, p = end) {
+				v[n] = strtol(p, &end, 10);
+				if (end == p) {
+					goto bad;
+				}
+			}
+			if (v[HIDCACHE_ITEM_FIELDS] < 0 || v[HIDCACHE_ITEM_FIELDS] > PATH_SIZE
+			 || nitems >= MAX_REPORT
+			) {
+				goto bad;
+			}
+			for (n = 0; n < (size_t)v[HIDCACHE_ITEM_FIELDS]; n++, p = end) {
+				node[n] = strtoul(p, &end, 16);
+				if (end == p) {
+					goto bad;
+				}
+			}
+			if (*p) {
+				goto bad;
+			}
+
+			if (!item) {
+				item = xcalloc(MAX_REPORT, sizeof(*item));
+			}
+
+			d = &item[nitems++];
+			d->ReportID = (uint8_t)v[0];
+			d->Offset = (uint8_t)v[1];
+			d->Size = (uint8_t)v[2];
+			d->Type = (uint8_t)v[3];
+			d->Attribute = (uint8_t)v[4];
+			d->Unit = v[5];
+			d->UnitExp = (int8_t)v[6];
+			d->LogMin = v[7];
+			d->LogMax = v[8];
+			d->assumed_LogMax = (v[9] != 0);
+			d->PhyMin = v[10];
+			d->PhyMax = v[11];
+			d->have_PhyMin = (int8_t)v[12];
+			d->have_PhyMax = (int8_t)v[13];
+			d->Path.Size = (uint8_t)v[14];
+			for (n = 0; n < d->Path.Size; n++) {
+				d->Path.Node[n] = (HIDNode_t)node[n];
+			}
+			continue;
+		}
+
+		if (!strncmp(line, "replen ", 7)) {
+			unsigned int	id;
+			unsigned long	len;
+
+			if (sscanf(line + 7, "%u %lu", &id, &len) != 2 || id > 255) {
+				goto bad;
+			}
+			hidcache.replen[id] = (size_t)len;
+			continue;
+		}
+
+		if (!strncmp(line, "bind ", 5)) {
+			Type = strtol(line + 5, &end, 10);
+			if (end == line + 5) {
+				goto bad;
+			}
+			p = end;
+			index = strtol(p, &end, 10);
+			path = end;
+			while (*path == ' ') {
+				path++;
+			}
+			if (end == p || !*path || index < -1 || index >= (long)nitems) {
+				goto bad;
+			}
+			if (!hidcache_find(path, (uint8_t)Type)) {
+				hidcache_add(path, (uint8_t)Type, index);
+			}
+			continue;
+		}
+
+		if (line[0] != '#' && line[0] != '\0') {
+			goto bad;
+		}
+	}
+
+	ok = (nitems > 0);
+
+bad:
+	fclose(f);
+
+	if (!ok || (desc = New_ReportDesc(item, nitems, hidcache.replen)) == NULL) {
+		upslogx(LOG_WARNING, "Report descriptor cache %s is damaged, ignored", hidcache.fn);
+		free(item);
+		for (n = 0; n < hidcache.bindsize; n++) {
+			free(hidcache.bind[n].path);
+		}
+		free(hidcache.bind);
+		hidcache.bind = NULL;
+		hidcache.bindsize = hidcache.bindused = 0;
+		return NULL;
+	}
+
+	hidcache.item = item;
+	hidcache.nitems = nitems;
+	hidcache.dirty = 0;
+	upsdebugx(1, "Using the report descriptor cache %s: %" PRIuSIZE " items, %" PRIuSIZE " paths",
+		hidcache.fn, nitems, hidcache.bindused);
+
+	return desc;
+}
+
+HIDDesc_t *HIDParseCached(const char *dir, HIDDevice_t *hd, const char *name,
+	usage_tables_t *utab, const usb_ctrl_charbuf rdbuf, usb_ctrl_charbufsize rdlen)
+{
+	HIDDesc_t	*desc = NULL;
+	uint32_t	hash;
+
+	HIDCacheFree();
+
+	/* both end up in names kept on disk, so they keep to 32 bits */
+	hash = (uint32_t)fnv1a_hash(FNV1A_INIT, rdbuf, (size_t)rdlen);
+
+	snprintf(hidcache.key, sizeof(hidcache.key), "key %04x %04x %04x %u %08lx %s %d",
+		(unsigned int)hd->VendorID, (unsigned int)hd->ProductID,
+		(unsigned int)hd->bcdDevice, (unsigned int)rdlen,
+		(unsigned long)hash, name, PATH_SIZE);
+	hidcache.utab = utab;
+
+	/* named after what it holds rather than after the UPS, so that the
+	 * drivers of several units of a model (and of the same subdriver)
+	 * share one, which the first of them to start writes */
+	if (dir) {
+		char	fn[NUT_PATH_MAX + 1];
+
+		hash = (uint32_t)fnv1a_hash(FNV1A_INIT, hidcache.key, strlen(hidcache.key));
+		snprintf(fn, sizeof(fn), "%s/%s-%04x-%04x-%08lx.hidcache",
+			dir, progname, (unsigned int)hd->VendorID,
+			(unsigned int)hd->ProductID, (unsigned long)hash);
+		hidcache.fn = xstrdup(fn);
+		desc = hidcache_load();
+	}
+
+	if (!desc) {
+		desc = Parse_ReportDesc(rdbuf, rdlen);
+
+		if (desc && hidcache.fn) {
+			hidcache.item = xcalloc(desc->nitems, sizeof(*hidcache.item));
+			memcpy(hidcache.item, desc->item, desc->nitems * sizeof(*hidcache.item));
+			hidcache.nitems = desc->nitems;
+			memcpy(hidcache.replen, desc->replen, sizeof(hidcache.replen));
+			hidcache.dirty = 1;
+		}
+	}
+
+	return desc;
+}
+
+int HIDCacheSave(void)
+{
+	char	tmpfn[NUT_PATH_MAX + 1];
+	FILE	*f;
+	size_t	i, n;
+	int	err;
+
+	if (!hidcache.fn || !hidcache.item || !hidcache.dirty) {
+		return 1;
+	}
+
+	/* other drivers may be writing the same one */
+	snprintf(tmpfn, sizeof(tmpfn), "%s.%ld.tmp", hidcache.fn, (long)getpid());
+	if ((f = fopen(tmpfn, "w")) == NULL) {
+		upslog_with_errno(LOG_WARNING, "Can't write the report descriptor cache %s", tmpfn);
+		return 0;
+	}
+
+	fprintf(f, "# NUT HID descriptor cache %d\n%s\n", HIDCACHE_VERSION, hidcache.key);
+
+	for (i = 0; i < hidcache.nitems; i++) {
+		const HIDData_t	*d = &hidcache.item[i];
+
+		fprintf(f, "item %u %u %u %u %u %ld %d %ld %ld %d %ld %ld %d %d %u",
+			d->ReportID, d->Offset, d->Size, d->Type, d->Attribute,
+			d->Unit, d->UnitExp, d->LogMin, d->LogMax, d->assumed_LogMax ? 1 : 0,
+			d->PhyMin, d->PhyMax, d->have_PhyMin, d->have_PhyMax, d->Path.Size);
+		for (n = 0; n < d->Path.Size; n++) {
+			fprintf(f, " %08lx", (unsigned long)d->Path.Node[n]);
+		}
+		fputc('\n', f);
+	}
+
+	for (i = 0; i < 256; i++) {
+		if (hidcache.replen[i]) {
+			fprintf(f, "replen %" PRIuSIZE " %" PRIuSIZE "\n", i, hidcache.replen[i]);
+		}
+	}
+
+	for (i = 0; i < hidcache.bindsize; i++) {
+		const hidbind_t	*b = &hidcache.bind[i];
+
+		/* a path with blanks would not be read back */
+		if (b->path && !strpbrk(b->path, " \t\n")) {
+			fprintf(f, "bind %u %ld %s\n", b->Type, b->item, b->path);
+		}
+	}
+
+	if (fflush(f) != 0 || ferror(f)) {
+		err = errno;
+		fclose(f);
+		unlink(tmpfn);
+		errno = err;
+		upslog_with_errno(LOG_WARNING, "Can't write the report descriptor cache %s", tmpfn);
+		return 0;
+	}
+	fclose(f);
+
+#ifdef WIN32
+	/* rename() does not replace a file there */
+	unlink(hidcache.fn);
+#endif	/* WIN32 */
+
+	if (rename(tmpfn, hidcache.fn) != 0) {
+		upslog_with_errno(LOG_WARNING, "Can't rename %s to %s", tmpfn, hidcache.fn);
+		unlink(tmpfn);
+		return 0;
+	}
+
+	upsdebugx(2, "%s: wrote %s", __func__, hidcache.fn);
+	hidcache.dirty = 0;
+	return 1;
+}
+
 /* Returns pointer to the corresponding HIDData_t item
  * or NULL if path is not found in report descriptor
  */
@@ -489,19 +942,36 @@ HIDData_t *HIDGetItemData(const char *hidpath, usage_tables_t *utab)
 	int	r;
 	HIDPath_t	Path;
 	HIDData_t	*p;
+	uint8_t	Type = interrupt_only ? ITEM_INPUT : ITEM_FEATURE;
+	int	cached = (pDesc && utab && utab == hidcache.utab);
+
+	if (cached) {
+		const hidbind_t	*b = hidcache_find(hidpath, Type);
+
+		if (b && b->item < (long)pDesc->nitems) {
+			return (b->item < 0) ? NULL : &pDesc->item[b->item];
+		}
+	}
 
 	r = string_to_path(hidpath, &Path, utab);
 	if (r <= 0) {
 		upsdebugx(4, "%s: string_to_path() failed to decipher '%s'", __func__, hidpath);
+		if (cached) {
+			hidcache_add(hidpath, Type, -1);
+		}
 		return NULL;
 	}
 
 	/* Get info on object (reportID, offset and size) */
-	p = FindObject_with_Path(pDesc, &Path, interrupt_only ? ITEM_INPUT:ITEM_FEATURE);
+	p = FindObject_with_Path(pDesc, &Path, Type);
 
 	if (!p)
 		upsdebugx(4, "%s: FindObject_with_Path() failed to locate '%s'", __func__, hidpath);
 
+	if (cached) {
+		hidcache_add(hidpath, Type, p ? (long)(p - pDesc->item) : -1);
+	}
+
 	return p;
 }
 
@@ -518,7 +988,7 @@ char *HIDGetDataItem(const HIDData_t *hiddata, usage_tables_t *utab)
 /* Return the physical value associated with the given HIDData path.
  * return 1 if OK, 0 on fail, -errno otherwise (ie disconnect).
  */
-int HIDGetDataValue(hid_dev_handle_t udev, HIDData_t *hiddata, double *Value, time_t age)
+int HIDGetDataValue(hid_dev_handle_t udev, HIDData_t *hiddata, double *Value, long age)
 {
 	int	r;
 	long	hValue;
@@ -533,17 +1003,92 @@ int HIDGetDataValue(hid_dev_handle_t udev, HIDData_t *hiddata, double *Value, ti
 		return -errno;
 	}
 
-	*Value = hValue;
-
-	/* Convert Logical Min, Max and Value into Physical */
+	/* Convert Logical Min, Max and Value into Physical, in units */
 	*Value = logical_to_physical(hiddata, hValue);
 
-	/* Process exponents and units */
-	*Value *= exponent(10, get_unit_expo(hiddata));
+	return 1;
+}
+
+/* Like HIDGetDataValue(), but return 2 (with *Value untouched) if the
+ * report of that item has not changed since the one *gen was set from.
+ */
+int HIDGetDataValueChanged(hid_dev_handle_t udev, HIDData_t *hiddata, double *Value, long age, unsigned long *gen)
+{
+	int	r;
+	long	hValue;
+
+	if (hiddata == NULL) {
+		return 0;
+	}
+
+	r = refresh_report_buffer(reportbuf, udev, hiddata, age);
+	if (r<0) {
+		upsdebug_with_errno(1, "Can't retrieve Report %02x", hiddata->ReportID);
+		return -errno;
+	}
+
+	if (*gen && *gen == reportbuf->gen[hiddata->ReportID]) {
+		return 2;
+	}
+	*gen = reportbuf->gen[hiddata->ReportID];
+
+	GetValue(reportbuf->data[hiddata->ReportID], hiddata, &hValue);
+	*Value = logical_to_physical(hiddata, hValue);
 
 	return 1;
 }
 
+/* Get the physical values of <count> items at once, with each report they
+ * are in refreshed no more than once (if older than <age>): ret[i] is like
+ * what HIDGetDataValue() would return for hiddata[i], Value[i] is set if
+ * that is 1. Returns the number of values got.
+ */
+int HIDGetDataValues(hid_dev_handle_t udev, HIDData_t **hiddata, double *Value, int *ret, int count, long age)
+{
+	int	i, j, got = 0;
+
+	for (i = 0; i < count; i++) {
+		ret[i] = 0;
+	}
+
+	for (i = 0; i < count; i++) {
+		uint8_t	id;
+		int	r;
+
+		if (hiddata[i] == NULL || ret[i] != 0) {
+			continue;
+		}
+
+		id = hiddata[i]->ReportID;
+		r = refresh_report_buffer(reportbuf, udev, hiddata[i], age);
+		if (r < 0) {
+			upsdebug_with_errno(1, "Can't retrieve Report %02x", id);
+			r = -errno;
+		}
+
+		/* decode all the items of that report from the one copy */
+		for (j = i; j < count; j++) {
+			long	hValue;
+
+			if (hiddata[j] == NULL || ret[j] != 0 || hiddata[j]->ReportID != id) {
+				continue;
+			}
+
+			if (r < 0) {
+				ret[j] = r;
+				continue;
+			}
+
+			GetValue(reportbuf->data[id], hiddata[j], &hValue);
+			Value[j] = logical_to_physical(hiddata[j], hValue);
+			ret[j] = 1;
+			got++;
+		}
+	}
+
+	return got;
+}
+
 /* Return the physical value associated with the given path.
  * return 1 if OK, 0 on fail, -errno otherwise (ie disconnect).
  */
@@ -554,6 +1099,16 @@ int HIDGetItemValue(hid_dev_handle_t udev, const char *hidpath, double *Value, u
 
 /* Return pointer to indexed string (empty if not found)
  */
+/* The string descriptors do not change while the device is connected, and
+ * each of them is a control transfer: those read for an index are kept
+ * (with the size of the buffer they were read in, as they may have been
+ * cut to it) until HIDStringCacheFree() on reconnection. Failed reads are
+ * not kept, so that they are tried again. */
+static struct {
+	char	*str;
+	size_t	buflen;
+} hid_string[256];
+
 char *HIDGetIndexString(hid_dev_handle_t udev, const int Index, char *buf, size_t buflen)
 {
 	usb_ctrl_strindex	idx;
@@ -624,10 +1179,37 @@ char *HIDGetIndexString(hid_dev_handle_t udev, const int Index, char *buf, size_
 # pragma GCC diagnostic pop
 #endif
 
-	if (comm_driver->get_string(udev, idx, buf, (usb_ctrl_charbufsize)buflen) < 1)
+	if (Index >= 0 && (size_t)Index < sizeof(hid_string) / sizeof(hid_string[0])
+	 && hid_string[Index].str && buflen <= hid_string[Index].buflen
+	) {
+		snprintf(buf, buflen, "%s", hid_string[Index].str);
+		return buf;
+	}
+
+	if (comm_driver->get_string(udev, idx, buf, (usb_ctrl_charbufsize)buflen) < 1) {
 		buf[0] = '\0';
+		return buf;
+	}
+
+	str_rtrim(buf, '\n');
+
+	if (Index >= 0 && (size_t)Index < sizeof(hid_string) / sizeof(hid_string[0])) {
+		free(hid_string[Index].str);
+		hid_string[Index].str = xstrdup(buf);
+		hid_string[Index].buflen = buflen;
+	}
+
+	return buf;
+}
 
-	return str_rtrim(buf, '\n');
+void HIDStringCacheFree(void)
+{
+	size_t	i;
+
+	for (i = 0; i < sizeof(hid_string) / sizeof(hid_string[0]); i++) {
+		free(hid_string[i].str);
+		hid_string[i].str = NULL;
+	}
 }
 
 /* Return pointer to indexed string from HID path (empty if not found)
@@ -663,10 +1245,7 @@ int HIDSetDataValue(hid_dev_handle_t udev, HIDData_t *hiddata, double Value)
 		return 0;
 	}
 
-	/* Process exponents and units */
-	Value /= exponent(10, get_unit_expo(hiddata));
-
-	/* Convert Physical Min, Max and Value into Logical */
+	/* Convert Physical Min, Max and Value (in units) into Logical */
 	hValue = physical_to_logical(hiddata, Value);
 
 	r = set_item_buffered(reportbuf, udev, hiddata, hValue);
@@ -690,12 +1269,21 @@ bool_t HIDSetItemValue(hid_dev_handle_t udev, const char *hidpath, double Value,
 	return TRUE;
 }
 
+/* with libusb-1.0, the interrupt pipe may be read asynchronously */
+#if !((defined SHUT_MODE) && SHUT_MODE) && (defined WITH_LIBUSB_1_0) && WITH_LIBUSB_1_0
+# define HID_INTERRUPT_PENDING()	(nut_libusb_interrupt_pending() > 0)
+#else
+# define HID_INTERRUPT_PENDING()	0
+#endif
+
 /* On success, return item count >0. When no notifications are available,
- * return 'error' or 'no event' code.
+ * return 'error' or 'no event' code. Reports which are already in (see
+ * HID_INTERRUPT_PENDING) are taken along with the first one.
  */
 int HIDGetEvents(hid_dev_handle_t udev, HIDData_t **event, int eventsize)
 {
 	unsigned char	buf[SMALLBUF];
+	unsigned char	seen[256];
 	int		itemCount = 0;
 	int		buflen, ret;
 	size_t	i, r;
@@ -760,46 +1348,61 @@ int HIDGetEvents(hid_dev_handle_t udev, HIDData_t **event, int eventsize)
 # pragma GCC diagnostic pop
 #endif
 
-	buflen = comm_driver->get_interrupt(
-		udev, (usb_ctrl_charbuf)buf,
-		(usb_ctrl_charbufsize)r,
-		750);
+	memset(seen, 0, sizeof(seen));
 
-	if (buflen <= 0) {
-		return buflen;	/* propagate "error" or "no event" code */
-	}
+	do {
+		int	count = 0;
 
-	ret = file_report_buffer(reportbuf, buf, (size_t)buflen);
-	if (ret < 0) {
-		upsdebug_with_errno(1, "%s: failed to buffer report", __func__);
-		return -errno;
-	}
+		buflen = comm_driver->get_interrupt(
+			udev, (usb_ctrl_charbuf)buf,
+			(usb_ctrl_charbufsize)r,
+			750);
 
-	/* now read all items that are part of this report */
-	for (i=0; i<pDesc->nitems; i++) {
+		if (buflen <= 0) {
+			/* propagate "error" or "no event" code */
+			return itemCount ? itemCount : buflen;
+		}
 
-		pData = &pDesc->item[i];
+		ret = file_report_buffer(reportbuf, buf, (size_t)buflen);
+		if (ret < 0) {
+			upsdebug_with_errno(1, "%s: failed to buffer report", __func__);
+			return -errno;
+		}
 
-		/* Variable not part of this report */
-		if (pData->ReportID != buf[0])
+		/* a report got again is in the buffer, with its items listed */
+		if (seen[buf[0]]) {
 			continue;
+		}
+		seen[buf[0]] = 1;
 
-		/* Not an input report */
-		if (pData->Type != ITEM_INPUT)
-			continue;
+		/* now read all items that are part of this report */
+		for (i=0; i<pDesc->nitems; i++) {
 
-		/* maximum number of events reached? */
-		if (itemCount >= eventsize) {
-			upsdebugx(1, "%s: too many events (truncated)", __func__);
-			break;
-		}
+			pData = &pDesc->item[i];
 
-		event[itemCount++] = pData;
-	}
+			/* Variable not part of this report */
+			if (pData->ReportID != buf[0])
+				continue;
 
-	if (itemCount == 0) {
-		upsdebugx(1, "%s: unexpected input report (ignored)", __func__);
-	}
+			/* Not an input report */
+			if (pData->Type != ITEM_INPUT)
+				continue;
+
+			/* maximum number of events reached? */
+			if (itemCount >= eventsize) {
+				upsdebugx(1, "%s: too many events (truncated)", __func__);
+				return itemCount;
+			}
+
+			event[itemCount++] = pData;
+			count++;
+		}
+
+		if (count == 0) {
+			upsdebugx(1, "%s: unexpected input report (ignored)", __func__);
+		}
+	/* more reports which came in meanwhile can be taken at once */
+	} while (HID_INTERRUPT_PENDING());
 
 	return itemCount;
 }
@@ -809,72 +1412,88 @@ int HIDGetEvents(hid_dev_handle_t udev, HIDData_t **event, int eventsize)
  * Support functions
  *******************************************************/
 
-static double logical_to_physical(HIDData_t *Data, long logical)
+/* compute once how the values of an item convert between logical and
+ * physical ones (in units, see get_unit_expo) */
+static void conv_init(HIDData_t *Data)
 {
-	double physical;
-	double Factor;
+	double	Factor;
 
 	upsdebugx(5, "PhyMax = %ld, PhyMin = %ld, LogMax = %ld, LogMin = %ld",
 		Data->PhyMax, Data->PhyMin, Data->LogMax, Data->LogMin);
 
+	Data->ConvUnit = exponent(10, get_unit_expo(Data));
+	Data->ConvScale = Data->ConvUnit;
+	Data->ConvOffset = 0;
+	Data->ConvRange = 0;
+	Data->have_Conv = 1;
+
 	/* HID spec says that if one or both are undefined, or if they are
 	 * both 0, then PhyMin = LogMin, PhyMax = LogMax. */
 	if (!Data->have_PhyMax || !Data->have_PhyMin ||
 		(Data->PhyMax == 0 && Data->PhyMin == 0))
 	{
-		return (double)logical;
+		return;
 	}
 
 	/* Paranoia */
 	if ((Data->PhyMax <= Data->PhyMin) || (Data->LogMax <= Data->LogMin))
 	{
 		/* this should not really happen */
-		upsdebugx(5, "Max was not greater than Min, returning logical value as is");
-		return (double)logical;
+		upsdebugx(5, "Max was not greater than Min, using values as is");
+		return;
 	}
 
 	Factor = (double)(Data->PhyMax - Data->PhyMin) / (Data->LogMax - Data->LogMin);
-	/* Convert Value */
-	physical = (double)((logical - Data->LogMin) * Factor) + Data->PhyMin;
+	Data->ConvScale = Factor * Data->ConvUnit;
+	Data->ConvOffset = (Data->PhyMin - Data->LogMin * Factor) * Data->ConvUnit;
+	Data->ConvMin = Data->PhyMin * Data->ConvUnit;
+	Data->ConvMax = Data->PhyMax * Data->ConvUnit;
+	Data->ConvInv = (double)(Data->LogMax - Data->LogMin) / (Data->PhyMax - Data->PhyMin);
+	Data->ConvRange = 1;
+}
 
-	if (physical > Data->PhyMax) {
-		return Data->PhyMax;
+/* Convert Logical Min, Max and Value into Physical, in units */
+static double logical_to_physical(HIDData_t *Data, long logical)
+{
+	double physical;
+
+	if (!Data->have_Conv) {
+		conv_init(Data);
 	}
 
-	if (physical < Data->PhyMin) {
-		return Data->PhyMin;
+	physical = (double)logical * Data->ConvScale + Data->ConvOffset;
+
+	if (Data->ConvRange) {
+		if (physical > Data->ConvMax) {
+			return Data->ConvMax;
+		}
+
+		if (physical < Data->ConvMin) {
+			return Data->ConvMin;
+		}
 	}
 
 	return physical;
 }
 
+/* Convert a physical value in units into a Logical one */
 static long physical_to_logical(HIDData_t *Data, double physical)
 {
 	long logical;
-	double Factor;
-
-	upsdebugx(5, "PhyMax = %ld, PhyMin = %ld, LogMax = %ld, LogMin = %ld",
-		Data->PhyMax, Data->PhyMin, Data->LogMax, Data->LogMin);
 
-	/* HID spec says that if one or both are undefined, or if they are
-	 * both 0, then PhyMin = LogMin, PhyMax = LogMax. */
-	if (!Data->have_PhyMax || !Data->have_PhyMin ||
-		(Data->PhyMax == 0 && Data->PhyMin == 0))
-	{
-		return (long)physical;
+	if (!Data->have_Conv) {
+		conv_init(Data);
 	}
 
-	/* Paranoia */
-	if ((Data->PhyMax <= Data->PhyMin) || (Data->LogMax <= Data->LogMin))
-	{
-		/* this should not really happen */
-		upsdebugx(5, "Max was not greater than Min, returning physical value as is");
+	/* Process exponents and units */
+	physical /= Data->ConvUnit;
+
+	if (!Data->ConvRange) {
 		return (long)physical;
 	}
 
-	Factor = (double)(Data->LogMax - Data->LogMin) / (Data->PhyMax - Data->PhyMin);
 	/* Convert Value */
-	logical = (long)((physical - Data->PhyMin) * Factor) + Data->LogMin;
+	logical = (long)((physical - Data->PhyMin) * Data->ConvInv) + Data->LogMin;
 
 	if (logical > Data->LogMax)
 		return Data->LogMax;
@@ -1021,24 +1640,98 @@ static int path_to_string(char *string, size_t size, const HIDPath_t *path, usag
 	return i;
 }
 
+/* The usage tables of a subdriver (its own, then hid_usage_lkp) hold
+ * several hundred entries, and each report walks them for every path
+ * component it names. They are indexed on first use, by name (not case
+ * sensitive) and by code, in open addressing hash tables which keep the
+ * first entry of either so that the subdriver ones still override the
+ * defaults. The index is made again if another set of tables comes.
+ */
+static struct {
+	usage_tables_t	*utab;	/* which the index is made of */
+	const usage_lkp_t	**byname, **bycode;
+	size_t	size;		/* slots of each (a power of 2) */
+} usage_index;
+
+static uint32_t usage_code_hash(const HIDNode_t usage)
+{
+	uint32_t	h = (uint32_t)usage * 2654435761U;
+
+	return h ^ (h >> 16);
+}
+
+static void usage_index_free(void)
+{
+	free(usage_index.byname);
+	free(usage_index.bycode);
+	memset(&usage_index, 0, sizeof(usage_index));
+}
+
+static void usage_index_make(usage_tables_t *utab)
+{
+	size_t	i, j, count = 0;
+
+	usage_index_free();
+
+	for (i = 0; utab[i] != NULL; i++) {
+		for (j = 0; utab[i][j].usage_name != NULL; j++) {
+			count++;
+		}
+	}
+
+	for (usage_index.size = 64; usage_index.size < 2 * count; usage_index.size *= 2);
+	usage_index.byname = xcalloc(usage_index.size, sizeof(*usage_index.byname));
+	usage_index.bycode = xcalloc(usage_index.size, sizeof(*usage_index.bycode));
+	usage_index.utab = utab;
+
+	for (i = 0; utab[i] != NULL; i++) {
+		for (j = 0; utab[i][j].usage_name != NULL; j++) {
+			const usage_lkp_t	*entry = &utab[i][j];
+			size_t	k;
+
+			for (k = str_hash_nocase(entry->usage_name) & (usage_index.size - 1);
+				usage_index.byname[k]
+				 && strcasecmp(usage_index.byname[k]->usage_name, entry->usage_name);
+				k = (k + 1) & (usage_index.size - 1));
+			if (!usage_index.byname[k]) {
+				usage_index.byname[k] = entry;
+			}
+
+			for (k = usage_code_hash(entry->usage_code) & (usage_index.size - 1);
+				usage_index.bycode[k]
+				 && usage_index.bycode[k]->usage_code != entry->usage_code;
+				k = (k + 1) & (usage_index.size - 1));
+			if (!usage_index.bycode[k]) {
+				usage_index.bycode[k] = entry;
+			}
+		}
+	}
+
+	upsdebugx(5, "%s: %" PRIuSIZE " usages in %" PRIuSIZE " slots",
+		__func__, count, usage_index.size);
+}
+
 /* usage conversion string -> numeric
  * Returns -1 for error, or a (HIDNode_t) ranged code value
  */
 static long hid_lookup_usage(const char *name, usage_tables_t *utab)
 {
-	int i, j;
+	size_t	k;
 
-	for (i = 0; utab[i] != NULL; i++)
-	{
-		for (j = 0; utab[i][j].usage_name != NULL; j++)
-		{
-			if (strcasecmp(utab[i][j].usage_name, name))
-				continue;
+	if (usage_index.utab != utab) {
+		usage_index_make(utab);
+	}
 
-			/* Note: currently per hidtypes.h, HIDNode_t == uint32_t */
-			upsdebugx(5, "hid_lookup_usage: %s -> %08x", name, (uint32_t)utab[i][j].usage_code);
-			return (long)(utab[i][j].usage_code);
-		}
+	for (k = str_hash_nocase(name) & (usage_index.size - 1);
+		usage_index.byname[k];
+		k = (k + 1) & (usage_index.size - 1)
+	) {
+		if (strcasecmp(usage_index.byname[k]->usage_name, name))
+			continue;
+
+		/* Note: currently per hidtypes.h, HIDNode_t == uint32_t */
+		upsdebugx(5, "hid_lookup_usage: %s -> %08x", name, (uint32_t)usage_index.byname[k]->usage_code);
+		return (long)(usage_index.byname[k]->usage_code);
 	}
 
 	upsdebugx(5, "hid_lookup_usage: %s -> not found in lookup table", name);
@@ -1048,18 +1741,21 @@ static long hid_lookup_usage(const char *name, usage_tables_t *utab)
 /* usage conversion numeric -> string */
 static const char *hid_lookup_path(const HIDNode_t usage, usage_tables_t *utab)
 {
-	int i, j;
+	size_t	k;
 
-	for (i = 0; utab[i] != NULL; i++)
-	{
-		for (j = 0; utab[i][j].usage_name != NULL; j++)
-		{
-			if (utab[i][j].usage_code != usage)
-				continue;
+	if (usage_index.utab != utab) {
+		usage_index_make(utab);
+	}
 
-			upsdebugx(5, "hid_lookup_path: %08x -> %s", (unsigned int)usage, utab[i][j].usage_name);
-			return utab[i][j].usage_name;
-		}
+	for (k = usage_code_hash(usage) & (usage_index.size - 1);
+		usage_index.bycode[k];
+		k = (k + 1) & (usage_index.size - 1)
+	) {
+		if (usage_index.bycode[k]->usage_code != usage)
+			continue;
+
+		upsdebugx(5, "hid_lookup_path: %08x -> %s", (unsigned int)usage, usage_index.bycode[k]->usage_name);
+		return usage_index.bycode[k]->usage_name;
 	}
 
 	upsdebugx(5, "hid_lookup_path: %08x -> not found in lookup table", (unsigned int)usage);
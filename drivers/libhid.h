@@ -70,7 +70,7 @@ typedef int bool_t;
 #define MODE_OPEN	0	/* open a HID device for the first time */
 #define MODE_REOPEN	1	/* reopen a HID device that was opened before */
 
-#define MAX_TS		2	/* validity period of a gotten report (2 sec) */
+#define MAX_TS		2000	/* validity period of a gotten report (2 sec, in msec) */
 
 /* ---------------------------------------------------------------------- */
 
@@ -92,9 +92,15 @@ extern HIDDesc_t	*pDesc;	/* parsed Report Descriptor */
 /* report buffer structure: holds data about most recent report for
    each given report id */
 typedef struct reportbuf_s {
-	time_t	ts[256];			/* timestamp when report was retrieved */
+	uint64_t	ts[256];		/* when report was retrieved (monotonic usec, 0 if not) */
 	size_t	len[256];			/* size of report data */
 	unsigned char	*data[256];		/* report data (allocated) */
+	int	incycle;			/* between HIDBeginCycle() and HIDEndCycle()? */
+	unsigned long	cycle;			/* number of the last cycle begun */
+	unsigned long	cycle_got[256];		/* cycle in which report was last requested */
+	int	cycle_ret[256];			/* ...and the result: 1, or the failed get_report() one */
+	unsigned char	*prev[256];		/* copy of the data as last compared (allocated) */
+	unsigned long	gen[256];		/* bumped when the data differ from that copy (0: never got) */
 } reportbuf_t;
 
 extern reportbuf_t	*reportbuf;	/* buffer for most recent reports */
@@ -131,9 +137,23 @@ HIDData_t *HIDGetItemData(const char *hidpath, usage_tables_t *utab);
 char *HIDGetDataItem(const HIDData_t *hiddata, usage_tables_t *utab);
 
 /*
- * HIDGetDataValue
+ * HIDGetDataValue: a report younger than <age> milliseconds is not read
+ * from the device again
  * -------------------------------------------------------------------------- */
-int HIDGetDataValue(hid_dev_handle_t udev, HIDData_t *hiddata, double *Value, time_t age);
+int HIDGetDataValue(hid_dev_handle_t udev, HIDData_t *hiddata, double *Value, long age);
+
+/*
+ * HIDGetDataValueChanged: like HIDGetDataValue(), but if the report holding
+ * the item is byte for byte the same as when *gen was noted, returns 2
+ * without decoding it. *gen (0 at first) is set to the current change of
+ * the report otherwise.
+ * -------------------------------------------------------------------------- */
+int HIDGetDataValueChanged(hid_dev_handle_t udev, HIDData_t *hiddata, double *Value, long age, unsigned long *gen);
+
+/*
+ * HIDGetDataValues
+ * -------------------------------------------------------------------------- */
+int HIDGetDataValues(hid_dev_handle_t udev, HIDData_t **hiddata, double *Value, int *ret, int count, long age);
 
 /*
  * HIDSetDataValue
@@ -145,11 +165,32 @@ int HIDSetDataValue(hid_dev_handle_t udev, HIDData_t *hiddata, double Value);
  * -------------------------------------------------------------------------- */
 char *HIDGetIndexString(hid_dev_handle_t udev, int Index, char *buf, size_t buflen);
 
+/*
+ * HIDStringCacheFree: forget the strings read by HIDGetIndexString(),
+ * when the device is (re)connected
+ * -------------------------------------------------------------------------- */
+void HIDStringCacheFree(void);
+
 /*
  * HIDGetEvents
  * -------------------------------------------------------------------------- */
 int HIDGetEvents(hid_dev_handle_t udev, HIDData_t **event, int eventlen);
 
+/*
+ * HIDParseCached
+ * -------------------------------------------------------------------------- */
+/* parse the report descriptor <rdbuf> of device <hd>, handled by subdriver
+ * <name> with usage tables <utab> (whose paths HIDGetItemData() then finds
+ * once each), or load it from a cache file in directory <dir> (may be NULL)
+ * if that holds the same descriptor of the same model, along with the
+ * paths found; one such file serves all the units of a model */
+HIDDesc_t *HIDParseCached(const char *dir, HIDDevice_t *hd, const char *name,
+	usage_tables_t *utab, const usb_ctrl_charbuf rdbuf, usb_ctrl_charbufsize rdlen);
+
+/* write the cache file if anything was not in it, returns 0 on failure */
+int HIDCacheSave(void);
+void HIDCacheFree(void);
+
 /*
  * Support functions
  * -------------------------------------------------------------------------- */
@@ -159,4 +200,11 @@ const char *HIDDataType(const HIDData_t *hiddata);
 void free_report_buffer(reportbuf_t *rbuf);
 reportbuf_t *new_report_buffer(HIDDesc_t *pDesc);
 
+/* between these calls (e.g. around a walk through the data), each report
+ * is requested from the device at most once, even if it gets older than
+ * the age asked for meanwhile: all the items in it are then decoded from
+ * the buffer, or fail like the request did */
+void HIDBeginCycle(reportbuf_t *rbuf);
+void HIDEndCycle(reportbuf_t *rbuf);
+
 #endif /* NUT_LIBHID_H_SEEN */
@@ -33,6 +33,8 @@
 #include "common.h" /* for xmalloc, upsdebugx prototypes */
 #include "usb-common.h"
 #include "nut_libusb.h"
+#include "iorec.h"
+#include "nut_probes.h"
 #ifdef WIN32
 #include "wincompat.h"
 #endif	/* WIN32 */
@@ -311,6 +313,11 @@ static int nut_libusb_open(usb_dev_handle **udevp,
 		usb_hid_number_opts_parsed = 1;
 	}
 
+	/* the device I/O is replayed from a recording (see iorec.c) */
+	if (iorec_mode == IOREC_REPLAY) {
+		return nut_usb_iorec_open(udevp, curDevice, matcher, callback);
+	}
+
 	/* libusb base init */
 	usb_init();
 	usb_find_busses();
@@ -549,6 +556,7 @@ static int nut_libusb_open(usb_dev_handle **udevp,
 			 * by several sub-drivers, differing by vendor/model strings)?
 			 */
 			if (!callback) {
+				nut_usb_iorec_device(curDevice, NULL, 0);
 				return 1;
 			}
 
@@ -714,6 +722,7 @@ static int nut_libusb_open(usb_dev_handle **udevp,
 				usb_subdriver.hid_ep_out
 				);
 
+			nut_usb_iorec_device(curDevice, rdbuf, rdlen);
 			fflush(stdout);
 
 			return rdlen;
@@ -830,6 +839,7 @@ static int nut_libusb_get_report(
 	usb_ctrl_charbufsize ReportSize)
 {
 	int	ret;
+	uint64_t	start;
 
 	upsdebugx(4, "Entering nut_libusb_get_report");
 
@@ -837,12 +847,23 @@ static int nut_libusb_get_report(
 		return 0;
 	}
 
-	ret = usb_control_msg(udev,
-		USB_ENDPOINT_IN + USB_TYPE_CLASS + USB_RECIP_INTERFACE,
-		0x01, /* HID_REPORT_GET */
-		ReportId+(0x03<<8), /* HID_REPORT_TYPE_FEATURE */
-		usb_subdriver.hid_rep_index,
-		raw_buf, ReportSize, USB_TIMEOUT);
+	if (iorec_mode == IOREC_REPLAY) {
+		int	len = ReportSize;
+
+		ret = nut_usb_iorec_replay("get_report", ReportId, raw_buf, &len);
+	} else {
+		NUT_PROBE2(usb_transfer, "get_report", (int)ReportId);
+		start = drv_stats_now_usec();
+		ret = usb_control_msg(udev,
+			USB_ENDPOINT_IN + USB_TYPE_CLASS + USB_RECIP_INTERFACE,
+			0x01, /* HID_REPORT_GET */
+			ReportId+(0x03<<8), /* HID_REPORT_TYPE_FEATURE */
+			usb_subdriver.hid_rep_index,
+			raw_buf, ReportSize, USB_TIMEOUT);
+		drv_stats_io(start);
+		NUT_PROBE3(usb_transfer_done, "get_report", (int)ReportId, ret);
+		nut_usb_iorec_record("get_report", ReportId, ret, raw_buf, ret);
+	}
 
 #ifdef WIN32
 	errno = -ret;
@@ -867,17 +888,29 @@ static int nut_libusb_set_report(
 	usb_ctrl_charbufsize ReportSize)
 {
 	int	ret;
+	uint64_t	start;
 
 	if (!udev) {
 		return 0;
 	}
 
-	ret = usb_control_msg(udev,
-		USB_ENDPOINT_OUT + USB_TYPE_CLASS + USB_RECIP_INTERFACE,
-		0x09, /* HID_REPORT_SET = 0x09*/
-		ReportId+(0x03<<8), /* HID_REPORT_TYPE_FEATURE */
-		usb_subdriver.hid_rep_index,
-		raw_buf, ReportSize, USB_TIMEOUT);
+	if (iorec_mode == IOREC_REPLAY) {
+		int	len = 0;
+
+		ret = nut_usb_iorec_replay("set_report", ReportId, NULL, &len);
+	} else {
+		NUT_PROBE2(usb_transfer, "set_report", (int)ReportId);
+		start = drv_stats_now_usec();
+		ret = usb_control_msg(udev,
+			USB_ENDPOINT_OUT + USB_TYPE_CLASS + USB_RECIP_INTERFACE,
+			0x09, /* HID_REPORT_SET = 0x09*/
+			ReportId+(0x03<<8), /* HID_REPORT_TYPE_FEATURE */
+			usb_subdriver.hid_rep_index,
+			raw_buf, ReportSize, USB_TIMEOUT);
+		drv_stats_io(start);
+		NUT_PROBE3(usb_transfer_done, "set_report", (int)ReportId, ret);
+		nut_usb_iorec_record("set_report", ReportId, ret, raw_buf, ReportSize);
+	}
 
 #ifdef WIN32
 	errno = -ret;
@@ -951,6 +984,13 @@ static int nut_libusb_get_interrupt(
 		return -1;
 	}
 
+	if (iorec_mode == IOREC_REPLAY) {
+		int	len = bufsize;
+
+		ret = nut_usb_iorec_replay("interrupt", -1, buf, &len);
+		return nut_libusb_strerror(ret, __func__);
+	}
+
 	/* Interrupt EP is USB_ENDPOINT_IN with offset defined in hid_ep_in, which is 0 by default, unless overridden in subdriver. */
 	ret = usb_interrupt_read(udev, USB_ENDPOINT_IN + usb_subdriver.hid_ep_in, (char *)buf, bufsize, timeout);
 
@@ -963,12 +1003,14 @@ static int nut_libusb_get_interrupt(
 		ret = usb_clear_halt(udev, 0x81);
 	}
 
+	nut_usb_iorec_record("interrupt", -1, ret, buf, ret);
+
 	return nut_libusb_strerror(ret, __func__);
 }
 
 static void nut_libusb_close(usb_dev_handle *udev)
 {
-	if (!udev) {
+	if (!udev || iorec_mode == IOREC_REPLAY) {
 		return;
 	}
 
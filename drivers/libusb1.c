@@ -30,10 +30,17 @@
 #include "common.h" /* for xmalloc, upsdebugx prototypes */
 #include "usb-common.h"
 #include "nut_libusb.h"
+#include "iorec.h"
+#include "nut_probes.h"
 #include "nut_stdint.h"
+#include "dstate.h" /* for dstate_watch_fd() */
+
+#ifndef WIN32
+# include <poll.h>
+#endif	/* !WIN32 */
 
 #define USB_DRIVER_NAME		"USB communication driver (libusb 1.0)"
-#define USB_DRIVER_VERSION	"0.50"
+#define USB_DRIVER_VERSION	"0.52"
 
 /* driver description structure */
 upsdrv_info_t comm_upsdrv_info = {
@@ -47,6 +54,45 @@ upsdrv_info_t comm_upsdrv_info = {
 #define MAX_REPORT_SIZE         0x1800
 
 static void nut_libusb_close(libusb_device_handle *udev);
+static int nut_libusb_hotplug_wait(void);
+static void nut_libusb_hotplug_found(uint16_t vid, uint16_t pid);
+static void nut_libusb_hotplug_lost(void);
+
+/* The interrupt pipe is read asynchronously where libusb has file
+ * descriptors to poll: a transfer is kept submitted on it, the main loop
+ * of the driver wakes up on those fds, and the reports which came in are
+ * queued for get_interrupt() to return without waiting. */
+#define NUT_LIBUSB_INTQ_SIZE	16
+#define NUT_LIBUSB_INTBUF_SIZE	SMALLBUF
+
+static struct libusb_transfer	*int_transfer = NULL;
+static int	int_submitted = 0;	/* the transfer is pending */
+static int	int_status = LIBUSB_SUCCESS;	/* why it stopped, if it did */
+static int	int_async = -1;	/* can be used (1), cannot (0), unknown yet (-1) */
+static unsigned char	int_buf[NUT_LIBUSB_INTBUF_SIZE];
+static struct {
+	int	len;
+	unsigned char	data[NUT_LIBUSB_INTBUF_SIZE];
+} int_queue[NUT_LIBUSB_INTQ_SIZE];
+static size_t	int_qhead = 0, int_qlen = 0;
+
+/* Once the device went away, a reconnection waits for it to come back
+ * where libusb has hotplug support: a callback for the VID/PID of the
+ * device is registered in a context of its own (whose fds also wake up
+ * the main loop), and the bus is only scanned again when a device which
+ * may be ours arrived, or every NUT_LIBUSB_HOTPLUG_RESCAN seconds in case
+ * the arrival was missed or the matcher would take another one. */
+#define NUT_LIBUSB_HOTPLUG_RESCAN	60
+
+#if (defined LIBUSB_API_VERSION) && (LIBUSB_API_VERSION >= 0x01000102)
+# define WITH_LIBUSB_HOTPLUG	1
+static libusb_context	*hp_ctx = NULL;
+static libusb_hotplug_callback_handle	hp_handle;
+static int	hp_arrived = 0;	/* since the last scan */
+static time_t	hp_lastscan = 0;
+static int	hp_known = 0;	/* hp_vid/hp_pid are of the device we had */
+static uint16_t	hp_vid = 0, hp_pid = 0;
+#endif	/* WITH_LIBUSB_HOTPLUG */
 
 /*! Add USB-related driver variables with addvar() and dstate_setinfo().
  * This removes some code duplication across the USB drivers.
@@ -85,6 +131,8 @@ void nut_usb_addvars(void)
 		"option to take the first match if available, or try another "
 		"(association of driver to device may vary between runs)");
 
+	addvar(VAR_VALUE, "usb_enum_cache", "Share the strings of the USB devices with the other drivers of this host, so that each one only opens its own (default: yes)");
+
 	addvar(VAR_VALUE, "usb_set_altinterface", "Force redundant call to usb_set_altinterface() (value=bAlternateSetting; default=0)");
 
 	addvar(VAR_VALUE, "usb_config_index",	"Deeper tuning of USB communications for complex devices");
@@ -174,6 +222,44 @@ static void nut_libusb_subdriver_defaults(usb_communication_subdriver_t *subdriv
  * is accepted, or < 1 if not. If it isn't accepted, the next device
  * (if any) will be tried, until there are no more devices left.
  */
+/* what can be told of <device> without opening it: its IDs and where it
+ * is, in <hd> with the strings in <bus>, <addr> and <port>; returns 0 if
+ * it has no address, so that it can not be looked up in the cache */
+static int nut_libusb_probe(libusb_device *device,
+	const struct libusb_device_descriptor *dev_desc, USBDevice_t *hd,
+	char *bus, char *addr, char *port)
+{
+	uint8_t	device_addr = libusb_get_device_address(device);
+
+	memset(hd, 0, sizeof(*hd));
+	hd->VendorID = dev_desc->idVendor;
+	hd->ProductID = dev_desc->idProduct;
+	hd->bcdDevice = dev_desc->bcdDevice;
+
+	snprintf(bus, 4, "%03d", libusb_get_bus_number(device));
+	hd->Bus = bus;
+	snprintf(addr, 4, "%03d", device_addr);
+	hd->Device = addr;
+#if (defined WITH_USB_BUSPORT) && (WITH_USB_BUSPORT)
+	if (libusb_get_port_number(device) > 0) {
+		snprintf(port, 4, "%03d", libusb_get_port_number(device));
+		hd->BusPort = port;
+	}
+#else
+	NUT_UNUSED_VARIABLE(port);
+#endif
+
+	return device_addr > 0;
+}
+
+/* whether the USB enumeration cache (see usb-common.h) is used */
+static int nut_libusb_enumcache_wanted(void)
+{
+	const char	*val = getval("usb_enum_cache");
+
+	return !val || !(!strcmp(val, "no") || !strcmp(val, "off") || !strcmp(val, "0"));
+}
+
 static int nut_libusb_open(libusb_device_handle **udevp,
 	USBDevice_t *curDevice, USBDeviceMatcher_t *matcher,
 	int (*callback)(libusb_device_handle *udev,
@@ -206,6 +292,10 @@ static int nut_libusb_open(libusb_device_handle **udevp,
 	int count_open_EACCESS = 0;
 	int count_open_errors = 0;
 	int count_open_attempts = 0;
+	int only_arrived;
+	int use_enumcache, count_cache_skipped, strings_ok;
+	USBDevice_t	probe;
+	char	probe_bus[4], probe_addr[4], probe_port[4];
 
 	/* report descriptor */
 	unsigned char	rdbuf[MAX_REPORT_SIZE];
@@ -281,6 +371,11 @@ static int nut_libusb_open(libusb_device_handle **udevp,
 		usb_hid_number_opts_parsed = 1;
 	}
 
+	/* the device I/O is replayed from a recording (see iorec.c) */
+	if (iorec_mode == IOREC_REPLAY) {
+		return nut_usb_iorec_open(udevp, curDevice, matcher, callback);
+	}
+
 	/* libusb base init */
 	if (libusb_init(NULL) < 0) {
 		libusb_exit(NULL);
@@ -302,8 +397,37 @@ static int nut_libusb_open(libusb_device_handle **udevp,
 		libusb_close(*udevp);
 #endif
 
+	/* when reconnecting, do not disturb the other devices on the bus
+	 * again before ours (or a similar one) is back */
+	if ((only_arrived = nut_libusb_hotplug_wait()) < 0) {
+		*udevp = NULL;
+		return -1;
+	}
+
+	use_enumcache = nut_libusb_enumcache_wanted();
+
+rescan:
+	count_open_EACCESS = 0;
+	count_open_errors = 0;
+	count_open_attempts = 0;
+	count_cache_skipped = 0;
+
 	devcount = libusb_get_device_list(NULL, &devlist);
 
+	/* tell the cache which devices are still around, our scan may stop
+	 * at the one it is after */
+	if (use_enumcache) {
+		nut_usb_enumcache_load();
+		for (devnum = 0; (ssize_t)devnum < devcount; devnum++) {
+			libusb_get_device_descriptor(devlist[devnum], &dev_desc);
+			if (nut_libusb_probe(devlist[devnum], &dev_desc, &probe,
+				probe_bus, probe_addr, probe_port)
+			) {
+				nut_usb_enumcache_get(&probe);
+			}
+		}
+	}
+
 	/* devcount may be < 0, loop will get skipped;
 	 * its SSIZE_MAX < SIZE_MAX for devnum */
 	for (devnum = 0; (ssize_t)devnum < devcount; devnum++) {
@@ -316,8 +440,37 @@ static int nut_libusb_open(libusb_device_handle **udevp,
 			devnum + 1, devcount,
 			dev_desc.idVendor, dev_desc.idProduct);
 
+#ifdef WITH_LIBUSB_HOTPLUG
+		if (only_arrived && (dev_desc.idVendor != hp_vid || dev_desc.idProduct != hp_pid)) {
+			upsdebugx(3, "Not the device we wait for, skipping");
+			continue;
+		}
+#endif	/* WITH_LIBUSB_HOTPLUG */
+
 		/* supported vendors are now checked by the supplied matcher */
 
+		/* if the strings of this device are known already, do not open
+		 * it (and disturb its own driver) when they do not match */
+		if (use_enumcache
+		 && nut_libusb_probe(device, &dev_desc, &probe, probe_bus, probe_addr, probe_port)
+		 && nut_usb_enumcache_get(&probe)
+		) {
+			for (m = matcher; m; m = m->next) {
+				if (matches(m, &probe) == 0) {
+					break;
+				}
+			}
+
+			if (m) {
+				upsdebugx(2, "Device %s:%s (%s, %s) is known not to match, skipping",
+					probe.Bus, probe.Device,
+					probe.Vendor ? probe.Vendor : "unknown",
+					probe.Product ? probe.Product : "unknown");
+				count_cache_skipped++;
+				continue;
+			}
+		}
+
 		/* open the device */
 		ret = libusb_open(device, udevp);
 		if (ret != 0) {
@@ -405,6 +558,7 @@ static int nut_libusb_open(libusb_device_handle **udevp,
 		curDevice->VendorID = dev_desc.idVendor;
 		curDevice->ProductID = dev_desc.idProduct;
 		curDevice->bcdDevice = dev_desc.bcdDevice;
+		strings_ok = (device_addr > 0);
 
 		if (dev_desc.iManufacturer) {
 			ret = nut_usb_get_string(udev, dev_desc.iManufacturer,
@@ -417,6 +571,7 @@ static int nut_libusb_open(libusb_device_handle **udevp,
 				}
 			} else {
 				upsdebugx(1, "%s: get Manufacturer string failed", __func__);
+				strings_ok = 0;
 			}
 		}
 
@@ -431,6 +586,7 @@ static int nut_libusb_open(libusb_device_handle **udevp,
 				}
 			} else {
 				upsdebugx(1, "%s: get Product string failed", __func__);
+				strings_ok = 0;
 			}
 		}
 
@@ -445,6 +601,7 @@ static int nut_libusb_open(libusb_device_handle **udevp,
 				}
 			} else {
 				upsdebugx(1, "%s: get Serial Number string failed", __func__);
+				strings_ok = 0;
 			}
 		}
 
@@ -460,6 +617,11 @@ static int nut_libusb_open(libusb_device_handle **udevp,
 		upsdebugx(2, "- Device: %s", curDevice->Device ? curDevice->Device : "unknown");
 		upsdebugx(2, "- Device release number: %04x", curDevice->bcdDevice);
 
+		/* a string which could not be read now might be later */
+		if (use_enumcache && strings_ok) {
+			nut_usb_enumcache_put(curDevice);
+		}
+
 		/* FIXME: extend to Eaton OEMs (HP, IBM, ...) */
 		if ((curDevice->VendorID == 0x463) && (curDevice->bcdDevice == 0x0202)) {
 			if (!getval("usb_hid_desc_index"))
@@ -611,6 +773,11 @@ static int nut_libusb_open(libusb_device_handle **udevp,
 		 * by several sub-drivers, differing by vendor/model strings)?
 		 */
 		if (!callback) {
+			if (use_enumcache) {
+				nut_usb_enumcache_save();
+			}
+			nut_usb_iorec_device(curDevice, NULL, 0);
+			nut_libusb_hotplug_found(dev_desc.idVendor, dev_desc.idProduct);
 			libusb_free_config_descriptor(conf_desc);
 			libusb_free_device_list(devlist, 1);
 			return 1;
@@ -800,6 +967,11 @@ static int nut_libusb_open(libusb_device_handle **udevp,
 			usb_subdriver.hid_ep_out
 			);
 
+		if (use_enumcache) {
+			nut_usb_enumcache_save();
+		}
+		nut_usb_iorec_device(curDevice, rdbuf, rdlen);
+		nut_libusb_hotplug_found(dev_desc.idVendor, dev_desc.idProduct);
 		fflush(stdout);
 		libusb_free_device_list(devlist, 1);
 
@@ -818,8 +990,21 @@ static int nut_libusb_open(libusb_device_handle **udevp,
 	/* If we got here, we did not return a successfully chosen device above */
 	*udevp = NULL;
 	libusb_free_device_list(devlist, 1);
+
+	if (use_enumcache) {
+		nut_usb_enumcache_save();
+
+		/* the cache may be wrong, e.g. about a device which was
+		 * swapped for another one of the same model: make sure */
+		if (count_cache_skipped) {
+			upsdebugx(2, "libusb1: No device found, scanning again without the USB enumeration cache");
+			use_enumcache = 0;
+			goto rescan;
+		}
+	}
 	upsdebugx(2, "libusb1: No appropriate HID device found");
 	fflush(stdout);
+	nut_libusb_hotplug_lost();
 
 	if (devcount < 1 || count_open_attempts == 0) {
 		upslogx(LOG_WARNING,
@@ -924,6 +1109,7 @@ static int nut_libusb_get_report(
 	usb_ctrl_charbufsize ReportSize)
 {
 	int	ret;
+	uint64_t	start;
 
 	upsdebugx(4, "Entering libusb_get_report");
 
@@ -949,13 +1135,24 @@ static int nut_libusb_get_report(
 		return 0;
 	}
 
-	/* libusb0: USB_ENDPOINT_IN + USB_TYPE_CLASS + USB_RECIP_INTERFACE */
-	ret = libusb_control_transfer(udev,
-		LIBUSB_ENDPOINT_IN|LIBUSB_REQUEST_TYPE_CLASS|LIBUSB_RECIPIENT_INTERFACE,
-		0x01, /* HID_REPORT_GET */
-		(uint16_t)ReportId + (0x03<<8), /* HID_REPORT_TYPE_FEATURE */
-		usb_subdriver.hid_rep_index,
-		raw_buf, (uint16_t)ReportSize, USB_TIMEOUT);
+	if (iorec_mode == IOREC_REPLAY) {
+		int	len = (int)ReportSize;
+
+		ret = nut_usb_iorec_replay("get_report", (int)ReportId, raw_buf, &len);
+	} else {
+		/* libusb0: USB_ENDPOINT_IN + USB_TYPE_CLASS + USB_RECIP_INTERFACE */
+		NUT_PROBE2(usb_transfer, "get_report", (int)ReportId);
+		start = drv_stats_now_usec();
+		ret = libusb_control_transfer(udev,
+			LIBUSB_ENDPOINT_IN|LIBUSB_REQUEST_TYPE_CLASS|LIBUSB_RECIPIENT_INTERFACE,
+			0x01, /* HID_REPORT_GET */
+			(uint16_t)ReportId + (0x03<<8), /* HID_REPORT_TYPE_FEATURE */
+			usb_subdriver.hid_rep_index,
+			raw_buf, (uint16_t)ReportSize, USB_TIMEOUT);
+		drv_stats_io(start);
+		NUT_PROBE3(usb_transfer_done, "get_report", (int)ReportId, ret);
+		nut_usb_iorec_record("get_report", (int)ReportId, ret, raw_buf, ret);
+	}
 
 	/* Ignore "protocol stall" (for unsupported request) on control endpoint */
 	if (ret == LIBUSB_ERROR_PIPE) {
@@ -976,6 +1173,7 @@ static int nut_libusb_set_report(
 	usb_ctrl_charbufsize ReportSize)
 {
 	int	ret;
+	uint64_t	start;
 
 #if (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_PUSH_POP) && ( (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_TYPE_LIMITS) || (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_TAUTOLOGICAL_CONSTANT_OUT_OF_RANGE_COMPARE) || (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_TAUTOLOGICAL_UNSIGNED_ZERO_COMPARE) )
 # pragma GCC diagnostic push
@@ -999,13 +1197,24 @@ static int nut_libusb_set_report(
 		return 0;
 	}
 
-	/* libusb0: USB_ENDPOINT_OUT + USB_TYPE_CLASS + USB_RECIP_INTERFACE */
-	ret = libusb_control_transfer(udev,
-		LIBUSB_ENDPOINT_OUT|LIBUSB_REQUEST_TYPE_CLASS|LIBUSB_RECIPIENT_INTERFACE,
-		0x09, /* HID_REPORT_SET = 0x09*/
-		(uint16_t)ReportId + (0x03<<8), /* HID_REPORT_TYPE_FEATURE */
-		usb_subdriver.hid_rep_index,
-		raw_buf, (uint16_t)ReportSize, USB_TIMEOUT);
+	if (iorec_mode == IOREC_REPLAY) {
+		int	len = 0;
+
+		ret = nut_usb_iorec_replay("set_report", (int)ReportId, NULL, &len);
+	} else {
+		/* libusb0: USB_ENDPOINT_OUT + USB_TYPE_CLASS + USB_RECIP_INTERFACE */
+		NUT_PROBE2(usb_transfer, "set_report", (int)ReportId);
+		start = drv_stats_now_usec();
+		ret = libusb_control_transfer(udev,
+			LIBUSB_ENDPOINT_OUT|LIBUSB_REQUEST_TYPE_CLASS|LIBUSB_RECIPIENT_INTERFACE,
+			0x09, /* HID_REPORT_SET = 0x09*/
+			(uint16_t)ReportId + (0x03<<8), /* HID_REPORT_TYPE_FEATURE */
+			usb_subdriver.hid_rep_index,
+			raw_buf, (uint16_t)ReportSize, USB_TIMEOUT);
+		drv_stats_io(start);
+		NUT_PROBE3(usb_transfer_done, "set_report", (int)ReportId, ret);
+		nut_usb_iorec_record("set_report", (int)ReportId, ret, raw_buf, (int)ReportSize);
+	}
 
 	/* Ignore "protocol stall" (for unsupported request) on control endpoint */
 	if (ret == LIBUSB_ERROR_PIPE) {
@@ -1049,6 +1258,347 @@ static int nut_libusb_get_string(
 	return nut_libusb_strerror(ret, __func__);
 }
 
+#ifndef WIN32
+static void LIBUSB_CALL nut_libusb_pollfd_added(int fd, short events, void *user_data)
+{
+	NUT_UNUSED_VARIABLE(user_data);
+
+	dstate_watch_fd(fd, ((events & POLLIN) ? DSTATE_WATCH_READ : 0)
+		| ((events & POLLOUT) ? DSTATE_WATCH_WRITE : 0));
+}
+
+static void LIBUSB_CALL nut_libusb_pollfd_removed(int fd, void *user_data)
+{
+	NUT_UNUSED_VARIABLE(user_data);
+
+	dstate_unwatch_fd(fd);
+}
+#endif	/* !WIN32 */
+
+/* have the main loop wake up on the fds of libusb context <ctx>, returns
+ * 0 if there are none to poll on this platform */
+static int nut_libusb_watch_fds(libusb_context *ctx)
+{
+#ifndef WIN32
+	const struct libusb_pollfd	**fds = libusb_get_pollfds(ctx);
+	size_t	i;
+
+	if (!fds) {
+		return 0;
+	}
+
+	for (i = 0; fds[i]; i++) {
+		nut_libusb_pollfd_added(fds[i]->fd, fds[i]->events, NULL);
+	}
+# if (defined LIBUSB_API_VERSION) && (LIBUSB_API_VERSION >= 0x01000104)
+	libusb_free_pollfds(fds);
+# else
+	free(fds);
+# endif
+
+	libusb_set_pollfd_notifiers(ctx,
+		nut_libusb_pollfd_added, nut_libusb_pollfd_removed, NULL);
+	return 1;
+#else	/* WIN32 */
+	NUT_UNUSED_VARIABLE(ctx);
+	return 0;
+#endif	/* WIN32 */
+}
+
+static void nut_libusb_unwatch_fds(libusb_context *ctx)
+{
+#ifndef WIN32
+	const struct libusb_pollfd	**fds;
+	size_t	i;
+
+	libusb_set_pollfd_notifiers(ctx, NULL, NULL, NULL);
+
+	if ((fds = libusb_get_pollfds(ctx)) == NULL) {
+		return;
+	}
+
+	for (i = 0; fds[i]; i++) {
+		dstate_unwatch_fd(fds[i]->fd);
+	}
+# if (defined LIBUSB_API_VERSION) && (LIBUSB_API_VERSION >= 0x01000104)
+	libusb_free_pollfds(fds);
+# else
+	free(fds);
+# endif
+#endif	/* !WIN32 */
+}
+
+/* runs from libusb_handle_events*(), also those in synchronous calls */
+static void LIBUSB_CALL nut_libusb_interrupt_done(struct libusb_transfer *transfer)
+{
+	int	ret;
+
+	int_submitted = 0;
+
+	switch (transfer->status)
+	{
+	case LIBUSB_TRANSFER_COMPLETED:
+		if (int_qlen == NUT_LIBUSB_INTQ_SIZE) {
+			/* the driver did not keep up: drop the oldest */
+			upsdebugx(1, "%s: queue full, dropping a report", __func__);
+			int_qhead = (int_qhead + 1) % NUT_LIBUSB_INTQ_SIZE;
+			int_qlen--;
+		}
+		ret = (transfer->actual_length > 0) ? transfer->actual_length : 0;
+		if (ret > 0) {
+			size_t	tail = (int_qhead + int_qlen) % NUT_LIBUSB_INTQ_SIZE;
+
+			memcpy(int_queue[tail].data, transfer->buffer, (size_t)ret);
+			int_queue[tail].len = ret;
+			int_qlen++;
+		}
+		break;
+
+	case LIBUSB_TRANSFER_TIMED_OUT:
+		break;
+
+	case LIBUSB_TRANSFER_STALL:
+		/* cleared (synchronously) by the next get_interrupt() */
+		int_status = LIBUSB_ERROR_PIPE;
+		return;
+
+	case LIBUSB_TRANSFER_NO_DEVICE:
+		int_status = LIBUSB_ERROR_NO_DEVICE;
+		return;
+
+	case LIBUSB_TRANSFER_OVERFLOW:
+		int_status = LIBUSB_ERROR_OVERFLOW;
+		return;
+
+	case LIBUSB_TRANSFER_CANCELLED:
+		return;
+
+	case LIBUSB_TRANSFER_ERROR:
+	default:
+		int_status = LIBUSB_ERROR_IO;
+		return;
+	}
+
+	/* re-arm at once, so that no report is missed */
+	if ((ret = libusb_submit_transfer(transfer)) < 0) {
+		int_status = ret;
+	} else {
+		int_submitted = 1;
+	}
+}
+
+/* the asynchronous way of get_interrupt(): returns LIBUSB_SUCCESS with a
+ * report copied to <buf> and its length in <*len>, LIBUSB_ERROR_TIMEOUT
+ * if none came in (yet), or the error which stopped the transfer; or
+ * returns LIBUSB_ERROR_NOT_SUPPORTED if it cannot be used */
+static int nut_libusb_interrupt_async(libusb_device_handle *udev,
+	usb_ctrl_charbuf buf, int *len)
+{
+	struct timeval	zero = { 0, 0 };
+	int	ret;
+
+	if (int_async == 0) {
+		return LIBUSB_ERROR_NOT_SUPPORTED;
+	}
+
+	if (!int_transfer) {
+		if (int_async < 0) {
+			int_async = nut_libusb_watch_fds(NULL);
+			upsdebugx(1, "%s: interrupt pipe is read %ssynchronously",
+				__func__, int_async ? "a" : "");
+			if (!int_async) {
+				return LIBUSB_ERROR_NOT_SUPPORTED;
+			}
+		}
+
+		if ((int_transfer = libusb_alloc_transfer(0)) == NULL) {
+			return LIBUSB_ERROR_NO_MEM;
+		}
+		libusb_fill_interrupt_transfer(int_transfer, udev,
+			LIBUSB_ENDPOINT_IN + usb_subdriver.hid_ep_in,
+			int_buf, (*len < (int)sizeof(int_buf)) ? *len : (int)sizeof(int_buf),
+			nut_libusb_interrupt_done, NULL, 0);
+		int_status = LIBUSB_SUCCESS;
+		int_qhead = int_qlen = 0;
+	}
+
+	/* take what came in since the last call */
+	libusb_handle_events_timeout_completed(NULL, &zero, NULL);
+
+	if (int_qlen) {
+		*len = (int_queue[int_qhead].len < *len) ? int_queue[int_qhead].len : *len;
+		memcpy(buf, int_queue[int_qhead].data, (size_t)*len);
+		int_qhead = (int_qhead + 1) % NUT_LIBUSB_INTQ_SIZE;
+		int_qlen--;
+		return LIBUSB_SUCCESS;
+	}
+
+	ret = int_status;
+	int_status = LIBUSB_SUCCESS;
+
+	/* Clear stall condition */
+	if (ret == LIBUSB_ERROR_PIPE) {
+		ret = libusb_clear_halt(udev, 0x81);
+	}
+
+	if (ret == LIBUSB_SUCCESS && !int_submitted) {
+		ret = libusb_submit_transfer(int_transfer);
+		if (ret == LIBUSB_SUCCESS) {
+			int_submitted = 1;
+		}
+	}
+
+	return (ret == LIBUSB_SUCCESS) ? LIBUSB_ERROR_TIMEOUT : ret;
+}
+
+/* stop reading the interrupt pipe (before the device is closed) */
+static void nut_libusb_interrupt_stop(void)
+{
+	if (int_transfer) {
+		struct timeval	tv = { 0, 100000 };
+		int	tries;
+
+		if (int_submitted && libusb_cancel_transfer(int_transfer) == LIBUSB_SUCCESS) {
+			/* the transfer may only be freed once it is done with */
+			for (tries = 0; int_submitted && tries < 10; tries++) {
+				libusb_handle_events_timeout_completed(NULL, &tv, NULL);
+			}
+		}
+
+		if (!int_submitted) {
+			libusb_free_transfer(int_transfer);
+		}
+		int_transfer = NULL;
+		int_submitted = 0;
+	}
+
+	if (int_async > 0) {
+		nut_libusb_unwatch_fds(NULL);
+		int_async = -1;
+	}
+
+	int_qhead = int_qlen = 0;
+}
+
+#ifdef WITH_LIBUSB_HOTPLUG
+static int LIBUSB_CALL nut_libusb_hotplug_arrived(libusb_context *ctx,
+	libusb_device *device, libusb_hotplug_event event, void *user_data)
+{
+	NUT_UNUSED_VARIABLE(ctx);
+	NUT_UNUSED_VARIABLE(device);
+	NUT_UNUSED_VARIABLE(event);
+	NUT_UNUSED_VARIABLE(user_data);
+
+	hp_arrived = 1;
+	return 0;	/* stay registered */
+}
+
+static void nut_libusb_hotplug_stop(void)
+{
+	if (!hp_ctx) {
+		return;
+	}
+
+	libusb_hotplug_deregister_callback(hp_ctx, hp_handle);
+	nut_libusb_unwatch_fds(hp_ctx);
+	libusb_exit(hp_ctx);
+	hp_ctx = NULL;
+}
+#endif	/* WITH_LIBUSB_HOTPLUG */
+
+/* before a scan of the bus: returns -1 to skip it while waiting for the
+ * device to come back, 1 if only devices with its VID/PID are to be
+ * checked (one of them arrived), 0 for a full scan */
+static int nut_libusb_hotplug_wait(void)
+{
+#ifdef WITH_LIBUSB_HOTPLUG
+	struct timeval	tv = { 0, 0 };
+	time_t	now = time(NULL);
+
+	if (!hp_ctx) {
+		hp_lastscan = now;
+		return 0;
+	}
+
+	libusb_handle_events_timeout_completed(hp_ctx, &tv, NULL);
+
+	if (now - hp_lastscan >= NUT_LIBUSB_HOTPLUG_RESCAN || now < hp_lastscan) {
+		upsdebugx(2, "libusb1: no news of the device for a while, scanning the bus");
+		hp_lastscan = now;
+		hp_arrived = 0;
+		return 0;
+	}
+
+	if (!hp_arrived) {
+		upsdebugx(2, "libusb1: waiting for a device %04X/%04X to arrive",
+			hp_vid, hp_pid);
+		return -1;
+	}
+
+	upsdebugx(2, "libusb1: a device %04X/%04X arrived", hp_vid, hp_pid);
+	hp_arrived = 0;
+	return 1;
+#else	/* !WITH_LIBUSB_HOTPLUG */
+	return 0;
+#endif	/* !WITH_LIBUSB_HOTPLUG */
+}
+
+/* the device was opened, a reconnection will wait for its VID/PID */
+static void nut_libusb_hotplug_found(uint16_t vid, uint16_t pid)
+{
+#ifdef WITH_LIBUSB_HOTPLUG
+	nut_libusb_hotplug_stop();
+	hp_vid = vid;
+	hp_pid = pid;
+	hp_known = 1;
+#else	/* !WITH_LIBUSB_HOTPLUG */
+	NUT_UNUSED_VARIABLE(vid);
+	NUT_UNUSED_VARIABLE(pid);
+#endif	/* !WITH_LIBUSB_HOTPLUG */
+}
+
+/* no device was opened: if we had one, start waiting for it to arrive */
+static void nut_libusb_hotplug_lost(void)
+{
+#ifdef WITH_LIBUSB_HOTPLUG
+	int	ret;
+
+	if (hp_ctx || !hp_known || !libusb_has_capability(LIBUSB_CAP_HAS_HOTPLUG)) {
+		return;
+	}
+
+	if (libusb_init(&hp_ctx) < 0) {
+		hp_ctx = NULL;
+		return;
+	}
+
+	/* the enumeration of the devices already there catches one which
+	 * arrived while the bus was scanned */
+	hp_arrived = 0;
+	ret = libusb_hotplug_register_callback(hp_ctx,
+		LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED, LIBUSB_HOTPLUG_ENUMERATE,
+		hp_vid, hp_pid, LIBUSB_HOTPLUG_MATCH_ANY,
+		nut_libusb_hotplug_arrived, NULL, &hp_handle);
+	if (ret != LIBUSB_SUCCESS) {
+		upsdebugx(1, "libusb1: could not register a hotplug callback: %s",
+			libusb_strerror((enum libusb_error)ret));
+		libusb_exit(hp_ctx);
+		hp_ctx = NULL;
+		return;
+	}
+
+	nut_libusb_watch_fds(hp_ctx);
+	upsdebugx(2, "libusb1: waiting for a device %04X/%04X to arrive, "
+		"the bus is scanned again at least every %d seconds",
+		hp_vid, hp_pid, NUT_LIBUSB_HOTPLUG_RESCAN);
+#endif	/* WITH_LIBUSB_HOTPLUG */
+}
+
+int nut_libusb_interrupt_pending(void)
+{
+	return (int)int_qlen;
+}
+
 /* Expected evaluated types for the API:
  * static int nut_libusb_get_interrupt(libusb_device_handle *udev,
  *	unsigned char *buf, int bufsize, int timeout)
@@ -1094,13 +1644,23 @@ static int nut_libusb_get_interrupt(
 	/* ret = libusb_interrupt_transfer(udev, 0x81, buf, bufsize, &bufsize, timeout); */
 	/* libusb0: ret = usb_interrupt_read(udev, USB_ENDPOINT_IN + usb_subdriver.hid_ep_in, (char *)buf, bufsize, timeout); */
 	/* Interrupt EP is LIBUSB_ENDPOINT_IN with offset defined in hid_ep_in, which is 0 by default, unless overridden in subdriver. */
-	ret = libusb_interrupt_transfer(udev,
-		LIBUSB_ENDPOINT_IN + usb_subdriver.hid_ep_in,
-		(unsigned char *)buf, tmpbufsize, &tmpbufsize, timeout);
+	if (iorec_mode == IOREC_REPLAY) {
+		ret = nut_usb_iorec_replay("interrupt", -1, buf, &tmpbufsize);
+	} else if ((ret = nut_libusb_interrupt_async(udev, buf, &tmpbufsize)) != LIBUSB_ERROR_NOT_SUPPORTED) {
+		nut_usb_iorec_record("interrupt", -1, ret, buf,
+			ret == LIBUSB_SUCCESS ? tmpbufsize : 0);
+	} else {
+		ret = libusb_interrupt_transfer(udev,
+			LIBUSB_ENDPOINT_IN + usb_subdriver.hid_ep_in,
+			(unsigned char *)buf, tmpbufsize, &tmpbufsize, timeout);
 
-	/* Clear stall condition */
-	if (ret == LIBUSB_ERROR_PIPE) {
-		ret = libusb_clear_halt(udev, 0x81);
+		/* Clear stall condition */
+		if (ret == LIBUSB_ERROR_PIPE) {
+			ret = libusb_clear_halt(udev, 0x81);
+		}
+
+		nut_usb_iorec_record("interrupt", -1, ret, buf,
+			ret == LIBUSB_SUCCESS ? tmpbufsize : 0);
 	}
 
 	/* In case of success, return the operation size, as done with libusb 0.1 */
@@ -1118,7 +1678,7 @@ static int nut_libusb_get_interrupt(
 
 static void nut_libusb_close(libusb_device_handle *udev)
 {
-	if (!udev) {
+	if (!udev || iorec_mode == IOREC_REPLAY) {
 		return;
 	}
 
@@ -1126,6 +1686,7 @@ static void nut_libusb_close(libusb_device_handle *udev)
 	 * into uninterruptible sleep.  So don't do it.
 	 */
 	/* libusb_release_interface(udev, usb_subdriver.hid_rep_index); */
+	nut_libusb_interrupt_stop();
 	libusb_close(udev);
 	libusb_exit(NULL);
 }
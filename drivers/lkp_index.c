@@ -0,0 +1,232 @@
+/* lkp_index.c - lazily made indices of the value lookup tables of drivers
+
+   Copyright (C)
+	2026	Network UPS Tools developers
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+/* The lookup tables of the drivers (info_lkp_t of usbhid-ups and snmp-ups)
+ * map device values to NUT strings and back, and are searched for each
+ * value on each poll. On its first use, the entries of a table are sorted
+ * by each of the two keys, keeping the table order of equal keys so that
+ * the first match is the one a scan would find, and a binary search finds
+ * them from then on. The index of a table is found by its address in a
+ * hash table. Short tables are scanned as before.
+ */
+
+#include "config.h" /* must be the first header */
+
+#include "common.h"
+#include "lkp_index.h"
+#include "nut_stdint.h"
+
+/* entries under which a table is just scanned */
+#define LKP_INDEX_MIN	8
+
+struct lkp_index_s {
+	const void	*table;
+	size_t	stride, n;
+	const lkp_index_ops_t	*ops;
+	const void	**by_num;	/* the entries sorted by device value... */
+	const void	**by_str;	/* ...and by NUT value, or NULL if short */
+};
+
+/* open addressing by table address, of lkp_mapsize slots (a power of 2) */
+static lkp_index_t	**lkp_map = NULL;
+static size_t	lkp_mapsize = 0, lkp_mapused = 0;
+
+/* of the table being sorted (qsort() has no context argument) */
+static const lkp_index_ops_t	*sort_ops = NULL;
+
+static size_t lkp_slot(const void *table)
+{
+	uintptr_t	h = (uintptr_t)table;
+
+	h ^= h >> 17;
+	h *= 0x9e3779b1U;
+	h ^= h >> 15;
+
+	return (size_t)h & (lkp_mapsize - 1);
+}
+
+/* by key, then by the order in the table */
+static int cmp_num(const void *a, const void *b)
+{
+	const void	*ea = *(const void * const *)a, *eb = *(const void * const *)b;
+	long	na = sort_ops->num(ea), nb = sort_ops->num(eb);
+
+	if (na != nb)
+		return (na < nb) ? -1 : 1;
+
+	return ((const char *)ea < (const char *)eb) ? -1 : ((const char *)ea > (const char *)eb);
+}
+
+static int cmp_str(const void *a, const void *b)
+{
+	const void	*ea = *(const void * const *)a, *eb = *(const void * const *)b;
+	int	r = strcmp(sort_ops->str(ea), sort_ops->str(eb));
+
+	if (r)
+		return r;
+
+	return ((const char *)ea < (const char *)eb) ? -1 : ((const char *)ea > (const char *)eb);
+}
+
+static lkp_index_t *lkp_make(const void *table, size_t stride, const lkp_index_ops_t *ops)
+{
+	lkp_index_t	*idx = xcalloc(1, sizeof(*idx));
+	const char	*p;
+	size_t	i;
+
+	idx->table = table;
+	idx->stride = stride;
+	idx->ops = ops;
+
+	for (p = table; p && !ops->is_end(p); p += stride) {
+		idx->n++;
+	}
+
+	if (idx->n < LKP_INDEX_MIN) {
+		return idx;
+	}
+
+	idx->by_num = xcalloc(idx->n, sizeof(*idx->by_num));
+	idx->by_str = xcalloc(idx->n, sizeof(*idx->by_str));
+	for (i = 0, p = table; i < idx->n; i++, p += stride) {
+		idx->by_num[i] = idx->by_str[i] = p;
+	}
+
+	sort_ops = ops;
+	qsort(idx->by_num, idx->n, sizeof(*idx->by_num), cmp_num);
+	qsort(idx->by_str, idx->n, sizeof(*idx->by_str), cmp_str);
+	sort_ops = NULL;
+
+	upsdebugx(5, "%s: indexed the %" PRIuSIZE " entries of table %p",
+		__func__, idx->n, table);
+
+	return idx;
+}
+
+lkp_index_t *lkp_index(const void *table, size_t stride, const lkp_index_ops_t *ops)
+{
+	size_t	i;
+
+	if (lkp_mapused * 2 >= lkp_mapsize) {
+		lkp_index_t	**old = lkp_map;
+		size_t	oldsize = lkp_mapsize;
+
+		lkp_mapsize = oldsize ? oldsize * 2 : 64;
+		lkp_map = xcalloc(lkp_mapsize, sizeof(*lkp_map));
+
+		for (i = 0; i < oldsize; i++) {
+			size_t	j;
+
+			if (!old[i])
+				continue;
+
+			for (j = lkp_slot(old[i]->table); lkp_map[j]; j = (j + 1) & (lkp_mapsize - 1));
+			lkp_map[j] = old[i];
+		}
+		free(old);
+	}
+
+	for (i = lkp_slot(table); lkp_map[i]; i = (i + 1) & (lkp_mapsize - 1)) {
+		if (lkp_map[i]->table == table) {
+			return lkp_map[i];
+		}
+	}
+
+	lkp_map[i] = lkp_make(table, stride, ops);
+	lkp_mapused++;
+
+	return lkp_map[i];
+}
+
+const void *lkp_find_num(const lkp_index_t *idx, long key)
+{
+	size_t	lo = 0, hi = idx->n;
+
+	if (!idx->by_num) {
+		const char	*p = idx->table;
+
+		for (; lo < idx->n; lo++, p += idx->stride) {
+			if (idx->ops->num(p) == key)
+				return p;
+		}
+		return NULL;
+	}
+
+	/* the first of the entries not less than the key */
+	while (lo < hi) {
+		size_t	mid = lo + (hi - lo) / 2;
+
+		if (idx->ops->num(idx->by_num[mid]) < key)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	if (lo < idx->n && idx->ops->num(idx->by_num[lo]) == key)
+		return idx->by_num[lo];
+
+	return NULL;
+}
+
+const void *lkp_find_str(const lkp_index_t *idx, const char *key)
+{
+	size_t	lo = 0, hi = idx->n;
+
+	if (!idx->by_str) {
+		const char	*p = idx->table;
+
+		for (; lo < idx->n; lo++, p += idx->stride) {
+			if (!strcmp(idx->ops->str(p), key))
+				return p;
+		}
+		return NULL;
+	}
+
+	while (lo < hi) {
+		size_t	mid = lo + (hi - lo) / 2;
+
+		if (strcmp(idx->ops->str(idx->by_str[mid]), key) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	if (lo < idx->n && !strcmp(idx->ops->str(idx->by_str[lo]), key))
+		return idx->by_str[lo];
+
+	return NULL;
+}
+
+void lkp_index_free(void)
+{
+	size_t	i;
+
+	for (i = 0; i < lkp_mapsize; i++) {
+		if (lkp_map[i]) {
+			free(lkp_map[i]->by_num);
+			free(lkp_map[i]->by_str);
+			free(lkp_map[i]);
+		}
+	}
+
+	free(lkp_map);
+	lkp_map = NULL;
+	lkp_mapsize = lkp_mapused = 0;
+}
@@ -0,0 +1,57 @@
+/* lkp_index.h - lazily made indices of the value lookup tables of drivers
+
+   Copyright (C)
+	2026	Network UPS Tools developers
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#ifndef NUT_LKP_INDEX_H_SEEN
+#define NUT_LKP_INDEX_H_SEEN 1
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+/* *INDENT-OFF* */
+extern "C" {
+/* *INDENT-ON* */
+#endif
+
+/* how the entries of a kind of table are read */
+typedef struct {
+	int	(*is_end)(const void *entry);	/* past the last entry? */
+	long	(*num)(const void *entry);	/* the device value */
+	const char	*(*str)(const void *entry);	/* the NUT value */
+} lkp_index_ops_t;
+
+typedef struct lkp_index_s lkp_index_t;
+
+/* the index of <table>, of entries <stride> bytes long, made on first use */
+lkp_index_t *lkp_index(const void *table, size_t stride, const lkp_index_ops_t *ops);
+
+/* the first entry of the table (in its order) with device value <key>,
+ * or with NUT value <key>; NULL if there is none */
+const void *lkp_find_num(const lkp_index_t *idx, long key);
+const void *lkp_find_str(const lkp_index_t *idx, const char *key);
+
+void lkp_index_free(void);
+
+#ifdef __cplusplus
+/* *INDENT-OFF* */
+}
+/* *INDENT-ON* */
+#endif
+
+#endif	/* NUT_LKP_INDEX_H_SEEN */
@@ -23,13 +23,24 @@
 #include "attribute.h"
 
 #include <regex.h>
+#include <notify.h>
 
 #include "CoreFoundation/CoreFoundation.h"
 #include "IOKit/ps/IOPowerSources.h"
 #include "IOKit/ps/IOPSKeys.h"
 
 #define DRIVER_NAME	"Mac OS X UPS meta-driver"
-#define DRIVER_VERSION	"1.43"
+#define DRIVER_VERSION	"1.44"
+
+/* notify(3) name posted when any power source changes */
+#if (defined kIOPSNotifyAnyPowerSource)
+# define MACOSX_UPS_NOTIFY_NAME	kIOPSNotifyAnyPowerSource
+#elif (defined kIOPSNotifyPowerSource)
+# define MACOSX_UPS_NOTIFY_NAME	kIOPSNotifyPowerSource
+#endif
+
+/* seconds between full updates when changes are notified */
+#define DEFAULT_POLLFREQ	60
 
 /* driver description structure */
 upsdrv_info_t upsdrv_info = {
@@ -47,6 +58,55 @@ upsdrv_info_t upsdrv_info = {
 static CFStringRef g_power_source_name = NULL;
 static double max_capacity_value = 100.0;
 
+/* With power source change notifications (as a notify(3) file descriptor,
+ * which is the extrafd of the driver loop), the power source dictionaries
+ * are only copied again when a change was notified, and every pollfreq
+ * seconds as a heartbeat; without them, at every pollinterval as before.
+ */
+static int notify_token = 0, notify_registered = 0;
+static time_t pollfreq = DEFAULT_POLLFREQ, lastpoll = 0;
+
+static void notify_init(void)
+{
+#ifdef MACOSX_UPS_NOTIFY_NAME
+	int	fd, flags;
+	uint32_t	status;
+
+	status = notify_register_file_descriptor(MACOSX_UPS_NOTIFY_NAME, &fd, 0, &notify_token);
+	if (status != NOTIFY_STATUS_OK) {
+		upslogx(LOG_WARNING, "Could not register for power source change notifications (status %u), polling instead",
+			(unsigned int)status);
+		return;
+	}
+
+	/* the tokens are drained in upsdrv_updateinfo() */
+	flags = fcntl(fd, F_GETFL);
+	if (flags == -1 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1) {
+		upslog_with_errno(LOG_WARNING, "Could not make the notification descriptor non-blocking, polling instead");
+		notify_cancel(notify_token);
+		return;
+	}
+
+	notify_registered = 1;
+	extrafd = fd;
+	upsdebugx(1, "Registered for %s notifications", MACOSX_UPS_NOTIFY_NAME);
+#else
+	upsdebugx(1, "No power source change notifications in this build, polling instead");
+#endif	/* MACOSX_UPS_NOTIFY_NAME */
+}
+
+/* how many notifications came since the previous call */
+static int notify_drain(void)
+{
+	int	token, count = 0;
+
+	while (read(extrafd, &token, sizeof(token)) == (ssize_t)sizeof(token)) {
+		count++;
+	}
+
+	return count;
+}
+
 /*! Copy the current power dictionary.
  *
  * Caller must release power dictionary when finished with it.
@@ -170,9 +230,25 @@ void upsdrv_updateinfo(void)
 	CFBooleanRef is_charging;
 	/* double max_capacity_value = 100.0; */
 	double current_capacity_value;
+	time_t now;
 
 	upsdebugx(1, "upsdrv_updateinfo()");
 
+	time(&now);
+
+	if (notify_registered) {
+		int changes = notify_drain();
+
+		if (!changes && lastpoll && now < lastpoll + pollfreq) {
+			upsdebugx(2, "No power source change notified");
+			return;
+		}
+
+		upsdebugx(2, "%d power source change(s) notified", changes);
+	}
+
+	lastpoll = now;
+
 	power_dictionary = copy_power_dictionary( g_power_source_name );
 	if(!power_dictionary) {
 		dstate_datastale();
@@ -249,13 +325,8 @@ void upsdrv_updateinfo(void)
 		}
 	}
 
-	/* TODO: it should be possible to set poll_interval (and maxage in the
-	 * server) to an absurdly large value, and use notify(3) to get
-	 * updates.
-	 */
-
-	/*
-	 * poll_interval = 2;
+	/* Changes are notified as they come (see notify_init()), so
+	 * poll_interval only bounds the check for them.
 	 */
 
 	dstate_dataok();
@@ -344,6 +415,8 @@ void upsdrv_help(void)
 /* list flags and values that you want to receive via -x */
 void upsdrv_makevartable(void)
 {
+	char temp[SMALLBUF];
+
 	/* allow '-x xyzzy' */
 	/* addvar(VAR_FLAG, "xyzzy", "Enable xyzzy mode"); */
 
@@ -351,6 +424,11 @@ void upsdrv_makevartable(void)
 	/* addvar(VAR_VALUE, "foo", "Override foo setting"); */
 
 	addvar(VAR_VALUE, "model", "Regular Expression to match power source model name");
+
+	snprintf(temp, sizeof(temp),
+		"Interval (in seconds) between full updates when changes are notified (default=%d)",
+		DEFAULT_POLLFREQ);
+	addvar(VAR_VALUE, "pollfreq", temp);
 }
 
 void upsdrv_initups(void)
@@ -465,6 +543,15 @@ void upsdrv_initups(void)
 
 	g_power_source_name = potential_model;
 
+	if (getval("pollfreq")) {
+		pollfreq = atoi(getval("pollfreq"));
+		if (pollfreq < 1) {
+			pollfreq = DEFAULT_POLLFREQ;
+		}
+	}
+
+	notify_init();
+
 	/* the upsh handlers can't be done here, as they get initialized
 	 * shortly after upsdrv_initups returns to main.
 	 */
@@ -479,6 +566,12 @@ void upsdrv_cleanup(void)
 	upsdebugx(1, "Cleanup: release references");
 	CFRelease(g_power_source_name);
 
+	if (notify_registered) {
+		notify_cancel(notify_token);
+		notify_registered = 0;
+		extrafd = ERROR_FD;
+	}
+
 	/* free(dynamic_mem); */
 	/* ser_close(upsfd, device_path); */
 }
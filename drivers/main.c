@@ -27,13 +27,19 @@
 #include "dstate.h"
 #include "attribute.h"
 #include "upsdrvquery.h"
+#include "iorec.h"
+#include "nut_probes.h"
 
 #ifndef WIN32
 # include <grp.h>
 #endif	/* !WIN32 */
+#include <ctype.h>
 #include <fcntl.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#ifndef WIN32
+# include <sys/wait.h>
+#endif	/* !WIN32 */
 
 /* data which may be useful to the drivers */
 TYPE_FD	upsfd = ERROR_FD;
@@ -70,7 +76,8 @@ int	handling_upsdrv_shutdown = 0;
 int	do_lock_port = 1;
 
 /* for dstate->sock_connect, default to effectively
- * asynchronous (0) with fallback to synchronous (1) */
+ * asynchronous (0); "auto" (-1) no longer falls back to synchronous (1)
+ * since writes that would block are queued per connection */
 int	do_synchronous = -1;
 
 /* for detecting -a values that don't match anything */
@@ -81,10 +88,77 @@ static
 # endif /* DRIVERS_MAIN_WITHOUT_MAIN */
 vartab_t	*vartab_h = NULL;
 
+/* vartab_h keeps the order of addvar() calls, for the -h and -L output,
+ * and this table finds its entries by name (without regard for case) for
+ * everything else; only the first entry of a name is put in the table,
+ * as the walk of the list used to find that one */
+static vartab_t	**vartab_table = NULL, *vartab_tail = NULL;
+static size_t	vartab_buckets = 0, vartab_entries = 0;
+
 /* variables possibly set by the global part of ups.conf
  * user and group may be set globally or per-driver
  */
 time_t	poll_interval = 2;
+/* pollinterval when not in whole seconds, and the poll_interval it was
+ * rounded up to (a driver setting poll_interval itself overrides it),
+ * see drv_poll_interval_msec() */
+static long	poll_interval_msec = 0;
+static time_t	poll_interval_msec_sec = 0;
+/* bounds of the adaptive polling interval in milliseconds (0 = same as
+ * pollinterval), see poll_adapt() */
+static long	poll_interval_min = 0, poll_interval_max = 0;
+
+/* save the states for the next run, and serve those of the last one while
+ * the device is initialized ("statesnapshot") */
+static int	do_snapshot = 0;
+
+/* take connections on the driver socket (and detach) before the device is
+ * initialized, which they then wait for ("lazyinit") */
+static int	do_lazyinit = 0;
+
+/* count allocations and publish the driver.stats.mem.* variables
+ * ("memstats") */
+static int	do_memstats = 0;
+
+/* sub-schedules of the driver, see drv_schedule_add() */
+typedef struct drv_schedule_s {
+	char	*name;
+	time_t	interval;
+	void	(*func)(void);
+	struct timeval	due;
+	struct drv_schedule_s	*next;
+} drv_schedule_t;
+
+static drv_schedule_t	*schedules = NULL;
+
+/* one-shot timers of the driver, see drv_timer_add() */
+typedef struct drv_timer_s {
+	int	id;
+	char	*name;
+	int	(*func)(void *arg);
+	void	*arg;
+	struct timeval	due;
+	struct drv_timer_s	*next;
+} drv_timer_t;
+
+static drv_timer_t	*timers = NULL;
+static int	timer_last_id = 0;
+
+/* pending I/O of a protocol layer, served during the waits, see drv_waiter_set() */
+static void	(*waiter_wake)(struct timeval *wake) = NULL;
+static int	(*waiter_run)(const struct timeval *now) = NULL;
+
+/* timing of driver activity, see drv_stats_add() */
+#define DRV_STATS_SAMPLES	128
+
+typedef struct {
+	uint64_t	usec[DRV_STATS_SAMPLES];	/* the latest calls, a ring */
+	size_t	count;		/* calls so far */
+	unsigned long	overruns;	/* which took longer than pollinterval */
+	int	changed;	/* since last published */
+} drv_stats_t;
+
+static drv_stats_t	drv_stats[DRV_STATS_KINDS];
 static char	*chroot_path = NULL, *user = NULL, *group = NULL;
 static int	user_from_cmdline = 0, group_from_cmdline = 0;
 
@@ -135,6 +209,12 @@ static char	*pidfn = NULL;
 static int	help_only = 0,
 		cli_args_accepted = 0,
 		dump_data = 0; /* Store the update_count requested */
+
+/* "driver host" mode, with several -a options: names of the devices, and
+ * the one this process is the instance for after host_spawn() forked it */
+static char	**host_names = NULL;
+static size_t	host_count = 0;
+static const char	*host_name = NULL;
 #endif /* DRIVERS_MAIN_WITHOUT_MAIN */
 
 /* pre-declare some private methods used */
@@ -223,7 +303,9 @@ static void help_msg(void)
 	printf("\nusage: %s (-a <id>|-s <id>) [OPTIONS]\n", progname);
 
 	printf("  -a <id>        - autoconfig using ups.conf section <id>\n");
-	printf("                 - note: -x after -a overrides ups.conf settings\n\n");
+	printf("                 - note: -x after -a overrides ups.conf settings\n");
+	printf("                 - note: can be given several times to start one\n");
+	printf("                   instance for each device from a single process\n\n");
 
 	printf("  -s <id>        - configure directly from cmd line arguments\n");
 	printf("                 - note: must specify all driver parameters with successive -x\n");
@@ -301,6 +383,52 @@ static void help_msg(void)
 }
 #endif /* DRIVERS_MAIN_WITHOUT_MAIN */
 
+static vartab_t *vartab_find(const char *var)
+{
+	vartab_t	*tmp;
+
+	if (!vartab_buckets || !var)
+		return NULL;
+
+	for (tmp = vartab_table[str_hash_nocase(var) & (vartab_buckets - 1)];
+		tmp; tmp = tmp->hashnext
+	) {
+		if (!strcasecmp(tmp->var, var))
+			return tmp;
+	}
+
+	return NULL;
+}
+
+static void vartab_hash_add(vartab_t *item)
+{
+	vartab_t	**slot;
+
+	if (vartab_find(item->var))
+		return;	/* the earlier one of that name is what is looked up */
+
+	slot = &vartab_table[str_hash_nocase(item->var) & (vartab_buckets - 1)];
+	item->hashnext = *slot;
+	*slot = item;
+	vartab_entries++;
+}
+
+/* keep chains short as the number of entries grows */
+static void vartab_grow(void)
+{
+	vartab_t	*tmp;
+
+	vartab_buckets = vartab_buckets ? 2 * vartab_buckets : 64;
+	free(vartab_table);
+	vartab_table = xcalloc(vartab_buckets, sizeof(*vartab_table));
+	vartab_entries = 0;
+
+	for (tmp = vartab_h; tmp; tmp = tmp->next) {
+		tmp->hashnext = NULL;
+		vartab_hash_add(tmp);
+	}
+}
+
 /* store these in dstate as driver.(parameter|flag) */
 # ifndef DRIVERS_MAIN_WITHOUT_MAIN
 static
@@ -330,7 +458,7 @@ static
 # endif /* DRIVERS_MAIN_WITHOUT_MAIN */
 void storeval(const char *var, char *val)
 {
-	vartab_t	*tmp, *last;
+	vartab_t	*tmp;
 
 	/* NOTE: (FIXME?) The override and default mechanisms here
 	 * effectively bypass both VAR_SENSITIVE protections and
@@ -361,38 +489,22 @@ void storeval(const char *var, char *val)
 		return;
 	}
 
-	tmp = last = vartab_h;
-
-	while (tmp) {
-		last = tmp;
-
-		/* sanity check */
-		if (!tmp->var) {
-			tmp = tmp->next;
-			continue;
-		}
-
-		/* later definitions overwrite earlier ones */
-		if (!strcasecmp(tmp->var, var)) {
-			free(tmp->val);
-
-			if (val)
-				tmp->val = xstrdup(val);
-
-			/* don't keep things like SNMP community strings */
-			if ((tmp->vartype & VAR_SENSITIVE) == 0) {
-				dparam_setinfo(var, val);
-			} else {
-				upsdebugx(4, "%s: skip dparam_setinfo() "
-					"for sensitive variable '%s'",
-					__func__, var);
-			}
+	/* later definitions overwrite earlier ones */
+	if ((tmp = vartab_find(var)) != NULL) {
+		free(tmp->val);
+		tmp->val = val ? xstrdup(val) : NULL;
 
-			tmp->found = 1;
-			return;
+		/* don't keep things like SNMP community strings */
+		if ((tmp->vartype & VAR_SENSITIVE) == 0) {
+			dparam_setinfo(var, val);
+		} else {
+			upsdebugx(4, "%s: skip dparam_setinfo() "
+				"for sensitive variable '%s'",
+				__func__, var);
 		}
 
-		tmp = tmp->next;
+		tmp->found = 1;
+		return;
 	}
 
 	/* try to help them out */
@@ -438,29 +550,32 @@ void storeval(const char *var, char *val)
 /* retrieve the value of variable <var> if possible */
 char *getval(const char *var)
 {
-	vartab_t	*tmp = vartab_h;
-
-	while (tmp) {
-		if (!strcasecmp(tmp->var, var))
-			return(tmp->val);
-		tmp = tmp->next;
-	}
+	vartab_t	*tmp = vartab_find(var);
 
-	return NULL;
+	return tmp ? tmp->val : NULL;
 }
 
 /* see if <var> has been defined, even if no value has been given to it */
 int testvar(const char *var)
 {
-	vartab_t	*tmp = vartab_h;
+	vartab_t	*tmp = vartab_find(var);
 
-	while (tmp) {
-		if (!strcasecmp(tmp->var, var))
-			return tmp->found;
-		tmp = tmp->next;
-	}
+	return tmp ? tmp->found : 0;
+}
 
-	return 0;	/* not found */
+const vartab_t *vartab_handle(const char *var)
+{
+	return vartab_find(var);
+}
+
+char *getval_handle(const vartab_t *handle)
+{
+	return handle ? handle->val : NULL;
+}
+
+int testvar_handle(const vartab_t *handle)
+{
+	return handle ? handle->found : 0;
 }
 
 /* See if <var> can be (re-)loaded now: either is reloadable by definition,
@@ -470,7 +585,7 @@ int testvar(const char *var)
  */
 int testvar_reloadable(const char *var, const char *val, int vartype)
 {
-	vartab_t	*tmp = vartab_h;
+	vartab_t	*tmp = vartab_find(var);
 	int	verdict = -2;
 
 	/* FIXME: handle VAR_FLAG typed (bitmask) values specially somehow?
@@ -482,98 +597,95 @@ int testvar_reloadable(const char *var, const char *val, int vartype)
 	upsdebugx(6, "%s: searching for var=%s, vartype=%d, reload_flag=%d",
 		__func__, NUT_STRARG(var), vartype, reload_flag);
 
-	while (tmp) {
-		if (!strcasecmp(tmp->var, var)) {
-			/* variable name is known */
-			upsdebugx(6, "%s: found var=%s, val='%s' => '%s', vartype=%d => %d, found=%d, reloadable=%d, reload_flag=%d",
-				__func__, NUT_STRARG(var),
-				NUT_STRARG(tmp->val), NUT_STRARG(val),
-				tmp->vartype, vartype,
-				tmp->found, tmp->reloadable, reload_flag);
-
-			if (val && tmp->val) {
-				/* a value is already known by name
-				 * and bitmask for VAR_FLAG/VAR_VALUE matches
-				 */
-				if ((vartype & tmp->vartype) && !strcasecmp(tmp->val, val)) {
-					if ((tmp->vartype & VAR_FLAG) && val == NULL) {
-						if (reload_flag) {
-							upsdebugx(1, "%s: setting '%s' "
-								"exists and is a flag; "
-								"new value was not specified",
-								__func__, var);
-						}
-
-						/* by default: apply flags initially, ignore later */
-						verdict = (
-							(!reload_flag)	/* For initial config reads, legacy code trusted what it saw */
-							|| tmp->reloadable	/* set in addvar*() */
-						);
-						goto finish;
-					}
-
+	if (tmp) {
+		/* variable name is known */
+		upsdebugx(6, "%s: found var=%s, val='%s' => '%s', vartype=%d => %d, found=%d, reloadable=%d, reload_flag=%d",
+			__func__, NUT_STRARG(var),
+			NUT_STRARG(tmp->val), NUT_STRARG(val),
+			tmp->vartype, vartype,
+			tmp->found, tmp->reloadable, reload_flag);
+
+		if (val && tmp->val) {
+			/* a value is already known by name
+			 * and bitmask for VAR_FLAG/VAR_VALUE matches
+			 */
+			if ((vartype & tmp->vartype) && !strcasecmp(tmp->val, val)) {
+				if ((tmp->vartype & VAR_FLAG) && val == NULL) {
 					if (reload_flag) {
 						upsdebugx(1, "%s: setting '%s' "
-							"exists and is unmodified",
+							"exists and is a flag; "
+							"new value was not specified",
 							__func__, var);
 					}
 
-					verdict = -1;	/* no-op for caller */
-					goto finish;
-				} else {
-					/* warn loudly if we are reloading and
-					 * can not change this modified value */
-					upsdebugx((reload_flag ? (tmp->reloadable ? 1 : 0) : 1),
-						"%s: setting '%s' exists and differs: "
-						"new type bitmask %d vs. %d, "
-						"new value '%s' vs. '%s'%s",
-						__func__, var,
-						vartype, tmp->vartype,
-						val, tmp->val,
-						((!reload_flag || tmp->reloadable) ? "" :
-							" (driver restart is needed to apply)")
-						);
-					/* FIXME: Define a special EXIT_RELOAD or something,
-					 * for "not quite a failure"? Or close connections
-					 * and re-exec() this driver from scratch (and so to
-					 * keep MAINPID for systemd et al)?
-					 */
-					if (reload_flag == 2 && !tmp->reloadable)
-						fatalx(
-#ifndef WIN32
-							(128 + SIGCMD_RELOAD_OR_EXIT)
-#else	/* WIN32 */
-							EXIT_SUCCESS
-#endif	/* WIN32 */
-							, "NUT driver reload-or-exit: setting %s was changed and requires a driver restart", var);
-
+					/* by default: apply flags initially, ignore later */
 					verdict = (
 						(!reload_flag)	/* For initial config reads, legacy code trusted what it saw */
 						|| tmp->reloadable	/* set in addvar*() */
 					);
+					goto finish;
+				}
+
+				if (reload_flag) {
+					upsdebugx(1, "%s: setting '%s' "
+						"exists and is unmodified",
+						__func__, var);
+				}
+
+				verdict = -1;	/* no-op for caller */
+				goto finish;
+			} else {
+				/* warn loudly if we are reloading and
+				 * can not change this modified value */
+				upsdebugx((reload_flag ? (tmp->reloadable ? 1 : 0) : 1),
+					"%s: setting '%s' exists and differs: "
+					"new type bitmask %d vs. %d, "
+					"new value '%s' vs. '%s'%s",
+					__func__, var,
+					vartype, tmp->vartype,
+					val, tmp->val,
+					((!reload_flag || tmp->reloadable) ? "" :
+						" (driver restart is needed to apply)")
+					);
+				/* FIXME: Define a special EXIT_RELOAD or something,
+				 * for "not quite a failure"? Or close connections
+				 * and re-exec() this driver from scratch (and so to
+				 * keep MAINPID for systemd et al)?
+				 */
+				if (reload_flag == 2 && !tmp->reloadable)
+					fatalx(
+#ifndef WIN32
+						(128 + SIGCMD_RELOAD_OR_EXIT)
+#else	/* WIN32 */
+						EXIT_SUCCESS
+#endif	/* WIN32 */
+						, "NUT driver reload-or-exit: setting %s was changed and requires a driver restart", var);
 
-					/* handle reload-or-error reports */
-					if (verdict == 0) {
-						if (reload_requires_restart < 1)
-							reload_requires_restart = 1;
-						else
-							reload_requires_restart++;
-					}
+				verdict = (
+					(!reload_flag)	/* For initial config reads, legacy code trusted what it saw */
+					|| tmp->reloadable	/* set in addvar*() */
+				);
 
-					goto finish;
+				/* handle reload-or-error reports */
+				if (verdict == 0) {
+					if (reload_requires_restart < 1)
+						reload_requires_restart = 1;
+					else
+						reload_requires_restart++;
 				}
-			}
 
-			/* okay to redefine if not yet defined, or if reload is allowed,
-			 * or if initially loading the configs
-			 */
-			verdict = (
-				(!reload_flag)
-				|| ((!tmp->found) || tmp->reloadable)
-			);
-			goto finish;
+				goto finish;
+			}
 		}
-		tmp = tmp->next;
+
+		/* okay to redefine if not yet defined, or if reload is allowed,
+		 * or if initially loading the configs
+		 */
+		verdict = (
+			(!reload_flag)
+			|| ((!tmp->found) || tmp->reloadable)
+		);
+		goto finish;
 	}
 
 	verdict = 1;	/* not found, may (re)load the definition */
@@ -735,14 +847,7 @@ finish:
 /* implement callback from driver - create the table for -x/conf entries */
 static void do_addvar(int vartype, const char *name, const char *desc, int reloadable)
 {
-	vartab_t	*tmp, *last;
-
-	tmp = last = vartab_h;
-
-	while (tmp) {
-		last = tmp;
-		tmp = tmp->next;
-	}
+	vartab_t	*tmp;
 
 	tmp = xmalloc(sizeof(vartab_t));
 
@@ -753,11 +858,18 @@ static void do_addvar(int vartype, const char *name, const char *desc, int reloa
 	tmp->found = 0;
 	tmp->reloadable = reloadable;
 	tmp->next = NULL;
+	tmp->hashnext = NULL;
 
-	if (last)
-		last->next = tmp;
+	if (vartab_tail)
+		vartab_tail->next = tmp;
 	else
 		vartab_h = tmp;
+	vartab_tail = tmp;
+
+	if (vartab_entries >= vartab_buckets)
+		vartab_grow();	/* puts the new one in too */
+	else
+		vartab_hash_add(tmp);
 }
 
 /* public callback from driver - create the table for -x/conf entries for reloadable values */
@@ -1145,11 +1257,118 @@ invalid:
 	return STAT_SET_INVALID;
 }
 
+long drv_poll_interval_msec(void)
+{
+	if (poll_interval_msec > 0 && poll_interval == poll_interval_msec_sec)
+		return poll_interval_msec;
+
+	return (long)poll_interval * 1000;
+}
+
+/* an interval in seconds, possibly with a fraction ("0.25"), in
+ * milliseconds; returns 0 if it is not a positive number */
+static long interval_msec(const char *val)
+{
+	char	*end = NULL;
+	double	sec;
+
+	if (!val)
+		return 0;
+
+	sec = strtod(val, &end);
+	if (end == val || *end != '\0' || sec * 1000 < 1 || sec * 1000 > INT_MAX)
+		return 0;
+
+	return (long)(sec * 1000 + 0.5);
+}
+
+/* the other way around, as the old value for testval_reloadable() */
+static const char *interval_str(long msec, char *buf, size_t bufsize)
+{
+	char	*p;
+
+	if (msec % 1000 == 0) {
+		snprintf(buf, bufsize, "%ld", msec / 1000);
+		return buf;
+	}
+
+	snprintf(buf, bufsize, "%ld.%03ld", msec / 1000, msec % 1000);
+	for (p = buf + strlen(buf) - 1; *p == '0'; p--)
+		*p = '\0';
+
+	return buf;
+}
+
+static void set_poll_interval(long msec)
+{
+	poll_interval = (time_t)((msec + 999) / 1000);
+
+	if (msec % 1000) {
+		poll_interval_msec = msec;
+		poll_interval_msec_sec = poll_interval;
+	} else {
+		poll_interval_msec = 0;
+	}
+}
+
 /* handle -x / ups.conf config details that are for this part of the code */
-static int main_arg(char *var, char *val)
+/* pollinterval, in the global section or in that of the device, and the
+ * driver does not need to restart to apply changes: <where> tells which
+ * for the error message */
+static void set_pollinterval(const char *var, const char *val, const char *where)
+{
+	char	buf[SMALLBUF];
+	int	do_handle = 1;
+	long	msec;
+
+	/* log a message if value changed */
+	interval_str(drv_poll_interval_msec(), buf, sizeof(buf));
+	if ((do_handle = testval_reloadable(var, buf, val, 1)) == 0) {
+		/* Should not happen, but... */
+		fatalx(EXIT_FAILURE, "Error: failed to check "
+			"testval_reloadable() for pollinterval: "
+			"old %s vs. new %s", buf, NUT_STRARG(val));
+	}
+
+	if (do_handle <= 0)
+		return;	/* no-op */
+
+	if ((msec = interval_msec(val)) <= 0) {
+		fatalx(EXIT_FAILURE, "Error: %sinvalid pollinterval: %s",
+			where, NUT_STRARG(val));
+	}
+
+	set_poll_interval(msec);
+}
+
+/* pollinterval_min and pollinterval_max, likewise */
+static void set_pollinterval_bound(const char *var, const char *val,
+	long *bound)
 {
-	int do_handle = -2;
+	char	buf[SMALLBUF];
+	int	do_handle = 1;
+	long	msec;
+
+	interval_str(*bound, buf, sizeof(buf));
+	if ((do_handle = testval_reloadable(var, buf, val, 1)) == 0) {
+		/* Should not happen, but... */
+		fatalx(EXIT_FAILURE, "Error: failed to check "
+			"testval_reloadable() for %s: "
+			"old %s vs. new %s", var, buf, NUT_STRARG(val));
+	}
+
+	if (do_handle <= 0)
+		return;
+
+	if ((msec = interval_msec(val)) <= 0) {
+		fatalx(EXIT_FAILURE, "Error: invalid %s: %s", var, NUT_STRARG(val));
+	}
 
+	*bound = msec;
+}
+
+static int main_arg(char *var, char *val)
+{
 	/* flags for main */
 
 	upsdebugx(3, "%s: var='%s' val='%s'",
@@ -1183,6 +1402,17 @@ static int main_arg(char *var, char *val)
 		return 1;	/* handled */
 	}
 
+	if (!strcmp(var, "memstats")) {
+		if (reload_flag) {
+			upsdebugx(6, "%s: SKIP: flag var='%s' can not be reloaded", __func__, var);
+		} else {
+			do_memstats = 1;
+			nut_mem_enable();
+			dstate_setinfo("driver.flag.memstats", "enabled");
+		}
+		return 1;	/* handled */
+	}
+
 	if (!strcmp(var, "allow_killpower")) {
 		if (reload_flag) {
 			upsdebugx(6, "%s: SKIP: flag var='%s' currently can not be reloaded "
@@ -1263,28 +1493,10 @@ static int main_arg(char *var, char *val)
 	 * be noticed by the reload operation currently, however.
 	 */
 	if (!strcmp(var, "pollinterval")) {
-		char buf[SMALLBUF];
-
-		/* log a message if value changed; skip if no good buf */
-		if (snprintf(buf, sizeof(buf), "%" PRIdMAX, (intmax_t)poll_interval)) {
-			if ((do_handle = testval_reloadable(var, buf, val, 1)) == 0) {
-				/* Should not happen, but... */
-				fatalx(EXIT_FAILURE, "Error: failed to check "
-					"testval_reloadable() for pollinterval: "
-					"old %s vs. new %s", buf, NUT_STRARG(val));
-			}
-		}
-
-		if (do_handle > 0) {
-			int ipv = atoi(val);
-			if (ipv > 0) {
-				poll_interval = (time_t)ipv;
-			} else {
-				fatalx(EXIT_FAILURE, "Error: UPS [%s]: invalid pollinterval: %d",
-					NUT_STRARG(upsname), ipv);
-			}
-		}	/* else: no-op */
+		char	where[SMALLBUF];
 
+		snprintf(where, sizeof(where), "UPS [%s]: ", NUT_STRARG(upsname));
+		set_pollinterval(var, val, where);
 		return 1;	/* handled */
 	}
 
@@ -1311,10 +1523,33 @@ static int main_arg(char *var, char *val)
 		return 1;	/* handled */
 	}
 
+	if (!strcmp(var, "statesnapshot")) {
+		do_snapshot = (!strcmp(val, "yes") || !strcmp(val, "on") || !strcmp(val, "1"));
+		return 1;	/* handled */
+	}
+
+	if (!strcmp(var, "lazyinit")) {
+		do_lazyinit = (!strcmp(val, "yes") || !strcmp(val, "on") || !strcmp(val, "1"));
+		return 1;	/* handled */
+	}
+
+	if (!strcmp(var, "pollinterval_min")) {
+		set_pollinterval_bound(var, val, &poll_interval_min);
+		return 1;	/* handled */
+	}
+
+	if (!strcmp(var, "pollinterval_max")) {
+		set_pollinterval_bound(var, val, &poll_interval_max);
+		return 1;	/* handled */
+	}
+
 	/* only for upsdrvctl - ignored here */
 	if (!strcmp(var, "sdorder"))
 		return 1;	/* handled */
 
+	if (!strcmp(var, "driverhost"))
+		return 1;	/* handled */
+
 	if (!strcmp(var, "maxstartdelay"))
 		return 1;	/* handled */
 
@@ -1382,7 +1617,6 @@ static int main_arg(char *var, char *val)
 static void do_global_args(const char *var, const char *val)
 {
 	char buf[SMALLBUF];
-	int do_handle = 1;
 
 	upsdebugx(3, "%s: var='%s' val='%s'",
 		__func__,
@@ -1391,25 +1625,27 @@ static void do_global_args(const char *var, const char *val)
 
 	/* Allow to reload this, why not */
 	if (!strcmp(var, "pollinterval")) {
-		/* log a message if value changed; skip if no good buf */
-		if (snprintf(buf, sizeof(buf), "%" PRIdMAX, (intmax_t)poll_interval)) {
-			if ((do_handle = testval_reloadable(var, buf, val, 1)) == 0) {
-				/* Should not happen, but... */
-				fatalx(EXIT_FAILURE, "Error: failed to check "
-					"testval_reloadable() for pollinterval: "
-					"old %s vs. new %s", buf, val);
-			}
-		}
+		set_pollinterval(var, val, "");
+		return;
+	}
 
-		if (do_handle > 0) {
-			int ipv = atoi(val);
-			if (ipv > 0) {
-				poll_interval = (time_t)ipv;
-			} else {
-				fatalx(EXIT_FAILURE, "Error: invalid pollinterval: %d", ipv);
-			}
-		}	/* else: no-op */
+	if (!strcmp(var, "statesnapshot")) {
+		do_snapshot = (!strcmp(val, "yes") || !strcmp(val, "on") || !strcmp(val, "1"));
+		return;
+	}
+
+	if (!strcmp(var, "lazyinit")) {
+		do_lazyinit = (!strcmp(val, "yes") || !strcmp(val, "on") || !strcmp(val, "1"));
+		return;
+	}
+
+	if (!strcmp(var, "pollinterval_min")) {
+		set_pollinterval_bound(var, val, &poll_interval_min);
+		return;
+	}
 
+	if (!strcmp(var, "pollinterval_max")) {
+		set_pollinterval_bound(var, val, &poll_interval_max);
 		return;
 	}
 
@@ -1736,7 +1972,7 @@ static int handle_reload_flag(void) {
 	 */
 	reload_requires_restart = -1;
 	/* 0 - Do not abort drivers started with '-s TMP_UPS_NAME' */
-	if (read_upsconf(0) < 0) {
+	if (read_upsconf_section(upsname, 0) < 0) {
 		upsdebugx(1, "%s: read_upsconf() failed fundamentally; "
 			"is this driver running via ups.conf at all?",
 			__func__);
@@ -1848,6 +2084,11 @@ void vartab_free(void)
 
 		tmp = next;
 	}
+
+	vartab_h = vartab_tail = NULL;
+	free(vartab_table);
+	vartab_table = NULL;
+	vartab_buckets = vartab_entries = 0;
 }
 
 #ifndef DRIVERS_MAIN_WITHOUT_MAIN
@@ -1857,6 +2098,32 @@ static void exit_upsdrv_cleanup(void)
 	upsdrv_cleanup();
 }
 
+static void schedules_free(void)
+{
+	drv_schedule_t	*sched, *next;
+
+	for (sched = schedules; sched; sched = next) {
+		next = sched->next;
+		free(sched->name);
+		free(sched);
+	}
+
+	schedules = NULL;
+}
+
+static void timers_free(void)
+{
+	drv_timer_t	*timer, *next;
+
+	for (timer = timers; timer; timer = next) {
+		next = timer->next;
+		free(timer->name);
+		free(timer);
+	}
+
+	timers = NULL;
+}
+
 static void exit_cleanup(void)
 {
 	dstate_setinfo("driver.state", "cleanup.exit");
@@ -1878,6 +2145,9 @@ static void exit_cleanup(void)
 	free(device_path);
 	free(user);
 	free(group);
+	free(host_names);
+	schedules_free();
+	timers_free();
 
 	if (pidfn) {
 		unlink(pidfn);
@@ -1886,6 +2156,7 @@ static void exit_cleanup(void)
 
 	dstate_free();
 	vartab_free();
+	iorec_free();
 
 #ifdef WIN32
 	if(mutex != INVALID_HANDLE_VALUE) {
@@ -2026,15 +2297,573 @@ void setup_signals(void)
 }
 #endif /* !WIN32*/
 
+uint64_t drv_stats_now_usec(void)
+{
+#if defined(HAVE_CLOCK_GETTIME) && defined(HAVE_CLOCK_MONOTONIC) && HAVE_CLOCK_GETTIME && HAVE_CLOCK_MONOTONIC
+	struct timespec	now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000 + (uint64_t)(now.tv_nsec / 1000);
+#else
+	struct timeval	now;
+
+	gettimeofday(&now, NULL);
+	return (uint64_t)now.tv_sec * 1000000 + (uint64_t)now.tv_usec;
+#endif
+}
+
+void drv_gettime(struct timeval *now)
+{
+	uint64_t	usec = drv_stats_now_usec();
+
+	now->tv_sec = (time_t)(usec / 1000000);
+	now->tv_usec = (suseconds_t)(usec % 1000000);
+}
+
+void drv_stats_add(drv_stats_kind_t kind, uint64_t usec)
+{
+	drv_stats_t	*st;
+
+	if (kind < 0 || kind >= DRV_STATS_KINDS) {
+		return;
+	}
+
+	st = &drv_stats[kind];
+	st->usec[st->count % DRV_STATS_SAMPLES] = usec;
+	st->count++;
+	if (usec > (uint64_t)drv_poll_interval_msec() * 1000) {
+		st->overruns++;
+	}
+	st->changed = 1;
+}
+
+void drv_stats_io(uint64_t start)
+{
+	uint64_t	now = drv_stats_now_usec();
+
+	/* a clock which went backwards only comes without CLOCK_MONOTONIC */
+	drv_stats_add(DRV_STATS_IO, now > start ? now - start : 0);
+}
+
+int drv_schedule_add(const char *name, time_t interval, void (*func)(void))
+{
+	drv_schedule_t	*sched;
+
+	if (!name || interval <= 0 || !func) {
+		upslogx(LOG_ERR, "%s: invalid schedule %s", __func__, NUT_STRARG(name));
+		return -1;
+	}
+
+	sched = xcalloc(1, sizeof(*sched));
+	sched->name = xstrdup(name);
+	sched->interval = interval;
+	sched->func = func;
+	drv_gettime(&sched->due);
+	sched->due.tv_sec += interval;
+
+	sched->next = schedules;
+	schedules = sched;
+
+	upsdebugx(2, "%s: %s every %" PRIdMAX " seconds",
+		__func__, name, (intmax_t)interval);
+
+	return 0;
+}
+
+void drv_waiter_set(void (*wake)(struct timeval *wake), int (*run)(const struct timeval *now))
+{
+	waiter_wake = wake;
+	waiter_run = run;
+}
+
+int drv_timer_add(const char *name, long msec, int (*func)(void *arg), void *arg)
+{
+	drv_timer_t	*timer;
+
+	if (!name || msec < 0 || !func) {
+		upslogx(LOG_ERR, "%s: invalid timer %s", __func__, NUT_STRARG(name));
+		return -1;
+	}
+
+	if (timer_last_id == INT_MAX) {
+		timer_last_id = 0;
+	}
+
+	timer = xcalloc(1, sizeof(*timer));
+	timer->id = ++timer_last_id;
+	timer->name = xstrdup(name);
+	timer->func = func;
+	timer->arg = arg;
+	drv_gettime(&timer->due);
+	timer->due.tv_sec += msec / 1000;
+	timer->due.tv_usec += (msec % 1000) * 1000;
+	if (timer->due.tv_usec >= 1000000) {
+		timer->due.tv_sec++;
+		timer->due.tv_usec -= 1000000;
+	}
+
+	timer->next = timers;
+	timers = timer;
+
+	upsdebugx(3, "%s: %s (%d) in %ld ms", __func__, name, timer->id, msec);
+
+	return timer->id;
+}
+
+void drv_timer_cancel(int id)
+{
+	drv_timer_t	**prev, *timer;
+
+	for (prev = &timers; (timer = *prev) != NULL; prev = &timer->next) {
+		if (timer->id == id) {
+			upsdebugx(3, "%s: %s (%d)", __func__, timer->name, id);
+			*prev = timer->next;
+			free(timer->name);
+			free(timer);
+			return;
+		}
+	}
+}
+
 /* This source file is used in some unit tests to mock realistic driver
  * behavior - using a production driver skeleton, but their own main().
  */
 #ifndef DRIVERS_MAIN_WITHOUT_MAIN
+/* polling statistics, published as driver.poll.* */
+static unsigned long	poll_missed = 0;
+static long	poll_jitter_max = 0;	/* milliseconds */
+
+#ifndef WIN32
+/* a child of ours serving the states of the last run on the driver socket
+ * meanwhile we initialize the device, see snapshot_serve() */
+static pid_t	snapshot_server = -1;
+
+static void snapshot_serve_stop(void)
+{
+	if (snapshot_server < 0)
+		return;
+
+	upsdebugx(1, "Stopping to serve the state snapshot (process %" PRIiMAX ")",
+		(intmax_t)snapshot_server);
+
+	kill(snapshot_server, SIGTERM);
+	while (waitpid(snapshot_server, NULL, 0) < 0 && errno == EINTR);
+	snapshot_server = -1;
+}
+
+/* If the snapshot <fn> of the last run is recent, fork a process which
+ * serves it (marked by driver.cached and driver.state "init.cached") until
+ * snapshot_serve_stop() before our own dstate_init(), so that clients see
+ * last-known data rather than a dropped socket while upsdrv_initups() and
+ * upsdrv_initinfo() run, however long the device takes to enumerate. */
+static void snapshot_serve(const char *fn)
+{
+	struct stat	st;
+	time_t	now, saved;
+	pid_t	pid, parent = getpid();
+	char	*sockname;
+
+	time(&now);
+	if (stat(fn, &st) != 0) {
+		upsdebug_with_errno(1, "No state snapshot to serve at %s", fn);
+		return;
+	}
+
+	if (difftime(now, st.st_mtime) > DSTATE_SNAPSHOT_MAXAGE) {
+		upsdebugx(1, "The state snapshot %s is too old to serve", fn);
+		return;
+	}
+
+	fflush(stdout);
+	fflush(stderr);
+
+	if ((pid = fork()) < 0) {
+		upslog_with_errno(LOG_WARNING, "Can't fork to serve the state snapshot");
+		return;
+	}
+
+	if (pid > 0) {
+		snapshot_server = pid;
+		atexit(snapshot_serve_stop);
+		return;
+	}
+
+	/* child: our tree only has the start-up settings so far */
+	if ((saved = dstate_snapshot_load(fn)) == 0)
+		_exit(EXIT_FAILURE);
+
+	dstate_setinfo("driver.state", "init.cached");
+	dstate_setinfo("driver.cached", "%" PRIiMAX, (intmax_t)saved);
+
+	sockname = dstate_init(progname, upsname);
+	upslogx(LOG_INFO, "Serving the states saved at %" PRIiMAX " on %s "
+		"while the device is initialized", (intmax_t)saved, sockname);
+	free(sockname);
+	dstate_dataok();
+
+	/* until the parent stops us, or is gone */
+	while (!exit_flag && getppid() == parent) {
+		struct timeval	timeout;
+
+		drv_gettime(&timeout);
+		timeout.tv_sec += 1;
+		dstate_poll_fds(timeout, ERROR_FD);
+	}
+
+	dstate_free();
+	_exit(EXIT_SUCCESS);
+}
+#endif	/* !WIN32 */
+
+static const char	*drv_stats_names[DRV_STATS_KINDS] = {
+	"initinfo", "updateinfo", "instcmd", "setvar", "io"
+};
+
+static int drv_stats_cmp(const void *a, const void *b)
+{
+	uint64_t	x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+/* publish the driver.stats.* variables of the kinds timed since the last
+ * time, figured over their latest DRV_STATS_SAMPLES calls */
+static void drv_stats_publish(void)
+{
+	uint64_t	sorted[DRV_STATS_SAMPLES], sum;
+	char	var[SMALLBUF];
+	size_t	i, n;
+	int	kind;
+
+	for (kind = 0; kind < DRV_STATS_KINDS; kind++) {
+		drv_stats_t	*st = &drv_stats[kind];
+		const char	*name = drv_stats_names[kind];
+
+		if (!st->changed) {
+			continue;
+		}
+		st->changed = 0;
+
+		n = st->count < DRV_STATS_SAMPLES ? st->count : DRV_STATS_SAMPLES;
+		memcpy(sorted, st->usec, n * sizeof(*sorted));
+		qsort(sorted, n, sizeof(*sorted), drv_stats_cmp);
+
+		for (i = 0, sum = 0; i < n; i++) {
+			sum += sorted[i];
+		}
+
+		snprintf(var, sizeof(var), "driver.stats.%s.min", name);
+		dstate_setinfo_double(var, (double)sorted[0] / 1000, 2, 0);
+		snprintf(var, sizeof(var), "driver.stats.%s.avg", name);
+		dstate_setinfo_double(var, (double)sum / (double)n / 1000, 2, 0);
+		snprintf(var, sizeof(var), "driver.stats.%s.p99", name);
+		dstate_setinfo_double(var, (double)sorted[(n * 99 + 99) / 100 - 1] / 1000, 2, 0);
+		snprintf(var, sizeof(var), "driver.stats.%s.max", name);
+		dstate_setinfo_double(var, (double)sorted[n - 1] / 1000, 2, 0);
+		snprintf(var, sizeof(var), "driver.stats.%s.overruns", name);
+		dstate_setinfo_int(var, (long)st->overruns, 0);
+	}
+}
+
+/* publish the driver.stats.mem.<tag>.* variables of nut_mem_tags(), and
+ * driver.stats.mem.heap.* for the whole heap where it can be told */
+static void drv_mem_publish(void)
+{
+	const nut_mem_tag_t	*tag;
+	char	var[SMALLBUF];
+	size_t	heap, peak;
+
+	for (tag = nut_mem_tags(); tag; tag = tag->next) {
+		if (tag->nofree) {
+			snprintf(var, sizeof(var), "driver.stats.mem.%s.allocs", tag->name);
+			dstate_setinfo(var, "%" PRIu64, tag->allocs);
+			snprintf(var, sizeof(var), "driver.stats.mem.%s.bytes", tag->name);
+			dstate_setinfo(var, "%" PRIu64, tag->bytes);
+			continue;
+		}
+
+		snprintf(var, sizeof(var), "driver.stats.mem.%s.live", tag->name);
+		dstate_setinfo(var, "%" PRIuSIZE, tag->live);
+		snprintf(var, sizeof(var), "driver.stats.mem.%s.peak", tag->name);
+		dstate_setinfo(var, "%" PRIuSIZE, tag->peak);
+	}
+
+	if ((heap = nut_mem_heap(&peak)) > 0) {
+		dstate_setinfo("driver.stats.mem.heap.live", "%" PRIuSIZE, heap);
+		dstate_setinfo("driver.stats.mem.heap.peak", "%" PRIuSIZE, peak);
+	}
+}
+
+/* see if <flag> is one of the words of the status <status> */
+static int status_has_flag(const char *status, const char *flag)
+{
+	size_t	len = strlen(flag);
+	const char	*p;
+
+	for (p = status; (p = strstr(p, flag)) != NULL; p += len) {
+		if ((p == status || p[-1] == ' ') && (p[len] == ' ' || p[len] == '\0')) {
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/* Pick the interval until the next poll, after one done every <current>
+ * milliseconds: the shortest one while the device is on battery or its
+ * status just changed, else twice as long as before up to the longest one.
+ * With neither pollinterval_min nor pollinterval_max set, it is pollinterval. */
+static long poll_adapt(long current)
+{
+	static char	last_status[ST_MAX_VALUE_LEN] = "";
+	const char	*status = dstate_getinfo("ups.status");
+	long	lo = drv_poll_interval_msec(), hi = lo, next;
+	char	buf[SMALLBUF];
+
+	if (poll_interval_min > 0 && poll_interval_min < lo)
+		lo = poll_interval_min;
+	if (poll_interval_max > hi)
+		hi = poll_interval_max;
+	if (!status)
+		status = "";
+
+	if (strcmp(status, last_status)
+	 || status_has_flag(status, "OB") || status_has_flag(status, "LB")
+	) {
+		next = lo;
+	} else {
+		next = current * 2;
+	}
+
+	if (next < lo)
+		next = lo;
+	if (next > hi)
+		next = hi;
+
+	snprintf(last_status, sizeof(last_status), "%s", status);
+
+	if (next != current) {
+		interval_str(next, buf, sizeof(buf));
+		upsdebugx(2, "%s: polling every %s seconds now (status '%s')",
+			__func__, buf, status);
+		dstate_setinfo("driver.poll.interval", "%s", buf);
+	}
+
+	return next;
+}
+
+/* a poll started <late> seconds after its deadline */
+static void poll_late(double late)
+{
+	long	ms = (long)(late * 1000);
+
+	if (ms > poll_jitter_max) {
+		poll_jitter_max = ms;
+		dstate_setinfo("driver.poll.jitter", "%ld", poll_jitter_max);
+	}
+}
+
+static void poll_deadline_missed(double late)
+{
+	poll_missed++;
+	upsdebugx(1, "Poll deadline missed by %.3f seconds (%lu times so far)",
+		late, poll_missed);
+	dstate_setinfo("driver.poll.missed", "%lu", poll_missed);
+}
+
+/* bring <wake> forward to the earliest sub-schedule due before it */
+static void schedules_wake(struct timeval *wake)
+{
+	const drv_schedule_t	*sched;
+
+	for (sched = schedules; sched; sched = sched->next) {
+		if (timercmp(&sched->due, wake, <)) {
+			*wake = sched->due;
+		}
+	}
+}
+
+/* run the sub-schedules which are due at <now>, returns how many ran */
+static int schedules_run(const struct timeval *now)
+{
+	drv_schedule_t	*sched;
+	int	ran = 0;
+
+	for (sched = schedules; sched; sched = sched->next) {
+		if (timercmp(now, &sched->due, <)) {
+			continue;
+		}
+
+		upsdebugx(3, "%s: %s", __func__, sched->name);
+		dstate_batch_begin();
+		sched->func();
+		dstate_batch_commit();
+		ran++;
+
+		sched->due.tv_sec += sched->interval;
+		if (!timercmp(now, &sched->due, <)) {
+			/* late by a whole interval, do not catch up */
+			sched->due = *now;
+			sched->due.tv_sec += sched->interval;
+		}
+	}
+
+	return ran;
+}
+
+/* bring <wake> forward to the earliest timer due before it */
+static void timers_wake(struct timeval *wake)
+{
+	const drv_timer_t	*timer;
+
+	for (timer = timers; timer; timer = timer->next) {
+		if (timercmp(&timer->due, wake, <)) {
+			*wake = timer->due;
+		}
+	}
+}
+
+/* run the timers which are due at <now> (but not those they set up),
+ * returns how many ran; <poll> is set if one of them asked for a poll */
+static int timers_run(const struct timeval *now, int *poll)
+{
+	drv_timer_t	**prev, *timer;
+	int	last_id = timer_last_id, ran = 0;
+
+	/* take them out one at a time, as they may add or cancel timers */
+	for (prev = &timers; (timer = *prev) != NULL; ) {
+		if (timer->id > last_id || timercmp(now, &timer->due, <)) {
+			prev = &timer->next;
+			continue;
+		}
+
+		*prev = timer->next;
+
+		upsdebugx(3, "%s: %s (%d)", __func__, timer->name, timer->id);
+		dstate_batch_begin();
+		if (timer->func(timer->arg) > 0) {
+			*poll = 1;
+		}
+		dstate_batch_commit();
+		ran++;
+
+		free(timer->name);
+		free(timer);
+
+		/* start over, the list may have changed */
+		prev = &timers;
+	}
+
+	return ran;
+}
+
+#ifndef WIN32
+static volatile sig_atomic_t	host_signal = 0;
+
+static void host_set_signal(int sig)
+{
+	host_signal = sig;
+}
+
+/* Start one instance of the driver per device named with -a, each a child
+ * process carrying on with the initialization below (the executable and
+ * what was set up so far are shared copy-on-write). This process waits
+ * for them: those going to the background exit once they initialized,
+ * the ones staying in the foreground get the signals sent to it. */
+static void host_spawn(void)
+{
+	pid_t	*pids = xcalloc(host_count, sizeof(*pids));
+	struct sigaction	sa;
+	size_t	i, running = 0;
+	int	failed = 0, status;
+	pid_t	pid;
+
+	fflush(stdout);
+	fflush(stderr);
+
+	for (i = 0; i < host_count; i++) {
+		pid = fork();
+
+		if (pid < 0) {
+			fatal_with_errno(EXIT_FAILURE, "Can't start the driver instance for [%s]",
+				host_names[i]);
+		}
+
+		if (pid == 0) {
+			host_name = host_names[i];
+			free(pids);
+			return;
+		}
+
+		upsdebugx(1, "%s: started the instance for [%s] as PID %ld",
+			__func__, host_names[i], (long)pid);
+		pids[i] = pid;
+		running++;
+	}
+
+	sigemptyset(&sa.sa_mask);
+	sa.sa_flags = 0;	/* let waitpid() see them */
+	sa.sa_handler = host_set_signal;
+	sigaction(SIGTERM, &sa, NULL);
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGQUIT, &sa, NULL);
+	sigaction(SIGCMD_RELOAD, &sa, NULL);
+	sigaction(SIGCMD_RELOAD_OR_EXIT, &sa, NULL);
+
+	while (running > 0) {
+		pid = waitpid(-1, &status, 0);
+
+		if (pid < 0) {
+			if (errno != EINTR) {
+				upslog_with_errno(LOG_ERR, "%s: waitpid", __func__);
+				break;
+			}
+
+			if (host_signal) {
+				upsdebugx(1, "%s: passing signal %d to the instances",
+					__func__, (int)host_signal);
+				for (i = 0; i < host_count; i++) {
+					if (pids[i] > 0) {
+						kill(pids[i], host_signal);
+					}
+				}
+				host_signal = 0;
+			}
+			continue;
+		}
+
+		for (i = 0; i < host_count && pids[i] != pid; i++);
+		if (i == host_count) {
+			continue;
+		}
+
+		pids[i] = 0;
+		running--;
+
+		if (!WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS) {
+			upslogx(LOG_ERR, "Driver instance for [%s] failed (status 0x%x)",
+				host_names[i], (unsigned int)status);
+			failed++;
+		} else {
+			upsdebugx(1, "%s: the instance for [%s] is done",
+				__func__, host_names[i]);
+		}
+	}
+
+	free(pids);
+	exit(failed ? EXIT_FAILURE : EXIT_SUCCESS);
+}
+#endif	/* !WIN32 */
+
 int main(int argc, char **argv)
 {
 	struct	passwd	*new_uid = NULL;
-	int	i, do_forceshutdown = 0;
-	int	update_count = 0;
+	int	i, do_forceshutdown = 0, host_single = 0;
+	int	update_count = 0, backgrounded = 0;
+	long	poll_every;	/* milliseconds */
+	struct timeval	poll_due;
+	uint64_t	stats_start, stats_took;
+	char	interval[SMALLBUF];
 
 #ifndef WIN32
 	int	cmd = 0;
@@ -2072,6 +2901,25 @@ int main(int argc, char **argv)
 				/* Avoid notification at exit */
 				help_only = 1;
 				break;
+			case 'a': { /* scope */
+					size_t	n;
+
+					for (n = 0; n < host_count && strcmp(host_names[n], optarg); n++);
+					if (n == host_count) {
+						host_names = xrealloc(host_names, (host_count + 1) * sizeof(*host_names));
+						host_names[host_count++] = optarg;
+					}
+				}
+				break;
+			case 's':
+			case 'c':
+			case 'k':
+#ifndef WIN32
+			case 'P':
+#endif	/* !WIN32 */
+				/* only starting drivers can be done for many at once */
+				host_single = 1;
+				break;
 			default:
 				break;
 		}
@@ -2157,16 +3005,34 @@ int main(int argc, char **argv)
 	/* build the driver's extra (-x) variable table */
 	upsdrv_makevartable();
 
+	if (host_count > 1 && !help_only) {
+		if (host_single) {
+			fatalx(EXIT_FAILURE, "Error: option '-a id' can be given several "
+				"times only to start the drivers, not with -s, -c, -k or -P");
+		}
+#ifndef WIN32
+		host_spawn();
+#else	/* WIN32 */
+		fatalx(EXIT_FAILURE, "Error: option '-a id' can not be given "
+			"several times on this platform");
+#endif	/* WIN32 */
+	}
+
 	while ((i = getopt(argc, argv, optstring)) != -1) {
 		switch (i) {
 			case 'a':
+				/* another instance started by host_spawn() */
+				if (host_name && strcmp(optarg, host_name))
+					break;
+
 				if (upsname)
 					fatalx(EXIT_FAILURE, "Error: options '-a id' and '-s id' "
 						"are mutually exclusive and single-use only.");
 
 				upsname = optarg;
 
-				read_upsconf(1);
+				/* only the global part and our section */
+				read_upsconf_section(upsname, 1);
 
 				if (!upsname_found)
 					fatalx(EXIT_FAILURE, "Error: Section %s not found in ups.conf",
@@ -2198,12 +3064,12 @@ int main(int argc, char **argv)
 				/* Processed above */
 				break;
 			case 'i': { /* scope */
-					int ipv = atoi(optarg);
-					if (ipv > 0) {
-						poll_interval = (time_t)ipv;
+					long	msec = interval_msec(optarg);
+					if (msec > 0) {
+						set_poll_interval(msec);
 					} else {
-						fatalx(EXIT_FAILURE, "Error: command-line: invalid pollinterval: %d",
-							ipv);
+						fatalx(EXIT_FAILURE, "Error: command-line: invalid pollinterval: %s",
+							optarg);
 					}
 				}
 				break;
@@ -2423,6 +3289,8 @@ int main(int argc, char **argv)
 		/* FIXME: coordinate with pollfreq? */
 		tv.tv_sec = 15;
 		tv.tv_usec = 0;
+		/* both queries go over the same connection */
+		upsdrvquery_keep(1);
 		cmdret = upsdrvquery_oneshot(progname, upsname,
 			"SET driver.flag.allow_killpower 1\n",
 			NULL, 0, &tv);
@@ -2439,6 +3307,7 @@ int main(int argc, char **argv)
 				upsdebug_with_errno(1, "Socket dialog with the other driver instance");
 			} else {
 				upslogx(LOG_INFO, "Request to killpower via running driver returned code %" PRIiSIZE, cmdret);
+				upsdrvquery_keep(0);
 				if (cmdret == 0)
 					/* Note: many drivers would abort with
 					 * "shutdown not supported" at this
@@ -2452,6 +3321,7 @@ int main(int argc, char **argv)
 			upsdebugx(1, "Socket dialog with the other driver instance: %s",
 				strerror(errno));
 		}
+		upsdrvquery_keep(0);
 	}
 
 	/* Handle reload-or-error over socket protocol with
@@ -2833,6 +3703,41 @@ int main(int argc, char **argv)
 	 * when its a pdu! */
 	dstate_setinfo("device.type", "ups");
 
+#ifndef WIN32
+	if (do_lazyinit && !dump_data && !do_forceshutdown) {
+		char	*sockname;
+
+		/* connections wait in the backlog of the socket (or are served
+		 * by the snapshot server below) until the device is ready, so
+		 * that upsd and upsdrvctl need not wait for it */
+		sockname = dstate_init(progname, upsname);
+		free(sockname);
+
+		if (foreground == 0) {
+			background();
+			writepid(pidfn);
+			backgrounded = 1;
+		}
+
+		upslogx(LOG_INFO, "Initializing the device after taking connections (lazyinit)");
+		upsnotify(NOTIFY_STATE_READY_WITH_PID, NULL);
+	}
+#endif	/* !WIN32 */
+
+	if (do_snapshot && !dump_data && !do_forceshutdown) {
+		char	snapfn[NUT_PATH_MAX + 1];
+
+		snprintf(snapfn, sizeof(snapfn), "%s/%s-%s%s",
+			dflt_statepath(), progname, upsname, DSTATE_SNAPSHOT_SUFFIX);
+#ifndef WIN32
+		snapshot_serve(snapfn);
+#endif	/* !WIN32 */
+		dstate_snapshot_enable(snapfn);
+	}
+
+	/* record (or replay) the device I/O if the environment says so */
+	iorec_init();
+
 	dstate_setinfo("driver.state", "init.device");
 	upsdrv_initups();
 	dstate_setinfo("driver.state", "init.quiet");
@@ -2860,7 +3765,9 @@ int main(int argc, char **argv)
 
 	/* get the base data established before allowing connections */
 	dstate_setinfo("driver.state", "init.info");
+	stats_start = drv_stats_now_usec();
 	upsdrv_initinfo();
+	drv_stats_add(DRV_STATS_INITINFO, drv_stats_now_usec() - stats_start);
 
 	/* Register a way to call upsdrv_shutdown() among `sdcommands` */
 	dstate_addcmd("shutdown.default");
@@ -2873,8 +3780,12 @@ int main(int argc, char **argv)
 	/* Note: a few drivers also call their upsdrv_updateinfo() during
 	 * their upsdrv_initinfo(), possibly to impact the initialization */
 	dstate_setinfo("driver.state", "init.updateinfo");
+	dstate_batch_begin();
+	NUT_PROBE1(driver_updateinfo, upsname);
 	upsdrv_updateinfo();
+	NUT_PROBE2(driver_updateinfo_done, upsname, 0);
 	dstate_setinfo("driver.state", "init.quiet");
+	dstate_batch_commit();
 
 	if (dstate_getinfo("driver.flag.ignorelb")) {
 		int	have_lb_method = 0;
@@ -2901,7 +3812,13 @@ int main(int argc, char **argv)
 	/* now we can start servicing requests */
 	/* Only write pid if we're not just dumping data, for discovery */
 	if (!dump_data) {
-		char * sockname = dstate_init(progname, upsname);
+		char * sockname;
+
+#ifndef WIN32
+		/* the snapshot server (if any) hands the socket over to us */
+		snapshot_serve_stop();
+#endif	/* !WIN32 */
+		sockname = dstate_init(progname, upsname);
 		/* Normally we stick to the built-in account info,
 		 * so if they were not over-ridden - no-op here:
 		 */
@@ -3014,7 +3931,11 @@ sockname_ownership_finished:
 	}
 
 	/* The poll_interval may have been changed from the default */
-	dstate_setinfo("driver.parameter.pollinterval", "%" PRIdMAX, (intmax_t)poll_interval);
+	interval_str(drv_poll_interval_msec(), interval, sizeof(interval));
+	dstate_setinfo("driver.parameter.pollinterval", "%s", interval);
+	dstate_setinfo("driver.poll.interval", "%s", interval);
+	dstate_setinfo("driver.poll.missed", "%lu", poll_missed);
+	dstate_setinfo("driver.poll.jitter", "%ld", poll_jitter_max);
 
 	/* The synchronous option may have been changed from the default */
 	dstate_setinfo("driver.parameter.synchronous", "%s",
@@ -3030,6 +3951,8 @@ sockname_ownership_finished:
 
 	switch (foreground) {
 		case 0:
+			if (backgrounded)
+				break;
 			background();
 			/* We had saved a PID before backgrounding, but
 			 * it changes when backgrounding - so save again
@@ -3086,19 +4009,65 @@ sockname_ownership_finished:
 		upsnotify(NOTIFY_STATE_READY_WITH_PID, NULL);
 	}
 
+	/* Each poll is due one interval after the deadline of the previous one
+	 * (so they do not drift), or after its start if extrafd woke us early.
+	 * One which overran its successor's deadline is followed at once. */
+	poll_every = drv_poll_interval_msec();
+	drv_gettime(&poll_due);
+
 	while (!exit_flag) {
-		struct timeval	timeout;
+		struct timeval	now, base;
+		double	late;
 
 		if (!dump_data) {
 			upsnotify(NOTIFY_STATE_WATCHDOG, NULL);
 		}
 
-		gettimeofday(&timeout, NULL);
-		timeout.tv_sec += poll_interval;
+		drv_gettime(&now);
+		if (timercmp(&now, &poll_due, <)) {
+			base = now;
+		} else {
+			late = difftimeval(now, poll_due);
+			if (late >= (double)poll_every / 1000) {
+				/* held up by a whole interval (busy, suspended...) */
+				poll_deadline_missed(late);
+				base = now;
+			} else {
+				poll_late(late);
+				base = poll_due;
+			}
+		}
 
 		dstate_setinfo("driver.state", "updateinfo");
+		dstate_batch_begin();
+		stats_start = drv_stats_now_usec();
+		NUT_PROBE1(driver_updateinfo, upsname);
 		upsdrv_updateinfo();
+		stats_took = drv_stats_now_usec() - stats_start;
+		NUT_PROBE2(driver_updateinfo_done, upsname, stats_took);
+		drv_stats_add(DRV_STATS_UPDATEINFO, stats_took);
+		drv_stats_publish();
+		if (do_memstats) {
+			drv_mem_publish();
+		}
+		poll_every = poll_adapt(poll_every);
 		dstate_setinfo("driver.state", "quiet");
+		dstate_batch_commit();
+
+		poll_due = base;
+		poll_due.tv_sec += poll_every / 1000;
+		poll_due.tv_usec += (poll_every % 1000) * 1000;
+		if (poll_due.tv_usec >= 1000000) {
+			poll_due.tv_sec++;
+			poll_due.tv_usec -= 1000000;
+		}
+		iorec_scale_wait(&base, &poll_due);
+
+		drv_gettime(&now);
+		if (!timercmp(&now, &poll_due, <)) {
+			poll_deadline_missed(difftimeval(now, poll_due));
+			poll_due = now;
+		}
 
 		/* Dump the data tree (in upsc-like format) to stdout and exit */
 		if (dump_data) {
@@ -3112,9 +4081,36 @@ sockname_ownership_finished:
 				update_count++;
 		}
 		else {
-			while (!dstate_poll_fds(timeout, extrafd) && !exit_flag) {
-				/* repeat until time is up or extrafd has data */
-				handle_reload_flag();
+			/* repeat until time is up or extrafd has data,
+			 * running the sub-schedules and timers which are due
+			 * meanwhile, and serving the pending I/O of the protocol
+			 * layer (and of the watched fds, in dstate_poll_fds()) */
+			while (!exit_flag) {
+				struct timeval	wake = poll_due;
+				int	ran, woke, poll_now = 0;
+
+				schedules_wake(&wake);
+				timers_wake(&wake);
+				if (waiter_wake) {
+					waiter_wake(&wake);
+				}
+				if (!(woke = dstate_poll_fds(wake, extrafd))) {
+					if (!exit_flag) {
+						handle_reload_flag();
+					}
+					continue;
+				}
+
+				drv_gettime(&now);
+				ran = schedules_run(&now);
+				ran += timers_run(&now, &poll_now);
+				if (waiter_run) {
+					ran += waiter_run(&now);
+				}
+				/* a watched fd or a timer asking for it polls now */
+				if (!ran || woke > 1 || poll_now || !timercmp(&now, &poll_due, <)) {
+					break;
+				}
 			}
 		}
 
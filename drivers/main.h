@@ -68,6 +68,66 @@ int main_instcmd(const char *cmdname, const char *extra, conn_t *conn);
  */
 int main_setvar(const char *varname, const char *val, conn_t *conn);
 
+/* Driver activity timed for the driver.stats.<kind>.* variables: the
+ * minimum, average, 99th percentile and maximum duration (milliseconds)
+ * of the latest calls, and how many of them took longer than pollinterval
+ */
+typedef enum {
+	DRV_STATS_INITINFO = 0,	/* upsdrv_initinfo() */
+	DRV_STATS_UPDATEINFO,	/* upsdrv_updateinfo() */
+	DRV_STATS_INSTCMD,	/* instant commands from the driver socket */
+	DRV_STATS_SETVAR,	/* SET requests from the driver socket */
+	DRV_STATS_IO,		/* transactions of the protocol layers */
+	DRV_STATS_KINDS
+} drv_stats_kind_t;
+
+/* a monotonic clock (if there is one), in microseconds */
+uint64_t drv_stats_now_usec(void);
+
+/* the clock which the driver loop keeps its schedule on: monotonic where
+ * there is one, so that setting the system time neither holds up nor
+ * rushes the polls; deadlines given to dstate_poll_fds(), and the times
+ * passed to the drv_waiter_set() callbacks, are on it */
+void drv_gettime(struct timeval *now);
+
+/* pollinterval in milliseconds, which may be under a second ("0.25");
+ * poll_interval has it in whole seconds (rounded up), and a driver which
+ * sets that itself overrides the configured value as before */
+long drv_poll_interval_msec(void);
+
+/* account for a call of <kind> which took <usec> */
+void drv_stats_add(drv_stats_kind_t kind, uint64_t usec);
+
+/* for protocol layers (serial, USB, SNMP...): account for a transaction
+ * with the device begun at drv_stats_now_usec() = <start> */
+void drv_stats_io(uint64_t start);
+
+/* Have <func> called every <interval> seconds between the polls (calls of
+ * upsdrv_updateinfo()), e.g. for readings which change slowly or are costly
+ * to get; the first call is one interval from now. Its changes of the data
+ * are sent out together, like those of a poll. <name> is for debug logs.
+ * Returns 0 on success, or -1 if the arguments are not valid.
+ */
+int drv_schedule_add(const char *name, time_t interval, void (*func)(void));
+
+/* For protocol layers with I/O pending between the polls (see
+ * ser_xact_start()): during its waits, the main loop has <wake> bring the
+ * end of the wait forward to their next deadline, and <run> serve what
+ * came in or timed out at <now>, returning how many it did (0 lets an
+ * early wake-up go on to the next poll, like for extrafd). NULL to stop.
+ */
+void drv_waiter_set(void (*wake)(struct timeval *wake), int (*run)(const struct timeval *now));
+
+/* Have <func> called once with <arg>, <msec> milliseconds from now, between
+ * the polls (e.g. for the timeouts of events watched with dstate_add_fd());
+ * it returns 1 to have the data updated at once, 0 otherwise. Its changes
+ * of the data are sent out together. <name> is for debug logs. Returns the
+ * id of the timer for drv_timer_cancel() (a no-op once the timer ran or was
+ * cancelled), or -1 if the arguments are not valid.
+ */
+int drv_timer_add(const char *name, long msec, int (*func)(void *arg), void *arg);
+void drv_timer_cancel(int id);
+
 /* main calls this driver function - it needs to call addvar */
 void upsdrv_makevartable(void);
 
@@ -85,9 +145,20 @@ typedef struct vartab_s {
 	char	*desc;		/* 40 character description for -h text	 */
 	int	found;		/* set once encountered, for testvar()	 */
 	int	reloadable;	/* driver reload may redefine this value */
-	struct vartab_s	*next;
+	struct vartab_s	*next;		/* in the order of addvar() calls */
+	struct vartab_s	*hashnext;	/* with the same hash of var	 */
 } vartab_t;
 
+/* For options checked over and over (e.g. while polling the device):
+ * look the entry of <var> up once, and keep it for getval_handle() and
+ * testvar_handle() which then work like getval() and testvar(), values
+ * given on reload included. The entry stays until the driver exits; the
+ * handle is NULL (and seen as never given) if the driver did not add it.
+ */
+const vartab_t *vartab_handle(const char *var);
+char *getval_handle(const vartab_t *handle);
+int testvar_handle(const vartab_t *handle);
+
 /* flags to define types in the vartab */
 
 #define VAR_FLAG	0x0001	/* argument is a flag (no value needed) */
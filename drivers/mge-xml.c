@@ -25,6 +25,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
 
 #include <ne_xml.h>
 
@@ -39,7 +40,7 @@
 #include "wincompat.h"
 #endif	/* WIN32 */
 
-#define MGE_XML_VERSION		"MGEXML/0.36"
+#define MGE_XML_VERSION		"MGEXML/0.37"
 
 #define MGE_XML_INITUPS		"/"
 #define MGE_XML_INITINFO	"/mgeups/product.xml /product.xml /ws/product.xml"
@@ -64,6 +65,7 @@ static char	mge_scratch_buf[256];
 
 static char	var[128];
 static char	val[128];
+static size_t	val_len = 0;	/* of the cdata gathered so far in val */
 
 static int	mge_shutdown_pending = 0;
 
@@ -1147,6 +1149,118 @@ static xml_info_t mge_xml2nut[] = {
 	{ NULL, 0, 0, NULL, 0, 0, NULL }
 };
 
+/* The mge_xml2nut table indexed by XML name and by NUT name (open
+ * addressing, a power of two at least twice the number of entries), so
+ * that the objects of each page are mapped without walking the table.
+ * Each index points to the first entry of a name, which is the one the
+ * table walk would find. */
+#define MGE_XML_MAP_SIZE	1024
+
+static xml_info_t	*mge_xml_map[MGE_XML_MAP_SIZE];
+static xml_info_t	*mge_nut_map[MGE_XML_MAP_SIZE];
+static int	mge_map_state = 0;	/* 0: not built, 1: built, -1: walk the table */
+
+static void mge_map_add(xml_info_t **map, const char *name, xml_info_t *info)
+{
+	size_t	slot;
+
+	for (slot = str_hash_nocase(name) & (MGE_XML_MAP_SIZE - 1);
+		map[slot] != NULL;
+		slot = (slot + 1) & (MGE_XML_MAP_SIZE - 1)
+	) {
+		/* keep the first entry of the name */
+		if (map == mge_xml_map && !strcasecmp(map[slot]->xmlname, name))
+			return;
+		if (map == mge_nut_map && !strcasecmp(map[slot]->nutname, name))
+			return;
+	}
+
+	map[slot] = info;
+}
+
+static void mge_build_map(void)
+{
+	xml_info_t	*info;
+	size_t	count = 0;
+
+	for (info = mge_xml2nut; info->xmlname != NULL || info->nutname != NULL; info++) {
+		count++;
+	}
+
+	if (count * 2 > MGE_XML_MAP_SIZE) {
+		upsdebugx(1, "%s: %" PRIuSIZE " entries do not fit, lookups will walk the table",
+			__func__, count);
+		mge_map_state = -1;
+		return;
+	}
+
+	for (info = mge_xml2nut; info->xmlname != NULL || info->nutname != NULL; info++) {
+		if (info->xmlname)
+			mge_map_add(mge_xml_map, info->xmlname, info);
+		if (info->nutname)
+			mge_map_add(mge_nut_map, info->nutname, info);
+	}
+
+	mge_map_state = 1;
+	upsdebugx(2, "%s: %" PRIuSIZE " entries indexed", __func__, count);
+}
+
+/* Find the (first) mge_xml2nut entry of an XML name, or NULL */
+static xml_info_t *mge_find_xml(const char *name)
+{
+	xml_info_t	*info;
+	size_t	slot;
+
+	if (!mge_map_state)
+		mge_build_map();
+
+	if (mge_map_state < 0) {
+		for (info = mge_xml2nut; info->xmlname != NULL || info->nutname != NULL; info++) {
+			if (info->xmlname && !strcasecmp(name, info->xmlname))
+				return info;
+		}
+		return NULL;
+	}
+
+	for (slot = str_hash_nocase(name) & (MGE_XML_MAP_SIZE - 1);
+		(info = mge_xml_map[slot]) != NULL;
+		slot = (slot + 1) & (MGE_XML_MAP_SIZE - 1)
+	) {
+		if (!strcasecmp(name, info->xmlname))
+			return info;
+	}
+
+	return NULL;
+}
+
+/* Find the (first) mge_xml2nut entry of a NUT name, or NULL */
+static xml_info_t *mge_find_nut(const char *name)
+{
+	xml_info_t	*info;
+	size_t	slot;
+
+	if (!mge_map_state)
+		mge_build_map();
+
+	if (mge_map_state < 0) {
+		for (info = mge_xml2nut; info->xmlname != NULL || info->nutname != NULL; info++) {
+			if (info->nutname && !strcasecmp(name, info->nutname))
+				return info;
+		}
+		return NULL;
+	}
+
+	for (slot = str_hash_nocase(name) & (MGE_XML_MAP_SIZE - 1);
+		(info = mge_nut_map[slot]) != NULL;
+		slot = (slot + 1) & (MGE_XML_MAP_SIZE - 1)
+	) {
+		if (!strcasecmp(name, info->nutname))
+			return info;
+	}
+
+	return NULL;
+}
+
 /* A start-element callback for element with given namespace/name. */
 static int mge_xml_startelm_cb(void *userdata, int parent, const char *nspace, const char *name, const char **atts)
 {
@@ -1211,12 +1325,14 @@ static int mge_xml_startelm_cb(void *userdata, int parent, const char *nspace, c
 		if (!strcasecmp(name, "ALARM")) {
 			int	i;
 			var[0] = val[0] = '\0';
+			val_len = 0;
 			for (i = 0; atts[i] && atts[i+1]; i += 2) {
 				if (!strcasecmp(atts[i], "object")) {
 					snprintf(var, sizeof(var), "%s", atts[i+1]);
 				}
 				if (!strcasecmp(atts[i], "value")) {
-					snprintf(val, sizeof(var), "%s", atts[i+1]);
+					snprintf(val, sizeof(val), "%s", atts[i+1]);
+					val_len = strlen(val);
 				}
 				if (!strcasecmp(atts[i], "date")) {
 					dstate_setinfo("ups.time", "%s", split_date_time(atts[i+1]));
@@ -1364,6 +1480,7 @@ static int mge_xml_startelm_cb(void *userdata, int parent, const char *nspace, c
 				if (!strcasecmp(atts[i], "name")) {
 					snprintf(var, sizeof(var), "%s", atts[i+1]);
 					val[0] = '\0';	/*don't inherit something from another object */
+					val_len = 0;
 				}
 			}
 			state = SU_OBJECT;
@@ -1379,6 +1496,7 @@ static int mge_xml_startelm_cb(void *userdata, int parent, const char *nspace, c
 				if (!strcasecmp(atts[i], "name")) {
 					snprintf(var, sizeof(var), "%s", atts[i+1]);
 					val[0] = '\0';	/*don't inherit something from another object */
+					val_len = 0;
 				}
 				if (!strcasecmp(atts[i], "access")) {
 					/* do something with RO/RW access? */
@@ -1455,7 +1573,13 @@ static int mge_xml_cdata_cb(void *userdata, int state, const char *cdata, size_t
 
 	case SU_OBJECT:
 	case GO_OBJECT:
-		snprintfcat(val, sizeof(val), "%.*s", (int)len, cdata);
+		/* append at the end of what we have, rather than looking for it */
+		if (len > sizeof(val) - 1 - val_len) {
+			len = sizeof(val) - 1 - val_len;
+		}
+		memcpy(val + val_len, cdata, len);
+		val_len += len;
+		val[val_len] = '\0';
 		break;
 
 	default:
@@ -1474,7 +1598,7 @@ static int mge_xml_endelm_cb(void *userdata, int state, const char *nspace, cons
 	NUT_UNUSED_VARIABLE(nspace);
 
 	/* ignore objects for which no value was set */
-	if (strlen(val) == 0) {
+	if (val[0] == '\0') {
 		upsdebugx(3, "%s: name </%s> ignored, no value set (state = %d)", __func__, name, state);
 		return 0;
 	}
@@ -1486,11 +1610,7 @@ static int mge_xml_endelm_cb(void *userdata, int state, const char *nspace, cons
 	case ALARM:
 	case SU_OBJECT:
 	case GO_OBJECT:
-		for (info = mge_xml2nut; info->xmlname != NULL; info++) {
-			if (strcasecmp(var, info->xmlname)) {
-				continue;
-			}
-
+		if ((info = mge_find_xml(var)) != NULL) {
 			upsdebugx(3, "-> XML variable %s [%s] maps to NUT variable %s", var, val, info->nutname);
 
 			if ((info->nutflags & ST_FLAG_STATIC) && dstate_getinfo(info->nutname)) {
@@ -1555,70 +1675,55 @@ subdriver_t mge_xml_subdriver = {
 };
 
 const char *vname_nut2mge_xml(const char *name) {
-	size_t i = 0;
+	xml_info_t *info;
 
 	assert(NULL != name);
 
-	for (; i < sizeof(mge_xml2nut) / sizeof(xml_info_t); ++i) {
-		xml_info_t *info = mge_xml2nut + i;
-
-		if (NULL != info->nutname)
-			if (0 == strcasecmp(name, info->nutname))
-				return info->xmlname;
-	}
+	info = mge_find_nut(name);
 
-	return NULL;
+	return info ? info->xmlname : NULL;
 }
 
 const char *vname_mge_xml2nut(const char *name) {
-	size_t i = 0;
+	xml_info_t *info;
 
 	assert(NULL != name);
 
-	for (; i < sizeof(mge_xml2nut) / sizeof(xml_info_t); ++i) {
-		xml_info_t *info = mge_xml2nut + i;
+	info = mge_find_xml(name);
 
-		if (NULL != info->xmlname)
-			if (0 == strcasecmp(name, info->xmlname))
-				return info->nutname;
-	}
-
-	return NULL;
+	return info ? info->nutname : NULL;
 }
 
 char *vvalue_mge_xml2nut(const char *name, const char *value, size_t len) {
-	size_t i = 0;
+	xml_info_t *info;
+	char *vcpy;
 
 	assert(NULL != name);
 
-	for (; i < sizeof(mge_xml2nut) / sizeof(xml_info_t); ++i) {
-		xml_info_t *info = mge_xml2nut + i;
+	info = mge_find_nut(name);
 
-		if (NULL != info->nutname)
-			if (0 == strcasecmp(name, info->nutname)) {
-				/* Copy value */
-				char *vcpy = (char *)malloc((len + 1) * sizeof(char));
+	if (NULL == info)
+		return NULL;
 
-				if (NULL == vcpy)
-					return vcpy;
+	/* Copy value */
+	vcpy = (char *)malloc((len + 1) * sizeof(char));
 
-				memcpy(vcpy, value, len * sizeof(char));
-				vcpy[len] = '\0';
+	if (NULL == vcpy)
+		return vcpy;
 
-				/* Convert */
-				if (NULL != info->convert) {
-					char *vconv = (char *)info->convert(vcpy);
+	memcpy(vcpy, value, len * sizeof(char));
+	vcpy[len] = '\0';
 
-					free(vcpy);
+	/* Convert */
+	if (NULL != info->convert) {
+		char *vconv = (char *)info->convert(vcpy);
 
-					return vconv;
-				}
-				else
-					return vcpy;
-			}
-	}
+		free(vcpy);
 
-	return NULL;
+		return vconv;
+	}
+	else
+		return vcpy;
 }
 
 void vname_register_rw(void) {
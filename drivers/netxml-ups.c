@@ -42,7 +42,7 @@
 #include "nut_stdint.h"
 
 #define DRIVER_NAME	"network XML UPS"
-#define DRIVER_VERSION	"0.48"
+#define DRIVER_VERSION	"0.49"
 
 /** *_OBJECT query multi-part body boundary */
 #define FORM_POST_BOUNDARY "NUT-NETXML-UPS-OBJECTS"
@@ -244,12 +244,28 @@ static ne_socket	*sock = NULL;
 static ne_uri		uri;
 static char	*product_page = NULL;
 
+/* The requests for the pages polled, dispatched again on each poll */
+#define NETXML_PAGE_REQUESTS	8
+static struct {
+	char		*page;
+	ne_request	*request;
+} page_requests[NETXML_PAGE_REQUESTS];
+static size_t	page_requests_count = 0;
+
+/* The parser of the alarm messages, see netxml_alarm_parse() */
+static ne_xml_parser	*alarm_parser = NULL;
+static char	alarm_carry[2 * LARGEBUF];
+static size_t	alarm_carry_len = 0;
+
 /* Support functions */
 static void netxml_alarm_set(void);
 static void netxml_status_set(void);
 static int netxml_authenticate(void *userdata, const char *realm, int attempt, char *username, char *password);
 static int netxml_dispatch_request(ne_request *request, ne_xml_parser *parser);
 static int netxml_get_page(const char *page);
+static void netxml_page_requests_free(void);
+static void netxml_alarm_parse(const char *buf, size_t len);
+static void netxml_alarm_parser_free(void);
 
 static int instcmd(const char *cmdname, const char *extra);
 static int setvar(const char *varname, const char *val);
@@ -320,13 +336,10 @@ void upsdrv_updateinfo(void)
 		ret = ne_sock_read(sock, buf, sizeof(buf));
 
 		if (ret > 0) {
-			/* alarm message received */
+			/* alarm message (or part of one) received */
 
-			ne_xml_parser	*parser = ne_xml_create();
-			upsdebugx(2, "%s: ne_sock_read(%" PRIiSIZE " bytes) => %s", __func__, ret, buf);
-			ne_xml_push_handler(parser, subdriver->startelm_cb, subdriver->cdata_cb, subdriver->endelm_cb, NULL);
-			ne_xml_parse(parser, buf, strlen(buf));
-			ne_xml_destroy(parser);
+			upsdebugx(2, "%s: ne_sock_read(%" PRIiSIZE " bytes) => %.*s", __func__, ret, (int)ret, buf);
+			netxml_alarm_parse(buf, (size_t)ret);
 			time(&lastheard);
 
 		} else if ((ret == NE_SOCK_TIMEOUT) && (difftime(time(NULL), lastheard) < 180)) {
@@ -658,6 +671,13 @@ void upsdrv_initups(void)
 
 	session = ne_session_create(uri.scheme, uri.host, uri.port);
 
+#ifdef HAVE_NE_SET_SESSION_FLAG
+	/* keep the connection open from one request to the next (asking for
+	 * it from HTTP/1.0 servers too): some cards are slow to accept new
+	 * connections, all the more with TLS */
+	ne_set_session_flag(session, NE_SESSFLAG_PERSIST, 1);
+#endif
+
 	/* timeout if we can't (re)connect to the UPS */
 #ifdef HAVE_NE_SET_CONNECT_TIMEOUT
 	ne_set_connect_timeout(session, timeout);
@@ -718,6 +738,9 @@ void upsdrv_cleanup(void)
 		ne_sock_close(sock);
 	}
 
+	netxml_alarm_parser_free();
+	netxml_page_requests_free();
+
 	if (session) {
 		ne_session_destroy(session);
 	}
@@ -729,33 +752,227 @@ void upsdrv_cleanup(void)
  * Support functions
  *********************************************************************/
 
+static void netxml_page_requests_free(void)
+{
+	size_t	i;
+
+	for (i = 0; i < page_requests_count; i++) {
+		ne_request_destroy(page_requests[i].request);
+		free(page_requests[i].page);
+	}
+
+	page_requests_count = 0;
+}
+
+/* The request for a page, made once and dispatched again on later polls
+ * (on the persistent connection of the session, if the card allows it) */
+static size_t netxml_page_request(const char *page)
+{
+	size_t	i;
+
+	for (i = 0; i < page_requests_count; i++) {
+		if (!strcmp(page_requests[i].page, page)) {
+			return i;
+		}
+	}
+
+	if (page_requests_count == NETXML_PAGE_REQUESTS) {
+		/* the pages changed along the way, start over */
+		netxml_page_requests_free();
+	}
+
+	i = page_requests_count++;
+	page_requests[i].page = xstrdup(page);
+	page_requests[i].request = ne_request_create(session, "GET", page);
+
+	return i;
+}
+
+/* Forget a request which failed, rather than to dispatch it again */
+static void netxml_page_request_drop(size_t i)
+{
+	ne_request_destroy(page_requests[i].request);
+	free(page_requests[i].page);
+
+	page_requests[i] = page_requests[--page_requests_count];
+}
+
 static int netxml_get_page(const char *page)
 {
 	int		ret = NE_ERROR;
-	ne_request	*request;
+	size_t		i;
 	ne_xml_parser	*parser;
 
 	upsdebugx(2, "%s: %s", __func__, (page != NULL)?page:"(null)");
 
 	if (page != NULL) {
-		request = ne_request_create(session, "GET", page);
+		i = netxml_page_request(page);
 
+		/* the page is parsed as it is read, see netxml_dispatch_request() */
 		parser = ne_xml_create();
 
 		ne_xml_push_handler(parser, subdriver->startelm_cb, subdriver->cdata_cb, subdriver->endelm_cb, NULL);
 
-		ret = netxml_dispatch_request(request, parser);
+		ret = netxml_dispatch_request(page_requests[i].request, parser);
 
 		if (ret) {
 			upsdebugx(2, "%s: %s", __func__, ne_get_error(session));
+			netxml_page_request_drop(i);
 		}
 
 		ne_xml_destroy(parser);
-		ne_request_destroy(request);
 	}
 	return ret;
 }
 
+/* The alarm messages are XML documents of their own, sent one after the
+ * other (NUL terminated) on the subscription socket, and not necessarily
+ * one per read. Rather than to make a parser for each, they are all fed
+ * to one as they come in, as the children of an element which the start
+ * of the stream opens and which is never closed, keeping only the XML
+ * declaration of the first message. The subdriver sees this element as
+ * the root. */
+#define NETXML_ALARM_STREAM	INT_MAX
+
+static int netxml_alarm_startelm_cb(void *userdata, int parent, const char *nspace, const char *name, const char **atts)
+{
+	if (parent == NE_XML_STATEROOT) {
+		return NETXML_ALARM_STREAM;
+	}
+
+	if (parent == NETXML_ALARM_STREAM) {
+		parent = NE_XML_STATEROOT;
+	}
+
+	return subdriver->startelm_cb(userdata, parent, nspace, name, atts);
+}
+
+static int netxml_alarm_cdata_cb(void *userdata, int state, const char *cdata, size_t len)
+{
+	if (state == NETXML_ALARM_STREAM) {
+		return 0;
+	}
+
+	return subdriver->cdata_cb(userdata, state, cdata, len);
+}
+
+static int netxml_alarm_endelm_cb(void *userdata, int state, const char *nspace, const char *name)
+{
+	if (state == NETXML_ALARM_STREAM) {
+		return 0;
+	}
+
+	return subdriver->endelm_cb(userdata, state, nspace, name);
+}
+
+static void netxml_alarm_parser_free(void)
+{
+	if (alarm_parser) {
+		ne_xml_destroy(alarm_parser);
+		alarm_parser = NULL;
+	}
+
+	alarm_carry_len = 0;
+}
+
+/* 1 if p (of len bytes) starts with an XML declaration, -1 if it may
+ * (len is too short to tell), 0 if it does not */
+static int netxml_alarm_decl(const char *p, size_t len)
+{
+	static const char	decl[] = "<?xml";
+
+	if (len < sizeof(decl) - 1) {
+		return strncmp(p, decl, len) ? 0 : -1;
+	}
+
+	return strncmp(p, decl, sizeof(decl) - 1) ? 0 : 1;
+}
+
+static int netxml_alarm_feed(const char *data, size_t len, int is_decl)
+{
+	static const char	stream_start[] = "<NETXML_ALARMS>";
+
+	if (!alarm_parser) {
+		alarm_parser = ne_xml_create();
+		ne_xml_push_handler(alarm_parser, netxml_alarm_startelm_cb, netxml_alarm_cdata_cb, netxml_alarm_endelm_cb, NULL);
+
+		if (is_decl && ne_xml_parse(alarm_parser, data, len)) {
+			return -1;
+		}
+
+		if (ne_xml_parse(alarm_parser, stream_start, sizeof(stream_start) - 1)) {
+			return -1;
+		}
+	}
+
+	if (is_decl) {
+		return 0;
+	}
+
+	/* NOTE: a zero length would tell the parser the document ended */
+	return ne_xml_parse(alarm_parser, data, len) ? -1 : 0;
+}
+
+static void netxml_alarm_parse(const char *buf, size_t len)
+{
+	char	*p = alarm_carry;
+	size_t	i = 0, j, n;
+	int	ret = 0, decl;
+
+	if (len > sizeof(alarm_carry) - alarm_carry_len) {
+		upsdebugx(1, "%s: no end to an XML declaration, dropped", __func__);
+		netxml_alarm_parser_free();
+		if (len > sizeof(alarm_carry)) {
+			return;
+		}
+	}
+
+	memcpy(alarm_carry + alarm_carry_len, buf, len);
+	n = alarm_carry_len + len;
+
+	while (i < n || ret) {
+		if (ret) {
+			/* start over with the next message */
+			upsdebugx(1, "%s: %s", __func__, ne_xml_get_error(alarm_parser));
+			ne_xml_destroy(alarm_parser);
+			alarm_parser = NULL;
+			ret = 0;
+			while (i < n && p[i] != '\0') {
+				i++;
+			}
+			continue;
+		}
+
+		if (p[i] == '\0') {
+			i++;
+			continue;
+		}
+
+		decl = netxml_alarm_decl(p + i, n - i);
+		if (decl < 0) {
+			break;	/* tell with the next read */
+		}
+
+		if (decl > 0) {
+			for (j = i + 5; j + 1 < n && (p[j] != '?' || p[j + 1] != '>'); j++);
+			if (j + 1 >= n) {
+				break;	/* the rest of it is yet to come */
+			}
+			ret = netxml_alarm_feed(p + i, j + 2 - i, 1);
+			i = j + 2;
+			continue;
+		}
+
+		for (j = i + 1; j < n && p[j] != '\0' && (p[j] != '<' || !netxml_alarm_decl(p + j, n - j)); j++);
+		ret = netxml_alarm_feed(p + i, j - i, 0);
+		i = j;
+	}
+
+	/* keep what is left for the next read */
+	memmove(alarm_carry, p + i, n - i);
+	alarm_carry_len = n - i;
+}
+
 static int netxml_alarm_subscribe(const char *page)
 {
 	ssize_t	ret;
@@ -772,6 +989,9 @@ static int netxml_alarm_subscribe(const char *page)
 
 	upsdebugx(2, "%s: %s", __func__, page);
 
+	/* a new stream of alarm messages */
+	netxml_alarm_parser_free();
+
 	sock = ne_sock_create();
 
 	if (gethostname(buf, sizeof(buf)) == 0) {
@@ -98,6 +98,8 @@ static ipmi_monitoring_ctx_t mon_ctx = NULL;
   /* Constants */
 #  define IPMI_SDR_MAX_RECORD_LENGTH                               IPMI_SDR_CACHE_MAX_SDR_RECORD_LENGTH
 #  define IPMI_SDR_ERR_CACHE_READ_CACHE_DOES_NOT_EXIST             IPMI_SDR_CACHE_ERR_CACHE_READ_CACHE_DOES_NOT_EXIST
+#  define IPMI_SDR_ERR_CACHE_INVALID                               IPMI_SDR_CACHE_ERR_CACHE_INVALID
+#  define IPMI_SDR_ERR_CACHE_OUT_OF_DATE                           IPMI_SDR_CACHE_ERR_CACHE_OUT_OF_DATE
 #  define IPMI_FRU_AREA_SIZE_MAX                                   IPMI_FRU_PARSE_AREA_SIZE_MAX
 #  define IPMI_FRU_FLAGS_SKIP_CHECKSUM_CHECKS                      IPMI_FRU_PARSE_FLAGS_SKIP_CHECKSUM_CHECKS
 #  define IPMI_FRU_AREA_TYPE_BOARD_INFO_AREA                       IPMI_FRU_PARSE_AREA_TYPE_BOARD_INFO_AREA
@@ -106,10 +108,14 @@ static ipmi_monitoring_ctx_t mon_ctx = NULL;
 #  define NUT_IPMI_SDR_CACHE_DEFAULTS                              IPMI_SDR_CACHE_CREATE_FLAGS_DEFAULT, IPMI_SDR_CACHE_VALIDATION_FLAGS_DEFAULT
 #endif /* HAVE_FREEIPMI_11X_12X */
 
-/* FIXME: freeipmi auto selects a cache based on the hostname you are
- * connecting too, but this is probably fine for you
- */
-#define CACHE_LOCATION "/tmp/sdrcache"
+/* The SDR cache is kept in the state path, so that it survives driver
+ * restarts (building it can take many seconds on slow BMCs), in a file
+ * named after the identity of the BMC (see libfreeipmi_sdr_cache_file()).
+ * FreeIPMI checks it against the timestamps of the SDR repository when
+ * it is opened, and it is then built again if the repository changed. */
+#define CACHE_PREFIX "nut-ipmipsu-sdrcache"
+
+static char	sdr_cache_file[NUT_PATH_MAX + 1];
 
 /* Support functions */
 static const char* libfreeipmi_getfield (uint8_t language_code,
@@ -125,6 +131,8 @@ static int libfreeipmi_get_board_info (const void *areabuf,
 
 static int libfreeipmi_get_sensors_info (IPMIDevice_t *ipmi_dev);
 
+static const char *libfreeipmi_sdr_cache_file (void);
+
 
 /*******************************************************************************
  * Implementation
@@ -585,10 +593,47 @@ static int libfreeipmi_get_board_info (const void *areabuf,
 }
 
 
+/* Name the SDR cache file after the manufacturer, product and device IDs
+ * of the BMC, so that one which was replaced (or a state path shared by
+ * several hosts) does not get the SDR of another */
+static const char *libfreeipmi_sdr_cache_file (void)
+{
+	fiid_obj_t obj_cmd_rs = NULL;
+	uint64_t manufacturer_id = 0, product_id = 0, device_id = 0;
+
+	if (*sdr_cache_file)
+		return sdr_cache_file;
+
+	if ((obj_cmd_rs = fiid_obj_create (tmpl_cmd_get_device_id_rs)) != NULL
+	 && ipmi_cmd_get_device_id (ipmi_ctx, obj_cmd_rs) >= 0
+	 && fiid_obj_get (obj_cmd_rs, "manufacturer_id.id", &manufacturer_id) > 0
+	 && fiid_obj_get (obj_cmd_rs, "product_id", &product_id) > 0
+	 && fiid_obj_get (obj_cmd_rs, "device_id", &device_id) > 0
+	) {
+		snprintf (sdr_cache_file, sizeof(sdr_cache_file),
+			"%s/" CACHE_PREFIX "-%06" PRIx64 "-%04" PRIx64 "-%02" PRIx64,
+			dflt_statepath(), manufacturer_id, product_id, device_id);
+	} else {
+		upsdebugx (1, "Can't get the BMC device ID: %s",
+			ipmi_ctx_errormsg (ipmi_ctx));
+		snprintf (sdr_cache_file, sizeof(sdr_cache_file),
+			"%s/" CACHE_PREFIX, dflt_statepath());
+	}
+
+	if (obj_cmd_rs)
+		fiid_obj_destroy (obj_cmd_rs);
+
+	upsdebugx (2, "SDR cache: %s", sdr_cache_file);
+
+	return sdr_cache_file;
+}
+
 /* Get the sensors list & values, specific to the given FRU ID
  * Return -1 on error, or the number of sensors found otherwise */
 static int libfreeipmi_get_sensors_info (IPMIDevice_t *ipmi_dev)
 {
+	const char *cache_file;
+	int cache_errnum;
 	uint8_t sdr_record[IPMI_SDR_MAX_RECORD_LENGTH];
 	uint8_t record_type, logical_physical_fru_device, logical_fru_device_device_slave_address;
 	uint8_t tmp_entity_id, tmp_entity_instance;
@@ -620,20 +665,36 @@ static int libfreeipmi_get_sensors_info (IPMIDevice_t *ipmi_dev)
 	}
 #endif
 
-	if (ipmi_sdr_cache_open (sdr_ctx, ipmi_ctx, CACHE_LOCATION) < 0)
+	cache_file = libfreeipmi_sdr_cache_file ();
+
+	if (ipmi_sdr_cache_open (sdr_ctx, ipmi_ctx, cache_file) < 0)
 	{
-		if (ipmi_sdr_ctx_errnum (sdr_ctx) != IPMI_SDR_ERR_CACHE_READ_CACHE_DOES_NOT_EXIST)
+		cache_errnum = ipmi_sdr_ctx_errnum (sdr_ctx);
+
+		if (cache_errnum == IPMI_SDR_ERR_CACHE_INVALID
+		 || cache_errnum == IPMI_SDR_ERR_CACHE_OUT_OF_DATE)
+		{
+			/* The SDR repository changed since it was cached */
+			upsdebugx (1, "ipmi_sdr_cache_open: %s, building it again",
+				ipmi_sdr_ctx_errormsg (sdr_ctx));
+			if (ipmi_sdr_cache_delete (sdr_ctx, cache_file) < 0)
+			{
+				libfreeipmi_cleanup();
+				fatal_with_errno(EXIT_FAILURE, "ipmi_sdr_cache_delete: %s",
+					ipmi_sdr_ctx_errormsg (sdr_ctx));
+			}
+		}
+		else if (cache_errnum != IPMI_SDR_ERR_CACHE_READ_CACHE_DOES_NOT_EXIST)
 		{
 			libfreeipmi_cleanup();
 			fatal_with_errno(EXIT_FAILURE, "ipmi_sdr_cache_open: %s",
 				ipmi_sdr_ctx_errormsg (sdr_ctx));
 		}
-	}
 
-	if (ipmi_sdr_ctx_errnum (sdr_ctx) == IPMI_SDR_ERR_CACHE_READ_CACHE_DOES_NOT_EXIST)
-	{
+		upsdebugx (1, "Building the SDR cache, this may take a while...");
+
 		if (ipmi_sdr_cache_create (sdr_ctx,
-				 ipmi_ctx, CACHE_LOCATION,
+				 ipmi_ctx, cache_file,
 				 NUT_IPMI_SDR_CACHE_DEFAULTS,
 				 NULL, NULL) < 0)
 		{
@@ -641,14 +702,11 @@ static int libfreeipmi_get_sensors_info (IPMIDevice_t *ipmi_dev)
 			fatal_with_errno(EXIT_FAILURE, "ipmi_sdr_cache_create: %s",
 				ipmi_sdr_ctx_errormsg (sdr_ctx));
 		}
-		if (ipmi_sdr_cache_open (sdr_ctx, ipmi_ctx, CACHE_LOCATION) < 0)
+		if (ipmi_sdr_cache_open (sdr_ctx, ipmi_ctx, cache_file) < 0)
 		{
-			if (ipmi_sdr_ctx_errnum (sdr_ctx) != IPMI_SDR_ERR_CACHE_READ_CACHE_DOES_NOT_EXIST)
-			{
-				libfreeipmi_cleanup();
-				fatal_with_errno(EXIT_FAILURE, "ipmi_sdr_cache_open: %s",
-					ipmi_sdr_ctx_errormsg (sdr_ctx));
-			}
+			libfreeipmi_cleanup();
+			fatal_with_errno(EXIT_FAILURE, "ipmi_sdr_cache_open: %s",
+				ipmi_sdr_ctx_errormsg (sdr_ctx));
 		}
 	}
 
@@ -863,8 +921,9 @@ int nut_ipmi_monitoring_init(void)
 	}
 
 #if HAVE_FREEIPMI_MONITORING
-	/* FIXME: replace "/tmp" by a proper place, using mkdtemp() or similar */
-	if (ipmi_monitoring_ctx_sdr_cache_directory (mon_ctx, "/tmp") < 0) {
+	/* Its own SDR cache (of the host, checked at each reading like ours)
+	 * is kept along with ours, rather than in "/tmp" */
+	if (ipmi_monitoring_ctx_sdr_cache_directory (mon_ctx, dflt_statepath()) < 0) {
 		upsdebugx (1, "ipmi_monitoring_ctx_sdr_cache_directory() error: %s",
 					ipmi_monitoring_ctx_errormsg (mon_ctx));
 		return -1;
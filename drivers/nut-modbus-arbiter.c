@@ -0,0 +1,710 @@
+/* nut-modbus-arbiter.c - share one Modbus RTU line between several drivers
+
+   Copyright (C)
+	2026	Network UPS Tools developers
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+/* The arbiter owns the serial port of an RS-485 line with several Modbus
+ * RTU slaves, and gives each driver instance a pseudo-terminal of its own
+ * to use as its "port". The requests which the drivers write there are put
+ * on the line one at a time, taking the drivers with a pending request in
+ * turn, and each answer goes back to the pseudo-terminal of the request.
+ *
+ * The drivers (generic_modbus, apc_modbus, socomec_jbus, huawei-ups2000,
+ * phoenixcontact_modbus...) need no change: libmodbus talks RTU to the
+ * pseudo-terminal as it would to the line, and the line is kept busy with
+ * back to back transactions rather than with the collisions and retries
+ * of drivers opening the port each on its own.
+ */
+
+#include "config.h" /* must be the first header */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <termios.h>
+#include <sys/stat.h>
+
+#include "common.h"
+#include "timehead.h"
+#include "nut_stdint.h"
+
+/* Modbus RTU: slave address, function code, data, CRC */
+#define MB_ADU_MAX		256
+#define MB_ADU_MIN		4
+
+/* By default, an answer is awaited this long after its request was sent */
+#define DEFAULT_TIMEOUT_MS	300
+
+/* No answer comes to a broadcast (slave 0), the slaves are given this
+ * long to process it before the next request */
+#define BROADCAST_DELAY_USEC	100000
+
+/* A partial request which its driver did not complete for that long
+ * (a leftover of a driver stopped mid-write) is dropped */
+#define PARTIAL_EXPIRY_USEC	100000
+
+typedef struct {
+	char	*link;		/* symlink to the pty, used as port by the driver */
+	int	mfd;		/* our (master) side of the pty */
+	int	sfd;		/* our hold on the slave side, see link_open() */
+	unsigned char	req[MB_ADU_MAX];
+	size_t	reqlen;
+	int	ready;		/* req is a complete request, waiting for the line */
+	int	stale;		/* the driver wrote again while its request was on the line */
+	uint64_t	last_rx;
+	unsigned long	served, timeouts, dropped;
+} client_t;
+
+static client_t	*clients = NULL;
+static size_t	nclients = 0, rr_next = 0;
+
+static const char	*line_port = NULL;
+static int	line_fd = -1;
+static long	line_baud = 9600;
+static int	line_databits = 8, line_stopbits = 1;
+static char	line_parity = 'N';
+static uint64_t	char_usec, frame_gap_usec;
+
+static uint64_t	timeout_usec = DEFAULT_TIMEOUT_MS * 1000;
+
+/* The transaction on the line, if any */
+static client_t	*xact = NULL;
+static unsigned char	xact_slave, xact_function;
+static unsigned char	resp[MB_ADU_MAX];
+static size_t	resplen;
+static uint64_t	xact_deadline, line_free_at = 0;
+
+static volatile sig_atomic_t	exit_flag = 0;
+
+static uint64_t now_usec(void)
+{
+	struct timeval	tv;
+
+	gettimeofday(&tv, NULL);
+	return (uint64_t)tv.tv_sec * 1000000 + (uint64_t)tv.tv_usec;
+}
+
+static uint16_t mb_crc16(const unsigned char *buf, size_t len)
+{
+	uint16_t	crc = 0xFFFF;
+	size_t	i;
+	int	b;
+
+	for (i = 0; i < len; i++) {
+		crc ^= buf[i];
+		for (b = 0; b < 8; b++) {
+			crc = (crc & 1) ? (uint16_t)((crc >> 1) ^ 0xA001) : (uint16_t)(crc >> 1);
+		}
+	}
+
+	return crc;
+}
+
+/* the CRC is sent low byte first */
+static int mb_crc_ok(const unsigned char *buf, size_t len)
+{
+	uint16_t	crc;
+
+	if (len < MB_ADU_MIN) {
+		return 0;
+	}
+
+	crc = mb_crc16(buf, len - 2);
+	return buf[len - 2] == (crc & 0xFF) && buf[len - 1] == (crc >> 8);
+}
+
+/* The length of the frame starting in buf, as far as its function code
+ * tells: the length, 0 if more bytes are needed to tell, or -1 if the
+ * function code does not tell (the end is then found by the CRC). */
+static long mb_request_len(const unsigned char *buf, size_t len)
+{
+	if (len < 2) {
+		return 0;
+	}
+
+	switch (buf[1]) {
+	case 0x01: case 0x02: case 0x03: case 0x04: case 0x05: case 0x06:
+		return 8;
+	case 0x07: case 0x0B: case 0x0C: case 0x11:
+		return 4;
+	case 0x0F: case 0x10:
+		return (len < 7) ? 0 : 9 + (long)buf[6];
+	case 0x16:
+		return 10;
+	case 0x17:
+		return (len < 11) ? 0 : 13 + (long)buf[10];
+	default:
+		return -1;
+	}
+}
+
+static long mb_response_len(const unsigned char *buf, size_t len)
+{
+	if (len < 2) {
+		return 0;
+	}
+
+	if (buf[1] & 0x80) {
+		return 5;	/* exception */
+	}
+
+	switch (buf[1]) {
+	case 0x01: case 0x02: case 0x03: case 0x04: case 0x0C: case 0x11: case 0x17:
+		return (len < 3) ? 0 : 5 + (long)buf[2];
+	case 0x05: case 0x06: case 0x0B: case 0x0F: case 0x10:
+		return 8;
+	case 0x07:
+		return 5;
+	case 0x16:
+		return 10;
+	default:
+		return -1;
+	}
+}
+
+/* Whether buf holds a whole frame: 1 if so, 0 if not yet, -1 if it is
+ * (or would reach) MB_ADU_MAX and still no valid frame */
+static int mb_frame_complete(const unsigned char *buf, size_t len,
+	long (*frame_len)(const unsigned char *, size_t))
+{
+	long	n = frame_len(buf, len);
+
+	if (n > MB_ADU_MAX) {
+		return -1;
+	}
+
+	if (n > 0) {
+		return ((size_t)n <= len) ? 1 : 0;
+	}
+
+	if (n < 0 && mb_crc_ok(buf, len)) {
+		return 1;
+	}
+
+	return (len >= MB_ADU_MAX) ? -1 : 0;
+}
+
+static speed_t line_speed(long baud)
+{
+	switch (baud) {
+	case 1200:	return B1200;
+	case 2400:	return B2400;
+	case 4800:	return B4800;
+	case 9600:	return B9600;
+	case 19200:	return B19200;
+	case 38400:	return B38400;
+#ifdef B57600
+	case 57600:	return B57600;
+#endif
+#ifdef B115200
+	case 115200:	return B115200;
+#endif
+#ifdef B230400
+	case 230400:	return B230400;
+#endif
+	default:
+		fatalx(EXIT_FAILURE, "Unsupported baud rate %ld", baud);
+	}
+}
+
+static void line_open(void)
+{
+	struct termios	tio;
+	long	bits;
+
+	line_fd = open(line_port, O_RDWR | O_NOCTTY | O_NONBLOCK);
+	if (line_fd < 0) {
+		fatal_with_errno(EXIT_FAILURE, "Can't open %s", line_port);
+	}
+
+	if (tcgetattr(line_fd, &tio)) {
+		fatal_with_errno(EXIT_FAILURE, "tcgetattr(%s)", line_port);
+	}
+
+	memset(&tio, 0, sizeof(tio));
+	tio.c_cflag = CLOCAL | CREAD;
+	switch (line_databits) {
+	case 7:	tio.c_cflag |= CS7; break;
+	default:	tio.c_cflag |= CS8; break;
+	}
+	if (line_stopbits == 2) {
+		tio.c_cflag |= CSTOPB;
+	}
+	if (line_parity == 'E') {
+		tio.c_cflag |= PARENB;
+	} else if (line_parity == 'O') {
+		tio.c_cflag |= PARENB | PARODD;
+	}
+	tio.c_iflag = (line_parity == 'N') ? IGNPAR : INPCK;
+	tio.c_cc[VMIN] = 0;
+	tio.c_cc[VTIME] = 0;
+	cfsetispeed(&tio, line_speed(line_baud));
+	cfsetospeed(&tio, line_speed(line_baud));
+
+	if (tcsetattr(line_fd, TCSANOW, &tio)) {
+		fatal_with_errno(EXIT_FAILURE, "tcsetattr(%s)", line_port);
+	}
+	tcflush(line_fd, TCIOFLUSH);
+
+	/* start bit, data bits, parity, stop bits */
+	bits = 1 + line_databits + (line_parity != 'N') + line_stopbits;
+	char_usec = (uint64_t)(bits * 1000000 / line_baud);
+	/* the 3.5 character silence between frames, 1.75 ms above 19200 baud */
+	frame_gap_usec = (line_baud > 19200) ? 1750 : char_usec * 7 / 2;
+
+	upsdebugx(1, "%s: %ld baud, %d%c%d, %" PRIu64 " usec per character",
+		line_port, line_baud, line_databits, line_parity, line_stopbits, char_usec);
+}
+
+/* The pty of a driver: our side is the master, and the link named on the
+ * command line points at the slave side. We keep the slave open as well,
+ * so that the master reads no hangup while no driver has it open, and
+ * put it in raw mode for the drivers which would not. */
+static void link_open(client_t *c)
+{
+	const char	*pts;
+	struct termios	tio;
+	struct stat	st;
+
+	c->mfd = posix_openpt(O_RDWR | O_NOCTTY);
+	if (c->mfd < 0 || grantpt(c->mfd) || unlockpt(c->mfd)
+	 || (pts = ptsname(c->mfd)) == NULL
+	) {
+		fatal_with_errno(EXIT_FAILURE, "Can't create a pty for %s", c->link);
+	}
+
+	c->sfd = open(pts, O_RDWR | O_NOCTTY);
+	if (c->sfd < 0) {
+		fatal_with_errno(EXIT_FAILURE, "Can't open %s", pts);
+	}
+
+	if (!tcgetattr(c->sfd, &tio)) {
+		cfmakeraw(&tio);
+		tcsetattr(c->sfd, TCSANOW, &tio);
+	}
+
+	fcntl(c->mfd, F_SETFL, fcntl(c->mfd, F_GETFL) | O_NONBLOCK);
+	set_close_on_exec(c->mfd);
+	set_close_on_exec(c->sfd);
+
+	/* a link left over by a previous run is replaced, not a file */
+	if (!lstat(c->link, &st)) {
+		if (!S_ISLNK(st.st_mode)) {
+			fatalx(EXIT_FAILURE, "%s exists and is not a symlink", c->link);
+		}
+		unlink(c->link);
+	}
+
+	if (symlink(pts, c->link)) {
+		fatal_with_errno(EXIT_FAILURE, "Can't create the link %s", c->link);
+	}
+
+	upsdebugx(1, "%s -> %s", c->link, pts);
+}
+
+static void links_remove(void)
+{
+	size_t	i;
+
+	for (i = 0; i < nclients; i++) {
+		unlink(clients[i].link);
+	}
+}
+
+static void client_read(client_t *c)
+{
+	unsigned char	buf[MB_ADU_MAX];
+	ssize_t	ret;
+	size_t	n;
+	uint64_t	now = now_usec();
+	int	r;
+
+	ret = read(c->mfd, buf, sizeof(buf));
+	if (ret <= 0) {
+		return;
+	}
+
+	if (c == xact) {
+		/* the driver gave up on its request (timed out on its side) */
+		c->stale = 1;
+	}
+
+	/* a new request replaces one the line did not take yet */
+	if (c->ready || (c->reqlen && now - c->last_rx > PARTIAL_EXPIRY_USEC)) {
+		if (c->ready) {
+			c->dropped++;
+		}
+		c->ready = 0;
+		c->reqlen = 0;
+	}
+	c->last_rx = now;
+
+	n = (size_t)ret;
+	if (n > sizeof(c->req) - c->reqlen) {
+		n = sizeof(c->req) - c->reqlen;
+	}
+	memcpy(c->req + c->reqlen, buf, n);
+	c->reqlen += n;
+
+	r = mb_frame_complete(c->req, c->reqlen, mb_request_len);
+	if (r > 0) {
+		if (!mb_crc_ok(c->req, c->reqlen)) {
+			upsdebugx(2, "%s: request with a bad CRC dropped", c->link);
+			c->dropped++;
+			c->reqlen = 0;
+			return;
+		}
+		c->ready = 1;
+	} else if (r < 0) {
+		upsdebugx(2, "%s: unknown request dropped", c->link);
+		c->dropped++;
+		c->reqlen = 0;
+	}
+}
+
+/* Put the next request on the line, from the drivers in turn */
+static void xact_start(void)
+{
+	size_t	i, n;
+	client_t	*c = NULL;
+	ssize_t	ret;
+	uint64_t	now = now_usec();
+
+	for (i = 0; i < nclients; i++) {
+		n = (rr_next + i) % nclients;
+		if (clients[n].ready) {
+			c = &clients[n];
+			rr_next = n + 1;
+			break;
+		}
+	}
+
+	if (!c) {
+		return;
+	}
+
+	/* what the line received since is no answer to this request */
+	tcflush(line_fd, TCIFLUSH);
+
+	upsdebug_hex(3, c->link, c->req, c->reqlen);
+	ret = write(line_fd, c->req, c->reqlen);
+	c->ready = 0;
+	if (ret < 0 || (size_t)ret != c->reqlen) {
+		upslog_with_errno(LOG_ERR, "%s: write failed", line_port);
+		c->dropped++;
+		c->reqlen = 0;
+		line_free_at = now + frame_gap_usec;
+		return;
+	}
+
+	now += c->reqlen * char_usec;	/* until it is sent */
+	c->reqlen = 0;
+
+	if (c->req[0] == 0) {
+		c->served++;
+		line_free_at = now + BROADCAST_DELAY_USEC;
+		return;
+	}
+
+	xact = c;
+	xact_slave = c->req[0];
+	xact_function = c->req[1];
+	c->stale = 0;
+	resplen = 0;
+	xact_deadline = now + timeout_usec;
+}
+
+static void xact_end(void)
+{
+	line_free_at = now_usec() + frame_gap_usec;
+	xact = NULL;
+	resplen = 0;
+}
+
+static void line_read(void)
+{
+	unsigned char	buf[MB_ADU_MAX];
+	ssize_t	ret;
+	size_t	n;
+	int	r;
+
+	ret = read(line_fd, buf, sizeof(buf));
+	if (ret <= 0) {
+		return;
+	}
+
+	if (!xact) {
+		upsdebug_hex(3, "unexpected data on the line", buf, (size_t)ret);
+		return;
+	}
+
+	n = (size_t)ret;
+	if (n > sizeof(resp) - resplen) {
+		n = sizeof(resp) - resplen;
+	}
+	memcpy(resp + resplen, buf, n);
+	resplen += n;
+
+	r = mb_frame_complete(resp, resplen, mb_response_len);
+	if (r == 0) {
+		return;
+	}
+
+	upsdebug_hex(3, "answer", resp, resplen);
+	if (r < 0 || !mb_crc_ok(resp, resplen)) {
+		upsdebugx(2, "%s: answer with a bad CRC dropped", xact->link);
+		xact->dropped++;
+	} else if (resp[0] != xact_slave || (resp[1] & 0x7F) != xact_function) {
+		upsdebugx(2, "%s: answer from another slave or function dropped", xact->link);
+		xact->dropped++;
+	} else if (xact->stale) {
+		upsdebugx(2, "%s: answer for a request given up dropped", xact->link);
+		xact->dropped++;
+	} else if (write(xact->mfd, resp, resplen) != (ssize_t)resplen) {
+		upslog_with_errno(LOG_WARNING, "%s: can't pass the answer", xact->link);
+		xact->dropped++;
+	} else {
+		xact->served++;
+	}
+
+	xact_end();
+}
+
+static void arbitrate(void)
+{
+	struct pollfd	*fds;
+	size_t	i;
+	uint64_t	now, wake;
+	int	timeout;
+
+	fds = xcalloc(nclients + 1, sizeof(*fds));
+
+	while (!exit_flag) {
+		now = now_usec();
+
+		if (xact && now >= xact_deadline) {
+			upsdebugx(2, "%s: no answer from slave %d", xact->link, xact_slave);
+			xact->timeouts++;
+			xact_end();
+			now = now_usec();
+		}
+
+		if (!xact && now >= line_free_at) {
+			xact_start();
+			now = now_usec();
+		}
+
+		/* wait for data, or for the line to be free for a waiting request */
+		wake = 0;
+		if (xact) {
+			wake = xact_deadline;
+		} else {
+			for (i = 0; i < nclients; i++) {
+				if (clients[i].ready) {
+					wake = line_free_at;
+					break;
+				}
+			}
+		}
+		timeout = !wake ? -1 : (wake <= now) ? 0 : (int)((wake - now + 999) / 1000);
+
+		fds[0].fd = line_fd;
+		fds[0].events = POLLIN;
+		for (i = 0; i < nclients; i++) {
+			fds[i + 1].fd = clients[i].mfd;
+			fds[i + 1].events = POLLIN;
+		}
+
+		if (poll(fds, (nfds_t)(nclients + 1), timeout) < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			fatal_with_errno(EXIT_FAILURE, "poll");
+		}
+
+		if (fds[0].revents & POLLIN) {
+			line_read();
+		}
+
+		for (i = 0; i < nclients; i++) {
+			if (fds[i + 1].revents & POLLIN) {
+				client_read(&clients[i]);
+			}
+		}
+	}
+
+	free(fds);
+
+	for (i = 0; i < nclients; i++) {
+		upsdebugx(1, "%s: %lu transactions, %lu timeouts, %lu dropped",
+			clients[i].link, clients[i].served, clients[i].timeouts, clients[i].dropped);
+	}
+}
+
+static void set_exit_flag(int sig)
+{
+	exit_flag = sig;
+}
+
+static void setup_signals(void)
+{
+	struct sigaction	sa;
+
+	sigemptyset(&sa.sa_mask);
+	sa.sa_flags = 0;
+
+	sa.sa_handler = set_exit_flag;
+	sigaction(SIGTERM, &sa, NULL);
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGQUIT, &sa, NULL);
+
+	sa.sa_handler = SIG_IGN;
+	sigaction(SIGHUP, &sa, NULL);
+	sigaction(SIGPIPE, &sa, NULL);
+}
+
+static void help(const char *arg_progname)
+	__attribute__((noreturn));
+
+static void help(const char *arg_progname)
+{
+	print_banner_once(arg_progname, 2);
+	printf("Modbus RTU line arbiter: shares one serial port between drivers.\n\n");
+
+	printf("usage: %s [OPTIONS] -p <port> <link> [<link> ...]\n\n", arg_progname);
+
+	printf("Each <link> is created as a symlink to a pseudo-terminal, to use as the\n");
+	printf("port of one driver instance; their requests take turns on the line.\n\n");
+
+	printf("  -h			display this help\n");
+	printf("  -p <port>		serial port of the RS-485 line\n");
+	printf("  -b <baud>		line speed (default 9600)\n");
+	printf("  -m <framing>		data bits, parity (N, E or O) and stop bits (default 8N1)\n");
+	printf("  -t <ms>		answer timeout (default %d), shorter than that of the drivers\n", DEFAULT_TIMEOUT_MS);
+	printf("  -u <user>		switch to <user> (the one of the drivers) after opening the port\n");
+	printf("  -F			stay in the foreground\n");
+	printf("  -D			raise debugging level\n");
+	printf("  -V			display the version of this software\n");
+
+	exit(EXIT_SUCCESS);
+}
+
+int main(int argc, char **argv)
+{
+	int	i, foreground = 0;
+	const char	*user = RUN_AS_USER, *prog = xbasename(argv[0]);
+	char	pidname[SMALLBUF];
+	long	t;
+
+	print_banner_once(prog, 0);
+
+	while ((i = getopt(argc, argv, "+hp:b:m:t:u:FDV")) != -1) {
+		switch (i) {
+			case 'p':
+				line_port = optarg;
+				break;
+
+			case 'b':
+				line_baud = strtol(optarg, NULL, 10);
+				break;
+
+			case 'm':
+				if (strlen(optarg) != 3
+				 || (optarg[0] != '7' && optarg[0] != '8')
+				 || !strchr("NEO", optarg[1])
+				 || (optarg[2] != '1' && optarg[2] != '2')
+				) {
+					fatalx(EXIT_FAILURE, "Invalid framing %s, try -h for help", optarg);
+				}
+				line_databits = optarg[0] - '0';
+				line_parity = optarg[1];
+				line_stopbits = optarg[2] - '0';
+				break;
+
+			case 't':
+				t = strtol(optarg, NULL, 10);
+				if (t <= 0) {
+					fatalx(EXIT_FAILURE, "Invalid timeout %s, try -h for help", optarg);
+				}
+				timeout_usec = (uint64_t)t * 1000;
+				break;
+
+			case 'u':
+				user = optarg;
+				break;
+
+			case 'F':
+				foreground = 1;
+				break;
+
+			case 'D':
+				nut_debug_level++;
+				break;
+
+			case 'V':
+				/* just show the banner */
+				exit(EXIT_SUCCESS);
+
+			case 'h':
+			default:
+				help(prog);
+		}
+	}
+
+	argc -= optind;
+	argv += optind;
+
+	if (!line_port || argc < 1) {
+		help(prog);
+	}
+
+	open_syslog(prog);
+
+	line_open();
+
+	/* the ptys get created by the user of the drivers, for them to open */
+	become_user(get_user_pwent(user));
+
+	nclients = (size_t)argc;
+	clients = xcalloc(nclients, sizeof(*clients));
+	for (i = 0; i < argc; i++) {
+		clients[i].link = argv[i];
+		link_open(&clients[i]);
+	}
+	atexit(links_remove);
+
+	setup_signals();
+
+	if (!foreground && !nut_debug_level) {
+		background();
+		snprintf(pidname, sizeof(pidname), "%s-%s", prog, xbasename(line_port));
+		writepid(pidname);
+	}
+
+	upslogx(LOG_INFO, "Arbitrating %s between %" PRIuSIZE " links", line_port, nclients);
+
+	arbitrate();
+
+	upslogx(LOG_INFO, "Signal %d: exiting", (int)exit_flag);
+
+	exit(EXIT_SUCCESS);
+}
@@ -118,4 +118,10 @@ typedef struct usb_communication_subdriver_s {
 
 extern usb_communication_subdriver_t	usb_subdriver;
 
+#if (defined WITH_LIBUSB_1_0) && WITH_LIBUSB_1_0
+/* reports got from the interrupt pipe which the next get_interrupt()
+ * calls return at once (see the asynchronous reading in libusb1.c) */
+int nut_libusb_interrupt_pending(void);
+#endif	/* WITH_LIBUSB_1_0 */
+
 #endif /* NUT_LIBUSB_H_SEEN */
@@ -58,7 +58,7 @@
 #	define DRIVER_NAME	"Generic Q* Serial driver"
 #endif	/* QX_USB */
 
-#define DRIVER_VERSION	"0.44"
+#define DRIVER_VERSION	"0.46"
 
 #ifdef QX_SERIAL
 #	include "serial.h"
@@ -157,10 +157,22 @@ static int	hunnox_step = 0;
 static int	is_usb = 0;	/* Whether the device is connected through USB (1) or serial (0) */
 #endif	/* QX_USB && QX_SERIAL */
 
+#define QX_WALK_ANSWERS	32	/* Max number of different commands whose answers are kept during a walk */
+
 static struct {
 	char	command[SMALLBUF];	/* Command sent to the UPS to get answer/to execute an instant command */
 	char	answer[SMALLBUF];	/* Answer from the UPS, filled at runtime */
-} previous_item = { "", "" };	/* Hold the values of the item processed just before the actual one */
+} walk_answers[QX_WALK_ANSWERS];	/* Hold the answers got in the walk going on, whatever the order of the items sharing a command */
+static size_t	walk_nanswers = 0;
+
+/* Index of the qx2nut table of the subdriver in use, by NUT name, for find_nut_info() */
+static const item_t	*qx_nut_table = NULL;	/* Table the index was made of */
+static item_t	**qx_nut_map = NULL;	/* First item of each name, open addressing */
+static size_t	qx_nut_map_size = 0;
+static item_t	**qx_nut_next = NULL;	/* Next item of the same name, in table order, by position in the table */
+
+static long	slowpollfreq = DEFAULT_SLOWPOLLFREQ;
+static time_t	lastslowpoll = 0;	/* Timestamp the last polling of QX_FLAG_SLOW items */
 
 
 /* == Support functions == */
@@ -171,6 +183,9 @@ static bool_t	qx_ups_walk(walkmode_t mode);
 static void	ups_status_set(void);
 static void	ups_alarm_set(void);
 static void	qx_set_var(item_t *item);
+static void	qx_set_slowcommands(void);
+static void	qx_build_map(void);
+static void	qx_free_map(void);
 
 
 /* == Struct & data for status processing == */
@@ -581,6 +596,192 @@ static int				langid_fix = -1;
 
 static int	(*subdriver_command)(const char *cmd, char *buf, size_t buflen) = NULL;
 
+/* Reply latency of the device, learnt from the first chunk of the replies
+ * it gave (see qx_reply_read()): the first read of a reply waits a few
+ * times that long, instead of the fixed timeout of the subdriver, and then
+ * the rest of that timeout if nothing came; only commands which went
+ * unanswered for the whole timeout before, and were never answered (likely
+ * not supported, and costing the whole timeout every time otherwise), are
+ * given up on right away. A reply which came after the wait doubles those
+ * which follow, until one comes in time again, and what may come late for
+ * a command given up on is drained before the next one. The figures are
+ * published as driver.stats.reply.* */
+#define QX_REPLY_LEARN	8	/* replies measured before the waits adapt */
+#define QX_REPLY_FLOOR	100	/* shortest wait for a reply, in ms */
+#define QX_REPLY_BACKOFF	4	/* most doublings after late replies */
+#define QX_REPLY_CMDS	64	/* commands told apart (others wait in full) */
+#define QX_REPLY_CMDLEN	16
+
+typedef struct {
+	char	cmd[QX_REPLY_CMDLEN];
+	int	answered;	/* ever */
+	int	ignored;	/* for the whole timeout, and not answered since */
+} qx_reply_cmd_t;
+
+static struct {
+	double	latency, deviation;	/* smoothed, in ms */
+	unsigned long	replies, cut, late;
+	unsigned int	backoff;
+	qx_reply_cmd_t	*cmd;	/* being sent, NULL if not told apart */
+	uint64_t	start;	/* when it was */
+	int	reading;	/* the first chunk of its reply was read already */
+	qx_reply_cmd_t	*drain_cmd;	/* given up on, to drain before the next one */
+	int	drain_ep, drain_len;
+	int	changed;	/* since published */
+} qx_reply;
+
+static qx_reply_cmd_t	qx_reply_cmds[QX_REPLY_CMDS];
+static size_t	qx_reply_ncmds = 0;
+
+/* how long the first read of a reply should wait, for a subdriver
+ * which would wait <dflt> ms */
+static int	qx_reply_wait(int dflt)
+{
+	double	wait;
+
+	if (qx_reply.replies < QX_REPLY_LEARN) {
+		return dflt;
+	}
+
+	wait = qx_reply.latency + 4 * qx_reply.deviation;
+	if (wait < 2 * qx_reply.latency) {
+		wait = 2 * qx_reply.latency;
+	}
+	if (wait < QX_REPLY_FLOOR) {
+		wait = QX_REPLY_FLOOR;
+	}
+	wait *= (double)(1U << qx_reply.backoff);
+
+	return (wait < dflt) ? (int)wait : dflt;
+}
+
+/* a command is about to be sent */
+static void	qx_reply_begin(const char *cmd)
+{
+	size_t	i;
+
+	/* whatever came after a reply was given up on */
+	if (qx_reply.drain_cmd) {
+		char	tmp[SMALLBUF];
+		int	len = (qx_reply.drain_len < (int)sizeof(tmp)) ? qx_reply.drain_len : (int)sizeof(tmp);
+
+		for (i = 0; i < 10; i++) {
+			if (usb_interrupt_read(udev, qx_reply.drain_ep,
+				(usb_ctrl_charbuf)tmp, len, 10) <= 0
+			) {
+				break;
+			}
+			/* it does answer after all, if late */
+			upsdebugx(4, "%s: drained a late reply to %.*s", __func__,
+				(int)strcspn(qx_reply.drain_cmd->cmd, "\r"), qx_reply.drain_cmd->cmd);
+			qx_reply.drain_cmd->ignored = 0;
+		}
+		qx_reply.drain_cmd = NULL;
+	}
+
+	qx_reply.cmd = NULL;
+	for (i = 0; i < qx_reply_ncmds; i++) {
+		if (!strcmp(qx_reply_cmds[i].cmd, cmd)) {
+			qx_reply.cmd = &qx_reply_cmds[i];
+			break;
+		}
+	}
+
+	if (!qx_reply.cmd && qx_reply_ncmds < QX_REPLY_CMDS && strlen(cmd) < QX_REPLY_CMDLEN) {
+		qx_reply.cmd = &qx_reply_cmds[qx_reply_ncmds++];
+		snprintf(qx_reply.cmd->cmd, sizeof(qx_reply.cmd->cmd), "%s", cmd);
+	}
+
+	qx_reply.reading = 0;
+	qx_reply.start = drv_stats_now_usec();
+}
+
+/* usb_interrupt_read() for the reply to the command sent last, which
+ * would wait <dflt> ms: the first chunk is waited for as learnt, and
+ * measured */
+static int	qx_reply_read(int ep, usb_ctrl_charbuf buf, int len, int dflt)
+{
+	int	wait, ret, in_time = 1;
+	double	ms, diff;
+
+	if (qx_reply.reading) {
+		return usb_interrupt_read(udev, ep, buf, len, dflt);
+	}
+
+	qx_reply.reading = 1;
+	wait = qx_reply_wait(dflt);
+	ret = usb_interrupt_read(udev, ep, buf, len, wait);
+
+	if ((ret == 0 || ret == LIBUSB_ERROR_TIMEOUT) && wait < dflt) {
+		qx_reply.changed = 1;
+
+		if (qx_reply.cmd && qx_reply.cmd->ignored) {
+			upsdebugx(4, "%s: no reply within %d ms, giving up", __func__, wait);
+			qx_reply.cut++;
+			qx_reply.drain_cmd = qx_reply.cmd;
+			qx_reply.drain_ep = ep;
+			qx_reply.drain_len = len;
+			return ret;
+		}
+
+		upsdebugx(4, "%s: no reply within %d ms, waiting up to %d ms",
+			__func__, wait, dflt);
+		in_time = 0;
+		if (qx_reply.backoff < QX_REPLY_BACKOFF) {
+			qx_reply.backoff++;
+		}
+		ret = usb_interrupt_read(udev, ep, buf, len, dflt - wait);
+	}
+
+	if (ret <= 0) {
+		if ((ret == 0 || ret == LIBUSB_ERROR_TIMEOUT)
+		 && qx_reply.cmd && !qx_reply.cmd->answered
+		) {
+			qx_reply.cmd->ignored = 1;
+		}
+		return ret;
+	}
+
+	if (qx_reply.cmd) {
+		qx_reply.cmd->answered = 1;
+		qx_reply.cmd->ignored = 0;
+	}
+
+	/* smoothed like the round-trip time of TCP (RFC 6298) */
+	ms = (double)(drv_stats_now_usec() - qx_reply.start) / 1000;
+	if (!qx_reply.replies++) {
+		qx_reply.latency = ms;
+		qx_reply.deviation = ms / 2;
+	} else {
+		diff = ms - qx_reply.latency;
+		qx_reply.deviation += ((diff < 0 ? -diff : diff) - qx_reply.deviation) / 4;
+		qx_reply.latency += diff / 8;
+	}
+
+	if (in_time) {
+		qx_reply.backoff = 0;
+	} else {
+		qx_reply.late++;
+	}
+	qx_reply.changed = 1;
+
+	return ret;
+}
+
+static void	qx_reply_publish(void)
+{
+	if (!qx_reply.changed || !qx_reply.replies) {
+		return;
+	}
+
+	dstate_setinfo("driver.stats.reply.latency", "%.1f", qx_reply.latency);
+	dstate_setinfo("driver.stats.reply.deviation", "%.1f", qx_reply.deviation);
+	dstate_setinfo("driver.stats.reply.wait", "%d", qx_reply_wait(1000));
+	dstate_setinfo("driver.stats.reply.cut", "%lu", qx_reply.cut);
+	dstate_setinfo("driver.stats.reply.late", "%lu", qx_reply.late);
+	qx_reply.changed = 0;
+}
+
 /* Cypress communication subdriver */
 static int	cypress_command(const char *cmd, char *buf, size_t buflen)
 {
@@ -626,8 +827,7 @@ static int	cypress_command(const char *cmd, char *buf, size_t buflen)
 
 		/* Read data in 8-byte chunks */
 		/* ret = usb->get_interrupt(udev, (unsigned char *)&buf[i], 8, 1000); */
-		ret = usb_interrupt_read(udev,
-			0x81,
+		ret = qx_reply_read(0x81,
 			(usb_ctrl_charbuf)&buf[i], 8, 1000);
 
 		/* Any errors here mean that we are unable to read a reply
@@ -708,10 +908,12 @@ static int	sgs_command(const char *cmd, char *buf, size_t buflen)
 
 		memset(tmp, 0, sizeof(tmp));
 
-		/* Read data in 8-byte chunks */
-		ret = usb_interrupt_read(udev,
-			0x81,
-			(usb_ctrl_charbuf)tmp, 8, 1000);
+		/* Read data in 8-byte chunks: the end of the reply is when
+		 * nothing more comes, which is not waited for as long once
+		 * its CR came */
+		ret = qx_reply_read(0x81,
+			(usb_ctrl_charbuf)tmp, 8,
+			memchr(buf, '\r', i) ? qx_reply_wait(1000) : 1000);
 
 		/* No error!!! */
 		/* if (ret == -110) */
@@ -837,8 +1039,7 @@ static int	phoenix_command(const char *cmd, char *buf, size_t buflen)
 
 		/* Read data in 8-byte chunks */
 		/* ret = usb->get_interrupt(udev, (unsigned char *)&buf[i], 8, 1000); */
-		ret = usb_interrupt_read(udev,
-			0x81,
+		ret = qx_reply_read(0x81,
 			(usb_ctrl_charbuf)&buf[i], 8, 1000);
 
 		/* Any errors here mean that we are unable to read a reply
@@ -900,8 +1101,7 @@ static int	ippon_command(const char *cmd, char *buf, size_t buflen)
 	upsdebugx(3, "send: %.*s", (int)strcspn(tmp, "\r"), tmp);
 
 	/* Read all 64 bytes of the reply in one large chunk */
-	ret = usb_interrupt_read(udev,
-		0x81,
+	ret = qx_reply_read(0x81,
 		(usb_ctrl_charbuf)tmp, sizeof(tmp), 1000);
 
 	/* Any errors here mean that we are unable to read a reply
@@ -962,9 +1162,17 @@ static int	ippon_command(const char *cmd, char *buf, size_t buflen)
 static int 	hunnox_protocol(int asking_for)
 {
 	char	buf[1030];
+	static const vartab_t	*novendor = NULL;
+	static int	novendor_looked_up = 0;
 
 	int langid_fix_local = 0x0409;
 
+	/* this runs for every query, the option is only looked up once */
+	if (!novendor_looked_up) {
+		novendor = vartab_handle("novendor");
+		novendor_looked_up = 1;
+	}
+
 	if (langid_fix != -1) {
 		langid_fix_local = langid_fix;
 	}
@@ -995,7 +1203,7 @@ static int 	hunnox_protocol(int asking_for)
 			}
 			break;
 		case 3:
-			if (asking_for != 0x0c && !testvar("novendor")) {
+			if (asking_for != 0x0c && !testvar_handle(novendor)) {
 				upsdebugx(3, "asking for: %02X", (unsigned int)0x0c);
 				usb_get_string(udev, 0x0c,
 					langid_fix_local, (usb_ctrl_charbuf)buf, 102);
@@ -1559,8 +1767,7 @@ static int	fuji_command(const char *cmd, char *buf, size_t buflen)
 	for (i = 0; (i <= buflen - 8) && (memchr(buf, '\r', buflen) == NULL); i += (size_t)ret) {
 
 		/* Read data in 8-byte chunks */
-		ret = usb_interrupt_read(udev,
-			USB_ENDPOINT_IN | 1,
+		ret = qx_reply_read(USB_ENDPOINT_IN | 1,
 			(usb_ctrl_charbuf)&buf[i], 8, 1000);
 
 		/* Any errors here mean that we are unable to read a reply
@@ -1637,8 +1844,7 @@ static int	phoenixtec_command(const char *cmd, char *buf, size_t buflen)
 
 	for (p = buf; p < buf + buflen; p += ret) {
 		/* buflen constrained to INT_MAX above, so we can cast: */
-		if ((ret = usb_interrupt_read(udev,
-				USB_ENDPOINT_IN | 1,
+		if ((ret = qx_reply_read(USB_ENDPOINT_IN | 1,
 				(usb_ctrl_charbuf)p, (int)(buf + buflen - p), 1000)) <= 0
 		) {
 			upsdebugx(3, "read: %s (%d)",
@@ -1919,8 +2125,7 @@ static int	gtec_command(const char *cmd, char *buf, size_t buflen)
 
 		/* Read data in 8-byte chunks */
 		/* ret = usb->get_interrupt(udev, (unsigned char *)&buf[i], 8, 1000); */
-		ret = usb_interrupt_read(udev,
-			0x81,
+		ret = qx_reply_read(0x81,
 			(usb_ctrl_charbuf)&buf[i], 128, 1000);
 
 		/* Any errors here mean that we are unable to read a reply
@@ -2151,7 +2356,7 @@ static int	armac_command(const char *cmd, char *buf, size_t buflen)
 		size_t bytes_available;
 
 		/* Read data in 6-byte chunks */
-		ret = usb_interrupt_read(udev, use_interrupt ? armac_endpoint_cache.in_endpoint_address : 0x81,
+		ret = qx_reply_read(use_interrupt ? armac_endpoint_cache.in_endpoint_address : 0x81,
 			(usb_ctrl_charbuf)tmpbuf, read_size, 1000);
 
 		/* Any errors here mean that we are unable to read a reply
@@ -3098,6 +3303,14 @@ void	upsdrv_makevartable(void)
 			 DEFAULT_POLLFREQ);
 	addvar(VAR_VALUE, QX_VAR_POLLFREQ, temp);
 
+	snprintf(temp, sizeof(temp),
+		"Set polling frequency of slowly changing data, in seconds (default=%d)",
+			 DEFAULT_SLOWPOLLFREQ);
+	addvar(VAR_VALUE, QX_VAR_SLOWPOLLFREQ, temp);
+
+	addvar(VAR_VALUE, QX_VAR_SLOWCOMMANDS,
+		"Comma-separated list of the commands whose answers change slowly");
+
 	addvar(VAR_VALUE, "protocol",
 		"Preselect communication protocol (skip autodetection)");
 
@@ -3180,6 +3393,9 @@ void	upsdrv_updateinfo(void)
 		lastpoll = now;
 		data_has_changed = FALSE;
 
+		if (now >= lastslowpoll + slowpollfreq)
+			lastslowpoll = now;
+
 		ups_alarm_set();
 		alarm_commit();
 
@@ -3213,6 +3429,13 @@ void	upsdrv_updateinfo(void)
 
 	retry = 0;
 
+#if defined(QX_USB) && !defined(TESTING)
+#  ifdef QX_SERIAL
+	if (is_usb)
+#  endif	/* QX_SERIAL (&& QX_USB) */
+		qx_reply_publish();
+#endif	/* QX_USB && !TESTING */
+
 	dstate_dataok();
 }
 
@@ -3225,6 +3448,9 @@ void	upsdrv_initinfo(void)
 
 	dstate_setinfo("driver.version.data", "%s", subdriver->name);
 
+	/* Mark the items of the slowly changing commands, if any */
+	qx_set_slowcommands();
+
 	/* Initialise data */
 	if (qx_ups_walk(QX_WALKMODE_INIT) == FALSE) {
 		fatalx(EXIT_FAILURE, "Can't initialise data from the UPS");
@@ -3276,7 +3502,12 @@ void	upsdrv_initinfo(void)
 
 	dstate_setinfo("driver.parameter.pollfreq", "%ld", pollfreq);
 
+	val = getval(QX_VAR_SLOWPOLLFREQ);
+	if (val)
+		slowpollfreq = strtol(val, NULL, 10);
+
 	time(&lastpoll);
+	lastslowpoll = lastpoll;
 
 	/* Install handlers */
 	upsh.setvar = setvar;
@@ -3611,6 +3842,7 @@ void	upsdrv_cleanup(void)
 
 #endif	/* TESTING */
 
+	qx_free_map();
 }
 
 
@@ -3652,6 +3884,7 @@ static ssize_t	qx_command(const char *cmd, char *buf, size_t buflen)
 			dstate_setinfo("driver.state", "reconnect.updateinfo");
 		}
 
+		qx_reply_begin(cmd);
 		ret = (*subdriver_command)(cmd, buf, buflen);
 
 		if (ret >= 0) {
@@ -3911,6 +4144,9 @@ static int	subdriver_matcher(void)
 
 	upslogx(LOG_INFO, "Using protocol: %s", subdriver->name);
 
+	/* Index the items of the subdriver for find_nut_info() */
+	qx_build_map();
+
 	return 1;
 }
 
@@ -4017,11 +4253,93 @@ static void	qx_set_var(item_t *item)
 	}
 }
 
+/* Return the answer already got in this walk for command cmd, if any. */
+static const char	*walk_answer_get(const char *cmd)
+{
+	size_t	i;
+
+	for (i = 0; i < walk_nanswers; i++) {
+		if (!strcasecmp(walk_answers[i].command, cmd))
+			return strlen(walk_answers[i].answer) > 0 ? walk_answers[i].answer : NULL;
+	}
+
+	return NULL;
+}
+
+/* Remember the answer got in this walk for command cmd. */
+static void	walk_answer_set(const char *cmd, const char *answer)
+{
+	size_t	i;
+
+	if (!strlen(cmd))
+		return;
+
+	for (i = 0; i < walk_nanswers; i++) {
+		if (!strcasecmp(walk_answers[i].command, cmd))
+			break;
+	}
+
+	if (i == walk_nanswers) {
+		/* Full: the commands beyond will just be sent again */
+		if (walk_nanswers == QX_WALK_ANSWERS)
+			return;
+		walk_nanswers++;
+	}
+
+	snprintf(walk_answers[i].command, sizeof(walk_answers[i].command), "%s", cmd);
+	snprintf(walk_answers[i].answer, sizeof(walk_answers[i].answer), "%s", answer);
+}
+
+/* Set QX_FLAG_SLOW on the items using the commands listed (comma-separated) in the 'slowcommands' var. */
+static void	qx_set_slowcommands(void)
+{
+	char	*val = getval(QX_VAR_SLOWCOMMANDS), *list, *cmd, *last = NULL;
+	item_t	*item;
+	size_t	len;
+
+	if (!val)
+		return;
+
+	list = xstrdup(val);
+
+	for (cmd = strtok_r(list, ", ", &last); cmd != NULL; cmd = strtok_r(NULL, ", ", &last)) {
+
+		len = strlen(cmd);
+
+		for (item = subdriver->qx2nut; item->info_type != NULL; item++) {
+
+			/* Status and alarms are needed at every update */
+			if (item->qxflags & (QX_FLAG_QUICK_POLL | QX_FLAG_CMD | QX_FLAG_SETVAR)
+			||  item->command == NULL
+			||  !strncmp(item->info_type, "ups.alarm", 9)
+			||  !strncmp(item->info_type, "ups.status", 10)
+			) {
+				continue;
+			}
+
+			/* Commands are matched without their trailing CR */
+			if (strncasecmp(item->command, cmd, len)
+			||  (item->command[len] != '\0' && strcmp(item->command + len, "\r"))
+			) {
+				continue;
+			}
+
+			upsdebugx(2, "%s: polling %s slowly", __func__, item->info_type);
+			item->qxflags |= QX_FLAG_SLOW;
+		}
+	}
+
+	free(list);
+}
+
 /* Walk UPS variables and set elements of the qx2nut array. */
 static bool_t	qx_ups_walk(walkmode_t mode)
 {
 	item_t	*item;
 	int	retcode;
+	time_t	now = 0;
+	bool_t	slow_due = FALSE;
+	const char	*answer;
 
 	/* Clear batt.{chrg,runt}.act for guesstimation */
 	if (mode == QX_WALKMODE_FULL_UPDATE) {
@@ -4030,9 +4348,16 @@ static bool_t	qx_ups_walk(walkmode_t mode)
 		battery_voltage_reports_one_pack_considered = 0;
 	}
 
-	/* Clear data from previous_item */
-	memset(previous_item.command, 0, sizeof(previous_item.command));
-	memset(previous_item.answer, 0, sizeof(previous_item.answer));
+	/* Slow items are polled in this full update if they are due */
+	if (mode == QX_WALKMODE_FULL_UPDATE) {
+		time(&now);
+		slow_due = (now >= lastslowpoll + slowpollfreq);
+		if (slow_due)
+			upsdebugx(1, "%s: polling slow items as well", __func__);
+	}
+
+	/* Forget the answers of the previous walk */
+	walk_nanswers = 0;
 
 	/* 3 modes: QX_WALKMODE_INIT, QX_WALKMODE_QUICK_UPDATE
 	 *      and QX_WALKMODE_FULL_UPDATE */
@@ -4101,6 +4426,14 @@ static bool_t	qx_ups_walk(walkmode_t mode)
 				continue;
 			}
 
+			/* These are only polled every slowpollfreq */
+			if ((item->qxflags & QX_FLAG_SLOW)
+			&&  !(item->qxflags & QX_FLAG_QUICK_POLL)
+			&&  slow_due == FALSE
+			) {
+				continue;
+			}
+
 			break;
 
 #if (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_PUSH_POP) && ( (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_COVERED_SWITCH_DEFAULT) || (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_UNREACHABLE_CODE) )
@@ -4151,15 +4484,13 @@ static bool_t	qx_ups_walk(walkmode_t mode)
 
 		}
 
-		/* Check whether the previous item uses the same command
-		 * and then use its answer, if available.. */
-		if (strlen(previous_item.command) > 0
-		&&  strlen(previous_item.answer) > 0
-		&&  !strcasecmp(previous_item.command, item->command)
-		) {
+		/* Check whether an item already processed in this walk uses
+		 * the same command and then use its answer, if available.. */
+		answer = walk_answer_get(item->command);
+		if (answer) {
 
 			snprintf(item->answer, sizeof(item->answer), "%s",
-				previous_item.answer);
+				answer);
 
 			/* Process the answer */
 			retcode = qx_process_answer(item, strlen(item->answer));
@@ -4171,11 +4502,8 @@ static bool_t	qx_ups_walk(walkmode_t mode)
 
 		}
 
-		/* Record item as previous_item */
-		snprintf(previous_item.command, sizeof(previous_item.command), "%s",
-			item->command);
-		snprintf(previous_item.answer, sizeof(previous_item.answer), "%s",
-			item->answer);
+		/* Record the answer for the next items using the same command */
+		walk_answer_set(item->command, item->answer);
 
 		if (retcode) {
 
@@ -4367,10 +4695,101 @@ static void	ups_status_set(void)
 	}
 }
 
+static void	qx_free_map(void)
+{
+	free(qx_nut_map);
+	qx_nut_map = NULL;
+	qx_nut_map_size = 0;
+
+	free(qx_nut_next);
+	qx_nut_next = NULL;
+
+	qx_nut_table = NULL;
+}
+
+/* Make the index of the qx2nut table of the subdriver in use by NUT name:
+ * the items of a name are chained in table order, their flags (which may
+ * change at runtime) being checked at lookup time, so that find_nut_info()
+ * returns the same item as if it went through the table.
+ * If it can't be allocated, find_nut_info() does that. */
+static void	qx_build_map(void)
+{
+	item_t	*item;
+	size_t	count = 0, i;
+
+	qx_free_map();
+
+	for (item = subdriver->qx2nut; item->info_type != NULL; item++) {
+		count++;
+	}
+
+	for (qx_nut_map_size = 16; qx_nut_map_size < count * 2; qx_nut_map_size *= 2)
+		;
+	qx_nut_map = calloc(qx_nut_map_size, sizeof(*qx_nut_map));
+	qx_nut_next = calloc(count + 1, sizeof(*qx_nut_next));
+
+	if (!qx_nut_map || !qx_nut_next) {
+		upsdebugx(1, "%s: out of memory, lookups will walk the table", __func__);
+		qx_free_map();
+		return;
+	}
+
+	/* Backwards, so that each item gets in front of the chain of its name */
+	for (i = count; i-- > 0; ) {
+		size_t	slot;
+
+		item = &subdriver->qx2nut[i];
+
+		for (slot = str_hash_nocase(item->info_type) & (qx_nut_map_size - 1);
+			qx_nut_map[slot] != NULL;
+			slot = (slot + 1) & (qx_nut_map_size - 1)
+		) {
+			if (!strcasecmp(qx_nut_map[slot]->info_type, item->info_type))
+				break;
+		}
+
+		qx_nut_next[i] = qx_nut_map[slot];
+		qx_nut_map[slot] = item;
+	}
+
+	qx_nut_table = subdriver->qx2nut;
+
+	upsdebugx(2, "%s: %" PRIuSIZE " items indexed", __func__, count);
+}
+
 /* See header file for details. */
 item_t	*find_nut_info(const char *varname, const unsigned long flag, const unsigned long noflag)
 {
-	item_t	*item;
+	item_t	*item = NULL;
+
+	/* Subdrivers may also look up their items while being tried (claim()) */
+	if (qx_nut_map && qx_nut_table == subdriver->qx2nut) {
+		size_t	slot;
+
+		for (slot = str_hash_nocase(varname) & (qx_nut_map_size - 1);
+			qx_nut_map[slot] != NULL;
+			slot = (slot + 1) & (qx_nut_map_size - 1)
+		) {
+			if (!strcasecmp(qx_nut_map[slot]->info_type, varname)) {
+				item = qx_nut_map[slot];
+				break;
+			}
+		}
+
+		for (; item != NULL; item = qx_nut_next[item - subdriver->qx2nut]) {
+
+			if (flag && ((item->qxflags & flag) != flag))
+				continue;
+
+			if (noflag && (item->qxflags & noflag))
+				continue;
+
+			return item;
+		}
+
+		upsdebugx(2, "%s: info type %s not found", __func__, varname);
+		return NULL;
+	}
 
 	for (item = subdriver->qx2nut; item->info_type != NULL; item++) {
 
@@ -4501,10 +4920,32 @@ int	qx_process(item_t *item, const char *command)
 	return qx_process_answer(item, (size_t)len);
 }
 
+/* Fill batt.{chrg,runt}.act for guesstimation, from <value> as published
+ * (NULL to look it up) */
+static void	qx_batt_update(const char *info_type, const char *value)
+{
+	double	*act;
+
+	if (!strcasecmp(info_type, "battery.charge"))
+		act = &batt.chrg.act;
+	else if (!strcasecmp(info_type, "battery.runtime"))
+		act = &batt.runt.act;
+	else
+		return;
+
+	if (!value)
+		value = dstate_getinfo(info_type);
+
+	if (value)
+		*act = strtol(value, NULL, 10);
+}
+
 /* See header file for details. */
 int	ups_infoval_set(item_t *item)
 {
 	char	value[SMALLBUF] = "";
+	double	dvalue;
+	int	precision;
 
 	/* Item need to be preprocessed? */
 	if (item->preprocess != NULL){
@@ -4547,7 +4988,18 @@ int	ups_infoval_set(item_t *item)
 				return -1;
 			}
 
-			snprintf_dynamic(value, sizeof(value), item->dfl, "%f", strtod(value, NULL));
+			dvalue = strtod(value, NULL);
+
+			/* the usual "%.0f" and the like: skip formatting steady readings */
+			if ((precision = dstate_float_precision(item->dfl)) >= 0
+			 && !(item->qxflags & QX_FLAG_NONUT)
+			) {
+				dstate_setinfo_double(item->info_type, dvalue, precision, 0);
+				qx_batt_update(item->info_type, NULL);
+				return 1;
+			}
+
+			snprintf_dynamic(value, sizeof(value), item->dfl, "%f", dvalue);
 		}
 
 	}
@@ -4564,12 +5016,7 @@ int	ups_infoval_set(item_t *item)
 	}
 
 	dstate_setinfo(item->info_type, "%s", value);
-
-	/* Fill batt.{chrg,runt}.act for guesstimation */
-	if (!strcasecmp(item->info_type, "battery.charge"))
-		batt.chrg.act = strtol(value, NULL, 10);
-	else if (!strcasecmp(item->info_type, "battery.runtime"))
-		batt.runt.act = strtol(value, NULL, 10);
+	qx_batt_update(item->info_type, value);
 
 	return 1;
 }
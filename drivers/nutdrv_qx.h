@@ -46,11 +46,14 @@
 #define QX_VAR_ONDELAY	"ondelay"
 #define QX_VAR_OFFDELAY	"offdelay"
 #define QX_VAR_POLLFREQ	"pollfreq"
+#define QX_VAR_SLOWPOLLFREQ	"slowpollfreq"
+#define QX_VAR_SLOWCOMMANDS	"slowcommands"
 
 /* Parameters default values */
 #define DEFAULT_ONDELAY		"180"	/* Delay between return of utility power and powering up of load, in seconds */
 #define DEFAULT_OFFDELAY	"30"	/* Delay before power off, in seconds */
 #define DEFAULT_POLLFREQ	30	/* Polling interval between full updates, in seconds; the driver will do quick polls in the meantime */
+#define DEFAULT_SLOWPOLLFREQ	300	/* Polling interval of the QX_FLAG_SLOW items, in seconds; full updates in the meantime reuse their last values */
 
 #ifndef TRUE
 typedef enum { FALSE, TRUE } bool_t;
@@ -128,6 +131,8 @@ typedef struct item_t {
 #define QX_FLAG_RANGE		512UL	/* Ranges for this var available and are stored in info_rw. */
 #define QX_FLAG_NONUT		1024UL	/* This var doesn't have a corresponding var in NUT. */
 #define QX_FLAG_SKIP		2048UL	/* Skip this var: this item won't be processed. */
+#define QX_FLAG_SLOW		4096UL	/* Slowly changing data (e.g. ratings, battery tests results): in QX_WALKMODE_FULL_UPDATE, retrieve it only every slowpollfreq seconds.
+					 * Ignored for QX_FLAG_QUICK_POLL items. */
 
 #define MAXTRIES		3	/* Max number of retries */
 
@@ -21,6 +21,8 @@
 #include "timehead.h"
 #include "serial.h"
 #include "main.h"
+#include "iorec.h"
+#include "nut_probes.h"
 #include "attribute.h"
 
 #ifndef WIN32
@@ -41,6 +43,128 @@
 
 	static unsigned int	comm_failures = 0;
 
+/* what ser_get_char() and ser_get_line*() read ahead of what they hand
+ * out, kept for the next reads on that port instead of one read() per
+ * character; ports beyond SER_RBUF_PORTS just go without. nut-scanner,
+ * which probes many ports at once from as many threads, builds this with
+ * more of them and SER_RBUF_THREADS, for the buffers to be handed out to
+ * the ports under a lock (each one is then only used by its own port) */
+#define SER_RBUF_SIZE	256
+#ifndef SER_RBUF_PORTS
+# define SER_RBUF_PORTS	4
+#endif
+
+#if (defined SER_RBUF_THREADS) && (defined HAVE_PTHREAD)
+# include <pthread.h>
+static pthread_mutex_t	ser_rbuf_mutex = PTHREAD_MUTEX_INITIALIZER;
+# define SER_RBUF_LOCK()	pthread_mutex_lock(&ser_rbuf_mutex)
+# define SER_RBUF_UNLOCK()	pthread_mutex_unlock(&ser_rbuf_mutex)
+#else
+# define SER_RBUF_LOCK()
+# define SER_RBUF_UNLOCK()
+#endif
+
+typedef struct {
+	int	used;
+	TYPE_FD_SER	fd;
+	size_t	pos, len;
+	char	data[SER_RBUF_SIZE];
+} ser_rbuf_t;
+
+static ser_rbuf_t	ser_rbufs[SER_RBUF_PORTS];
+
+/* the read-ahead buffer of port <fd>, with a free one taken for it if
+ * <create> and it has none: NULL if there is none */
+static ser_rbuf_t *ser_rbuf_find(TYPE_FD_SER fd, int create)
+{
+	ser_rbuf_t	*rb = NULL;
+	size_t	i;
+
+	SER_RBUF_LOCK();
+
+	for (i = 0; i < SER_RBUF_PORTS && !rb; i++) {
+		if (ser_rbufs[i].used && ser_rbufs[i].fd == fd)
+			rb = &ser_rbufs[i];
+	}
+
+	for (i = 0; i < SER_RBUF_PORTS && create && !rb; i++) {
+		if (!ser_rbufs[i].used) {
+			memset(&ser_rbufs[i], 0, sizeof(ser_rbufs[i]));
+			ser_rbufs[i].used = 1;
+			ser_rbufs[i].fd = fd;
+			rb = &ser_rbufs[i];
+		}
+	}
+
+	SER_RBUF_UNLOCK();
+
+	return rb;
+}
+
+/* forget what was read ahead on port <fd> */
+static void ser_rbuf_drop(TYPE_FD_SER fd)
+{
+	ser_rbuf_t	*rb = ser_rbuf_find(fd, 0);
+
+	if (rb) {
+		SER_RBUF_LOCK();
+		rb->pos = rb->len = 0;
+		rb->used = 0;
+		SER_RBUF_UNLOCK();
+	}
+}
+
+static ssize_t ser_read(TYPE_FD_SER fd, void *buf, size_t buflen,
+	time_t d_sec, suseconds_t d_usec);
+
+/* make sure there's something left in <rb>, reading whatever the port has
+ * (waiting for it as long as a read of a single char would); returns the
+ * count of bytes left, or the result of the read which failed */
+static ssize_t ser_rbuf_fill(TYPE_FD_SER fd, ser_rbuf_t *rb,
+	time_t d_sec, suseconds_t d_usec)
+{
+	ssize_t	ret;
+
+	if (rb->pos < rb->len)
+		return (ssize_t)(rb->len - rb->pos);
+
+	rb->pos = rb->len = 0;
+
+	ret = ser_read(fd, rb->data, sizeof(rb->data), d_sec, d_usec);
+	if (ret > 0)
+		rb->len = (size_t)ret;
+
+	return ret;
+}
+
+/* what's left from the read-ahead of port <fd> first, if anything,
+ * otherwise a plain read */
+static ssize_t ser_read_rbuf(TYPE_FD_SER fd, void *buf, size_t buflen,
+	time_t d_sec, suseconds_t d_usec)
+{
+	ser_rbuf_t	*rb = ser_rbuf_find(fd, 0);
+	size_t	n;
+
+	if (!rb || rb->pos >= rb->len)
+		return ser_read(fd, buf, buflen, d_sec, d_usec);
+
+	n = rb->len - rb->pos;
+	if (n > buflen)
+		n = buflen;
+
+	memcpy(buf, rb->data + rb->pos, n);
+	rb->pos += n;
+
+	return (ssize_t)n;
+}
+
+#ifndef WIN32
+/* replaying recorded I/O: the "port" is a pseudo-terminal (which drivers
+ * may set up with termios calls of their own) that nobody writes to, so
+ * that a select() on it just times out; this is its controlling side */
+static int	replay_wfd = -1;
+#endif	/* !WIN32 */
+
 static void ser_open_error(const char *port)
 	__attribute__((noreturn));
 
@@ -149,6 +273,28 @@ TYPE_FD_SER ser_open_nf(const char *port)
 {
 	TYPE_FD_SER	fd;
 
+#ifndef WIN32
+	if (iorec_mode == IOREC_REPLAY) {
+		const char	*pts;
+
+		replay_wfd = posix_openpt(O_RDWR | O_NOCTTY);
+		if (replay_wfd < 0 || grantpt(replay_wfd) || unlockpt(replay_wfd)
+		 || (pts = ptsname(replay_wfd)) == NULL
+		 || (fd = open(pts, O_RDWR | O_NOCTTY | O_NONBLOCK)) < 0
+		) {
+			if (replay_wfd >= 0) {
+				close(replay_wfd);
+				replay_wfd = -1;
+			}
+			return ERROR_FD_SER;
+		}
+
+		upsdebugx(1, "%s: replaying the recorded I/O of %s", __func__, port);
+		ser_rbuf_drop(fd);
+		return fd;
+	}
+#endif	/* !WIN32 */
+
 	fd = open(port, O_RDWR | O_NOCTTY | O_EXCL | O_NONBLOCK);
 
 	if (INVALID_FD_SER(fd)) {
@@ -156,6 +302,7 @@ TYPE_FD_SER ser_open_nf(const char *port)
 	}
 
 	lock_set(fd, port);
+	ser_rbuf_drop(fd);
 
 	return fd;
 }
@@ -177,6 +324,10 @@ int ser_set_speed_nf(TYPE_FD_SER fd, const char *port, speed_t speed)
 	struct	termios	tio;
 	NUT_UNUSED_VARIABLE(port);
 
+	if (iorec_mode == IOREC_REPLAY) {
+		return 0;
+	}
+
 	if (tcgetattr(fd, &tio) != 0) {
 		return -1;
 	}
@@ -216,6 +367,10 @@ int ser_set_speed(TYPE_FD_SER fd, const char *port, speed_t speed)
 #ifndef WIN32
 static int ser_set_control(TYPE_FD_SER fd, int line, int state)
 {
+	if (iorec_mode == IOREC_REPLAY) {
+		return 0;
+	}
+
 	if (state) {
 		return ioctl(fd, TIOCMBIS, &line);
 	} else {
@@ -272,9 +427,20 @@ int ser_set_rts(TYPE_FD_SER fd, int state)
 static int ser_get_control(TYPE_FD_SER fd, int line)
 {
 	int	flags;
+	char	key[SMALLBUF];
+
+	snprintf(key, sizeof(key), "0x%x", (unsigned int)line);
+
+	if (iorec_mode == IOREC_REPLAY) {
+		long	ret = 0;
+
+		iorec_replay("ser", "control", key, &ret, NULL, NULL);
+		return (int)ret;
+	}
 
 	ioctl(fd, TIOCMGET, &flags);
 
+	iorec_record("ser", "control", key, (long)(flags & line), NULL, 0);
 	return (flags & line);
 }
 #endif	/* !WIN32 */
@@ -325,6 +491,19 @@ int ser_close(TYPE_FD_SER fd, const char *port)
 #endif	/* WIN32 */
 	}
 
+	ser_xact_cancel(fd);
+	ser_rbuf_drop(fd);
+
+#ifndef WIN32
+	if (iorec_mode == IOREC_REPLAY) {
+		if (replay_wfd >= 0) {
+			close(replay_wfd);
+			replay_wfd = -1;
+		}
+		return close(fd) ? -1 : 0;
+	}
+#endif	/* !WIN32 */
+
 	if (close(fd) != 0)
 		return -1;
 
@@ -336,6 +515,38 @@ int ser_close(TYPE_FD_SER fd, const char *port)
 	return 0;
 }
 
+/* select_read(), timed for the driver.stats.io.* variables, and recorded
+ * or replayed (timeouts and errors too) if so asked */
+static ssize_t ser_read(TYPE_FD_SER fd, void *buf, size_t buflen,
+	time_t d_sec, suseconds_t d_usec)
+{
+	uint64_t	start;
+	ssize_t	ret;
+
+	if (iorec_mode == IOREC_REPLAY) {
+		long	res = 0;
+		size_t	len = buflen;
+
+		if (!iorec_replay("ser", "read", NULL, &res, buf, &len)) {
+			return 0;
+		}
+		if (res < 0) {
+			errno = EIO;
+			return -1;
+		}
+		return (ssize_t)len;
+	}
+
+	NUT_PROBE2(serial_transfer, "read", buflen);
+	start = drv_stats_now_usec();
+	ret = select_read(fd, buf, buflen, d_sec, d_usec);
+	drv_stats_io(start);
+	NUT_PROBE3(serial_transfer_done, "read", buflen, ret);
+
+	iorec_record("ser", "read", NULL, (long)ret, buf, ret > 0 ? (size_t)ret : 0);
+	return ret;
+}
+
 ssize_t ser_send_char(TYPE_FD_SER fd, unsigned char ch)
 {
 	return ser_send_buf_pace(fd, 0, &ch, 1);
@@ -449,19 +660,35 @@ ssize_t ser_send_buf_pace(TYPE_FD_SER fd, useconds_t d_usec, const void *buf,
 	ssize_t	ret = 0;
 	ssize_t	sent;
 	const char	*data = buf;
+	uint64_t	start;
 
 	assert(buflen < SSIZE_MAX);
+
+	/* what the driver sends is not compared, only the pace is kept */
+	if (iorec_mode == IOREC_REPLAY) {
+		iorec_replay("ser", "write", NULL, NULL, NULL, NULL);
+		return (ssize_t)buflen;
+	}
+
+	NUT_PROBE2(serial_transfer, "write", buflen);
+	start = drv_stats_now_usec();
 	for (sent = 0; sent < (ssize_t)buflen; sent += ret) {
 		/* Conditions above ensure that (buflen - sent) > 0 below */
 		ret = write(fd, &data[sent], (d_usec == 0) ? (size_t)((ssize_t)buflen - sent) : 1);
 
 		if (ret < 1) {
+			drv_stats_io(start);
+			NUT_PROBE3(serial_transfer_done, "write", buflen, ret);
+			iorec_record("ser", "write", NULL, (long)ret, buf, (size_t)sent);
 			return ret;
 		}
 
 		usleep(d_usec);
 	}
 
+	drv_stats_io(start);
+	NUT_PROBE3(serial_transfer_done, "write", buflen, sent);
+	iorec_record("ser", "write", NULL, (long)sent, buf, buflen);
 	return sent;
 }
 
@@ -471,14 +698,25 @@ ssize_t ser_get_char(TYPE_FD_SER fd, void *ch, time_t d_sec, useconds_t d_usec)
 	 * effectively the same (and signed -1 for suseconds_t), and at most long:
 	 * https://pubs.opengroup.org/onlinepubs/009604599/basedefs/sys/types.h.html
 	 */
-	return select_read(fd, ch, 1, d_sec, (suseconds_t)d_usec);
+	ser_rbuf_t	*rb = ser_rbuf_find(fd, 1);
+	ssize_t	ret;
+
+	if (!rb)
+		return ser_read(fd, ch, 1, d_sec, (suseconds_t)d_usec);
+
+	ret = ser_rbuf_fill(fd, rb, d_sec, (suseconds_t)d_usec);
+	if (ret < 1)
+		return ret;
+
+	*(char *)ch = rb->data[rb->pos++];
+	return 1;
 }
 
 ssize_t ser_get_buf(TYPE_FD_SER fd, void *buf, size_t buflen, time_t d_sec, useconds_t d_usec)
 {
 	memset(buf, '\0', buflen);
 
-	return select_read(fd, buf, buflen, d_sec, (suseconds_t)d_usec);
+	return ser_read_rbuf(fd, buf, buflen, d_sec, (suseconds_t)d_usec);
 }
 
 /* keep reading until buflen bytes are received or a timeout occurs */
@@ -493,7 +731,7 @@ ssize_t ser_get_buf_len(TYPE_FD_SER fd, void *buf, size_t buflen, time_t d_sec,
 
 	for (recv = 0; recv < (ssize_t)buflen; recv += ret) {
 
-		ret = select_read(fd, &data[recv],
+		ret = ser_read_rbuf(fd, &data[recv],
 			(size_t)((ssize_t)buflen - recv),
 			d_sec, (suseconds_t)d_usec);
 
@@ -505,46 +743,58 @@ ssize_t ser_get_buf_len(TYPE_FD_SER fd, void *buf, size_t buflen, time_t d_sec,
 	return recv;
 }
 
-/* reads a line up to <endchar>, discarding anything else that may follow,
-   with callouts to the handler if anything matches the alertset */
+/* reads a line up to <endchar>, keeping anything that may follow for the
+   next reads, with callouts to the handler if anything matches the alertset */
 ssize_t ser_get_line_alert(TYPE_FD_SER fd, void *buf, size_t buflen, char endchar,
 	const char *ignset, const char *alertset, void handler(char ch),
 	time_t d_sec, useconds_t d_usec)
 {
-	ssize_t	i, ret;
-	char	tmp[64];
-	char	*data = buf;
+	ssize_t	ret;
+	char	*data = buf, ch;
 	ssize_t	count = 0, maxcount;
+	ser_rbuf_t	tmp, *rb = ser_rbuf_find(fd, 1);
 
 	assert(buflen < SSIZE_MAX && buflen > 0);
 	memset(buf, '\0', buflen);
 
+	/* no buffer left for this port: what follows the line is lost */
+	if (!rb) {
+		rb = &tmp;
+		rb->pos = rb->len = 0;
+	}
+
 	maxcount = (ssize_t)buflen - 1;		/* for trailing \0 */
 
 	while (count < maxcount) {
-		ret = select_read(fd, tmp, sizeof(tmp), d_sec, (suseconds_t)d_usec);
+		ret = ser_rbuf_fill(fd, rb, d_sec, (suseconds_t)d_usec);
 
 		if (ret < 1) {
 			return ret;
 		}
 
-		for (i = 0; i < ret; i++) {
+		while (rb->pos < rb->len) {
+
+			if (count == maxcount) {
+				return count;
+			}
+
+			ch = rb->data[rb->pos++];
 
-			if ((count == maxcount) || (tmp[i] == endchar)) {
+			if (ch == endchar) {
 				return count;
 			}
 
-			if (strchr(ignset, tmp[i]))
+			if (strchr(ignset, ch))
 				continue;
 
-			if (strchr(alertset, tmp[i])) {
+			if (strchr(alertset, ch)) {
 				if (handler)
-					handler(tmp[i]);
+					handler(ch);
 
 				continue;
 			}
 
-			data[count++] = tmp[i];
+			data[count++] = ch;
 		}
 	}
 
@@ -585,9 +835,231 @@ ssize_t ser_flush_in(TYPE_FD_SER fd, const char *ignset, int verbose)
 
 int ser_flush_io(TYPE_FD_SER fd)
 {
+	ser_rbuf_drop(fd);
+
+	if (iorec_mode == IOREC_REPLAY) {
+		return 0;
+	}
+
 	return tcflush(fd, TCIOFLUSH);
 }
 
+/* the pending transactions of ser_xact_start(), one per port at most */
+typedef struct {
+	int	used;
+	TYPE_FD_SER	fd;
+	int	endchar;
+	char	*ignset;
+	char	*buf;
+	size_t	len, maxlen;
+	time_t	d_sec;
+	useconds_t	d_usec;
+	struct timeval	deadline;
+	ser_xact_done_t	done;
+	void	*arg;
+} ser_xact_t;
+
+static ser_xact_t	ser_xacts[SER_RBUF_PORTS];
+
+static void ser_xact_deadline(ser_xact_t *x, const struct timeval *now)
+{
+	x->deadline = *now;
+	x->deadline.tv_sec += x->d_sec + (time_t)(x->d_usec / 1000000);
+	x->deadline.tv_usec += (suseconds_t)(x->d_usec % 1000000);
+	if (x->deadline.tv_usec >= 1000000) {
+		x->deadline.tv_sec++;
+		x->deadline.tv_usec -= 1000000;
+	}
+}
+
+/* take <x> off the list, then tell its owner about <ret> (which may start
+ * another transaction on the port) */
+static void ser_xact_finish(ser_xact_t *x, ssize_t ret)
+{
+	ser_xact_t	last = *x;
+
+	x->used = 0;
+	x->ignset = x->buf = NULL;
+
+#ifndef WIN32
+	dstate_unwatch_fd(last.fd);
+#endif	/* !WIN32 */
+
+	if (last.done)
+		last.done(last.fd, ret, last.buf, ret > 0 ? last.len : 0, last.arg);
+
+	free(last.ignset);
+	free(last.buf);
+}
+
+/* what came in for <x> so far: returns 1 if it's over */
+static int ser_xact_feed(ser_xact_t *x, const struct timeval *now)
+{
+	ser_rbuf_t	*rb = ser_rbuf_find(x->fd, 1);
+	ssize_t	ret;
+	int	got = 0;
+	char	ch;
+
+	if (!rb) {
+		/* could not happen: the port got one in ser_xact_start() */
+		ser_xact_finish(x, -1);
+		return 1;
+	}
+
+	while ((ret = ser_rbuf_fill(x->fd, rb, 0, 0)) > 0) {
+		got = 1;
+
+		while (rb->pos < rb->len) {
+			ch = rb->data[rb->pos++];
+
+			if (x->endchar >= 0 && ch == (char)x->endchar) {
+				ser_xact_finish(x, (ssize_t)x->len);
+				return 1;
+			}
+
+			if (x->endchar >= 0 && strchr(x->ignset, ch))
+				continue;
+
+			x->buf[x->len++] = ch;
+
+			if (x->len == x->maxlen) {
+				ser_xact_finish(x, (ssize_t)x->len);
+				return 1;
+			}
+		}
+	}
+
+	if (ret < 0) {
+		ser_xact_finish(x, -1);
+		return 1;
+	}
+
+	/* the timeout counts from the last char in */
+	if (got) {
+		ser_xact_deadline(x, now);
+	} else if (!timercmp(now, &x->deadline, <)) {
+		ser_xact_finish(x, 0);
+		return 1;
+	}
+
+	return 0;
+}
+
+static void ser_xact_wake(struct timeval *wake)
+{
+	size_t	i;
+
+	for (i = 0; i < SER_RBUF_PORTS; i++) {
+		if (ser_xacts[i].used && timercmp(&ser_xacts[i].deadline, wake, <))
+			*wake = ser_xacts[i].deadline;
+	}
+}
+
+static int ser_xact_run(const struct timeval *now)
+{
+	size_t	i;
+	int	ran = 0;
+
+	for (i = 0; i < SER_RBUF_PORTS; i++) {
+		if (ser_xacts[i].used && ser_xact_feed(&ser_xacts[i], now))
+			ran++;
+	}
+
+	return ran;
+}
+
+int ser_xact_start(TYPE_FD_SER fd, const void *req, size_t reqlen,
+	int endchar, const char *ignset, size_t maxlen,
+	time_t d_sec, useconds_t d_usec, ser_xact_done_t done, void *arg)
+{
+	ser_xact_t	*x = NULL;
+	struct timeval	now;
+	size_t	i;
+
+	if (INVALID_FD_SER(fd) || !maxlen || ser_xact_pending(fd)) {
+		return -1;
+	}
+
+	for (i = 0; i < SER_RBUF_PORTS && !x; i++) {
+		if (!ser_xacts[i].used)
+			x = &ser_xacts[i];
+	}
+
+	/* the answer is collected in the read-ahead buffer of the port */
+	if (!x || !ser_rbuf_find(fd, 1)) {
+		upsdebugx(1, "%s: too many ports with transactions", __func__);
+		return -1;
+	}
+
+	if (reqlen && ser_send_buf(fd, req, reqlen) != (ssize_t)reqlen) {
+		return -1;
+	}
+
+	memset(x, 0, sizeof(*x));
+	x->fd = fd;
+	x->endchar = endchar;
+	x->ignset = xstrdup(ignset ? ignset : "");
+	x->buf = xcalloc(maxlen + 1, 1);
+	x->maxlen = maxlen;
+	x->d_sec = d_sec;
+	x->d_usec = d_usec;
+	x->done = done;
+	x->arg = arg;
+
+#ifdef WIN32
+	/* no waiting on the port in the main loop there: just do it now */
+	{
+		ssize_t	ret;
+
+		if (endchar >= 0) {
+			ret = ser_get_line(fd, x->buf, maxlen + 1, (char)endchar,
+				x->ignset, d_sec, d_usec);
+		} else {
+			ret = ser_get_buf_len(fd, x->buf, maxlen, d_sec, d_usec);
+		}
+		x->used = 1;
+		x->len = ret > 0 ? (size_t)ret : 0;
+		ser_xact_finish(x, ret);
+	}
+#else	/* !WIN32 */
+	x->used = 1;
+	drv_gettime(&now);
+	ser_xact_deadline(x, &now);
+
+	dstate_watch_fd(fd, DSTATE_WATCH_READ);
+	drv_waiter_set(ser_xact_wake, ser_xact_run);
+
+	/* the answer may well be there already */
+	ser_xact_feed(x, &now);
+#endif	/* !WIN32 */
+
+	return 0;
+}
+
+int ser_xact_pending(TYPE_FD_SER fd)
+{
+	size_t	i;
+
+	for (i = 0; i < SER_RBUF_PORTS; i++) {
+		if (ser_xacts[i].used && ser_xacts[i].fd == fd)
+			return 1;
+	}
+
+	return 0;
+}
+
+void ser_xact_cancel(TYPE_FD_SER fd)
+{
+	size_t	i;
+
+	for (i = 0; i < SER_RBUF_PORTS; i++) {
+		if (ser_xacts[i].used && ser_xacts[i].fd == fd) {
+			ser_xacts[i].done = NULL;
+			ser_xact_finish(&ser_xacts[i], 0);
+		}
+	}
+}
+
 void ser_comm_fail(const char *fmt, ...)
 {
 	int	ret;
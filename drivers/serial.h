@@ -78,6 +78,10 @@ ssize_t ser_send_buf(TYPE_FD_SER fd, const void *buf, size_t buflen);
 ssize_t ser_send_buf_pace(TYPE_FD_SER fd, useconds_t d_usec, const void *buf,
 	size_t buflen);
 
+/* ser_get_char(), ser_get_line*() read whatever is available and hand out
+ * the rest on the next calls of these and ser_get_buf*() for that port,
+ * until ser_flush_in/io() or ser_close(): drivers which read characters
+ * without them must not mix both */
 ssize_t ser_get_char(TYPE_FD_SER fd, void *ch, time_t d_sec, useconds_t d_usec);
 
 ssize_t ser_get_buf(TYPE_FD_SER fd, void *buf, size_t buflen, time_t d_sec, useconds_t d_usec);
@@ -85,8 +89,8 @@ ssize_t ser_get_buf(TYPE_FD_SER fd, void *buf, size_t buflen, time_t d_sec, usec
 /* keep reading until buflen bytes are received or a timeout occurs */
 ssize_t ser_get_buf_len(TYPE_FD_SER fd, void *buf, size_t buflen, time_t d_sec, useconds_t d_usec);
 
-/* reads a line up to <endchar>, discarding anything else that may follow,
-   with callouts to the handler if anything matches the alertset */
+/* reads a line up to <endchar>, keeping anything that may follow for the
+   next reads, with callouts to the handler if anything matches the alertset */
 ssize_t ser_get_line_alert(TYPE_FD_SER fd, void *buf, size_t buflen, char endchar,
 	const char *ignset, const char *alertset, void handler (char ch),
 	time_t d_sec, useconds_t d_usec);
@@ -98,6 +102,35 @@ ssize_t ser_get_line(TYPE_FD_SER fd, void *buf, size_t buflen, char endchar,
 ssize_t ser_flush_in(TYPE_FD_SER fd, const char *ignset, int verbose);
 int ser_flush_io(TYPE_FD_SER fd);
 
+/* Non-blocking transactions: send <reqlen> bytes of <req> (nothing if 0)
+ * and have the answer collected by the main loop as it comes in, while
+ * the driver keeps serving its clients; <done> is then called with the
+ * port, the length of the answer (0 on timeout, -1 on error) and the
+ * answer itself (NUL-terminated), and may start the next transaction.
+ * The answer is a line up to <endchar> (not included), without the chars
+ * in <ignset>, of <maxlen> chars at most, or if <endchar> is
+ * SER_XACT_NOEND, exactly <maxlen> bytes; the port is given <d_sec> and
+ * <d_usec> for each char, as for ser_get_line(). Several ports can each
+ * have one transaction pending.
+ * Returns 0 if the request was sent, -1 if it could not be or the port
+ * has a transaction pending already.
+ */
+#define SER_XACT_NOEND	(-1)
+
+typedef void (*ser_xact_done_t)(TYPE_FD_SER fd, ssize_t ret,
+	const char *buf, size_t len, void *arg);
+
+int ser_xact_start(TYPE_FD_SER fd, const void *req, size_t reqlen,
+	int endchar, const char *ignset, size_t maxlen,
+	time_t d_sec, useconds_t d_usec, ser_xact_done_t done, void *arg);
+
+/* whether a transaction is pending on the port */
+int ser_xact_pending(TYPE_FD_SER fd);
+
+/* drop the pending transaction of the port, if any, without calling its
+ * <done> (ser_close() does it too) */
+void ser_xact_cancel(TYPE_FD_SER fd);
+
 /* unified failure reporting: call these often */
 void ser_comm_fail(const char *fmt, ...)
 	__attribute__ ((__format__ (__printf__, 1, 2)));
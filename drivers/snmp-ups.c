@@ -37,6 +37,9 @@
 #include "nut_float.h"
 #include "nut_stdint.h"
 #include "snmp-ups.h"
+#include "iorec.h"
+#include "nut_probes.h"
+#include "lkp_index.h"
 #include "parseconf.h"
 
 #include <ctype.h> /* for isprint() */
@@ -146,6 +149,10 @@ int g_pwr_battery;
 int pollfreq; /* polling frequency */
 int semistaticfreq; /* semistatic entry update frequency */
 static int semistatic_countdown = 0;
+int normalfreq; /* normal entry update frequency */
+static int normal_countdown = 0;
+static int snmp_batch = DEFAULT_SNMP_BATCH; /* most varbinds per request */
+static int snmp_window = DEFAULT_SNMP_WINDOW; /* most batches in flight */
 
 static int quirk_symmetra_threephase = 0;
 
@@ -177,7 +184,7 @@ static const char *mibname;
 static const char *mibvers;
 
 #define DRIVER_NAME	"Generic SNMP UPS driver"
-#define DRIVER_VERSION	"1.35"
+#define DRIVER_VERSION	"1.46"
 
 /* driver description structure */
 upsdrv_info_t	upsdrv_info = {
@@ -197,6 +204,19 @@ upsdrv_info_t	upsdrv_info = {
 
 static time_t lastpoll = 0;
 
+/* The traps (and informs) received from the device: they make the next
+ * update re-read the status and alarms, and the entries whose OIDs they
+ * carry, without waiting for pollfreq */
+static struct {
+	netsnmp_session	*sess;	/* listening, NULL if not */
+	int	sock;
+	int	pending;	/* a trap came since the last walk */
+	int	walking;	/* the walk going on is for a trap */
+	int	all;		/* it named more entries than hits[] holds */
+	const snmp_info_t	*hits[SU_TRAP_MAXHITS];
+	size_t	nhits;
+} su_trap = { NULL, -1, 0, 0, 0, { NULL }, 0 };
+
 /* Communication status handling */
 #define COMM_UNKNOWN 0
 #define COMM_OK      1
@@ -216,8 +236,28 @@ static int device_template_offset = -1;
 /* sysOID location */
 #define SYSOID_OID	".1.3.6.1.2.1.1.2.0"
 
+/* What to do with a variable which an OID gave: FALSE if it is not usable */
+typedef bool_t (*su_var_fn_t)(const struct variable_list *var, void *arg);
+
 /* Forward functions declarations */
 static void disable_transfer_oids(void);
+static void su_batch_begin(int mode);
+static void su_batch_end(void);
+static void su_batch_free(void);
+static void su_info_index_free(void);
+static bool_t snmp_ups_walk_devices(int mode);
+static void su_poll_class_init(void);
+static void su_topo_load(void);
+static void su_topo_save(void);
+static void su_topo_free(void);
+static mib2nut_info_t *su_topo_mib(void);
+static void sysoid_index_free(void);
+static bool_t su_poll_due(const snmp_info_t *su_info_p);
+static bool_t nut_snmp_get_var(const char *OID, su_var_fn_t fn, void *arg);
+static void su_trap_open(void);
+static void su_trap_read(void);
+static void su_trap_done(void);
+static void su_trap_close(void);
 bool_t get_and_process_data(int mode, snmp_info_t *su_info_p);
 int extract_template_number(snmp_info_flags_t template_type, const char* varname);
 snmp_info_flags_t get_template_type(const char* varname);
@@ -267,7 +307,7 @@ void upsdrv_initinfo(void)
 			su_addcmd(su_info_p);
 
 /*
-			if (nut_snmp_get(su_info_p->OID) != NULL) {
+			if (nut_snmp_get_var(su_info_p->OID, NULL, NULL) == TRUE) {
 				dstate_addcmd(su_info_p->info_type);
 				upsdebugx(1, "upsdrv_initinfo(): adding command '%s'", su_info_p->info_type);
 			}
@@ -287,6 +327,7 @@ void upsdrv_initinfo(void)
 	if (snmp_ups_walk(SU_WALKMODE_INIT) == TRUE) {
 		dstate_dataok();
 		comm_status = COMM_OK;
+		su_topo_save();
 	}
 	else {
 		dstate_datastale();
@@ -296,15 +337,22 @@ void upsdrv_initinfo(void)
 	/* setup handlers for instcmd and setvar functions */
 	upsh.setvar = su_setvar;
 	upsh.instcmd = su_instcmd;
+	upsh.setvar_batch = su_setvar_batch;
+	upsh.instcmd_batch = su_instcmd_batch;
 }
 
 void upsdrv_updateinfo(void)
 {
 	upsdebugx(1,"SNMP UPS driver: entering %s()", __func__);
 
+	/* what the device told in the meantime */
+	su_trap_read();
+
 	/* only update every pollfreq */
 	/* FIXME: only update status (SU_STATUS_*), à la usbhid-ups, in between */
 	if (time(NULL) > (lastpoll + pollfreq)) {
+		/* traps coming during the walk are for the next one */
+		su_trap.pending = 0;
 
 		alarm_init();
 		status_init();
@@ -332,6 +380,34 @@ void upsdrv_updateinfo(void)
 
 		/* store timestamp */
 		lastpoll = time(NULL);
+		su_trap_done();
+	}
+	else if (su_trap.pending) {
+		/* a trap came: re-read the status and what it named, not the rest */
+		upsdebugx(1, "%s: reading the status after a trap", __func__);
+		su_trap.pending = 0;
+
+		alarm_init();
+		status_init();
+
+		su_trap.walking = 1;
+		if (snmp_ups_walk(SU_WALKMODE_UPDATE)) {
+			dstate_dataok();
+			comm_status = COMM_OK;
+		}
+		else {
+			dstate_datastale();
+			comm_status = COMM_LOST;
+		}
+		su_trap.walking = 0;
+
+		if (daisychain_enabled == FALSE)
+			alarm_commit();
+		status_commit();
+		if (daisychain_enabled == TRUE)
+			alarm_commit();
+
+		su_trap_done();
 	}
 	else {
 		/* Just tell the same status to upsd */
@@ -405,10 +481,24 @@ void upsdrv_makevartable(void)
 		"Set polling frequency in seconds, to reduce network flow (default=30)");
 	addvar(VAR_VALUE, SU_VAR_SEMISTATICFREQ,
 		"Set semistatic value update frequency in update cycles, to reduce network flow (default=10)");
+	addvar(VAR_VALUE, SU_VAR_NORMALFREQ,
+		"Set the update frequency of the values which are neither status nor semistatic, in update cycles (default=1)");
+	addvar(VAR_VALUE, SU_VAR_POLLCLASS,
+		"Set how often some values are updated: comma-separated name=fast|normal|slow|demand, the names may have '*'");
 	addvar(VAR_VALUE, SU_VAR_RETRIES,
 		"Specifies the number of Net-SNMP retries to be used in the requests (default=5)");
 	addvar(VAR_VALUE, SU_VAR_TIMEOUT,
 		"Specifies the Net-SNMP timeout in seconds between retries (default=1)");
+	addvar(VAR_VALUE, SU_VAR_BATCH,
+		"Set the most variables asked for in one request, 1 to ask for each on its own (default=16)");
+	addvar(VAR_VALUE, SU_VAR_WINDOW,
+		"Set the most batched requests sent before their answers came, 1 to wait for each (default=4)");
+	addvar(VAR_VALUE, SU_VAR_TRAPLISTEN,
+		"Listen for the traps and informs of the device on this transport (e.g. udp:10162), to re-read its status at once");
+	addvar(VAR_VALUE | VAR_SENSITIVE, SU_VAR_TRAPCOMMUNITY,
+		"Set the community the traps must come with (default=the community)");
+	addvar(VAR_FLAG, SU_VAR_DISCOVERYCACHE,
+		"Keep what the startup discovered of the device in a file of the state path, for faster restarts");
 	addvar(VAR_FLAG, "notransferoids",
 		"Disable transfer OIDs (use on APCC Symmetras)");
 	addvar(VAR_FLAG, "symmetrathreephase",
@@ -421,6 +511,10 @@ void upsdrv_makevartable(void)
 		"Set the authentication pass phrase used for authenticated SNMPv3 messages (no default)");
 	addvar(VAR_VALUE | VAR_SENSITIVE, SU_VAR_PRIVPASSWD,
 		"Set the privacy pass phrase used for encrypted SNMPv3 messages (no default)");
+	addvar(VAR_VALUE | VAR_SENSITIVE, SU_VAR_AUTHKEY,
+		"Set the authentication master key (Ku) in hexadecimal, instead of the pass phrase, for faster starts (no default)");
+	addvar(VAR_VALUE | VAR_SENSITIVE, SU_VAR_PRIVKEY,
+		"Set the privacy master key (Ku) in hexadecimal, instead of the pass phrase, for faster starts (no default)");
 
 	/* Construct addvar() for SU_VAR_AUTHPROT: */
 	{ int comma = 0;
@@ -625,6 +719,9 @@ void upsdrv_initups(void)
 	/* init SNMP library, etc... */
 	nut_snmp_init(progname, device_path);
 
+	/* what the last start found out, if it is the same device */
+	su_topo_load();
+
 	/* FIXME: first test if the device is reachable to avoid timeouts! */
 
 	/* FIXME: with the argument called "mibs" (plural) it could make
@@ -654,6 +751,17 @@ void upsdrv_initups(void)
 	}
 	semistatic_countdown = semistaticfreq;
 
+	/* init normal update frequency */
+	if (getval(SU_VAR_NORMALFREQ))
+		normalfreq = atoi(getval(SU_VAR_NORMALFREQ));
+	else
+		normalfreq = DEFAULT_NORMALFREQ;
+	if (normalfreq < 1) {
+		upsdebugx(1, "Bad %s value provided, setting to default", SU_VAR_NORMALFREQ);
+		normalfreq = DEFAULT_NORMALFREQ;
+	}
+	normal_countdown = 0;
+
 	/* Get UPS Model node to see if there's a MIB */
 /* FIXME: extend and use match_model_OID(char *model) */
 	su_info_p = su_find_info("ups.model");
@@ -778,6 +886,9 @@ void upsdrv_initups(void)
 
 	/* set shutdown and autostart delay */
 	set_delays();
+
+	/* the device may tell of its changes as they come */
+	su_trap_open();
 }
 
 void upsdrv_cleanup(void)
@@ -785,6 +896,12 @@ void upsdrv_cleanup(void)
 	/* General cleanup */
 	if (daisychain_info)
 		free(daisychain_info);
+	lkp_index_free();
+	su_info_index_free();
+	su_batch_free();
+	su_topo_free();
+	sysoid_index_free();
+	su_trap_close();
 
 	/* Net-SNMP specific cleanup */
 	nut_snmp_cleanup();
@@ -794,11 +911,39 @@ void upsdrv_cleanup(void)
  * SNMP functions.
  * ----------------------------------------------------------- */
 
+/* the bytes of key <hex> (with or without "0x"), returns their count or 0
+ * if it is not an even count of hexadecimal digits which fits */
+static size_t su_parse_key(const char *hex, u_char *key, size_t keysize)
+{
+	size_t	i, len;
+
+	if (hex[0] == '0' && (hex[1] == 'x' || hex[1] == 'X'))
+		hex += 2;
+
+	len = strlen(hex);
+	if (len == 0 || len % 2 || len / 2 > keysize)
+		return 0;
+
+	for (i = 0; i < len / 2; i++) {
+		unsigned int	byte;
+
+		if (!isxdigit((unsigned char)hex[2 * i]) || !isxdigit((unsigned char)hex[2 * i + 1])
+		 || sscanf(hex + 2 * i, "%2x", &byte) != 1
+		) {
+			return 0;
+		}
+		key[i] = (u_char)byte;
+	}
+
+	return len / 2;
+}
+
 void nut_snmp_init(const char *type, const char *hostname)
 {
 	char *ns_options = NULL;
 	const char *community, *version;
 	const char *secLevel = NULL, *authPassword, *privPassword;
+	const char *authKey, *privKey;
 	const char *authProtocol, *privProtocol;
 	int snmp_retries = DEFAULT_NETSNMP_RETRIES;
 	long snmp_timeout = DEFAULT_NETSNMP_TIMEOUT;
@@ -812,6 +957,14 @@ void nut_snmp_init(const char *type, const char *hostname)
 		upsdebugx(2, "Failed to enable numeric OIDs resolution");
 	}
 
+	/* The mapping tables only use numeric OIDs, so nothing needs the textual
+	 * MIBs which the library would parse and keep (megabytes of them, in
+	 * each of the driver processes) unless asked for explicitly */
+	if (getenv("MIBS") == NULL) {
+		upsdebugx(2, "Not loading the textual MIBs (MIBS is not set)");
+		setenv("MIBS", "", 1);
+	}
+
 	/* Initialize the SNMP library */
 	init_snmp(type);
 
@@ -834,6 +987,24 @@ void nut_snmp_init(const char *type, const char *hostname)
 	g_snmp_sess.timeout = snmp_timeout * ONE_SEC;
 	upsdebugx(2, "Setting SNMP timeout to %ld second(s)", snmp_timeout);
 
+	if (testvar(SU_VAR_BATCH)) {
+		snmp_batch = atoi(getval(SU_VAR_BATCH));
+		if (snmp_batch < 1) {
+			upsdebugx(1, "Bad %s value provided, setting to 1", SU_VAR_BATCH);
+			snmp_batch = 1;
+		}
+	}
+	upsdebugx(2, "Setting SNMP batches to %i variables", snmp_batch);
+
+	if (testvar(SU_VAR_WINDOW)) {
+		snmp_window = atoi(getval(SU_VAR_WINDOW));
+		if (snmp_window < 1) {
+			upsdebugx(1, "Bad %s value provided, setting to 1", SU_VAR_WINDOW);
+			snmp_window = 1;
+		}
+	}
+	upsdebugx(2, "Setting SNMP window to %i batches", snmp_window);
+
 	/* Retrieve user parameters */
 	version = testvar(SU_VAR_VERSION) ? getval(SU_VAR_VERSION) : "v1";
 
@@ -891,15 +1062,18 @@ void nut_snmp_init(const char *type, const char *hostname)
 		/* Process mandatory fields, based on the security level */
 		authPassword = testvar(SU_VAR_AUTHPASSWD) ? getval(SU_VAR_AUTHPASSWD) : NULL;
 		privPassword = testvar(SU_VAR_PRIVPASSWD) ? getval(SU_VAR_PRIVPASSWD) : NULL;
+		authKey = testvar(SU_VAR_AUTHKEY) ? getval(SU_VAR_AUTHKEY) : NULL;
+		privKey = testvar(SU_VAR_PRIVKEY) ? getval(SU_VAR_PRIVKEY) : NULL;
 
 		switch (g_snmp_sess.securityLevel) {
 			case SNMP_SEC_LEVEL_AUTHNOPRIV:
-				if (authPassword == NULL)
-					fatalx(EXIT_FAILURE, "authPassword is required for SNMPv3 in %s mode", secLevel);
+				if (authPassword == NULL && authKey == NULL)
+					fatalx(EXIT_FAILURE, "authPassword (or authKey) is required for SNMPv3 in %s mode", secLevel);
 				break;
 			case SNMP_SEC_LEVEL_AUTHPRIV:
-				if ((authPassword == NULL) || (privPassword == NULL))
-					fatalx(EXIT_FAILURE, "authPassword and privPassword are required for SNMPv3 in %s mode", secLevel);
+				if ((authPassword == NULL && authKey == NULL)
+				 || (privPassword == NULL && privKey == NULL))
+					fatalx(EXIT_FAILURE, "authPassword and privPassword (or authKey and privKey) are required for SNMPv3 in %s mode", secLevel);
 				break;
 			default:
 			case SNMP_SEC_LEVEL_NOAUTH:
@@ -949,8 +1123,15 @@ void nut_snmp_init(const char *type, const char *hostname)
 			fatalx(EXIT_FAILURE, "Bad SNMPv3 authProtocol: %s", authProtocol);
 
 		/* set the authentication key to a MD5/SHA1 hashed version of our
-		 * passphrase (must be at least 8 characters long) */
-		if (g_snmp_sess.securityLevel != SNMP_SEC_LEVEL_NOAUTH) {
+		 * passphrase (must be at least 8 characters long), unless it was
+		 * given as is: the hashing takes a megabyte of passes */
+		if (g_snmp_sess.securityLevel != SNMP_SEC_LEVEL_NOAUTH && authKey != NULL) {
+			g_snmp_sess.securityAuthKeyLen = su_parse_key(authKey,
+				g_snmp_sess.securityAuthKey, sizeof(g_snmp_sess.securityAuthKey));
+			if (!g_snmp_sess.securityAuthKeyLen)
+				fatalx(EXIT_FAILURE, "Bad SNMPv3 authKey, not an even count of hexadecimal digits");
+		}
+		else if (g_snmp_sess.securityLevel != SNMP_SEC_LEVEL_NOAUTH) {
 #if (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_PUSH_POP) && ( (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_TYPE_LIMITS) || (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_TAUTOLOGICAL_CONSTANT_OUT_OF_RANGE_COMPARE) )
 # pragma GCC diagnostic push
 #endif
@@ -1022,7 +1203,13 @@ net-snmp/library/keytools.h:   int    generate_Ku(const oid * hashtype, u_int ha
 
 		/* set the privacy key to a MD5/SHA1 hashed version of our
 		 * passphrase (must be at least 8 characters long) */
-		if (g_snmp_sess.securityLevel == SNMP_SEC_LEVEL_AUTHPRIV) {
+		if (g_snmp_sess.securityLevel == SNMP_SEC_LEVEL_AUTHPRIV && privKey != NULL) {
+			g_snmp_sess.securityPrivKeyLen = su_parse_key(privKey,
+				g_snmp_sess.securityPrivKey, sizeof(g_snmp_sess.securityPrivKey));
+			if (!g_snmp_sess.securityPrivKeyLen)
+				fatalx(EXIT_FAILURE, "Bad SNMPv3 privKey, not an even count of hexadecimal digits");
+		}
+		else if (g_snmp_sess.securityLevel == SNMP_SEC_LEVEL_AUTHPRIV) {
 			g_snmp_sess.securityPrivKeyLen = USM_PRIV_KU_LEN;
 
 #if (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_PUSH_POP) && ( (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_TYPE_LIMITS) || (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_TAUTOLOGICAL_CONSTANT_OUT_OF_RANGE_COMPARE) )
@@ -1076,35 +1263,180 @@ void nut_snmp_cleanup(void)
 	SOCK_CLEANUP; /* wrapper not needed on Unix! */
 }
 
-/* Free a struct snmp_pdu * returned by nut_snmp_walk */
-static void nut_snmp_free(struct snmp_pdu ** array_to_free)
+/* A response with just the variable <var>, as if it had been asked alone */
+static struct snmp_pdu *nut_snmp_single_pdu(const struct variable_list *var)
+{
+	struct snmp_pdu	*pdu = snmp_pdu_create(SNMP_MSG_RESPONSE);
+
+	if (pdu == NULL) {
+		fatalx(EXIT_FAILURE, "Not enough memory");
+	}
+	snmp_pdu_add_variable(pdu, var->name, var->name_length, var->type,
+		var->val.string, var->val_len);
+
+	return pdu;
+}
+
+/* What a response keeps in an I/O recording (see iorec.c), in host order:
+ * errstat, then the type, name and value of each of its variables (of
+ * which there are several for batched requests) */
+static size_t nut_snmp_iorec_pack(const struct snmp_pdu *response,
+	unsigned char *buf, size_t bufsize)
+{
+	const struct variable_list	*var = response->variables;
+	long	errstat = response->errstat;
+	size_t	len = 0;
+
+	if (sizeof(errstat) > bufsize) {
+		return 0;
+	}
+	memcpy(buf + len, &errstat, sizeof(errstat));
+	len += sizeof(errstat);
+
+	/* a response without variables is kept as one empty variable */
+	do {
+		size_t	name_len = var ? var->name_length : 0,
+			val_len = var ? var->val_len : 0;
+		u_char	type = var ? var->type : 0;
+
+		if (len + sizeof(type) + 2 * sizeof(size_t)
+		  + name_len * sizeof(oid) + val_len > bufsize
+		) {
+			return 0;
+		}
+
+		memcpy(buf + len, &type, sizeof(type));
+		len += sizeof(type);
+		memcpy(buf + len, &name_len, sizeof(name_len));
+		len += sizeof(name_len);
+		if (name_len) {
+			memcpy(buf + len, var->name, name_len * sizeof(oid));
+			len += name_len * sizeof(oid);
+		}
+		memcpy(buf + len, &val_len, sizeof(val_len));
+		len += sizeof(val_len);
+		if (val_len) {
+			memcpy(buf + len, var->val.string, val_len);
+			len += val_len;
+		}
+	} while (var && (var = var->next_variable) != NULL);
+
+	return len;
+}
+
+static struct snmp_pdu *nut_snmp_iorec_unpack(const unsigned char *buf, size_t len)
 {
-	struct snmp_pdu ** current_element;
+	struct snmp_pdu	*response;
+	long	errstat;
+	u_char	type;
+	size_t	off = 0, name_len, val_len;
+	oid	name[MAX_OID_LEN];
 
-	if (array_to_free != NULL) {
-		current_element = array_to_free;
+	if (len < sizeof(errstat) + sizeof(type) + 2 * sizeof(size_t)) {
+		return NULL;
+	}
 
-		while (*current_element != NULL) {
-			snmp_free_pdu(*current_element);
-			current_element++;
+	response = snmp_pdu_create(SNMP_MSG_RESPONSE);
+	if (response == NULL) {
+		fatalx(EXIT_FAILURE, "Not enough memory");
+	}
+
+	memcpy(&errstat, buf + off, sizeof(errstat));
+	off += sizeof(errstat);
+	response->errstat = errstat;
+
+	while (off + sizeof(type) + 2 * sizeof(size_t) <= len) {
+		memcpy(&type, buf + off, sizeof(type));
+		off += sizeof(type);
+		memcpy(&name_len, buf + off, sizeof(name_len));
+		off += sizeof(name_len);
+		if (name_len > MAX_OID_LEN || off + name_len * sizeof(oid) + sizeof(val_len) > len) {
+			break;
+		}
+		memcpy(name, buf + off, name_len * sizeof(oid));
+		off += name_len * sizeof(oid);
+		memcpy(&val_len, buf + off, sizeof(val_len));
+		off += sizeof(val_len);
+		if (off + val_len > len) {
+			break;
 		}
 
-		free( array_to_free );
+		if (name_len) {
+			snmp_pdu_add_variable(response, name, name_len, type,
+				buf + off, val_len);
+		}
+		off += val_len;
 	}
+
+	return response;
+}
+
+/* snmp_synch_response(), timed for the driver.stats.io.* variables, and
+ * recorded or replayed (see iorec.c) if so asked */
+static int nut_snmp_synch_response(struct snmp_pdu *pdu, struct snmp_pdu **response)
+{
+	static unsigned char	buf[IOREC_DATA_MAX];
+	char	key[SMALLBUF];
+	const char	*op;
+	size_t	len = 0;
+	long	status = STAT_TIMEOUT;
+	uint64_t	start;
+
+	op = (pdu->command == SNMP_MSG_SET) ? "set"
+		: (pdu->command == SNMP_MSG_GETNEXT) ? "getnext"
+		: (pdu->command == SNMP_MSG_GETBULK) ? "getbulk" : "get";
+
+	if (iorec_mode != IOREC_OFF && pdu->variables) {
+		snprint_objid(key, sizeof(key),
+			pdu->variables->name, pdu->variables->name_length);
+	} else {
+		snprintf(key, sizeof(key), "-");
+	}
+
+	if (iorec_mode == IOREC_REPLAY) {
+		/* the library would free the request once sent */
+		snmp_free_pdu(pdu);
+
+		*response = NULL;
+		len = sizeof(buf);
+		if (!iorec_replay("snmp", op, key, &status, buf, &len)) {
+			return STAT_TIMEOUT;
+		}
+		if (len) {
+			*response = nut_snmp_iorec_unpack(buf, len);
+		}
+		return (int)status;
+	}
+
+	NUT_PROBE1(snmp_transfer, op);
+	start = drv_stats_now_usec();
+	status = snmp_synch_response(g_snmp_sess_p, pdu, response);
+	drv_stats_io(start);
+	NUT_PROBE2(snmp_transfer_done, op, status);
+
+	if (iorec_mode == IOREC_RECORD) {
+		if (*response) {
+			len = nut_snmp_iorec_pack(*response, buf, sizeof(buf));
+		}
+		iorec_record("snmp", op, key, status, buf, len);
+	}
+
+	return (int)status;
 }
 
-/* Return a NULL terminated array of snmp_pdu * */
-static struct snmp_pdu **nut_snmp_walk(const char *OID, int max_iteration)
+/* Hand the variables of OID and the ones after it in its sub-tree, up to
+ * <max_iteration> of them, to <fn> (which may be NULL) as they come, in
+ * the responses, until it returns FALSE: returns how many it took */
+static int nut_snmp_walk(const char *OID, int max_iteration, su_var_fn_t fn, void *arg)
 {
 	int status;
 	struct snmp_pdu *pdu, *response = NULL;
 	oid name[MAX_OID_LEN];
 	size_t name_len = MAX_OID_LEN;
-	oid * current_name;
+	oid current_name[MAX_OID_LEN];
 	size_t current_name_len;
 	static unsigned int numerr = 0;
-	int nb_iteration = 0;
-	struct snmp_pdu ** ret_array = NULL;
+	int nb_iteration = 0, taken = 0;
 	int type = SNMP_MSG_GET;
 
 	upsdebugx(3, "%s(%s)", __func__, OID);
@@ -1114,21 +1446,35 @@ static struct snmp_pdu **nut_snmp_walk(const char *OID, int max_iteration)
 	if (!snmp_parse_oid(OID, name, &name_len)) {
 		upsdebugx(2, "[%s] %s: %s: %s",
 			upsname?upsname:device_name, __func__, OID, snmp_api_errstring(snmp_errno));
-		return NULL;
+		return 0;
 	}
 
-	current_name = name;
+	memcpy(current_name, name, name_len * sizeof(oid));
 	current_name_len = name_len;
 
 	while( nb_iteration < max_iteration ) {
-		struct snmp_pdu	**new_ret_array;
+		struct variable_list	*var;
+		int	got = 0;
 
 		/* Going to a shorter OID means we are outside our sub-tree */
 		if( current_name_len < name_len ) {
 			break;
 		}
 
-		pdu = snmp_pdu_create(type);
+		/* the next ones all at once, where the protocol allows */
+		if (type == SNMP_MSG_GETNEXT && snmp_batch > 1
+		 && max_iteration - nb_iteration > 1
+		 && g_snmp_sess.version != SNMP_VERSION_1
+		) {
+			pdu = snmp_pdu_create(SNMP_MSG_GETBULK);
+			if (pdu != NULL) {
+				pdu->non_repeaters = 0;
+				pdu->max_repetitions = (max_iteration - nb_iteration < snmp_batch)
+					? max_iteration - nb_iteration : snmp_batch;
+			}
+		} else {
+			pdu = snmp_pdu_create(type);
+		}
 
 		if (pdu == NULL) {
 			fatalx(EXIT_FAILURE, "Not enough memory");
@@ -1136,7 +1482,7 @@ static struct snmp_pdu **nut_snmp_walk(const char *OID, int max_iteration)
 
 		snmp_add_null_var(pdu, current_name, current_name_len);
 
-		status = snmp_synch_response(g_snmp_sess_p, pdu, &response);
+		status = nut_snmp_synch_response(pdu, &response);
 
 		if (!response) {
 			break;
@@ -1146,15 +1492,13 @@ static struct snmp_pdu **nut_snmp_walk(const char *OID, int max_iteration)
 			if (mibname == NULL) {
 				/* We are probing for proper mib - ignore errors */
 				snmp_free_pdu(response);
-				nut_snmp_free(ret_array);
-				return NULL;
+				return 0;
 			}
 
 			if (response->errstat == SNMP_ERR_NOSUCHNAME) {
 				upsdebugx(4, "%s: OID does not exist, skipping", __func__);
 				snmp_free_pdu(response);
-				nut_snmp_free(ret_array);
-				return NULL;
+				return 0;
 			}
 
 			upsdebugx(3, "status = %i, response->errstat = %li", status, response->errstat);
@@ -1181,76 +1525,560 @@ static struct snmp_pdu **nut_snmp_walk(const char *OID, int max_iteration)
 
 			snmp_free_pdu(response);
 			break;
-		} else {
+		}
+
+		/* the variables of a GETBULK answer go one by one, as if each
+		 * had been asked for with a GETNEXT */
+		for (var = response->variables; var != NULL; var = var->next_variable) {
 			/* Checked the "type" field of the returned varbind if
 			 * it is a type error exception (only applicable with
 			 * SNMPv2 or SNMPv3 protocol, would not happen with
 			 * SNMPv1). This allows to proceed interpreting large
 			 * responses when one entry in the middle is rejectable.
 			 */
-			if (response->variables->type == SNMP_NOSUCHOBJECT ||
-			    response->variables->type == SNMP_NOSUCHINSTANCE ||
-			    response->variables->type == SNMP_ENDOFMIBVIEW) {
+			if (var->type == SNMP_NOSUCHOBJECT ||
+			    var->type == SNMP_NOSUCHINSTANCE ||
+			    var->type == SNMP_ENDOFMIBVIEW) {
 				upslogx(LOG_WARNING, "[%s] Warning: type error exception (OID = %s)",
 						upsname?upsname:device_name, OID);
-				snmp_free_pdu(response);
 				break;
 			}
 			else {
 				/* no error */
 				numerr = 0;
 			}
+
+			nb_iteration++;
+			got++;
+
+			if (fn != NULL && !fn(var, arg)) {
+				break;
+			}
+			taken++;
+
+			/* the response goes, the next request starts from here */
+			current_name_len = (var->name_length < MAX_OID_LEN)
+				? var->name_length : MAX_OID_LEN;
+			memcpy(current_name, var->name, current_name_len * sizeof(oid));
+
+			if (nb_iteration >= max_iteration || current_name_len < name_len) {
+				break;
+			}
+		}
+
+		snmp_free_pdu(response);
+
+		if (!got || var != NULL) {
+			break;
 		}
 
-		nb_iteration++;
-		/* +1 is for the terminating NULL */
-		new_ret_array = realloc(
-			ret_array,
-			sizeof(struct snmp_pdu*) * ((size_t)nb_iteration+1)
-			);
-		if (new_ret_array == NULL) {
-			upsdebugx(1, "%s: Failed to realloc thread", __func__);
-			break;
+		type = SNMP_MSG_GETNEXT;
+	}
+
+	return taken;
+}
+
+/* -----------------------------------------------------------
+ * Batched requests: the OIDs which nut_snmp_get_var() was asked for during
+ * an update walk are remembered in order, and at the start of the next
+ * walk of the same kind (with or without the slow and normal entries) they
+ * are all requested again, up to snmp_batch of them in each GET. What
+ * these bring is then served from a table; anything else (an OID which
+ * is new, or which the agent did not give in a batch) is asked for on
+ * its own as before, with the usual handling of its errors.
+ * ----------------------------------------------------------- */
+
+typedef struct {
+	const char	*OID;	/* NULL if the slot is free, else in a plan or next */
+	const struct variable_list	*var;	/* answer of a batch, or NULL */
+	int	asked;		/* by the walk going on */
+	char	**from;		/* the slot of the plan which holds OID, or NULL */
+} su_batch_ent_t;
+
+static struct {
+	int	active;		/* in an update walk */
+	int	kind;		/* 1 if the slow entries are due, | 2 if the normal */
+	size_t	size;		/* OIDs in a batch: snmp_batch, or less if too big */
+	char	**plan[4];	/* OIDs asked for by the last walk of each kind */
+	size_t	nplan[4], planalloc[4];
+	char	**next;		/* ...and by the walk going on */
+	size_t	nnext, nextalloc;
+	su_batch_ent_t	*tab;	/* a hash table of tabsize slots (a power of 2) */
+	size_t	tabsize, tabused;
+	struct snmp_pdu	**resps;	/* the answers which var point into */
+	size_t	nresps, respsalloc;
+} su_batch;
+
+/* where <OID> is in the table, or would be */
+static size_t su_batch_slot(const char *OID)
+{
+	size_t	i;
+
+	for (i = str_hash_nocase(OID) & (su_batch.tabsize - 1);
+		su_batch.tab[i].OID && strcmp(su_batch.tab[i].OID, OID);
+		i = (i + 1) & (su_batch.tabsize - 1)
+	)
+		;
+
+	return i;
+}
+
+/* the entry of <OID>, or the free one for it (with room for it made):
+ * the caller fills in its OID, with a string which lasts until the end of
+ * the walk */
+static su_batch_ent_t *su_batch_find(const char *OID)
+{
+	size_t	i;
+
+	if ((su_batch.tabused + 1) * 2 > su_batch.tabsize) {
+		su_batch_ent_t	*old = su_batch.tab;
+		size_t	oldsize = su_batch.tabsize;
+
+		su_batch.tabsize = oldsize ? oldsize * 2 : 256;
+		su_batch.tab = xcalloc(su_batch.tabsize, sizeof(*su_batch.tab));
+		for (i = 0; i < oldsize; i++) {
+			if (old[i].OID) {
+				su_batch.tab[su_batch_slot(old[i].OID)] = old[i];
+			}
+		}
+		free(old);
+	}
+
+	return &su_batch.tab[su_batch_slot(OID)];
+}
+
+/* a GET of the <n> OIDs, with idx[] telling which of them each variable
+ * is and <*sent> their count; NULL if none of them could be parsed */
+static struct snmp_pdu *su_batch_pdu(char **oids, size_t n, size_t *idx, size_t *sent)
+{
+	struct snmp_pdu	*pdu;
+	oid	name[MAX_OID_LEN];
+	size_t	i, name_len;
+
+	pdu = snmp_pdu_create(SNMP_MSG_GET);
+	if (pdu == NULL) {
+		fatalx(EXIT_FAILURE, "Not enough memory");
+	}
+
+	*sent = 0;
+	for (i = 0; i < n; i++) {
+		name_len = MAX_OID_LEN;
+		if (!snmp_parse_oid(oids[i], name, &name_len)) {
+			continue;
+		}
+		snmp_add_null_var(pdu, name, name_len);
+		idx[(*sent)++] = i;
+	}
+
+	if (!*sent) {
+		snmp_free_pdu(pdu);
+		return NULL;
+	}
+
+	upsdebugx(3, "%s: %" PRIuSIZE " OIDs from %s", __func__, *sent, oids[idx[0]]);
+	return pdu;
+}
+
+static void su_batch_fetch(char **oids, size_t n);
+
+/* file the answers that a GET made by su_batch_pdu() got (and frees it) */
+static void su_batch_file(char **oids, size_t n, const size_t *idx, size_t sent,
+	int status, struct snmp_pdu *response)
+{
+	struct variable_list	*var;
+	size_t	i;
+	long	bad;
+
+	if (status != STAT_SUCCESS || response == NULL) {
+		upsdebugx(2, "%s: no answer, the OIDs will be requested one by one", __func__);
+		if (response)
+			snmp_free_pdu(response);
+		return;
+	}
+
+	switch (response->errstat)
+	{
+	case SNMP_ERR_NOERROR:
+		break;
+
+	case SNMP_ERR_TOOBIG:
+		/* the answer would not fit: in halves, then */
+		snmp_free_pdu(response);
+		if (n > 1) {
+			upsdebugx(3, "%s: answer too big, splitting the batch", __func__);
+			if (su_batch.size > n / 2)
+				su_batch.size = n / 2;
+			su_batch_fetch(oids, n / 2);
+			su_batch_fetch(oids + n / 2, n - n / 2);
+		}
+		return;
+
+	case SNMP_ERR_NOSUCHNAME:
+		/* SNMPv1: one of them is missing, which spoils the whole lot,
+		 * so the others are asked for again without it */
+		bad = response->errindex;
+		snmp_free_pdu(response);
+		if (sent > 1 && bad >= 1 && (size_t)bad <= sent) {
+			i = idx[bad - 1];
+			su_batch_fetch(oids, i);
+			su_batch_fetch(oids + i + 1, n - i - 1);
+		}
+		return;
+
+	default:
+		upsdebugx(2, "%s: error %li, the OIDs will be requested one by one",
+			__func__, response->errstat);
+		snmp_free_pdu(response);
+		return;
+	}
+
+	/* the answer has the variables in the order asked for; it is kept
+	 * until the end of the walk, and the entries point into it */
+	for (var = response->variables, i = 0; var != NULL && i < sent;
+		var = var->next_variable, i++
+	) {
+		su_batch_ent_t	*e;
+
+		if (var->type == SNMP_NOSUCHOBJECT ||
+		    var->type == SNMP_NOSUCHINSTANCE ||
+		    var->type == SNMP_ENDOFMIBVIEW) {
+			continue;
+		}
+
+		e = su_batch_find(oids[idx[i]]);
+		if (e->OID == NULL) {
+			e->OID = oids[idx[i]];
+			e->from = &oids[idx[i]];
+			su_batch.tabused++;
+		}
+		if (e->var == NULL) {
+			e->var = var;
+		}
+	}
+
+	if (su_batch.nresps == su_batch.respsalloc) {
+		su_batch.respsalloc = su_batch.respsalloc ? su_batch.respsalloc * 2 : 16;
+		su_batch.resps = xrealloc(su_batch.resps,
+			su_batch.respsalloc * sizeof(*su_batch.resps));
+	}
+	su_batch.resps[su_batch.nresps++] = response;
+}
+
+/* request the <n> OIDs at once, and file the answers */
+static void su_batch_fetch(char **oids, size_t n)
+{
+	struct snmp_pdu	*pdu, *response = NULL;
+	size_t	sent, *idx;
+	int	status;
+
+	if (!n) {
+		return;
+	}
+
+	idx = xcalloc(n, sizeof(*idx));
+	pdu = su_batch_pdu(oids, n, idx, &sent);
+	if (pdu != NULL) {
+		status = nut_snmp_synch_response(pdu, &response);
+		su_batch_file(oids, n, idx, sent, status, response);
+	}
+	free(idx);
+}
+
+/* A batch sent with snmp_async_send(), until its answer comes */
+typedef struct {
+	char	**oids;
+	size_t	n, sent, *idx;
+	int	done, status;
+	struct snmp_pdu	*response;
+	uint64_t	start;
+} su_batch_req_t;
+
+static size_t	su_batch_pending = 0;
+
+static int su_batch_callback(int op, struct snmp_session *sess, int reqid,
+	struct snmp_pdu *pdu, void *magic)
+{
+	su_batch_req_t	*r = magic;
+
+	NUT_UNUSED_VARIABLE(sess);
+	NUT_UNUSED_VARIABLE(reqid);
+
+	drv_stats_io(r->start);
+	NUT_PROBE2(snmp_transfer_done, "async", op);
+
+	/* the library frees the answer once we return */
+	if (op == NETSNMP_CALLBACK_OP_RECEIVED_MESSAGE && pdu != NULL) {
+		r->status = STAT_SUCCESS;
+		r->response = snmp_clone_pdu(pdu);
+	} else {
+		r->status = STAT_TIMEOUT;
+	}
+
+	r->done = 1;
+	su_batch_pending--;
+
+	return 1;
+}
+
+/* request the <n> OIDs in batches of <size>, with up to snmp_window of
+ * these sent before any answer came, and file the answers */
+static void su_batch_fetch_window(char **oids, size_t n, size_t size)
+{
+	su_batch_req_t	*reqs;
+	size_t	i, nreqs = (n + size - 1) / size, nsent = 0;
+
+	if (!n) {
+		return;
+	}
+
+	reqs = xcalloc(nreqs, sizeof(*reqs));
+	for (i = 0; i < nreqs; i++) {
+		reqs[i].oids = oids + i * size;
+		reqs[i].n = (n - i * size < size) ? n - i * size : size;
+		reqs[i].idx = xcalloc(reqs[i].n, sizeof(*reqs[i].idx));
+		reqs[i].status = STAT_ERROR;
+	}
+
+	su_batch_pending = 0;
+	while (nsent < nreqs || su_batch_pending > 0) {
+		struct timeval	tv;
+		fd_set	fds;
+		int	numfds = 0, block = 0, count;
+
+		while (nsent < nreqs && su_batch_pending < (size_t)snmp_window) {
+			su_batch_req_t	*r = &reqs[nsent++];
+			struct snmp_pdu	*pdu = su_batch_pdu(r->oids, r->n, r->idx, &r->sent);
+
+			if (pdu == NULL) {
+				r->done = 1;
+				continue;
+			}
+
+			NUT_PROBE1(snmp_transfer, "async");
+			r->start = drv_stats_now_usec();
+			if (!snmp_async_send(g_snmp_sess_p, pdu, su_batch_callback, r)) {
+				upsdebugx(2, "%s: can't send a batch: %s",
+					__func__, snmp_api_errstring(snmp_errno));
+				snmp_free_pdu(pdu);
+				r->done = 1;
+				continue;
+			}
+			su_batch_pending++;
+		}
+
+		if (!su_batch_pending) {
+			break;
+		}
+
+		FD_ZERO(&fds);
+		tv.tv_sec = 1;
+		tv.tv_usec = 0;
+		snmp_select_info(&numfds, &fds, &tv, &block);
+
+		count = select(numfds, &fds, NULL, NULL, block ? NULL : &tv);
+		if (count > 0) {
+			snmp_read(&fds);
+		} else if (count == 0 || errno != EINTR) {
+			/* resends, or gives up on, the requests due */
+			snmp_timeout();
+		}
+	}
+
+	/* in the order asked for, as the plan holds them */
+	for (i = 0; i < nreqs; i++) {
+		if (reqs[i].sent) {
+			su_batch_file(reqs[i].oids, reqs[i].n, reqs[i].idx,
+				reqs[i].sent, reqs[i].status, reqs[i].response);
+		}
+		free(reqs[i].idx);
+	}
+	free(reqs);
+}
+
+/* forget the answers; the table and arrays stay, for the next walk */
+static void su_batch_clear(void)
+{
+	size_t	i;
+
+	if (su_batch.tabused) {
+		memset(su_batch.tab, 0, su_batch.tabsize * sizeof(*su_batch.tab));
+		su_batch.tabused = 0;
+	}
+
+	for (i = 0; i < su_batch.nresps; i++) {
+		snmp_free_pdu(su_batch.resps[i]);
+	}
+	su_batch.nresps = 0;
+
+	for (i = 0; i < su_batch.nnext; i++) {
+		free(su_batch.next[i]);
+	}
+	su_batch.nnext = 0;
+}
+
+/* start a walk: fetch what the last one of its kind asked for */
+static void su_batch_begin(int mode)
+{
+	size_t	i, n;
+	int	kind = (semistatic_countdown == 0) | (normal_countdown == 0) << 1;
+
+	su_batch_clear();
+
+	if (mode != SU_WALKMODE_UPDATE || snmp_batch < 2) {
+		return;
+	}
+	su_batch.active = 1;
+	su_batch.kind = kind;
+	if (!su_batch.size)
+		su_batch.size = (size_t)snmp_batch;
+
+	/* the recordings of iorec.c hold one transaction after the other */
+	if (snmp_window > 1 && iorec_mode == IOREC_OFF) {
+		su_batch_fetch_window(su_batch.plan[kind], su_batch.nplan[kind],
+			su_batch.size);
+		return;
+	}
+
+	for (i = 0; i < su_batch.nplan[kind]; i += n) {
+		n = su_batch.nplan[kind] - i;
+		if (n > su_batch.size)
+			n = su_batch.size;
+		su_batch_fetch(su_batch.plan[kind] + i, n);
+	}
+}
+
+/* end a walk: what it asked for is the plan of the next one */
+static void su_batch_end(void)
+{
+	size_t	i, kind = (size_t)su_batch.kind;
+
+	if (su_batch.active) {
+		char	**old = su_batch.plan[kind];
+		size_t	oldalloc = su_batch.planalloc[kind];
+
+		/* (but those which moved to the next one) */
+		for (i = 0; i < su_batch.nplan[kind]; i++) {
+			free(old[i]);
+		}
+		su_batch.plan[kind] = su_batch.next;
+		su_batch.nplan[kind] = su_batch.nnext;
+		su_batch.planalloc[kind] = su_batch.nextalloc;
+		su_batch.next = old;
+		su_batch.nnext = 0;
+		su_batch.nextalloc = oldalloc;
+	}
+	su_batch.active = 0;
+
+	su_batch_clear();
+}
+
+static void su_batch_free(void)
+{
+	size_t	i, kind;
+
+	su_batch.active = 0;
+	su_batch_clear();
+	for (kind = 0; kind < 4; kind++) {
+		for (i = 0; i < su_batch.nplan[kind]; i++) {
+			free(su_batch.plan[kind][i]);
 		}
-		else {
-			ret_array = new_ret_array;
+		free(su_batch.plan[kind]);
+		su_batch.plan[kind] = NULL;
+		su_batch.nplan[kind] = su_batch.planalloc[kind] = 0;
+	}
+	free(su_batch.next);
+	su_batch.next = NULL;
+	su_batch.nextalloc = 0;
+	free(su_batch.tab);
+	su_batch.tab = NULL;
+	su_batch.tabsize = 0;
+	free(su_batch.resps);
+	su_batch.resps = NULL;
+	su_batch.respsalloc = 0;
+}
+
+/* the answer for <OID> brought by a batch, if any (it lasts until the end
+ * of the walk); either way, it is in the plan of the next walk */
+static const struct variable_list *su_batch_get(const char *OID)
+{
+	su_batch_ent_t	*e;
+	char	*next_oid = NULL;
+
+	if (!su_batch.active) {
+		return NULL;
+	}
+
+	e = su_batch_find(OID);
+	if (e->OID == NULL) {
+		next_oid = xstrdup(OID);
+		e->OID = next_oid;
+		su_batch.tabused++;
+	} else if (!e->asked) {
+		/* the string of the plan moves to the next one */
+		if (e->from != NULL) {
+			next_oid = *e->from;
+			*e->from = NULL;
+			e->from = NULL;
+		} else {
+			next_oid = xstrdup(OID);
 		}
-		ret_array[nb_iteration-1] = response;
-		ret_array[nb_iteration]=NULL;
+	}
 
-		current_name = response->variables->name;
-		current_name_len = response->variables->name_length;
+	if (!e->asked) {
+		e->asked = 1;
+		if (su_batch.nnext == su_batch.nextalloc) {
+			su_batch.nextalloc = su_batch.nextalloc ? su_batch.nextalloc * 2 : 64;
+			su_batch.next = xrealloc(su_batch.next,
+				su_batch.nextalloc * sizeof(*su_batch.next));
+		}
+		su_batch.next[su_batch.nnext++] = next_oid;
+	}
 
-		type = SNMP_MSG_GETNEXT;
+	if (e->var == NULL) {
+		return NULL;
 	}
 
-	return ret_array;
+	upsdebugx(3, "%s: %s from the batch", __func__, OID);
+	return e->var;
 }
 
-struct snmp_pdu *nut_snmp_get(const char *OID)
+/* Hand the variable which <OID> gives to <fn> (NULL to just check that it
+ * gives one), from a batch or asked for on its own, in the response where
+ * it came: returns what <fn> did */
+static bool_t nut_snmp_get_var(const char *OID, su_var_fn_t fn, void *arg)
 {
-	struct snmp_pdu ** pdu_array;
-	struct snmp_pdu * ret_pdu;
+	const struct variable_list	*var;
 
 	if (OID == NULL)
-		return NULL;
+		return FALSE;
 
 	upsdebugx(3, "%s(%s)", __func__, OID);
 
-	pdu_array = nut_snmp_walk(OID,1);
-
-	if(pdu_array == NULL) {
-		return NULL;
+	if ((var = su_batch_get(OID)) != NULL) {
+		return (fn != NULL) ? fn(var, arg) : TRUE;
 	}
 
-	ret_pdu = snmp_clone_pdu(*pdu_array);
+	return (nut_snmp_walk(OID, 1, fn, arg) > 0) ? TRUE : FALSE;
+}
+
+static bool_t su_var_clone(const struct variable_list *var, void *arg)
+{
+	*(struct snmp_pdu **)arg = nut_snmp_single_pdu(var);
+	return TRUE;
+}
+
+/* a response of its own, which the caller frees; the driver itself rather
+ * decodes the variables where they came, with nut_snmp_get_var() */
+struct snmp_pdu *nut_snmp_get(const char *OID)
+{
+	struct snmp_pdu	*pdu = NULL;
 
-	nut_snmp_free(pdu_array);
+	nut_snmp_get_var(OID, su_var_clone, &pdu);
 
-	return ret_pdu;
+	return pdu;
 }
 
-static bool_t decode_str(struct snmp_pdu *pdu, char *buf, size_t buf_len, info_lkp_t *oid2info)
+static bool_t decode_str(const struct variable_list *var, char *buf, size_t buf_len, info_lkp_t *oid2info)
 {
 	size_t len = 0;
 	char tmp_buf[SU_LARGEBUF];
@@ -1258,7 +2086,7 @@ static bool_t decode_str(struct snmp_pdu *pdu, char *buf, size_t buf_len, info_l
 	/* zero out buffer. */
 	memset(buf, 0, buf_len);
 
-	switch (pdu->variables->type) {
+	switch (var->type) {
 	case ASN_OCTET_STR:
 	case ASN_OPAQUE:
 		{ /* scoping */
@@ -1266,17 +2094,17 @@ static bool_t decode_str(struct snmp_pdu *pdu, char *buf, size_t buf_len, info_l
 			int hex = 0, x;
 			unsigned char *cp;
 
-			len = pdu->variables->val_len > buf_len - 1 ?
-				buf_len - 1 : pdu->variables->val_len;
-			for(cp = pdu->variables->val.string, x = 0; x < (int)pdu->variables->val_len; x++, cp++) {
+			len = var->val_len > buf_len - 1 ?
+				buf_len - 1 : var->val_len;
+			for(cp = var->val.string, x = 0; x < (int)var->val_len; x++, cp++) {
 				if (!(isprint((size_t)*cp) || isspace((size_t)*cp))) {
 					hex = 1;
 				}
 			}
 			if (hex)
-				snprint_hexstring(buf, buf_len, pdu->variables->val.string, pdu->variables->val_len);
+				snprint_hexstring(buf, buf_len, var->val.string, var->val_len);
 			else {
-				memcpy(buf, pdu->variables->val.string, len);
+				memcpy(buf, var->val.string, len);
 				buf[len] = '\0';
 			}
 		}
@@ -1287,10 +2115,10 @@ static bool_t decode_str(struct snmp_pdu *pdu, char *buf, size_t buf_len, info_l
 		if(oid2info) {
 			const char *str;
 			/* See union netsnmp_vardata in net-snmp/types.h: "integer" is a "long*" */
-			assert(sizeof(pdu->variables->val.integer) == sizeof(long*));
+			assert(sizeof(var->val.integer) == sizeof(long*));
 			/* If in future net-snmp headers val becomes not-a-pointer,
 			 * compiler should complain about (void*) arg casting here */
-			if((str = su_find_infoval(oid2info, pdu->variables->val.integer))) {
+			if((str = su_find_infoval(oid2info, var->val.integer))) {
 				strncpy(buf, str, buf_len-1);
 			}
 			/* when oid2info returns NULL, don't publish the variable! */
@@ -1301,7 +2129,7 @@ static bool_t decode_str(struct snmp_pdu *pdu, char *buf, size_t buf_len, info_l
 			buf[buf_len-1]='\0';
 		}
 		else {
-			int ret = snprintf(buf, buf_len, "%ld", *pdu->variables->val.integer);
+			int ret = snprintf(buf, buf_len, "%ld", *var->val.integer);
 			if (ret < 0)
 				upsdebugx(3, "Failed to retrieve ASN_GAUGE");
 			else
@@ -1311,7 +2139,7 @@ static bool_t decode_str(struct snmp_pdu *pdu, char *buf, size_t buf_len, info_l
 	case ASN_TIMETICKS:
 		/* convert timeticks to seconds */
 		{
-			int ret = snprintf(buf, buf_len, "%ld", *pdu->variables->val.integer / 100);
+			int ret = snprintf(buf, buf_len, "%ld", *var->val.integer / 100);
 			if (ret < 0)
 				upsdebugx(3, "Failed to retrieve ASN_TIMETICKS");
 			else
@@ -1319,7 +2147,7 @@ static bool_t decode_str(struct snmp_pdu *pdu, char *buf, size_t buf_len, info_l
 		}
 		break;
 	case ASN_OBJECT_ID:
-		snprint_objid (tmp_buf, sizeof(tmp_buf), pdu->variables->val.objid, pdu->variables->val_len / sizeof(oid));
+		snprint_objid (tmp_buf, sizeof(tmp_buf), var->val.objid, var->val_len / sizeof(oid));
 		upsdebugx(2, "Received an OID value: %s", tmp_buf);
 		/* Try to get the value of the pointed OID */
 		if (nut_snmp_get_str(tmp_buf, buf, buf_len, oid2info) == FALSE) {
@@ -1338,39 +2166,52 @@ static bool_t decode_str(struct snmp_pdu *pdu, char *buf, size_t buf_len, info_l
 	return TRUE;
 }
 
-bool_t nut_snmp_get_str(const char *OID, char *buf, size_t buf_len, info_lkp_t *oid2info)
-{
-	struct snmp_pdu *pdu;
-	bool_t ret;
+/* where nut_snmp_get_{str,oid,int}() want the value */
+typedef struct {
+	const char	*OID;
+	char	*buf;
+	size_t	buf_len;
+	info_lkp_t	*oid2info;
+	long	value;
+} su_var_dest_t;
 
-	upsdebugx(3, "Entering %s()", __func__);
+static bool_t su_var_str(const struct variable_list *var, void *arg)
+{
+	su_var_dest_t	*dest = arg;
 
-	pdu = nut_snmp_get(OID);
-	if (pdu == NULL)
+	if (decode_str(var, dest->buf, dest->buf_len, dest->oid2info) == FALSE) {
+		upsdebugx(2, "[%s] unhandled ASN 0x%x received from %s",
+			upsname?upsname:device_name, var->type, dest->OID);
 		return FALSE;
+	}
 
-	ret = decode_str(pdu,buf,buf_len,oid2info);
+	return TRUE;
+}
 
-	if(ret == FALSE) {
-		upsdebugx(2, "[%s] unhandled ASN 0x%x received from %s",
-			upsname?upsname:device_name, pdu->variables->type, OID);
-	}
+bool_t nut_snmp_get_str(const char *OID, char *buf, size_t buf_len, info_lkp_t *oid2info)
+{
+	su_var_dest_t	dest;
 
-	snmp_free_pdu(pdu);
+	upsdebugx(3, "Entering %s()", __func__);
 
-	return ret;
+	dest.OID = OID;
+	dest.buf = buf;
+	dest.buf_len = buf_len;
+	dest.oid2info = oid2info;
+
+	return nut_snmp_get_var(OID, su_var_str, &dest);
 }
 
 
-static bool_t decode_oid(struct snmp_pdu *pdu, char *buf, size_t buf_len)
+static bool_t decode_oid(const struct variable_list *var, char *buf, size_t buf_len)
 {
 	/* zero out buffer. */
 	memset(buf, 0, buf_len);
 
-	switch (pdu->variables->type) {
+	switch (var->type) {
 		case ASN_OBJECT_ID:
-			snprint_objid (buf, buf_len, pdu->variables->val.objid,
-				pdu->variables->val_len / sizeof(oid));
+			snprint_objid (buf, buf_len, var->val.objid,
+				var->val_len / sizeof(oid));
 			upsdebugx(2, "OID value: %s", buf);
 			break;
 		default:
@@ -1380,93 +2221,105 @@ static bool_t decode_oid(struct snmp_pdu *pdu, char *buf, size_t buf_len)
 	return TRUE;
 }
 
+static bool_t su_var_oid(const struct variable_list *var, void *arg)
+{
+	su_var_dest_t	*dest = arg;
+
+	if (decode_oid(var, dest->buf, dest->buf_len) == FALSE) {
+		upsdebugx(2, "[%s] unhandled ASN 0x%x received from %s",
+			upsname?upsname:device_name, var->type, dest->OID);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
 /* Return the value stored in OID, which is an OID (sysOID for example)
  * and don't try to get the value pointed by this OID (no follow).
  * To achieve the latter behavior, use standard nut_snmp_get_{str,int}() */
 bool_t nut_snmp_get_oid(const char *OID, char *buf, size_t buf_len)
 {
-	struct snmp_pdu *pdu;
-	bool_t ret = FALSE;
+	su_var_dest_t	dest;
 
 	/* zero out buffer. */
 	memset(buf, 0, buf_len);
 
 	upsdebugx(3, "Entering %s()", __func__);
 
-	pdu = nut_snmp_get(OID);
-	if (pdu == NULL)
-		return FALSE;
-
-	ret = decode_oid(pdu, buf, buf_len);
-
-	if(ret == FALSE) {
-		upsdebugx(2, "[%s] unhandled ASN 0x%x received from %s",
-			upsname?upsname:device_name, pdu->variables->type, OID);
-	}
-
-	snmp_free_pdu(pdu);
+	dest.OID = OID;
+	dest.buf = buf;
+	dest.buf_len = buf_len;
 
-	return ret;
+	return nut_snmp_get_var(OID, su_var_oid, &dest);
 }
 
-bool_t nut_snmp_get_int(const char *OID, long *pval)
+static bool_t su_var_int(const struct variable_list *var, void *arg)
 {
+	su_var_dest_t	*dest = arg;
 	char tmp_buf[SU_LARGEBUF];
-	struct snmp_pdu *pdu;
-	long value;
-	char *buf;
-
-	upsdebugx(3, "Entering %s()", __func__);
-
-	pdu = nut_snmp_get(OID);
-	if (pdu == NULL)
-		return FALSE;
+	size_t len;
 
-	switch (pdu->variables->type) {
+	switch (var->type) {
 	case ASN_OCTET_STR:
 	case ASN_OPAQUE:
-		buf = xmalloc(pdu->variables->val_len + 1);
-		memcpy(buf, pdu->variables->val.string, pdu->variables->val_len);
-		buf[pdu->variables->val_len] = '\0';
-		value = strtol(buf, NULL, 0);
-		free(buf);
+		len = (var->val_len < sizeof(tmp_buf)) ? var->val_len : sizeof(tmp_buf) - 1;
+		memcpy(tmp_buf, var->val.string, len);
+		tmp_buf[len] = '\0';
+		dest->value = strtol(tmp_buf, NULL, 0);
 		break;
 	case ASN_INTEGER:
 	case ASN_COUNTER:
 	case ASN_GAUGE:
-		value = *pdu->variables->val.integer;
+		dest->value = *var->val.integer;
 		break;
 	case ASN_TIMETICKS:
 		/* convert timeticks to seconds */
-		value = *pdu->variables->val.integer / 100;
+		dest->value = *var->val.integer / 100;
 		break;
 	case ASN_OBJECT_ID:
-		snprint_objid (tmp_buf, sizeof(tmp_buf), pdu->variables->val.objid, pdu->variables->val_len / sizeof(oid));
+		snprint_objid (tmp_buf, sizeof(tmp_buf), var->val.objid, var->val_len / sizeof(oid));
 		upsdebugx(2, "Received an OID value: %s", tmp_buf);
 		/* Try to get the value of the pointed OID */
-		if (nut_snmp_get_int(tmp_buf, &value) == FALSE) {
+		if (nut_snmp_get_int(tmp_buf, &dest->value) == FALSE) {
 			char	*oid_leaf;
 			upsdebugx(3, "Failed to retrieve OID value, using fallback");
 			/* Otherwise return the last part of the returned OID (ex: 1.2.3 => 3) */
 			oid_leaf = strrchr(tmp_buf, '.');
-			value = strtol(oid_leaf+1, NULL, 0);
-			upsdebugx(3, "Fallback value: %ld", value);
+			dest->value = strtol(oid_leaf+1, NULL, 0);
+			upsdebugx(3, "Fallback value: %ld", dest->value);
 		}
 		break;
 	default:
 		upslogx(LOG_ERR, "[%s] unhandled ASN 0x%x received from %s",
-			upsname?upsname:device_name, pdu->variables->type, OID);
+			upsname?upsname:device_name, var->type, dest->OID);
 		return FALSE;
 	}
 
-	snmp_free_pdu(pdu);
+	return TRUE;
+}
+
+bool_t nut_snmp_get_int(const char *OID, long *pval)
+{
+	su_var_dest_t	dest;
+
+	upsdebugx(3, "Entering %s()", __func__);
+
+	dest.OID = OID;
+	dest.value = 0;
+
+	if (nut_snmp_get_var(OID, su_var_int, &dest) == FALSE)
+		return FALSE;
 
 	if (pval != NULL)
-		*pval = value;
+		*pval = dest.value;
 
 	return TRUE;
 }
 
+/* while not NULL, nut_snmp_set() adds to this request instead of sending
+ * one of its own, see su_setOID_batch() */
+static struct snmp_pdu *set_batch = NULL;
+
 bool_t nut_snmp_set(const char *OID, char type, const char *value)
 {
 	int status;
@@ -1483,7 +2336,7 @@ bool_t nut_snmp_set(const char *OID, char type, const char *value)
 		return FALSE;
 	}
 
-	pdu = snmp_pdu_create(SNMP_MSG_SET);
+	pdu = set_batch ? set_batch : snmp_pdu_create(SNMP_MSG_SET);
 	if (pdu == NULL)
 		fatalx(EXIT_FAILURE, "Not enough memory");
 
@@ -1494,9 +2347,12 @@ bool_t nut_snmp_set(const char *OID, char type, const char *value)
 		return FALSE;
 	}
 
-	status = snmp_synch_response(g_snmp_sess_p, pdu, &response);
+	if (set_batch)
+		return TRUE;
+
+	status = nut_snmp_synch_response(pdu, &response);
 
-	if ((status == STAT_SUCCESS) && (response->errstat == SNMP_ERR_NOERROR))
+	if ((status == STAT_SUCCESS) && response && (response->errstat == SNMP_ERR_NOERROR))
 		ret = TRUE;
 	else
 		nut_snmp_perror(g_snmp_sess_p, status, response,
@@ -1619,8 +2475,10 @@ static void disable_transfer_oids(void)
 }
 
 /* Universal function to add or update info element.
- * If value is NULL, use the default one (su_info_p->dfl) if provided */
-void su_setinfo(snmp_info_t *su_info_p, const char *value)
+ * If value is NULL, use the default one (su_info_p->dfl) if provided,
+ * unless a number (dvalue) to publish with <precision> decimals is */
+static void su_setinfo_value(snmp_info_t *su_info_p, const char *value,
+	const double *dvalue, int precision)
 {
 	info_lkp_t	*info_lkp;
 	char info_type[128]; /* We tweak incoming "su_info_p->info_type" value in some cases */
@@ -1708,7 +2566,9 @@ void su_setinfo(snmp_info_t *su_info_p, const char *value)
 	if ((strcasecmp(su_info_p->info_type, "ups.status"))
 		&& (strcasecmp(strrchr(su_info_p->info_type, '.'), ".alarm")))
 	{
-		if (value != NULL)
+		if (dvalue != NULL)
+			dstate_setinfo_double(info_type, *dvalue, precision, 0);
+		else if (value != NULL)
 			dstate_setinfo(info_type, "%s", value);
 		else if (su_info_p->dfl != NULL)
 			dstate_setinfo(info_type, "%s", su_info_p->dfl);
@@ -1740,6 +2600,11 @@ void su_setinfo(snmp_info_t *su_info_p, const char *value)
 	}
 }
 
+void su_setinfo(snmp_info_t *su_info_p, const char *value)
+{
+	su_setinfo_value(su_info_p, value, NULL, 0);
+}
+
 void su_status_set(snmp_info_t *su_info_p, long value)
 {
 	const char *info_value = NULL;
@@ -1819,10 +2684,64 @@ void su_alarm_set(snmp_info_t *su_info_p, long value)
 	/* TODO: else */
 }
 
+/* The entries of snmp_info by info_type (case-insensitive), indexed when
+ * it is first searched and again whenever it points at another table: a
+ * MIB mapping has hundreds of them, and su_find_info() is used on each
+ * setvar, instcmd and template lookup. Only the first entry of a given
+ * info_type is kept, which is the one a scan would find. */
+static struct {
+	const snmp_info_t	*table;
+	size_t	*slot;		/* 1 + the entry, or 0 if free */
+	size_t	size;		/* a power of 2 */
+} su_info_index;
+
+static size_t su_info_slot(const char *type)
+{
+	return str_hash_nocase(type) & (su_info_index.size - 1);
+}
+
+static void su_info_index_free(void)
+{
+	free(su_info_index.slot);
+	su_info_index.slot = NULL;
+	su_info_index.size = 0;
+	su_info_index.table = NULL;
+}
+
+static void su_info_index_make(void)
+{
+	size_t	i, j, n;
+
+	su_info_index_free();
+	for (n = 0; snmp_info[n].info_type != NULL; n++)
+		;
+
+	for (su_info_index.size = 64; su_info_index.size < n * 2; su_info_index.size *= 2)
+		;
+	su_info_index.slot = xcalloc(su_info_index.size, sizeof(*su_info_index.slot));
+	su_info_index.table = snmp_info;
+
+	for (i = 0; i < n; i++) {
+		for (j = su_info_slot(snmp_info[i].info_type);
+			su_info_index.slot[j] != 0;
+			j = (j + 1) & (su_info_index.size - 1)
+		) {
+			if (!strcasecmp(snmp_info[su_info_index.slot[j] - 1].info_type,
+				snmp_info[i].info_type))
+				break;
+		}
+		if (su_info_index.slot[j] == 0)
+			su_info_index.slot[j] = i + 1;
+	}
+
+	upsdebugx(5, "%s: indexed the %" PRIuSIZE " entries of snmp_info",
+		__func__, n);
+}
+
 /* find info element definition in my info array. */
 snmp_info_t *su_find_info(const char *type)
 {
-	snmp_info_t *su_info_p;
+	size_t	i;
 
 	if (snmp_info == NULL) {
 		fatalx(EXIT_FAILURE, "%s: snmp_info is not initialized", __func__);
@@ -1832,11 +2751,20 @@ snmp_info_t *su_find_info(const char *type)
 		upsdebugx(1, "%s: WARNING: snmp_info is empty", __func__);
 	}
 
-	for (su_info_p = &snmp_info[0]; (su_info_p != NULL && su_info_p->info_type != NULL) ; su_info_p++)
+	if (su_info_index.table != snmp_info) {
+		su_info_index_make();
+	}
+
+	for (i = su_info_slot(type); su_info_index.slot[i] != 0;
+		i = (i + 1) & (su_info_index.size - 1)
+	) {
+		snmp_info_t	*su_info_p = &snmp_info[su_info_index.slot[i] - 1];
+
 		if (!strcasecmp(su_info_p->info_type, type)) {
 			upsdebugx(3, "%s: \"%s\" found", __func__, type);
 			return su_info_p;
 		}
+	}
 
 	upsdebugx(3, "%s: unknown info type (%s)", __func__, type);
 	return NULL;
@@ -1892,6 +2820,73 @@ static bool_t match_model_OID(void)
 	return retCode;
 }
 
+/* The mib2nut entries by their sysOID, parsed once: a hash table of
+ * sysoid_index.size slots (a power of 2) holding 1 + the entry, 0 if free.
+ * The entries of a given sysOID follow each other in the order of the
+ * mib2nut table, so that the first one to match is found first. */
+static struct {
+	size_t	*slot, size;
+	oid	**oids;		/* the sysOID of each entry, NULL if none */
+	size_t	*lens, n;
+} sysoid_index;
+
+static size_t sysoid_slot(const oid *name, size_t len)
+{
+	return fnv1a_hash(FNV1A_INIT, name, len * sizeof(*name)) & (sysoid_index.size - 1);
+}
+
+static void sysoid_index_make(void)
+{
+	oid	name[MAX_OID_LEN];
+	size_t	i, j, len;
+
+	for (sysoid_index.n = 0; mib2nut[sysoid_index.n] != NULL; sysoid_index.n++)
+		;
+	for (sysoid_index.size = 64; sysoid_index.size < sysoid_index.n * 2; sysoid_index.size *= 2)
+		;
+
+	sysoid_index.slot = xcalloc(sysoid_index.size, sizeof(*sysoid_index.slot));
+	sysoid_index.oids = xcalloc(sysoid_index.n, sizeof(*sysoid_index.oids));
+	sysoid_index.lens = xcalloc(sysoid_index.n, sizeof(*sysoid_index.lens));
+
+	for (i = 0; i < sysoid_index.n; i++) {
+		if (mib2nut[i]->sysOID == NULL)
+			continue;
+
+		len = MAX_OID_LEN;
+		if (!read_objid(mib2nut[i]->sysOID, name, &len)) {
+			upsdebugx(2, "%s: can't build OID %s: %s",
+				__func__, mib2nut[i]->sysOID, snmp_api_errstring(snmp_errno));
+			continue;
+		}
+
+		sysoid_index.oids[i] = xcalloc(len, sizeof(oid));
+		memcpy(sysoid_index.oids[i], name, len * sizeof(oid));
+		sysoid_index.lens[i] = len;
+
+		for (j = sysoid_slot(name, len); sysoid_index.slot[j] != 0;
+			j = (j + 1) & (sysoid_index.size - 1))
+			;
+		sysoid_index.slot[j] = i + 1;
+	}
+
+	upsdebugx(5, "%s: indexed the sysOID of %" PRIuSIZE " MIB mappings",
+		__func__, sysoid_index.n);
+}
+
+static void sysoid_index_free(void)
+{
+	size_t	i;
+
+	for (i = 0; i < sysoid_index.n; i++) {
+		free(sysoid_index.oids[i]);
+	}
+	free(sysoid_index.oids);
+	free(sysoid_index.lens);
+	free(sysoid_index.slot);
+	memset(&sysoid_index, 0, sizeof(sysoid_index));
+}
+
 /* Try to find the MIB using sysOID matching.
  * Return a pointer to a mib2nut definition if found, NULL otherwise */
 static mib2nut_info_t *match_sysoid(void)
@@ -1899,9 +2894,7 @@ static mib2nut_info_t *match_sysoid(void)
 	char sysOID_buf[LARGEBUF];
 	oid device_sysOID[MAX_OID_LEN];
 	size_t device_sysOID_len = MAX_OID_LEN;
-	oid mib2nut_sysOID[MAX_OID_LEN];
-	size_t mib2nut_sysOID_len = MAX_OID_LEN;
-	int i;
+	size_t i, j;
 
 	/* Retrieve sysOID value of this device */
 	if (nut_snmp_get_oid(SYSOID_OID, sysOID_buf, sizeof(sysOID_buf)) != TRUE)
@@ -1925,30 +2918,20 @@ static mib2nut_info_t *match_sysoid(void)
 		return NULL;
 	}
 
-	/* Now, iterate on mib2nut definitions */
-	for (i = 0; mib2nut[i] != NULL; i++)
-	{
-		upsdebugx(1, "%s: checking MIB %s", __func__, mib2nut[i]->mib_name);
-
-		if (mib2nut[i]->sysOID == NULL)
-			continue;
-
-		/* Clear variables */
-		memset(mib2nut_sysOID, 0, sizeof(mib2nut_sysOID));
-		mib2nut_sysOID_len = MAX_OID_LEN;
-
-		if (!read_objid(mib2nut[i]->sysOID, mib2nut_sysOID, &mib2nut_sysOID_len))
-		{
-			upsdebugx(2, "%s: can't build OID %s: %s",
-				__func__, sysOID_buf, snmp_api_errstring(snmp_errno));
+	if (sysoid_index.slot == NULL) {
+		sysoid_index_make();
+	}
 
-			/* Try to continue anyway! */
-			continue;
-		}
+	/* Now, iterate on the mib2nut definitions of this sysOID */
+	for (j = sysoid_slot(device_sysOID, device_sysOID_len); sysoid_index.slot[j] != 0;
+		j = (j + 1) & (sysoid_index.size - 1))
+	{
+		i = sysoid_index.slot[j] - 1;
 
 		/* Now compare these */
 		upsdebugx(1, "%s: comparing %s with %s", __func__, sysOID_buf, mib2nut[i]->sysOID);
-		if (!netsnmp_oid_equals(device_sysOID, device_sysOID_len, mib2nut_sysOID, mib2nut_sysOID_len))
+		if (!netsnmp_oid_equals(device_sysOID, device_sysOID_len,
+			sysoid_index.oids[i], sysoid_index.lens[i]))
 		{
 			upsdebugx(2, "%s: sysOID matches MIB '%s'!", __func__, mib2nut[i]->mib_name);
 			/* Counter verify, using {ups,device}.model */
@@ -1956,14 +2939,14 @@ static mib2nut_info_t *match_sysoid(void)
 
 			if (snmp_info == NULL) {
 				upsdebugx(0, "%s: WARNING: snmp_info is not initialized "
-					"for mapping table entry #%d \"%s\"",
+					"for mapping table entry #%" PRIuSIZE " \"%s\"",
 					__func__, i, mib2nut[i]->mib_name
 					);
 				continue;
 			}
 			else if (snmp_info[0].info_type == NULL) {
 				upsdebugx(1, "%s: WARNING: snmp_info is empty "
-					"for mapping table entry #%d \"%s\"",
+					"for mapping table entry #%" PRIuSIZE " \"%s\"",
 					__func__, i, mib2nut[i]->mib_name);
 			}
 
@@ -2008,7 +2991,11 @@ bool_t load_mib2nut(const char *mib)
 	/* First, try to match against sysOID, if no MIB was provided.
 	 * This should speed up init stage
 	 * (Note: sysOID points the device main MIB entry point) */
-	if (mibIsAuto)
+	if (mibIsAuto && (m2n = su_topo_mib()) != NULL) {
+		upsdebugx(2, "%s: using the '%s' MIB found by the last start",
+			__func__, m2n->mib_name);
+	}
+	else if (mibIsAuto)
 	{
 		upsdebugx(2, "%s: trying the new match_sysoid() method with %s",
 			__func__, mib);
@@ -2123,20 +3110,41 @@ bool_t load_mib2nut(const char *mib)
 	return FALSE;
 }
 
+/* how lkp_index() reads the oid2info tables, which end with a NULL or
+ * "NULL" info_value */
+static int su_lkp_is_end(const void *entry)
+{
+	const info_lkp_t	*info_lkp = entry;
+
+	return (info_lkp->info_value == NULL || !strcmp(info_lkp->info_value, "NULL"));
+}
+
+static long su_lkp_num(const void *entry)
+{
+	return ((const info_lkp_t *)entry)->oid_value;
+}
+
+static const char *su_lkp_str(const void *entry)
+{
+	return ((const info_lkp_t *)entry)->info_value;
+}
+
+static const lkp_index_ops_t	su_lkp_ops = { su_lkp_is_end, su_lkp_num, su_lkp_str };
+
 /* find the OID value matching that INFO_* value */
 long su_find_valinfo(info_lkp_t *oid2info, const char* value)
 {
-	info_lkp_t *info_lkp;
+	const info_lkp_t *info_lkp = NULL;
 
-	for (info_lkp = oid2info; (info_lkp != NULL) &&
-		(strcmp(info_lkp->info_value, "NULL")); info_lkp++) {
-
-		if (!(strcmp(info_lkp->info_value, value))) {
-			upsdebugx(1, "%s: found %s (value: %s)",
-					__func__, info_lkp->info_value, value);
+	if (oid2info != NULL) {
+		info_lkp = (const info_lkp_t *)lkp_find_str(
+			lkp_index(oid2info, sizeof(*oid2info), &su_lkp_ops), value);
+	}
+	if (info_lkp != NULL) {
+		upsdebugx(1, "%s: found %s (value: %s)",
+				__func__, info_lkp->info_value, value);
 
-			return info_lkp->oid_value;
-		}
+		return info_lkp->oid_value;
 	}
 	upsdebugx(1, "%s: no matching INFO_* value for this OID value (%s)", __func__, value);
 	return -1;
@@ -2166,7 +3174,7 @@ const char *su_find_strval(info_lkp_t *oid2info, void *value)
 /* find the INFO_* value matching that OID numeric (long) value */
 const char *su_find_infoval(info_lkp_t *oid2info, void *raw_value)
 {
-	info_lkp_t *info_lkp;
+	const info_lkp_t *info_lkp = NULL;
 	long value = *((long *)raw_value);
 
 #if WITH_SNMP_LKP_FUN
@@ -2182,15 +3190,15 @@ const char *su_find_infoval(info_lkp_t *oid2info, void *raw_value)
 #endif /* WITH_SNMP_LKP_FUN */
 
 	/* Otherwise, use the simple values mapping */
-	for (info_lkp = oid2info; (info_lkp != NULL) &&
-		 (info_lkp->info_value != NULL) && (strcmp(info_lkp->info_value, "NULL")); info_lkp++) {
-
-		if (info_lkp->oid_value == value) {
-			upsdebugx(1, "%s: found %s (value: %ld)",
-					__func__, info_lkp->info_value, value);
+	if (oid2info != NULL) {
+		info_lkp = (const info_lkp_t *)lkp_find_num(
+			lkp_index(oid2info, sizeof(*oid2info), &su_lkp_ops), value);
+	}
+	if (info_lkp != NULL) {
+		upsdebugx(1, "%s: found %s (value: %ld)",
+				__func__, info_lkp->info_value, value);
 
-			return info_lkp->info_value;
-		}
+		return info_lkp->info_value;
 	}
 	upsdebugx(1, "%s: no matching INFO_* value for this OID value (%ld)", __func__, value);
 	return NULL;
@@ -2311,6 +3319,7 @@ static snmp_info_t *instantiate_info(snmp_info_t *info_template, snmp_info_t *ne
 	new_instance->dfl = info_template->dfl;
 	new_instance->flags = info_template->flags;
 	new_instance->oid2info = info_template->oid2info;
+	new_instance->poll_class = info_template->poll_class;
 
 	upsdebugx(2, "instantiate_info: template instantiated");
 	return new_instance;
@@ -2395,7 +3404,7 @@ static int base_snmp_template_index(const snmp_info_t *su_info_p)
 				snprintf_dynamic(test_OID, sizeof(test_OID), su_info_p->OID, "%i", base_index);
 			}
 
-			if (nut_snmp_get(test_OID) != NULL) {
+			if (nut_snmp_get_var(test_OID, NULL, NULL) == TRUE) {
 				if (su_info_p->flags & SU_FLAG_ZEROINVALID) {
 					long value;
 					if ((nut_snmp_get_int(test_OID, &value)) && (value!=0)) {
@@ -2427,8 +3436,217 @@ static int base_snmp_template_index(const snmp_info_t *su_info_p)
 			device_template_index_base = base_index;
 	}
 
-	upsdebugx(3, "%s: template_index_base = %i", __func__, base_index);
-	return base_index;
+	upsdebugx(3, "%s: template_index_base = %i", __func__, base_index);
+	return base_index;
+}
+
+/* -----------------------------------------------------------
+ * Discovery cache: with the "discoverycache" flag, the MIB which the
+ * startup matched and the instance counts of the templates it probed for
+ * (which on a daisy-chain of PDUs means hundreds of requests) are saved
+ * in a file of the state path, along with the agent and its sysObjectID.
+ * The next start of the driver for the same device checks these with a
+ * request or two each instead, and probes them in full if they differ.
+ * ----------------------------------------------------------- */
+
+typedef struct {
+	char	*OID;		/* the template */
+	int	base, count;	/* its first index, and the instances from there */
+} su_topo_count_t;
+
+static struct {
+	char	*fn;		/* NULL if not in use */
+	char	*sysOID;	/* of the device now */
+	char	*mib;		/* of the file, if the same device */
+	su_topo_count_t	*counts;
+	size_t	ncounts, countsalloc;
+	int	dirty;		/* differs from the file */
+} su_topo;
+
+static su_topo_count_t *su_topo_count(const char *OID_template)
+{
+	size_t	i;
+
+	for (i = 0; i < su_topo.ncounts; i++) {
+		if (!strcmp(su_topo.counts[i].OID, OID_template))
+			return &su_topo.counts[i];
+	}
+
+	return NULL;
+}
+
+static void su_topo_set_count(const char *OID_template, int base, int count)
+{
+	su_topo_count_t	*c;
+
+	if (!su_topo.fn) {
+		return;
+	}
+
+	if ((c = su_topo_count(OID_template)) == NULL) {
+		if (su_topo.ncounts == su_topo.countsalloc) {
+			su_topo.countsalloc = su_topo.countsalloc ? su_topo.countsalloc * 2 : 16;
+			su_topo.counts = xrealloc(su_topo.counts,
+				su_topo.countsalloc * sizeof(*su_topo.counts));
+		}
+		c = &su_topo.counts[su_topo.ncounts++];
+		c->OID = xstrdup(OID_template);
+	} else if (c->base == base && c->count == count) {
+		return;
+	}
+
+	c->base = base;
+	c->count = count;
+	su_topo.dirty = 1;
+}
+
+static void su_topo_free(void)
+{
+	size_t	i;
+
+	for (i = 0; i < su_topo.ncounts; i++) {
+		free(su_topo.counts[i].OID);
+	}
+	free(su_topo.counts);
+	free(su_topo.fn);
+	free(su_topo.sysOID);
+	free(su_topo.mib);
+	memset(&su_topo, 0, sizeof(su_topo));
+}
+
+static void su_topo_load(void)
+{
+	char	fn[NUT_PATH_MAX + 1], buf[LARGEBUF], sysOID[LARGEBUF];
+	char	*agent = NULL, *fsysOID = NULL;
+	FILE	*f;
+
+	if (!testvar(SU_VAR_DISCOVERYCACHE)) {
+		return;
+	}
+
+	snprintf(fn, sizeof(fn), "%s/%s-%s.discovery", dflt_statepath(), progname, upsname);
+	su_topo.fn = xstrdup(fn);
+
+	/* this one request tells whether it is still the same kind of device */
+	if (nut_snmp_get_oid(SYSOID_OID, sysOID, sizeof(sysOID)) != TRUE
+	 && nut_snmp_get_str(SYSOID_OID, sysOID, sizeof(sysOID), NULL) != TRUE
+	) {
+		sysOID[0] = '\0';
+	}
+	su_topo.sysOID = xstrdup(sysOID);
+	su_topo.dirty = 1;
+
+	if ((f = fopen(fn, "r")) == NULL) {
+		upsdebugx(2, "%s: no discovery cache %s yet", __func__, fn);
+		return;
+	}
+
+	while (fgets(buf, sizeof(buf), f)) {
+		char	*val = strchr(buf, ' '), *nl = strchr(buf, '\n');
+		int	base, count, off = 0;
+
+		if (nl)
+			*nl = '\0';
+		if (buf[0] == '#' || val == NULL)
+			continue;
+		*val++ = '\0';
+
+		if (!strcmp(buf, "agent")) {
+			free(agent);
+			agent = xstrdup(val);
+		} else if (!strcmp(buf, "sysoid")) {
+			free(fsysOID);
+			fsysOID = xstrdup(val);
+		} else if (!strcmp(buf, "mib")) {
+			free(su_topo.mib);
+			su_topo.mib = xstrdup(val);
+		} else if (!strcmp(buf, "count")
+			&& sscanf(val, "%i %i %n", &base, &count, &off) == 2 && off > 0
+		) {
+			su_topo_set_count(val + off, base, count);
+		}
+	}
+	fclose(f);
+
+	if (!agent || strcmp(agent, device_path) || !fsysOID || strcmp(fsysOID, sysOID)) {
+		upsdebugx(1, "%s: %s is of another device, ignored", __func__, fn);
+		su_topo_free();
+		su_topo.fn = xstrdup(fn);
+		su_topo.sysOID = xstrdup(sysOID);
+	} else {
+		upsdebugx(1, "%s: read the discovery cache %s", __func__, fn);
+	}
+	su_topo.dirty = (su_topo.mib == NULL);
+
+	free(agent);
+	free(fsysOID);
+}
+
+static void su_topo_save(void)
+{
+	char	tmpfn[NUT_PATH_MAX + 1];
+	size_t	i;
+	FILE	*f;
+
+	if (!su_topo.fn || !mibname) {
+		return;
+	}
+	if (!su_topo.dirty && su_topo.mib && !strcmp(su_topo.mib, mibname)) {
+		upsdebugx(2, "%s: the discovery cache is up to date", __func__);
+		return;
+	}
+
+	snprintf(tmpfn, sizeof(tmpfn), "%s.%ld.tmp", su_topo.fn, (long)getpid());
+	if ((f = fopen(tmpfn, "w")) == NULL) {
+		upslog_with_errno(LOG_WARNING, "Can't write the discovery cache %s", tmpfn);
+		return;
+	}
+
+	fprintf(f, "# %s discovery cache, remove to probe the device in full\n", progname);
+	fprintf(f, "agent %s\n", device_path);
+	fprintf(f, "sysoid %s\n", su_topo.sysOID);
+	fprintf(f, "mib %s\n", mibname);
+	for (i = 0; i < su_topo.ncounts; i++) {
+		fprintf(f, "count %i %i %s\n", su_topo.counts[i].base,
+			su_topo.counts[i].count, su_topo.counts[i].OID);
+	}
+
+	if (fclose(f) != 0 || rename(tmpfn, su_topo.fn) != 0) {
+		upslog_with_errno(LOG_WARNING, "Can't write the discovery cache %s", su_topo.fn);
+		unlink(tmpfn);
+		return;
+	}
+
+	upsdebugx(1, "%s: wrote the discovery cache %s", __func__, su_topo.fn);
+	su_topo.dirty = 0;
+}
+
+/* the MIB which the last start matched, if it still does */
+static mib2nut_info_t *su_topo_mib(void)
+{
+	int	i;
+
+	if (!su_topo.mib) {
+		return NULL;
+	}
+
+	for (i = 0; mib2nut[i] != NULL; i++) {
+		if (strcmp(mib2nut[i]->mib_name, su_topo.mib) || !mib2nut[i]->snmp_info)
+			continue;
+
+		snmp_info = mib2nut[i]->snmp_info;
+		if (match_model_OID() == TRUE) {
+			return mib2nut[i];
+		}
+		break;
+	}
+
+	upsdebugx(1, "%s: the '%s' MIB of the discovery cache does not match",
+		__func__, su_topo.mib);
+	snmp_info = NULL;
+	su_topo.dirty = 1;
+
+	return NULL;
 }
 
 /* Try to determine the number of items (outlets, outlet groups, ...),
@@ -2441,6 +3659,8 @@ static int guesstimate_template_count(snmp_info_t *su_info_p)
 	int base_count;
 	const char *OID_template = su_info_p->OID;
 
+	const su_topo_count_t	*cached;
+
 	upsdebugx(1, "%s(%s)", __func__, OID_template);
 
 	/* Test if OID is indexed: safeguard for infinite loop */
@@ -2449,10 +3669,26 @@ static int guesstimate_template_count(snmp_info_t *su_info_p)
 		return 0;
 	}
 
+	/* As many as the last start found, if the last one is there and
+	 * the one after it is not */
+	if ((cached = su_topo_count(OID_template)) != NULL && cached->count > 0) {
+		snprintf_dynamic(test_OID, sizeof(test_OID), OID_template, "%i",
+			cached->base + cached->count - 1);
+		if (nut_snmp_get_var(test_OID, NULL, NULL) == TRUE) {
+			snprintf_dynamic(test_OID, sizeof(test_OID), OID_template, "%i",
+				cached->base + cached->count);
+			if (nut_snmp_get_var(test_OID, NULL, NULL) == FALSE) {
+				upsdebugx(3, "%s: %i, as cached", __func__, cached->count);
+				return cached->count;
+			}
+		}
+		upsdebugx(2, "%s: the cached count %i does not match", __func__, cached->count);
+	}
+
 	/* Determine if OID index starts from 0 or 1? */
 	snprintf_dynamic(test_OID, sizeof(test_OID), OID_template, "%i", base_index);
 
-	if (nut_snmp_get(test_OID) == NULL) {
+	if (nut_snmp_get_var(test_OID, NULL, NULL) == FALSE) {
 		base_index++;
 	}
 	else {
@@ -2467,11 +3703,12 @@ static int guesstimate_template_count(snmp_info_t *su_info_p)
 	/* Now, actually iterate */
 	for (base_count = 0 ;  ; base_count++) {
 		snprintf_dynamic(test_OID, sizeof(test_OID), OID_template, "%i", base_index + base_count);
-		if (nut_snmp_get(test_OID) == NULL)
+		if (nut_snmp_get_var(test_OID, NULL, NULL) == FALSE)
 			break;
 	}
 
 	upsdebugx(3, "%s: %i", __func__, base_count);
+	su_topo_set_count(OID_template, base_index, base_count);
 	return base_count;
 }
 
@@ -3069,8 +4306,372 @@ static int process_phase_data(const char* type, long *nb_phases, snmp_info_t *su
 }
 
 
+/* does the OID of an entry (its template, with "%i" or "%d" for any
+ * index) match <oid>, with or without their leading dots? */
+static int su_trap_oid_match(const char *tmpl, const char *oid)
+{
+	if (*tmpl == '.')
+		tmpl++;
+	if (*oid == '.')
+		oid++;
+
+	while (*tmpl != '\0') {
+		if (tmpl[0] == '%' && (tmpl[1] == 'i' || tmpl[1] == 'd')) {
+			if (!isdigit((unsigned char)*oid))
+				return 0;
+			while (isdigit((unsigned char)*oid))
+				oid++;
+			tmpl += 2;
+			continue;
+		}
+		if (*tmpl++ != *oid++)
+			return 0;
+	}
+
+	return *oid == '\0';
+}
+
+/* note which entries a trap names, for the walk it causes */
+static void su_trap_hit(const char *oid)
+{
+	snmp_info_t	*su_info_p;
+	size_t	i;
+
+	for (su_info_p = &snmp_info[0]; su_info_p->info_type != NULL; su_info_p++) {
+		if (su_info_p->OID == NULL || !su_trap_oid_match(su_info_p->OID, oid))
+			continue;
+
+		for (i = 0; i < su_trap.nhits && su_trap.hits[i] != su_info_p; i++)
+			;
+		if (i < su_trap.nhits)
+			continue;
+
+		if (su_trap.nhits == SU_TRAP_MAXHITS) {
+			su_trap.all = 1;
+			return;
+		}
+		upsdebugx(3, "%s: %s names %s", __func__, oid, su_info_p->info_type);
+		su_trap.hits[su_trap.nhits++] = su_info_p;
+	}
+}
+
+static int su_trap_callback(int op, netsnmp_session *session, int reqid,
+	netsnmp_pdu *pdu, void *magic)
+{
+	const char	*community;
+	netsnmp_variable_list	*vars;
+	char	oid[SU_INFOSIZE];
+
+	NUT_UNUSED_VARIABLE(reqid);
+	NUT_UNUSED_VARIABLE(magic);
+
+	if (op != NETSNMP_CALLBACK_OP_RECEIVED_MESSAGE || pdu == NULL)
+		return 1;
+
+	if (pdu->command != SNMP_MSG_TRAP && pdu->command != SNMP_MSG_TRAP2
+	 && pdu->command != SNMP_MSG_INFORM
+	) {
+		upsdebugx(2, "%s: ignoring a PDU of type %d", __func__, pdu->command);
+		return 1;
+	}
+
+	/* SNMPv3 ones were authenticated by the library already */
+	if (pdu->version != SNMP_VERSION_3) {
+		community = testvar(SU_VAR_TRAPCOMMUNITY) ? getval(SU_VAR_TRAPCOMMUNITY)
+			: testvar(SU_VAR_COMMUNITY) ? getval(SU_VAR_COMMUNITY) : "public";
+
+		if (pdu->community == NULL || pdu->community_len != strlen(community)
+		 || memcmp(pdu->community, community, pdu->community_len)
+		) {
+			upsdebugx(1, "%s: ignoring a trap with another community", __func__);
+			return 1;
+		}
+	}
+
+	if (pdu->command == SNMP_MSG_INFORM) {
+		netsnmp_pdu	*reply = snmp_clone_pdu(pdu);
+
+		if (reply != NULL) {
+			reply->command = SNMP_MSG_RESPONSE;
+			reply->errstat = 0;
+			reply->errindex = 0;
+			if (!snmp_send(session, reply)) {
+				upsdebugx(1, "%s: can't acknowledge the inform", __func__);
+				snmp_free_pdu(reply);
+			}
+		}
+	}
+
+	upsdebugx(1, "%s: received %s", __func__,
+		(pdu->command == SNMP_MSG_INFORM) ? "an inform" : "a trap");
+
+	for (vars = pdu->variables; vars != NULL; vars = vars->next_variable) {
+		snprint_objid(oid, sizeof(oid), vars->name, vars->name_length);
+		su_trap_hit(oid);
+	}
+	su_trap.pending = 1;
+
+	return 1;
+}
+
+/* listen on the "traplisten" transport: its socket wakes the main loop */
+static void su_trap_open(void)
+{
+	const char	*spec;
+	netsnmp_transport	*transport;
+	netsnmp_session	sess;
+
+	if (!testvar(SU_VAR_TRAPLISTEN))
+		return;
+	spec = getval(SU_VAR_TRAPLISTEN);
+
+	transport = netsnmp_transport_open_server("snmptrap", spec);
+	if (transport == NULL) {
+		upslogx(LOG_ERR, "Can't listen for traps on %s (a port below 1024"
+			" needs the driver to keep the privileges)", spec);
+		return;
+	}
+
+	snmp_sess_init(&sess);
+	sess.peername = SNMP_DEFAULT_PEERNAME;
+	sess.version = SNMP_DEFAULT_VERSION;
+	sess.community_len = SNMP_DEFAULT_COMMUNITY_LEN;
+	sess.retries = SNMP_DEFAULT_RETRIES;
+	sess.timeout = SNMP_DEFAULT_TIMEOUT;
+	sess.callback = su_trap_callback;
+	sess.callback_magic = NULL;
+	sess.isAuthoritative = SNMP_SESS_UNKNOWNAUTH;
+
+	su_trap.sock = transport->sock;
+	su_trap.sess = snmp_add(&sess, transport, NULL, NULL);
+	if (su_trap.sess == NULL) {
+		upslogx(LOG_ERR, "Can't listen for traps on %s", spec);
+		su_trap.sock = -1;
+		return;
+	}
+
+#ifndef WIN32
+	extrafd = su_trap.sock;
+#endif	/* !WIN32 */
+
+	upslogx(LOG_INFO, "Listening for traps on %s", spec);
+}
+
+/* hand what came on the trap socket to su_trap_callback() */
+static void su_trap_read(void)
+{
+	fd_set	fds;
+	struct timeval	tv;
+	int	i;
+
+	if (su_trap.sess == NULL)
+		return;
+
+	/* not forever if the device floods us */
+	for (i = 0; i < 64; i++) {
+		FD_ZERO(&fds);
+		FD_SET(su_trap.sock, &fds);
+		tv.tv_sec = 0;
+		tv.tv_usec = 0;
+		if (select(su_trap.sock + 1, &fds, NULL, NULL, &tv) <= 0)
+			break;
+		snmp_read(&fds);
+	}
+}
+
+/* after a walk: forget what the traps named, unless more came meanwhile */
+static void su_trap_done(void)
+{
+	if (su_trap.pending)
+		return;
+
+	su_trap.nhits = 0;
+	su_trap.all = 0;
+}
+
+static void su_trap_close(void)
+{
+	if (su_trap.sess == NULL)
+		return;
+
+#ifndef WIN32
+	if (extrafd == su_trap.sock)
+		extrafd = ERROR_FD;
+#endif	/* !WIN32 */
+
+	snmp_close(su_trap.sess);
+	su_trap.sess = NULL;
+	su_trap.sock = -1;
+}
+
+/* does <type> match <pattern>, where a '*' stands for any characters? */
+static int su_poll_match(const char *pattern, const char *type)
+{
+	for (; *pattern != '\0'; pattern++, type++) {
+		if (*pattern == '*') {
+			for (; ; type++) {
+				if (su_poll_match(pattern + 1, type))
+					return 1;
+				if (*type == '\0')
+					return 0;
+			}
+		}
+		if (tolower((unsigned char)*pattern) != tolower((unsigned char)*type))
+			return 0;
+	}
+
+	return *type == '\0';
+}
+
+/* Set the polling class of each entry of the mapping: the one of the
+ * "pollclass" setting (of several patterns which match, the last one),
+ * or else the status and alarms are fast, the SU_FLAG_SEMI_STATIC
+ * entries slow, and the others normal */
+static void su_poll_class_init(void)
+{
+	static const char	*classes[] = { "auto", "fast", "normal", "slow", "demand" };
+	snmp_info_t	*su_info_p;
+	char	*buf = NULL, *item, *saveptr = NULL, **pattern = NULL;
+	su_poll_class_t	*pclass = NULL;
+	size_t	i, n = 0;
+
+	if (testvar(SU_VAR_POLLCLASS)) {
+		buf = xstrdup(getval(SU_VAR_POLLCLASS));
+		pattern = xcalloc(strlen(buf) / 2 + 1, sizeof(*pattern));
+		pclass = xcalloc(strlen(buf) / 2 + 1, sizeof(*pclass));
+	}
+
+	for (item = buf ? strtok_r(buf, ", ", &saveptr) : NULL; item != NULL;
+		item = strtok_r(NULL, ", ", &saveptr)
+	) {
+		char	*eq = strchr(item, '=');
+
+		if (eq == NULL) {
+			upsdebugx(1, "%s: ignoring '%s', not name=class", __func__, item);
+			continue;
+		}
+		*eq++ = '\0';
+
+		for (i = 0; i < SIZEOF_ARRAY(classes); i++) {
+			if (!strcasecmp(eq, classes[i]))
+				break;
+		}
+		if (i == SIZEOF_ARRAY(classes)) {
+			upsdebugx(1, "%s: ignoring unknown class '%s' of %s", __func__, eq, item);
+			continue;
+		}
+
+		pattern[n] = item;
+		pclass[n++] = (su_poll_class_t)i;
+	}
+
+	for (su_info_p = &snmp_info[0]; su_info_p->info_type != NULL; su_info_p++) {
+		const char	*dot = strrchr(su_info_p->info_type, '.');
+		su_poll_class_t	pc = SU_POLL_AUTO;
+
+		for (i = 0; i < n; i++) {
+			if (su_poll_match(pattern[i], su_info_p->info_type))
+				pc = pclass[i];
+		}
+
+		if (pc == SU_POLL_AUTO) {
+			if (!strcasecmp(su_info_p->info_type, "ups.status")
+			 || !strcasecmp(su_info_p->info_type, "ups.alarms")
+			 || (dot != NULL && !strcmp(dot, ".alarm"))
+			) {
+				pc = SU_POLL_FAST;
+			} else if (su_info_p->flags & SU_FLAG_SEMI_STATIC) {
+				pc = SU_POLL_SLOW;
+			} else {
+				pc = SU_POLL_NORMAL;
+			}
+		}
+
+		if (pc != su_info_p->poll_class) {
+			upsdebugx(3, "%s: %s polled as %s", __func__,
+				su_info_p->info_type, classes[pc]);
+		}
+		su_info_p->poll_class = pc;
+	}
+
+	free(pattern);
+	free(pclass);
+	free(buf);
+}
+
+/* is the entry to be read by the update walk going on? */
+static bool_t su_poll_due(const snmp_info_t *su_info_p)
+{
+	if (su_trap.walking) {
+		const char	*dot = strrchr(su_info_p->info_type, '.');
+		size_t	i;
+
+		if (su_trap.all
+		 || !strcasecmp(su_info_p->info_type, "ups.status")
+		 || !strcasecmp(su_info_p->info_type, "ups.alarms")
+		 || (dot != NULL && !strcmp(dot, ".alarm"))
+		) {
+			return TRUE;
+		}
+		for (i = 0; i < su_trap.nhits; i++) {
+			if (su_trap.hits[i] == su_info_p)
+				return TRUE;
+		}
+		return FALSE;
+	}
+
+	switch (su_info_p->poll_class)
+	{
+	case SU_POLL_NORMAL:
+		return (normal_countdown == 0) ? TRUE : FALSE;
+
+	case SU_POLL_SLOW:
+		if (semistatic_countdown != 0)
+			return FALSE;
+		upsdebugx(1, "Refreshing semi-static entry %s", su_info_p->OID);
+		return TRUE;
+
+	case SU_POLL_DEMAND:
+		return FALSE;
+
+	case SU_POLL_AUTO:
+	case SU_POLL_FAST:
+	default:
+		return TRUE;
+	}
+}
+
 /* walk ups variables and set elements of the info array. */
 bool_t snmp_ups_walk(int mode)
+{
+	bool_t status;
+
+	/* a walk for a trap reads few entries, outside of the cycles */
+	if (su_trap.walking) {
+		return snmp_ups_walk_devices(mode);
+	}
+
+	if (mode == SU_WALKMODE_UPDATE) {
+		semistatic_countdown--;
+		if (semistatic_countdown < 0)
+			semistatic_countdown = semistaticfreq;
+		normal_countdown--;
+		if (normal_countdown < 0)
+			normal_countdown = normalfreq - 1;
+	}
+	else {
+		su_poll_class_init();
+	}
+
+	/* update walks get most of their data in batches */
+	su_batch_begin(mode);
+	status = snmp_ups_walk_devices(mode);
+	su_batch_end();
+
+	return status;
+}
+
+static bool_t snmp_ups_walk_devices(int mode)
 {
 	long *walked_input_phases, *walked_output_phases, *walked_bypass_phases;
 #ifdef COUNT_ITERATIONS
@@ -3080,12 +4681,6 @@ bool_t snmp_ups_walk(int mode)
 	snmp_info_t *su_info_p;
 	bool_t status = FALSE;
 
-	if (mode == SU_WALKMODE_UPDATE) {
-		semistatic_countdown--;
-		if (semistatic_countdown < 0)
-			semistatic_countdown = semistaticfreq;
-	}
-
 	/* Loop through all device(s) */
 	/* Note: considering "unitary" and "daisy-chained" devices, we have
 	 * several variables (and their values) that can come into play:
@@ -3193,12 +4788,9 @@ bool_t snmp_ups_walk(int mode)
 			if ((mode == SU_WALKMODE_UPDATE) && !(su_info_p->flags & SU_FLAG_OK))
 				continue;
 
-			/* skip semi-static elements in update mode: only parse when countdown reaches 0 */
-			if ((mode == SU_WALKMODE_UPDATE) && (su_info_p->flags & SU_FLAG_SEMI_STATIC)) {
-				if (semistatic_countdown != 0)
-					continue;
-				upsdebugx(1, "Refreshing semi-static entry %s", su_info_p->OID);
-			}
+			/* skip the elements of the polling classes not due in this walk */
+			if ((mode == SU_WALKMODE_UPDATE) && !su_poll_due(su_info_p))
+				continue;
 
 			/* skip static elements in update mode */
 			if ((mode == SU_WALKMODE_UPDATE) && (su_info_p->flags & SU_FLAG_STATIC))
@@ -3320,17 +4912,47 @@ bool_t snmp_ups_walk(int mode)
 	return status;
 }
 
+/* an entry of a table of alarms: the OID of a present one */
+static bool_t su_var_alarm(const struct variable_list *var, void *arg)
+{
+	char buf[SU_INFOSIZE];
+	alarms_info_t * alarms;
+
+	NUT_UNUSED_VARIABLE(arg);
+
+	/* Retrieve the OID name, for comparison */
+	if (decode_oid(var, buf, sizeof(buf)) == TRUE) {
+		alarms = alarms_info;
+		while( alarms->OID ) {
+			if(!strcmp(buf, alarms->OID)) {
+				upsdebugx(3, "Alarm OID found => %s", alarms->OID);
+				/* Check for ups.status value */
+				if (alarms->status_value) {
+					upsdebugx(3, "Alarm value (status) found => %s", alarms->status_value);
+					status_set(alarms->status_value);
+				}
+				/* Check for ups.alarm value */
+				if (alarms->alarm_value) {
+					upsdebugx(3, "Alarm value (alarm) found => %s", alarms->alarm_value);
+					alarm_set(alarms->alarm_value);
+				}
+				break;
+			}
+			alarms++;
+		}
+	}
+
+	return TRUE;
+}
+
 bool_t su_ups_get(snmp_info_t *su_info_p)
 {
 	static char buf[SU_INFOSIZE];
 	bool_t status;
 	long value;
 	double dvalue;
+	int precision = -1;	/* if dvalue is the value, rather than buf */
 	const char *strValue = NULL;
-	struct snmp_pdu ** pdu_array;
-	struct snmp_pdu * current_pdu;
-	alarms_info_t * alarms;
-	int index = 0;
 	char *format_char = NULL;
 	int saved_current_device_number = -1;
 	snmp_info_t *tmp_info_p = NULL;
@@ -3483,39 +5105,10 @@ bool_t su_ups_get(snmp_info_t *su_info_p)
 					upsdebugx(2, "=> truncating alarms present to INT_MAX");
 					value = INT_MAX;
 				}
-				pdu_array = nut_snmp_walk(su_info_p->OID, (int)value);
-				if(pdu_array == NULL) {
+				if (nut_snmp_walk(su_info_p->OID, (int)value, su_var_alarm, NULL) == 0) {
 					upsdebugx(2, "=> Walk failed");
 					return FALSE;
 				}
-
-				current_pdu = pdu_array[index];
-				while(current_pdu) {
-					/* Retrieve the OID name, for comparison */
-					if (decode_oid(current_pdu, buf, sizeof(buf)) == TRUE) {
-						alarms = alarms_info;
-						while( alarms->OID ) {
-							if(!strcmp(buf, alarms->OID)) {
-								upsdebugx(3, "Alarm OID found => %s", alarms->OID);
-								/* Check for ups.status value */
-								if (alarms->status_value) {
-									upsdebugx(3, "Alarm value (status) found => %s", alarms->status_value);
-									status_set(alarms->status_value);
-								}
-								/* Check for ups.alarm value */
-								if (alarms->alarm_value) {
-									upsdebugx(3, "Alarm value (alarm) found => %s", alarms->alarm_value);
-									alarm_set(alarms->alarm_value);
-								}
-								break;
-							}
-							alarms++;
-						}
-					}
-					index++;
-					current_pdu = pdu_array[index];
-				}
-				nut_snmp_free(pdu_array);
 			}
 		}
 		else {
@@ -3557,8 +5150,8 @@ bool_t su_ups_get(snmp_info_t *su_info_p)
 			temp = value * su_info_p->info_len;
 		}
 
-		snprintf(buf, sizeof(buf), "%.1f", temp);
-		su_setinfo(su_info_p, buf);
+		dvalue = temp;
+		su_setinfo_value(su_info_p, NULL, &dvalue, 1);
 
 		free_info(tmp_info_p);
 		return TRUE;
@@ -3620,10 +5213,13 @@ bool_t su_ups_get(snmp_info_t *su_info_p)
 				 * FIXME: Use remainder? is (dvalue%1.0)>0 cleaner?
 				 */
 				dvalue = value * su_info_p->info_len;
-				if (f_equal((int)dvalue, dvalue))
-					snprintf(buf, sizeof(buf), "%i", (int)dvalue);
-				else
-					snprintf(buf, sizeof(buf), "%.2f", (float)dvalue);
+				if (f_equal((int)dvalue, dvalue)) {
+					dvalue = (int)dvalue;
+					precision = 0;
+				} else {
+					dvalue = (float)dvalue;
+					precision = 2;
+				}
 			}
 		}
 	}
@@ -3632,11 +5228,18 @@ bool_t su_ups_get(snmp_info_t *su_info_p)
 		if (saved_current_device_number >= 0) {
 			current_device_number = 1;
 		}
-		su_setinfo(su_info_p, buf);
+		if (precision >= 0) {
+			/* readings are published without formatting them
+			 * again and again while they do not change */
+			su_setinfo_value(su_info_p, NULL, &dvalue, precision);
+			upsdebugx(2, "=> value: %.*f", precision, dvalue);
+		} else {
+			su_setinfo(su_info_p, buf);
+			upsdebugx(2, "=> value: %s", buf);
+		}
 		if (saved_current_device_number >= 0) {
 			current_device_number = saved_current_device_number;
 		}
-		upsdebugx(2, "=> value: %s", buf);
 	}
 	else {
 		upsdebugx(2, "=> Failed");
@@ -3966,6 +5569,12 @@ static int su_setOID(int mode, const char *varname, const char *val)
 
 		retval = STAT_SET_FAILED;
 	}
+	else if (set_batch) {
+		/* sent (and published, for settings) by su_setOID_batch() */
+		retval = STAT_SET_HANDLED;
+		upsdebugx(2, "%s: %s '%s' added to the batch", __func__,
+			(mode==SU_MODE_INSTCMD)?"command":"setting", varname);
+	}
 	else {
 		retval = STAT_SET_HANDLED;
 		if (mode==SU_MODE_INSTCMD)
@@ -3987,6 +5596,118 @@ static int su_setOID(int mode, const char *varname, const char *val)
 	return retval;
 }
 
+static size_t su_set_batch_count(void)
+{
+	struct variable_list	*var;
+	size_t	count = 0;
+
+	for (var = set_batch->variables; var; var = var->next_variable)
+		count++;
+
+	return count;
+}
+
+/* drop the OIDs past the first <keep> of the batch if one of them is
+ * already among these: an agent need not apply the same OID twice in
+ * one request in order (think of "beeper.disable" then "beeper.enable") */
+static bool_t su_set_batch_split(size_t keep)
+{
+	struct variable_list	*last = NULL, *var, *prev;
+	size_t	i;
+
+	for (var = set_batch->variables, i = 0; var && i < keep; var = var->next_variable, i++)
+		last = var;
+
+	if (last == NULL)
+		return FALSE;
+
+	for (var = last->next_variable; var; var = var->next_variable) {
+		for (prev = set_batch->variables; prev != last->next_variable; prev = prev->next_variable) {
+			if (!netsnmp_oid_equals(var->name, var->name_length,
+				prev->name, prev->name_length))
+			{
+				snmp_free_varbind(last->next_variable);
+				last->next_variable = NULL;
+				return TRUE;
+			}
+		}
+	}
+
+	return FALSE;
+}
+
+/* Like su_setOID() for each of <count> settings or commands, but with the
+ * OIDs of up to SU_SET_BATCH_MAX of them in each SNMP SET request.
+ * An agent applies such a request as a whole or not at all, so when one
+ * fails, its items are tried again one by one to tell which are at fault.
+ * An item which sets an OID again goes in the next request.
+ */
+static void su_setOID_batch(int mode, size_t count, const char **name, const char **val, int *ret)
+{
+	int	*queued = xcalloc(count, sizeof(*queued));
+	size_t	i = 0, j, start, numvars;
+
+	while (i < count) {
+		struct snmp_pdu	*pdu, *response = NULL;
+		bool_t	ok;
+		int	status;
+
+		set_batch = snmp_pdu_create(SNMP_MSG_SET);
+		if (set_batch == NULL)
+			fatalx(EXIT_FAILURE, "Not enough memory");
+
+		for (start = i, numvars = 0; i < count && numvars < SU_SET_BATCH_MAX; i++) {
+			size_t	before = numvars;
+
+			ret[i] = su_setOID(mode, name[i], val[i]);
+			numvars = su_set_batch_count();
+			if (numvars > before && su_set_batch_split(before)) {
+				numvars = before;
+				break;
+			}
+			queued[i] = (ret[i] == STAT_SET_HANDLED && numvars > before);
+		}
+
+		pdu = set_batch;
+		set_batch = NULL;
+
+		if (!numvars) {
+			snmp_free_pdu(pdu);
+			continue;
+		}
+
+		upsdebugx(2, "%s: sending %" PRIuSIZE " %s in one request",
+			__func__, numvars, (mode==SU_MODE_INSTCMD)?"commands":"settings");
+
+		status = nut_snmp_synch_response(pdu, &response);
+		ok = ((status == STAT_SUCCESS) && response && (response->errstat == SNMP_ERR_NOERROR));
+		if (!ok)
+			nut_snmp_perror(g_snmp_sess_p, status, response,
+				"%s: can't set %" PRIuSIZE " OIDs at once", __func__, numvars);
+		snmp_free_pdu(response);
+
+		for (j = start; j < i; j++) {
+			if (!queued[j])
+				continue;
+
+			if (!ok) {
+				ret[j] = su_setOID(mode, name[j], val[j]);
+				continue;
+			}
+
+			if (mode==SU_MODE_SETVAR) {
+				upsdebugx(1, "%s: successfully set %s to \"%s\"", __func__, name[j], val[j]);
+				dstate_setinfo(name[j], "%s", val[j]);
+			}
+			else {
+				upsdebugx(1, "%s: successfully sent command %s", __func__, name[j]);
+			}
+		}
+	}
+
+	free(queued);
+}
+
 /* set r/w INFO_ element to a value.
  * FIXME: make a common function with su_instcmd! */
 int su_setvar(const char *varname, const char *val)
@@ -4024,7 +5745,7 @@ int su_addcmd(snmp_info_t *su_info_p)
 		}
 	}
 	else {
-		if (nut_snmp_get(su_info_p->OID) != NULL) {
+		if (nut_snmp_get_var(su_info_p->OID, NULL, NULL) == TRUE) {
 			dstate_addcmd(su_info_p->info_type);
 			upsdebugx(1, "%s: adding command '%s'", __func__, su_info_p->info_type);
 		}
@@ -4051,6 +5772,45 @@ int su_instcmd(const char *cmdname, const char *extradata)
 	return ret;
 }
 
+/* batches of the two above, see su_setOID_batch() */
+void su_setvar_batch(size_t count, const char **varname, const char **val, int *ret)
+{
+	size_t	i;
+
+	for (i = 0; i < count; i++)
+		upsdebug_SET_STARTING(varname[i], val[i]);
+
+	su_setOID_batch(SU_MODE_SETVAR, count, varname, val, ret);
+
+	for (i = 0; i < count; i++) {
+		if (ret[i] == STAT_SET_FAILED)
+			upslog_SET_FAILED(varname[i], val[i]);
+		else if (ret[i] == STAT_SET_UNKNOWN)
+			upslog_SET_UNKNOWN(varname[i], val[i]);
+		else if (ret[i] == STAT_SET_INVALID)
+			upslog_SET_INVALID(varname[i], val[i]);
+	}
+}
+
+void su_instcmd_batch(size_t count, const char **cmdname, const char **extra, int *ret)
+{
+	size_t	i;
+
+	for (i = 0; i < count; i++)
+		upsdebug_INSTCMD_STARTING(cmdname[i], extra[i]);
+
+	su_setOID_batch(SU_MODE_INSTCMD, count, cmdname, extra, ret);
+
+	for (i = 0; i < count; i++) {
+		if (ret[i] == STAT_INSTCMD_FAILED)
+			upslog_INSTCMD_FAILED(cmdname[i], extra[i]);
+		else if (ret[i] == STAT_INSTCMD_UNKNOWN)
+			upslog_INSTCMD_UNKNOWN(cmdname[i], extra[i]);
+		else if (ret[i] == STAT_INSTCMD_INVALID)
+			upslog_INSTCMD_INVALID(cmdname[i], extra[i]);
+	}
+}
+
 /* FIXME: the below functions can be removed since these were for loading
  * the mib2nut information from a file instead of the .h definitions... */
 /* return 1 if usable, 0 if not */
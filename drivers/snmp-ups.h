@@ -139,6 +139,10 @@
 #define DEFAULT_NETSNMP_RETRIES   5
 #define DEFAULT_NETSNMP_TIMEOUT   1    /* in seconds */
 #define DEFAULT_SEMISTATICFREQ    10   /* in snmpwalk update cycles */
+#define DEFAULT_NORMALFREQ        1    /* in snmpwalk update cycles */
+#define DEFAULT_SNMP_BATCH        16   /* varbinds per GET(BULK) request */
+#define DEFAULT_SNMP_WINDOW       4    /* batch requests in flight at once */
+#define SU_TRAP_MAXHITS           32   /* entries a trap names, beyond it all are read */
 
 /* use explicit booleans */
 #ifndef FALSE
@@ -236,6 +240,15 @@ typedef struct {
 typedef uint32_t snmp_info_flags_t; /* To extend when 32 bits become too congested */
 #define PRI_SU_FLAGS	PRIu32
 
+/* How often the update walks read an entry */
+typedef enum {
+	SU_POLL_AUTO = 0,	/* from its kind, see su_poll_class_init() */
+	SU_POLL_FAST,		/* on each walk */
+	SU_POLL_NORMAL,		/* one walk in every normalfreq (default: each) */
+	SU_POLL_SLOW,		/* once in semistaticfreq walks */
+	SU_POLL_DEMAND		/* at startup, then when set through the driver */
+} su_poll_class_t;
+
 typedef struct {
 	char         *info_type;  /* INFO_ or CMD_ element */
 	int           info_flags; /* flags to set in addinfo: see ST_FLAG_*
@@ -258,6 +271,8 @@ typedef struct {
 	                           * when/if we get more than 32 flag values.
 	                           */
 	info_lkp_t   *oid2info;   /* lookup table between OID and NUT values */
+	su_poll_class_t poll_class; /* SU_POLL_AUTO in the mappings, set
+	                           * from the configuration at startup */
 } snmp_info_t;
 
 /* Help align with DMF branch codebase until it is merged */
@@ -268,7 +283,7 @@ typedef struct {
 #  define snmp_info_default(_1, _2, _3, _4, _5, _6, _7)	{_1, _2, _3, _4, _5, _6, _7, NULL, NULL}
 # endif /* WITH_DMF_LUA  */
 #else
-#  define snmp_info_default(_1, _2, _3, _4, _5, _6, _7)	{_1, _2, _3, _4, _5, _6, _7}
+#  define snmp_info_default(_1, _2, _3, _4, _5, _6, _7)	{_1, _2, _3, _4, _5, _6, _7, SU_POLL_AUTO}
 #endif /* WITH_DMF_FUNCTIONS */
 #define snmp_info_sentinel	snmp_info_default(NULL, 0, 0, NULL, NULL, 0, NULL)
 
@@ -368,6 +383,13 @@ typedef struct {
 #define SU_VAR_RETRIES		"snmp_retries"
 #define SU_VAR_TIMEOUT		"snmp_timeout"
 #define SU_VAR_SEMISTATICFREQ	"semistaticfreq"
+#define SU_VAR_NORMALFREQ	"normalfreq"
+#define SU_VAR_POLLCLASS	"pollclass"
+#define SU_VAR_DISCOVERYCACHE	"discoverycache"
+#define SU_VAR_BATCH		"snmp_batch"
+#define SU_VAR_WINDOW		"snmp_window"
+#define SU_VAR_TRAPLISTEN	"traplisten"
+#define SU_VAR_TRAPCOMMUNITY	"trapcommunity"
 #define SU_VAR_MIBS			"mibs"
 #define SU_VAR_POLLFREQ		"pollfreq"
 /* SNMP v3 related parameters */
@@ -375,6 +397,8 @@ typedef struct {
 #define SU_VAR_SECNAME		"secName"
 #define SU_VAR_AUTHPASSWD	"authPassword"
 #define SU_VAR_PRIVPASSWD	"privPassword"
+#define SU_VAR_AUTHKEY		"authKey"
+#define SU_VAR_PRIVKEY		"privKey"
 #define SU_VAR_AUTHPROT		"authProtocol"
 #define SU_VAR_PRIVPROT		"privProtocol"
 
@@ -396,6 +420,9 @@ typedef struct {
 #define SU_MODE_INSTCMD     1
 #define SU_MODE_SETVAR      2
 
+/* most settings or commands of a batch sent in one SNMP SET request */
+#define SU_SET_BATCH_MAX	16
+
 /* log spew limiters */
 #define SU_ERR_LIMIT 10	/* start limiting after this many errors in a row  */
 #define SU_ERR_RATE 100	/* only print every nth error once limiting starts */
@@ -479,6 +506,8 @@ extern int temperature_unit;
 
 int su_setvar(const char *varname, const char *val);
 int su_instcmd(const char *cmdname, const char *extradata);
+void su_setvar_batch(size_t count, const char **varname, const char **val, int *ret);
+void su_instcmd_batch(size_t count, const char **cmdname, const char **extra, int *ret);
 void su_shutdown_ups(void);
 
 void set_delays(void);
@@ -491,6 +520,7 @@ extern int g_pwr_battery;
 extern int pollfreq; /* polling frequency */
 extern int input_phases, output_phases, bypass_phases;
 extern int semistaticfreq; /* semistatic entry update frequency */
+extern int normalfreq; /* normal entry update frequency */
 
 /* pointer to the Snmp2Nut lookup table */
 extern mib2nut_info_t *mib2nut_info;
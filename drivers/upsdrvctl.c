@@ -29,6 +29,15 @@
 #include <sys/stat.h>
 #ifndef WIN32
 #include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <fcntl.h>
+#include <poll.h>
+#if (defined HAVE_SPAWN_H) && (defined HAVE_POSIX_SPAWN)
+# include <spawn.h>
+# define UPSDRVCTL_SPAWN 1
+extern char **environ;
+#endif
 #else	/* WIN32 */
 #include "wincompat.h"
 #endif	/* WIN32 */
@@ -45,6 +54,7 @@ typedef struct {
 	char	*upsname;
 	char	*driver;
 	char	*port;
+	char	*driverhost;	/* started with the others of this name */
 	int	sdorder;
 	int	maxstartdelay;
 	int	maxretry;
@@ -63,9 +73,16 @@ static int	upscount = 0;
 
 static int	maxsdorder = 0, testmode = 0, exec_error = 0, exec_timeout = 0;
 
+	/* starting all drivers: devices with the same driverhost run in one */
+static int	start_grouped = 0;
+
 	/* Should we wait for driver (1) or "parallelize" drivers start (0) */
 static int	waitfordrivers = 1;
 
+/* how many drivers "start" and "stop" of all devices handle at the same
+ * time (-j); each is done by a child process of ours, see send_jobs() */
+static int	maxjobs = 1;
+
 	/* timer - keeps us from getting stuck if a driver hangs
 	 * NOTE: Default value is also documented in man page
 	 */
@@ -158,6 +175,11 @@ void do_upsconf_args(char *arg_upsname, char *var, char *val)
 			if (!strcmp(var, "port"))
 				tmp->port = xstrdup(val);
 
+			if (!strcmp(var, "driverhost")) {
+				free(tmp->driverhost);
+				tmp->driverhost = xstrdup(val);
+			}
+
 			if (!strcmp(var, "maxstartdelay"))
 				tmp->maxstartdelay = atoi(val);
 
@@ -190,6 +212,7 @@ void do_upsconf_args(char *arg_upsname, char *var, char *val)
 	tmp->upsname = xstrdup(arg_upsname);
 	tmp->driver = NULL;
 	tmp->port = NULL;
+	tmp->driverhost = NULL;
 	tmp->pid = -1;
 	tmp->next = NULL;
 	tmp->sdorder = 0;
@@ -204,6 +227,9 @@ void do_upsconf_args(char *arg_upsname, char *var, char *val)
 	if (!strcmp(var, "port"))
 		tmp->port = xstrdup(val);
 
+	if (!strcmp(var, "driverhost"))
+		tmp->driverhost = xstrdup(val);
+
 	if (last)
 		last->next = tmp;
 	else
@@ -654,6 +680,93 @@ static void waitpid_timeout(const int sig)
 }
 #endif	/* !WIN32 */
 
+/* will <ups> be started within the same driver process as <other>? */
+static int same_driverhost(const ups_t *ups, const ups_t *other)
+{
+	return start_grouped
+		&& ups->driverhost && other->driverhost
+		&& ups->driver && other->driver
+		&& !strcmp(ups->driverhost, other->driverhost)
+		&& !strcmp(ups->driver, other->driver);
+}
+
+#ifndef WIN32
+/* sockets passed to upsdrvctl by a service manager (socket activation)
+ * for the driver(s) started with <ups>: returns how many there are, and
+ * fills fds[] if it is not NULL */
+static int listen_fds_for(const ups_t *ups, int *fds)
+{
+	const ups_t	*tmp;
+	char	fn[NUT_PATH_MAX + 1];
+	int	count = 0;
+	TYPE_FD	fd;
+
+	if (nut_listen_fds() < 1) {
+		return 0;
+	}
+
+	for (tmp = upstable; tmp; tmp = tmp->next) {
+		if (tmp != ups && !same_driverhost(ups, tmp)) {
+			continue;
+		}
+
+		snprintf(fn, sizeof(fn), "%s/%s-%s", dflt_statepath(),
+			tmp->driver, tmp->upsname);
+
+		fd = nut_listen_fd_unix(fn);
+		if (VALID_FD(fd)) {
+			if (fds) {
+				fds[count] = fd;
+			}
+			count++;
+		}
+	}
+
+	return count;
+}
+
+/* in the process about to exec the driver: move the sockets passed for
+ * it to where the protocol wants them, from NUT_LISTEN_FDS_START up, and
+ * tell it about them; the others were opened close-on-exec */
+static void listen_fds_pass(const ups_t *ups)
+{
+	int	*fds, count, i;
+	char	buf[SMALLBUF];
+
+	count = listen_fds_for(ups, NULL);
+	if (count < 1) {
+		return;
+	}
+
+	fds = xcalloc((size_t)count, sizeof(*fds));
+	listen_fds_for(ups, fds);
+
+	/* out of the way first, so that moving one does not clobber another */
+	for (i = 0; i < count; i++) {
+		fds[i] = fcntl(fds[i], F_DUPFD, NUT_LISTEN_FDS_START + nut_listen_fds());
+		if (fds[i] < 0) {
+			fatal_with_errno(EXIT_FAILURE, "Can't pass the listening socket");
+		}
+	}
+
+	for (i = 0; i < count; i++) {
+		if (dup2(fds[i], NUT_LISTEN_FDS_START + i) < 0) {
+			fatal_with_errno(EXIT_FAILURE, "Can't pass the listening socket");
+		}
+		close(fds[i]);
+	}
+
+	free(fds);
+
+	snprintf(buf, sizeof(buf), "%d", count);
+	setenv("LISTEN_FDS", buf, 1);
+	snprintf(buf, sizeof(buf), "%" PRIuMAX, (uintmax_t)getpid());
+	setenv("LISTEN_PID", buf, 1);
+
+	upsdebugx(1, "Passing %d listening socket(s) to the driver", count);
+}
+#endif	/* !WIN32 */
+
 /* print out a command line at the given debug level. */
 static void debugcmdline(int level, const char *msg, char *const argv[])
 {
@@ -679,10 +792,27 @@ static void forkexec(char *const argv[], const ups_t *ups)
 	} else {
 		pid_t	pid, waitret;
 
-		pid = fork();
+#ifdef UPSDRVCTL_SPAWN
+		/* the child would only exec the driver: posix_spawn() does that
+		 * without copying all of upsdrvctl (and its parsed ups.conf);
+		 * passed sockets need the child's own pid set up for it though */
+		if (listen_fds_for(ups, NULL) < 1) {
+			ret = posix_spawn(&pid, argv[0], NULL, NULL, argv, environ);
 
-		if (pid < 0)
-			fatal_with_errno(EXIT_FAILURE, "fork");
+			if (ret != 0) {
+				errno = ret;
+				upslog_with_errno(LOG_WARNING, "Can't start driver %s", argv[0]);
+				exec_error++;
+				return;
+			}
+		} else
+#endif	/* UPSDRVCTL_SPAWN */
+		{
+			pid = fork();
+
+			if (pid < 0)
+				fatal_with_errno(EXIT_FAILURE, "fork");
+		}
 
 		if (pid != 0) {			/* parent */
 			int	wstat;
@@ -774,6 +904,8 @@ static void forkexec(char *const argv[], const ups_t *ups)
 
 	/* child or foreground mode (no fork) */
 
+	listen_fds_pass(ups);
+
 	ret = execv(argv[0], argv);
 
 	/* shouldn't get here normally */
@@ -844,45 +976,29 @@ static void list_driver(const ups_t *ups)
 	printf("%s\n", ups->upsname);
 }
 
-static void status_driver(const ups_t *ups)
+/* Check the PID file of a driver, and if that process is alive */
+static void status_pidfile(const ups_t *ups, pid_t *pidFromFile, int *pidAlive)
 {
-	/* TODO: Options (global static) for details of configuration like
-	 * the driver name, serial, etc. or even current life-cycle status
-	 * (e.g. valid PID existence, data query via socket protocol...)
-	 */
-	static int	headerShown = 0;
 #ifndef WIN32
 	char	pidfn[NUT_PATH_MAX + 1];
 	int	cmdret = -1;
 #endif	/* !WIN32 */
-	char	bufPid[LARGEBUF], *pidStrFromSocket = NULL,
-		bufStatus[LARGEBUF], *statusStrFromSocket = NULL;
-	int	pidAlive = -1,
-		qretPing = -1, qretPid = -1, qretStatus = -1,
-		nudl = nut_upsdrvquery_debug_level,
-		nsdl = nut_sendsignal_debug_level;
-	pid_t	pidFromFile = -1, pidFromSocket = -1;
-	struct timeval	tv;
-	udq_pipe_conn_t	*conn;
 
-	if (!ups) {
-		upsdebugx(1, "%s: skip due to ups==null", __func__);
-		return;
-	}
+	*pidFromFile = -1;
+	*pidAlive = -1;
 
-	/* Hush the fopen(pidfile) message but let "real errors" be seen */
-	nut_sendsignal_debug_level = NUT_SENDSIGNAL_DEBUG_LEVEL_KILL_SIG0PING - 1;
 #ifndef WIN32
 	snprintf(pidfn, sizeof(pidfn), "%s/%s-%s.pid", altpidpath(), ups->driver, ups->upsname);
-	pidFromFile = parsepidfile(pidfn);
-	if (pidFromFile >= 0) {                                                                                                                                                                                                                       /* this method actively reports errors, if any */
-		cmdret = sendsignalpid(pidFromFile, 0, ups->driver, 1);
+	*pidFromFile = parsepidfile(pidfn);
+	if (*pidFromFile >= 0) {
+		/* this method actively reports errors, if any */
+		cmdret = sendsignalpid(*pidFromFile, 0, ups->driver, 1);
 		/* returns zero for a successfully sent signal */
 		if (cmdret == 0)
-			pidAlive = 1;
+			*pidAlive = 1;
 	}
 	upsdebugx(4, "%s: pidfn=%s pidFromFile=%" PRIiMAX " cmdret=%d pidAlive=%d",
-		__func__, pidfn, (intmax_t)pidFromFile, cmdret, pidAlive);
+		__func__, pidfn, (intmax_t)*pidFromFile, cmdret, *pidAlive);
 #else	/* WIN32 */
 /*	// FIXME: We actually have no probing signals over pipe so far,
 	// and sending 0 (NULL here) is proven unsafe
@@ -891,8 +1007,108 @@ static void status_driver(const ups_t *ups)
 	cmdret = sendsignal(pidfn, COMMAND_RELOAD, 1);
 	upsdebugx(4, "%s: pipe pidfn=%s cmdret=%d", __func__, pidfn, cmdret);
  */
+	NUT_UNUSED_VARIABLE(ups);
 	NUT_WIN32_INCOMPLETE_DETAILED("no probing signals over pipe yet");
 #endif	/* WIN32 */
+}
+
+/* Print the status line of a driver (and the header before the first one) */
+static void status_report(const ups_t *ups,
+	pid_t pidFromFile, int pidAlive,
+	int qretPing, int qretPid, int qretStatus,
+	const char *pidStrFromSocket, const char *statusStrFromSocket)
+{
+	static int	headerShown = 0;
+	pid_t	pidFromSocket = -1;
+
+	if (qretPid == STAT_INSTCMD_HANDLED && pidStrFromSocket) {
+		pidFromSocket = parsepid(pidStrFromSocket);
+		if (errno != 0)
+			pidFromSocket = -1;
+	}
+
+	if (pidFromFile < 0 && pidFromSocket >= 0) {
+		upsdebugx(3, "%s: PID was not available from a file, but was "
+			"from Socket Protocol; check if it is alive instead",
+			__func__);
+
+		pidAlive = checkprocname(pidFromSocket, ups->driver);
+		upsdebugx(4, "%s: pidFromSocket=%" PRIiMAX " pidAlive=%d",
+			__func__, (intmax_t)pidFromSocket, pidAlive);
+	} else if (pidAlive < 0 && pidFromSocket >= 0 && (pidFromFile != pidFromSocket)) {
+		upsdebugx(3, "%s: PID value was available from a file, but was "
+			"not found running or valid; another one is available "
+			"from Socket Protocol; check if it is alive instead",
+			__func__);
+
+		pidAlive = checkprocname(pidFromSocket, ups->driver);
+		upsdebugx(4, "%s: pidFromSocket=%" PRIiMAX " pidAlive=%d",
+			__func__, (intmax_t)pidFromSocket, pidAlive);
+	}
+
+	/* Complete any cached (error) writes before the next lines,
+	 * more so on WIN32 */
+	fflush(stderr);
+	fflush(stdout);
+	usleep(1000);
+
+	if (!headerShown) {
+		printf("%-11s\t%11s\t%s\t%s\t%s\t%s\t%s\n",
+			"UPSNAME",
+			"UPSDRV",
+			"RUNNING",
+			"PF_PID",
+			"S_RESPONSIVE",
+			"S_PID",
+			"S_STATUS"
+			);
+		headerShown = 1;
+	}
+
+	upsdebugx(2, "%s: raw values: pidAlive=%d "
+		"pidFromFile=%" PRIiMAX " pidFromSocket=%" PRIiMAX " "
+		"qretPing=%d qretPid=%d qretStatus=%d",
+		__func__, pidAlive,
+		(intmax_t)(pidFromFile), (intmax_t)(pidFromSocket),
+		qretPing, qretPid, qretStatus
+		);
+
+	printf("%-11s\t%11s\t%s\t%" PRIiMAX "\t%s\t%s\t%s\n",
+		ups->upsname, ups->driver,
+		((pidFromFile < 0 && pidFromSocket < 0) || (pidAlive < 0)
+		 ? "N/A" : (pidAlive > 0 ? "RUNNING" : "STOPPED")),
+		(intmax_t)(pidFromFile),
+		((qretPing == STAT_INSTCMD_HANDLED) ? "RESPONSIVE" : "NOT_RESPONSIVE"),
+		(pidStrFromSocket ? pidStrFromSocket : "N/A"),
+		((qretStatus == STAT_INSTCMD_HANDLED) ? NUT_STRARG(statusStrFromSocket) : "")
+		);
+	fflush(stdout);
+}
+
+static void status_driver(const ups_t *ups)
+{
+	/* TODO: Options (global static) for details of configuration like
+	 * the driver name, serial, etc. or even current life-cycle status
+	 * (e.g. valid PID existence, data query via socket protocol...)
+	 */
+	char	bufPid[LARGEBUF], *pidStrFromSocket = NULL,
+		bufStatus[LARGEBUF], *statusStrFromSocket = NULL;
+	int	pidAlive = -1,
+		qretPing = -1, qretPid = -1, qretStatus = -1,
+		nudl = nut_upsdrvquery_debug_level,
+		nsdl = nut_sendsignal_debug_level;
+	pid_t	pidFromFile = -1;
+	struct timeval	tv;
+	udq_pipe_conn_t	*conn;
+
+	if (!ups) {
+		upsdebugx(1, "%s: skip due to ups==null", __func__);
+		return;
+	}
+
+	/* Hush the fopen(pidfile) message but let "real errors" be seen */
+	nut_sendsignal_debug_level = NUT_SENDSIGNAL_DEBUG_LEVEL_KILL_SIG0PING - 1;
+	status_pidfile(ups, &pidFromFile, &pidAlive);
 
 	/* Hush the fopen(socketfile) in upsdrvquery_connect_drvname_upsname() */
 	nut_upsdrvquery_debug_level = 0;
@@ -933,9 +1149,6 @@ static void status_driver(const ups_t *ups)
 				if (bufPid[l - 1] == '\n')
 					bufPid[l - 1] = '\0';
 				qretPid = STAT_INSTCMD_HANDLED;
-				pidFromSocket = parsepid(pidStrFromSocket);
-				if (errno != 0)
-					pidFromSocket = -1;
 			} else {
 				/* query failed or returned not a PID<something> */
 				qretPid = -1;
@@ -994,73 +1207,280 @@ static void status_driver(const ups_t *ups)
 		conn = NULL;
 	}
 
-	if (pidFromFile < 0 && pidFromSocket >= 0) {
-		upsdebugx(3, "%s: PID was not available from a file, but was "
-			"from Socket Protocol; check if it is alive instead",
-			__func__);
+	status_report(ups, pidFromFile, pidAlive, qretPing, qretPid, qretStatus,
+		pidStrFromSocket, statusStrFromSocket);
 
-		pidAlive = checkprocname(pidFromSocket, ups->driver);
-		upsdebugx(4, "%s: pidFromSocket=%" PRIiMAX " pidAlive=%d",
-			__func__, (intmax_t)pidFromSocket, pidAlive);
-	} else if (pidAlive < 0 && pidFromSocket >= 0 && (pidFromFile != pidFromSocket)) {
-		upsdebugx(3, "%s: PID value was available from a file, but was "
-			"not found running or valid; another one is available "
-			"from Socket Protocol; check if it is alive instead",
-			__func__);
+	nut_sendsignal_debug_level = nsdl;
+}
 
-		pidAlive = checkprocname(pidFromSocket, ups->driver);
-		upsdebugx(4, "%s: pidFromSocket=%" PRIiMAX " pidAlive=%d",
-			__func__, (intmax_t)pidFromSocket, pidAlive);
+#ifndef WIN32
+/* A query of status_all_drivers() in flight */
+typedef struct {
+	const ups_t	*ups;
+	int	fd;
+	int	connecting;	/* waiting for connect() to complete */
+	char	buf[LARGEBUF];
+	size_t	len;
+	pid_t	pidFromFile;
+	int	pidAlive, qretPing, qretPid, qretStatus;
+	char	pid[SMALLBUF], status[LARGEBUF];
+} status_query_t;
+
+/* all the questions of status_driver(), asked at once */
+#define STATUS_QUERY	"NOBROADCAST\nPING\nGETPID\nDUMPSTATUS\n"
+
+static void status_query_done(status_query_t *q)
+{
+	if (q->fd >= 0) {
+		/* best effort, as a LOGOUT of upsdrvquery_close() but we
+		 * do not linger for the driver to see it */
+		if (write(q->fd, "LOGOUT\n", 7) < 0)
+			upsdebug_with_errno(4, "%s: LOGOUT to %s", __func__, q->ups->upsname);
+		close(q->fd);
+		q->fd = -1;
+	}
+}
+
+static void status_query_send(status_query_t *q)
+{
+	ssize_t	ret = write(q->fd, STATUS_QUERY, strlen(STATUS_QUERY));
+
+	/* a fresh socket takes this much without blocking */
+	if (ret != (ssize_t)strlen(STATUS_QUERY)) {
+		upsdebug_with_errno(3, "%s: write to %s", __func__, q->ups->upsname);
+		status_query_done(q);
 	}
+}
 
-	/* Complete any cached (error) writes before the next lines,
-	 * more so on WIN32 */
-	fflush(stderr);
-	fflush(stdout);
-	usleep(1000);
+static void status_query_connect(status_query_t *q)
+{
+	struct sockaddr_un	sa;
+	int	flags;
 
-	if (!headerShown) {
-		printf("%-11s\t%11s\t%s\t%s\t%s\t%s\t%s\n",
-			"UPSNAME",
-			"UPSDRV",
-			"RUNNING",
-			"PF_PID",
-			"S_RESPONSIVE",
-			"S_PID",
-			"S_STATUS"
-			);
-		headerShown = 1;
+	memset(&sa, '\0', sizeof(sa));
+	sa.sun_family = AF_UNIX;
+	snprintf(sa.sun_path, sizeof(sa.sun_path), "%s/%s-%s",
+		dflt_statepath(), q->ups->driver, q->ups->upsname);
+	check_unix_socket_filename(sa.sun_path);
+
+	if ((q->fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+		upslog_with_errno(LOG_ERR, "open socket");
+		return;
 	}
 
-	upsdebugx(2, "%s: raw values: pidAlive=%d "
-		"pidFromFile=%" PRIiMAX " pidFromSocket=%" PRIiMAX " "
-		"qretPing=%d qretPid=%d qretStatus=%d",
-		__func__, pidAlive,
-		(intmax_t)(pidFromFile), (intmax_t)(pidFromSocket),
-		qretPing, qretPid, qretStatus
-		);
+	flags = fcntl(q->fd, F_GETFL, 0);
+	if (flags < 0 || fcntl(q->fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+		upslog_with_errno(LOG_ERR, "fcntl on driver socket %s failed", sa.sun_path);
+		close(q->fd);
+		q->fd = -1;
+		return;
+	}
 
-	printf("%-11s\t%11s\t%s\t%" PRIiMAX "\t%s\t%s\t%s\n",
-		ups->upsname, ups->driver,
-		((pidFromFile < 0 && pidFromSocket < 0) || (pidAlive < 0)
-		 ? "N/A" : (pidAlive > 0 ? "RUNNING" : "STOPPED")),
-		(intmax_t)(pidFromFile),
-		((qretPing == STAT_INSTCMD_HANDLED) ? "RESPONSIVE" : "NOT_RESPONSIVE"),
-		(pidStrFromSocket ? pidStrFromSocket : "N/A"),
-		((qretStatus == STAT_INSTCMD_HANDLED) ? NUT_STRARG(statusStrFromSocket) : "")
-		);
-	fflush(stdout);
+	if (connect(q->fd, (struct sockaddr *) &sa, sizeof(sa)) == 0) {
+		status_query_send(q);
+		return;
+	}
+
+	if (errno == EINPROGRESS || errno == EAGAIN) {
+		q->connecting = 1;
+		return;
+	}
+
+	/* not running, most likely */
+	upsdebug_with_errno(3, "%s: connect to %s", __func__, sa.sun_path);
+	close(q->fd);
+	q->fd = -1;
+}
+
+/* Take in the complete lines of a reply, returns 1 once DUMPDONE came */
+static int status_query_parse(status_query_t *q)
+{
+	char	*line = q->buf, *eol;
+
+	while ((eol = memchr(line, '\n', q->len - (size_t)(line - q->buf))) != NULL) {
+		*eol = '\0';
+
+		if (!strcmp(line, "PONG")) {
+			q->qretPing = STAT_INSTCMD_HANDLED;
+		} else if (!strncmp(line, "PID ", 4)) {
+			snprintf(q->pid, sizeof(q->pid), "%s", line + 4);
+			q->qretPid = STAT_INSTCMD_HANDLED;
+		} else if (!strncmp(line, "SETINFO ups.status ", 19)) {
+			snprintf(q->status, sizeof(q->status), "%s", line + 19);
+			q->qretStatus = STAT_INSTCMD_HANDLED;
+		} else if (!strcmp(line, "DUMPDONE")) {
+			return 1;
+		}
+		/* else a broadcast which came before NOBROADCAST */
+
+		line = eol + 1;
+	}
+
+	q->len -= (size_t)(line - q->buf);
+	memmove(q->buf, line, q->len);
+
+	if (q->len >= sizeof(q->buf) - 1) {
+		/* no line is this long, drop the junk */
+		q->len = 0;
+	}
+
+	return 0;
+}
+
+/* As status_driver() for all the devices, but with the connections to all
+ * drivers made and served at once in one poll() loop, so that one slow or
+ * hung driver costs the same few seconds as many of them */
+static void status_all_drivers(void)
+{
+	status_query_t	*queries;
+	struct pollfd	*fds;
+	const ups_t	*ups;
+	size_t	nq = 0, i, nfds;
+	int	nsdl = nut_sendsignal_debug_level;
+	time_t	deadline;
+
+	for (ups = upstable; ups; ups = ups->next)
+		nq++;
+
+	queries = (status_query_t *)xcalloc(nq, sizeof(*queries));
+	fds = (struct pollfd *)xcalloc(nq, sizeof(*fds));
+
+	/* Hush the fopen(pidfile) message but let "real errors" be seen */
+	nut_sendsignal_debug_level = NUT_SENDSIGNAL_DEBUG_LEVEL_KILL_SIG0PING - 1;
+
+	for (i = 0, ups = upstable; ups; ups = ups->next, i++) {
+		status_query_t	*q = &queries[i];
+
+		q->ups = ups;
+		q->qretPing = q->qretPid = q->qretStatus = -1;
+		status_pidfile(ups, &q->pidFromFile, &q->pidAlive);
+		status_query_connect(q);
+	}
+
+	/* FIXME: coordinate with pollfreq? */
+	deadline = time(NULL) + 3;
+
+	for (;;) {
+		time_t	now = time(NULL);
+		int	ret;
+
+		for (i = 0, nfds = 0; i < nq; i++) {
+			if (queries[i].fd < 0)
+				continue;
+			fds[nfds].fd = queries[i].fd;
+			fds[nfds].events = queries[i].connecting ? POLLOUT : POLLIN;
+			fds[nfds].revents = 0;
+			nfds++;
+		}
+
+		if (nfds == 0)
+			break;
+
+		if (now >= deadline) {
+			upsdebugx(1, "%s: %" PRIuSIZE " driver(s) did not answer in time",
+				__func__, nfds);
+			break;
+		}
+
+		ret = poll(fds, (nfds_t)nfds, (int)(deadline - now) * 1000);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			upslog_with_errno(LOG_ERR, "poll");
+			break;
+		}
+
+		for (i = 0, nfds = 0; i < nq; i++) {
+			status_query_t	*q = &queries[i];
+			struct pollfd	*pfd;
+			ssize_t	len;
+
+			if (q->fd < 0)
+				continue;
+			pfd = &fds[nfds++];
+
+			if (!pfd->revents)
+				continue;
+
+			if (q->connecting) {
+				int	err = 0;
+				socklen_t	errlen = sizeof(err);
+
+				q->connecting = 0;
+				if (getsockopt(q->fd, SOL_SOCKET, SO_ERROR, &err, &errlen) < 0 || err) {
+					upsdebugx(3, "%s: connect to %s: %s", __func__,
+						q->ups->upsname, strerror(err ? err : errno));
+					status_query_done(q);
+				} else {
+					status_query_send(q);
+				}
+				continue;
+			}
+
+			len = read(q->fd, q->buf + q->len, sizeof(q->buf) - 1 - q->len);
+			if (len < 0 && (errno == EAGAIN || errno == EINTR))
+				continue;
+			if (len <= 0) {
+				upsdebugx(3, "%s: %s closed the connection",
+					__func__, q->ups->upsname);
+				status_query_done(q);
+				continue;
+			}
+
+			q->len += (size_t)len;
+			if (status_query_parse(q))
+				status_query_done(q);
+		}
+	}
+
+	for (i = 0; i < nq; i++) {
+		status_query_t	*q = &queries[i];
+
+		status_query_done(q);
+
+		/* as status_driver(), the later answers only count if
+		 * the earlier ones came */
+		if (q->qretPing != STAT_INSTCMD_HANDLED)
+			q->qretPid = -1;
+		if (q->qretPid != STAT_INSTCMD_HANDLED)
+			q->qretStatus = -1;
+
+		status_report(q->ups, q->pidFromFile, q->pidAlive,
+			q->qretPing, q->qretPid, q->qretStatus,
+			(q->qretPid == STAT_INSTCMD_HANDLED ? q->pid : NULL),
+			q->status);
+	}
 
 	nut_sendsignal_debug_level = nsdl;
+	free(fds);
+	free(queries);
 }
+#endif	/* !WIN32 */
 
 static void start_driver(const ups_t *ups)
 {
-	char	*argv[10];
+	char	**argv;
 	char	dfn[NUT_PATH_MAX + 1], dbg[SMALLBUF];
 	int	ret, arg = 0;
 	int	initial_exec_error = exec_error, initial_exec_timeout = exec_timeout, drv_maxretry = maxretry, drv_retrydelay = retrydelay;
 	struct stat	fs;
+	const ups_t	*tmp;
+	size_t	members = 1;
+
+	/* the first device of a driverhost group starts all of them */
+	for (tmp = upstable; tmp && tmp != ups; tmp = tmp->next) {
+		if (same_driverhost(ups, tmp)) {
+			upsdebugx(1, "UPS %s is started along with %s (driverhost %s)",
+				ups->upsname, tmp->upsname, ups->driverhost);
+			return;
+		}
+	}
+
+	for (tmp = ups->next; tmp; tmp = tmp->next) {
+		if (same_driverhost(ups, tmp)) {
+			members++;
+		}
+	}
 
 	upsdebugx(1, "Starting UPS: %s", ups->upsname);
 
@@ -1083,6 +1503,7 @@ static void start_driver(const ups_t *ups)
 	if (ret < 0)
 		fatal_with_errno(EXIT_FAILURE, "Can't start %s", dfn);
 
+	argv = xcalloc(10 + 2 * members, sizeof(*argv));
 	argv[arg++] = dfn;
 
 	if (nut_debug_level_passthrough > 0
@@ -1168,6 +1589,13 @@ static void start_driver(const ups_t *ups)
 	argv[arg++] = (char *)"-a";		/* FIXME: cast away const */
 	argv[arg++] = ups->upsname;
 
+	for (tmp = ups->next; tmp; tmp = tmp->next) {
+		if (same_driverhost(ups, tmp)) {
+			argv[arg++] = (char *)"-a";	/* FIXME: cast away const */
+			argv[arg++] = tmp->upsname;
+		}
+	}
+
 	/* stick on the chroot / user args if given to us */
 	if (pt_root) {
 		argv[arg++] = (char *)"-r";	/* FIXME: cast away const */
@@ -1208,6 +1636,8 @@ static void start_driver(const ups_t *ups)
 					sleep ((unsigned int)drv_retrydelay);
 		}
 	}
+
+	free(argv);
 }
 
 static void help(const char *progname)
@@ -1232,6 +1662,8 @@ static void help(const char *arg_progname)
 	printf("  -F			driver stays foregrounded even if no debugging is enabled\n");
 	printf("  -FF			driver stays foregrounded and still saves the PID file\n");
 	printf("  -B			driver(s) stay backgrounded even if debugging is bumped\n");
+	printf("  -j <N>		start or stop up to <N> drivers at the same time\n");
+	printf("              		(with \"all\" devices; default 1, one after another)\n");
 
 	printf("\nListing known driver(s):\n");
 	printf("  -l | list		list all device driver confgurations that can be managed\n");
@@ -1349,6 +1781,119 @@ static void send_one_driver(void (*command_func)(const ups_t *), const char *arg
 	fatalx(EXIT_FAILURE, "UPS %s not found in ups.conf", arg_upsname);
 }
 
+#ifndef WIN32
+/* Exit status of a job: which of the counters it raised */
+#define JOB_EXEC_ERROR	1
+#define JOB_EXEC_TIMEOUT	2
+
+/* Collect one finished job of send_jobs() and account for how it went */
+static void job_reap(pid_t *pids, const ups_t **jobs, size_t njobs, const char *verb)
+{
+	pid_t	pid;
+	int	wstat;
+	size_t	i;
+
+	for (;;) {
+		pid = waitpid(-1, &wstat, 0);
+
+		if (pid < 0) {
+			if (errno == EINTR)
+				continue;
+			fatal_with_errno(EXIT_FAILURE, "waitpid");
+		}
+
+		for (i = 0; i < njobs && pids[i] != pid; i++);
+		if (i < njobs)
+			break;
+	}
+
+	pids[i] = 0;
+
+	if (!WIFEXITED(wstat)) {
+		upslogx(LOG_WARNING, "UPS [%s]: could not %s the driver "
+			"(the job ended abnormally)", jobs[i]->upsname, verb);
+		exec_error++;
+		return;
+	}
+
+	if (WEXITSTATUS(wstat) & JOB_EXEC_ERROR) {
+		upslogx(LOG_WARNING, "UPS [%s]: could not %s the driver",
+			jobs[i]->upsname, verb);
+		exec_error++;
+	}
+
+	if (WEXITSTATUS(wstat) & JOB_EXEC_TIMEOUT) {
+		/* we can not revise this later like our own children: the
+		 * driver process belonged to the job, count it as failed */
+		upslogx(LOG_WARNING, "UPS [%s]: the driver did not %s within "
+			"maxstartdelay", jobs[i]->upsname, verb);
+		exec_error++;
+	}
+
+	upsdebugx(1, "UPS [%s]: job done (status 0x%x)",
+		jobs[i]->upsname, (unsigned int)wstat);
+}
+
+/* Run command_func() for each UPS in a child process of ours, up to maxjobs
+ * at a time, so that the waits for (and retries of) the drivers overlap.
+ * They are begun in the order of ups.conf, and each reports how it went
+ * in its exit status, so errors are still told apart per device. */
+static void send_jobs(void (*command_func)(const ups_t *), const char *verb)
+{
+	const ups_t	**jobs;
+	const ups_t	*ups;
+	pid_t	*pids, pid;
+	size_t	njobs = 0, i;
+	int	running = 0;
+
+	for (ups = upstable; ups; ups = ups->next)
+		njobs++;
+
+	jobs = xcalloc(njobs, sizeof(*jobs));
+	pids = xcalloc(njobs, sizeof(*pids));
+
+	upsdebugx(1, "Handling %" PRIuSIZE " drivers, up to %d at a time",
+		njobs, maxjobs);
+
+	for (ups = upstable, i = 0; ups; ups = ups->next, i++) {
+		while (running >= maxjobs) {
+			job_reap(pids, jobs, njobs, verb);
+			running--;
+		}
+
+		jobs[i] = ups;
+		fflush(stdout);
+		fflush(stderr);
+
+		pid = fork();
+		if (pid < 0)
+			fatal_with_errno(EXIT_FAILURE, "fork");
+
+		if (pid == 0) {
+			/* the job: do it just like without -j, do not run
+			 * the clean-up handlers of the parent when done */
+			exec_error = 0;
+			exec_timeout = 0;
+			command_func(ups);
+			fflush(stdout);
+			_exit((exec_error ? JOB_EXEC_ERROR : 0)
+				| (exec_timeout ? JOB_EXEC_TIMEOUT : 0));
+		}
+
+		pids[i] = pid;
+		running++;
+	}
+
+	while (running > 0) {
+		job_reap(pids, jobs, njobs, verb);
+		running--;
+	}
+
+	free(pids);
+	free(jobs);
+}
+#endif	/* !WIN32 */
+
 /* walk UPS table and send command to all UPSes according to sdorder */
 static void send_all_drivers(void (*command_func)(const ups_t *))
 {
@@ -1361,6 +1906,13 @@ static void send_all_drivers(void (*command_func)(const ups_t *))
 	exec_error = 0;
 	exec_timeout = 0;
 
+#ifndef WIN32
+	if (command_func == &status_driver && ups->next) {
+		status_all_drivers();
+		return;
+	}
+#endif	/* !WIN32 */
+
 	if (command_func == &list_driver || command_func == &status_driver) {
 		while (ups) {
 			command_func(ups);
@@ -1395,12 +1947,32 @@ static void send_all_drivers(void (*command_func)(const ups_t *))
 			);
 		}
 
+		start_grouped = (command_func == &start_driver);
+
+#ifndef WIN32
+		/* the jobs can only wait for drivers which background
+		 * themselves (the foregrounded ones are our children) */
+		if (maxjobs > 1 && !testmode && waitfordrivers
+		&&  (command_func == &start_driver || command_func == &stop_driver)
+		&&  nut_foreground_passthrough <= 0
+		&&  !(nut_foreground_passthrough != 0
+		      && nut_debug_level > 0
+		      && nut_debug_level_passthrough > 0)
+		) {
+			send_jobs(command_func,
+				(command_func == &start_driver ? "start" : "stop"));
+			start_grouped = 0;
+			return;
+		}
+#endif	/* !WIN32 */
+
 		while (ups) {
 			command_func(ups);
 
 			ups = ups->next;
 		}
 
+		start_grouped = 0;
 		return;
 	}
 
@@ -1443,6 +2015,7 @@ static void exit_cleanup(void)
 
 		free(tmp->driver);
 		free(tmp->port);
+		free(tmp->driverhost);
 		free(tmp->upsname);
 		free(tmp);
 
@@ -1465,12 +2038,28 @@ int main(int argc, char **argv)
 	snprintf(progdesc, sizeof(progdesc), "%s - UPS driver controller", xbasename(prog));
 	print_banner_once(progdesc, 0);
 
-	while ((i = getopt(argc, argv, "+htu:r:DdFBVc:l")) != -1) {
+	while ((i = getopt(argc, argv, "+htu:r:DdFBVc:lj:")) != -1) {
 		switch(i) {
 			case 'r':
 				pt_root = optarg;
 				break;
 
+			case 'j':
+				maxjobs = atoi(optarg);
+				if (maxjobs < 1) {
+					fatalx(EXIT_FAILURE,
+						"Error: invalid argument to option -%c: %s. "
+						"Try -h for help.", i, optarg);
+				}
+#ifdef WIN32
+				if (maxjobs > 1) {
+					upslogx(LOG_WARNING, "Option -j is not "
+						"supported on this platform, ignored");
+					maxjobs = 1;
+				}
+#endif	/* WIN32 */
+				break;
+
 			case 't':
 				testmode = 1;
 				break;
@@ -1657,6 +2246,10 @@ int main(int argc, char **argv)
 
 	atexit(exit_cleanup);
 
+	/* take the sockets a service manager may have passed, before
+	 * anything is forked; they go on to the drivers they are for */
+	nut_listen_fds();
+
 	read_upsconf(1);
 
 	if (argc == lastarg) {
@@ -157,51 +157,58 @@ udq_pipe_conn_t *upsdrvquery_connect(const char *sockfn) {
 	return conn;
 }
 
-udq_pipe_conn_t *upsdrvquery_connect_drvname_upsname(const char *drvname, const char *upsname) {
-	char	sockname[NUT_PATH_MAX + 1];
+/* Socket (or pipe) name of a driver, returns 0 if it does not exist */
+static int upsdrvquery_sockname(const char *drvname, const char *upsname, char *sockname, size_t sockname_sz) {
 #ifndef WIN32
 	struct stat     fs;
-	snprintf(sockname, sizeof(sockname), "%s/%s-%s",
+	snprintf(sockname, sockname_sz, "%s/%s-%s",
 		dflt_statepath(), drvname, upsname);
 	check_unix_socket_filename(sockname);
 	if (stat(sockname, &fs)) {
 		if (nut_debug_level > 0 || nut_upsdrvquery_debug_level >= NUT_UPSDRVQUERY_DEBUG_LEVEL_CONNECT)
 			upslog_with_errno(LOG_ERR, "Can't open %s", sockname);
-		return NULL;
+		return 0;
 	}
 #else	/* WIN32 */
-	snprintf(sockname, sizeof(sockname), "\\\\.\\pipe\\%s-%s", drvname, upsname);
+	snprintf(sockname, sockname_sz, "\\\\.\\pipe\\%s-%s", drvname, upsname);
 #endif  /* WIN32 */
 
+	return 1;
+}
+
+udq_pipe_conn_t *upsdrvquery_connect_drvname_upsname(const char *drvname, const char *upsname) {
+	char	sockname[NUT_PATH_MAX + 1];
+
+	if (!upsdrvquery_sockname(drvname, upsname, sockname, sizeof(sockname)))
+		return NULL;
+
 	return upsdrvquery_connect(sockname);
 }
 
-void upsdrvquery_close(udq_pipe_conn_t *conn) {
-#ifdef WIN32
-	int	loggedOut = 0;
-#endif  /* WIN32 */
+/* Say LOGOUT to the driver, returns 1 if that could be written */
+static int upsdrvquery_logout(udq_pipe_conn_t *conn) {
+	int	nudl = nut_upsdrvquery_debug_level;
+	ssize_t ret;
 
-	if (!conn)
-		return;
+	if (!conn || INVALID_FD(conn->sockfd))
+		return 0;
 
-	if (VALID_FD(conn->sockfd)) {
-		int	nudl = nut_upsdrvquery_debug_level;
-		ssize_t ret;
-		upsdebugx(5, "%s: closing driver socket, try to say goodbye", __func__);
-		ret = upsdrvquery_write(conn, "LOGOUT\n");
-		if (7 <= ret) {
-			upsdebugx(5, "%s: okay", __func__);
-#ifdef WIN32
-			loggedOut = 1;
-#endif  /* WIN32 */
-			usleep(1000000);
-		} else {
-			upsdebugx(5, "%s: must have been closed on the other side", __func__);
-		}
-		nut_upsdrvquery_debug_level = nudl;
+	upsdebugx(5, "%s: closing driver socket, try to say goodbye", __func__);
+	ret = upsdrvquery_write(conn, "LOGOUT\n");
+	nut_upsdrvquery_debug_level = nudl;
+	if (7 <= ret) {
+		upsdebugx(5, "%s: okay", __func__);
+		return 1;
 	}
 
+	upsdebugx(5, "%s: must have been closed on the other side", __func__);
+	return 0;
+}
+
+static void upsdrvquery_disconnect(udq_pipe_conn_t *conn, int loggedOut) {
 #ifndef WIN32
+	NUT_UNUSED_VARIABLE(loggedOut);
+
 	if (VALID_FD(conn->sockfd))
 		close(conn->sockfd);
 #else	/* WIN32 */
@@ -223,8 +230,22 @@ void upsdrvquery_close(udq_pipe_conn_t *conn) {
 #endif  /* WIN32 */
 
 	conn->sockfd = ERROR_FD;
+	conn->nobroadcast = 0;
 	memset(conn->buf, 0, sizeof(conn->buf));
 	memset(conn->sockfn, 0, sizeof(conn->sockfn));
+}
+
+void upsdrvquery_close(udq_pipe_conn_t *conn) {
+	int	loggedOut;
+
+	if (!conn)
+		return;
+
+	loggedOut = upsdrvquery_logout(conn);
+	if (loggedOut)
+		usleep(1000000);
+
+	upsdrvquery_disconnect(conn, loggedOut);
 	/* caller should free the conn */
 }
 
@@ -436,6 +457,7 @@ ssize_t upsdrvquery_prepare(udq_pipe_conn_t *conn, struct timeval tv) {
 
 	if (tv.tv_sec < 1 && tv.tv_usec < 1) {
 		upsdebugx(5, "%s: proclaiming readiness for tracked commands without flush of server messages", __func__);
+		conn->nobroadcast = 1;
 		return 1;
 	}
 
@@ -511,6 +533,7 @@ ssize_t upsdrvquery_prepare(udq_pipe_conn_t *conn, struct timeval tv) {
 
 finish:
 	upsdebugx(5, "%s: ready for tracked commands", __func__);
+	conn->nobroadcast = 1;
 	return 1;
 
 socket_error:
@@ -534,6 +557,7 @@ ssize_t upsdrvquery_restore_broadcast(udq_pipe_conn_t *conn)
 
 	upsdebugx(5, "%s: restored broadcast for connection on socket [%d]",
 		__func__, conn->sockfd);
+	conn->nobroadcast = 0;
 
 	return 1;
 }
@@ -669,15 +693,110 @@ socket_error:
 	return -1;
 }
 
+/* Connections kept by upsdrvquery_keep(1), one per socket name */
+static int	keep_conns = 0;
+static udq_pipe_conn_t	**kept_conns = NULL;
+static size_t	kept_count = 0;
+
+/* Forget a kept connection which failed, without the LOGOUT dialog */
+static void upsdrvquery_drop_kept(udq_pipe_conn_t *conn) {
+	size_t	i;
+
+	for (i = 0; i < kept_count; i++) {
+		if (kept_conns[i] == conn) {
+			upsdebugx(5, "%s: dropping connection to %s",
+				__func__, conn->sockfn);
+			upsdrvquery_disconnect(conn, 0);
+			free(conn);
+			kept_conns[i] = kept_conns[--kept_count];
+			return;
+		}
+	}
+}
+
+udq_pipe_conn_t *upsdrvquery_connect_kept(const char *sockfn) {
+	udq_pipe_conn_t	*conn;
+	size_t	i;
+
+	for (i = 0; i < kept_count; i++) {
+		conn = kept_conns[i];
+		if (strcmp(conn->sockfn, sockfn))
+			continue;
+
+#ifndef WIN32
+		{	/* the socket is non-blocking: a closed one reads as an
+			 * end of file, a live one has nothing or a stray line */
+			char	c;
+			ssize_t	ret = recv(conn->sockfd, &c, 1, MSG_PEEK);
+
+			if (ret == 0 || (ret < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+				upsdrvquery_drop_kept(conn);
+				break;
+			}
+		}
+#endif	/* !WIN32 */
+
+		upsdebugx(5, "%s: reusing connection to %s", __func__, sockfn);
+		return conn;
+	}
+
+	if ((conn = upsdrvquery_connect(sockfn)) == NULL)
+		return NULL;
+
+	kept_conns = (udq_pipe_conn_t **)xrealloc(kept_conns,
+		(kept_count + 1) * sizeof(*kept_conns));
+	kept_conns[kept_count++] = conn;
+
+	return conn;
+}
+
+void upsdrvquery_close_kept(void) {
+	size_t	i;
+	int	loggedOut = 0;
+
+	/* one goodbye pause for all of them */
+	for (i = 0; i < kept_count; i++) {
+		if (upsdrvquery_logout(kept_conns[i]))
+			loggedOut = 1;
+	}
+	if (loggedOut)
+		usleep(1000000);
+
+	for (i = 0; i < kept_count; i++) {
+		upsdrvquery_disconnect(kept_conns[i], loggedOut);
+		free(kept_conns[i]);
+	}
+
+	free(kept_conns);
+	kept_conns = NULL;
+	kept_count = 0;
+}
+
+void upsdrvquery_keep(int keep) {
+	keep_conns = keep;
+	if (!keep)
+		upsdrvquery_close_kept();
+}
+
+static ssize_t upsdrvquery_oneshot_conn_ex(udq_pipe_conn_t *conn, const char *query, char *buf, const size_t bufsz, struct timeval *ptv, int kept);
+
 ssize_t upsdrvquery_oneshot(
 	const char *drvname, const char *upsname,
 	const char *query,
 	char *buf, const size_t bufsz,
 	struct timeval *ptv
 ) {
-	udq_pipe_conn_t	*conn = upsdrvquery_connect_drvname_upsname(drvname, upsname);
+	udq_pipe_conn_t	*conn;
 	ssize_t	ret;
+	char	sockname[NUT_PATH_MAX + 1];
+
+	if (keep_conns) {
+		if (!upsdrvquery_sockname(drvname, upsname, sockname, sizeof(sockname)))
+			return -1;
+		return upsdrvquery_oneshot_sockfn(sockname, query, buf, bufsz, ptv);
+	}
 
+	conn = upsdrvquery_connect_drvname_upsname(drvname, upsname);
 	if (!conn || INVALID_FD(conn->sockfd))
 		return -1;
 
@@ -695,9 +814,21 @@ ssize_t upsdrvquery_oneshot_sockfn(
 	char *buf, const size_t bufsz,
 	struct timeval *ptv
 ) {
-	udq_pipe_conn_t	*conn = upsdrvquery_connect(sockfn);
+	udq_pipe_conn_t	*conn;
 	ssize_t	ret;
 
+	if (keep_conns) {
+		if ((conn = upsdrvquery_connect_kept(sockfn)) == NULL)
+			return -1;
+
+		ret = upsdrvquery_oneshot_conn_ex(conn, query, buf, bufsz, ptv, 1);
+		if (ret < 0)
+			upsdrvquery_drop_kept(conn);
+
+		return ret;
+	}
+
+	conn = upsdrvquery_connect(sockfn);
 	if (!conn || INVALID_FD(conn->sockfd))
 		return -1;
 
@@ -715,6 +846,17 @@ ssize_t upsdrvquery_oneshot_conn(
 	const char *query,
 	char *buf, const size_t bufsz,
 	struct timeval *ptv
+) {
+	return upsdrvquery_oneshot_conn_ex(conn, query, buf, bufsz, ptv, 0);
+}
+
+/* A kept connection is quieted once and stays so between the queries */
+static ssize_t upsdrvquery_oneshot_conn_ex(
+	udq_pipe_conn_t *conn,
+	const char *query,
+	char *buf, const size_t bufsz,
+	struct timeval *ptv,
+	int kept
 ) {
 	struct timeval	tv;
 	ssize_t	ret;
@@ -740,7 +882,9 @@ ssize_t upsdrvquery_oneshot_conn(
 	 * expects one line replies to a specific command,
 	 * so want to rule out the noise.
 	 */
-	if (upsdrvquery_prepare(conn, tv) < 0) {
+	if (!(kept && conn->nobroadcast)
+	&&  upsdrvquery_prepare(conn, tv) < 0
+	) {
 		ret = -1;
 		goto finish;
 	}
@@ -763,6 +907,7 @@ ssize_t upsdrvquery_oneshot_conn(
 	}
 
 finish:
-	upsdrvquery_restore_broadcast(conn); /* best effort */
+	if (!kept)
+		upsdrvquery_restore_broadcast(conn); /* best effort */
 	return ret;
 }
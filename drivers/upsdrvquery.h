@@ -33,6 +33,7 @@ typedef struct udq_pipe_conn_s {
 #endif	/* WIN32 */
 	char		buf[LARGEBUF];
 	char		sockfn[NUT_PATH_MAX + 1];
+	int		nobroadcast;	/* Set to 1 by upsdrvquery_prepare() */
 } udq_pipe_conn_t;
 
 udq_pipe_conn_t *upsdrvquery_connect(const char *sockfn);
@@ -53,6 +54,14 @@ ssize_t upsdrvquery_oneshot_sockfn(const char *sockfn, const char *query, char *
 /* One-shot using an existing connection (caller must close + free connection) */
 ssize_t upsdrvquery_oneshot_conn(udq_pipe_conn_t *conn, const char *query, char *buf, const size_t bufsz, struct timeval *tv);
 
+/* With upsdrvquery_keep(1), upsdrvquery_oneshot*() reuse the connection
+ * made to a driver socket by an earlier call (only quieted once, and not
+ * given back its broadcasts) instead of connecting and saying LOGOUT for
+ * each query; upsdrvquery_keep(0) or upsdrvquery_close_kept() close them */
+void upsdrvquery_keep(int keep);
+udq_pipe_conn_t *upsdrvquery_connect_kept(const char *sockfn);
+void upsdrvquery_close_kept(void);
+
 /* Internal toggle for some NUT programs that deal with Unix socket chatter.
  * For a detailed rationale comment see upsdrvquery.c */
 extern int nut_upsdrvquery_debug_level;
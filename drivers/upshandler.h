@@ -44,6 +44,13 @@ struct ups_handler
 {
 	int	(*setvar)(const char *, const char *);
 	int	(*instcmd)(const char *, const char *);
+
+	/* optional: settings (or commands) which came in a row in one BATCH,
+	 * to be done together where the device allows it; ret[] gets what
+	 * setvar() (or instcmd()) would have returned for each. Without
+	 * them, those are called once for each. */
+	void	(*setvar_batch)(size_t count, const char **varname, const char **val, int *ret);
+	void	(*instcmd_batch)(size_t count, const char **cmdname, const char **extra, int *ret);
 };
 
 /* Log levels; packagers might want to fiddle with NOTICE vs. WARN or ERR,
@@ -19,7 +19,9 @@
 
 #include "config.h"	/* must be first */
 #include "common.h"
+#include "nut_stdint.h"
 #include "usb-common.h"
+#include "iorec.h"
 
 int is_usb_device_supported(usb_device_id_t *usb_device_id_list, USBDevice_t *device)
 {
@@ -462,10 +464,19 @@ int nut_usb_get_string(
 		return -1;
 	}
 
+	if (iorec_mode == IOREC_REPLAY) {
+		len = (int)buflen - 1;
+		ret = nut_usb_iorec_replay("string", StringIdx, buf, &len);
+		buf[len > 0 ? len : 0] = '\0';
+		return ret;
+	}
+
 	/* request langid descriptor */
 	ret = nut_usb_get_string_descriptor(udev, 0, 0, buffer, 4);
-	if (ret < 0)
+	if (ret < 0) {
+		nut_usb_iorec_record("string", StringIdx, ret, NULL, 0);
 		return ret;
+	}
 
 	if (ret == 4 && buffer[0] >= 4 && buffer[1] == USB_DT_STRING) {
 		langid = buffer[2] | (buffer[3] << 8);
@@ -477,6 +488,7 @@ int nut_usb_get_string(
 	/* retrieve string in preferred language */
 	ret = nut_usb_get_string_descriptor(udev, StringIdx, langid, buffer, sizeof(buffer));
 	if (ret < 0) {
+		nut_usb_iorec_record("string", StringIdx, ret, NULL, 0);
 #ifdef WIN32
 		/* only for libusb0 ? */
 		errno = -ret;
@@ -496,5 +508,417 @@ int nut_usb_get_string(
 	}
 	buf[i] = '\0';
 
+	nut_usb_iorec_record("string", StringIdx, len, buf, len);
 	return len;
 }
+
+#define USB_ENUMCACHE_FILE	"usb-enum.cache"
+#define USB_ENUMCACHE_HEADER	"NUT-USB-ENUM 1"
+
+typedef struct {
+	uint16_t	vid, pid, bcd;
+	char	*bus, *device;
+	char	*vendor, *product, *serial;
+	int	seen;	/* in this scan */
+} usb_enumcache_entry_t;
+
+static usb_enumcache_entry_t	*enumcache = NULL;
+static size_t	enumcache_count = 0, enumcache_alloc = 0;
+static int	enumcache_changed = 0;
+
+static void enumcache_path(char *fn, size_t fnlen)
+{
+	snprintf(fn, fnlen, "%s/%s", dflt_statepath(), USB_ENUMCACHE_FILE);
+}
+
+/* a string field of a line: empty for none, else prefixed by '=' */
+static char *enumcache_field(char **p)
+{
+	char	*s = *p, *end;
+
+	if (!s) {
+		return NULL;
+	}
+
+	if ((end = strchr(s, '\t')) != NULL) {
+		*end = '\0';
+		*p = end + 1;
+	} else {
+		*p = NULL;
+	}
+
+	return (*s == '=') ? xstrdup(s + 1) : NULL;
+}
+
+/* strings which would not fit in a field are not cached */
+static int enumcache_storable(const char *s)
+{
+	return !s || !strpbrk(s, "\t\n");
+}
+
+static void enumcache_entry_free(usb_enumcache_entry_t *e)
+{
+	free(e->bus);
+	free(e->device);
+	free(e->vendor);
+	free(e->product);
+	free(e->serial);
+}
+
+static usb_enumcache_entry_t *enumcache_find(const USBDevice_t *hd)
+{
+	size_t	i;
+
+	if (!hd->Bus || !hd->Device) {
+		return NULL;
+	}
+
+	for (i = 0; i < enumcache_count; i++) {
+		usb_enumcache_entry_t	*e = &enumcache[i];
+
+		if (e->vid == hd->VendorID && e->pid == hd->ProductID
+		 && e->bcd == hd->bcdDevice
+		 && !strcmp(e->bus, hd->Bus) && !strcmp(e->device, hd->Device)
+		) {
+			return e;
+		}
+	}
+
+	return NULL;
+}
+
+static usb_enumcache_entry_t *enumcache_add(void)
+{
+	if (enumcache_count >= enumcache_alloc) {
+		enumcache_alloc = enumcache_alloc ? 2 * enumcache_alloc : 16;
+		enumcache = xrealloc(enumcache, enumcache_alloc * sizeof(*enumcache));
+	}
+
+	memset(&enumcache[enumcache_count], 0, sizeof(*enumcache));
+	return &enumcache[enumcache_count++];
+}
+
+void nut_usb_enumcache_load(void)
+{
+	char	fn[NUT_PATH_MAX + 1], line[LARGEBUF];
+	FILE	*f;
+
+	nut_usb_enumcache_save();	/* drop what a previous scan left */
+
+	enumcache_path(fn, sizeof(fn));
+	if ((f = fopen(fn, "r")) == NULL) {
+		upsdebugx(3, "%s: no USB enumeration cache in %s", __func__, fn);
+		return;
+	}
+
+	if (!fgets(line, sizeof(line), f)
+	 || strncmp(line, USB_ENUMCACHE_HEADER "\n", sizeof(USB_ENUMCACHE_HEADER))
+	) {
+		upsdebugx(1, "%s: ignoring %s, not a USB enumeration cache", __func__, fn);
+		fclose(f);
+		return;
+	}
+
+	while (fgets(line, sizeof(line), f)) {
+		unsigned int	vid, pid, bcd;
+		char	bus[SMALLBUF], device[SMALLBUF], *p, *nl;
+		usb_enumcache_entry_t	*e;
+
+		if ((nl = strchr(line, '\n')) == NULL) {
+			break;	/* cut short, e.g. by a full disk */
+		}
+		*nl = '\0';
+
+		if ((p = strchr(line, '\t')) == NULL
+		 || sscanf(line, "%x:%x:%x %63s %63s", &vid, &pid, &bcd, bus, device) != 5
+		) {
+			continue;
+		}
+		p++;
+
+		e = enumcache_add();
+		e->vid = (uint16_t)vid;
+		e->pid = (uint16_t)pid;
+		e->bcd = (uint16_t)bcd;
+		e->bus = xstrdup(bus);
+		e->device = xstrdup(device);
+		e->vendor = enumcache_field(&p);
+		e->product = enumcache_field(&p);
+		e->serial = enumcache_field(&p);
+	}
+
+	fclose(f);
+	upsdebugx(3, "%s: %" PRIuSIZE " USB devices known from %s",
+		__func__, enumcache_count, fn);
+}
+
+int nut_usb_enumcache_get(USBDevice_t *hd)
+{
+	usb_enumcache_entry_t	*e = enumcache_find(hd);
+
+	if (!e) {
+		return 0;
+	}
+
+	e->seen = 1;
+	hd->Vendor = e->vendor;
+	hd->Product = e->product;
+	hd->Serial = e->serial;
+
+	return 1;
+}
+
+void nut_usb_enumcache_put(const USBDevice_t *hd)
+{
+	usb_enumcache_entry_t	*e;
+
+	if (!hd->Bus || !hd->Device
+	 || !enumcache_storable(hd->Vendor) || !enumcache_storable(hd->Product)
+	 || !enumcache_storable(hd->Serial)
+	) {
+		return;
+	}
+
+	if ((e = enumcache_find(hd)) != NULL) {
+		e->seen = 1;
+		if (!strcmp(e->vendor ? e->vendor : "", hd->Vendor ? hd->Vendor : "")
+		 && !strcmp(e->product ? e->product : "", hd->Product ? hd->Product : "")
+		 && !strcmp(e->serial ? e->serial : "", hd->Serial ? hd->Serial : "")
+		) {
+			return;
+		}
+		enumcache_entry_free(e);
+		memset(e, 0, sizeof(*e));
+	} else {
+		e = enumcache_add();
+	}
+
+	e->vid = hd->VendorID;
+	e->pid = hd->ProductID;
+	e->bcd = hd->bcdDevice;
+	e->bus = xstrdup(hd->Bus);
+	e->device = xstrdup(hd->Device);
+	e->vendor = hd->Vendor ? xstrdup(hd->Vendor) : NULL;
+	e->product = hd->Product ? xstrdup(hd->Product) : NULL;
+	e->serial = hd->Serial ? xstrdup(hd->Serial) : NULL;
+	e->seen = 1;
+	enumcache_changed = 1;
+}
+
+void nut_usb_enumcache_save(void)
+{
+	char	fn[NUT_PATH_MAX + 1], tmp[NUT_PATH_MAX + 1];
+	FILE	*f = NULL;
+	size_t	i;
+
+	/* devices not seen any more are gone, or at another address */
+	for (i = 0; i < enumcache_count; i++) {
+		if (!enumcache[i].seen) {
+			enumcache_changed = 1;
+		}
+	}
+
+	if (enumcache_changed) {
+		enumcache_path(fn, sizeof(fn));
+		snprintf(tmp, sizeof(tmp), "%s.%ld", fn, (long)getpid());
+
+		if ((f = fopen(tmp, "w")) == NULL) {
+			upsdebug_with_errno(2, "%s: can not write %s", __func__, tmp);
+		} else {
+			fprintf(f, "%s\n", USB_ENUMCACHE_HEADER);
+		}
+	}
+
+	for (i = 0; i < enumcache_count; i++) {
+		usb_enumcache_entry_t	*e = &enumcache[i];
+
+		if (f && e->seen) {
+			fprintf(f, "%04x:%04x:%04x %s %s\t%s%s\t%s%s\t%s%s\n",
+				e->vid, e->pid, e->bcd, e->bus, e->device,
+				e->vendor ? "=" : "", e->vendor ? e->vendor : "",
+				e->product ? "=" : "", e->product ? e->product : "",
+				e->serial ? "=" : "", e->serial ? e->serial : "");
+		}
+		enumcache_entry_free(e);
+	}
+
+	/* written aside and renamed, as the other drivers may read it */
+	if (f) {
+		if (fclose(f) != 0 || rename(tmp, fn) != 0) {
+			upsdebug_with_errno(2, "%s: can not update %s", __func__, fn);
+			unlink(tmp);
+		} else {
+			upsdebugx(3, "%s: updated %s", __func__, fn);
+		}
+	}
+
+	free(enumcache);
+	enumcache = NULL;
+	enumcache_count = enumcache_alloc = 0;
+	enumcache_changed = 0;
+}
+
+/* What a replayed device (see iorec.c) is opened as: the methods of
+ * usb_communication_subdriver_t only check it is not NULL, and then
+ * answer from the recording without handing it to libusb. */
+static char	iorec_udev;
+
+/* API neutral: record a transfer <op> of the methods (<key> being a report
+ * or string index, -1 if none) with the raw result <ret> of libusb and the
+ * <len> bytes it moved */
+void nut_usb_iorec_record(const char *op, int key, int ret,
+	const void *data, int len)
+{
+	char	keybuf[SMALLBUF];
+
+	if (iorec_mode != IOREC_RECORD) {
+		return;
+	}
+
+	snprintf(keybuf, sizeof(keybuf), "0x%02x", (unsigned int)key);
+	iorec_record("usb", op, key < 0 ? NULL : keybuf, (long)ret,
+		data, len > 0 ? (size_t)len : 0);
+}
+
+/* API neutral: replay a transfer recorded as above instead of doing it,
+ * filling up to <*len> bytes of <buf> and setting <*len> to their count;
+ * returns the recorded libusb result (0 with no data at the end) */
+int nut_usb_iorec_replay(const char *op, int key, void *buf, int *len)
+{
+	char	keybuf[SMALLBUF];
+	size_t	n = (*len > 0) ? (size_t)*len : 0;
+	long	ret = 0;
+
+	snprintf(keybuf, sizeof(keybuf), "0x%02x", (unsigned int)key);
+	if (!iorec_replay("usb", op, key < 0 ? NULL : keybuf, &ret, buf, &n)) {
+		ret = 0;
+		n = 0;
+	}
+
+	*len = (int)n;
+	return (int)ret;
+}
+
+/* API neutral: record what the open method learnt about the device it
+ * has chosen, for nut_usb_iorec_open() to replay */
+void nut_usb_iorec_device(USBDevice_t *hd, usb_ctrl_charbuf rdbuf, int rdlen)
+{
+	char	key[SMALLBUF], info[LARGEBUF];
+
+	if (iorec_mode != IOREC_RECORD) {
+		return;
+	}
+
+	snprintf(key, sizeof(key), "%04x:%04x", hd->VendorID, hd->ProductID);
+	snprintf(info, sizeof(info), "%s\n%s\n%s\n%s\n%s",
+		hd->Vendor ? hd->Vendor : "",
+		hd->Product ? hd->Product : "",
+		hd->Serial ? hd->Serial : "",
+		hd->Bus ? hd->Bus : "",
+		hd->Device ? hd->Device : "");
+
+	iorec_record("usb", "device", key, (long)hd->bcdDevice, info, strlen(info));
+	iorec_record("usb", "rdesc", NULL, (long)rdlen, rdbuf,
+		rdlen > 0 ? (size_t)rdlen : 0);
+}
+
+static char *iorec_field(char **p)
+{
+	char	*s = *p, *end;
+
+	if (!s) {
+		return NULL;
+	}
+
+	if ((end = strchr(s, '\n')) != NULL) {
+		*end = '\0';
+		*p = end + 1;
+	} else {
+		*p = NULL;
+	}
+
+	return *s ? xstrdup(s) : NULL;
+}
+
+/* API neutral: open the recorded device instead of a real one, with the
+ * same matching and callback as the open methods; returns the report
+ * descriptor length (or 1 without callback), or -1 if it is not usable */
+int nut_usb_iorec_open(usb_dev_handle **udevp, USBDevice_t *curDevice,
+	USBDeviceMatcher_t *matcher,
+	int (*callback)(usb_dev_handle *udev, USBDevice_t *hd,
+		usb_ctrl_charbuf rdbuf, usb_ctrl_charbufsize rdlen))
+{
+	char	info[LARGEBUF], key[SMALLBUF], *p = info;
+	usb_ctrl_char	rdbuf[0x1800];
+	size_t	len = sizeof(info) - 1;
+	long	ret;
+	unsigned int	vid = 0, pid = 0;
+	USBDeviceMatcher_t	*m;
+
+	*udevp = NULL;
+
+	if (!iorec_replay("usb", "device", NULL, &ret, info, &len)) {
+		return -1;
+	}
+	info[len] = '\0';
+
+	free(curDevice->Vendor);
+	free(curDevice->Product);
+	free(curDevice->Serial);
+	free(curDevice->Bus);
+	free(curDevice->Device);
+#if (defined WITH_USB_BUSPORT) && (WITH_USB_BUSPORT)
+	free(curDevice->BusPort);
+#endif
+	memset(curDevice, '\0', sizeof(*curDevice));
+
+	curDevice->Vendor = iorec_field(&p);
+	curDevice->Product = iorec_field(&p);
+	curDevice->Serial = iorec_field(&p);
+	curDevice->Bus = iorec_field(&p);
+	curDevice->Device = iorec_field(&p);
+	curDevice->bcdDevice = (uint16_t)ret;
+
+	/* the IDs are kept in the key, readable in the recording */
+	if (!iorec_replay_key(key, sizeof(key))
+	 || sscanf(key, "%x:%x", &vid, &pid) != 2
+	) {
+		upsdebugx(1, "%s: recorded device has no IDs", __func__);
+		return -1;
+	}
+	curDevice->VendorID = (uint16_t)vid;
+	curDevice->ProductID = (uint16_t)pid;
+
+	upsdebugx(2, "Replaying recorded device %04x:%04x (%s, %s)",
+		curDevice->VendorID, curDevice->ProductID,
+		curDevice->Vendor ? curDevice->Vendor : "unknown",
+		curDevice->Product ? curDevice->Product : "unknown");
+
+	for (m = matcher; m; m = m->next) {
+		ret = m->match_function(curDevice, m->privdata);
+		if (ret == -1) {
+			fatal_with_errno(EXIT_FAILURE, "matcher");
+		}
+		if (ret != 1) {
+			upsdebugx(2, "Recorded device does not match");
+			return -1;
+		}
+	}
+
+	*udevp = (usb_dev_handle *)&iorec_udev;
+
+	if (!callback) {
+		return 1;
+	}
+
+	len = sizeof(rdbuf);
+	if (!iorec_replay("usb", "rdesc", NULL, &ret, rdbuf, &len)
+	 || ret < 1 || callback(*udevp, curDevice, rdbuf, (usb_ctrl_charbufsize)len) < 1
+	) {
+		upsdebugx(2, "Recorded device not accepted");
+		*udevp = NULL;
+		return -1;
+	}
+
+	return (int)len;
+}
@@ -565,4 +565,30 @@ void warn_if_bad_usb_port_filename(const char *fn);
  * langid descriptor is invalid. */
 int nut_usb_get_string(usb_dev_handle *udev, int StringIdx, char *buf, size_t buflen);
 
+/* Recording and replay of the device I/O (see iorec.h) by the open
+ * methods: keep what was learnt about the chosen device, or open the
+ * recorded one (returning like them) without touching libusb */
+void nut_usb_iorec_record(const char *op, int key, int ret,
+	const void *data, int len);
+int nut_usb_iorec_replay(const char *op, int key, void *buf, int *len);
+void nut_usb_iorec_device(USBDevice_t *hd, usb_ctrl_charbuf rdbuf, int rdlen);
+int nut_usb_iorec_open(usb_dev_handle **udevp, USBDevice_t *curDevice,
+	USBDeviceMatcher_t *matcher,
+	int (*callback)(usb_dev_handle *udev, USBDevice_t *hd,
+		usb_ctrl_charbuf rdbuf, usb_ctrl_charbufsize rdlen));
+
+/* Drivers of one host share what they learnt of the USB devices (their
+ * strings, which take opening each one and several control transfers to
+ * read) in a file of the state path, so that after a bus reset each of
+ * them only opens the device it is after. Entries are keyed by the IDs,
+ * bus and address, which change when a device is plugged again.
+ * nut_usb_enumcache_get() fills the strings of <hd> (which it owns) if it
+ * is known, nut_usb_enumcache_put() records those of a device read anew,
+ * and nut_usb_enumcache_save() writes the entries of the devices seen in
+ * this scan back if anything changed, and drops the others. */
+void nut_usb_enumcache_load(void);
+int nut_usb_enumcache_get(USBDevice_t *hd);
+void nut_usb_enumcache_put(const USBDevice_t *hd);
+void nut_usb_enumcache_save(void);
+
 #endif /* NUT_USB_COMMON_H */
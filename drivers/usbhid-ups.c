@@ -29,15 +29,17 @@
  */
 
 #define DRIVER_NAME	"Generic HID driver"
-#define DRIVER_VERSION	"0.65"
+#define DRIVER_VERSION	"0.70"
 
 #define HU_VAR_WAITBEFORERECONNECT "waitbeforereconnect"
 
 #include "main.h"	/* Must be first, includes "config.h" */
+#include <ctype.h>
 #include "nut_stdint.h"
 #include "libhid.h"
 #include "usbhid-ups.h"
 #include "hidparser.h"
+#include "lkp_index.h"
 #include "hidtypes.h"
 #include "common.h"
 #ifdef WIN32
@@ -250,13 +252,17 @@ static time_t last_rb_start = 0;
 /* support functions */
 static hid_info_t *find_nut_info(const char *varname);
 static hid_info_t *find_hid_info(const HIDData_t *hiddata);
+static void hu_build_maps(void);
+static void hu_free_maps(void);
 static const char *hu_find_infoval(info_lkp_t *hid2info, const double value);
 static long hu_find_valinfo(info_lkp_t *hid2info, const char* value);
 static void process_boolean_info(const char *nutvalue);
 static void ups_alarm_set(void);
 static void ups_status_set(void);
 static bool_t hid_ups_walk(walkmode_t mode);
+static bool_t hid_ups_walk_items(walkmode_t mode);
 static int reconnect_ups(void);
+static void hu_process_events(HIDData_t **event, int evtCount);
 static int ups_infoval_set(hid_info_t *item, double value);
 static int callback(hid_dev_handle_t argudev, HIDDevice_t *arghd,
 					usb_ctrl_charbuf rdbuf, usb_ctrl_charbufsize rdlen);
@@ -264,6 +270,19 @@ static int callback(hid_dev_handle_t argudev, HIDDevice_t *arghd,
 static double interval(void);
 #endif
 
+/* reverse maps of subdriver->hid2nut, made by each HU_WALKMODE_INIT walk:
+ * by HID object (indexed like pDesc->item) and by NUT name (a hash table
+ * of hu_nut_map_size slots, a power of 2) */
+static hid_info_t	**hu_hid_map = NULL;
+static size_t	hu_hid_map_size = 0;
+static hid_info_t	**hu_nut_map = NULL;
+static size_t	hu_nut_map_size = 0;
+
+/* for each element of subdriver->hid2nut, the change of its report which
+ * it was last decoded from by a walk (see HIDGetDataValueChanged()) */
+static unsigned long	*hu_item_gen = NULL;
+static size_t	hu_item_gen_size = 0;
+
 /* global variables */
 HIDDesc_t	*pDesc = NULL;		/* parsed Report Descriptor */
 reportbuf_t	*reportbuf = NULL;	/* buffer for most recent reports */
@@ -1144,6 +1163,9 @@ void upsdrv_makevartable(void)
 	addvar(VAR_FLAG, "powercom_sdcmd_byte_order_fallback",
 		"Set to use legacy byte order for Powercom HID shutdown commands. Either it was wrong forever, or some older devices/firmwares had it the other way around");
 
+	addvar(VAR_FLAG, "hidcache",
+		"Keep the parsed report descriptor in a file of the state path, for faster restarts");
+
 #if !((defined SHUT_MODE) && SHUT_MODE)
 	addvar(VAR_VALUE, "subdriver", "Explicit USB HID subdriver selection");
 
@@ -1167,14 +1189,61 @@ void upsdrv_makevartable(void)
 #endif	/* SHUT_MODE / USB */
 }
 
+/* process the events got from the interrupt pipe */
 #define	MAX_EVENT_NUM	32
 
-void upsdrv_updateinfo(void)
+static void hu_process_events(HIDData_t **event, int evtCount)
 {
 	hid_info_t	*item;
-	HIDData_t	*event[MAX_EVENT_NUM], *found_data;
-	int		i, evtCount;
-	double		value;
+	HIDData_t	*found_data;
+	int		i;
+	double		value[MAX_EVENT_NUM];
+	int		ret[MAX_EVENT_NUM];
+
+	if (evtCount > MAX_EVENT_NUM) {
+		evtCount = MAX_EVENT_NUM;
+	}
+
+	/* the events come in a few reports, decoded in one go each */
+	HIDGetDataValues(udev, event, value, ret, evtCount, drv_poll_interval_msec());
+
+	for (i = 0; i < evtCount; i++) {
+
+		if (ret[i] != 1)
+			continue;
+
+		if (nut_debug_level >= 2) {
+			upsdebugx(2,
+				"Path: %s, Type: %s, ReportID: 0x%02x, "
+				"Offset: %i, Size: %i, Value: %g",
+				HIDGetDataItem(event[i], subdriver->utab),
+				HIDDataType(event[i]), event[i]->ReportID,
+				event[i]->Offset, event[i]->Size, value[i]);
+		}
+
+		/* Skip Input reports, if we don't use the Feature report */
+		found_data = FindObject_with_Path(pDesc, &(event[i]->Path), interrupt_only ? ITEM_INPUT:ITEM_FEATURE);
+		if (!found_data && !interrupt_only) {
+			found_data = FindObject_with_Path(pDesc, &(event[i]->Path), ITEM_INPUT);
+		}
+		if (!found_data) {
+			upsdebugx(2, "Could not find event as either ITEM_INPUT or ITEM_FEATURE?");
+			continue;
+		}
+		item = find_hid_info(found_data);
+		if (!item) {
+			upsdebugx(3, "NUT doesn't use this HID object");
+			continue;
+		}
+
+		ups_infoval_set(item, value[i]);
+	}
+}
+
+void upsdrv_updateinfo(void)
+{
+	HIDData_t	*event[MAX_EVENT_NUM];
+	int		evtCount;
 	time_t		now;
 
 	upsdebugx(1, "upsdrv_updateinfo...");
@@ -1270,37 +1339,7 @@ void upsdrv_updateinfo(void)
 	}
 
 	/* Process pending events (HID notifications on Interrupt pipe) */
-	for (i = 0; i < evtCount; i++) {
-
-		if (HIDGetDataValue(udev, event[i], &value, poll_interval) != 1)
-			continue;
-
-		if (nut_debug_level >= 2) {
-			upsdebugx(2,
-				"Path: %s, Type: %s, ReportID: 0x%02x, "
-				"Offset: %i, Size: %i, Value: %g",
-				HIDGetDataItem(event[i], subdriver->utab),
-				HIDDataType(event[i]), event[i]->ReportID,
-				event[i]->Offset, event[i]->Size, value);
-		}
-
-		/* Skip Input reports, if we don't use the Feature report */
-		found_data = FindObject_with_Path(pDesc, &(event[i]->Path), interrupt_only ? ITEM_INPUT:ITEM_FEATURE);
-		if (!found_data && !interrupt_only) {
-			found_data = FindObject_with_Path(pDesc, &(event[i]->Path), ITEM_INPUT);
-		}
-		if (!found_data) {
-			upsdebugx(2, "Could not find event as either ITEM_INPUT or ITEM_FEATURE?");
-			continue;
-		}
-		item = find_hid_info(found_data);
-		if (!item) {
-			upsdebugx(3, "NUT doesn't use this HID object");
-			continue;
-		}
-
-		ups_infoval_set(item, value);
-	}
+	hu_process_events(event, evtCount);
 #ifdef DEBUG
 	upsdebugx(1, "took %.3f seconds handling interrupt reports...",
 		interval());
@@ -1332,6 +1371,19 @@ void upsdrv_updateinfo(void)
 			return;
 	}
 
+#if !((defined SHUT_MODE) && SHUT_MODE) && (defined WITH_LIBUSB_1_0) && WITH_LIBUSB_1_0
+	/* reports which came in on the interrupt pipe during the walk (they
+	 * are read asynchronously, see libusb1.c) need not wait for the
+	 * next update */
+	while (use_interrupt_pipe == TRUE && nut_libusb_interrupt_pending()) {
+		evtCount = HIDGetEvents(udev, event, MAX_EVENT_NUM);
+		if (evtCount <= 0)
+			break;
+		upsdebugx(1, "Got %i more HID objects...", evtCount);
+		hu_process_events(event, evtCount);
+	}
+#endif	/* USB with libusb-1.0 */
+
 	ups_status_set();
 	buzzmode_commit();
 	status_commit();
@@ -1646,6 +1698,7 @@ void upsdrv_initups(void)
 	if (hid_ups_walk(HU_WALKMODE_INIT) == FALSE) {
 		fatalx(EXIT_FAILURE, "Can't initialize data from HID UPS");
 	}
+	HIDCacheSave();
 
 	/* Set values below from user settings only if supported by UPS */
 	if (dstate_getinfo("battery.charge.low")) {
@@ -1713,6 +1766,13 @@ void upsdrv_cleanup(void)
 	upsdebugx(1, "upsdrv_cleanup...");
 
 	comm_driver->close_dev(udev);
+	hu_free_maps();
+	free(hu_item_gen);
+	hu_item_gen = NULL;
+	HIDCacheSave();
+	HIDCacheFree();
+	HIDStringCacheFree();
+	lkp_index_free();
 	Free_ReportDesc(pDesc);
 	free_report_buffer(reportbuf);
 #if !((defined SHUT_MODE) && SHUT_MODE)
@@ -1817,23 +1877,6 @@ static int callback(
 	hd = arghd;
 	udev = argudev;
 
-	/* Parse Report Descriptor */
-	Free_ReportDesc(pDesc);
-	pDesc = Parse_ReportDesc(rdbuf, rdlen);
-	if (!pDesc) {
-		upsdebug_with_errno(1, "Failed to parse report descriptor!");
-		return 0;
-	}
-
-	/* prepare report buffer */
-	free_report_buffer(reportbuf);
-	reportbuf = new_report_buffer(pDesc);
-	if (!reportbuf) {
-		upsdebug_with_errno(1, "Failed to allocate report buffer!");
-		Free_ReportDesc(pDesc);
-		return 0;
-	}
-
 	/* select the subdriver for this device */
 	subdriver = match_function_subdriver_name(0);
 	if (!subdriver) {
@@ -1853,6 +1896,25 @@ static int callback(
 
 	upslogx(LOG_INFO, "Using subdriver: %s", subdriver->name);
 
+	/* Parse Report Descriptor (or get it from the cache) */
+	hu_free_maps();
+	Free_ReportDesc(pDesc);
+	pDesc = HIDParseCached(testvar("hidcache") ? dflt_statepath() : NULL,
+		hd, subdriver->name, subdriver->utab, rdbuf, rdlen);
+	if (!pDesc) {
+		upsdebug_with_errno(1, "Failed to parse report descriptor!");
+		return 0;
+	}
+
+	/* prepare report buffer */
+	free_report_buffer(reportbuf);
+	reportbuf = new_report_buffer(pDesc);
+	if (!reportbuf) {
+		upsdebug_with_errno(1, "Failed to allocate report buffer!");
+		Free_ReportDesc(pDesc);
+		return 0;
+	}
+
 	if (subdriver->fix_report_desc(arghd, pDesc)) {
 		upsdebugx(2, "Report Descriptor Fixed");
 	}
@@ -1927,8 +1989,42 @@ int fix_report_desc(HIDDevice_t *arg_pDev, HIDDesc_t *arg_pDesc) {
 	return 0;
 }
 
-/* walk ups variables and set elements of the info array. */
+/* May the walk leave alone an item the report of which came back the
+ * same as when it was decoded last? Not in the init walk, nor those which
+ * depend on more than their bytes: the alarms (set anew in each full
+ * update) and the items converted by a function of the subdriver, which
+ * may look at other data. */
+static int hu_item_skips_unchanged(const hid_info_t *item, walkmode_t mode)
+{
+	size_t	i = (size_t)(item - subdriver->hid2nut);
+
+	if (mode == HU_WALKMODE_INIT || i >= hu_item_gen_size) {
+		return 0;
+	}
+
+	if (!strncmp(item->info_type, "ups.alarm", 9)
+	 || (item->hid2info != NULL && item->hid2info->fun != NULL)
+	) {
+		return 0;
+	}
+
+	return 1;
+}
+
+/* walk ups variables and set elements of the info array: each report
+ * the items of which are needed is requested from the device once. */
 static bool_t hid_ups_walk(walkmode_t mode)
+{
+	bool_t	ret;
+
+	HIDBeginCycle(reportbuf);
+	ret = hid_ups_walk_items(mode);
+	HIDEndCycle(reportbuf);
+
+	return ret;
+}
+
+static bool_t hid_ups_walk_items(walkmode_t mode)
 {
 	hid_info_t	*item;
 	double		value;
@@ -1943,6 +2039,19 @@ static bool_t hid_ups_walk(walkmode_t mode)
 	/* 3 modes: HU_WALKMODE_INIT, HU_WALKMODE_QUICK_UPDATE
 	 * and HU_WALKMODE_FULL_UPDATE */
 
+	/* the init walk decodes everything, and notes from what */
+	if (mode == HU_WALKMODE_INIT) {
+		size_t	count = 0;
+
+		for (item = subdriver->hid2nut; item->info_type != NULL; item++) {
+			count++;
+		}
+
+		free(hu_item_gen);
+		hu_item_gen = calloc(count ? count : 1, sizeof(*hu_item_gen));
+		hu_item_gen_size = hu_item_gen ? count : 0;
+	}
+
 	/* Device data walk ----------------------------- */
 	for (item = subdriver->hid2nut; item->info_type != NULL; item++) {
 
@@ -2068,7 +2177,12 @@ static bool_t hid_ups_walk(walkmode_t mode)
 		}
 #endif	/* !SHUT_MODE => USB */
 
-		retcode = HIDGetDataValue(udev, item->hiddata, &value, poll_interval);
+		if (hu_item_skips_unchanged(item, mode)) {
+			retcode = HIDGetDataValueChanged(udev, item->hiddata, &value,
+				drv_poll_interval_msec(), &hu_item_gen[item - subdriver->hid2nut]);
+		} else {
+			retcode = HIDGetDataValue(udev, item->hiddata, &value, drv_poll_interval_msec());
+		}
 
 		switch (retcode)
 		{
@@ -2102,6 +2216,12 @@ static bool_t hid_ups_walk(walkmode_t mode)
 		case 1:
 			break;	/* Found! */
 
+		case 2:
+			/* Same report as last time, so all is still as set then */
+			upsdebugx(5, "Path: %s, ReportID: 0x%02x: unchanged",
+				item->hidpath, item->hiddata->ReportID);
+			continue;
+
 		case 0:
 			continue;
 
@@ -2166,6 +2286,10 @@ static bool_t hid_ups_walk(walkmode_t mode)
 		}
 	}
 
+	if (mode == HU_WALKMODE_INIT) {
+		hu_build_maps();
+	}
+
 	return TRUE;
 }
 
@@ -2203,6 +2327,7 @@ static int reconnect_ups(void)
 	upsdebugx(4, "===================================================================");
 
 	upsdebugx(4, "Opening comm_driver ...");
+	HIDStringCacheFree();
 	ret = comm_driver->open_dev(&udev, &curDevice, subdriver_matcher, NULL);
 	upsdebugx(4, "Opening comm_driver returns ret=%i", ret);
 	if (ret > 0) {
@@ -2588,6 +2713,84 @@ static void ups_status_set(void)
 	}
 }
 
+static void hu_free_maps(void)
+{
+	free(hu_hid_map);
+	hu_hid_map = NULL;
+	hu_hid_map_size = 0;
+
+	free(hu_nut_map);
+	hu_nut_map = NULL;
+	hu_nut_map_size = 0;
+}
+
+/* make the reverse maps of the info array, for find_nut_info() and
+ * find_hid_info() to keep to the first matching element as if they
+ * went through it; if they can not be allocated, they do that */
+static void hu_build_maps(void)
+{
+	hid_info_t	*hidups_item;
+	size_t	count = 0;
+
+	hu_free_maps();
+
+	if (!pDesc || !pDesc->nitems) {
+		return;
+	}
+
+	for (hidups_item = subdriver->hid2nut; hidups_item->info_type != NULL; hidups_item++) {
+		count++;
+	}
+
+	hu_hid_map = calloc(pDesc->nitems, sizeof(*hu_hid_map));
+	for (hu_nut_map_size = 16; hu_nut_map_size < count * 2; hu_nut_map_size *= 2)
+		;
+	hu_nut_map = calloc(hu_nut_map_size, sizeof(*hu_nut_map));
+
+	if (!hu_hid_map || !hu_nut_map) {
+		upsdebugx(1, "%s: out of memory, lookups will walk the info array", __func__);
+		hu_free_maps();
+		return;
+	}
+	hu_hid_map_size = pDesc->nitems;
+
+	for (hidups_item = subdriver->hid2nut; hidups_item->info_type != NULL; hidups_item++) {
+		size_t	i;
+
+		if (hidups_item->hiddata == NULL) {
+			continue;
+		}
+
+		/* the first element of each name... */
+		for (i = str_hash_nocase(hidups_item->info_type) & (hu_nut_map_size - 1);
+			hu_nut_map[i] != NULL;
+			i = (i + 1) & (hu_nut_map_size - 1)
+		) {
+			if (!strcasecmp(hu_nut_map[i]->info_type, hidups_item->info_type))
+				break;
+		}
+		if (hu_nut_map[i] == NULL) {
+			hu_nut_map[i] = hidups_item;
+		}
+
+		/* ...and of each HID object, not counting server side vars */
+		if (hidups_item->hidflags & HU_FLAG_ABSENT) {
+			continue;
+		}
+
+		if (hidups_item->hiddata >= pDesc->item
+		 && hidups_item->hiddata < pDesc->item + pDesc->nitems
+		) {
+			i = (size_t)(hidups_item->hiddata - pDesc->item);
+			if (hu_hid_map[i] == NULL) {
+				hu_hid_map[i] = hidups_item;
+			}
+		}
+	}
+
+	upsdebugx(2, "%s: %" PRIuSIZE " info elements mapped", __func__, count);
+}
+
 /* find info element definition in info array
  * by NUT varname.
  */
@@ -2595,6 +2798,21 @@ static hid_info_t *find_nut_info(const char *varname)
 {
 	hid_info_t *hidups_item;
 
+	if (hu_nut_map) {
+		size_t	i;
+
+		for (i = str_hash_nocase(varname) & (hu_nut_map_size - 1);
+			hu_nut_map[i] != NULL;
+			i = (i + 1) & (hu_nut_map_size - 1)
+		) {
+			if (!strcasecmp(hu_nut_map[i]->info_type, varname))
+				return hu_nut_map[i];
+		}
+
+		upsdebugx(2, "find_nut_info: unknown info type: %s", varname);
+		return NULL;
+	}
+
 	for (hidups_item = subdriver->hid2nut; hidups_item->info_type != NULL ; hidups_item++) {
 
 		if (strcasecmp(hidups_item->info_type, varname))
@@ -2620,6 +2838,12 @@ static hid_info_t *find_hid_info(const HIDData_t *hiddata)
 		return NULL;
 	}
 
+	if (hu_hid_map && hu_hid_map_size == pDesc->nitems
+	 && hiddata >= pDesc->item && hiddata < pDesc->item + pDesc->nitems
+	) {
+		return hu_hid_map[hiddata - pDesc->item];
+	}
+
 	for (hidups_item = subdriver->hid2nut; hidups_item->info_type != NULL ; hidups_item++) {
 
 		/* Skip server side vars */
@@ -2633,11 +2857,29 @@ static hid_info_t *find_hid_info(const HIDData_t *hiddata)
 	return NULL;
 }
 
+/* how lkp_index() reads the hid2info tables, which end with a NULL nut_value */
+static int hu_lkp_is_end(const void *entry)
+{
+	return ((const info_lkp_t *)entry)->nut_value == NULL;
+}
+
+static long hu_lkp_num(const void *entry)
+{
+	return ((const info_lkp_t *)entry)->hid_value;
+}
+
+static const char *hu_lkp_str(const void *entry)
+{
+	return ((const info_lkp_t *)entry)->nut_value;
+}
+
+static const lkp_index_ops_t	hu_lkp_ops = { hu_lkp_is_end, hu_lkp_num, hu_lkp_str };
+
 /* find the HID Item value matching that NUT value */
 /* useful for set with value lookup... */
 static long hu_find_valinfo(info_lkp_t *hid2info, const char* value)
 {
-	info_lkp_t	*info_lkp;
+	const info_lkp_t	*info_lkp;
 
 	/* if a conversion function is defined, use 'value' as argument for it */
 	if (hid2info->nuf != NULL) {
@@ -2647,13 +2889,13 @@ static long hu_find_valinfo(info_lkp_t *hid2info, const char* value)
 		return hid_value;
 	}
 
-	for (info_lkp = hid2info; info_lkp->nut_value != NULL; info_lkp++) {
-		if (!(strcmp(info_lkp->nut_value, value))) {
-			upsdebugx(5,
-				"hu_find_valinfo: found %s (value: %ld)",
-				info_lkp->nut_value, info_lkp->hid_value);
-			return info_lkp->hid_value;
-		}
+	info_lkp = (const info_lkp_t *)lkp_find_str(
+		lkp_index(hid2info, sizeof(*hid2info), &hu_lkp_ops), value);
+	if (info_lkp) {
+		upsdebugx(5,
+			"hu_find_valinfo: found %s (value: %ld)",
+			info_lkp->nut_value, info_lkp->hid_value);
+		return info_lkp->hid_value;
 	}
 
 	upsdebugx(3,
@@ -2665,7 +2907,7 @@ static long hu_find_valinfo(info_lkp_t *hid2info, const char* value)
 /* find the NUT value matching that HID Item value */
 static const char *hu_find_infoval(info_lkp_t *hid2info, const double value)
 {
-	info_lkp_t	*info_lkp;
+	const info_lkp_t	*info_lkp;
 
 	/* if a conversion function is defined, use 'value' as argument for it */
 	if (hid2info->fun != NULL) {
@@ -2673,13 +2915,13 @@ static const char *hu_find_infoval(info_lkp_t *hid2info, const double value)
 	}
 
 	/* use 'value' as an index for a lookup in an array */
-	for (info_lkp = hid2info; info_lkp->nut_value != NULL; info_lkp++) {
-		if (info_lkp->hid_value == (long)value) {
-			upsdebugx(5,
-				"hu_find_infoval: found %s (value: %ld)",
-				info_lkp->nut_value, (long)value);
-			return info_lkp->nut_value;
-		}
+	info_lkp = (const info_lkp_t *)lkp_find_num(
+		lkp_index(hid2info, sizeof(*hid2info), &hu_lkp_ops), (long)value);
+	if (info_lkp) {
+		upsdebugx(5,
+			"hu_find_infoval: found %s (value: %ld)",
+			info_lkp->nut_value, (long)value);
+		return info_lkp->nut_value;
 	}
 
 	upsdebugx(3,
@@ -2692,6 +2934,7 @@ static const char *hu_find_infoval(info_lkp_t *hid2info, const double value)
 static int ups_infoval_set(hid_info_t *item, double value)
 {
 	const char	*nutvalue;
+	int	precision;
 
 	/* need lookup'ed translation? */
 	if (item->hid2info != NULL){
@@ -2714,6 +2957,9 @@ static int ups_infoval_set(hid_info_t *item, double value)
 		}
 
 		dstate_setinfo(item->info_type, "%s", nutvalue);
+	} else if ((precision = dstate_float_precision(item->dfl)) >= 0) {
+		/* the usual "%.0f" and the like: skip formatting steady readings */
+		dstate_setinfo_double(item->info_type, value, precision, 0);
 	} else {
 		dstate_setinfo_dynamic(item->info_type, item->dfl, "%f", value);
 	}
@@ -105,6 +105,7 @@
 #include "attribute.h"
 #include "proto.h"
 #include "str.h"
+#include "nut_stdint.h"
 
 #if (defined HAVE_LIBREGEX && HAVE_LIBREGEX)
 # include <regex.h>
@@ -416,12 +417,35 @@ const char * rootpidpath(void);
 /* Die with a standard message if socket filename is too long */
 void check_unix_socket_filename(const char *fn);
 
+/* Listening sockets passed by a service manager (systemd socket activation,
+ * or upsdrvctl the same way) as file descriptors from NUT_LISTEN_FDS_START
+ * up, with LISTEN_PID and LISTEN_FDS in the environment (which the first
+ * call takes away, so that children do not see them): returns how many */
+#define NUT_LISTEN_FDS_START	3
+int nut_listen_fds(void);
+
+/* The passed socket listening on the unix socket <path>, or ERROR_FD */
+TYPE_FD nut_listen_fd_unix(const char *path);
+
 #ifdef NUT_WANT_INET_NTOP_XX
 /* NOT THREAD SAFE!
  * Helpers to convert one IP address to string from different structure types
  * Return pointer to internal buffer, or NULL and errno upon errors */
 const char *inet_ntopSS(struct sockaddr_storage *s);
 const char *inet_ntopAI(struct addrinfo *ai);
+
+/* Connect a stream socket to one of the addresses listed by <res> (as from
+ * getaddrinfo()), racing them "Happy Eyeballs" style (RFC 8305): attempts
+ * start CONNECT_AI_ATTEMPT_DELAY milliseconds apart (or as soon as the
+ * previous ones failed), taking the address families in turn, and the
+ * first to connect wins. The whole race is limited by <timeout> if not
+ * NULL. If <last> holds an address of the list (ss_family not 0), it is
+ * tried first; it is updated with the address which won.
+ * Return the connected (blocking) socket, or -1 and errno upon errors
+ * (ETIMEDOUT if time ran out) */
+#define CONNECT_AI_ATTEMPT_DELAY	250
+int connect_ai_race(struct addrinfo *res, const struct timeval *timeout,
+	struct sockaddr_storage *last);
 #endif	/* NUT_WANT_INET_NTOP_XX */
 
 /* Provide integration for systemd inhibitor interface (where available,
@@ -517,6 +541,10 @@ void fatal_with_errno(int status, const char *fmt, ...)
 void fatalx(int status, const char *fmt, ...)
 	__attribute__ ((__format__ (__printf__, 2, 3))) __attribute__((noreturn));
 
+/* Wait until the messages logged so far are written out, when logging
+ * asynchronously (NUT_DEBUG_ASYNC); done on fatal errors and at exit */
+void upslog_flush(void);
+
 /* Report CONFIG_FLAGS used for this build of NUT similarly to how
  * upsdebugx(1, ...) would do it, but not limiting the string length
  */
@@ -542,6 +570,34 @@ void *xcalloc(size_t number, size_t size);
 void *xrealloc(void *ptr, size_t size);
 char *xstrdup(const char *string);
 
+/* Memory accounting by subsystem ("tag"): the bytes each holds now and
+ * at most, the allocations it made and their bytes in total. The pools
+ * and tables of the state trees (state.c) keep theirs all the time. The
+ * x*alloc() wrappers count theirs under "xalloc" once nut_mem_enable()
+ * was called, but as their blocks are given back with a plain free() all
+ * over the tree, only the allocations and bytes (the churn) of that one
+ * can be told. nut_mem_tags() lists the tags used so far, for the
+ * driver.stats.mem.* variables and the statistics of upsd. */
+typedef struct nut_mem_tag_s {
+	const char	*name;
+	int	nofree;		/* frees are not seen, live and peak mean nothing */
+	size_t	live, peak;	/* bytes held, now and at most */
+	uint64_t	allocs, bytes;	/* allocations made, and their bytes */
+	int	listed;
+	struct nut_mem_tag_s	*next;
+} nut_mem_tag_t;
+
+#define NUT_MEM_TAG_INIT(name)	{ (name), 0, 0, 0, 0, 0, 0, NULL }
+
+void nut_mem_enable(void);
+void nut_mem_add(nut_mem_tag_t *tag, size_t size);
+void nut_mem_sub(nut_mem_tag_t *tag, size_t size);
+const nut_mem_tag_t *nut_mem_tags(void);
+
+/* bytes the heap of the process holds now (and in <peak>, at most when
+ * this was called), or 0 where that cannot be told */
+size_t nut_mem_heap(size_t *peak);
+
 int vsnprintfcat(char *dst, size_t size, const char *fmt, va_list ap);
 int snprintfcat(char *dst, size_t size, const char *fmt, ...)
 	__attribute__ ((__format__ (__printf__, 3, 4)));
@@ -598,6 +654,17 @@ char * mkstr_dynamic(const char *fmt_dynamic, const char *fmt_reference, ...)
  */
 int strcmp_null(const char *s1, const char *s2);
 
+/* FNV-1a hash of a string folded to lower case, for the hash tables of
+ * names: names which differ only in case land together, so it serves the
+ * tables compared with strcmp() as well as those with strcasecmp().
+ * It is defined in str.c, with fnv1a_hash() for other data: the hash of
+ * <len> bytes at <buf>, going on from <hash> (FNV1A_INIT to start).
+ * On either, the low 32 bits are those of the 32-bit FNV-1a.
+ */
+#define FNV1A_INIT	((size_t)2166136261U)
+size_t str_hash_nocase(const char *string);
+size_t fnv1a_hash(size_t hash, const void *buf, size_t len);
+
 #if (defined HAVE_LIBREGEX && HAVE_LIBREGEX)
 /* Helper function for compiling a regular expression. On success,
  * store the compiled regular expression (or NULL) in *compiled, and
@@ -56,7 +56,7 @@ typedef struct range_s {
 
 /* list of instant commands */
 typedef struct cmdlist_s {
-	char	*name;
+	const char	*name;		/* interned, see state_name_intern() */
 	struct cmdlist_s	*next;
 } cmdlist_t;
 
@@ -0,0 +1,60 @@
+/*
+ * nut_probes.h - Network UPS Tools static tracepoints (USDT)
+ *
+ * Copyright (C)
+ *	2026	Network UPS Tools developers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+#ifndef NUT_PROBES_H_SEEN
+#define NUT_PROBES_H_SEEN 1
+
+/* "config.h" is generated by autotools and lacks a header guard, so
+ * we use an unambiguously named macro we know we must have, as one.
+ * It must be the first header: be sure to know all about system config.
+ */
+#ifndef NUT_NETVERSION
+# include "config.h"
+#endif
+
+/* Probe points of the "nut" provider, for SystemTap, bpftrace, perf and
+ * other tools reading USDT notes, e.g.:
+ *
+ *	bpftrace -e 'usdt:/usr/sbin/upsd:nut:upsd_command
+ *		{ printf("%s %s\n", str(arg0), str(arg1)); }' -p `pidof upsd`
+ *
+ * They are built with "configure --with-usdt" (the default if <sys/sdt.h>
+ * is found), and cost a no-op instruction each while nothing is attached;
+ * otherwise they are compiled out altogether. Arguments should be cheap to
+ * evaluate (numbers and existing strings), as they always are. The list of
+ * the probes and their arguments is in docs/developers.txt. */
+
+#if (defined WITH_USDT) && WITH_USDT && (defined HAVE_SYS_SDT_H) && HAVE_SYS_SDT_H
+# include <sys/sdt.h>
+# define NUT_PROBE(name)			DTRACE_PROBE(nut, name)
+# define NUT_PROBE1(name, a1)			DTRACE_PROBE1(nut, name, a1)
+# define NUT_PROBE2(name, a1, a2)		DTRACE_PROBE2(nut, name, a1, a2)
+# define NUT_PROBE3(name, a1, a2, a3)		DTRACE_PROBE3(nut, name, a1, a2, a3)
+# define NUT_PROBE4(name, a1, a2, a3, a4)	DTRACE_PROBE4(nut, name, a1, a2, a3, a4)
+#else
+# define NUT_PROBE(name)			do {} while (0)
+# define NUT_PROBE1(name, a1)			do {} while (0)
+# define NUT_PROBE2(name, a1, a2)		do {} while (0)
+# define NUT_PROBE3(name, a1, a2, a3)		do {} while (0)
+# define NUT_PROBE4(name, a1, a2, a3, a4)	do {} while (0)
+#endif
+
+#endif	/* NUT_PROBES_H_SEEN */
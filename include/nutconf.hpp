@@ -55,6 +55,7 @@ class NutParser;
 class NutConfigParser;
 class DefaultConfigParser;
 class GenericConfigParser;
+class GenericConfigWriter;
 
 
 /**
@@ -827,7 +828,10 @@ public:
 	/** Sections map */
 	typedef std::map<std::string, GenericConfigSection> SectionMap;
 
-	GenericConfiguration(){}
+	/** Serialised sections map */
+	typedef std::map<std::string, std::string> SerialisedSectionMap;
+
+	GenericConfiguration(): m_serialised_by(nullptr) {}
 
 	virtual ~GenericConfiguration() override;
 
@@ -839,13 +843,45 @@ public:
 	/** \} */
 
 	// FIXME Let be public or set it as protected with public accessors ?
+	// NOTE: Code changing a section here directly (rather than with
+	// the setters below) should touch() it, so that it is serialised
+	// anew by the next writeTo()
 	SectionMap sections;
 
 	const GenericConfigSection& operator[](const std::string& secname)const{return sections.find(secname)->second;}
-	GenericConfigSection& operator[](const std::string& secname){return sections[secname];}
+	GenericConfigSection& operator[](const std::string& secname){touch(secname); return sections[secname];}
+
+	/**
+	 *  \brief  Mark section as changed
+	 *
+	 *  Sections which were not changed since the last \ref writeTo
+	 *  are written the same as serialised then, instead of anew.
+	 *  The setters mark the sections they change; this is needed
+	 *  only when the \ref sections are changed directly.
+	 *
+	 *  \param  section  Section name
+	 */
+	inline void touch(const std::string & section)
+	{
+		m_serialised.erase(section);
+	}
+
+	/** Mark all sections as changed */
+	inline void touchAll()
+	{
+		m_serialised.clear();
+	}
 
 
 protected:
+	friend class GenericConfigWriter;
+
+	/** Sections as serialised by the last \ref writeTo and not changed since */
+	mutable SerialisedSectionMap m_serialised;
+
+	/** Type of the writer which serialised \ref m_serialised */
+	mutable const std::type_info * m_serialised_by;
+
 	virtual void setGenericConfigSection(const GenericConfigSection& section) override;
 
 	/**
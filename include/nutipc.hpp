@@ -43,6 +43,15 @@ extern "C" {
 
 #ifndef WIN32
 # include <sys/wait.h>
+# include <fcntl.h>
+# if (defined HAVE_SYS_SIGNALFD_H) && (defined HAVE_SIGNALFD)
+#  include <sys/signalfd.h>
+#  define NUT_IPC_SIGNALFD 1
+# endif
+# if (defined HAVE_SPAWN_H) && (defined HAVE_POSIX_SPAWNP)
+#  include <spawn.h>
+#  define NUT_IPC_POSIX_SPAWN 1
+# endif
 #else	/* WIN32 */
 # include "wincompat.h"
 #endif	/* WIN32 */
@@ -186,8 +195,20 @@ class Process {
 
 		private:
 
+		/** Descriptor set-up done in the child before the binary runs */
+		struct FileAction {
+			int         fd;     /**< Child's descriptor                       */
+			int         from;   /**< Descriptor to dup, -1 to open, -2 close  */
+			std::string path;   /**< Path to open                              */
+			int         flags;  /**< Open flags                                */
+			mode_t      mode;   /**< Open mode                                 */
+		};  // end of struct FileAction
+
+		typedef std::list<FileAction> FileActions;
+
 		std::string m_bin;
 		Arguments   m_args;
+		FileActions m_actions;
 
 		public:
 
@@ -221,6 +242,55 @@ class Process {
 		 */
 		Executor(const std::string & command);
 
+		/** Copy constructor (so that an executor may be set up and then run) */
+		Executor(const Executor & orig):
+			Main(), m_bin(orig.m_bin), m_args(orig.m_args), m_actions(orig.m_actions) {}
+
+		/**
+		 *  \brief  Make child's descriptor a copy of the parent's one
+		 *
+		 *  E.g. \c redirect(1,pipe_fd) for the child to write its
+		 *  standard output to a pipe.
+		 *  The set-up is done in the order the redirections were added.
+		 *
+		 *  \param  fd    Child's descriptor
+		 *  \param  from  Parent's descriptor
+		 */
+		void redirect(int fd, int from);
+
+		/**
+		 *  \brief  Open a file as child's descriptor
+		 *
+		 *  \param  fd     Child's descriptor
+		 *  \param  path   File path
+		 *  \param  flags  \c open flags
+		 *  \param  mode   \c open mode (for a new file)
+		 */
+		void redirect(int fd, const std::string & path, int flags, mode_t mode = 0644);
+
+		/**
+		 *  \brief  Close a descriptor in the child
+		 *
+		 *  \param  fd  Child's descriptor
+		 */
+		void close(int fd);
+
+		/**
+		 *  \brief  Start the binary in a new process
+		 *
+		 *  Unlike running the executor in a forked \ref Child, this uses
+		 *  \c posix_spawnp where available, which does not need to copy
+		 *  the caller's address space (or even its page tables) first;
+		 *  otherwise it falls back to \c fork and \c execvp.
+		 *
+		 *  \return Child PID
+		 */
+		pid_t spawn() const
+#if (defined __cplusplus) && (__cplusplus < 201100)
+			throw(std::runtime_error)
+#endif
+			;
+
 		/** Execution of the binary */
 		int operator () ()
 #if (defined __cplusplus) && (__cplusplus < 201100)
@@ -245,8 +315,7 @@ class Process {
 		 *  \brief  binary     Binary to be executed
 		 *  \brief  arguments  Command-line arguments to the binary
 		 */
-		Execution(const std::string & binary, const Executor::Arguments & arguments):
-			Child<Executor>(Executor(binary, arguments)) {}
+		Execution(const std::string & binary, const Executor::Arguments & arguments);
 
 		/**
 		 *  Constructor
@@ -260,7 +329,17 @@ class Process {
 		 *
 		 *  \param  command  Command to be executed
 		 */
-		Execution(const std::string & command): Child<Executor>(Executor(command)) {}
+		Execution(const std::string & command);
+
+		/**
+		 *  Constructor
+		 *
+		 *  This form runs an executor set up by the caller
+		 *  (e.g. with descriptor redirections).
+		 *
+		 *  \param  executor  Executor
+		 */
+		Execution(const Executor & executor);
 
 	};  // end of class Execution
 
@@ -324,6 +403,49 @@ Process::Child<M>::Child(M main)
 }
 
 
+/**
+ *  \brief  Child process running an external command
+ *
+ *  The command is started by \ref Process::Executor::spawn
+ *  rather than by running the executor in a copy of this process.
+ */
+template <>
+inline Process::Child<Process::Executor>::Child(Process::Executor main)
+#if (defined __cplusplus) && (__cplusplus < 201100)
+	throw(std::runtime_error)
+#endif
+	:
+	m_pid(0),
+	m_exited(false),
+	m_exit_code(0)
+{
+#ifdef WIN32
+	NUT_UNUSED_VARIABLE(main);
+
+	std::stringstream e;
+
+	e << "Can't spawn: not implemented on this platform yet";
+
+	/* NUT_WIN32_INCOMPLETE(); */
+	throw std::logic_error(e.str());
+#else	/* !WIN32 */
+	m_pid = main.spawn();
+#endif	/* !WIN32 */
+}
+
+
+/* The execution constructors follow the specialisation above (being
+ * defined in the class, they would instantiate the generic one first) */
+inline Process::Execution::Execution(const std::string & binary, const Executor::Arguments & arguments):
+	Child<Executor>(Executor(binary, arguments)) {}
+
+inline Process::Execution::Execution(const std::string & command):
+	Child<Executor>(Executor(command)) {}
+
+inline Process::Execution::Execution(const Executor & executor):
+	Child<Executor>(executor) {}
+
+
 template <class M>
 int Process::Child<M>::wait()
 #if (defined __cplusplus) && (__cplusplus < 201100)
@@ -549,6 +671,122 @@ class Signal {
 
 	};  // end of HandlerThread
 
+	/**
+	 *  \brief  Signal handler for an event loop
+	 *
+	 *  An alternative to \ref HandlerThread for processes which run their
+	 *  own event loop: rather than by a dedicated thread, the signals are
+	 *  reported via a file descriptor (see \ref fd), which is readable
+	 *  while any of them is pending.  The loop then calls \ref handle,
+	 *  which passes them to the \ref H handler instance inline, so that
+	 *  no synchronisation with another thread is needed.
+	 *
+	 *  Where available (Linux), \c signalfd is used and the signals are
+	 *  blocked; so the instance should be created before starting other
+	 *  threads, which then inherit the signal mask (or those should block
+	 *  the signals on their own).  Otherwise, the actual signal handler
+	 *  routine writes the signal number to a (non-blocking) self-pipe.
+	 *
+	 *  As with \ref HandlerThread, at most one instance per handler class
+	 *  may exist (the signal handler routine only has access to statics).
+	 */
+	template <class H>
+	class HandlerFd {
+		private:
+
+		/** Self-pipe (or the \c signalfd descriptor as the read end) */
+		static int s_pipe[2];
+
+		/** Signal handler */
+		H m_handler;
+
+		/** Signals registered */
+		Signal::List m_siglist;
+
+#ifndef WIN32
+		/** Signals blocked for \c signalfd (which were not before) */
+		sigset_t m_blocked;
+
+		/** Signal actions replaced with the self-pipe notifier */
+		std::list<std::pair<int, struct sigaction> > m_old_actions;
+#endif	/* !WIN32 */
+
+		/**
+		 *  \brief  Signal handler routine
+		 *
+		 *  Writes the signal number to the self-pipe (only used
+		 *  if \c signalfd is not).  Should the pipe be full, the
+		 *  signal is dropped; its read end is readable anyway.
+		 *
+		 *  \param  signal  Signal
+		 */
+		static void signalNotifier(int signal);
+
+#ifndef WIN32
+		/**
+		 *  \brief  Set up \c signalfd for the signals
+		 *
+		 *  \param  sigset  Signals
+		 *
+		 *  \retval true  on success
+		 *  \retval false if \c signalfd is not available
+		 */
+		bool setupSignalFd(const sigset_t & sigset);
+
+		/** Set up the self-pipe and the signal handler routine */
+		void setupSelfPipe();
+#endif	/* !WIN32 */
+
+		public:
+
+		/**
+		 *  \brief  Constructor
+		 *
+		 *  If more than 1 instance creation is attempted, an exception is thrown.
+		 *
+		 *  \param  siglist  List of signals that shall be handled
+		 */
+		HandlerFd(const Signal::List & siglist)
+#if (defined __cplusplus) && (__cplusplus < 201100)
+			throw(std::logic_error, std::runtime_error)
+#endif
+			;
+
+		/**
+		 *  \brief  Signal notification file descriptor
+		 *
+		 *  To be polled for reading by the event loop.
+		 *
+		 *  \return File descriptor
+		 */
+		inline int fd() const { return s_pipe[0]; }
+
+		/** Signal handler instance */
+		inline H & handler() { return m_handler; }
+
+		/**
+		 *  \brief  Handle pending signals
+		 *
+		 *  Passes all signals pending to the handler, without blocking.
+		 *
+		 *  \return Number of signals handled
+		 */
+		size_t handle()
+#if (defined __cplusplus) && (__cplusplus < 201100)
+			throw(std::runtime_error)
+#endif
+			;
+
+		/**
+		 *  \brief  Destructor
+		 *
+		 *  Unblocks the signals (or restores their former actions)
+		 *  and closes the descriptors.
+		 */
+		~HandlerFd();
+
+	};  // end of HandlerFd
+
 	/**
 	 *  \brief  Send signal to a process
 	 *
@@ -879,6 +1117,268 @@ Signal::HandlerThread<H>::~HandlerThread
 }
 
 
+/** Initialization of the self-pipes */
+template <class H>
+int Signal::HandlerFd<H>::s_pipe[2] = { -1, -1 };
+
+
+template <class H>
+void Signal::HandlerFd<H>::signalNotifier(int signal) {
+	int saved_errno = errno;
+
+	// Async-signal-safe; the result is ignored (see above)
+	ssize_t written = ::write(s_pipe[1], &signal, sizeof(signal));
+
+	NUT_UNUSED_VARIABLE(written);
+
+	errno = saved_errno;
+}
+
+
+#ifndef WIN32
+template <class H>
+bool Signal::HandlerFd<H>::setupSignalFd(const sigset_t & sigset) {
+#ifdef NUT_IPC_SIGNALFD
+	sigset_t old_mask;
+
+# ifdef HAVE_PTHREAD
+	int status = ::pthread_sigmask(SIG_BLOCK, &sigset, &old_mask);
+# else
+	int status = ::sigprocmask(SIG_BLOCK, &sigset, &old_mask) ? errno : 0;
+# endif
+
+	if (status) {
+		std::stringstream e;
+
+		e << "Failed to block signals: " << status;
+
+		throw std::runtime_error(e.str());
+	}
+
+	// Remember which signals were not blocked before
+	Signal::List::const_iterator sig = m_siglist.begin();
+
+	for (; sig != m_siglist.end(); ++sig) {
+		int signo = static_cast<int>(*sig);
+
+		if (!sigismember(&old_mask, signo))
+			sigaddset(&m_blocked, signo);
+	}
+
+	s_pipe[0] = ::signalfd(-1, &sigset, SFD_NONBLOCK | SFD_CLOEXEC);
+
+	if (-1 != s_pipe[0])
+		return true;
+
+	// Not supported by the kernel, probably; unblock the signals
+# ifdef HAVE_PTHREAD
+	::pthread_sigmask(SIG_UNBLOCK, &m_blocked, nullptr);
+# else
+	::sigprocmask(SIG_UNBLOCK, &m_blocked, nullptr);
+# endif
+	sigemptyset(&m_blocked);
+#else	/* !NUT_IPC_SIGNALFD */
+	NUT_UNUSED_VARIABLE(sigset);
+#endif	/* !NUT_IPC_SIGNALFD */
+
+	return false;
+}
+
+
+template <class H>
+void Signal::HandlerFd<H>::setupSelfPipe() {
+	if (::pipe(s_pipe)) {
+		std::stringstream e;
+
+		e << "Failed to create self-pipe: " << errno;
+
+		throw std::runtime_error(e.str());
+	}
+
+	for (size_t i = 0; i < 2; ++i) {
+		int flags = ::fcntl(s_pipe[i], F_GETFL);
+
+		if (-1 == flags
+		||  ::fcntl(s_pipe[i], F_SETFL, flags | O_NONBLOCK)
+		||  ::fcntl(s_pipe[i], F_SETFD, FD_CLOEXEC)
+		) {
+			std::stringstream e;
+
+			e << "Failed to set up self-pipe: " << errno;
+
+			throw std::runtime_error(e.str());
+		}
+	}
+
+	// Register signals
+	Signal::List::const_iterator sig = m_siglist.begin();
+
+	for (; sig != m_siglist.end(); ++sig) {
+		struct sigaction action, old_action;
+
+		::memset(&action, 0, sizeof(action));
+# ifdef sigemptyset
+		// no :: here because macro
+		sigemptyset(&action.sa_mask);
+# else
+		::sigemptyset(&action.sa_mask);
+# endif
+
+		action.sa_handler = &signalNotifier;
+		action.sa_flags   = SA_RESTART;
+
+		int signo = static_cast<int>(*sig);
+
+		if (::sigaction(signo, &action, &old_action)) {
+			std::stringstream e;
+
+			e << "Failed to register signal handler for signal ";
+			e << signo << ": " << errno;
+
+			throw std::runtime_error(e.str());
+		}
+
+		m_old_actions.push_back(std::pair<int, struct sigaction>(signo, old_action));
+	}
+}
+#endif	/* !WIN32 */
+
+
+template <class H>
+Signal::HandlerFd<H>::HandlerFd(const Signal::List & siglist)
+#if (defined __cplusplus) && (__cplusplus < 201100)
+	throw(std::logic_error, std::runtime_error)
+#endif
+	: m_siglist(siglist)
+{
+#ifdef WIN32
+	std::stringstream e;
+
+	e << "Can't prepare signal handling descriptor: not implemented on this platform yet";
+
+	/* NUT_WIN32_INCOMPLETE(); */
+	throw std::logic_error(e.str());
+#else	/* !WIN32 */
+	// At most one instance per process allowed
+	if (-1 != s_pipe[0])
+		throw std::logic_error(
+			"Attempt to create a duplicate of signal handling descriptor detected");
+
+	sigset_t sigset;
+
+	sigemptyset(&sigset);
+	sigemptyset(&m_blocked);
+
+	Signal::List::const_iterator sig = m_siglist.begin();
+
+	for (; sig != m_siglist.end(); ++sig)
+		sigaddset(&sigset, static_cast<int>(*sig));
+
+	if (!setupSignalFd(sigset))
+		setupSelfPipe();
+#endif	/* !WIN32 */
+}
+
+
+template <class H>
+size_t Signal::HandlerFd<H>::handle()
+#if (defined __cplusplus) && (__cplusplus < 201100)
+	throw(std::runtime_error)
+#endif
+{
+	size_t handled = 0;
+
+#ifndef WIN32
+	for (;;) {
+		int     signals[16];
+		size_t  count = 0;
+		ssize_t read_out;
+
+# ifdef NUT_IPC_SIGNALFD
+		if (-1 == s_pipe[1]) {
+			struct signalfd_siginfo info[16];
+
+			read_out = ::read(s_pipe[0], info, sizeof(info));
+
+			if (read_out > 0) {
+				count = static_cast<size_t>(read_out) / sizeof(info[0]);
+
+				for (size_t i = 0; i < count; ++i)
+					signals[i] = static_cast<int>(info[i].ssi_signo);
+			}
+		}
+		else
+# endif	/* NUT_IPC_SIGNALFD */
+		{
+			read_out = ::read(s_pipe[0], signals, sizeof(signals));
+
+			if (read_out > 0)
+				count = static_cast<size_t>(read_out) / sizeof(signals[0]);
+		}
+
+		if (-1 == read_out) {
+			if (EINTR == errno)
+				continue;
+
+			// Nothing (more) pending
+			if (EAGAIN == errno || EWOULDBLOCK == errno)
+				break;
+
+			std::stringstream e;
+
+			e << "Failed to read signals from descriptor ";
+			e << s_pipe[0] << ": " << errno;
+
+			throw std::runtime_error(e.str());
+		}
+
+		// Handle signals
+		for (size_t i = 0; i < count; ++i)
+			m_handler(static_cast<Signal::enum_t>(signals[i]));
+
+		handled += count;
+
+		if (0 == read_out)
+			break;
+	}
+#endif	/* !WIN32 */
+
+	return handled;
+}
+
+
+template <class H>
+Signal::HandlerFd<H>::~HandlerFd
+#if (defined __clang__)
+	<H>
+#endif
+()
+{
+#ifndef WIN32
+	// Restore former signal actions (of the self-pipe)
+	std::list<std::pair<int, struct sigaction> >::const_iterator
+		action = m_old_actions.begin();
+
+	for (; action != m_old_actions.end(); ++action)
+		::sigaction(action->first, &action->second, nullptr);
+
+	// Unblock signals (of signalfd)
+# ifdef HAVE_PTHREAD
+	::pthread_sigmask(SIG_UNBLOCK, &m_blocked, nullptr);
+# else
+	::sigprocmask(SIG_UNBLOCK, &m_blocked, nullptr);
+# endif
+
+	for (size_t i = 0; i < 2; ++i) {
+		if (-1 != s_pipe[i])
+			::close(s_pipe[i]);
+
+		s_pipe[i] = -1;
+	}
+#endif	/* !WIN32 */
+}
+
+
 /** NUT-specific signal handling */
 class NutSignal: public Signal {
 	public:
@@ -620,6 +620,63 @@ class NutFile: public NutStream {
 		throw std::runtime_error(e.str());
 	}
 
+	/**
+	 *  \brief  Rename file
+	 *
+	 *  The file replaces another one of the \c new_name (if any)
+	 *  atomically, where the OS and file system allow for that.
+	 *  Note that the object keeps its (original) file name.
+	 *
+	 *  \param[in]   new_name  New file name
+	 *  \param[out]  err_code  Error code
+	 *  \param[out]  err-msg   Error message
+	 *
+	 *  \retval true  if \c rename succeeded
+	 *  \retval false if \c rename failed
+	 */
+	bool rename(const std::string & new_name, int & err_code, std::string & err_msg)
+#if (defined __cplusplus) && (__cplusplus < 201100)
+		throw()
+#endif
+		;
+
+	/**
+	 *  \brief  Rename file
+	 *
+	 *  \param[in]  new_name  New file name
+	 *
+	 *  \retval true  if \c rename succeeded
+	 *  \retval false if \c rename failed
+	 */
+	inline bool rename(const std::string & new_name)
+#if (defined __cplusplus) && (__cplusplus < 201100)
+		throw()
+#endif
+	{
+		int ec;
+		std::string em;
+
+		return rename(new_name, ec, em);
+	}
+
+	/** Rename file (or throw exception) */
+	inline void renamex(const std::string & new_name)
+#if (defined __cplusplus) && (__cplusplus < 201100)
+		throw(std::runtime_error)
+#endif
+	{
+		int ec;
+		std::string em;
+
+		if (rename(new_name, ec, em))
+			return;
+
+		std::stringstream e;
+		e << "Failed to rename file " << m_name << " to " << new_name << ": " << ec << ": " << em;
+
+		throw std::runtime_error(e.str());
+	}
+
 	/**
 	 *  \brief  Constructor (with open)
 	 *
@@ -58,6 +58,12 @@ class NutWriter {
 	/** Output stream (by reference) */
 	NutStream & m_output_stream;
 
+	/**
+	 *  Output buffer: unless null, writes are collected here
+	 *  rather than passed to the output stream one at a time
+	 */
+	std::string * m_buffer;
+
 	public:
 
 	/**
@@ -78,7 +84,7 @@ class NutWriter {
 	 *
 	 *  \param  ostream  Output stream
 	 */
-	NutWriter(NutStream & ostream): m_output_stream(ostream) {}
+	NutWriter(NutStream & ostream): m_output_stream(ostream), m_buffer(nullptr) {}
 
 	/**
 	 *  \brief  Write to output stream
@@ -89,6 +95,12 @@ class NutWriter {
 	 *  \retval NUTW_ERROR otherwise
 	 */
 	inline status_t write(const std::string & str) {
+		if (nullptr != m_buffer) {
+			*m_buffer += str;
+
+			return NUTW_OK;
+		}
+
 		NutStream::status_t status = m_output_stream.putString(str);
 
 		return NutStream::NUTS_OK == status ? NUTW_OK : NUTW_ERROR;
@@ -101,6 +113,12 @@ class NutWriter {
 	 *  An exception is thrown on error.
 	 */
 	inline void writex(const std::string & str) {
+		if (nullptr != m_buffer) {
+			*m_buffer += str;
+
+			return;
+		}
+
 		NutStream::status_t status = m_output_stream.putString(str);
 
 		if (NutStream::NUTS_OK != status) {
@@ -376,6 +394,12 @@ class GenericConfigWriter: public DefaultConfigWriter {
 	/**
 	 *  \brief  Base configuration serializer
 	 *
+	 *  The configuration is serialised in memory and written
+	 *  to the output stream at once.
+	 *  Sections not changed since the configuration was last
+	 *  written by the same kind of writer are not serialised
+	 *  anew, their text from then is reused.
+	 *
 	 *  \param  config  Base configuration
 	 *
 	 *  \retval NUTW_OK    on success
@@ -83,7 +83,10 @@ int pconf_parse_error(PCONF_CTX_t *ctx);
 int pconf_line(PCONF_CTX_t *ctx, const char *line);
 void pconf_finish(PCONF_CTX_t *ctx);
 char *pconf_encode(const char *src, char *dest, size_t destsize);
+int pconf_encode_needed(const char *src);
 int pconf_char(PCONF_CTX_t *ctx, char ch);
+int pconf_buf(PCONF_CTX_t *ctx, const char *buf, size_t buflen, size_t *used);
+int pconf_compact(PCONF_CTX_t *ctx, size_t keep);
 
 #ifdef __cplusplus
 /* *INDENT-OFF* */
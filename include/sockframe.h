@@ -0,0 +1,97 @@
+/* sockframe.h - framed records on the socket between a driver and upsd
+
+   Copyright (C)
+	2026	Network UPS Tools developers
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#ifndef NUT_SOCKFRAME_H_SEEN
+#define NUT_SOCKFRAME_H_SEEN 1
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+/* *INDENT-OFF* */
+extern "C" {
+/* *INDENT-ON* */
+#endif
+
+/* asked for with "FRAMED <version>", and confirmed the same way */
+#define SOCKFRAME_VERSION	1
+
+/* Each record starts with its whole length (header included) in two bytes,
+ * most significant first, and its type in one byte. */
+#define SOCKFRAME_HEADER_LEN	3
+#define SOCKFRAME_MAXLEN	65535
+
+/* The arguments of one line of the text protocol: their number in one
+ * byte, then for each its length in two bytes and as many bytes followed
+ * by a NUL (values are raw, not quoted or escaped), or else the id of a
+ * name defined before, as two bytes with SOCKFRAME_REF set. */
+#define SOCKFRAME_ARGS	1
+
+/* The definition of a name for the records which follow: its id in two
+ * bytes, then the name followed by a NUL. Ids are given from 0 up. */
+#define SOCKFRAME_NAME	2
+
+#define SOCKFRAME_REF	0x8000
+#define SOCKFRAME_MAXNAMES	0x8000
+
+/* most arguments a reader takes from a record */
+#define SOCKFRAME_MAXARGS	16
+
+typedef struct {
+	char	**name;		/* by id */
+	size_t	count, alloc;
+	size_t	*bucket;	/* writer: id + 1 of the last name with that hash */
+	size_t	*chain;		/* writer: id + 1 of the name before it */
+	size_t	buckets;
+} sockframe_names_t;
+
+void sockframe_names_init(sockframe_names_t *names);
+void sockframe_names_free(sockframe_names_t *names);
+
+/* writer side: encode into <buf> the arguments of a line, the first
+ * <numnames> of which (the command and the variable or command name) go
+ * by an id, given one if new; returns the length of the record, or 0 if
+ * it does not fit in <bufsize> */
+size_t sockframe_args(char *buf, size_t bufsize, sockframe_names_t *names,
+	size_t numnames, size_t numargs, const char **arg);
+
+/* writer side: encode into <buf> the definition of the name <id>,
+ * returns the length of the record, or 0 if it does not fit */
+size_t sockframe_name(char *buf, size_t bufsize, const sockframe_names_t *names,
+	size_t id);
+
+/* reader side: whether <len> bytes at <buf> start with a whole record,
+ * returns 1 with its length in <reclen>, 0 if more is needed, or -1 if
+ * they do not make a record */
+int sockframe_next(const char *buf, size_t len, size_t *reclen);
+
+/* reader side: take a record found by sockframe_next(); an ARGS record
+ * fills arg[] (pointing into it or into <names>) and returns 1 with their
+ * number in <numargs>, a NAME record is remembered in <names> and returns
+ * 0, and -1 means the record is not valid */
+int sockframe_decode(char *rec, size_t reclen, sockframe_names_t *names,
+	char **arg, size_t *numargs);
+
+#ifdef __cplusplus
+/* *INDENT-OFF* */
+}
+/* *INDENT-ON* */
+#endif
+
+#endif	/* NUT_SOCKFRAME_H_SEEN */
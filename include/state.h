@@ -23,6 +23,7 @@
 #define NUT_STATE_H_SEEN 1
 
 #include "extstate.h"
+#include "nut_stdint.h"
 
 #ifdef __cplusplus
 /* *INDENT-OFF* */
@@ -32,6 +33,11 @@ extern "C" {
 
 #define ST_SOCK_BUF_LEN 512
 
+/* Room for short values (including the terminating NUL) within the
+ * st_tree_t node itself; longer ones are allocated separately. Most
+ * values seen in practice fit. */
+#define ST_TREE_RAW_INLINE	32
+
 #include "timehead.h"
 
 #if defined(HAVE_CLOCK_GETTIME) && defined(HAVE_CLOCK_MONOTONIC) && HAVE_CLOCK_GETTIME && HAVE_CLOCK_MONOTONIC
@@ -41,10 +47,10 @@ typedef struct timeval	st_tree_timespec_t;
 #endif
 
 typedef struct st_tree_s {
-	char	*var;
+	const char	*var;		/* interned, see state_name_intern() */
 	char	*val;			/* points to raw or safe */
 
-	char	*raw;			/* raw data from caller */
+	char	*raw;			/* raw data from caller, may point to rawbuf */
 	size_t	rawsize;
 
 	char	*safe;			/* safe data from pconf_encode */
@@ -53,22 +59,50 @@ typedef struct st_tree_s {
 	int	flags;
 	long	aux;
 
+	/* last value given to state_setinfo_double(), which the text
+	 * in raw was made from with numprec decimals; only valid while
+	 * numset is non-zero, other changes of raw clear it */
+	double	numval;
+	int	numprec;
+	int	numset;
+
 	/* When was this entry last written (meaning that
 	 * val/raw/safe, flags, aux, enum or range value
 	 * was added, changed or deleted)?
 	 */
 	st_tree_timespec_t	lastset;
+	/* and in which generation, see state_prune() */
+	unsigned long	gen;
 
 	struct enum_s		*enum_list;
 	struct range_s		*range_list;
 
+	/* AVL tree ordered by strcasecmp() of var */
 	struct st_tree_s	*left;
 	struct st_tree_s	*right;
+	int	height;		/* of the subtree rooted here, leaf = 1 */
+
+	/* inline storage for raw, see ST_TREE_RAW_INLINE */
+	char	rawbuf[ST_TREE_RAW_INLINE];
 } st_tree_t;
 
+/* The names of variables and commands in the trees and lists, one copy
+ * of each (equal but for case) in the process: state_name_intern() adds
+ * a reference to it, and the copy is gone with the last release.
+ * state_name_find() returns the copy of a name in use, if any, which can
+ * be compared to those of nodes and list items by pointer. */
+const char *state_name_intern(const char *name);
+const char *state_name_find(const char *name);
+void state_name_release(const char *name);
+
 int state_get_timestamp(st_tree_timespec_t *now);
+/* the same clock in microseconds, comparable between the processes of a
+ * system (e.g. a driver and upsd, for their TRACE of changes) */
+uint64_t state_get_timestamp_usec(void);
 int st_tree_node_compare_timestamp(const st_tree_t *node, const st_tree_timespec_t *cutoff);
 int state_setinfo(st_tree_t **nptr, const char *var, const char *val);
+int state_setinfo_double(st_tree_t **nptr, const char *var, double value,
+	int precision, double deadband, char *buf, size_t bufsize);
 int state_addenum(st_tree_t *root, const char *var, const char *val);
 int state_addrange(st_tree_t *root, const char *var, const int min, const int max);
 int state_setaux(st_tree_t *root, const char *var, const char *auxs);
@@ -84,10 +118,55 @@ void state_cmdfree(cmdlist_t *list);
 int state_delcmd(cmdlist_t **list, const char *cmd);
 int state_delinfo(st_tree_t **root, const char *var);
 int state_delinfo_olderthan(st_tree_t **root, const char *var, const st_tree_timespec_t *cutoff);
+
+/* Prune in one sweep what a poll cycle did not refresh: each node is
+ * tagged with the generation current when it was last written (set, even
+ * to the same value, or given flags, aux, enum or range values, or passed
+ * to state_touchinfo()). state_generation_next() starts a new generation
+ * and returns it; state_prune() then deletes the nodes (but immutable
+ * ones) whose name starts with <prefix>, or all of them if it is NULL,
+ * that were not written in generation <gen>, calling <deleted> after
+ * each. Returns the number of nodes deleted. */
+unsigned long state_generation_next(void);
+void state_touchinfo(st_tree_t *node);
+size_t state_prune(st_tree_t **root, const char *prefix, unsigned long gen,
+	void (*deleted)(const char *var, void *arg), void *arg);
 int state_delenum(st_tree_t *root, const char *var, const char *val);
 int state_delrange(st_tree_t *root, const char *var, const int min, const int max);
 st_tree_t *state_tree_find(st_tree_t *node, const char *var);
 
+/* An indexed family of variables, whose names differ in one number only
+ * (e.g. "outlet.%i.current" for outlet.1.current, outlet.2.current...),
+ * as PDU and multi-phase devices publish by the dozen: the name of each
+ * is made from the template once, when first used, and kept by index in
+ * a dense array, along with the node found for it. So setting them over
+ * and over costs neither formatting their names nor walks down the tree.
+ * A family is meant for one tree; the nodes it keeps are only taken as
+ * long as no node was deleted since (from any tree). */
+#define ST_FAMILY_MAXINDEX	4096
+
+typedef struct st_family_s {
+	char	*tmpl;
+	const char	**name;		/* interned, by index; NULL until used */
+	st_tree_t	**node;		/* by index, see above */
+	size_t	count;		/* of room in name[] and node[] */
+	unsigned long	frees;	/* nodes deleted when node[] was filled */
+	struct st_family_s	*next;	/* for use by the owner */
+} st_family_t;
+
+/* returns NULL if <tmpl> does not take exactly one integer */
+st_family_t *state_family_new(const char *tmpl);
+void state_family_free(st_family_t *fam);
+/* the name of variable <index> of the family, or NULL if out of range
+ * (it must be below ST_FAMILY_MAXINDEX) */
+const char *state_family_name(st_family_t *fam, int index);
+st_tree_t *state_family_find(st_family_t *fam, st_tree_t *root, int index);
+/* as state_setinfo() and state_setinfo_double(), or -1 if <index> is
+ * out of range */
+int state_family_setinfo(st_family_t *fam, st_tree_t **nptr, int index, const char *val);
+int state_family_setinfo_double(st_family_t *fam, st_tree_t **nptr, int index,
+	double value, int precision, double deadband, char *buf, size_t bufsize);
+
 #ifdef __cplusplus
 /* *INDENT-OFF* */
 }
@@ -0,0 +1,118 @@
+/* stateshm.h - device states shared by a driver with upsd through memory
+
+   Copyright (C)
+	2026	Network UPS Tools developers
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#ifndef NUT_STATESHM_H_SEEN
+#define NUT_STATESHM_H_SEEN 1
+
+#include "state.h"
+#include "nut_stdint.h"
+
+#ifdef __cplusplus
+/* *INDENT-OFF* */
+extern "C" {
+/* *INDENT-ON* */
+#endif
+
+#if (!defined WIN32) && (defined HAVE___SYNC_SYNCHRONIZE) && HAVE___SYNC_SYNCHRONIZE
+# define WITH_STATESHM	1
+#endif
+
+/* The region is a file next to the driver socket, named like it with this
+ * suffix, which the driver maps read-write and its readers read-only */
+#define STATESHM_SUFFIX	".shm"
+
+#define STATESHM_MAGIC	0x4e555453	/* "NUTS" */
+#define STATESHM_VERSION	1
+
+/* most arguments in one record (SETFLAGS with every flag known) */
+#define STATESHM_MAXARGS	8
+
+/* Start of the region. The records which follow are the lines a DUMPALL
+ * would send (SETINFO, ADDENUM, ADDRANGE, SETAUX, SETFLAGS, ADDCMD), each
+ * as a count of arguments in one byte and as many NUL-terminated strings,
+ * with the values not escaped. They are guarded by a seqlock: the writer
+ * makes "seq" odd while it updates them, readers retry if it changed. */
+typedef struct {
+	uint32_t	magic;
+	uint32_t	version;
+	volatile unsigned long	seq;
+	volatile size_t	size;	/* of the whole file, which only grows */
+	volatile size_t	len;	/* of the records */
+	char	data[1];
+} stateshm_t;
+
+typedef struct {
+	int	fd;
+	char	*fn;
+	stateshm_t	*map;
+	size_t	mapsize;
+	unsigned long	seq;	/* reader: of the copy in buf */
+	char	*buf;		/* writer: records being made; reader: the copy */
+	size_t	len, bufsize;
+} stateshm_ctx_t;
+
+void stateshm_init(stateshm_ctx_t *ctx);
+
+/* driver side: create the region (replacing any older file of that name),
+ * returns 1 on success or 0 with errno set */
+int stateshm_create(stateshm_ctx_t *ctx, const char *fn);
+
+/* driver side: serialize the states into the region, returns its new
+ * sequence number (0 on failure) */
+unsigned long stateshm_publish(stateshm_ctx_t *ctx, const st_tree_t *root,
+	const cmdlist_t *cmdlist);
+
+/* reader side: map (or re-map) the region of a driver read-only,
+ * returns 1 on success or 0 with errno set */
+int stateshm_open(stateshm_ctx_t *ctx, const char *fn);
+
+/* reader side: copy out the records of the region, returns 1 if a new
+ * copy is in ctx->buf, 0 if it is unchanged, -1 if it could not be read
+ * consistently or is not usable */
+int stateshm_read(stateshm_ctx_t *ctx);
+
+/* walk the records in ctx->buf: fills arg[] (pointing into the buffer)
+ * and returns the number of arguments, or 0 at the end */
+size_t stateshm_next(const stateshm_ctx_t *ctx, size_t *off, char **arg);
+
+/* A snapshot file holds the same records behind a header of its own, so
+ * that a restarting driver can serve the states of its previous run; this
+ * works on all platforms. */
+#define STATESHM_SNAPSHOT_MAGIC	0x4e555443	/* "NUTC" */
+
+/* serialize the states and write them to <fn> through a temporary file
+ * renamed over it, returns 1 on success or 0 with errno set */
+int stateshm_save(stateshm_ctx_t *ctx, const char *fn, const st_tree_t *root,
+	const cmdlist_t *cmdlist);
+
+/* read the records of snapshot <fn> into ctx->buf for stateshm_next(),
+ * returns the time they were saved, or 0 with errno set */
+time_t stateshm_load(stateshm_ctx_t *ctx, const char *fn);
+
+/* unmap the region; the driver side also removes the file */
+void stateshm_close(stateshm_ctx_t *ctx);
+
+#ifdef __cplusplus
+/* *INDENT-OFF* */
+}
+/* *INDENT-ON* */
+#endif
+
+#endif	/* NUT_STATESHM_H_SEEN */
@@ -39,6 +39,12 @@ void do_upsconf_args(char *upsname, char *var, char *val);
  */
 int read_upsconf(int fatal_errors);
 
+/* like read_upsconf(), but only call back do_upsconf_args() for the global
+ * settings and those of the [section] (e.g. of a driver), which an index
+ * of ups.conf saved in the state path by the last full parse tells where
+ * to find; falls back to a full parse if the index is not current */
+int read_upsconf_section(const char *section, int fatal_errors);
+
 #ifdef __cplusplus
 /* *INDENT-OFF* */
 }
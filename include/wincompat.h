@@ -152,12 +152,44 @@ typedef struct pipe_conn_s {
 
 extern pipe_conn_t *pipe_connhead;
 extern OVERLAPPED pipe_connection_overlapped;
+/* if set, called by pipe_create() with each new listening pipe instance */
+extern void (*pipe_create_hook)(HANDLE handle);
 void pipe_create(const char * pipe_name);
 void pipe_connect();
 void pipe_disconnect(pipe_conn_t *conn);
 int pipe_ready(pipe_conn_t *conn);
 int send_to_named_pipe(const char * pipe_name, const char * data);
 
+/* Overlapped reads kept posted on a (byte mode) named pipe, so that a
+ * burst from the other end lands in several buffers at once, rather than
+ * in one which has to be taken and started again before the rest comes.
+ * The reads of a pipe are filled in the order they were started, and
+ * pipe_reads_next() hands them out in that same order. */
+#define PIPE_READS_COUNT	4
+
+typedef struct {
+	HANDLE		handle;
+	OVERLAPPED	ov[PIPE_READS_COUNT];
+	char		*buf[PIPE_READS_COUNT];
+	int		pending[PIPE_READS_COUNT];	/* ov[] is in use by the system */
+	DWORD		bufsize;
+	size_t		next;	/* the oldest read, see pipe_reads_next() */
+} pipe_reads_t;
+
+/* start all the reads on <handle>, of <bufsize> bytes each; with an
+ * (auto-reset) <event> their completions signal it, else they go to the
+ * completion port the handle is associated with; returns 0 on error */
+int pipe_reads_start(pipe_reads_t *reads, HANDLE handle, HANDLE event, size_t bufsize);
+/* take the oldest read: returns 1 with its data (followed by a NUL) in
+ * <buf> and <len> once it completed, 0 if it did not yet, -1 on error */
+int pipe_reads_next(pipe_reads_t *reads, char **buf, DWORD *len);
+/* start again the read taken by pipe_reads_next(); returns 0 on error */
+int pipe_reads_again(pipe_reads_t *reads);
+/* cancel the pending reads and wait until the system is done with them,
+ * before the handle is closed; the buffers stay for pipe_reads_free() */
+void pipe_reads_stop(pipe_reads_t *reads);
+void pipe_reads_free(pipe_reads_t *reads);
+
 #define COMMAND_FSD "COMMAND_FSD"
 #define COMMAND_STOP "COMMAND_STOP"
 #define COMMAND_RELOAD "COMMAND_RELOAD"
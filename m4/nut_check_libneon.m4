@@ -82,8 +82,8 @@ if test -z "${nut_have_neon_seen}"; then
 	AC_CHECK_FUNCS(ne_xml_dispatch_request, [], [nut_have_neon=no])
 
 	if test "${nut_have_neon}" = "yes"; then
-		dnl Check for connect timeout support in library (optional)
-		AC_CHECK_FUNCS(ne_set_connect_timeout ne_sock_connect_timeout)
+		dnl Check for connect timeout and session flags support in library (optional)
+		AC_CHECK_FUNCS(ne_set_connect_timeout ne_sock_connect_timeout ne_set_session_flag)
 		LIBNEON_CFLAGS="${depCFLAGS}"
 		LIBNEON_LIBS="${depLIBS}"
 
@@ -38,6 +38,9 @@ let ups_global   = "chroot"
                  | "nowait"
                  | "retrydelay"
                  | "pollinterval"
+                 | "pollinterval_min"
+                 | "pollinterval_max"
+                 | "statesnapshot"
                  | "synchronous"
                  | "user"
                  | "group"
@@ -51,10 +54,12 @@ let ups_fields_re = /(default|override)\.[^:=#\r\t\n \/]+/
 let ups_fields   = "driver"
                  | "port"
                  | "sdorder"
+                 | "driverhost"
                  | "desc"
                  | "nolock"
                  | "ignorelb"
                  | "maxstartdelay"
+                 | "statesnapshot"
                  | "synchronous"
                  | "user"
                  | "group"
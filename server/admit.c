@@ -0,0 +1,184 @@
+/* admit.c - admission control of new client connections for upsd
+
+   Copyright (C)
+	2026	Network UPS Tools developers
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+/* When a network partition heals, all of its clients come back at once.
+ * ACCEPT_RATE spreads the cost of setting them up over time (a token
+ * bucket: connections beyond it are closed right away, and the clients
+ * try again later), and MAXCONN_PER_ADDR keeps one address from taking
+ * all the slots; the connections of each address are counted in a hash
+ * table, so that checking them does not walk the client list.
+ * With WORKERS, each process applies these limits on its own.
+ */
+
+#include "config.h" /* must be the first header */
+
+#include "common.h"
+#include "upsd.h"
+#include "stats.h"
+#include "admit.h"
+
+typedef struct admit_addr_s {
+	char	*addr;
+	size_t	count;
+	struct admit_addr_s	*next;
+} admit_addr_t;
+
+static admit_addr_t	**addr_table = NULL;
+static size_t	addr_buckets = 0, addr_entries = 0;
+
+/* ACCEPT_RATE tokens left, and when they were last topped up */
+static double	rate_tokens = 0;
+static uint64_t	rate_usec = 0;
+
+/* take a token for one new connection: returns 0 if over ACCEPT_RATE */
+int admit_rate_take(void)
+{
+	uint64_t	now;
+	double	burst;
+
+	if (accept_rate <= 0) {
+		return 1;
+	}
+
+	now = stats_now_usec();
+	burst = accept_burst ? (double)accept_burst : accept_rate;
+
+	if (!rate_usec) {
+		rate_tokens = burst;
+	} else {
+		rate_tokens += accept_rate * (double)(now - rate_usec) / 1000000;
+		if (rate_tokens > burst) {
+			rate_tokens = burst;
+		}
+	}
+	rate_usec = now;
+
+	if (rate_tokens < 1) {
+		return 0;
+	}
+
+	rate_tokens--;
+	return 1;
+}
+
+static admit_addr_t **addr_slot(const char *addr)
+{
+	admit_addr_t	**entry = &addr_table[str_hash_nocase(addr) & (addr_buckets - 1)];
+
+	while (*entry && strcmp((*entry)->addr, addr)) {
+		entry = &(*entry)->next;
+	}
+
+	return entry;
+}
+
+/* keep chains short as the number of addresses grows */
+static void addr_grow(void)
+{
+	admit_addr_t	**old = addr_table, *entry, *next;
+	size_t	i, oldsize = addr_buckets;
+
+	addr_buckets = oldsize ? 2 * oldsize : 64;
+	addr_table = xcalloc(addr_buckets, sizeof(*addr_table));
+
+	for (i = 0; i < oldsize; i++) {
+		for (entry = old[i]; entry; entry = next) {
+			admit_addr_t	**slot = &addr_table[str_hash_nocase(entry->addr) & (addr_buckets - 1)];
+
+			next = entry->next;
+			entry->next = *slot;
+			*slot = entry;
+		}
+	}
+
+	free(old);
+}
+
+/* count a new connection from <addr>: returns 0 (without counting it)
+ * if that address has MAXCONN_PER_ADDR of them already */
+int admit_addr_add(const char *addr)
+{
+	admit_addr_t	**slot;
+
+	if (addr_entries >= addr_buckets) {
+		addr_grow();
+	}
+
+	slot = addr_slot(addr);
+
+	if (*slot) {
+		if (maxconn_per_addr && (*slot)->count >= maxconn_per_addr) {
+			return 0;
+		}
+		(*slot)->count++;
+		return 1;
+	}
+
+	*slot = xcalloc(1, sizeof(**slot));
+	(*slot)->addr = xstrdup(addr);
+	(*slot)->count = 1;
+	addr_entries++;
+
+	return 1;
+}
+
+/* a connection counted by admit_addr_add() is gone */
+void admit_addr_del(const char *addr)
+{
+	admit_addr_t	**slot, *entry;
+
+	if (!addr_buckets) {
+		return;
+	}
+
+	slot = addr_slot(addr);
+
+	if (!(entry = *slot)) {
+		upslogx(LOG_ERR, "Programming error: no connections counted from %s", addr);
+		return;
+	}
+
+	if (--entry->count) {
+		return;
+	}
+
+	*slot = entry->next;
+	free(entry->addr);
+	free(entry);
+	addr_entries--;
+}
+
+void admit_free(void)
+{
+	admit_addr_t	*entry, *next;
+	size_t	i;
+
+	for (i = 0; i < addr_buckets; i++) {
+		for (entry = addr_table[i]; entry; entry = next) {
+			next = entry->next;
+			free(entry->addr);
+			free(entry);
+		}
+	}
+
+	free(addr_table);
+	addr_table = NULL;
+	addr_buckets = addr_entries = 0;
+}
@@ -0,0 +1,42 @@
+/* admit.h - admission control of new client connections for upsd
+
+   Copyright (C)
+	2026	Network UPS Tools developers
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#ifndef NUT_ADMIT_H_SEEN
+#define NUT_ADMIT_H_SEEN 1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* at most this many connections are taken from a listener per wakeup */
+#define ADMIT_ACCEPT_BATCH	64
+
+int admit_rate_take(void);
+
+int admit_addr_add(const char *addr);
+void admit_addr_del(const char *addr);
+
+void admit_free(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif	/* NUT_ADMIT_H_SEEN */
@@ -24,6 +24,12 @@
 #include "user.h"
 #include "netssl.h"
 #include "nut_stdint.h"
+#include "evloop.h"
+#include "netwatch.h"
+#include "workers.h"
+#include "metrics.h"
+#include "stateshm.h"
+#include "history.h"
 #include <ctype.h>
 
 static ups_t	*upstable = NULL;
@@ -41,16 +47,22 @@ int	nut_debug_level_global = -1;
  */
 int nut_debug_level_args = 0;
 
+/* Set while load_upsdconf() re-reads the file upon a reload, for settings
+ * which are only applied at startup */
+static int	reloading_upsdconf = 0;
+
+/* What a reload did to the UPS sections, see conf_reload() */
+static int	reload_added = 0, reload_redefined = 0, reload_updated = 0,
+	reload_removed = 0, reload_unchanged = 0;
+
 /* add another UPS for monitoring from ups.conf */
-static void ups_create(const char *fn, const char *name, const char *desc)
+void ups_create(const char *fn, const char *name, const char *desc)
 {
 	upstype_t	*temp;
 
-	for (temp = firstups; temp != NULL; temp = temp->next) {
-		if (!strcasecmp(temp->name, name)) {
-			upslogx(LOG_ERR, "UPS name [%s] is already in use!", name);
-			return;
-		}
+	if (get_ups_ptr(name)) {
+		upslogx(LOG_ERR, "UPS name [%s] is already in use!", name);
+		return;
 	}
 
 	/* grab some memory and add the info */
@@ -64,6 +76,7 @@ static void ups_create(const char *fn, const char *name, const char *desc)
 
 	temp->stale = 1;
 	temp->retain = 1;
+	stateshm_init(&temp->shm);
 #ifdef WIN32
 	memset(&temp->read_overlapped,0,sizeof(temp->read_overlapped));
 	memset(temp->buf,0,sizeof(temp->buf));
@@ -77,13 +90,24 @@ static void ups_create(const char *fn, const char *name, const char *desc)
 		return;
 	}
 #endif	/* WIN32 */
-	temp->sock_fd = sstate_connect(temp);
 
 	/* preload this to the current time to avoid false staleness */
 	time(&temp->last_heard);
 
+	/* reconnect and staleness checks, starting on the next loop */
+	timer_init(&temp->timer, ups_check, temp);
+
+	if (worker_id < 0) {
+		temp->sock_fd = sstate_connect(temp);
+		timer_set(&temp->timer, 0);
+	} else {
+		/* workers only serve the states published by the main process */
+		temp->sock_fd = ERROR_FD;
+	}
+
 	temp->next = firstups;
 	firstups = temp;
+	ups_index_add(temp);
 	num_ups++;
 }
 
@@ -118,16 +142,31 @@ static void ups_update(const char *fn, const char *name, const char *desc)
 		pconf_finish(&temp->sock_ctx);
 
 #ifndef WIN32
+		evloop_del(temp->sock_fd);
 		close(temp->sock_fd);
 #else	/* WIN32 */
+		evloop_del_handle(temp->sock_fd);
 		CloseHandle(temp->sock_fd);
 #endif	/* WIN32 */
 		temp->sock_fd = ERROR_FD;
 		temp->dumpdone = 0;
+		free(temp->seq_epoch);
+		temp->seq_epoch = NULL;
+		timer_set(&temp->timer, 0);	/* reconnect */
 
 		/* now redefine the filename and wrap up */
 		free(temp->fn);
 		temp->fn = xstrdup(fn);
+		reload_redefined++;
+	} else if ((desc == NULL) != (temp->desc == NULL)
+		|| (desc && strcmp(desc, temp->desc) != 0)
+	) {
+		/* the driver connection and its states are kept as they are */
+		upsdebugx(1, "Updated description of UPS [%s]", name);
+		reload_updated++;
+	} else {
+		upsdebugx(2, "UPS [%s] is unchanged", name);
+		reload_unchanged++;
 	}
 
 	/* update the description */
@@ -190,6 +229,18 @@ static int parse_upsd_conf_args(size_t numargs, char **arg)
 		}
 	}
 
+	/* CLIENT_INACTIVITY_DELAY <seconds> */
+	if (!strcmp(arg[0], "CLIENT_INACTIVITY_DELAY")) {
+		if (isdigit((size_t)arg[1][0]) && atoi(arg[1]) > 0) {
+			client_inactivity_delay = atoi(arg[1]);
+			return 1;
+		}
+		else {
+			upslogx(LOG_ERR, "CLIENT_INACTIVITY_DELAY has non numeric or zero value (%s)!", arg[1]);
+			return 0;
+		}
+	}
+
 	/* TRACKINGDELAY <seconds> */
 	if (!strcmp(arg[0], "TRACKINGDELAY")) {
 		if (isdigit((size_t)arg[1][0])) {
@@ -228,6 +279,74 @@ static int parse_upsd_conf_args(size_t numargs, char **arg)
 		return 0;
 	}
 
+	/* SHARED_STATE <bool> */
+	if (!strcmp(arg[0], "SHARED_STATE")) {
+		if (parse_boolean(arg[1], &shared_state)) {
+#ifndef WITH_STATESHM
+			if (shared_state) {
+				upslogx(LOG_WARNING, "SHARED_STATE is not supported on this platform, ignored");
+				shared_state = 0;
+			}
+#endif	/* !WITH_STATESHM */
+			return 1;
+		}
+
+		upslogx(LOG_ERR, "SHARED_STATE has non boolean value (%s)!", arg[1]);
+		return 0;
+	}
+
+	/* FRAMED_SOCKET <bool> */
+	if (!strcmp(arg[0], "FRAMED_SOCKET")) {
+		if (parse_boolean(arg[1], &framed_socket)) {
+			return 1;
+		}
+
+		upslogx(LOG_ERR, "FRAMED_SOCKET has non boolean value (%s)!", arg[1]);
+		return 0;
+	}
+
+	/* MEMSTATS <bool> */
+	if (!strcmp(arg[0], "MEMSTATS")) {
+		if (parse_boolean(arg[1], &mem_stats)) {
+			if (mem_stats) {
+				nut_mem_enable();
+			}
+			return 1;
+		}
+
+		upslogx(LOG_ERR, "MEMSTATS has non boolean value (%s)!", arg[1]);
+		return 0;
+	}
+
+	/* TRACE <sample> */
+	if (!strcmp(arg[0], "TRACE")) {
+		if (isdigit((size_t)arg[1][0])) {
+			trace_sample = atoi(arg[1]);
+			return 1;
+		}
+
+		upslogx(LOG_ERR, "TRACE has non numeric value (%s)!", arg[1]);
+		return 0;
+	}
+
+	/* HISTORY <depth> <varname>... */
+	if (!strcmp(arg[0], "HISTORY")) {
+		size_t	i;
+
+		if (numargs < 3) {
+			upslogx(LOG_ERR, "HISTORY needs a depth and variable names!");
+			return 0;
+		}
+
+		for (i = 2; i < numargs; i++) {
+			if (!history_conf_add(arg[1], arg[i])) {
+				upslogx(LOG_ERR, "HISTORY has non numeric or zero depth (%s)!", arg[1]);
+				return 0;
+			}
+		}
+		return 1;
+	}
+
 	/* MAXCONN <connections> */
 	if (!strcmp(arg[0], "MAXCONN")) {
 		if (isdigit((size_t)arg[1][0])) {
@@ -241,6 +360,69 @@ static int parse_upsd_conf_args(size_t numargs, char **arg)
 		}
 	}
 
+	/* MAXCONN_PER_ADDR <connections> */
+	if (!strcmp(arg[0], "MAXCONN_PER_ADDR")) {
+		if (isdigit((size_t)arg[1][0])) {
+			maxconn_per_addr = (size_t)atol(arg[1]);
+			return 1;
+		}
+		else {
+			upslogx(LOG_ERR, "MAXCONN_PER_ADDR has non numeric value (%s)!", arg[1]);
+			return 0;
+		}
+	}
+
+	/* ACCEPT_RATE <connections per second> [<burst>] */
+	if (!strcmp(arg[0], "ACCEPT_RATE")) {
+		char	*end;
+		double	rate = strtod(arg[1], &end);
+
+		if (end == arg[1] || *end != '\0' || rate < 0
+		 || (numargs > 2 && !isdigit((size_t)arg[2][0]))
+		) {
+			upslogx(LOG_ERR, "ACCEPT_RATE has non numeric value (%s)!", arg[1]);
+			return 0;
+		}
+
+		accept_rate = rate;
+		accept_burst = (numargs > 2) ? (size_t)atol(arg[2]) : 0;
+		return 1;
+	}
+
+	/* MAXSENDQUEUE <bytes> */
+	if (!strcmp(arg[0], "MAXSENDQUEUE")) {
+		if (isdigit((size_t)arg[1][0])) {
+			long	v = atol(arg[1]);
+
+			/* must hold at least one complete answer line */
+			if (v < NUT_NET_ANSWER_MAX + 1) {
+				upslogx(LOG_WARNING, "MAXSENDQUEUE value %ld is too small, using %d",
+					v, NUT_NET_ANSWER_MAX + 1);
+				v = NUT_NET_ANSWER_MAX + 1;
+			}
+			sendq_max = (size_t)v;
+			return 1;
+		}
+		else {
+			upslogx(LOG_ERR, "MAXSENDQUEUE has non numeric value (%s)!", arg[1]);
+			return 0;
+		}
+	}
+
+	/* SENDQUEUE_POLICY <disconnect|wait> */
+	if (!strcmp(arg[0], "SENDQUEUE_POLICY")) {
+		if (!strcasecmp(arg[1], "disconnect")) {
+			sendq_policy = SENDQ_POLICY_DISCONNECT;
+			return 1;
+		}
+		if (!strcasecmp(arg[1], "wait")) {
+			sendq_policy = SENDQ_POLICY_WAIT;
+			return 1;
+		}
+		upslogx(LOG_ERR, "SENDQUEUE_POLICY has unknown value (%s)!", arg[1]);
+		return 0;
+	}
+
 	/* STATEPATH <dir> */
 	if (!strcmp(arg[0], "STATEPATH")) {
 		const char *sp = getenv("NUT_STATEPATH");
@@ -256,6 +438,54 @@ static int parse_upsd_conf_args(size_t numargs, char **arg)
 		return 1;
 	}
 
+	/* EVENT_BACKEND <auto|poll|epoll|kqueue|iocp> */
+	if (!strcmp(arg[0], "EVENT_BACKEND")) {
+		evloop_backend_t	backend;
+
+		if (!evloop_backend_parse(arg[1], &backend)) {
+			upslogx(LOG_ERR, "EVENT_BACKEND has unknown value (%s)!", arg[1]);
+			return 0;
+		}
+
+		/* only applied at startup, see evloop_init() call in main() */
+		if (reloading_upsdconf && backend != evloop_backend_wanted) {
+			upslogx(LOG_WARNING, "EVENT_BACKEND change requires a restart of upsd");
+		} else {
+			evloop_backend_wanted = backend;
+		}
+		return 1;
+	}
+
+	/* WORKERS <processes> */
+	if (!strcmp(arg[0], "WORKERS")) {
+		int	v;
+
+		if (!isdigit((size_t)arg[1][0])) {
+			upslogx(LOG_ERR, "WORKERS has non numeric value (%s)!", arg[1]);
+			return 0;
+		}
+
+		v = atoi(arg[1]);
+		if (v > WORKERS_MAX) {
+			upslogx(LOG_WARNING, "WORKERS value %d is too large, using %d",
+				v, WORKERS_MAX);
+			v = WORKERS_MAX;
+		}
+
+		if (v > 0 && !workers_supported()) {
+			upslogx(LOG_WARNING, "WORKERS are not supported on this platform, ignored");
+			v = 0;
+		}
+
+		/* listeners are shared with the workers at startup, see workers_listen() */
+		if (reloading_upsdconf && v != worker_count) {
+			upslogx(LOG_WARNING, "WORKERS change requires a restart of upsd");
+		} else {
+			worker_count = v;
+		}
+		return 1;
+	}
+
 	/* DATAPATH <dir> */
 	if (!strcmp(arg[0], "DATAPATH")) {
 		free(datapath);
@@ -301,6 +531,48 @@ static int parse_upsd_conf_args(size_t numargs, char **arg)
 		upslogx(LOG_ERR, "DISABLE_WEAK_SSL has non boolean value (%s)!", arg[1]);
 		return 0;
 	}
+
+	/* SSL_SESSION_CACHE <entries> */
+	if (!strcmp(arg[0], "SSL_SESSION_CACHE")) {
+		if (isdigit((size_t)arg[1][0])) {
+			ssl_session_cache = atoi(arg[1]);
+			return 1;
+		}
+		else {
+			upslogx(LOG_ERR, "SSL_SESSION_CACHE has non numeric value (%s)!", arg[1]);
+			return 0;
+		}
+	}
+
+	/* SSL_SESSION_TIMEOUT <seconds> */
+	if (!strcmp(arg[0], "SSL_SESSION_TIMEOUT")) {
+		if (isdigit((size_t)arg[1][0])) {
+			ssl_session_timeout = atoi(arg[1]);
+			return 1;
+		}
+		else {
+			upslogx(LOG_ERR, "SSL_SESSION_TIMEOUT has non numeric value (%s)!", arg[1]);
+			return 0;
+		}
+	}
+
+	/* SSL_SESSION_TICKETS <bool> */
+	if (!strcmp(arg[0], "SSL_SESSION_TICKETS")) {
+		if (parse_boolean(arg[1], &ssl_session_tickets))
+			return 1;
+
+		upslogx(LOG_ERR, "SSL_SESSION_TICKETS has non boolean value (%s)!", arg[1]);
+		return 0;
+	}
+
+	/* SSL_KTLS <bool> */
+	if (!strcmp(arg[0], "SSL_KTLS")) {
+		if (parse_boolean(arg[1], &ssl_ktls))
+			return 1;
+
+		upslogx(LOG_ERR, "SSL_KTLS has non boolean value (%s)!", arg[1]);
+		return 0;
+	}
 #endif /* WITH_OPENSSL | WITH_NSS */
 
 	/* ACCEPT <aclname> [<aclname>...] */
@@ -324,6 +596,15 @@ static int parse_upsd_conf_args(size_t numargs, char **arg)
 		return 1;
 	}
 
+	/* METRICS <address> [<port>] */
+	if (!strcmp(arg[0], "METRICS")) {
+		if (numargs < 3)
+			metrics_listen_add(arg[1], METRICS_PORT);
+		else
+			metrics_listen_add(arg[1], arg[2]);
+		return 1;
+	}
+
 	/* everything below here uses up through arg[2] */
 	if (numargs < 3)
 		return 0;
@@ -377,11 +658,16 @@ void load_upsdconf(int reloading)
 		return;
 	}
 
+	reloading_upsdconf = reloading;
+
 	if (reloading) {
 		/* if upsd.conf added or changed
 		 * (or commented away) the debug_min
 		 * setting, detect that */
 		nut_debug_level_global = -1;
+
+		/* the variables kept are those named in there now */
+		history_conf_free();
 	}
 
 	while (pconf_file_next(&ctx)) {
@@ -524,10 +810,13 @@ void upsconf_add(int reloading)
 				tmp->driver, tmp->upsname);
 
 			/* if a UPS exists, update it, else add it as new */
-			if ((reloading) && (get_ups_ptr(tmp->upsname) != NULL))
+			if ((reloading) && (get_ups_ptr(tmp->upsname) != NULL)) {
 				ups_update(statefn, tmp->upsname, tmp->desc);
-			else
+			} else {
 				ups_create(statefn, tmp->upsname, tmp->desc);
+				if (reloading)
+					reload_added++;
+			}
 		}
 
 		/* free tmp's resources */
@@ -546,7 +835,7 @@ void upsconf_add(int reloading)
 }
 
 /* remove a UPS from the linked list */
-static void delete_ups(upstype_t *target)
+void delete_ups(upstype_t *target)
 {
 	upstype_t	*ptr, *last;
 
@@ -568,16 +857,25 @@ static void delete_ups(upstype_t *target)
 			else
 				last->next = ptr->next;
 
-			if (VALID_FD(ptr->sock_fd))
+			ups_index_del(ptr);
+			timer_cancel(&ptr->timer);
+
+			if (VALID_FD(ptr->sock_fd)) {
 #ifndef WIN32
+				evloop_del(ptr->sock_fd);
 				close(ptr->sock_fd);
 #else	/* WIN32 */
+				evloop_del_handle(ptr->sock_fd);
 				CloseHandle(ptr->sock_fd);
 #endif	/* WIN32 */
+			}
 
 			/* release memory */
 			sstate_infofree(ptr);
 			sstate_cmdfree(ptr);
+			netwatch_ups_free(ptr);
+			history_ups_free(ptr);
+			sstate_connfree(ptr);
 			pconf_finish(&ptr->sock_ctx);
 
 			free(ptr->fn);
@@ -626,6 +924,9 @@ void conf_reload(void)
 	if (!check_file("upsd.conf"))
 		return;
 
+	reload_added = reload_redefined = reload_updated = 0;
+	reload_removed = reload_unchanged = 0;
+
 	/* reset retain flags on all known UPS entries */
 	upstmp = firstups;
 	while (upstmp) {
@@ -648,12 +949,21 @@ void conf_reload(void)
 		/* upstmp may be deleted during this pass */
 		upsnext = upstmp->next;
 
-		if (upstmp->retain == 0)
+		if (upstmp->retain == 0) {
 			delete_ups(upstmp);
+			reload_removed++;
+		}
 
 		upstmp = upsnext;
 	}
 
+	/* only the sections counted as added or redefined (re)connect to
+	 * their drivers, the others keep their connections and states */
+	upslogx(LOG_INFO, "Reloaded ups.conf: %d UPS added, %d redefined, "
+		"%d with a new description, %d removed, %d unchanged",
+		reload_added, reload_redefined, reload_updated,
+		reload_removed, reload_unchanged);
+
 	/* did they actually delete the last UPS? */
 	if (firstups == NULL)
 		upslogx(LOG_WARNING, "Warning: no UPSes currently defined!");
@@ -35,9 +35,16 @@ void load_upsdconf(int reloading);
 /* add valid UPSes from ups.conf to the internal structures */
 void upsconf_add(int reloading);
 
-/* flush existing config, then reread everything */
+/* reread everything; UPS sections which did not change keep their driver
+ * connections and states */
 void conf_reload(void);
 
+/* add a UPS (connecting to its driver, except in WORKERS processes),
+ * or remove one along with its states */
+struct upstype_s;
+void ups_create(const char *fn, const char *name, const char *desc);
+void delete_ups(struct upstype_s *target);
+
 typedef struct ups_s {
 	char	*upsname;
 	char	*driver;
@@ -23,63 +23,85 @@
 
 #include "common.h"
 #include "parseconf.h"
+#include "state.h"
+#include "nut_stdint.h"
 
 #include "desc.h"
 
 extern const char *datapath;
 
+/* The descriptions of both kinds are hashed by the pointer of their name,
+ * interned like those of the state trees: a name that is not interned has
+ * no description, and there is nothing to compare but pointers. */
+#define DESC_HASH_SIZE	256	/* a power of two, cmdvartab has about as many */
+
 typedef struct dlist_s {
-	char	*name;
+	const char	*name;		/* interned */
 	char	*desc;
+	int	cmd;			/* of a CMDDESC rather than a VARDESC */
 	struct dlist_s	*next;
 } dlist_t;
 
-static dlist_t	*cmd_list = NULL, *var_list = NULL;
+static dlist_t	*desc_hash[DESC_HASH_SIZE];
+
+/* cmdvartab is only read when the first description is asked for:
+ * 0 = not to be read, 1 = to be read, 2 = read */
+static int	desc_state = 0;
 
-static void list_free(dlist_t *ptr)
+static size_t desc_bucket(const char *key)
 {
-	dlist_t	*next;
+	uintptr_t	ptr = (uintptr_t)key;
 
-	while (ptr) {
-		next = ptr->next;
+	return (size_t)((ptr >> 4) ^ (ptr >> 12)) & (DESC_HASH_SIZE - 1);
+}
 
-		free(ptr->name);
-		free(ptr->desc);
-		free(ptr);
+static dlist_t *desc_find(const char *key, int cmd)
+{
+	dlist_t	*temp;
 
-		ptr = next;
+	for (temp = desc_hash[desc_bucket(key)]; temp != NULL; temp = temp->next) {
+		if (temp->name == key && temp->cmd == cmd) {
+			return temp;
+		}
 	}
+
+	return NULL;
 }
 
-static const char *list_get(const dlist_t *list, const char *name)
+static const char *desc_get(const char *name, int cmd)
 {
+	const char	*key;
 	const dlist_t	*temp;
 
-	for (temp = list; temp != NULL; temp = temp->next) {
+	desc_ready();
 
-		if (!strcasecmp(temp->name, name)) {
-			return temp->desc;
-		}
+	if ((key = state_name_find(name)) == NULL) {
+		return NULL;
 	}
 
-	return NULL;
+	temp = desc_find(key, cmd);
+
+	return temp ? temp->desc : NULL;
 }
 
-static void desc_add(dlist_t **list, const char *name, const char *desc)
+static void desc_add(const char *name, const char *desc, int cmd)
 {
-	dlist_t	*temp;
+	dlist_t	*temp = NULL;
+	const char	*key = state_name_find(name);
+	size_t	bucket;
 
-	for (temp = *list; temp != NULL; temp = temp->next) {
-		if (!strcasecmp(temp->name, name)) {
-			break;
-		}
+	if (key != NULL) {
+		temp = desc_find(key, cmd);
 	}
 
 	if (temp == NULL) {
 		temp = xcalloc(1, sizeof(*temp));
-		temp->name = xstrdup(name);
-		temp->next = *list;
-		*list = temp;
+		temp->name = state_name_intern(name);
+		temp->cmd = cmd;
+
+		bucket = desc_bucket(temp->name);
+		temp->next = desc_hash[bucket];
+		desc_hash[bucket] = temp;
 	}
 
 	free(temp->desc);
@@ -91,9 +113,7 @@ static void desc_file_err(const char *errmsg)
 	upslogx(LOG_ERR, "Fatal error in parseconf (cmdvartab): %s", errmsg);
 }
 
-/* interface */
-
-void desc_load(void)
+static void desc_read(void)
 {
 	char	fn[NUT_PATH_MAX];
 	PCONF_CTX_t	ctx;
@@ -120,12 +140,12 @@ void desc_load(void)
 		}
 
 		if (!strcmp(ctx.arglist[0], "CMDDESC")) {
-			desc_add(&cmd_list, ctx.arglist[1], ctx.arglist[2]);
+			desc_add(ctx.arglist[1], ctx.arglist[2], 1);
 			continue;
 		}
 
 		if (!strcmp(ctx.arglist[0], "VARDESC")) {
-			desc_add(&var_list, ctx.arglist[1], ctx.arglist[2]);
+			desc_add(ctx.arglist[1], ctx.arglist[2], 0);
 			continue;
 		}
 
@@ -135,20 +155,48 @@ void desc_load(void)
 	pconf_finish(&ctx);
 }
 
+/* interface */
+
+void desc_load(void)
+{
+	desc_free();
+	desc_state = 1;
+}
+
+void desc_ready(void)
+{
+	if (desc_state == 1) {
+		desc_state = 2;
+		desc_read();
+	}
+}
+
 void desc_free(void)
 {
-	list_free(cmd_list);
-	list_free(var_list);
+	dlist_t	*temp, *next;
+	size_t	i;
+
+	for (i = 0; i < DESC_HASH_SIZE; i++) {
+		for (temp = desc_hash[i]; temp != NULL; temp = next) {
+			next = temp->next;
+
+			state_name_release(temp->name);
+			free(temp->desc);
+			free(temp);
+		}
+
+		desc_hash[i] = NULL;
+	}
 
-	cmd_list = var_list = NULL;
+	desc_state = 0;
 }
 
 const char *desc_get_cmd(const char *name)
 {
-	return list_get(cmd_list, name);
+	return desc_get(name, 1);
 }
 
 const char *desc_get_var(const char *name)
 {
-	return list_get(var_list, name);
+	return desc_get(name, 0);
 }
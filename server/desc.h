@@ -30,7 +30,10 @@ extern "C" {
 /* *INDENT-ON* */
 #endif
 
+/* desc_load() only arms the reading of cmdvartab, which happens with the
+ * first description asked for, or with desc_ready() */
 void desc_load(void);
+void desc_ready(void);
 void desc_free(void);
 const char *desc_get_cmd(const char *name);
 const char *desc_get_var(const char *name);
@@ -0,0 +1,1229 @@
+/* evloop.c - pluggable event notification backends for upsd
+
+   Copyright (C)
+	2026	Network UPS Tools developers
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+/* Historically mainloop() rebuilt a pollfd array from the driver, client
+ * and listener lists on every iteration, making each wakeup cost O(all
+ * connections). Here descriptors are registered once when they are opened
+ * and removed when they are closed, and the kernel-side notification
+ * facility (where available) only hands back the ready ones.
+ *
+ * The WIN32 build uses an I/O completion port for sockets and named pipes
+ * alike, see below.
+ */
+
+#include "config.h"	/* must be the first header */
+
+#ifdef WIN32
+/* GetQueuedCompletionStatusEx() and CancelIoEx() came with Vista */
+# if (!defined(_WIN32_WINNT)) || (_WIN32_WINNT < 0x0600)
+#  undef _WIN32_WINNT
+#  define _WIN32_WINNT 0x0600
+# endif
+#endif	/* WIN32 */
+
+#include "common.h"
+#include "nut_stdint.h"
+#include "evloop.h"
+
+#ifndef WIN32
+# ifdef HAVE_POLL_H
+#  include <poll.h>
+# endif
+# if defined(HAVE_SYS_EPOLL_H) && defined(HAVE_EPOLL_CREATE1)
+#  include <sys/epoll.h>
+#  define EVLOOP_HAVE_EPOLL 1
+# endif
+# if defined(HAVE_SYS_EVENT_H) && defined(HAVE_KQUEUE)
+#  include <sys/event.h>
+#  define EVLOOP_HAVE_KQUEUE 1
+# endif
+#endif	/* !WIN32 */
+
+/* How many ready events to fetch from the kernel in one go; the rest
+ * (if any) would be reported by the next wait */
+#define EVLOOP_BATCH	256
+
+evloop_backend_t	evloop_backend_wanted = EVLOOP_AUTO;
+
+static struct {
+	const char	*name;
+	evloop_backend_t	backend;
+} evloop_backends[] = {
+	{ "auto",	EVLOOP_AUTO	},
+	{ "poll",	EVLOOP_POLL	},
+	{ "epoll",	EVLOOP_EPOLL	},
+	{ "kqueue",	EVLOOP_KQUEUE	},
+	{ "iocp",	EVLOOP_IOCP	},
+	{ NULL,		EVLOOP_AUTO	}
+};
+
+int evloop_backend_parse(const char *name, evloop_backend_t *result)
+{
+	size_t	i;
+
+	if (!name || !result)
+		return 0;
+
+	for (i = 0; evloop_backends[i].name; i++) {
+		if (!strcasecmp(evloop_backends[i].name, name)) {
+			*result = evloop_backends[i].backend;
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+const char *evloop_backend_name(evloop_backend_t backend)
+{
+	size_t	i;
+
+	for (i = 0; evloop_backends[i].name; i++) {
+		if (evloop_backends[i].backend == backend)
+			return evloop_backends[i].name;
+	}
+
+	return "unknown";
+}
+
+#ifndef WIN32
+
+/* registration record for one descriptor */
+typedef struct {
+	TYPE_FD_SOCK	fd;
+	int		events;
+	handler_t	handler;
+	size_t		pollidx;	/* slot in pfds[] for the poll backend */
+} evloop_reg_t;
+
+static evloop_backend_t	evloop_active = EVLOOP_POLL;
+
+/* registrations indexed by descriptor number */
+static evloop_reg_t	**regs = NULL;
+static size_t	regs_len = 0, nregs = 0, maxregs = 0;
+
+/* poll() backend: dense array of watched descriptors */
+static struct pollfd	*pfds = NULL;
+static evloop_reg_t	**preg = NULL;
+static size_t	npfds = 0, pfds_len = 0;
+
+#ifdef EVLOOP_HAVE_EPOLL
+static int	epfd = -1;
+static struct epoll_event	epevents[EVLOOP_BATCH];
+#endif
+
+#ifdef EVLOOP_HAVE_KQUEUE
+static int	kqfd = -1;
+static struct kevent	kqevents[EVLOOP_BATCH];
+#endif
+
+/* last batch of ready descriptors */
+static evloop_event_t	*ready = NULL;
+static size_t	ready_len = 0;
+static int	nready = 0;
+
+static evloop_reg_t *reg_get(TYPE_FD_SOCK fd)
+{
+	if (fd < 0 || (size_t)fd >= regs_len)
+		return NULL;
+
+	return regs[fd];
+}
+
+static void ready_reserve(size_t count)
+{
+	if (ready_len >= count)
+		return;
+
+	ready_len = count;
+	ready = xrealloc(ready, ready_len * sizeof(*ready));
+}
+
+static short poll_events(int events)
+{
+	short	ev = 0;
+
+	if (events & EVLOOP_READ)
+		ev |= POLLIN;
+	if (events & EVLOOP_WRITE)
+		ev |= POLLOUT;
+
+	return ev;
+}
+
+#ifdef EVLOOP_HAVE_EPOLL
+static uint32_t epoll_events(int events)
+{
+	uint32_t	ev = 0;
+
+	if (events & EVLOOP_READ)
+		ev |= EPOLLIN;
+	if (events & EVLOOP_WRITE)
+		ev |= EPOLLOUT;
+
+	return ev;
+}
+#endif	/* EVLOOP_HAVE_EPOLL */
+
+#ifdef EVLOOP_HAVE_KQUEUE
+/* apply the difference between old and new interest sets */
+static int kqueue_apply(TYPE_FD_SOCK fd, int oldev, int newev, void *udata)
+{
+	struct kevent	kev[2];
+	int	n = 0;
+
+	if ((oldev ^ newev) & EVLOOP_READ) {
+		EV_SET(&kev[n], fd, EVFILT_READ,
+			(newev & EVLOOP_READ) ? EV_ADD : EV_DELETE, 0, 0, udata);
+		n++;
+	}
+
+	if ((oldev ^ newev) & EVLOOP_WRITE) {
+		EV_SET(&kev[n], fd, EVFILT_WRITE,
+			(newev & EVLOOP_WRITE) ? EV_ADD : EV_DELETE, 0, 0, udata);
+		n++;
+	}
+
+	if (n == 0)
+		return 0;
+
+	return kevent(kqfd, kev, n, NULL, 0, NULL);
+}
+#endif	/* EVLOOP_HAVE_KQUEUE */
+
+static void backend_close(void)
+{
+#ifdef EVLOOP_HAVE_EPOLL
+	if (epfd >= 0) {
+		close(epfd);
+		epfd = -1;
+	}
+#endif
+#ifdef EVLOOP_HAVE_KQUEUE
+	if (kqfd >= 0) {
+		close(kqfd);
+		kqfd = -1;
+	}
+#endif
+}
+
+evloop_backend_t evloop_init(evloop_backend_t backend, size_t maxfds)
+{
+	evloop_backend_t	chosen = EVLOOP_POLL;
+
+	backend_close();
+
+	if (backend == EVLOOP_AUTO) {
+#if defined EVLOOP_HAVE_EPOLL
+		backend = EVLOOP_EPOLL;
+#elif defined EVLOOP_HAVE_KQUEUE
+		backend = EVLOOP_KQUEUE;
+#else
+		backend = EVLOOP_POLL;
+#endif
+	}
+
+	switch (backend) {
+	case EVLOOP_EPOLL:
+#ifdef EVLOOP_HAVE_EPOLL
+		epfd = epoll_create1(EPOLL_CLOEXEC);
+		if (epfd >= 0) {
+			chosen = EVLOOP_EPOLL;
+		} else {
+			upslog_with_errno(LOG_WARNING, "%s: epoll_create1() failed, falling back to poll", __func__);
+		}
+#else
+		upslogx(LOG_WARNING, "%s: epoll is not supported by this build, falling back to poll", __func__);
+#endif
+		break;
+
+	case EVLOOP_KQUEUE:
+#ifdef EVLOOP_HAVE_KQUEUE
+		kqfd = kqueue();
+		if (kqfd >= 0) {
+			chosen = EVLOOP_KQUEUE;
+		} else {
+			upslog_with_errno(LOG_WARNING, "%s: kqueue() failed, falling back to poll", __func__);
+		}
+#else
+		upslogx(LOG_WARNING, "%s: kqueue is not supported by this build, falling back to poll", __func__);
+#endif
+		break;
+
+	case EVLOOP_IOCP:
+		upslogx(LOG_WARNING, "%s: iocp is only supported on Windows, falling back to poll", __func__);
+		break;
+
+	case EVLOOP_POLL:
+	case EVLOOP_AUTO:
+	default:
+		break;
+	}
+
+	evloop_active = chosen;
+	evloop_resize(maxfds);
+
+	upslogx(LOG_INFO, "Using %s event notification backend", evloop_backend_name(evloop_active));
+
+	return evloop_active;
+}
+
+void evloop_resize(size_t maxfds)
+{
+	maxregs = maxfds;
+
+	if (nregs > maxregs) {
+		upslogx(LOG_WARNING, "%s: %" PRIuSIZE " descriptors are already "
+			"registered, more than the new limit of %" PRIuSIZE,
+			__func__, nregs, maxregs);
+	}
+}
+
+void evloop_free(void)
+{
+	size_t	i;
+
+	backend_close();
+
+	for (i = 0; i < regs_len; i++)
+		free(regs[i]);
+
+	free(regs);
+	regs = NULL;
+	regs_len = nregs = 0;
+
+	free(pfds);
+	free(preg);
+	pfds = NULL;
+	preg = NULL;
+	npfds = pfds_len = 0;
+
+	free(ready);
+	ready = NULL;
+	ready_len = 0;
+	nready = 0;
+}
+
+int evloop_add(TYPE_FD_SOCK fd, int events, handler_type_t type, void *data)
+{
+	evloop_reg_t	*reg;
+
+	if (INVALID_FD_SOCK(fd))
+		return 0;
+
+	if (reg_get(fd)) {
+		upsdebugx(1, "%s: FD %d is already registered", __func__, fd);
+		return 0;
+	}
+
+	if (nregs >= maxregs) {
+		upsdebugx(1, "%s: can not register FD %d: "
+			"reached the limit of %" PRIuSIZE " connections",
+			__func__, fd, maxregs);
+		return 0;
+	}
+
+	if ((size_t)fd >= regs_len) {
+		size_t	newlen = regs_len ? regs_len : 64;
+
+		while (newlen <= (size_t)fd)
+			newlen *= 2;
+
+		regs = xrealloc(regs, newlen * sizeof(*regs));
+		memset(regs + regs_len, 0, (newlen - regs_len) * sizeof(*regs));
+		regs_len = newlen;
+	}
+
+	reg = xcalloc(1, sizeof(*reg));
+	reg->fd = fd;
+	reg->events = events;
+	reg->handler.type = type;
+	reg->handler.data = data;
+
+	switch (evloop_active) {
+#ifdef EVLOOP_HAVE_EPOLL
+	case EVLOOP_EPOLL:
+		{
+			struct epoll_event	ev;
+
+			memset(&ev, 0, sizeof(ev));
+			ev.events = epoll_events(events);
+			ev.data.ptr = reg;
+
+			if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+				upslog_with_errno(LOG_ERR, "%s: epoll_ctl(ADD, %d)", __func__, fd);
+				free(reg);
+				return 0;
+			}
+		}
+		break;
+#endif
+#ifdef EVLOOP_HAVE_KQUEUE
+	case EVLOOP_KQUEUE:
+		if (kqueue_apply(fd, 0, events, reg) < 0) {
+			upslog_with_errno(LOG_ERR, "%s: kevent(ADD, %d)", __func__, fd);
+			free(reg);
+			return 0;
+		}
+		break;
+#endif
+	case EVLOOP_POLL:
+	default:
+		if (npfds >= pfds_len) {
+			pfds_len = pfds_len ? pfds_len * 2 : 64;
+			pfds = xrealloc(pfds, pfds_len * sizeof(*pfds));
+			preg = xrealloc(preg, pfds_len * sizeof(*preg));
+		}
+		pfds[npfds].fd = fd;
+		pfds[npfds].events = poll_events(events);
+		pfds[npfds].revents = 0;
+		preg[npfds] = reg;
+		reg->pollidx = npfds;
+		npfds++;
+		break;
+	}
+
+	regs[fd] = reg;
+	nregs++;
+
+	upsdebugx(5, "%s: FD %d (handler type %d) registered, %" PRIuSIZE " in total",
+		__func__, fd, type, nregs);
+
+	return 1;
+}
+
+int evloop_mod(TYPE_FD_SOCK fd, int events)
+{
+	evloop_reg_t	*reg = reg_get(fd);
+
+	if (!reg)
+		return 0;
+
+	if (reg->events == events)
+		return 1;
+
+	switch (evloop_active) {
+#ifdef EVLOOP_HAVE_EPOLL
+	case EVLOOP_EPOLL:
+		{
+			struct epoll_event	ev;
+
+			memset(&ev, 0, sizeof(ev));
+			ev.events = epoll_events(events);
+			ev.data.ptr = reg;
+
+			if (epoll_ctl(epfd, EPOLL_CTL_MOD, fd, &ev) < 0) {
+				upslog_with_errno(LOG_ERR, "%s: epoll_ctl(MOD, %d)", __func__, fd);
+				return 0;
+			}
+		}
+		break;
+#endif
+#ifdef EVLOOP_HAVE_KQUEUE
+	case EVLOOP_KQUEUE:
+		if (kqueue_apply(fd, reg->events, events, reg) < 0) {
+			upslog_with_errno(LOG_ERR, "%s: kevent(MOD, %d)", __func__, fd);
+			return 0;
+		}
+		break;
+#endif
+	case EVLOOP_POLL:
+	default:
+		pfds[reg->pollidx].events = poll_events(events);
+		break;
+	}
+
+	reg->events = events;
+
+	return 1;
+}
+
+int evloop_del(TYPE_FD_SOCK fd)
+{
+	evloop_reg_t	*reg = reg_get(fd);
+	int	i;
+
+	if (!reg)
+		return 0;
+
+	switch (evloop_active) {
+#ifdef EVLOOP_HAVE_EPOLL
+	case EVLOOP_EPOLL:
+		if (epoll_ctl(epfd, EPOLL_CTL_DEL, fd, NULL) < 0) {
+			upsdebug_with_errno(2, "%s: epoll_ctl(DEL, %d)", __func__, fd);
+		}
+		break;
+#endif
+#ifdef EVLOOP_HAVE_KQUEUE
+	case EVLOOP_KQUEUE:
+		if (kqueue_apply(fd, reg->events, 0, reg) < 0) {
+			upsdebug_with_errno(2, "%s: kevent(DEL, %d)", __func__, fd);
+		}
+		break;
+#endif
+	case EVLOOP_POLL:
+	default:
+		/* move the last entry into the freed slot */
+		npfds--;
+		if (reg->pollidx != npfds) {
+			pfds[reg->pollidx] = pfds[npfds];
+			preg[reg->pollidx] = preg[npfds];
+			preg[reg->pollidx]->pollidx = reg->pollidx;
+		}
+		break;
+	}
+
+	/* do not let the caller dispatch to a freed object */
+	for (i = 0; i < nready; i++) {
+		if (ready[i].fd == fd)
+			ready[i].handler.type = HANDLER_NONE;
+	}
+
+	regs[fd] = NULL;
+	nregs--;
+	free(reg);
+
+	upsdebugx(5, "%s: FD %d unregistered, %" PRIuSIZE " left",
+		__func__, fd, nregs);
+
+	return 1;
+}
+
+size_t evloop_count(void)
+{
+	return nregs;
+}
+
+int evloop_wait(int timeout_ms)
+{
+	int	ret, i;
+
+	nready = 0;
+
+	switch (evloop_active) {
+#ifdef EVLOOP_HAVE_EPOLL
+	case EVLOOP_EPOLL:
+		ret = epoll_wait(epfd, epevents, EVLOOP_BATCH, timeout_ms);
+		if (ret <= 0)
+			return ret;
+
+		ready_reserve((size_t)ret);
+		for (i = 0; i < ret; i++) {
+			evloop_reg_t	*reg = epevents[i].data.ptr;
+			int	rev = 0;
+
+			if (epevents[i].events & EPOLLIN)
+				rev |= EVLOOP_READ;
+			if (epevents[i].events & EPOLLOUT)
+				rev |= EVLOOP_WRITE;
+			if (epevents[i].events & (EPOLLHUP | EPOLLERR))
+				rev |= EVLOOP_HUP;
+
+			ready[nready].fd = reg->fd;
+			ready[nready].revents = rev;
+			ready[nready].handler = reg->handler;
+			nready++;
+		}
+		return nready;
+#endif
+#ifdef EVLOOP_HAVE_KQUEUE
+	case EVLOOP_KQUEUE:
+		{
+			struct timespec	ts;
+
+			ts.tv_sec = timeout_ms / 1000;
+			ts.tv_nsec = (long)(timeout_ms % 1000) * 1000000L;
+
+			ret = kevent(kqfd, NULL, 0, kqevents, EVLOOP_BATCH, &ts);
+			if (ret <= 0)
+				return ret;
+
+			ready_reserve((size_t)ret);
+			for (i = 0; i < ret; i++) {
+				evloop_reg_t	*reg = kqevents[i].udata;
+				int	rev = 0;
+
+				if (kqevents[i].flags & EV_ERROR) {
+					rev |= EVLOOP_HUP;
+				} else if (kqevents[i].filter == EVFILT_READ) {
+					/* EOF with no data left is a hangup,
+					 * otherwise let the reader drain it */
+					if ((kqevents[i].flags & EV_EOF) && kqevents[i].data == 0)
+						rev |= EVLOOP_HUP;
+					else
+						rev |= EVLOOP_READ;
+				} else if (kqevents[i].filter == EVFILT_WRITE) {
+					rev |= (kqevents[i].flags & EV_EOF) ? EVLOOP_HUP : EVLOOP_WRITE;
+				}
+
+				ready[nready].fd = reg->fd;
+				ready[nready].revents = rev;
+				ready[nready].handler = reg->handler;
+				nready++;
+			}
+			return nready;
+		}
+#endif
+	case EVLOOP_POLL:
+	default:
+		break;
+	}
+
+	ret = poll(pfds, (nfds_t)npfds, timeout_ms);
+	if (ret <= 0)
+		return ret;
+
+	ready_reserve((size_t)ret);
+	for (i = 0; (size_t)i < npfds && nready < ret; i++) {
+		int	rev = 0;
+
+		if (!pfds[i].revents)
+			continue;
+
+		if (pfds[i].revents & POLLIN)
+			rev |= EVLOOP_READ;
+		if (pfds[i].revents & POLLOUT)
+			rev |= EVLOOP_WRITE;
+		if (pfds[i].revents & (POLLHUP | POLLERR | POLLNVAL))
+			rev |= EVLOOP_HUP;
+
+		ready[nready].fd = pfds[i].fd;
+		ready[nready].revents = rev;
+		ready[nready].handler = preg[i]->handler;
+		nready++;
+	}
+
+	return nready;
+}
+
+const evloop_event_t *evloop_ready(int idx)
+{
+	if (idx < 0 || idx >= nready)
+		return NULL;
+
+	return &ready[idx];
+}
+
+#else	/* WIN32 */
+
+/* WaitForMultipleObjects() can not wait for more than MAXIMUM_WAIT_OBJECTS
+ * (64) handles at once, so all activity is funneled into one I/O completion
+ * port instead:
+ * - sockets with read interest get a zero-byte overlapped WSARecv(), which
+ *   completes as soon as there is data (or an EOF or error) to read, and is
+ *   posted again by the next evloop_wait() after the handler had its go;
+ * - accepting connections and waiting for room to write can not be done so,
+ *   there WSAEventSelect() signals an event whose thread pool wait posts a
+ *   packet to the port;
+ * - named pipes (driver connections, the upsd command pipe) are associated
+ *   with the port by evloop_add_handle(), so the overlapped ReadFile() and
+ *   ConnectNamedPipe() requests their owners start are reported directly.
+ */
+
+/* registration record for one socket, its address is the completion key */
+typedef struct evloop_reg_s {
+	TYPE_FD_SOCK	fd;
+	int		events;
+	handler_t	handler;
+	OVERLAPPED	ov;		/* for the zero-byte WSARecv() */
+	int		recv_pending;	/* ov is in use by the system */
+	HANDLE		event;		/* WSAEventSelect() target, if needed */
+	HANDLE		wait;		/* thread pool wait for "event" */
+	volatile LONG	posted;		/* packets posted for us, not fetched yet */
+	int		dead;		/* evloop_del()'ed, waiting for the above */
+	struct evloop_reg_s	*next;	/* hash chain, or list of dead ones */
+} evloop_reg_t;
+
+/* registration record for one named pipe, see handle_key() */
+typedef struct {
+	HANDLE		handle;
+	handler_t	handler;
+	unsigned int	gen;
+} evloop_hreg_t;
+
+#define EVLOOP_BUCKETS	256
+#define EVLOOP_BUCKET(fd)	(((size_t)(fd) >> 2) % EVLOOP_BUCKETS)
+
+/* completion keys of named pipes have the lowest bit set, unlike socket
+ * registration addresses; the slot number comes with a generation count
+ * so that late packets for a closed pipe do not reach a new owner */
+#define EVLOOP_KEY_HANDLE	0x1
+#define EVLOOP_KEY_NODATA	0x2
+#define EVLOOP_GEN_MASK		0x3fff
+
+static evloop_backend_t	evloop_active = EVLOOP_IOCP;
+static HANDLE	port = NULL;
+
+static evloop_reg_t	*buckets[EVLOOP_BUCKETS];
+static evloop_reg_t	*zombies = NULL;
+static size_t	nregs = 0, maxregs = 0;
+
+static evloop_hreg_t	*hregs = NULL;
+static size_t	hregs_len = 0, nhregs = 0;
+
+/* sockets reported readable by the last evloop_wait() */
+static evloop_reg_t	*rearm[EVLOOP_BATCH];
+static size_t	nrearm = 0;
+
+static OVERLAPPED_ENTRY	entries[EVLOOP_BATCH];
+static evloop_event_t	ready[EVLOOP_BATCH];
+static int	nready = 0;
+
+/* the port may be needed (e.g. by the command pipe) before evloop_init() */
+static HANDLE port_get(void)
+{
+	if (!port) {
+		port = CreateIoCompletionPort(INVALID_HANDLE_VALUE, NULL, 0, 1);
+		if (!port) {
+			fatalx(EXIT_FAILURE, "Can't create an I/O completion port: error %lu",
+				(unsigned long)GetLastError());
+		}
+	}
+
+	return port;
+}
+
+static evloop_reg_t *reg_get(TYPE_FD_SOCK fd)
+{
+	evloop_reg_t	*reg;
+
+	for (reg = buckets[EVLOOP_BUCKET(fd)]; reg; reg = reg->next) {
+		if (reg->fd == fd)
+			return reg;
+	}
+
+	return NULL;
+}
+
+/* free a dead registration once the system and the port are done with it */
+static void reg_release(evloop_reg_t *reg)
+{
+	evloop_reg_t	**pp;
+
+	if (reg->recv_pending || reg->posted > 0)
+		return;
+
+	for (pp = &zombies; *pp; pp = &(*pp)->next) {
+		if (*pp == reg) {
+			*pp = reg->next;
+			break;
+		}
+	}
+
+	free(reg);
+}
+
+static VOID CALLBACK wait_callback(PVOID arg, BOOLEAN timed_out)
+{
+	evloop_reg_t	*reg = arg;
+
+	NUT_UNUSED_VARIABLE(timed_out);
+
+	InterlockedIncrement(&reg->posted);
+	if (!PostQueuedCompletionStatus(port, 0, (ULONG_PTR)reg, NULL))
+		InterlockedDecrement(&reg->posted);
+}
+
+/* (re)select the network events which need the WSAEventSelect() way */
+static int select_events(evloop_reg_t *reg)
+{
+	long	mask = 0;
+
+	if (reg->handler.type == SERVER && (reg->events & EVLOOP_READ))
+		mask |= FD_ACCEPT;
+	if (reg->events & EVLOOP_WRITE)
+		mask |= FD_WRITE | FD_CLOSE;
+
+	if (!mask) {
+		/* also drops what an accepted socket inherits from the listener */
+		WSAEventSelect(reg->fd, NULL, 0);
+		return 1;
+	}
+
+	if (!reg->event) {
+		reg->event = CreateEvent(NULL, FALSE, FALSE, NULL);	/* auto-reset */
+		if (!reg->event)
+			return 0;
+
+		if (!RegisterWaitForSingleObject(&reg->wait, reg->event,
+			wait_callback, reg, INFINITE, WT_EXECUTEINWAITTHREAD)
+		) {
+			CloseHandle(reg->event);
+			reg->event = NULL;
+			return 0;
+		}
+	}
+
+	return (WSAEventSelect(reg->fd, reg->event, mask) == 0);
+}
+
+/* have the port tell when there is something to read */
+static void recv_arm(evloop_reg_t *reg)
+{
+	WSABUF	buf;
+	DWORD	flags = 0;
+
+	if (reg->recv_pending || reg->dead || !(reg->events & EVLOOP_READ)
+	 || reg->handler.type == SERVER
+	) {
+		return;
+	}
+
+	memset(&reg->ov, 0, sizeof(reg->ov));
+	buf.buf = NULL;
+	buf.len = 0;
+
+	if (WSARecv(reg->fd, &buf, 1, NULL, &flags, &reg->ov, NULL) != 0
+	 && WSAGetLastError() != WSA_IO_PENDING
+	) {
+		/* report it as a hangup by the next evloop_wait() */
+		upsdebugx(2, "%s: WSARecv() on socket %" PRIuMAX " failed: %d",
+			__func__, (uintmax_t)reg->fd, WSAGetLastError());
+		InterlockedIncrement(&reg->posted);
+		if (!PostQueuedCompletionStatus(port, EVLOOP_HUP, (ULONG_PTR)reg, NULL))
+			InterlockedDecrement(&reg->posted);
+		return;
+	}
+
+	/* even an immediate success is queued to the port */
+	reg->recv_pending = 1;
+}
+
+evloop_backend_t evloop_init(evloop_backend_t backend, size_t maxfds)
+{
+	if (backend != EVLOOP_AUTO && backend != EVLOOP_IOCP) {
+		upslogx(LOG_WARNING, "%s: only iocp is supported on Windows, using it instead of %s",
+			__func__, evloop_backend_name(backend));
+	}
+
+	port_get();
+	evloop_active = EVLOOP_IOCP;
+	evloop_resize(maxfds);
+
+	upslogx(LOG_INFO, "Using %s event notification backend", evloop_backend_name(evloop_active));
+
+	return evloop_active;
+}
+
+void evloop_resize(size_t maxfds)
+{
+	maxregs = maxfds;
+
+	if (nregs + nhregs > maxregs) {
+		upslogx(LOG_WARNING, "%s: %" PRIuSIZE " descriptors are already "
+			"registered, more than the new limit of %" PRIuSIZE,
+			__func__, nregs + nhregs, maxregs);
+	}
+}
+
+void evloop_free(void)
+{
+	size_t	i;
+	evloop_reg_t	*reg, *next;
+
+	for (i = 0; i < EVLOOP_BUCKETS; i++) {
+		for (reg = buckets[i]; reg; reg = next) {
+			next = reg->next;
+			if (reg->event) {
+				UnregisterWaitEx(reg->wait, INVALID_HANDLE_VALUE);
+				CloseHandle(reg->event);
+			}
+			free(reg);
+		}
+		buckets[i] = NULL;
+	}
+
+	for (reg = zombies; reg; reg = next) {
+		next = reg->next;
+		free(reg);
+	}
+	zombies = NULL;
+	nregs = 0;
+
+	free(hregs);
+	hregs = NULL;
+	hregs_len = nhregs = 0;
+
+	nrearm = 0;
+	nready = 0;
+
+	if (port) {
+		CloseHandle(port);
+		port = NULL;
+	}
+}
+
+int evloop_add(TYPE_FD_SOCK fd, int events, handler_type_t type, void *data)
+{
+	evloop_reg_t	*reg;
+
+	if (INVALID_FD_SOCK(fd))
+		return 0;
+
+	if (reg_get(fd)) {
+		upsdebugx(1, "%s: socket %" PRIuMAX " is already registered",
+			__func__, (uintmax_t)fd);
+		return 0;
+	}
+
+	if (nregs + nhregs >= maxregs) {
+		upsdebugx(1, "%s: can not register socket %" PRIuMAX ": "
+			"reached the limit of %" PRIuSIZE " connections",
+			__func__, (uintmax_t)fd, maxregs);
+		return 0;
+	}
+
+	reg = xcalloc(1, sizeof(*reg));
+	reg->fd = fd;
+	reg->events = events;
+	reg->handler.type = type;
+	reg->handler.data = data;
+
+	/* listeners only ever see packets from wait_callback() */
+	if (type != SERVER
+	 && !CreateIoCompletionPort((HANDLE)fd, port_get(), (ULONG_PTR)reg, 0)
+	) {
+		upslogx(LOG_ERR, "%s: can not associate socket %" PRIuMAX
+			" with the completion port: error %lu",
+			__func__, (uintmax_t)fd, (unsigned long)GetLastError());
+		free(reg);
+		return 0;
+	}
+
+	if (!select_events(reg)) {
+		upslogx(LOG_ERR, "%s: WSAEventSelect() on socket %" PRIuMAX " failed: %d",
+			__func__, (uintmax_t)fd, WSAGetLastError());
+		if (reg->event) {
+			UnregisterWaitEx(reg->wait, INVALID_HANDLE_VALUE);
+			CloseHandle(reg->event);
+		}
+		free(reg);
+		return 0;
+	}
+
+	reg->next = buckets[EVLOOP_BUCKET(fd)];
+	buckets[EVLOOP_BUCKET(fd)] = reg;
+	nregs++;
+
+	recv_arm(reg);
+
+	upsdebugx(5, "%s: socket %" PRIuMAX " (handler type %d) registered, %" PRIuSIZE " in total",
+		__func__, (uintmax_t)fd, type, nregs + nhregs);
+
+	return 1;
+}
+
+int evloop_mod(TYPE_FD_SOCK fd, int events)
+{
+	evloop_reg_t	*reg = reg_get(fd);
+	int	oldev;
+
+	if (!reg)
+		return 0;
+
+	if (reg->events == events)
+		return 1;
+
+	oldev = reg->events;
+	reg->events = events;
+
+	if ((oldev ^ events) & EVLOOP_WRITE) {
+		if (!select_events(reg)) {
+			upslogx(LOG_ERR, "%s: WSAEventSelect() on socket %" PRIuMAX " failed: %d",
+				__func__, (uintmax_t)fd, WSAGetLastError());
+			reg->events = oldev;
+			return 0;
+		}
+	}
+
+	/* a zero-byte read still pending from before is just as good;
+	 * dropping read interest is handled when it completes */
+	recv_arm(reg);
+
+	return 1;
+}
+
+int evloop_del(TYPE_FD_SOCK fd)
+{
+	evloop_reg_t	*reg, **pp;
+	size_t	i;
+
+	for (pp = &buckets[EVLOOP_BUCKET(fd)]; *pp; pp = &(*pp)->next) {
+		if ((*pp)->fd == fd)
+			break;
+	}
+
+	if (!(reg = *pp))
+		return 0;
+
+	*pp = reg->next;
+	nregs--;
+
+	if (reg->event) {
+		/* waits for a running wait_callback() to finish */
+		UnregisterWaitEx(reg->wait, INVALID_HANDLE_VALUE);
+		WSAEventSelect(fd, NULL, 0);
+		CloseHandle(reg->event);
+		reg->event = NULL;
+	}
+
+	if (reg->recv_pending) {
+		/* the cancelled request is still reported to the port */
+		CancelIoEx((HANDLE)fd, &reg->ov);
+	}
+
+	/* do not let the caller dispatch to a freed object */
+	for (i = 0; i < nrearm; i++) {
+		if (rearm[i] == reg)
+			rearm[i] = NULL;
+	}
+
+	for (i = 0; i < (size_t)nready; i++) {
+		if (ready[i].fd == fd)
+			ready[i].handler.type = HANDLER_NONE;
+	}
+
+	reg->dead = 1;
+	reg->handler.type = HANDLER_NONE;
+	reg->next = zombies;
+	zombies = reg;
+	reg_release(reg);
+
+	upsdebugx(5, "%s: socket %" PRIuMAX " unregistered, %" PRIuSIZE " left",
+		__func__, (uintmax_t)fd, nregs + nhregs);
+
+	return 1;
+}
+
+int evloop_add_handle(HANDLE handle, handler_type_t type, void *data)
+{
+	ULONG_PTR	key;
+	size_t	slot = 0;
+
+	if (handle == INVALID_HANDLE_VALUE)
+		return 0;
+
+	if (!data) {
+		/* the owner tells its objects apart by the OVERLAPPED */
+		key = ((ULONG_PTR)type << 2) | EVLOOP_KEY_NODATA | EVLOOP_KEY_HANDLE;
+	} else {
+		if (nregs + nhregs >= maxregs) {
+			upsdebugx(1, "%s: can not register handle: "
+				"reached the limit of %" PRIuSIZE " connections",
+				__func__, maxregs);
+			return 0;
+		}
+
+		while (slot < hregs_len && hregs[slot].handle)
+			slot++;
+
+		if (slot >= hregs_len) {
+			size_t	newlen = hregs_len ? hregs_len * 2 : 16;
+
+			if (newlen > 0xffff) {
+				upsdebugx(1, "%s: too many handles registered", __func__);
+				return 0;
+			}
+
+			hregs = xrealloc(hregs, newlen * sizeof(*hregs));
+			memset(hregs + hregs_len, 0, (newlen - hregs_len) * sizeof(*hregs));
+			hregs_len = newlen;
+		}
+
+		key = ((((ULONG_PTR)hregs[slot].gen << 16) | slot) << 2) | EVLOOP_KEY_HANDLE;
+	}
+
+	if (!CreateIoCompletionPort(handle, port_get(), key, 0)) {
+		upslogx(LOG_ERR, "%s: can not associate a named pipe with "
+			"the completion port: error %lu",
+			__func__, (unsigned long)GetLastError());
+		return 0;
+	}
+
+	if (data) {
+		hregs[slot].handle = handle;
+		hregs[slot].handler.type = type;
+		hregs[slot].handler.data = data;
+		nhregs++;
+	}
+
+	upsdebugx(5, "%s: handle (type %d) registered, %" PRIuSIZE " in total",
+		__func__, type, nregs + nhregs);
+
+	return 1;
+}
+
+int evloop_del_handle(HANDLE handle)
+{
+	size_t	slot;
+	int	i;
+
+	for (slot = 0; slot < hregs_len; slot++) {
+		if (hregs[slot].handle == handle)
+			break;
+	}
+
+	if (slot >= hregs_len)
+		return 0;
+
+	/* packets for the old key, e.g. the cancelled pending read, get lost */
+	hregs[slot].handle = NULL;
+	hregs[slot].gen = (hregs[slot].gen + 1) & EVLOOP_GEN_MASK;
+	nhregs--;
+
+	for (i = 0; i < nready; i++) {
+		if (ready[i].handle == handle)
+			ready[i].handler.type = HANDLER_NONE;
+	}
+
+	return 1;
+}
+
+size_t evloop_count(void)
+{
+	return nregs + nhregs;
+}
+
+/* turn a packet from the port into a ready entry, returns 0 to skip it */
+static int packet_ready(const OVERLAPPED_ENTRY *entry, evloop_event_t *ev)
+{
+	ULONG_PTR	key = entry->lpCompletionKey;
+	evloop_reg_t	*reg;
+
+	ev->fd = ERROR_FD_SOCK;
+	ev->handle = INVALID_HANDLE_VALUE;
+	ev->overlapped = entry->lpOverlapped;
+	ev->revents = EVLOOP_READ;
+
+	if (key & EVLOOP_KEY_HANDLE) {
+		size_t	slot;
+
+		if (key & EVLOOP_KEY_NODATA) {
+			ev->handler.type = (handler_type_t)(key >> 2);
+			ev->handler.data = NULL;
+			return 1;
+		}
+
+		slot = (size_t)((key >> 2) & 0xffff);
+		if (slot >= hregs_len || !hregs[slot].handle
+		 || hregs[slot].gen != (unsigned int)(key >> 18)
+		) {
+			return 0;
+		}
+
+		ev->handle = hregs[slot].handle;
+		ev->handler = hregs[slot].handler;
+		return 1;
+	}
+
+	reg = (evloop_reg_t *)key;
+
+	if (entry->lpOverlapped) {
+		/* our zero-byte WSARecv() */
+		DWORD	bytes, flags;
+
+		reg->recv_pending = 0;
+		if (reg->dead) {
+			reg_release(reg);
+			return 0;
+		}
+
+		if (!WSAGetOverlappedResult(reg->fd, &reg->ov, &bytes, FALSE, &flags)) {
+			ev->revents = EVLOOP_HUP;
+		} else if (!(reg->events & EVLOOP_READ)) {
+			/* evloop_mod() posts it again when needed */
+			return 0;
+		} else if (nrearm < EVLOOP_BATCH) {
+			rearm[nrearm++] = reg;
+		}
+	} else {
+		/* from wait_callback() or recv_arm() */
+		WSANETWORKEVENTS	ne;
+
+		InterlockedDecrement(&reg->posted);
+		if (reg->dead) {
+			reg_release(reg);
+			return 0;
+		}
+
+		if (entry->dwNumberOfBytesTransferred & EVLOOP_HUP) {
+			ev->revents = EVLOOP_HUP;
+		} else {
+			if (WSAEnumNetworkEvents(reg->fd, NULL, &ne) != 0)
+				return 0;
+
+			ev->revents = 0;
+			if (ne.lNetworkEvents & FD_ACCEPT)
+				ev->revents |= EVLOOP_READ;
+			if (ne.lNetworkEvents & FD_WRITE)
+				ev->revents |= EVLOOP_WRITE;
+			if (ne.lNetworkEvents & FD_CLOSE)
+				ev->revents |= EVLOOP_HUP;
+
+			if (!ev->revents)
+				return 0;
+		}
+	}
+
+	ev->fd = reg->fd;
+	ev->handler = reg->handler;
+	return 1;
+}
+
+int evloop_wait(int timeout_ms)
+{
+	ULONG	n = 0, i;
+	size_t	j;
+
+	/* the handlers have read what the last batch reported */
+	for (j = 0; j < nrearm; j++) {
+		if (rearm[j])
+			recv_arm(rearm[j]);
+	}
+	nrearm = 0;
+	nready = 0;
+
+	if (!GetQueuedCompletionStatusEx(port_get(), entries, EVLOOP_BATCH,
+		&n, (timeout_ms < 0) ? INFINITE : (DWORD)timeout_ms, FALSE)
+	) {
+		if (GetLastError() == WAIT_TIMEOUT)
+			return 0;
+
+		errno = EINVAL;
+		return -1;
+	}
+
+	for (i = 0; i < n; i++) {
+		if (packet_ready(&entries[i], &ready[nready]))
+			nready++;
+	}
+
+	return nready;
+}
+
+const evloop_event_t *evloop_ready(int idx)
+{
+	if (idx < 0 || idx >= nready)
+		return NULL;
+
+	return &ready[idx];
+}
+
+#endif	/* WIN32 */
@@ -0,0 +1,118 @@
+/* evloop.h - pluggable event notification backends for upsd
+
+   Copyright (C)
+	2026	Network UPS Tools developers
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#ifndef NUT_EVLOOP_H_SEEN
+#define NUT_EVLOOP_H_SEEN 1
+
+#include "common.h"	/* TYPE_FD_SOCK */
+
+#ifdef __cplusplus
+/* *INDENT-OFF* */
+extern "C" {
+/* *INDENT-ON* */
+#endif
+
+/* What kind of object is behind a registered file descriptor */
+typedef enum {
+	HANDLER_NONE = 0,	/* entry was unregistered while in a ready batch */
+	DRIVER = 1,
+	CLIENT,
+	SERVER,
+	WORKER		/* handoff channel of WORKERS, see workers.c */
+#ifdef WIN32
+	,NAMED_PIPE
+#endif	/* WIN32 */
+} handler_type_t;
+
+typedef struct {
+	handler_type_t	type;
+	void		*data;
+} handler_t;
+
+/* Event interest and readiness bits */
+#define EVLOOP_READ	0x0001
+#define EVLOOP_WRITE	0x0002
+#define EVLOOP_HUP	0x0004	/* hangup, error or invalid descriptor */
+
+/* Known backends; EVLOOP_AUTO picks the best one built in */
+typedef enum {
+	EVLOOP_AUTO = 0,
+	EVLOOP_POLL,
+	EVLOOP_EPOLL,
+	EVLOOP_KQUEUE,
+	EVLOOP_IOCP	/* Windows I/O completion port */
+} evloop_backend_t;
+
+/* One ready descriptor as reported by evloop_wait() */
+typedef struct {
+	TYPE_FD_SOCK	fd;
+	int		revents;
+	handler_t	handler;
+#ifdef WIN32
+	HANDLE		handle;		/* named pipe, see evloop_add_handle() */
+	OVERLAPPED	*overlapped;	/* its request which completed */
+#endif	/* WIN32 */
+} evloop_event_t;
+
+/* Backend selected in upsd.conf (EVENT_BACKEND), applied by evloop_init() */
+extern evloop_backend_t	evloop_backend_wanted;
+
+/* Parse a backend name; returns 1 on success, 0 for unknown names */
+int evloop_backend_parse(const char *name, evloop_backend_t *result);
+const char *evloop_backend_name(evloop_backend_t backend);
+
+/* Set up the backend to track up to "maxfds" descriptors.
+ * Falls back to poll() if the requested backend is not available.
+ * Returns the backend actually used. */
+evloop_backend_t evloop_init(evloop_backend_t backend, size_t maxfds);
+void evloop_resize(size_t maxfds);
+void evloop_free(void);
+
+/* Registration is done once, when descriptors are created or closed.
+ * These return 1 on success, 0 on failure (e.g. no room left). */
+int evloop_add(TYPE_FD_SOCK fd, int events, handler_type_t type, void *data);
+int evloop_mod(TYPE_FD_SOCK fd, int events);
+int evloop_del(TYPE_FD_SOCK fd);
+size_t evloop_count(void);
+
+#ifdef WIN32
+/* Associate a named pipe opened for overlapped I/O with the completion
+ * port; each completion of a ReadFile() or ConnectNamedPipe() started on
+ * it is then reported as EVLOOP_READ. Pipes registered with "data" count
+ * as connections and must be evloop_del_handle()'d before CloseHandle();
+ * those without (the upsd command pipe) are told apart by "overlapped" */
+int evloop_add_handle(HANDLE handle, handler_type_t type, void *data);
+int evloop_del_handle(HANDLE handle);
+#endif	/* WIN32 */
+
+/* Wait up to "timeout_ms" and return the number of ready entries,
+ * 0 on timeout, -1 on error (errno is set). Entries can be fetched
+ * with evloop_ready() until the next evloop_wait() call; an entry
+ * whose descriptor was evloop_del()'ed meanwhile has HANDLER_NONE type */
+int evloop_wait(int timeout_ms);
+const evloop_event_t *evloop_ready(int idx);
+
+#ifdef __cplusplus
+/* *INDENT-OFF* */
+}
+/* *INDENT-ON* */
+#endif
+
+#endif	/* NUT_EVLOOP_H_SEEN */
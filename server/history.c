@@ -0,0 +1,220 @@
+/* history.c - recent values of numeric variables kept by upsd, served by
+               LIST HISTORY
+
+   Copyright (C)
+	2026	Network UPS Tools developers
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+/* Only the variables named by HISTORY in upsd.conf are kept, each value
+ * as a float with the second it was set at, in a ring of the configured
+ * depth which is allocated at the first value. Values are recorded when
+ * they change (as seen by state_setinfo()), so a steady reading costs
+ * nothing until it moves. With WORKERS, each process keeps its own.
+ */
+
+#include "config.h" /* must be the first header */
+
+#include "common.h"
+#include "upstype.h"
+#include "history.h"
+
+#include <math.h>
+
+typedef struct {
+	char	*var;
+	size_t	depth;
+} history_conf_t;
+
+static history_conf_t	*conf = NULL;
+static size_t	nconf = 0;
+
+int history_conf_add(const char *depth, const char *var)
+{
+	char	*end;
+	long	d;
+	size_t	i;
+
+	d = strtol(depth, &end, 10);
+	if (*depth == '\0' || *end != '\0' || d < 1) {
+		return 0;
+	}
+	if (d > HISTORY_DEPTH_MAX) {
+		upslogx(LOG_WARNING, "HISTORY depth %ld is too large, using %d",
+			d, HISTORY_DEPTH_MAX);
+		d = HISTORY_DEPTH_MAX;
+	}
+
+	/* the last setting of a variable wins */
+	for (i = 0; i < nconf; i++) {
+		if (!strcmp(conf[i].var, var)) {
+			conf[i].depth = (size_t)d;
+			return 1;
+		}
+	}
+
+	conf = xrealloc(conf, (nconf + 1) * sizeof(*conf));
+	conf[nconf].var = xstrdup(var);
+	conf[nconf].depth = (size_t)d;
+	nconf++;
+
+	return 1;
+}
+
+void history_conf_free(void)
+{
+	size_t	i;
+
+	for (i = 0; i < nconf; i++) {
+		free(conf[i].var);
+	}
+
+	free(conf);
+	conf = NULL;
+	nconf = 0;
+}
+
+size_t history_depth(const char *var)
+{
+	size_t	i;
+
+	for (i = 0; i < nconf; i++) {
+		if (!strcmp(conf[i].var, var)) {
+			return conf[i].depth;
+		}
+	}
+
+	return 0;
+}
+
+const history_sample_t *history_sample(const history_ring_t *ring, size_t i)
+{
+	return &ring->samples[(ring->first + i) % ring->depth];
+}
+
+/* keep the newest values of ring in a ring of the new depth */
+static void history_resize(history_ring_t *ring, size_t depth)
+{
+	history_sample_t	*samples = xcalloc(depth, sizeof(*samples));
+	size_t	count = (ring->count < depth) ? ring->count : depth, i;
+
+	for (i = 0; i < count; i++) {
+		samples[i] = *history_sample(ring, ring->count - count + i);
+	}
+
+	free(ring->samples);
+	ring->samples = samples;
+	ring->depth = depth;
+	ring->first = 0;
+	ring->count = count;
+}
+
+static void history_ring_free(history_ring_t *ring)
+{
+	free(ring->var);
+	free(ring->samples);
+	free(ring);
+}
+
+static history_ring_t **history_findp(upstype_t *ups, const char *var)
+{
+	history_ring_t	**ringp;
+
+	for (ringp = &ups->history; *ringp; ringp = &(*ringp)->next) {
+		if (!strcmp((*ringp)->var, var)) {
+			break;
+		}
+	}
+
+	return ringp;
+}
+
+void history_record(upstype_t *ups, const char *var, const char *val)
+{
+	history_ring_t	**ringp, *ring;
+	history_sample_t	*sample;
+	size_t	depth;
+	double	value;
+	char	*end;
+
+	if (!nconf) {
+		return;
+	}
+
+	depth = history_depth(var);
+	ringp = history_findp(ups, var);
+	ring = *ringp;
+
+	/* no longer kept since a reload */
+	if (!depth) {
+		if (ring) {
+			*ringp = ring->next;
+			history_ring_free(ring);
+		}
+		return;
+	}
+
+	value = strtod(val, &end);
+	if (end == val || *end != '\0' || !isfinite(value)) {
+		upsdebugx(3, "%s: [%s] %s is not numeric: %s", __func__, ups->name, var, val);
+		return;
+	}
+
+	if (!ring) {
+		ring = xcalloc(1, sizeof(*ring));
+		ring->var = xstrdup(var);
+		*ringp = ring;
+	}
+	if (ring->depth != depth) {
+		history_resize(ring, depth);
+	}
+
+	if (ring->count < ring->depth) {
+		sample = &ring->samples[(ring->first + ring->count) % ring->depth];
+		ring->count++;
+	} else {
+		sample = &ring->samples[ring->first];
+		ring->first = (ring->first + 1) % ring->depth;
+	}
+
+	sample->when = (uint32_t)time(NULL);
+	sample->value = (float)value;
+}
+
+const history_ring_t *history_find(const upstype_t *ups, const char *var)
+{
+	const history_ring_t	*ring;
+
+	for (ring = ups->history; ring; ring = ring->next) {
+		if (!strcmp(ring->var, var)) {
+			break;
+		}
+	}
+
+	return ring;
+}
+
+void history_ups_free(upstype_t *ups)
+{
+	history_ring_t	*ring, *next;
+
+	for (ring = ups->history; ring; ring = next) {
+		next = ring->next;
+		history_ring_free(ring);
+	}
+
+	ups->history = NULL;
+}
@@ -0,0 +1,76 @@
+/* history.h - recent values of numeric variables kept by upsd, served by
+               LIST HISTORY
+
+   Copyright (C)
+	2026	Network UPS Tools developers
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#ifndef NUT_HISTORY_H_SEEN
+#define NUT_HISTORY_H_SEEN 1
+
+#include "nut_stdint.h"
+
+#ifdef __cplusplus
+/* *INDENT-OFF* */
+extern "C" {
+/* *INDENT-ON* */
+#endif
+
+/* most values kept for one variable of one device */
+#define HISTORY_DEPTH_MAX	1048576
+
+/* one value as it was set, 8 bytes */
+typedef struct {
+	uint32_t	when;	/* seconds since the epoch */
+	float		value;
+} history_sample_t;
+
+/* the last "depth" values of a variable (ring, the oldest at "first") */
+typedef struct history_ring_s {
+	char		*var;
+	history_sample_t	*samples;
+	size_t		depth;
+	size_t		first;
+	size_t		count;
+	struct history_ring_s	*next;
+} history_ring_t;
+
+struct upstype_s;
+
+/* upsd.conf HISTORY <depth> <varname>...; returns 0 if depth is not usable */
+int history_conf_add(const char *depth, const char *var);
+/* forget those settings (before a reload reads them again) */
+void history_conf_free(void);
+/* how many values of var are kept, 0 if none */
+size_t history_depth(const char *var);
+
+/* the driver of ups set var to val */
+void history_record(struct upstype_s *ups, const char *var, const char *val);
+/* the values kept for var of ups, NULL if none yet */
+const history_ring_t *history_find(const struct upstype_s *ups, const char *var);
+/* the i-th of them, oldest first */
+const history_sample_t *history_sample(const history_ring_t *ring, size_t i);
+
+void history_ups_free(struct upstype_s *ups);
+
+#ifdef __cplusplus
+/* *INDENT-OFF* */
+}
+/* *INDENT-ON* */
+#endif
+
+#endif	/* NUT_HISTORY_H_SEEN */
@@ -0,0 +1,519 @@
+/* metrics.c - Prometheus/OpenMetrics scrape endpoint of upsd (METRICS)
+
+   Copyright (C)
+	2026	Network UPS Tools developers
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+/* Connections to a METRICS listener speak just enough HTTP/1.1 for
+ * "GET /metrics" (and HEAD), with keep-alive and pipelining. Every
+ * numeric variable of each available device becomes a gauge sample
+ * "nut_<variable>{ups="<name>"}", each ups.status flag a sample of
+ * "nut_ups_status{ups="<name>",flag="<FLAG>"}". The response body is
+ * kept between scrapes and only re-made (with one walk over each
+ * device tree) after metrics_changed() was called.
+ */
+
+#include "config.h" /* must be the first header */
+
+#include <ctype.h>
+
+#include "common.h"
+#include "upsd.h"
+#include "upstype.h"
+#include "nut_ctype.h"
+#include "metrics.h"
+
+/* one numeric variable, pointers into the device trees are only
+ * valid while the body is made */
+typedef struct {
+	const char	*var;
+	const char	*val;
+	const upstype_t	*ups;
+	size_t	upsnum;		/* position of ups in the list */
+} metrics_sample_t;
+
+static metrics_sample_t	*samples = NULL;
+static size_t	numsamples = 0, samplesize = 0;
+
+/* cached response body, without the OpenMetrics "# EOF" line */
+static char	*body = NULL;
+static size_t	bodylen = 0, bodysize = 0;
+static int	body_valid = 0;
+
+void metrics_changed(void)
+{
+	body_valid = 0;
+}
+
+void metrics_free(void)
+{
+	free(samples);
+	samples = NULL;
+	numsamples = samplesize = 0;
+
+	free(body);
+	body = NULL;
+	bodylen = bodysize = 0;
+	body_valid = 0;
+}
+
+static void body_add(const char *fmt, ...)
+	__attribute__ ((__format__ (__printf__, 1, 2)));
+
+static void body_add(const char *fmt, ...)
+{
+	char	line[LARGEBUF];
+	size_t	len;
+	va_list	ap;
+
+	va_start(ap, fmt);
+	vsnprintf(line, sizeof(line), fmt, ap);
+	va_end(ap);
+
+	len = strlen(line);
+	if (bodylen + len > bodysize) {
+		bodysize = (bodylen + len) * 2;
+		body = xrealloc(body, bodysize);
+	}
+	memcpy(body + bodylen, line, len);
+	bodylen += len;
+}
+
+/* a metric name character for a variable name character */
+static int name_char(int c)
+{
+	if (isalnum((unsigned char)c) || c == '_' || c == ':') {
+		return c;
+	}
+
+	return '_';
+}
+
+static void name_format(const char *var, char *buf, size_t bufsize)
+{
+	size_t	i;
+
+	for (i = 0; var[i] && i + 1 < bufsize; i++) {
+		buf[i] = (char)name_char(var[i]);
+	}
+	buf[i] = '\0';
+}
+
+/* the label value syntax escapes backslashes, quotes and newlines */
+static void label_format(const char *val, char *buf, size_t bufsize)
+{
+	size_t	len = 0;
+
+	for (; *val && len + 3 < bufsize; val++) {
+		if (*val == '\\' || *val == '"') {
+			buf[len++] = '\\';
+			buf[len++] = *val;
+		} else if (*val == '\n') {
+			buf[len++] = '\\';
+			buf[len++] = 'n';
+		} else {
+			buf[len++] = *val;
+		}
+	}
+	buf[len] = '\0';
+}
+
+/* only plain decimal numbers: no hex, no leading blanks, and no
+ * dates or versions which strtod() would accept a prefix of */
+static int is_number(const char *val)
+{
+	char	*end;
+
+	if (!val || (!isdigit((unsigned char)*val)
+		&& *val != '-' && *val != '+' && *val != '.')
+	) {
+		return 0;
+	}
+
+	if (strchr(val, 'x') || strchr(val, 'X')) {
+		return 0;
+	}
+
+	strtod(val, &end);
+	return end != val && *end == '\0';
+}
+
+static void sample_add(const st_tree_t *node, const upstype_t *ups, size_t upsnum)
+{
+	if (numsamples >= samplesize) {
+		samplesize = samplesize ? samplesize * 2 : 256;
+		samples = xrealloc(samples, samplesize * sizeof(*samples));
+	}
+
+	samples[numsamples].var = node->var;
+	samples[numsamples].val = node->val;
+	samples[numsamples].ups = ups;
+	samples[numsamples].upsnum = upsnum;
+	numsamples++;
+}
+
+static void tree_collect(const st_tree_t *node, const upstype_t *ups, size_t upsnum)
+{
+	if (!node) {
+		return;
+	}
+
+	tree_collect(node->left, ups, upsnum);
+
+	if (is_number(node->val)) {
+		sample_add(node, ups, upsnum);
+	}
+
+	tree_collect(node->right, ups, upsnum);
+}
+
+/* compare the metric names, as samples of a family must be together */
+static int name_cmp(const char *a, const char *b)
+{
+	for (; *a && *b; a++, b++) {
+		int	ca = name_char(*a), cb = name_char(*b);
+
+		if (ca != cb) {
+			return ca - cb;
+		}
+	}
+
+	return name_char(*a) - name_char(*b);
+}
+
+static int sample_cmp(const void *p1, const void *p2)
+{
+	const metrics_sample_t	*s1 = (const metrics_sample_t *)p1;
+	const metrics_sample_t	*s2 = (const metrics_sample_t *)p2;
+	int	ret = name_cmp(s1->var, s2->var);
+
+	if (ret) {
+		return ret;
+	}
+
+	if (s1->upsnum != s2->upsnum) {
+		return s1->upsnum < s2->upsnum ? -1 : 1;
+	}
+
+	return strcmp(s1->var, s2->var);
+}
+
+static int ups_served(const upstype_t *ups)
+{
+	return VALID_FD(ups->sock_fd) && !ups->stale && ups->inforoot;
+}
+
+static void body_make(void)
+{
+	const upstype_t	*ups;
+	char	name[SMALLBUF], label[SMALLBUF];
+	size_t	i, upsnum;
+	int	status_seen = 0;
+
+	bodylen = 0;
+	numsamples = 0;
+
+	for (ups = firstups, upsnum = 0; ups; ups = ups->next, upsnum++) {
+		if (ups_served(ups)) {
+			tree_collect(ups->inforoot, ups, upsnum);
+		}
+	}
+
+	qsort(samples, numsamples, sizeof(*samples), sample_cmp);
+
+	for (i = 0; i < numsamples; i++) {
+		const metrics_sample_t	*s = &samples[i];
+		int	newfamily = !i || name_cmp(samples[i - 1].var, s->var);
+
+		/* variables whose names differ only in characters which are
+		 * not allowed in metric names would be duplicate series */
+		if (!newfamily && samples[i - 1].ups == s->ups) {
+			continue;
+		}
+
+		name_format(s->var, name, sizeof(name));
+		if (newfamily) {
+			body_add("# TYPE nut_%s gauge\n", name);
+		}
+
+		label_format(s->ups->name, label, sizeof(label));
+		body_add("nut_%s{ups=\"%s\"} %s\n", name, label, s->val);
+	}
+
+	/* flags of the effective status, as LIST VAR would tell them */
+	for (ups = firstups; ups; ups = ups->next) {
+		const char	*status, *flag;
+		char	word[SMALLBUF];
+
+		if (!ups_served(ups)
+		 || !(status = state_getinfo(ups->inforoot, "ups.status"))
+		) {
+			continue;
+		}
+
+		if (!status_seen) {
+			body_add("# TYPE nut_ups_status gauge\n");
+			status_seen = 1;
+		}
+
+		label_format(ups->name, label, sizeof(label));
+
+		if (ups->fsd) {
+			body_add("nut_ups_status{ups=\"%s\",flag=\"FSD\"} 1\n", label);
+		}
+
+		for (flag = status; *flag; ) {
+			size_t	len = strcspn(flag, " ");
+
+			if (len > 0 && len < sizeof(word)) {
+				memcpy(word, flag, len);
+				word[len] = '\0';
+				label_format(word, name, sizeof(name));
+				body_add("nut_ups_status{ups=\"%s\",flag=\"%s\"} 1\n",
+					label, name);
+			}
+
+			flag += len;
+			flag += strspn(flag, " ");
+		}
+	}
+
+	body_valid = 1;
+
+	upsdebugx(3, "%s: made a %" PRIuSIZE " byte response of %" PRIuSIZE " samples",
+		__func__, bodylen, numsamples);
+}
+
+/* add to <buf> the samples of each tag (and of the heap) which has <field>:
+ * 0 for the bytes held, 1 for their peak, 2 for the allocations made */
+static void mem_family(char *buf, size_t bufsize, const char *name, int field)
+{
+	const nut_mem_tag_t	*tag;
+	size_t	heap, peak;
+
+	snprintfcat(buf, bufsize, "# TYPE nut_upsd_memory_%s gauge\n", name);
+
+	for (tag = nut_mem_tags(); tag; tag = tag->next) {
+		if (field == 2) {
+			snprintfcat(buf, bufsize, "nut_upsd_memory_%s{tag=\"%s\"} %" PRIu64 "\n",
+				name, tag->name, tag->allocs);
+		} else if (!tag->nofree) {
+			snprintfcat(buf, bufsize, "nut_upsd_memory_%s{tag=\"%s\"} %" PRIuSIZE "\n",
+				name, tag->name, field ? tag->peak : tag->live);
+		}
+	}
+
+	if (field != 2 && (heap = nut_mem_heap(&peak)) > 0) {
+		snprintfcat(buf, bufsize, "nut_upsd_memory_%s{tag=\"heap\"} %" PRIuSIZE "\n",
+			name, field ? peak : heap);
+	}
+}
+
+/* the memory upsd holds (MEMSTATS), made for each scrape since it changes
+ * all the time: returns its length in <buf> */
+static size_t mem_make(char *buf, size_t bufsize)
+{
+	buf[0] = '\0';
+
+	if (!mem_stats) {
+		return 0;
+	}
+
+	mem_family(buf, bufsize, "bytes", 0);
+	mem_family(buf, bufsize, "peak_bytes", 1);
+	mem_family(buf, bufsize, "allocations", 2);
+
+	return strlen(buf);
+}
+
+/* a response without a body of its own, e.g. for errors */
+static void send_status(nut_ctype_t *client, const char *status)
+{
+	sendback(client, "HTTP/1.1 %s\r\n"
+		"Content-Type: text/plain; charset=utf-8\r\n"
+		"Content-Length: %" PRIuSIZE "\r\n"
+		"%s\r\n%s\n",
+		status, strlen(status) + 1,
+		client->hangup ? "Connection: close\r\n" : "",
+		status);
+}
+
+/* the value of header <name> in a request head, up to the end of line */
+static const char *header_find(const char *head, const char *name, size_t *len)
+{
+	size_t	namelen = strlen(name);
+	const char	*line;
+
+	for (line = strchr(head, '\n'); line; line = strchr(line, '\n')) {
+		line++;
+
+		if (!strncasecmp(line, name, namelen) && line[namelen] == ':') {
+			const char	*val = line + namelen + 1;
+
+			val += strspn(val, " \t");
+			*len = strcspn(val, "\r\n");
+			return val;
+		}
+	}
+
+	return NULL;
+}
+
+/* case-insensitive search for <word> in the first <len> bytes of <val> */
+static int header_has(const char *val, size_t len, const char *word)
+{
+	size_t	wordlen = strlen(word), i;
+
+	for (i = 0; val && i + wordlen <= len; i++) {
+		if (!strncasecmp(val + i, word, wordlen)) {
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/* answer one request, <head> is its NUL-terminated request line and headers */
+static void metrics_request(nut_ctype_t *client, const char *head)
+{
+	char	method[16], target[SMALLBUF], version[16], mem[LARGEBUF];
+	const char	*val;
+	size_t	len = 0, memlen;
+	int	openmetrics, head_only;
+
+	if (sscanf(head, "%15s %255s %15s", method, target, version) != 3
+	 || strncmp(version, "HTTP/1.", 7)
+	) {
+		client->hangup = 1;
+		send_status(client, "400 Bad Request");
+		return;
+	}
+
+	/* HTTP/1.0 closes unless asked otherwise, HTTP/1.1 the other way */
+	val = header_find(head, "Connection", &len);
+	if (!strcmp(version, "HTTP/1.0")) {
+		client->hangup = !header_has(val, len, "keep-alive");
+	} else if (header_has(val, len, "close")) {
+		client->hangup = 1;
+	}
+
+	head_only = !strcmp(method, "HEAD");
+	if (!head_only && strcmp(method, "GET")) {
+		send_status(client, "405 Method Not Allowed");
+		return;
+	}
+
+	if (strcmp(target, "/metrics") && strncmp(target, "/metrics?", 9)) {
+		send_status(client, "404 Not Found");
+		return;
+	}
+
+	if (!body_valid) {
+		body_make();
+	}
+	memlen = mem_make(mem, sizeof(mem));
+
+	/* Prometheus asks for OpenMetrics first; the older text format
+	 * only lacks the "# EOF" line */
+	val = header_find(head, "Accept", &len);
+	openmetrics = header_has(val, len, "application/openmetrics-text");
+
+	if (!sendback(client, "HTTP/1.1 200 OK\r\n"
+		"Content-Type: %s\r\n"
+		"Content-Length: %" PRIuSIZE "\r\n"
+		"%s\r\n",
+		openmetrics
+			? "application/openmetrics-text; version=1.0.0; charset=utf-8"
+			: "text/plain; version=0.0.4; charset=utf-8",
+		bodylen + memlen + (openmetrics ? 6 : 0),
+		client->hangup ? "Connection: close\r\n" : "")
+	 || head_only
+	) {
+		return;
+	}
+
+	if (sendback_raw(client, body, bodylen)
+	 && (!memlen || sendback_raw(client, mem, memlen))
+	 && openmetrics
+	) {
+		sendback_raw(client, "# EOF\n", 6);
+	}
+}
+
+/* length of the request head at the start of <buf>, including the
+ * empty line which ends it, or 0 if it is not complete yet */
+static size_t head_length(const char *buf, size_t len)
+{
+	size_t	i;
+
+	for (i = 0; i + 1 < len; i++) {
+		if (buf[i] != '\n') {
+			continue;
+		}
+
+		if (buf[i + 1] == '\n') {
+			return i + 2;
+		}
+
+		if (buf[i + 1] == '\r' && i + 2 < len && buf[i + 2] == '\n') {
+			return i + 3;
+		}
+	}
+
+	return 0;
+}
+
+void metrics_input(nut_ctype_t *client, const char *buf, size_t len)
+{
+	metrics_req_t	*req = client->metrics;
+
+	while (len > 0 && !client->hangup) {
+		size_t	take = sizeof(req->buf) - 1 - req->len, headlen;
+
+		if (take > len) {
+			take = len;
+		}
+
+		memcpy(req->buf + req->len, buf, take);
+		req->len += take;
+		buf += take;
+		len -= take;
+
+		/* pipelined requests are answered in order */
+		while (!client->hangup
+		 && (headlen = head_length(req->buf, req->len)) > 0
+		) {
+			char	save = req->buf[headlen];
+
+			time(&client->last_heard);
+
+			req->buf[headlen] = '\0';
+			upsdebugx(2, "%s: [%s] %.*s", __func__, client->addr,
+				(int)strcspn(req->buf, "\r\n"), req->buf);
+			metrics_request(client, req->buf);
+			req->buf[headlen] = save;
+
+			memmove(req->buf, req->buf + headlen, req->len - headlen);
+			req->len -= headlen;
+		}
+
+		if (req->len >= sizeof(req->buf) - 1) {
+			client->hangup = 1;
+			send_status(client, "431 Request Header Fields Too Large");
+		}
+	}
+}
@@ -0,0 +1,63 @@
+/* metrics.h - Prometheus/OpenMetrics scrape endpoint of upsd (METRICS)
+
+   Copyright (C)
+	2026	Network UPS Tools developers
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#ifndef NUT_METRICS_H_SEEN
+#define NUT_METRICS_H_SEEN 1
+
+#include <stddef.h>
+
+/* default port of a "METRICS <address>" listener */
+#define METRICS_PORT	"9199"
+
+/* longest HTTP request head (request line and headers) accepted */
+#define METRICS_REQUEST_MAX	4096
+
+#ifdef __cplusplus
+/* *INDENT-OFF* */
+extern "C" {
+/* *INDENT-ON* */
+#endif
+
+struct nut_ctype_s;
+
+/* HTTP request state of a connection to a METRICS listener */
+typedef struct metrics_req_s {
+	char	buf[METRICS_REQUEST_MAX];
+	size_t	len;
+} metrics_req_t;
+
+/* device data served by the scrapes has changed, re-make the cached
+ * response body on the next one */
+void metrics_changed(void);
+
+/* handle <len> bytes received from a METRICS connection: answers are
+ * queued with sendback_raw(), and client->hangup is set if the
+ * connection is to be closed once they are sent */
+void metrics_input(struct nut_ctype_s *client, const char *buf, size_t len);
+
+void metrics_free(void);
+
+#ifdef __cplusplus
+/* *INDENT-OFF* */
+}
+/* *INDENT-ON* */
+#endif
+
+#endif	/* NUT_METRICS_H_SEEN */
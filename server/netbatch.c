@@ -0,0 +1,225 @@
+/* netbatch.c - BATCH handler for upsd
+
+   Copyright (C)
+	2026	Network UPS Tools developers
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+/* Between BATCH BEGIN and BATCH END, the SET and INSTCMD of a client are
+ * checked and answered as usual, but held back: BATCH END sends those for
+ * each UPS to its driver in one write, bracketed the same way, so that
+ * the driver can hand them to the device together (e.g. in one SNMP SET
+ * of many variables), and answers OK once they are all sent.
+ */
+
+#include "common.h"
+
+#include "upsd.h"
+#include "sstate.h"
+#include "neterr.h"
+
+#include "netbatch.h"
+
+/* the commands and settings held were sent (<failed> = 0) or not:
+ * forget their tracking ids, once set as failed in the latter case */
+static void batch_tracking_done(nut_batch_t *batch, int failed)
+{
+	char	status[SMALLBUF];
+	size_t	i;
+
+	snprintf(status, sizeof(status), "%d", STAT_FAILED);
+
+	for (i = 0; i < batch->tracking_count; i++) {
+		if (failed) {
+			tracking_set(batch->tracking[i], status);
+		}
+		free(batch->tracking[i]);
+	}
+
+	batch->tracking_count = 0;
+}
+
+static void batch_free(nut_batch_t *batch)
+{
+	batch_tracking_done(batch, 1);
+	free(batch->tracking);
+	free(batch->upsname);
+	free(batch->buf);
+	free(batch);
+}
+
+/* send the lines held back for a UPS to its driver: returns 0 if they
+ * could not be sent */
+static int batch_send(nut_batch_t *batch)
+{
+	upstype_t	*ups;
+	int	ret;
+
+	if (!batch->count) {
+		return 1;
+	}
+
+	ups = get_ups_ptr(batch->upsname);
+	if (!ups) {
+		upslogx(LOG_INFO, "Batch for UPS [%s] not sent: it is gone", batch->upsname);
+		ret = 0;
+	} else {
+		/* the buffer starts with room for BATCH BEGIN, see batch_add() */
+		snprintfcat(batch->buf, batch->size, "BATCH END\n");
+		ret = sstate_sendline(ups, batch->buf);
+
+		upsdebugx(2, "%s: UPS [%s]: %" PRIuSIZE " commands and settings %s",
+			__func__, ups->name, batch->count, ret ? "sent" : "not sent");
+	}
+
+	batch_tracking_done(batch, !ret);
+
+	batch->len = 0;
+	batch->count = 0;
+	batch->instcmd = 0;
+
+	return ret;
+}
+
+static int batch_add(nut_batch_t *batch, const char *line, const char *tracking_id)
+{
+	const char	*begin = "BATCH BEGIN\n", *end = "BATCH END\n";
+	size_t	linelen = strlen(line);
+	int	ret = 1;
+
+	if (batch->count >= NET_BATCH_MAX) {
+		ret = batch_send(batch);
+	}
+
+	if (!batch->len) {
+		batch->len = strlen(begin);
+		if (batch->size < batch->len + 1) {
+			batch->size = LARGEBUF;
+			batch->buf = xrealloc(batch->buf, batch->size);
+		}
+		snprintf(batch->buf, batch->size, "%s", begin);
+	}
+
+	if (batch->len + linelen + strlen(end) + 1 > batch->size) {
+		while (batch->len + linelen + strlen(end) + 1 > batch->size) {
+			batch->size *= 2;
+		}
+		batch->buf = xrealloc(batch->buf, batch->size);
+	}
+
+	if (!strncmp(line, "INSTCMD ", 8)) {
+		batch->instcmd = 1;
+	}
+
+	memcpy(batch->buf + batch->len, line, linelen + 1);
+	batch->len += linelen;
+	batch->count++;
+
+	if (tracking_id && *tracking_id) {
+		/* no more than the lines of a batch */
+		if (!batch->tracking) {
+			batch->tracking = xcalloc(NET_BATCH_MAX, sizeof(*batch->tracking));
+		}
+		batch->tracking[batch->tracking_count++] = xstrdup(tracking_id);
+	}
+
+	return ret;
+}
+
+int netbatch_sendline(nut_ctype_t *client, upstype_t *ups, const char *line,
+	const char *tracking_id)
+{
+	nut_batch_t	**batch;
+
+	if (!client->batching) {
+		return sstate_sendline(ups, line);
+	}
+
+	for (batch = &client->batches; *batch; batch = &(*batch)->next) {
+		if (!strcmp((*batch)->upsname, ups->name)) {
+			break;
+		}
+	}
+
+	if (!*batch) {
+		*batch = xcalloc(1, sizeof(**batch));
+		(*batch)->upsname = xstrdup(ups->name);
+	}
+
+	return batch_add(*batch, line, tracking_id);
+}
+
+void netbatch_client_free(nut_ctype_t *client)
+{
+	nut_batch_t	*batch, *next;
+
+	for (batch = client->batches; batch; batch = next) {
+		next = batch->next;
+
+		/* the client was told they were accepted */
+		if (batch->count) {
+			upslogx(LOG_WARNING, "Batch of %s@%s for UPS [%s] discarded: "
+				"%" PRIuSIZE " commands and settings not sent%s",
+				client_username(client), client->addr, batch->upsname,
+				batch->count, batch->tracking_count ? ", tracked ones set as failed" : "");
+		}
+
+		batch_free(batch);
+	}
+
+	client->batches = NULL;
+	client->batching = 0;
+}
+
+/* BATCH BEGIN | END */
+void net_batch(nut_ctype_t *client, size_t numarg, const char **arg)
+{
+	nut_batch_t	*batch;
+	const char	*failed = NULL;
+
+	if (numarg != 1) {
+		send_err(client, NUT_ERR_INVALID_ARGUMENT);
+		return;
+	}
+
+	if (!strcasecmp(arg[0], "BEGIN")) {
+		client->batching = 1;
+		sendback(client, "OK\n");
+		return;
+	}
+
+	if (strcasecmp(arg[0], "END")) {
+		send_err(client, NUT_ERR_INVALID_ARGUMENT);
+		return;
+	}
+
+	for (batch = client->batches; batch; batch = batch->next) {
+		int	instcmd = batch->instcmd;
+
+		if (!batch_send(batch) && !failed) {
+			failed = instcmd ? NUT_ERR_INSTCMD_FAILED : NUT_ERR_SET_FAILED;
+		}
+	}
+
+	netbatch_client_free(client);
+
+	if (failed) {
+		send_err(client, failed);
+		return;
+	}
+
+	sendback(client, "OK\n");
+}
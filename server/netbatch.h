@@ -0,0 +1,68 @@
+/* netbatch.h - BATCH handler for upsd
+
+   Copyright (C)
+	2026	Network UPS Tools developers
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#ifndef NUT_NETBATCH_H_SEEN
+#define NUT_NETBATCH_H_SEEN 1
+
+#include "nut_ctype.h"
+#include "upstype.h"
+
+#ifdef __cplusplus
+/* *INDENT-OFF* */
+extern "C" {
+/* *INDENT-ON* */
+#endif
+
+/* most SET and INSTCMD lines sent to a driver in one of its batches
+ * (those after go in another) */
+#define NET_BATCH_MAX	64
+
+/* the lines held back for one UPS by a client between BATCH BEGIN and
+ * BATCH END */
+typedef struct nut_batch_s {
+	char	*upsname;
+	char	*buf;
+	size_t	len, size, count;
+	int	instcmd;	/* whether an INSTCMD is among them */
+	char	**tracking;	/* ids of those which are tracked */
+	size_t	tracking_count;
+	struct nut_batch_s	*next;
+} nut_batch_t;
+
+void net_batch(nut_ctype_t *client, size_t numarg, const char **arg);
+
+/* send a SET or INSTCMD <line> for <ups> to its driver, or hold it back
+ * if the client is in a batch (with its <tracking_id>, if not NULL, to
+ * be set as failed if the batch is not sent): returns 0 if it could not
+ * be sent */
+int netbatch_sendline(nut_ctype_t *client, upstype_t *ups, const char *line,
+	const char *tracking_id);
+
+/* the batches still held are dropped, with a warning, and the commands
+ * and settings tracked in them are set as failed */
+void netbatch_client_free(nut_ctype_t *client);
+
+#ifdef __cplusplus
+/* *INDENT-OFF* */
+}
+/* *INDENT-ON* */
+#endif
+
+#endif	/* NUT_NETBATCH_H_SEEN */
@@ -34,6 +34,8 @@
 #include "netmisc.h"
 #include "netuser.h"
 #include "netinstcmd.h"
+#include "netwatch.h"
+#include "netbatch.h"
 
 #define FLAG_USER	0x0001		/* username and password must be set */
 
@@ -56,6 +58,8 @@ static struct {
 
 	{ "GET",	net_get,	0		},
 	{ "LIST",	net_list,	0		},
+	{ "WATCH",	net_watch,	0		},	/* since protocol 1.4 */
+	{ "UNWATCH",	net_unwatch,	0		},
 
 	{ "USERNAME",	net_username,	0		},
 	{ "PASSWORD",	net_password,	0		},
@@ -72,6 +76,7 @@ static struct {
 
 	{ "SET",	net_set,	FLAG_USER	},
 	{ "INSTCMD",	net_instcmd,	FLAG_USER	},
+	{ "BATCH",	net_batch,	FLAG_USER	},
 
 	{ NULL,		(void(*)(struct nut_ctype_s *, size_t,  const char **))(NULL), 0		}
 };
@@ -131,6 +131,38 @@ static void get_cmddesc(nut_ctype_t *client, const char *upsname, const char *cm
 			upsname, cmd);
 }
 
+void netget_type(const st_tree_t *node, const char *upsname, const char *var,
+	char *buf, size_t bufsize)
+{
+	snprintf(buf, bufsize, "TYPE %s %s", upsname, var);
+
+	if (node->flags & ST_FLAG_RW)
+		snprintfcat(buf, bufsize, " RW");
+
+	if (node->enum_list) {
+		snprintfcat(buf, bufsize, " ENUM");
+	}
+
+	if (node->range_list) {
+		snprintfcat(buf, bufsize, " RANGE");
+	}
+
+	if (node->flags & ST_FLAG_STRING) {
+		snprintfcat(buf, bufsize, " STRING:%ld", node->aux);
+		return;
+	}
+
+	/* Any variable that is not string | range | enum is just a simple
+	 * numeric value */
+
+	if (!(node->flags & ST_FLAG_NUMBER)) {
+		upsdebugx(3, "%s: assuming that UPS[%s] variable %s which has no type flag is a NUMBER",
+			__func__, upsname, var);
+	}
+
+	snprintfcat(buf, bufsize, " NUMBER");
+}
+
 static void get_type(nut_ctype_t *client, const char *upsname, const char *var)
 {
 	char	buf[SMALLBUF];
@@ -154,33 +186,8 @@ static void get_type(nut_ctype_t *client, const char *upsname, const char *var)
 		return;
 	}
 
-	snprintf(buf, sizeof(buf), "TYPE %s %s", upsname, var);
-
-	if (node->flags & ST_FLAG_RW)
-		snprintfcat(buf, sizeof(buf), " RW");
-
-	if (node->enum_list) {
-		snprintfcat(buf, sizeof(buf), " ENUM");
-	}
-
-	if (node->range_list) {
-		snprintfcat(buf, sizeof(buf), " RANGE");
-	}
-
-	if (node->flags & ST_FLAG_STRING) {
-		sendback(client, "%s STRING:%ld\n", buf, node->aux);
-		return;
-	}
-
-	/* Any variable that is not string | range | enum is just a simple
-	 * numeric value */
-
-	if (!(node->flags & ST_FLAG_NUMBER)) {
-		upsdebugx(3, "%s: assuming that UPS[%s] variable %s which has no type flag is a NUMBER",
-			__func__, upsname, var);
-	}
-
-	sendback(client, "%s NUMBER\n", buf);
+	netget_type(node, upsname, var, buf, sizeof(buf));
+	sendback(client, "%s\n", buf);
 }
 
 static void get_var_server(nut_ctype_t *client, const char *upsname, const char *var)
@@ -225,6 +232,11 @@ static void get_var_server(nut_ctype_t *client, const char *upsname, const char
 		return;
 	}
 
+	if (!strncasecmp(var, "server.stats.", 13)) {
+		stats_get_var(client, upsname, var);
+		return;
+	}
+
 	send_err(client, NUT_ERR_VAR_NOT_SUPPORTED);
 }
 
@@ -263,6 +275,47 @@ static void get_var(nut_ctype_t *client, const char *upsname, const char *var)
 		sendback(client, "VAR %s %s \"%s\"\n", upsname, var, val);
 }
 
+/* GET VARS <ups> <var>...: several GET VAR in one framed answer */
+static void get_vars(nut_ctype_t *client, const char *upsname, size_t numvars, const char **vars)
+{
+	const	upstype_t	*ups;
+	const	char	*val;
+	size_t	i;
+	int	ret;
+
+	ups = get_ups_ptr(upsname);
+
+	if (!ups) {
+		send_err(client, NUT_ERR_UNKNOWN_UPS);
+		return;
+	}
+
+	if (!ups_available(ups, client))
+		return;
+
+	if (!sendback(client, "BEGIN GET VARS %s\n", upsname))
+		return;
+
+	for (i = 0; i < numvars; i++) {
+		val = sstate_getinfo(ups, vars[i]);
+
+		if (!val) {
+			/* server.* are not device variables either */
+			ret = sendback(client, "MISSING %s %s\n", upsname, vars[i]);
+		} else if ((!strcasecmp(vars[i], "ups.status")) && (ups->fsd)) {
+			/* handle special case for status */
+			ret = sendback(client, "VAR %s %s \"FSD %s\"\n", upsname, vars[i], val);
+		} else {
+			ret = sendback(client, "VAR %s %s \"%s\"\n", upsname, vars[i], val);
+		}
+
+		if (!ret)
+			return;
+	}
+
+	sendback(client, "END GET VARS %s\n", upsname);
+}
+
 void net_get(nut_ctype_t *client, size_t numarg, const char **arg)
 {
 	if (numarg < 1) {
@@ -306,6 +359,12 @@ void net_get(nut_ctype_t *client, size_t numarg, const char **arg)
 		return;
 	}
 
+	/* GET VARS UPS VARNAME... */
+	if (!strcasecmp(arg[0], "VARS")) {
+		get_vars(client, arg[1], numarg - 2, &arg[2]);
+		return;
+	}
+
 	/* GET VAR UPS VARNAME */
 	if (!strcasecmp(arg[0], "VAR")) {
 		get_var(client, arg[1], arg[2]);
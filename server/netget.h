@@ -25,6 +25,8 @@
 #ifndef NUT_NETGET_H_SEEN
 #define NUT_NETGET_H_SEEN 1
 
+#include "state.h"
+
 #ifdef __cplusplus
 /* *INDENT-OFF* */
 extern "C" {
@@ -33,6 +35,10 @@ extern "C" {
 
 void net_get(nut_ctype_t *client, size_t numarg, const char **arg);
 
+/* the answer to GET TYPE for <node> (without its newline) */
+void netget_type(const st_tree_t *node, const char *upsname, const char *var,
+	char *buf, size_t bufsize);
+
 #ifdef __cplusplus
 /* *INDENT-OFF* */
 }
@@ -27,6 +27,7 @@
 #include "neterr.h"
 
 #include "netinstcmd.h"
+#include "netbatch.h"
 
 static void send_instcmd(nut_ctype_t *client, const char *upsname,
 	const char *cmdname, const char *value, const char *tracking_id)
@@ -65,7 +66,7 @@ static void send_instcmd(nut_ctype_t *client, const char *upsname,
 	}
 
 	/* see if this user is allowed to do this command */
-	if (!user_checkinstcmd(client->username, client->password, cmdname)) {
+	if (!user_checkinstcmd(client->cred, cmdname)) {
 		send_err(client, NUT_ERR_ACCESS_DENIED);
 		return;
 	}
@@ -89,13 +90,13 @@ static void send_instcmd(nut_ctype_t *client, const char *upsname,
 	snprintfcat(sockcmd, sizeof(sockcmd), "\n");
 
 	upslogx(LOG_INFO, "Instant command: %s@%s did %s%s%s on %s (tracking ID: %s)",
-		client->username, client->addr, cmdname,
+		client_username(client), client->addr, cmdname,
 		(value != NULL)?" with value ":"",
 		(value != NULL)?value:"",
 		ups->name,
 		(have_tracking_id) ? tracking_id : "disabled");
 
-	if (!sstate_sendline(ups, sockcmd)) {
+	if (!netbatch_sendline(client, ups, sockcmd, have_tracking_id ? tracking_id : NULL)) {
 		upslogx(LOG_INFO, "Set command send failed");
 		send_err(client, NUT_ERR_INSTCMD_FAILED);
 		return;
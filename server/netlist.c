@@ -20,16 +20,22 @@
 */
 
 #include "common.h"
+#include "nut_stdint.h"
+
+#include <ctype.h>
 
 #include "upsd.h"
 #include "sstate.h"
 #include "state.h"
+#include "desc.h"
 #include "neterr.h"
 
+#include "netget.h"
 #include "netlist.h"
+#include "history.h"
+#include "workers.h"
 
 extern	upstype_t	*firstups;	/* for list_ups */
-extern	nut_ctype_t *firstclient;	/* for list_clients */
 
 static int tree_dump(st_tree_t *node, nut_ctype_t *client, const char *ups,
 	int rw, int fsd)
@@ -81,6 +87,62 @@ static int tree_dump(st_tree_t *node, nut_ctype_t *client, const char *ups,
 	return 1;
 }
 
+/* append the "VAR" lines of a subtree to the LIST VAR cache of <ups>,
+ * formatted (and truncated) exactly as tree_dump() would send them */
+static void tree_serialize(const st_tree_t *node, upstype_t *ups, size_t *bufsize)
+{
+	char	line[NUT_NET_ANSWER_MAX + 1];
+	size_t	len;
+
+	if (!node)
+		return;
+
+	tree_serialize(node->left, ups, bufsize);
+
+	/* status is always a special case */
+	if ((ups->fsd == 1) && (!strcasecmp(node->var, "ups.status"))) {
+		snprintf(line, sizeof(line), "VAR %s %s \"FSD %s\"\n",
+			ups->name, node->var, node->val);
+	} else {
+		snprintf(line, sizeof(line), "VAR %s %s \"%s\"\n",
+			ups->name, node->var, node->val);
+	}
+
+	len = strlen(line);
+	if (ups->listvar_len + len > *bufsize) {
+		*bufsize = (ups->listvar_len + len) * 2;
+		ups->listvar_buf = xrealloc(ups->listvar_buf, *bufsize);
+	}
+	memcpy(ups->listvar_buf + ups->listvar_len, line, len);
+	ups->listvar_len += len;
+
+	tree_serialize(node->right, ups, bufsize);
+}
+
+/* return the cached LIST VAR body of <ups>, re-made if the data changed */
+static const char *listvar_cache_get(upstype_t *ups, size_t *len)
+{
+	size_t	bufsize;
+
+	if (!ups->listvar_valid || ups->listvar_fsd != ups->fsd) {
+		free(ups->listvar_buf);
+		ups->listvar_buf = NULL;
+		ups->listvar_len = 0;
+		bufsize = 0;
+
+		tree_serialize(ups->inforoot, ups, &bufsize);
+
+		ups->listvar_fsd = ups->fsd;
+		ups->listvar_valid = 1;
+
+		upsdebugx(3, "%s: UPS [%s]: made a %" PRIuSIZE " byte LIST VAR cache",
+			__func__, ups->name, ups->listvar_len);
+	}
+
+	*len = ups->listvar_len;
+	return ups->listvar_buf;
+}
+
 static void list_rw(nut_ctype_t *client, const char *upsname)
 {
 	const   upstype_t *ups;
@@ -104,7 +166,55 @@ static void list_rw(nut_ctype_t *client, const char *upsname)
 	sendback(client, "END LIST RW %s\n", upsname);
 }
 
-static void list_var(nut_ctype_t *client, const char *upsname)
+/* all there is to know about each RW variable of a subtree, as the GET
+ * and LIST commands about it would answer */
+static int tree_dump_settings(const st_tree_t *node, nut_ctype_t *client,
+	const char *upsname)
+{
+	char	buf[SMALLBUF];
+	const	char	*desc;
+	const	enum_t	*etmp;
+	const	range_t	*rtmp;
+
+	if (!node)
+		return 1;
+
+	if (!tree_dump_settings(node->left, client, upsname))
+		return 0;
+
+	if (node->flags & ST_FLAG_RW) {
+		if (!sendback(client, "RW %s %s \"%s\"\n", upsname, node->var, node->val))
+			return 0;
+
+		netget_type(node, upsname, node->var, buf, sizeof(buf));
+		if (!sendback(client, "%s\n", buf))
+			return 0;
+
+		/* see get_desc() */
+		desc = desc_get_var(strncmp(node->var, "upstream.", 9) ? node->var : node->var + 9);
+		if (!sendback(client, "DESC %s %s \"%s\"\n", upsname, node->var,
+			desc ? desc : "Description unavailable"))
+			return 0;
+
+		for (etmp = node->enum_list; etmp != NULL; etmp = etmp->next) {
+			if (!sendback(client, "ENUM %s %s \"%s\"\n",
+				upsname, node->var, etmp->val))
+				return 0;
+		}
+
+		for (rtmp = node->range_list; rtmp != NULL; rtmp = rtmp->next) {
+			if (!sendback(client, "RANGE %s %s \"%i\" \"%i\"\n",
+				upsname, node->var, rtmp->min, rtmp->max))
+				return 0;
+		}
+	}
+
+	return tree_dump_settings(node->right, client, upsname);
+}
+
+/* LIST SETTINGS <ups>: what LIST RW, then GET TYPE, GET DESC, LIST ENUM
+ * and LIST RANGE for each would tell, for a settings page in one request */
+static void list_settings(nut_ctype_t *client, const char *upsname)
 {
 	const   upstype_t *ups;
 
@@ -118,15 +228,189 @@ static void list_var(nut_ctype_t *client, const char *upsname)
 	if (!ups_available(ups, client))
 		return;
 
-	if (!sendback(client, "BEGIN LIST VAR %s\n", upsname))
+	if (!sendback(client, "BEGIN LIST SETTINGS %s\n", upsname))
+		return;
+
+	if (!tree_dump_settings(ups->inforoot, client, upsname))
+		return;
+
+	sendback(client, "END LIST SETTINGS %s\n", upsname);
+}
+
+static void list_var(nut_ctype_t *client, const char *upsname)
+{
+	upstype_t	*ups;
+	const char	*buf;
+	size_t	len;
+
+	ups = get_ups_ptr(upsname);
+
+	if (!ups) {
+		send_err(client, NUT_ERR_UNKNOWN_UPS);
+		return;
+	}
+
+	if (!ups_available(ups, client))
 		return;
 
-	if (!tree_dump(ups->inforoot, client, upsname, 0, ups->fsd))
+	if (!sendback(client, "BEGIN LIST VAR %s\n", upsname))
 		return;
 
+	/* the cache is made with the configured name; answer other
+	 * spellings of it (names are case-insensitive) the old way */
+	if (!strcmp(upsname, ups->name)) {
+		buf = listvar_cache_get(ups, &len);
+		if (!sendback_raw(client, buf, len))
+			return;
+	} else {
+		if (!tree_dump(ups->inforoot, client, upsname, 0, ups->fsd))
+			return;
+	}
+
 	sendback(client, "END LIST VAR %s\n", upsname);
 }
 
+/* cursors of LIST VAR ... SINCE are "<seconds>.<microseconds>" of the
+ * clock used for st_tree_t timestamps; the value is opaque to clients */
+static void cursor_format(const st_tree_timespec_t *ts, char *buf, size_t bufsize)
+{
+#if defined(HAVE_CLOCK_GETTIME) && defined(HAVE_CLOCK_MONOTONIC) && HAVE_CLOCK_GETTIME && HAVE_CLOCK_MONOTONIC
+	snprintf(buf, bufsize, "%" PRIdMAX ".%06ld", (intmax_t)ts->tv_sec, (long)(ts->tv_nsec / 1000));
+#else
+	snprintf(buf, bufsize, "%" PRIdMAX ".%06ld", (intmax_t)ts->tv_sec, (long)ts->tv_usec);
+#endif
+}
+
+static int cursor_parse(const char *buf, st_tree_timespec_t *ts)
+{
+	char	*end;
+	long	usec = 0;
+	intmax_t	sec;
+
+	memset(ts, 0, sizeof(*ts));
+
+	errno = 0;
+	sec = strtoimax(buf, &end, 10);
+	if (errno || end == buf || sec < 0)
+		return 0;
+
+	if (*end == '.') {
+		const char	*frac = end + 1;
+
+		usec = strtol(frac, &end, 10);
+		if (end == frac || usec < 0 || usec > 999999)
+			return 0;
+	}
+
+	if (*end != '\0')
+		return 0;
+
+	ts->tv_sec = (time_t)sec;
+#if defined(HAVE_CLOCK_GETTIME) && defined(HAVE_CLOCK_MONOTONIC) && HAVE_CLOCK_GETTIME && HAVE_CLOCK_MONOTONIC
+	ts->tv_nsec = usec * 1000;
+#else
+	ts->tv_usec = usec;
+#endif
+
+	return 1;
+}
+
+/* send the VAR lines of a subtree for nodes set at or after <cutoff>,
+ * or for all of them if <cutoff> is NULL */
+static int tree_dump_since(st_tree_t *node, nut_ctype_t *client, const char *upsname,
+	int fsd, const st_tree_timespec_t *cutoff)
+{
+	if (!node)
+		return 1;
+
+	if (!tree_dump_since(node->left, client, upsname, fsd, cutoff))
+		return 0;
+
+	if (!cutoff || st_tree_node_compare_timestamp(node, cutoff) >= 0) {
+		int	ret;
+
+		/* status is always a special case */
+		if ((fsd == 1) && (!strcasecmp(node->var, "ups.status"))) {
+			ret = sendback(client, "VAR %s %s \"FSD %s\"\n",
+				upsname, node->var, node->val);
+		} else {
+			ret = sendback(client, "VAR %s %s \"%s\"\n",
+				upsname, node->var, node->val);
+		}
+
+		if (!ret)
+			return 0;
+	}
+
+	return tree_dump_since(node->right, client, upsname, fsd, cutoff);
+}
+
+/* LIST VAR <ups> SINCE <cursor>: only what changed since an earlier call
+ * (cursor "0" for the first one) */
+static void list_var_since(nut_ctype_t *client, const char *upsname, const char *cursor)
+{
+	const	upstype_t	*ups;
+	st_tree_timespec_t	cutoff, now;
+	const st_tree_timespec_t	*since = &cutoff;
+	char	newcursor[SMALLBUF];
+	size_t	i;
+
+	ups = get_ups_ptr(upsname);
+
+	if (!ups) {
+		send_err(client, NUT_ERR_UNKNOWN_UPS);
+		return;
+	}
+
+	if (!cursor_parse(cursor, &cutoff)) {
+		send_err(client, NUT_ERR_INVALID_ARGUMENT);
+		return;
+	}
+
+	if (!ups_available(ups, client))
+		return;
+
+	/* taken before the dump: anything changed later is in the next delta */
+	state_get_timestamp(&now);
+	cursor_format(&now, newcursor, sizeof(newcursor));
+
+	if (!sendback(client, "BEGIN LIST VAR %s SINCE %s\n", upsname, cursor))
+		return;
+
+	/* deletions (or the FSD flag) before the cursor may be unknown:
+	 * tell the client to start over, and list everything */
+#if defined(HAVE_CLOCK_GETTIME) && defined(HAVE_CLOCK_MONOTONIC) && HAVE_CLOCK_GETTIME && HAVE_CLOCK_MONOTONIC
+	if (difftimespec(cutoff, ups->delta_horizon) < 0)
+#else
+	if (difftimeval(cutoff, ups->delta_horizon) < 0)
+#endif
+	{
+		if (!sendback(client, "RESYNC %s\n", upsname))
+			return;
+		since = NULL;
+	} else {
+		for (i = 0; i < ups->numdelvars; i++) {
+#if defined(HAVE_CLOCK_GETTIME) && defined(HAVE_CLOCK_MONOTONIC) && HAVE_CLOCK_GETTIME && HAVE_CLOCK_MONOTONIC
+			if (difftimespec(ups->delvars[i].when, cutoff) < 0)
+#else
+			if (difftimeval(ups->delvars[i].when, cutoff) < 0)
+#endif
+				continue;
+
+			if (!sendback(client, "DELETED %s %s\n", upsname, ups->delvars[i].var))
+				return;
+		}
+	}
+
+	if (!tree_dump_since(ups->inforoot, client, upsname, ups->fsd, since))
+		return;
+
+	if (!sendback(client, "CURSOR %s %s\n", upsname, newcursor))
+		return;
+
+	sendback(client, "END LIST VAR %s SINCE %s\n", upsname, cursor);
+}
+
 static void list_cmd(nut_ctype_t *client, const char *upsname)
 {
 	const   upstype_t *ups;
@@ -255,6 +539,108 @@ static void list_ups(nut_ctype_t *client)
 	sendback(client, "END LIST UPS\n");
 }
 
+/* longest pattern of LIST FLEET, and most stars in it */
+#define FLEET_PATTERN_MAXLEN	128
+#define FLEET_PATTERN_MAXSTARS	16
+
+/* whether <name> matches <pattern>, in which '*' stands for any text and
+ * '?' for any character, without regard to case like UPS names; after a
+ * mismatch only the last star takes one more character and the rest of
+ * the pattern is tried again from there, so that this does not take more
+ * than the lengths of both multiplied */
+static int fleet_match(const char *pattern, const char *name)
+{
+	const char	*star = NULL, *resume = NULL;
+
+	while (*name) {
+		if (*pattern == '*') {
+			star = ++pattern;
+			resume = name;
+			continue;
+		}
+
+		if (*pattern && (*pattern == '?'
+		 || tolower((unsigned char)*pattern) == tolower((unsigned char)*name))
+		) {
+			pattern++;
+			name++;
+			continue;
+		}
+
+		if (!star)
+			return 0;
+
+		pattern = star;
+		name = ++resume;
+	}
+
+	while (*pattern == '*')
+		pattern++;
+
+	return (*pattern == '\0');
+}
+
+/* whether a LIST FLEET pattern is short and simple enough to be matched
+ * against every UPS name in the main loop */
+static int fleet_pattern_ok(const char *pattern)
+{
+	size_t	len, stars = 0;
+
+	for (len = 0; pattern[len]; len++) {
+		if (pattern[len] == '*')
+			stars++;
+	}
+
+	return (len <= FLEET_PATTERN_MAXLEN && stars <= FLEET_PATTERN_MAXSTARS);
+}
+
+/* LIST FLEET <pattern> <var>...: those variables of every UPS whose name
+ * matches, so that an overview of many devices takes one request */
+static void list_fleet(nut_ctype_t *client, const char *pattern,
+	size_t numvars, const char **vars)
+{
+	upstype_t	*utmp;
+	size_t	i;
+
+	if (!fleet_pattern_ok(pattern)) {
+		send_err(client, NUT_ERR_INVALID_ARGUMENT);
+		return;
+	}
+
+	if (!sendback(client, "BEGIN LIST FLEET %s\n", pattern))
+		return;
+
+	for (utmp = firstups; utmp; utmp = utmp->next) {
+		const char	*val;
+		int	ret = 1;
+
+		if (!fleet_match(pattern, utmp->name))
+			continue;
+
+		/* like ups_available(), but in the list */
+		if (worker_id >= 0 ? !utmp->worker_connected : INVALID_FD(utmp->sock_fd)) {
+			ret = sendback(client, "UNAVAILABLE %s %s\n", utmp->name, NUT_ERR_DRIVER_NOT_CONNECTED);
+		} else if (utmp->stale) {
+			ret = sendback(client, "UNAVAILABLE %s %s\n", utmp->name, NUT_ERR_DATA_STALE);
+		} else for (i = 0; ret && i < numvars; i++) {
+			val = sstate_getinfo(utmp, vars[i]);
+
+			if (!val) {
+				ret = sendback(client, "MISSING %s %s\n", utmp->name, vars[i]);
+			} else if ((!strcasecmp(vars[i], "ups.status")) && (utmp->fsd)) {
+				ret = sendback(client, "VAR %s %s \"FSD %s\"\n", utmp->name, vars[i], val);
+			} else {
+				ret = sendback(client, "VAR %s %s \"%s\"\n", utmp->name, vars[i], val);
+			}
+		}
+
+		if (!ret)
+			return;
+	}
+
+	sendback(client, "END LIST FLEET %s\n", pattern);
+}
+
 static void list_clients(nut_ctype_t *client, const char *upsname)
 {
 	const upstype_t *ups;
@@ -270,21 +656,97 @@ static void list_clients(nut_ctype_t *client, const char *upsname)
 	if (!sendback(client, "BEGIN LIST CLIENT %s\n", upsname))
 		return;
 
-	if (firstclient) {
-		int	ret;
-		/* show connected clients */
-		for (c = firstclient; c; c = cnext) {
-			if (c->loginups && (!ups || !strcasecmp(c->loginups, ups->name))) {
-				ret = sendback(client, "CLIENT %s %s\n", c->loginups, c->addr);
-				if (!ret)
-					return;
-			}
-			cnext = c->next;
-		}
+	/* show the clients logged into it */
+	for (c = ups->logins; c; c = cnext) {
+		if (!sendback(client, "CLIENT %s %s\n", c->loginups, c->addr))
+			return;
+		cnext = c->loginnext;
 	}
 	sendback(client, "END LIST CLIENT %s\n", upsname);
 }
 
+/* the changes the driver sent with a TRACE time, oldest first */
+static void list_trace(nut_ctype_t *client, const char *upsname)
+{
+	const upstype_t	*ups;
+	size_t	i;
+
+	ups = get_ups_ptr(upsname);
+
+	if (!ups) {
+		send_err(client, NUT_ERR_UNKNOWN_UPS);
+		return;
+	}
+
+	if (!sendback(client, "BEGIN LIST TRACE %s\n", upsname))
+		return;
+
+	for (i = 0; ups->traces && i < SS_TRACE_MAX; i++) {
+		const sstate_trace_t	*trace =
+			&ups->traces[(ups->tracenext + i) % SS_TRACE_MAX];
+
+		if (!trace->var)
+			continue;
+
+		if (!sendback(client, "TRACE %s %s %" PRIu64 " %" PRIu64 " %" PRIu64 "\n",
+			ups->name, trace->var, trace->set, trace->recv, trace->sent))
+			return;
+	}
+
+	sendback(client, "END LIST TRACE %s\n", upsname);
+}
+
+/* the values of var kept by HISTORY set after "since" (seconds since the
+ * epoch, if given), oldest first */
+static void list_history(nut_ctype_t *client, const char *upsname,
+	const char *var, const char *since)
+{
+	const upstype_t	*ups;
+	const history_ring_t	*ring;
+	unsigned long	after = 0;
+	size_t	i;
+
+	ups = get_ups_ptr(upsname);
+
+	if (!ups) {
+		send_err(client, NUT_ERR_UNKNOWN_UPS);
+		return;
+	}
+
+	if (!history_depth(var)) {
+		send_err(client, NUT_ERR_FEATURE_NOT_CONFIGURED);
+		return;
+	}
+
+	if (since) {
+		char	*end;
+
+		after = strtoul(since, &end, 10);
+		if (*since == '\0' || *end != '\0') {
+			send_err(client, NUT_ERR_INVALID_ARGUMENT);
+			return;
+		}
+	}
+
+	if (!sendback(client, "BEGIN LIST HISTORY %s %s\n", upsname, var))
+		return;
+
+	ring = history_find(ups, var);
+
+	for (i = 0; ring && i < ring->count; i++) {
+		const history_sample_t	*sample = history_sample(ring, i);
+
+		if (sample->when <= after)
+			continue;
+
+		if (!sendback(client, "HISTORY %s %s %" PRIu32 " \"%.7g\"\n",
+			ups->name, var, sample->when, (double)sample->value))
+			return;
+	}
+
+	sendback(client, "END LIST HISTORY %s %s\n", upsname, var);
+}
+
 void net_list(nut_ctype_t *client, size_t numarg, const char **arg)
 {
 	if (numarg < 1) {
@@ -303,6 +765,12 @@ void net_list(nut_ctype_t *client, size_t numarg, const char **arg)
 		return;
 	}
 
+	/* LIST VAR UPS SINCE CURSOR */
+	if (!strcasecmp(arg[0], "VAR") && numarg >= 4 && !strcasecmp(arg[2], "SINCE")) {
+		list_var_since(client, arg[1], arg[3]);
+		return;
+	}
+
 	/* LIST VAR UPS */
 	if (!strcasecmp(arg[0], "VAR")) {
 		list_var(client, arg[1]);
@@ -315,6 +783,12 @@ void net_list(nut_ctype_t *client, size_t numarg, const char **arg)
 		return;
 	}
 
+	/* LIST SETTINGS UPS */
+	if (!strcasecmp(arg[0], "SETTINGS")) {
+		list_settings(client, arg[1]);
+		return;
+	}
+
 	/* LIST CMD UPS */
 	if (!strcasecmp(arg[0], "CMD")) {
 		list_cmd(client, arg[1]);
@@ -327,11 +801,23 @@ void net_list(nut_ctype_t *client, size_t numarg, const char **arg)
 		return;
 	}
 
+	/* LIST TRACE UPS */
+	if (!strcasecmp(arg[0], "TRACE")) {
+		list_trace(client, arg[1]);
+		return;
+	}
+
 	if (numarg < 3) {
 		send_err(client, NUT_ERR_INVALID_ARGUMENT);
 		return;
 	}
 
+	/* LIST FLEET PATTERN VARNAME... */
+	if (!strcasecmp(arg[0], "FLEET")) {
+		list_fleet(client, arg[1], numarg - 2, &arg[2]);
+		return;
+	}
+
 	/* LIST ENUM UPS VARNAME */
 	if (!strcasecmp(arg[0], "ENUM")) {
 		list_enum(client, arg[1], arg[2]);
@@ -344,5 +830,11 @@ void net_list(nut_ctype_t *client, size_t numarg, const char **arg)
 		return;
 	}
 
+	/* LIST HISTORY UPS VARNAME [SINCE] */
+	if (!strcasecmp(arg[0], "HISTORY")) {
+		list_history(client, arg[1], arg[2], (numarg > 3) ? arg[3] : NULL);
+		return;
+	}
+
 	send_err(client, NUT_ERR_INVALID_ARGUMENT);
 }
@@ -28,6 +28,9 @@
 #include "neterr.h"
 
 #include "netmisc.h"
+#include "netwatch.h"
+#include "workers.h"
+#include "metrics.h"
 
 void net_ver(nut_ctype_t *client, size_t numarg, const char **arg)
 {
@@ -93,7 +96,7 @@ void net_help(nut_ctype_t *client, size_t numarg, const char **arg)
 	}
 
 	sendback(client, "Commands: HELP VER PROTVER GET LIST SET INSTCMD"
-		" LOGIN LOGOUT USERNAME PASSWORD STARTTLS\n");
+		" LOGIN LOGOUT USERNAME PASSWORD STARTTLS WATCH UNWATCH BATCH\n");
 	/* Not exposed: PRIMARY/MASTER FSD */
 }
 
@@ -114,15 +117,23 @@ void net_fsd(nut_ctype_t *client, size_t numarg, const char **arg)
 	}
 
 	/* make sure this user is allowed to do FSD */
-	if (!user_checkaction(client->username, client->password, "FSD")) {
+	if (!user_checkaction(client->cred, "FSD")) {
 		send_err(client, NUT_ERR_ACCESS_DENIED);
 		return;
 	}
 
 	upslogx(LOG_INFO, "Client %s@%s set FSD on UPS [%s]",
-		client->username, client->addr, ups->name);
+		client_username(client), client->addr, ups->name);
 
 	ups->fsd = 1;
+	workers_changed();
+	metrics_changed();
 	sendback(client, "OK FSD-SET\n");
+
+	/* the effective ups.status has changed; LIST VAR SINCE has
+	 * no timestamp for that, so older cursors get a full list */
+	state_get_timestamp(&ups->delta_horizon);
+	netwatch_notify(ups, "ups.status");
+	netwatch_flush(ups);
 }
 
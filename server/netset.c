@@ -26,6 +26,7 @@
 #include "neterr.h"
 
 #include "netset.h"
+#include "netbatch.h"
 
 static void set_var(nut_ctype_t *client, const char *upsname, const char *var,
 	const char *newval, const char *tracking_id)
@@ -48,7 +49,7 @@ static void set_var(nut_ctype_t *client, const char *upsname, const char *var,
 		return;
 
 	/* make sure this user is allowed to do SET */
-	if (!user_checkaction(client->username, client->password, "SET")) {
+	if (!user_checkaction(client->cred, "SET")) {
 		send_err(client, NUT_ERR_ACCESS_DENIED);
 		return;
 	}
@@ -169,10 +170,10 @@ static void set_var(nut_ctype_t *client, const char *upsname, const char *var,
 	snprintfcat(cmd, sizeof(cmd), "\n");
 
 	upslogx(LOG_INFO, "Set variable: %s@%s set %s on %s to %s (tracking ID: %s)",
-		client->username, client->addr, var, ups->name, newval,
+		client_username(client), client->addr, var, ups->name, newval,
 		(have_tracking_id) ? tracking_id : "disabled");
 
-	if (!sstate_sendline(ups, cmd)) {
+	if (!netbatch_sendline(client, ups, cmd, have_tracking_id ? tracking_id : NULL)) {
 		upslogx(LOG_INFO, "Set command send failed");
 		send_err(client, NUT_ERR_SET_FAILED);
 		return;
@@ -37,6 +37,7 @@
 #include "upsd.h"
 #include "neterr.h"
 #include "netssl.h"
+#include "evloop.h"
 #include "nut_stdint.h"
 
 #ifdef WITH_NSS
@@ -70,6 +71,17 @@ int	disable_weak_ssl = 0;
 int certrequest = 0;
 #endif /* WITH_CLIENT_CERTIFICATE_VALIDATION */
 
+/* TLS session resumption, so that reconnecting clients can skip the
+ * full key exchange; see upsd.conf SSL_SESSION_* options */
+int	ssl_session_cache = NETSSL_SESSION_CACHE_DEFAULT;
+int	ssl_session_timeout = NETSSL_SESSION_TIMEOUT_DEFAULT;
+int	ssl_session_tickets = 1;
+
+/* kernel TLS (Linux, OpenSSL 3): once the handshake is done, records are
+ * encrypted by the kernel (or the NIC) as they are written to the socket;
+ * see upsd.conf SSL_KTLS */
+int	ssl_ktls = 1;
+
 static int	ssl_initialized = 0;
 
 #ifndef WITH_SSL
@@ -105,6 +117,14 @@ ssize_t ssl_read(nut_ctype_t *client, char *buf, size_t buflen)
 	return -1;
 }
 
+int ssl_handshake_continue(nut_ctype_t *client)
+{
+	NUT_UNUSED_VARIABLE(client);
+
+	upslogx(LOG_ERR, "ssl_handshake_continue called but SSL wasn't compiled in");
+	return -1;
+}
+
 void ssl_init(void)
 {
 	ssl_initialized = 0;	/* keep gcc quiet */
@@ -274,45 +294,115 @@ static void HandshakeCallback(PRFileDesc *fd, nut_ctype_t *client_data)
 
 #endif /* WITH_OPENSSL | WITH_NSS */
 
-void net_starttls(nut_ctype_t *client, size_t numarg, const char **arg)
-{
 #ifdef WITH_OPENSSL
-	int ret;
-#elif defined(WITH_NSS) /* WITH_OPENSSL */
-	SECStatus	status;
-	PRFileDesc	*socket;
-#endif /* WITH_OPENSSL | WITH_NSS */
+/* whether the records of <ssl> are encrypted by the kernel */
+static int ssl_ktls_send(SSL *ssl)
+{
+#ifdef BIO_get_ktls_send
+	return BIO_get_ktls_send(SSL_get_wbio(ssl));
+#else
+	NUT_UNUSED_VARIABLE(ssl);
+	return 0;
+#endif
+}
+#endif /* WITH_OPENSSL */
 
-	NUT_UNUSED_VARIABLE(numarg);
-	NUT_UNUSED_VARIABLE(arg);
+/* advance the TLS handshake of a client as far as its non-blocking
+ * socket allows, so that one slow (or hostile) peer doing the key
+ * exchange does not hold up the drivers and the other clients;
+ * see ssl_handshake_continue() for the return values */
+static int ssl_handshake_step(nut_ctype_t *client)
+{
+#ifdef WITH_OPENSSL
+	int	ret;
 
-	if (client->ssl) {
-		send_err(client, NUT_ERR_ALREADY_SSL_MODE);
-		return;
+	ret = SSL_accept(client->ssl);
+	if (ret == 1) {
+		client->ssl_handshake = 0;
+		client->ssl_connected = 1;
+		upsdebugx(3, "SSL connected (%s%s)", SSL_get_version(client->ssl),
+			ssl_ktls_send(client->ssl) ? ", kernel TLS" : "");
+		return 1;
 	}
 
-	client->ssl_connected = 0;
+	switch (SSL_get_error(client->ssl, ret))
+	{
+	case SSL_ERROR_WANT_READ:
+		evloop_mod(client->sock_fd, EVLOOP_READ);
+		return 0;
 
-	if ((!certfile) || (!ssl_initialized)) {
-		send_err(client, NUT_ERR_FEATURE_NOT_CONFIGURED);
-		return;
+	case SSL_ERROR_WANT_WRITE:
+		evloop_mod(client->sock_fd, EVLOOP_WRITE);
+		return 0;
+
+	default:
+		break;
 	}
 
-#ifdef WITH_OPENSSL
-	if (!ssl_ctx)
+	if (ret == 0) {
+		upslog_with_errno(LOG_ERR, "SSL_accept do not accept handshake.");
+	} else {
+		upslog_with_errno(LOG_ERR, "Unknown return value from SSL_accept");
+	}
+	ssl_error(client->ssl, ret);
+
 #elif defined(WITH_NSS) /* WITH_OPENSSL */
-	if (!NSS_IsInitialized())
-#endif /* WITH_OPENSSL | WITH_NSS */
+	SECStatus	status;
+
+	/* Note: this call can generate memory leaks not resolvable
+	 * by any release function.
+	 * Probably SSL session key object allocation. */
+	status = SSL_ForceHandshake(client->ssl);
+	if (status == SECSuccess) {
+		client->ssl_handshake = 0;
+		client->ssl_connected = 1;
+		return 1;
+	}
+
+	switch (PR_GetError())
 	{
-		send_err(client, NUT_ERR_FEATURE_NOT_CONFIGURED);
-		ssl_initialized = 0;
-		return;
+	case PR_WOULD_BLOCK_ERROR:
+		/* NSS does not tell which way; the server flights are
+		 * small enough for the socket buffer, so wait for input */
+		evloop_mod(client->sock_fd, EVLOOP_READ);
+		return 0;
+
+	case SSL_ERROR_NO_CERTIFICATE:
+		upslogx(LOG_WARNING, "Client %s do not provide certificate.",
+			client->addr);
+		client->ssl_handshake = 0;
+		client->ssl_connected = 1;
+		return 1;
+
+	default:
+		nss_error("net_starttls / SSL_ForceHandshake");
+		break;
 	}
+#endif /* WITH_OPENSSL | WITH_NSS */
 
-	if (!sendback(client, "OK STARTTLS\n")) {
-		return;
+	client->ssl_handshake = 0;
+	return -1;
+}
+
+int ssl_handshake_continue(nut_ctype_t *client)
+{
+	if (!client->ssl || !client->ssl_handshake) {
+		return -1;
 	}
 
+	return ssl_handshake_step(client);
+}
+
+/* set up TLS on a client socket after "OK STARTTLS" was sent,
+ * and start the handshake; returns as ssl_handshake_continue() */
+static int ssl_handshake(nut_ctype_t *client)
+{
+#ifdef WITH_NSS
+	SECStatus	status;
+	PRFileDesc	*socket;
+	PRSocketOptionData	sockopt;
+#endif /* WITH_NSS */
+
 #ifdef WITH_OPENSSL
 
 	client->ssl = SSL_new(ssl_ctx);
@@ -320,35 +410,16 @@ void net_starttls(nut_ctype_t *client, size_t numarg, const char **arg)
 	if (!client->ssl) {
 		upslog_with_errno(LOG_ERR, "SSL_new failed\n");
 		ssl_debug();
-		return;
+		return -1;
 	}
 
 	if (SSL_set_fd(client->ssl, client->sock_fd) != 1) {
 		upslog_with_errno(LOG_ERR, "SSL_set_fd failed\n");
 		ssl_debug();
-		return;
+		return -1;
 	}
 
-	ret = SSL_accept(client->ssl);
-	switch (ret)
-	{
-	case 1:
-		client->ssl_connected = 1;
-		upsdebugx(3, "SSL connected (%s)", SSL_get_version(client->ssl));
-		break;
-
-	case 0:
-		upslog_with_errno(LOG_ERR, "SSL_accept do not accept handshake.");
-		ssl_error(client->ssl, ret);
-		break;
-
-	case -1:
-		upslog_with_errno(LOG_ERR, "Unknown return value from SSL_accept");
-		ssl_error(client->ssl, ret);
-		break;
-	default:
-		break;
-	}
+	client->ssl_handshake = 1;
 
 #elif defined(WITH_NSS) /* WITH_OPENSSL */
 
@@ -356,20 +427,28 @@ void net_starttls(nut_ctype_t *client, size_t numarg, const char **arg)
 	if (socket == NULL) {
 		upslogx(LOG_ERR, "Can not initialize SSL connection");
 		nss_error("net_starttls / PR_ImportTCPSocket");
-		return;
+		return -1;
+	}
+
+	sockopt.option = PR_SockOpt_Nonblocking;
+	sockopt.value.non_blocking = PR_TRUE;
+	if (PR_SetSocketOption(socket, &sockopt) != PR_SUCCESS) {
+		upslogx(LOG_ERR, "Can not initialize SSL connection");
+		nss_error("net_starttls / PR_SetSocketOption");
+		return -1;
 	}
 
 	client->ssl = SSL_ImportFD(NULL, socket);
 	if (client->ssl == NULL) {
 		upslogx(LOG_ERR, "Can not initialize SSL connection");
 		nss_error("net_starttls / SSL_ImportFD");
-		return;
+		return -1;
 	}
 
 	if (SSL_SetPKCS11PinArg(client->ssl, client) == -1) {
 		upslogx(LOG_ERR, "Can not initialize SSL connection");
 		nss_error("net_starttls / SSL_SetPKCS11PinArg");
-		return;
+		return -1;
 	}
 
 #if (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_PUSH_POP) && (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_CAST_FUNCTION_TYPE_STRICT)
@@ -383,28 +462,28 @@ void net_starttls(nut_ctype_t *client, size_t numarg, const char **arg)
 	if (status != SECSuccess) {
 		upslogx(LOG_ERR, "Can not initialize SSL connection");
 		nss_error("net_starttls / SSL_AuthCertificateHook");
-		return;
+		return -1;
 	}
 
 	status = SSL_BadCertHook(client->ssl, (SSLBadCertHandler)BadCertHandler, client);
 	if (status != SECSuccess) {
 		upslogx(LOG_ERR, "Can not initialize SSL connection");
 		nss_error("net_starttls / SSL_BadCertHook");
-		return;
+		return -1;
 	}
 
 	status = SSL_HandshakeCallback(client->ssl, (SSLHandshakeCallback)HandshakeCallback, client);
 	if (status != SECSuccess) {
 		upslogx(LOG_ERR, "Can not initialize SSL connection");
 		nss_error("net_starttls / SSL_HandshakeCallback");
-		return;
+		return -1;
 	}
 
 	status = SSL_ConfigSecureServer(client->ssl, cert, privKey, NSS_FindCertKEAType(cert));
 	if (status != SECSuccess) {
 		upslogx(LOG_ERR, "Can not initialize SSL connection");
 		nss_error("net_starttls / SSL_ConfigSecureServer");
-		return;
+		return -1;
 	}
 #if (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_PUSH_POP) && (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_CAST_FUNCTION_TYPE_STRICT)
 #pragma GCC diagnostic pop
@@ -414,26 +493,53 @@ void net_starttls(nut_ctype_t *client, size_t numarg, const char **arg)
 	if (status != SECSuccess) {
 		upslogx(LOG_ERR, "Can not initialize SSL connection");
 		nss_error("net_starttls / SSL_ResetHandshake");
+		return -1;
+	}
+
+	client->ssl_handshake = 1;
+#endif /* WITH_OPENSSL | WITH_NSS */
+
+	return ssl_handshake_step(client);
+}
+
+void net_starttls(nut_ctype_t *client, size_t numarg, const char **arg)
+{
+	NUT_UNUSED_VARIABLE(numarg);
+	NUT_UNUSED_VARIABLE(arg);
+
+	if (client->ssl) {
+		send_err(client, NUT_ERR_ALREADY_SSL_MODE);
 		return;
 	}
 
-	/* Note: this call can generate memory leaks not resolvable
-	 * by any release function.
-	 * Probably SSL session key object allocation. */
-	status = SSL_ForceHandshake(client->ssl);
-	if (status != SECSuccess) {
-		PRErrorCode code = PR_GetError();
-		if (code==SSL_ERROR_NO_CERTIFICATE) {
-			upslogx(LOG_WARNING, "Client %s do not provide certificate.",
-				client->addr);
-		} else {
-			nss_error("net_starttls / SSL_ForceHandshake");
-			/* TODO : Close the connection. */
-			return;
-		}
+	client->ssl_connected = 0;
+
+	if ((!certfile) || (!ssl_initialized)) {
+		send_err(client, NUT_ERR_FEATURE_NOT_CONFIGURED);
+		return;
 	}
-	client->ssl_connected = 1;
+
+#ifdef WITH_OPENSSL
+	if (!ssl_ctx)
+#elif defined(WITH_NSS) /* WITH_OPENSSL */
+	if (!NSS_IsInitialized())
 #endif /* WITH_OPENSSL | WITH_NSS */
+	{
+		send_err(client, NUT_ERR_FEATURE_NOT_CONFIGURED);
+		ssl_initialized = 0;
+		return;
+	}
+
+	/* this must reach the client before the handshake begins */
+	if (!sendback(client, "OK STARTTLS\n") || !client_flush(client)) {
+		return;
+	}
+
+	/* the handshake goes on from the main loop as the client answers */
+	if (ssl_handshake(client) < 0) {
+		client->ssl_handshake = 0;
+		client_drop(client);
+	}
 }
 
 void ssl_init(void)
@@ -470,6 +576,8 @@ void ssl_init(void)
 	}
 
 	SSL_CTX_set_options(ssl_ctx, SSL_OP_CIPHER_SERVER_PREFERENCE);
+	/* client sockets are non-blocking, see client_flush() */
+	SSL_CTX_set_mode(ssl_ctx, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
 #if OPENSSL_VERSION_NUMBER < 0x10100000L
 	/* set minimum protocol TLSv1 */
 	SSL_CTX_set_options(ssl_ctx, SSL_OP_NO_SSLv2 | SSL_OP_NO_SSLv3);
@@ -509,6 +617,48 @@ void ssl_init(void)
 
 	SSL_CTX_set_verify(ssl_ctx, SSL_VERIFY_NONE, NULL);
 
+	/* session resumption: cached session IDs and/or stateless tickets */
+	if (ssl_session_cache > 0) {
+		SSL_CTX_set_session_cache_mode(ssl_ctx, SSL_SESS_CACHE_SERVER);
+		SSL_CTX_sess_set_cache_size(ssl_ctx, ssl_session_cache);
+		SSL_CTX_set_session_id_context(ssl_ctx,
+			(const unsigned char *)"upsd", 4);
+	} else {
+		SSL_CTX_set_session_cache_mode(ssl_ctx, SSL_SESS_CACHE_OFF);
+	}
+
+	if (ssl_session_timeout > 0) {
+		SSL_CTX_set_timeout(ssl_ctx, (long)ssl_session_timeout);
+	}
+
+#ifdef SSL_OP_NO_TICKET
+	if (!ssl_session_tickets) {
+		SSL_CTX_set_options(ssl_ctx, SSL_OP_NO_TICKET);
+#if OPENSSL_VERSION_NUMBER >= 0x10101000L
+		/* no point in sending TLSv1.3 tickets nobody can use */
+		if (ssl_session_cache <= 0) {
+			SSL_CTX_set_num_tickets(ssl_ctx, 0);
+		}
+#endif
+	}
+#endif /* SSL_OP_NO_TICKET */
+
+#ifdef SSL_OP_ENABLE_KTLS
+	/* falls back to encrypting in user space by itself if the kernel or
+	 * the negotiated cipher do not support it */
+	if (ssl_ktls) {
+		SSL_CTX_set_options(ssl_ctx, SSL_OP_ENABLE_KTLS);
+	}
+#else
+	if (ssl_ktls) {
+		upsdebugx(1, "SSL_KTLS: kernel TLS is not supported by this OpenSSL");
+	}
+#endif /* SSL_OP_ENABLE_KTLS */
+
+	upsdebugx(1, "SSL session cache: %d entries, timeout %ds, tickets %s",
+		ssl_session_cache, ssl_session_timeout,
+		ssl_session_tickets ? "enabled" : "disabled");
+
 	ssl_initialized = 1;
 
 #elif defined(WITH_NSS) /* WITH_OPENSSL */
@@ -540,14 +690,35 @@ void ssl_init(void)
 		return;
 	}
 
-	/* Default server cache config */
-	status = SSL_ConfigServerSessionIDCache(0, 0, 0, NULL);
+	/* Server session cache, zero values mean NSS defaults */
+	status = SSL_ConfigServerSessionIDCache(
+		ssl_session_cache > 0 ? ssl_session_cache : 0,
+		(PRUint32)(ssl_session_timeout > 0 ? ssl_session_timeout : 0),
+		(PRUint32)(ssl_session_timeout > 0 ? ssl_session_timeout : 0),
+		NULL);
 	if (status != SECSuccess) {
 		upslogx(LOG_ERR, "Can not initialize SSL server cache");
 		nss_error("ssl_init / SSL_ConfigServerSessionIDCache");
 		return;
 	}
 
+	if (ssl_session_cache <= 0) {
+		status = SSL_OptionSetDefault(SSL_NO_CACHE, PR_TRUE);
+		if (status != SECSuccess) {
+			upslogx(LOG_ERR, "Can not disable SSL session cache");
+			nss_error("ssl_init / SSL_OptionSetDefault(SSL_NO_CACHE)");
+			return;
+		}
+	}
+
+	status = SSL_OptionSetDefault(SSL_ENABLE_SESSION_TICKETS,
+		ssl_session_tickets ? PR_TRUE : PR_FALSE);
+	if (status != SECSuccess) {
+		upslogx(LOG_ERR, "Can not set up SSL session tickets");
+		nss_error("ssl_init / SSL_OptionSetDefault(SSL_ENABLE_SESSION_TICKETS)");
+		return;
+	}
+
 	if (!disable_weak_ssl) {
 		status = SSL_OptionSetDefault(SSL_ENABLE_SSL3, PR_TRUE);
 		if (status != SECSuccess) {
@@ -647,6 +818,34 @@ void ssl_init(void)
 #endif /* WITH_OPENSSL | WITH_NSS */
 }
 
+/* client sockets are non-blocking: tell a transient condition (TLS
+ * record not complete yet, socket buffer full) apart from real errors
+ * returns 1 and sets errno to EAGAIN if the call should be retried */
+static int ssl_would_block(nut_ctype_t *client, ssize_t ret)
+{
+	int	again = 0;
+
+#ifdef WITH_OPENSSL
+	switch (SSL_get_error(client->ssl, (int)ret)) {
+	case SSL_ERROR_WANT_READ:
+	case SSL_ERROR_WANT_WRITE:
+		again = 1;
+		break;
+	default:
+		break;
+	}
+#elif defined(WITH_NSS) /* WITH_OPENSSL */
+	NUT_UNUSED_VARIABLE(client);
+	NUT_UNUSED_VARIABLE(ret);
+	again = (PR_GetError() == PR_WOULD_BLOCK_ERROR);
+#endif /* WITH_OPENSSL | WITH_NSS */
+
+	if (again)
+		errno = EAGAIN;
+
+	return again;
+}
+
 #if (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_PUSH_POP_BESIDEFUNC) && ( (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_TYPE_LIMITS_BESIDEFUNC) || (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_TAUTOLOGICAL_CONSTANT_OUT_OF_RANGE_COMPARE_BESIDEFUNC) )
 # pragma GCC diagnostic push
 #endif
@@ -685,7 +884,8 @@ ssize_t ssl_read(nut_ctype_t *client, char *buf, size_t buflen)
 #endif /* WITH_OPENSSL | WITH_NSS */
 
 	if (ret < 1) {
-		ssl_error(client->ssl, ret);
+		if (!ssl_would_block(client, ret))
+			ssl_error(client->ssl, ret);
 		return -1;
 	}
 
@@ -722,6 +922,12 @@ ssize_t ssl_write(nut_ctype_t *client, const char *buf, size_t buflen)
 
 	upsdebugx(5, "ssl_write ret=%" PRIiSIZE, ret);
 
+	if (ret < 1) {
+		if (!ssl_would_block(client, ret))
+			ssl_error(client->ssl, ret);
+		return -1;
+	}
+
 	return ret;
 }
 #if (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_PUSH_POP_BESIDEFUNC) && ( (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_TYPE_LIMITS_BESIDEFUNC) || (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_TAUTOLOGICAL_CONSTANT_OUT_OF_RANGE_COMPARE_BESIDEFUNC) )
@@ -35,6 +35,14 @@ extern int	disable_weak_ssl;
 #ifdef WITH_CLIENT_CERTIFICATE_VALIDATION
 extern int certrequest;
 #endif /* WITH_CLIENT_CERTIFICATE_VALIDATION */
+extern int	ssl_session_cache;
+extern int	ssl_session_timeout;
+extern int	ssl_session_tickets;
+extern int	ssl_ktls;
+
+/* Defaults for SSL_SESSION_CACHE (entries) and SSL_SESSION_TIMEOUT (sec) */
+#define NETSSL_SESSION_CACHE_DEFAULT	1024
+#define NETSSL_SESSION_TIMEOUT_DEFAULT	300
 
 /* List possible values for certrequested */
 /* No request */
@@ -54,6 +62,11 @@ ssize_t ssl_write(nut_ctype_t *client, const char *buf, size_t buflen);
 
 void net_starttls(nut_ctype_t *client, size_t numarg, const char **arg);
 
+/* Resume the TLS handshake of a client when its socket is ready again;
+ * returns 1 once the session is up, 0 if more I/O is needed (the wanted
+ * event is registered with evloop_mod()), -1 if the handshake failed */
+int ssl_handshake_continue(nut_ctype_t *client);
+
 #ifdef __cplusplus
 /* *INDENT-OFF* */
 }
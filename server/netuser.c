@@ -26,6 +26,8 @@
 #include "user.h"		/* for user_checkaction */
 
 #include "netuser.h"
+#include "workers.h"
+#include "netwatch.h"
 
 /* LOGIN <ups> */
 void net_login(nut_ctype_t *client, size_t numarg, const char **arg)
@@ -38,7 +40,7 @@ void net_login(nut_ctype_t *client, size_t numarg, const char **arg)
 	}
 
 	if (client->loginups != NULL) {
-		upslogx(LOG_INFO, "Client %s@%s tried to login twice", client->username, client->addr);
+		upslogx(LOG_INFO, "Client %s@%s tried to login twice", client_username(client), client->addr);
 		send_err(client, NUT_ERR_ALREADY_LOGGED_IN);
 		return;
 	}
@@ -52,17 +54,26 @@ void net_login(nut_ctype_t *client, size_t numarg, const char **arg)
 	}
 
 	/* make sure this is a valid user */
-	if (!user_checkaction(client->username, client->password, "LOGIN")) {
+	if (!user_checkaction(client->cred, "LOGIN")) {
 		upsdebugx(3, "%s: not a valid user: %s",
-			__func__, client->username);
+			__func__, client_username(client));
 		send_err(client, NUT_ERR_ACCESS_DENIED);
 		return;
 	}
 
 	ups->numlogins++;
+	workers_changed();
+	netwatch_numlogins(ups);
 	client->loginups = xstrdup(ups->name);
 
-	upslogx(LOG_INFO, "User %s@%s logged into UPS [%s]%s", client->username, client->addr,
+	client->loginprev = NULL;
+	client->loginnext = ups->logins;
+	if (ups->logins) {
+		ups->logins->loginprev = client;
+	}
+	ups->logins = client;
+
+	upslogx(LOG_INFO, "User %s@%s logged into UPS [%s]%s", client_username(client), client->addr,
 		client->loginups, client->ssl ? " (SSL)" : "");
 	sendback(client, "OK\n");
 }
@@ -76,13 +87,13 @@ void net_logout(nut_ctype_t *client, size_t numarg, const char **arg)
 	}
 
 	if (client->loginups != NULL) {
-		upslogx(LOG_INFO, "User %s@%s logged out from UPS [%s]%s", client->username, client->addr,
+		upslogx(LOG_INFO, "User %s@%s logged out from UPS [%s]%s", client_username(client), client->addr,
 			client->loginups, client->ssl ? " (SSL)" : "");
 	}
 
 	sendback(client, "OK Goodbye\n");
 
-	client->last_heard = 0;
+	client_drop(client);
 }
 
 /* NOTE: Protocol updated since NUT 2.8.0 to handle master/primary
@@ -105,8 +116,8 @@ static int do_net_primary(nut_ctype_t *client, size_t numarg, const char **arg)
 	}
 
 	/* make sure this user is allowed to do PRIMARY or MASTER */
-	if (!user_checkaction(client->username, client->password, "PRIMARY")
-	&&  !user_checkaction(client->username, client->password, "MASTER")
+	if (!user_checkaction(client->cred, "PRIMARY")
+	&&  !user_checkaction(client->cred, "MASTER")
 	) {
 		send_err(client, NUT_ERR_ACCESS_DENIED);
 		return -1;
@@ -125,7 +136,7 @@ void net_master(nut_ctype_t *client, size_t numarg, const char **arg) {
 		"requested MASTER level for device %s - "
 		"which is deprecated in favor of PRIMARY "
 		"since NUT 2.8.0",
-		client->username, client->addr,
+		client_username(client), client->addr,
 		(numarg > 0) ? arg[0] : "<null>");
 
 	if (0 == do_net_primary(client, numarg, arg)) {
@@ -144,35 +155,41 @@ void net_primary(nut_ctype_t *client, size_t numarg, const char **arg)
 /* USERNAME <username> */
 void net_username(nut_ctype_t *client, size_t numarg, const char **arg)
 {
+	user_cred_t	*cred;
+
 	if (numarg != 1) {
 		send_err(client, NUT_ERR_INVALID_ARGUMENT);
 		return;
 	}
 
-	if (client->username != NULL) {
+	if (client_username(client) != NULL) {
 		upslogx(LOG_INFO, "Client %s@%s tried to set a username twice",
-			client->username, client->addr);
+			client_username(client), client->addr);
 
 		send_err(client, NUT_ERR_ALREADY_SET_USERNAME);
 		return;
 	}
 
-	client->username = xstrdup(arg[0]);
+	cred = user_cred_get(arg[0], client->cred ? client->cred->password : NULL);
+	user_cred_put(client->cred);
+	client->cred = cred;
 	sendback(client, "OK\n");
 }
 
 /* PASSWORD <password> */
 void net_password(nut_ctype_t *client, size_t numarg, const char **arg)
 {
+	user_cred_t	*cred;
+
 	if (numarg != 1) {
 		send_err(client, NUT_ERR_INVALID_ARGUMENT);
 		return;
 	}
 
-	if (client->password != NULL) {
-		if (client->username)
+	if (client->cred && client->cred->password != NULL) {
+		if (client_username(client))
 			upslogx(LOG_INFO, "Client %s@%s tried to set a password twice",
-				client->username, client->addr);
+				client_username(client), client->addr);
 		else
 			upslogx(LOG_INFO, "Client on %s tried to set a password twice",
 				client->addr);
@@ -181,6 +198,8 @@ void net_password(nut_ctype_t *client, size_t numarg, const char **arg)
 		return;
 	}
 
-	client->password = xstrdup(arg[0]);
+	cred = user_cred_get(client_username(client), arg[0]);
+	user_cred_put(client->cred);
+	client->cred = cred;
 	sendback(client, "OK\n");
 }
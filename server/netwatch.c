@@ -0,0 +1,274 @@
+/* netwatch.c - WATCH (server push) handlers for upsd
+
+   Copyright (C)
+	2026	Network UPS Tools developers
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#include "common.h"
+#include "nut_stdint.h"
+
+#include "upsd.h"
+#include "sstate.h"
+#include "state.h"
+#include "neterr.h"
+
+#include "netwatch.h"
+
+static void watch_free(nut_watch_t *watch)
+{
+	size_t	i;
+
+	for (i = 0; i < watch->numvars; i++) {
+		free(watch->vars[i]);
+	}
+
+	free(watch->vars);
+	free(watch);
+}
+
+/* unlink <watch> from the list of its UPS */
+static void watch_unlink_ups(nut_watch_t *watch)
+{
+	nut_watch_t	**wp;
+
+	for (wp = &watch->ups->watchers; *wp; wp = &(*wp)->next_ups) {
+		if (*wp == watch) {
+			*wp = watch->next_ups;
+			return;
+		}
+	}
+}
+
+/* unlink <watch> from the list of its client */
+static void watch_unlink_client(nut_watch_t *watch)
+{
+	nut_watch_t	**wp;
+
+	for (wp = &watch->client->watches; *wp; wp = &(*wp)->next_client) {
+		if (*wp == watch) {
+			*wp = watch->next_client;
+			return;
+		}
+	}
+}
+
+static int watch_wants(const nut_watch_t *watch, const char *var)
+{
+	size_t	i;
+
+	if (!watch->vars) {
+		return 1;
+	}
+
+	for (i = 0; i < watch->numvars; i++) {
+		if (!strcasecmp(watch->vars[i], var)) {
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+static nut_watch_t *watch_find(const nut_ctype_t *client, const upstype_t *ups)
+{
+	nut_watch_t	*watch;
+
+	for (watch = client->watches; watch; watch = watch->next_client) {
+		if (watch->ups == ups) {
+			return watch;
+		}
+	}
+
+	return NULL;
+}
+
+/* WATCH <ups> [<var>...] */
+void net_watch(nut_ctype_t *client, size_t numarg, const char **arg)
+{
+	upstype_t	*ups;
+	nut_watch_t	*watch;
+	size_t	i;
+
+	if (numarg < 1) {
+		send_err(client, NUT_ERR_INVALID_ARGUMENT);
+		return;
+	}
+
+	ups = get_ups_ptr(arg[0]);
+
+	if (!ups) {
+		send_err(client, NUT_ERR_UNKNOWN_UPS);
+		return;
+	}
+
+	/* a repeated WATCH replaces the earlier variable list */
+	watch = watch_find(client, ups);
+
+	if (watch) {
+		watch_unlink_ups(watch);
+		watch_unlink_client(watch);
+		watch_free(watch);
+	}
+
+	watch = xcalloc(1, sizeof(*watch));
+	watch->client = client;
+	watch->ups = ups;
+
+	if (numarg > 1) {
+		watch->numvars = numarg - 1;
+		watch->vars = xcalloc(watch->numvars, sizeof(*watch->vars));
+
+		for (i = 0; i < watch->numvars; i++) {
+			watch->vars[i] = xstrdup(arg[i + 1]);
+		}
+	}
+
+	watch->next_ups = ups->watchers;
+	ups->watchers = watch;
+	watch->next_client = client->watches;
+	client->watches = watch;
+
+	upsdebugx(2, "%s: client %s watches %" PRIuSIZE " variable(s) of UPS [%s]",
+		__func__, client->addr, watch->numvars, ups->name);
+
+	sendback(client, "OK WATCH %s\n", arg[0]);
+
+	/* the count as it stands, which also tells that it will be pushed */
+	if (watch->vars && watch_wants(watch, "NUMLOGINS")) {
+		sendback(client, "CHANGED %s NUMLOGINS \"%d\"\n", ups->name, ups->numlogins);
+	}
+}
+
+/* UNWATCH [<ups>] */
+void net_unwatch(nut_ctype_t *client, size_t numarg, const char **arg)
+{
+	upstype_t	*ups;
+	nut_watch_t	*watch;
+
+	if (numarg > 1) {
+		send_err(client, NUT_ERR_INVALID_ARGUMENT);
+		return;
+	}
+
+	if (numarg == 0) {
+		netwatch_client_free(client);
+		sendback(client, "OK UNWATCH\n");
+		return;
+	}
+
+	ups = get_ups_ptr(arg[0]);
+
+	if (!ups) {
+		send_err(client, NUT_ERR_UNKNOWN_UPS);
+		return;
+	}
+
+	watch = watch_find(client, ups);
+
+	if (watch) {
+		watch_unlink_ups(watch);
+		watch_unlink_client(watch);
+		watch_free(watch);
+	}
+
+	sendback(client, "OK UNWATCH %s\n", arg[0]);
+}
+
+void netwatch_notify(upstype_t *ups, const char *var)
+{
+	nut_watch_t	*watch;
+	const st_tree_t	*node;
+
+	if (!ups->watchers || !var) {
+		return;
+	}
+
+	node = sstate_getnode(ups, var);
+
+	for (watch = ups->watchers; watch; watch = watch->next_ups) {
+
+		if (!watch_wants(watch, var)) {
+			continue;
+		}
+
+		if (!node) {
+			sendback(watch->client, "DELETED %s %s\n", ups->name, var);
+			continue;
+		}
+
+		/* status is always a special case, see GET VAR */
+		if ((ups->fsd == 1) && (!strcasecmp(var, "ups.status"))) {
+			sendback(watch->client, "CHANGED %s %s \"FSD %s\"\n",
+				ups->name, node->var, node->val);
+		} else {
+			sendback(watch->client, "CHANGED %s %s \"%s\"\n",
+				ups->name, node->var, node->val);
+		}
+	}
+}
+
+void netwatch_numlogins(upstype_t *ups)
+{
+	nut_watch_t	*watch;
+
+	for (watch = ups->watchers; watch; watch = watch->next_ups) {
+		/* only asked for by name, not with all the variables */
+		if (!watch->vars || !watch_wants(watch, "NUMLOGINS")) {
+			continue;
+		}
+
+		sendback(watch->client, "CHANGED %s NUMLOGINS \"%d\"\n",
+			ups->name, ups->numlogins);
+		client_flush(watch->client);
+	}
+}
+
+void netwatch_flush(upstype_t *ups)
+{
+	nut_watch_t	*watch;
+
+	for (watch = ups->watchers; watch; watch = watch->next_ups) {
+		/* a failure marks the client to be dropped by the main loop */
+		client_flush(watch->client);
+	}
+}
+
+void netwatch_client_free(nut_ctype_t *client)
+{
+	nut_watch_t	*watch, *wnext;
+
+	for (watch = client->watches; watch; watch = wnext) {
+		wnext = watch->next_client;
+		watch_unlink_ups(watch);
+		watch_free(watch);
+	}
+
+	client->watches = NULL;
+}
+
+void netwatch_ups_free(upstype_t *ups)
+{
+	nut_watch_t	*watch, *wnext;
+
+	for (watch = ups->watchers; watch; watch = wnext) {
+		wnext = watch->next_ups;
+		watch_unlink_client(watch);
+		watch_free(watch);
+	}
+
+	ups->watchers = NULL;
+}
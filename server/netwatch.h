@@ -0,0 +1,65 @@
+/* netwatch.h - WATCH (server push) handlers for upsd
+
+   Copyright (C)
+	2026	Network UPS Tools developers
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#ifndef NUT_NETWATCH_H_SEEN
+#define NUT_NETWATCH_H_SEEN 1
+
+#include "nut_ctype.h"
+#include "upstype.h"
+
+#ifdef __cplusplus
+/* *INDENT-OFF* */
+extern "C" {
+/* *INDENT-ON* */
+#endif
+
+/* one subscription of a client to (some variables of) a UPS; it is
+ * linked both into ups->watchers and into client->watches */
+typedef struct nut_watch_s {
+	nut_ctype_t	*client;
+	upstype_t	*ups;
+	char		**vars;		/* NULL = all of them */
+	size_t		numvars;
+	struct nut_watch_s	*next_ups;
+	struct nut_watch_s	*next_client;
+} nut_watch_t;
+
+void net_watch(nut_ctype_t *client, size_t numarg, const char **arg);
+void net_unwatch(nut_ctype_t *client, size_t numarg, const char **arg);
+
+/* tell the watchers of <ups> that <var> was changed or deleted */
+void netwatch_notify(upstype_t *ups, const char *var);
+/* send out what netwatch_notify() queued for the watchers of <ups> */
+void netwatch_flush(upstype_t *ups);
+
+/* tell the clients which WATCH NUMLOGINS of <ups> that its count changed */
+void netwatch_numlogins(upstype_t *ups);
+
+/* drop subscriptions when a client disconnects or a UPS goes away */
+void netwatch_client_free(nut_ctype_t *client);
+void netwatch_ups_free(upstype_t *ups);
+
+#ifdef __cplusplus
+/* *INDENT-OFF* */
+}
+/* *INDENT-ON* */
+#endif
+
+#endif /* NUT_NETWATCH_H_SEEN */
@@ -38,6 +38,10 @@
 #endif
 
 #include "parseconf.h"
+#include "timers.h"
+#include "stats.h"
+#include "metrics.h"
+#include "user.h"
 
 #ifdef __cplusplus
 /* *INDENT-OFF* */
@@ -45,18 +49,33 @@ extern "C" {
 /* *INDENT-ON* */
 #endif
 
+/* the USERNAME given by a client, NULL if none */
+#define client_username(client)	((client)->cred ? (client)->cred->username : NULL)
+
 /* client structure */
 typedef struct nut_ctype_s {
 	char	*addr;
 	TYPE_FD_SOCK	sock_fd;
 	time_t	last_heard;
+	nut_timer_t	idle_timer;	/* CLIENT_INACTIVITY_DELAY, see client_idle() */
 	char	*loginups;
-	char	*password;
-	char	*username;
+	/* in the logins of that UPS */
+	struct nut_ctype_s	*loginprev, *loginnext;
+	user_cred_t	*cred;	/* USERNAME and PASSWORD, see user_cred_get() */
 	/* per client status info for commands and settings
 	 * (disabled by default) */
 	int	tracking;
 
+	/* counted for its address, see admit.c */
+	int	admitted;
+
+#ifndef WIN32
+	/* credentials of a peer on a "LISTEN unix:/path" socket,
+	 * if the platform can tell them; (uid_t)-1 otherwise */
+	uid_t	peer_uid;
+	gid_t	peer_gid;
+#endif	/* !WIN32 */
+
 #ifdef	WITH_OPENSSL
 	SSL	*ssl;
 #elif defined(WITH_NSS)
@@ -65,15 +84,38 @@ typedef struct nut_ctype_s {
 	void *ssl;
 #endif
 	int	ssl_connected;
+	int	ssl_handshake;	/* STARTTLS accepted, handshake not done yet */
+
+	/* outbound data collected by sendback() for the current
+	 * request(s), written out at once by client_flush();
+	 * bytes from outoff up to outlen are not sent yet */
+	char	*outbuf;
+	size_t	outoff;
+	size_t	outlen;
+	size_t	outsize;
+	int	sendq_overflow;	/* to be dropped, see SENDQUEUE_POLICY */
+	int	hangup;		/* to be dropped once outbuf is sent */
+
+	/* HTTP request state on a METRICS listener, NULL otherwise */
+	metrics_req_t	*metrics;
+
+	/* traffic of this connection, see stats.c */
+	stats_counter_t	bytes_in;
+	stats_counter_t	bytes_out;
+
+	/* WATCH subscriptions of this client, see netwatch.c */
+	struct nut_watch_s	*watches;
+
+	/* between BATCH BEGIN and BATCH END: the SET and INSTCMD held back
+	 * for each UPS, see netbatch.c */
+	int	batching;
+	struct nut_batch_s	*batches;
 
 	PCONF_CTX_t	ctx;
 
 	/* doubly linked list */
 	struct nut_ctype_s	*prev;
 	struct nut_ctype_s	*next;
-#ifdef WIN32
-	HANDLE Event;
-#endif	/* WIN32 */
 } nut_ctype_t;
 
 #ifdef __cplusplus
@@ -28,6 +28,13 @@
 #include "upsd.h"
 #include "upstype.h"
 #include "nut_stdint.h"
+#include "evloop.h"
+#include "netwatch.h"
+#include "workers.h"
+#include "metrics.h"
+#include "stateshm.h"
+#include "sockframe.h"
+#include "history.h"
 
 #include <fcntl.h>
 #include <stdio.h>
@@ -39,6 +46,91 @@
 #include <sys/un.h>
 #endif	/* !WIN32 */
 
+static void shm_update(upstype_t *ups);
+
+/* remember a change which came with SETINFO ... TRACE <usec> */
+static void trace_add(upstype_t *ups, const char *var, const char *usec)
+{
+	sstate_trace_t	*trace;
+	uint64_t	set;
+	char	*end;
+
+	if (trace_sample < 1) {
+		return;
+	}
+
+	set = (uint64_t)strtoull(usec, &end, 10);
+	if (end == usec || *end != '\0') {
+		return;
+	}
+
+	if (!ups->traces) {
+		ups->traces = xcalloc(SS_TRACE_MAX, sizeof(*ups->traces));
+	}
+
+	trace = &ups->traces[ups->tracenext];
+	ups->tracenext = (ups->tracenext + 1) % SS_TRACE_MAX;
+
+	free(trace->var);
+	trace->var = xstrdup(var);
+	trace->set = set;
+	trace->recv = ups->trace_recv;
+	trace->sent = 0;
+}
+
+static uint64_t trace_diff(uint64_t later, uint64_t earlier)
+{
+	return (later > earlier) ? later - earlier : 0;
+}
+
+/* the changes traced since the last time were written out to the WATCH
+ * clients: note when, and log one of trace_sample of them */
+static void trace_sent(upstype_t *ups)
+{
+	static unsigned long	traced = 0;
+	uint64_t	now = 0;
+	size_t	i;
+
+	if (!ups->traces) {
+		return;
+	}
+
+	for (i = 0; i < SS_TRACE_MAX; i++) {
+		sstate_trace_t	*trace = &ups->traces[i];
+
+		if (!trace->var || trace->sent) {
+			continue;
+		}
+
+		if (!now) {
+			now = state_get_timestamp_usec();
+		}
+		trace->sent = now;
+
+		if (trace_sample > 0 && ++traced % (unsigned long)trace_sample == 0) {
+			upslogx(LOG_INFO, "Trace of UPS [%s] %s: "
+				"%" PRIu64 " us from the driver to upsd, "
+				"%" PRIu64 " us in upsd",
+				ups->name, trace->var,
+				trace_diff(trace->recv, trace->set),
+				trace_diff(trace->sent, trace->recv));
+		}
+	}
+}
+
+/* forget the states kept over a reconnection, which the driver is about
+ * to send all again */
+static void sstate_resync(upstype_t *ups)
+{
+	upsdebugx(2, "%s: UPS [%s]: driver sends all the states again", __func__, ups->name);
+
+	sstate_infofree(ups);
+	sstate_cmdfree(ups);
+
+	state_setinfo(&ups->inforoot, "ups.status", "WAIT");
+	sstate_info_changed(ups, "ups.status");
+}
+
 static int parse_args(upstype_t *ups, size_t numargs, char **arg)
 {
 	if (numargs < 1)
@@ -49,27 +141,88 @@ static int parse_args(upstype_t *ups, size_t numargs, char **arg)
 		return 1;
 	}
 
+	/* the answer to DUMPSINCE, after which the driver sends just the
+	 * changes we missed (RESUME) or all again (RESYNC); the changes it
+	 * broadcasts before are among either, so they are taken as usual */
+	if (ups->resuming && !strcasecmp(arg[0], "RESUME")) {
+		upsdebugx(2, "%s: UPS [%s]: driver resumes from change %" PRIu64,
+			__func__, ups->name, ups->seq);
+		ups->resuming = 0;
+		return 1;
+	}
+
+	if (ups->resuming && !strcasecmp(arg[0], "RESYNC")) {
+		ups->resuming = 0;
+		sstate_resync(ups);
+		return 1;
+	}
+
+	/* a driver which did not know DUMPSINCE sent a whole dump over the
+	 * states kept: have it sent again without them */
+	if (ups->resuming && !strcasecmp(arg[0], "DUMPDONE")) {
+		ups->resuming = 0;
+		sstate_resync(ups);
+		free(ups->seq_epoch);
+		ups->seq_epoch = NULL;
+		sstate_sendline(ups, "DUMPALL\n");
+		return 1;
+	}
+
 	if (!strcasecmp(arg[0], "DUMPDONE")) {
 		upsdebugx(3, "%s: UPS [%s]: dump is done", __func__, ups->name);
 		ups->dumpdone = 1;
+		timer_set(&ups->timer, 0);	/* see ups_check() */
 		return 1;
 	}
 
 	if (!strcasecmp(arg[0], "DATASTALE")) {
 		upsdebugx(3, "%s: UPS [%s]: data is STALE now", __func__, ups->name);
 		ups->data_ok = 0;
+		timer_set(&ups->timer, 0);
 		return 1;
 	}
 
 	if (!strcasecmp(arg[0], "DATAOK")) {
 		upsdebugx(3, "%s: UPS [%s]: data is NOT STALE now", __func__, ups->name);
 		ups->data_ok = 1;
+		timer_set(&ups->timer, 0);
 		return 1;
 	}
 
 	if (numargs < 2)
 		return 0;
 
+	/* FRAMED <version>: records follow instead of text, see sockframe.h */
+	if (!strcasecmp(arg[0], "FRAMED")) {
+		if (atoi(arg[1]) == SOCKFRAME_VERSION) {
+			upsdebugx(2, "%s: UPS [%s]: driver sends records now", __func__, ups->name);
+			ups->framed = 1;
+		}
+		return 1;
+	}
+
+	/* SEQ <epoch> <number>: the last change the driver sent, see
+	 * sstate_connect() */
+	if (!strcasecmp(arg[0], "SEQ")) {
+		if (numargs < 3) {
+			return 0;
+		}
+		if (!ups->seq_epoch || strcmp(ups->seq_epoch, arg[1])) {
+			free(ups->seq_epoch);
+			ups->seq_epoch = xstrdup(arg[1]);
+		}
+		ups->seq = (uint64_t)strtoull(arg[2], NULL, 10);
+		return 1;
+	}
+
+	/* SHMSTATE <seq>: the states in the memory shared by the driver
+	 * changed, see stateshm.h */
+	if (!strcasecmp(arg[0], "SHMSTATE")) {
+		upsdebugx(3, "%s: UPS [%s]: shared states are at %s", __func__, ups->name, arg[1]);
+		shm_update(ups);
+		return 1;
+	}
+
 	/* FIXME: all these should return their state_...() value! */
 	/* ADDCMD <cmdname> */
 	if (!strcasecmp(arg[0], "ADDCMD")) {
@@ -85,7 +238,8 @@ static int parse_args(upstype_t *ups, size_t numargs, char **arg)
 
 	/* DELINFO <var> */
 	if (!strcasecmp(arg[0], "DELINFO")) {
-		state_delinfo(&ups->inforoot, arg[1]);
+		if (state_delinfo(&ups->inforoot, arg[1]))
+			sstate_info_changed(ups, arg[1]);
 		return 1;
 	}
 
@@ -98,9 +252,17 @@ static int parse_args(upstype_t *ups, size_t numargs, char **arg)
 		return 1;
 	}
 
-	/* SETINFO <varname> <value> */
+	/* SETINFO <varname> <value> [TRACE <usec>] */
 	if (!strcasecmp(arg[0], "SETINFO")) {
-		state_setinfo(&ups->inforoot, arg[1], arg[2]);
+		ups->stats.setinfo++;
+		if (state_setinfo(&ups->inforoot, arg[1], arg[2])) {
+			sstate_info_changed(ups, arg[1]);
+			history_record(ups, arg[1], arg[2]);
+
+			if (numargs > 4 && !strcasecmp(arg[3], "TRACE")) {
+				trace_add(ups, arg[1], arg[4]);
+			}
+		}
 		return 1;
 	}
 
@@ -152,6 +314,325 @@ static int parse_args(upstype_t *ups, size_t numargs, char **arg)
 	return 0;
 }
 
+/* Applying the shared states: records are compared with what is known
+ * already, so that only real changes go through parse_args() like the
+ * same lines from the socket would, and the LIST VAR ... SINCE time of
+ * the others is left alone; then whatever the driver no longer has is
+ * deleted, as it would have sent DELINFO, DELENUM, ... for it. */
+
+typedef struct {
+	const char	**item;
+	size_t	num, size;
+} shm_names_t;
+
+static void shm_names_add(shm_names_t *names, const char *name)
+{
+	if (names->num == names->size) {
+		names->size = names->size ? 2 * names->size : 64;
+		names->item = xrealloc(names->item, names->size * sizeof(*names->item));
+	}
+	names->item[names->num++] = name;
+}
+
+static int shm_names_has(const shm_names_t *names, const char *name, int nocase)
+{
+	size_t	i;
+
+	for (i = 0; i < names->num; i++) {
+		if (!(nocase ? strcasecmp : strcmp)(names->item[i], name)) {
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+static int shm_var_cmp(const void *a, const void *b)
+{
+	return strcasecmp(*(const char * const *)a, *(const char * const *)b);
+}
+
+/* collect the variables of the tree missing from (sorted) names */
+static void shm_tree_missing(const st_tree_t *node, const shm_names_t *vars,
+	shm_names_t *missing)
+{
+	if (!node) {
+		return;
+	}
+
+	shm_tree_missing(node->left, vars, missing);
+
+	if (!vars->num || !bsearch(&node->var, vars->item, vars->num,
+		sizeof(*vars->item), shm_var_cmp)
+	) {
+		shm_names_add(missing, node->var);
+	}
+
+	shm_tree_missing(node->right, vars, missing);
+}
+
+static void shm_names_reset(shm_names_t *names, int owned)
+{
+	size_t	i;
+
+	if (owned) {
+		for (i = 0; i < names->num; i++) {
+			free((char *)names->item[i]);
+		}
+	}
+	names->num = 0;
+}
+
+/* the records about one variable were all seen: drop what they lack;
+ * enums has the values as in the records, ranges has "<min> <max>" */
+static void shm_var_done(upstype_t *ups, char *var, const shm_names_t *enums,
+	const shm_names_t *ranges, int aux_seen, int flags_seen)
+{
+	st_tree_t	*node = state_tree_find(ups->inforoot, var);
+	const enum_t	*etmp, *enext;
+	const range_t	*rtmp, *rnext;
+	char	buf[ST_MAX_VALUE_LEN], *arg[4];
+
+	if (!node) {
+		return;
+	}
+
+	arg[1] = var;
+
+	for (etmp = node->enum_list; etmp; etmp = enext) {
+		size_t	i, len = 0;
+
+		enext = etmp->next;
+
+		/* kept escaped for the wire, see pconf_encode() */
+		for (i = 0; etmp->val[i] && len + 1 < sizeof(buf); i++) {
+			if (etmp->val[i] == '\\' && etmp->val[i + 1]) {
+				i++;
+			}
+			buf[len++] = etmp->val[i];
+		}
+		buf[len] = '\0';
+
+		if (!shm_names_has(enums, buf, 0)) {
+			arg[0] = "DELENUM";
+			arg[2] = buf;
+			parse_args(ups, 3, arg);
+		}
+	}
+
+	for (rtmp = node->range_list; rtmp; rtmp = rnext) {
+		char	min[SMALLBUF], max[SMALLBUF];
+
+		rnext = rtmp->next;
+		snprintf(buf, sizeof(buf), "%d %d", rtmp->min, rtmp->max);
+		if (!shm_names_has(ranges, buf, 0)) {
+			snprintf(min, sizeof(min), "%d", rtmp->min);
+			snprintf(max, sizeof(max), "%d", rtmp->max);
+			arg[0] = "DELRANGE";
+			arg[2] = min;
+			arg[3] = max;
+			parse_args(ups, 4, arg);
+		}
+	}
+
+	if (!aux_seen && node->aux) {
+		state_setaux(ups->inforoot, var, "0");
+	}
+
+	if (!flags_seen && (node->flags & (ST_FLAG_RW | ST_FLAG_STRING | ST_FLAG_NUMBER))) {
+		state_setflags(ups->inforoot, var, 0, NULL);
+	}
+}
+
+/* does the record tell something new about this node? */
+static int shm_record_new(const st_tree_t *node, size_t numargs, char **arg)
+{
+	const enum_t	*etmp;
+	const range_t	*rtmp;
+	char	enc[ST_MAX_VALUE_LEN];
+	size_t	i;
+	int	flags = 0;
+
+	if (!node) {
+		return 1;
+	}
+
+	if (!strcmp(arg[0], "SETINFO")) {
+		return strcmp(node->raw, arg[2]) != 0;
+	}
+
+	if (!strcmp(arg[0], "ADDENUM")) {
+		pconf_encode(arg[2], enc, sizeof(enc));
+		for (etmp = node->enum_list; etmp; etmp = etmp->next) {
+			if (!strcmp(etmp->val, enc)) {
+				return 0;
+			}
+		}
+		return 1;
+	}
+
+	if (!strcmp(arg[0], "ADDRANGE") && numargs >= 4) {
+		for (rtmp = node->range_list; rtmp; rtmp = rtmp->next) {
+			if (rtmp->min == atoi(arg[2]) && rtmp->max == atoi(arg[3])) {
+				return 0;
+			}
+		}
+		return 1;
+	}
+
+	if (!strcmp(arg[0], "SETAUX")) {
+		return node->aux != strtol(arg[2], NULL, 10);
+	}
+
+	if (!strcmp(arg[0], "SETFLAGS")) {
+		for (i = 2; i < numargs; i++) {
+			if (!strcasecmp(arg[i], "RW")) {
+				flags |= ST_FLAG_RW;
+			} else if (!strcasecmp(arg[i], "STRING")) {
+				flags |= ST_FLAG_STRING;
+			} else if (!strcasecmp(arg[i], "NUMBER")) {
+				flags |= ST_FLAG_NUMBER;
+			}
+		}
+		return (node->flags & (ST_FLAG_RW | ST_FLAG_STRING | ST_FLAG_NUMBER)) != flags;
+	}
+
+	return 1;
+}
+
+static void shm_apply(upstype_t *ups)
+{
+	shm_names_t	vars = { NULL, 0, 0 }, cmds = { NULL, 0, 0 };
+	shm_names_t	enums = { NULL, 0, 0 }, ranges = { NULL, 0, 0 };
+	shm_names_t	missing = { NULL, 0, 0 };
+	char	*arg[STATESHM_MAXARGS], *var = NULL, buf[SMALLBUF];
+	const cmdlist_t	*ctmp, *cnext;
+	st_tree_t	*node = NULL;
+	size_t	numargs, off = 0, i;
+	int	aux_seen = 0, flags_seen = 0;
+
+	while ((numargs = stateshm_next(&ups->shm, &off, arg)) > 0) {
+		if (numargs < 2) {
+			continue;
+		}
+
+		if (!strcmp(arg[0], "ADDCMD")) {
+			shm_names_add(&cmds, arg[1]);
+			parse_args(ups, numargs, arg);
+			continue;
+		}
+
+		if (numargs < 3) {
+			continue;
+		}
+
+		/* records about one variable come in a row, SETINFO first */
+		if (!strcmp(arg[0], "SETINFO")) {
+			if (var) {
+				shm_var_done(ups, var, &enums, &ranges, aux_seen, flags_seen);
+			}
+
+			var = arg[1];
+			shm_names_add(&vars, var);
+			shm_names_reset(&enums, 0);
+			shm_names_reset(&ranges, 1);
+			aux_seen = flags_seen = 0;
+
+			node = state_tree_find(ups->inforoot, var);
+		} else if (!var || strcasecmp(var, arg[1]) != 0) {
+			continue;	/* should not happen */
+		} else if (!strcmp(arg[0], "ADDENUM")) {
+			shm_names_add(&enums, arg[2]);
+		} else if (!strcmp(arg[0], "ADDRANGE") && numargs >= 4) {
+			snprintf(buf, sizeof(buf), "%d %d", atoi(arg[2]), atoi(arg[3]));
+			shm_names_add(&ranges, xstrdup(buf));
+		} else if (!strcmp(arg[0], "SETAUX")) {
+			aux_seen = 1;
+		} else if (!strcmp(arg[0], "SETFLAGS")) {
+			flags_seen = 1;
+		}
+
+		if (shm_record_new(node, numargs, arg)) {
+			parse_args(ups, numargs, arg);
+
+			if (!node) {
+				node = state_tree_find(ups->inforoot, var);
+			}
+		}
+	}
+
+	if (var) {
+		shm_var_done(ups, var, &enums, &ranges, aux_seen, flags_seen);
+	}
+
+	/* variables the driver no longer has; the records come in tree
+	 * order, but sort them to be sure of the bsearch() */
+	if (vars.num) {
+		qsort(vars.item, vars.num, sizeof(*vars.item), shm_var_cmp);
+	}
+	shm_tree_missing(ups->inforoot, &vars, &missing);
+
+	for (i = 0; i < missing.num; i++) {
+		char	*delarg[2];
+
+		/* the name goes away with the node */
+		snprintf(buf, sizeof(buf), "%s", missing.item[i]);
+		delarg[0] = "DELINFO";
+		delarg[1] = buf;
+		parse_args(ups, 2, delarg);
+	}
+
+	for (ctmp = ups->cmdlist; ctmp; ctmp = cnext) {
+		cnext = ctmp->next;
+		if (!shm_names_has(&cmds, ctmp->name, 1)) {
+			char	*delarg[2];
+
+			snprintf(buf, sizeof(buf), "%s", ctmp->name);
+			delarg[0] = "DELCMD";
+			delarg[1] = buf;
+			parse_args(ups, 2, delarg);
+		}
+	}
+
+	shm_names_reset(&ranges, 1);
+	free(vars.item);
+	free(cmds.item);
+	free(missing.item);
+	free(enums.item);
+	free(ranges.item);
+}
+
+/* a SHMSTATE doorbell rang */
+static void shm_update(upstype_t *ups)
+{
+	int	ret;
+
+	if (!ups->shm.map) {
+		char	fn[NUT_PATH_MAX + 1];
+
+		snprintf(fn, sizeof(fn), "%s%s", ups->fn, STATESHM_SUFFIX);
+		if (!stateshm_open(&ups->shm, fn)) {
+			upslog_with_errno(LOG_WARNING, "Can't read the shared states "
+				"of UPS [%s] from %s", ups->name, fn);
+			sstate_disconnect(ups);
+			return;
+		}
+	}
+
+	ret = stateshm_read(&ups->shm);
+
+	if (ret < 0) {
+		/* the next doorbell tells about a newer copy anyway */
+		upsdebugx(1, "%s: UPS [%s]: shared states not usable just now",
+			__func__, ups->name);
+		return;
+	}
+
+	if (ret > 0) {
+		shm_apply(ups);
+	}
+}
+
 /* nothing fancy - just make the driver say something back to us */
 static void sendping(upstype_t *ups)
 {
@@ -190,17 +671,51 @@ static void sendping(upstype_t *ups)
 	time(&ups->last_ping);
 }
 
+/* SEQ, and after a reconnection with the states kept (see
+ * sstate_disconnect()) DUMPSINCE for the changes missed: the DUMPALL
+ * sent after it anyway is for drivers which do not know it */
+static void sstate_seqcmd(upstype_t *ups, char *buf, size_t bufsize)
+{
+	ups->resuming = 0;
+
+	if (shared_state) {
+		snprintf(buf, bufsize, "%s", "");
+		return;
+	}
+
+	if (!ups->seq_epoch) {
+		snprintf(buf, bufsize, "SEQ\n");
+		return;
+	}
+
+	snprintf(buf, bufsize, "SEQ\nDUMPSINCE %s %" PRIu64 "\n", ups->seq_epoch, ups->seq);
+	ups->resuming = 1;
+}
+
 /* interface */
 
 TYPE_FD sstate_connect(upstype_t *ups)
 {
 	TYPE_FD	fd;
 #ifndef WIN32
-	const char	*dumpcmd = "DUMPALL\n";
-	size_t	dumpcmdlen = strlen(dumpcmd);
+	/* drivers which do not know SHMSTATE just send everything, those
+	 * which do not know FRAMED send text, and those which do not know
+	 * TRACE just send SETINFO without times */
+	char	dumpcmd[LARGEBUF], framecmd[SMALLBUF] = "", seqcmd[SMALLBUF];
+	size_t	dumpcmdlen;
 	ssize_t	ret;
 	struct sockaddr_un	sa;
 
+	if (framed_socket && !shared_state) {
+		snprintf(framecmd, sizeof(framecmd), "FRAMED %d\n", SOCKFRAME_VERSION);
+	}
+
+	sstate_seqcmd(ups, seqcmd, sizeof(seqcmd));
+	snprintf(dumpcmd, sizeof(dumpcmd), "%s%s%s%sDUMPALL\n",
+		shared_state ? "SHMSTATE\n" : "", framecmd,
+		(trace_sample > 0) ? "TRACE\n" : "", seqcmd);
+	dumpcmdlen = strlen(dumpcmd);
+
 	upsdebugx(2, "%s: preparing UNIX socket %s", __func__, NUT_STRARG(ups->fn));
 	check_unix_socket_filename(ups->fn);
 
@@ -276,10 +791,14 @@ TYPE_FD sstate_connect(upstype_t *ups)
 
 #else	/* WIN32 */
 	char pipename[NUT_PATH_MAX];
-	const char	*dumpcmd = "DUMPALL\n";
+	char	dumpcmd[LARGEBUF], seqcmd[SMALLBUF];
 	BOOL  result = FALSE;
 	DWORD bytesWritten;
 
+	sstate_seqcmd(ups, seqcmd, sizeof(seqcmd));
+	snprintf(dumpcmd, sizeof(dumpcmd), "%s%sDUMPALL\n",
+		(trace_sample > 0) ? "TRACE\n" : "", seqcmd);
+
 	upsdebugx(2, "%s: preparing Windows pipe %s", __func__, NUT_STRARG(ups->fn));
 	snprintf(pipename, sizeof(pipename), "\\\\.\\pipe\\%s", ups->fn);
 
@@ -317,15 +836,28 @@ TYPE_FD sstate_connect(upstype_t *ups)
 		return ERROR_FD;
 	}
 
-	/* Start a read IO so we could wait on the event associated with it */
-	ReadFile(fd, ups->buf,
-		sizeof(ups->buf) - 1, /*-1 to be sure to have a trailling 0 */
-		NULL, &(ups->read_overlapped));
+	/* completions of the reads started below go to the event loop */
+	if (!evloop_add_handle(fd, DRIVER, ups)) {
+		upslogx(LOG_ERR, "Can not watch the named pipe of UPS [%s]", ups->name);
+		CloseHandle(fd);
+		return ERROR_FD;
+	}
+
+	/* several reads at once, so that a burst of updates (like the reply
+	 * to DUMPALL) is not taken one small buffer per wakeup */
+	if (!pipe_reads_start(&ups->reads, fd, NULL, SS_PIPE_BUF)) {
+		upslog_with_errno(LOG_ERR, "Initial read from UPS [%s] failed", ups->name);
+		evloop_del_handle(fd);
+		CloseHandle(fd);
+		return ERROR_FD;
+	}
 #endif	/* WIN32 */
 
 	/* sstate_connect() continued for both platforms: */
 
 	pconf_init(&ups->sock_ctx, NULL);
+	ups->framed = 0;
+	ups->framelen = 0;
 
 	ups->dumpdone = 0;
 	ups->stale = 0;
@@ -333,8 +865,23 @@ TYPE_FD sstate_connect(upstype_t *ups)
 	/* now is the last time we heard something from the driver */
 	time(&ups->last_heard);
 
-	/* set ups.status to "WAIT" while waiting for the driver response to dumpcmd */
-	state_setinfo(&ups->inforoot, "ups.status", "WAIT");
+	/* unless the driver is to send just the changes we missed, the data
+	 * is about to be re-sent, older LIST VAR SINCE cursors can not be
+	 * served with a delta, and ups.status is "WAIT" for the response */
+	if (!ups->resuming) {
+		sstate_delta_reset(ups);
+		state_setinfo(&ups->inforoot, "ups.status", "WAIT");
+		sstate_info_changed(ups, "ups.status");
+	}
+
+#ifndef WIN32
+	if (!evloop_add(fd, EVLOOP_READ, DRIVER, ups)) {
+		upslogx(LOG_ERR, "Can not watch the socket of UPS [%s]", ups->name);
+		pconf_finish(&ups->sock_ctx);
+		close(fd);
+		return ERROR_FD;
+	}
+#endif	/* !WIN32 */
 
 	upslogx(LOG_INFO, "Connected to UPS [%s]: %s", ups->name, ups->fn);
 
@@ -347,67 +894,158 @@ void sstate_disconnect(upstype_t *ups)
 		return;
 	}
 
-	sstate_infofree(ups);
-	sstate_cmdfree(ups);
+	/* the states of a whole dump and the changes after it, numbered by
+	 * the driver, are kept for DUMPSINCE once we reconnect */
+	if (!ups->seq_epoch || !ups->dumpdone || shared_state) {
+		sstate_infofree(ups);
+		sstate_cmdfree(ups);
+		free(ups->seq_epoch);
+		ups->seq_epoch = NULL;
+	}
+	ups->resuming = 0;
 
 	pconf_finish(&ups->sock_ctx);
 
+	/* a driver started anew numbers its names from scratch */
+	ups->framed = 0;
+	sockframe_names_free(&ups->frame_names);
+	free(ups->framebuf);
+	ups->framebuf = NULL;
+	ups->framelen = 0;
+
+	/* a driver started anew shares its states in another file */
+	stateshm_close(&ups->shm);
+
 #ifndef WIN32
+	evloop_del(ups->sock_fd);
 	close(ups->sock_fd);
 #else	/* WIN32 */
+	pipe_reads_stop(&ups->reads);
+	evloop_del_handle(ups->sock_fd);
 	CloseHandle(ups->sock_fd);
 #endif	/* WIN32 */
 
 	ups->sock_fd = ERROR_FD;
+	workers_changed();
+	metrics_changed();
+
+	/* have ups_check() reconnect */
+	timer_set(&ups->timer, 0);
 }
 
-void sstate_readline(upstype_t *ups)
+/* feed a chunk of records from a FRAMED driver to parse_args();
+ * returns 0 after a bad record, 1 otherwise */
+static int sstate_parse_frames(upstype_t *ups, char *buf, size_t len)
 {
-	ssize_t	i, ret;
+	char	*arg[SOCKFRAME_MAXARGS], *rec;
+	size_t	reclen = 0, numargs, take;
+	int	ret;
+
+	while (len > 0) {
+		if (ups->framelen == 0) {
+			ret = sockframe_next(buf, len, &reclen);
+
+			if (ret == 0) {
+				/* the rest comes with the next read */
+				if (!ups->framebuf) {
+					ups->framebuf = xmalloc(SOCKFRAME_MAXLEN);
+				}
+				memcpy(ups->framebuf, buf, len);
+				ups->framelen = len;
+				return 1;
+			}
 
-#ifndef WIN32
-	char	buf[SMALLBUF];
+			rec = buf;
+		} else {
+			/* complete the record cut short: its length first */
+			if (ups->framelen < 2) {
+				take = 2 - ups->framelen;
+			} else if (sockframe_next(ups->framebuf, ups->framelen, &reclen) < 0) {
+				take = 0;
+			} else {
+				take = reclen - ups->framelen;
+			}
 
-	if ((!ups) || INVALID_FD(ups->sock_fd)) {
-		return;
-	}
+			if (take > len) {
+				take = len;
+			}
 
-	ret = read(ups->sock_fd, buf, sizeof(buf));
+			memcpy(ups->framebuf + ups->framelen, buf, take);
+			ups->framelen += take;
+			buf += take;
+			len -= take;
 
-	if (ret < 0) {
-		switch(errno)
+			ret = sockframe_next(ups->framebuf, ups->framelen, &reclen);
+			if (ret == 0) {
+				continue;
+			}
+
+			rec = ups->framebuf;
+			ups->framelen = 0;
+			reclen = (ret > 0) ? reclen : 0;
+		}
+
+		if (ret < 0) {
+			upslogx(LOG_NOTICE, "Bad record length from UPS [%s]", ups->name);
+			ups->stats.parse_errors++;
+			return 0;
+		}
+
+		if (rec == buf) {
+			buf += reclen;
+			len -= reclen;
+		}
+
+		switch (sockframe_decode(rec, reclen, &ups->frame_names, arg, &numargs))
 		{
-		case EINTR:
-		case EAGAIN:
-			return;
+		case 1:
+			if (parse_args(ups, numargs, arg)) {
+				time(&ups->last_heard);
+			}
+
+			/* the driver went away while being handled */
+			if (INVALID_FD(ups->sock_fd)) {
+				return 1;
+			}
+			continue;
+
+		case 0:
+			continue;	/* a name to refer to */
 
 		default:
-			upslog_with_errno(LOG_WARNING, "Read from UPS [%s] failed", ups->name);
-			sstate_disconnect(ups);
-			return;
+			upslogx(LOG_NOTICE, "Bad record from UPS [%s]", ups->name);
+			ups->stats.parse_errors++;
+			return 0;
 		}
 	}
-#else	/* WIN32 */
-	if ((!ups) || INVALID_FD(ups->sock_fd)) {
-		return;
-	}
 
-	/* FIXME? I do not see either buf filled below */
-	char *buf = ups->buf;
-	DWORD bytesRead;
-	GetOverlappedResult(ups->sock_fd, &ups->read_overlapped, &bytesRead, FALSE);
-	ret = bytesRead;
-#endif	/* WIN32 */
+	return 1;
+}
+
+/* feed a chunk read from the driver to its parser;
+ * returns 0 after a parse error, 1 otherwise */
+static int sstate_parse(upstype_t *ups, char *buf, size_t len)
+{
+	size_t	off, used;
+
+	if (ups->framed) {
+		return sstate_parse_frames(ups, buf, len);
+	}
 
-	for (i = 0; i < ret; i++) {
+	for (off = 0; off < len; off += used) {
 
-		switch (pconf_char(&ups->sock_ctx, buf[i]))
+		switch (pconf_buf(&ups->sock_ctx, buf + off, len - off, &used))
 		{
 		case 1:
 			/* set the 'last heard' time to now for later staleness checks */
 			if (parse_args(ups, ups->sock_ctx.numargs, ups->sock_ctx.arglist)) {
 				time(&ups->last_heard);
 			}
+
+			/* records follow the confirmation of FRAMED */
+			if (ups->framed) {
+				return sstate_parse_frames(ups, buf + off + used, len - off - used);
+			}
 			continue;
 
 		case 0:
@@ -416,15 +1054,159 @@ void sstate_readline(upstype_t *ups)
 		default:
 			/* parse error */
 			upslogx(LOG_NOTICE, "Parse error on sock: %s", ups->sock_ctx.errmsg);
+			ups->stats.parse_errors++;
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+void sstate_readline(upstype_t *ups)
+{
+#ifndef WIN32
+	ssize_t	ret;
+	size_t	total = 0;
+
+	if ((!ups) || INVALID_FD(ups->sock_fd)) {
+		return;
+	}
+
+	if (!ups->rbuf) {
+		ups->rbufsize = SS_RBUF_MIN;
+		ups->rbuf = xmalloc(ups->rbufsize);
+	}
+
+	/* drain the socket, so that a big DUMPALL is taken in a few wakeups
+	 * rather than SMALLBUF bytes at a time, but leave the others a turn
+	 * after SS_READ_MAX bytes (the rest is still pending next time) */
+	while (total < SS_READ_MAX) {
+		ret = read(ups->sock_fd, ups->rbuf, ups->rbufsize);
+
+		if (ret < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				break;
+			}
+
+			upslog_with_errno(LOG_WARNING, "Read from UPS [%s] failed", ups->name);
+			sstate_disconnect(ups);
 			return;
 		}
+
+		if (ret == 0) {
+			break;
+		}
+
+		if (trace_sample > 0) {
+			ups->trace_recv = state_get_timestamp_usec();
+		}
+
+		total += (size_t)ret;
+
+		if (!sstate_parse(ups, ups->rbuf, (size_t)ret)) {
+			netwatch_flush(ups);
+			trace_sent(ups);
+			return;
+		}
+
+		/* the driver went away while being handled, e.g. on a bad dump */
+		if (INVALID_FD(ups->sock_fd)) {
+			break;
+		}
+
+		/* a full buffer suggests more is coming: take it in bigger bites */
+		if ((size_t)ret == ups->rbufsize && ups->rbufsize < SS_RBUF_MAX) {
+			ups->rbufsize *= 2;
+			ups->rbuf = xrealloc(ups->rbuf, ups->rbufsize);
+		}
 	}
 
-#ifdef WIN32
-	/* Restart async read */
-	memset(ups->buf,0,sizeof(ups->buf));
-	ReadFile( ups->sock_fd, ups->buf, sizeof(ups->buf)-1,NULL, &(ups->read_overlapped)); /* -1 to be sure to have a trailing 0 */
+	if (total == 0) {
+		return;
+	}
+#else	/* WIN32 */
+	char	*buf;
+	DWORD	bytesRead;
+	int	ret;
+
+	if ((!ups) || INVALID_FD(ups->sock_fd)) {
+		return;
+	}
+
+	/* take the reads started in sstate_connect() or below which are
+	 * done, in order (a completion may be that of a later one), and
+	 * start each again once parsed; all which are done must be taken,
+	 * as their completions may have been reported already (so the rest
+	 * of one which fails to parse is dropped, and the next ones go on) */
+	while ((ret = pipe_reads_next(&ups->reads, &buf, &bytesRead)) > 0) {
+		if (trace_sample > 0) {
+			ups->trace_recv = state_get_timestamp_usec();
+		}
+
+		sstate_parse(ups, buf, (size_t)bytesRead);
+
+		/* the driver went away while being handled, e.g. on a bad dump */
+		if (INVALID_FD(ups->sock_fd)) {
+			break;
+		}
+
+		if (!pipe_reads_again(&ups->reads)) {
+			ret = -1;
+			break;
+		}
+	}
+
+	if (ret < 0) {
+		upslogx(LOG_WARNING, "Read from UPS [%s] failed", ups->name);
+		sstate_disconnect(ups);
+		return;
+	}
+#endif	/* WIN32 */
+
+	/* push the changes from this chunk to WATCH clients at once */
+	netwatch_flush(ups);
+	trace_sent(ups);
+	workers_changed();
+
+	/* the driver talks again, ups_check() can tell if data is fine */
+	if (ups->stale) {
+		timer_set(&ups->timer, 0);
+	}
+}
+
+void sstate_connfree(upstype_t *ups)
+{
+#ifndef WIN32
+	free(ups->rbuf);
+	ups->rbuf = NULL;
+	ups->rbufsize = 0;
+#else	/* WIN32 */
+	pipe_reads_free(&ups->reads);
 #endif	/* WIN32 */
+
+	stateshm_close(&ups->shm);
+
+	sockframe_names_free(&ups->frame_names);
+	free(ups->framebuf);
+	ups->framebuf = NULL;
+	ups->framelen = 0;
+
+	free(ups->seq_epoch);
+	ups->seq_epoch = NULL;
+
+	if (ups->traces) {
+		size_t	i;
+
+		for (i = 0; i < SS_TRACE_MAX; i++) {
+			free(ups->traces[i].var);
+		}
+		free(ups->traces);
+		ups->traces = NULL;
+	}
 }
 
 const char *sstate_getinfo(const upstype_t *ups, const char *var)
@@ -499,6 +1281,65 @@ void sstate_infofree(upstype_t *ups)
 	state_infofree(ups->inforoot);
 
 	ups->inforoot = NULL;
+
+	free(ups->listvar_buf);
+	ups->listvar_buf = NULL;
+	ups->listvar_len = 0;
+	ups->listvar_valid = 0;
+
+	sstate_delta_reset(ups);
+}
+
+/* forget the history used by LIST VAR ... SINCE, so that clients
+ * with an older cursor get a complete list again */
+void sstate_delta_reset(upstype_t *ups)
+{
+	size_t	i;
+
+	for (i = 0; i < ups->numdelvars; i++) {
+		free(ups->delvars[i].var);
+	}
+
+	free(ups->delvars);
+	ups->delvars = NULL;
+	ups->numdelvars = 0;
+
+	state_get_timestamp(&ups->delta_horizon);
+}
+
+/* remember that <var> was deleted, for LIST VAR ... SINCE */
+static void sstate_delvar_add(upstype_t *ups, const char *var)
+{
+	sstate_delvar_t	*dv;
+
+	if (ups->numdelvars >= SS_MAX_DELVARS) {
+		/* drop the oldest, and with it the knowledge of what
+		 * happened before it */
+		ups->delta_horizon = ups->delvars[0].when;
+		free(ups->delvars[0].var);
+		ups->numdelvars--;
+		memmove(ups->delvars, ups->delvars + 1,
+			ups->numdelvars * sizeof(*ups->delvars));
+	} else if (!ups->delvars) {
+		ups->delvars = xcalloc(SS_MAX_DELVARS, sizeof(*ups->delvars));
+	}
+
+	dv = &ups->delvars[ups->numdelvars++];
+	dv->var = xstrdup(var);
+	state_get_timestamp(&dv->when);
+}
+
+/* variable <var> was set to a new value or deleted */
+void sstate_info_changed(upstype_t *ups, const char *var)
+{
+	ups->listvar_valid = 0;
+	metrics_changed();
+
+	if (var && !state_tree_find(ups->inforoot, var)) {
+		sstate_delvar_add(ups, var);
+	}
+
+	netwatch_notify(ups, var);
 }
 
 void sstate_cmdfree(upstype_t *ups)
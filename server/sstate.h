@@ -29,6 +29,27 @@
 
 #define SS_CONNFAIL_INT 300	/* complain about a dead driver every 5 mins */
 #define SS_MAX_READ 256		/* don't let drivers tie us up in read()     */
+#define SS_MAX_DELVARS 128	/* deletions remembered for LIST VAR SINCE   */
+#define SS_RBUF_MIN SMALLBUF	/* driver socket read buffer, initial size   */
+#define SS_RBUF_MAX 65536	/* ...grown up to this while reads fill it   */
+#define SS_READ_MAX 262144	/* most bytes taken from a driver per wakeup */
+#define SS_PIPE_BUF 16384	/* WIN32: each of the reads posted on a pipe */
+#define SS_TRACE_MAX 16		/* traced changes remembered for LIST TRACE  */
+
+/* a deleted variable, as reported by LIST VAR ... SINCE */
+typedef struct sstate_delvar_s {
+	char	*var;
+	st_tree_timespec_t	when;
+} sstate_delvar_t;
+
+/* a change which the driver sent with its TRACE time, see LIST TRACE;
+ * the times are from state_get_timestamp_usec() */
+typedef struct sstate_trace_s {
+	char	*var;
+	uint64_t	set;	/* in the driver */
+	uint64_t	recv;	/* read from the driver socket */
+	uint64_t	sent;	/* written to the WATCH clients, 0 = not yet */
+} sstate_trace_t;
 
 #ifdef __cplusplus
 /* *INDENT-OFF* */
@@ -39,6 +60,7 @@ extern "C" {
 TYPE_FD sstate_connect(upstype_t *ups);
 void sstate_disconnect(upstype_t *ups);
 void sstate_readline(upstype_t *ups);
+void sstate_connfree(upstype_t *ups);
 const char *sstate_getinfo(const upstype_t *ups, const char *var);
 int sstate_getflags(const upstype_t *ups, const char *var);
 long sstate_getaux(const upstype_t *ups, const char *var);
@@ -50,6 +72,8 @@ void sstate_makerwlist(const upstype_t *ups, char *buf, size_t bufsize);
 void sstate_makeinstcmdlist_t(const upstype_t *ups, char *buf, size_t bufsize);
 int sstate_dead(upstype_t *ups, int maxage);
 void sstate_infofree(upstype_t *ups);
+void sstate_info_changed(upstype_t *ups, const char *var);
+void sstate_delta_reset(upstype_t *ups);
 void sstate_cmdfree(upstype_t *ups);
 int sstate_sendline(upstype_t *ups, const char *buf);
 const st_tree_t *sstate_getnode(const upstype_t *ups, const char *varname);
@@ -0,0 +1,419 @@
+/* stats.c - activity counters of upsd, served as server.stats.* variables
+
+   Copyright (C)
+	2026	Network UPS Tools developers
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+/* Counters are plain increments in the code paths they describe, so that
+ * keeping them costs next to nothing; they are only formatted when asked
+ * for with GET VAR <ups> server.stats.<name>, or logged by stats_dump().
+ * With WORKERS, each process keeps (and answers with) its own counters.
+ */
+
+#include "config.h" /* must be the first header */
+
+#include "common.h"
+#include "upsd.h"
+#include "upstype.h"
+#include "nut_ctype.h"
+#include "neterr.h"
+#include "evloop.h"
+#include "timers.h"
+#include "stats.h"
+
+#include <sys/time.h>
+
+/* how often the per-device SETINFO rates are updated, in seconds */
+#define STATS_RATE_PERIOD	60
+
+/* service time histogram: bucket i counts requests served in less than
+ * 10^(i+1) microseconds, the last one anything slower */
+#define STATS_HIST_BUCKETS	8
+
+static const char	*hist_labels[STATS_HIST_BUCKETS] = {
+	"10us", "100us", "1ms", "10ms", "100ms", "1s", "10s", "inf"
+};
+
+typedef struct {
+	const char	*name;	/* netcmds[] entry, NULL if not seen yet */
+	stats_counter_t	count;
+	stats_counter_t	usec;
+	stats_counter_t	hist[STATS_HIST_BUCKETS];
+} stats_cmd_t;
+
+static time_t	started = 0;
+static stats_counter_t	wakeups = 0, timeouts = 0;
+static stats_counter_t	bytes_in = 0, bytes_out = 0;
+static stats_counter_t	unknown_cmds = 0;
+static long	clients = 0;
+static stats_counter_t	rejected = 0, deferred = 0;
+
+/* indexed by netcmds[] position */
+static stats_cmd_t	*cmds = NULL;
+static size_t	ncmds = 0;
+
+static nut_timer_t	rate_timer;
+static time_t	rate_mark = 0;
+
+uint64_t stats_now_usec(void)
+{
+#if defined(HAVE_CLOCK_GETTIME) && defined(HAVE_CLOCK_MONOTONIC) && HAVE_CLOCK_GETTIME && HAVE_CLOCK_MONOTONIC
+	struct timespec	now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000 + (uint64_t)(now.tv_nsec / 1000);
+#else
+	struct timeval	now;
+
+	gettimeofday(&now, NULL);
+	return (uint64_t)now.tv_sec * 1000000 + (uint64_t)now.tv_usec;
+#endif
+}
+
+static void rate_update(void *data)
+{
+	upstype_t	*ups;
+	time_t	now;
+	double	elapsed;
+
+	NUT_UNUSED_VARIABLE(data);
+
+	time(&now);
+	elapsed = difftime(now, rate_mark);
+
+	if (elapsed > 0) {
+		for (ups = firstups; ups; ups = ups->next) {
+			ups->stats.setinfo_rate =
+				(double)(ups->stats.setinfo - ups->stats.setinfo_mark) / elapsed;
+			ups->stats.setinfo_mark = ups->stats.setinfo;
+		}
+	}
+
+	rate_mark = now;
+	timer_set(&rate_timer, now + STATS_RATE_PERIOD);
+}
+
+void stats_init(void)
+{
+	time(&started);
+	rate_mark = started;
+
+	timer_init(&rate_timer, rate_update, NULL);
+	timer_set(&rate_timer, started + STATS_RATE_PERIOD);
+}
+
+void stats_free(void)
+{
+	timer_cancel(&rate_timer);
+
+	free(cmds);
+	cmds = NULL;
+	ncmds = 0;
+}
+
+void stats_command(size_t cmdnum, const char *name, uint64_t usec)
+{
+	stats_cmd_t	*cmd;
+	uint64_t	limit = 10;
+	size_t	i;
+
+	if (cmdnum >= ncmds) {
+		cmds = xrealloc(cmds, (cmdnum + 1) * sizeof(*cmds));
+		memset(cmds + ncmds, 0, (cmdnum + 1 - ncmds) * sizeof(*cmds));
+		ncmds = cmdnum + 1;
+	}
+
+	cmd = &cmds[cmdnum];
+	cmd->name = name;
+	cmd->count++;
+	cmd->usec += usec;
+
+	for (i = 0; i < STATS_HIST_BUCKETS - 1 && usec >= limit; i++) {
+		limit *= 10;
+	}
+	cmd->hist[i]++;
+}
+
+void stats_unknown_command(void)
+{
+	unknown_cmds++;
+}
+
+void stats_client_count(int delta)
+{
+	clients += delta;
+}
+
+void stats_client_rejected(void)
+{
+	rejected++;
+}
+
+void stats_client_deferred(size_t count)
+{
+	deferred += count;
+}
+
+void stats_client_io(nut_ctype_t *client, size_t in, size_t out)
+{
+	client->bytes_in += in;
+	client->bytes_out += out;
+	bytes_in += in;
+	bytes_out += out;
+}
+
+void stats_wakeup(int ready)
+{
+	wakeups++;
+	if (ready == 0) {
+		timeouts++;
+	}
+}
+
+static const stats_cmd_t *cmd_find(const char *name, size_t len)
+{
+	size_t	i;
+
+	for (i = 0; i < ncmds; i++) {
+		if (cmds[i].name && strlen(cmds[i].name) == len
+		 && !strncasecmp(cmds[i].name, name, len)
+		) {
+			return &cmds[i];
+		}
+	}
+
+	return NULL;
+}
+
+static void hist_format(const stats_cmd_t *cmd, char *buf, size_t bufsize)
+{
+	size_t	i, len = 0;
+
+	buf[0] = '\0';
+	for (i = 0; i < STATS_HIST_BUCKETS && len < bufsize; i++) {
+		len += (size_t)snprintf(buf + len, bufsize - len, "%s%s=%" PRIu64,
+			i ? " " : "", hist_labels[i], cmd ? cmd->hist[i] : 0);
+	}
+}
+
+/* server.stats.cmd.<NAME>.<count|usec|hist>, returns 0 if no such name */
+static int cmd_var(const char *name, char *val, size_t valsize)
+{
+	const char	*field = strrchr(name, '.');
+	const stats_cmd_t	*cmd;
+
+	if (!field || field == name) {
+		return 0;
+	}
+
+	/* commands not issued yet exist all the same, with zeroes */
+	cmd = cmd_find(name, (size_t)(field - name));
+	field++;
+
+	if (!strcasecmp(field, "count")) {
+		snprintf(val, valsize, "%" PRIu64, cmd ? cmd->count : 0);
+	} else if (!strcasecmp(field, "usec")) {
+		snprintf(val, valsize, "%" PRIu64, cmd ? cmd->usec : 0);
+	} else if (!strcasecmp(field, "hist")) {
+		hist_format(cmd, val, valsize);
+	} else {
+		return 0;
+	}
+
+	return 1;
+}
+
+/* server.stats.mem.<tag>.<live|peak|allocs|bytes> of nut_mem_tags(), or
+ * mem.heap.<live|peak>; returns 0 if no such name */
+static int mem_var(const char *name, char *val, size_t valsize)
+{
+	const char	*field = strrchr(name, '.');
+	const nut_mem_tag_t	*tag;
+	size_t	len;
+
+	if (!field || field == name) {
+		return 0;
+	}
+
+	len = (size_t)(field - name);
+	field++;
+
+	if (len == 4 && !strncasecmp(name, "heap", 4)) {
+		size_t	heap, peak;
+
+		heap = nut_mem_heap(&peak);
+		if (!strcasecmp(field, "live")) {
+			snprintf(val, valsize, "%" PRIuSIZE, heap);
+		} else if (!strcasecmp(field, "peak")) {
+			snprintf(val, valsize, "%" PRIuSIZE, peak);
+		} else {
+			return 0;
+		}
+		return 1;
+	}
+
+	for (tag = nut_mem_tags(); tag; tag = tag->next) {
+		if (strlen(tag->name) == len && !strncasecmp(tag->name, name, len)) {
+			break;
+		}
+	}
+
+	if (!tag) {
+		return 0;
+	}
+
+	if (!strcasecmp(field, "allocs")) {
+		snprintf(val, valsize, "%" PRIu64, tag->allocs);
+	} else if (!strcasecmp(field, "bytes")) {
+		snprintf(val, valsize, "%" PRIu64, tag->bytes);
+	} else if (tag->nofree) {
+		return 0;
+	} else if (!strcasecmp(field, "live")) {
+		snprintf(val, valsize, "%" PRIuSIZE, tag->live);
+	} else if (!strcasecmp(field, "peak")) {
+		snprintf(val, valsize, "%" PRIuSIZE, tag->peak);
+	} else {
+		return 0;
+	}
+
+	return 1;
+}
+
+void stats_get_var(nut_ctype_t *client, const char *upsname, const char *var)
+{
+	const char	*name = var + strlen("server.stats.");
+	char	val[SMALLBUF];
+	time_t	now;
+
+	time(&now);
+
+	if (!strcasecmp(name, "uptime")) {
+		snprintf(val, sizeof(val), "%.0f", difftime(now, started));
+	} else if (!strcasecmp(name, "fds")) {
+		snprintf(val, sizeof(val), "%" PRIuSIZE, evloop_count());
+	} else if (!strcasecmp(name, "clients")) {
+		snprintf(val, sizeof(val), "%ld", clients);
+	} else if (!strcasecmp(name, "clients.rejected")) {
+		snprintf(val, sizeof(val), "%" PRIu64, rejected);
+	} else if (!strcasecmp(name, "clients.deferred")) {
+		snprintf(val, sizeof(val), "%" PRIu64, deferred);
+	} else if (!strcasecmp(name, "wakeups")) {
+		snprintf(val, sizeof(val), "%" PRIu64, wakeups);
+	} else if (!strcasecmp(name, "timeouts")) {
+		snprintf(val, sizeof(val), "%" PRIu64, timeouts);
+	} else if (!strcasecmp(name, "bytes.in")) {
+		snprintf(val, sizeof(val), "%" PRIu64, bytes_in);
+	} else if (!strcasecmp(name, "bytes.out")) {
+		snprintf(val, sizeof(val), "%" PRIu64, bytes_out);
+	} else if (!strcasecmp(name, "client.bytes.in")) {
+		snprintf(val, sizeof(val), "%" PRIu64, client->bytes_in);
+	} else if (!strcasecmp(name, "client.bytes.out")) {
+		snprintf(val, sizeof(val), "%" PRIu64, client->bytes_out);
+	} else if (!strcasecmp(name, "cmd.unknown")) {
+		snprintf(val, sizeof(val), "%" PRIu64, unknown_cmds);
+	} else if (!strncasecmp(name, "cmd.", 4)) {
+		if (!cmd_var(name + 4, val, sizeof(val))) {
+			send_err(client, NUT_ERR_VAR_NOT_SUPPORTED);
+			return;
+		}
+	} else if (!strncasecmp(name, "mem.", 4)) {
+		if (!mem_var(name + 4, val, sizeof(val))) {
+			send_err(client, NUT_ERR_VAR_NOT_SUPPORTED);
+			return;
+		}
+	} else if (!strncasecmp(name, "ups.", 4)) {
+		/* the device is the one named in the request */
+		const upstype_t	*ups = get_ups_ptr(upsname);
+
+		if (!ups) {
+			send_err(client, NUT_ERR_UNKNOWN_UPS);
+			return;
+		}
+
+		if (!strcasecmp(name + 4, "setinfo")) {
+			snprintf(val, sizeof(val), "%" PRIu64, ups->stats.setinfo);
+		} else if (!strcasecmp(name + 4, "setinfo.rate")) {
+			snprintf(val, sizeof(val), "%.2f", ups->stats.setinfo_rate);
+		} else if (!strcasecmp(name + 4, "parse_errors")) {
+			snprintf(val, sizeof(val), "%" PRIu64, ups->stats.parse_errors);
+		} else {
+			send_err(client, NUT_ERR_VAR_NOT_SUPPORTED);
+			return;
+		}
+	} else {
+		send_err(client, NUT_ERR_VAR_NOT_SUPPORTED);
+		return;
+	}
+
+	sendback(client, "VAR %s %s \"%s\"\n", upsname, var, val);
+}
+
+void stats_dump(void)
+{
+	const nut_mem_tag_t	*tag;
+	const upstype_t	*ups;
+	const nut_ctype_t	*client;
+	char	hist[SMALLBUF];
+	time_t	now;
+	size_t	i;
+
+	time(&now);
+
+	upslogx(LOG_INFO, "Statistics: up %.0f seconds, %" PRIuSIZE " descriptors, "
+		"%ld clients (%" PRIu64 " rejected, %" PRIu64 " reads deferred), "
+		"%" PRIu64 " wakeups (%" PRIu64 " timeouts), "
+		"%" PRIu64 " bytes in, %" PRIu64 " bytes out, %" PRIu64 " unknown commands",
+		difftime(now, started), evloop_count(), clients, rejected, deferred,
+		wakeups, timeouts, bytes_in, bytes_out, unknown_cmds);
+
+	for (i = 0; i < ncmds; i++) {
+		if (!cmds[i].name) {
+			continue;
+		}
+
+		hist_format(&cmds[i], hist, sizeof(hist));
+		upslogx(LOG_INFO, "Statistics: command %s: %" PRIu64 " requests, "
+			"%" PRIu64 " us in total, %s",
+			cmds[i].name, cmds[i].count, cmds[i].usec, hist);
+	}
+
+	for (tag = nut_mem_tags(); mem_stats && tag; tag = tag->next) {
+		if (tag->nofree) {
+			upslogx(LOG_INFO, "Statistics: memory %s: %" PRIu64 " allocations, "
+				"%" PRIu64 " bytes in total",
+				tag->name, tag->allocs, tag->bytes);
+		} else {
+			upslogx(LOG_INFO, "Statistics: memory %s: %" PRIuSIZE " bytes held "
+				"(%" PRIuSIZE " at most), %" PRIu64 " allocations",
+				tag->name, tag->live, tag->peak, tag->allocs);
+		}
+	}
+
+	for (ups = firstups; ups; ups = ups->next) {
+		upslogx(LOG_INFO, "Statistics: UPS [%s]: %" PRIu64 " SETINFO "
+			"(%.2f per second), %" PRIu64 " parse errors",
+			ups->name, ups->stats.setinfo, ups->stats.setinfo_rate,
+			ups->stats.parse_errors);
+	}
+
+	for (client = firstclient; client; client = client->next) {
+		upslogx(LOG_INFO, "Statistics: client %s (%s): "
+			"%" PRIu64 " bytes in, %" PRIu64 " bytes out",
+			client->addr, client_username(client) ? client_username(client) : "-",
+			client->bytes_in, client->bytes_out);
+	}
+}
@@ -0,0 +1,76 @@
+/* stats.h - activity counters of upsd, served as server.stats.* variables
+
+   Copyright (C)
+	2026	Network UPS Tools developers
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#ifndef NUT_STATS_H_SEEN
+#define NUT_STATS_H_SEEN 1
+
+#include "nut_stdint.h"
+
+#ifdef __cplusplus
+/* *INDENT-OFF* */
+extern "C" {
+/* *INDENT-ON* */
+#endif
+
+typedef uint64_t	stats_counter_t;
+
+/* per-device counters, embedded in upstype_t */
+typedef struct {
+	stats_counter_t	setinfo;	/* SETINFO lines from the driver */
+	stats_counter_t	parse_errors;	/* lines the parser rejected */
+	stats_counter_t	setinfo_mark;	/* "setinfo" at the last rate update */
+	double		setinfo_rate;	/* per second, over the last period */
+} stats_ups_t;
+
+struct nut_ctype_s;
+
+/* clock for service times, in microseconds from an arbitrary origin */
+uint64_t stats_now_usec(void);
+
+void stats_init(void);
+void stats_free(void);
+
+/* a netcmds[] entry (or none, for an unknown command) served a request */
+void stats_command(size_t cmdnum, const char *name, uint64_t usec);
+void stats_unknown_command(void);
+
+/* client connections and their traffic */
+void stats_client_count(int delta);
+void stats_client_rejected(void);
+/* reads of lower lanes put off to a later iteration, see mainloop() */
+void stats_client_deferred(size_t count);
+void stats_client_io(struct nut_ctype_s *client, size_t in, size_t out);
+
+/* the main loop woke up with "ready" descriptors (0 on timeout) */
+void stats_wakeup(int ready);
+
+/* answer GET VAR <ups> server.stats.<name> */
+void stats_get_var(struct nut_ctype_s *client, const char *upsname, const char *var);
+
+/* log all counters, e.g. on SIGUSR1 */
+void stats_dump(void);
+
+#ifdef __cplusplus
+/* *INDENT-OFF* */
+}
+/* *INDENT-ON* */
+#endif
+
+#endif	/* NUT_STATS_H_SEEN */
@@ -45,9 +45,9 @@ typedef struct stype_s {
 	char	*addr;
 	char	*port;
 	TYPE_FD_SOCK	sock_fd;
-#ifdef WIN32
-	HANDLE  Event;
-#endif	/* WIN32 */
+	TYPE_FD_SOCK	*worker_fds;	/* SO_REUSEPORT siblings, see workers_listen() */
+	int	metrics;	/* METRICS (HTTP) listener, see metrics.c */
+	int	inherited;	/* passed by a service manager, see listen_inherited() */
 	struct stype_s	*next;
 } stype_t;
 
@@ -0,0 +1,194 @@
+/* timers.c - deadlines for upsd housekeeping, kept in a min-heap
+
+   Copyright (C)
+	2026	Network UPS Tools developers
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+/* The main loop used to look at every client and every driver on each
+ * iteration, to find the few which were idle or silent for too long.
+ * Instead, each of those keeps a timer here, and the heap tells which
+ * deadline comes next; that also tells how long the loop may sleep.
+ *
+ * Timers are meant to be cheap to leave alone: e.g. a client timer is
+ * not moved when the client talks, but on expiry the callback checks
+ * the real last activity and re-arms itself if it was not idle.
+ */
+
+#include "config.h" /* must be the first header */
+
+#include "common.h"
+#include "timers.h"
+
+#include <sys/time.h>
+
+/* 1-based binary heap of armed timers, ordered by due time */
+static nut_timer_t	**heap = NULL;
+static size_t	heaplen = 0, heapsize = 0;
+
+static void heap_put(size_t idx, nut_timer_t *timer)
+{
+	heap[idx] = timer;
+	timer->heapidx = idx;
+}
+
+static void heap_up(size_t idx)
+{
+	nut_timer_t	*timer = heap[idx];
+
+	while (idx > 1 && heap[idx / 2]->due > timer->due) {
+		heap_put(idx, heap[idx / 2]);
+		idx /= 2;
+	}
+
+	heap_put(idx, timer);
+}
+
+static void heap_down(size_t idx)
+{
+	nut_timer_t	*timer = heap[idx];
+
+	for (;;) {
+		size_t	child = idx * 2;
+
+		if (child > heaplen)
+			break;
+
+		if (child < heaplen && heap[child + 1]->due < heap[child]->due)
+			child++;
+
+		if (heap[child]->due >= timer->due)
+			break;
+
+		heap_put(idx, heap[child]);
+		idx = child;
+	}
+
+	heap_put(idx, timer);
+}
+
+void timer_init(nut_timer_t *timer, nut_timer_cb_t cb, void *data)
+{
+	timer->due = 0;
+	timer->heapidx = 0;
+	timer->cb = cb;
+	timer->data = data;
+}
+
+int timer_armed(const nut_timer_t *timer)
+{
+	return (timer->heapidx != 0);
+}
+
+void timer_set(nut_timer_t *timer, time_t due)
+{
+	if (timer_armed(timer)) {
+		time_t	was = timer->due;
+
+		timer->due = due;
+		if (due < was) {
+			heap_up(timer->heapidx);
+		} else {
+			heap_down(timer->heapidx);
+		}
+		return;
+	}
+
+	if (heaplen + 1 >= heapsize) {
+		heapsize = heapsize ? heapsize * 2 : 64;
+		heap = xrealloc(heap, heapsize * sizeof(*heap));
+	}
+
+	timer->due = due;
+	heaplen++;
+	heap_put(heaplen, timer);
+	heap_up(heaplen);
+}
+
+void timer_cancel(nut_timer_t *timer)
+{
+	size_t	idx = timer->heapidx;
+	nut_timer_t	*last;
+
+	if (!idx)
+		return;
+
+	timer->heapidx = 0;
+	last = heap[heaplen--];
+
+	if (last == timer)
+		return;
+
+	/* move the last one into the hole, then let it find its place */
+	heap_put(idx, last);
+	if (idx > 1 && heap[idx / 2]->due > last->due) {
+		heap_up(idx);
+	} else {
+		heap_down(idx);
+	}
+}
+
+int timers_next_ms(int maxwait)
+{
+	struct timeval	now;
+	double	ms;
+
+	if (!heaplen)
+		return maxwait;
+
+	gettimeofday(&now, NULL);
+
+	/* deadlines have a one second resolution, like time() */
+	ms = ((double)heap[1]->due - (double)now.tv_sec) * 1000.0
+		- (double)now.tv_usec / 1000.0;
+
+	if (ms <= 0)
+		return 0;
+
+	if (ms >= (double)maxwait)
+		return maxwait;
+
+	return (int)ms + 1;
+}
+
+void timers_run(void)
+{
+	time_t	now;
+
+	time(&now);
+
+	while (heaplen && heap[1]->due <= now) {
+		nut_timer_t	*timer = heap[1];
+
+		/* disarm first, the callback may well set it again */
+		timer_cancel(timer);
+		timer->cb(timer->data);
+	}
+}
+
+void timers_free(void)
+{
+	size_t	i;
+
+	for (i = 1; i <= heaplen; i++) {
+		heap[i]->heapidx = 0;
+	}
+
+	free(heap);
+	heap = NULL;
+	heaplen = 0;
+	heapsize = 0;
+}
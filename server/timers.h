@@ -0,0 +1,65 @@
+/* timers.h - deadlines for upsd housekeeping, kept in a min-heap
+
+   Copyright (C)
+	2026	Network UPS Tools developers
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#ifndef NUT_TIMERS_H_SEEN
+#define NUT_TIMERS_H_SEEN 1
+
+#include <time.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+/* *INDENT-OFF* */
+extern "C" {
+/* *INDENT-ON* */
+#endif
+
+typedef void (*nut_timer_cb_t)(void *data);
+
+/* A timer is embedded in the object it works for (client, UPS...);
+ * the callback may re-arm it, or free the object after cancelling it */
+typedef struct nut_timer_s {
+	time_t		due;
+	size_t		heapidx;	/* position in the heap, 0 if not armed */
+	nut_timer_cb_t	cb;
+	void		*data;
+} nut_timer_t;
+
+void timer_init(nut_timer_t *timer, nut_timer_cb_t cb, void *data);
+
+/* arm (or move) a timer to fire once "due" has come, which may be
+ * in the past to have it fire on the next timers_run() */
+void timer_set(nut_timer_t *timer, time_t due);
+void timer_cancel(nut_timer_t *timer);
+int timer_armed(const nut_timer_t *timer);
+
+/* milliseconds until the earliest deadline, at most "maxwait" */
+int timers_next_ms(int maxwait);
+
+/* call back the timers whose deadline has come */
+void timers_run(void);
+void timers_free(void);
+
+#ifdef __cplusplus
+/* *INDENT-OFF* */
+}
+/* *INDENT-ON* */
+#endif
+
+#endif	/* NUT_TIMERS_H_SEEN */
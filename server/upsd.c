@@ -33,9 +33,13 @@
 #include "netcmds.h"
 #include "upsconf.h"
 
+#include <ctype.h>
+
 #ifndef WIN32
 # include <sys/un.h>
 # include <sys/socket.h>
+# include <netinet/in.h>
+# include <netinet/tcp.h>	/* TCP_NODELAY */
 # include <netdb.h>
 
 # ifdef HAVE_SYS_SIGNAL_H
@@ -65,6 +69,15 @@
 #include "sstate.h"
 #include "desc.h"
 #include "neterr.h"
+#include "evloop.h"
+#include "netwatch.h"
+#include "timers.h"
+#include "workers.h"
+#include "stats.h"
+#include "metrics.h"
+#include "history.h"
+#include "admit.h"
+#include "nut_probes.h"
 
 #ifdef HAVE_WRAP
 #include <tcpd.h>
@@ -82,6 +95,31 @@ int	maxage = 15;
 /* default to 1h before cleaning up status tracking entries */
 int	tracking_delay = 3600;
 
+/* default 60 seconds before idle clients are disconnected */
+int	client_inactivity_delay = 60;
+
+/* retry connections to drivers this often (seconds) */
+#define UPS_RECONNECT_DELAY	2
+
+/* longest sleep of the main loop even if no timer is due (milliseconds),
+ * for the service watchdog and to notice signals on all platforms */
+#define MAINLOOP_MAX_WAIT	2000
+
+/* Requests of clients are served by lanes, one after the other in each
+ * iteration of the main loop: those of upsmon (logged into a UPS) first,
+ * along with the drivers and everything else, then those of clients which
+ * gave a USERNAME and PASSWORD, and the anonymous ones last. The lower
+ * lanes read from at most so many clients in one iteration, the others
+ * stay ready for the next one (not on WIN32, whose completion port would
+ * not tell about them again), so that bulk readers do not hold up FSD and
+ * status polls during a power event. */
+#define CLIENT_LANE_CRITICAL	0
+#define CLIENT_LANE_ADMIN	1
+#define CLIENT_LANE_READER	2
+#define CLIENT_LANES	3
+
+static const size_t	client_lane_budget[CLIENT_LANES] = { 0 /* all */, 64, 32 };
+
 /*
  * Preloaded to ALLOW_NO_DEVICE from upsd.conf or environment variable
  * (with higher prio for envvar); defaults to disabled for legacy compat.
@@ -94,9 +132,32 @@ int allow_no_device = 0;
  */
 int allow_not_all_listeners = 0;
 
+/* read the device states from memory shared by the drivers (SHARED_STATE) */
+int shared_state = 0;
+
+/* have the drivers send records rather than text (FRAMED_SOCKET) */
+int framed_socket = 0;
+
+/* have the drivers TRACE their changes, logging one of this many (TRACE) */
+int trace_sample = 0;
+
+/* count allocations, and tell the memory held in the statistics (MEMSTATS) */
+int mem_stats = 0;
+
 /* preloaded to {OPEN_MAX} in main, can be overridden via upsd.conf */
 nfds_t	maxconn = 0;
 
+/* see MAXCONN_PER_ADDR and ACCEPT_RATE in upsd.conf, 0 for no limit */
+size_t	maxconn_per_addr = 0;
+double	accept_rate = 0;
+size_t	accept_burst = 0;
+
+/* default to 1 MiB of unsent answers per client, see MAXSENDQUEUE */
+size_t	sendq_max = 1048576;
+
+/* see SENDQUEUE_POLICY in upsd.conf */
+sendq_policy_t	sendq_policy = SENDQ_POLICY_DISCONNECT;
+
 /* preloaded to STATEPATH in main, can be overridden via upsd.conf */
 char	*statepath = NULL;
 
@@ -109,25 +170,23 @@ static const char	*progname;
 nut_ctype_t	*firstclient = NULL;
 /* static nut_ctype_t	*lastclient = NULL; */
 
-/* default is to listen on all local interfaces */
-static stype_t	*firstaddr = NULL;
+/* structures of gone clients, for the next ones: connections come and go
+ * in bursts (see admit.c), and idle ones should not be scattered over
+ * the heap */
+#define CLIENT_POOL_MAX	256
+static nut_ctype_t	*client_pool = NULL;
+static size_t	client_pooled = 0;
 
-static int 	opt_af = AF_UNSPEC;
+/* parser memory kept by a client between requests, see client_input() */
+#define CLIENT_PCONF_KEEP	512
 
-typedef enum {
-	DRIVER = 1,
-	CLIENT,
-	SERVER
-#ifdef WIN32
-	,NAMED_PIPE
-#endif	/* WIN32 */
+/* default is to listen on all local interfaces */
+static stype_t	*firstaddr = NULL;
 
-} handler_type_t;
+/* METRICS listeners, apart from the LISTEN ones: see metrics.c */
+static stype_t	*firstmetrics = NULL;
 
-typedef struct {
-	handler_type_t	type;
-	void		*data;
-} handler_t;
+static int 	opt_af = AF_UNSPEC;
 
 /* Commands and settings status tracking */
 
@@ -142,27 +201,32 @@ typedef struct tracking_s {
 	char	*id;
 	int	status;
 	time_t	request_time; /* for cleanup */
-	/* doubly linked list */
+	/* doubly linked list, oldest first: as all entries are kept for
+	 * the same tracking_delay, this is also their expiry order */
 	struct tracking_s	*prev;
 	struct tracking_s	*next;
+	struct tracking_s	*hnext;	/* chain in tracking_index */
 } tracking_t;
 
-static tracking_t	*tracking_list = NULL;
+static tracking_t	*tracking_list = NULL, *tracking_last = NULL;
 
-#ifndef WIN32
-	/* pollfd  */
-static struct pollfd	*fds = NULL;
-#else	/* WIN32 */
-static HANDLE		*fds = NULL;
+/* index of tracking_list by (case-insensitive) id, the bucket count
+ * is a power of two which grows with the number of entries */
+static tracking_t	**tracking_index = NULL;
+static size_t	tracking_index_size = 0, tracking_count = 0;
+
+/* fires when the oldest tracking entry is due for cleanup */
+static nut_timer_t	tracking_timer;
+
+#ifdef WIN32
 static HANDLE		mutex = INVALID_HANDLE_VALUE;
 #endif	/* WIN32 */
-static handler_t	*handler = NULL;
 
 	/* pid file */
 static char	pidfn[NUT_PATH_MAX];
 
 	/* set by signal handlers */
-static int	reload_flag = 0, exit_flag = 0;
+static int	reload_flag = 0, exit_flag = 0, stats_flag = 0;
 
 /* Minimalistic support for UUID v4 */
 /* Ref: RFC 4122 https://tools.ietf.org/html/rfc4122#section-4.1.2 */
@@ -172,6 +236,74 @@ static int	reload_flag = 0, exit_flag = 0;
 # define SERVICE_UNIT_NAME "nut-server.service"
 #endif
 
+/* index of firstups by (case-insensitive) name, kept by ups_index_add()
+ * and ups_index_del(); the bucket count is a power of two */
+static upstype_t	**ups_index = NULL;
+static size_t	ups_index_size = 0, ups_index_count = 0;
+
+static void ups_index_grow(void)
+{
+	upstype_t	**old = ups_index, *ups, *unext;
+	size_t	oldsize = ups_index_size, i;
+
+	ups_index_size = oldsize ? oldsize * 2 : 64;
+	ups_index = xcalloc(ups_index_size, sizeof(*ups_index));
+
+	for (i = 0; i < oldsize; i++) {
+		for (ups = old[i]; ups; ups = unext) {
+			size_t	b = str_hash_nocase(ups->name) & (ups_index_size - 1);
+
+			unext = ups->hnext;
+			ups->hnext = ups_index[b];
+			ups_index[b] = ups;
+		}
+	}
+
+	free(old);
+}
+
+/* register a new entry of firstups for get_ups_ptr() */
+void ups_index_add(upstype_t *ups)
+{
+	size_t	b;
+
+	/* keep the chains short */
+	if (ups_index_count >= ups_index_size)
+		ups_index_grow();
+
+	b = str_hash_nocase(ups->name) & (ups_index_size - 1);
+	ups->hnext = ups_index[b];
+	ups_index[b] = ups;
+	ups_index_count++;
+}
+
+/* forget an entry of firstups before it is freed */
+void ups_index_del(upstype_t *ups)
+{
+	upstype_t	**pp;
+
+	if (!ups_index)
+		return;
+
+	pp = &ups_index[str_hash_nocase(ups->name) & (ups_index_size - 1)];
+	for (; *pp; pp = &(*pp)->hnext) {
+		if (*pp == ups) {
+			*pp = ups->hnext;
+			ups->hnext = NULL;
+			ups_index_count--;
+			return;
+		}
+	}
+}
+
+static void ups_index_free(void)
+{
+	free(ups_index);
+	ups_index = NULL;
+	ups_index_size = 0;
+	ups_index_count = 0;
+}
+
 /* return a pointer to the named ups if possible */
 upstype_t *get_ups_ptr(const char *name)
 {
@@ -183,9 +315,12 @@ upstype_t *get_ups_ptr(const char *name)
 		return NULL;
 	}
 
-	for (tmp = firstups; tmp; tmp = tmp->next) {
-		if (!strcasecmp(tmp->name, name)) {
-			return tmp;
+	if (ups_index) {
+		tmp = ups_index[str_hash_nocase(name) & (ups_index_size - 1)];
+		for (; tmp; tmp = tmp->hnext) {
+			if (!strcasecmp(tmp->name, name)) {
+				return tmp;
+			}
 		}
 	}
 
@@ -203,6 +338,8 @@ static void ups_data_stale(upstype_t *ups)
 	}
 
 	ups->stale = 1;
+	workers_changed();
+	metrics_changed();
 
 	upslogx(LOG_NOTICE, "Data for UPS [%s] is stale - check driver", ups->name);
 }
@@ -215,18 +352,77 @@ static void ups_data_ok(upstype_t *ups)
 	}
 
 	ups->stale = 0;
+	workers_changed();
+	metrics_changed();
 
 	upslogx(LOG_NOTICE, "UPS [%s] data is no longer stale", ups->name);
 }
 
-/* add another listening address */
-void listen_add(const char *addr, const char *port)
+/* timer callback: (re)connect to the driver of a UPS, ping it and
+ * tell when its data turns stale (or is fine again), then work out
+ * when something may change by itself next */
+void ups_check(void *data)
+{
+	upstype_t	*ups = (upstype_t *)data;
+	time_t	now, next, ping;
+
+	/* see if we need to (re)connect to the socket */
+	if (INVALID_FD(ups->sock_fd)) {
+		upsdebugx(1, "%s: UPS [%s] is not currently connected, "
+			"trying to reconnect",
+			__func__, ups->name);
+		ups->sock_fd = sstate_connect(ups);
+		if (INVALID_FD(ups->sock_fd)) {
+			upsdebugx(1, "%s: UPS [%s] is still not connected (FD %d)",
+				__func__, ups->name, ups->sock_fd);
+			time(&now);
+			timer_set(&ups->timer, now + UPS_RECONNECT_DELAY);
+			return;
+		}
+
+		upsdebugx(1, "%s: UPS [%s] is now connected as FD %d",
+			__func__, ups->name, ups->sock_fd);
+		workers_changed();
+		metrics_changed();
+	}
+
+	/* throw some warnings if it's not feeding us data any more */
+	if (sstate_dead(ups, maxage)) {
+		ups_data_stale(ups);
+	} else {
+		ups_data_ok(ups);
+	}
+
+	if (INVALID_FD(ups->sock_fd)) {
+		/* e.g. the ping failed */
+		time(&now);
+		timer_set(&ups->timer, now);
+		return;
+	}
+
+	/* next, the data would become stale, or the driver due for a ping */
+	time(&now);
+	next = ups->last_heard + maxage + 1;
+	ping = (ups->last_ping > ups->last_heard ? ups->last_ping : ups->last_heard)
+		+ maxage / 3 + 1;
+	if (ping < next) {
+		next = ping;
+	}
+	if (next <= now) {
+		next = now + 1;
+	}
+
+	timer_set(&ups->timer, next);
+}
+
+/* add another listening address to <list> */
+static stype_t *stype_add(stype_t **list, const char *addr, const char *port)
 {
 	stype_t	*server;
 
 	/* don't change listening addresses on reload */
 	if (reload_flag) {
-		return;
+		return NULL;
 	}
 
 	/* grab some memory and add the info */
@@ -236,15 +432,44 @@ void listen_add(const char *addr, const char *port)
 	server->sock_fd = ERROR_FD_SOCK;
 	server->next = NULL;
 
-	if (firstaddr) {
+	if (*list) {
 		stype_t	*tmp;
-		for (tmp = firstaddr; tmp->next; tmp = tmp->next);
+		for (tmp = *list; tmp->next; tmp = tmp->next);
 		tmp->next = server;
 	} else {
-		firstaddr = server;
+		*list = server;
+	}
+
+	return server;
+}
+
+void listen_add(const char *addr, const char *port)
+{
+	stype_t	*server = stype_add(&firstaddr, addr, port);
+
+	if (server) {
+		upsdebugx(3, "listen_add: added %s:%s", server->addr, server->port);
+	}
+}
+
+void metrics_listen_add(const char *addr, const char *port)
+{
+	stype_t	*server = stype_add(&firstmetrics, addr, port);
+
+	if (server) {
+		server->metrics = 1;
+		upsdebugx(3, "%s: added %s:%s", __func__, server->addr, server->port);
+	}
+}
+
+/* Socket path of a "LISTEN unix:/path" entry, or NULL for TCP ones */
+static const char *listen_unix_path(const char *addr)
+{
+	if (addr && !strncmp(addr, "unix:", 5)) {
+		return addr + 5;
 	}
 
-	upsdebugx(3, "listen_add: added %s:%s", server->addr, server->port);
+	return NULL;
 }
 
 /* Close the connection if needed and free the allocated memory.
@@ -252,8 +477,26 @@ void listen_add(const char *addr, const char *port)
  * in whoever points to this server instance (if needed)! */
 static void stype_free(stype_t *server)
 {
+	if (server->worker_fds) {
+		int	i;
+
+		for (i = 0; i < worker_count; i++) {
+			if (VALID_FD_SOCK(server->worker_fds[i])) {
+				close(server->worker_fds[i]);
+			}
+		}
+		free(server->worker_fds);
+	}
+
 	if (VALID_FD_SOCK(server->sock_fd)) {
+		evloop_del(server->sock_fd);
 		close(server->sock_fd);
+#ifndef WIN32
+		if (listen_unix_path(server->addr) && !server->inherited) {
+			/* may fail after dropping privileges, nothing we can do */
+			unlink(listen_unix_path(server->addr));
+		}
+#endif	/* !WIN32 */
 	}
 
 	free(server->addr);
@@ -261,6 +504,85 @@ static void stype_free(stype_t *server)
 	free(server);
 }
 
+/* create a listening socket for local connections */
+static void setupunix(stype_t *server)
+{
+	const char	*path = listen_unix_path(server->addr);
+#ifndef WIN32
+	struct sockaddr_un	ssaddr;
+	struct stat	st;
+	TYPE_FD_SOCK	sock_fd;
+	int	v;
+
+	upsdebugx(3, "setupunix: try to bind to %s", path);
+
+	if (*path != '/') {
+		upslogx(LOG_ERR, "LISTEN %s: socket path must be absolute",
+			server->addr);
+		return;
+	}
+
+	check_unix_socket_filename(path);
+
+	/* clean up after an earlier instance, but do not remove
+	 * anything which is not a socket */
+	if (lstat(path, &st) == 0) {
+		if (!S_ISSOCK(st.st_mode)) {
+			upslogx(LOG_ERR, "LISTEN %s: %s exists and is not a socket",
+				server->addr, path);
+			return;
+		}
+		unlink(path);
+	}
+
+	sock_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (INVALID_FD_SOCK(sock_fd)) {
+		upsdebug_with_errno(3, "setupunix: socket");
+		return;
+	}
+
+	memset(&ssaddr, 0, sizeof(ssaddr));
+	ssaddr.sun_family = AF_UNIX;
+	snprintf(ssaddr.sun_path, sizeof(ssaddr.sun_path), "%s", path);
+
+	if (bind(sock_fd, (struct sockaddr *) &ssaddr, sizeof(ssaddr)) < 0) {
+		upsdebug_with_errno(3, "setupunix: bind");
+		close(sock_fd);
+		upslogx(LOG_ERR, "not listening on %s", server->addr);
+		return;
+	}
+
+	/* same audience as a localhost TCP listener would have; access
+	 * is still subject to the permissions of the parent directory */
+	if (chmod(path, 0666) < 0) {
+		upsdebug_with_errno(3, "setupunix: chmod");
+	}
+
+	if ((v = fcntl(sock_fd, F_GETFL, 0)) == -1) {
+		fatal_with_errno(EXIT_FAILURE, "setupunix: fcntl(get)");
+	}
+
+	if (fcntl(sock_fd, F_SETFL, v | O_NDELAY) == -1) {
+		fatal_with_errno(EXIT_FAILURE, "setupunix: fcntl(set)");
+	}
+
+	if (listen(sock_fd, SOMAXCONN) < 0) {
+		upsdebug_with_errno(3, "setupunix: listen");
+		close(sock_fd);
+		unlink(path);
+		upslogx(LOG_ERR, "not listening on %s", server->addr);
+		return;
+	}
+
+	server->sock_fd = sock_fd;
+	upslogx(LOG_INFO, "listening on %s", server->addr);
+#else	/* WIN32 */
+	NUT_UNUSED_VARIABLE(path);
+	upslogx(LOG_ERR, "LISTEN %s: unix sockets are not supported on this platform",
+		server->addr);
+#endif	/* WIN32 */
+}
+
 /* create a listening socket for tcp connections */
 static void setuptcp(stype_t *server)
 {
@@ -283,6 +605,11 @@ static void setuptcp(stype_t *server)
 		return;
 	}
 
+	if (listen_unix_path(server->addr)) {
+		setupunix(server);
+		return;
+	}
+
 	upsdebugx(3, "setuptcp: try to bind to %s port %s", server->addr, server->port);
 	if (!strcmp(server->addr, "localhost")) {
 		/* Warn about possible surprises with IPv4 vs. IPv6 */
@@ -323,6 +650,7 @@ static void setuptcp(stype_t *server)
 			serverAnyV4->addr = xstrdup("0.0.0.0");
 			serverAnyV4->port = xstrdup(server->port);
 			serverAnyV4->sock_fd = ERROR_FD_SOCK;
+			serverAnyV4->metrics = server->metrics;
 			serverAnyV4->next = NULL;
 		}
 
@@ -334,6 +662,7 @@ static void setuptcp(stype_t *server)
 			serverAnyV6->addr = xstrdup("::0");
 			serverAnyV6->port = xstrdup(server->port);
 			serverAnyV6->sock_fd = ERROR_FD_SOCK;
+			serverAnyV6->metrics = server->metrics;
 			serverAnyV6->next = NULL;
 		}
 
@@ -454,6 +783,12 @@ static void setuptcp(stype_t *server)
 			fatal_with_errno(EXIT_FAILURE, "setuptcp: setsockopt");
 		}
 
+		/* WORKERS get listeners of their own for this address,
+		 * scrapes are served by the main process alone */
+		if (!server->metrics) {
+			workers_reuseport(sock_fd);
+		}
+
 #ifdef IPV6_V6ONLY
 		/* Ordinarily we request that IPv6 listeners handle only IPv6
 		 * and not IPv4 mapped addresses - if the OS would honour that.
@@ -475,7 +810,7 @@ static void setuptcp(stype_t *server)
 			continue;
 		}
 
-/* WSAEventSelect automatically set the socket to nonblocking mode */
+/* on WIN32, WSAEventSelect() in evloop_add() makes it non-blocking */
 #ifndef WIN32
 		if ((v = fcntl(sock_fd, F_GETFL, 0)) == -1) {
 			fatal_with_errno(EXIT_FAILURE, "setuptcp: fcntl(get)");
@@ -486,7 +821,7 @@ static void setuptcp(stype_t *server)
 		}
 #endif	/* !WIN32 */
 
-		if (listen(sock_fd, 16) < 0) {
+		if (listen(sock_fd, SOMAXCONN) < 0) {
 			upsdebug_with_errno(3, "setuptcp: listen");
 			close(sock_fd);
 			continue;
@@ -506,16 +841,6 @@ static void setuptcp(stype_t *server)
 		break;
 	}
 
-#ifdef WIN32
-		server->Event = CreateEvent(NULL, /* Security */
-				FALSE, /* auto-reset */
-				FALSE, /* initial state */
-				NULL); /* no name */
-
-		/* Associate socket event to the socket via its Event object */
-		WSAEventSelect( server->sock_fd, server->Event, FD_ACCEPT );
-#endif	/* WIN32 */
-
 	freeaddrinfo(res);
 
 	/* leave up to the caller, server_load(), to fail silently if there is
@@ -529,19 +854,31 @@ static void setuptcp(stype_t *server)
 	return;
 }
 
-/* decrement the login counter for this ups */
-static void declogins(const char *upsname)
+/* decrement the login counter for the ups of this client */
+static void declogins(nut_ctype_t *client)
 {
 	upstype_t	*ups;
 
-	ups = get_ups_ptr(upsname);
+	ups = get_ups_ptr(client->loginups);
 
 	if (!ups) {
-		upslogx(LOG_INFO, "Tried to decrement invalid ups name (%s)", upsname);
+		upslogx(LOG_INFO, "Tried to decrement invalid ups name (%s)", client->loginups);
 		return;
 	}
 
+	if (client->loginprev) {
+		client->loginprev->loginnext = client->loginnext;
+	} else {
+		ups->logins = client->loginnext;
+	}
+
+	if (client->loginnext) {
+		client->loginnext->loginprev = client->loginprev;
+	}
+
 	ups->numlogins--;
+	workers_changed();
+	netwatch_numlogins(ups);
 
 	if (ups->numlogins < 0) {
 		upslogx(LOG_ERR, "Programming error: UPS [%s] has numlogins=%d", ups->name, ups->numlogins);
@@ -556,16 +893,28 @@ static void client_disconnect(nut_ctype_t *client)
 	}
 
 	upsdebugx(2, "Disconnect from %s", client->addr);
+	NUT_PROBE2(upsd_client_disconnect, client->addr, (int)client->sock_fd);
 
-	shutdown(client->sock_fd, 2);
-	close(client->sock_fd);
+	timer_cancel(&client->idle_timer);
+	stats_client_count(-1);
 
-#ifdef WIN32
-	CloseHandle(client->Event);
-#endif	/* WIN32 */
+	if (client->admitted) {
+		admit_addr_del(client->addr);
+	}
+
+	/* not there any more if handed over to another process */
+	if (VALID_FD_SOCK(client->sock_fd)) {
+		evloop_del(client->sock_fd);
+		shutdown(client->sock_fd, 2);
+		close(client->sock_fd);
+	}
+
+	/* before the count goes down, which the watchers are told */
+	netwatch_client_free(client);
+	netbatch_client_free(client);
 
 	if (client->loginups) {
-		declogins(client->loginups);
+		declogins(client);
 	}
 
 	ssl_finish(client);
@@ -586,34 +935,126 @@ static void client_disconnect(nut_ctype_t *client)
 		/* lastclient = client->prev; */
 	}
 
+	free(client->metrics);
+	free(client->outbuf);
 	free(client->addr);
 	free(client->loginups);
-	free(client->password);
-	free(client->username);
-	free(client);
+	user_cred_put(client->cred);
+
+	if (client_pooled < CLIENT_POOL_MAX) {
+		client->next = client_pool;
+		client_pool = client;
+		client_pooled++;
+	} else {
+		free(client);
+	}
 
 	return;
 }
 
-/* send the buffer <sendbuf> of length <sendlen> to host <dest>
- * returns effectively a boolean: 0 = failed, 1 = sent ok
+/* have the main loop disconnect a client as soon as possible, when it
+ * can not be done right away as the caller still needs the structure */
+void client_drop(nut_ctype_t *client)
+{
+	client->last_heard = 0;
+	timer_set(&client->idle_timer, 0);
+}
+
+/* timer callback: shed clients after CLIENT_INACTIVITY_DELAY, except
+ * those which WATCH (unless marked as failed by client_drop()) */
+static void client_idle(void *data)
+{
+	nut_ctype_t	*client = (nut_ctype_t *)data;
+	time_t	now;
+
+	time(&now);
+
+	if (client->last_heard != 0) {
+		if (client->watches) {
+			/* subscribers mostly listen: no need for parser memory */
+			pconf_compact(&client->ctx, 0);
+			timer_set(&client->idle_timer, now + client_inactivity_delay);
+			return;
+		}
+
+		/* it said something meanwhile, count from there */
+		if (difftime(now, client->last_heard) <= client_inactivity_delay) {
+			timer_set(&client->idle_timer,
+				client->last_heard + client_inactivity_delay + 1);
+			return;
+		}
+	}
+
+	upsdebugx(2, "Disconnect %s (%s)", client->addr,
+		client->last_heard ? "inactivity" : "dropped");
+	client_disconnect(client);
+}
+
+/* toggle O_NONBLOCK on a client socket
+ * returns 1 on success, 0 on failure */
+static int client_set_nonblocking(nut_ctype_t *client, int nonblocking)
+{
+#ifndef WIN32
+	int	v;
+
+	if ((v = fcntl(client->sock_fd, F_GETFL, 0)) == -1) {
+		upslog_with_errno(LOG_ERR, "%s: fcntl(get) for %s", __func__, client->addr);
+		return 0;
+	}
+
+	if (nonblocking)
+		v |= O_NONBLOCK;
+	else
+		v &= ~O_NONBLOCK;
+
+	if (fcntl(client->sock_fd, F_SETFL, v) == -1) {
+		upslog_with_errno(LOG_ERR, "%s: fcntl(set) for %s", __func__, client->addr);
+		return 0;
+	}
+#else	/* WIN32 */
+	/* accepted sockets inherit the non-blocking mode which WSAEventSelect()
+	 * in evloop_add() gave the listener */
+	NUT_UNUSED_VARIABLE(client);
+	NUT_UNUSED_VARIABLE(nonblocking);
+#endif	/* WIN32 */
+
+	return 1;
+}
+
+/* drop everything queued for a client (e.g. after a write error) */
+static void client_outbuf_reset(nut_ctype_t *client)
+{
+	client->outoff = 0;
+	client->outlen = 0;
+}
+
+/* write out as much as the socket would take of the data collected by
+ * sendback() for this client, with a single write() or ssl_write() call;
+ * anything left over is sent when the socket becomes writable again, and
+ * we stop reading further requests from the client until then
+ * returns effectively a boolean: 0 = failed, 1 = sent or queued ok
  */
-int sendback(nut_ctype_t *client, const char *fmt, ...)
+int client_flush(nut_ctype_t *client)
 {
 	ssize_t	res;
 	size_t	len;
-	char	ans[NUT_NET_ANSWER_MAX+1];
-	va_list	ap;
 
-	if (!client) {
+	if (!client || client->sendq_overflow) {
 		return 0;
 	}
 
-	va_start(ap, fmt);
-	vsnprintf(ans, sizeof(ans), fmt, ap);
-	va_end(ap);
+	if (client->ssl_handshake) {
+		/* keep it queued until the TLS session is up, the
+		 * handshake decides which events we wait for now */
+		return 1;
+	}
 
-	len = strlen(ans);
+	len = client->outlen - client->outoff;
+	if (!len) {
+		client_outbuf_reset(client);
+		evloop_mod(client->sock_fd, EVLOOP_READ);
+		return 1;
+	}
 
 	/* System write() and our ssl_write() have a loophole that they write a
 	 * size_t amount of bytes and upon success return that in ssize_t value
@@ -622,72 +1063,255 @@ int sendback(nut_ctype_t *client, const char *fmt, ...)
 
 #ifdef WITH_SSL
 	if (client->ssl) {
-		res = ssl_write(client, ans, len);
+		res = ssl_write(client, client->outbuf + client->outoff, len);
 	} else
 #endif /* WITH_SSL */
 	{
-		res = write(client->sock_fd, ans, len);
+		res = write(client->sock_fd, client->outbuf + client->outoff, len);
 	}
 
-	{ /* scoping */
-		char * s = str_rtrim(ans, '\n');
-		upsdebugx(2, "write: [destfd=%d] [len=%" PRIuSIZE "] [%s]", client->sock_fd, len, s);
+#ifndef WIN32
+	if (res < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+		res = 0;	/* try again later */
 	}
 
-	if (res < 0 || len != (size_t)res) {
-		upslog_with_errno(LOG_NOTICE, "write() failed for %s", client->addr);
-		client->last_heard = 0;
-		return 0;	/* failed */
+	if (res >= 0) {
+		upsdebugx(3, "flush: [destfd=%d] [len=%" PRIuSIZE "] [sent=%" PRIiSIZE "]",
+			client->sock_fd, len, res);
+
+		client->outoff += (size_t)res;
+		stats_client_io(client, 0, (size_t)res);
+		if (client->outoff < client->outlen) {
+			/* backpressure: wait for the client to read its answers */
+			evloop_mod(client->sock_fd, EVLOOP_WRITE);
+		} else {
+			client_outbuf_reset(client);
+			evloop_mod(client->sock_fd, EVLOOP_READ);
+			if (client->hangup) {
+				client_drop(client);
+			}
+		}
+		return 1;	/* OK */
 	}
+#else	/* WIN32 */
+	upsdebugx(3, "flush: [destfd=%d] [len=%" PRIuSIZE "]", client->sock_fd, len);
 
-	return 1;	/* OK */
+	if (res >= 0 && len == (size_t)res) {
+		stats_client_io(client, 0, (size_t)res);
+		client_outbuf_reset(client);
+		if (client->hangup) {
+			client_drop(client);
+		}
+		return 1;	/* OK */
+	}
+#endif	/* WIN32 */
+
+	upslog_with_errno(LOG_NOTICE, "write() failed for %s", client->addr);
+	client_outbuf_reset(client);
+	client_drop(client);
+	return 0;	/* failed */
 }
 
-/* just a simple wrapper for now */
-int send_err(nut_ctype_t *client, const char *errtype)
+/* the client has too much unsent data queued, apply SENDQUEUE_POLICY
+ * returns 1 if the client may stay connected, 0 if it is to be dropped */
+static int client_sendq_overflow(nut_ctype_t *client)
 {
-	if (!client) {
-		return -1;
-	}
+#ifndef WIN32
+	if (sendq_policy == SENDQ_POLICY_WAIT) {
+		struct timeval	start, now;
 
-	upsdebugx(4, "Sending error [%s] to client %s", errtype, client->addr);
+		gettimeofday(&start, NULL);
+		now = start;
 
-	return sendback(client, "ERR %s\n", errtype);
-}
+		while (client->outlen - client->outoff > sendq_max) {
+			struct pollfd	pfd;
+			int	left = NUT_NET_SENDQ_WAIT_MS - (int)(difftimeval(now, start) * 1000);
 
-/* disconnect anyone logged into this UPS */
-void kick_login_clients(const char *upsname)
-{
-	nut_ctype_t	*client, *cnext;
+			if (left <= 0)
+				break;
 
-	for (client = firstclient; client; client = cnext) {
+			pfd.fd = client->sock_fd;
+			pfd.events = POLLOUT;
+			pfd.revents = 0;
 
-		cnext = client->next;
+			if (poll(&pfd, 1, left) < 0 && errno != EINTR)
+				break;
 
-		/* if it's not logged in, don't check it */
-		if (!client->loginups) {
-			continue;
-		}
+			if (pfd.revents & (POLLHUP | POLLERR | POLLNVAL))
+				break;
 
-		if (!strcmp(client->loginups, upsname)) {
-			upslogx(LOG_INFO, "Kicking client %s (was on UPS [%s])\n", client->addr, upsname);
-			client_disconnect(client);
+			if ((pfd.revents & POLLOUT) && !client_flush(client))
+				return 0;
+
+			gettimeofday(&now, NULL);
 		}
+
+		if (client->outlen - client->outoff <= sendq_max)
+			return 1;
 	}
+#endif	/* !WIN32 */
+
+	upslogx(LOG_WARNING, "Dropping client %s: more than %" PRIuSIZE
+		" bytes of answers are not yet consumed by it",
+		client->addr, sendq_max);
+
+	client_outbuf_reset(client);
+	client->sendq_overflow = 1;
+	client_drop(client);
+
+	return 0;
 }
 
-/* make sure a UPS is sane - connected, with fresh data */
-int ups_available(const upstype_t *ups, nut_ctype_t *client)
+/* make room for <len> more bytes at the end of the output buffer
+ * returns where to put them */
+static char *client_outbuf_reserve(nut_ctype_t *client, size_t len)
 {
-	if (!ups) {
-		/* Should never happen, but handle this
-		 * just in case instead of segfaulting */
-		upsdebugx(1, "%s: ERROR, called with a NULL ups pointer", __func__);
-		send_err(client, NUT_ERR_FEATURE_NOT_SUPPORTED);
-		return 0;
+	/* reclaim the space of data already sent */
+	if (client->outoff > 0) {
+		memmove(client->outbuf, client->outbuf + client->outoff,
+			client->outlen - client->outoff);
+		client->outlen -= client->outoff;
+		client->outoff = 0;
 	}
 
-	if (INVALID_FD(ups->sock_fd)) {
+	if (client->outsize - client->outlen < len) {
+		client->outsize = client->outlen + len;
+		if (client->outsize < NUT_NET_OUTBUF_FLUSH + NUT_NET_ANSWER_MAX + 1)
+			client->outsize = NUT_NET_OUTBUF_FLUSH + NUT_NET_ANSWER_MAX + 1;
+		client->outbuf = xrealloc(client->outbuf, client->outsize);
+	}
+
+	return client->outbuf + client->outlen;
+}
+
+/* account for <len> bytes added after client_outbuf_reserve(), send them
+ * if enough data is collected, and enforce MAXSENDQUEUE
+ * returns effectively a boolean: 0 = failed, 1 = queued ok
+ */
+static int client_outbuf_commit(nut_ctype_t *client, size_t len)
+{
+	client->outlen += len;
+
+	if (client->outlen - client->outoff >= NUT_NET_OUTBUF_FLUSH
+	&& !client_flush(client)
+	) {
+		return 0;
+	}
+
+	if (client->outlen - client->outoff > sendq_max
+	&& !client_sendq_overflow(client)
+	) {
+		return 0;
+	}
+
+	return 1;	/* OK */
+}
+
+/* add a formatted line to the output buffer of <client>, which is sent
+ * when the current request is done (or the buffer fills up)
+ * returns effectively a boolean: 0 = failed, 1 = queued ok
+ */
+int sendback(nut_ctype_t *client, const char *fmt, ...)
+{
+	int	ret;
+	size_t	len;
+	char	*ans;
+	va_list	ap;
+
+	if (!client || client->sendq_overflow) {
+		return 0;
+	}
+
+	/* make room for a complete answer line */
+	ans = client_outbuf_reserve(client, NUT_NET_ANSWER_MAX + 1);
+
+	va_start(ap, fmt);
+	ret = vsnprintf(ans, NUT_NET_ANSWER_MAX + 1, fmt, ap);
+	va_end(ap);
+
+	if (ret < 0) {
+		upsdebugx(1, "%s: failed to format the answer for %s", __func__, client->addr);
+		return 0;
+	}
+
+	/* truncated lines are sent as much as fits, like before */
+	len = strlen(ans);
+
+	if (nut_debug_level >= 2) {
+		char	*s = xstrdup(ans);
+		upsdebugx(2, "write: [destfd=%d] [len=%" PRIuSIZE "] [%s]",
+			client->sock_fd, len, str_rtrim(s, '\n'));
+		free(s);
+	}
+
+	NUT_PROBE3(upsd_sendback, client->addr, ans, len);
+
+	return client_outbuf_commit(client, len);
+}
+
+/* like sendback(), for a block of (possibly many) pre-formatted lines */
+int sendback_raw(nut_ctype_t *client, const char *buf, size_t len)
+{
+	if (!client || client->sendq_overflow) {
+		return 0;
+	}
+
+	if (!len) {
+		return 1;
+	}
+
+	memcpy(client_outbuf_reserve(client, len), buf, len);
+
+	upsdebugx(2, "write: [destfd=%d] [len=%" PRIuSIZE "] (pre-formatted block)",
+		client->sock_fd, len);
+	NUT_PROBE3(upsd_sendback, client->addr, NULL, len);
+
+	return client_outbuf_commit(client, len);
+}
+
+/* just a simple wrapper for now */
+int send_err(nut_ctype_t *client, const char *errtype)
+{
+	if (!client) {
+		return -1;
+	}
+
+	upsdebugx(4, "Sending error [%s] to client %s", errtype, client->addr);
+
+	return sendback(client, "ERR %s\n", errtype);
+}
+
+/* disconnect anyone logged into this UPS */
+void kick_login_clients(const char *upsname)
+{
+	upstype_t	*ups = get_ups_ptr(upsname);
+	nut_ctype_t	*client, *cnext;
+
+	if (!ups) {
+		return;
+	}
+
+	for (client = ups->logins; client; client = cnext) {
+
+		cnext = client->loginnext;
+
+		upslogx(LOG_INFO, "Kicking client %s (was on UPS [%s])\n", client->addr, upsname);
+		client_disconnect(client);
+	}
+}
+
+/* make sure a UPS is sane - connected, with fresh data */
+int ups_available(const upstype_t *ups, nut_ctype_t *client)
+{
+	if (!ups) {
+		/* Should never happen, but handle this
+		 * just in case instead of segfaulting */
+		upsdebugx(1, "%s: ERROR, called with a NULL ups pointer", __func__);
+		send_err(client, NUT_ERR_FEATURE_NOT_SUPPORTED);
+		return 0;
+	}
+
+	if (worker_id >= 0 ? !ups->worker_connected : INVALID_FD(ups->sock_fd)) {
 		send_err(client, NUT_ERR_DRIVER_NOT_CONNECTED);
 		return 0;
 	}
@@ -713,27 +1337,27 @@ static void check_command(int cmdnum, nut_ctype_t *client, size_t numarg,
 		struct request_info	req;
 #endif	/* HAVE_WRAP */
 
-		if (!client->username) {
+		if (!client_username(client)) {
 			upsdebugx(1, "%s: client not logged in yet", __func__);
 			send_err(client, NUT_ERR_USERNAME_REQUIRED);
 			return;
 		}
 
-		if (!client->password) {
+		if (!client->cred->password) {
 			upsdebugx(1, "%s: client not logged in yet", __func__);
 			send_err(client, NUT_ERR_PASSWORD_REQUIRED);
 			return;
 		}
 
 #ifdef HAVE_WRAP
-		request_init(&req, RQ_DAEMON, progname, RQ_FILE, client->sock_fd, RQ_USER, client->username, 0);
+		request_init(&req, RQ_DAEMON, progname, RQ_FILE, client->sock_fd, RQ_USER, client_username(client), 0);
 		fromhost(&req);
 
 		if (!hosts_access(&req)) {
 			upsdebugx(1,
 				"%s: while authenticating %s found that "
 				"tcp-wrappers says access should be denied",
-				__func__, client->username);
+				__func__, client_username(client));
 			send_err(client, NUT_ERR_ACCESS_DENIED);
 			return;
 		}
@@ -759,56 +1383,98 @@ static void parse_net(nut_ctype_t *client)
 
 	for (i = 0; netcmds[i].name; i++) {
 		if (!strcasecmp(netcmds[i].name, client->ctx.arglist[0])) {
+			uint64_t	start = stats_now_usec(), took;
+
+			NUT_PROBE3(upsd_command, client->addr, netcmds[i].name, client->ctx.numargs);
 			check_command(i, client, client->ctx.numargs, (const char **) client->ctx.arglist);
+			took = stats_now_usec() - start;
+			stats_command((size_t)i, netcmds[i].name, took);
+			NUT_PROBE3(upsd_command_done, client->addr, netcmds[i].name, took);
 			return;
 		}
 	}
 
 	/* fallthrough = not matched by any entry in netcmds */
 
+	stats_unknown_command();
 	send_err(client, NUT_ERR_UNKNOWN_COMMAND);
 }
 
-/* answer incoming tcp connections */
-static void client_connect(stype_t *server)
+#ifndef WIN32
+/* learn who is on the other end of a unix socket connection */
+static void client_peercred(nut_ctype_t *client)
 {
-	struct	sockaddr_storage csock;
-#if defined(__hpux) && !defined(_XOPEN_SOURCE_EXTENDED)
-	int	clen;
-#else
-	socklen_t	clen;
-#endif
-	int		fd;
-	nut_ctype_t		*client;
+# if defined(SO_PEERCRED)
+	struct ucred	cred;
+	socklen_t	len = sizeof(cred);
 
-	clen = sizeof(csock);
-	fd = accept(server->sock_fd, (struct sockaddr *) &csock, &clen);
+	if (getsockopt(client->sock_fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) == 0) {
+		client->peer_uid = cred.uid;
+		client->peer_gid = cred.gid;
+	}
+# elif defined(HAVE_GETPEEREID)
+	uid_t	uid;
+	gid_t	gid;
 
-	if (fd < 0) {
+	if (getpeereid(client->sock_fd, &uid, &gid) == 0) {
+		client->peer_uid = uid;
+		client->peer_gid = gid;
+	}
+# endif
+
+	if (client->peer_uid == (uid_t)-1) {
+		upsdebugx(2, "Connect from %s: peer credentials not available",
+			client->addr);
 		return;
 	}
 
-	client = xcalloc(1, sizeof(*client));
+	upsdebugx(2, "Connect from %s: peer uid %" PRIdMAX " gid %" PRIdMAX,
+		client->addr, (intmax_t)client->peer_uid, (intmax_t)client->peer_gid);
+}
+#endif	/* !WIN32 */
+
+/* set up the structure for a new client connection on <fd>, which is
+ * non-blocking already: one slow reader may not stall everyone else,
+ * see client_flush(); returns NULL (with <fd> closed) if it can not be
+ * served */
+static nut_ctype_t *client_add(int fd, const char *peer)
+{
+	nut_ctype_t		*client;
+
+	if (client_pool) {
+		client = client_pool;
+		client_pool = client->next;
+		client_pooled--;
+		memset(client, 0, sizeof(*client));
+	} else {
+		client = xcalloc(1, sizeof(*client));
+	}
 
 	client->sock_fd = fd;
 
 	time(&client->last_heard);
 
-	client->addr = xstrdup(inet_ntopSS(&csock));
-
-	client->tracking = 0;
+	client->addr = xstrdup(peer);
 
-#ifdef WIN32
-	client->Event = CreateEvent(NULL, /* Security, */
-				FALSE,    /* auto-reset */
-				FALSE,    /* initial state */
-				NULL);    /* no name */
+#ifndef WIN32
+	client->peer_uid = (uid_t)-1;
+	client->peer_gid = (gid_t)-1;
+#endif	/* !WIN32 */
 
-	/* Associate socket event to the socket via its Event object */
-	WSAEventSelect( client->sock_fd, client->Event, FD_READ );
-#endif	/* WIN32 */
+	client->tracking = 0;
 
 	pconf_init(&client->ctx, NULL);
+	timer_init(&client->idle_timer, client_idle, client);
+
+	if (!evloop_add(client->sock_fd, EVLOOP_READ, CLIENT, client)) {
+		upslogx(LOG_WARNING, "Can not watch connection from %s, dropping it",
+			client->addr);
+		close(client->sock_fd);
+		pconf_finish(&client->ctx);
+		free(client->addr);
+		free(client);
+		return NULL;
+	}
 
 	if (firstclient) {
 		firstclient->prev = client;
@@ -816,6 +1482,10 @@ static void client_connect(stype_t *server)
 	}
 
 	firstclient = client;
+	stats_client_count(1);
+	NUT_PROBE2(upsd_client_connect, client->addr, fd);
+
+	timer_set(&client->idle_timer, client->last_heard + client_inactivity_delay + 1);
 
 /*
 	if (lastclient) {
@@ -825,17 +1495,344 @@ static void client_connect(stype_t *server)
 
 	lastclient = client;
  */
-	upsdebugx(2, "Connect from %s", client->addr);
+	return client;
+}
+
+/* at MAXCONN: make room for a new connection by dropping the one idle
+ * for the longest (a second at least) of those which did not give a user
+ * name, LOGIN or WATCH, so that upsmon sessions and subscribers are kept
+ * as anonymous clients come and go; returns 0 if there is none */
+static int client_evict(void)
+{
+	nut_ctype_t	*client, *victim = NULL;
+	time_t	now;
+
+	time(&now);
+
+	for (client = firstclient; client; client = client->next) {
+		if (client->cred || client->loginups || client->watches
+		 || client->last_heard == 0
+		 || difftime(now, client->last_heard) < 1
+		) {
+			continue;
+		}
+
+		if (!victim || difftime(victim->last_heard, client->last_heard) > 0) {
+			victim = client;
+		}
+	}
+
+	if (!victim) {
+		return 0;
+	}
+
+	upsdebugx(2, "Disconnect %s (idle at MAXCONN)", victim->addr);
+	client_disconnect(victim);
+
+	return 1;
+}
+
+/* take one connection from a listener, returns 0 if there was none */
+static int client_accept(stype_t *server)
+{
+	struct	sockaddr_storage csock;
+#if defined(__hpux) && !defined(_XOPEN_SOURCE_EXTENDED)
+	int	clen;
+#else
+	socklen_t	clen;
+#endif
+	int		fd, local = 0, counted = 0;
+	nut_ctype_t		*client;
+	const char	*peer;
+
+	clen = sizeof(csock);
+#ifdef HAVE_ACCEPT4
+	fd = accept4(server->sock_fd, (struct sockaddr *) &csock, &clen,
+		SOCK_NONBLOCK | SOCK_CLOEXEC);
+#else
+	fd = accept(server->sock_fd, (struct sockaddr *) &csock, &clen);
+#endif
+
+	if (fd < 0) {
+		return 0;
+	}
+
+#ifndef WIN32
+	/* local peers are known by the socket they came through */
+	if (csock.ss_family == AF_UNIX) {
+		peer = server->addr;
+		local = 1;
+	} else
+#endif	/* !WIN32 */
+	{
+		peer = inet_ntopSS(&csock);
+	}
+
+	if (!peer) {
+		peer = "(unknown)";
+	}
+
+	/* the admission limits are for the network, local clients pass */
+	if (!local) {
+		if (!admit_rate_take()) {
+			upsdebugx(2, "Rejecting connection from %s: over ACCEPT_RATE", peer);
+			goto reject;
+		}
+
+		if (!admit_addr_add(peer)) {
+			upsdebugx(2, "Rejecting connection from %s: reached "
+				"MAXCONN_PER_ADDR limit of %" PRIuSIZE " connections",
+				peer, maxconn_per_addr);
+			goto reject;
+		}
+		counted = 1;
+	}
+
+	if (evloop_count() >= (size_t)maxconn && !client_evict()) {
+		upslogx(LOG_WARNING, "Rejecting connection from %s: "
+			"reached MAXCONN limit of %" PRIdMAX " connections",
+			peer, (intmax_t)maxconn);
+		goto reject;
+	}
+
+#if !(defined HAVE_ACCEPT4) && !(defined WIN32)
+	{
+		/* as accept4() would have made it */
+		int	v = fcntl(fd, F_GETFD, 0);
+
+		if (v != -1) {
+			fcntl(fd, F_SETFD, v | FD_CLOEXEC);
+		}
+	}
+#endif	/* !HAVE_ACCEPT4 && !WIN32 */
+
+	if ((client = client_add(fd, peer)) == NULL) {
+		if (counted) {
+			admit_addr_del(peer);
+		}
+		return 1;
+	}
+
+	client->admitted = counted;
+#ifndef HAVE_ACCEPT4
+	client_set_nonblocking(client, 1);
+#endif	/* !HAVE_ACCEPT4 */
+
+#ifndef WIN32
+	if (local) {
+		client_peercred(client);
+	} else
+#endif	/* !WIN32 */
+	{
+		/* answers are collected in the output buffer and written in
+		 * large blocks already; Nagle would only hold the last part of
+		 * an answer to pipelined requests until the client ACKs the
+		 * previous ones, which it may delay for tens of milliseconds */
+		int	one = 1;
+
+		if (setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, (void *)&one, sizeof(one)) != 0) {
+			upsdebug_with_errno(3, "%s: setsockopt TCP_NODELAY", __func__);
+		}
+	}
+
+	if (server->metrics) {
+		client->metrics = xcalloc(1, sizeof(*client->metrics));
+	}
+
+	upsdebugx(2, "Connect from %s%s", client->addr,
+		client->metrics ? " (METRICS)" : "");
+
+	return 1;
+
+reject:
+	if (counted) {
+		admit_addr_del(peer);
+	}
+	stats_client_rejected();
+	close(fd);
+
+	return 1;
 }
 
+/* answer incoming tcp and unix socket connections: after a network
+ * partition heals, clients come back all at once, so take a batch of
+ * them per wakeup, and leave the rest of the queue for the next round */
+static void client_connect(stype_t *server)
+{
+	int	i;
+
+	for (i = 0; i < ADMIT_ACCEPT_BATCH; i++) {
+		if (!client_accept(server)) {
+			break;
+		}
+	}
+}
+
+#ifdef WITH_SSL
+/* carry on with the TLS handshake of a client after STARTTLS */
+static void client_handshake(nut_ctype_t *client)
+{
+	int	ret = ssl_handshake_continue(client);
+
+	if (ret < 0) {
+		upsdebugx(2, "Disconnect %s (TLS handshake failure)", client->addr);
+		client_disconnect(client);
+		return;
+	}
+
+	/* send what was queued meanwhile, e.g. WATCH notifications */
+	if (ret > 0 && !client_flush(client)) {
+		upsdebugx(2, "Disconnect %s (write failure)", client->addr);
+		client_disconnect(client);
+	}
+}
+#endif /* WITH_SSL */
+
 /* read tcp messages and handle them */
+/* WORKERS: give the client over to the main process, starting with the
+ * request just parsed and followed by the <restlen> bytes of <rest> */
+static void client_handoff(nut_ctype_t *client, const char *rest, size_t restlen)
+{
+	char	*in, enc[LARGEBUF];
+	size_t	i, inlen = 0, insize;
+
+	/* the parsed request goes back to the wire format, with every
+	 * word quoted so that blanks and empty words survive */
+	insize = restlen + 2;
+	for (i = 0; i < client->ctx.numargs; i++) {
+		insize += 2 * strlen(client->ctx.arglist[i]) + 3;
+	}
+
+	in = xcalloc(1, insize + 1);
+
+	for (i = 0; i < client->ctx.numargs; i++) {
+		pconf_encode(client->ctx.arglist[i], enc, sizeof(enc));
+		inlen += (size_t)snprintf(in + inlen, insize - inlen, "%s\"%s\"",
+			i ? " " : "", enc);
+	}
+	in[inlen++] = '\n';
+	memcpy(in + inlen, rest, restlen);
+	inlen += restlen;
+
+	if (!workers_handoff(client->sock_fd, client->addr,
+		client->outbuf + client->outoff, client->outlen - client->outoff,
+		in, inlen)
+	) {
+		upslogx(LOG_WARNING, "Can not hand %s over to the main process, dropping it",
+			client->addr);
+	} else {
+		/* the main process has its own copy of the descriptor now:
+		 * forget ours without shutting the connection down */
+		evloop_del(client->sock_fd);
+		close(client->sock_fd);
+		client->sock_fd = ERROR_FD_SOCK;
+	}
+
+	free(in);
+	client_disconnect(client);
+}
+
+/* handle <len> bytes received from the client, which may be gone
+ * (disconnected or handed over) when this returns */
+static void client_input(nut_ctype_t *client, const char *buf, size_t len)
+{
+	size_t	off, used;
+
+	/* WORKERS answer from the latest published states */
+	if (worker_id >= 0) {
+		workers_refresh();
+	}
+
+	if (client->metrics) {
+		metrics_input(client, buf, len);
+		client_flush(client);
+
+		if (client->sendq_overflow) {
+			client_disconnect(client);
+		}
+		return;
+	}
+
+	/* fragment handling code: complete lines are split at once,
+	 * partial ones are kept in the parser context for the next read */
+	for (off = 0; off < len; off += used) {
+
+		switch (pconf_buf(&client->ctx, buf + off, len - off, &used))
+		{
+		case 1:
+			time(&client->last_heard);	/* command received */
+
+			if (worker_id >= 0 && workers_must_forward(
+				client->ctx.numargs, (const char **) client->ctx.arglist)
+			) {
+				client_flush(client);
+				client_handoff(client, buf + off + used, len - off - used);
+				return;
+			}
+
+			parse_net(client);
+			continue;
+
+		case 0:
+			continue;	/* haven't gotten a line yet */
+
+		default:
+			/* parse error */
+			upslogx(LOG_NOTICE, "Parse error on sock: %s", client->ctx.errmsg);
+			client_flush(client);
+			return;
+		}
+	}
+
+	/* what a long request made the parser take is not kept for good */
+	pconf_compact(&client->ctx, CLIENT_PCONF_KEEP);
+
+	/* send the answers to all requests from this chunk at once */
+	client_flush(client);
+
+	if (client->sendq_overflow) {
+		client_disconnect(client);
+	}
+}
+
+/* WORKERS: carry on with a client connection handed over by a worker,
+ * which has already sent some answers and left <out> to be sent still */
+void client_adopt(TYPE_FD_SOCK sock_fd, const char *addr,
+	const char *out, size_t outlen, const char *in, size_t inlen)
+{
+	nut_ctype_t	*client;
+
+	if ((client = client_add(sock_fd, addr)) == NULL) {
+		return;
+	}
+
+	/* shared with the worker, which has made it so already */
+	client_set_nonblocking(client, 1);
+
+	upsdebugx(2, "Taking over %s from a worker", client->addr);
+
+	if (outlen > 0 && !sendback_raw(client, out, outlen)) {
+		client_disconnect(client);
+		return;
+	}
+
+	client_input(client, in, inlen);
+}
+
+/* read some data from the client and act on it; the buffer holds a whole
+ * TLS record, as the rest of one is kept decrypted in the library where
+ * it does not make the socket readable again (pipelining clients) */
 static void client_readline(nut_ctype_t *client)
 {
-	char	buf[SMALLBUF];
-	int	i;
+	char	buf[16384];
 	ssize_t	ret;
 
 #ifdef WITH_SSL
+	if (client->ssl_handshake) {
+		client_handshake(client);
+		return;
+	}
+
 	if (client->ssl) {
 		ret = ssl_read(client, buf, sizeof(buf));
 	} else
@@ -845,6 +1842,12 @@ static void client_readline(nut_ctype_t *client)
 	}
 
 	if (ret < 0) {
+#ifndef WIN32
+		if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+			/* e.g. only a part of a TLS record has arrived */
+			return;
+		}
+#endif	/* !WIN32 */
 		upsdebug_with_errno(2, "Disconnect %s (read failure)", client->addr);
 		client_disconnect(client);
 		return;
@@ -856,30 +1859,157 @@ static void client_readline(nut_ctype_t *client)
 		return;
 	}
 
-	/* fragment handling code */
-	for (i = 0; i < ret; i++) {
+	stats_client_io(client, (size_t)ret, 0);
+	client_input(client, buf, (size_t)ret);
+}
 
-		/* add to the receive queue one by one */
-		switch (pconf_char(&client->ctx, buf[i]))
-		{
-		case 1:
-			time(&client->last_heard);	/* command received */
-			parse_net(client);
+/* continue sending the answers queued for a slow client */
+static void client_writable(nut_ctype_t *client)
+{
+#ifdef WITH_SSL
+	if (client->ssl_handshake) {
+		client_handshake(client);
+		return;
+	}
+#endif /* WITH_SSL */
+
+	if (!client_flush(client)) {
+		upsdebugx(2, "Disconnect %s (write failure)", client->addr);
+		client_disconnect(client);
+	}
+}
+
+#ifndef WIN32
+/* is <sa> (of a passed socket) bound to the address of the entry <server>? */
+static int listen_same_addr(const stype_t *server, const struct sockaddr *sa)
+{
+	struct addrinfo	hints, *res, *ai;
+	int	same = 0;
+
+	if (listen_unix_path(server->addr)) {
+		return 0;
+	}
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = sa->sa_family;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_protocol = IPPROTO_TCP;
+	hints.ai_flags = AI_PASSIVE;
+
+	if (getaddrinfo(strcmp(server->addr, "*") ? server->addr : NULL,
+		server->port, &hints, &res) != 0
+	) {
+		return 0;
+	}
+
+	for (ai = res; ai && !same; ai = ai->ai_next) {
+		if (sa->sa_family == AF_INET) {
+			const struct sockaddr_in	*a = (const struct sockaddr_in *)sa,
+				*b = (const struct sockaddr_in *)ai->ai_addr;
+
+			same = (a->sin_port == b->sin_port
+				&& !memcmp(&a->sin_addr, &b->sin_addr, sizeof(a->sin_addr)));
+		} else if (sa->sa_family == AF_INET6) {
+			const struct sockaddr_in6	*a = (const struct sockaddr_in6 *)sa,
+				*b = (const struct sockaddr_in6 *)ai->ai_addr;
+
+			same = (a->sin6_port == b->sin6_port
+				&& !memcmp(&a->sin6_addr, &b->sin6_addr, sizeof(a->sin6_addr)));
+		}
+	}
+
+	freeaddrinfo(res);
+	return same;
+}
+
+/* the entry of <list> for the passed socket bound to <ss>, if any */
+static stype_t *listen_find_inherited(stype_t *list, const struct sockaddr_storage *ss)
+{
+	stype_t	*server;
+
+	for (server = list; server; server = server->next) {
+		if (VALID_FD_SOCK(server->sock_fd)) {
 			continue;
+		}
 
-		case 0:
-			continue;	/* haven't gotten a line yet */
+		if (ss->ss_family == AF_UNIX) {
+			const char	*path = listen_unix_path(server->addr);
 
-		default:
-			/* parse error */
-			upslogx(LOG_NOTICE, "Parse error on sock: %s", client->ctx.errmsg);
-			return;
+			if (path && !strcmp(path, ((const struct sockaddr_un *)ss)->sun_path)) {
+				return server;
+			}
+		} else if (listen_same_addr(server, (const struct sockaddr *)ss)) {
+			return server;
 		}
 	}
 
-	return;
+	return NULL;
 }
 
+/* Take the listening sockets passed by a service manager (socket
+ * activation): each serves the LISTEN or METRICS entry it is bound to,
+ * or else a new LISTEN entry of its own. They are listening already, and
+ * connections which came before upsd did are waiting on them. */
+static void listen_inherited(void)
+{
+	int	i, count = nut_listen_fds();
+
+	for (i = 0; i < count; i++) {
+		TYPE_FD_SOCK	sock_fd = NUT_LISTEN_FDS_START + i;
+		struct sockaddr_storage	ss;
+		socklen_t	sslen = sizeof(ss);
+		char	addr[NI_MAXHOST + 5], port[NI_MAXSERV];
+		stype_t	*server;
+		int	v;
+
+		memset(&ss, 0, sizeof(ss));
+		if (getsockname(sock_fd, (struct sockaddr *)&ss, &sslen) != 0) {
+			upslog_with_errno(LOG_WARNING, "Passed socket %d: getsockname", sock_fd);
+			continue;
+		}
+
+		if (ss.ss_family == AF_UNIX) {
+			const char	*path = ((struct sockaddr_un *)&ss)->sun_path;
+
+			if (!*path) {
+				upslogx(LOG_WARNING, "Passed socket %d has no path, ignored", sock_fd);
+				continue;
+			}
+			snprintf(addr, sizeof(addr), "unix:%s", path);
+			snprintf(port, sizeof(port), "%s", string_const(PORT));
+		} else if (ss.ss_family != AF_INET && ss.ss_family != AF_INET6) {
+			upslogx(LOG_WARNING, "Passed socket %d is not for TCP, ignored", sock_fd);
+			continue;
+		} else if ((v = getnameinfo((struct sockaddr *)&ss, sslen,
+				addr, sizeof(addr), port, sizeof(port),
+				NI_NUMERICHOST | NI_NUMERICSERV)) != 0
+		) {
+			upslogx(LOG_WARNING, "Passed socket %d: getnameinfo: %s",
+				sock_fd, gai_strerror(v));
+			continue;
+		}
+
+		if (!(server = listen_find_inherited(firstaddr, &ss))
+		 && !(server = listen_find_inherited(firstmetrics, &ss))
+		 && !(server = stype_add(&firstaddr, addr, port))
+		) {
+			continue;
+		}
+
+		if ((v = fcntl(sock_fd, F_GETFL, 0)) == -1
+		 || fcntl(sock_fd, F_SETFL, v | O_NDELAY) == -1
+		) {
+			fatal_with_errno(EXIT_FAILURE, "%s: fcntl", __func__);
+		}
+
+		server->sock_fd = sock_fd;
+		server->inherited = 1;
+		upslogx(LOG_INFO, "listening on %s port %s (passed by the service manager)",
+			server->addr, server->port);
+	}
+}
+#endif	/* !WIN32 */
+
 void server_load(void)
 {
 	stype_t	*server;
@@ -894,6 +2024,10 @@ void server_load(void)
 		listenersValidLocalhostIPv4 = 0,
 		listenersValidLocalhostIPv6 = 0;
 
+#ifndef WIN32
+	listen_inherited();
+#endif	/* !WIN32 */
+
 	/* default behaviour if no LISTEN address has been specified */
 	if (!firstaddr) {
 		/* Note: default opt_af==AF_UNSPEC so not constrained to only one protocol */
@@ -912,6 +2046,33 @@ void server_load(void)
 		setuptcp(server);
 	}
 
+	/* now that the list is settled, see workers_listen() */
+	for (server = firstaddr; server; server = server->next) {
+		workers_listen(server);
+	}
+
+	/* Register listeners only now, since setuptcp() can move the
+	 * descriptors between list entries when handling `LISTEN *` */
+	for (server = firstaddr; server; server = server->next) {
+		if (VALID_FD_SOCK(server->sock_fd)) {
+			evloop_add(server->sock_fd, EVLOOP_READ, SERVER, server);
+		}
+	}
+
+	/* METRICS listeners do not count as LISTEN interfaces below */
+	for (server = firstmetrics; server; server = server->next) {
+		setuptcp(server);
+	}
+
+	for (server = firstmetrics; server; server = server->next) {
+		if (VALID_FD_SOCK(server->sock_fd)) {
+			evloop_add(server->sock_fd, EVLOOP_READ, SERVER, server);
+		} else if (!allow_not_all_listeners) {
+			fatalx(EXIT_FAILURE, "Fatal error: METRICS %s port %s "
+				"is not available", server->addr, server->port);
+		}
+	}
+
 	/* Account separately from setuptcp() because it can edit the list,
 	 * e.g. when handling `LISTEN *` lines.
 	 */
@@ -1034,6 +2195,13 @@ void server_free(void)
 	}
 
 	firstaddr = NULL;
+
+	for (server = firstmetrics; server; server = snext) {
+		snext = server->next;
+		stype_free(server);
+	}
+
+	firstmetrics = NULL;
 }
 
 static void client_free(void)
@@ -1045,6 +2213,13 @@ static void client_free(void)
 		cnext = client->next;
 		client_disconnect(client);
 	}
+
+	for (client = client_pool; client; client = cnext) {
+		cnext = client->next;
+		free(client);
+	}
+	client_pool = NULL;
+	client_pooled = 0;
 }
 
 static void driver_free(void)
@@ -1059,16 +2234,22 @@ static void driver_free(void)
 
 		if (VALID_FD(ups->sock_fd)) {
 #ifndef WIN32
+			evloop_del(ups->sock_fd);
 			close(ups->sock_fd);
 #else	/* WIN32 */
+			evloop_del_handle(ups->sock_fd);
 			DisconnectNamedPipe(ups->sock_fd);
 			CloseHandle(ups->sock_fd);
 #endif	/* WIN32 */
 			ups->sock_fd = ERROR_FD;
 		}
 
+		timer_cancel(&ups->timer);
 		sstate_infofree(ups);
 		sstate_cmdfree(ups);
+		netwatch_ups_free(ups);
+		history_ups_free(ups);
+		sstate_connfree(ups);
 
 		pconf_finish(&ups->sock_ctx);
 
@@ -1077,12 +2258,17 @@ static void driver_free(void)
 		free(ups->desc);
 		free(ups);
 	}
+
+	firstups = NULL;
+	ups_index_free();
 }
 
 static void upsd_cleanup(void)
 {
 	upsdebugx(1, "%s: starting the end-game", __func__);
 
+	workers_stop();
+
 	if (strlen(pidfn) > 0) {
 		unlink(pidfn);
 	}
@@ -1096,6 +2282,11 @@ static void upsd_cleanup(void)
 	client_free();
 	driver_free();
 	tracking_free();
+	stats_free();
+	metrics_free();
+	history_conf_free();
+	admit_free();
+	timers_free();
 
 	free(statepath);
 	free(datapath);
@@ -1103,8 +2294,7 @@ static void upsd_cleanup(void)
 	free(certname);
 	free(certpasswd);
 
-	free(fds);
-	free(handler);
+	evloop_free();
 
 #ifdef WIN32
 	if (mutex != INVALID_HANDLE_VALUE) {
@@ -1118,9 +2308,9 @@ static void upsd_cleanup(void)
 
 static void poll_reload(void)
 {
+	size_t	maxalloc;
 #ifndef WIN32
 	long	ret;
-	size_t	maxalloc;
 
 	ret = sysconf(_SC_OPEN_MAX);
 
@@ -1130,6 +2320,7 @@ static void poll_reload(void)
 			"but you requested %" PRIdMAX ". The server won't start until this\n"
 			"problem is resolved.\n", ret, (intmax_t)maxconn);
 	}
+#endif	/* !WIN32 */
 
 	if (1 > maxconn) {
 		fatalx(EXIT_FAILURE,
@@ -1146,20 +2337,86 @@ static void poll_reload(void)
 	}
 
 	/* The checks above effectively limit that maxconn is in size_t range */
-	fds = xrealloc(fds, (size_t)maxconn * sizeof(*fds));
-	handler = xrealloc(handler, (size_t)maxconn * sizeof(*handler));
-#else	/* WIN32 */
-	fds = xrealloc(fds, (size_t)MAXIMUM_WAIT_OBJECTS * sizeof(*fds));
-	handler = xrealloc(handler, (size_t)MAXIMUM_WAIT_OBJECTS * sizeof(*handler));
-#endif	/* WIN32 */
+	evloop_resize((size_t)maxconn);
 }
 
 /* instant command and setvar status tracking */
 
+/* timer callback for tracking_cleanup() */
+static void tracking_expire(void *data)
+{
+	NUT_UNUSED_VARIABLE(data);
+	tracking_cleanup();
+}
+
+static void tracking_index_grow(void)
+{
+	tracking_t	*item;
+
+	free(tracking_index);
+	tracking_index_size = tracking_index_size ? tracking_index_size * 2 : 64;
+	tracking_index = xcalloc(tracking_index_size, sizeof(*tracking_index));
+
+	/* oldest first, so that the newest of duplicate ids is found first */
+	for (item = tracking_list; item; item = item->next) {
+		size_t	b = str_hash_nocase(item->id) & (tracking_index_size - 1);
+
+		item->hnext = tracking_index[b];
+		tracking_index[b] = item;
+	}
+}
+
+static tracking_t *tracking_find(const char *id)
+{
+	tracking_t	*item;
+
+	if (!tracking_index)
+		return NULL;
+
+	item = tracking_index[str_hash_nocase(id) & (tracking_index_size - 1)];
+	for (; item; item = item->hnext) {
+		if (!strcasecmp(item->id, id))
+			return item;
+	}
+
+	return NULL;
+}
+
+/* unlink an entry from the list and the index, and free it */
+static void tracking_release(tracking_t *item)
+{
+	tracking_t	**pp;
+
+	pp = &tracking_index[str_hash_nocase(item->id) & (tracking_index_size - 1)];
+	for (; *pp; pp = &(*pp)->hnext) {
+		if (*pp == item) {
+			*pp = item->hnext;
+			break;
+		}
+	}
+
+	if (item->prev)
+		item->prev->next = item->next;
+	else
+		/* deleting first entry */
+		tracking_list = item->next;
+
+	if (item->next)
+		item->next->prev = item->prev;
+	else
+		tracking_last = item->prev;
+
+	tracking_count--;
+
+	free(item->id);
+	free(item);
+}
+
 /* allocate a new status tracking entry */
 int tracking_add(const char *id)
 {
 	tracking_t	*item;
+	size_t	b;
 
 	if ((!tracking_enabled) || (!id))
 		return 0;
@@ -1170,12 +2427,30 @@ int tracking_add(const char *id)
 	item->status = STAT_PENDING;
 	time(&item->request_time);
 
-	if (tracking_list) {
-		tracking_list->prev = item;
-		item->next = tracking_list;
+	if (!timer_armed(&tracking_timer)) {
+		timer_init(&tracking_timer, tracking_expire, NULL);
+		timer_set(&tracking_timer, item->request_time + tracking_delay + 1);
+	}
+
+	/* the newest entry goes last */
+	if (tracking_last) {
+		tracking_last->next = item;
+		item->prev = tracking_last;
+	} else {
+		tracking_list = item;
 	}
 
-	tracking_list = item;
+	tracking_last = item;
+	tracking_count++;
+
+	/* keep the chains short */
+	if (tracking_count > tracking_index_size) {
+		tracking_index_grow();
+	} else {
+		b = str_hash_nocase(item->id) & (tracking_index_size - 1);
+		item->hnext = tracking_index[b];
+		tracking_index[b] = item;
+	}
 
 	return 1;
 }
@@ -1183,29 +2458,24 @@ int tracking_add(const char *id)
 /* set status of a specific tracking entry */
 int tracking_set(const char *id, const char *value)
 {
-	tracking_t	*item, *next_item;
+	tracking_t	*item;
 
 	/* sanity checks */
 	if ((!tracking_list) || (!id) || (!value))
 		return 0;
 
-	for (item = tracking_list; item; item = next_item) {
+	item = tracking_find(id);
+	if (!item)
+		return 0; /* id not found! */
 
-		next_item = item->next;
-
-		if (!strcasecmp(item->id, id)) {
-			item->status = atoi(value);
-			return 1;
-		}
-	}
-
-	return 0; /* id not found! */
+	item->status = atoi(value);
+	return 1;
 }
 
 /* free a specific tracking entry */
 int tracking_del(const char *id)
 {
-	tracking_t	*item, *next_item;
+	tracking_t	*item;
 
 	/* sanity check */
 	if ((!tracking_list) || (!id))
@@ -1213,53 +2483,31 @@ int tracking_del(const char *id)
 
 	upsdebugx(3, "%s: deleting id %s", __func__, id);
 
-	for (item = tracking_list; item; item = next_item) {
-
-		next_item = item->next;
-
-		if (strcasecmp(item->id, id))
-			continue;
-
-		if (item->prev)
-			item->prev->next = item->next;
-		else
-			/* deleting first entry */
-			tracking_list = item->next;
+	item = tracking_find(id);
+	if (!item)
+		return 0; /* id not found! */
 
-		if (item->next)
-			item->next->prev = item->prev;
-
-		free(item->id);
-		free(item);
-
-		return 1;
-
-	}
-
-	return 0; /* id not found! */
+	tracking_release(item);
+	return 1;
 }
 
 /* free all status tracking entries */
 void tracking_free(void)
 {
-	tracking_t	*item, *next_item;
-
-	/* sanity check */
-	if (!tracking_list)
-		return;
-
 	upsdebugx(3, "%s", __func__);
 
-	for (item = tracking_list; item; item = next_item) {
-		next_item = item->next;
-		tracking_del(item->id);
+	while (tracking_list) {
+		tracking_release(tracking_list);
 	}
+
+	free(tracking_index);
+	tracking_index = NULL;
+	tracking_index_size = 0;
 }
 
 /* cleanup status tracking entries according to their age and tracking_delay */
 void tracking_cleanup(void)
 {
-	tracking_t	*item, *next_item;
 	time_t	now;
 
 	/* sanity check */
@@ -1270,32 +2518,32 @@ void tracking_cleanup(void)
 
 	upsdebugx(3, "%s", __func__);
 
-	for (item = tracking_list; item; item = next_item) {
-
-		next_item = item->next;
+	/* the oldest entries are first, stop at the first one to keep */
+	while (tracking_list
+	&& difftime(now, tracking_list->request_time) > tracking_delay) {
+		upsdebugx(3, "%s: deleting id %s", __func__, tracking_list->id);
+		tracking_release(tracking_list);
+	}
 
-		if (difftime(now, item->request_time) > tracking_delay) {
-			tracking_del(item->id);
-		}
+	/* come back when the oldest remaining entry expires */
+	if (tracking_list) {
+		timer_set(&tracking_timer, tracking_list->request_time + tracking_delay + 1);
+	} else {
+		timer_cancel(&tracking_timer);
 	}
 }
 
 /* get status of a specific tracking entry */
 char *tracking_get(const char *id)
 {
-	tracking_t	*item, *next_item;
+	tracking_t	*item;
 
 	/* sanity checks */
 	if ((!tracking_list) || (!id))
 		return "ERR UNKNOWN";
 
-	for (item = tracking_list; item; item = next_item) {
-
-		next_item = item->next;
-
-		if (strcasecmp(item->id, id))
-			continue;
-
+	item = tracking_find(id);
+	if (item) {
 		switch (item->status)
 		{
 		case STAT_PENDING:
@@ -1381,119 +2629,206 @@ static void set_reload_flag(int sig)
 	reload_flag = 1;
 }
 
-/* service requests and check on new data */
-static void mainloop(void)
-{
 #ifndef WIN32
-	int	ret;
-	nfds_t	i;
-#else	/* WIN32 */
-	DWORD	ret;
-	pipe_conn_t * conn;
-#endif	/* WIN32 */
+static void set_stats_flag(int sig)
+{
+	NUT_UNUSED_VARIABLE(sig);
+	stats_flag = 1;
+}
+#endif	/* !WIN32 */
 
-	nfds_t	nfds = 0;
-	upstype_t	*ups;
-	nut_ctype_t		*client, *cnext;
-	stype_t		*server;
-	time_t	now;
+#ifdef WIN32
+/* the upsd command pipe has a new connection, or a command on one */
+static void pipe_event(OVERLAPPED *overlapped)
+{
+	pipe_conn_t	*conn;
 
-	upsnotify(NOTIFY_STATE_WATCHDOG, NULL);
+	if (overlapped == &pipe_connection_overlapped) {
+		upsdebugx(4, "%s: calling pipe_connect() for NAMED_PIPE", __func__);
+		pipe_connect();
+		return;
+	}
 
-	time(&now);
+	for (conn = pipe_connhead; conn; conn = conn->next) {
+		if (&conn->overlapped == overlapped) {
+			break;
+		}
+	}
 
-	if (reload_flag) {
-		upsnotify(NOTIFY_STATE_RELOADING, NULL);
-		conf_reload();
-		poll_reload();
-		reload_flag = 0;
-		upsnotify(NOTIFY_STATE_READY, NULL);
+	if (!conn) {
+		upsdebugx(2, "%s: completion for an unknown pipe connection", __func__);
+		return;
 	}
 
-	/* cleanup instcmd/setvar status tracking entries if needed */
-	tracking_cleanup();
+	upsdebugx(4, "%s: calling pipe_ready() for NAMED_PIPE", __func__);
+	if (pipe_ready(conn)) {
+		if (!strncmp(conn->buf, SIGCMD_STOP, sizeof(SIGCMD_STOP))) {
+			set_exit_flag(1);
+		}
+		else if (!strncmp(conn->buf, SIGCMD_RELOAD, sizeof(SIGCMD_RELOAD))) {
+			set_reload_flag(1);
+		}
+		else {
+			upslogx(LOG_ERR,"Unknown signal");
+		}
 
-#ifndef WIN32
-	/* scan through driver sockets */
-	for (ups = firstups; ups && (nfds < maxconn); ups = ups->next) {
+		upsdebugx(4, "%s: calling pipe_disconnect() for NAMED_PIPE", __func__);
+		pipe_disconnect(conn);
+	}
+}
 
-		/* see if we need to (re)connect to the socket */
-		if (INVALID_FD(ups->sock_fd)) {
-			upsdebugx(1, "%s: UPS [%s] is not currently connected, "
-				"trying to reconnect",
-				__func__, ups->name);
-			ups->sock_fd = sstate_connect(ups);
-			if (INVALID_FD(ups->sock_fd)) {
-				upsdebugx(1, "%s: UPS [%s] is still not connected (FD %d)",
-					__func__, ups->name, ups->sock_fd);
-			} else {
-				upsdebugx(1, "%s: UPS [%s] is now connected as FD %d",
-					__func__, ups->name, ups->sock_fd);
-			}
-			continue;
-		}
+/* new listening instances of the command pipe report to the event loop */
+static void pipe_register(HANDLE handle)
+{
+	if (!evloop_add_handle(handle, NAMED_PIPE, NULL)) {
+		upslogx(LOG_ERR, "Can not watch the command pipe");
+	}
+}
+#endif	/* WIN32 */
 
-		/* throw some warnings if it's not feeding us data any more */
-		if (sstate_dead(ups, maxage)) {
-			ups_data_stale(ups);
-		} else {
-			ups_data_ok(ups);
-		}
+/* service requests and check on new data */
+/* the lane of a client, see CLIENT_LANES */
+static int client_lane(const nut_ctype_t *client)
+{
+	if (client->loginups) {
+		return CLIENT_LANE_CRITICAL;
+	}
 
-		fds[nfds].fd = ups->sock_fd;
-		fds[nfds].events = POLLIN;
+	if (client->cred && client->cred->username && client->cred->password) {
+		return CLIENT_LANE_ADMIN;
+	}
 
-		handler[nfds].type = DRIVER;
-		handler[nfds].data = ups;
+	return CLIENT_LANE_READER;
+}
 
-		nfds++;
+/* the lane of a ready event: only client reads go by their lane */
+static int event_lane(const evloop_event_t *ev)
+{
+	if (ev->handler.type != CLIENT || (ev->revents & (EVLOOP_HUP | EVLOOP_WRITE))) {
+		return CLIENT_LANE_CRITICAL;
 	}
 
-	/* scan through client sockets */
-	for (client = firstclient; client; client = cnext) {
+	return client_lane((const nut_ctype_t *)ev->handler.data);
+}
 
-		cnext = client->next;
+static void mainloop_event(const evloop_event_t *ev)
+{
+	if (ev->revents & EVLOOP_HUP) {
 
-		if (difftime(now, client->last_heard) > 60) {
-			/* shed clients after 1 minute of inactivity */
-			/* FIXME: create an upsd.conf parameter (CLIENT_INACTIVITY_DELAY) */
-			client_disconnect(client);
-			continue;
+		switch(ev->handler.type)
+		{
+		case DRIVER:
+			sstate_disconnect((upstype_t *)ev->handler.data);
+			break;
+		case CLIENT:
+			client_disconnect((nut_ctype_t *)ev->handler.data);
+			break;
+		case SERVER:
+			upsdebugx(2, "%s: server disconnected", __func__);
+			break;
+		case WORKER:
+			if (!workers_channel_event(ev->handler.data, ev->revents)) {
+				exit_flag = SIGTERM;
+			}
+			break;
+#ifdef WIN32
+		case NAMED_PIPE:
+#endif	/* WIN32 */
+		case HANDLER_NONE:
+			break;
 		}
 
-		if (nfds >= maxconn) {
-			/* ignore clients that we are unable to handle */
-			continue;
+		return;
+	}
+
+	if (ev->revents & EVLOOP_WRITE) {
+		if (ev->handler.type == CLIENT) {
+			client_writable((nut_ctype_t *)ev->handler.data);
 		}
 
-		fds[nfds].fd = client->sock_fd;
-		fds[nfds].events = POLLIN;
+		return;
+	}
 
-		handler[nfds].type = CLIENT;
-		handler[nfds].data = client;
+	if (ev->revents & EVLOOP_READ) {
 
-		nfds++;
+		switch(ev->handler.type)
+		{
+		case DRIVER:
+			sstate_readline((upstype_t *)ev->handler.data);
+			break;
+		case CLIENT:
+			client_readline((nut_ctype_t *)ev->handler.data);
+			break;
+		case SERVER:
+			client_connect((stype_t *)ev->handler.data);
+			break;
+		case WORKER:
+			if (!workers_channel_event(ev->handler.data, ev->revents)) {
+				exit_flag = SIGTERM;
+			}
+			break;
+#ifdef WIN32
+		case NAMED_PIPE:
+			pipe_event(ev->overlapped);
+			break;
+#endif	/* WIN32 */
+		case HANDLER_NONE:
+			break;
+		}
 	}
+}
 
-	/* scan through server sockets */
-	for (server = firstaddr; server && (nfds < maxconn); server = server->next) {
+static void mainloop(void)
+{
+	static unsigned char	*ready_lanes = NULL;
+	static size_t	ready_lanes_size = 0, lane_next[CLIENT_LANES];
+	int	ret, lane;
+	nfds_t	i;
+	nfds_t	nfds = 0;
 
-		if (server->sock_fd < 0) {
-			continue;
-		}
+	/* WORKERS are no services of their own to the service manager */
+	if (worker_id < 0) {
+		upsnotify(NOTIFY_STATE_WATCHDOG, NULL);
+	}
+
+	if (stats_flag) {
+		stats_dump();
+		stats_flag = 0;
+	}
 
-		fds[nfds].fd = server->sock_fd;
-		fds[nfds].events = POLLIN;
+	if (reload_flag) {
+		nfds_t	oldmaxconn = maxconn;
 
-		handler[nfds].type = SERVER;
-		handler[nfds].data = server;
+		upsnotify(NOTIFY_STATE_RELOADING, NULL);
+		conf_reload();
+		poll_reload();
+		metrics_changed();
 
-		nfds++;
+		/* workers keep their clients unless they have to size their
+		 * event loops anew */
+		if (maxconn != oldmaxconn) {
+			workers_restart();
+		} else {
+			workers_changed();
+		}
+		reload_flag = 0;
+		upsnotify(NOTIFY_STATE_READY, NULL);
 	}
 
+	/* driver (re)connections and staleness checks, idle clients and
+	 * expired instcmd/setvar status tracking entries: whatever is due */
+	timers_run();
+
+	/* driver and client descriptors are (un)registered with the event
+	 * loop as they are opened and closed */
+	nfds = (nfds_t)evloop_count();
 	upsdebugx(2, "%s: polling %" PRIdMAX " filedescriptors", __func__, (intmax_t)nfds);
 
-	ret = poll(fds, nfds, 2000);
+	/* let WORKERS see what changed during this iteration */
+	workers_publish();
+
+	ret = evloop_wait(timers_next_ms(MAINLOOP_MAX_WAIT));
+	stats_wakeup(ret);
 
 	if (ret == 0) {
 		upsdebugx(2, "%s: no data available", __func__);
@@ -1505,294 +2840,157 @@ static void mainloop(void)
 		return;
 	}
 
-	for (i = 0; i < nfds; i++) {
-
-		if (fds[i].revents & (POLLHUP|POLLERR|POLLNVAL)) {
-
-			switch(handler[i].type)
-			{
-			case DRIVER:
-				sstate_disconnect((upstype_t *)handler[i].data);
-				break;
-			case CLIENT:
-				client_disconnect((nut_ctype_t *)handler[i].data);
-				break;
-			case SERVER:
-				upsdebugx(2, "%s: server disconnected", __func__);
-				break;
-
-#if (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_PUSH_POP) && ( (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_COVERED_SWITCH_DEFAULT) || (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_UNREACHABLE_CODE) )
-# pragma GCC diagnostic push
-#endif
-#ifdef HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_COVERED_SWITCH_DEFAULT
-# pragma GCC diagnostic ignored "-Wcovered-switch-default"
-#endif
-#ifdef HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_UNREACHABLE_CODE
-# pragma GCC diagnostic ignored "-Wunreachable-code"
-#endif
-/* Older CLANG (e.g. clang-3.4) seems to not support the GCC pragmas above */
-#ifdef __clang__
-#pragma clang diagnostic push
-#pragma clang diagnostic ignored "-Wcovered-switch-default"
-#pragma clang diagnostic ignored "-Wunreachable-code"
-#endif
-			/* All enum cases defined as of the time of coding
-			 * have been covered above. Handle later definitions,
-			 * memory corruptions and buggy inputs below...
-			 */
-			default:
-				upsdebugx(2, "%s: <unknown> disconnected", __func__);
-				break;
-#ifdef __clang__
-#pragma clang diagnostic pop
-#endif
-#if (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_PUSH_POP) && ( (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_COVERED_SWITCH_DEFAULT) || (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_UNREACHABLE_CODE) )
-# pragma GCC diagnostic pop
-#endif
+	/* lanes are told before any is served, as serving a request may
+	 * move its client to another lane */
+	if ((size_t)ret > ready_lanes_size) {
+		ready_lanes_size = (size_t)ret;
+		ready_lanes = xrealloc(ready_lanes, ready_lanes_size);
+	}
 
-			}
+	for (i = 0; i < (nfds_t)ret; i++) {
+		const evloop_event_t	*ev = evloop_ready((int)i);
 
-			continue;
-		}
+		ready_lanes[i] = (unsigned char)((ev && ev->handler.type != HANDLER_NONE)
+			? event_lane(ev) : CLIENT_LANES);
+	}
 
-		if (fds[i].revents & POLLIN) {
+	for (lane = 0; lane < CLIENT_LANES; lane++) {
+		size_t	served = 0, deferred = 0, n;
 
-			switch(handler[i].type)
-			{
-			case DRIVER:
-				sstate_readline((upstype_t *)handler[i].data);
-				break;
-			case CLIENT:
-				client_readline((nut_ctype_t *)handler[i].data);
-				break;
-			case SERVER:
-				client_connect((stype_t *)handler[i].data);
-				break;
+		for (n = 0; n < (size_t)ret; n++) {
+			/* the lower lanes start where they left off, so that all
+			 * of their clients get their turn */
+			size_t	idx = lane ? (n + lane_next[lane]) % (size_t)ret : n;
+			const evloop_event_t	*ev;
 
-#if (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_PUSH_POP) && ( (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_COVERED_SWITCH_DEFAULT) || (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_UNREACHABLE_CODE) )
-# pragma GCC diagnostic push
-#endif
-#ifdef HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_COVERED_SWITCH_DEFAULT
-# pragma GCC diagnostic ignored "-Wcovered-switch-default"
-#endif
-#ifdef HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_UNREACHABLE_CODE
-# pragma GCC diagnostic ignored "-Wunreachable-code"
-#endif
-/* Older CLANG (e.g. clang-3.4) seems to not support the GCC pragmas above */
-#ifdef __clang__
-#pragma clang diagnostic push
-#pragma clang diagnostic ignored "-Wcovered-switch-default"
-#pragma clang diagnostic ignored "-Wunreachable-code"
-#endif
-			/* All enum cases defined as of the time of coding
-			 * have been covered above. Handle later definitions,
-			 * memory corruptions and buggy inputs below...
-			 */
-			default:
-				upsdebugx(2, "%s: <unknown> has data available", __func__);
-				break;
-#ifdef __clang__
-#pragma clang diagnostic pop
-#endif
-#if (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_PUSH_POP) && ( (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_COVERED_SWITCH_DEFAULT) || (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_UNREACHABLE_CODE) )
-# pragma GCC diagnostic pop
-#endif
+			if (ready_lanes[idx] != lane) {
+				continue;
 			}
 
-			continue;
-		}
-	}
-#else	/* WIN32 */
-	/* scan through driver sockets */
-	for (ups = firstups; ups && (nfds < maxconn); ups = ups->next) {
+			/* NOTE: handlers may close other descriptors of this
+			 * batch (e.g. kick clients); those become HANDLER_NONE */
+			ev = evloop_ready((int)idx);
+			if (!ev || ev->handler.type == HANDLER_NONE) {
+				continue;
+			}
 
-		/* see if we need to (re)connect to the socket */
-		if (INVALID_FD(ups->sock_fd)) {
-			upsdebugx(1, "%s: UPS [%s] is not currently connected, "
-				"trying to reconnect",
-				__func__, ups->name);
-			ups->sock_fd = sstate_connect(ups);
-			if (INVALID_FD(ups->sock_fd)) {
-				upsdebugx(1, "%s: UPS [%s] is still not connected (FD %d)",
-					__func__, ups->name, ups->sock_fd);
-			} else {
-				upsdebugx(1, "%s: UPS [%s] is now connected as FD %d",
-					__func__, ups->name, ups->sock_fd);
+#ifndef WIN32
+			if (client_lane_budget[lane] && served >= client_lane_budget[lane]) {
+				deferred++;
+				continue;
 			}
-			continue;
+#endif	/* !WIN32 */
+
+			mainloop_event(ev);
+			served++;
+			lane_next[lane] = idx + 1;
 		}
 
-		/* throw some warnings if it's not feeding us data any more */
-		if (sstate_dead(ups, maxage)) {
-			ups_data_stale(ups);
-		} else {
-			ups_data_ok(ups);
+		if (deferred) {
+			upsdebugx(3, "%s: lane %d served %" PRIuSIZE " clients, deferred %" PRIuSIZE,
+				__func__, lane, served, deferred);
+			stats_client_deferred(deferred);
 		}
+	}
+}
 
-		/* FIXME: Is the conditional needed? We got here... */
-		if (VALID_FD(ups->sock_fd)) {
-			fds[nfds] = ups->read_overlapped.hEvent;
+#ifndef WIN32
+/* WORKERS: turn a freshly forked copy of the main process into worker
+ * <idx>, which serves the read-only requests of clients connecting to
+ * its own listening sockets; see workers.c for the rest of the story */
+void upsd_worker_run(int idx)
+{
+	upstype_t	*ups;
+	nut_ctype_t	*client, *cnext;
+	stype_t		*server;
+	struct sigaction	sa;
 
-			handler[nfds].type = DRIVER;
-			handler[nfds].data = ups;
+	/* forget what the main process was watching */
+	evloop_free();
+	evloop_init(evloop_backend_wanted, (size_t)maxconn);
 
-			nfds++;
-		}
-	}
+	/* the main process alone owns the PID file... */
+	memset(pidfn, 0, sizeof(pidfn));
 
-	/* scan through client sockets */
+	/* ...its clients: drop our copies without shutting them down... */
 	for (client = firstclient; client; client = cnext) {
-
 		cnext = client->next;
+		close(client->sock_fd);
+		client->sock_fd = ERROR_FD_SOCK;
+		client_disconnect(client);
+	}
 
-		if (difftime(now, client->last_heard) > 60) {
-			/* shed clients after 1 minute of inactivity */
-			client_disconnect(client);
-			continue;
-		}
-
-		if (nfds >= maxconn) {
-			/* ignore clients that we are unable to handle */
-			continue;
+	/* ...and the driver connections */
+	for (ups = firstups; ups; ups = ups->next) {
+		timer_cancel(&ups->timer);
+		if (VALID_FD(ups->sock_fd)) {
+			close(ups->sock_fd);
+			ups->sock_fd = ERROR_FD;
 		}
-
-		fds[nfds] = client->Event;
-
-		handler[nfds].type = CLIENT;
-		handler[nfds].data = client;
-
-		nfds++;
+		stateshm_close(&ups->shm);
 	}
 
-	/* scan through server sockets */
-	for (server = firstaddr; server && (nfds < maxconn); server = server->next) {
+	timer_cancel(&tracking_timer);
 
-		if (INVALID_FD_SOCK(server->sock_fd)) {
-			continue;
+	/* scrapes are left to the main process */
+	for (server = firstmetrics; server; server = server->next) {
+		if (VALID_FD_SOCK(server->sock_fd)) {
+			close(server->sock_fd);
+			server->sock_fd = ERROR_FD_SOCK;
 		}
-
-		fds[nfds] = server->Event;
-
-		handler[nfds].type = SERVER;
-		handler[nfds].data = server;
-
-		nfds++;
 	}
 
-	/* Wait on the read IO on named pipe  */
-	for (conn = pipe_connhead; conn; conn = conn->next) {
-		fds[nfds] = conn->overlapped.hEvent;
-		handler[nfds].type = NAMED_PIPE;
-		handler[nfds].data = (void *)conn;
-		nfds++;
-	}
-	/* Add the new named pipe connected event */
-	fds[nfds] = pipe_connection_overlapped.hEvent;
-	handler[nfds].type = NAMED_PIPE;
-	handler[nfds].data = NULL;
-	nfds++;
+	/* accept on our own share of each TCP listener; local (unix socket)
+	 * ones remain with the main process, which also removes them */
+	for (server = firstaddr; server; server = server->next) {
+		TYPE_FD_SOCK	sock_fd = ERROR_FD_SOCK;
 
-	upsdebugx(2, "%s: wait for %d filedescriptors", __func__, nfds);
+		if (server->worker_fds) {
+			int	i;
 
-	/* https://docs.microsoft.com/en-us/windows/win32/api/synchapi/nf-synchapi-waitformultipleobjects */
-	ret = WaitForMultipleObjects(nfds,fds,FALSE,2000);
+			for (i = 0; i < worker_count; i++) {
+				if (i == idx) {
+					sock_fd = server->worker_fds[i];
+				} else if (VALID_FD_SOCK(server->worker_fds[i])) {
+					close(server->worker_fds[i]);
+				}
+			}
+			free(server->worker_fds);
+			server->worker_fds = NULL;
+		}
 
-	upsdebugx(6, "%s: wait for filedescriptors done: %" PRIu64, __func__, ret);
+		if (VALID_FD_SOCK(server->sock_fd)) {
+			close(server->sock_fd);
+		}
+		server->sock_fd = sock_fd;
 
-	if (ret == WAIT_TIMEOUT) {
-		upsdebugx(2, "%s: no data available", __func__);
-		return;
+		if (VALID_FD_SOCK(server->sock_fd)
+		 && !evloop_add(server->sock_fd, EVLOOP_READ, SERVER, server)
+		) {
+			fatalx(EXIT_FAILURE, "Worker %d: can not watch %s port %s",
+				idx, server->addr, server->port);
+		}
 	}
 
-	if (ret == WAIT_FAILED) {
-		DWORD err = GetLastError();
-		err = err; /* remove compile time warning */
-		upslog_with_errno(LOG_ERR, "%s", __func__);
-		upsdebugx(2, "%s: wait failed: code 0x%" PRIx64, __func__, err);
-		return;
-	}
+	workers_child_init(idx);
 
-#if (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_PUSH_POP) && ( (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_TYPE_LIMITS) || (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_TAUTOLOGICAL_CONSTANT_OUT_OF_RANGE_COMPARE) )
-# pragma GCC diagnostic push
-#endif
-#ifdef HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_TYPE_LIMITS
-# pragma GCC diagnostic ignored "-Wtype-limits"
-#endif
-#ifdef HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_TAUTOLOGICAL_CONSTANT_OUT_OF_RANGE_COMPARE
-# pragma GCC diagnostic ignored "-Wtautological-constant-out-of-range-compare"
-#endif
-	if (ret >= WAIT_ABANDONED_0 && ret <= WAIT_ABANDONED_0 + nfds - 1) {
-		/* One abandoned mutex object that satisfied the wait? */
-		ret = ret - WAIT_ABANDONED_0;
-		upsdebugx(5, "%s: got abandoned FD array item: %" PRIu64, __func__, nfds, ret);
-		/* FIXME: Should this be handled somehow? Cleanup? Abort?.. */
-	} else
-	if (ret >= WAIT_OBJECT_0 && ret <= WAIT_OBJECT_0 + nfds - 1) {
-		/* Which one handle was triggered this time? */
-		/* Note: WAIT_OBJECT_0 may be currently defined as 0,
-		 * but docs insist on checking and shifting the range */
-		ret = ret - WAIT_OBJECT_0;
-		upsdebugx(5, "%s: got event on FD array item: %" PRIu64, __func__, nfds, ret);
-	}
-#if (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_PUSH_POP) && ( (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_TYPE_LIMITS) || (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_TAUTOLOGICAL_CONSTANT_OUT_OF_RANGE_COMPARE) )
-# pragma GCC diagnostic pop
-#endif
+	/* configuration reloads come as a fresh set of workers */
+	sigemptyset(&sa.sa_mask);
+	sa.sa_flags = 0;
+	sa.sa_handler = SIG_IGN;
+	sigaction(SIGHUP, &sa, NULL);
 
-	if (ret >= nfds) {
-		/* Array indexes are [0..nfds-1] */
-		upsdebugx(2, "%s: unexpected response to query about data available: %" PRIu64, __func__, ret);
-		return;
+	upsdebugx(1, "Worker %d: serving read-only requests", idx);
+
+	while (!exit_flag) {
+		mainloop();
 	}
 
-	upsdebugx(6, "%s: requesting handler[%" PRIu64 "]", __func__, ret);
-	upsdebugx(6, "%s: handler.type=%d handler.data=%p", __func__, handler[ret].type, handler[ret].data);
+	upsdebugx(1, "Worker %d: signal %d, exiting", idx, exit_flag);
 
-	switch(handler[ret].type) {
-		case DRIVER:
-			upsdebugx(4, "%s: calling sstate_readline() for DRIVER", __func__);
-			sstate_readline((upstype_t *)handler[ret].data);
-			break;
-		case CLIENT:
-			upsdebugx(4, "%s: calling client_readline() for CLIENT", __func__);
-			client_readline((nut_ctype_t *)handler[ret].data);
-			break;
-		case SERVER:
-			upsdebugx(4, "%s: calling client_connect() for SERVER", __func__);
-			client_connect((stype_t *)handler[ret].data);
-			break;
-		case NAMED_PIPE:
-			/* a new pipe connection has been signaled */
-			if (fds[ret] == pipe_connection_overlapped.hEvent) {
-				upsdebugx(4, "%s: calling pipe_connect() for NAMED_PIPE", __func__);
-				pipe_connect();
-			}
-			/* one of the read event handle has been signaled */
-			else {
-				upsdebugx(4, "%s: calling pipe_ready() for NAMED_PIPE", __func__);
-				pipe_conn_t * conn = handler[ret].data;
-				if ( pipe_ready(conn) ) {
-					if (!strncmp(conn->buf, SIGCMD_STOP, sizeof(SIGCMD_STOP))) {
-						set_exit_flag(1);
-					}
-					else if (!strncmp(conn->buf, SIGCMD_RELOAD, sizeof(SIGCMD_RELOAD))) {
-						set_reload_flag(1);
-					}
-					else {
-						upslogx(LOG_ERR,"Unknown signal"
-						       );
-					}
-
-					upsdebugx(4, "%s: calling pipe_disconnect() for NAMED_PIPE", __func__);
-					pipe_disconnect(conn);
-				}
-			}
-			break;
-		default:
-			upsdebugx(2, "%s: <unknown> has data available", __func__);
-			break;
-	}
-#endif	/* WIN32 */
+	exit(EXIT_SUCCESS);
 }
+#endif	/* !WIN32 */
 
 static void help(const char *arg_progname)
 	__attribute__((noreturn));
@@ -1859,7 +3057,12 @@ static void setup_signals(void)
 	/* handle reloading */
 	sa.sa_handler = set_reload_flag;
 	sigaction(SIGHUP, &sa, NULL);
+
+	/* log the activity counters */
+	sa.sa_handler = set_stats_flag;
+	sigaction(SIGUSR1, &sa, NULL);
 #else	/* WIN32 */
+	pipe_create_hook = pipe_register;
 	pipe_create(UPSD_PIPE_NAME);
 #endif	/* WIN32 */
 }
@@ -2183,12 +3386,18 @@ int main(int argc, char **argv)
 	/* FIXME: Check for overflows (and int size of nfds_t vs. long) - see get_max_pid_t() for example */
 	maxconn = (nfds_t)sysconf(_SC_OPEN_MAX);
 #else	/* WIN32 */
-	maxconn = 64;  /*FIXME NUT_WIN32_INCOMPLETE : arbitrary value, need adjustement */
+	/* no MAXIMUM_WAIT_OBJECTS ceiling with the completion port loop, but
+	 * no system limit to ask for either (may be overridden in upsd.conf) */
+	maxconn = 1024;
 #endif	/* WIN32 */
 
 	/* handle upsd.conf */
 	load_upsdconf(0);	/* 0 = initial */
 
+	/* descriptors get registered as soon as listeners and driver
+	 * sockets are opened below, so the event loop must exist first */
+	evloop_init(evloop_backend_wanted, (size_t)maxconn);
+
 	/* CLI debug level can not be smaller than debug_min specified
 	 * in upsd.conf. Note that non-zero debug_min does not impact
 	 * foreground running mode.
@@ -2295,6 +3504,11 @@ int main(int argc, char **argv)
 	/* initialize SSL (keyfile must be readable by nut user) */
 	ssl_init();
 
+	stats_init();
+
+	/* fork the WORKERS, if any, now that everything is loaded */
+	workers_start();
+
 	upsnotify(NOTIFY_STATE_READY_WITH_PID, NULL);
 
 	while (!exit_flag) {
@@ -52,6 +52,10 @@ typedef unsigned long int nfds_t;
 
 #define NUT_NET_ANSWER_MAX SMALLBUF
 
+/* sendback() collects a response in the per-client buffer, which is
+ * written out when the request is finished or when it grows this big */
+#define NUT_NET_OUTBUF_FLUSH	16384
+
 #ifdef __cplusplus
 /* *INDENT-OFF* */
 extern "C" {
@@ -61,14 +65,25 @@ extern "C" {
 /* prototypes from upsd.c */
 
 upstype_t *get_ups_ptr(const char *upsname);
+void ups_index_add(upstype_t *ups);
+void ups_index_del(upstype_t *ups);
 int ups_available(const upstype_t *ups, nut_ctype_t *client);
+void ups_check(void *data);
 
 void listen_add(const char *addr, const char *port);
+void metrics_listen_add(const char *addr, const char *port);
 
 void kick_login_clients(const char *upsname);
 int sendback(nut_ctype_t *client, const char *fmt, ...)
 	__attribute__ ((__format__ (__printf__, 2, 3)));
+int sendback_raw(nut_ctype_t *client, const char *buf, size_t len);
 int send_err(nut_ctype_t *client, const char *errtype);
+int client_flush(nut_ctype_t *client);
+void client_drop(nut_ctype_t *client);
+void client_adopt(TYPE_FD_SOCK sock_fd, const char *addr,
+	const char *out, size_t outlen, const char *in, size_t inlen);
+void upsd_worker_run(int idx)
+	__attribute__((noreturn));
 
 void server_load(void);
 void server_free(void);
@@ -97,9 +112,24 @@ int tracking_enable(void);
 int tracking_disable(void);
 int tracking_is_enabled(void);
 
+/* what to do with a client whose unsent answers exceed MAXSENDQUEUE */
+typedef enum {
+	SENDQ_POLICY_DISCONNECT = 0,	/* drop the client connection */
+	SENDQ_POLICY_WAIT		/* block up to NUT_NET_SENDQ_WAIT_MS for it */
+} sendq_policy_t;
+
+#define NUT_NET_SENDQ_WAIT_MS	5000
+
 /* declarations from upsd.c */
 extern int		maxage, tracking_delay, allow_no_device, allow_not_all_listeners;
+extern int		shared_state, framed_socket, trace_sample, mem_stats;
+extern int		client_inactivity_delay;
+extern size_t		sendq_max;
+extern sendq_policy_t	sendq_policy;
 extern nfds_t		maxconn;
+extern size_t		maxconn_per_addr;
+extern double		accept_rate;
+extern size_t		accept_burst;
 extern char		*statepath, *datapath;
 extern upstype_t	*firstups;
 extern nut_ctype_t	*firstclient;
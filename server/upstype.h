@@ -23,8 +23,17 @@
 #define NUT_UPSTYPE_H_SEEN 1
 
 #include "parseconf.h"
+#include "state.h"	/* st_tree_timespec_t */
+#include "stateshm.h"
+#include "sockframe.h"
+#include "timers.h"
+#include "stats.h"
 #include "common.h"
 
+#ifdef WIN32
+# include "wincompat.h"	/* pipe_reads_t */
+#endif	/* WIN32 */
+
 #ifdef __cplusplus
 /* *INDENT-OFF* */
 extern "C" {
@@ -38,8 +47,10 @@ typedef struct upstype_s {
 	char			*desc;
 	TYPE_FD			sock_fd;
 #ifdef WIN32
-	char 			buf[SMALLBUF];
-	OVERLAPPED		read_overlapped;
+	pipe_reads_t		reads;	/* kept posted on the pipe, see sstate_readline() */
+#else	/* !WIN32 */
+	char			*rbuf;	/* reused by sstate_readline(), grows with the traffic */
+	size_t			rbufsize;
 #endif	/* WIN32 */
 	int			stale;
 	int			dumpdone;
@@ -47,16 +58,64 @@ typedef struct upstype_s {
 	time_t			last_heard;
 	time_t			last_ping;
 	time_t			last_connfail;
+	nut_timer_t		timer;	/* reconnect and staleness checks, see ups_check() */
 	PCONF_CTX_t		sock_ctx;
+	stateshm_ctx_t		shm;	/* states shared by the driver, see SHARED_STATE */
+
+	/* the driver sends records, see FRAMED_SOCKET: the names they refer
+	 * to, and the start of a record cut short by the end of a read */
+	int			framed;
+	sockframe_names_t	frame_names;
+	char			*framebuf;
+	size_t			framelen;
+
+	/* the run of the driver and its last change we know of, see SEQ;
+	 * while resuming, the states are kept until the driver tells whether
+	 * it sends what we missed (RESUME) or all again */
+	char			*seq_epoch;
+	uint64_t		seq;
+	int			resuming;
 	struct st_tree_s	*inforoot;
 	struct cmdlist_s	*cmdlist;
 
+	/* pre-serialized "VAR" lines for LIST VAR, see netlist.c;
+	 * dropped by sstate_info_changed() when inforoot is modified */
+	char			*listvar_buf;
+	size_t			listvar_len;
+	int			listvar_valid;
+	int			listvar_fsd;	/* ups->fsd when it was made */
+
+	/* clients subscribed with WATCH, see netwatch.c */
+	struct nut_watch_s	*watchers;
+
+	/* for LIST VAR ... SINCE: names of recently deleted variables, and
+	 * the time before which changes (including FSD) are not known */
+	struct sstate_delvar_s	*delvars;
+	size_t			numdelvars;
+	st_tree_timespec_t	delta_horizon;
+
+	/* the last SS_TRACE_MAX changes sent with a TRACE time (ring, the
+	 * oldest at tracenext), and when the chunk being parsed was read */
+	struct sstate_trace_s	*traces;
+	size_t			tracenext;
+	uint64_t		trace_recv;
+
+	stats_ups_t		stats;	/* see stats.c */
+
+	/* recent values of the variables named by HISTORY, see history.c */
+	struct history_ring_s	*history;
+
 	int	numlogins;
+	struct nut_ctype_s	*logins;	/* the clients logged into it, see net_login() */
 	int	fsd;		/* forced shutdown in effect? */
 
+	/* in WORKERS processes: driver connection of the main process */
+	int	worker_connected;
+
 	int	retain;
 
 	struct upstype_s	*next;
+	struct upstype_s	*hnext;	/* chain in the by-name index, see get_ups_ptr() */
 
 } upstype_t;
 
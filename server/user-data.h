@@ -31,22 +31,35 @@ extern "C" {
 /* *INDENT-ON* */
 #endif
 
-typedef struct {
+/* chain entry of the instcmd hash set of a user */
+typedef struct instcmdlist_s {
 	char	*cmd;
-	void	*next;
+	struct instcmdlist_s	*next;
 } instcmdlist_t;
 
-typedef struct {
-	char	*action;
-	void	*next;
-} actionlist_t;
+/* "actions" of a user, compiled into a bit set */
+#define USER_ACTION_SET		0x0001
+#define USER_ACTION_FSD		0x0002
+#define USER_ACTION_LOGIN	0x0004
+#define USER_ACTION_MASTER	0x0008
+#define USER_ACTION_PRIMARY	0x0010
 
-typedef struct {
+typedef struct ulist_s {
 	char	*username;
-	char	*password;
-	instcmdlist_t *firstcmd;
-	actionlist_t  *firstaction;
-	void	*next;
+	char	*password;	/* plain text "password", or NULL */
+	char	*password_hash;	/* crypt(3) "password_hash", or NULL */
+
+	/* instcmds allowed, by (case-insensitive) name; the bucket
+	 * count is a power of two (or 0 if there are none) */
+	instcmdlist_t	**cmdhash;
+	size_t	cmdhashsize;
+	size_t	numcmds;
+	int	allcmds;	/* "instcmds = all" */
+
+	unsigned int	actions;	/* USER_ACTION_* */
+
+	struct ulist_s	*next;	/* in upsd.users order */
+	struct ulist_s	*hnext;	/* chain in the by-name index */
 } ulist_t;
 
 #ifdef __cplusplus
@@ -26,43 +26,120 @@
 #include <arpa/inet.h>
 #endif	/* !WIN32 */
 
+#include <ctype.h>
+#ifdef HAVE_CRYPT_H
+#include <crypt.h>
+#endif	/* HAVE_CRYPT_H */
+
 #include "common.h"
 #include "parseconf.h"
 
 #include "user.h"
 #include "user-data.h"
 
-static ulist_t	*users = NULL;
+static ulist_t	*users = NULL, *lastuser = NULL;
 
 static	ulist_t	*curr_user;
 
+/* index of users by (case-sensitive) name; the bucket count
+ * is a power of two */
+static ulist_t	**user_index = NULL;
+static size_t	user_index_size = 0, user_index_count = 0;
+
+/* changes whenever the users are flushed, so that results cached in
+ * a user_auth_t from an older upsd.users are not trusted */
+static unsigned int	users_gen = 1;
+
+/* credentials of the client connections, by (username, password);
+ * the bucket count is a power of two */
+static user_cred_t	**cred_index = NULL;
+static size_t	cred_index_size = 0, cred_index_count = 0;
+
+static const struct {
+	const char	*name;
+	unsigned int	bit;
+} user_actions[] = {
+	{ "SET",	USER_ACTION_SET },
+	{ "FSD",	USER_ACTION_FSD },
+	{ "LOGIN",	USER_ACTION_LOGIN },
+	{ "MASTER",	USER_ACTION_MASTER },
+	{ "PRIMARY",	USER_ACTION_PRIMARY },
+	{ NULL,		0 }
+};
+
+static void user_index_grow(void)
+{
+	ulist_t	**old = user_index, *user, *unext;
+	size_t	oldsize = user_index_size, i;
+
+	user_index_size = oldsize ? oldsize * 2 : 16;
+	user_index = xcalloc(user_index_size, sizeof(*user_index));
+
+	for (i = 0; i < oldsize; i++) {
+		for (user = old[i]; user; user = unext) {
+			size_t	b = str_hash_nocase(user->username) & (user_index_size - 1);
+
+			unext = user->hnext;
+			user->hnext = user_index[b];
+			user_index[b] = user;
+		}
+	}
+
+	free(old);
+}
+
+static ulist_t *user_find(const char *un)
+{
+	ulist_t	*user;
+
+	if (!user_index) {
+		return NULL;
+	}
+
+	user = user_index[str_hash_nocase(un) & (user_index_size - 1)];
+	for (; user; user = user->hnext) {
+		if (!strcmp(user->username, un)) {
+			return user;
+		}
+	}
+
+	return NULL;
+}
+
 /* create a new user entry */
 static void user_add(const char *un)
 {
-	ulist_t	*tmp, *last = NULL;
+	ulist_t	*tmp;
+	size_t	b;
 
 	if (!un) {
 		return;
 	}
 
-	for (tmp = users; tmp != NULL; tmp = tmp->next) {
-
-		last = tmp;
-
-		if (!strcmp(tmp->username, un)) {
-			fprintf(stderr, "Ignoring duplicate user %s\n", un);
-			return;
-		}
+	if (user_find(un)) {
+		fprintf(stderr, "Ignoring duplicate user %s\n", un);
+		return;
 	}
 
 	tmp = xcalloc(1, sizeof(*tmp));
 	tmp->username = xstrdup(un);
 
-	if (last) {
-		last->next = tmp;
+	if (lastuser) {
+		lastuser->next = tmp;
 	} else {
 		users = tmp;
 	}
+	lastuser = tmp;
+
+	/* keep the chains short */
+	if (user_index_count >= user_index_size) {
+		user_index_grow();
+	}
+
+	b = str_hash_nocase(tmp->username) & (user_index_size - 1);
+	tmp->hnext = user_index[b];
+	user_index[b] = tmp;
+	user_index_count++;
 
 	/* remember who we're working on */
 	curr_user = tmp;
@@ -90,106 +167,170 @@ static void user_password(const char *pw)
 	curr_user->password = xstrdup(pw);
 }
 
-/* attach allowed instcmds to user */
-static void user_add_instcmd(const char *cmd)
+/* set password hash, as made by crypt(3) */
+static void user_password_hash(const char *hash)
 {
-	instcmdlist_t	*tmp, *last = NULL;
-
 	if (!curr_user) {
-		upslogx(LOG_WARNING, "Ignoring instcmd definition outside "
+		upslogx(LOG_WARNING, "Ignoring password_hash definition outside "
 			"user section");
 		return;
 	}
 
-	if (!cmd) {
+	if (!hash) {
 		return;
 	}
 
-	for (tmp = curr_user->firstcmd; tmp != NULL; tmp = tmp->next) {
+	if (curr_user->password_hash) {
+		fprintf(stderr, "Ignoring duplicate password_hash for %s\n",
+			curr_user->username);
+		return;
+	}
+
+#ifndef HAVE_CRYPT
+	upslogx(LOG_WARNING, "This upsd was built without crypt(3) support: "
+		"user %s can not log in with a password_hash",
+		curr_user->username);
+#endif	/* !HAVE_CRYPT */
+
+	curr_user->password_hash = xstrdup(hash);
+}
+
+static const instcmdlist_t *user_findcmd(const ulist_t *user, const char *cmd)
+{
+	const instcmdlist_t	*tmp;
 
-		last = tmp;
+	if (!user->cmdhash) {
+		return NULL;
+	}
 
-		/* ignore duplicates */
+	tmp = user->cmdhash[str_hash_nocase(cmd) & (user->cmdhashsize - 1)];
+	for (; tmp != NULL; tmp = tmp->next) {
 		if (!strcasecmp(tmp->cmd, cmd)) {
-			return;
+			return tmp;
 		}
 	}
 
-	upsdebugx(2, "user_add_instcmd: adding '%s' for %s",
-				cmd, curr_user->username);
+	return NULL;
+}
 
-	tmp = xcalloc(1, sizeof(*tmp));
+static void user_cmdhash_grow(ulist_t *user)
+{
+	instcmdlist_t	**old = user->cmdhash, *tmp, *tnext;
+	size_t	oldsize = user->cmdhashsize, i;
 
-	tmp->cmd = xstrdup(cmd);
+	user->cmdhashsize = oldsize ? oldsize * 2 : 8;
+	user->cmdhash = xcalloc(user->cmdhashsize, sizeof(*user->cmdhash));
 
-	if (last) {
-		last->next = tmp;
-	} else {
-		curr_user->firstcmd = tmp;
+	for (i = 0; i < oldsize; i++) {
+		for (tmp = old[i]; tmp; tmp = tnext) {
+			size_t	b = str_hash_nocase(tmp->cmd) & (user->cmdhashsize - 1);
+
+			tnext = tmp->next;
+			tmp->next = user->cmdhash[b];
+			user->cmdhash[b] = tmp;
+		}
 	}
+
+	free(old);
 }
 
-static actionlist_t *addaction(actionlist_t *base, const char *action)
+/* attach allowed instcmds to user */
+static void user_add_instcmd(const char *cmd)
 {
-	actionlist_t	*tmp, *last = NULL;
+	instcmdlist_t	*tmp;
+	size_t	b;
 
-	if (!action) {
-		return base;
+	if (!curr_user) {
+		upslogx(LOG_WARNING, "Ignoring instcmd definition outside "
+			"user section");
+		return;
 	}
 
-	for (tmp = base; tmp != NULL; tmp = tmp->next) {
+	if (!cmd) {
+		return;
+	}
+
+	upsdebugx(2, "user_add_instcmd: adding '%s' for %s",
+				cmd, curr_user->username);
 
-		last = tmp;
+	if (!strcasecmp(cmd, "all")) {
+		curr_user->allcmds = 1;
+		return;
+	}
+
+	/* ignore duplicates */
+	if (user_findcmd(curr_user, cmd)) {
+		return;
+	}
+
+	if (curr_user->numcmds >= curr_user->cmdhashsize) {
+		user_cmdhash_grow(curr_user);
 	}
 
 	tmp = xcalloc(1, sizeof(*tmp));
-	tmp->action = xstrdup(action);
+	tmp->cmd = xstrdup(cmd);
 
-	if (last) {
-		last->next = tmp;
-		return base;
+	b = str_hash_nocase(cmd) & (curr_user->cmdhashsize - 1);
+	tmp->next = curr_user->cmdhash[b];
+	curr_user->cmdhash[b] = tmp;
+	curr_user->numcmds++;
+}
+
+/* USER_ACTION_* bit for an action name, 0 if unknown */
+static unsigned int action_bit(const char *action)
+{
+	size_t	i;
+
+	for (i = 0; user_actions[i].name; i++) {
+		if (!strcasecmp(user_actions[i].name, action)) {
+			return user_actions[i].bit;
+		}
 	}
 
-	return tmp;
+	return 0;
 }
 
 /* attach allowed actions to user */
 static void user_add_action(const char *act)
 {
+	unsigned int	bit;
+
 	if (!curr_user) {
 		upslogx(LOG_WARNING, "Ignoring action definition outside "
 			"user section");
 		return;
 	}
 
+	if (!act) {
+		return;
+	}
+
 	upsdebugx(2, "user_add_action: adding '%s' for %s",
 				act, curr_user->username);
 
-	curr_user->firstaction = addaction(curr_user->firstaction, act);
-}
-
-static void flushcmd(instcmdlist_t *ptr)
-{
-	if (!ptr) {
+	if (!(bit = action_bit(act))) {
+		upslogx(LOG_WARNING, "Ignoring unknown action %s for %s",
+			act, curr_user->username);
 		return;
 	}
 
-	flushcmd(ptr->next);
-
-	free(ptr->cmd);
-	free(ptr);
+	curr_user->actions |= bit;
 }
 
-static void flushaction(actionlist_t *ptr)
+static void flushcmds(ulist_t *user)
 {
-	if (!ptr) {
-		return;
-	}
+	instcmdlist_t	*tmp, *tnext;
+	size_t	i;
 
-	flushaction(ptr->next);
+	for (i = 0; i < user->cmdhashsize; i++) {
+		for (tmp = user->cmdhash[i]; tmp; tmp = tnext) {
+			tnext = tmp->next;
+			free(tmp->cmd);
+			free(tmp);
+		}
+	}
 
-	free(ptr->action);
-	free(ptr);
+	free(user->cmdhash);
 }
 
 static void flushuser(ulist_t *ptr)
@@ -199,11 +340,11 @@ static void flushuser(ulist_t *ptr)
 	}
 
 	flushuser(ptr->next);
-	flushcmd(ptr->firstcmd);
-	flushaction(ptr->firstaction);
+	flushcmds(ptr);
 
 	free(ptr->username);
 	free(ptr->password);
+	free(ptr->password_hash);
 	free(ptr);
 }
 
@@ -212,113 +353,190 @@ void user_flush(void)
 {
 	flushuser(users);
 	users = NULL;
-}
+	lastuser = NULL;
+	curr_user = NULL;
 
-static int user_matchinstcmd(ulist_t *user, const char * cmd)
-{
-	instcmdlist_t	*tmp;
+	free(user_index);
+	user_index = NULL;
+	user_index_size = 0;
+	user_index_count = 0;
 
-	for (tmp = user->firstcmd; tmp != NULL; tmp = tmp->next) {
+	users_gen++;
+}
 
-		if (!strcasecmp(tmp->cmd, cmd)) {
-			return 1;	/* good */
-		}
+static int user_password_ok(const ulist_t *user, const char *pw)
+{
+	if (user->password_hash) {
+#ifdef HAVE_CRYPT
+		const char	*res = crypt(pw, user->password_hash);
 
-		if (!strcasecmp(tmp->cmd, "all")) {
-			return 1;	/* good */
-		}
+		return res && !strcmp(res, user->password_hash);
+#else	/* !HAVE_CRYPT */
+		return 0;
+#endif	/* !HAVE_CRYPT */
 	}
 
-	return 0;	/* fail */
+	return user->password && !strcmp(user->password, pw);
 }
 
-int user_checkinstcmd(const char *un, const char *pw, const char *cmd)
+/* the user entry matching the credentials, or NULL if there is none;
+ * the outcome is kept in *auth (if given), and taken from there as long
+ * as upsd.users was not reloaded, since verifying a password_hash is
+ * (on purpose) expensive */
+static const ulist_t *user_verify(user_auth_t *auth, const char *un, const char *pw)
 {
-	ulist_t	*tmp;
+	const ulist_t	*user;
 
-	if ((!un) || (!pw) || (!cmd)) {
-		return 0;	/* failed */
+	if (auth && auth->gen == users_gen) {
+		return (const ulist_t *)auth->user;
 	}
 
-	for (tmp = users; tmp != NULL; tmp = tmp->next) {
+	user = user_find(un);
 
-		/* let's be paranoid before we call strcmp */
+	if (user && !user_password_ok(user, pw)) {
+		upsdebugx(2, "%s: password mismatch for %s", __func__, un);
+		user = NULL;
+	}
 
-		if ((!tmp->username) || (!tmp->password)) {
-			continue;
-		}
+	if (auth) {
+		auth->user = user;
+		auth->gen = users_gen;
+	}
 
-		if (strcmp(tmp->username, un)) {
-			continue;
-		}
+	return user;
+}
 
+static size_t cred_hash(const char *un, const char *pw)
+{
+	size_t	h = un ? str_hash_nocase(un) : FNV1A_INIT;
 
-		if (strcmp(tmp->password, pw)) {
-			/* password mismatch */
-			return 0;	/* fail */
+	/* going on over the password, which is compared as it is */
+	return pw ? fnv1a_hash(h, pw, strlen(pw)) : h;
+}
+
+static int cred_same(const char *a, const char *b)
+{
+	return (!a && !b) || (a && b && !strcmp(a, b));
+}
+
+static void cred_index_grow(void)
+{
+	user_cred_t	**old = cred_index, *cred, *cnext;
+	size_t	oldsize = cred_index_size, i;
+
+	cred_index_size = oldsize ? oldsize * 2 : 16;
+	cred_index = xcalloc(cred_index_size, sizeof(*cred_index));
+
+	for (i = 0; i < oldsize; i++) {
+		for (cred = old[i]; cred; cred = cnext) {
+			size_t	b = cred_hash(cred->username, cred->password) & (cred_index_size - 1);
+
+			cnext = cred->next;
+			cred->next = cred_index[b];
+			cred_index[b] = cred;
 		}
+	}
+
+	free(old);
+}
 
-		if (!user_matchinstcmd(tmp, cmd)) {
-			return 0;		/* fail */
+/* a reference to the credentials made of <un> and <pw> (either may be
+ * NULL), for user_cred_put() to drop */
+user_cred_t *user_cred_get(const char *un, const char *pw)
+{
+	user_cred_t	*cred;
+	size_t	b;
+
+	if (cred_index) {
+		b = cred_hash(un, pw) & (cred_index_size - 1);
+		for (cred = cred_index[b]; cred; cred = cred->next) {
+			if (cred_same(cred->username, un) && cred_same(cred->password, pw)) {
+				cred->refs++;
+				return cred;
+			}
 		}
+	}
 
-		/* passed all checks */
-		return 1;	/* good */
+	if (cred_index_count >= cred_index_size) {
+		cred_index_grow();
 	}
 
-	/* username not found */
-	return 0;	/* fail */
+	cred = xcalloc(1, sizeof(*cred));
+	cred->username = un ? xstrdup(un) : NULL;
+	cred->password = pw ? xstrdup(pw) : NULL;
+	cred->refs = 1;
+
+	b = cred_hash(un, pw) & (cred_index_size - 1);
+	cred->next = cred_index[b];
+	cred_index[b] = cred;
+	cred_index_count++;
+
+	return cred;
 }
 
-static int user_matchaction(ulist_t *user, const char *action)
+void user_cred_put(user_cred_t *cred)
 {
-	actionlist_t	*tmp;
+	user_cred_t	**cptr;
 
-	for (tmp = user->firstaction; tmp != NULL; tmp = tmp->next) {
+	if (!cred || --cred->refs > 0) {
+		return;
+	}
 
-		if (!strcasecmp(tmp->action, action)) {
-			return 1;	/* good */
-		}
+	cptr = &cred_index[cred_hash(cred->username, cred->password) & (cred_index_size - 1)];
+	while (*cptr != cred) {
+		cptr = &(*cptr)->next;
 	}
+	*cptr = cred->next;
 
-	return 0;	/* fail */
+	free(cred->username);
+	free(cred->password);
+	free(cred);
+
+	if (--cred_index_count == 0) {
+		free(cred_index);
+		cred_index = NULL;
+		cred_index_size = 0;
+	}
 }
 
-int user_checkaction(const char *un, const char *pw, const char *action)
+int user_checkinstcmd(user_cred_t *cred, const char *cmd)
 {
-	ulist_t	*tmp;
+	const ulist_t	*user;
 
-	if ((!un) || (!pw) || (!action))
+	if ((!cred) || (!cred->username) || (!cred->password) || (!cmd)) {
 		return 0;	/* failed */
+	}
 
-	for (tmp = users; tmp != NULL; tmp = tmp->next) {
+	if (!(user = user_verify(&cred->auth, cred->username, cred->password))) {
+		return 0;	/* fail */
+	}
 
-		/* let's be paranoid before we call strcmp */
+	if (!user->allcmds && !user_findcmd(user, cmd)) {
+		return 0;	/* fail */
+	}
 
-		if ((!tmp->username) || (!tmp->password)) {
-			continue;
-		}
+	/* passed all checks */
+	return 1;	/* good */
+}
 
-		if (strcmp(tmp->username, un)) {
-			continue;
-		}
+int user_checkaction(user_cred_t *cred, const char *action)
+{
+	const ulist_t	*user;
 
-		if (strcmp(tmp->password, pw)) {
-			upsdebugx(2, "user_checkaction: password mismatch");
-			return 0;	/* fail */
-		}
+	if ((!cred) || (!cred->username) || (!cred->password) || (!action))
+		return 0;	/* failed */
 
-		if (!user_matchaction(tmp, action)) {
-			upsdebugx(2, "user_matchaction: failed");
-			return 0;	/* fail */
-		}
+	if (!(user = user_verify(&cred->auth, cred->username, cred->password))) {
+		return 0;	/* fail */
+	}
 
-		/* passed all checks */
-		return 1;	/* good */
+	if (!(user->actions & action_bit(action))) {
+		upsdebugx(2, "user_matchaction: failed");
+		return 0;	/* fail */
 	}
 
-	/* username not found */
-	return 0;	/* fail */
+	/* passed all checks */
+	return 1;	/* good */
 }
 
 /* handle "upsmon primary" and "upsmon secondary" for nicer configurations */
@@ -350,6 +568,11 @@ static void parse_var(char *var, char *val)
 		return;
 	}
 
+	if (!strcasecmp(var, "password_hash")) {
+		user_password_hash(val);
+		return;
+	}
+
 	if (!strcasecmp(var, "instcmds")) {
 		user_add_instcmd(val);
 		return;
@@ -499,4 +722,13 @@ void user_load(void)
 	}
 
 	pconf_finish(&ctx);
+
+	for (curr_user = users; curr_user; curr_user = curr_user->next) {
+		if (curr_user->password && curr_user->password_hash) {
+			upslogx(LOG_WARNING, "User %s has both a password and a "
+				"password_hash, only the latter is used",
+				curr_user->username);
+		}
+	}
+	curr_user = NULL;
 }
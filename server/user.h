@@ -31,10 +31,34 @@ extern "C" {
 /* *INDENT-ON* */
 #endif
 
+/* Outcome of checking the credentials of a client connection, which
+ * can not change for its lifetime: kept there (zeroed initially) and
+ * passed to the checks, so a password is verified just once as long as
+ * upsd.users is not reloaded */
+typedef struct {
+	const void	*user;	/* matching user entry, NULL if none */
+	unsigned int	gen;	/* of the users it was checked against */
+} user_auth_t;
+
+/* The credentials given by client connections (USERNAME and PASSWORD),
+ * with the outcome of checking them: shared by all the connections which
+ * gave the same, so that the many upsmon sessions of one account do not
+ * each keep a copy of them (nor verify the password each) */
+typedef struct user_cred_s {
+	char	*username;	/* NULL if not given (yet) */
+	char	*password;	/* NULL if not given (yet) */
+	user_auth_t	auth;
+	size_t	refs;
+	struct user_cred_s	*next;	/* in its hash bucket */
+} user_cred_t;
+
 void user_load(void);
 
-int user_checkinstcmd(const char *un, const char *pw, const char *cmd);
-int user_checkaction(const char *un, const char *pw, const char *action);
+user_cred_t *user_cred_get(const char *un, const char *pw);
+void user_cred_put(user_cred_t *cred);
+
+int user_checkinstcmd(user_cred_t *cred, const char *cmd);
+int user_checkaction(user_cred_t *cred, const char *action);
 
 void user_flush(void);
 
@@ -0,0 +1,1023 @@
+/* workers.c - read-only worker processes for upsd (WORKERS in upsd.conf)
+
+   Copyright (C)
+	2026	Network UPS Tools developers
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+/* The main upsd process talks to the drivers and owns everything that
+ * changes state: logins, FSD, SET and INSTCMD with their tracking, WATCH
+ * subscriptions and TLS sessions. Each worker process accepts connections
+ * on its own SO_REUSEPORT sibling of every TCP listener, so the kernel
+ * spreads new clients over all of them, and answers the requests which
+ * only read device data from a copy of the device states.
+ *
+ * That copy is published by the main process into a shared memory area as
+ * text in the driver protocol (SETINFO, ADDENUM, ...) guarded by a seqlock:
+ * the writer makes the sequence number odd while it updates the data, and
+ * readers copy the data out and retry if the number changed meanwhile, so
+ * neither side ever waits for the other.
+ *
+ * The first request a worker may not answer has the whole connection handed
+ * over to the main process: the socket goes over a Unix socket pair with
+ * SCM_RIGHTS, along with answers not yet sent and input not yet processed
+ * (starting with that request), and the main process carries on with it as
+ * with any client of its own.
+ */
+
+#include "config.h" /* must be the first header */
+
+#include "upsd.h"
+#include "upstype.h"
+#include "sstate.h"
+#include "state.h"
+#include "evloop.h"
+#include "timers.h"
+#include "workers.h"
+#include "conf.h"
+#include "desc.h"
+#include "nut_stdint.h"
+
+#ifndef WIN32
+# include <sys/socket.h>
+# include <sys/mman.h>
+# include <sys/wait.h>
+# include <fcntl.h>
+# include <signal.h>
+
+# if (!defined MAP_ANONYMOUS) && (defined MAP_ANON)
+#  define MAP_ANONYMOUS	MAP_ANON
+# endif
+
+# if (defined SO_REUSEPORT) && (defined SCM_RIGHTS) && (defined MAP_ANONYMOUS) \
+  && (defined HAVE___SYNC_SYNCHRONIZE)
+#  define WITH_WORKERS	1
+# endif
+#endif	/* !WIN32 */
+
+int	worker_count = 0;
+int	worker_id = -1;
+
+#ifdef WITH_WORKERS
+
+/* wait this long before replacing a worker which went away (seconds) */
+#define WORKERS_RESPAWN_DELAY	1
+
+/* longest line of a published device state */
+#define WORKERS_SNAPSHOT_LINE	(2 * ST_MAX_VALUE_LEN + SMALLBUF)
+
+/* the shared device states, see workers_publish() and workers_refresh() */
+typedef struct {
+	volatile unsigned long	seq;	/* odd while being written */
+	volatile int	valid;		/* 0 if the states did not fit */
+	volatile size_t	len;
+	char	data[1];
+} workers_snapshot_t;
+
+/* sent ahead of a connection handed over to the main process */
+typedef struct {
+	uint32_t	addrlen;
+	uint32_t	outlen;
+	uint32_t	inlen;
+} workers_handoff_t;
+
+typedef struct {
+	int	idx;
+	pid_t	pid;
+	TYPE_FD_SOCK	chan;	/* main process end of the handoff channel */
+	nut_timer_t	respawn;
+} worker_t;
+
+static worker_t	workers[WORKERS_MAX];
+static int	workers_running = 0;
+
+static workers_snapshot_t	*snapshot = NULL;
+static size_t	snapshot_mapsize = 0;
+static int	snapshot_dirty = 0, snapshot_toobig = 0;
+
+/* main process: the states being serialized; worker: the loaded copy */
+static char	*snapbuf = NULL;
+static size_t	snapbuf_len = 0, snapbuf_size = 0;
+
+/* worker process: which snapshot it serves, and its end of the channel */
+static unsigned long	snapshot_seen = 0;
+static int	snapshot_usable = 0;
+static TYPE_FD_SOCK	worker_chan = ERROR_FD_SOCK;
+
+static void worker_spawn(worker_t *w);
+
+int workers_supported(void)
+{
+	return 1;
+}
+
+void workers_reuseport(TYPE_FD_SOCK sock_fd)
+{
+	int	one = 1;
+
+	if (worker_count < 1) {
+		return;
+	}
+
+	if (setsockopt(sock_fd, SOL_SOCKET, SO_REUSEPORT, (void *)&one, sizeof(one)) != 0) {
+		upslog_with_errno(LOG_WARNING, "%s: setsockopt SO_REUSEPORT", __func__);
+	}
+}
+
+void workers_listen(stype_t *server)
+{
+	struct sockaddr_storage	ss;
+	socklen_t	sslen = sizeof(ss);
+	int	i, v, one = 1;
+
+	if (worker_count < 1 || INVALID_FD_SOCK(server->sock_fd) || server->worker_fds) {
+		return;
+	}
+
+	/* the service manager holds the address of a passed socket (without
+	 * SO_REUSEPORT), so it is only served by the main process as well */
+	if (server->inherited) {
+		upsdebugx(1, "%s: %s port %s was passed to upsd, not shared with the workers",
+			__func__, server->addr, server->port);
+		return;
+	}
+
+	if (getsockname(server->sock_fd, (struct sockaddr *)&ss, &sslen) != 0) {
+		upslog_with_errno(LOG_ERR, "%s: getsockname for %s", __func__, server->addr);
+		return;
+	}
+
+	/* local (unix socket) clients are only served by the main process */
+	if (ss.ss_family != AF_INET && ss.ss_family != AF_INET6) {
+		return;
+	}
+
+	server->worker_fds = xcalloc((size_t)worker_count, sizeof(*server->worker_fds));
+
+	for (i = 0; i < worker_count; i++) {
+		TYPE_FD_SOCK	sock_fd = socket(ss.ss_family, SOCK_STREAM, IPPROTO_TCP);
+
+		if (INVALID_FD_SOCK(sock_fd)) {
+			fatal_with_errno(EXIT_FAILURE, "%s: socket", __func__);
+		}
+
+		if (setsockopt(sock_fd, SOL_SOCKET, SO_REUSEADDR, (void *)&one, sizeof(one)) != 0
+		 || setsockopt(sock_fd, SOL_SOCKET, SO_REUSEPORT, (void *)&one, sizeof(one)) != 0
+		) {
+			fatal_with_errno(EXIT_FAILURE, "%s: setsockopt", __func__);
+		}
+
+#ifdef IPV6_V6ONLY
+		if (ss.ss_family == AF_INET6) {
+			/* same as the main listener, see setuptcp() */
+			setsockopt(sock_fd, IPPROTO_IPV6, IPV6_V6ONLY, (void *)&one, sizeof(one));
+		}
+#endif
+
+		if (bind(sock_fd, (struct sockaddr *)&ss, sslen) < 0) {
+			fatal_with_errno(EXIT_FAILURE,
+				"Can not share listener %s port %s with worker %d",
+				server->addr, server->port, i);
+		}
+
+		if ((v = fcntl(sock_fd, F_GETFL, 0)) == -1
+		 || fcntl(sock_fd, F_SETFL, v | O_NDELAY) == -1
+		) {
+			fatal_with_errno(EXIT_FAILURE, "%s: fcntl", __func__);
+		}
+
+		if (listen(sock_fd, SOMAXCONN) < 0) {
+			fatal_with_errno(EXIT_FAILURE, "%s: listen", __func__);
+		}
+
+		server->worker_fds[i] = sock_fd;
+	}
+
+	upsdebugx(2, "%s: %d workers share %s port %s",
+		__func__, worker_count, server->addr, server->port);
+}
+
+/* append a line to snapbuf */
+static void snapshot_add(const char *fmt, ...)
+	__attribute__ ((__format__ (__printf__, 1, 2)));
+
+static void snapshot_add(const char *fmt, ...)
+{
+	va_list	ap;
+	int	ret;
+
+	if (snapbuf_size - snapbuf_len < WORKERS_SNAPSHOT_LINE) {
+		snapbuf_size = (snapbuf_len + WORKERS_SNAPSHOT_LINE) * 2;
+		snapbuf = xrealloc(snapbuf, snapbuf_size);
+	}
+
+	va_start(ap, fmt);
+	ret = vsnprintf(snapbuf + snapbuf_len, WORKERS_SNAPSHOT_LINE, fmt, ap);
+	va_end(ap);
+
+	if (ret < 0 || ret >= WORKERS_SNAPSHOT_LINE) {
+		upsdebugx(1, "%s: line too long, skipped", __func__);
+		return;
+	}
+
+	snapbuf_len += (size_t)ret;
+}
+
+static void snapshot_tree(const st_tree_t *node)
+{
+	const enum_t	*etmp;
+	const range_t	*rtmp;
+
+	if (!node) {
+		return;
+	}
+
+	snapshot_tree(node->left);
+
+	/* node->val and enum values are already escaped for the protocol */
+	snapshot_add("SETINFO %s \"%s\"\n", node->var, node->val);
+
+	if (node->flags & (ST_FLAG_RW | ST_FLAG_STRING | ST_FLAG_NUMBER)) {
+		snapshot_add("SETFLAGS %s%s%s%s\n", node->var,
+			(node->flags & ST_FLAG_RW) ? " RW" : "",
+			(node->flags & ST_FLAG_STRING) ? " STRING" : "",
+			(node->flags & ST_FLAG_NUMBER) ? " NUMBER" : "");
+	}
+
+	if (node->aux) {
+		snapshot_add("SETAUX %s %ld\n", node->var, node->aux);
+	}
+
+	for (etmp = node->enum_list; etmp; etmp = etmp->next) {
+		snapshot_add("ADDENUM %s \"%s\"\n", node->var, etmp->val);
+	}
+
+	for (rtmp = node->range_list; rtmp; rtmp = rtmp->next) {
+		snapshot_add("ADDRANGE %s %d %d\n", node->var, rtmp->min, rtmp->max);
+	}
+
+	snapshot_tree(node->right);
+}
+
+void workers_changed(void)
+{
+	snapshot_dirty = 1;
+}
+
+void workers_publish(void)
+{
+	upstype_t	*ups;
+	const cmdlist_t	*ctmp;
+
+	if (!snapshot || worker_id >= 0 || !snapshot_dirty) {
+		return;
+	}
+
+	snapshot_dirty = 0;
+	snapbuf_len = 0;
+
+	for (ups = firstups; ups; ups = ups->next) {
+		char	desc[SMALLBUF];
+
+		snapshot_add("UPS %s %d %d %d %d \"%s\"\n", ups->name,
+			VALID_FD(ups->sock_fd) ? 1 : 0,
+			ups->stale, ups->fsd, ups->numlogins,
+			pconf_encode(ups->desc ? ups->desc : "", desc, sizeof(desc)));
+
+		snapshot_tree(ups->inforoot);
+
+		for (ctmp = ups->cmdlist; ctmp; ctmp = ctmp->next) {
+			snapshot_add("ADDCMD %s\n", ctmp->name);
+		}
+	}
+
+	snapshot->seq++;
+	__sync_synchronize();
+
+	if (snapbuf_len <= WORKERS_SNAPSHOT_MAX) {
+		memcpy(snapshot->data, snapbuf, snapbuf_len);
+		snapshot->len = snapbuf_len;
+		snapshot->valid = 1;
+		snapshot_toobig = 0;
+	} else {
+		/* workers hand over all their clients until it fits again */
+		if (!snapshot_toobig) {
+			upslogx(LOG_WARNING, "Device states (%" PRIuSIZE " bytes) "
+				"do not fit the room shared with WORKERS, "
+				"all requests are served by the main process",
+				snapbuf_len);
+		}
+		snapshot->len = 0;
+		snapshot->valid = 0;
+		snapshot_toobig = 1;
+	}
+
+	__sync_synchronize();
+	snapshot->seq++;
+
+	upsdebugx(5, "%s: published %" PRIuSIZE " bytes as #%lu",
+		__func__, snapbuf_len, snapshot->seq);
+}
+
+/* apply one published line to the states of this worker */
+static void snapshot_apply(upstype_t **upsp, size_t numargs, char **arg)
+{
+	upstype_t	*ups;
+
+	if (numargs < 2) {
+		return;
+	}
+
+	if (!strcmp(arg[0], "UPS")) {
+		*upsp = NULL;
+
+		if (numargs < 7) {
+			return;
+		}
+
+		/* sections added by a reload of the main process show up here
+		 * first, and those it removed are missing (see snapshot_load) */
+		if ((ups = get_ups_ptr(arg[1])) == NULL) {
+			ups_create("", arg[1], arg[6][0] ? arg[6] : NULL);
+			if ((ups = get_ups_ptr(arg[1])) == NULL) {
+				return;
+			}
+		} else if (strcmp(ups->desc ? ups->desc : "", arg[6]) != 0) {
+			free(ups->desc);
+			ups->desc = arg[6][0] ? xstrdup(arg[6]) : NULL;
+		}
+
+		*upsp = ups;
+		ups->retain = 1;
+		ups->worker_connected = atoi(arg[2]);
+		ups->stale = atoi(arg[3]);
+		ups->fsd = atoi(arg[4]);
+		ups->numlogins = atoi(arg[5]);
+		return;
+	}
+
+	if ((ups = *upsp) == NULL) {
+		return;
+	}
+
+	if (!strcmp(arg[0], "ADDCMD")) {
+		state_addcmd(&ups->cmdlist, arg[1]);
+		return;
+	}
+
+	if (numargs < 3) {
+		return;
+	}
+
+	if (!strcmp(arg[0], "SETINFO")) {
+		state_setinfo(&ups->inforoot, arg[1], arg[2]);
+	} else if (!strcmp(arg[0], "SETFLAGS")) {
+		state_setflags(ups->inforoot, arg[1], numargs - 2, &arg[2]);
+	} else if (!strcmp(arg[0], "SETAUX")) {
+		state_setaux(ups->inforoot, arg[1], arg[2]);
+	} else if (!strcmp(arg[0], "ADDENUM")) {
+		state_addenum(ups->inforoot, arg[1], arg[2]);
+	} else if (!strcmp(arg[0], "ADDRANGE") && numargs >= 4) {
+		state_addrange(ups->inforoot, arg[1], atoi(arg[2]), atoi(arg[3]));
+	}
+}
+
+static void snapshot_load(void)
+{
+	PCONF_CTX_t	ctx;
+	upstype_t	*ups, *next;
+	size_t	off, used;
+	int	complete = 1;
+
+	for (ups = firstups; ups; ups = ups->next) {
+		sstate_infofree(ups);
+		sstate_cmdfree(ups);
+		ups->worker_connected = 0;
+		ups->stale = 1;
+		ups->retain = 0;
+	}
+
+	ups = NULL;
+	pconf_init(&ctx, NULL);
+
+	for (off = 0; off < snapbuf_len; off += used) {
+		int	ret = pconf_buf(&ctx, snapbuf + off, snapbuf_len - off, &used);
+
+		if (ret == 0) {
+			break;
+		}
+
+		if (ret < 0) {
+			upslogx(LOG_ERR, "%s: parse error: %s", __func__, ctx.errmsg);
+			complete = 0;
+			break;
+		}
+
+		snapshot_apply(&ups, ctx.numargs, ctx.arglist);
+	}
+
+	pconf_finish(&ctx);
+
+	/* a UPS not published (any more) was removed by a reload */
+	for (ups = firstups; complete && ups; ups = next) {
+		next = ups->next;
+		if (!ups->retain) {
+			delete_ups(ups);
+		}
+	}
+}
+
+void workers_refresh(void)
+{
+	int	tries;
+
+	if (!snapshot || worker_id < 0) {
+		return;
+	}
+
+	/* the main process updates the data rarely and quickly; if it is
+	 * busy right now, keep serving the previous copy */
+	for (tries = 0; tries < 3; tries++) {
+		unsigned long	seq = snapshot->seq;
+		int	valid;
+		size_t	len;
+
+		__sync_synchronize();
+
+		if (seq == snapshot_seen) {
+			return;
+		}
+
+		if (seq & 1) {
+			continue;
+		}
+
+		valid = snapshot->valid;
+		len = snapshot->len;
+
+		if (valid && len <= WORKERS_SNAPSHOT_MAX) {
+			if (snapbuf_size < len) {
+				snapbuf_size = len;
+				snapbuf = xrealloc(snapbuf, snapbuf_size);
+			}
+			memcpy(snapbuf, snapshot->data, len);
+			snapbuf_len = len;
+		} else {
+			valid = 0;
+		}
+
+		__sync_synchronize();
+
+		if (snapshot->seq != seq) {
+			continue;
+		}
+
+		snapshot_seen = seq;
+		snapshot_usable = valid;
+
+		if (valid) {
+			snapshot_load();
+		}
+
+		upsdebugx(5, "%s: loaded #%lu (%s)", __func__, seq,
+			valid ? "usable" : "not usable");
+		return;
+	}
+}
+
+int workers_must_forward(size_t numargs, const char **arg)
+{
+	if (!snapshot_usable) {
+		return 1;
+	}
+
+	if (numargs < 1) {
+		return 0;
+	}
+
+	if (!strcasecmp(arg[0], "VER")
+	 || !strcasecmp(arg[0], "NETVER")
+	 || !strcasecmp(arg[0], "PROTVER")
+	 || !strcasecmp(arg[0], "HELP")
+	) {
+		return 0;
+	}
+
+	/* TRACKING entries are kept by the main process */
+	if (!strcasecmp(arg[0], "GET")) {
+		return (numargs > 1 && !strcasecmp(arg[1], "TRACKING"));
+	}
+
+	/* logged in clients are known to the main process, and only
+	 * it has the history of changes for LIST VAR ... SINCE and the
+	 * traced changes for LIST TRACE, or the values for LIST HISTORY */
+	if (!strcasecmp(arg[0], "LIST")) {
+		if (numargs > 1 && (!strcasecmp(arg[1], "CLIENT")
+		 || !strcasecmp(arg[1], "TRACE")
+		 || !strcasecmp(arg[1], "HISTORY"))
+		) {
+			return 1;
+		}
+
+		return (numargs > 3 && !strcasecmp(arg[1], "VAR")
+			&& !strcasecmp(arg[3], "SINCE"));
+	}
+
+	return 1;
+}
+
+/* write all of buf, the descriptors are blocking */
+static int write_all(TYPE_FD_SOCK fd, const char *buf, size_t len)
+{
+	while (len > 0) {
+		ssize_t	ret = write(fd, buf, len);
+
+		if (ret < 0 && errno == EINTR) {
+			continue;
+		}
+
+		if (ret <= 0) {
+			return 0;
+		}
+
+		buf += ret;
+		len -= (size_t)ret;
+	}
+
+	return 1;
+}
+
+static int read_all(TYPE_FD_SOCK fd, char *buf, size_t len)
+{
+	while (len > 0) {
+		ssize_t	ret = read(fd, buf, len);
+
+		if (ret < 0 && errno == EINTR) {
+			continue;
+		}
+
+		if (ret <= 0) {
+			return 0;
+		}
+
+		buf += ret;
+		len -= (size_t)ret;
+	}
+
+	return 1;
+}
+
+int workers_handoff(TYPE_FD_SOCK sock_fd, const char *addr,
+	const char *out, size_t outlen, const char *in, size_t inlen)
+{
+	workers_handoff_t	hdr;
+	struct msghdr	msg;
+	struct iovec	iov;
+	struct cmsghdr	*cmsg;
+	union {
+		struct cmsghdr	align;
+		char	buf[CMSG_SPACE(sizeof(int))];
+	} control;
+	ssize_t	ret;
+
+	if (INVALID_FD_SOCK(worker_chan)) {
+		return 0;
+	}
+
+	hdr.addrlen = (uint32_t)strlen(addr);
+	hdr.outlen = (uint32_t)outlen;
+	hdr.inlen = (uint32_t)inlen;
+
+	memset(&msg, 0, sizeof(msg));
+	memset(&control, 0, sizeof(control));
+	iov.iov_base = (void *)&hdr;
+	iov.iov_len = sizeof(hdr);
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control.buf;
+	msg.msg_controllen = sizeof(control.buf);
+
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+	memcpy(CMSG_DATA(cmsg), &sock_fd, sizeof(int));
+
+	do {
+		ret = sendmsg(worker_chan, &msg, 0);
+	} while (ret < 0 && errno == EINTR);
+
+	if (ret < 0) {
+		upslog_with_errno(LOG_ERR, "%s: sendmsg", __func__);
+		return 0;
+	}
+
+	if ((size_t)ret < sizeof(hdr)
+	 && !write_all(worker_chan, (const char *)&hdr + ret, sizeof(hdr) - (size_t)ret)
+	) {
+		return 0;
+	}
+
+	if (!write_all(worker_chan, addr, hdr.addrlen)
+	 || !write_all(worker_chan, out, outlen)
+	 || !write_all(worker_chan, in, inlen)
+	) {
+		upslog_with_errno(LOG_ERR, "%s: write", __func__);
+		return 0;
+	}
+
+	upsdebugx(2, "Handed over %s to the main process", addr);
+	return 1;
+}
+
+/* the worker process is gone: forget it, and start another one soon */
+static void worker_lost(worker_t *w)
+{
+	int	status = 0;
+
+	if (VALID_FD_SOCK(w->chan)) {
+		evloop_del(w->chan);
+		close(w->chan);
+		w->chan = ERROR_FD_SOCK;
+	}
+
+	if (w->pid > 0) {
+		kill(w->pid, SIGTERM);
+		waitpid(w->pid, &status, 0);
+		upslogx(LOG_WARNING, "Worker %d (PID %" PRIdMAX ") went away, restarting it",
+			w->idx, (intmax_t)w->pid);
+		w->pid = -1;
+	}
+
+	timer_set(&w->respawn, time(NULL) + WORKERS_RESPAWN_DELAY);
+}
+
+/* take over a client connection from a worker */
+static void worker_receive(worker_t *w)
+{
+	workers_handoff_t	hdr;
+	struct msghdr	msg;
+	struct iovec	iov;
+	struct cmsghdr	*cmsg;
+	union {
+		struct cmsghdr	align;
+		char	buf[CMSG_SPACE(sizeof(int))];
+	} control;
+	ssize_t	ret;
+	TYPE_FD_SOCK	fd = ERROR_FD_SOCK;
+	size_t	total;
+	char	*buf;
+
+	memset(&msg, 0, sizeof(msg));
+	iov.iov_base = (void *)&hdr;
+	iov.iov_len = sizeof(hdr);
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control.buf;
+	msg.msg_controllen = sizeof(control.buf);
+
+	do {
+		ret = recvmsg(w->chan, &msg, 0);
+	} while (ret < 0 && errno == EINTR);
+
+	if (ret <= 0) {
+		worker_lost(w);
+		return;
+	}
+
+	for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+		if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+			memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+		}
+	}
+
+	if ((size_t)ret < sizeof(hdr)
+	 && !read_all(w->chan, (char *)&hdr + ret, sizeof(hdr) - (size_t)ret)
+	) {
+		ret = -1;
+	}
+
+	total = (size_t)hdr.addrlen + hdr.outlen + hdr.inlen;
+
+	if (ret < 0 || INVALID_FD_SOCK(fd) || hdr.addrlen >= SMALLBUF
+	 || total > sendq_max + WORKERS_SNAPSHOT_LINE + LARGEBUF * 2
+	) {
+		upslogx(LOG_ERR, "Worker %d sent a malformed handover", w->idx);
+		if (VALID_FD_SOCK(fd)) {
+			close(fd);
+		}
+		worker_lost(w);
+		return;
+	}
+
+	buf = xcalloc(1, total + 1);
+
+	if (!read_all(w->chan, buf, total)) {
+		free(buf);
+		close(fd);
+		worker_lost(w);
+		return;
+	}
+
+	/* client_adopt() wants the address as a string of its own */
+	{
+		char	addr[SMALLBUF];
+
+		memcpy(addr, buf, hdr.addrlen);
+		addr[hdr.addrlen] = '\0';
+
+		client_adopt(fd, addr,
+			buf + hdr.addrlen, hdr.outlen,
+			buf + hdr.addrlen + hdr.outlen, hdr.inlen);
+	}
+
+	free(buf);
+}
+
+int workers_channel_event(void *data, int revents)
+{
+	worker_t	*w = (worker_t *)data;
+
+	/* in a worker, the only such entry is the channel to the main
+	 * process which never writes to it: this means it is gone */
+	if (worker_id >= 0) {
+		return 0;
+	}
+
+	if (revents & EVLOOP_READ) {
+		worker_receive(w);
+	} else if (revents & EVLOOP_HUP) {
+		worker_lost(w);
+	}
+
+	return 1;
+}
+
+static void worker_respawn(void *data)
+{
+	worker_spawn((worker_t *)data);
+}
+
+static void worker_spawn(worker_t *w)
+{
+	TYPE_FD_SOCK	sv[2];
+	pid_t	pid;
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) != 0) {
+		upslog_with_errno(LOG_ERR, "Can not start worker %d: socketpair", w->idx);
+		timer_set(&w->respawn, time(NULL) + WORKERS_RESPAWN_DELAY);
+		return;
+	}
+
+	/* don't let both processes flush the same buffered log lines */
+	fflush(stdout);
+	fflush(stderr);
+
+	if ((pid = fork()) < 0) {
+		upslog_with_errno(LOG_ERR, "Can not start worker %d: fork", w->idx);
+		close(sv[0]);
+		close(sv[1]);
+		timer_set(&w->respawn, time(NULL) + WORKERS_RESPAWN_DELAY);
+		return;
+	}
+
+	if (pid == 0) {
+		close(sv[0]);
+		worker_chan = sv[1];
+		upsd_worker_run(w->idx);	/* does not return */
+	}
+
+	close(sv[1]);
+	w->pid = pid;
+	w->chan = sv[0];
+
+	if (!evloop_add(w->chan, EVLOOP_READ, WORKER, w)) {
+		upslogx(LOG_ERR, "Can not watch worker %d", w->idx);
+	}
+
+	upsdebugx(1, "Started worker %d as PID %" PRIdMAX, w->idx, (intmax_t)pid);
+}
+
+void workers_child_init(int idx)
+{
+	int	i;
+
+	worker_id = idx;
+
+	/* nothing of the main process' bookkeeping applies here */
+	for (i = 0; i < workers_running; i++) {
+		timer_cancel(&workers[i].respawn);
+		if (VALID_FD_SOCK(workers[i].chan)) {
+			close(workers[i].chan);
+			workers[i].chan = ERROR_FD_SOCK;
+		}
+		workers[i].pid = -1;
+	}
+	workers_running = 0;
+
+	/* a misbehaving worker must not corrupt what the others see */
+	if (mprotect(snapshot, snapshot_mapsize, PROT_READ) != 0) {
+		upslog_with_errno(LOG_WARNING, "%s: mprotect", __func__);
+	}
+
+	free(snapbuf);
+	snapbuf = NULL;
+	snapbuf_len = snapbuf_size = 0;
+	snapshot_seen = 0;
+	snapshot_usable = 0;
+
+	if (!evloop_add(worker_chan, EVLOOP_READ, WORKER, NULL)) {
+		fatalx(EXIT_FAILURE, "Worker %d: can not watch the main process", idx);
+	}
+
+	workers_refresh();
+}
+
+/* fork every worker which is not running */
+static void workers_spawn_all(void)
+{
+	int	i;
+
+	workers_running = worker_count;
+
+	for (i = 0; i < worker_count; i++) {
+		worker_t	*w = &workers[i];
+
+		if (w->pid <= 0) {
+			worker_spawn(w);
+		}
+	}
+}
+
+void workers_start(void)
+{
+	int	i;
+
+	if (worker_count < 1 || worker_id >= 0 || snapshot) {
+		return;
+	}
+
+	snapshot_mapsize = sizeof(workers_snapshot_t) + WORKERS_SNAPSHOT_MAX;
+	snapshot = mmap(NULL, snapshot_mapsize, PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+
+	if (snapshot == MAP_FAILED) {
+		fatal_with_errno(EXIT_FAILURE, "Can not share memory with WORKERS");
+	}
+
+	/* the first copy is there before anybody could ask for it */
+	snapshot_dirty = 1;
+	workers_publish();
+
+	/* read the descriptions once for all the workers to share */
+	desc_ready();
+
+	for (i = 0; i < worker_count; i++) {
+		workers[i].idx = i;
+		workers[i].pid = -1;
+		workers[i].chan = ERROR_FD_SOCK;
+		timer_init(&workers[i].respawn, worker_respawn, &workers[i]);
+	}
+
+	workers_spawn_all();
+
+	upslogx(LOG_INFO, "Started %d worker processes for read-only requests",
+		worker_count);
+}
+
+void workers_stop(void)
+{
+	int	i, status;
+
+	if (worker_id >= 0) {
+		return;
+	}
+
+	for (i = 0; i < workers_running; i++) {
+		worker_t	*w = &workers[i];
+
+		timer_cancel(&w->respawn);
+
+		if (VALID_FD_SOCK(w->chan)) {
+			evloop_del(w->chan);
+			close(w->chan);
+			w->chan = ERROR_FD_SOCK;
+		}
+
+		if (w->pid > 0) {
+			kill(w->pid, SIGTERM);
+		}
+	}
+
+	for (i = 0; i < workers_running; i++) {
+		worker_t	*w = &workers[i];
+
+		if (w->pid > 0) {
+			waitpid(w->pid, &status, 0);
+			w->pid = -1;
+		}
+	}
+
+	workers_running = 0;
+}
+
+void workers_restart(void)
+{
+	if (!snapshot || worker_id >= 0) {
+		return;
+	}
+
+	upsdebugx(1, "%s: replacing workers to apply the new configuration", __func__);
+
+	workers_stop();
+	snapshot_dirty = 1;
+	workers_publish();
+	workers_spawn_all();
+}
+
+#else	/* !WITH_WORKERS */
+
+int workers_supported(void)
+{
+	return 0;
+}
+
+void workers_reuseport(TYPE_FD_SOCK sock_fd)
+{
+	NUT_UNUSED_VARIABLE(sock_fd);
+}
+
+void workers_listen(stype_t *server)
+{
+	NUT_UNUSED_VARIABLE(server);
+}
+
+void workers_start(void)
+{
+}
+
+void workers_stop(void)
+{
+}
+
+void workers_restart(void)
+{
+}
+
+void workers_changed(void)
+{
+}
+
+void workers_publish(void)
+{
+}
+
+void workers_refresh(void)
+{
+}
+
+int workers_must_forward(size_t numargs, const char **arg)
+{
+	NUT_UNUSED_VARIABLE(numargs);
+	NUT_UNUSED_VARIABLE(arg);
+	return 1;
+}
+
+int workers_handoff(TYPE_FD_SOCK sock_fd, const char *addr,
+	const char *out, size_t outlen, const char *in, size_t inlen)
+{
+	NUT_UNUSED_VARIABLE(sock_fd);
+	NUT_UNUSED_VARIABLE(addr);
+	NUT_UNUSED_VARIABLE(out);
+	NUT_UNUSED_VARIABLE(outlen);
+	NUT_UNUSED_VARIABLE(in);
+	NUT_UNUSED_VARIABLE(inlen);
+	return 0;
+}
+
+int workers_channel_event(void *data, int revents)
+{
+	NUT_UNUSED_VARIABLE(data);
+	NUT_UNUSED_VARIABLE(revents);
+	return 1;
+}
+
+void workers_child_init(int idx)
+{
+	NUT_UNUSED_VARIABLE(idx);
+}
+
+#endif	/* !WITH_WORKERS */
@@ -0,0 +1,91 @@
+/* workers.h - read-only worker processes for upsd (WORKERS in upsd.conf)
+
+   Copyright (C)
+	2026	Network UPS Tools developers
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#ifndef NUT_WORKERS_H_SEEN
+#define NUT_WORKERS_H_SEEN 1
+
+#include "common.h"	/* TYPE_FD_SOCK */
+#include "stype.h"
+
+/* upper limit for WORKERS in upsd.conf */
+#define WORKERS_MAX	64
+
+/* room for the published copy of all device states, see workers_publish() */
+#define WORKERS_SNAPSHOT_MAX	(8 * 1024 * 1024)
+
+#ifdef __cplusplus
+/* *INDENT-OFF* */
+extern "C" {
+/* *INDENT-ON* */
+#endif
+
+/* number of worker processes requested in upsd.conf, 0 = none */
+extern int	worker_count;
+
+/* index of this worker process, or -1 in the main upsd process */
+extern int	worker_id;
+
+/* returns 1 if this build can run worker processes at all */
+int workers_supported(void);
+
+/* main process, before bind(): let the workers share this listener */
+void workers_reuseport(TYPE_FD_SOCK sock_fd);
+
+/* main process, after bind(): open the workers' own listening sockets
+ * for the same address as server->sock_fd */
+void workers_listen(stype_t *server);
+
+/* main process: fork the workers, stop them, or replace them with fresh
+ * ones which know the reloaded configuration (UPS sections added or
+ * removed by a reload need no restart, workers learn about them from
+ * the published device states) */
+void workers_start(void);
+void workers_stop(void);
+void workers_restart(void);
+
+/* main process: device states seen by workers need an update, which
+ * workers_publish() does once per main loop iteration */
+void workers_changed(void);
+void workers_publish(void);
+
+/* worker process: pick up the latest published device states */
+void workers_refresh(void);
+
+/* worker process: returns 1 if the request in arg[] is not one the worker
+ * may answer (anything but reading device data), so the client is to be
+ * handed over to the main process with workers_handoff() */
+int workers_must_forward(size_t numargs, const char **arg);
+int workers_handoff(TYPE_FD_SOCK sock_fd, const char *addr,
+	const char *out, size_t outlen, const char *in, size_t inlen);
+
+/* activity on a WORKER evloop entry; returns 0 if this (worker)
+ * process should exit since the main process is gone */
+int workers_channel_event(void *data, int revents);
+
+/* worker process: called from upsd_worker_run() in the new process */
+void workers_child_init(int idx);
+
+#ifdef __cplusplus
+/* *INDENT-OFF* */
+}
+/* *INDENT-ON* */
+#endif
+
+#endif	/* NUT_WORKERS_H_SEEN */
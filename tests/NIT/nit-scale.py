@@ -0,0 +1,584 @@
+#!/usr/bin/env python3
+# -*- coding: utf-8 -*-
+
+# nit-scale.py - simulated devices and clients for the "scale" NIT profile
+#
+# This program stands in for the drivers of many devices: it listens on
+# the driver sockets which upsd connects to (as named in the generated
+# ups.conf), answers DUMPALL and PING like a driver, and injects value
+# changes at a fixed rate. It also opens many client connections to upsd,
+# which WATCH the changed variable of every device, so that the delay from
+# a SETINFO written by a "driver" to the CHANGED line read by a client
+# can be measured. A second phase has the clients issue LIST VAR requests
+# as fast as upsd answers them. The CPU time and memory of upsd, read from
+# /proc (or ps), are reported along with the latencies and throughput.
+#
+# Everything runs in one event loop, so the numbers include the delays of
+# this program itself: its own CPU use is reported too, and a value close
+# to 100% means that the load generator, not upsd, was the bottleneck.
+#
+# Copyright (C)
+#	2026	Network UPS Tools developers
+#
+# License: GPLv2+
+
+import argparse
+import json
+import os
+import selectors
+import socket
+import subprocess
+import sys
+import time
+
+try:
+    import resource
+except ImportError:
+    resource = None
+
+# The changed variable, which the clients WATCH; its values are the
+# sequence numbers of the injections, to tell when each one was made
+SCALE_VAR = "input.voltage"
+
+# A typical set of readings, padded to --vars with more of them
+BASE_VARS = [
+    ("device.mfr", "NIT"),
+    ("device.model", "Scale Simulator"),
+    ("device.type", "ups"),
+    ("ups.status", "OL"),
+    ("ups.load", "35"),
+    ("battery.charge", "100"),
+    ("battery.runtime", "3600"),
+    ("battery.voltage", "27.2"),
+    ("input.frequency", "50.0"),
+    ("output.voltage", "230.0"),
+    ("output.frequency", "50.0"),
+    ("ups.temperature", "27.0"),
+]
+
+
+def log(msg):
+    sys.stderr.write("[nit-scale] %s\n" % msg)
+    sys.stderr.flush()
+
+
+def quote(value):
+    return '"' + value.replace("\\", "\\\\").replace('"', '\\"') + '"'
+
+
+def percentile(samples, p):
+    """ samples must be sorted """
+    if not samples:
+        return None
+    return samples[min(len(samples) - 1, int(p / 100.0 * len(samples)))]
+
+
+class Conn(object):
+    """ A non-blocking stream with line-based input and queued output """
+
+    def __init__(self, loop, sock, handler):
+        self.loop = loop
+        self.sock = sock
+        self.handler = handler
+        self.inbuf = b""
+        self.outbuf = bytearray()
+        self.writing = False
+        self.closed = False
+        sock.setblocking(False)
+        loop.sel.register(sock, selectors.EVENT_READ, self)
+
+    def send(self, data):
+        if self.closed:
+            return
+        had = len(self.outbuf) > 0
+        self.outbuf += data.encode("utf-8") if isinstance(data, str) else data
+        if not had:
+            self.flush()
+
+    def flush(self):
+        try:
+            sent = self.sock.send(self.outbuf)
+            del self.outbuf[:sent]
+        except BlockingIOError:
+            pass
+        except OSError:
+            self.close()
+            return
+        if self.writing != bool(self.outbuf):
+            self.writing = bool(self.outbuf)
+            self.loop.sel.modify(self.sock, selectors.EVENT_READ
+                | (selectors.EVENT_WRITE if self.writing else 0), self)
+
+    def on_event(self, mask):
+        if mask & selectors.EVENT_WRITE:
+            self.flush()
+        if not (mask & selectors.EVENT_READ) or self.closed:
+            return
+        try:
+            data = self.sock.recv(262144)
+        except BlockingIOError:
+            return
+        except OSError:
+            data = b""
+        if not data:
+            self.close()
+            return
+
+        buf = self.inbuf + data
+        lines = buf.split(b"\n")
+        self.inbuf = lines.pop()
+        now = time.monotonic()
+        for line in lines:
+            self.handler.on_line(self, line.decode("utf-8", "replace"), now)
+
+    def close(self):
+        if self.closed:
+            return
+        self.closed = True
+        try:
+            self.loop.sel.unregister(self.sock)
+        except (KeyError, ValueError):
+            pass
+        self.sock.close()
+        self.handler.on_close(self)
+
+
+class Listener(object):
+    """ The driver socket of a simulated device """
+
+    def __init__(self, loop, device):
+        self.loop = loop
+        self.device = device
+        self.sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+        try:
+            os.unlink(device.path)
+        except OSError:
+            pass
+        self.sock.bind(device.path)
+        # as drivers do; when started by root, upsd runs as another user
+        os.chmod(device.path, 0o666 if os.getuid() == 0 else 0o660)
+        self.sock.listen(4)
+        self.sock.setblocking(False)
+        loop.sel.register(self.sock, selectors.EVENT_READ, self)
+
+    def on_event(self, mask):
+        try:
+            sock, _ = self.sock.accept()
+        except OSError:
+            return
+        self.device.conns.append(Conn(self.loop, sock, self.device))
+
+    def close(self):
+        self.loop.sel.unregister(self.sock)
+        self.sock.close()
+        try:
+            os.unlink(self.device.path)
+        except OSError:
+            pass
+
+
+class Device(object):
+    """ Answers upsd on the driver socket like a driver would """
+
+    def __init__(self, name, path, nvars):
+        self.name = name
+        self.path = path
+        self.conns = []
+        self.dumped = False
+        self.values = [(SCALE_VAR, "230.0")] + BASE_VARS[:max(0, nvars - 1)]
+        for i in range(len(self.values), nvars):
+            self.values.append(("ups.test.reading%d" % i, "%d.5" % (i * 7 % 1000)))
+        dump = "".join("SETINFO %s %s\n" % (v, quote(val)) for v, val in self.values)
+        self.dump = (dump + "DATAOK\nDUMPDONE\n").encode("utf-8")
+
+    def on_line(self, conn, line, now):
+        cmd = line.split(" ", 1)[0]
+        if cmd == "DUMPALL":
+            conn.send(self.dump)
+            self.dumped = True
+        elif cmd == "PING":
+            conn.send("PONG\n")
+        # anything else (SET, INSTCMD...) is not simulated
+
+    def on_close(self, conn):
+        if conn in self.conns:
+            self.conns.remove(conn)
+
+    def inject(self, seq):
+        for conn in self.conns:
+            conn.send("SETINFO %s \"%d\"\n" % (SCALE_VAR, seq))
+
+
+class Client(object):
+    """ A client of upsd, which WATCHes or LISTs the devices """
+
+    def __init__(self, loop, sock, index):
+        self.loop = loop
+        self.index = index
+        self.conn = Conn(loop, sock, self)
+        self.watched = 0
+        self.errors = 0
+        self.listing = False
+        self.pending = 0
+        self.lists = 0
+        self.vars = 0
+        self.next_dev = 0
+
+    def watch_all(self, devices):
+        self.conn.send("".join("WATCH %s %s\n" % (d.name, SCALE_VAR) for d in devices))
+
+    def start_listing(self, depth):
+        self.conn.send("UNWATCH\n")
+        self.listing = True
+        self.next_dev = self.index * 7919
+        for _ in range(depth):
+            self.request_list()
+
+    def request_list(self):
+        devices = self.loop.devices
+        dev = devices[self.next_dev % len(devices)]
+        self.next_dev += 1
+        self.pending += 1
+        self.conn.send("LIST VAR %s\n" % dev.name)
+
+    def on_line(self, conn, line, now):
+        if line.startswith("CHANGED "):
+            # CHANGED <ups> <var> "<seq>"
+            if not self.listing:
+                parts = line.split(" ", 3)
+                if len(parts) == 4 and parts[2] == SCALE_VAR:
+                    self.loop.received(parts[3].strip('"'), now)
+        elif line.startswith("VAR "):
+            self.vars += 1
+        elif line.startswith("END LIST VAR "):
+            self.pending -= 1
+            if self.loop.counting:
+                self.lists += 1
+            if self.loop.listing:
+                self.request_list()
+        elif line.startswith("OK WATCH "):
+            self.watched += 1
+        elif line.startswith("ERR "):
+            self.errors += 1
+            if self.listing:
+                self.pending -= 1
+                if self.loop.listing:
+                    self.request_list()
+
+    def on_close(self, conn):
+        if not self.loop.stopping:
+            log("client %d lost its connection to upsd" % self.index)
+            self.loop.failed = True
+
+
+class UpsdMeter(object):
+    """ CPU time and memory of the upsd process """
+
+    def __init__(self, pid):
+        self.pid = pid
+        self.rss_max = 0
+        self.use_proc = os.path.exists("/proc/%d/stat" % pid)
+
+    def sample(self):
+        """ Returns the CPU seconds used so far, and updates rss_max """
+        cpu = None
+        rss = None
+        try:
+            if self.use_proc:
+                with open("/proc/%d/stat" % self.pid) as f:
+                    # fields after the "(comm)", which may hold spaces
+                    fields = f.read().rsplit(")", 1)[1].split()
+                cpu = (int(fields[11]) + int(fields[12])) / float(os.sysconf("SC_CLK_TCK"))
+                with open("/proc/%d/status" % self.pid) as f:
+                    for line in f:
+                        if line.startswith("VmRSS:"):
+                            rss = int(line.split()[1])
+            else:
+                out = subprocess.check_output(["ps", "-o", "rss=", "-o", "time=",
+                    "-p", str(self.pid)]).decode().split()
+                rss = int(out[0])
+                t = out[1].replace("-", ":").split(":")
+                cpu = 0.0
+                for part, mult in zip(reversed(t), (1, 60, 3600, 86400)):
+                    cpu += float(part) * mult
+        except (OSError, IndexError, ValueError, subprocess.CalledProcessError):
+            pass
+        if rss is not None and rss > self.rss_max:
+            self.rss_max = rss
+        return cpu
+
+
+class ScaleTest(object):
+
+    def __init__(self, args):
+        self.args = args
+        self.sel = selectors.DefaultSelector()
+        self.devices = []
+        self.listeners = []
+        self.clients = []
+        self.sent = {}		# seq -> injection time
+        self.latencies = []
+        self.measure_from = None
+        self.listing = False
+        self.counting = False
+        self.stopping = False
+        self.failed = False
+        self.meter = None
+        self.last_sample = 0
+
+    def received(self, seq, now):
+        t0 = self.sent.get(seq)
+        if t0 is None:
+            return
+        if self.measure_from is not None and t0 >= self.measure_from:
+            self.latencies.append(now - t0)
+
+    def run_loop(self, until, condition=None, tick=None):
+        """ Serve the sockets until the <until> time, or until <condition>
+            holds; returns False if that did not happen in time """
+        while not self.failed:
+            now = time.monotonic()
+            if condition is not None and condition():
+                return True
+            if now >= until:
+                return condition is None
+            if tick is not None:
+                tick(now)
+            if self.meter is not None and now - self.last_sample >= 1:
+                self.meter.sample()
+                self.last_sample = now
+            for key, mask in self.sel.select(min(0.01, until - now)):
+                key.data.on_event(mask)
+        return False
+
+    def setup(self):
+        a = self.args
+        for i in range(1, a.devices + 1):
+            name = "%s%d" % (a.prefix, i)
+            dev = Device(name, os.path.join(a.statepath, "%s-%s" % (a.driver, name)), a.vars)
+            self.devices.append(dev)
+            self.listeners.append(Listener(self, dev))
+
+        if a.ready_file:
+            with open(a.ready_file, "w") as f:
+                f.write("%d\n" % os.getpid())
+
+        log("%d device sockets are listening, waiting for upsd to dump them all" % a.devices)
+        if not self.run_loop(time.monotonic() + a.setup_timeout,
+                lambda: all(d.dumped for d in self.devices)):
+            log("upsd did not connect to all of the devices in %d seconds" % a.setup_timeout)
+            return False
+
+        pid = None
+        deadline = time.monotonic() + a.setup_timeout
+        while pid is None and time.monotonic() < deadline:
+            try:
+                with open(a.upsd_pid_file) as f:
+                    pid = int(f.read().split()[0])
+            except (OSError, IndexError, ValueError):
+                self.run_loop(time.monotonic() + 0.5)
+        if pid is None:
+            log("no PID of upsd in %s" % a.upsd_pid_file)
+            return False
+        self.meter = UpsdMeter(pid)
+
+        for i in range(a.clients):
+            sock = socket.create_connection((a.host, a.port), timeout=a.setup_timeout)
+            sock.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+            self.clients.append(Client(self, sock, i))
+
+        # upsd may still be digesting the dumps: retry the WATCH of those
+        # which failed until all of them are accepted
+        deadline = time.monotonic() + a.setup_timeout
+        for c in self.clients:
+            c.watch_all(self.devices)
+        while True:
+            if not self.run_loop(deadline, lambda: all(
+                    c.watched + c.errors >= len(self.devices) for c in self.clients)):
+                log("the WATCH requests were not answered in %d seconds" % a.setup_timeout)
+                return False
+            if all(c.watched >= len(self.devices) for c in self.clients):
+                break
+            self.run_loop(time.monotonic() + 1)
+            for c in self.clients:
+                c.watched = 0
+                c.errors = 0
+                c.watch_all(self.devices)
+
+        return True
+
+    def phase_latency(self):
+        a = self.args
+        start = time.monotonic()
+        self.measure_from = start + a.warmup
+        end = self.measure_from + a.duration
+        state = {"seq": 0, "dev": 0}
+
+        def inject(now):
+            due = int((min(now, end) - start) * a.rate)
+            while state["seq"] < due:
+                state["seq"] += 1
+                dev = self.devices[state["dev"] % len(self.devices)]
+                state["dev"] += 1
+                self.sent[str(state["seq"])] = time.monotonic()
+                dev.inject(state["seq"])
+
+        self.run_loop(self.measure_from)
+        cpu0 = self.meter.sample()
+        self.run_loop(end, tick=inject)
+        cpu1 = self.meter.sample()
+
+        injected = sum(1 for t in self.sent.values() if t >= self.measure_from)
+        # let the notifications of the last injections arrive
+        expected = injected * len(self.clients)
+        self.run_loop(time.monotonic() + 5, lambda: len(self.latencies) >= expected)
+
+        lat = sorted(self.latencies)
+
+        def ms(v):
+            return None if v is None else round(v * 1000, 3)
+
+        return {
+            "injected": injected,
+            "notifications": len(lat),
+            "missed": expected - len(lat),
+            "latency_ms_p50": ms(percentile(lat, 50)),
+            "latency_ms_p99": ms(percentile(lat, 99)),
+            "latency_ms_max": ms(lat[-1] if lat else None),
+            "latency_ms_mean": ms(sum(lat) / len(lat) if lat else None),
+            "upsd_cpu_percent": None if cpu0 is None or cpu1 is None
+                else round((cpu1 - cpu0) * 100 / a.duration, 1),
+        }
+
+    def phase_list(self):
+        a = self.args
+        self.listing = True
+        for c in self.clients:
+            c.start_listing(a.depth)
+
+        # start counting once the pipelines are full
+        self.run_loop(time.monotonic() + 1)
+        self.counting = True
+        vars0 = sum(c.vars for c in self.clients)
+        cpu0 = self.meter.sample()
+        start = time.monotonic()
+        self.run_loop(start + a.list_duration)
+        elapsed = time.monotonic() - start
+        cpu1 = self.meter.sample()
+        self.counting = False
+        self.listing = False
+
+        lists = sum(c.lists for c in self.clients)
+        nvars = sum(c.vars for c in self.clients) - vars0
+        self.run_loop(time.monotonic() + 5, lambda: all(c.pending <= 0 for c in self.clients))
+        return {
+            "lists_per_sec": round(lists / elapsed, 1),
+            "vars_per_sec": round(nvars / elapsed, 1),
+            "upsd_cpu_percent": None if cpu0 is None or cpu1 is None
+                else round((cpu1 - cpu0) * 100 / elapsed, 1),
+        }
+
+    def close(self):
+        self.stopping = True
+        for c in self.clients:
+            c.conn.close()
+        for d in self.devices:
+            for conn in list(d.conns):
+                conn.close()
+        for l in self.listeners:
+            l.close()
+
+
+def raise_nofile(needed):
+    if resource is None:
+        return True
+    soft, hard = resource.getrlimit(resource.RLIMIT_NOFILE)
+    if soft >= needed:
+        return True
+    if hard != resource.RLIM_INFINITY and hard < needed:
+        log("%d file descriptors are needed, but the limit is %d" % (needed, hard))
+        return False
+    resource.setrlimit(resource.RLIMIT_NOFILE, (needed, hard))
+    return True
+
+
+def main():
+    p = argparse.ArgumentParser(description="Simulated devices and clients "
+        "to measure upsd under load, for the 'scale' profile of nit.sh")
+    p.add_argument("--statepath", required=True, help="where upsd looks for the driver sockets")
+    p.add_argument("--host", default="localhost")
+    p.add_argument("--port", type=int, default=3493)
+    p.add_argument("--driver", default="dummy-ups", help="driver name in the ups.conf sections")
+    p.add_argument("--prefix", default="scale", help="UPS names are <prefix>1...<prefix>N")
+    p.add_argument("--devices", type=int, default=100)
+    p.add_argument("--vars", type=int, default=40, help="variables of each device")
+    p.add_argument("--clients", type=int, default=10)
+    p.add_argument("--rate", type=float, default=100, help="changes injected per second")
+    p.add_argument("--warmup", type=float, default=2, help="seconds before measuring")
+    p.add_argument("--duration", type=float, default=30, help="seconds of the latency phase")
+    p.add_argument("--list-duration", type=float, default=10, help="seconds of the LIST VAR phase")
+    p.add_argument("--depth", type=int, default=4, help="LIST VAR requests in flight per client")
+    p.add_argument("--setup-timeout", type=int, default=120)
+    p.add_argument("--upsd-pid-file", required=True)
+    p.add_argument("--ready-file", help="written once the device sockets listen")
+    p.add_argument("--report", help="JSON file for the results")
+    a = p.parse_args()
+
+    if a.devices < 1 or a.clients < 1 or a.vars < 1 or a.rate <= 0:
+        p.error("--devices, --clients, --vars and --rate must be positive")
+
+    if not raise_nofile(2 * a.devices + a.clients + 64):
+        return 1
+
+    test = ScaleTest(a)
+    cpu_start = time.process_time()
+    wall_start = time.monotonic()
+    try:
+        if not test.setup():
+            return 1
+        log("%d clients WATCH %s of %d devices, injecting %g changes per second"
+            % (a.clients, SCALE_VAR, a.devices, a.rate))
+        latency = test.phase_latency()
+        log("LIST VAR phase, %d requests in flight per client" % a.depth)
+        listing = test.phase_list()
+    finally:
+        test.close()
+
+    report = {
+        "devices": a.devices,
+        "vars": a.vars,
+        "clients": a.clients,
+        "rate": a.rate,
+        "duration": a.duration,
+        "latency": latency,
+        "list": listing,
+        "upsd_rss_kb_max": test.meter.rss_max,
+        "harness_cpu_percent": round((time.process_time() - cpu_start) * 100
+            / (time.monotonic() - wall_start), 1),
+    }
+
+    print("NIT scale: %d devices of %d vars, %d clients, %g changes/s for %gs"
+        % (a.devices, a.vars, a.clients, a.rate, a.duration))
+    print("  propagation latency (ms): p50=%s p99=%s max=%s mean=%s"
+        % (latency["latency_ms_p50"], latency["latency_ms_p99"],
+           latency["latency_ms_max"], latency["latency_ms_mean"]))
+    print("  notifications: %d for %d changes, %d missed"
+        % (latency["notifications"], latency["injected"], latency["missed"]))
+    print("  LIST VAR: %s lists/s, %s vars/s"
+        % (listing["lists_per_sec"], listing["vars_per_sec"]))
+    print("  upsd: CPU %s%% (changes), %s%% (LIST VAR), max RSS %d kB"
+        % (latency["upsd_cpu_percent"], listing["upsd_cpu_percent"], test.meter.rss_max))
+    print("  load generator CPU: %s%%" % report["harness_cpu_percent"])
+
+    if a.report:
+        with open(a.report, "w") as f:
+            json.dump(report, f, indent=2, sort_keys=True)
+            f.write("\n")
+
+    if test.failed or latency["notifications"] == 0 or listing["lists_per_sec"] == 0:
+        return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
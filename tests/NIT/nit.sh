@@ -27,6 +27,8 @@
 #			script can anyway choose to `mktemp` another)
 #	NUT_DEBUG_UPSMON_NOTIFY_SYSLOG=false	To *disable* upsmon
 #			notifications spilling to the script's console.
+#	NIT_SCALE_DEVICES=1000 NIT_SCALE_CLIENTS=50	to size the
+#			NIT_CASE=scale load test (see testcase_sandbox_scale)
 #
 # Common sandbox run for testing goes from NUT root build directory like:
 #	DEBUG_SLEEP=600 NUT_PORT=12345 NIT_CASE=testcase_sandbox_start_drivers_after_upsd NUT_FOREGROUND_WITH_PID=true make check-NIT &
@@ -318,6 +320,7 @@ PID_UPSSCHED=""
 PID_DUMMYUPS=""
 PID_DUMMYUPS1=""
 PID_DUMMYUPS2=""
+PID_NITSCALE=""
 
 # Stash it for some later decisions
 TESTDIR_CALLER="${TESTDIR-}"
@@ -399,10 +402,10 @@ stop_daemons() {
         PID_UPSSCHED_NOW="`head -1 "$NUT_PIDPATH/upssched.pid"`"
     fi
 
-    if [ -n "$PID_UPSD$PID_UPSMON$PID_DUMMYUPS$PID_DUMMYUPS1$PID_DUMMYUPS2$PID_UPSSCHED$PID_UPSSCHED_NOW" ] ; then
+    if [ -n "$PID_UPSD$PID_UPSMON$PID_DUMMYUPS$PID_DUMMYUPS1$PID_DUMMYUPS2$PID_UPSSCHED$PID_UPSSCHED_NOW$PID_NITSCALE" ] ; then
         log_info "Stopping test daemons"
-        kill -15 $PID_UPSD $PID_UPSMON $PID_DUMMYUPS $PID_DUMMYUPS1 $PID_DUMMYUPS2 $PID_UPSSCHED $PID_UPSSCHED_NOW 2>/dev/null || return 0
-        wait $PID_UPSD $PID_UPSMON $PID_DUMMYUPS $PID_DUMMYUPS1 $PID_DUMMYUPS2 $PID_UPSSCHED $PID_UPSSCHED_NOW || true
+        kill -15 $PID_UPSD $PID_UPSMON $PID_DUMMYUPS $PID_DUMMYUPS1 $PID_DUMMYUPS2 $PID_UPSSCHED $PID_UPSSCHED_NOW $PID_NITSCALE 2>/dev/null || return 0
+        wait $PID_UPSD $PID_UPSMON $PID_DUMMYUPS $PID_DUMMYUPS1 $PID_DUMMYUPS2 $PID_UPSSCHED $PID_UPSSCHED_NOW $PID_NITSCALE || true
     fi
 
     PID_UPSD=""
@@ -411,6 +414,7 @@ stop_daemons() {
     PID_DUMMYUPS=""
     PID_DUMMYUPS1=""
     PID_DUMMYUPS2=""
+    PID_NITSCALE=""
 
     unset PID_UPSSCHED_NOW
 }
@@ -1268,6 +1272,52 @@ testcase_sandbox_upsc_query_bogus() {
     fi
 }
 
+testcase_sandbox_list_fleet() {
+    log_info "[testcase_sandbox_list_fleet] Query LIST FLEET with a usual and with a pathological pattern"
+
+    PYTHON_FLEET="`command -v python3`" || PYTHON_FLEET=""
+    if [ -z "${PYTHON_FLEET}" ] ; then
+        log_warn "[testcase_sandbox_list_fleet] SKIPPED: no Python 3 interpreter to talk to upsd"
+        return 0
+    fi
+
+    # The other patterns would take ages with a backtracking matcher on
+    # long names: the first of them should match nothing at once, and the
+    # second one (with too many stars) be refused
+    runcmd "${PYTHON_FLEET}" -c '
+import socket, sys, time
+s = socket.create_connection(("localhost", int(sys.argv[1])), timeout=10)
+f = s.makefile("rw", newline="\n")
+def ask(line):
+    f.write(line + "\n")
+    f.flush()
+    res = []
+    while True:
+        ans = f.readline().rstrip("\n")
+        res.append(ans)
+        if not ans.startswith(("BEGIN ", "VAR ", "MISSING ", "UNAVAILABLE ")):
+            return res
+start = time.time()
+print(" | ".join(ask("LIST FLEET d?mm* ups.status")))
+print(" | ".join(ask("LIST FLEET \"" + "*?" * 16 + "Z\" ups.status")))
+print(" | ".join(ask("LIST FLEET \"" + "*?" * 20 + "Z\" ups.status")))
+print("%.1f" % (time.time() - start))
+' "${NUT_PORT}" || die "[testcase_sandbox_list_fleet] upsd does not respond on port ${NUT_PORT} ($?): $CMDERR"
+
+    if echo "$CMDOUT" | grep '^BEGIN LIST FLEET d?mm\* | VAR dummy ups.status ".*END LIST FLEET d?mm\*$' >/dev/null \
+    && echo "$CMDOUT" | grep '^BEGIN LIST FLEET [*?]*Z | END LIST FLEET [*?]*Z$' >/dev/null \
+    && echo "$CMDOUT" | grep '^ERR INVALID-ARGUMENT$' >/dev/null \
+    && echo "$CMDOUT" | tail -1 | grep '^[0-4]\.' >/dev/null \
+    ; then
+        PASSED="`expr $PASSED + 1`"
+        log_info "[testcase_sandbox_list_fleet] PASSED: got expected replies to LIST FLEET"
+    else
+        log_error "[testcase_sandbox_list_fleet] got unexpected replies to LIST FLEET: $CMDOUT"
+        FAILED="`expr $FAILED + 1`"
+        FAILED_FUNCS="$FAILED_FUNCS testcase_sandbox_list_fleet"
+    fi
+}
+
 testcase_sandbox_upsc_query_timer() {
     log_separator
     log_info "[testcase_sandbox_upsc_query_timer] Test that dummy-ups TIMER action changes the reported state"
@@ -1673,10 +1723,122 @@ sandbox_start_upsmon_master() {
 
 ####################################
 
+### Scale profile: ##############################################
+# Many devices, simulated by nit-scale.py in place of the drivers, and many
+# clients WATCHing them; the simulator injects value changes at a fixed
+# rate and reports their propagation latency, the LIST VAR throughput and
+# the CPU and memory use of upsd. Sized by these variables:
+[ -n "${NIT_SCALE_DEVICES-}" ] || NIT_SCALE_DEVICES=100
+[ -n "${NIT_SCALE_CLIENTS-}" ] || NIT_SCALE_CLIENTS=10
+[ -n "${NIT_SCALE_VARS-}" ] || NIT_SCALE_VARS=40
+# changes per second (over all devices), and seconds of each measurement
+[ -n "${NIT_SCALE_RATE-}" ] || NIT_SCALE_RATE=100
+[ -n "${NIT_SCALE_DURATION-}" ] || NIT_SCALE_DURATION=30
+[ -n "${NIT_SCALE_LIST_DURATION-}" ] || NIT_SCALE_LIST_DURATION=10
+# JSON copy of the results, to compare between builds
+[ -n "${NIT_SCALE_REPORT-}" ] || NIT_SCALE_REPORT="${BUILDDIR}/nit-scale-report.json"
+
+generatecfg_ups_scale() {
+    generatecfg_ups_trivial
+
+    # No driver runs for these sections: upsd finds their sockets
+    # served by nit-scale.py
+    awk -v N="${1-$NIT_SCALE_DEVICES}" 'BEGIN {
+        for (i = 1; i <= N; i++)
+            printf("[scale%d]\n    driver = dummy-ups\n    port = nit-scale\n", i);
+    }' >> "$NUT_CONFPATH/ups.conf" \
+    || die "Failed to populate temporary FS structure for the NIT: ups.conf"
+}
+
+isTestableScale() {
+    PYTHON_SCALE=""
+    if isTestablePython ; then
+        PYTHON_SCALE="`echo "${PY_SHEBANG}" | sed 's,^#! *,,'`"
+    else
+        PYTHON_SCALE="`command -v python3`" || PYTHON_SCALE=""
+    fi
+
+    if [ -z "${PYTHON_SCALE}" ] \
+    || ! ${PYTHON_SCALE} -c 'import selectors' 2>/dev/null \
+    ; then
+        log_warn "[isTestableScale] No Python 3 interpreter to run nit-scale.py"
+        return 1
+    fi
+    return 0
+}
+
+testcase_sandbox_scale() {
+    log_separator
+    log_info "[testcase_sandbox_scale] ${NIT_SCALE_DEVICES} simulated devices with ${NIT_SCALE_VARS} variables, ${NIT_SCALE_CLIENTS} clients, ${NIT_SCALE_RATE} changes per second"
+
+    if ! isTestableScale ; then
+        log_warn "[testcase_sandbox_scale] SKIPPED"
+        return 0
+    fi
+
+    generatecfg_upsd_nodev
+    generatecfg_upsdusers_trivial
+    generatecfg_ups_scale "${NIT_SCALE_DEVICES}"
+    SANDBOX_CONFIG_GENERATED=true
+
+    # Both upsd and the simulator hold a socket for each device
+    NOFILE_NEEDED="`expr 2 \* ${NIT_SCALE_DEVICES} + ${NIT_SCALE_CLIENTS} + 64`"
+    NOFILE_NOW="`ulimit -n`"
+    if [ x"${NOFILE_NOW}" != xunlimited ] && [ "${NOFILE_NOW}" -lt "${NOFILE_NEEDED}" ] ; then
+        ulimit -n "${NOFILE_NEEDED}" \
+        || log_warn "[testcase_sandbox_scale] Could not raise the limit of open files from ${NOFILE_NOW} to ${NOFILE_NEEDED}"
+    fi
+
+    rm -f "${NUT_STATEPATH}/nit-scale.ready" "${NUT_STATEPATH}/nit-scale.upsd-pid"
+    ${PYTHON_SCALE} "${SRCDIR}/nit-scale.py" \
+        --statepath "${NUT_STATEPATH}" --host localhost --port "${NUT_PORT}" \
+        --devices "${NIT_SCALE_DEVICES}" --vars "${NIT_SCALE_VARS}" \
+        --clients "${NIT_SCALE_CLIENTS}" --rate "${NIT_SCALE_RATE}" \
+        --duration "${NIT_SCALE_DURATION}" --list-duration "${NIT_SCALE_LIST_DURATION}" \
+        --ready-file "${NUT_STATEPATH}/nit-scale.ready" \
+        --upsd-pid-file "${NUT_STATEPATH}/nit-scale.upsd-pid" \
+        --report "${NIT_SCALE_REPORT}" \
+        > "${NUT_STATEPATH}/nit-scale.out" &
+    PID_NITSCALE="$!"
+
+    COUNTDOWN=60
+    while [ "$COUNTDOWN" -gt 0 ] && [ ! -s "${NUT_STATEPATH}/nit-scale.ready" ] && isPidAlive "$PID_NITSCALE" ; do
+        sleep 1
+        COUNTDOWN="`expr $COUNTDOWN - 1`"
+    done
+
+    if [ ! -s "${NUT_STATEPATH}/nit-scale.ready" ] \
+    || ! upsd_start_loop "testcase_sandbox_scale" \
+    ; then
+        log_error "[testcase_sandbox_scale] Could not start the simulated devices and upsd"
+        FAILED="`expr $FAILED + 1`"
+        FAILED_FUNCS="$FAILED_FUNCS testcase_sandbox_scale"
+        return 1
+    fi
+    echo "$PID_UPSD" > "${NUT_STATEPATH}/nit-scale.upsd-pid"
+
+    RES=0
+    wait "$PID_NITSCALE" || RES=$?
+    PID_NITSCALE=""
+
+    cat "${NUT_STATEPATH}/nit-scale.out"
+    if [ "$RES" = 0 ] ; then
+        log_info "[testcase_sandbox_scale] PASSED: results saved into ${NIT_SCALE_REPORT}"
+        PASSED="`expr $PASSED + 1`"
+    else
+        log_error "[testcase_sandbox_scale] FAILED (exit code $RES)"
+        FAILED="`expr $FAILED + 1`"
+        FAILED_FUNCS="$FAILED_FUNCS testcase_sandbox_scale"
+    fi
+}
+
+####################################
+
 testgroup_sandbox() {
     testcase_sandbox_start_drivers_after_upsd
     testcase_sandbox_upsc_query_model
     testcase_sandbox_upsc_query_bogus
+    testcase_sandbox_list_fleet
     testcase_sandbox_upsc_query_timer
     testcases_sandbox_python
     testcases_sandbox_cppnit
@@ -1722,6 +1884,14 @@ testgroup_sandbox_nutscanner() {
     sandbox_forget_configs
 }
 
+testgroup_sandbox_scale() {
+    # Runs alone: upsd gets the simulated devices instead of the dummies
+    testcase_sandbox_scale
+
+    log_separator
+    sandbox_forget_configs
+}
+
 testgroup_sandbox_upsmon_master() {
     # Arrange for quick test iterations
     # Optional arg can specify amount of power sources to MONITOR and require
@@ -1739,6 +1909,7 @@ case "${NIT_CASE}" in
     cppnit) testgroup_sandbox_cppnit ;;
     python) testgroup_sandbox_python ;;
     nutscanner|nut-scanner) testgroup_sandbox_nutscanner ;;
+    scale) testgroup_sandbox_scale ;;
     testcase_*|testgroup_*|testcases_*|testgroups_*)
         log_warn "========================================================"
         log_warn "You asked to run just a specific testcase* or testgroup*"
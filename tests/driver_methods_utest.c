@@ -29,7 +29,7 @@
 
 /* driver version */
 #define DRIVER_NAME	"Mock driver for unit tests"
-#define DRIVER_VERSION	"0.02"
+#define DRIVER_VERSION	"0.03"
 
 /* driver description structure */
 upsdrv_info_t upsdrv_info = {
@@ -58,6 +58,41 @@ static void report_fail(void) {
 	cases_failed++;
 }
 
+#ifndef WIN32
+/* callback of the watched pipe in test cases #23+#24+#25 */
+static int fd_calls = 0, fd_ret = 0;
+
+static int fd_func(int fd, int events, void *arg) {
+	char	c;
+
+	NUT_UNUSED_VARIABLE(arg);
+
+	if ((events & DSTATE_WATCH_READ) && read(fd, &c, 1) == 1) {
+		fd_calls++;
+	}
+
+	return fd_ret;
+}
+
+/* write a byte to the watched pipe and wait at most <msec> for it */
+static int fd_poll(int wfd, long msec) {
+	struct timeval	deadline;
+
+	if (write(wfd, "x", 1) != 1) {
+		return -1;
+	}
+
+	drv_gettime(&deadline);
+	deadline.tv_usec += msec * 1000;
+	while (deadline.tv_usec >= 1000000) {
+		deadline.tv_sec++;
+		deadline.tv_usec -= 1000000;
+	}
+
+	return dstate_poll_fds(deadline, ERROR_FD);
+}
+#endif	/* !WIN32 */
+
 static int report_0_means_pass(int i) {
 	if (i == 0) {
 		report_pass();
@@ -367,12 +402,78 @@ int main(int argc, char **argv) {
 	report_0_means_pass(strcmp(valueStr, "OB LB FSD"));
 	printf(" test for ups.status with FSD token set and now committed: '%s'; got OB LB FSD?\n", NUT_STRARG(valueStr));
 
+	/* Test cases #21+#22 (built on top of #20)
+	 * Commit the same tokens again after ups.status was changed by other
+	 * means; check status_get() for known and unknown tokens.
+	 * Expectation: the status is published again, the tokens are found.
+	 */
+	dstate_setinfo("ups.status", "OL");
+	status_init();
+	status_set("OB LB");
+	status_set("FSD");
+	status_commit();
+
+	/* #21 */
+	valueStr = dstate_getinfo("ups.status");
+	report_0_means_pass(strcmp(valueStr, "OB LB FSD"));
+	printf(" test for ups.status re-committed after it was changed directly: '%s'; got OB LB FSD?\n", NUT_STRARG(valueStr));
+
+	/* #22 */
+	status_set("XYZ");
+	report_0_means_pass(!(status_get("LB") && status_get("XYZ")
+		&& !status_get("OL") && !status_get("XY")));
+	printf(" test for status_get() of known and unknown tokens: got LB and XYZ, no OL nor XY?\n");
+
 	/* Clear testing state before finishing. */
 	alarm_init();
 	alarm_commit();
 	status_init();
 	status_commit();
 
+#ifndef WIN32
+	/* Test cases #23+#24+#25 (from scratch)
+	 * Watch a pipe with a callback, write to it and wait for it.
+	 * Expectation: the callback reads the byte, and dstate_poll_fds()
+	 * goes on waiting (returns 0), wakes up (returns 2) or unwatches
+	 * the pipe (the last byte waits until the timeout), as it was told.
+	 */
+	{
+		int	pfd[2];
+
+		if (pipe(pfd) == 0) {
+			int	ret;
+
+			dstate_add_fd(pfd[0], DSTATE_WATCH_READ, fd_func, NULL);
+
+			/* #23 */
+			fd_ret = 0;
+			ret = fd_poll(pfd[1], 500);
+			report_0_means_pass(!(ret == 0 && fd_calls == 1));
+			printf(" test for dstate_add_fd() callback going on waiting: got %d after %d call(s), expected 0 after 1?\n", ret, fd_calls);
+
+			/* #24 */
+			fd_ret = 1;
+			ret = fd_poll(pfd[1], 500);
+			report_0_means_pass(!(ret == 2 && fd_calls == 2));
+			printf(" test for dstate_add_fd() callback waking up: got %d after %d call(s), expected 2 after 2?\n", ret, fd_calls);
+
+			/* #25 */
+			fd_ret = -1;
+			fd_poll(pfd[1], 100);
+			ret = fd_poll(pfd[1], 100);
+			report_0_means_pass(!(ret == 1 && fd_calls == 3));
+			printf(" test for dstate_add_fd() callback unwatching: got %d after %d call(s), expected 1 after 3?\n", ret, fd_calls);
+
+			dstate_unwatch_fd(pfd[0]);
+			close(pfd[0]);
+			close(pfd[1]);
+		} else {
+			report_fail();
+			printf(" test for dstate_add_fd(): could not create a pipe\n");
+		}
+	}
+#endif	/* !WIN32 */
+
 	/* Finish */
 	printf("test_rules completed. Total cases %d, passed %d, failed %d\n",
 		cases_passed+cases_failed, cases_passed, cases_failed);
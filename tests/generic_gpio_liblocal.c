@@ -137,6 +137,18 @@ int gpiod_line_event_read(struct gpiod_line *line,
 	return 0;
 }
 
+int gpiod_line_event_get_fd(struct gpiod_line *line) {
+	NUT_UNUSED_VARIABLE(line);
+	return -1;
+}
+
+int gpiod_line_event_read_fd(int fd, struct gpiod_line_event *event) {
+	NUT_UNUSED_VARIABLE(fd);
+	NUT_UNUSED_VARIABLE(event);
+	errno = EAGAIN;
+	return -1;
+}
+
 unsigned int gpiod_line_offset(struct gpiod_line *line) {
 	NUT_UNUSED_VARIABLE(line);
 	return 0;
@@ -286,4 +298,47 @@ int gpiod_line_request_wait_edge_events(struct gpiod_line_request *request,
 void gpiod_line_request_release(struct gpiod_line_request *request) {
 	NUT_UNUSED_VARIABLE(request);
 }
+
+/* no edge events: the lines are polled */
+int gpiod_line_request_get_fd(struct gpiod_line_request *request) {
+	NUT_UNUSED_VARIABLE(request);
+	return -1;
+}
+
+int gpiod_line_request_read_edge_events(struct gpiod_line_request *request,
+					struct gpiod_edge_event_buffer *buffer,
+					size_t max_events) {
+	NUT_UNUSED_VARIABLE(request);
+	NUT_UNUSED_VARIABLE(buffer);
+	NUT_UNUSED_VARIABLE(max_events);
+	return 0;
+}
+
+struct gpiod_edge_event_buffer *gpiod_edge_event_buffer_new(size_t capacity) {
+	NUT_UNUSED_VARIABLE(capacity);
+	return (struct gpiod_edge_event_buffer *)1;
+}
+
+void gpiod_edge_event_buffer_free(struct gpiod_edge_event_buffer *buffer) {
+	NUT_UNUSED_VARIABLE(buffer);
+}
+
+struct gpiod_edge_event *
+gpiod_edge_event_buffer_get_event(struct gpiod_edge_event_buffer *buffer,
+				  unsigned long index) {
+	NUT_UNUSED_VARIABLE(buffer);
+	NUT_UNUSED_VARIABLE(index);
+	return NULL;
+}
+
+enum gpiod_edge_event_type
+gpiod_edge_event_get_event_type(struct gpiod_edge_event *event) {
+	NUT_UNUSED_VARIABLE(event);
+	return GPIOD_EDGE_EVENT_RISING_EDGE;
+}
+
+unsigned int gpiod_edge_event_get_line_offset(struct gpiod_edge_event *event) {
+	NUT_UNUSED_VARIABLE(event);
+	return 0;
+}
 #endif	/* WITH_LIBGPIO_VERSION */
@@ -0,0 +1,584 @@
+/*  nutbench.c - microbenchmarks of the NUT core data structures and parsers
+ *
+ *  Copyright (C)
+ *      2026            Network UPS Tools developers
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+
+/* Each benchmark prints one line of tab-separated fields:
+ *	name	n	ops	ns_per_op
+ * where <n> is the size of the data set (variables, bytes, items...),
+ * <ops> the count of operations timed and <ns_per_op> the best of the
+ * rounds. The data sets are generated the same way on each run, so the
+ * output of two builds can be compared line by line (e.g. with join(1)).
+ */
+
+#include "config.h"
+#include "common.h"
+#include "state.h"
+#include "parseconf.h"
+#include "hidparser.h"
+#include "nutscan-ip.h"
+#include "nut_stdint.h"
+#include "timehead.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static double	bench_mintime = 0.2;	/* seconds per measurement */
+static int	bench_rounds = 3;
+static char	**bench_only = NULL;	/* name prefixes to run, or all */
+static int	bench_nonly = 0;
+
+/* sink for the results, so that the compiler keeps the work */
+static volatile long	bench_sink = 0;
+
+static double bench_now(void)
+{
+#if defined(HAVE_CLOCK_GETTIME) && defined(HAVE_CLOCK_MONOTONIC) && HAVE_CLOCK_GETTIME && HAVE_CLOCK_MONOTONIC
+	struct timespec	ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+#else
+	struct timeval	tv;
+
+	gettimeofday(&tv, NULL);
+	return (double)tv.tv_sec + (double)tv.tv_usec / 1e6;
+#endif
+}
+
+static int bench_selected(const char *name)
+{
+	int	i;
+
+	if (bench_nonly == 0)
+		return 1;
+
+	for (i = 0; i < bench_nonly; i++) {
+		if (!strncmp(name, bench_only[i], strlen(bench_only[i])))
+			return 1;
+	}
+
+	return 0;
+}
+
+/* <fn> runs <iters> iterations of <per> operations each over <arg>, and
+ * returns the seconds spent in the part to measure */
+typedef double (*bench_fn_t)(void *arg, size_t iters);
+
+static void bench_run(const char *name, size_t n, size_t per, bench_fn_t fn, void *arg)
+{
+	size_t	iters = 1;
+	double	dt, best;
+	int	r;
+
+	if (!bench_selected(name))
+		return;
+
+	/* grow the iterations until one measurement lasts long enough */
+	while ((dt = fn(arg, iters)) < bench_mintime) {
+		double	scale = (dt > 0) ? 1.5 * bench_mintime / dt : 10;
+
+		iters = (size_t)((double)iters * (scale > 10 ? 10 : scale)) + 1;
+	}
+
+	best = dt;
+	for (r = 1; r < bench_rounds; r++) {
+		dt = fn(arg, iters);
+		if (dt < best)
+			best = dt;
+	}
+
+	printf("%s\t%" PRIuSIZE "\t%" PRIuSIZE "\t%.2f\n",
+		name, n, iters * per, best * 1e9 / ((double)iters * (double)per));
+	fflush(stdout);
+}
+
+/* a fixed pseudo-random sequence, the same on each run */
+static uint32_t	bench_seed = 1;
+
+static uint32_t bench_rand(void)
+{
+	bench_seed = bench_seed * 1103515245U + 12345U;
+	return bench_seed >> 8;
+}
+
+static void bench_shuffle(char **names, size_t n)
+{
+	size_t	i;
+
+	for (i = n; i > 1; i--) {
+		size_t	j = bench_rand() % i;
+		char	*tmp = names[i - 1];
+
+		names[i - 1] = names[j];
+		names[j] = tmp;
+	}
+}
+
+/* ---- state.c: the st_tree_t of the variables of a driver ---- */
+
+typedef struct {
+	size_t	n;
+	char	**names;	/* <n> variable names, in random order */
+	st_tree_t	*root;
+} state_bench_t;
+
+static void state_build(state_bench_t *sb)
+{
+	size_t	i;
+
+	for (i = 0; i < sb->n; i++)
+		state_setinfo(&sb->root, sb->names[i], "value");
+}
+
+static double bench_state_new(void *arg, size_t iters)
+{
+	state_bench_t	*sb = arg;
+	double	dt = 0, t0;
+	size_t	it;
+
+	for (it = 0; it < iters; it++) {
+		t0 = bench_now();
+		state_build(sb);
+		dt += bench_now() - t0;
+
+		state_infofree(sb->root);
+		sb->root = NULL;
+	}
+
+	return dt;
+}
+
+static double bench_state_update(void *arg, size_t iters)
+{
+	state_bench_t	*sb = arg;
+	double	t0 = bench_now();
+	size_t	it, i;
+
+	for (it = 0; it < iters; it++) {
+		const char	*val = (it & 1) ? "12.5" : "12.6";
+
+		for (i = 0; i < sb->n; i++)
+			state_setinfo(&sb->root, sb->names[i], val);
+	}
+
+	return bench_now() - t0;
+}
+
+static double bench_state_find(void *arg, size_t iters)
+{
+	state_bench_t	*sb = arg;
+	double	t0 = bench_now();
+	size_t	it, i;
+	long	found = 0;
+
+	for (it = 0; it < iters; it++) {
+		for (i = 0; i < sb->n; i++) {
+			if (state_tree_find(sb->root, sb->names[i]))
+				found++;
+		}
+	}
+
+	bench_sink += found;
+	return bench_now() - t0;
+}
+
+static double bench_state_del(void *arg, size_t iters)
+{
+	state_bench_t	*sb = arg;
+	double	dt = 0, t0;
+	size_t	it, i;
+
+	for (it = 0; it < iters; it++) {
+		state_build(sb);
+
+		t0 = bench_now();
+		for (i = 0; i < sb->n; i++)
+			state_delinfo(&sb->root, sb->names[i]);
+		dt += bench_now() - t0;
+	}
+
+	return dt;
+}
+
+static void bench_state(void)
+{
+	static const char	*prefix[] = {
+		"battery", "input", "output", "ups", "device", "outlet", "ambient", "driver"
+	};
+	static const size_t	sizes[] = { 10, 100, 1000, 10000 };
+	state_bench_t	sb;
+	size_t	s, i;
+	char	buf[SMALLBUF];
+
+	for (s = 0; s < SIZEOF_ARRAY(sizes); s++) {
+		sb.n = sizes[s];
+		sb.names = xcalloc(sb.n, sizeof(*sb.names));
+		sb.root = NULL;
+
+		for (i = 0; i < sb.n; i++) {
+			snprintf(buf, sizeof(buf), "%s.%05u.value",
+				prefix[i % SIZEOF_ARRAY(prefix)], (unsigned int)i);
+			sb.names[i] = xstrdup(buf);
+		}
+		bench_shuffle(sb.names, sb.n);
+
+		bench_run("state_setinfo.new", sb.n, sb.n, bench_state_new, &sb);
+
+		state_build(&sb);
+		bench_run("state_setinfo.update", sb.n, sb.n, bench_state_update, &sb);
+		bench_run("state_tree_find", sb.n, sb.n, bench_state_find, &sb);
+		state_infofree(sb.root);
+		sb.root = NULL;
+
+		bench_run("state_delinfo", sb.n, sb.n, bench_state_del, &sb);
+
+		for (i = 0; i < sb.n; i++)
+			free(sb.names[i]);
+		free(sb.names);
+	}
+}
+
+/* ---- parseconf.c: the configuration files and the network protocol ---- */
+
+typedef struct {
+	char	*text;		/* ups.conf-like text */
+	size_t	len;
+	char	**lines;	/* the same, split into lines */
+	size_t	nlines;
+	PCONF_CTX_t	ctx;
+} pconf_bench_t;
+
+static void pconf_bench_err(const char *errmsg)
+{
+	fprintf(stderr, "pconf error: %s\n", errmsg);
+}
+
+static double bench_pconf_char(void *arg, size_t iters)
+{
+	pconf_bench_t	*pb = arg;
+	double	t0 = bench_now();
+	size_t	it, i;
+	long	args = 0;
+
+	for (it = 0; it < iters; it++) {
+		for (i = 0; i < pb->len; i++) {
+			if (pconf_char(&pb->ctx, pb->text[i]) == 1)
+				args += (long)pb->ctx.numargs;
+		}
+	}
+
+	bench_sink += args;
+	return bench_now() - t0;
+}
+
+static double bench_pconf_line(void *arg, size_t iters)
+{
+	pconf_bench_t	*pb = arg;
+	double	t0 = bench_now();
+	size_t	it, i;
+	long	args = 0;
+
+	for (it = 0; it < iters; it++) {
+		for (i = 0; i < pb->nlines; i++) {
+			pconf_line(&pb->ctx, pb->lines[i]);
+			args += (long)pb->ctx.numargs;
+		}
+	}
+
+	bench_sink += args;
+	return bench_now() - t0;
+}
+
+typedef struct {
+	const char	*src;
+	char	dest[LARGEBUF];
+} encode_bench_t;
+
+static double bench_pconf_encode(void *arg, size_t iters)
+{
+	encode_bench_t	*eb = arg;
+	double	t0 = bench_now();
+	size_t	it;
+	long	len = 0;
+
+	for (it = 0; it < iters; it++)
+		len += (long)strlen(pconf_encode(eb->src, eb->dest, sizeof(eb->dest)));
+
+	bench_sink += len;
+	return bench_now() - t0;
+}
+
+static void bench_pconf(void)
+{
+	static const char	*section =
+		"# UPS number %u in the rack\n"
+		"[ups%u]\n"
+		"\tdriver = usbhid-ups\n"
+		"\tport = auto\n"
+		"\tdesc = \"Rack %u, \\\"left\\\" side\"\n"
+		"\tpollinterval = 5\n"
+		"\toverride.battery.charge.low = 20\n"
+		"\n";
+	static const char	*encode_src[] = {
+		"Smart-UPS 1500",
+		"OL CHRG \"a quoted\\path\" and some more text to make up a longer "
+		"value which needs \"several\" escapes, as a \\long\\ description "
+		"of a device or a multi-word status would"
+	};
+	pconf_bench_t	pb;
+	encode_bench_t	eb;
+	size_t	i, size = 0;
+	char	*p;
+
+	/* one buffer of 256 sections, and a copy split into lines */
+	pb.text = xcalloc(256, strlen(section) + 16);
+	for (i = 0; i < 256; i++) {
+		size += (size_t)sprintf(pb.text + size, section,
+			(unsigned int)i, (unsigned int)i, (unsigned int)i / 16);
+	}
+	pb.len = size;
+
+	pb.lines = xcalloc(pb.len, sizeof(*pb.lines));
+	pb.nlines = 0;
+	p = xstrdup(pb.text);
+	for (p = strtok(p, "\n"); p; p = strtok(NULL, "\n"))
+		pb.lines[pb.nlines++] = p;
+
+	pconf_init(&pb.ctx, pconf_bench_err);
+	bench_run("pconf_char", pb.len, pb.len, bench_pconf_char, &pb);
+	bench_run("pconf_line", pb.nlines, pb.nlines, bench_pconf_line, &pb);
+	pconf_finish(&pb.ctx);
+
+	for (i = 0; i < SIZEOF_ARRAY(encode_src); i++) {
+		eb.src = encode_src[i];
+		bench_run("pconf_encode", strlen(eb.src), 1, bench_pconf_encode, &eb);
+	}
+
+	free(pb.lines[0]);
+	free(pb.lines);
+	free(pb.text);
+}
+
+/* ---- hidparser.c: the report descriptors of the HID drivers ---- */
+
+typedef struct {
+	HIDDesc_t	*desc;
+	HIDPath_t	*paths;		/* the paths of desc->item[] */
+	HIDData_t	*data;		/* for GetValue() */
+	size_t	n;
+	unsigned char	report[64];
+} hid_bench_t;
+
+static double bench_hid_getvalue(void *arg, size_t iters)
+{
+	hid_bench_t	*hb = arg;
+	double	t0 = bench_now();
+	size_t	it, i;
+	long	value, sum = 0;
+
+	for (it = 0; it < iters; it++) {
+		for (i = 0; i < hb->n; i++) {
+			GetValue(hb->report, &hb->data[i], &value);
+			sum += value;
+		}
+	}
+
+	bench_sink += sum;
+	return bench_now() - t0;
+}
+
+static double bench_hid_findpath(void *arg, size_t iters)
+{
+	hid_bench_t	*hb = arg;
+	double	t0 = bench_now();
+	size_t	it, i;
+	long	found = 0;
+
+	for (it = 0; it < iters; it++) {
+		for (i = 0; i < hb->n; i++) {
+			if (FindObject_with_Path(hb->desc, &hb->paths[i], ITEM_FEATURE))
+				found++;
+		}
+	}
+
+	bench_sink += found;
+	return bench_now() - t0;
+}
+
+static void bench_hid(void)
+{
+	/* fields of the usual sizes (bits) at various offsets */
+	static const struct {
+		uint8_t	Offset, Size;
+		long	LogMin, LogMax;
+	} fields[] = {
+		{ 0, 8, 0, 255 }, { 8, 16, 0, 65535 }, { 24, 1, 0, 1 },
+		{ 25, 7, -64, 63 }, { 32, 32, -1, 2147483647 }, { 64, 12, 0, 4095 },
+		{ 76, 4, 0, 15 }, { 80, 16, -32768, 32767 }
+	};
+	static const size_t	sizes[] = { 10, 100, MAX_REPORT };
+	HIDData_t	*item;
+	size_t	replen[256];
+	hid_bench_t	hb;
+	size_t	s, i;
+
+	memset(&hb, 0, sizeof(hb));
+	for (i = 0; i < sizeof(hb.report); i++)
+		hb.report[i] = (unsigned char)bench_rand();
+
+	hb.n = SIZEOF_ARRAY(fields);
+	hb.data = xcalloc(hb.n, sizeof(*hb.data));
+	for (i = 0; i < hb.n; i++) {
+		hb.data[i].Offset = fields[i].Offset;
+		hb.data[i].Size = fields[i].Size;
+		hb.data[i].LogMin = fields[i].LogMin;
+		hb.data[i].LogMax = fields[i].LogMax;
+	}
+	bench_run("hid_GetValue", hb.n, hb.n, bench_hid_getvalue, &hb);
+	free(hb.data);
+
+	for (i = 0; i < SIZEOF_ARRAY(replen); i++)
+		replen[i] = 16;
+
+	for (s = 0; s < SIZEOF_ARRAY(sizes); s++) {
+		hb.n = sizes[s];
+		item = xcalloc(hb.n, sizeof(*item));
+		hb.paths = xcalloc(hb.n, sizeof(*hb.paths));
+
+		/* UPS.PowerSummary-like paths, sharing their leading nodes */
+		for (i = 0; i < hb.n; i++) {
+			item[i].Path.Size = 4;
+			item[i].Path.Node[0] = 0x00840004;
+			item[i].Path.Node[1] = 0x00840010 + (HIDNode_t)(i % 16);
+			item[i].Path.Node[2] = 0x00850000 + (HIDNode_t)(i / 16);
+			item[i].Path.Node[3] = 0x00840030 + (HIDNode_t)(i % 7);
+			item[i].ReportID = (uint8_t)(1 + i % 255);
+			item[i].Type = ITEM_FEATURE;
+			item[i].Size = 16;
+			hb.paths[i] = item[i].Path;
+		}
+
+		hb.desc = New_ReportDesc(item, hb.n, replen);
+		if (!hb.desc)
+			fatalx(EXIT_FAILURE, "New_ReportDesc failed");
+
+		bench_run("hid_FindObject_with_Path", hb.n, hb.n, bench_hid_findpath, &hb);
+
+		Free_ReportDesc(hb.desc);
+		free(hb.paths);
+		free(item);
+	}
+}
+
+/* ---- nutscan-ip.c: the addresses to scan ---- */
+
+typedef struct {
+	nutscan_ip_range_list_t	irl;
+	nutscan_ip_range_list_iter_t	iter;
+	char	*ip;
+} ip_bench_t;
+
+static double bench_ip_iter(void *arg, size_t iters)
+{
+	ip_bench_t	*ib = arg;
+	double	t0 = bench_now();
+	size_t	it;
+
+	for (it = 0; it < iters; it++) {
+		free(ib->ip);
+		ib->ip = nutscan_ip_ranges_iter_inc(&ib->iter);
+		if (!ib->ip)
+			ib->ip = nutscan_ip_ranges_iter_init(&ib->iter, &ib->irl);
+	}
+
+	return bench_now() - t0;
+}
+
+static void bench_ip(void)
+{
+	static const struct {
+		const char	*name, *start, *end;
+		size_t	n;
+	} ranges[] = {
+		{ "nutscan_ip_ranges_iter_inc.ipv4", "10.0.0.0", "10.0.255.255", 65536 },
+		{ "nutscan_ip_ranges_iter_inc.ipv6", "fd00::", "fd00::ffff", 65536 }
+	};
+	ip_bench_t	ib;
+	size_t	i;
+
+	for (i = 0; i < SIZEOF_ARRAY(ranges); i++) {
+		nutscan_init_ip_ranges(&ib.irl);
+		nutscan_add_ip_range(&ib.irl,
+			xstrdup(ranges[i].start), xstrdup(ranges[i].end));
+		ib.ip = nutscan_ip_ranges_iter_init(&ib.iter, &ib.irl);
+
+		bench_run(ranges[i].name, ranges[i].n, 1, bench_ip_iter, &ib);
+
+		free(ib.ip);
+		nutscan_free_ip_ranges(&ib.irl);
+	}
+}
+
+static void usage(const char *prog)
+{
+	printf("Usage: %s [-t msec] [-r rounds] [name-prefix ...]\n\n", prog);
+	printf("  -t msec   : minimum duration of one measurement (default 200)\n");
+	printf("  -r rounds : measurements of each benchmark, the best is shown (default 3)\n");
+	printf("\nOutput lines are: name<TAB>n<TAB>ops<TAB>ns_per_op\n");
+}
+
+int main(int argc, char **argv)
+{
+	int	i;
+
+	while ((i = getopt(argc, argv, "ht:r:")) != -1) {
+		switch (i) {
+		case 't':
+			bench_mintime = atof(optarg) / 1000;
+			break;
+		case 'r':
+			bench_rounds = atoi(optarg);
+			break;
+		case 'h':
+		default:
+			usage(argv[0]);
+			return (i == 'h') ? EXIT_SUCCESS : EXIT_FAILURE;
+		}
+	}
+
+	if (bench_mintime <= 0 || bench_rounds < 1) {
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	bench_only = argv + optind;
+	bench_nonly = argc - optind;
+
+	printf("# name\tn\tops\tns_per_op\n");
+
+	bench_state();
+	bench_pconf();
+	bench_hid();
+	bench_ip();
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,315 @@
+/* nutclientbench - microbenchmarks of the libnutclient protocol parsers
+
+   Companion of nutbench.c for the C++ client library, printing the same
+   tab-separated lines: name, n, ops and ns_per_op. The lists are served
+   by a thread of this program over the loopback interface, so parseList()
+   is measured along with the reading of the socket it parses from.
+
+   Copyright (C)
+	2026	Network UPS Tools developers
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#include "common.h"
+
+#include "../clients/nutclient.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+
+namespace {
+
+double benchMinTime = 0.2;	/* seconds per measurement */
+int benchRounds = 3;
+char** benchOnly = nullptr;	/* name prefixes to run, or all */
+int benchNOnly = 0;
+
+/* sink for the results, so that the compiler keeps the work */
+volatile size_t benchSink = 0;
+
+/* Run <fn> (returning the seconds spent) for more and more iterations of
+ * <per> operations until it lasts long enough, then print the best round */
+void benchRun(const char* name, size_t n, size_t per, const std::function<double(size_t)>& fn)
+{
+	size_t iters = 1;
+	double dt;
+
+	if (benchNOnly > 0)
+	{
+		int i;
+		for (i = 0; i < benchNOnly; i++)
+		{
+			if (strncmp(name, benchOnly[i], strlen(benchOnly[i])) == 0)
+			{
+				break;
+			}
+		}
+		if (i == benchNOnly)
+		{
+			return;
+		}
+	}
+
+	while ((dt = fn(iters)) < benchMinTime)
+	{
+		double scale = (dt > 0) ? 1.5 * benchMinTime / dt : 10;
+		iters = static_cast<size_t>(static_cast<double>(iters) * (scale > 10 ? 10 : scale)) + 1;
+	}
+
+	double best = dt;
+	for (int r = 1; r < benchRounds; r++)
+	{
+		dt = fn(iters);
+		if (dt < best)
+		{
+			best = dt;
+		}
+	}
+
+	printf("%s\t%zu\t%zu\t%.2f\n", name, n, iters * per,
+		best * 1e9 / (static_cast<double>(iters) * static_cast<double>(per)));
+	fflush(stdout);
+}
+
+double now()
+{
+	return std::chrono::duration<double>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/* Reach the protected parsers of the client */
+class BenchClient : public nut::TcpClient
+{
+public:
+	using nut::TcpClient::explode;
+	using nut::TcpClient::parseList;
+	using nut::TcpClient::sendAsyncQueries;
+};
+
+/* Answer each "LIST VAR dev" request on the first connection to <fd> with
+ * <answer>, until the client hangs up */
+void serveList(int fd, const std::string& answer)
+{
+	int conn = accept(fd, nullptr, nullptr);
+	if (conn < 0)
+	{
+		return;
+	}
+
+	std::string req;
+	char buf[512];
+	ssize_t len;
+	while ((len = read(conn, buf, sizeof(buf))) > 0)
+	{
+		req.append(buf, static_cast<size_t>(len));
+		size_t eol;
+		while ((eol = req.find('\n')) != std::string::npos)
+		{
+			const std::string& out = (req.compare(0, eol, "LIST VAR dev") == 0)
+				? answer : std::string("ERR UNKNOWN-COMMAND\n");
+			for (size_t done = 0; done < out.size(); )
+			{
+				ssize_t ret = write(conn, out.data() + done, out.size() - done);
+				if (ret <= 0)
+				{
+					close(conn);
+					return;
+				}
+				done += static_cast<size_t>(ret);
+			}
+			req.erase(0, eol + 1);
+		}
+	}
+	close(conn);
+}
+
+void benchExplode()
+{
+	static const char* lines[] = {
+		"VAR dev ups.status \"OL\"",
+		"VAR dev battery.charge \"100\"",
+		"VAR dev device.description \"Rack 2, \\\"left\\\" side UPS with a long description\"",
+		"RW dev input.transfer.high \"264\""
+	};
+	std::vector<std::string> str(lines, lines + SIZEOF_ARRAY(lines));
+
+	benchRun("nutclient_explode", str.size(), str.size(), [&](size_t iters)
+	{
+		double t0 = now();
+		size_t count = 0;
+		for (size_t it = 0; it < iters; it++)
+		{
+			for (const std::string& line : str)
+			{
+				count += BenchClient::explode(line, 4).size();
+			}
+		}
+		benchSink += count;
+		return now() - t0;
+	});
+
+	std::vector<std::string> tokens;
+	benchRun("nutclient_explode.reuse", str.size(), str.size(), [&](size_t iters)
+	{
+		double t0 = now();
+		size_t count = 0;
+		for (size_t it = 0; it < iters; it++)
+		{
+			for (const std::string& line : str)
+			{
+				BenchClient::explode(line, 4, tokens);
+				count += tokens.size();
+			}
+		}
+		benchSink += count;
+		return now() - t0;
+	});
+}
+
+void benchParseList()
+{
+	static const size_t sizes[] = { 10, 100, 1000 };
+
+	for (size_t n : sizes)
+	{
+		std::string answer = "BEGIN LIST VAR dev\n";
+		for (size_t i = 0; i < n; i++)
+		{
+			answer += "VAR dev battery." + std::to_string(i) + ".voltage \"" + std::to_string(i * 7 % 1000) + ".5\"\n";
+		}
+		answer += "END LIST VAR dev\n";
+
+		int fd = socket(AF_INET, SOCK_STREAM, 0);
+		struct sockaddr_in addr;
+		socklen_t addrlen = sizeof(addr);
+		memset(&addr, 0, sizeof(addr));
+		addr.sin_family = AF_INET;
+		addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		if (fd < 0
+		 || bind(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) < 0
+		 || listen(fd, 1) < 0
+		 || getsockname(fd, reinterpret_cast<struct sockaddr*>(&addr), &addrlen) < 0)
+		{
+			fatal_with_errno(EXIT_FAILURE, "Can not listen on the loopback interface");
+		}
+
+		std::thread server(serveList, fd, answer);
+
+		{
+			BenchClient client;
+			client.connect("127.0.0.1", ntohs(addr.sin_port));
+
+			benchRun("nutclient_parseList", n, n, [&](size_t iters)
+			{
+				double t0 = now();
+				size_t count = 0;
+				for (size_t it = 0; it < iters; it++)
+				{
+					client.sendAsyncQueries(std::vector<std::string>(1, "LIST VAR dev"));
+					client.parseList("VAR dev", [&](const std::string& line, size_t begin)
+					{
+						count += line.size() - begin;
+					});
+				}
+				benchSink += count;
+				return now() - t0;
+			});
+
+			benchRun("nutclient_parseList.explode", n, n, [&](size_t iters)
+			{
+				double t0 = now();
+				size_t count = 0;
+				std::vector<std::string> tokens;
+				for (size_t it = 0; it < iters; it++)
+				{
+					client.sendAsyncQueries(std::vector<std::string>(1, "LIST VAR dev"));
+					client.parseList("VAR dev", [&](const std::string& line, size_t begin)
+					{
+						BenchClient::explode(line, begin, tokens);
+						count += tokens.size();
+					});
+				}
+				benchSink += count;
+				return now() - t0;
+			});
+
+			client.disconnect();
+		}
+
+		server.join();
+		close(fd);
+	}
+}
+
+} /* namespace */
+
+int main(int argc, char **argv)
+{
+	int opt;
+
+	while ((opt = getopt(argc, argv, "ht:r:")) != -1)
+	{
+		switch (opt)
+		{
+		case 't':
+			benchMinTime = atof(optarg) / 1000;
+			break;
+		case 'r':
+			benchRounds = atoi(optarg);
+			break;
+		case 'h':
+		default:
+			printf("Usage: %s [-t msec] [-r rounds] [name-prefix ...]\n", argv[0]);
+			return (opt == 'h') ? EXIT_SUCCESS : EXIT_FAILURE;
+		}
+	}
+
+	if (benchMinTime <= 0 || benchRounds < 1)
+	{
+		printf("Usage: %s [-t msec] [-r rounds] [name-prefix ...]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	benchOnly = argv + optind;
+	benchNOnly = argc - optind;
+
+	printf("# name\tn\tops\tns_per_op\n");
+
+	try
+	{
+		benchExplode();
+		benchParseList();
+	}
+	catch (nut::NutException& ex)
+	{
+		fprintf(stderr, "nutclientbench: %s\n", ex.what());
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
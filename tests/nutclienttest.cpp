@@ -79,6 +79,7 @@ class NutClientTest : public CppUnit::TestFixture
 		CPPUNIT_TEST( test_copy_assignment_var );
 
 		CPPUNIT_TEST( test_nutclientstub_dev );
+		CPPUNIT_TEST( test_cachingclient );
 	CPPUNIT_TEST_SUITE_END();
 
 public:
@@ -99,6 +100,7 @@ public:
 	void test_copy_assignment_var();
 
 	void test_nutclientstub_dev();
+	void test_cachingclient();
 };
 
 // Registers the fixture into the 'registry'
@@ -545,6 +547,76 @@ void NutClientTest::test_nutclientstub_dev() {
 		!noException);
 }
 
+void NutClientTest::test_cachingclient() {
+	bool noException = true;
+
+	nut::MemClientStub c;
+	nut::CachingClient cc(c, 3600);
+	try
+	{
+		c.setDeviceVariable("ups_1", "name_1", "value_1");
+
+		ListValue values = cc.getDeviceVariableValue("ups_1", "name_1");
+		CPPUNIT_ASSERT_MESSAGE(
+			"Failed caching client: bad first value",
+			values.size() == 1 && values[0] == std::string("value_1"));
+
+		// changed behind its back: the cached value stays
+		c.setDeviceVariable("ups_1", "name_1", "value_2");
+		values = cc.getDeviceVariableValue("ups_1", "name_1");
+		CPPUNIT_ASSERT_MESSAGE(
+			"Failed caching client: value not cached",
+			values[0] == std::string("value_1"));
+
+		cc.invalidate("ups_1");
+		values = cc.getDeviceVariableValue("ups_1", "name_1");
+		CPPUNIT_ASSERT_MESSAGE(
+			"Failed caching client: value not fetched after invalidate",
+			values[0] == std::string("value_2"));
+
+		// changed through it: fetched again
+		cc.setDeviceVariable("ups_1", "name_1", "value_3");
+		values = cc.getDeviceVariableValue("ups_1", "name_1");
+		CPPUNIT_ASSERT_MESSAGE(
+			"Failed caching client: value not fetched after set",
+			values[0] == std::string("value_3"));
+
+		// a zero TTL always fetches
+		cc.setVariableTTL("name_1", 0);
+		c.setDeviceVariable("ups_1", "name_1", "value_4");
+		values = cc.getDeviceVariableValue("ups_1", "name_1");
+		CPPUNIT_ASSERT_MESSAGE(
+			"Failed caching client: zero TTL value cached",
+			values[0] == std::string("value_4"));
+
+		CPPUNIT_ASSERT_MESSAGE(
+			"Failed caching client: wrong variable names",
+			cc.getDeviceVariableNames("ups_1") == std::set<std::string>{ "name_1" });
+	}
+	catch(nut::NutException& ex)
+	{
+		NUT_UNUSED_VARIABLE(ex);
+		noException = false;
+	}
+	CPPUNIT_ASSERT_MESSAGE(
+		"Failed caching client: throw exception",
+		noException);
+
+	noException = true;
+	try
+	{
+		cc.getDeviceVariableValue("ups_1", "name_2");
+	}
+	catch(nut::NutException& ex)
+	{
+		NUT_UNUSED_VARIABLE(ex);
+		noException = false;
+	}
+	CPPUNIT_ASSERT_MESSAGE(
+		"Failed caching client: unknown variable throw no exception",
+		!noException);
+}
+
 } // namespace nut {}
 
 #if (defined __clang__) && (defined HAVE_PRAGMA_CLANG_DIAGNOSTIC_IGNORED_DEPRECATED_DECLARATIONS)
@@ -399,6 +399,15 @@ void NutConfigUnitTest::testUpsConfiguration() {
 	config3.parseFromString(input3);
 	config3.setOverrideDouble(my_ups, "battery.voltage.low", 12.4);
 	check(static_cast<nut::Serialisable *>(&config3), expected3);
+
+	// Sections changed directly are serialised anew once touched
+	config3.sections[my_ups]["desc"].values.front() = "Mail server";
+	config3.touch(my_ups);
+
+	std::string expected4(expected3);
+	expected4.replace(expected4.find("Web"), 3, "Mail");
+
+	check(static_cast<nut::Serialisable *>(&config3), expected4);
 }
 
 
@@ -89,6 +89,7 @@ class NutIPCUnitTest: public CppUnit::TestFixture {
 		CPPUNIT_TEST( testSignalSend );
 		CPPUNIT_TEST( testSignalRecvQuick );
 		CPPUNIT_TEST( testSignalRecvStaggered );
+		CPPUNIT_TEST( testSignalRecvFd );
 	CPPUNIT_TEST_SUITE_END();
 
 	/**
@@ -110,6 +111,9 @@ class NutIPCUnitTest: public CppUnit::TestFixture {
 	void testSignalRecvQuick();
 	void testSignalRecvStaggered();
 
+	/** Signal receiving test (via event loop descriptor) */
+	void testSignalRecvFd();
+
 	inline void setUp() override {}
 	inline void tearDown() override {}
 
@@ -139,6 +143,33 @@ void NutIPCUnitTest::testExec() {
 	CPPUNIT_ASSERT(123 == child.wait());
 
 	CPPUNIT_ASSERT(0 == nut::Process::execute("test 'Hello world' = 'Hello world'"));
+
+	// Standard output redirected to a pipe
+	int pipe_fds[2];
+
+	CPPUNIT_ASSERT(0 == ::pipe(pipe_fds));
+
+	args.clear();
+	args.push_back("-c");
+	args.push_back("echo Hello");
+
+	nut::Process::Executor echo(bin, args);
+
+	echo.redirect(1, pipe_fds[1]);
+	echo.close(pipe_fds[0]);
+
+	nut::Process::Execution echo_child(echo);
+
+	::close(pipe_fds[1]);
+
+	char buf[16];
+	ssize_t len = ::read(pipe_fds[0], buf, sizeof(buf));
+
+	::close(pipe_fds[0]);
+
+	CPPUNIT_ASSERT(0 == echo_child.wait());
+	CPPUNIT_ASSERT(6 == len);
+	CPPUNIT_ASSERT(0 == std::string(buf, 6).compare("Hello\n"));
 #endif	/* !WIN32 */
 }
 
@@ -375,6 +406,46 @@ void NutIPCUnitTest::testSignalRecvStaggered() {
 #endif	/* !WIN32 */
 }
 
+void NutIPCUnitTest::testSignalRecvFd() {
+#ifdef WIN32
+	/* FIXME NUT_WIN32_INCOMPLETE:
+	 *  Needs implementation for signals via pipes */
+	std::cout << "NutIPCUnitTest::testSignalRecvFd(): skipped on this platform" << std::endl;
+#else	/* !WIN32 */
+	nut::Signal::List signals;
+	caught_signals.clear();
+
+	signals.push_back(nut::Signal::USER1);
+	signals.push_back(nut::Signal::USER2);
+
+	nut::Signal::HandlerFd<TestSignalHandler> sig_handler(signals);
+
+	// Nothing pending yet
+	CPPUNIT_ASSERT(0 == sig_handler.handle());
+
+	pid_t my_pid = nut::Process::getPID();
+
+	CPPUNIT_ASSERT(0 == nut::Signal::send(nut::Signal::USER1, my_pid));
+	CPPUNIT_ASSERT(0 == nut::Signal::send(nut::Signal::USER2, my_pid));
+
+	// The descriptor becomes readable (as for an event loop)
+	fd_set rfds;
+	FD_ZERO(&rfds);
+	FD_SET(sig_handler.fd(), &rfds);
+
+	struct timeval timeout = { 1, 0 };
+
+	CPPUNIT_ASSERT(1 == ::select(sig_handler.fd() + 1, &rfds, nullptr, nullptr, &timeout));
+
+	// The signals are handled in this very thread
+	CPPUNIT_ASSERT(2 == sig_handler.handle());
+	CPPUNIT_ASSERT(caught_signals.size() == 2);
+	CPPUNIT_ASSERT(0 == sig_handler.handle());
+
+	caught_signals.clear();
+#endif	/* !WIN32 */
+}
+
 // Implement out of class declaration to avoid
 //   error: 'SomeClass' has no out-of-line virtual method
 //   definitions; its vtable will be emitted in every translation unit
@@ -0,0 +1,178 @@
+/*  parseconftest.c - check that pconf_buf() splits lines like pconf_char(),
+ *                    and pconf_encode() escaping
+ *
+ *  Copyright (C)
+ *      2026            Network UPS Tools developers
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+
+#include "config.h"
+#include "common.h"
+#include "parseconf.h"
+#include "nut_stdint.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+static int	errors = 0;
+
+/* what the driver and client sockets typically carry, and a few oddities */
+static const char	*input =
+	"SETINFO ups.status \"OL CHRG\"\n"
+	"SETINFO battery.charge 100\r\n"
+	"GET VAR myups   ups.status\n"
+	"\n"
+	"SET VAR ups ups.delay.shutdown \"\"\n"
+	"SETINFO ups.mfr \"Some \\\"quoted\\\" vendor\"\n"
+	"ADDENUM input.transfer.low 180 # comment\n"
+	"SETINFO a=b \"x=y\"\n"
+	"SETINFO ab\"cd\" \"ef\"gh\n"
+	"SETINFO multi\\\nline value\n"
+	"SETINFO tab\there \"no\ttab\"\n"
+	"SETINFO bad \"unterminated # here\"\n"
+	"PING\n"
+	"DUMPDONE\n";
+
+/* lines as split by one parser, joined with '|' between words */
+static size_t run(int bulk, size_t chunk, char out[][256], size_t maxlines)
+{
+	PCONF_CTX_t	ctx;
+	size_t	n = 0, len = strlen(input), pos, off, used, i;
+	int	ret;
+
+	pconf_init(&ctx, NULL);
+
+	for (pos = 0; pos < len; pos += chunk) {
+		size_t	clen = (len - pos < chunk) ? len - pos : chunk;
+
+		for (off = 0; off < clen; off += used) {
+			if (bulk) {
+				ret = pconf_buf(&ctx, input + pos + off, clen - off, &used);
+			} else {
+				ret = pconf_char(&ctx, input[pos + off]);
+				used = 1;
+			}
+
+			if (ret == 0)
+				continue;
+
+			if (n >= maxlines)
+				break;
+
+			if (ret < 0) {
+				snprintf(out[n++], 256, "ERROR");
+				continue;
+			}
+
+			out[n][0] = '\0';
+			for (i = 0; i < ctx.numargs; i++) {
+				snprintfcat(out[n], 256, "%s%s", i ? "|" : "", ctx.arglist[i]);
+			}
+			n++;
+		}
+	}
+
+	pconf_finish(&ctx);
+	return n;
+}
+
+/* the byte by byte pconf_encode() this is checked against */
+static void encode_ref(const char *src, char *dest, size_t destsize)
+{
+	size_t	i, destlen = 0, maxlen = destsize - 1;
+
+	memset(dest, '\0', destsize);
+
+	for (i = 0; src[i]; i++) {
+		if (strchr("#\\\"", src[i])) {
+			if (destlen >= maxlen - 1)
+				return;
+
+			dest[destlen++] = '\\';
+		}
+
+		if (destlen >= maxlen)
+			return;
+
+		dest[destlen++] = src[i];
+	}
+}
+
+static void test_encode(void)
+{
+	static const char	*values[] = {
+		"", "100", "OL CHRG", "\"", "a\\b", "#", "\\\\", "x\"y#z\\",
+		"Some \"quoted\" vendor", "a rather long value without any escapes",
+		NULL
+	};
+	char	ref[64], got[64];
+	size_t	i, size;
+
+	for (i = 0; values[i] != NULL; i++) {
+		if (pconf_encode_needed(values[i]) != (strcspn(values[i], "#\\\"") != strlen(values[i]))) {
+			printf("encode_needed: wrong for [%s]\n", values[i]);
+			errors++;
+		}
+
+		/* (the old code overran a 1-byte dest with an escape first) */
+		for (size = 2; size <= sizeof(got); size++) {
+			encode_ref(values[i], ref, size);
+			pconf_encode(values[i], got, size);
+
+			if (strcmp(ref, got)) {
+				printf("encode into %" PRIuSIZE " bytes: [%s] instead of [%s]\n",
+					size, got, ref);
+				errors++;
+			}
+		}
+	}
+}
+
+int main(void)
+{
+	char	ref[32][256], got[32][256];
+	size_t	nref, ngot, chunk, i;
+
+	nref = run(0, 1, ref, 32);
+
+	for (chunk = 1; chunk <= strlen(input); chunk++) {
+		ngot = run(1, chunk, got, 32);
+
+		if (ngot != nref) {
+			printf("chunk %" PRIuSIZE ": got %" PRIuSIZE " lines instead of %" PRIuSIZE "\n",
+				chunk, ngot, nref);
+			errors++;
+			continue;
+		}
+
+		for (i = 0; i < nref; i++) {
+			if (strcmp(ref[i], got[i])) {
+				printf("chunk %" PRIuSIZE ", line %" PRIuSIZE ": [%s] instead of [%s]\n",
+					chunk, i, got[i], ref[i]);
+				errors++;
+			}
+		}
+	}
+
+	test_encode();
+
+	if (errors)
+		printf("parseconftest collected %i errors\n", errors);
+
+	return (errors != 0);
+}
@@ -0,0 +1,263 @@
+/*  statetreetest.c - check the st_tree_t storage behind the state_* API
+ *
+ *  Copyright (C)
+ *      2026            Network UPS Tools developers
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+
+#include "config.h"
+#include "common.h"
+#include "state.h"
+#include "nut_stdint.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define NUMVARS	1000
+
+static int	errors = 0;
+
+/* check ordering and AVL balance of a subtree, return its height */
+static int check_tree(const st_tree_t *node, const char **prev, size_t *count)
+{
+	int	hl, hr;
+
+	if (!node)
+		return 0;
+
+	hl = check_tree(node->left, prev, count);
+
+	if (*prev && strcasecmp(*prev, node->var) >= 0) {
+		printf("Out of order: [%s] after [%s]\n", node->var, *prev);
+		errors++;
+	}
+	*prev = node->var;
+	(*count)++;
+
+	hr = check_tree(node->right, prev, count);
+
+	if (hl - hr > 1 || hr - hl > 1) {
+		printf("Unbalanced at [%s]: %d vs %d\n", node->var, hl, hr);
+		errors++;
+	}
+
+	if (node->height != (hl > hr ? hl : hr) + 1) {
+		printf("Wrong height at [%s]: %d\n", node->var, node->height);
+		errors++;
+	}
+
+	return node->height;
+}
+
+static void check(const st_tree_t *root, size_t expected, const char *when)
+{
+	const char	*prev = NULL;
+	size_t	count = 0;
+	int	height = check_tree(root, &prev, &count);
+
+	if (count != expected) {
+		printf("%s: found %" PRIuSIZE " nodes, expected %" PRIuSIZE "\n",
+			when, count, expected);
+		errors++;
+	}
+
+	/* an AVL tree is never taller than ~1.44*log2(n) */
+	if (expected >= NUMVARS && height > 15) {
+		printf("%s: tree of %" PRIuSIZE " nodes is %d levels deep\n",
+			when, count, height);
+		errors++;
+	}
+}
+
+int main(void)
+{
+	st_tree_t	*root = NULL;
+	char	var[SMALLBUF], val[SMALLBUF];
+	size_t	i, n = 0;
+
+	/* sorted insertion used to degrade the tree into a list */
+	for (i = 0; i < NUMVARS; i++) {
+		snprintf(var, sizeof(var), "outlet.%04" PRIuSIZE ".status", i);
+		snprintf(val, sizeof(val), "%" PRIuSIZE, i);
+		if (state_setinfo(&root, var, val) != 1) {
+			printf("Failed to add [%s]\n", var);
+			errors++;
+		}
+		n++;
+	}
+	check(root, n, "after sorted insert");
+
+	/* updates: no change, change; lookups are case-insensitive */
+	if (state_setinfo(&root, "OUTLET.0010.STATUS", "10") != 0) {
+		printf("Same value was reported as a change\n");
+		errors++;
+	}
+	if (state_setinfo(&root, "outlet.0010.status", "on") != 1) {
+		printf("Changed value was not reported\n");
+		errors++;
+	}
+	if (!state_getinfo(root, "outlet.0010.status")
+	||  strcmp(state_getinfo(root, "outlet.0010.status"), "on")
+	) {
+		printf("Lookup of a changed value failed\n");
+		errors++;
+	}
+	check(root, n, "after update");
+
+	/* delete every other entry, including inner nodes */
+	for (i = 0; i < NUMVARS; i += 2) {
+		snprintf(var, sizeof(var), "outlet.%04" PRIuSIZE ".status", i);
+		if (state_delinfo(&root, var) != 1) {
+			printf("Failed to delete [%s]\n", var);
+			errors++;
+		}
+		n--;
+	}
+	check(root, n, "after deletes");
+
+	if (state_delinfo(&root, "outlet.0000.status") != 0) {
+		printf("Deleted a missing entry\n");
+		errors++;
+	}
+
+	/* immutable entries survive */
+	state_tree_find(root, "outlet.0001.status")->flags |= ST_FLAG_IMMUTABLE;
+	if (state_delinfo(&root, "outlet.0001.status") != 0) {
+		printf("Deleted an immutable entry\n");
+		errors++;
+	}
+
+	for (i = 1; i < NUMVARS; i += 2) {
+		snprintf(var, sizeof(var), "outlet.%04" PRIuSIZE ".status", i);
+		if (!state_tree_find(root, var)) {
+			printf("Lost [%s]\n", var);
+			errors++;
+		}
+	}
+
+	/* values move between the inline buffer of a node and the heap,
+	 * long names work too */
+	memset(val, 'x', ST_TREE_RAW_INLINE * 2);
+	val[ST_TREE_RAW_INLINE * 2] = '\0';
+	snprintf(var, sizeof(var), "%0*d.long.name", ST_TREE_RAW_INLINE, 1);
+	if (state_setinfo(&root, var, "short") != 1
+	||  state_setinfo(&root, var, val) != 1
+	||  strcmp(state_getinfo(root, var), val)
+	||  state_setinfo(&root, var, "again") != 1
+	||  strcmp(state_getinfo(root, var), "again")
+	) {
+		printf("Growing or shrinking the value of [%s] failed\n", var);
+		errors++;
+	}
+
+	if (state_addenum(root, var, "short") != 1
+	||  state_addenum(root, var, val) != 1
+	||  state_addenum(root, var, val) != 0
+	||  state_delenum(root, var, "short") != 1
+	||  !state_getenumlist(root, var)
+	||  strcmp(state_getenumlist(root, var)->val, val)
+	) {
+		printf("Enum list of [%s] is wrong\n", var);
+		errors++;
+	}
+
+	/* numeric values are only formatted when they move beyond the
+	 * deadband, and text set in between is not mistaken for them */
+	if (state_setinfo_double(&root, "input.voltage", 230.04, 1, 0.5, val, sizeof(val)) != 1
+	||  strcmp(state_getinfo(root, "input.voltage"), "230.0")
+	||  state_setinfo_double(&root, "input.voltage", 230.4, 1, 0.5, val, sizeof(val)) != 0
+	||  strcmp(state_getinfo(root, "input.voltage"), "230.0")
+	||  state_setinfo_double(&root, "input.voltage", 231, 1, 0.5, val, sizeof(val)) != 1
+	||  strcmp(val, "231.0")
+	||  state_setinfo(&root, "input.voltage", "unknown") != 1
+	||  state_setinfo_double(&root, "input.voltage", 231, 1, 0.5, val, sizeof(val)) != 1
+	||  strcmp(state_getinfo(root, "input.voltage"), "231.0")
+	||  state_setinfo_double(&root, "input.voltage", 231, 0, 0.5, val, sizeof(val)) != 1
+	||  strcmp(state_getinfo(root, "input.voltage"), "231")
+	) {
+		printf("Numeric values of [input.voltage] are wrong\n");
+		errors++;
+	}
+
+	/* the trees of all devices share one copy of a name (as spelt first),
+	 * which goes away with the last of them */
+	{
+		st_tree_t	*other = NULL;
+		cmdlist_t	*cmds = NULL;
+
+		if (state_setinfo(&other, "INPUT.VOLTAGE", "230") != 1
+		||  state_addcmd(&cmds, "input.voltage") != 1
+		||  state_tree_find(other, "input.voltage")->var != state_tree_find(root, "input.voltage")->var
+		||  cmds->name != state_name_find("Input.Voltage")
+		||  strcmp(state_tree_find(other, "input.voltage")->var, "input.voltage")
+		) {
+			printf("Name of [input.voltage] is not shared\n");
+			errors++;
+		}
+
+		state_infofree(other);
+		state_cmdfree(cmds);
+	}
+
+	/* indexed families find the same nodes as the names do, and do not
+	 * keep those which were deleted meanwhile */
+	{
+		st_family_t	*fam = state_family_new("outlet.%i.current");
+
+		if (!fam
+		||  state_family_new("outlet.%s.current")
+		||  state_family_setinfo(fam, &root, 3, "1.5") != 1
+		||  state_family_setinfo(fam, &root, 3, "1.5") != 0
+		||  strcmp(state_getinfo(root, "outlet.3.current"), "1.5")
+		||  state_setinfo(&root, "outlet.3.current", "2.5") != 1
+		||  strcmp(state_family_find(fam, root, 3)->val, "2.5")
+		||  state_family_setinfo_double(fam, &root, 40, 0.25, 2, 0, val, sizeof(val)) != 1
+		||  strcmp(state_getinfo(root, "outlet.40.current"), "0.25")
+		||  state_family_find(fam, root, 7)
+		||  state_family_setinfo(fam, &root, ST_FAMILY_MAXINDEX, "0") != -1
+		) {
+			printf("Family of [outlet.%%i.current] is wrong\n");
+			errors++;
+		}
+
+		if (state_delinfo(&root, "outlet.3.current") != 1
+		||  state_family_find(fam, root, 3)
+		||  state_family_setinfo(fam, &root, 3, "1.5") != 1
+		||  state_family_find(fam, root, 3) != state_tree_find(root, "outlet.3.current")
+		) {
+			printf("Family of [outlet.%%i.current] kept a deleted node\n");
+			errors++;
+		}
+
+		state_family_free(fam);
+	}
+
+	state_infofree(root);
+
+	if (state_name_find("input.voltage") || state_name_find("outlet.0001.status")
+	||  state_name_find("outlet.3.current")
+	) {
+		printf("Names outlived their trees\n");
+		errors++;
+	}
+
+	if (errors)
+		printf("statetreetest collected %i errors\n", errors);
+
+	return (errors != 0);
+}
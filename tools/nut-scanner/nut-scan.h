@@ -33,6 +33,7 @@
 #define NUT_SCAN_H
 
 #include <sys/types.h>
+#include <stdio.h>
 
 /* Ensure uint16_t et al: */
 #if defined HAVE_INTTYPES_H
@@ -215,17 +216,63 @@ nutscan_device_t * nutscan_scan_eaton_serial(const char* ports_list);
 sem_t * nutscan_semaphore(void);
 void nutscan_semaphore_set(sem_t *s);
 # endif
+# if (defined HAVE_PTHREAD_TRYJOIN) || (defined HAVE_SEMAPHORE_UNNAMED) || (defined HAVE_SEMAPHORE_NAMED)
+/* Shares out max_threads between the scans flagged in scans[] (as they
+ * are going to run at the same time) by how long each of them takes per
+ * address, into max_threads_oldnut et al, so that a slow one does not
+ * keep the others waiting for threads; call before starting them */
+void nutscan_balance_threads(const int scans[TYPE_END]);
+# endif
 #endif
 
+/* Descriptors which nutscan_ip_ranges_probe() leaves for the threads of
+ * the other scans going on (see nutscan_balance_threads()) */
+extern size_t nutscan_fds_reserved;
+
+/* Wall-clock limit for all of the scans together, from now on (0 seconds
+ * for none): past it they start no more exchanges, and those going on
+ * are not waited for longer than it. Set it before starting the scans. */
+void nutscan_set_deadline(time_t seconds);
+int nutscan_deadline_passed(void);
+/* usec_timeout, or the time left if the deadline comes sooner (0 once
+ * it has passed) */
+useconds_t nutscan_deadline_clamp(useconds_t usec_timeout);
+/* Monotonic clock, in msec */
+long nutscan_now_ms(void);
+
 /* Display functions */
 void nutscan_display_ups_conf(nutscan_device_t * device);
 void nutscan_display_parsable(nutscan_device_t * device);
+/* Likewise for just the one device, not the list it is in; such as
+ * a device passed to the nutscan_set_device_found_handler() hook */
+void nutscan_display_ups_conf_one(const nutscan_device_t * device);
+void nutscan_display_parsable_one(const nutscan_device_t * device);
 
 /* Display sanity-check concerns for various fields etc. (if any) */
 void nutscan_display_ups_conf_with_sanity_check(nutscan_device_t * device);
 void nutscan_display_sanity_check(nutscan_device_t * device);
 void nutscan_display_sanity_check_serial(nutscan_device_t * device);
 
+/* Cache of scan results, for incremental rescans (see nutscan-cache.c) */
+typedef struct nutscan_cache_s nutscan_cache_t;
+
+/* Loads the cache from path (an empty one if there is no such file yet);
+ * returns NULL if it could not be read */
+nutscan_cache_t * nutscan_cache_load(const char * path);
+/* Replaces the ranges of irl by the addresses of known devices in them
+ * (all of them if irl is empty) followed by those of its ranges not
+ * scanned in the last max_age seconds; returns the new range count */
+size_t nutscan_cache_plan(nutscan_cache_t * cache, nutscan_ip_range_list_t * irl, time_t max_age);
+/* Merges the devices found by the scans of the types flagged in scanned[]
+ * over irl (as planned) and serial_ports into the cache, reporting the
+ * added, removed and changed ones to report (if not NULL) */
+void nutscan_cache_update(nutscan_cache_t * cache, nutscan_device_t * dev[TYPE_END],
+	const int scanned[TYPE_END], const nutscan_ip_range_list_t * irl,
+	const char * serial_ports, FILE * report);
+/* Writes the cache to path, replacing it; returns 0 on success */
+int nutscan_cache_save(const nutscan_cache_t * cache, const char * path);
+void nutscan_cache_free(nutscan_cache_t * cache);
+
 #ifdef __cplusplus
 /* *INDENT-OFF* */
 }
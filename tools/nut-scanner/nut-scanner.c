@@ -92,16 +92,25 @@
 
 #define ERR_BAD_OPTION	(-1)
 
-static const char optstring[] = "?ht:T:s:e:E:c:l:u:W:X:w:x:p:b:B:d:L:CUSMOAm:QnNPqIVaD";
+/* How long the scan of an IP address range is recent for --rescan, in seconds */
+#define DEFAULT_CACHE_MAX_AGE	(7 * 24 * 3600)
+
+static const char optstring[] = "?ht:T:Z:s:e:E:c:l:u:W:X:w:x:p:b:B:d:L:CUSMOAm:k:RK:rG:QnNPFqIVaD";
 
 #ifdef HAVE_GETOPT_LONG
 static const struct option longopts[] = {
 	{ "timeout", required_argument, NULL, 't' },
 	{ "thread", required_argument, NULL, 'T' },
+	{ "deadline", required_argument, NULL, 'Z' },
 	{ "start_ip", required_argument, NULL, 's' },
 	{ "end_ip", required_argument, NULL, 'e' },
 	{ "eaton_serial", required_argument, NULL, 'E' },
 	{ "mask_cidr", required_argument, NULL, 'm' },
+	{ "shard", required_argument, NULL, 'k' },
+	{ "random_order", no_argument, NULL, 'R' },
+	{ "cache", required_argument, NULL, 'K' },
+	{ "rescan", no_argument, NULL, 'r' },
+	{ "cache_max_age", required_argument, NULL, 'G' },
 	{ "community", required_argument, NULL, 'c' },
 	{ "secLevel", required_argument, NULL, 'l' },
 	{ "secName", required_argument, NULL, 'u' },
@@ -125,6 +134,7 @@ static const struct option longopts[] = {
 	{ "disp_nut_conf_with_sanity_check", no_argument, NULL, 'Q' },
 	{ "disp_nut_conf", no_argument, NULL, 'N' },
 	{ "disp_parsable", no_argument, NULL, 'P' },
+	{ "stream", no_argument, NULL, 'F' },
 	{ "quiet", no_argument, NULL, 'q' },
 	{ "help", no_argument, NULL, 'h' },
 	{ "version", no_argument, NULL, 'V' },
@@ -146,6 +156,78 @@ static int cli_link_detail_level = -1;
 /* Track requested IP ranges (from CLI or auto-discovery) */
 static nutscan_ip_range_list_t ip_ranges_list;
 
+/* With -F: how each device is displayed as soon as it is found (or NULL
+ * to display them all when the scans are done), and the devices already
+ * displayed -- as "type:driver:port" -- since some of them are found
+ * by more than one scan (e.g. avahi asks the old NUT scan along) */
+static void (*stream_display_func)(const nutscan_device_t * device) = NULL;
+
+#define STREAM_SEEN_BUCKETS	1024
+typedef struct stream_seen_s {
+	struct stream_seen_s	*next;
+	char	key[1];
+} stream_seen_t;
+static stream_seen_t *stream_seen[STREAM_SEEN_BUCKETS];
+#ifdef HAVE_PTHREAD
+static pthread_mutex_t stream_mutex = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+/* nutscan_device_found_t hook for -F, called from the scanning threads */
+static void stream_device_found(const nutscan_device_t * device)
+{
+	char	key[LARGEBUF];
+	size_t	hash;
+	stream_seen_t	*seen;
+	size_t	len;
+
+	snprintf(key, sizeof(key), "%d:%s:%s", (int)device->type,
+		device->driver ? device->driver : "", device->port ? device->port : "");
+	hash = str_hash_nocase(key);
+
+#ifdef HAVE_PTHREAD
+	pthread_mutex_lock(&stream_mutex);
+#endif
+	for (seen = stream_seen[hash % STREAM_SEEN_BUCKETS]; seen; seen = seen->next) {
+		if (!strcmp(seen->key, key)) {
+			break;
+		}
+	}
+
+	if (!seen) {
+		len = strlen(key);
+		seen = xcalloc(1, sizeof(*seen) + len);
+		memcpy(seen->key, key, len + 1);
+		seen->next = stream_seen[hash % STREAM_SEEN_BUCKETS];
+		stream_seen[hash % STREAM_SEEN_BUCKETS] = seen;
+
+		stream_display_func(device);
+		fflush(stdout);
+	}
+#ifdef HAVE_PTHREAD
+	pthread_mutex_unlock(&stream_mutex);
+#endif
+}
+
+static void stream_free(void)
+{
+	size_t	i;
+
+	for (i = 0; i < STREAM_SEEN_BUCKETS; i++) {
+		while (stream_seen[i]) {
+			stream_seen_t	*seen = stream_seen[i];
+
+			stream_seen[i] = seen->next;
+			free(seen);
+		}
+	}
+}
+
+/* The display_func of -F, as everything was displayed already */
+static void display_nothing(nutscan_device_t * device)
+{
+	NUT_UNUSED_VARIABLE(device);
+}
+
 #ifdef HAVE_PTHREAD
 static pthread_t thread[TYPE_END];
 
@@ -1016,6 +1098,8 @@ static void show_usage(const char *arg_progname)
 	printf("  -T, --thread <max number of threads>: Limit the amount of scanning threads running simultaneously (not implemented in this build: no pthread support)\n");
 #endif
 
+	printf("  -Z, --deadline <seconds>: Stop all of the scans this long after they began, with what was found by then (default: none).\n");
+
 	printf("\nNote: many scanning options depend on further loadable libraries.\n");
 	/* Note: if debug is enabled, this is prefixed with timestamps */
 	upsdebugx_report_search_paths(0, 0);
@@ -1031,6 +1115,9 @@ static void show_usage(const char *arg_progname)
 #endif
 	printf("  -m, --mask_cidr auto4/auto6: Likewise, limiting to IPv4 or IPv6 interfaces.\n");
 	printf("                        Only the first auto* request would be honoured.\n");
+	printf("  -k, --shard <i/N>: Only scan every N-th address of the ranges, starting from the i-th one (1..N),\n");
+	printf("                     so N instances of nut-scanner can share the ranges between them.\n");
+	printf("  -R, --random_order: Go through the addresses of each range in a random order, rather than one after another.\n");
 	printf("NOTE: IP address range specifications can be repeated, to scan several.\n");
 	printf("Specifying a single first or last address before starting another range\n");
 	printf("leads to scanning just that one address as the range.\n");
@@ -1148,6 +1235,12 @@ static void show_usage(const char *arg_progname)
 	printf("  -Q, --disp_nut_conf_with_sanity_check: Display result in the ups.conf format with sanity-check warnings as comments (default)\n");
 	printf("  -N, --disp_nut_conf: Display result in the ups.conf format\n");
 	printf("  -P, --disp_parsable: Display result in a parsable format\n");
+	printf("  -F, --stream: Display each device as soon as it is found, rather than all of them when the scans are done (in the ups.conf format without sanity-check warnings, or with -P the parsable one)\n");
+	printf("\ncache specific options:\n");
+	printf("  -K, --cache <file>: Keep the devices found and the IP address ranges scanned in this file\n");
+	printf("  -r, --rescan: Check the devices of the cache first, skip the IP address ranges scanned recently,\n");
+	printf("                and report the devices added, removed or changed since the previous scans (needs -K)\n");
+	printf("  -G, --cache_max_age <seconds>: How long the scan of an IP address range is recent (default %d)\n", DEFAULT_CACHE_MAX_AGE);
 	printf("\nMiscellaneous options:\n");
 	printf("  -h, --help: display this help text\n");
 	printf("  -V, --version: Display NUT version\n");
@@ -1176,6 +1269,12 @@ int main(int argc, char *argv[])
 	int allow_avahi = 0;
 	int allow_ipmi = 0;
 	int allow_eaton_serial = 0; /* MUST be requested explicitly! */
+	char *cache_path = NULL;
+	int cache_rescan = 0;
+	time_t cache_max_age = DEFAULT_CACHE_MAX_AGE;
+	time_t deadline = 0;
+	int planned[TYPE_END];
+	nutscan_cache_t *cache = NULL;
 	int quiet = 0; /* The debugging level for certain upsdebugx() progress messages; 0 = print always, quiet==1 is to require at least one -D */
 	void (*display_func)(nutscan_device_t * device);
 	int ret_code = EXIT_SUCCESS;
@@ -1496,6 +1595,82 @@ int main(int argc, char *argv[])
 #endif /* HAVE_PTHREAD && ways to limit the thread count */
 				}
 				break;
+			case 'k':
+				{	/* scoping */
+					char	*endptr = NULL;
+					unsigned long	shard = 0, count = 0;
+
+					errno = 0;
+					shard = strtoul(optarg, &endptr, 10);
+					if (!errno && endptr && *endptr == '/') {
+						count = strtoul(endptr + 1, &endptr, 10);
+					}
+					if (errno || !endptr || *endptr
+					||  shard < 1 || count < 1 || shard > count
+					||  (uintmax_t)count > (uintmax_t)SIZE_MAX
+					) {
+						fatalx(EXIT_FAILURE,
+							"Invalid shard value, should be i/N with i from 1 to N: %s",
+							optarg);
+					}
+					ip_ranges_list.shard_index = (size_t)(shard - 1);
+					ip_ranges_list.shard_count = (size_t)count;
+				}
+				break;
+			case 'R':
+				{	/* scoping */
+					struct timeval	now;
+
+					/* any non-zero key; the shards need not
+					 * agree on it, they do not share addresses
+					 * whatever the order of each one is */
+					gettimeofday(&now, NULL);
+					ip_ranges_list.order_key = ((uint64_t)now.tv_sec << 20)
+						^ (uint64_t)now.tv_usec
+						^ ((uint64_t)getpid() << 40);
+					if (ip_ranges_list.order_key == 0) {
+						ip_ranges_list.order_key = 1;
+					}
+					upsdebugx(1, "Scanning the IP address ranges in an order permuted by key %" PRIu64,
+						ip_ranges_list.order_key);
+				}
+				break;
+			case 'K':
+				cache_path = optarg;
+				break;
+			case 'r':
+				cache_rescan = 1;
+				break;
+			case 'G':
+				{	/* scoping */
+					char	*endptr = NULL;
+					long	age;
+
+					errno = 0;
+					age = strtol(optarg, &endptr, 10);
+					if (errno || !endptr || *endptr || age < 0) {
+						fatalx(EXIT_FAILURE,
+							"Invalid cache max age value, should be a count of seconds: %s",
+							optarg);
+					}
+					cache_max_age = (time_t)age;
+				}
+				break;
+			case 'Z':
+				{	/* scoping */
+					char	*endptr = NULL;
+					long	secs;
+
+					errno = 0;
+					secs = strtol(optarg, &endptr, 10);
+					if (errno || !endptr || *endptr || secs <= 0) {
+						fatalx(EXIT_FAILURE,
+							"Invalid deadline value, should be a count of seconds: %s",
+							optarg);
+					}
+					deadline = (time_t)secs;
+				}
+				break;
 			case 'C':
 				allow_all = 1;
 				break;
@@ -1542,6 +1717,9 @@ int main(int argc, char *argv[])
 			case 'P':
 				display_func = nutscan_display_parsable;
 				break;
+			case 'F':
+				stream_display_func = nutscan_display_ups_conf_one;
+				break;
 			case 'q':
 				quiet = 1;
 				break;
@@ -1586,6 +1764,14 @@ display_help:
 		}
 	}
 
+	if (stream_display_func) {
+		if (display_func == nutscan_display_parsable) {
+			stream_display_func = nutscan_display_parsable_one;
+		}
+		display_func = display_nothing;
+		nutscan_set_device_found_handler(stream_device_found);
+	}
+
 #ifdef HAVE_PTHREAD
 	{	/* scoping for the string */
 #  if defined HAVE_SEMAPHORE_UNNAMED
@@ -1673,6 +1859,19 @@ display_help:
 		end_ip = NULL;
 	}
 
+	if (cache_rescan && !cache_path) {
+		fatalx(EXIT_FAILURE, "The --rescan option needs a --cache file");
+	}
+
+	if (cache_path) {
+		if ((cache = nutscan_cache_load(cache_path)) == NULL) {
+			fatalx(EXIT_FAILURE, "Could not read the cache file %s", cache_path);
+		}
+		if (cache_rescan) {
+			nutscan_cache_plan(cache, &ip_ranges_list, cache_max_age);
+		}
+	}
+
 	if (!allow_usb && !allow_snmp && !allow_xml && !allow_oldnut && !allow_nut_simulation &&
 		!allow_avahi && !allow_ipmi && !allow_eaton_serial
 	) {
@@ -1695,6 +1894,24 @@ display_help:
 		/* BEWARE: allow_all does not include allow_eaton_serial! */
 	}
 
+	/* The scans of the networks below run at the same time, sharing
+	 * max_threads (as each needs) and the deadline */
+	memset(planned, 0, sizeof(planned));
+	if (ip_ranges_list.ip_ranges_count) {
+		planned[TYPE_SNMP] = allow_snmp && nutscan_avail_snmp;
+		planned[TYPE_NUT] = allow_oldnut && nutscan_avail_nut;
+		planned[TYPE_IPMI] = allow_ipmi && nutscan_avail_ipmi;
+	}
+#if (defined HAVE_PTHREAD) && ( (defined HAVE_PTHREAD_TRYJOIN) || (defined HAVE_SEMAPHORE_UNNAMED) || (defined HAVE_SEMAPHORE_NAMED) )
+	nutscan_balance_threads(planned);
+#else
+	NUT_UNUSED_VARIABLE(planned);
+#endif
+	if (deadline) {
+		upsdebugx(1, "Scans stop in %" PRIiMAX " seconds", (intmax_t)deadline);
+		nutscan_set_deadline(deadline);
+	}
+
 /* TODO/discuss : Should the #else...#endif code below for lack of pthreads
  * during build also serve as a fallback for pthread failure at runtime?
  */
@@ -1893,6 +2110,29 @@ display_help:
 	}
 #endif /* HAVE_PTHREAD */
 
+	if (cache) {
+		int	scanned[TYPE_END];
+
+		memset(scanned, 0, sizeof(scanned));
+		scanned[TYPE_USB] = allow_usb && nutscan_avail_usb;
+		scanned[TYPE_SNMP] = allow_snmp && nutscan_avail_snmp;
+		scanned[TYPE_XML] = allow_xml && nutscan_avail_xml_http;
+		scanned[TYPE_NUT] = allow_oldnut && nutscan_avail_nut;
+		scanned[TYPE_NUT_SIMULATION] = allow_nut_simulation && nutscan_avail_nut_simulation;
+		scanned[TYPE_AVAHI] = allow_avahi && nutscan_avail_avahi;
+		scanned[TYPE_IPMI] = allow_ipmi && nutscan_avail_ipmi;
+		scanned[TYPE_EATON_SERIAL] = allow_eaton_serial;
+
+		upsdebugx(1, "SCANS DONE: update the cache in %s", cache_path);
+		nutscan_cache_update(cache, dev, scanned, &ip_ranges_list,
+			serial_ports, cache_rescan ? stdout : NULL);
+		if (nutscan_cache_save(cache, cache_path) != 0) {
+			upsdebugx(0, "WARNING: Could not update the cache file %s", cache_path);
+		}
+		nutscan_cache_free(cache);
+		cache = NULL;
+	}
+
 	upsdebugx(1, "SCANS DONE: display results");
 
 	upsdebugx(1, "SCANS DONE: display results: USB");
@@ -1948,6 +2188,8 @@ display_help:
 #endif
 
 	upsdebugx(1, "SCANS DONE: free common scanner resources");
+	nutscan_set_device_found_handler(NULL);
+	stream_free();
 	nutscan_free_ip_ranges(&ip_ranges_list);
 	nutscan_free();
 
@@ -0,0 +1,701 @@
+/*
+ *  Copyright (C) 2026 - NUT Community
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+/*! \file nutscan-cache.c
+    \brief cache of nut-scanner results, for incremental rescans
+*/
+
+#include "config.h" /* must be first */
+
+#include "nut_stdint.h"
+#include "common.h"
+#include "nut-scan.h"
+#include "nutscan-serial.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+/* The cache file is made of tab-separated lines (with tabs, newlines and
+ * backslashes in the fields escaped by a backslash):
+ *	range	<last scanned>	<start IP>	<end IP>
+ *	device	<last seen>	<type>	<driver>	<port>	[<option>=<value>...]
+ * where the times are seconds since the Epoch. Other lines are ignored.
+ */
+#define CACHE_HEADER	"# nut-scanner cache of scan results, see nut-scanner --cache"
+
+typedef struct {
+	time_t	seen;
+	char	*start_ip, *end_ip;
+} nutscan_cache_range_t;
+
+typedef struct {
+	time_t	seen;
+	nutscan_device_type_t	type;
+	char	*driver, *port;
+	char	*opts;		/* escaped option=value fields, tab-separated, as in the file */
+	int	found;		/* by the scan being compared */
+	int	removed;	/* in scope of that scan, yet not found */
+} nutscan_cache_device_t;
+
+struct nutscan_cache_s {
+	nutscan_cache_range_t	*ranges;
+	size_t	ranges_count;
+	nutscan_cache_device_t	*devices;
+	size_t	devices_count;
+	size_t	devices_sorted;	/* the first ones are sorted by type and port */
+	size_t	revalidated;	/* first ranges of the planned list, single addresses of known devices */
+};
+
+/* Appends s to buf at *len (growing it), escaped for the file */
+static void cache_escape(char **buf, size_t *len, size_t *size, const char *s)
+{
+	for (; s && *s; s++) {
+		if (*len + 3 > *size) {
+			*size = *size * 2 + 64;
+			*buf = xrealloc(*buf, *size);
+		}
+		switch (*s) {
+			case '\t':
+				(*buf)[(*len)++] = '\\';
+				(*buf)[(*len)++] = 't';
+				break;
+			case '\n':
+				(*buf)[(*len)++] = '\\';
+				(*buf)[(*len)++] = 'n';
+				break;
+			case '\\':
+				(*buf)[(*len)++] = '\\';
+				(*buf)[(*len)++] = '\\';
+				break;
+			default:
+				(*buf)[(*len)++] = *s;
+		}
+	}
+	if (*len + 1 > *size) {
+		*size = *len + 1;
+		*buf = xrealloc(*buf, *size);
+	}
+	(*buf)[*len] = '\0';
+}
+
+/* Unescapes the field s in place */
+static char *cache_unescape(char *s)
+{
+	char	*r = s, *w = s;
+
+	while (*r) {
+		if (*r == '\\' && r[1]) {
+			r++;
+			*w++ = (*r == 't') ? '\t' : (*r == 'n') ? '\n' : *r;
+			r++;
+		} else {
+			*w++ = *r++;
+		}
+	}
+	*w = '\0';
+
+	return s;
+}
+
+/* Options of dev as kept in the file */
+static char *cache_device_opts(const nutscan_device_t *dev)
+{
+	nutscan_options_t	*opt;
+	char	*buf = NULL;
+	size_t	len = 0, size = 0;
+
+	cache_escape(&buf, &len, &size, "");
+	for (opt = dev->opt; opt; opt = opt->next) {
+		if (!opt->option) {
+			continue;
+		}
+		if (len) {
+			/* the separator is not escaped */
+			if (len + 2 > size) {
+				size = size * 2 + 64;
+				buf = xrealloc(buf, size);
+			}
+			buf[len++] = '\t';
+			buf[len] = '\0';
+		}
+		/* '=' does not need an escape: the option name comes first */
+		cache_escape(&buf, &len, &size, opt->option);
+		cache_escape(&buf, &len, &size, "=");
+		cache_escape(&buf, &len, &size, opt->value ? opt->value : "");
+	}
+
+	return buf;
+}
+
+static int cache_device_cmp(const void *a, const void *b)
+{
+	const nutscan_cache_device_t	*da = a, *db = b;
+
+	if (da->type != db->type) {
+		return (da->type < db->type) ? -1 : 1;
+	}
+
+	return strcmp(da->port, db->port);
+}
+
+static nutscan_cache_device_t *cache_find_device(nutscan_cache_t *cache,
+	nutscan_device_type_t type, const char *port)
+{
+	nutscan_cache_device_t	key;
+
+	memset(&key, 0, sizeof(key));
+	key.type = type;
+	key.port = (char *)port;
+
+	return bsearch(&key, cache->devices, cache->devices_sorted,
+		sizeof(*cache->devices), cache_device_cmp);
+}
+
+static nutscan_device_type_t cache_type(const char *s)
+{
+	int	i;
+
+	for (i = TYPE_NONE + 1; i < TYPE_END; i++) {
+		if (!strcmp(s, nutscan_device_type_strings[i])) {
+			return (nutscan_device_type_t)i;
+		}
+	}
+
+	return TYPE_NONE;
+}
+
+/* Whether devices of this type are found on the IP address ranges */
+static int cache_type_is_ip(nutscan_device_type_t type)
+{
+	return (type == TYPE_SNMP || type == TYPE_XML
+		|| type == TYPE_NUT || type == TYPE_IPMI);
+}
+
+/* Parsed bounds of a range of addresses (or of one address if end_ip is
+ * NULL), into r; returns 0 if they are not addresses */
+static int cache_parse_range(const char *start_ip, const char *end_ip, nutscan_ip_iter_t *r)
+{
+	char	*ip_str;
+
+	memset(r, 0, sizeof(*r));
+	ip_str = nutscan_ip_iter_init(r, start_ip, end_ip);
+	if (!ip_str) {
+		return 0;
+	}
+	free(ip_str);
+
+	return 1;
+}
+
+/* Whether the addresses of a are all in r */
+static int cache_range_in(const nutscan_ip_iter_t *a, const nutscan_ip_iter_t *r)
+{
+	if (a->type != r->type) {
+		return 0;
+	}
+
+	if (a->type == IPv4) {
+		return (ntohl(a->start.s_addr) >= ntohl(r->start.s_addr)
+			&& ntohl(a->stop.s_addr) <= ntohl(r->stop.s_addr));
+	}
+
+	return (memcmp(&a->start6, &r->start6, sizeof(a->start6)) >= 0
+		&& memcmp(&a->stop6, &r->stop6, sizeof(a->stop6)) <= 0);
+}
+
+/* Parsed ranges of irl, for cache_in_ranges() */
+static nutscan_ip_iter_t *cache_parse_ranges(const nutscan_ip_range_list_t *irl,
+	size_t skip, size_t *count)
+{
+	nutscan_ip_iter_t	*parsed;
+	nutscan_ip_range_t	*p;
+	size_t	i;
+
+	*count = 0;
+	parsed = xcalloc(irl->ip_ranges_count + 1, sizeof(*parsed));
+	for (i = 0, p = irl->ip_ranges; p; p = p->next, i++) {
+		if (i >= skip && cache_parse_range(p->start_ip, p->end_ip, &parsed[*count])) {
+			(*count)++;
+		}
+	}
+
+	return parsed;
+}
+
+static int cache_in_ranges(const nutscan_ip_iter_t *a, const nutscan_ip_iter_t *ranges, size_t count)
+{
+	size_t	i;
+
+	for (i = 0; i < count; i++) {
+		if (cache_range_in(a, &ranges[i])) {
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+nutscan_cache_t * nutscan_cache_load(const char *path)
+{
+	nutscan_cache_t	*cache = xcalloc(1, sizeof(*cache));
+	FILE	*f;
+	char	line[LARGEBUF * 4];
+	size_t	lineno = 0;
+
+	if ((f = fopen(path, "r")) == NULL) {
+		if (errno != ENOENT) {
+			upsdebug_with_errno(0, "WARNING: %s: could not read %s", __func__, path);
+			free(cache);
+			return NULL;
+		}
+		upsdebugx(1, "%s: no cache in %s yet", __func__, path);
+		return cache;
+	}
+
+	while (fgets(line, sizeof(line), f)) {
+		char	*field[6], *opts;
+		size_t	n = 0, len = strlen(line);
+
+		lineno++;
+		if (len && line[len - 1] == '\n') {
+			line[--len] = '\0';
+		}
+
+		/* the options go as they are, still escaped */
+		opts = line;
+		for (n = 0; n < 6 && opts; n++) {
+			field[n] = opts;
+			if ((opts = strchr(opts, '\t')) != NULL) {
+				*opts++ = '\0';
+			}
+		}
+
+		if (n == 4 && !strcmp(field[0], "range")) {
+			nutscan_cache_range_t	*r;
+
+			cache->ranges = xrealloc(cache->ranges,
+				(cache->ranges_count + 1) * sizeof(*cache->ranges));
+			r = &cache->ranges[cache->ranges_count++];
+			r->seen = (time_t)strtoll(field[1], NULL, 10);
+			r->start_ip = xstrdup(cache_unescape(field[2]));
+			r->end_ip = xstrdup(cache_unescape(field[3]));
+		} else if (n >= 5 && !strcmp(field[0], "device")) {
+			nutscan_cache_device_t	*d;
+			nutscan_device_type_t	type = cache_type(field[2]);
+
+			if (type == TYPE_NONE) {
+				upsdebugx(1, "%s: %s:%" PRIuSIZE ": unknown device type %s",
+					__func__, path, lineno, field[2]);
+				continue;
+			}
+
+			cache->devices = xrealloc(cache->devices,
+				(cache->devices_count + 1) * sizeof(*cache->devices));
+			d = &cache->devices[cache->devices_count++];
+			memset(d, 0, sizeof(*d));
+			d->seen = (time_t)strtoll(field[1], NULL, 10);
+			d->type = type;
+			d->driver = xstrdup(cache_unescape(field[3]));
+			d->port = xstrdup(cache_unescape(field[4]));
+			d->opts = xstrdup((n == 6) ? field[5] : "");
+		} else if (*line && *line != '#') {
+			upsdebugx(1, "%s: %s:%" PRIuSIZE ": ignoring unknown line",
+				__func__, path, lineno);
+		}
+	}
+
+	fclose(f);
+
+	qsort(cache->devices, cache->devices_count, sizeof(*cache->devices), cache_device_cmp);
+	cache->devices_sorted = cache->devices_count;
+
+	upsdebugx(1, "%s: %" PRIuSIZE " devices and %" PRIuSIZE " scanned ranges in %s",
+		__func__, cache->devices_count, cache->ranges_count, path);
+
+	return cache;
+}
+
+void nutscan_cache_free(nutscan_cache_t *cache)
+{
+	size_t	i;
+
+	if (!cache) {
+		return;
+	}
+
+	for (i = 0; i < cache->ranges_count; i++) {
+		free(cache->ranges[i].start_ip);
+		free(cache->ranges[i].end_ip);
+	}
+	for (i = 0; i < cache->devices_count; i++) {
+		free(cache->devices[i].driver);
+		free(cache->devices[i].port);
+		free(cache->devices[i].opts);
+	}
+	free(cache->ranges);
+	free(cache->devices);
+	free(cache);
+}
+
+static int cache_host_cmp(const void *a, const void *b)
+{
+	return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+size_t nutscan_cache_plan(nutscan_cache_t *cache, nutscan_ip_range_list_t *irl, time_t max_age)
+{
+	nutscan_ip_range_list_t	planned;
+	nutscan_ip_iter_t	*fresh, *wanted, *kept, r;
+	size_t	fresh_count = 0, wanted_count = 0, kept_count = 0, hosts_count = 0, i;
+	char	**hosts;
+	nutscan_ip_range_t	*p;
+	time_t	now = time(NULL);
+
+	/* ranges scanned recently enough to be skipped */
+	fresh = xcalloc(cache->ranges_count + 1, sizeof(*fresh));
+	for (i = 0; i < cache->ranges_count; i++) {
+		if (now - cache->ranges[i].seen <= max_age
+		&&  cache_parse_range(cache->ranges[i].start_ip, cache->ranges[i].end_ip, &fresh[fresh_count])
+		) {
+			fresh_count++;
+		}
+	}
+
+	wanted = cache_parse_ranges(irl, 0, &wanted_count);
+	kept = xcalloc(irl->ip_ranges_count + 1, sizeof(*kept));
+
+	nutscan_init_ip_ranges(&planned);
+	planned.shard_index = irl->shard_index;
+	planned.shard_count = irl->shard_count;
+	planned.order_key = irl->order_key;
+
+	/* the known devices first: their addresses in the requested ranges
+	 * (or all of them if none were), unless a range scanned anyway has
+	 * them, one address each */
+	hosts = xcalloc(cache->devices_count + 1, sizeof(*hosts));
+	for (i = 0; i < cache->devices_count; i++) {
+		char	host[SMALLBUF];
+
+		if (!cache_type_is_ip(cache->devices[i].type)
+		||  !nutscan_port_host(cache->devices[i].port, host, sizeof(host))
+		) {
+			continue;
+		}
+		if (irl->ip_ranges_count
+		&& (!cache_parse_range(host, NULL, &r) || !cache_in_ranges(&r, wanted, wanted_count))
+		) {
+			continue;
+		}
+		hosts[hosts_count++] = xstrdup(host);
+	}
+	qsort(hosts, hosts_count, sizeof(*hosts), cache_host_cmp);
+
+	for (p = irl->ip_ranges; p; p = p->next) {
+		if (cache_parse_range(p->start_ip, p->end_ip, &r)
+		&&  cache_in_ranges(&r, fresh, fresh_count)
+		) {
+			upsdebugx(1, "%s: IP address range [%s .. %s] was scanned recently, "
+				"only checking the devices found there",
+				__func__, p->start_ip, p->end_ip);
+			continue;
+		}
+		if (cache_parse_range(p->start_ip, p->end_ip, &r)) {
+			kept[kept_count++] = r;
+		}
+	}
+
+	for (i = 0; i < hosts_count; i++) {
+		if ((i > 0 && !strcmp(hosts[i], hosts[i - 1]))
+		|| (cache_parse_range(hosts[i], NULL, &r) && cache_in_ranges(&r, kept, kept_count))
+		) {
+			free(hosts[i]);
+			continue;
+		}
+		nutscan_add_ip_range(&planned, hosts[i], NULL);
+	}
+	cache->revalidated = planned.ip_ranges_count;
+
+	for (p = irl->ip_ranges; p; p = p->next) {
+		if (cache_parse_range(p->start_ip, p->end_ip, &r)
+		&&  cache_in_ranges(&r, fresh, fresh_count)
+		) {
+			continue;
+		}
+		nutscan_add_ip_range(&planned, xstrdup(p->start_ip),
+			(p->end_ip == p->start_ip) ? NULL : xstrdup(p->end_ip));
+	}
+
+	upsdebugx(1, "%s: checking %" PRIuSIZE " known addresses, then scanning %" PRIuSIZE
+		" of %" PRIuSIZE " requested IP address ranges",
+		__func__, cache->revalidated, planned.ip_ranges_count - cache->revalidated,
+		irl->ip_ranges_count);
+
+	free(hosts);
+	free(kept);
+	free(wanted);
+	free(fresh);
+
+	nutscan_free_ip_ranges(irl);
+	*irl = planned;
+
+	return irl->ip_ranges_count;
+}
+
+/* Prints the escaped options of the file as key="value" */
+static void cache_report_opts(FILE *report, const char *opts)
+{
+	char	*buf = xstrdup(opts), *s = buf, *e;
+
+	while (s && *s) {
+		char	*eq;
+
+		if ((e = strchr(s, '\t')) != NULL) {
+			*e++ = '\0';
+		}
+		if ((eq = strchr(s, '=')) != NULL) {
+			*eq++ = '\0';
+			fprintf(report, " %s=\"%s\"", cache_unescape(s), cache_unescape(eq));
+		}
+		s = e;
+	}
+
+	free(buf);
+}
+
+static void cache_report(FILE *report, const char *what, nutscan_device_type_t type,
+	const char *driver, const char *port, const char *opts)
+{
+	if (!report) {
+		return;
+	}
+
+	fprintf(report, "# nut-scanner: %s: %s driver=\"%s\" port=\"%s\"",
+		what, nutscan_device_type_strings[type], driver, port);
+	cache_report_opts(report, opts);
+	fprintf(report, "\n");
+}
+
+void nutscan_cache_update(nutscan_cache_t *cache, nutscan_device_t *dev[TYPE_END],
+	const int scanned[TYPE_END], const nutscan_ip_range_list_t *irl,
+	const char *serial_ports, FILE *report)
+{
+	nutscan_ip_iter_t	*ranges, r;
+	size_t	ranges_count, i, j;
+	char	**serial_list = NULL;
+	nutscan_ip_range_t	*p;
+	time_t	now = time(NULL);
+	int	type;
+
+	/* the devices found */
+	for (type = TYPE_NONE + 1; type < TYPE_END; type++) {
+		nutscan_device_t	*d;
+
+		for (d = nutscan_rewind_device(dev[type]); d; d = d->next) {
+			nutscan_cache_device_t	*c;
+			char	*opts;
+
+			if (!d->port || !d->driver) {
+				continue;
+			}
+
+			opts = cache_device_opts(d);
+			c = cache_find_device(cache, d->type, d->port);
+			if (c && !c->found) {
+				if (strcmp(c->driver, d->driver) || strcmp(c->opts, opts)) {
+					cache_report(report, "changed, was", c->type, c->driver, c->port, c->opts);
+					cache_report(report, "changed, now", d->type, d->driver, d->port, opts);
+					free(c->driver);
+					free(c->opts);
+					c->driver = xstrdup(d->driver);
+					c->opts = opts;
+				} else {
+					free(opts);
+				}
+				c->found = 1;
+				c->seen = now;
+				continue;
+			}
+			if (c) {
+				/* found by several scans of its type */
+				free(opts);
+				continue;
+			}
+
+			cache_report(report, "added", d->type, d->driver, d->port, opts);
+			cache->devices = xrealloc(cache->devices,
+				(cache->devices_count + 1) * sizeof(*cache->devices));
+			c = &cache->devices[cache->devices_count++];
+			memset(c, 0, sizeof(*c));
+			c->seen = now;
+			c->type = d->type;
+			c->driver = xstrdup(d->driver);
+			c->port = xstrdup(d->port);
+			c->opts = opts;
+			c->found = 1;
+		}
+	}
+
+	/* the known devices which the scans should have found again */
+	ranges = cache_parse_ranges(irl, 0, &ranges_count);
+	if (scanned[TYPE_EATON_SERIAL]) {
+		serial_list = nutscan_get_serial_ports_list(serial_ports);
+	}
+
+	for (i = 0; i < cache->devices_sorted; i++) {
+		nutscan_cache_device_t	*c = &cache->devices[i];
+		char	host[SMALLBUF];
+
+		if (c->found || !scanned[c->type]) {
+			continue;
+		}
+
+		/* other shards had some of the addresses */
+		if (cache_type_is_ip(c->type) && irl->shard_count > 1) {
+			continue;
+		}
+
+		if (cache_type_is_ip(c->type) && nutscan_port_host(c->port, host, sizeof(host))
+		&& (!cache_parse_range(host, NULL, &r) || !cache_in_ranges(&r, ranges, ranges_count))
+		) {
+			continue;
+		}
+
+		if (c->type == TYPE_EATON_SERIAL) {
+			for (j = 0; serial_list && serial_list[j] && strcmp(serial_list[j], c->port); j++);
+			if (!serial_list || !serial_list[j]) {
+				continue;
+			}
+		}
+
+		cache_report(report, "removed", c->type, c->driver, c->port, c->opts);
+		c->removed = 1;
+	}
+
+	if (serial_list) {
+		for (j = 0; serial_list[j]; j++) {
+			free(serial_list[j]);
+		}
+		free(serial_list);
+	}
+	free(ranges);
+
+	/* the ranges scanned, not counting the known addresses checked */
+	for (i = 0, p = irl->ip_ranges; p && irl->shard_count <= 1; p = p->next, i++) {
+		if (i < cache->revalidated) {
+			continue;
+		}
+		for (j = 0; j < cache->ranges_count; j++) {
+			if (!strcmp(cache->ranges[j].start_ip, p->start_ip)
+			&&  !strcmp(cache->ranges[j].end_ip, p->end_ip)
+			) {
+				break;
+			}
+		}
+		if (j == cache->ranges_count) {
+			cache->ranges = xrealloc(cache->ranges,
+				(cache->ranges_count + 1) * sizeof(*cache->ranges));
+			cache->ranges[j].start_ip = xstrdup(p->start_ip);
+			cache->ranges[j].end_ip = xstrdup(p->end_ip);
+			cache->ranges_count++;
+		}
+		cache->ranges[j].seen = now;
+	}
+
+	qsort(cache->devices, cache->devices_count, sizeof(*cache->devices), cache_device_cmp);
+	cache->devices_sorted = cache->devices_count;
+}
+
+int nutscan_cache_save(const nutscan_cache_t *cache, const char *path)
+{
+	char	*tmp, *buf = NULL;
+	size_t	len, size = 0, i;
+	int	fd;
+	FILE	*f;
+
+	tmp = xcalloc(strlen(path) + 5, 1);
+	sprintf(tmp, "%s.tmp", path);
+
+	/* the SNMP options may be secrets */
+	if ((fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0600)) < 0
+	||  (f = fdopen(fd, "w")) == NULL
+	) {
+		upsdebug_with_errno(0, "WARNING: %s: could not write %s", __func__, tmp);
+		if (fd >= 0) {
+			close(fd);
+		}
+		free(tmp);
+		return -1;
+	}
+
+	fprintf(f, "%s\n", CACHE_HEADER);
+
+	for (i = 0; i < cache->ranges_count; i++) {
+		const nutscan_cache_range_t	*r = &cache->ranges[i];
+
+		len = 0;
+		cache_escape(&buf, &len, &size, r->start_ip);
+		fprintf(f, "range\t%" PRIdMAX "\t%s", (intmax_t)r->seen, buf);
+		len = 0;
+		cache_escape(&buf, &len, &size, r->end_ip);
+		fprintf(f, "\t%s\n", buf);
+	}
+
+	for (i = 0; i < cache->devices_count; i++) {
+		const nutscan_cache_device_t	*d = &cache->devices[i];
+
+		if (d->removed) {
+			continue;
+		}
+
+		len = 0;
+		cache_escape(&buf, &len, &size, d->driver);
+		fprintf(f, "device\t%" PRIdMAX "\t%s\t%s",
+			(intmax_t)d->seen, nutscan_device_type_strings[d->type], buf);
+		len = 0;
+		cache_escape(&buf, &len, &size, d->port);
+		fprintf(f, "\t%s%s%s\n", buf, *d->opts ? "\t" : "", d->opts);
+	}
+
+	free(buf);
+
+	if (fclose(f) != 0) {
+		upsdebug_with_errno(0, "WARNING: %s: could not write %s", __func__, tmp);
+		unlink(tmp);
+		free(tmp);
+		return -1;
+	}
+
+#ifdef WIN32
+	/* rename() does not replace an existing file there */
+	unlink(path);
+#endif
+	if (rename(tmp, path) != 0) {
+		upsdebug_with_errno(0, "WARNING: %s: could not replace %s", __func__, path);
+		unlink(tmp);
+		free(tmp);
+		return -1;
+	}
+
+	free(tmp);
+	return 0;
+}
@@ -26,6 +26,7 @@
 #include "config.h"	/* must be the first header */
 
 #include "nutscan-device.h"
+#include "nutscan-ip.h"
 #include "common.h"
 #include <stdlib.h>
 #include <string.h>
@@ -56,6 +57,14 @@ const char * nutscan_device_type_lstrings[TYPE_END] = {
 	"serial",
 };
 
+/* See nutscan_set_device_found_handler() */
+static nutscan_device_found_t device_found_handler = NULL;
+
+void nutscan_set_device_found_handler(nutscan_device_found_t handler)
+{
+	device_found_handler = handler;
+}
+
 nutscan_device_t * nutscan_new_device(void)
 {
 	nutscan_device_t * device;
@@ -182,6 +191,40 @@ nutscan_device_t * nutscan_add_device_to_device(nutscan_device_t * first, nutsca
 		return first;
 	}
 
+	/* A scanner adds each device it found on its own, while lists
+	 * of some are only joined together later */
+	if (second != NULL && second->prev == NULL && second->next == NULL) {
+		/* the other network scans try its address first */
+		switch (second->type) {
+			case TYPE_SNMP:
+			case TYPE_XML:
+			case TYPE_NUT:
+			case TYPE_IPMI:
+			case TYPE_AVAHI:
+				{	/* scoping */
+					char	host[SMALLBUF];
+
+					if (second->port
+					 && nutscan_port_host(second->port, host, sizeof(host))
+					) {
+						nutscan_ip_hint_add(host);
+					}
+				}
+				break;
+			case TYPE_NONE:
+			case TYPE_USB:
+			case TYPE_NUT_SIMULATION:
+			case TYPE_EATON_SERIAL:
+			case TYPE_END:
+			default:
+				break;
+		}
+
+		if (device_found_handler) {
+			device_found_handler(second);
+		}
+	}
+
 	/* Get end of first device */
 	if (first != NULL) {
 		dev1 = first;
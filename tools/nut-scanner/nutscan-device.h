@@ -86,6 +86,13 @@ void nutscan_add_commented_option_to_device(nutscan_device_t * device, char * op
 void nutscan_add_option_to_device(nutscan_device_t * device, char * option, char * value);
 nutscan_device_t * nutscan_add_device_to_device(nutscan_device_t * first, nutscan_device_t * second);
 
+/* Called by nutscan_add_device_to_device() for each device as a scanner
+ * adds it to its results, from the scanning thread (usually under a lock
+ * of that scanner only); it may be passed the same device again later,
+ * and should not keep the pointer. NULL (default) to not be told. */
+typedef void (*nutscan_device_found_t)(const nutscan_device_t * device);
+void nutscan_set_device_found_handler(nutscan_device_found_t handler);
+
 /**
  *  \brief  Rewind device list
  *
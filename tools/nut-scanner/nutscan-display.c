@@ -47,6 +47,52 @@ static char * nutscan_device_type_string[TYPE_END] = {
  */
 static size_t last_nutdev_num = 0;
 
+/* Number of the next "nutdev-<type>" section, kept up to date in
+ * last_nutdev_num for the sanity checks */
+static size_t nutdev_num = 1;
+
+/* Displays one device as a ups.conf section */
+static void display_ups_conf_device(const nutscan_device_t * dev)
+{
+	nutscan_options_t * opt;
+
+	printf("[nutdev-%s%" PRIuSIZE "]\n\tdriver = \"%s\"",
+		nutscan_device_type_lstrings[dev->type],
+		nutdev_num, dev->driver);
+
+	if (dev->alt_driver_names) {
+		printf("\t# alternately: %s",
+			dev->alt_driver_names);
+	}
+
+	printf("\n\tport = \"%s\"\n",
+		dev->port);
+
+	opt = dev->opt;
+
+	while (NULL != opt) {
+		if (opt->option != NULL) {
+			printf("\t");
+			if (opt->comment_tag) {
+				if (opt->comment_tag[0] == '\0') {
+					printf("# ");
+				} else {
+					printf("###%s### ", opt->comment_tag);
+				}
+			}
+			printf("%s", opt->option);
+			if (opt->value != NULL) {
+				printf(" = \"%s\"", opt->value);
+			}
+			printf("\n");
+		}
+		opt = opt->next;
+	}
+
+	nutdev_num++;
+	last_nutdev_num = nutdev_num;
+}
+
 void nutscan_display_ups_conf_with_sanity_check(nutscan_device_t * device)
 {
 	/* Note: while a single device is passed to the method, it is actually
@@ -65,8 +111,6 @@ void nutscan_display_ups_conf(nutscan_device_t * device)
 	 * used to locate the list of related device types and iterate it all.
 	 */
 	nutscan_device_t * current_dev = device;
-	nutscan_options_t * opt;
-	static size_t nutdev_num = 1;
 
 	upsdebugx(2, "%s: %s", __func__, device
 		? (device->type < TYPE_END ? nutscan_device_type_string[device->type] : "<UNKNOWN>")
@@ -83,46 +127,40 @@ void nutscan_display_ups_conf(nutscan_device_t * device)
 
 	/* Display each device */
 	do {
-		printf("[nutdev-%s%" PRIuSIZE "]\n\tdriver = \"%s\"",
-			nutscan_device_type_lstrings[current_dev->type],
-			nutdev_num, current_dev->driver);
+		display_ups_conf_device(current_dev);
+		current_dev = current_dev->next;
+	}
+	while (current_dev != NULL);
+}
 
-		if (current_dev->alt_driver_names) {
-			printf("\t# alternately: %s",
-				current_dev->alt_driver_names);
-		}
+/* Displays one device as a parsable line */
+static void display_parsable_device(const nutscan_device_t * dev)
+{
+	nutscan_options_t * opt;
 
-		printf("\n\tport = \"%s\"\n",
-			current_dev->port);
+	/* Do not separate by whitespace, in case someone already parses this */
+	printf("%s:driver=\"%s\",port=\"%s\"",
+		nutscan_device_type_string[dev->type],
+		dev->driver,
+		dev->port);
 
-		opt = current_dev->opt;
+	opt = dev->opt;
 
-		while (NULL != opt) {
-			if (opt->option != NULL) {
-				printf("\t");
-				if (opt->comment_tag) {
-					if (opt->comment_tag[0] == '\0') {
-						printf("# ");
-					} else {
-						printf("###%s### ", opt->comment_tag);
-					}
-				}
-				printf("%s", opt->option);
-				if (opt->value != NULL) {
-					printf(" = \"%s\"", opt->value);
-				}
-				printf("\n");
+	while (NULL != opt) {
+		if (opt->option != NULL && opt->comment_tag == NULL) {
+			/* Do not separate by whitespace, in case someone already parses this */
+			printf(",%s", opt->option);
+			if (opt->value != NULL) {
+				printf("=\"%s\"", opt->value);
 			}
-			opt = opt->next;
 		}
-
-		nutdev_num++;
-
-		current_dev = current_dev->next;
+		opt = opt->next;
 	}
-	while (current_dev != NULL);
 
-	last_nutdev_num = nutdev_num;
+	/* NOTE: Currently no handling for dev->alt_driver_names
+	 * here, since no driver options maps to this concept */
+
+	printf("\n");
 }
 
 void nutscan_display_parsable(nutscan_device_t * device)
@@ -131,7 +169,6 @@ void nutscan_display_parsable(nutscan_device_t * device)
 	 * used to locate the list of related device types and iterate it all.
 	 */
 	nutscan_device_t * current_dev = device;
-	nutscan_options_t * opt;
 
 	upsdebugx(2, "%s: %s", __func__, device
 		? (device->type < TYPE_END ? nutscan_device_type_string[device->type] : "<UNKNOWN>")
@@ -148,35 +185,26 @@ void nutscan_display_parsable(nutscan_device_t * device)
 
 	/* Display each device */
 	do {
-		/* Do not separate by whitespace, in case someone already parses this */
-		printf("%s:driver=\"%s\",port=\"%s\"",
-			nutscan_device_type_string[current_dev->type],
-			current_dev->driver,
-			current_dev->port);
-
-		opt = current_dev->opt;
-
-		while (NULL != opt) {
-			if (opt->option != NULL && opt->comment_tag == NULL) {
-				/* Do not separate by whitespace, in case someone already parses this */
-				printf(",%s", opt->option);
-				if (opt->value != NULL) {
-					printf("=\"%s\"", opt->value);
-				}
-			}
-			opt = opt->next;
-		}
-
-		/* NOTE: Currently no handling for current_dev->alt_driver_names
-		 * here, since no driver options maps to this concept */
-
-		printf("\n");
-
+		display_parsable_device(current_dev);
 		current_dev = current_dev->next;
 	}
 	while (current_dev != NULL);
 }
 
+void nutscan_display_ups_conf_one(const nutscan_device_t * device)
+{
+	if (device != NULL) {
+		display_ups_conf_device(device);
+	}
+}
+
+void nutscan_display_parsable_one(const nutscan_device_t * device)
+{
+	if (device != NULL) {
+		display_parsable_device(device);
+	}
+}
+
 /* TODO: If this is ever a memory-pressure problem,
  * e.g. if preparing to monitor hundreds of devices,
  * can convert to dynamically allocated (and freed)
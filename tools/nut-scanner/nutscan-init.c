@@ -59,6 +59,9 @@ int nutscan_avail_snmp = 0;
 int nutscan_avail_usb = 0;
 int nutscan_avail_xml_http = 0;
 
+/* Descriptors which nutscan_ip_ranges_probe() leaves to the other scans */
+size_t nutscan_fds_reserved = 0;
+
 /* Methods defined in scan_*.c source files */
 int nutscan_load_usb_library(const char *libname_path);
 int nutscan_unload_usb_library(void);
@@ -133,10 +136,137 @@ size_t max_threads_netsnmp = 0; /* 10240; */
 	 */
 size_t max_threads_ipmi = 0;	/* limits not yet known */
 
+/* Rough time spent on each address by the scans sharing max_threads,
+ * relative to one TCP connection and reply of the NUT probe: an agent
+ * found by the SNMP sweep gets a session of several GETs, and a BMC
+ * the few exchanges of an IPMI session setup, retransmitted as need be */
+static size_t nutscan_thread_weight(nutscan_device_type_t type)
+{
+	switch (type) {
+		case TYPE_NUT:
+			return 1;
+		case TYPE_SNMP:
+			return 3;
+		case TYPE_IPMI:
+			return 4;
+		case TYPE_NONE:
+		case TYPE_USB:
+		case TYPE_XML:
+		case TYPE_NUT_SIMULATION:
+		case TYPE_AVAHI:
+		case TYPE_EATON_SERIAL:
+		case TYPE_END:
+		default:
+			/* one thread or socket each, whatever the addresses */
+			return 0;
+	}
+}
+
+void nutscan_balance_threads(const int scans[TYPE_END])
+{
+	size_t	total = 0, share[TYPE_END];
+	int	type, count = 0;
+
+	for (type = 0; type < TYPE_END; type++) {
+		if (scans[type] && nutscan_thread_weight((nutscan_device_type_t)type)) {
+			total += nutscan_thread_weight((nutscan_device_type_t)type);
+			count++;
+		}
+	}
+
+	/* nothing to share out */
+	if (count < 2 || max_threads < (size_t)count) {
+		return;
+	}
+
+	for (type = 0; type < TYPE_END; type++) {
+		share[type] = 0;
+		if (scans[type]) {
+			share[type] = max_threads * nutscan_thread_weight((nutscan_device_type_t)type) / total;
+			if (share[type] < 1 && nutscan_thread_weight((nutscan_device_type_t)type)) {
+				share[type] = 1;
+			}
+		}
+	}
+
+	/* lower limits in place are kept */
+	if (share[TYPE_NUT] && (!max_threads_oldnut || share[TYPE_NUT] < max_threads_oldnut)) {
+		max_threads_oldnut = share[TYPE_NUT];
+	}
+	if (share[TYPE_SNMP] && (!max_threads_netsnmp || share[TYPE_SNMP] < max_threads_netsnmp)) {
+		max_threads_netsnmp = share[TYPE_SNMP];
+	}
+	if (share[TYPE_IPMI] && (!max_threads_ipmi || share[TYPE_IPMI] < max_threads_ipmi)) {
+		max_threads_ipmi = share[TYPE_IPMI];
+	}
+
+	/* each of those threads has a socket open while the NUT probes
+	 * are connecting to as many addresses as descriptors allow */
+	if (scans[TYPE_NUT]) {
+		nutscan_fds_reserved = max_threads_netsnmp * (scans[TYPE_SNMP] != 0)
+			+ max_threads_ipmi * (scans[TYPE_IPMI] != 0);
+	}
+
+	upsdebugx(1, "%s: scanning threads for NUT: %" PRIuSIZE ", SNMP: %" PRIuSIZE
+		", IPMI: %" PRIuSIZE " of %" PRIuSIZE, __func__,
+		scans[TYPE_NUT] ? max_threads_oldnut : 0,
+		scans[TYPE_SNMP] ? max_threads_netsnmp : 0,
+		scans[TYPE_IPMI] ? max_threads_ipmi : 0, max_threads);
+}
+
 # endif  /* HAVE_PTHREAD_TRYJOIN || HAVE_SEMAPHORE_UNNAMED || HAVE_SEMAPHORE_NAMED */
 
 #endif /* HAVE_PTHREAD */
 
+/* Monotonic clock value (msec) past which the scans give up, 0 for none */
+static long nutscan_deadline_ms = 0;
+
+long nutscan_now_ms(void)
+{
+#if defined(HAVE_CLOCK_GETTIME) && defined(HAVE_CLOCK_MONOTONIC) && HAVE_CLOCK_GETTIME && HAVE_CLOCK_MONOTONIC
+	struct timespec	ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) == 0) {
+		return (long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+	}
+#endif
+	{
+		struct timeval	tv;
+
+		gettimeofday(&tv, NULL);
+		return (long)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+	}
+}
+
+void nutscan_set_deadline(time_t seconds)
+{
+	nutscan_deadline_ms = (seconds > 0) ? nutscan_now_ms() + (long)seconds * 1000 : 0;
+}
+
+int nutscan_deadline_passed(void)
+{
+	return (nutscan_deadline_ms && nutscan_now_ms() >= nutscan_deadline_ms);
+}
+
+useconds_t nutscan_deadline_clamp(useconds_t usec_timeout)
+{
+	long	left;
+
+	if (!nutscan_deadline_ms) {
+		return usec_timeout;
+	}
+
+	left = nutscan_deadline_ms - nutscan_now_ms();
+	if (left <= 0) {
+		return 0;
+	}
+	if ((uintmax_t)left * 1000 < (uintmax_t)usec_timeout) {
+		return (useconds_t)left * 1000;
+	}
+
+	return usec_timeout;
+}
+
 #ifdef WIN32
 /* Stub for libupsclient */
 void do_upsconf_args(char *confupsname, char *var, char *val) {
@@ -700,6 +830,8 @@ void nutscan_free(void)
 	nutscan_unload_ipmi_library();
 	nutscan_unload_upsclient_library();
 
+	nutscan_ip_hints_free();
+
 #ifdef HAVE_PTHREAD
 /* TOTHINK: See comments near mutex/semaphore init code above */
 # ifdef HAVE_SEMAPHORE_UNNAMED
@@ -26,12 +26,20 @@
 
 #include "nut_stdint.h"
 #include "common.h"
+#include "nut-scan.h"
 #include "nutscan-ip.h"
 #include <stdio.h>
 #include <sys/types.h>
 #ifndef WIN32
 # include <sys/socket.h>
 # include <netdb.h>
+# include <netinet/in.h>
+# include <arpa/inet.h>
+# include <fcntl.h>
+# include <sys/resource.h>
+# ifdef HAVE_POLL_H
+#  include <poll.h>
+# endif
 #else	/* WIN32 */
 /* Those 2 files for support of getaddrinfo, getnameinfo and freeaddrinfo
    on Windows 2000 and older versions */
@@ -98,6 +106,9 @@ nutscan_ip_range_list_t *nutscan_init_ip_ranges(nutscan_ip_range_list_t *irl)
 	irl->ip_ranges = NULL;
 	irl->ip_ranges_last = NULL;
 	irl->ip_ranges_count = 0;
+	irl->shard_index = 0;
+	irl->shard_count = 0;
+	irl->order_key = 0;
 
 	return irl;
 }
@@ -237,101 +248,592 @@ const char * nutscan_stringify_ip_ranges(nutscan_ip_range_list_t *irl)
 	return buf;
 }
 
-/* Return the first ip or NULL if error */
-char * nutscan_ip_ranges_iter_init(nutscan_ip_range_list_iter_t *irliter, const nutscan_ip_range_list_t *irl)
+/* Bijective mix of x in [0, mask], the permutation walked by
+ * nutscan_ip_ranges_iter_pick() */
+static uint64_t nutscan_ip_ranges_iter_mix(const nutscan_ip_range_list_iter_t *irliter, uint64_t x)
+{
+	uint64_t	mask = irliter->range_mask;
+
+	x = (x + irliter->range_key) & mask;
+	x = (x * irliter->range_mult) & mask;
+	x ^= x >> irliter->range_shift;
+	x = (x * 0x9E3779B97F4A7C15ULL) & mask;
+	x ^= x >> irliter->range_shift;
+
+	return x;
+}
+
+/* Offset in the current range of its n-th address to hand out */
+static uint64_t nutscan_ip_ranges_iter_pick(const nutscan_ip_range_list_iter_t *irliter, uint64_t n)
+{
+	uint64_t	step = (irliter->irl->shard_count > 1) ? irliter->irl->shard_count : 1;
+
+	if (irliter->irl->order_key != 0 && irliter->range_members > 1) {
+		/* cycle-walking: mixing again the values past range_members
+		 * (less than half of [0, mask]) until landing on a member
+		 * makes a permutation of the members */
+		do {
+			n = nutscan_ip_ranges_iter_mix(irliter, n);
+		} while (n >= irliter->range_members);
+	}
+
+	return irliter->range_first + n * step;
+}
+
+/* Inverse of a * x modulo 2^64, for odd a (Newton's iteration doubles
+ * the count of correct low bits each time, from 3 with x = a) */
+static uint64_t nutscan_ip_ranges_iter_inverse(uint64_t a)
+{
+	uint64_t	x = a;
+	int	i;
+
+	for (i = 0; i < 5; i++) {
+		x *= 2 - a * x;
+	}
+
+	return x;
+}
+
+/* Inverse of nutscan_ip_ranges_iter_mix(); range_shift is at least half
+ * of the bits of mask, so one more xorshift by it undoes one */
+static uint64_t nutscan_ip_ranges_iter_unmix(const nutscan_ip_range_list_iter_t *irliter, uint64_t x)
+{
+	uint64_t	mask = irliter->range_mask;
+
+	x ^= x >> irliter->range_shift;
+	x = (x * nutscan_ip_ranges_iter_inverse(0x9E3779B97F4A7C15ULL)) & mask;
+	x ^= x >> irliter->range_shift;
+	x = (x * nutscan_ip_ranges_iter_inverse(irliter->range_mult)) & mask;
+	x = (x - irliter->range_key) & mask;
+
+	return x;
+}
+
+/* Position in the walk of the current range of its member m, so that
+ * nutscan_ip_ranges_iter_pick() of it is the offset of that member */
+static uint64_t nutscan_ip_ranges_iter_unpick(const nutscan_ip_range_list_iter_t *irliter, uint64_t m)
+{
+	if (irliter->irl->order_key != 0 && irliter->range_members > 1) {
+		do {
+			m = nutscan_ip_ranges_iter_unmix(irliter, m);
+		} while (m >= irliter->range_members);
+	}
+
+	return m;
+}
+
+/* Addresses which answered some scan, see nutscan_ip_hint_add() */
+#define NUTSCAN_IP_HINTS_MAX	4096
+static nutscan_ip_addr_t	*ip_hints = NULL;
+static size_t	ip_hints_count = 0;
+#ifdef HAVE_PTHREAD
+static pthread_mutex_t	ip_hints_mutex = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+void nutscan_ip_hint_add(const char *host)
+{
+	nutscan_ip_addr_t	ip;
+	char	buf[SMALLBUF];
+	size_t	len, i;
+
+	if (!host) {
+		return;
+	}
+
+	memset(&ip, 0, sizeof(ip));
+	if (*host == '[') {
+		host++;
+		len = strcspn(host, "]");
+		if (len >= sizeof(buf)) {
+			return;
+		}
+		memcpy(buf, host, len);
+		buf[len] = '\0';
+		host = buf;
+	}
+	if (inet_pton(AF_INET, host, &ip.addr) == 1) {
+		ip.type = IPv4;
+	} else if (inet_pton(AF_INET6, host, &ip.addr6) == 1) {
+		ip.type = IPv6;
+	} else {
+		/* a host name, not in any range */
+		return;
+	}
+
+#ifdef HAVE_PTHREAD
+	pthread_mutex_lock(&ip_hints_mutex);
+#endif
+	for (i = 0; i < ip_hints_count; i++) {
+		if (!memcmp(&ip_hints[i], &ip, sizeof(ip))) {
+			break;
+		}
+	}
+	if (i == ip_hints_count && ip_hints_count < NUTSCAN_IP_HINTS_MAX) {
+		if (!ip_hints) {
+			ip_hints = xcalloc(NUTSCAN_IP_HINTS_MAX, sizeof(*ip_hints));
+		}
+		ip_hints[ip_hints_count++] = ip;
+		upsdebugx(5, "%s: %s answered, trying it first in the other scans",
+			__func__, host);
+	}
+#ifdef HAVE_PTHREAD
+	pthread_mutex_unlock(&ip_hints_mutex);
+#endif
+}
+
+void nutscan_ip_hints_free(void)
+{
+#ifdef HAVE_PTHREAD
+	pthread_mutex_lock(&ip_hints_mutex);
+#endif
+	free(ip_hints);
+	ip_hints = NULL;
+	ip_hints_count = 0;
+#ifdef HAVE_PTHREAD
+	pthread_mutex_unlock(&ip_hints_mutex);
+#endif
+}
+
+int nutscan_port_host(const char *port, char *buf, size_t buflen)
+{
+	const char	*s, *e;
+
+	if ((s = strstr(port, "://")) != NULL) {
+		port = s + 3;
+	}
+	if ((s = strrchr(port, '@')) != NULL) {
+		port = s + 1;
+	}
+
+	if (*port == '[') {
+		port++;
+		e = strchr(port, ']');
+	} else if ((e = strchr(port, ':')) != NULL && strchr(e + 1, ':')) {
+		/* a bare IPv6 address */
+		e = NULL;
+	}
+	if (!e) {
+		e = port + strlen(port);
+	}
+	if ((s = strchr(port, '/')) != NULL && s < e) {
+		e = s;
+	}
+
+	if (e == port || (size_t)(e - port) >= buflen) {
+		return 0;
+	}
+
+	memcpy(buf, port, (size_t)(e - port));
+	buf[e - port] = '\0';
+
+	return 1;
+}
+
+/* Offset of ip from the start of the current range, if it is in there
+ * (and not too far into a huge IPv6 one); returns 0 otherwise */
+static int nutscan_ip_ranges_iter_offset(const nutscan_ip_range_list_iter_t *irliter,
+	const nutscan_ip_addr_t *ip, uint64_t *off)
+{
+	const nutscan_ip_iter_t	*r = &(irliter->curr_ip_iter);
+	int	i, borrow = 0;
+
+	if (ip->type != r->type) {
+		return 0;
+	}
+
+	if (ip->type == IPv4) {
+		uint32_t	a = ntohl(ip->addr.s_addr);
+
+		if (a < ntohl(r->start.s_addr) || a > ntohl(r->stop.s_addr)) {
+			return 0;
+		}
+		*off = (uint64_t)a - ntohl(r->start.s_addr);
+		return 1;
+	}
+
+	if (memcmp(&ip->addr6, &r->start6, sizeof(struct in6_addr)) < 0
+	 || memcmp(&ip->addr6, &r->stop6, sizeof(struct in6_addr)) > 0
+	) {
+		return 0;
+	}
+
+	*off = 0;
+	for (i = 15; i >= 0; i--) {
+		int	d = ip->addr6.s6_addr[i] - r->start6.s6_addr[i] - borrow;
+
+		borrow = (d < 0);
+		if (borrow) {
+			d += 256;
+		}
+		if (i < 8 && d != 0) {
+			return 0;
+		}
+		if (i >= 8) {
+			*off |= (uint64_t)d << (8 * (15 - i));
+		}
+	}
+
+	return 1;
+}
+
+/* Finds a hinted address of the current range which was not handed out
+ * yet, notes it in early[] and returns 1 with its offset; 0 if none */
+static int nutscan_ip_ranges_iter_hint(nutscan_ip_range_list_iter_t *irliter, uint64_t *off)
 {
+	uint64_t	step = (irliter->irl->shard_count > 1) ? irliter->irl->shard_count : 1;
+	int	found = 0;
+
+#ifdef HAVE_PTHREAD
+	pthread_mutex_lock(&ip_hints_mutex);
+#endif
+	while (!found && irliter->hints_seen < ip_hints_count
+	    && irliter->early_count < NUTSCAN_IP_ITER_EARLY
+	) {
+		uint64_t	n;
+		size_t	i;
+
+		if (!nutscan_ip_ranges_iter_offset(irliter, &ip_hints[irliter->hints_seen++], off)
+		 || *off < irliter->range_first
+		 || (*off - irliter->range_first) % step != 0
+		 || (*off - irliter->range_first) / step >= irliter->range_members
+		) {
+			continue;
+		}
+
+		n = nutscan_ip_ranges_iter_unpick(irliter, (*off - irliter->range_first) / step);
+		if (n < irliter->range_pos) {
+			continue;
+		}
+		for (i = 0; i < irliter->early_count && irliter->early[i] != n; i++);
+		if (i < irliter->early_count) {
+			continue;
+		}
+
+		irliter->early[irliter->early_count++] = n;
+		found = 1;
+	}
+#ifdef HAVE_PTHREAD
+	pthread_mutex_unlock(&ip_hints_mutex);
+#endif
+
+	return found;
+}
+
+/* Whether the n-th address of the walk was handed out ahead of it */
+static int nutscan_ip_ranges_iter_early(const nutscan_ip_range_list_iter_t *irliter, uint64_t n)
+{
+	size_t	i;
+
+	for (i = 0; i < irliter->early_count; i++) {
+		if (irliter->early[i] == n) {
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/* Count of addresses in the range of ip, capped to UINT64_MAX
+ * for IPv6 ranges wider than that */
+static uint64_t nutscan_ip_iter_size(const nutscan_ip_iter_t *ip)
+{
+	uint64_t	hi = 0, lo = 0;
+	int	i, borrow = 0;
+
+	if (ip->type == IPv4) {
+		return (uint64_t)ntohl(ip->stop.s_addr) - ntohl(ip->start.s_addr) + 1;
+	}
+
+	/* stop6 - start6 as two 64-bit halves */
+	for (i = 15; i >= 0; i--) {
+		int	d = ip->stop6.s6_addr[i] - ip->start6.s6_addr[i] - borrow;
+
+		borrow = (d < 0);
+		if (borrow) {
+			d += 256;
+		}
+		if (i >= 8) {
+			lo |= (uint64_t)d << (8 * (15 - i));
+		} else {
+			hi |= (uint64_t)d << (8 * (7 - i));
+		}
+	}
+
+	if (hi != 0 || lo == UINT64_MAX) {
+		return UINT64_MAX;
+	}
+
+	return lo + 1;
+}
+
+/* Sets up irliter for the range it points to; returns 0 if that range
+ * has no addresses to hand out (bad, or none of them in the shard) */
+static int nutscan_ip_ranges_iter_range(nutscan_ip_range_list_iter_t *irliter)
+{
+	const nutscan_ip_range_list_t	*irl = irliter->irl;
+	uint64_t	size, count = (irl->shard_count > 1) ? irl->shard_count : 1;
+	unsigned int	bits;
 	char	*ip_str;
 
+	upsdebugx(4, "%s: beginning iteration with IP range [%s .. %s]",
+		__func__, irliter->ip_ranges_iter->start_ip,
+		irliter->ip_ranges_iter->end_ip);
+
+	memset(&(irliter->curr_ip_iter), 0, sizeof(nutscan_ip_iter_t));
+	irliter->range_members = 0;
+	irliter->range_pos = 0;
+	irliter->hints_seen = 0;
+	irliter->early_count = 0;
+
+	/* only kept for the parsed start and stop addresses */
+	ip_str = nutscan_ip_iter_init(
+		&(irliter->curr_ip_iter),
+		irliter->ip_ranges_iter->start_ip,
+		irliter->ip_ranges_iter->end_ip);
+	if (!ip_str) {
+		return 0;
+	}
+	free(ip_str);
+
+	size = nutscan_ip_iter_size(&(irliter->curr_ip_iter));
+	if (size == UINT64_MAX) {
+		upsdebugx(0, "WARNING: %s: only the first %" PRIu64 " addresses of range [%s .. %s] will be scanned",
+			__func__, size, irliter->ip_ranges_iter->start_ip,
+			irliter->ip_ranges_iter->end_ip);
+	}
+
+	/* members of the shard are those numbered shard_index modulo
+	 * shard_count, counting across all of the ranges */
+	irliter->range_first = (irl->shard_index % count + count
+		- irliter->range_base % count) % count;
+	if (irliter->range_first < size) {
+		irliter->range_members = (size - irliter->range_first - 1) / count + 1;
+	}
+	irliter->range_base += size;
+
+	if (irl->order_key != 0 && irliter->range_members > 1) {
+		uint64_t	k = irl->order_key ^ (irliter->range_base * 0xBF58476D1CE4E5B9ULL);
+
+		for (bits = 1; bits < 64 && (irliter->range_members - 1) >> bits; bits++);
+		irliter->range_mask = (bits < 64) ? (((uint64_t)1 << bits) - 1) : UINT64_MAX;
+		irliter->range_shift = (bits + 1) / 2;
+		k ^= k >> 31;
+		irliter->range_key = k;
+		k *= 0x94D049BB133111EBULL;
+		k ^= k >> 29;
+		irliter->range_mult = k | 1;
+	}
+
+	upsdebugx(5, "%s: %" PRIu64 " of %" PRIu64 " addresses of the range to scan",
+		__func__, irliter->range_members, size);
+
+	return (irliter->range_members > 0);
+}
+
+/* Return 1 with the first ip in ip, or 0 if there is none */
+int nutscan_ip_ranges_iter_init_addr(nutscan_ip_range_list_iter_t *irliter,
+	const nutscan_ip_range_list_t *irl, nutscan_ip_addr_t *ip)
+{
 	if (!irliter) {
 		upsdebugx(5, "%s: skip, no nutscan_ip_range_list_iter_t was specified", __func__);
-		return NULL;
+		return 0;
 	}
 
+	memset(irliter, 0, sizeof(nutscan_ip_range_list_iter_t));
+
 	if (!irl) {
 		upsdebugx(5, "%s: skip, no nutscan_ip_range_list_t was specified", __func__);
-		return NULL;
+		return 0;
 	}
 
 	if (!irl->ip_ranges) {
 		upsdebugx(5, "%s: skip, empty nutscan_ip_range_list_t was specified", __func__);
-		return NULL;
+		return 0;
 	}
 
-	memset(irliter, 0, sizeof(nutscan_ip_range_list_iter_t));
 	irliter->irl = irl;
 	irliter->ip_ranges_iter = irl->ip_ranges;
-	memset(&(irliter->curr_ip_iter), 0, sizeof(nutscan_ip_iter_t));
 
-	upsdebugx(4, "%s: beginning iteration with first IP range [%s .. %s]",
-		__func__, irliter->ip_ranges_iter->start_ip,
-		irliter->ip_ranges_iter->end_ip);
+	if (irl->shard_count > 1 || irl->order_key != 0) {
+		upsdebugx(4, "%s: scanning shard %" PRIuSIZE " of %" PRIuSIZE "%s",
+			__func__, irl->shard_index + 1,
+			(irl->shard_count > 1) ? irl->shard_count : 1,
+			irl->order_key ? " in permuted order" : "");
+	}
 
-	ip_str = nutscan_ip_iter_init(
-		&(irliter->curr_ip_iter),
-		irliter->ip_ranges_iter->start_ip,
-		irliter->ip_ranges_iter->end_ip);
+	/* if this range has nothing to scan, its range_members
+	 * is 0 so the first address is from one of the next ones */
+	nutscan_ip_ranges_iter_range(irliter);
 
-	upsdebugx(5, "%s: got IP from range: %s", __func__, NUT_STRARG(ip_str));
-	return ip_str;
+	return nutscan_ip_ranges_iter_inc_addr(irliter, ip);
 }
 
-/* return the next IP
- * return NULL if there is no more IP
- */
-char * nutscan_ip_ranges_iter_inc(nutscan_ip_range_list_iter_t *irliter)
+/* Return 1 with the next ip in ip, or 0 if there is no more IP */
+int nutscan_ip_ranges_iter_inc_addr(nutscan_ip_range_list_iter_t *irliter,
+	nutscan_ip_addr_t *ip)
 {
-	char	*ip_str;
+	uint64_t	off;
+	int	i;
 
 	if (!irliter) {
 		upsdebugx(5, "%s: skip, no nutscan_ip_range_list_iter_t was specified", __func__);
-		return NULL;
+		return 0;
 	}
 
 	if (!irliter->irl) {
 		upsdebugx(5, "%s: skip, no nutscan_ip_range_list_t was specified", __func__);
-		return NULL;
+		return 0;
 	}
 
 	if (!irliter->irl->ip_ranges) {
 		upsdebugx(5, "%s: skip, empty nutscan_ip_range_list_t was specified", __func__);
+		return 0;
+	}
+
+	for (;;) {
+		/* the ones found by other scans first, then the rest in turn */
+		if (irliter->range_pos < irliter->range_members
+		 && nutscan_ip_ranges_iter_hint(irliter, &off)
+		) {
+			break;
+		}
+		while (irliter->range_pos < irliter->range_members
+		    && nutscan_ip_ranges_iter_early(irliter, irliter->range_pos)
+		) {
+			irliter->range_pos++;
+		}
+		if (irliter->range_pos < irliter->range_members) {
+			off = nutscan_ip_ranges_iter_pick(irliter, irliter->range_pos++);
+			break;
+		}
+
+		if (!irliter->ip_ranges_iter) {
+			upsdebugx(5, "%s: skip, finished nutscan_ip_range_list_t was specified", __func__);
+			return 0;
+		}
+
+		/* else: end of one range, try to switch to next */
+		upsdebugx(5, "%s: end of IP range [%s .. %s]",
+			__func__, irliter->ip_ranges_iter->start_ip,
+			irliter->ip_ranges_iter->end_ip);
+
+		irliter->ip_ranges_iter = irliter->ip_ranges_iter->next;
+		if (!(irliter->ip_ranges_iter)) {
+			upsdebugx(5, "%s: end of whole IP range list", __func__);
+			return 0;
+		}
+
+		nutscan_ip_ranges_iter_range(irliter);
+	}
+
+	memset(ip, 0, sizeof(nutscan_ip_addr_t));
+	ip->type = irliter->curr_ip_iter.type;
+	if (ip->type == IPv4) {
+		ip->addr.s_addr = htonl((uint32_t)(ntohl(irliter->curr_ip_iter.start.s_addr) + off));
+	} else {
+		unsigned int	carry = 0;
+
+		memcpy(&ip->addr6, &(irliter->curr_ip_iter.start6), sizeof(struct in6_addr));
+		for (i = 15; i >= 0 && (off != 0 || carry != 0); i--) {
+			unsigned int	sum = ip->addr6.s6_addr[i] + (unsigned int)(off & 0xff) + carry;
+
+			ip->addr6.s6_addr[i] = (uint8_t)sum;
+			carry = sum >> 8;
+			off >>= 8;
+		}
+	}
+
+	return 1;
+}
+
+char * nutscan_ip_addr_to_str(const nutscan_ip_addr_t *ip, char *buf, size_t buflen)
+{
+	struct in_addr	addr;
+	struct in6_addr	addr6;
+	size_t	hlen;
+
+	if (!buf || buflen < 3) {
 		return NULL;
 	}
 
-	if (!irliter->ip_ranges_iter) {
-		upsdebugx(5, "%s: skip, finished nutscan_ip_range_list_t was specified", __func__);
+	if (ip->type == IPv4) {
+		addr = ip->addr;
+		if (ntop(&addr, buf, buflen) != 0) {
+			return NULL;
+		}
+		return buf;
+	}
+
+	/* IPv6 addresses must be in square brackets,
+	 * for upsclient et al to differentiate them
+	 * from the port number.
+	 */
+	addr6 = ip->addr6;
+	buf[0] = '[';
+	if (ntop6(&addr6, buf + 1, buflen - 2) != 0) {
 		return NULL;
 	}
+	hlen = strlen(buf);
+	buf[hlen] = ']';
+	buf[hlen + 1] = '\0';
 
-	ip_str = nutscan_ip_iter_inc(&(irliter->curr_ip_iter));
+	return buf;
+}
+
+socklen_t nutscan_ip_addr_to_sockaddr(const nutscan_ip_addr_t *ip, uint16_t port,
+	struct sockaddr_storage *sa)
+{
+	memset(sa, 0, sizeof(*sa));
+
+	if (ip->type == IPv4) {
+		struct sockaddr_in	*sin = (struct sockaddr_in *)sa;
 
-	if (ip_str) {
-		upsdebugx(5, "%s: got IP from range: %s", __func__, NUT_STRARG(ip_str));
-		return ip_str;
+		sin->sin_family = AF_INET;
+		sin->sin_port = htons(port);
+		sin->sin_addr = ip->addr;
+		return sizeof(*sin);
+	} else {
+		struct sockaddr_in6	*sin6 = (struct sockaddr_in6 *)sa;
+
+		sin6->sin6_family = AF_INET6;
+		sin6->sin6_port = htons(port);
+		memcpy(&sin6->sin6_addr, &ip->addr6, sizeof(struct in6_addr));
+		return sizeof(*sin6);
 	}
+}
 
-	upsdebugx(5, "%s: end of IP range [%s .. %s]",
-		__func__, irliter->ip_ranges_iter->start_ip,
-		irliter->ip_ranges_iter->end_ip);
+/* Return the first ip or NULL if error */
+char * nutscan_ip_ranges_iter_init(nutscan_ip_range_list_iter_t *irliter, const nutscan_ip_range_list_t *irl)
+{
+	nutscan_ip_addr_t	ip;
+	char	host[SMALLBUF];
 
-	/* else: end of one range, try to switch to next */
-	irliter->ip_ranges_iter = irliter->ip_ranges_iter->next;
-	if (!(irliter->ip_ranges_iter)) {
-		upsdebugx(5, "%s: end of whole IP range list", __func__);
+	if (!nutscan_ip_ranges_iter_init_addr(irliter, irl, &ip)
+	||  !nutscan_ip_addr_to_str(&ip, host, sizeof(host))
+	) {
 		return NULL;
 	}
 
-	memset(&(irliter->curr_ip_iter), 0, sizeof(nutscan_ip_iter_t));
-	upsdebugx(4, "%s: beginning iteration with next IP range [%s .. %s]",
-		__func__, irliter->ip_ranges_iter->start_ip,
-		irliter->ip_ranges_iter->end_ip);
+	upsdebugx(5, "%s: got IP from range: %s", __func__, host);
+	return strdup(host);
+}
 
-	ip_str = nutscan_ip_iter_init(
-		&(irliter->curr_ip_iter),
-		irliter->ip_ranges_iter->start_ip,
-		irliter->ip_ranges_iter->end_ip);
+/* return the next IP
+ * return NULL if there is no more IP
+ */
+char * nutscan_ip_ranges_iter_inc(nutscan_ip_range_list_iter_t *irliter)
+{
+	nutscan_ip_addr_t	ip;
+	char	host[SMALLBUF];
+
+	if (!nutscan_ip_ranges_iter_inc_addr(irliter, &ip)
+	||  !nutscan_ip_addr_to_str(&ip, host, sizeof(host))
+	) {
+		return NULL;
+	}
 
-	upsdebugx(5, "%s: got IP from range: %s", __func__, NUT_STRARG(ip_str));
-	return ip_str;
+	upsdebugx(5, "%s: got IP from range: %s", __func__, host);
+	return strdup(host);
 }
 
 /* Return the first ip or NULL if error */
@@ -679,3 +1181,449 @@ int nutscan_cidr_to_ip(const char * cidr, char ** start_ip, char ** stop_ip)
 	free(first_ip);
 	return 1;
 }
+
+/* State shared by the threads of nutscan_ip_ranges_run() */
+typedef struct nutscan_ip_pool_s {
+#ifdef HAVE_PTHREAD
+	pthread_mutex_t	lock;		/* of the iterator and next_ip */
+#endif
+	nutscan_ip_range_list_iter_t	iter;
+	char	*next_ip;		/* handed out next, NULL when done */
+	size_t	count;			/* addresses handed out */
+	nutscan_ip_ranges_work_t	work;
+	void	*arg;
+} nutscan_ip_pool_t;
+
+static void * nutscan_ip_pool_worker(void *arg)
+{
+	nutscan_ip_pool_t	*pool = (nutscan_ip_pool_t *)arg;
+	char	*ip_str;
+	enum network_type	type;
+
+	for (;;) {
+#ifdef HAVE_PTHREAD
+		pthread_mutex_lock(&pool->lock);
+#endif
+		if (pool->next_ip && nutscan_deadline_passed()) {
+			upsdebugx(1, "%s: deadline passed, not scanning the addresses left",
+				__func__);
+			free(pool->next_ip);
+			pool->next_ip = NULL;
+		}
+
+		/* the type goes with the address, the next one may be of another range */
+		ip_str = pool->next_ip;
+		type = pool->iter.curr_ip_iter.type;
+		if (ip_str) {
+			pool->next_ip = nutscan_ip_ranges_iter_inc(&pool->iter);
+			pool->count++;
+		}
+#ifdef HAVE_PTHREAD
+		pthread_mutex_unlock(&pool->lock);
+#endif
+
+		if (!ip_str) {
+			break;
+		}
+
+		/* one of max_threads slots for all the kinds of scans going on */
+#ifdef HAVE_PTHREAD
+# if (defined HAVE_SEMAPHORE_UNNAMED) || (defined HAVE_SEMAPHORE_NAMED)
+		if (nutscan_semaphore()) {
+			sem_wait(nutscan_semaphore());
+		}
+# elif (defined HAVE_PTHREAD_TRYJOIN)
+		pthread_mutex_lock(&threadcount_mutex);
+		curr_threads++;
+		pthread_mutex_unlock(&threadcount_mutex);
+# endif
+#endif	/* HAVE_PTHREAD */
+
+		pool->work(ip_str, type, pool->arg);
+
+#ifdef HAVE_PTHREAD
+# if (defined HAVE_SEMAPHORE_UNNAMED) || (defined HAVE_SEMAPHORE_NAMED)
+		if (nutscan_semaphore()) {
+			sem_post(nutscan_semaphore());
+		}
+# elif (defined HAVE_PTHREAD_TRYJOIN)
+		pthread_mutex_lock(&threadcount_mutex);
+		if (curr_threads > 0) {
+			curr_threads--;
+		}
+		pthread_mutex_unlock(&threadcount_mutex);
+# endif
+#endif	/* HAVE_PTHREAD */
+	}
+
+	return NULL;
+}
+
+size_t nutscan_ip_ranges_run(const nutscan_ip_range_list_t *irl, size_t max_workers,
+	nutscan_ip_ranges_work_t work, void *arg)
+{
+	nutscan_ip_pool_t	pool;
+#ifdef HAVE_PTHREAD
+	nutscan_ip_range_list_iter_t	probe;
+	nutscan_ip_addr_t	ip;
+	pthread_t	*threads;
+	size_t	workers = max_threads, started, i;
+	int	more;
+#endif	/* HAVE_PTHREAD */
+
+	memset(&pool, 0, sizeof(pool));
+	pool.work = work;
+	pool.arg = arg;
+	pool.next_ip = nutscan_ip_ranges_iter_init(&pool.iter, irl);
+
+	if (!pool.next_ip) {
+		return 0;
+	}
+
+#ifdef HAVE_PTHREAD
+	if (max_workers > 0 && (max_workers < workers || workers < 1)) {
+		workers = max_workers;
+	}
+
+	if (workers < 1) {
+		workers = 1;
+	}
+
+	/* no more threads than addresses, for short ranges */
+	more = nutscan_ip_ranges_iter_init_addr(&probe, irl, &ip);
+	for (i = 0; more && i < workers; i++) {
+		more = nutscan_ip_ranges_iter_inc_addr(&probe, &ip);
+	}
+	workers = i;
+
+	upsdebugx(2, "%s: scanning with %" PRIuSIZE " threads", __func__, workers);
+
+	pthread_mutex_init(&pool.lock, NULL);
+	threads = xcalloc(workers, sizeof(*threads));
+
+	for (started = 0; started < workers; started++) {
+		if (pthread_create(&threads[started], NULL, nutscan_ip_pool_worker, &pool) != 0) {
+			upsdebugx(1, "%s: could only start %" PRIuSIZE " scanning threads",
+				__func__, started);
+			break;
+		}
+	}
+
+	/* the addresses left are scanned here, if no thread could start */
+	if (started == 0) {
+		nutscan_ip_pool_worker(&pool);
+	}
+
+	for (i = 0; i < started; i++) {
+		int	ret = pthread_join(threads[i], NULL);
+
+		if (ret != 0) {
+			upsdebugx(0, "WARNING: %s: pthread_join() returned code %i",
+				__func__, ret);
+		}
+	}
+
+	free(threads);
+	pthread_mutex_destroy(&pool.lock);
+#else	/* !HAVE_PTHREAD */
+	NUT_UNUSED_VARIABLE(max_workers);
+
+	nutscan_ip_pool_worker(&pool);
+#endif	/* !HAVE_PTHREAD */
+
+	return pool.count;
+}
+
+#if (!defined WIN32) && (defined HAVE_POLL_H)
+/* One connection of nutscan_ip_ranges_probe(), free while fd < 0 */
+typedef struct nutscan_ip_probe_s {
+	int	fd;
+	int	connected;
+	nutscan_ip_addr_t	ip;
+	long	deadline;		/* msec, see nutscan_now_ms() */
+	size_t	sent;			/* of the request */
+	char	*reply;
+	size_t	len;
+} nutscan_ip_probe_t;
+
+/* Largest reply collected from one address */
+#define NUTSCAN_IP_PROBE_REPLY_MAX	(64 * 1024)
+
+/* Starts a non-blocking connect to ip:port in the free slot p;
+ * returns 0 if the address was taken care of (maybe it failed right
+ * away), or -1 if no socket could be had for now and it should be
+ * retried when some other connection is done */
+static int nutscan_ip_probe_start(nutscan_ip_probe_t *p, const nutscan_ip_addr_t *ip,
+	uint16_t port, long deadline)
+{
+	struct sockaddr_storage	sa;
+	socklen_t	salen;
+	int	fd;
+
+	salen = nutscan_ip_addr_to_sockaddr(ip, port, &sa);
+
+	if ((fd = socket(sa.ss_family, SOCK_STREAM, 0)) < 0) {
+		if (errno == EMFILE || errno == ENFILE) {
+			return -1;
+		}
+		upsdebug_with_errno(1, "%s: socket()", __func__);
+		return 0;
+	}
+
+	fcntl(fd, F_SETFD, FD_CLOEXEC);
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+	if (connect(fd, (struct sockaddr *)&sa, salen) < 0 && errno != EINPROGRESS) {
+		upsdebug_with_errno(5, "%s: connect()", __func__);
+		close(fd);
+		return 0;
+	}
+
+	p->fd = fd;
+	p->connected = 0;
+	p->ip = *ip;
+	p->deadline = deadline;
+	p->sent = 0;
+	p->reply = NULL;
+	p->len = 0;
+
+	return 0;
+}
+
+/* Ends the connection of slot p, and passes along what was read on it
+ * (the address only becomes a string for those which were there) */
+static void nutscan_ip_probe_done(nutscan_ip_probe_t *p,
+	nutscan_ip_ranges_reply_t reply, void *arg)
+{
+	char	host[SMALLBUF];
+
+	if (p->connected && nutscan_ip_addr_to_str(&p->ip, host, sizeof(host))) {
+		reply(host, p->ip.type, p->reply, p->len, arg);
+	}
+
+	close(p->fd);
+	free(p->reply);
+	p->fd = -1;
+	p->reply = NULL;
+}
+
+int nutscan_ip_ranges_probe(const nutscan_ip_range_list_t *irl, uint16_t port,
+	const char *request, const char *reply_end, useconds_t usec_timeout,
+	size_t max_inflight, nutscan_ip_ranges_reply_t reply, void *arg)
+{
+	nutscan_ip_range_list_iter_t	iter;
+	nutscan_ip_probe_t	*probes;
+	struct pollfd	*pfds;
+	size_t	*slot_of;
+	size_t	i, active = 0, started = 0;
+	long	timeout_ms = (long)(usec_timeout / 1000);
+	size_t	request_len = request ? strlen(request) : 0;
+	nutscan_ip_addr_t	ip;
+	int	more;
+	struct rlimit	rl;
+
+	if (timeout_ms < 1) {
+		timeout_ms = 1;
+	}
+
+	/* as many connections as descriptors are left to this process,
+	 * and to the threads of the other scans going on */
+	if (max_inflight == 0) {
+		max_inflight = 1024;
+		if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur != RLIM_INFINITY) {
+			max_inflight = (rl.rlim_cur > 64 + 16) ? (size_t)rl.rlim_cur - 64 : 16;
+		}
+		max_inflight = (max_inflight > nutscan_fds_reserved + 16)
+			? max_inflight - nutscan_fds_reserved : 16;
+		if (max_inflight > 16384) {
+			max_inflight = 16384;
+		}
+	}
+
+	probes = xcalloc(max_inflight, sizeof(*probes));
+	pfds = xcalloc(max_inflight, sizeof(*pfds));
+	slot_of = xcalloc(max_inflight, sizeof(*slot_of));
+	for (i = 0; i < max_inflight; i++) {
+		probes[i].fd = -1;
+	}
+
+	upsdebugx(2, "%s: up to %" PRIuSIZE " connections at a time to port %" PRIu16,
+		__func__, max_inflight, port);
+
+	more = nutscan_ip_ranges_iter_init_addr(&iter, irl, &ip);
+
+	while (more || active) {
+		long	now = nutscan_now_ms(), wait_ms = timeout_ms;
+		long	conn_ms = (long)(nutscan_deadline_clamp(usec_timeout) / 1000);
+		size_t	npfds = 0;
+		int	ret;
+
+		if (more && nutscan_deadline_passed()) {
+			upsdebugx(1, "%s: deadline passed, not probing the addresses left",
+				__func__);
+			more = 0;
+		}
+		if (conn_ms < 1) {
+			conn_ms = 1;
+		}
+
+		/* new connections in the free slots */
+		for (i = 0; more && i < max_inflight; i++) {
+			if (probes[i].fd >= 0) {
+				continue;
+			}
+			if (nutscan_ip_probe_start(&probes[i], &ip, port,
+				now + conn_ms) < 0
+			) {
+				if (active == 0) {
+					upsdebugx(0, "%s: no socket could be created, giving up", __func__);
+					more = 0;
+				}
+				break;
+			}
+			if (probes[i].fd >= 0) {
+				active++;
+			}
+			started++;
+			more = nutscan_ip_ranges_iter_inc_addr(&iter, &ip);
+		}
+
+		for (i = 0; i < max_inflight; i++) {
+			nutscan_ip_probe_t	*p = &probes[i];
+
+			if (p->fd < 0) {
+				continue;
+			}
+			if (p->deadline <= now) {
+				nutscan_ip_probe_done(p, reply, arg);
+				active--;
+				continue;
+			}
+			if (p->deadline - now < wait_ms) {
+				wait_ms = p->deadline - now;
+			}
+			pfds[npfds].fd = p->fd;
+			pfds[npfds].events = (!p->connected || p->sent < request_len)
+				? POLLOUT : POLLIN;
+			pfds[npfds].revents = 0;
+			slot_of[npfds++] = i;
+		}
+
+		if (npfds == 0) {
+			continue;
+		}
+
+		ret = poll(pfds, (nfds_t)npfds, (int)wait_ms);
+		if (ret < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			upsdebug_with_errno(0, "%s: poll()", __func__);
+			break;
+		}
+
+		for (i = 0; ret > 0 && i < npfds; i++) {
+			nutscan_ip_probe_t	*p = &probes[slot_of[i]];
+			ssize_t	n;
+
+			if (pfds[i].revents == 0) {
+				continue;
+			}
+			ret--;
+
+			if (!p->connected) {
+				int	err = 0;
+				socklen_t	errlen = sizeof(err);
+
+				if (getsockopt(p->fd, SOL_SOCKET, SO_ERROR, &err, &errlen) < 0 || err) {
+					/* nobody there */
+					nutscan_ip_probe_done(p, reply, arg);
+					active--;
+					continue;
+				}
+
+				if (nut_debug_level >= 5) {
+					char	host[SMALLBUF];
+
+					upsdebugx(5, "%s: %s:%" PRIu16 " accepted the connection",
+						__func__, nutscan_ip_addr_to_str(&p->ip, host, sizeof(host))
+							? host : "?", port);
+				}
+				p->connected = 1;
+				if (!request_len) {
+					nutscan_ip_probe_done(p, reply, arg);
+					active--;
+				}
+				continue;
+			}
+
+			if (p->sent < request_len) {
+				n = send(p->fd, request + p->sent, request_len - p->sent
+#ifdef MSG_NOSIGNAL
+					, MSG_NOSIGNAL
+#else
+					, 0
+#endif
+					);
+				if (n < 0 && errno != EAGAIN && errno != EINTR) {
+					nutscan_ip_probe_done(p, reply, arg);
+					active--;
+				} else if (n > 0) {
+					p->sent += (size_t)n;
+				}
+				continue;
+			}
+
+			if (!p->reply) {
+				p->reply = xcalloc(1, NUTSCAN_IP_PROBE_REPLY_MAX + 1);
+			}
+
+			n = recv(p->fd, p->reply + p->len, NUTSCAN_IP_PROBE_REPLY_MAX - p->len, 0);
+			if (n < 0 && (errno == EAGAIN || errno == EINTR)) {
+				continue;
+			}
+			if (n > 0) {
+				p->len += (size_t)n;
+				p->reply[p->len] = '\0';
+			}
+			if (n <= 0 || p->len >= NUTSCAN_IP_PROBE_REPLY_MAX
+			 || (reply_end && strstr(p->reply, reply_end))
+			) {
+				nutscan_ip_probe_done(p, reply, arg);
+				active--;
+			}
+		}
+	}
+
+	/* only after a poll() failure */
+	for (i = 0; i < max_inflight; i++) {
+		if (probes[i].fd >= 0) {
+			nutscan_ip_probe_done(&probes[i], reply, arg);
+		}
+	}
+
+	upsdebugx(2, "%s: probed %" PRIuSIZE " addresses", __func__, started);
+
+	free(slot_of);
+	free(pfds);
+	free(probes);
+
+	return 0;
+}
+#else	/* WIN32 || !HAVE_POLL_H */
+int nutscan_ip_ranges_probe(const nutscan_ip_range_list_t *irl, uint16_t port,
+	const char *request, const char *reply_end, useconds_t usec_timeout,
+	size_t max_inflight, nutscan_ip_ranges_reply_t reply, void *arg)
+{
+	NUT_UNUSED_VARIABLE(irl);
+	NUT_UNUSED_VARIABLE(port);
+	NUT_UNUSED_VARIABLE(request);
+	NUT_UNUSED_VARIABLE(reply_end);
+	NUT_UNUSED_VARIABLE(usec_timeout);
+	NUT_UNUSED_VARIABLE(max_inflight);
+	NUT_UNUSED_VARIABLE(reply);
+	NUT_UNUSED_VARIABLE(arg);
+
+	return -1;
+}
+#endif	/* WIN32 || !HAVE_POLL_H */
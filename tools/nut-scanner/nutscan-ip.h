@@ -26,6 +26,7 @@
 #define SCAN_IP
 
 #ifndef WIN32
+#include <sys/socket.h>
 #include <arpa/inet.h>
 #include <netinet/in.h>
 #else	/* WIN32 */
@@ -55,6 +56,24 @@ typedef struct nutscan_ip_iter {
 
 char * nutscan_ip_iter_init(nutscan_ip_iter_t *, const char * startIP, const char * stopIP);
 char * nutscan_ip_iter_inc(nutscan_ip_iter_t *);
+
+/* One address as handed out by nutscan_ip_ranges_iter_init_addr() et al,
+ * without formatting it into a string (which only the addresses which
+ * replied usually need) */
+typedef struct nutscan_ip_addr_s {
+	enum network_type	type;
+	struct in_addr		addr;	/* if type is IPv4 */
+	struct in6_addr		addr6;	/* if type is IPv6 */
+} nutscan_ip_addr_t;
+
+/* Formats the address into buf like the string iterators do (IPv6 ones
+ * in square brackets); returns buf, or NULL if it did not fit */
+char * nutscan_ip_addr_to_str(const nutscan_ip_addr_t *ip, char *buf, size_t buflen);
+
+/* Fills sa with the address and port; returns the length of the
+ * sockaddr for connect(), sendto() et al */
+socklen_t nutscan_ip_addr_to_sockaddr(const nutscan_ip_addr_t *ip, uint16_t port,
+	struct sockaddr_storage *sa);
 int nutscan_cidr_to_ip(const char * cidr, char ** start_ip, char ** stop_ip);
 
 /* Track requested IP ranges (from CLI or auto-discovery) */
@@ -70,6 +89,12 @@ typedef struct nutscan_ip_range_list_s {
 	nutscan_ip_range_t * ip_ranges;		/* Actual linked list of entries, first entry */
 	nutscan_ip_range_t * ip_ranges_last;	/* Pointer to end of list for quicker additions */
 	size_t ip_ranges_count;			/* Counter of added entries */
+	/* Which addresses the iterators hand out, and in which order
+	 * (kept as set by nutscan_init_ip_ranges() to scan them all,
+	 * one after another): */
+	size_t shard_index;			/* Only the addresses numbered shard_index... */
+	size_t shard_count;			/* ...modulo shard_count (0 or 1 for all of them) */
+	uint64_t order_key;			/* Non-zero to go through each range in an order permuted by this key */
 } nutscan_ip_range_list_t;
 
 /* Initialize fields of caller-provided list
@@ -97,16 +122,75 @@ size_t nutscan_add_ip_range(nutscan_ip_range_list_t *irl, char * start_ip, char
 /* Iterator over given nutscan_ip_range_list_t structure
  * and the currently pointed-to range in its list.
  * Several iterators may use the same range.
+ * The addresses passed to nutscan_ip_hint_add() meanwhile are handed
+ * out before the others (up to NUTSCAN_IP_ITER_EARLY per range).
  */
+#define NUTSCAN_IP_ITER_EARLY	64
 typedef struct nutscan_ip_range_list_iter_s {
 	const nutscan_ip_range_list_t * irl;	/* Structure with actual linked list of address-range entries */
 	nutscan_ip_range_t * ip_ranges_iter;	/* Helper for iteration: across the list of IP ranges */
-	nutscan_ip_iter_t    curr_ip_iter;	/* Helper for iteration: across one currently iterated IP range */
+	nutscan_ip_iter_t    curr_ip_iter;	/* Helper for iteration: across one currently iterated IP range (its start stays as the first address) */
+	uint64_t	range_base;		/* Number of the first address of the current range among all of them, for sharding */
+	uint64_t	range_first;		/* Offset in the current range of its first address in the shard */
+	uint64_t	range_members;		/* Count of addresses of the current range in the shard */
+	uint64_t	range_pos;		/* Count of those already handed out */
+	uint64_t	range_mask;		/* Of the permutation of [0, range_members) */
+	uint64_t	range_key;
+	uint64_t	range_mult;
+	unsigned int	range_shift;
+	size_t	hints_seen;			/* Count of nutscan_ip_hint_add() addresses checked against the current range */
+	uint64_t	early[NUTSCAN_IP_ITER_EARLY];	/* Positions (as of range_pos) of the hinted ones handed out ahead of their turn */
+	size_t	early_count;
 } nutscan_ip_range_list_iter_t;
 
 char * nutscan_ip_ranges_iter_init(nutscan_ip_range_list_iter_t *irliter, const nutscan_ip_range_list_t *irl);
 char * nutscan_ip_ranges_iter_inc(nutscan_ip_range_list_iter_t *irliter);
 
+/* Same as above, storing the address into ip instead of a string to
+ * free; return 1 if there is one, 0 if there are no more addresses */
+int nutscan_ip_ranges_iter_init_addr(nutscan_ip_range_list_iter_t *irliter,
+	const nutscan_ip_range_list_t *irl, nutscan_ip_addr_t *ip);
+int nutscan_ip_ranges_iter_inc_addr(nutscan_ip_range_list_iter_t *irliter,
+	nutscan_ip_addr_t *ip);
+
+/* Notes that host (an IP address, maybe in square brackets) answered
+ * some scan, so the iterators of the others try it first: a device is
+ * likely to speak more than one of the protocols */
+void nutscan_ip_hint_add(const char *host);
+void nutscan_ip_hints_free(void);
+
+/* Host part of the port of a device found on the network (such as
+ * "10.0.0.5" out of "upsname@10.0.0.5:3493" or "http://[::1]"), without
+ * brackets, into buf; returns 0 if it has none */
+int nutscan_port_host(const char *port, char *buf, size_t buflen);
+
+/* Calls work() for each address of the ranges, from a pool of at most
+ * max_workers threads (0 for max_threads) which take the addresses in
+ * turn from one iterator: all addresses are being scanned all the time,
+ * instead of a thread being created for each of them. Each one scanned
+ * takes a slot of nutscan_semaphore() meanwhile, which is shared by the
+ * scans of all kinds. work() gets the address string to free, and its
+ * type; arg is passed along. Returns the count of addresses scanned.
+ */
+typedef void (*nutscan_ip_ranges_work_t)(char *ip_str, enum network_type type, void *arg);
+size_t nutscan_ip_ranges_run(const nutscan_ip_range_list_t *irl, size_t max_workers,
+	nutscan_ip_ranges_work_t work, void *arg);
+
+/* Connects to port of each address of the ranges without blocking, at
+ * most max_inflight at a time (0 for as many as descriptors allow), and
+ * sends request (if not NULL) once connected. reply() is called for each
+ * address which accepted the connection, with what it sent back until
+ * reply_end was seen, it closed the connection or usec_timeout (counted
+ * from the connect) elapsed; the reply is NUL-terminated, or NULL if
+ * nothing was read. Returns 0, or -1 if not supported in this build so
+ * the caller should use nutscan_ip_ranges_run() instead.
+ */
+typedef void (*nutscan_ip_ranges_reply_t)(const char *ip_str, enum network_type type,
+	const char *reply, size_t len, void *arg);
+int nutscan_ip_ranges_probe(const nutscan_ip_range_list_t *irl, uint16_t port,
+	const char *request, const char *reply_end, useconds_t usec_timeout,
+	size_t max_inflight, nutscan_ip_ranges_reply_t reply, void *arg);
+
 #ifdef __cplusplus
 /* *INDENT-OFF* */
 }
@@ -36,6 +36,7 @@ int nutscan_unload_avahi_library(void);
 #include <assert.h>
 #include <stdlib.h>
 #include "timehead.h"
+#include "nut_stdint.h"
 
 #include <avahi-client/client.h>
 #include <avahi-client/lookup.h>
@@ -54,7 +55,7 @@ static const char *dl_error = NULL;
 static char *dl_saved_libname = NULL;
 
 static AvahiClient* (*nut_avahi_service_browser_get_client)(AvahiServiceBrowser *);
-static int (*nut_avahi_simple_poll_loop)(AvahiSimplePoll *s);
+static int (*nut_avahi_simple_poll_iterate)(AvahiSimplePoll *s, int sleep_time);
 static void (*nut_avahi_client_free)(AvahiClient *client);
 static int (*nut_avahi_client_errno)(AvahiClient*);
 static void (*nut_avahi_free)(void *p);
@@ -141,7 +142,7 @@ int nutscan_load_avahi_library(const char *libname_path)
 		goto err;
 	}
 
-	*(void **) (&nut_avahi_simple_poll_loop) = lt_dlsym(dl_handle, "avahi_simple_poll_loop");
+	*(void **) (&nut_avahi_simple_poll_iterate) = lt_dlsym(dl_handle, "avahi_simple_poll_iterate");
 	if ((dl_error = lt_dlerror()) != NULL) {
 		goto err;
 	}
@@ -250,6 +251,142 @@ static AvahiSimplePoll *simple_poll = NULL;
 static nutscan_device_t * dev_ret = NULL;
 static useconds_t avahi_usec_timeout = 0;
 
+/* The browsing is done when the service browser said it found all of
+ * them for now and their resolvers all called back, or on the deadline */
+static int avahi_browse_done = 0;
+static size_t avahi_resolvers_pending = 0;
+
+/* The upsd services which published no device_list, to query directly
+ * once the browsing is done (together rather than each in turn inside
+ * a resolver callback, which stalls the other resolvers meanwhile) */
+typedef struct {
+	char	*host_name;
+	char	*ip;
+	uint16_t	port;
+	int	proto;
+	int	found;
+} avahi_upsd_t;
+static avahi_upsd_t *avahi_upsd = NULL;
+static size_t avahi_upsd_count = 0;
+
+/* Adds an upsd entry without associated device */
+static void add_upsd_device(const char * host_name, uint16_t port, int proto)
+{
+	nutscan_device_t * dev = NULL;
+	char buf[6];
+	size_t buf_size;
+
+	snprintf(buf, sizeof(buf), "%u", port);
+	dev = nutscan_new_device();
+	dev->type = TYPE_NUT;
+	dev->driver = strdup(SCAN_AVAHI_DRIVERNAME);
+	if (proto == AVAHI_PROTO_INET) {
+		nutscan_add_option_to_device(dev, "desc", "IPv4");
+	}
+	if (proto == AVAHI_PROTO_INET6) {
+		nutscan_add_option_to_device(dev, "desc", "IPv6");
+	}
+	if (port != PORT) {
+		/*+1+1 is for ':' character and terminating 0 */
+		/*buf is the string containing the port number*/
+		buf_size = strlen(host_name) + strlen(buf) + 1 + 1;
+		dev->port = malloc(buf_size);
+		if (dev->port) {
+			snprintf(dev->port, buf_size, "%s:%s",
+				host_name, buf);
+		}
+	}
+	else {
+		dev->port = strdup(host_name);
+	}
+	if (dev->port) {
+		dev_ret = nutscan_add_device_to_device(dev_ret, dev);
+	}
+	else {
+		nutscan_free_device(dev);
+	}
+}
+
+/* Whether one of the devices found by the "Old NUT" scan is on ip */
+static int upsd_device_found(nutscan_device_t * devs, const char * ip)
+{
+	nutscan_device_t * dev;
+	size_t len = strlen(ip);
+
+	for (dev = nutscan_rewind_device(devs); dev; dev = dev->next) {
+		const char *host;
+
+		if (!dev->port || (host = strrchr(dev->port, '@')) == NULL) {
+			continue;
+		}
+		host++;
+		if (*host == '[') {
+			host++;
+		}
+		if (!strncmp(host, ip, len)
+		&& (host[len] == '\0' || host[len] == ':' || host[len] == ']')
+		) {
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/* Queries the upsd services which published no device_list, those on
+ * one port at a time with the concurrent "Old NUT" scan of their addresses */
+static void query_upsd_services(void)
+{
+	size_t i, j;
+
+	for (i = 0; i < avahi_upsd_count; i++) {
+		nutscan_ip_range_list_t irl;
+		nutscan_device_t * devs;
+		char buf[6];
+
+		if (avahi_upsd[i].found < 0) {
+			/* done with its port already */
+			continue;
+		}
+
+		nutscan_init_ip_ranges(&irl);
+		for (j = i; j < avahi_upsd_count; j++) {
+			if (avahi_upsd[j].port == avahi_upsd[i].port) {
+				nutscan_add_ip_range(&irl, strdup(avahi_upsd[j].ip), NULL);
+			}
+		}
+
+		snprintf(buf, sizeof(buf), "%u", avahi_upsd[i].port);
+		upsdebugx(1, "%s: querying %" PRIuSIZE " upsd services on port %s",
+			__func__, irl.ip_ranges_count, buf);
+		devs = nutscan_scan_ip_range_nut(&irl, buf, avahi_usec_timeout);
+		nutscan_free_ip_ranges(&irl);
+
+		for (j = avahi_upsd_count; j-- > i; ) {
+			if (avahi_upsd[j].port != avahi_upsd[i].port) {
+				continue;
+			}
+			if (!upsd_device_found(devs, avahi_upsd[j].ip)) {
+				add_upsd_device(avahi_upsd[j].host_name,
+					avahi_upsd[j].port, avahi_upsd[j].proto);
+			}
+			avahi_upsd[j].found = -1;
+		}
+
+		if (devs) {
+			dev_ret = nutscan_add_device_to_device(dev_ret, devs);
+		}
+	}
+
+	for (i = 0; i < avahi_upsd_count; i++) {
+		free(avahi_upsd[i].host_name);
+		free(avahi_upsd[i].ip);
+	}
+	free(avahi_upsd);
+	avahi_upsd = NULL;
+	avahi_upsd_count = 0;
+}
+
 static void update_device(const char * host_name, const char *ip, uint16_t port, char * text, int proto)
 {
 	nutscan_device_t * dev = NULL;
@@ -263,7 +400,6 @@ static void update_device(const char * host_name, const char *ip, uint16_t port,
 	char * device = NULL;
 	char * device_saveptr = NULL;
 	int device_found = 0;
-	char buf[6];
 	size_t buf_size;
 
 	if (text == NULL) {
@@ -341,44 +477,22 @@ static void update_device(const char * host_name, const char *ip, uint16_t port,
 	free(t);
 
 	/* If no device published in avahi data, try to get the device by
-	connecting directly to upsd */
+	connecting directly to upsd (when the browsing is done) */
 	if (!device_found) {
-		snprintf(buf, sizeof(buf), "%u", port);
-		dev = nutscan_scan_nut(ip, ip, buf, avahi_usec_timeout);
-		if (dev) {
-			dev_ret = nutscan_add_device_to_device(dev_ret, dev);
-		}
-		/* add an upsd entry without associated device */
-		else {
-			dev = nutscan_new_device();
-			dev->type = TYPE_NUT;
-			dev->driver = strdup(SCAN_AVAHI_DRIVERNAME);
-			if (proto == AVAHI_PROTO_INET) {
-				nutscan_add_option_to_device(dev, "desc", "IPv4");
-			}
-			if (proto == AVAHI_PROTO_INET6) {
-				nutscan_add_option_to_device(dev, "desc", "IPv6");
-			}
-			if (port != PORT) {
-				/*+1+1 is for ':' character and terminating 0 */
-				/*buf is the string containing the port number*/
-				buf_size = strlen(host_name) + strlen(buf) + 1 + 1;
-				dev->port = malloc(buf_size);
-				if (dev->port) {
-					snprintf(dev->port, buf_size, "%s:%s",
-						host_name, buf);
-				}
-			}
-			else {
-				dev->port = strdup(host_name);
-			}
-			if (dev->port) {
-				dev_ret = nutscan_add_device_to_device(dev_ret, dev);
-			}
-			else {
-				nutscan_free_device(dev);
-			}
+		avahi_upsd_t *new_upsd = realloc(avahi_upsd,
+			(avahi_upsd_count + 1) * sizeof(*avahi_upsd));
+
+		if (new_upsd == NULL) {
+			upsdebugx(0, "%s: Memory allocation error", __func__);
+			return;
 		}
+		avahi_upsd = new_upsd;
+		new_upsd = &avahi_upsd[avahi_upsd_count++];
+		new_upsd->host_name = strdup(host_name);
+		new_upsd->ip = strdup(ip);
+		new_upsd->port = port;
+		new_upsd->proto = proto;
+		new_upsd->found = 0;
 	}
 }
 
@@ -474,6 +588,7 @@ static void resolve_callback(
 	}
 
 	(*nut_avahi_service_resolver_free)(r);
+	avahi_resolvers_pending--;
 }
 
 static void browse_callback(
@@ -529,6 +644,8 @@ static void browse_callback(
 					"Failed to resolve service '%s': %s",
 					__func__,
 					name, (*nut_avahi_strerror)((*nut_avahi_client_errno)(c)));
+			else
+				avahi_resolvers_pending++;
 
 			break;
 
@@ -537,7 +654,8 @@ static void browse_callback(
 			break;
 
 		case AVAHI_BROWSER_ALL_FOR_NOW:
-			(*nut_avahi_simple_poll_quit)(simple_poll);
+			/* the resolvers started meanwhile may still call back */
+			avahi_browse_done = 1;
 			goto fallthrough_AVAHI_BROWSER_CACHE_EXHAUSTED; /* be explicit */
 
 		case AVAHI_BROWSER_CACHE_EXHAUSTED:
@@ -612,6 +730,7 @@ nutscan_device_t * nutscan_scan_avahi(useconds_t usec_timeout)
 	 */
 	AvahiClient *client = NULL;
 	AvahiServiceBrowser *sb = NULL;
+	struct timeval start;
 	int error;
 
 	if (!nutscan_avail_avahi) {
@@ -619,6 +738,11 @@ nutscan_device_t * nutscan_scan_avahi(useconds_t usec_timeout)
 	}
 
 	avahi_usec_timeout = usec_timeout;
+	if (avahi_usec_timeout <= 0)
+		avahi_usec_timeout = DEFAULT_NETWORK_TIMEOUT * 1000 * 1000;
+	avahi_usec_timeout = nutscan_deadline_clamp(avahi_usec_timeout);
+	avahi_browse_done = 0;
+	avahi_resolvers_pending = 0;
 
 	/* Allocate main loop object */
 	if (!(simple_poll = (*nut_avahi_simple_poll_new)())) {
@@ -658,8 +782,34 @@ nutscan_device_t * nutscan_scan_avahi(useconds_t usec_timeout)
 		goto fail;
 	}
 
-	/* Run the main loop */
-	(*nut_avahi_simple_poll_loop)(simple_poll);
+	/* Run the main loop until all services are resolved, or the deadline */
+	gettimeofday(&start, NULL);
+	for (;;) {
+		struct timeval now;
+		double elapsed_ms;
+
+		if (avahi_browse_done && !avahi_resolvers_pending) {
+			break;
+		}
+
+		gettimeofday(&now, NULL);
+		elapsed_ms = difftimeval(now, start) * 1000.0;
+		if (elapsed_ms >= (double)avahi_usec_timeout / 1000.0) {
+			upsdebugx(1, "%s: timed out %s, with %" PRIuSIZE " services not resolved",
+				__func__, avahi_browse_done ? "resolving" : "browsing",
+				avahi_resolvers_pending);
+			break;
+		}
+
+		/* non-zero if quit on failure, see callbacks */
+		if ((*nut_avahi_simple_poll_iterate)(simple_poll,
+			(int)((double)avahi_usec_timeout / 1000.0 - elapsed_ms) + 1) != 0
+		) {
+			break;
+		}
+	}
+
+	query_upsd_services();
 
 fail:
 
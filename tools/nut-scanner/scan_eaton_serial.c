@@ -56,6 +56,7 @@
 #include "bcmxcp_ser.h"
 #include "bcmxcp.h"
 #include "nutscan-serial.h"
+#include "iorec.h"
 
 /* SHUT header */
 #define SHUT_SYNC 0x16
@@ -95,6 +96,69 @@ TYPE_FD   upsfd;
 int   exit_flag = 0;
 int   do_lock_port;
 
+/* serial.c times its I/O for the driver.stats.io.* variables */
+uint64_t drv_stats_now_usec(void)
+{
+	return 0;
+}
+
+void drv_stats_io(uint64_t start)
+{
+	NUT_UNUSED_VARIABLE(start);
+}
+
+/* ... and can record or replay it, which the scanner never does */
+iorec_mode_t	iorec_mode = IOREC_OFF;
+
+void iorec_record(const char *chan, const char *op, const char *key,
+	long ret, const void *data, size_t len)
+{
+	NUT_UNUSED_VARIABLE(chan);
+	NUT_UNUSED_VARIABLE(op);
+	NUT_UNUSED_VARIABLE(key);
+	NUT_UNUSED_VARIABLE(ret);
+	NUT_UNUSED_VARIABLE(data);
+	NUT_UNUSED_VARIABLE(len);
+}
+
+int iorec_replay(const char *chan, const char *op, const char *key,
+	long *ret, void *data, size_t *len)
+{
+	NUT_UNUSED_VARIABLE(chan);
+	NUT_UNUSED_VARIABLE(op);
+	NUT_UNUSED_VARIABLE(key);
+	NUT_UNUSED_VARIABLE(ret);
+	NUT_UNUSED_VARIABLE(data);
+	NUT_UNUSED_VARIABLE(len);
+	return 0;
+}
+
+/* ... and its non-blocking transactions use the main loop and its fds,
+ * which the scanner doesn't start */
+void drv_gettime(struct timeval *now)
+{
+	gettimeofday(now, NULL);
+}
+
+void drv_waiter_set(void (*wake)(struct timeval *wake), int (*run)(const struct timeval *now))
+{
+	NUT_UNUSED_VARIABLE(wake);
+	NUT_UNUSED_VARIABLE(run);
+}
+
+#ifndef WIN32
+void dstate_watch_fd(int fd, int events)
+{
+	NUT_UNUSED_VARIABLE(fd);
+	NUT_UNUSED_VARIABLE(events);
+}
+
+void dstate_unwatch_fd(int fd)
+{
+	NUT_UNUSED_VARIABLE(fd);
+}
+#endif	/* !WIN32 */
+
 /* Functions extracted from drivers/bcmxcp.c, to avoid pulling too many things
  * lightweight function to calculate the 8-bit
  * two's complement checksum of buf, using XCP data length (including header)
@@ -200,6 +264,25 @@ static nutscan_device_t * nutscan_scan_eaton_serial_shut(const char* port_name)
  * XCP functions (Eaton Powerware legacy)
  ******************************************************************************/
 
+/* Light version of drivers/bcmxcp_ser.c->send_write_command(), which
+ * writes to the global upsfd: other threads scanning other ports would
+ * change it under its feet */
+static void xcp_send_command(TYPE_FD_SER devfd, const unsigned char *command, size_t command_length)
+{
+	unsigned char	sbuf[128];
+
+	if (command_length > sizeof(sbuf) - 3) {
+		return;
+	}
+
+	sbuf[0] = PW_COMMAND_START_BYTE;
+	sbuf[1] = (unsigned char)command_length;
+	memcpy(sbuf + 2, command, command_length);
+	sbuf[command_length + 2] = calc_checksum(sbuf);
+
+	ser_send_buf(devfd, sbuf, command_length + 3);
+}
+
 /* XCP scan:
  *   baudrate nego (...)
  *   Send ESC to take it out of menu
@@ -221,14 +304,6 @@ static nutscan_device_t * nutscan_scan_eaton_serial_xcp(const char* port_name)
 	memset(sbuf, 0, 128);
 
 	if (VALID_FD_SER(devfd)) {
-#ifdef HAVE_PTHREAD
-		pthread_mutex_lock(&dev_mutex);
-#endif
-		upsfd = devfd;
-#ifdef HAVE_PTHREAD
-		pthread_mutex_unlock(&dev_mutex);
-#endif
-
 		for (i = 0; (pw_baud_rates[i].rate != 0) && (dev == NULL); i++)
 		{
 			memset(answer, 0, 256);
@@ -241,7 +316,7 @@ static nutscan_device_t * nutscan_scan_eaton_serial_xcp(const char* port_name)
 				break;
 
 			usleep(90000);
-			send_write_command(BCMXCP_AUTHCMD, 4);
+			xcp_send_command(devfd, BCMXCP_AUTHCMD, 4);
 			usleep(500000);
 
 			/* Discovery with Baud Hunting (XCP protocol spec. §4.1.2)
@@ -380,6 +455,28 @@ static nutscan_device_t * nutscan_scan_eaton_serial_q1(const char* port_name)
 	return dev;
 }
 
+/* Protocols tried in turn on each port (SHUT first, unless another one
+ * found more devices on the ports scanned so far: the ports of a serial
+ * concentrator tend to all have the same kind of UPS). A protocol which
+ * gets no reply costs seconds of timeouts, so this spares the later
+ * ports those of the protocols which did not find anything. */
+typedef nutscan_device_t * (*nutscan_eaton_serial_probe_t)(const char* port_name);
+
+static const struct {
+	const char	*name;
+	nutscan_eaton_serial_probe_t	probe;
+} eaton_serial_protocols[] = {
+	{ "SHUT", nutscan_scan_eaton_serial_shut },
+	{ "XCP", nutscan_scan_eaton_serial_xcp },
+	{ "Q1", nutscan_scan_eaton_serial_q1 }
+	/* Else try UTalk? */
+};
+
+#define EATON_SERIAL_PROTOCOLS	(sizeof(eaton_serial_protocols) / sizeof(eaton_serial_protocols[0]))
+
+/* Devices found by each of eaton_serial_protocols[] in this scan */
+static size_t eaton_serial_hits[EATON_SERIAL_PROTOCOLS];
+
 /* Wrap calls to actual implementations of nutscan_scan_eaton_serial_shut(),
  * nutscan_scan_eaton_serial_xcp() and/or nutscan_scan_eaton_serial_q1()
  * which implement the semantics of parallel-able scanning.
@@ -391,17 +488,42 @@ static void * nutscan_scan_eaton_serial_device_thready(void * port_arg)
 {
 	nutscan_device_t * dev = NULL;
 	char* port_name = (char*) port_arg;
+	size_t hits[EATON_SERIAL_PROTOCOLS], order[EATON_SERIAL_PROTOCOLS];
+	size_t i, j;
+
+#ifdef HAVE_PTHREAD
+	pthread_mutex_lock(&dev_mutex);
+#endif
+	memcpy(hits, eaton_serial_hits, sizeof(hits));
+#ifdef HAVE_PTHREAD
+	pthread_mutex_unlock(&dev_mutex);
+#endif
+
+	/* most found first, in the default order for as many */
+	for (i = 0; i < EATON_SERIAL_PROTOCOLS; i++) {
+		for (j = i; j > 0 && hits[order[j - 1]] < hits[i]; j--) {
+			order[j] = order[j - 1];
+		}
+		order[j] = i;
+	}
 
-	/* Try SHUT first */
-	if ((dev = nutscan_scan_eaton_serial_shut(port_name)) == NULL) {
-		usleep(100000);
-		/* Else, try XCP */
-		if ((dev = nutscan_scan_eaton_serial_xcp(port_name)) == NULL) {
-			/* Else, try Q1 */
+	for (i = 0; i < EATON_SERIAL_PROTOCOLS && dev == NULL; i++) {
+		if (i > 0) {
 			usleep(100000);
-			dev = nutscan_scan_eaton_serial_q1(port_name);
 		}
-		/* Else try UTalk? */
+
+		upsdebugx(3, "%s: trying %s on %s", __func__,
+			eaton_serial_protocols[order[i]].name, port_name);
+
+		if ((dev = eaton_serial_protocols[order[i]].probe(port_name)) != NULL) {
+#ifdef HAVE_PTHREAD
+			pthread_mutex_lock(&dev_mutex);
+#endif
+			eaton_serial_hits[order[i]]++;
+#ifdef HAVE_PTHREAD
+			pthread_mutex_unlock(&dev_mutex);
+#endif
+		}
 	}
 
 	return dev;
@@ -433,6 +555,8 @@ nutscan_device_t * nutscan_scan_eaton_serial(const char* ports_range)
 	pthread_mutex_init(&dev_mutex, NULL);
 #endif /* HAVE_PTHREAD */
 
+	memset(eaton_serial_hits, 0, sizeof(eaton_serial_hits));
+
 	/* 1) Get ports_list */
 	serial_ports_list = nutscan_get_serial_ports_list(ports_range);
 	if (serial_ports_list == NULL) {
@@ -459,6 +583,12 @@ nutscan_device_t * nutscan_scan_eaton_serial(const char* ports_range)
 	/* port(s) iterator */
 	current_port_nb = 0;
 	while (serial_ports_list[current_port_nb] != NULL) {
+		if (nutscan_deadline_passed()) {
+			upsdebugx(1, "%s: deadline passed, not scanning the ports left",
+				__func__);
+			break;
+		}
+
 #ifdef HAVE_PTHREAD
 		/* NOTE: With many enough targets to scan, this can crash
 		 * by spawning too many children; add a limit and loop to
@@ -814,6 +814,14 @@ nutscan_device_t * nutscan_scan_ip_range_ipmi(nutscan_ip_range_list_t * irl, nut
 		ip_str = nutscan_ip_ranges_iter_init(&ip, irl);
 
 		while (ip_str != NULL) {
+			if (nutscan_deadline_passed()) {
+				upsdebugx(1, "%s: deadline passed, not scanning the addresses left",
+					__func__);
+				free(ip_str);
+				ip_str = NULL;
+				break;
+			}
+
 #ifdef HAVE_PTHREAD
 			/* NOTE: With many enough targets to scan, this can crash
 			 * by spawning too many children; add a limit and loop to
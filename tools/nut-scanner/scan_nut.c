@@ -164,6 +164,72 @@ err:
 }
 /* end of dynamic link library stuff */
 
+/* Adds the device found as upsname on the NUT server at hostname:port
+ * to dev_ret */
+static void scan_nut_add_device(const char *upsname, const char *hostname, uint16_t port)
+{
+	nutscan_device_t * dev;
+	size_t buf_size;
+
+	/* FIXME: check for duplication by getting driver.port and device.serial
+	 * for comparison with other busses results */
+	/* FIXME:
+	 * - also print the description if != "Unavailable"?
+	 * - for upsmon.conf or ups.conf (using dummy-ups)? */
+	dev = nutscan_new_device();
+	dev->type = TYPE_NUT;
+	/* NOTE: There is no driver by such name, in practice it could
+	 * be a dummy-ups relay, a clone driver, or part of upsmon config */
+	dev->driver = strdup(SCAN_NUT_DRIVERNAME);
+	/* +1+1 is for '@' character and terminating 0,
+	 * and the other +1+1 is for possible '[' and ']'
+	 * around the host name:
+	 */
+	buf_size = strlen(upsname) + strlen(hostname) + 1 + 1 + 1 + 1;
+	if (port != PORT) {
+		/* colon and up to 5 digits */
+		buf_size += 6;
+	}
+
+	dev->port = malloc(buf_size);
+
+	if (dev->port) {
+		/* Check if IPv6 and needs brackets */
+		char	*hostname_colon = strchr(hostname, ':');
+
+		if (hostname_colon && *hostname_colon == '\0')
+			hostname_colon = NULL;
+		if (*hostname == '[')
+			hostname_colon = NULL;
+
+		if (port != PORT) {
+			if (hostname_colon) {
+				snprintf(dev->port, buf_size, "%s@[%s]:%" PRIu16,
+					upsname, hostname, port);
+			} else {
+				snprintf(dev->port, buf_size, "%s@%s:%" PRIu16,
+					upsname, hostname, port);
+			}
+		} else {
+			/* Standard port, not suffixed */
+			if (hostname_colon) {
+				snprintf(dev->port, buf_size, "%s@[%s]",
+					upsname, hostname);
+			} else {
+				snprintf(dev->port, buf_size, "%s@%s",
+					upsname, hostname);
+			}
+		}
+#ifdef HAVE_PTHREAD
+		pthread_mutex_lock(&dev_mutex);
+#endif
+		dev_ret = nutscan_add_device_to_device(dev_ret, dev);
+#ifdef HAVE_PTHREAD
+		pthread_mutex_unlock(&dev_mutex);
+#endif
+	}
+}
+
 /* FIXME: SSL support */
 /* Performs a (parallel-able) NUT protocol scan of one remote host:port.
  * Returns NULL, updates global dev_ret when a scan is successful.
@@ -180,8 +246,6 @@ static void * list_nut_devices_thready(void * arg)
 	char **answer = NULL;
 	char *hostname = NULL;
 	UPSCONN_t *ups = xcalloc(1, sizeof(*ups));
-	nutscan_device_t * dev = NULL;
-	size_t buf_size;
 
 	tv.tv_sec = nut_arg->timeout / (1000*1000);
 	tv.tv_usec = nut_arg->timeout % (1000*1000);
@@ -223,64 +287,7 @@ static void * list_nut_devices_thready(void * arg)
 			goto end;
 		}
 
-		/* FIXME: check for duplication by getting driver.port and device.serial
-		 * for comparison with other busses results */
-		/* FIXME:
-		 * - also print answer[2] if != "Unavailable"?
-		 * - for upsmon.conf or ups.conf (using dummy-ups)? */
-		dev = nutscan_new_device();
-		dev->type = TYPE_NUT;
-		/* NOTE: There is no driver by such name, in practice it could
-		 * be a dummy-ups relay, a clone driver, or part of upsmon config */
-		dev->driver = strdup(SCAN_NUT_DRIVERNAME);
-		/* +1+1 is for '@' character and terminating 0,
-		 * and the other +1+1 is for possible '[' and ']'
-		 * around the host name:
-		 */
-		buf_size = strlen(answer[1]) + strlen(hostname) + 1 + 1 + 1 + 1;
-		if (port != PORT) {
-			/* colon and up to 5 digits */
-			buf_size += 6;
-		}
-
-		dev->port = malloc(buf_size);
-
-		if (dev->port) {
-			/* Check if IPv6 and needs brackets */
-			char	*hostname_colon = strchr(hostname, ':');
-
-			if (hostname_colon && *hostname_colon == '\0')
-				hostname_colon = NULL;
-			if (*hostname == '[')
-				hostname_colon = NULL;
-
-			if (port != PORT) {
-				if (hostname_colon) {
-					snprintf(dev->port, buf_size, "%s@[%s]:%" PRIu16,
-						answer[1], hostname, port);
-				} else {
-					snprintf(dev->port, buf_size, "%s@%s:%" PRIu16,
-						answer[1], hostname, port);
-				}
-			} else {
-				/* Standard port, not suffixed */
-				if (hostname_colon) {
-					snprintf(dev->port, buf_size, "%s@[%s]",
-						answer[1], hostname);
-				} else {
-					snprintf(dev->port, buf_size, "%s@%s",
-						answer[1], hostname);
-				}
-			}
-#ifdef HAVE_PTHREAD
-			pthread_mutex_lock(&dev_mutex);
-#endif
-			dev_ret = nutscan_add_device_to_device(dev_ret, dev);
-#ifdef HAVE_PTHREAD
-			pthread_mutex_unlock(&dev_mutex);
-#endif
-		}
-
+		scan_nut_add_device(answer[1], hostname, port);
 	}
 
 end:
@@ -319,81 +326,109 @@ nutscan_device_t * nutscan_scan_nut(const char* start_ip, const char* stop_ip, c
 	return ndret;
 }
 
-nutscan_device_t * nutscan_scan_ip_range_nut(nutscan_ip_range_list_t * irl, const char* port, useconds_t usec_timeout)
+/* What the scan of one address needs besides it, see scan_nut_address() */
+struct scan_nut_range_arg {
+	const char * port;
+	useconds_t timeout;
+};
+
+/* Starts the scan of one address of a range, in a thread of the pool of
+ * nutscan_ip_ranges_run(); takes ownership of ip_str */
+static void scan_nut_address(char * ip_str, enum network_type type, void * arg)
 {
-	bool_t pass = TRUE; /* Track that we may spawn a scanning thread */
-	nutscan_ip_range_list_iter_t ip;
-	char * ip_str = NULL;
-	char * ip_dest = NULL;
+	struct scan_nut_range_arg * range_arg = (struct scan_nut_range_arg *)arg;
+	struct scan_nut_arg * nut_arg;
 	char buf[SMALLBUF];
-#ifndef WIN32
-	struct sigaction oldact;
-	int change_action_handler = 0;
-#endif	/* !WIN32 */
-	struct scan_nut_arg *nut_arg;
+	char * ip_dest;
 
-#ifdef HAVE_PTHREAD
-# if (defined HAVE_SEMAPHORE_UNNAMED) || (defined HAVE_SEMAPHORE_NAMED)
-	sem_t * semaphore = nutscan_semaphore();
-#  if (defined HAVE_SEMAPHORE_UNNAMED)
-	sem_t   semaphore_scantype_inst;
-	sem_t * semaphore_scantype = &semaphore_scantype_inst;
-#  elif (defined HAVE_SEMAPHORE_NAMED)
-	sem_t * semaphore_scantype = NULL;
-#  endif
-# endif /* HAVE_SEMAPHORE_UNNAMED || HAVE_SEMAPHORE_NAMED */
-	pthread_t thread;
-	nutscan_thread_t * thread_array = NULL;
-	size_t thread_count = 0, i;
-# if (defined HAVE_PTHREAD_TRYJOIN) || (defined HAVE_SEMAPHORE_UNNAMED) || (defined HAVE_SEMAPHORE_NAMED)
-	size_t  max_threads_scantype = max_threads_oldnut;
-# endif
+	if (range_arg->port) {
+		if (type == IPv4) {
+			snprintf(buf, sizeof(buf), "%s:%s", ip_str, range_arg->port);
+		}
+		else {
+			snprintf(buf, sizeof(buf), "[%s]:%s", ip_str, range_arg->port);
+		}
 
-	pthread_mutex_init(&dev_mutex, NULL);
+		ip_dest = strdup(buf);
+	}
+	else {
+		ip_dest = strdup(ip_str);
+	}
 
-# if (defined HAVE_SEMAPHORE_UNNAMED) || (defined HAVE_SEMAPHORE_NAMED)
-	if (max_threads_scantype > 0) {
-#ifdef HAVE_PRAGMAS_FOR_GCC_DIAGNOSTIC_IGNORED_UNREACHABLE_CODE
-#pragma GCC diagnostic push
-#endif
-#ifdef HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_UNREACHABLE_CODE
-#pragma GCC diagnostic ignored "-Wunreachable-code"
-#endif
-#ifdef __clang__
-#pragma clang diagnostic push
-#pragma clang diagnostic ignored "-Wunreachable-code"
-#endif
-		/* Different platforms, different sizes, none fits all... */
-		if (SIZE_MAX > UINT_MAX && max_threads_scantype > UINT_MAX) {
-#ifdef __clang__
-#pragma clang diagnostic pop
-#endif
-#ifdef HAVE_PRAGMAS_FOR_GCC_DIAGNOSTIC_IGNORED_UNREACHABLE_CODE
-#pragma GCC diagnostic pop
-#endif
-			upsdebugx(1,
-				"WARNING: %s: Limiting max_threads_scantype to range acceptable for " REPORT_SEM_INIT_METHOD "()",
-				__func__);
-			max_threads_scantype = UINT_MAX - 1;
+	free(ip_str);
+
+	if ((nut_arg = malloc(sizeof(struct scan_nut_arg))) == NULL) {
+		upsdebugx(0, "%s: Memory allocation error", __func__);
+		free(ip_dest);
+		return;
+	}
+
+	nut_arg->timeout = nutscan_deadline_clamp(range_arg->timeout);
+	nut_arg->hostname = ip_dest;
+
+	/* Note: the thready method releases nut_arg and ip_dest */
+	list_nut_devices_thready(nut_arg);
+}
+
+/* Takes the devices out of a reply to "LIST UPS" collected by
+ * nutscan_ip_ranges_probe() from the NUT server at ip_str:*arg */
+static void scan_nut_probe_reply(const char * ip_str, enum network_type type,
+	const char * reply, size_t len, void * arg)
+{
+	uint16_t port = *(uint16_t *)arg;
+	const char * line, * eol;
+
+	NUT_UNUSED_VARIABLE(type);
+	NUT_UNUSED_VARIABLE(len);
+
+	if (!reply) {
+		upsdebugx(3, "%s: %s:%" PRIu16 " did not reply", __func__, ip_str, port);
+		return;
+	}
+
+	/* BEGIN LIST UPS
+	 * UPS <upsname> "<description>"
+	 * END LIST UPS
+	 */
+	for (line = reply; *line; line = eol + 1) {
+		char upsname[SMALLBUF];
+		size_t namelen;
+
+		if ((eol = strchr(line, '\n')) == NULL) {
+			/* cut short by the timeout */
+			break;
 		}
 
-		upsdebugx(4, "%s: " REPORT_SEM_INIT_METHOD "() for %" PRIuSIZE " threads", __func__, max_threads_scantype);
-#  if (defined HAVE_SEMAPHORE_UNNAMED)
-		if (sem_init(semaphore_scantype, 0, (unsigned int)max_threads_scantype)) {
-			upsdebug_with_errno(4, "%s: " REPORT_SEM_INIT_METHOD "() failed", __func__);
-			max_threads_scantype = 0;
+		if (!strncmp(line, "ERR ", 4)) {
+			upsdebugx(2, "%s: %s:%" PRIu16 " refused to list devices: %.*s",
+				__func__, ip_str, port, (int)(eol - line), line);
+			break;
 		}
-#  elif (defined HAVE_SEMAPHORE_NAMED)
-		if (SEM_FAILED == (semaphore_scantype = sem_open(SEMNAME_UPSCLIENT, O_CREAT, 0644, (unsigned int)max_threads_scantype))) {
-			upsdebug_with_errno(4, "%s: " REPORT_SEM_INIT_METHOD "() failed", __func__);
-			semaphore_scantype = NULL;
-			max_threads_scantype = 0;
+
+		if (strncmp(line, "UPS ", 4)) {
+			continue;
 		}
-#  endif
+
+		line += 4;
+		namelen = strcspn(line, " \r\n");
+		if (namelen == 0 || namelen >= sizeof(upsname)) {
+			continue;
+		}
+
+		memcpy(upsname, line, namelen);
+		upsname[namelen] = '\0';
+		scan_nut_add_device(upsname, ip_str, port);
 	}
-# endif /* HAVE_SEMAPHORE_UNNAMED || HAVE_SEMAPHORE_NAMED */
+}
 
-#endif /* HAVE_PTHREAD */
+nutscan_device_t * nutscan_scan_ip_range_nut(nutscan_ip_range_list_t * irl, const char* port, useconds_t usec_timeout)
+{
+	struct scan_nut_range_arg range_arg;
+	uint16_t probe_port = PORT;
+#ifndef WIN32
+	struct sigaction oldact;
+	int change_action_handler = 0;
+#endif	/* !WIN32 */
 
 	if (!nutscan_avail_nut) {
 		return NULL;
@@ -416,6 +451,16 @@ nutscan_device_t * nutscan_scan_ip_range_nut(nutscan_ip_range_list_t * irl, cons
 			__func__, nutscan_stringify_ip_ranges(irl));
 	}
 
+	if (port) {
+		long l = strtol(port, NULL, 10);
+
+		if (l < 1 || l > 65535) {
+			upsdebugx(0, "%s: invalid port number '%s'", __func__, port);
+			return NULL;
+		}
+		probe_port = (uint16_t)l;
+	}
+
 #ifndef WIN32
 	/* Ignore SIGPIPE if the caller hasn't set a handler for it yet */
 	if (sigaction(SIGPIPE, NULL, &oldact) == 0) {
@@ -433,280 +478,25 @@ nutscan_device_t * nutscan_scan_ip_range_nut(nutscan_ip_range_list_t * irl, cons
 	}
 #endif	/* !WIN32 */
 
-	ip_str = nutscan_ip_ranges_iter_init(&ip, irl);
+	range_arg.port = port;
+	range_arg.timeout = usec_timeout;
 
-	while (ip_str != NULL) {
 #ifdef HAVE_PTHREAD
-		/* NOTE: With many enough targets to scan, this can crash
-		 * by spawning too many children; add a limit and loop to
-		 * "reap" some already done with their work. And probably
-		 * account them in thread_array[] as something to not wait
-		 * for below in pthread_join()...
-		 */
-
-# if (defined HAVE_SEMAPHORE_UNNAMED) || (defined HAVE_SEMAPHORE_NAMED)
-		/* Just wait for someone to free a semaphored slot,
-		 * if none are available, and then/otherwise grab one
-		 */
-		if (thread_array == NULL) {
-			/* Starting point, or after a wait to complete
-			 * all earlier runners */
-			if (max_threads_scantype > 0)
-				sem_wait(semaphore_scantype);
-			sem_wait(semaphore);
-			pass = TRUE;
-		} else {
-			/* If successful (the lock was acquired),
-			 * sem_wait() and sem_trywait() will return 0.
-			 * Otherwise, -1 is returned and errno is set,
-			 * and the state of the semaphore is unchanged.
-			 */
-			int	stwST = sem_trywait(semaphore_scantype);
-			int	stwS  = sem_trywait(semaphore);
-			pass = ((max_threads_scantype == 0 || stwST == 0) && stwS == 0);
-			upsdebugx(4, "%s: max_threads_scantype=%" PRIuSIZE
-				" curr_threads=%" PRIuSIZE
-				" thread_count=%" PRIuSIZE
-				" stwST=%d stwS=%d pass=%u",
-				__func__, max_threads_scantype,
-				curr_threads, thread_count,
-				stwST, stwS, pass
-			);
-		}
-# else
-#  ifdef HAVE_PTHREAD_TRYJOIN
-		/* A somewhat naive and brute-force solution for
-		 * systems without a semaphore.h. This may suffer
-		 * some off-by-one errors, using a few more threads
-		 * than intended (if we race a bit at the wrong time,
-		 * probably up to one per enabled scanner routine).
-		 */
-
-		/* TOTHINK: Should there be a threadcount_mutex when
-		 * we just read the value in if() and while() below?
-		 * At worst we would overflow the limit a bit due to
-		 * other protocol scanners...
-		 */
-		if (curr_threads >= max_threads
-		|| (curr_threads >= max_threads_scantype && max_threads_scantype > 0)
-		) {
-			upsdebugx(2, "%s: already running %" PRIuSIZE " scanning threads "
-				"(launched overall: %" PRIuSIZE "), "
-				"waiting until some would finish",
-				__func__, curr_threads, thread_count);
-
-			while (curr_threads >= max_threads
-			   || (curr_threads >= max_threads_scantype && max_threads_scantype > 0)
-			) {
-				for (i = 0; i < thread_count ; i++) {
-					int ret;
-
-					if (!thread_array[i].active) continue;
-
-					pthread_mutex_lock(&threadcount_mutex);
-					upsdebugx(3, "%s: Trying to join thread #%" PRIuSIZE "...", __func__, i);
-					ret = pthread_tryjoin_np(thread_array[i].thread, NULL);
-					switch (ret) {
-						case ESRCH:     /* No thread with the ID thread could be found - already "joined"? */
-							upsdebugx(5, "%s: Was thread #%" PRIuSIZE " joined earlier?", __func__, i);
-							break;
-						case 0:         /* thread exited */
-							if (curr_threads > 0) {
-								curr_threads --;
-								upsdebugx(4, "%s: Joined a finished thread #%" PRIuSIZE, __func__, i);
-							} else {
-								/* threadcount_mutex fault? */
-								upsdebugx(0, "WARNING: %s: Accounting of thread count "
-									"says we are already at 0", __func__);
-							}
-							thread_array[i].active = FALSE;
-							break;
-						case EBUSY:     /* actively running */
-							upsdebugx(6, "%s: thread #%" PRIuSIZE " still busy (%i)",
-								__func__, i, ret);
-							break;
-						case EDEADLK:   /* Errors with thread interactions... bail out? */
-						case EINVAL:    /* Errors with thread interactions... bail out? */
-						default:        /* new pthreads abilities? */
-							upsdebugx(5, "%s: thread #%" PRIuSIZE " reported code %i",
-								__func__, i, ret);
-							break;
-					}
-					pthread_mutex_unlock(&threadcount_mutex);
-				}
-
-				if (curr_threads >= max_threads
-				|| (curr_threads >= max_threads_scantype && max_threads_scantype > 0)
-				) {
-					usleep (10000); /* microSec's, so 0.01s here */
-				}
-			}
-			upsdebugx(2, "%s: proceeding with scan", __func__);
-		}
-
-		/* NOTE: No change to default "pass" in this ifdef:
-		 * if we got to this line, we have a slot to use */
-#  endif /* HAVE_PTHREAD_TRYJOIN */
-# endif  /* HAVE_SEMAPHORE_UNNAMED || HAVE_SEMAPHORE_NAMED */
-#endif   /* HAVE_PTHREAD */
-
-		if (pass) {
-			if (port) {
-				if (ip.curr_ip_iter.type == IPv4) {
-					snprintf(buf, sizeof(buf), "%s:%s", ip_str, port);
-				}
-				else {
-					snprintf(buf, sizeof(buf), "[%s]:%s", ip_str, port);
-				}
-
-				ip_dest = strdup(buf);
-			}
-			else {
-				ip_dest = strdup(ip_str);
-			}
-
-			if ((nut_arg = malloc(sizeof(struct scan_nut_arg))) == NULL) {
-				upsdebugx(0, "%s: Memory allocation error", __func__);
-				free(ip_dest);
-				break;
-			}
-
-			nut_arg->timeout = usec_timeout;
-			nut_arg->hostname = ip_dest;
+	pthread_mutex_init(&dev_mutex, NULL);
+#endif
 
-#ifdef HAVE_PTHREAD
-			if (pthread_create(&thread, NULL, list_nut_devices_thready, (void*)nut_arg) == 0) {
-				nutscan_thread_t	*new_thread_array;
-# ifdef HAVE_PTHREAD_TRYJOIN
-				pthread_mutex_lock(&threadcount_mutex);
-				curr_threads++;
-# endif /* HAVE_PTHREAD_TRYJOIN */
-
-				thread_count++;
-				new_thread_array = realloc(thread_array,
-					thread_count * sizeof(nutscan_thread_t));
-				if (new_thread_array == NULL) {
-					upsdebugx(1, "%s: Failed to realloc thread array", __func__);
-					break;
-				}
-				else {
-					thread_array = new_thread_array;
-				}
-				thread_array[thread_count - 1].thread = thread;
-				thread_array[thread_count - 1].active = TRUE;
-
-# ifdef HAVE_PTHREAD_TRYJOIN
-				pthread_mutex_unlock(&threadcount_mutex);
-# endif /* HAVE_PTHREAD_TRYJOIN */
-			}
-#else  /* if not HAVE_PTHREAD */
-			list_nut_devices_thready(nut_arg);
-#endif /* if HAVE_PTHREAD */
-
-			/* Prepare the next iteration; note that
-			 * nutscan_scan_ipmi_device_thready()
-			 * takes care of freeing "tmp_sec" and its
-			 * copy (note strdup!) of "ip_str" as
-			 * hostname, possibly suffixed with a port.
-			 */
-			free(ip_str);
-			ip_str = nutscan_ip_ranges_iter_inc(&ip);
-		} else { /* if not pass -- all slots busy */
-#ifdef HAVE_PTHREAD
-# if (defined HAVE_SEMAPHORE_UNNAMED) || (defined HAVE_SEMAPHORE_NAMED)
-			/* Wait for all current scans to complete */
-			if (thread_array != NULL) {
-				upsdebugx (2, "%s: Running too many scanning threads (%"
-					PRIuSIZE "), "
-					"waiting until older ones would finish",
-					__func__, thread_count);
-				for (i = 0; i < thread_count ; i++) {
-					int ret;
-					if (!thread_array[i].active) {
-						/* Probably should not get here,
-						 * but handle it just in case */
-						upsdebugx(0, "WARNING: %s: Midway clean-up: did not expect thread %" PRIuSIZE " to be not active",
-							__func__, i);
-						sem_post(semaphore);
-						if (max_threads_scantype > 0)
-							sem_post(semaphore_scantype);
-						continue;
-					}
-					thread_array[i].active = FALSE;
-					ret = pthread_join(thread_array[i].thread, NULL);
-					if (ret != 0) {
-						upsdebugx(0, "WARNING: %s: Midway clean-up: pthread_join() returned code %i",
-							__func__, ret);
-					}
-					sem_post(semaphore);
-					if (max_threads_scantype > 0)
-						sem_post(semaphore_scantype);
-				}
-				thread_count = 0;
-				free(thread_array);
-				thread_array = NULL;
-			}
-# else
-#  ifdef HAVE_PTHREAD_TRYJOIN
-			/* TODO: Move the wait-loop for TRYJOIN here? */
-#  endif /* HAVE_PTHREAD_TRYJOIN */
-# endif  /* HAVE_SEMAPHORE_UNNAMED || HAVE_SEMAPHORE_NAMED */
-#endif   /* HAVE_PTHREAD */
-		} /* if: could we "pass" or not? */
-	} /* while */
+	/* Connect to all of the addresses at once if we can, and see which
+	 * of them reply to "LIST UPS"; otherwise each thread of the pool
+	 * waits for one of them to connect */
+	if (nutscan_ip_ranges_probe(irl, probe_port, "LIST UPS\n", "END LIST UPS\n",
+		usec_timeout, 0, scan_nut_probe_reply, &probe_port) < 0
+	) {
+		nutscan_ip_ranges_run(irl, max_threads_oldnut, scan_nut_address, &range_arg);
+	}
 
 #ifdef HAVE_PTHREAD
-	if (thread_array != NULL) {
-		upsdebugx(2, "%s: all planned scans launched, waiting for threads to complete", __func__);
-		for (i = 0; i < thread_count; i++) {
-			int ret;
-
-			if (!thread_array[i].active) continue;
-
-			ret = pthread_join(thread_array[i].thread, NULL);
-			if (ret != 0) {
-				upsdebugx(0, "WARNING: %s: Clean-up: pthread_join() returned code %i",
-					__func__, ret);
-			}
-			thread_array[i].active = FALSE;
-# if (defined HAVE_SEMAPHORE_UNNAMED) || (defined HAVE_SEMAPHORE_NAMED)
-			sem_post(semaphore);
-			if (max_threads_scantype > 0)
-				sem_post(semaphore_scantype);
-# else
-#  ifdef HAVE_PTHREAD_TRYJOIN
-			pthread_mutex_lock(&threadcount_mutex);
-			if (curr_threads > 0) {
-				curr_threads --;
-				upsdebugx(5, "%s: Clean-up: Joined a finished thread #%" PRIuSIZE,
-					__func__, i);
-			} else {
-				upsdebugx(0, "WARNING: %s: Clean-up: Accounting of thread count "
-					"says we are already at 0", __func__);
-			}
-			pthread_mutex_unlock(&threadcount_mutex);
-#  endif /* HAVE_PTHREAD_TRYJOIN */
-# endif /* HAVE_SEMAPHORE_UNNAMED || HAVE_SEMAPHORE_NAMED */
-		}
-		free(thread_array);
-		upsdebugx(2, "%s: all threads freed", __func__);
-	}
 	pthread_mutex_destroy(&dev_mutex);
-
-# if (defined HAVE_SEMAPHORE_UNNAMED) || (defined HAVE_SEMAPHORE_NAMED)
-	if (max_threads_scantype > 0) {
-#  if (defined HAVE_SEMAPHORE_UNNAMED)
-		sem_destroy(semaphore_scantype);
-#  elif (defined HAVE_SEMAPHORE_NAMED)
-		if (semaphore_scantype) {
-			sem_unlink(SEMNAME_UPSCLIENT);
-			sem_close(semaphore_scantype);
-			semaphore_scantype = NULL;
-		}
-#  endif
-	}
-# endif /* HAVE_SEMAPHORE_UNNAMED || HAVE_SEMAPHORE_NAMED */
-#endif /* HAVE_PTHREAD */
+#endif
 
 #ifndef WIN32
 	if (change_action_handler) {
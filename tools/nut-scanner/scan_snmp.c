@@ -37,6 +37,10 @@ int nutscan_unload_snmp_library(void);
 
 #ifndef WIN32
 # include <sys/socket.h>
+# include <sys/select.h>
+# include <netinet/in.h>
+# include <arpa/inet.h>
+# include <netdb.h>
 #else	/* WIN32 */
 # undef _WIN32_WINNT
 #endif	/* WIN32 */
@@ -670,6 +674,15 @@ static void try_all_oid(void * arg, const char * mib_found)
 	}
 }
 
+/* The SNMPv3 keys hashed from the pass phrases, which are the same for all
+ * the hosts of a scan: made once before its threads start, as the hashing
+ * takes a megabyte of passes for each */
+static struct {
+	int	ready;
+	u_char	auth[USM_AUTH_KU_LEN], priv[USM_PRIV_KU_LEN];
+	size_t	authlen, privlen;
+} scan_keys;
+
 static int init_session(struct snmp_session * snmp_sess, nutscan_snmp_t * sec)
 {
 	(*nut_snmp_sess_init)(snmp_sess);
@@ -823,7 +836,11 @@ static int init_session(struct snmp_session * snmp_sess, nutscan_snmp_t * sec)
 				__func__, snmp_sess->securityAuthProtoLen);
 			return 0;
 		}
-		if ((*nut_generate_Ku)(snmp_sess->securityAuthProto,
+		if (scan_keys.ready) {
+			memcpy(snmp_sess->securityAuthKey, scan_keys.auth, scan_keys.authlen);
+			snmp_sess->securityAuthKeyLen = scan_keys.authlen;
+		}
+		else if ((*nut_generate_Ku)(snmp_sess->securityAuthProto,
 					(u_int)snmp_sess->securityAuthProtoLen,
 					(unsigned char *) sec->authPassword,
 					strlen(sec->authPassword),
@@ -912,7 +929,11 @@ static int init_session(struct snmp_session * snmp_sess, nutscan_snmp_t * sec)
 				__func__, snmp_sess->securityAuthProtoLen);
 			return 0;
 		}
-		if ((*nut_generate_Ku)(snmp_sess->securityAuthProto,
+		if (scan_keys.ready) {
+			memcpy(snmp_sess->securityPrivKey, scan_keys.priv, scan_keys.privlen);
+			snmp_sess->securityPrivKeyLen = scan_keys.privlen;
+		}
+		else if ((*nut_generate_Ku)(snmp_sess->securityAuthProto,
 					(u_int)snmp_sess->securityAuthProtoLen,
 					(unsigned char *) sec->privPassword,
 					strlen(sec->privPassword),
@@ -932,6 +953,30 @@ static int init_session(struct snmp_session * snmp_sess, nutscan_snmp_t * sec)
 	return 1;
 }
 
+/* hash the pass phrases of <sec> for all the hosts to come */
+static void scan_keys_make(nutscan_snmp_t * sec)
+{
+	struct snmp_session	snmp_sess;
+	nutscan_snmp_t	tmp_sec;
+
+	memset(&scan_keys, 0, sizeof(scan_keys));
+	if (sec->community != NULL || sec->secLevel == NULL) {
+		return;
+	}
+
+	memcpy(&tmp_sec, sec, sizeof(tmp_sec));
+	tmp_sec.peername = NULL;
+	if (init_session(&snmp_sess, &tmp_sec)) {
+		memcpy(scan_keys.auth, snmp_sess.securityAuthKey, snmp_sess.securityAuthKeyLen);
+		scan_keys.authlen = snmp_sess.securityAuthKeyLen;
+		memcpy(scan_keys.priv, snmp_sess.securityPrivKey, snmp_sess.securityPrivKeyLen);
+		scan_keys.privlen = snmp_sess.securityPrivKeyLen;
+		scan_keys.ready = 1;
+	}
+	free(snmp_sess.securityName);
+	memset(&snmp_sess, 0, sizeof(snmp_sess));
+}
+
 static void * wrap_nut_snmp_sess_open(struct snmp_session *session)
 {
 	/* Open the session */
@@ -942,6 +987,67 @@ static void * wrap_nut_snmp_sess_open(struct snmp_session *session)
  * Returns NULL, updates global dev_ret when a scan is successful.
  * FREES the caller's copy of "sec" and "peername" in it, if applicable.
  */
+/* The entries of snmp_device_table by their sysoid, parsed once per scan
+ * (before its threads start, which then only read it): a hash table of
+ * sysoid_index.size slots (a power of 2) holding 1 + the entry, 0 if free.
+ * The entries of a given sysoid follow each other in table order. */
+static struct {
+	size_t	*slot, size;
+	oid	**oids;		/* the sysoid of each entry, NULL if none */
+	size_t	*lens, n;
+} sysoid_index;
+
+static size_t sysoid_slot(const oid *name, size_t len)
+{
+	return fnv1a_hash(FNV1A_INIT, name, len * sizeof(*name)) & (sysoid_index.size - 1);
+}
+
+static void sysoid_index_make(void)
+{
+	oid	name[MAX_OID_LEN];
+	size_t	i, j, len;
+
+	for (sysoid_index.n = 0; snmp_device_table[sysoid_index.n].mib != NULL; sysoid_index.n++)
+		;
+	for (sysoid_index.size = 64; sysoid_index.size < sysoid_index.n * 2; sysoid_index.size *= 2)
+		;
+
+	sysoid_index.slot = xcalloc(sysoid_index.size, sizeof(*sysoid_index.slot));
+	sysoid_index.oids = xcalloc(sysoid_index.n, sizeof(*sysoid_index.oids));
+	sysoid_index.lens = xcalloc(sysoid_index.n, sizeof(*sysoid_index.lens));
+
+	for (i = 0; i < sysoid_index.n; i++) {
+		if (snmp_device_table[i].sysoid == NULL)
+			continue;
+
+		len = MAX_OID_LEN;
+		if (!(*nut_snmp_parse_oid)(snmp_device_table[i].sysoid, name, &len))
+			continue;
+
+		sysoid_index.oids[i] = xcalloc(len, sizeof(oid));
+		memcpy(sysoid_index.oids[i], name, len * sizeof(oid));
+		sysoid_index.lens[i] = len;
+
+		for (j = sysoid_slot(name, len); sysoid_index.slot[j] != 0;
+			j = (j + 1) & (sysoid_index.size - 1))
+			;
+		sysoid_index.slot[j] = i + 1;
+	}
+}
+
+static void sysoid_index_free(void)
+{
+	size_t	i;
+
+	for (i = 0; i < sysoid_index.n; i++) {
+		free(sysoid_index.oids[i]);
+	}
+	free(sysoid_index.oids);
+	free(sysoid_index.lens);
+	free(sysoid_index.slot);
+	memset(&sysoid_index, 0, sizeof(sysoid_index));
+}
+
 static void * try_SysOID_thready(void * arg)
 {
 	struct snmp_session snmp_sess;
@@ -950,7 +1056,7 @@ static void * try_SysOID_thready(void * arg)
 	oid name[MAX_OID_LEN];
 	size_t name_len = MAX_OID_LEN;
 	nutscan_snmp_t * sec = (nutscan_snmp_t *)arg;
-	int index = 0;
+	size_t index, slot;
 	char *mib_found = NULL;
 
 	upsdebugx(2, "Entering %s for %s", __func__, sec->peername);
@@ -962,9 +1068,13 @@ static void * try_SysOID_thready(void * arg)
 
 	snmp_sess.retries = 0;
 	/* netsnmp timeout is accounted in uS, but typed as long
-	 * and not useconds_t (which is at most long per POSIX)
+	 * and not useconds_t (which is at most long per POSIX);
+	 * its 0 would be the library default, not "no time left"
 	 */
-	snmp_sess.timeout = (long)g_usec_timeout;
+	snmp_sess.timeout = (long)nutscan_deadline_clamp(g_usec_timeout);
+	if (snmp_sess.timeout == 0) {
+		goto try_SysOID_free;
+	}
 
 	/* Open the session */
 	handle = wrap_nut_snmp_sess_open(&snmp_sess); /* establish the session */
@@ -1008,25 +1118,17 @@ static void * try_SysOID_thready(void * arg)
 		if (response->variables != NULL &&
 				response->variables->val.objid != NULL
 		) {
-			while (snmp_device_table[index].mib != NULL) {
-				if (snmp_device_table[index].sysoid == NULL) {
-					index++;
-					continue;
-				}
-				name_len = MAX_OID_LEN;
+			const oid	*objid = response->variables->val.objid;
+			size_t	objid_len = response->variables->val_len / sizeof(oid);
 
-				if (!(*nut_snmp_parse_oid)(
-					snmp_device_table[index].sysoid,
-					name, &name_len)
-				) {
-					index++;
-					continue;
-				}
+			for (slot = sysoid_slot(objid, objid_len);
+				sysoid_index.slot[slot] != 0;
+				slot = (slot + 1) & (sysoid_index.size - 1)
+			) {
+				index = sysoid_index.slot[slot] - 1;
 
-				if ((*nut_snmp_oid_compare)(
-					response->variables->val.objid,
-					response->variables->val_len/sizeof(oid),
-					name, name_len) == 0
+				if ((*nut_snmp_oid_compare)(objid, objid_len,
+					sysoid_index.oids[index], sysoid_index.lens[index]) == 0
 				) {
 					/* we have found a relevant sysoid */
 
@@ -1050,7 +1152,6 @@ static void * try_SysOID_thready(void * arg)
 						}
 					}
 				}
-				index++;
 			}
 		}
 
@@ -1101,77 +1202,343 @@ nutscan_device_t * nutscan_scan_snmp(const char * start_ip, const char * stop_ip
 	return ndret;
 }
 
-nutscan_device_t * nutscan_scan_ip_range_snmp(nutscan_ip_range_list_t * irl,
-                                     useconds_t usec_timeout, nutscan_snmp_t * sec)
+/* Starts the scan of one address of a range, in a thread of the pool of
+ * nutscan_ip_ranges_run(); takes ownership of ip_str */
+static void scan_snmp_address(char * ip_str, enum network_type type, void * arg)
 {
-	bool_t pass = TRUE; /* Track that we may spawn a scanning thread */
-	nutscan_device_t * result;
+	nutscan_snmp_t * sec = (nutscan_snmp_t *)arg;
 	nutscan_snmp_t * tmp_sec;
-	nutscan_ip_range_list_iter_t ip;
-	char * ip_str = NULL;
 
-#ifdef HAVE_PTHREAD
-# if (defined HAVE_SEMAPHORE_UNNAMED) || (defined HAVE_SEMAPHORE_NAMED)
-	sem_t * semaphore = nutscan_semaphore();
-#  if (defined HAVE_SEMAPHORE_UNNAMED)
-	sem_t   semaphore_scantype_inst;
-	sem_t * semaphore_scantype = &semaphore_scantype_inst;
-#  elif (defined HAVE_SEMAPHORE_NAMED)
-	sem_t * semaphore_scantype = NULL;
-#  endif
-# endif /* HAVE_SEMAPHORE_UNNAMED || HAVE_SEMAPHORE_NAMED */
-	pthread_t thread;
-	nutscan_thread_t * thread_array = NULL;
-	size_t thread_count = 0, i;
-# if (defined HAVE_PTHREAD_TRYJOIN) || (defined HAVE_SEMAPHORE_UNNAMED) || (defined HAVE_SEMAPHORE_NAMED)
-	size_t  max_threads_scantype = max_threads_netsnmp;
-# endif
+	NUT_UNUSED_VARIABLE(type);
 
-	pthread_mutex_init(&dev_mutex, NULL);
+	tmp_sec = malloc(sizeof(nutscan_snmp_t));
+	if (tmp_sec == NULL) {
+		upsdebugx(0, "%s: Memory allocation error", __func__);
+		free(ip_str);
+		return;
+	}
 
-# if (defined HAVE_SEMAPHORE_UNNAMED) || (defined HAVE_SEMAPHORE_NAMED)
-	if (max_threads_scantype > 0) {
-#ifdef HAVE_PRAGMAS_FOR_GCC_DIAGNOSTIC_IGNORED_UNREACHABLE_CODE
-#pragma GCC diagnostic push
-#endif
-#ifdef HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_UNREACHABLE_CODE
-#pragma GCC diagnostic ignored "-Wunreachable-code"
-#endif
-#ifdef __clang__
-#pragma clang diagnostic push
-#pragma clang diagnostic ignored "-Wunreachable-code"
-#endif
-		/* Different platforms, different sizes, none fits all... */
-		if (SIZE_MAX > UINT_MAX && max_threads_scantype > UINT_MAX) {
-#ifdef __clang__
-#pragma clang diagnostic pop
-#endif
-#ifdef HAVE_PRAGMAS_FOR_GCC_DIAGNOSTIC_IGNORED_UNREACHABLE_CODE
-#pragma GCC diagnostic pop
-#endif
-			upsdebugx(1,
-				"WARNING: %s: Limiting max_threads_scantype to range acceptable for " REPORT_SEM_INIT_METHOD "()",
-				__func__);
-			max_threads_scantype = UINT_MAX - 1;
+	memcpy(tmp_sec, sec, sizeof(nutscan_snmp_t));
+	tmp_sec->peername = ip_str;
+
+	/* Note: the thready method releases "tmp_sec" and its
+	 * reference (NOT strdup!) to "ip_str" as peername */
+	try_SysOID_thready(tmp_sec);
+}
+
+/* Datagrams sent by scan_snmp_sweep() between looks at the replies */
+#define SNMP_SWEEP_BURST	256
+/* Rounds of scan_snmp_sweep(), the later ones only to silent addresses */
+#define SNMP_SWEEP_ROUNDS	2
+
+/* Addresses which replied to scan_snmp_sweep() */
+typedef struct {
+	struct sockaddr_storage * addr;
+	size_t count;
+} scan_snmp_replied_t;
+
+/* Appends a BER length to buf at *pos */
+static void scan_snmp_ber_len(unsigned char * buf, size_t * pos, size_t len)
+{
+	if (len < 0x80) {
+		buf[(*pos)++] = (unsigned char)len;
+	} else {
+		buf[(*pos)++] = 0x82;
+		buf[(*pos)++] = (unsigned char)(len >> 8);
+		buf[(*pos)++] = (unsigned char)(len & 0xff);
+	}
+}
+
+/* Builds an SNMPv1 GetRequest for sysObjectID.0 (see SysOID) with the
+ * community into buf, as net-snmp would send it to each address; returns
+ * its length, or 0 if the community does not fit */
+static size_t scan_snmp_sweep_request(unsigned char * buf, size_t bufsize, const char * community)
+{
+	/* request-id, error-status, error-index; and the one variable
+	 * binding of OID 1.3.6.1.2.1.1.2.0 to NULL */
+	static const unsigned char pdu[] = {
+		0x02, 0x04, 0x4e, 0x55, 0x54, 0x53,
+		0x02, 0x01, 0x00,
+		0x02, 0x01, 0x00,
+		0x30, 0x0e, 0x30, 0x0c,
+		0x06, 0x08, 0x2b, 0x06, 0x01, 0x02, 0x01, 0x01, 0x02, 0x00,
+		0x05, 0x00
+	};
+	size_t clen = strlen(community), msglen, pos = 0;
+
+	if (clen > 1024 || bufsize < clen + sizeof(pdu) + 16) {
+		return 0;
+	}
+
+	/* version 0 (SNMPv1), community, GetRequest-PDU */
+	msglen = 3 + 1 + (clen < 0x80 ? 1 : 3) + clen + 2 + sizeof(pdu);
+
+	buf[pos++] = 0x30;
+	scan_snmp_ber_len(buf, &pos, msglen);
+	buf[pos++] = 0x02;
+	buf[pos++] = 0x01;
+	buf[pos++] = 0x00;
+	buf[pos++] = 0x04;
+	scan_snmp_ber_len(buf, &pos, clen);
+	memcpy(buf + pos, community, clen);
+	pos += clen;
+	buf[pos++] = 0xa0;
+	buf[pos++] = (unsigned char)sizeof(pdu);
+	memcpy(buf + pos, pdu, sizeof(pdu));
+	pos += sizeof(pdu);
+
+	return pos;
+}
+
+/* Skips the BER header at *pos of buf[len] which should have the tag;
+ * returns the length of its contents, or -1 if it is not there */
+static long scan_snmp_ber_skip(const unsigned char * buf, size_t len, size_t * pos, unsigned char tag)
+{
+	size_t l, n;
+
+	if (*pos + 2 > len || buf[*pos] != tag) {
+		return -1;
+	}
+	l = buf[*pos + 1];
+	*pos += 2;
+	if (l & 0x80) {
+		n = l & 0x7f;
+		if (n == 0 || n > 2 || *pos + n > len) {
+			return -1;
+		}
+		for (l = 0; n > 0; n--) {
+			l = (l << 8) | buf[(*pos)++];
 		}
+	}
+	if (*pos + l > len) {
+		return -1;
+	}
+	return (long)l;
+}
+
+/* Is buf[len] an SNMP GetResponse to scan_snmp_sweep_request()? Any
+ * version goes, the agent gets asked properly by try_SysOID_thready() */
+static int scan_snmp_sweep_is_reply(const unsigned char * buf, size_t len)
+{
+	size_t pos = 0;
+	long l;
+
+	if (scan_snmp_ber_skip(buf, len, &pos, 0x30) < 0
+	 || (l = scan_snmp_ber_skip(buf, len, &pos, 0x02)) < 0
+	) {
+		return 0;
+	}
+	pos += (size_t)l;
+	if ((l = scan_snmp_ber_skip(buf, len, &pos, 0x04)) < 0) {
+		return 0;
+	}
+	pos += (size_t)l;
+
+	return scan_snmp_ber_skip(buf, len, &pos, 0xa2) >= 0;
+}
 
-		upsdebugx(4, "%s: " REPORT_SEM_INIT_METHOD "() for %" PRIuSIZE " threads", __func__, max_threads_scantype);
-#  if (defined HAVE_SEMAPHORE_UNNAMED)
-		if (sem_init(semaphore_scantype, 0, (unsigned int)max_threads_scantype)) {
-			upsdebug_with_errno(4, "%s: " REPORT_SEM_INIT_METHOD "() failed", __func__);
-			max_threads_scantype = 0;
+static int scan_snmp_sweep_replied(const scan_snmp_replied_t * replied,
+	const struct sockaddr_storage * sa)
+{
+	size_t i;
+
+	for (i = 0; i < replied->count; i++) {
+		const struct sockaddr_storage * r = &replied->addr[i];
+
+		if (r->ss_family != sa->ss_family) {
+			continue;
+		}
+		if (sa->ss_family == AF_INET
+		 && ((const struct sockaddr_in *)r)->sin_addr.s_addr == ((const struct sockaddr_in *)sa)->sin_addr.s_addr
+		) {
+			return 1;
 		}
-#  elif (defined HAVE_SEMAPHORE_NAMED)
-		if (SEM_FAILED == (semaphore_scantype = sem_open(SEMNAME_SNMP, O_CREAT, 0644, (unsigned int)max_threads_scantype))) {
-			upsdebug_with_errno(4, "%s: " REPORT_SEM_INIT_METHOD "() failed", __func__);
-			semaphore_scantype = NULL;
-			max_threads_scantype = 0;
+		if (sa->ss_family == AF_INET6
+		 && !memcmp(&((const struct sockaddr_in6 *)r)->sin6_addr, &((const struct sockaddr_in6 *)sa)->sin6_addr, sizeof(struct in6_addr))
+		) {
+			return 1;
 		}
-#  endif
 	}
-# endif /* HAVE_SEMAPHORE_UNNAMED || HAVE_SEMAPHORE_NAMED */
 
-#endif /* HAVE_PTHREAD */
+	return 0;
+}
+
+/* Collects the replies waiting on the sockets, for up to usec_timeout
+ * after the last one (or none at all), into replied and irl_found */
+static void scan_snmp_sweep_collect(const int * sockets, useconds_t usec_timeout,
+	scan_snmp_replied_t * replied, nutscan_ip_range_list_t * irl_found)
+{
+	unsigned char buf[LARGEBUF];
+	char string[SMALLBUF];
+
+	for (;;) {
+		struct timeval timeout;
+		useconds_t usec_left;
+		fd_set fds;
+		int maxfd = -1, i;
+
+		FD_ZERO(&fds);
+		for (i = 0; i < 2; i++) {
+			if (sockets[i] >= 0) {
+				FD_SET(sockets[i], &fds);
+				if (sockets[i] > maxfd) {
+					maxfd = sockets[i];
+				}
+			}
+		}
+		if (maxfd < 0) {
+			return;
+		}
+
+		usec_left = nutscan_deadline_clamp(usec_timeout);
+		timeout.tv_sec = usec_left / 1000000;
+		timeout.tv_usec = usec_left % 1000000;
+		if (select(maxfd + 1, &fds, NULL, NULL, &timeout) <= 0) {
+			return;
+		}
+
+		for (i = 0; i < 2; i++) {
+			struct sockaddr_storage sa;
+			socklen_t salen = sizeof(sa);
+			struct sockaddr_storage * new_addr;
+			ssize_t recv_size;
+
+			if (sockets[i] < 0 || !FD_ISSET(sockets[i], &fds)) {
+				continue;
+			}
+
+			recv_size = recvfrom(sockets[i], (char *)buf, sizeof(buf), 0,
+				(struct sockaddr *)&sa, &salen);
+			if (recv_size <= 0
+			 || !scan_snmp_sweep_is_reply(buf, (size_t)recv_size)
+			 || scan_snmp_sweep_replied(replied, &sa)
+			) {
+				continue;
+			}
+
+			if (getnameinfo((struct sockaddr *)&sa, salen, string, sizeof(string),
+				NULL, 0, NI_NUMERICHOST) != 0
+			) {
+				continue;
+			}
+
+			new_addr = realloc(replied->addr, (replied->count + 1) * sizeof(*new_addr));
+			if (new_addr == NULL) {
+				upsdebugx(0, "%s: Memory allocation error", __func__);
+				return;
+			}
+			replied->addr = new_addr;
+			replied->addr[replied->count++] = sa;
+
+			upsdebugx(3, "%s: SNMP agent found at %s", __func__, string);
+			if (sa.ss_family == AF_INET6) {
+				/* as the iterator would have it, see try_SysOID_thready() */
+				char	bracketed[SMALLBUF + 2];
+
+				snprintf(bracketed, sizeof(bracketed), "[%s]", string);
+				nutscan_add_ip_range(irl_found, xstrdup(bracketed), NULL);
+			} else {
+				nutscan_add_ip_range(irl_found, xstrdup(string), NULL);
+			}
+		}
+	}
+}
+
+/* Sends a GET of sysObjectID.0 to each address of the ranges, in bursts
+ * from one socket per address family, and lists in irl_found those which
+ * replied: try_SysOID_thready() then only waits on agents which are there.
+ * Returns 0, or -1 if that could not be done so all addresses should be
+ * tried in turn. Only for SNMPv1 communities, as SNMPv3 needs a session
+ * (and engine ID discovery) to get any reply at all. */
+static int scan_snmp_sweep(const nutscan_ip_range_list_t * irl, const nutscan_snmp_t * sec,
+	useconds_t usec_timeout, nutscan_ip_range_list_t * irl_found)
+{
+	unsigned char request[LARGEBUF];
+	size_t request_len;
+	int sockets[2] = { -1, -1 };	/* IPv4, IPv6; -2 if none could be had */
+	scan_snmp_replied_t replied = { NULL, 0 };
+	int round, usable = 0;
+
+	if (sec->community == NULL && sec->secLevel != NULL) {
+		return -1;
+	}
+
+	request_len = scan_snmp_sweep_request(request, sizeof(request),
+		sec->community ? sec->community : "public");
+	if (request_len == 0) {
+		return -1;
+	}
+
+	for (round = 0; round < SNMP_SWEEP_ROUNDS && !nutscan_deadline_passed(); round++) {
+		nutscan_ip_range_list_iter_t iter;
+		nutscan_ip_addr_t ip;
+		int more;
+		size_t sent = 0;
+
+		for (more = nutscan_ip_ranges_iter_init_addr(&iter, irl, &ip);
+			more && !nutscan_deadline_passed();
+			more = nutscan_ip_ranges_iter_inc_addr(&iter, &ip)
+		) {
+			struct sockaddr_storage sa;
+			socklen_t salen = nutscan_ip_addr_to_sockaddr(&ip, SNMP_PORT, &sa);
+			int family = (ip.type == IPv4) ? 0 : 1;
+
+			if (scan_snmp_sweep_replied(&replied, &sa)) {
+				continue;
+			}
+
+			if (sockets[family] == -1) {
+				if ((sockets[family] = socket(sa.ss_family, SOCK_DGRAM, 0)) < 0) {
+					upsdebug_with_errno(1, "%s: Error creating socket", __func__);
+					sockets[family] = -2;
+				} else {
+					usable = 1;
+				}
+			}
+			if (sockets[family] < 0) {
+				continue;
+			}
+
+			if (sendto(sockets[family], (const char *)request, request_len, 0,
+				(struct sockaddr *)&sa, salen) <= 0
+			) {
+				upsdebug_with_errno(3, "%s: Error sending SNMP request", __func__);
+				continue;
+			}
+
+			/* pick up what came back meanwhile, before it overflows */
+			if (++sent % SNMP_SWEEP_BURST == 0) {
+				scan_snmp_sweep_collect(sockets, 1000, &replied, irl_found);
+			}
+		}
+
+		upsdebugx(2, "%s: round %d of %d sent %" PRIuSIZE " requests",
+			__func__, (round + 1), SNMP_SWEEP_ROUNDS, sent);
+
+		if (sent == 0) {
+			break;
+		}
+
+		scan_snmp_sweep_collect(sockets, usec_timeout, &replied, irl_found);
+	}
+
+	if (sockets[0] >= 0)
+		close(sockets[0]);
+	if (sockets[1] >= 0)
+		close(sockets[1]);
+
+	upsdebugx(2, "%s: %" PRIuSIZE " SNMP agents replied", __func__, replied.count);
+
+	free(replied.addr);
+
+	return usable ? 0 : -1;
+}
+
+nutscan_device_t * nutscan_scan_ip_range_snmp(nutscan_ip_range_list_t * irl,
+                                     useconds_t usec_timeout, nutscan_snmp_t * sec)
+{
+	nutscan_device_t * result;
+	nutscan_ip_range_list_t irl_found;
 
 	if (!nutscan_avail_snmp) {
 		return NULL;
@@ -1205,265 +1572,30 @@ nutscan_device_t * nutscan_scan_ip_range_snmp(nutscan_ip_range_list_t * irl,
 	/* Initialize the SNMP library */
 	init_snmp_once();
 
-	ip_str = nutscan_ip_ranges_iter_init(&ip, irl);
-
-	while (ip_str != NULL) {
-#ifdef HAVE_PTHREAD
-		/* NOTE: With many enough targets to scan, this can crash
-		 * by spawning too many children; add a limit and loop to
-		 * "reap" some already done with their work. And probably
-		 * account them in thread_array[] as something to not wait
-		 * for below in pthread_join()...
-		 */
-
-# if (defined HAVE_SEMAPHORE_UNNAMED) || (defined HAVE_SEMAPHORE_NAMED)
-		/* Just wait for someone to free a semaphored slot,
-		 * if none are available, and then/otherwise grab one
-		 */
-		if (thread_array == NULL) {
-			/* Starting point, or after a wait to complete
-			 * all earlier runners */
-			if (max_threads_scantype > 0)
-				sem_wait(semaphore_scantype);
-			sem_wait(semaphore);
-			pass = TRUE;
-		} else {
-			/* If successful (the lock was acquired),
-			 * sem_wait() and sem_trywait() will return 0.
-			 * Otherwise, -1 is returned and errno is set,
-			 * and the state of the semaphore is unchanged.
-			 */
-			int	stwST = sem_trywait(semaphore_scantype);
-			int	stwS  = sem_trywait(semaphore);
-			pass = ((max_threads_scantype == 0 || stwST == 0) && stwS == 0);
-			upsdebugx(4, "%s: max_threads_scantype=%" PRIuSIZE
-				" curr_threads=%" PRIuSIZE
-				" thread_count=%" PRIuSIZE
-				" stwST=%d stwS=%d pass=%d",
-				__func__, max_threads_scantype,
-				curr_threads, thread_count,
-				stwST, stwS, pass
-			);
-		}
-# else
-#  ifdef HAVE_PTHREAD_TRYJOIN
-		/* A somewhat naive and brute-force solution for
-		 * systems without a semaphore.h. This may suffer
-		 * some off-by-one errors, using a few more threads
-		 * than intended (if we race a bit at the wrong time,
-		 * probably up to one per enabled scanner routine).
-		 */
-
-		/* TOTHINK: Should there be a threadcount_mutex when
-		 * we just read the value in if() and while() below?
-		 * At worst we would overflow the limit a bit due to
-		 * other protocol scanners...
-		 */
-		if (curr_threads >= max_threads
-		|| (curr_threads >= max_threads_scantype && max_threads_scantype > 0)
-		) {
-			upsdebugx(2, "%s: already running %" PRIuSIZE " scanning threads "
-				"(launched overall: %" PRIuSIZE "), "
-				"waiting until some would finish",
-				__func__, curr_threads, thread_count);
-
-			while (curr_threads >= max_threads
-			   || (curr_threads >= max_threads_scantype && max_threads_scantype > 0)
-			) {
-				for (i = 0; i < thread_count ; i++) {
-					int ret;
-
-					if (!thread_array[i].active) continue;
-
-					pthread_mutex_lock(&threadcount_mutex);
-					upsdebugx(3, "%s: Trying to join thread #%" PRIuSIZE "...", __func__, i);
-					ret = pthread_tryjoin_np(thread_array[i].thread, NULL);
-					switch (ret) {
-						case ESRCH:     /* No thread with the ID thread could be found - already "joined"? */
-							upsdebugx(5, "%s: Was thread #%" PRIuSIZE " joined earlier?", __func__, i);
-							break;
-						case 0:         /* thread exited */
-							if (curr_threads > 0) {
-								curr_threads --;
-								upsdebugx(4, "%s: Joined a finished thread #%" PRIuSIZE, __func__, i);
-							} else {
-								/* threadcount_mutex fault? */
-								upsdebugx(0, "WARNING: %s: Accounting of thread count "
-									"says we are already at 0", __func__);
-							}
-							thread_array[i].active = FALSE;
-							break;
-						case EBUSY:     /* actively running */
-							upsdebugx(6, "%s: thread #%" PRIuSIZE " still busy (%i)",
-								__func__, i, ret);
-							break;
-						case EDEADLK:   /* Errors with thread interactions... bail out? */
-						case EINVAL:    /* Errors with thread interactions... bail out? */
-						default:        /* new pthreads abilities? */
-							upsdebugx(5, "%s: thread #%" PRIuSIZE " reported code %i",
-								__func__, i, ret);
-							break;
-					}
-					pthread_mutex_unlock(&threadcount_mutex);
-				}
-
-				if (curr_threads >= max_threads
-				|| (curr_threads >= max_threads_scantype && max_threads_scantype > 0)
-				) {
-					usleep (10000); /* microSec's, so 0.01s here */
-				}
-			}
-			upsdebugx(2, "%s: proceeding with scan", __func__);
-		}
-
-		/* NOTE: No change to default "pass" in this ifdef:
-		 * if we got to this line, we have a slot to use */
-#  endif /* HAVE_PTHREAD_TRYJOIN */
-# endif  /* HAVE_SEMAPHORE_UNNAMED || HAVE_SEMAPHORE_NAMED */
-#endif   /* HAVE_PTHREAD */
-
-		if (pass) {
-			tmp_sec = malloc(sizeof(nutscan_snmp_t));
-			if (tmp_sec == NULL) {
-				upsdebugx(0, "%s: Memory allocation error", __func__);
-				break;
-			}
-
-			memcpy(tmp_sec, sec, sizeof(nutscan_snmp_t));
-			tmp_sec->peername = ip_str;
+	/* ...and find the known sysoids in one lookup per device */
+	sysoid_index_make();
+	scan_keys_make(sec);
 
 #ifdef HAVE_PTHREAD
-			if (pthread_create(&thread, NULL, try_SysOID_thready, (void*)tmp_sec) == 0) {
-				nutscan_thread_t	*new_thread_array;
-# ifdef HAVE_PTHREAD_TRYJOIN
-				pthread_mutex_lock(&threadcount_mutex);
-				curr_threads++;
-# endif /* HAVE_PTHREAD_TRYJOIN */
-
-				thread_count++;
-				new_thread_array = realloc(thread_array,
-					thread_count * sizeof(nutscan_thread_t));
-				if (new_thread_array == NULL) {
-					upsdebugx(1, "%s: Failed to realloc thread array", __func__);
-					break;
-				}
-				else {
-					thread_array = new_thread_array;
-				}
-				thread_array[thread_count - 1].thread = thread;
-				thread_array[thread_count - 1].active = TRUE;
+	pthread_mutex_init(&dev_mutex, NULL);
+#endif
 
-# ifdef HAVE_PTHREAD_TRYJOIN
-				pthread_mutex_unlock(&threadcount_mutex);
-# endif /* HAVE_PTHREAD_TRYJOIN */
-			}
-#else   /* if not HAVE_PTHREAD */
-			try_SysOID_thready(tmp_sec);
-#endif  /* if HAVE_PTHREAD */
-
-			/* Prepare the next iteration; note that
-			 * try_SysOID_thready()
-			 * takes care of freeing "tmp_sec" and its
-			 * reference (NOT strdup!) to "ip_str" as
-			 * peername.
-			 */
-			ip_str = nutscan_ip_ranges_iter_inc(&ip);
-		} else { /* if not pass -- all slots busy */
-#ifdef HAVE_PTHREAD
-# if (defined HAVE_SEMAPHORE_UNNAMED) || (defined HAVE_SEMAPHORE_NAMED)
-			/* Wait for all current scans to complete */
-			if (thread_array != NULL) {
-				upsdebugx (2, "%s: Running too many scanning threads (%"
-					PRIuSIZE "), "
-					"waiting until older ones would finish",
-					__func__, thread_count);
-				for (i = 0; i < thread_count ; i++) {
-					int ret;
-					if (!thread_array[i].active) {
-						/* Probably should not get here,
-						 * but handle it just in case */
-						upsdebugx(0, "WARNING: %s: Midway clean-up: did not expect thread %" PRIuSIZE " to be not active",
-							__func__, i);
-						sem_post(semaphore);
-						if (max_threads_scantype > 0)
-							sem_post(semaphore_scantype);
-						continue;
-					}
-					thread_array[i].active = FALSE;
-					ret = pthread_join(thread_array[i].thread, NULL);
-					if (ret != 0) {
-						upsdebugx(0, "WARNING: %s: Midway clean-up: pthread_join() returned code %i",
-							__func__, ret);
-					}
-					sem_post(semaphore);
-					if (max_threads_scantype > 0)
-						sem_post(semaphore_scantype);
-				}
-				thread_count = 0;
-				free(thread_array);
-				thread_array = NULL;
-			}
-# else
-#  ifdef HAVE_PTHREAD_TRYJOIN
-			/* TODO: Move the wait-loop for TRYJOIN here? */
-#  endif /* HAVE_PTHREAD_TRYJOIN */
-# endif  /* HAVE_SEMAPHORE_UNNAMED || HAVE_SEMAPHORE_NAMED */
-#endif   /* HAVE_PTHREAD */
-		} /* if: could we "pass" or not? */
-	} /* while */
+	/* Only the addresses with an agent replying to a community GET are
+	 * worth a session each; SNMPv3 ones are all tried in turn */
+	nutscan_init_ip_ranges(&irl_found);
+	if (scan_snmp_sweep(irl, sec, usec_timeout, &irl_found) < 0) {
+		nutscan_ip_ranges_run(irl, max_threads_netsnmp, scan_snmp_address, sec);
+	} else if (irl_found.ip_ranges_count > 0) {
+		nutscan_ip_ranges_run(&irl_found, max_threads_netsnmp, scan_snmp_address, sec);
+	}
+	nutscan_free_ip_ranges(&irl_found);
 
 #ifdef HAVE_PTHREAD
-	if (thread_array != NULL) {
-		upsdebugx(2, "%s: all planned scans launched, waiting for threads to complete", __func__);
-		for (i = 0; i < thread_count; i++) {
-			int ret;
-
-			if (!thread_array[i].active) continue;
-
-			ret = pthread_join(thread_array[i].thread, NULL);
-			if (ret != 0) {
-				upsdebugx(0, "WARNING: %s: Clean-up: pthread_join() returned code %i",
-					__func__, ret);
-			}
-			thread_array[i].active = FALSE;
-# if (defined HAVE_SEMAPHORE_UNNAMED) || (defined HAVE_SEMAPHORE_NAMED)
-			sem_post(semaphore);
-			if (max_threads_scantype > 0)
-				sem_post(semaphore_scantype);
-# else
-#  ifdef HAVE_PTHREAD_TRYJOIN
-			pthread_mutex_lock(&threadcount_mutex);
-			if (curr_threads > 0) {
-				curr_threads --;
-				upsdebugx(5, "%s: Clean-up: Joined a finished thread #%" PRIuSIZE,
-					__func__, i);
-			} else {
-				upsdebugx(0, "WARNING: %s: Clean-up: Accounting of thread count "
-					"says we are already at 0", __func__);
-			}
-			pthread_mutex_unlock(&threadcount_mutex);
-#  endif /* HAVE_PTHREAD_TRYJOIN */
-# endif /* HAVE_SEMAPHORE_UNNAMED || HAVE_SEMAPHORE_NAMED */
-		}
-		free(thread_array);
-		upsdebugx(2, "%s: all threads freed", __func__);
-	}
 	pthread_mutex_destroy(&dev_mutex);
+#endif
 
-# if (defined HAVE_SEMAPHORE_UNNAMED) || (defined HAVE_SEMAPHORE_NAMED)
-	if (max_threads_scantype > 0) {
-#  if (defined HAVE_SEMAPHORE_UNNAMED)
-		sem_destroy(semaphore_scantype);
-#  elif (defined HAVE_SEMAPHORE_NAMED)
-		if (semaphore_scantype) {
-			sem_unlink(SEMNAME_SNMP);
-			sem_close(semaphore_scantype);
-			semaphore_scantype = NULL;
-		}
-#  endif
-	}
-# endif /* HAVE_SEMAPHORE_UNNAMED || HAVE_SEMAPHORE_NAMED */
-#endif /* HAVE_PTHREAD */
+	sysoid_index_free();
+	memset(&scan_keys, 0, sizeof(scan_keys));
 
 	result = nutscan_rewind_device(dev_ret);
 	dev_ret = NULL;
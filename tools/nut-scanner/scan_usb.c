@@ -52,6 +52,8 @@ static int (*nut_usb_get_string_with_langid)(libusb_device_handle *dev, int inde
 static int nut_usb_get_string_with_langid_control_transfer(
 		libusb_device_handle *dev, int index, int langid,
 		char *buf, size_t buflen);
+/* Index of the known devices, built when the library is loaded */
+static void usb_device_index_build(void);
 
 /* Compatibility layer between libusb 0.1 and 1.0 */
 #if WITH_LIBUSB_1_0
@@ -268,6 +270,8 @@ int nutscan_load_usb_library(const char *libname_path)
 		free(dl_saved_libname);
 	dl_saved_libname = xstrdup(libname_path);
 
+	usb_device_index_build();
+
 	return 1;
 
 err:
@@ -284,12 +288,86 @@ err:
 }
 /* end of dynamic link library stuff */
 
-static char* is_usb_device_supported(usb_device_id_t *usb_device_id_list,
-					int dev_VendorID, int dev_ProductID, char **alt)
+/* Index of usb_device_table[] by VID:PID (open addressing, holding the
+ * entry number plus one, or 0 for a free slot), so that each enumerated
+ * device is matched without walking the whole table. The first entry of
+ * a VID:PID wins, as with the walk. */
+#define USB_DEVICE_INDEX_SIZE	1024	/* a power of two */
+static uint16_t usb_device_index[USB_DEVICE_INDEX_SIZE];
+static int usb_device_indexed = 0;	/* -1 if the table does not fit */
+
+static size_t usb_device_index_slot(uint16_t VendorID, uint16_t ProductID)
+{
+	uint32_t	key = ((uint32_t)VendorID << 16) | ProductID;
+
+	/* Multiplicative hashing, keeping the top 10 bits */
+	return (size_t)((uint32_t)(key * 2654435761U) >> 22) & (USB_DEVICE_INDEX_SIZE - 1);
+}
+
+static void usb_device_index_build(void)
+{
+	size_t	i, slot;
+
+	if (usb_device_indexed) {
+		return;
+	}
+
+	for (i = 0; usb_device_table[i].driver_name != NULL; i++) {
+		/* keep it at most half full for short probes */
+		if (i >= USB_DEVICE_INDEX_SIZE / 2) {
+			upsdebugx(1, "%s: too many known USB devices, "
+				"matching them one by one", __func__);
+			memset(usb_device_index, 0, sizeof(usb_device_index));
+			usb_device_indexed = -1;
+			return;
+		}
+
+		for (slot = usb_device_index_slot(usb_device_table[i].vendorID, usb_device_table[i].productID);
+		     usb_device_index[slot];
+		     slot = (slot + 1) & (USB_DEVICE_INDEX_SIZE - 1)
+		) {
+			usb_device_id_t	*usbdev = &usb_device_table[usb_device_index[slot] - 1];
+
+			if (usbdev->vendorID == usb_device_table[i].vendorID
+			 && usbdev->productID == usb_device_table[i].productID
+			) {
+				break;
+			}
+		}
+
+		if (!usb_device_index[slot]) {
+			usb_device_index[slot] = (uint16_t)(i + 1);
+		}
+	}
+
+	upsdebugx(1, "%s: indexed %" PRIuSIZE " known USB devices", __func__, i);
+	usb_device_indexed = 1;
+}
+
+static char* is_usb_device_supported(uint16_t dev_VendorID, uint16_t dev_ProductID, char **alt)
 {
 	usb_device_id_t *usbdev;
+	size_t	slot;
+
+	if (usb_device_indexed <= 0) {
+		for (usbdev = usb_device_table; usbdev->driver_name != NULL; usbdev++) {
+			if ((usbdev->vendorID == dev_VendorID)
+			 && (usbdev->productID == dev_ProductID)
+			) {
+				if (alt)
+					*alt = usbdev->alt_driver_names;
+				return usbdev->driver_name;
+			}
+		}
+
+		return NULL;
+	}
 
-	for (usbdev = usb_device_id_list; usbdev->driver_name != NULL; usbdev++) {
+	for (slot = usb_device_index_slot(dev_VendorID, dev_ProductID);
+	     usb_device_index[slot];
+	     slot = (slot + 1) & (USB_DEVICE_INDEX_SIZE - 1)
+	) {
+		usbdev = &usb_device_table[usb_device_index[slot] - 1];
 		if ((usbdev->vendorID == dev_VendorID)
 		 && (usbdev->productID == dev_ProductID)
 		) {
@@ -581,7 +659,7 @@ nutscan_device_t * nutscan_scan_usb(nutscan_usb_t * scanopts)
 			bcdDevice = dev->descriptor.bcdDevice;
 #endif
 			if ((driver_name =
-				is_usb_device_supported(usb_device_table,
+				is_usb_device_supported(
 					VendorID, ProductID, &alt_driver_names)) != NULL) {
 
 				/* open the device */
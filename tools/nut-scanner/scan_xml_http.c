@@ -206,7 +206,156 @@ static int startelm_cb(void *userdata, int parent, const char *nspace, const cha
 	return result;
 }
 
-/* Performs a (parallel-able) NetXML protocol scan of one remote host:port.
+/* Inspects a reply to <SCAN_REQUEST/> from the host at IP address
+ * string, and adds it to dev_ret if the netxml-ups driver can talk
+ * to it. Returns 1 if added, 0 if not fit, -1 on memory errors. */
+static int scan_xml_http_reply(const char *buf, size_t len, const char *string, uint16_t port_udp)
+{
+	nutscan_device_t * nut_dev;
+	ne_xml_parser	*parser;
+	int	parserFailed;
+	char	url[SMALLBUF + 8];
+
+	nut_dev = nutscan_new_device();
+	if (nut_dev == NULL) {
+		upsdebugx(0, "%s: Memory allocation error", __func__);
+		return -1;
+	}
+
+#ifdef HAVE_PTHREAD
+	pthread_mutex_lock(&dev_mutex);
+#endif
+	upsdebugx(5,
+		"%s: Some host at IP %s replied to NetXML UDP request on port %d, "
+		"inspecting the response...",
+		__func__, string, port_udp);
+	nut_dev->type = TYPE_XML;
+	/* Try to read device type */
+	parser = (*nut_ne_xml_create)();
+	(*nut_ne_xml_push_handler)(parser, startelm_cb,
+				NULL, NULL, nut_dev);
+	(*nut_ne_xml_parse)(parser, buf, len);
+	parserFailed = (*nut_ne_xml_failed)(parser); /* 0 = ok, nonzero = fail */
+	(*nut_ne_xml_destroy)(parser);
+
+	if (parserFailed == 0) {
+		nut_dev->driver = strdup("netxml-ups");
+		snprintf(url, sizeof(url), "http://%s", string);
+		/* FIXME: Should the IPv6 address here be bracketed?
+		 *  Does our driver support the notation? */
+		nut_dev->port = strdup(url);
+		upsdebugx(3,
+			"%s: Adding configuration for driver='%s' port='%s'",
+			__func__, nut_dev->driver, nut_dev->port);
+		dev_ret = nutscan_add_device_to_device(
+			dev_ret, nut_dev);
+#ifdef HAVE_PTHREAD
+		pthread_mutex_unlock(&dev_mutex);
+#endif
+		return 1;
+	}
+
+	upsdebugx(0, "WARNING: %s: "
+		"Device at IP %s replied with NetXML but was not deemed compatible "
+		"with 'netxml-ups' driver (unsupported protocol version, etc.)",
+		__func__, string);
+	nutscan_free_device(nut_dev);
+#ifdef HAVE_PTHREAD
+	pthread_mutex_unlock(&dev_mutex);
+#endif
+	return 0;
+}
+
+#define MAX_RETRIES 3
+
+/* Collects the replies to <SCAN_REQUEST/> waiting on peerSocket, until
+ * usec_timeout from now (however many come meanwhile, and no later than
+ * the deadline of the scans) or none at all if it is 0, skipping the
+ * addresses which replied already; returns how many were collected, or
+ * -1 on memory errors */
+static ssize_t scan_xml_http_sweep_replies(int peerSocket, useconds_t usec_timeout,
+	uint16_t port_udp, struct in_addr **replied, size_t *replied_count)
+{
+	struct sockaddr_in sockAddress_udp;
+	socklen_t sockAddressLength;
+	struct timeval timeout, start, now;
+	fd_set fds;
+	char buf[SMALLBUF + 8];
+	char string[SMALLBUF];
+	ssize_t recv_size, count = 0;
+	size_t i;
+	double left;
+
+	usec_timeout = nutscan_deadline_clamp(usec_timeout);
+	gettimeofday(&start, NULL);
+
+	for (;;) {
+		struct in_addr *new_replied;
+
+		gettimeofday(&now, NULL);
+		left = (double)usec_timeout / 1000000.0 - difftimeval(now, start);
+		if (left < 0) {
+			left = 0;
+		}
+
+		FD_ZERO(&fds);
+		FD_SET(peerSocket, &fds);
+		timeout.tv_sec = (time_t)left;
+		timeout.tv_usec = (suseconds_t)((left - (double)timeout.tv_sec) * 1000000.0);
+
+		if (select(peerSocket + 1, &fds, NULL, NULL, &timeout) <= 0) {
+			break;
+		}
+
+		sockAddressLength = sizeof(sockAddress_udp);
+		recv_size = recvfrom(peerSocket, buf, sizeof(buf), 0,
+			(struct sockaddr *)&sockAddress_udp, &sockAddressLength);
+		if (recv_size < 0) {
+			upsdebug_with_errno(3, "%s: Error reading socket", __func__);
+			continue;
+		}
+
+		/* do not count a device twice, if it replied to a retry too */
+		for (i = 0; i < *replied_count; i++) {
+			if ((*replied)[i].s_addr == sockAddress_udp.sin_addr.s_addr) {
+				break;
+			}
+		}
+		if (i < *replied_count) {
+			continue;
+		}
+
+		new_replied = realloc(*replied, (*replied_count + 1) * sizeof(**replied));
+		if (new_replied == NULL) {
+			upsdebugx(0, "%s: Memory allocation error", __func__);
+			return -1;
+		}
+		*replied = new_replied;
+		(*replied)[(*replied_count)++] = sockAddress_udp.sin_addr;
+
+		if (getnameinfo((struct sockaddr *)&sockAddress_udp,
+			sizeof(struct sockaddr_in), string, sizeof(string),
+			NULL, 0, NI_NUMERICHOST) != 0
+		) {
+			upsdebug_with_errno(0, "%s: Error converting IP address", __func__);
+			continue;
+		}
+
+		/* recv_size is a ssize_t, so in range of size_t */
+		if (scan_xml_http_reply(buf, (size_t)recv_size, string, port_udp) < 0) {
+			return -1;
+		}
+		count++;
+	}
+
+	return count;
+}
+
+/* Performs a NetXML protocol scan of one remote host:port, or of all
+ * hosts replying to a broadcast if its peername is NULL: the request is
+ * sent a few times (UDP packets may get lost) within one usec_timeout
+ * window, and the replies to any of them are all collected from the same
+ * socket until its end (or the first one, for a single host).
  * Returns NULL, updates global dev_ret when a scan is successful.
  * FREES the caller's copy of "arg" and "hostname" in it, if applicable.
  */
@@ -225,15 +374,9 @@ static void * nutscan_scan_xml_http_thready(void * arg)
 	int peerSocket = -1;
 	int sockopt_on = 1;
 	struct sockaddr_in sockAddress_udp;
-	socklen_t sockAddressLength = sizeof(sockAddress_udp);
-	fd_set fds;
-	struct timeval timeout;
-	int ret;
-	char buf[SMALLBUF + 8];
-	char string[SMALLBUF];
-	ssize_t recv_size;
+	struct in_addr *replied = NULL;
+	size_t replied_count = 0;
 	int i;
-	nutscan_device_t * nut_dev = NULL;
 
 	memset(&sockAddress_udp, 0, sizeof(sockAddress_udp));
 
@@ -260,189 +403,69 @@ static void * nutscan_scan_xml_http_thready(void * arg)
 		goto end_free;
 	}
 
-	/* FIXME : Per http://stackoverflow.com/questions/683624/udp-broadcast-on-all-interfaces
-	 * A single sendto() generates a single packet,
-	 * so one must iterate all known interfaces... */
-#define MAX_RETRIES 3
-	for (i = 0; i != MAX_RETRIES ; i++) {
-		/* Initialize socket */
-		sockAddress_udp.sin_family = AF_INET;
-		if (ip == NULL) {
-			upsdebugx(2,
-				"%s: scanning connected network segment(s) "
-				"with a broadcast, attempt %d of %d with a timeout of %" PRIuMAX " usec",
-				__func__, (i + 1), MAX_RETRIES, (uintmax_t)usec_timeout);
-			sockAddress_udp.sin_addr.s_addr = INADDR_BROADCAST;
-			setsockopt(peerSocket, SOL_SOCKET, SO_BROADCAST,
-				SOCK_OPT_CAST &sockopt_on,
-				sizeof(sockopt_on));
-		} else {
-			upsdebugx(2,
-				"%s: scanning IP '%s' with a unicast, "
-				"attempt %d of %d with a timeout of %" PRIuMAX " usec",
-				__func__, ip, (i + 1), MAX_RETRIES, (uintmax_t)usec_timeout);
-			inet_pton(AF_INET, ip, &(sockAddress_udp.sin_addr));
-		}
-		sockAddress_udp.sin_port = htons(port_udp);
+	/* Initialize socket */
+	sockAddress_udp.sin_family = AF_INET;
+	sockAddress_udp.sin_port = htons(port_udp);
+	if (ip == NULL) {
+		/* FIXME : Per http://stackoverflow.com/questions/683624/udp-broadcast-on-all-interfaces
+		 * A single sendto() generates a single packet,
+		 * so one must iterate all known interfaces... */
+		sockAddress_udp.sin_addr.s_addr = INADDR_BROADCAST;
+		setsockopt(peerSocket, SOL_SOCKET, SO_BROADCAST,
+			SOCK_OPT_CAST &sockopt_on,
+			sizeof(sockopt_on));
+	} else if (inet_pton(AF_INET, ip, &(sockAddress_udp.sin_addr)) != 1) {
+		upsdebugx(0, "%s: Invalid IPv4 address '%s'", __func__, ip);
+		goto end;
+	}
+
+	for (i = 0; i != MAX_RETRIES && !nutscan_deadline_passed(); i++) {
+		ssize_t collected;
+
+		upsdebugx(2,
+			"%s: scanning %s%s, attempt %d of %d "
+			"within a timeout of %" PRIuMAX " usec",
+			__func__,
+			(ip ? "IP " : "connected network segment(s) with a broadcast"),
+			(ip ? ip : ""), (i + 1), MAX_RETRIES, (uintmax_t)usec_timeout);
 
 		/* Send scan request */
 		if (sendto(peerSocket, scanMsg, strlen(scanMsg), 0,
 			(struct sockaddr *)&sockAddress_udp,
-			sockAddressLength) <= 0
+			sizeof(sockAddress_udp)) <= 0
 		) {
-			upsdebugx(0, "%s: "
+			upsdebug_with_errno(0, "%s: "
 				"Error sending Eaton <SCAN_REQUEST/> to %s, #%d/%d",
 				__func__,
 				(ip ? ip : "<broadcast>"), (i + 1), MAX_RETRIES);
-			usleep(usec_timeout);
-			continue;
 		}
-		else
-		{
-			int retNum = 0;
-			FD_ZERO(&fds);
-			FD_SET(peerSocket, &fds);
-
-			timeout.tv_sec = usec_timeout / 1000000;
-			timeout.tv_usec = usec_timeout % 1000000;
-
-			upsdebugx(5, "%s: sent request to %s, "
-				"loop #%d/%d, waiting for responses",
-				__func__, (ip ? ip : "<broadcast>"), (i + 1), MAX_RETRIES);
-			while ((ret = select(peerSocket + 1, &fds, NULL, NULL,
-						&timeout))
-			) {
-				ne_xml_parser	*parser;
-				int	parserFailed;
-
-				retNum ++;
-				upsdebugx(5, "%s: request to %s, "
-					"loop #%d/%d, response #%d",
-					__func__, (ip ? ip : "<broadcast>"), (i + 1), MAX_RETRIES, retNum);
-
-				timeout.tv_sec = usec_timeout / 1000000;
-				timeout.tv_usec = usec_timeout % 1000000;
 
-				if (ret == -1) {
-					upsdebug_with_errno(0,
-						"%s: Error waiting on socket",
-						__func__);
-					break;
-				}
-
-				sockAddressLength = sizeof(struct sockaddr_in);
-				recv_size = recvfrom(peerSocket, buf,
-					sizeof(buf), 0,
-					(struct sockaddr *)&sockAddress_udp,
-					&sockAddressLength);
-
-				if (recv_size < 0) {
-					upsdebug_with_errno(0, "%s: "
-						"Error reading socket: #%d/%d",
-						__func__, (i + 1), MAX_RETRIES);
-					usleep(usec_timeout);
-					continue;
-				}
-
-				if (getnameinfo(
-					(struct sockaddr *)&sockAddress_udp,
-					sizeof(struct sockaddr_in), string,
-					sizeof(string), NULL, 0,
-					NI_NUMERICHOST) != 0
-				) {
-					upsdebug_with_errno(0, "%s: "
-						"Error converting IP address", __func__);
-					usleep(usec_timeout);
-					continue;
-				}
-
-				nut_dev = nutscan_new_device();
-				if (nut_dev == NULL) {
-					upsdebugx(0, "%s: Memory allocation error", __func__);
-					goto end_abort;
-				}
-
-#ifdef HAVE_PTHREAD
-				pthread_mutex_lock(&dev_mutex);
-#endif
-				upsdebugx(5,
-					"%s: Some host at IP %s replied to NetXML UDP request on port %d, "
-					"inspecting the response...",
-					__func__, string, port_udp);
-				nut_dev->type = TYPE_XML;
-				/* Try to read device type */
-				parser = (*nut_ne_xml_create)();
-				(*nut_ne_xml_push_handler)(parser, startelm_cb,
-							NULL, NULL, nut_dev);
-				/* recv_size is a ssize_t, so in range of size_t */
-				(*nut_ne_xml_parse)(parser, buf, (size_t)recv_size);
-				parserFailed = (*nut_ne_xml_failed)(parser); /* 0 = ok, nonzero = fail */
-				(*nut_ne_xml_destroy)(parser);
-
-				if (parserFailed == 0) {
-					nut_dev->driver = strdup("netxml-ups");
-					sprintf(buf, "http://%s", string);
-					/* FIXME: Should the IPv6 address here be bracketed?
-					 *  Does our driver support the notation? */
-					nut_dev->port = strdup(buf);
-					upsdebugx(3,
-						"%s: Adding configuration for driver='%s' port='%s'",
-						__func__, nut_dev->driver, nut_dev->port);
-					dev_ret = nutscan_add_device_to_device(
-						dev_ret, nut_dev);
-#ifdef HAVE_PTHREAD
-					pthread_mutex_unlock(&dev_mutex);
-#endif
-				}
-				else
-				{
-					upsdebugx(0, "WARNING: %s: "
-						"Device at IP %s replied with NetXML but was not deemed compatible "
-						"with 'netxml-ups' driver (unsupported protocol version, etc.)",
-						__func__, string);
-					nutscan_free_device(nut_dev);
-					nut_dev = NULL;
-#ifdef HAVE_PTHREAD
-					pthread_mutex_unlock(&dev_mutex);
-#endif
-					if (ip == NULL) {
-						/* skip this device; note that for a
-						 * broadcast scan there may be more
-						 * in the loop's queue */
-						continue;
-					}
-				}
+		/* The replies to earlier attempts come here as well */
+		collected = scan_xml_http_sweep_replies(peerSocket,
+			usec_timeout / MAX_RETRIES
+			+ (i == MAX_RETRIES - 1 ? usec_timeout % MAX_RETRIES : 0),
+			port_udp, &replied, &replied_count);
+		if (collected < 0) {
+			upsdebugx(1,
+				"%s: Had to abort scan for %s, see fatal details above",
+				__func__, (ip ? ip : "<broadcast>"));
+			goto end;
+		}
 
-				if (ip != NULL) {
-					upsdebugx(2,
-						"%s: we collected one reply "
-						"to unicast for %s (repsponse from %s), done",
-						__func__, ip, string);
-					goto end;
-				}
-			} /* while select() responses */
-			if (ip == NULL && dev_ret != NULL) {
-				upsdebugx(2,
-					"%s: we collected one round of replies "
-					"to broadcast with no errors, done", __func__);
-				goto end;
-			}
+		if (ip != NULL && replied_count > 0) {
+			break;
 		}
 	}
-	upsdebugx(2,
-		"%s: no replies collected for %s, done",
-		__func__, (ip ? ip : "<broadcast>"));
-	goto end;
 
-end_abort:
-	upsdebugx(1,
-		"%s: Had to abort scan for %s, see fatal details above",
-		__func__, (ip ? ip : "<broadcast>"));
+	upsdebugx(2,
+		"%s: %" PRIuSIZE " replies collected for %s, done",
+		__func__, replied_count, (ip ? ip : "<broadcast>"));
 
 end:
 	/* Broadcast is also a socket! */
 	if (peerSocket != -1)
 		close(peerSocket);
+	free(replied);
 
 end_free:
 	/* free resources which come from the caller
@@ -481,9 +504,109 @@ nutscan_device_t * nutscan_scan_xml_http_range(const char * start_ip, const char
 	return ndret;
 }
 
+/* Sends <SCAN_REQUEST/> to each (IPv4) address of the ranges from one
+ * socket, and collects the replies as they come: the whole range waits
+ * for one timeout (shared by the rounds), and not each address in turn
+ * for its own. Addresses which did not reply are asked again in the next
+ * rounds. */
+static void scan_xml_http_sweep(const nutscan_ip_range_list_t * irl,
+	const nutscan_xml_t * sec, useconds_t usec_timeout)
+{
+	char *scanMsg = "<SCAN_REQUEST/>";
+	uint16_t port_udp = 4679;
+	int peerSocket;
+	int round;
+	struct in_addr *replied = NULL;
+	size_t replied_count = 0;
+
+	if (sec->port_udp > 0 && sec->port_udp <= 65534)
+		port_udp = sec->port_udp;
+	if (sec->usec_timeout > 0)
+		usec_timeout = sec->usec_timeout;
+	if (usec_timeout <= 0)
+		usec_timeout = 5000000; /* Driver default : 5sec */
+
+	if ((peerSocket = socket(AF_INET, SOCK_DGRAM, 0)) == -1) {
+		upsdebugx(0, "%s: Error creating socket", __func__);
+		return;
+	}
+
+	for (round = 0; round != MAX_RETRIES && !nutscan_deadline_passed(); round++) {
+		nutscan_ip_range_list_iter_t iter;
+		nutscan_ip_addr_t ip;
+		int more;
+		size_t sent = 0, i;
+
+		upsdebugx(2, "%s: round %d of %d within a timeout of %" PRIuMAX " usec",
+			__func__, (round + 1), MAX_RETRIES, (uintmax_t)usec_timeout);
+
+		for (more = nutscan_ip_ranges_iter_init_addr(&iter, irl, &ip);
+			more && !nutscan_deadline_passed();
+			more = nutscan_ip_ranges_iter_inc_addr(&iter, &ip)
+		) {
+			struct sockaddr_in sockAddress_udp;
+
+			if (ip.type != IPv4) {
+				if (round == 0) {
+					char host[SMALLBUF];
+
+					upsdebugx(1, "%s: skipping '%s', only IPv4 is supported",
+						__func__, nutscan_ip_addr_to_str(&ip, host, sizeof(host))
+							? host : "?");
+				}
+				continue;
+			}
+
+			memset(&sockAddress_udp, 0, sizeof(sockAddress_udp));
+			sockAddress_udp.sin_family = AF_INET;
+			sockAddress_udp.sin_port = htons(port_udp);
+			sockAddress_udp.sin_addr = ip.addr;
+
+			for (i = 0; i < replied_count; i++) {
+				if (replied[i].s_addr == sockAddress_udp.sin_addr.s_addr) {
+					break;
+				}
+			}
+			if (i < replied_count) {
+				continue;
+			}
+
+			if (sendto(peerSocket, scanMsg, strlen(scanMsg), 0,
+				(struct sockaddr *)&sockAddress_udp,
+				sizeof(sockAddress_udp)) <= 0
+			) {
+				upsdebug_with_errno(3, "%s: Error sending Eaton <SCAN_REQUEST/>",
+					__func__);
+				continue;
+			}
+			sent++;
+
+			/* pick up what came back meanwhile, before it overflows */
+			scan_xml_http_sweep_replies(peerSocket, 0, port_udp,
+				&replied, &replied_count);
+		}
+
+		if (sent == 0) {
+			break;
+		}
+
+		if (scan_xml_http_sweep_replies(peerSocket,
+			usec_timeout / MAX_RETRIES
+			+ (round == MAX_RETRIES - 1 ? usec_timeout % MAX_RETRIES : 0),
+			port_udp, &replied, &replied_count) < 0
+		) {
+			break;
+		}
+	}
+
+	upsdebugx(2, "%s: %" PRIuSIZE " replies collected", __func__, replied_count);
+
+	free(replied);
+	close(peerSocket);
+}
+
 nutscan_device_t * nutscan_scan_ip_range_xml_http(nutscan_ip_range_list_t * irl, useconds_t usec_timeout, nutscan_xml_t * sec)
 {
-	bool_t pass = TRUE; /* Track that we may spawn a scanning thread */
 	nutscan_device_t * result = NULL;
 	nutscan_xml_t * tmp_sec = NULL;
 
@@ -500,28 +623,7 @@ nutscan_device_t * nutscan_scan_ip_range_xml_http(nutscan_ip_range_list_t * irl,
 		upsdebugx(1, "%s: Scanning XML/HTTP bus using broadcast.", __func__);
 		/* Fall through to after the if/else clause */
 	} else {
-		/* Iterate the one or a range of IPs to scan */
-		nutscan_ip_range_list_iter_t ip;
-		char * ip_str = NULL;
-
-#ifdef HAVE_PTHREAD
-# if (defined HAVE_SEMAPHORE_UNNAMED) || (defined HAVE_SEMAPHORE_NAMED)
-		sem_t * semaphore = nutscan_semaphore();
-#  if (defined HAVE_SEMAPHORE_UNNAMED)
-		sem_t   semaphore_scantype_inst;
-		sem_t * semaphore_scantype = &semaphore_scantype_inst;
-#  elif (defined HAVE_SEMAPHORE_NAMED)
-		sem_t * semaphore_scantype = NULL;
-#  endif
-# endif /* HAVE_SEMAPHORE_UNNAMED || HAVE_SEMAPHORE_NAMED */
-		pthread_t thread;
-		nutscan_thread_t * thread_array = NULL;
-		size_t thread_count = 0, i;
-# if (defined HAVE_PTHREAD_TRYJOIN) || (defined HAVE_SEMAPHORE_UNNAMED) || (defined HAVE_SEMAPHORE_NAMED)
-		size_t  max_threads_scantype = max_threads_netxml;
-# endif
-#endif	/* HAVE_PTHREAD */
-
+		/* Scan the one or a range of IPs at once */
 		if (irl->ip_ranges_count == 1
 		&& (irl->ip_ranges->start_ip == irl->ip_ranges->end_ip
 		    || !strcmp(irl->ip_ranges->start_ip, irl->ip_ranges->end_ip)
@@ -535,313 +637,13 @@ nutscan_device_t * nutscan_scan_ip_range_xml_http(nutscan_ip_range_list_t * irl,
 
 #ifdef HAVE_PTHREAD
 		pthread_mutex_init(&dev_mutex, NULL);
-
-# if (defined HAVE_SEMAPHORE_UNNAMED) || (defined HAVE_SEMAPHORE_NAMED)
-		if (max_threads_scantype > 0) {
-#ifdef HAVE_PRAGMAS_FOR_GCC_DIAGNOSTIC_IGNORED_UNREACHABLE_CODE
-#pragma GCC diagnostic push
-#endif
-#ifdef HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_UNREACHABLE_CODE
-#pragma GCC diagnostic ignored "-Wunreachable-code"
 #endif
-#ifdef __clang__
-#pragma clang diagnostic push
-#pragma clang diagnostic ignored "-Wunreachable-code"
-#endif
-			/* Different platforms, different sizes, none fits all... */
-			if (SIZE_MAX > UINT_MAX && max_threads_scantype > UINT_MAX) {
-#ifdef __clang__
-#pragma clang diagnostic pop
-#endif
-#ifdef HAVE_PRAGMAS_FOR_GCC_DIAGNOSTIC_IGNORED_UNREACHABLE_CODE
-#pragma GCC diagnostic pop
-#endif
-				upsdebugx(1,
-					"WARNING: %s: Limiting max_threads_scantype to range acceptable for " REPORT_SEM_INIT_METHOD "()",
-					__func__);
-				max_threads_scantype = UINT_MAX - 1;
-			}
-
-			upsdebugx(4, "%s: " REPORT_SEM_INIT_METHOD "() for %" PRIuSIZE " threads", __func__, max_threads_scantype);
-#  if (defined HAVE_SEMAPHORE_UNNAMED)
-			if (sem_init(semaphore_scantype, 0, (unsigned int)max_threads_scantype)) {
-				upsdebug_with_errno(4, "%s: " REPORT_SEM_INIT_METHOD "() failed", __func__);
-				max_threads_scantype = 0;
-			}
-#  elif (defined HAVE_SEMAPHORE_NAMED)
-			if (SEM_FAILED == (semaphore_scantype = sem_open(SEMNAME_NETXML, O_CREAT, 0644, (unsigned int)max_threads_scantype))) {
-				upsdebug_with_errno(4, "%s: " REPORT_SEM_INIT_METHOD "() failed", __func__);
-				semaphore_scantype = NULL;
-				max_threads_scantype = 0;
-			}
-#  endif
-		}
-# endif /* HAVE_SEMAPHORE_UNNAMED || HAVE_SEMAPHORE_NAMED */
-
-#endif /* HAVE_PTHREAD */
-
-		ip_str = nutscan_ip_ranges_iter_init(&ip, irl);
 
-		while (ip_str != NULL) {
-#ifdef HAVE_PTHREAD
-			/* NOTE: With many enough targets to scan, this can crash
-			 * by spawning too many children; add a limit and loop to
-			 * "reap" some already done with their work. And probably
-			 * account them in thread_array[] as something to not wait
-			 * for below in pthread_join()...
-			 */
-
-# if (defined HAVE_SEMAPHORE_UNNAMED) || (defined HAVE_SEMAPHORE_NAMED)
-			/* Just wait for someone to free a semaphored slot,
-			 * if none are available, and then/otherwise grab one
-			 */
-			if (thread_array == NULL) {
-				/* Starting point, or after a wait to complete
-				 * all earlier runners */
-				if (max_threads_scantype > 0)
-					sem_wait(semaphore_scantype);
-				sem_wait(semaphore);
-				pass = TRUE;
-			} else {
-				/* If successful (the lock was acquired),
-				 * sem_wait() and sem_trywait() will return 0.
-				 * Otherwise, -1 is returned and errno is set,
-				 * and the state of the semaphore is unchanged.
-				 */
-				int	stwST = sem_trywait(semaphore_scantype);
-				int	stwS  = sem_trywait(semaphore);
-				pass = ((max_threads_scantype == 0 || stwST == 0) && stwS == 0);
-				upsdebugx(4, "%s: max_threads_scantype=%" PRIuSIZE
-					" curr_threads=%" PRIuSIZE
-					" thread_count=%" PRIuSIZE
-					" stwST=%d stwS=%d pass=%u",
-					__func__, max_threads_scantype,
-					curr_threads, thread_count,
-					stwST, stwS, pass
-				);
-			}
-# else
-#  ifdef HAVE_PTHREAD_TRYJOIN
-			/* A somewhat naive and brute-force solution for
-			 * systems without a semaphore.h. This may suffer
-			 * some off-by-one errors, using a few more threads
-			 * than intended (if we race a bit at the wrong time,
-			 * probably up to one per enabled scanner routine).
-			 */
-
-			/* TOTHINK: Should there be a threadcount_mutex when
-			 * we just read the value in if() and while() below?
-			 * At worst we would overflow the limit a bit due to
-			 * other protocol scanners...
-			 */
-			if (curr_threads >= max_threads
-			|| (curr_threads >= max_threads_scantype && max_threads_scantype > 0)
-			) {
-				upsdebugx(2, "%s: already running %" PRIuSIZE " scanning threads "
-					"(launched overall: %" PRIuSIZE "), "
-					"waiting until some would finish",
-					__func__, curr_threads, thread_count);
-
-				while (curr_threads >= max_threads
-				   || (curr_threads >= max_threads_scantype && max_threads_scantype > 0)
-				) {
-					for (i = 0; i < thread_count ; i++) {
-						int ret;
-
-						if (!thread_array[i].active) continue;
-
-						pthread_mutex_lock(&threadcount_mutex);
-						upsdebugx(3, "%s: Trying to join thread #%" PRIuSIZE "...", __func__, i);
-						ret = pthread_tryjoin_np(thread_array[i].thread, NULL);
-						switch (ret) {
-							case ESRCH:     /* No thread with the ID thread could be found - already "joined"? */
-								upsdebugx(5, "%s: Was thread #%" PRIuSIZE " joined earlier?", __func__, i);
-								break;
-							case 0:         /* thread exited */
-								if (curr_threads > 0) {
-									curr_threads --;
-									upsdebugx(4, "%s: Joined a finished thread #%" PRIuSIZE, __func__, i);
-								} else {
-									/* threadcount_mutex fault? */
-									upsdebugx(0, "WARNING: %s: Accounting of thread count "
-										"says we are already at 0", __func__);
-								}
-								thread_array[i].active = FALSE;
-								break;
-							case EBUSY:     /* actively running */
-								upsdebugx(6, "%s: thread #%" PRIuSIZE " still busy (%i)",
-									__func__, i, ret);
-								break;
-							case EDEADLK:   /* Errors with thread interactions... bail out? */
-							case EINVAL:    /* Errors with thread interactions... bail out? */
-							default:        /* new pthreads abilities? */
-								upsdebugx(5, "%s: thread #%" PRIuSIZE " reported code %i",
-									__func__, i, ret);
-								break;
-						}
-						pthread_mutex_unlock(&threadcount_mutex);
-					}
-
-					if (curr_threads >= max_threads
-					|| (curr_threads >= max_threads_scantype && max_threads_scantype > 0)
-					) {
-							usleep (10000); /* microSec's, so 0.01s here */
-					}
-				}
-				upsdebugx(2, "%s: proceeding with scan", __func__);
-			}
-
-			/* NOTE: No change to default "pass" in this ifdef:
-			 * if we got to this line, we have a slot to use */
-#  endif /* HAVE_PTHREAD_TRYJOIN */
-# endif  /* HAVE_SEMAPHORE_UNNAMED || HAVE_SEMAPHORE_NAMED */
-#endif   /* HAVE_PTHREAD */
-
-			if (pass) {
-				tmp_sec = malloc(sizeof(nutscan_xml_t));
-				if (tmp_sec == NULL) {
-					upsdebugx(0, "%s: Memory allocation error", __func__);
-					break;
-				}
-
-				memcpy(tmp_sec, sec, sizeof(nutscan_xml_t));
-				tmp_sec->peername = ip_str;
-				if (tmp_sec->usec_timeout <= 0) {
-					tmp_sec->usec_timeout = usec_timeout;
-				}
+		scan_xml_http_sweep(irl, sec, usec_timeout);
 
 #ifdef HAVE_PTHREAD
-				if (pthread_create(&thread, NULL, nutscan_scan_xml_http_thready, (void*)tmp_sec) == 0) {
-					nutscan_thread_t	*new_thread_array;
-# ifdef HAVE_PTHREAD_TRYJOIN
-					pthread_mutex_lock(&threadcount_mutex);
-					curr_threads++;
-# endif /* HAVE_PTHREAD_TRYJOIN */
-
-					thread_count++;
-					new_thread_array = realloc(thread_array,
-						thread_count * sizeof(nutscan_thread_t));
-					if (new_thread_array == NULL) {
-						upsdebugx(1, "%s: Failed to realloc thread array", __func__);
-						break;
-					}
-					else {
-						thread_array = new_thread_array;
-					}
-					thread_array[thread_count - 1].thread = thread;
-					thread_array[thread_count - 1].active = TRUE;
-
-# ifdef HAVE_PTHREAD_TRYJOIN
-					pthread_mutex_unlock(&threadcount_mutex);
-# endif /* HAVE_PTHREAD_TRYJOIN */
-				}
-#else	/* if not HAVE_PTHREAD */
-				nutscan_scan_xml_http_thready(tmp_sec);
-#endif	/* if HAVE_PTHREAD */
-
-				/* Prepare the next iteration; note that
-				 * nutscan_scan_xml_http_thready()
-				 * takes care of freeing "tmp_sec" and its
-				 * reference (NOT strdup!) to "ip_str" as
-				 * peername.
-				 */
-				ip_str = nutscan_ip_ranges_iter_inc(&ip);
-			} else { /* if not pass -- all slots busy */
-#ifdef HAVE_PTHREAD
-# if (defined HAVE_SEMAPHORE_UNNAMED) || (defined HAVE_SEMAPHORE_NAMED)
-				/* Wait for all current scans to complete */
-				if (thread_array != NULL) {
-					upsdebugx (2, "%s: Running too many scanning threads (%"
-						PRIuSIZE "), "
-						"waiting until older ones would finish",
-						__func__, thread_count);
-					for (i = 0; i < thread_count ; i++) {
-						int ret;
-						if (!thread_array[i].active) {
-							/* Probably should not get here,
-							 * but handle it just in case */
-							upsdebugx(0, "WARNING: %s: Midway clean-up: did not expect thread %" PRIuSIZE " to be not active",
-								__func__, i);
-							sem_post(semaphore);
-							if (max_threads_scantype > 0)
-								sem_post(semaphore_scantype);
-							continue;
-						}
-						thread_array[i].active = FALSE;
-						ret = pthread_join(thread_array[i].thread, NULL);
-						if (ret != 0) {
-							upsdebugx(0, "WARNING: %s: Midway clean-up: pthread_join() returned code %i",
-								__func__, ret);
-						}
-						sem_post(semaphore);
-						if (max_threads_scantype > 0)
-							sem_post(semaphore_scantype);
-					}
-					thread_count = 0;
-					free(thread_array);
-					thread_array = NULL;
-				}
-# else
-#  ifdef HAVE_PTHREAD_TRYJOIN
-				/* TODO: Move the wait-loop for TRYJOIN here? */
-#  endif /* HAVE_PTHREAD_TRYJOIN */
-# endif  /* HAVE_SEMAPHORE_UNNAMED || HAVE_SEMAPHORE_NAMED */
-#endif   /* HAVE_PTHREAD */
-			} /* if: could we "pass" or not? */
-		} /* while */
-
-#ifdef HAVE_PTHREAD
-		if (thread_array != NULL) {
-			upsdebugx(2, "%s: all planned scans launched, waiting for threads to complete", __func__);
-			for (i = 0; i < thread_count; i++) {
-				int ret;
-
-				if (!thread_array[i].active) continue;
-
-				ret = pthread_join(thread_array[i].thread, NULL);
-				if (ret != 0) {
-					upsdebugx(0, "WARNING: %s: Clean-up: pthread_join() returned code %i",
-						__func__, ret);
-				}
-				thread_array[i].active = FALSE;
-# if (defined HAVE_SEMAPHORE_UNNAMED) || (defined HAVE_SEMAPHORE_NAMED)
-				sem_post(semaphore);
-				if (max_threads_scantype > 0)
-					sem_post(semaphore_scantype);
-# else
-#  ifdef HAVE_PTHREAD_TRYJOIN
-				pthread_mutex_lock(&threadcount_mutex);
-				if (curr_threads > 0) {
-					curr_threads --;
-					upsdebugx(5, "%s: Clean-up: Joined a finished thread #%" PRIuSIZE,
-						__func__, i);
-				} else {
-					upsdebugx(0, "WARNING: %s: Clean-up: Accounting of thread count "
-						"says we are already at 0", __func__);
-				}
-				pthread_mutex_unlock(&threadcount_mutex);
-#  endif /* HAVE_PTHREAD_TRYJOIN */
-# endif /* HAVE_SEMAPHORE_UNNAMED || HAVE_SEMAPHORE_NAMED */
-			}
-			free(thread_array);
-			upsdebugx(2, "%s: all threads freed", __func__);
-		}
 		pthread_mutex_destroy(&dev_mutex);
-
-# if (defined HAVE_SEMAPHORE_UNNAMED) || (defined HAVE_SEMAPHORE_NAMED)
-		if (max_threads_scantype > 0) {
-#  if (defined HAVE_SEMAPHORE_UNNAMED)
-			sem_destroy(semaphore_scantype);
-#  elif (defined HAVE_SEMAPHORE_NAMED)
-			if (semaphore_scantype) {
-				sem_unlink(SEMNAME_NETXML);
-				sem_close(semaphore_scantype);
-				semaphore_scantype = NULL;
-			}
-#  endif
-		}
-# endif /* HAVE_SEMAPHORE_UNNAMED || HAVE_SEMAPHORE_NAMED */
-#endif /* HAVE_PTHREAD */
+#endif
 
 		result = nutscan_rewind_device(dev_ret);
 		dev_ret = NULL;
@@ -867,8 +669,16 @@ nutscan_device_t * nutscan_scan_ip_range_xml_http(nutscan_ip_range_list_t * irl,
 		tmp_sec->usec_timeout = usec_timeout;
 	}
 
+#ifdef HAVE_PTHREAD
+	pthread_mutex_init(&dev_mutex, NULL);
+#endif
+
 	/* Note: the thready method releases the resources */
 	nutscan_scan_xml_http_thready(tmp_sec);
+
+#ifdef HAVE_PTHREAD
+	pthread_mutex_destroy(&dev_mutex);
+#endif
 	result = nutscan_rewind_device(dev_ret);
 	dev_ret = NULL;
 	return result;
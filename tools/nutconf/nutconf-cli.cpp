@@ -45,6 +45,7 @@ extern "C" {
 #include <vector>
 #include <map>
 #include <stdexcept>
+#include <fstream>
 #include <cassert>
 #include <cstring>
 #include <cstdlib>
@@ -77,6 +78,9 @@ const char * Usage::s_text[] = {
 	"    --version                           Display tool version on stdout and exit",
 	"    --autoconfigure                     Perform automatic configuration",
 	"    --is-configured                     Checks whether NUT is configured",
+	"    --batch <file>                      Reads more operations from file (- for stdin)",
+	"                                        One set of the options below per line; all files",
+	"                                        are written once at the end (or none on error)",
 	"    --local <directory>                 Sets configuration directory",
 	"    --system                            Sets configuration directory to " CONFPATH " (default)",
 	"                                        NOTE: If NUT_CONFPATH envvar is set,",
@@ -1109,6 +1113,9 @@ class NutConfOptions: public Options {
 	/** --local argument */
 	std::string local;
 
+	/** --batch argument */
+	std::string batch;
+
 	/** --system */
 	bool system;
 
@@ -1376,6 +1383,21 @@ NutConfOptions::NutConfOptions(char * const argv[], int argc):
 			else
 				local = args.front();
 		}
+		else if ("batch" == *opt) {
+			Arguments args;
+
+			if (!batch.empty())
+				m_errors.push_back("--batch option specified more than once");
+
+			else if (NutConfOptions::SETTER != optMode("batch", args))
+				m_errors.push_back("--batch option requires an argument");
+
+			else if (args.size() > 1)
+				m_errors.push_back("Only one file may be specified with the --batch option");
+
+			else
+				batch = args.front();
+		}
 		else if ("system" == *opt) {
 			if (system)
 				m_errors.push_back("--system option specified more than once");
@@ -2025,27 +2047,163 @@ static bool source(nut::Serialisable * config, const std::string & file_name) {
 /**
  *  \brief  Store configuration object to file
  *
- *  If the file exists, it's rewritten.
+ *  If the file exists, it's replaced: the configuration is written
+ *  to a temporary file next to it first, which is then renamed,
+ *  so readers see either the former or the new file contents.
+ *  The former file permissions (and owner, if possible) are kept.
  *
  *  \param  config     Configuration object
  *  \param  file_name  File name
  */
 static void store(nut::Serialisable * config, const std::string & file_name) {
-	nut::NutFile file(file_name, nut::NutFile::WRITE_ONLY);
+	std::stringstream tmp_name;
+
+	tmp_name << file_name << ".tmp." << getpid();
+
+	nut::NutFile file(tmp_name.str(), nut::NutFile::WRITE_ONLY);
 
 	bool written_ok = config->writeTo(file);
 
 	file.closex();
 
+	if (written_ok) {
+		struct stat	st;
+
+		if (0 == ::stat(file_name.c_str(), &st)) {
+			if (0 != ::chmod(tmp_name.str().c_str(), st.st_mode & 07777)) {
+				std::cerr << "Warning: Failed to keep permissions of "
+					<< file_name << std::endl;
+			}
+#ifndef WIN32
+			if (0 != ::chown(tmp_name.str().c_str(), st.st_uid, st.st_gid)) {
+				std::cerr << "Warning: Failed to keep ownership of "
+					<< file_name << std::endl;
+			}
+#endif	/* !WIN32 */
+		}
+
+		written_ok = file.rename(file_name);
+	}
+
 	if (written_ok)
 		return;
 
+	file.remove();
+
 	std::cerr << "Error: Failed to write " << file_name << std::endl;
 
 	::exit(1);
 }
 
 
+/**
+ *  \brief  Configuration file
+ *
+ *  The configuration is sourced from the file upon first use,
+ *  and stored (if changed) only upon \ref store call.
+ */
+template <class C>
+class ConfigFile {
+	private:
+
+	/** File name */
+	const std::string m_name;
+
+	/** Configuration object */
+	C m_config;
+
+	/** Configuration was sourced */
+	bool m_sourced;
+
+	/** Configuration was changed */
+	bool m_changed;
+
+	/** Source the configuration (once) */
+	inline void sourceOnce() {
+		if (m_sourced)
+			return;
+
+		source(&m_config, m_name);
+
+		m_sourced = true;
+	}
+
+	public:
+
+	/**
+	 *  \brief  Constructor
+	 *
+	 *  \param  name  File name
+	 */
+	ConfigFile(const std::string & name):
+		m_name(name), m_sourced(false), m_changed(false) {}
+
+	/** Configuration (for reading) */
+	inline const C & get() {
+		sourceOnce();
+
+		return m_config;
+	}
+
+	/** Configuration (to be changed) */
+	inline C & change() {
+		sourceOnce();
+
+		m_changed = true;
+
+		return m_config;
+	}
+
+	/** Store the configuration (unless unchanged) */
+	inline void store() {
+		if (!m_changed)
+			return;
+
+		::store(&m_config, m_name);
+
+		m_changed = false;
+	}
+
+};  // end of class ConfigFile
+
+
+/**
+ *  \brief  Set of the configuration files
+ *
+ *  All operations (including those read by --batch) change
+ *  the configuration objects, which are written once in the end.
+ */
+struct ConfigFiles {
+	ConfigFile<nut::NutConfiguration>       nut;         /**< nut.conf    */
+	ConfigFile<nut::UpsmonConfiguration>    upsmon;      /**< upsmon.conf */
+	ConfigFile<nut::UpsdConfiguration>      upsd;        /**< upsd.conf   */
+	ConfigFile<nut::UpsConfiguration>       ups;         /**< ups.conf    */
+	ConfigFile<nut::UpsdUsersConfiguration> upsd_users;  /**< upsd.users  */
+
+	/**
+	 *  \brief  Constructor
+	 *
+	 *  \param  etc  Configuration directory
+	 */
+	ConfigFiles(const std::string & etc):
+		nut(etc + "/nut.conf"),
+		upsmon(etc + "/upsmon.conf"),
+		upsd(etc + "/upsd.conf"),
+		ups(etc + "/ups.conf"),
+		upsd_users(etc + "/upsd.users") {}
+
+	/** Store the changed configuration files */
+	void store() {
+		nut.store();
+		upsmon.store();
+		upsd.store();
+		ups.store();
+		upsd_users.store();
+	}
+
+};  // end of struct ConfigFiles
+
+
 /**
  *  \brief  Check whether NUT was configured
  *
@@ -2137,17 +2295,13 @@ static nut::UpsmonConfiguration::Monitor monitor(
 /**
  *  \brief  NUT mode getter
  *
- *  \param  etc   Configuration directory
+ *  \param  conf  Configuration files
  *
  *  \return NUT mode (as string)
  */
-static std::string getMode(const std::string & etc) {
-	std::string nut_conf_file(etc + "/nut.conf");
+static std::string getMode(ConfigFiles & conf) {
 	std::stringstream e;
-	nut::NutConfiguration nut_conf;
-
-	// Source previous configuration
-	source(&nut_conf, nut_conf_file);
+	const nut::NutConfiguration & nut_conf = conf.nut.get();
 
 	nut::NutConfiguration::NutMode mode = nut_conf.mode;
 
@@ -2194,21 +2348,13 @@ static std::string getMode(const std::string & etc) {
  *  \brief  NUT mode setter
  *
  *  \param  mode  Mode
- *  \param  etc   Configuration directory
+ *  \param  conf  Configuration files
  */
-static void setMode(const std::string & mode, const std::string & etc) {
-	std::string nut_conf_file(etc + "/nut.conf");
-
-	nut::NutConfiguration nut_conf;
-
-	// Source previous configuration (if any)
-	source(&nut_conf, nut_conf_file);
+static void setMode(const std::string & mode, ConfigFiles & conf) {
+	nut::NutConfiguration & nut_conf = conf.nut.change();
 
 	// Set mode
 	nut_conf.mode = nut::NutConfiguration::NutModeFromString(mode);
-
-	// Store configuration
-	store(&nut_conf, nut_conf_file);
 }
 
 
@@ -2216,19 +2362,14 @@ static void setMode(const std::string & mode, const std::string & etc) {
  *  \brief  Set monitors in upsmon.conf
  *
  *  \param  monitors  Monitor list
- *  \param  etc       Configuration directory
+ *  \param  conf      Configuration files
  *  \param  keep_ex   Keep existing entries (discard by default)
  */
 static void setMonitors(
 	const std::list<nut::UpsmonConfiguration::Monitor> & monitors,
-	const std::string & etc, bool keep_ex = false)
+	ConfigFiles & conf, bool keep_ex = false)
 {
-	std::string upsmon_conf_file(etc + "/upsmon.conf");
-
-	nut::UpsmonConfiguration upsmon_conf;
-
-	// Source previous configuration (if any)
-	source(&upsmon_conf, upsmon_conf_file);
+	nut::UpsmonConfiguration & upsmon_conf = conf.upsmon.change();
 
 	// Remove existing monitors (unless we want to keep them)
 	if (!keep_ex)
@@ -2240,9 +2381,6 @@ static void setMonitors(
 
 	for (; monitor != monitors.end(); ++monitor)
 		upsmon_conf.monitors.push_back(*monitor);
-
-	// Store configuration
-	store(&upsmon_conf, upsmon_conf_file);
 }
 
 
@@ -2291,19 +2429,14 @@ static nut::UpsdConfiguration::Listen listenAddr(
  *  \brief  Set listen addresses in upsd.conf
  *
  *  \param  listen_addrs  Address list
- *  \param  etc           Configuration directory
+ *  \param  conf          Configuration files
  *  \param  keep_ex       Keep existing entries (discard by default)
  */
 static void setListenAddrs(
 	const std::list<nut::UpsdConfiguration::Listen> & listen_addrs,
-	const std::string & etc, bool keep_ex = false)
+	ConfigFiles & conf, bool keep_ex = false)
 {
-	std::string upsd_conf_file(etc + "/upsd.conf");
-
-	nut::UpsdConfiguration upsd_conf;
-
-	// Source previous configuration (if any)
-	source(&upsd_conf, upsd_conf_file);
+	nut::UpsdConfiguration & upsd_conf = conf.upsd.change();
 
 	// Remove existing listen addresses (unless we want to keep them)
 	if (!keep_ex)
@@ -2315,9 +2448,6 @@ static void setListenAddrs(
 
 	for (; listen != listen_addrs.end(); ++listen)
 		upsd_conf.listens.push_back(*listen);
-
-	// Store configuration
-	store(&upsd_conf, upsd_conf_file);
 }
 
 
@@ -2325,31 +2455,26 @@ static void setListenAddrs(
  *  \brief  Set devices in ups.conf
  *
  *  \param  devices  Device list
- *  \param  etc      Configuration directory
+ *  \param  conf     Configuration files
  *  \param  keep_ex  Keep existing entries (discard by default)
  */
 static void setDevices(
 	const std::vector<NutConfOptions::DeviceSpec> & devices,
-	const std::string & etc, bool keep_ex = false)
+	ConfigFiles & conf, bool keep_ex = false)
 {
-	std::string ups_conf_file(etc + "/ups.conf");
-
-	nut::UpsConfiguration ups_conf;
-
-	// Source previous configuration (if any)
-	source(&ups_conf, ups_conf_file);
+	nut::UpsConfiguration & ups_conf = conf.ups.change();
 
 	// Remove existing devices (unless we want to keep them)
 	if (!keep_ex) {
 		nut::UpsConfiguration::SectionMap::iterator
 			ups = ups_conf.sections.begin();
 
-		for (; ups != ups_conf.sections.end(); ++ups) {
+		while (ups != ups_conf.sections.end()) {
 			// Keep global section
 			if (ups->first.empty())
-				continue;
-
-			ups_conf.sections.erase(ups);
+				++ups;
+			else
+				ups = ups_conf.sections.erase(ups);
 		}
 	}
 
@@ -2366,9 +2491,6 @@ static void setDevices(
 		for (; setting != (*dev).settings.end(); ++setting)
 			ups_conf.setKey(id, setting->first, setting->second);
 	}
-
-	// Store configuration
-	store(&ups_conf, ups_conf_file);
 }
 
 
@@ -2376,18 +2498,13 @@ static void setDevices(
  *  \brief  Set notify flags in upsmon.conf
  *
  *  \param  flags  Notify flags specifications
- *  \param  etc    Configuration directory
+ *  \param  conf   Configuration files
  */
 static void setNotifyFlags(
 	const NutConfOptions::NotifyFlagsSpecs & flags,
-	const std::string & etc)
+	ConfigFiles & conf)
 {
-	std::string upsmon_conf_file(etc + "/upsmon.conf");
-
-	nut::UpsmonConfiguration upsmon_conf;
-
-	// Source previous configuration (if any)
-	source(&upsmon_conf, upsmon_conf_file);
+	nut::UpsmonConfiguration & upsmon_conf = conf.upsmon.change();
 
 	NutConfOptions::NotifyFlagsSpecs::const_iterator specs = flags.begin();
 
@@ -2421,9 +2538,6 @@ static void setNotifyFlags(
 			sum |= static_cast<unsigned int>(flag);
 		}
 	}
-
-	// Store configuration
-	store(&upsmon_conf, upsmon_conf_file);
 }
 
 
@@ -2431,18 +2545,13 @@ static void setNotifyFlags(
  *  \brief  Set notify messages in upsmon.conf
  *
  *  \param  msgs  Notify messages specifications
- *  \param  etc   Configuration directory
+ *  \param  conf  Configuration files
  */
 static void setNotifyMsgs(
 	const NutConfOptions::NotifyMsgSpecs & msgs,
-	const std::string & etc)
+	ConfigFiles & conf)
 {
-	std::string upsmon_conf_file(etc + "/upsmon.conf");
-
-	nut::UpsmonConfiguration upsmon_conf;
-
-	// Source previous configuration (if any)
-	source(&upsmon_conf, upsmon_conf_file);
+	nut::UpsmonConfiguration & upsmon_conf = conf.upsmon.change();
 
 	NutConfOptions::NotifyMsgSpecs::const_iterator spec = msgs.begin();
 
@@ -2462,9 +2571,6 @@ static void setNotifyMsgs(
 		// Set message
 		upsmon_conf.notifyMessages[type] = spec->second;
 	}
-
-	// Store configuration
-	store(&upsmon_conf, upsmon_conf_file);
 }
 
 
@@ -2472,21 +2578,13 @@ static void setNotifyMsgs(
  *  \brief  Set notify command in upsmon.conf
  *
  *  \param  cmd  Notify command
- *  \param  etc  Configuration directory
+ *  \param  conf Configuration files
  */
-static void setNotifyCmd(const std::string & cmd, const std::string & etc)
+static void setNotifyCmd(const std::string & cmd, ConfigFiles & conf)
 {
-	std::string upsmon_conf_file(etc + "/upsmon.conf");
-
-	nut::UpsmonConfiguration upsmon_conf;
-
-	// Source previous configuration (if any)
-	source(&upsmon_conf, upsmon_conf_file);
+	nut::UpsmonConfiguration & upsmon_conf = conf.upsmon.change();
 
 	upsmon_conf.notifyCmd = cmd;
-
-	// Store configuration
-	store(&upsmon_conf, upsmon_conf_file);
 }
 
 
@@ -2494,21 +2592,13 @@ static void setNotifyCmd(const std::string & cmd, const std::string & etc)
  *  \brief  Set shutdown command in upsmon.conf
  *
  *  \param  cmd  Shutdown command
- *  \param  etc  Configuration directory
+ *  \param  conf Configuration files
  */
-static void setShutdownCmd(const std::string & cmd, const std::string & etc)
+static void setShutdownCmd(const std::string & cmd, ConfigFiles & conf)
 {
-	std::string upsmon_conf_file(etc + "/upsmon.conf");
-
-	nut::UpsmonConfiguration upsmon_conf;
-
-	// Source previous configuration (if any)
-	source(&upsmon_conf, upsmon_conf_file);
+	nut::UpsmonConfiguration & upsmon_conf = conf.upsmon.change();
 
 	upsmon_conf.shutdownCmd = cmd;
-
-	// Store configuration
-	store(&upsmon_conf, upsmon_conf_file);
 }
 
 
@@ -2516,15 +2606,10 @@ static void setShutdownCmd(const std::string & cmd, const std::string & etc)
  *  \brief  Set minimum of power supplies in upsmon.conf
  *
  *  \param  min_supplies  Minimum of power supplies
- *  \param  etc           Configuration directory
+ *  \param  conf          Configuration files
  */
-static void setMinSupplies(const std::string & min_supplies, const std::string & etc) {
-	std::string upsmon_conf_file(etc + "/upsmon.conf");
-
-	nut::UpsmonConfiguration upsmon_conf;
-
-	// Source previous configuration (if any)
-	source(&upsmon_conf, upsmon_conf_file);
+static void setMinSupplies(const std::string & min_supplies, ConfigFiles & conf) {
+	nut::UpsmonConfiguration & upsmon_conf = conf.upsmon.change();
 
 	unsigned int min;
 
@@ -2539,9 +2624,6 @@ static void setMinSupplies(const std::string & min_supplies, const std::string &
 	}
 
 	upsmon_conf.minSupplies = min;
-
-	// Store configuration
-	store(&upsmon_conf, upsmon_conf_file);
 }
 
 
@@ -2549,20 +2631,12 @@ static void setMinSupplies(const std::string & min_supplies, const std::string &
  *  \brief  Set powerdown flag file in upsmon.conf
  *
  *  \param  powerdown_flag  Powerdown flag file
- *  \param  etc             Configuration directory
+ *  \param  conf            Configuration files
  */
-static void setPowerdownFlag(const std::string & powerdown_flag, const std::string & etc) {
-	std::string upsmon_conf_file(etc + "/upsmon.conf");
-
-	nut::UpsmonConfiguration upsmon_conf;
-
-	// Source previous configuration (if any)
-	source(&upsmon_conf, upsmon_conf_file);
+static void setPowerdownFlag(const std::string & powerdown_flag, ConfigFiles & conf) {
+	nut::UpsmonConfiguration & upsmon_conf = conf.upsmon.change();
 
 	upsmon_conf.powerDownFlag = powerdown_flag;
-
-	// Store configuration
-	store(&upsmon_conf, upsmon_conf_file);
 }
 
 
@@ -2570,31 +2644,26 @@ static void setPowerdownFlag(const std::string & powerdown_flag, const std::stri
  *  \brief  Set users in upsd.users
  *
  *  \param  users    User list
- *  \param  etc      Configuration directory
+ *  \param  conf     Configuration files
  *  \param  keep_ex  Keep existing entries (discard by default)
  */
 static void setUsers(
 	const NutConfOptions::UserSpecs & users,
-	const std::string & etc, bool keep_ex = false)
+	ConfigFiles & conf, bool keep_ex = false)
 {
-	std::string upsd_users_file(etc + "/upsd.users");
-
-	nut::UpsdUsersConfiguration upsd_users;
-
-	// Source previous configuration (if any)
-	source(&upsd_users, upsd_users_file);
+	nut::UpsdUsersConfiguration & upsd_users = conf.upsd_users.change();
 
 	// Remove existing users (unless we want to keep them)
 	if (!keep_ex) {
 		nut::UpsdUsersConfiguration::SectionMap::iterator
 			user = upsd_users.sections.begin();
 
-		for (; user != upsd_users.sections.end(); ++user) {
+		while (user != upsd_users.sections.end()) {
 			// Keep global section
 			if (user->first.empty())
-				continue;
-
-			upsd_users.sections.erase(user);
+				++user;
+			else
+				user = upsd_users.sections.erase(user);
 		}
 	}
 
@@ -2649,9 +2718,6 @@ static void setUsers(
 			upsd_users.setUpsmonMode(mode);
 		}
 	}
-
-	// Store configuration
-	store(&upsd_users, upsd_users_file);
 }
 
 
@@ -3114,6 +3180,245 @@ static void scanSerialDevices(const NutConfOptions & options) {
 #endif  // defined WITH_NUTSCANNER
 
 
+/**
+ *  \brief  Apply configuration operations
+ *
+ *  \param  options  Options (specifying the operations)
+ *  \param  conf     Configuration files
+ */
+static void apply(const NutConfOptions & options, ConfigFiles & conf) {
+	// --get-mode
+	if (options.get_mode) {
+		std::cout << getMode(conf) << std::endl;
+	}
+
+	// --set-mode
+	if (!options.mode.empty()) {
+		setMode(options.mode, conf);
+	}
+
+	// Monitors were set
+	if (!options.monitors.empty()) {
+		std::list<nut::UpsmonConfiguration::Monitor> monitors;
+
+		for (size_t n = options.monitors.size() / 6, i = 0; i < n; ++i) {
+			monitors.push_back(monitor(i, options));
+		}
+
+		setMonitors(monitors, conf, options.add_monitor_cnt > 0);
+	}
+
+	// Listen addresses were set
+	if (!options.listen_addrs.empty()) {
+		std::list<nut::UpsdConfiguration::Listen> listen_addrs;
+
+		for (size_t i = 0; i < options.listen_addrs.size(); ++i) {
+			listen_addrs.push_back(listenAddr(i, options));
+		}
+
+		setListenAddrs(listen_addrs, conf, options.add_listen_cnt > 0);
+	}
+
+	// Devices were set
+	if (!options.devices.empty()) {
+		setDevices(options.devices, conf, options.add_device_cnt > 0);
+	}
+
+	// Notify flags were set
+	if (!options.notify_flags.empty()) {
+		setNotifyFlags(options.notify_flags, conf);
+	}
+
+	// Notify messages were set
+	if (!options.notify_msgs.empty()) {
+		setNotifyMsgs(options.notify_msgs, conf);
+	}
+
+	// Notify command was set
+	if (!options.notify_cmd.empty()) {
+		setNotifyCmd(options.notify_cmd, conf);
+	}
+
+	// Shutdown command was set
+	if (!options.shutdown_cmd.empty()) {
+		setShutdownCmd(options.shutdown_cmd, conf);
+	}
+
+	// Min. of power supplies was set
+	if (!options.min_supplies.empty()) {
+		setMinSupplies(options.min_supplies, conf);
+	}
+
+	// Powerdown flag file was set
+	if (!options.powerdown_flag.empty()) {
+		setPowerdownFlag(options.powerdown_flag, conf);
+	}
+
+	// Users were set
+	if (!options.users.empty()) {
+		setUsers(options.users, conf, options.add_user_cnt > 0);
+	}
+}
+
+
+/**
+ *  \brief  Split batch file line to words
+ *
+ *  Words are separated by white space, which may be kept in a word
+ *  using single or double quotes; backslash escapes the following
+ *  character (except in single quotes).
+ *  A word starting with '#' begins a comment (till the end of line).
+ *
+ *  \param[in]   line   Line
+ *  \param[out]  words  Words
+ *
+ *  \retval true  on success
+ *  \retval false if a quotation is not terminated
+ */
+static bool splitWords(const std::string & line, std::vector<std::string> & words) {
+	std::string word;
+	bool        in_word = false;
+	char        quote   = '\0';
+
+	for (size_t i = 0; i < line.size(); ++i) {
+		char ch = line[i];
+
+		// Quoted
+		if ('\0' != quote) {
+			if (quote == ch)
+				quote = '\0';
+
+			else if ('\\' == ch && '"' == quote && i + 1 < line.size())
+				word += line[++i];
+
+			else
+				word += ch;
+
+			continue;
+		}
+
+		// Words separator
+		if (' ' == ch || '\t' == ch || '\r' == ch) {
+			if (in_word) {
+				words.push_back(word);
+				word.clear();
+				in_word = false;
+			}
+
+			continue;
+		}
+
+		// Comment
+		if ('#' == ch && !in_word)
+			break;
+
+		in_word = true;
+
+		if ('"' == ch || '\'' == ch)
+			quote = ch;
+
+		else if ('\\' == ch && i + 1 < line.size())
+			word += line[++i];
+
+		else
+			word += ch;
+	}
+
+	if ('\0' != quote)
+		return false;
+
+	if (in_word)
+		words.push_back(word);
+
+	return true;
+}
+
+
+/**
+ *  \brief  Apply configuration operations read from batch file
+ *
+ *  Each line of the file specifies operations the same way
+ *  as the command line does (only the configuration ones are
+ *  allowed, though).
+ *  Errors terminate the execution, before anything is stored.
+ *
+ *  \param  file_name  File name (\c - means standard input)
+ *  \param  prog       Program name
+ *  \param  conf       Configuration files
+ */
+static void batch(const std::string & file_name, const char * prog, ConfigFiles & conf) {
+	std::ifstream  file;
+	std::istream * input = &std::cin;
+
+	if ("-" != file_name) {
+		file.open(file_name.c_str());
+
+		if (!file.is_open()) {
+			std::cerr << "Error: Failed to open " << file_name << std::endl;
+
+			::exit(1);
+		}
+
+		input = &file;
+	}
+
+	std::string line;
+
+	for (size_t line_no = 1; std::getline(*input, line); ++line_no) {
+		std::vector<std::string> words;
+
+		if (!splitWords(line, words)) {
+			std::cerr << "Error: " << file_name << ':' << line_no
+				<< ": Unterminated quotation" << std::endl;
+
+			::exit(1);
+		}
+
+		if (words.empty())
+			continue;
+
+		// Arguments as if given on the command line
+		std::vector<char *> argv(1, const_cast<char *>(prog));
+
+		for (size_t i = 0; i < words.size(); ++i)
+			argv.push_back(const_cast<char *>(words[i].c_str()));
+
+		NutConfOptions options(&argv[0], static_cast<int>(argv.size()));
+
+		if (!options.valid) {
+			std::cerr << "Error: " << file_name << ':' << line_no
+				<< ": Invalid operations" << std::endl;
+
+			options.reportInvalid();
+
+			::exit(1);
+		}
+
+		if (options.exists("help") || options.existsSingle("h")
+		||  options.exists("version") || options.existsSingle("V")
+		||  options.autoconfigure || options.is_configured
+		||  options.system || !options.local.empty() || !options.batch.empty()
+		||  options.scan_snmp_cnt || options.scan_usb || options.scan_nut_cnt
+		||  options.scan_xml_http || options.scan_avahi || options.scan_ipmi_cnt
+		||  options.scan_serial
+		) {
+			std::cerr << "Error: " << file_name << ':' << line_no
+				<< ": Only configuration operations are allowed in batch" << std::endl;
+
+			::exit(1);
+		}
+
+		apply(options, conf);
+	}
+
+	if (input->bad()) {
+		std::cerr << "Error: Failed to read " << file_name << std::endl;
+
+		::exit(1);
+	}
+}
+
+
 /**
  *  \brief  Main routine (exceptions unsafe)
  *
@@ -3181,77 +3486,18 @@ static int mainx(int argc, char * const argv[]) {
 		::exit(is_configured ? 0 : 1);
 	}
 
-	// --get-mode
-	if (options.get_mode) {
-		std::cout << getMode(etc) << std::endl;
-	}
+	ConfigFiles conf(etc);
 
-	// --set-mode
-	if (!options.mode.empty()) {
-		setMode(options.mode, etc);
-	}
+	// Operations specified on the command line
+	apply(options, conf);
 
-	// Monitors were set
-	if (!options.monitors.empty()) {
-		std::list<nut::UpsmonConfiguration::Monitor> monitors;
-
-		for (size_t n = options.monitors.size() / 6, i = 0; i < n; ++i) {
-			monitors.push_back(monitor(i, options));
-		}
-
-		setMonitors(monitors, etc, options.add_monitor_cnt > 0);
+	// --batch
+	if (!options.batch.empty()) {
+		batch(options.batch, prog, conf);
 	}
 
-	// Listen addresses were set
-	if (!options.listen_addrs.empty()) {
-		std::list<nut::UpsdConfiguration::Listen> listen_addrs;
-
-		for (size_t i = 0; i < options.listen_addrs.size(); ++i) {
-			listen_addrs.push_back(listenAddr(i, options));
-		}
-
-		setListenAddrs(listen_addrs, etc, options.add_listen_cnt > 0);
-	}
-
-	// Devices were set
-	if (!options.devices.empty()) {
-		setDevices(options.devices, etc, options.add_device_cnt > 0);
-	}
-
-	// Notify flags were set
-	if (!options.notify_flags.empty()) {
-		setNotifyFlags(options.notify_flags, etc);
-	}
-
-	// Notify messages were set
-	if (!options.notify_msgs.empty()) {
-		setNotifyMsgs(options.notify_msgs, etc);
-	}
-
-	// Notify command was set
-	if (!options.notify_cmd.empty()) {
-		setNotifyCmd(options.notify_cmd, etc);
-	}
-
-	// Shutdown command was set
-	if (!options.shutdown_cmd.empty()) {
-		setShutdownCmd(options.shutdown_cmd, etc);
-	}
-
-	// Min. of power supplies was set
-	if (!options.min_supplies.empty()) {
-		setMinSupplies(options.min_supplies, etc);
-	}
-
-	// Powerdown flag file was set
-	if (!options.powerdown_flag.empty()) {
-		setPowerdownFlag(options.powerdown_flag, etc);
-	}
-
-	// Users were set
-	if (!options.users.empty()) {
-		setUsers(options.users, etc, options.add_user_cnt > 0);
-	}
+	// Store the changed configuration files (each once)
+	conf.store();
 
 #if (defined WITH_NUTSCANNER)
 